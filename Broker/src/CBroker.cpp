@@ -33,20 +33,34 @@
 
 #include "CAdapterFactory.hpp"
 #include "CBroker.hpp"
+#include "CCaptureLog.hpp"
 #include "CConnectionManager.hpp"
 #include "CDispatcher.hpp"
 #include "CListener.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CNetworkEmulator.hpp"
+#include "CProfiler.hpp"
+#include "CMulticastChannel.hpp"
+#include "CSharedMemoryTransport.hpp"
 #include "CGlobalConfiguration.hpp"
 #include "CGlobalPeerList.hpp"
+#include "CTelemetryWriter.hpp"
+#include "CThreadPolicy.hpp"
+#include "CTraceLog.hpp"
+#include "CWarmState.hpp"
+#include "CWatchdog.hpp"
 
 #include <boost/asio/io_service.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <map>
 
 /// General FREEDM Namespace
@@ -59,6 +73,58 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Length of a tick of the timer wheel in milliseconds
+const unsigned int WHEEL_TICK = 1;
+
+/// Number of slots of the timer wheel, one tick each
+const unsigned int WHEEL_SLOTS = 1024;
+
+/// Milliseconds a phase change can come after the phase end without being late
+const unsigned int PHASE_LATE_TOLERANCE = 1;
+
+/// Percent of its configured length a planned phase keeps at least
+const unsigned int PHASE_FLOOR_PERCENT = 25;
+
+/// Planned phases are this many times the measured busy time of the module
+const unsigned int PHASE_DEMAND_MARGIN = 2;
+
+/// Milliseconds a slice of a resumable task runs before it should yield
+const unsigned int SLICE_DURATION = 10;
+
+/// Phase changes of the scheduler
+CCounter& PhaseChangesMetric = CMetrics::Instance().GetCounter(
+    "dgi_broker_phase_changes_total", "Phase changes of the scheduler");
+
+/// Reloads of the timings file
+CCounter& TimingReloadsMetric = CMetrics::Instance().GetCounter(
+    "dgi_broker_timing_reloads_total", "Reloads of the timings file");
+
+/// Phase changes that came late
+CCounter& LatePhasesMetric = CMetrics::Instance().GetCounter(
+    "dgi_broker_late_phase_changes_total",
+    "Phase changes that came over a millisecond after the phase end");
+
+/// Slices of resumable tasks that yielded
+CCounter& YieldsMetric = CMetrics::Instance().GetCounter(
+    "dgi_broker_task_yields_total",
+    "Slices of resumable tasks that yielded before the task was done");
+
+/// Gets the synchronized milliseconds since the epoch at a time
+boost::uint64_t SynchronizedMilliseconds(boost::posix_time::ptime now)
+{
+    static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970,1,1));
+    now += CGlobalConfiguration::Instance().GetClockSkew();
+    return (now - EPOCH).total_milliseconds();
+}
+
+/// Gets the synchronized microseconds since the epoch at a time
+boost::uint64_t SynchronizedMicroseconds(boost::posix_time::ptime now)
+{
+    static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970,1,1));
+    now += CGlobalConfiguration::Instance().GetClockSkew();
+    return (now - EPOCH).total_microseconds();
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -74,36 +140,144 @@ CBroker& CBroker::Instance()
 /// Private constructor for the singleton Broker instance
 ///////////////////////////////////////////////////////////////////////////////
 CBroker::CBroker()
-    : m_phasetimer(m_ioService)
+    : m_strand(m_ioService)
+    , m_phasetimer(m_ioService)
+    , m_phaseclock(m_ioService)
+    , m_wheel(WHEEL_SLOTS)
+    , m_wheeltimer(m_ioService)
+    , m_wheelstart(CVirtualClock::Now())
+    , m_wheeltick(0)
+    , m_wheelnext(0)
+    , m_wheelarmed(false)
+    , m_overrun(false)
+    , m_pendingeffective(0)
+    , m_roundorigin(0)
+    , m_backlog(0)
     , m_synchronizer()
     , m_signals(m_ioService, SIGINT, SIGTERM)
+    , m_reload(m_ioService, SIGHUP)
     , m_stopping(false)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     m_synchronizer = boost::make_shared<CClockSynchronizer>(boost::ref(m_ioService));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @fn CBroker::~CBroker
-/// @description Cleans up all the timers from this module since the timers are
-///     stored as pointers.
+/// @fn CBroker::CTaskQueue::CTaskQueue
+/// @description Creates an empty ready queue.
+/// @pre None
+/// @post The queue has INITIAL_CAPACITY empty slots.
+///////////////////////////////////////////////////////////////////////////////
+CBroker::CTaskQueue::CTaskQueue()
+    : m_order(0)
+    , m_tasks(INITIAL_CAPACITY)
+    , m_head(0)
+    , m_size(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::CTaskQueue::Push
+/// @description Moves a task into the next free slot of the ring. The slots
+///     are kept between tasks, so queueing does not allocate unless the ring
+///     is full, in which case it is doubled.
 /// @pre None
-/// @post All the timers are destroyed and their handles no longer point at
-///     valid resources.
+/// @post The task is at the back of the queue and x is empty.
+/// @param x the task to queue
 ///////////////////////////////////////////////////////////////////////////////
-CBroker::~CBroker()
+void CBroker::CTaskQueue::Push(CBroker::BoundScheduleable& x)
 {
-    for(TimersMap::iterator it=m_timers.begin(); it!=m_timers.end(); it++)
+    if(m_size == m_tasks.size())
     {
-        delete it->second;
+        std::vector<BoundScheduleable> grown(m_tasks.size() * 2);
+        for(std::size_t i = 0; i < m_size; i++)
+        {
+            grown[i].swap(m_tasks[(m_head + i) % m_tasks.size()]);
+        }
+        m_tasks.swap(grown);
+        m_head = 0;
     }
+    m_tasks[(m_head + m_size) % m_tasks.size()].swap(x);
+    m_size++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::CTaskQueue::Push
+/// @description Moves a task with a deadline into the heap. The tasks with
+///     a deadline run in the order of their deadlines, earliest first and in
+///     the order they were queued on a tie, and all of them run before the
+///     tasks without one.
+/// @pre None
+/// @post The task is in the heap and x is empty.
+/// @param x the task to queue
+/// @param deadline the time the task should have started by
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::CTaskQueue::Push(CBroker::BoundScheduleable& x,
+    const boost::posix_time::ptime& deadline)
+{
+    m_urgent.push_back(SDeadlineTask());
+    m_urgent.back().deadline = deadline;
+    m_urgent.back().order = m_order++;
+    m_urgent.back().task.swap(x);
+    std::push_heap(m_urgent.begin(), m_urgent.end(), &CTaskQueue::Later);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::CTaskQueue::Pop
+/// @description Moves the task with the earliest deadline out of the heap,
+///     or if no task has a deadline, the task at the front of the ring out
+///     of its slot.
+/// @pre None
+/// @post The task is removed from the queue, if there was one.
+/// @param x set to the task
+/// @return False if the queue was empty.
+///////////////////////////////////////////////////////////////////////////////
+bool CBroker::CTaskQueue::Pop(CBroker::BoundScheduleable& x)
+{
+    if(!m_urgent.empty())
+    {
+        std::pop_heap(m_urgent.begin(), m_urgent.end(), &CTaskQueue::Later);
+        x.clear();
+        x.swap(m_urgent.back().task);
+        m_urgent.pop_back();
+        return true;
+    }
+    if(m_size == 0)
+    {
+        return false;
+    }
+    x.clear();
+    x.swap(m_tasks[m_head]);
+    m_head = (m_head + 1) % m_tasks.size();
+    m_size--;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::CTaskQueue::Later
+/// @description Orders the heap of tasks with deadlines so the task that is
+///     due first is on top.
+/// @param a a queued task
+/// @param b another queued task
+/// @return True if a is due after b.
+///////////////////////////////////////////////////////////////////////////////
+bool CBroker::CTaskQueue::Later(const SDeadlineTask& a, const SDeadlineTask& b)
+{
+    if(a.deadline != b.deadline)
+    {
+        return a.deadline > b.deadline;
+    }
+    return a.order > b.order;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::Run()
 /// @description Starts the adapter factory. Runs the ioservice until it is out
-///              of work. Runs the clock synchronizer.
+///              of work. Runs the clock synchronizer. With more than one
+///              broker thread the ioservice is run by a pool of threads; the
+///              handlers of the scheduler, the modules and the connections
+///              stay serialized on m_strand, other handlers run in parallel.
 /// @pre  The ioservice has some schedule of jobs waiting to be performed (so
 ///       it doesn't exit immediately).
 /// @post The ioservice has stopped.
@@ -111,7 +285,7 @@ CBroker::~CBroker()
 ///////////////////////////////////////////////////////////////////////////////
 void CBroker::Run()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
     boost::asio::ip::udp::resolver resolver(m_ioService);
@@ -121,16 +295,37 @@ void CBroker::Run()
     );
     boost::asio::ip::udp::endpoint endpoint = *(resolver.resolve(query));
 
+    // the emulated links are read before anything is sent
+    CNetworkEmulator::Instance().Start();
+
     // Listen for connections and create an event to spawn a new connection
     CListener::Instance().Start(endpoint);
+    CMulticastChannel::Instance().Start();
+    CSharedMemoryTransport::Instance().Start();
+    CTraceLog::Instance().Start();
+    device::CTelemetryWriter::Instance().Start();
+    CCaptureLog::Instance().Start();
+    CWatchdog::Instance().Start();
+    CProfiler::Instance().Start(m_ioService);
+    CMetrics::Instance().Start();
+    // the hints of the last run are read before any module starts
+    CWarmState::Instance().Start();
+    if(CGlobalConfiguration::Instance().GetPrecisePhases()
+        && m_phaseclock.Open(boost::posix_time::microseconds(
+            CGlobalConfiguration::Instance().GetPhaseSpin())))
+    {
+        LOG_NOTICE(Logger)<<"Phase boundaries use the monotonic phase clock with a "
+            <<CGlobalConfiguration::Instance().GetPhaseSpin()<<"us spin"<<std::endl;
+    }
 
     // Try to align on the first phase change
-    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::ptime now = CVirtualClock::Now();
     now += CGlobalConfiguration::Instance().GetClockSkew();
     now -= boost::posix_time::milliseconds(2 * ALIGNMENT_DURATION);
     m_last_alignment = now;
 
     m_signals.async_wait(boost::bind(&CBroker::HandleSignal, this, _1, _2));
+    m_reload.async_wait(boost::bind(&CBroker::HandleReloadSignal, this, _1, _2));
     device::CAdapterFactory::Instance(); // create it
 
     CDispatcher::Instance().RegisterReadHandler(m_synchronizer, "clk");
@@ -140,7 +335,38 @@ void CBroker::Run()
     // have finished. While the server is running, there is always at least one
     // asynchronous operation outstanding: the asynchronous accept call waiting
     // for new incoming connections.
+    boost::thread_group pool;
+    for(unsigned int i = 1; i < CGlobalConfiguration::Instance().GetBrokerThreads(); i++)
+    {
+        pool.create_thread(boost::bind(&CBroker::RunService, this));
+    }
+    CThreadPolicy::Instance().Apply("broker");
     m_ioService.run();
+    pool.join_all();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::RunService
+/// @description Runs the ioservice on an extra thread of the pool.
+/// @pre Run has started the pool.
+/// @post The ioservice has stopped.
+/// @ErrorHandling An exception that escapes a handler is logged and stops the
+///     ioservice, so that Run returns on the main thread.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::RunService()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    CThreadPolicy::Instance().Apply("broker");
+    try
+    {
+        m_ioService.run();
+    }
+    catch(std::exception& e)
+    {
+        LOG_FATAL(Logger) << "Broker thread failed: " << e.what() << std::endl;
+        m_ioService.stop();
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -150,10 +376,24 @@ void CBroker::Run()
 ///////////////////////////////////////////////////////////////////////////////
 boost::asio::io_service& CBroker::GetIOService()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return m_ioService;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetStrand
+/// @description Returns the strand that the scheduler, the module tasks and
+///     the peer connections run on. Work for them that comes from another
+///     thread, or from a handler of the ioservice that is not on the strand,
+///     must be posted to it.
+/// @return The strand of the broker.
+///////////////////////////////////////////////////////////////////////////////
+boost::asio::io_service::strand& CBroker::GetStrand()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_strand;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::Stop
 /// @description  Registers a stop command into the io_service's job queue.
@@ -166,7 +406,7 @@ boost::asio::io_service& CBroker::GetIOService()
 ///////////////////////////////////////////////////////////////////////////////
 void CBroker::Stop(unsigned int signum)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     // FIXME add code here to stop lb, gm, and sc
     // (IAgent should get a virtual Stop function)
@@ -177,7 +417,7 @@ void CBroker::Stop(unsigned int signum)
     }
 
     /* Run agents' previously-posted handlers before shutting down. */
-    m_ioService.post(boost::bind(&CBroker::HandleStop, this, signum));
+    m_strand.post(boost::bind(&CBroker::HandleStop, this, signum));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -204,6 +444,68 @@ void CBroker::HandleSignal(const boost::system::error_code& error, int signum)
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::HandleReloadSignal
+/// @description Handle the signal that reloads the timings file.
+/// @pre None
+/// @post The timings file is scheduled to be reloaded and the signal is
+///     waited for again.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::HandleReloadSignal(const boost::system::error_code& error, int)
+{
+    // The limitations of HandleSignal apply here as well.
+    if(!error)
+    {
+        m_strand.post(boost::bind(&CBroker::ReloadTimings, this));
+        m_reload.async_wait(boost::bind(&CBroker::HandleReloadSignal, this, _1, _2));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::ReloadTimings
+/// @description Loads the timings file again and takes the phases of the
+///     modules registered by timing parameter from it. In a group the phase
+///     lengths must change at the same round on every node, so the group
+///     leader publishes them once it sees the reload; without group
+///     management they are applied here at the second round boundary from
+///     now. The other timings apply to the timers armed after the reload.
+/// @pre Called on the broker strand.
+/// @post The configured phases are those of the file, unless it could not be
+///     read, in which case nothing changes.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::ReloadTimings()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    try
+    {
+        LOG_NOTICE(Logger) << "Reloading timings, " << CTimings::Reload()
+            << " values changed" << std::endl;
+    }
+    catch(std::exception& e)
+    {
+        LOG_WARN(Logger) << "Kept the old timings: " << e.what() << std::endl;
+        return;
+    }
+    TimingReloadsMetric.Increment();
+
+    std::vector<unsigned int> lengths;
+    {
+        boost::mutex::scoped_lock schlock(m_schmutex);
+        for(unsigned int i=0; i < m_configured.size(); i++)
+        {
+            if(m_phasetimings[i] != CTimings::TIMING_COUNT)
+            {
+                m_configured[i].second = CTimings::GetDuration(m_phasetimings[i]);
+            }
+            lengths.push_back(m_configured[i].second.total_milliseconds());
+        }
+    }
+    if(!IsModuleRegistered("gm") && !lengths.empty())
+    {
+        SetPhaseLengths(lengths, GetRoundBoundary(1));
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::HandleStop
 /// @description Handles closing all the sockets connection managers and
@@ -215,29 +517,42 @@ void CBroker::HandleSignal(const boost::system::error_code& error, int signum)
 ///////////////////////////////////////////////////////////////////////////////
 void CBroker::HandleStop(unsigned int signum)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if (signum > 0)
     {
-        Logger.Fatal<<"Caught signal "<<signum<<". Shutting Down..."<<std::endl;
+        LOG_FATAL(Logger)<<"Caught signal "<<signum<<". Shutting Down..."<<std::endl;
         // If we get another signal at this point, really stop right away
         m_signals.clear();
     }
 
+    m_reload.cancel();
     m_synchronizer->Stop();
     CConnectionManager::Instance().StopAll();
+    CMulticastChannel::Instance().Stop();
+    CSharedMemoryTransport::Instance().Stop();
+    CMetrics::Instance().Stop();
+    CWarmState::Instance().Stop();
 
     // The server is stopped by canceling all outstanding asynchronous
     // operations. Once all operations have been canceled, the call to
     // m_ioService.run() from CBroker::Run() will exit.
     m_ioService.stop();
+    m_phaseclock.Close();
+    CWatchdog::Instance().Stop();
+    CProfiler::Instance().Stop();
+    CCaptureLog::Instance().Stop();
 
     // We must also ensure the devices have been shut down. That's all we know.
     // The devices have their own ioservice and will handle this themselves.
     device::CAdapterFactory::Instance().Stop();
+    // the last rows of the device tables are written once no adapter runs
+    device::CTelemetryWriter::Instance().Stop();
 
     if (signum > 0)
     {
+        // Write out the queued logs before the signal ends the process.
+        CGlobalLogger::instance().StopAsync();
         raise(signum);
     }
 }
@@ -255,12 +570,15 @@ void CBroker::HandleStop(unsigned int signum)
 ///////////////////////////////////////////////////////////////////////////////
 void CBroker::RegisterModule(CBroker::ModuleIdent m, boost::posix_time::time_duration phase)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     boost::mutex::scoped_lock schlock(m_schmutex);
     boost::system::error_code err;
     if(!IsModuleRegistered(m))
     {
         m_modules.push_back(PhaseTuple(m,phase));
+        m_configured.push_back(PhaseTuple(m,phase));
+        m_phasetimings.push_back(CTimings::TIMING_COUNT);
+        m_phaseids.push_back(ResolveModule(m));
         if(m_modules.size() == 1)
         {
             schlock.unlock();
@@ -270,6 +588,29 @@ void CBroker::RegisterModule(CBroker::ModuleIdent m, boost::posix_time::time_dur
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::RegisterModule
+/// @description Registers the module with the current value of a timing
+///     parameter as its phase, which ReloadTimings updates.
+/// @pre None
+/// @post The module is registered and its phase follows the timing.
+/// @param m the identifier for the module.
+/// @param phase the timing parameter of the phase duration.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::RegisterModule(CBroker::ModuleIdent m, CTimings::ETiming phase)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    RegisterModule(m, CTimings::GetDuration(phase));
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    for(unsigned int i=0; i < m_configured.size(); i++)
+    {
+        if(m_configured[i].first == m)
+        {
+            m_phasetimings[i] = phase;
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::IsModuleRegistered
 /// @description Checks to see if a module is registered with the scheduler.
@@ -292,6 +633,103 @@ bool CBroker::IsModuleRegistered(ModuleIdent m)
     return exists;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::IsModuleRegistered
+/// @description Checks to see if the module with an id is registered with the
+///     scheduler.
+/// @pre None
+/// @post None
+/// @param m the id of the module.
+/// @return true if the module is registered with the broker.
+///////////////////////////////////////////////////////////////////////////////
+bool CBroker::IsModuleRegistered(ModuleId m)
+{
+    for(unsigned int i=0; i < m_phaseids.size(); i++)
+    {
+        if(m_phaseids[i] == m)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::CanRunInline
+/// @description Checks if a task of a module can be run by the caller instead
+///     of being scheduled. That is the case on the broker strand during the
+///     phase of the module while no task of the module is waiting, so running
+///     the task at once keeps the order the tasks would have run in.
+/// @pre None
+/// @post None
+/// @param m the id of the module.
+/// @return true if it is the phase of the module and its queue is empty.
+///////////////////////////////////////////////////////////////////////////////
+bool CBroker::CanRunInline(ModuleId m)
+{
+    if(!m_strand.running_in_this_thread())
+    {
+        return false;
+    }
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    return m_phase < m_phaseids.size() && m_phaseids[m_phase] == m
+        && m < m_ready.size() && m_ready[m].Size() == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetModuleId
+/// @description Gets the integer id of a module. Ids are assigned in order
+///     the first time a module identifier is seen, by RegisterModule,
+///     AllocateTimer or this function, and index the ready queues. Callers
+///     that schedule often can keep the id instead of the identifier.
+/// @pre None
+/// @post The module has an id, a ready queue and its metrics.
+/// @param m the identifier for the module.
+/// @return The id of the module.
+///////////////////////////////////////////////////////////////////////////////
+CBroker::ModuleId CBroker::GetModuleId(ModuleIdent m)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    return ResolveModule(m);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::ResolveModule
+/// @description Looks up the id of a module, assigning the next one if the
+///     module has none yet.
+/// @pre m_schmutex is held.
+/// @post The module has an id, a ready queue and its metrics.
+/// @param m the identifier for the module.
+/// @return The id of the module.
+///////////////////////////////////////////////////////////////////////////////
+CBroker::ModuleId CBroker::ResolveModule(const ModuleIdent& m)
+{
+    std::map<ModuleIdent, ModuleId>::const_iterator it = m_moduleids.find(m);
+    if(it != m_moduleids.end())
+    {
+        return it->second;
+    }
+    ModuleId id = m_ready.size();
+    m_ready.push_back(CTaskQueue());
+    m_phasestats.push_back(SPhaseStatistics());
+    std::string label = CMetrics::Label("module", m);
+    SModuleMetrics metrics;
+    metrics.tasks = &CMetrics::Instance().GetCounter("dgi_broker_tasks_total",
+        "Tasks that have run, by module", label);
+    metrics.overruns = &CMetrics::Instance().GetCounter(
+        "dgi_broker_phase_overruns_total",
+        "Phases that a task of the module ran past", label);
+    metrics.queue = &CMetrics::Instance().GetGauge("dgi_broker_ready_tasks",
+        "Tasks waiting in the ready queue of the module", label);
+    metrics.runtime = &CMetrics::Instance().GetHistogram(
+        "dgi_broker_task_seconds", "Run times of the tasks, by module", label);
+    metrics.memory.reset(new CSizeTracker(m, "ready"));
+    m_metrics.push_back(metrics);
+    m_moduleids.insert(std::make_pair(m, id));
+    return id;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::AllocateTimer
 /// @description Returns a handle to a timer to use for scheduling tasks.
@@ -303,18 +741,17 @@ bool CBroker::IsModuleRegistered(ModuleIdent m)
 ///////////////////////////////////////////////////////////////////////////////
 CBroker::TimerHandle CBroker::AllocateTimer(CBroker::ModuleIdent module)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     boost::mutex::scoped_lock schlock(m_schmutex);
-    CBroker::TimerHandle myhandle;
-    boost::asio::deadline_timer* t = new boost::asio::deadline_timer(m_ioService);
-    myhandle = m_handlercounter;
-    m_handlercounter++;
-    m_allocs.insert(CBroker::TimerAlloc::value_type(myhandle,module));
-    m_timers.insert(CBroker::TimersMap::value_type(myhandle,t));
-    m_nexttime.insert(CBroker::NextTimeMap::value_type(myhandle,false));
-    m_ntexpired.insert(CBroker::NextTimeMap::value_type(myhandle,false));
-    return myhandle;
+    STimer t;
+    t.module = ResolveModule(module);
+    t.armed = false;
+    t.nextround = false;
+    t.slack = boost::posix_time::pos_infin;
+    t.deadline = 0;
+    m_timers.push_back(t);
+    return m_timers.size() - 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -323,7 +760,12 @@ CBroker::TimerHandle CBroker::AllocateTimer(CBroker::ModuleIdent module)
 ///   future. The task will be scheduled to run by the Broker after the timer
 ///   expires and during the module that owns the timer's phase. The attempt to
 ///	  schedule may be rejected if the Broker is stopping, indicated by the return
-///	  value.
+///	  value. The timer is placed in the slot of the timer wheel for its
+///   deadline, so arming and cancelling it takes constant time. Setting a
+///   timer that is already armed cancels it first: the earlier task is run
+///   with operation_aborted. A timer with a slack queues its task with a
+///   deadline of the slack past the time it expires or is cancelled, so a
+///   timeout runs ahead of the tasks without a deadline that queued first.
 /// @param h The handle to the timer being set.
 /// @param wait the amount of the time to wait. If this value is "not_a_date_time"
 ///     The wait is converted to positive infinity and the time will expire as
@@ -331,6 +773,8 @@ CBroker::TimerHandle CBroker::AllocateTimer(CBroker::ModuleIdent module)
 /// @param x A schedulable, a functor, that expects a single
 /// 	boost::system::error_code parameter and returns void, created via
 ///		boost::bind()
+/// @param slack how long the task may wait in the ready queue once the timer
+///     expires, or pos_infin to queue it behind the tasks already waiting
 /// @pre The module is registered
 /// @post If the Broker is not stopping, the function is scheduled to be called
 /// 	in the future. If a next time function is scheduled, its timer will
@@ -339,9 +783,10 @@ CBroker::TimerHandle CBroker::AllocateTimer(CBroker::ModuleIdent module)
 /// @return 0 on success, -1 if rejected
 ///////////////////////////////////////////////////////////////////////////////
 int CBroker::Schedule(CBroker::TimerHandle h,
-    boost::posix_time::time_duration wait, CBroker::Scheduleable x)
+    boost::posix_time::time_duration wait, CBroker::Scheduleable x,
+    boost::posix_time::time_duration slack)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     {
         boost::unique_lock<boost::mutex> lock(m_stoppingMutex);
         if (m_stopping)
@@ -351,24 +796,225 @@ int CBroker::Schedule(CBroker::TimerHandle h,
     }
 
     boost::mutex::scoped_lock schlock(m_schmutex);
-    CBroker::Scheduleable s;
+    if(h >= m_timers.size())
+    {
+        LOG_ERROR(Logger)<<"Scheduled task for unallocated timer "<<h<<std::endl;
+        return -1;
+    }
+    STimer& t = m_timers[h];
+    if(t.armed)
+    {
+        Disarm(h);
+        Fire(h, boost::asio::error::operation_aborted);
+        if(!m_busy)
+        {
+            m_strand.post(boost::bind(&CBroker::Worker, this));
+        }
+    }
+    t.task = x;
+    t.slack = slack;
+    t.armed = true;
     if(wait.is_not_a_date_time())
     {
-        wait = boost::posix_time::time_duration(boost::posix_time::pos_infin);
-        m_nexttime[h] = true;
+        t.nextround = true;
+        t.entry = m_nextround.insert(m_nextround.end(), h);
     }
     else
     {
-        m_nexttime[h] = false;
+        // Round up, a timer never expires before its wait has passed
+        boost::posix_time::ptime now = CVirtualClock::Now();
+        boost::posix_time::time_duration offset = now + wait - m_wheelstart;
+        boost::uint64_t deadline = m_wheeltick + 1;
+        if(!offset.is_negative())
+        {
+            const boost::uint64_t tick = WHEEL_TICK * 1000;
+            const boost::uint64_t us = offset.total_microseconds();
+            if((us + tick - 1) / tick > deadline)
+            {
+                deadline = (us + tick - 1) / tick;
+            }
+        }
+        t.nextround = false;
+        t.deadline = deadline;
+        TimerList& slot = m_wheel[deadline % WHEEL_SLOTS];
+        t.entry = slot.insert(slot.end(), h);
+        ArmWheel(deadline);
     }
-    m_timers[h]->expires_from_now(wait);
-    s = boost::bind(&CBroker::ScheduledTask,this,x,h,boost::asio::placeholders::error);
-    Logger.Debug<<"Scheduled task for timer "<<h<<std::endl;
-    m_timers[h]->async_wait(s);
+    LOG_DEBUG(Logger)<<"Scheduled task for timer "<<h<<std::endl;
 
     return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Expire
+/// @description Ends the wait of an armed timer early. The task is queued for
+///   the module that owns the timer as if the wait had passed, so it is called
+///   without an error, rather than with the operation_aborted that setting
+///   the timer again would give the earlier task.
+/// @param h The handle to the timer to expire.
+/// @pre None.
+/// @post If the timer was armed, its task is in the ready queue of its module
+///   and the timer is not armed.
+/// @return 0 on success, -1 if the timer was not armed
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::Expire(CBroker::TimerHandle h)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    if(h >= m_timers.size() || !m_timers[h].armed)
+    {
+        return -1;
+    }
+    Disarm(h);
+    Fire(h, boost::system::error_code());
+    if(!m_busy)
+    {
+        m_strand.post(boost::bind(&CBroker::Worker, this));
+    }
+    LOG_DEBUG(Logger)<<"Expired timer "<<h<<" early"<<std::endl;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Disarm
+/// @description Takes an armed timer out of the wheel slot or the list of
+///     next round timers that holds it.
+/// @pre m_schmutex is held and the timer is armed.
+/// @post The timer is not armed. Its task is kept.
+/// @param handle the timer to disarm
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::Disarm(CBroker::TimerHandle handle)
+{
+    STimer& t = m_timers[handle];
+    if(t.nextround)
+    {
+        m_nextround.erase(t.entry);
+    }
+    else
+    {
+        m_wheel[t.deadline % WHEEL_SLOTS].erase(t.entry);
+    }
+    t.armed = false;
+    t.nextround = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Fire
+/// @description Binds the task of a timer to an error code and adds it to
+///     the ready queue of the module that owns the timer, with a deadline if
+///     the timer has a slack.
+/// @pre m_schmutex is held and the timer has been disarmed.
+/// @post The task is in the ready queue and the timer holds no task.
+/// @param handle the timer that expired or was cancelled
+/// @param err the error code the task is called with
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::Fire(CBroker::TimerHandle handle, const boost::system::error_code &err)
+{
+    STimer& t = m_timers[handle];
+    LOG_DEBUG(Logger)<<"Handle finished: "<<handle<<" For module "<<t.module<<std::endl;
+    CBroker::BoundScheduleable y = boost::bind(t.task, err);
+    if(t.slack.is_special())
+    {
+        m_ready[t.module].Push(y);
+    }
+    else
+    {
+        m_ready[t.module].Push(y, CVirtualClock::Now() + t.slack);
+    }
+    NoteQueueDepth(t.module);
+    t.task.clear();
+    LOG_DEBUG(Logger)<<"Module "<<t.module<<" now has queue size: "<<m_ready[t.module].Size()<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::ArmWheel
+/// @description Sets the timer that drives the wheel to go off on a tick,
+///     unless it is already set to go off sooner.
+/// @pre m_schmutex is held.
+/// @post The wheel timer goes off no later than the tick.
+/// @param tick the wheel tick to go off on
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::ArmWheel(boost::uint64_t tick)
+{
+    if(m_wheelarmed && m_wheelnext <= tick)
+    {
+        return;
+    }
+    m_wheelarmed = true;
+    m_wheelnext = tick;
+    // a wait cancelled by this is ignored, and a turn that was already
+    // queued only turns the wheel early
+    m_wheeltimer.expires_at(m_wheelstart +
+        boost::posix_time::milliseconds(tick * WHEEL_TICK));
+    m_wheeltimer.async_wait(m_strand.wrap(boost::bind(&CBroker::TurnWheel,
+        this, boost::asio::placeholders::error)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::TurnWheel
+/// @description Advances the timer wheel to the current tick. The timers of
+///     each slot passed whose deadline has come are fired, the others belong
+///     to a later turn of the wheel. Then the wheel timer is set for the next
+///     slot that holds a timer.
+/// @pre The wheel timer went off.
+/// @post The tasks of the expired timers are in their modules' ready queues
+///     and the worker is running if there is work for the active module.
+/// @param err The error code of the wheel timer.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::TurnWheel(const boost::system::error_code &err)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(err == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    m_wheelarmed = false;
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    boost::uint64_t end = (now - m_wheelstart).total_milliseconds() / WHEEL_TICK;
+    boost::uint64_t tick = m_wheeltick;
+    if(end < tick)
+    {
+        end = tick;
+    }
+    // behind by more than a turn: every slot is visited once
+    if(end - tick > WHEEL_SLOTS)
+    {
+        tick = end - WHEEL_SLOTS;
+    }
+    for(tick++; tick <= end; tick++)
+    {
+        TimerList& slot = m_wheel[tick % WHEEL_SLOTS];
+        TimerList::iterator it = slot.begin();
+        while(it != slot.end())
+        {
+            TimerHandle h = *it++;
+            if(m_timers[h].deadline <= end)
+            {
+                Disarm(h);
+                Fire(h, boost::system::error_code());
+            }
+        }
+    }
+    m_wheeltick = end;
+    for(unsigned int i = 1; i <= WHEEL_SLOTS; i++)
+    {
+        if(!m_wheel[(end + i) % WHEEL_SLOTS].empty())
+        {
+            ArmWheel(end + i);
+            break;
+        }
+    }
+    if(!m_busy)
+    {
+        schlock.unlock();
+        Worker();
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::Schedule
 /// @description Given a module and a task, put that task into that modules
@@ -388,7 +1034,96 @@ int CBroker::Schedule(CBroker::TimerHandle h,
 ///////////////////////////////////////////////////////////////////////////////
 int CBroker::Schedule(ModuleIdent m, BoundScheduleable x, bool start_worker)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return Schedule(GetModuleId(m), x, start_worker);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Schedule
+/// @description Given a module id and a task, put that task into that
+///     module's job queue. The attempt to schedule will be rejected if the
+///     Broker is stopping.
+/// @pre The id was returned by GetModuleId.
+/// @post The task is placed in the work queue for the module m. If the
+///     start_worker parameter is set to true, the module's worker will be
+///     activated if it isn't already.
+/// @param m The id of the module the schedulable should be run as.
+/// @param x The method that will be run. A functor that expects no parameters
+///		and returns void. Created via boost::bind()
+/// @param start_worker tells the worker to begin processing again, if it is
+///     currently idle.
+/// @return 0 on success, -1 if rejected because the Broker is stopping or
+///     the id is unknown.
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::Schedule(ModuleId m, BoundScheduleable x, bool start_worker)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return Enqueue(m, x, boost::posix_time::pos_infin, start_worker);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Schedule
+/// @description Given a module and a task with a deadline, put that task
+///     into that module's job queue. Within the module's phase the tasks with
+///     a deadline run earliest deadline first, ahead of the tasks without one,
+///     so a timeout is not held up behind a pile of message handlers.
+/// @pre The module is registered.
+/// @post The task is placed in the work queue for the module m.
+/// @param m The module the schedulable should be run as.
+/// @param x The method that will be run.
+/// @param slack how long the task may wait from now before it should run, or
+///     pos_infin to queue it behind the tasks already waiting.
+/// @param start_worker tells the worker to begin processing again, if it is
+///     currently idle.
+/// @return 0 on success, -1 if rejected because the Broker is stopping.
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::Schedule(ModuleIdent m, BoundScheduleable x,
+    boost::posix_time::time_duration slack, bool start_worker)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return Enqueue(GetModuleId(m), x, slack, start_worker);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Schedule
+/// @description Given a module id and a task with a deadline, put that task
+///     into that module's job queue, ahead of the tasks due later.
+/// @pre The id was returned by GetModuleId.
+/// @post The task is placed in the work queue for the module m.
+/// @param m The id of the module the schedulable should be run as.
+/// @param x The method that will be run.
+/// @param slack how long the task may wait from now before it should run, or
+///     pos_infin to queue it behind the tasks already waiting.
+/// @param start_worker tells the worker to begin processing again, if it is
+///     currently idle.
+/// @return 0 on success, -1 if rejected because the Broker is stopping or
+///     the id is unknown.
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::Schedule(ModuleId m, BoundScheduleable x,
+    boost::posix_time::time_duration slack, bool start_worker)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return Enqueue(m, x, slack, start_worker);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::Enqueue
+/// @description Puts a task into a module's job queue, with a deadline of
+///     the slack from now unless the slack is special.
+/// @pre None
+/// @post The task is placed in the work queue for the module m, and x is
+///     empty.
+/// @param m The id of the module the schedulable should be run as.
+/// @param x The method that will be run.
+/// @param slack how long the task may wait, or pos_infin for no deadline.
+/// @param start_worker tells the worker to begin processing again, if it is
+///     currently idle.
+/// @return 0 on success, -1 if rejected because the Broker is stopping or
+///     the id is unknown.
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::Enqueue(ModuleId m, BoundScheduleable& x,
+    const boost::posix_time::time_duration& slack, bool start_worker)
+{
     {
         boost::unique_lock<boost::mutex> lock(m_stoppingMutex);
         if (m_stopping)
@@ -398,18 +1133,106 @@ int CBroker::Schedule(ModuleIdent m, BoundScheduleable x, bool start_worker)
     }
 
     boost::mutex::scoped_lock schlock(m_schmutex);
-    m_ready[m].push_back(x);
+    if(m >= m_ready.size())
+    {
+        LOG_ERROR(Logger)<<"Scheduled task for unknown module "<<m<<std::endl;
+        return -1;
+    }
+    if(slack.is_special())
+    {
+        m_ready[m].Push(x);
+    }
+    else
+    {
+        m_ready[m].Push(x, CVirtualClock::Now() + slack);
+    }
+    NoteQueueDepth(m);
+    LOG_DEBUG(Logger)<<"Module "<<m<<" now has queue size: "<<m_ready[m].Size()<<std::endl;
+    LOG_DEBUG(Logger)<<"Scheduled task (NODELAY) for "<<m<<std::endl;
     if(!m_busy && start_worker)
     {
         schlock.unlock();
         Worker();
-        schlock.lock();
     }
-    Logger.Debug<<"Module "<<m<<" now has queue size: "<<m_ready[m].size()<<std::endl;
-    Logger.Debug<<"Scheduled task (NODELAY) for "<<m<<std::endl;
     return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::ScheduleResumable
+/// @description Schedules a task that can spread a long computation over
+///     several runs. The task does a slice of its work, calls ShouldYield
+///     between steps and returns false to yield once it is true, keeping
+///     whatever it needs to resume in the state it is bound to. The rest of
+///     the task is queued behind the module's other tasks, so it resumes
+///     later in the phase if there is time left, or in the module's next
+///     phase otherwise. It returns true once it is done.
+/// @pre The module is registered.
+/// @post The first slice of the task is in the module's ready queue.
+/// @param m The module the task should be run as.
+/// @param x The resumable task, created via boost::bind().
+/// @return 0 on success, -1 if rejected because the Broker is stopping.
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::ScheduleResumable(ModuleIdent m, ResumableScheduleable x)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return ScheduleResumable(GetModuleId(m), x);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::ScheduleResumable
+/// @description Schedules a resumable task for a module identified by its
+///     integer id.
+/// @pre The id was returned by GetModuleId.
+/// @post The first slice of the task is in the module's ready queue.
+/// @param m The id of the module the task should be run as.
+/// @param x The resumable task, created via boost::bind().
+/// @return 0 on success, -1 if rejected because the Broker is stopping or
+///     the id is unknown.
+///////////////////////////////////////////////////////////////////////////////
+int CBroker::ScheduleResumable(ModuleId m, ResumableScheduleable x)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    BoundScheduleable slice = boost::bind(&CBroker::RunSlice, this, m, x);
+    return Enqueue(m, slice, boost::posix_time::pos_infin, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::RunSlice
+/// @description Runs a slice of a resumable task. If the task yields it goes
+///     to the back of the module's ready queue, so the tasks queued since run
+///     first.
+/// @pre Run by the worker in the phase of the module.
+/// @post The task is done or queued again, unless the Broker is stopping.
+/// @param m The id of the module the task is run as.
+/// @param x The resumable task.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::RunSlice(ModuleId m, ResumableScheduleable x)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!x())
+    {
+        YieldsMetric.Increment();
+        BoundScheduleable slice = boost::bind(&CBroker::RunSlice, this, m, x);
+        Enqueue(m, slice, boost::posix_time::pos_infin, true);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::ShouldYield
+/// @description Tells a long task that it should stop and continue later:
+///     it has run for a slice, or its module's phase is over. Any task can
+///     ask, but only a resumable task can act on the answer.
+/// @pre Called from a task run by the worker.
+/// @post None
+/// @return True if the task should return and resume later.
+///////////////////////////////////////////////////////////////////////////////
+bool CBroker::ShouldYield()
+{
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    return now >= m_phaseends
+        || now - m_taskstart >= boost::posix_time::milliseconds(SLICE_DURATION);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn CBroker::ChangePhase
 /// @description Changes the current active module when time allotted to the
@@ -422,7 +1245,7 @@ int CBroker::Schedule(ModuleIdent m, BoundScheduleable x, bool start_worker)
 ///////////////////////////////////////////////////////////////////////////////
 void CBroker::ChangePhase(const boost::system::error_code & /*err*/)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(m_modules.size() == 0)
     {
         m_phase=0;
@@ -432,25 +1255,49 @@ void CBroker::ChangePhase(const boost::system::error_code & /*err*/)
     // Past this point assume there is at least one module.
     boost::mutex::scoped_lock schlock(m_schmutex);
     m_phase++;
-    // Get the time without millisec and with millisec then see how many millsec we
-    // are into this second.
+    // Get the synchronized time then see how many millsec we are into this
+    // round.
     // Generate a clock beacon
-    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
-    boost::posix_time::time_duration time = now.time_of_day();
-    time += CGlobalConfiguration::Instance().GetClockSkew();
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    boost::uint64_t usecs = SynchronizedMicroseconds(now);
+    boost::uint64_t millisecs = usecs / 1000;
+    // the phase clock sets every boundary from the round, so nothing drifts
+    bool realign = m_phaseclock.IsOpen();
+
+    m_schedstats.changes++;
+    PhaseChangesMetric.Increment();
+    if(!m_phaseends.is_special())
+    {
+        boost::posix_time::time_duration late = now - m_phaseends;
+        if(late > boost::posix_time::milliseconds(PHASE_LATE_TOLERANCE))
+        {
+            m_schedstats.late++;
+            LatePhasesMetric.Increment();
+        }
+        if(late > m_schedstats.maxlate)
+        {
+            m_schedstats.maxlate = late;
+        }
+    }
 
     if(m_phase >= m_modules.size())
     {
         m_phase = 0;
     }
-    unsigned int round = 0;
-    for(unsigned int i=0; i < m_modules.size(); i++)
+    // New phase lengths start a new round on every node at the same time.
+    if(!m_pendinglengths.empty() && millisecs >= m_pendingeffective)
     {
-        round += m_modules[i].second.total_milliseconds();
+        for(unsigned int i=0; i < m_modules.size(); i++)
+        {
+            m_modules[i].second = boost::posix_time::milliseconds(m_pendinglengths[i]);
+        }
+        m_roundorigin = m_pendingeffective;
+        m_pendinglengths.clear();
+        realign = true;
     }
+    unsigned int round = RoundLength();
     assert(round > 0);
-    unsigned int millisecs = time.total_milliseconds();
-    unsigned int intoround = (millisecs % round);
+    unsigned int intoround = IntoRound(millisecs, round);
     unsigned int cphase = 0;
     unsigned int tmp = m_modules[0].second.total_milliseconds();
     // Pre: Assume it should be the first phase.
@@ -470,9 +1317,23 @@ void CBroker::ChangePhase(const boost::system::error_code & /*err*/)
     // what phase it should be and then schedule that phase?
     // As an aside, you could tune alignment duration down to 0 so that every
     // phase is specifically assigned to a time slice.
-    if(now-m_last_alignment > boost::posix_time::milliseconds(ALIGNMENT_DURATION))
+    if(realign || now-m_last_alignment > boost::posix_time::milliseconds(ALIGNMENT_DURATION))
     {
-        Logger.Notice<<"Aligned phase to "<<cphase<<" (was "<<m_phase<<") for "
+        m_schedstats.alignments++;
+        if(cphase != m_phase)
+        {
+            m_schedstats.misaligned++;
+        }
+        else
+        {
+            int drift = static_cast<int>(remaining) - static_cast<int>(sched_duration);
+            m_schedstats.drift = drift;
+            if(std::abs(drift) > m_schedstats.maxdrift)
+            {
+                m_schedstats.maxdrift = std::abs(drift);
+            }
+        }
+        LOG_NOTICE(Logger)<<"Aligned phase to "<<cphase<<" (was "<<m_phase<<") for "
                    <<remaining<<" ms"<<std::endl;
 
 
@@ -480,42 +1341,67 @@ void CBroker::ChangePhase(const boost::system::error_code & /*err*/)
         m_last_alignment = now;
         sched_duration = remaining;
     }
+    // End the phase early rather than miss the start of a new schedule.
+    if(!m_pendinglengths.empty() && m_pendingeffective > millisecs
+        && m_pendingeffective - millisecs < sched_duration)
+    {
+        sched_duration = m_pendingeffective - millisecs;
+    }
     if(m_modules.size() > 0)
     {
-        Logger.Notice<<"Phase: "<<m_modules[m_phase].first<<" for "<<sched_duration<<"ms "<<"offset "<<CGlobalConfiguration::Instance().GetClockSkew()<<std::endl;
+        CProfiler::Instance().SetPhase(m_phase, m_modules[m_phase].first);
+        LOG_NOTICE(Logger)<<"Phase: "<<m_modules[m_phase].first<<" for "<<sched_duration<<"ms "<<"offset "<<CGlobalConfiguration::Instance().GetClockSkew()<<std::endl;
     }
     if(m_phase != oldphase)
     {
         CConnectionManager::Instance().ChangePhase((m_phase==0));
         ModuleIdent oldident = m_modules[oldphase].first;
-        Logger.Notice<<"Changed Phase: expiring next time timers for "<<oldident<<std::endl;
-        // Look through the timers for the module and see if any of them are
-        // set for next time:
-        BOOST_FOREACH(CBroker::TimerAlloc::value_type t, m_allocs)
+        ModuleId oldid = m_phaseids[oldphase];
+        LOG_NOTICE(Logger)<<"Changed Phase: expiring next time timers for "<<oldident<<std::endl;
+        // Expire the timers of the module that are set for next time; their
+        // tasks run with success the next time the module is active.
+        TimerList::iterator it = m_nextround.begin();
+        while(it != m_nextround.end())
         {
-            Logger.Debug<<"Examine timer "<<t.first<<" for module "<<t.second<<" expire nexttime: "
-                        <<m_nexttime[t.first]<<std::endl;
-            if(t.second == oldident && m_nexttime[t.first] == true)
+            TimerHandle h = *it++;
+            if(m_timers[h].module == oldid)
             {
-                Logger.Notice<<"Scheduling task for next time timer: "<<t.first<<std::endl;
-                m_timers[t.first]->cancel();
-                m_nexttime[t.first] = false;
-                m_ntexpired[t.first] = true;
+                LOG_NOTICE(Logger)<<"Scheduling task for next time timer: "<<h<<std::endl;
+                Disarm(h);
+                Fire(h, boost::system::error_code());
             }
         }
     }
     //If the worker isn't going, start him again when you change phases.
     boost::posix_time::time_duration r = boost::posix_time::milliseconds(sched_duration);
+    if(m_phaseclock.IsOpen())
+    {
+        // the boundary is a whole synchronized millisecond, now is past one
+        r -= boost::posix_time::microseconds(usecs % 1000);
+    }
     m_phaseends = now + r;
+    m_phasestats[m_phaseids[m_phase]].phases++;
+    if(CTraceLog::Instance().IsEnabled())
+    {
+        CTraceLog::Instance().Emit(TRACE_PHASE, m_modules[m_phase].first.c_str(),
+            std::string(), 0, sched_duration);
+    }
+    m_overrun = false;
     if(!m_busy)
     {
         schlock.unlock();
         Worker();
         schlock.lock();
     }
+    if(m_phaseclock.IsOpen())
+    {
+        m_phaseclock.Arm(m_phaseends, m_strand.wrap(boost::bind(
+            &CBroker::ChangePhase, this, boost::asio::placeholders::error)));
+        return;
+    }
     m_phasetimer.expires_from_now(r);
-    m_phasetimer.async_wait(boost::bind(&CBroker::ChangePhase,this,
-        boost::asio::placeholders::error));
+    m_phasetimer.async_wait(m_strand.wrap(boost::bind(&CBroker::ChangePhase,this,
+        boost::asio::placeholders::error)));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -532,42 +1418,7 @@ void CBroker::ChangePhase(const boost::system::error_code & /*err*/)
 ///////////////////////////////////////////////////////////////////////////////
 boost::posix_time::time_duration CBroker::TimeRemaining()
 {
-    return m_phaseends - boost::posix_time::microsec_clock::universal_time();
-}
-
-///////////////////////////////////////////////////////////////////////////////
-/// @fn CBroker::ScheduledTask
-/// @description When a timer for a task expires, this function is called to
-/// 	insert the readied task into owning module's ready task queue.
-/// @pre A task is scheduled for execution
-/// @post The task is entered into th ready queue.
-///////////////////////////////////////////////////////////////////////////////
-void CBroker::ScheduledTask(CBroker::Scheduleable x, CBroker::TimerHandle handle,
-    const boost::system::error_code &err)
-{
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    boost::mutex::scoped_lock schlock(m_schmutex);
-    ModuleIdent module = m_allocs[handle];
-    boost::system::error_code serr;
-    if(m_ntexpired[handle])
-    {
-        m_ntexpired[handle] = false;
-    }
-    else
-    {
-        serr = err;
-    }
-    Logger.Debug<<"Handle finished: "<<handle<<" For module "<<module<<std::endl;
-    // First, prepare another bind, which uses the given error
-    CBroker::BoundScheduleable y = boost::bind(x,serr);
-    // Put it into the ready queue
-    m_ready[module].push_back(y);
-    Logger.Debug<<"Module "<<module<<" now has queue size: "<<m_ready[module].size()<<std::endl;
-    if(!m_busy)
-    {
-        schlock.unlock();
-        Worker();
-    }
+    return m_phaseends - CVirtualClock::Now();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -581,26 +1432,35 @@ void CBroker::ScheduledTask(CBroker::Scheduleable x, CBroker::TimerHandle handle
 ///////////////////////////////////////////////////////////////////////////////
 void CBroker::Worker()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     boost::mutex::scoped_lock schlock(m_schmutex);
     if(m_phase >= m_modules.size())
     {
         m_busy = false;
         return;
     }
-    ModuleIdent active = m_modules[m_phase].first;
-    if(m_ready[active].size() > 0)
+    ModuleId active = m_phaseids[m_phase];
+    CBroker::BoundScheduleable x;
+    if(m_ready[active].Pop(x))
     {
-        Logger.Debug<<"Performing Job"<<std::endl;
+        NoteQueueSize(active);
+        LOG_DEBUG(Logger)<<"Performing Job"<<std::endl;
         // Mark that the worker has something to do
         m_busy = true;
-        // Extract the first item from the work queue:
-        CBroker::BoundScheduleable x = m_ready[active].front();
-        m_ready[active].pop_front();
+        boost::posix_time::ptime phaseends = m_phaseends;
+        boost::posix_time::ptime start =
+            CVirtualClock::Now();
+        m_taskstart = start;
         // Execute the task.
+        CWatchdog::Instance().BeginTask(m_modules[m_phase].first);
+        CProfiler::Instance().BeginTask();
         schlock.unlock();
         x();
+        CProfiler::Instance().EndTask();
+        CWatchdog::Instance().EndTask();
         schlock.lock();
+        NoteTask(active, start,
+            CVirtualClock::Now(), phaseends);
     }
     else
     {
@@ -608,7 +1468,396 @@ void CBroker::Worker()
         return;
     }
     // Schedule the worker again:
-    m_ioService.post(boost::bind(&CBroker::Worker, this));
+    m_strand.post(boost::bind(&CBroker::Worker, this));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::NoteQueueSize
+/// @description Updates the queue depth and the memory metrics of a module's
+///     ready queue, and the backlog the listener admits datagrams by. The
+///     ring keeps its slots when tasks leave, so the bytes follow the slots
+///     rather than the tasks.
+/// @pre m_schmutex is held and the queue of the module just changed.
+/// @post The metrics of the module match its queue and m_backlog is the
+///     size of the longest queue.
+/// @param m the module whose queue changed
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::NoteQueueSize(ModuleId m)
+{
+    m_metrics[m].queue->Set(m_ready[m].Size());
+    m_metrics[m].memory->Update(m_ready[m].Size(),
+        m_ready[m].Capacity() * sizeof(BoundScheduleable));
+
+    std::size_t backlog = 0;
+    for(std::size_t i = 0; i < m_ready.size(); i++)
+    {
+        backlog = std::max(backlog, m_ready[i].Size());
+    }
+    m_backlog = backlog;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::NoteQueueDepth
+/// @description Raises the high water mark of a module's ready queue and
+///     updates its queue depth metric.
+/// @pre m_schmutex is held and a task was just added to the queue.
+/// @post maxqueue of the module is at least the size of its queue.
+/// @param m the module whose queue grew
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::NoteQueueDepth(ModuleId m)
+{
+    NoteQueueSize(m);
+    if(m_ready[m].Size() > m_phasestats[m].maxqueue)
+    {
+        m_phasestats[m].maxqueue = m_ready[m].Size();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::NoteTask
+/// @description Adds the run of a task to the statistics of its module. A
+///     task that finishes after the end of the phase it started in is an
+///     overrun; each phase is counted once.
+/// @pre m_schmutex is held.
+/// @post The statistics of the module include the task.
+/// @param m the module the task ran as
+/// @param start when the task started
+/// @param end when the task returned
+/// @param phaseends the end of the phase when the task started
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::NoteTask(ModuleId m, const boost::posix_time::ptime& start,
+    const boost::posix_time::ptime& end, const boost::posix_time::ptime& phaseends)
+{
+    SPhaseStatistics& stats = m_phasestats[m];
+    boost::posix_time::time_duration run = end - start;
+    stats.tasks++;
+    stats.busy += run;
+    if(run > stats.longest)
+    {
+        stats.longest = run;
+    }
+    unsigned int bucket = 0;
+    boost::uint64_t us = run.is_negative() ? 0 : run.total_microseconds();
+    while(us > 1 && bucket + 1 < LATENCY_BUCKETS)
+    {
+        us >>= 1;
+        bucket++;
+    }
+    stats.latency[bucket]++;
+    m_metrics[m].tasks->Increment();
+    m_metrics[m].runtime->Observe(run.is_negative() ? 0 :
+        run.total_microseconds() / 1e6);
+    if(!phaseends.is_special() && end > phaseends && !m_overrun &&
+        phaseends == m_phaseends)
+    {
+        stats.overruns++;
+        m_metrics[m].overruns->Increment();
+        m_overrun = true;
+        LOG_INFO(Logger)<<"Module "<<m_modules[m_phase].first<<" overran its phase by "
+            <<(end - phaseends).total_milliseconds()<<" ms"<<std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetPhaseStatistics
+/// @description Gets the task run times, phase overruns and ready queue
+///     depth recorded for a module since the scheduler started.
+/// @pre None
+/// @post None
+/// @param m the identifier for the module.
+/// @return The statistics of the module, all zero if it has not been seen.
+///////////////////////////////////////////////////////////////////////////////
+SPhaseStatistics CBroker::GetPhaseStatistics(ModuleIdent m)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    std::map<ModuleIdent, ModuleId>::const_iterator it = m_moduleids.find(m);
+    if(it == m_moduleids.end())
+    {
+        return SPhaseStatistics();
+    }
+    return m_phasestats[it->second];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetSchedulerStatistics
+/// @description Gets how many phase changes came late and how far the
+///     phases drifted from the round clock at the alignment checks.
+/// @pre None
+/// @post None
+/// @return The phase change statistics.
+///////////////////////////////////////////////////////////////////////////////
+SSchedulerStatistics CBroker::GetSchedulerStatistics()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    return m_schedstats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::TakePhaseDemand
+/// @description Gets the average time each module spent running tasks in one
+///     of its phases since the last call, so the group leader can size the
+///     phases for the workload.
+/// @pre None
+/// @post The next call measures from this point.
+/// @return Busy microseconds per phase of each module, in registration order.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<unsigned int> CBroker::TakePhaseDemand()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    std::vector<unsigned int> demand;
+    m_demandbase.resize(m_phasestats.size());
+    for(unsigned int i=0; i < m_phaseids.size(); i++)
+    {
+        const SPhaseStatistics& now = m_phasestats[m_phaseids[i]];
+        const SPhaseStatistics& base = m_demandbase[m_phaseids[i]];
+        unsigned int phases = now.phases - base.phases;
+        boost::posix_time::time_duration busy = now.busy - base.busy;
+        demand.push_back(phases > 0 ? busy.total_microseconds() / phases : 0);
+    }
+    m_demandbase = m_phasestats;
+    return demand;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetPhaseLengths
+/// @description Gets the lengths of the phases the scheduler is running.
+/// @pre None
+/// @post None
+/// @return Phase length of each module in milliseconds, in registration order.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<unsigned int> CBroker::GetPhaseLengths()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    std::vector<unsigned int> lengths;
+    for(unsigned int i=0; i < m_modules.size(); i++)
+    {
+        lengths.push_back(m_modules[i].second.total_milliseconds());
+    }
+    return lengths;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetConfiguredLengths
+/// @description Gets the phase lengths the modules were registered with, as
+///     updated by the last reload of the timings file.
+/// @pre None
+/// @post None
+/// @return The configured phase length of each module in milliseconds, in
+///     registration order.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<unsigned int> CBroker::GetConfiguredLengths()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    std::vector<unsigned int> lengths;
+    for(unsigned int i=0; i < m_configured.size(); i++)
+    {
+        lengths.push_back(m_configured[i].second.total_milliseconds());
+    }
+    return lengths;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::PlanPhaseLengths
+/// @description Divides the configured round between the modules by their
+///     measured busy time. Each module is given room for PHASE_DEMAND_MARGIN
+///     times its busy time but no less than PHASE_FLOOR_PERCENT of its
+///     configured phase, and the time left over is shared in proportion to
+///     that. The round keeps its configured length so the other timings
+///     derived from it still hold.
+/// @pre None
+/// @post None
+/// @param demand busy microseconds per phase of each module, as given by
+///     TakePhaseDemand.
+/// @return The planned phase lengths in milliseconds, the configured lengths
+///     if the modules need more than the whole round.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<unsigned int> CBroker::PlanPhaseLengths(const std::vector<unsigned int>& demand)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    std::vector<unsigned int> configured, want;
+    unsigned int round = 0, wanted = 0;
+    for(unsigned int i=0; i < m_configured.size(); i++)
+    {
+        unsigned int length = m_configured[i].second.total_milliseconds();
+        unsigned int floor = length * PHASE_FLOOR_PERCENT / 100;
+        unsigned int need = 0;
+        if(i < demand.size())
+        {
+            need = (demand[i] * PHASE_DEMAND_MARGIN + 999) / 1000;
+        }
+        if(floor == 0)
+        {
+            floor = 1;
+        }
+        configured.push_back(length);
+        want.push_back(need > floor ? need : floor);
+        round += length;
+        wanted += want.back();
+    }
+    if(wanted >= round)
+    {
+        return configured;
+    }
+    std::vector<unsigned int> lengths;
+    unsigned int planned = 0, largest = 0;
+    for(unsigned int i=0; i < want.size(); i++)
+    {
+        boost::uint64_t share = boost::uint64_t(round - wanted) * want[i] / wanted;
+        lengths.push_back(want[i] + share);
+        planned += lengths.back();
+        if(lengths[i] > lengths[largest])
+        {
+            largest = i;
+        }
+    }
+    lengths[largest] += round - planned;
+    return lengths;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetRoundBoundary
+/// @description Finds when a round starts on the synchronized clock, which
+///     is the same instant on every node of the group.
+/// @pre At least one module is registered.
+/// @post None
+/// @param rounds how many complete rounds to leave before the boundary.
+/// @return Synchronized milliseconds since the epoch the round starts.
+///////////////////////////////////////////////////////////////////////////////
+boost::uint64_t CBroker::GetRoundBoundary(unsigned int rounds)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    boost::uint64_t millisecs = SynchronizedMilliseconds(now);
+    unsigned int round = RoundLength();
+    return millisecs - IntoRound(millisecs, round) + boost::uint64_t(rounds + 1) * round;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::SetPhaseLengths
+/// @description Sets new phase lengths for the modules. The current lengths
+///     run until the given round boundary, where the first phase of a round
+///     with the new lengths begins.
+/// @pre lengths has a non-zero length for each registered module.
+/// @post The lengths replace any that are still pending. They are ignored if
+///     they do not match the registered modules.
+/// @param lengths phase length of each module in milliseconds, in
+///     registration order.
+/// @param effective the synchronized milliseconds since the epoch the new
+///     round starts.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::SetPhaseLengths(const std::vector<unsigned int>& lengths,
+    boost::uint64_t effective)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock schlock(m_schmutex);
+    if(lengths.size() != m_modules.size() ||
+        std::find(lengths.begin(), lengths.end(), 0u) != lengths.end())
+    {
+        LOG_WARN(Logger) << "Ignored phase lengths for " << lengths.size()
+            << " modules" << std::endl;
+        return;
+    }
+    m_pendinglengths = lengths;
+    m_pendingeffective = effective;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::SetStateDigest
+/// @description Sets the load balance state of this node that the group
+///     management and clock messages carry to the peers, so that the load
+///     balance module does not have to broadcast it in rounds of its own.
+/// @pre None
+/// @post The messages made from now on carry the digest.
+/// @param digest the state, with an epoch greater than the last one set.
+///////////////////////////////////////////////////////////////////////////////
+void CBroker::SetStateDigest(const lb::StateDigestMessage& digest)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::shared_ptr<const lb::StateDigestMessage> next =
+        boost::make_shared<lb::StateDigestMessage>(digest);
+    boost::mutex::scoped_lock digestlock(m_digestMutex);
+    m_digest = next;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::GetDigestEpoch
+/// @description Gets the epoch of the load balance state the messages carry.
+/// @pre None
+/// @post None
+/// @return The epoch of the digest, or 0 if none was set.
+///////////////////////////////////////////////////////////////////////////////
+google::protobuf::uint64 CBroker::GetDigestEpoch()
+{
+    boost::mutex::scoped_lock digestlock(m_digestMutex);
+    return m_digest ? m_digest->epoch() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::AttachStateDigest
+/// @description Copies the load balance state of this node into a message
+///     sent to a peer. A module that encodes the message once and reuses it
+///     keys the encoding on the returned epoch.
+/// @pre None
+/// @post The message carries the digest, if one was set.
+/// @param msg the message to advertise the state on.
+/// @return The epoch of the digest, or 0 if none was set.
+///////////////////////////////////////////////////////////////////////////////
+google::protobuf::uint64 CBroker::AttachStateDigest(ModuleMessage& msg)
+{
+    boost::shared_ptr<const lb::StateDigestMessage> digest;
+    {
+        boost::mutex::scoped_lock digestlock(m_digestMutex);
+        digest = m_digest;
+    }
+    if(!digest)
+    {
+        return 0;
+    }
+    msg.mutable_lb_digest()->CopyFrom(*digest);
+    return digest->epoch();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::RoundLength
+/// @description Adds up the phases of the registered modules.
+/// @pre m_schmutex is held.
+/// @post None
+/// @return The length of a round in milliseconds.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CBroker::RoundLength() const
+{
+    unsigned int round = 0;
+    for(unsigned int i=0; i < m_modules.size(); i++)
+    {
+        round += m_modules[i].second.total_milliseconds();
+    }
+    return round;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @fn CBroker::IntoRound
+/// @description Finds how far a time is into the round it falls in. Rounds
+///     are counted from the boundary the phase lengths last changed at.
+/// @pre round is not zero.
+/// @post None
+/// @param millisecs synchronized milliseconds since the epoch.
+/// @param round the length of a round in milliseconds.
+/// @return Milliseconds since the start of the round.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CBroker::IntoRound(boost::uint64_t millisecs, unsigned int round) const
+{
+    if(millisecs >= m_roundorigin)
+    {
+        return (millisecs - m_roundorigin) % round;
+    }
+    return (round - (m_roundorigin - millisecs) % round) % round;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
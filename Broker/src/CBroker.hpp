@@ -34,14 +34,21 @@
 #define FREEDM_BROKER_HPP
 
 #include "CClockSynchronizer.hpp"
+#include "CMetrics.hpp"
+#include "CPhaseClock.hpp"
+#include "CTimings.hpp"
+#include "CVirtualClock.hpp"
 
 #include <list>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
-#include <boost/asio/deadline_timer.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 namespace freedm {
@@ -53,34 +60,66 @@ class CDispatcher;
 /// How often the scheduler should verify the schedule is being followed
 const unsigned int ALIGNMENT_DURATION = 250;
 
+/// Number of buckets of the task run time histograms
+const unsigned int LATENCY_BUCKETS = 16;
+
+/// Scheduling statistics of a module
+struct SPhaseStatistics
+{
+    SPhaseStatistics() : phases(0), tasks(0), overruns(0), maxqueue(0),
+        busy(0, 0, 0), longest(0, 0, 0), latency(LATENCY_BUCKETS, 0) { }
+    unsigned int phases; /// Phases the module has been given
+    unsigned int tasks; /// Tasks of the module that have run
+    unsigned int overruns; /// Phases that a task of the module ran past
+    unsigned int maxqueue; /// Most tasks waiting in the ready queue at once
+    boost::posix_time::time_duration busy; /// Time spent running tasks
+    boost::posix_time::time_duration longest; /// Longest run of a task
+    /// Tasks by run time, bucket i counts runs below 2^(i+1) microseconds that
+    /// did not fit an earlier bucket; the last bucket also counts longer runs
+    std::vector<unsigned int> latency;
+};
+
+/// Statistics of the phase changes of the scheduler
+struct SSchedulerStatistics
+{
+    SSchedulerStatistics() : changes(0), late(0), maxlate(0, 0, 0),
+        alignments(0), misaligned(0), drift(0), maxdrift(0) { }
+    unsigned int changes; /// Phase changes
+    unsigned int late; /// Phase changes that came late by over a millisecond
+    boost::posix_time::time_duration maxlate; /// Latest phase change
+    unsigned int alignments; /// Checks of the phase against the round clock
+    unsigned int misaligned; /// Checks that found another phase should run
+    int drift; /// Milliseconds the last checked phase end was off the round
+    int maxdrift; /// Largest drift in milliseconds, either way
+};
+
 /// Scheduler for the DGI modules
 class CBroker : private boost::noncopyable
 {
 public:
     typedef boost::function<void (boost::system::error_code)> Scheduleable;
     typedef boost::function<void ()> BoundScheduleable;
+    typedef boost::function<bool ()> ResumableScheduleable;
     typedef std::string ModuleIdent;
+    typedef unsigned int ModuleId;
     typedef std::pair<ModuleIdent, boost::posix_time::time_duration> PhaseTuple;
     typedef std::vector< PhaseTuple > ModuleVector;
     typedef unsigned int PhaseMarker;
     typedef unsigned int TimerHandle;
-    typedef std::map<TimerHandle, ModuleIdent> TimerAlloc;
-    typedef std::map<TimerHandle, boost::asio::deadline_timer* > TimersMap;
-    typedef std::map<TimerHandle, bool > NextTimeMap;
-    typedef std::map<ModuleIdent, std::list< BoundScheduleable > > ReadyMap;
+    typedef std::list<TimerHandle> TimerList;
 
     /// Get the singleton instance of this class
     static CBroker& Instance();
 
-    /// De-allocates the timers when the CBroker is destroyed.
-    ~CBroker();
-
     /// Starts the DGI Broker scheduler.
     void Run();
 
     /// Return a reference to the boost::ioservice
     boost::asio::io_service& GetIOService();
 
+    /// Return the strand that serializes the modules and their connections
+    boost::asio::io_service::strand& GetStrand();
+
     /// Requests that the Broker stops execution to exit the DGI.
     void Stop(unsigned int signum = 0);
 
@@ -90,43 +129,218 @@ public:
     /// Handles the stop signal from the operating System.
     void HandleStop(unsigned int signum = 0);
 
+    /// Handle the signal that reloads the timings file
+    void HandleReloadSignal(const boost::system::error_code& error, int parameter);
+
+    /// Reloads the timings file and schedules the new phase lengths
+    void ReloadTimings();
+
     /// Schedules a task that will run after a timer expires.
-    int Schedule(TimerHandle h, boost::posix_time::time_duration wait, Scheduleable x);
+    int Schedule(TimerHandle h, boost::posix_time::time_duration wait, Scheduleable x,
+        boost::posix_time::time_duration slack = boost::posix_time::pos_infin);
+
+    /// Runs the task of an armed timer now, as if its wait had passed.
+    int Expire(TimerHandle h);
 
     /// Schedule a task to be run as soon as the module is active.
     int Schedule(ModuleIdent m, BoundScheduleable x, bool start_worker=true);
 
+    /// Schedule a task for a module identified by its integer id.
+    int Schedule(ModuleId m, BoundScheduleable x, bool start_worker=true);
+
+    /// Schedule a task that runs ahead of the tasks with later deadlines.
+    int Schedule(ModuleIdent m, BoundScheduleable x,
+        boost::posix_time::time_duration slack, bool start_worker=true);
+
+    /// Schedule a task with a deadline for a module identified by its id.
+    int Schedule(ModuleId m, BoundScheduleable x,
+        boost::posix_time::time_duration slack, bool start_worker=true);
+
+    /// Schedule a task that runs in slices until it returns true.
+    int ScheduleResumable(ModuleIdent m, ResumableScheduleable x);
+
+    /// Schedule a task in slices for a module identified by its id.
+    int ScheduleResumable(ModuleId m, ResumableScheduleable x);
+
+    /// Checks if the running task has used up its slice of the phase
+    bool ShouldYield();
+
+    /// Gets the integer id of a module, assigning one on first use
+    ModuleId GetModuleId(ModuleIdent m);
+
     /// Allocate a timer to a specified module.
     TimerHandle AllocateTimer(ModuleIdent module);
 
     /// Registers a module for the scheduler
     void RegisterModule(ModuleIdent m, boost::posix_time::time_duration phase);
 
+    /// Registers a module whose phase is a reloadable timing parameter
+    void RegisterModule(ModuleIdent m, CTimings::ETiming phase);
+
     /// Checks to see if a module is registered with the scheduler
     bool IsModuleRegistered(ModuleIdent m);
 
+    /// Checks to see if a module id is registered with the scheduler
+    bool IsModuleRegistered(ModuleId m);
+
+    /// Checks if a task of a module could run right now, ahead of nothing
+    bool CanRunInline(ModuleId m);
+
+    /// Gets the tasks waiting in the longest ready queue, read without a lock
+    std::size_t GetBacklog() const { return m_backlog; }
+
     /// Returns how much time the current module has left in its phase
     boost::posix_time::time_duration TimeRemaining();
 
     /// Returns the synchronizer
     CClockSynchronizer& GetClockSynchronizer();
 
+    /// Gets the scheduling statistics of a module
+    SPhaseStatistics GetPhaseStatistics(ModuleIdent m);
+
+    /// Gets the phase change statistics of the scheduler
+    SSchedulerStatistics GetSchedulerStatistics();
+
+    /// Gets the busy time per phase of each module since the last call
+    std::vector<unsigned int> TakePhaseDemand();
+
+    /// Gets the current phase length of each module in milliseconds
+    std::vector<unsigned int> GetPhaseLengths();
+
+    /// Gets the configured phase length of each module in milliseconds
+    std::vector<unsigned int> GetConfiguredLengths();
+
+    /// Sizes the phases of a round for the busy time of each module
+    std::vector<unsigned int> PlanPhaseLengths(const std::vector<unsigned int>& demand);
+
+    /// Gets the synchronized time a number of rounds from now starts
+    boost::uint64_t GetRoundBoundary(unsigned int rounds);
+
+    /// Changes the phase lengths at a round boundary
+    void SetPhaseLengths(const std::vector<unsigned int>& lengths, boost::uint64_t effective);
+
+    /// Sets the load balance state the periodic messages advertise
+    void SetStateDigest(const lb::StateDigestMessage& digest);
+
+    /// Gets the epoch of the load balance state advertised, 0 for none
+    google::protobuf::uint64 GetDigestEpoch();
+
+    /// Advertises the load balance state on a message, returns its epoch
+    google::protobuf::uint64 AttachStateDigest(ModuleMessage& msg);
+
 private:
+    /// The ready tasks of one module: a growable ring buffer of the tasks
+    /// without a deadline, behind a heap of the tasks with one
+    class CTaskQueue
+    {
+    public:
+        /// Creates an empty queue with room for INITIAL_CAPACITY tasks
+        CTaskQueue();
+        /// Moves a task to the back of the queue, leaving x empty
+        void Push(BoundScheduleable& x);
+        /// Moves a task into the queue ahead of those with later deadlines
+        void Push(BoundScheduleable& x, const boost::posix_time::ptime& deadline);
+        /// Moves the task with the earliest deadline, or the front task, into x
+        bool Pop(BoundScheduleable& x);
+        /// Gets the number of queued tasks
+        std::size_t Size() const { return m_size + m_urgent.size(); }
+        /// Gets the number of slots in the ring and the heap
+        std::size_t Capacity() const { return m_tasks.size() + m_urgent.capacity(); }
+    private:
+        /// A queued task with a deadline
+        struct SDeadlineTask
+        {
+            /// The time the task should have started by
+            boost::posix_time::ptime deadline;
+            /// The order the task was queued in, to break ties
+            boost::uint64_t order;
+            /// The task
+            BoundScheduleable task;
+        };
+        /// Orders the heap so the earliest deadline is on top
+        static bool Later(const SDeadlineTask& a, const SDeadlineTask& b);
+        /// The tasks with a deadline, as a heap
+        std::vector<SDeadlineTask> m_urgent;
+        /// The order of the next task with a deadline
+        boost::uint64_t m_order;
+        /// The slots of the ring, reused as tasks come and go
+        std::vector<BoundScheduleable> m_tasks;
+        /// Slot of the task at the front of the queue
+        std::size_t m_head;
+        /// Number of queued tasks
+        std::size_t m_size;
+        /// Number of slots of a new queue
+        static const std::size_t INITIAL_CAPACITY = 64;
+    };
+
+    /// An allocated timer
+    struct STimer
+    {
+        /// The module that owns the timer
+        ModuleId module;
+        /// The task to run when the timer expires
+        Scheduleable task;
+        /// Set while the task is waiting for the timer
+        bool armed;
+        /// Set if the timer expires at the end of the module's phase
+        bool nextround;
+        /// How long the task may wait once the timer expires, or pos_infin
+        boost::posix_time::time_duration slack;
+        /// Wheel tick the timer expires on
+        boost::uint64_t deadline;
+        /// Position of the timer in its wheel slot or in m_nextround
+        TimerList::iterator entry;
+    };
+
     /// Private constructor for the singleton instance
     CBroker();
 
+    /// Gets the id of a module with m_schmutex held
+    ModuleId ResolveModule(const ModuleIdent& m);
+
+    /// Queues a task for a module, with a deadline unless it is special
+    int Enqueue(ModuleId m, BoundScheduleable& x,
+        const boost::posix_time::time_duration& slack, bool start_worker);
+
     /// The io_service used to perform asynchronous operations.
     boost::asio::io_service m_ioService;
 
+    /// Runs the scheduler, the modules and the peer connections in order.
+    boost::asio::io_service::strand m_strand;
+
+    ///Runs the io_service on one of the extra threads of the pool.
+    void RunService();
+
     ///An task that will advance the Broker's active module to the next module.
     void ChangePhase(const boost::system::error_code &err);
 
-    ///Adds a task scheduled by a module to the task queue when the timer expires.
-    void ScheduledTask(Scheduleable x, TimerHandle handle, const boost::system::error_code &err);
+    ///Queues the tasks of the timers that expired since the last turn.
+    void TurnWheel(const boost::system::error_code &err);
+
+    ///Sets the wheel timer to go off by a tick, unless it goes off earlier.
+    void ArmWheel(boost::uint64_t tick);
+
+    ///Removes an armed timer from the wheel or from the next round timers.
+    void Disarm(TimerHandle handle);
+
+    ///Moves the task of a timer to its module's ready queue.
+    void Fire(TimerHandle handle, const boost::system::error_code &err);
 
     ///Executes tasks from the active module's task queue.
     void Worker();
 
+    ///Runs a slice of a resumable task and queues the rest behind it.
+    void RunSlice(ModuleId m, ResumableScheduleable x);
+
+    ///The time the running task started.
+    boost::posix_time::ptime m_taskstart;
+
+    ///Gets how many milliseconds a synchronized time is into its round.
+    unsigned int IntoRound(boost::uint64_t millisecs, unsigned int round) const;
+
+    ///Gets the length of a round in milliseconds with m_schmutex held.
+    unsigned int RoundLength() const;
+
     ///True while the worker is actively running tasks.
     bool m_busy;
 
@@ -136,6 +350,12 @@ private:
     ///List of modules for the scheduler
     ModuleVector m_modules;
 
+    ///The ids of the modules of m_modules, in the same order
+    std::vector<ModuleId> m_phaseids;
+
+    ///The ids assigned to the module identifiers
+    std::map<ModuleIdent, ModuleId> m_moduleids;
+
     ///The active module in the scheduler.
     PhaseMarker m_phase;
 
@@ -143,40 +363,114 @@ private:
     boost::posix_time::ptime m_phaseends;
 
     ///Timer for the phases
-    boost::asio::deadline_timer m_phasetimer;
+    CVirtualTimer m_phasetimer;
+
+    ///Timer for the phases on the monotonic clock, used once it is open
+    CPhaseClock m_phaseclock;
+
+    ///The allocated timers, indexed by their handles.
+    std::vector<STimer> m_timers;
+
+    ///The slots of the timer wheel, each lists the timers expiring on it.
+    std::vector<TimerList> m_wheel;
+
+    ///Timers that expire at the end of their module's phase.
+    TimerList m_nextround;
+
+    ///The single timer that drives the wheel.
+    CVirtualTimer m_wheeltimer;
 
-    ///The current counter for the time handlers
-    TimerHandle m_handlercounter;
+    ///The time of wheel tick 0.
+    boost::posix_time::ptime m_wheelstart;
 
-    ///Timer allocations for modules.
-    TimerAlloc m_allocs;
+    ///The last wheel tick whose timers have expired.
+    boost::uint64_t m_wheeltick;
 
-    ///A relation between the timer handles and the actual timer objects.
-    TimersMap m_timers;
+    ///The tick the wheel timer is set for.
+    boost::uint64_t m_wheelnext;
 
-    ///Maps handle to bool: if a timer handle is set to expire for the next round.
-    NextTimeMap m_nexttime;
+    ///Set while the wheel timer is waiting.
+    bool m_wheelarmed;
 
-    ///Maps if a specific timer has been cancelled or triggered by end of round
-    NextTimeMap m_ntexpired;
+    ///Jobs that are ready to run as soon as their phase comes up, by module id
+    std::vector<CTaskQueue> m_ready;
 
-    ///A map of jobs that are ready to run as soon as their phase comes up
-    ReadyMap m_ready;
+    ///Scheduling statistics of the modules, by module id
+    std::vector<SPhaseStatistics> m_phasestats;
+
+    ///The runtime metrics of a module
+    struct SModuleMetrics
+    {
+        CCounter* tasks; /// Tasks of the module that have run
+        CCounter* overruns; /// Phases that a task of the module ran past
+        CGauge* queue; /// Tasks waiting in the ready queue
+        CHistogram* runtime; /// Run times of the tasks
+        boost::shared_ptr<CSizeTracker> memory; /// Size of the ready queue
+    };
+
+    ///Runtime metrics of the modules, by module id
+    std::vector<SModuleMetrics> m_metrics;
+
+    ///Phase change statistics
+    SSchedulerStatistics m_schedstats;
+
+    ///Set once a task has overrun the current phase
+    bool m_overrun;
+
+    ///The phase lengths the modules registered with, in the order of m_modules
+    ModuleVector m_configured;
+
+    ///The timing each configured phase is reloaded from, TIMING_COUNT if none
+    std::vector<CTimings::ETiming> m_phasetimings;
+
+    ///The module statistics when the phase demand was last taken
+    std::vector<SPhaseStatistics> m_demandbase;
+
+    ///Phase lengths in milliseconds waiting for their round boundary
+    std::vector<unsigned int> m_pendinglengths;
+
+    ///Synchronized milliseconds since the epoch when the pending lengths apply
+    boost::uint64_t m_pendingeffective;
+
+    ///Synchronized milliseconds since the epoch a round started at
+    boost::uint64_t m_roundorigin;
+
+    ///Updates the metrics of a ready queue that has changed.
+    void NoteQueueSize(ModuleId m);
+
+    ///Records the depth of a ready queue that has grown.
+    void NoteQueueDepth(ModuleId m);
+
+    ///Records the run time of a task of the active module.
+    void NoteTask(ModuleId m, const boost::posix_time::ptime& start,
+        const boost::posix_time::ptime& end, const boost::posix_time::ptime& phaseends);
 
     ///Lock for the scheduler.
     boost::mutex m_schmutex;
 
+    ///The size of the longest ready queue, for readers without m_schmutex
+    volatile std::size_t m_backlog;
+
     ///The clock synchronizer which aligns clocks between DGIs
     boost::shared_ptr<CClockSynchronizer> m_synchronizer;
 
     ///The registered signal handlers.
     boost::asio::signal_set m_signals;
 
+    ///The signal that reloads the timings file.
+    boost::asio::signal_set m_reload;
+
     ///Flag to prevent modules from scheduling, set when the DGI is stopping
     bool m_stopping;
 
     ///Lock for m_stopping
     boost::mutex m_stoppingMutex;
+
+    ///The load balance state to advertise, null until one is set
+    boost::shared_ptr<const lb::StateDigestMessage> m_digest;
+
+    ///Lock for m_digest
+    boost::mutex m_digestMutex;
 };
 
     } // namespace broker
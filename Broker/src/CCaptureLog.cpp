@@ -0,0 +1,258 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CCaptureLog.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Records the received datagrams and plays them back
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CCaptureLog.hpp"
+
+#include "CBroker.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CListener.hpp"
+#include "CLogger.hpp"
+#include "messages/ProtocolMessage.pb.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The universal time the capture time stamps count from
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970,1,1));
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::Instance
+/// @description Access the singleton instance of the capture log
+/// @pre None
+/// @post None
+/// @return A reference to the capture log.
+///////////////////////////////////////////////////////////////////////////////
+CCaptureLog& CCaptureLog::Instance()
+{
+    static CCaptureLog instance;
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::CCaptureLog
+/// @description Creates a capture log that neither records nor replays.
+/// @pre None
+/// @post The replay timer runs on the broker's io_service.
+///////////////////////////////////////////////////////////////////////////////
+CCaptureLog::CCaptureLog()
+    : m_recording(false)
+    , m_speed(1.0)
+    , m_time(0)
+    , m_first(0)
+    , m_timer(CBroker::Instance().GetIOService())
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::Start
+/// @description Opens the capture file for appending, writing its header if
+///     it is new, or opens the replay file and schedules its first window.
+/// @ErrorHandling Throws a std::runtime_error if a file cannot be opened or
+///     the replay file is not a capture file.
+/// @pre Called once, after the listener has started.
+/// @post The received windows are recorded, or the replay has begun.
+///////////////////////////////////////////////////////////////////////////////
+void CCaptureLog::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const CGlobalConfiguration& config = CGlobalConfiguration::Instance();
+    SCaptureHeader header;
+
+    if(!config.GetCaptureFile().empty())
+    {
+        const char* path = config.GetCaptureFile().c_str();
+        m_capture.open(path, std::ios::out | std::ios::binary | std::ios::app);
+        if(!m_capture)
+        {
+            throw std::runtime_error("Cannot open the capture file "
+                + config.GetCaptureFile());
+        }
+        if(m_capture.tellp() == std::streampos(0))
+        {
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+            header.version = CAPTURE_VERSION;
+            m_capture.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        m_recording = true;
+        LOG_INFO(Logger)<<"Recording received datagrams to "<<path<<std::endl;
+    }
+
+    if(!config.GetReplayCapture().empty())
+    {
+        m_replay.open(config.GetReplayCapture().c_str(),
+            std::ios::in | std::ios::binary);
+        if(!m_replay.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != CAPTURE_VERSION)
+        {
+            throw std::runtime_error(config.GetReplayCapture()
+                + " is not a capture file.");
+        }
+        m_speed = config.GetReplaySpeed();
+        if(!ReadRecord())
+        {
+            LOG_WARN(Logger)<<"The capture file "<<config.GetReplayCapture()
+                <<" has no datagrams"<<std::endl;
+            return;
+        }
+        m_first = m_time;
+        m_origin = CVirtualClock::Now();
+        m_timer.expires_at(m_origin);
+        m_timer.async_wait(CBroker::Instance().GetStrand().wrap(boost::bind(
+            &CCaptureLog::Replay, this, boost::asio::placeholders::error)));
+        LOG_INFO(Logger)<<"Replaying received datagrams from "
+            <<config.GetReplayCapture()<<std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::Stop
+/// @description Cancels the replay and writes out the recorded windows.
+/// @pre None
+/// @post No more windows are replayed.
+///////////////////////////////////////////////////////////////////////////////
+void CCaptureLog::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    if(m_recording)
+    {
+        m_capture.flush();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::Record
+/// @description Appends a window to the capture file with its sender and
+///     the current time. The file is buffered, so a window costs a copy.
+/// @pre Called on the broker thread while recording.
+/// @post The window is queued in the file buffer.
+/// @param window The received window.
+/// @param from The endpoint that sent the window.
+///////////////////////////////////////////////////////////////////////////////
+void CCaptureLog::Record(const ProtocolMessageWindow& window,
+    const boost::asio::ip::udp::endpoint& from)
+{
+    std::string bytes, address = from.address().to_string();
+    window.SerializeToString(&bytes);
+
+    SCaptureRecord record;
+    record.time = (CVirtualClock::Now()
+        - EPOCH).total_microseconds();
+    record.length = bytes.size();
+    record.port = from.port();
+    record.address_length = address.size();
+
+    m_capture.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    m_capture.write(address.data(), address.size());
+    m_capture.write(bytes.data(), bytes.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::ReadRecord
+/// @description Reads the next window of the replay file.
+/// @pre The replay file is open.
+/// @post m_window, m_from and m_time describe the window.
+/// @return False at the end of the file or at a malformed record.
+///////////////////////////////////////////////////////////////////////////////
+bool CCaptureLog::ReadRecord()
+{
+    SCaptureRecord record;
+    if(!m_replay.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        return false;
+    }
+
+    std::vector<char> payload(record.address_length + record.length + 1);
+    if(!m_replay.read(&payload[0], record.address_length + record.length))
+    {
+        return false;
+    }
+
+    boost::system::error_code ec;
+    std::string address(&payload[0], record.address_length);
+    m_from = boost::asio::ip::udp::endpoint(
+        boost::asio::ip::address::from_string(address, ec), record.port);
+    m_window.reset(new ProtocolMessageWindow);
+    if(ec || !m_window->ParseFromArray(&payload[record.address_length],
+        record.length))
+    {
+        LOG_WARN(Logger)<<"Malformed record in the capture file"<<std::endl;
+        return false;
+    }
+    m_time = record.time;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCaptureLog::Replay
+/// @description Hands the window that was read to the listener as if it had
+///     just arrived, then schedules the next window at its recorded distance
+///     from the first one, divided by the replay speed.
+/// @pre Called on the broker strand by the replay timer.
+/// @post The window is processed by the listener.
+/// @param e The error code of the replay timer.
+///////////////////////////////////////////////////////////////////////////////
+void CCaptureLog::Replay(const boost::system::error_code& e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(e)
+    {
+        return;
+    }
+
+    CListener::Instance().HandleParsed(m_window, m_from);
+
+    if(!ReadRecord())
+    {
+        LOG_NOTICE(Logger)<<"Finished replaying received datagrams"<<std::endl;
+        return;
+    }
+
+    boost::uint64_t offset = m_time > m_first ? m_time - m_first : 0;
+    m_timer.expires_at(m_origin + boost::posix_time::microseconds(
+        static_cast<boost::int64_t>(offset / m_speed)));
+    m_timer.async_wait(CBroker::Instance().GetStrand().wrap(boost::bind(
+        &CCaptureLog::Replay, this, boost::asio::placeholders::error)));
+}
+
+    } // namespace broker
+} // namespace freedm
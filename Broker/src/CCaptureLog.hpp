@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CCaptureLog.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Records the received datagrams and plays them back
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CCAPTURELOG_HPP
+#define CCAPTURELOG_HPP
+
+#include "CVirtualClock.hpp"
+
+#include <fstream>
+#include <string>
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace freedm {
+    namespace broker {
+
+class ProtocolMessageWindow;
+
+/// The header at the start of a capture file
+struct SCaptureHeader
+{
+    /// CAPTURE_MAGIC
+    char magic[8];
+    /// CAPTURE_VERSION
+    boost::uint32_t version;
+    /// Unused, zero
+    boost::uint32_t reserved;
+};
+
+/// One received datagram, followed by the address and the window bytes
+struct SCaptureRecord
+{
+    /// Microseconds since the epoch the datagram was processed at
+    boost::uint64_t time;
+    /// The size of the serialized window in bytes
+    boost::uint32_t length;
+    /// The port of the sender
+    boost::uint16_t port;
+    /// The size of the sender's address text in bytes
+    boost::uint16_t address_length;
+};
+
+/// Identifies a capture file
+const char CAPTURE_MAGIC[8] = { 'F', 'R', 'E', 'E', 'D', 'M', 'C', 'P' };
+
+/// The layout version of the capture file
+const boost::uint32_t CAPTURE_VERSION = 1;
+
+/// Records the received windows to a file, or replays them from one
+////////////////////////////////////////////////////////////////////////////////
+/// With a capture file each window the listener processes is appended with
+/// its sender and the time it was processed. A replayed file hands the same
+/// windows to the listener at the same distances from each other, divided by
+/// the replay speed, in place of the peers that sent them. Together with a
+/// replay adapter this runs the modules on the same inputs every time.
+////////////////////////////////////////////////////////////////////////////////
+class CCaptureLog
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CCaptureLog
+    static CCaptureLog& Instance();
+
+    /// Opens the configured capture or replay file
+    void Start();
+
+    /// Stops the replay and flushes the capture file
+    void Stop();
+
+    /// True if the received windows are recorded
+    bool IsRecording() const { return m_recording; }
+
+    /// Appends a received window to the capture file
+    void Record(const ProtocolMessageWindow& window,
+        const boost::asio::ip::udp::endpoint& from);
+
+private:
+    /// Private constructor for the singleton instance
+    CCaptureLog();
+
+    /// Reads the next record of the replay file
+    bool ReadRecord();
+
+    /// Hands the window that was read to the listener
+    void Replay(const boost::system::error_code& e);
+
+    /// True if the received windows are recorded
+    bool m_recording;
+
+    /// The file windows are recorded to
+    std::ofstream m_capture;
+
+    /// The file windows are replayed from
+    std::ifstream m_replay;
+
+    /// The replay speed relative to the recording
+    double m_speed;
+
+    /// The window that was read last
+    boost::shared_ptr<ProtocolMessageWindow> m_window;
+
+    /// The sender of the window that was read last
+    boost::asio::ip::udp::endpoint m_from;
+
+    /// The recorded time of the window that was read last
+    boost::uint64_t m_time;
+
+    /// The recorded time of the first window
+    boost::uint64_t m_first;
+
+    /// The time the first window was replayed
+    boost::posix_time::ptime m_origin;
+
+    /// Expires when the next window is due
+    CVirtualTimer m_timer;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CCAPTURELOG_HPP
@@ -26,12 +26,22 @@
 #include "CGlobalConfiguration.hpp"
 #include "CGlobalPeerList.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CMulticastChannel.hpp"
 #include "CPeerNode.hpp"
+#include "CWarmState.hpp"
+#include "Messages.hpp"
 #include "messages/ModuleMessage.pb.h"
+#include "messages/ProtocolMessage.pb.h"
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
 #include <memory>
 #include <utility>
+#include <vector>
 
+#include <boost/assign/list_of.hpp>
 #include <boost/date_time/posix_time/ptime.hpp>
 #include <boost/foreach.hpp>
 #include <boost/range/adaptor/map.hpp>
@@ -47,6 +57,25 @@ CLocalLogger Logger(__FILE__);
 const int MAX_REGRESSION_ENTRIES = 200;
 const double SYNCHRONIZER_LAMBDA = .99999;
 const int QUERY_INTERVAL = 10000;
+/// The largest number of exchange rounds between queries to a stable peer
+const unsigned int MAX_EXCHANGE_STRIDE = 8;
+/// Skews that change less than this between responses are stable
+const double STABLE_SKEW_CHANGE = 1e-6;
+/// The responses needed before a skew is trusted to be stable
+const unsigned int STABLE_MIN_RESPONSES = 4;
+/// Marks a handle in m_peerindex that has no entry in the peer table
+const std::size_t NO_INDEX = static_cast<std::size_t>(-1);
+/// The share of its saved weight an offset of the last run starts with
+const double WARM_TRUST = 0.5;
+/// The exchange rounds a passive sample stands in for a query
+const unsigned int PASSIVE_ROUNDS = 2;
+/// The epoch the clock readings of a window are counted from
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+
+/// Round trips taken from the regular traffic instead of a clock exchange
+CCounter& PassiveMetric = CMetrics::Instance().GetCounter(
+    "dgi_clock_passive_samples_total",
+    "Clock samples taken from the regular traffic instead of an exchange");
 
 }
 
@@ -60,14 +89,15 @@ const int QUERY_INTERVAL = 10000;
 ///////////////////////////////////////////////////////////////////////////////
 CClockSynchronizer::CClockSynchronizer(boost::asio::io_service& ios)
     : m_exchangetimer(ios)
+    , m_peermemory("clk", "peers")
+    , m_responsememory("clk", "responses")
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    MapIndex ii(GetUUID(),GetUUID());
-    m_offsets[ii] = boost::posix_time::milliseconds(0);
-    SetWeight(ii, 1.0);
-    m_skews[ii] = 0.0;
-    m_lastinteraction = boost::posix_time::microsec_clock::universal_time();
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     m_kcounter = 0;
+    m_exchangeepoch = 0;
+    InternPeer(GetUUID());
+    ResetSelf();
+    m_lastinteraction = CVirtualClock::Now();
     m_myoffset = boost::posix_time::milliseconds(0);
     m_myskew = 0.0;
 }
@@ -83,10 +113,12 @@ CClockSynchronizer::CClockSynchronizer(boost::asio::io_service& ios)
 ///////////////////////////////////////////////////////////////////////////////
 void CClockSynchronizer::Run()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    ResumeWarmState();
     m_exchangetimer.expires_from_now(boost::posix_time::milliseconds(QUERY_INTERVAL));
-    m_exchangetimer.async_wait(boost::bind(&CClockSynchronizer::Exchange,this,
-        boost::asio::placeholders::error));
+    m_exchangetimer.async_wait(CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CClockSynchronizer::Exchange,this,
+        boost::asio::placeholders::error)));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -98,7 +130,7 @@ void CClockSynchronizer::Run()
 ///////////////////////////////////////////////////////////////////////////////
 void CClockSynchronizer::Stop()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     m_exchangetimer.cancel();
 }
 
@@ -112,15 +144,15 @@ void CClockSynchronizer::Stop()
 void CClockSynchronizer::HandleIncomingMessage(
     boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if (!msg->has_clock_synchronizer_message())
     {
-        Logger.Warn << "Dropped message of unexpected type:\n" << msg->DebugString();
+        LOG_WARN(Logger) << "Dropped message of unexpected type:\n" << msg->DebugString();
         return;
     }
 
-    ClockSynchronizerMessage csm = msg->clock_synchronizer_message();
+    const ClockSynchronizerMessage& csm = msg->clock_synchronizer_message();
     if(csm.has_exchange_message())
     {
         HandleExchange(csm.exchange_message(), peer);
@@ -131,7 +163,7 @@ void CClockSynchronizer::HandleIncomingMessage(
     }
     else
     {
-        Logger.Warn << "Dropped clk message of unexpected type:\n" << msg->DebugString();
+        LOG_WARN(Logger) << "Dropped clk message of unexpected type:\n" << msg->DebugString();
     }
 }
 
@@ -146,7 +178,7 @@ void CClockSynchronizer::HandleIncomingMessage(
 ///////////////////////////////////////////////////////////////////////////////
 void CClockSynchronizer::HandleExchange(const ExchangeMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     // Respond to the query ID
     peer.Send(CreateExchangeResponse(msg.query()));
@@ -164,42 +196,89 @@ void CClockSynchronizer::HandleExchange(const ExchangeMessage& msg, CPeerNode pe
 ///////////////////////////////////////////////////////////////////////////////
 void CClockSynchronizer::HandleExchangeResponse(const ExchangeResponseMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    std::string sender = peer.GetUUID();
-    MapIndex ij(GetUUID(),sender);
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::size_t ij = InternPeer(peer.GetId());
+    SPeerClock& entry = m_peers[ij];
     boost::posix_time::ptime challenge;
-    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::ptime now = CVirtualClock::Now();
     boost::posix_time::ptime response =
         boost::posix_time::time_from_string(msg.unsynchronized_sendtime());
     unsigned int k = msg.response();
-    Logger.Debug<<__FILE__<<":"<<__LINE__<<std::endl;
-    if(m_queries.find(ij) == m_queries.end() || m_queries[ij].first != k)
-        return;
-    challenge = m_queries[ij].second;
-    m_queries.erase(ij);
-    ResponseMap::iterator rit = m_responses.find(ij);
-    ResponseList rlist;
-    if(rit == m_responses.end())
+    // The kernel receive time leaves out the time spent in the broker queues
+    if(msg.has_unsynchronized_receivetime())
     {
-        m_responses[ij] = rlist;
+        now = boost::posix_time::time_from_string(msg.unsynchronized_receivetime());
     }
-    else
+    LOG_DEBUG(Logger)<<__FILE__<<":"<<__LINE__<<std::endl;
+    if(!entry.querying || entry.query != k)
+        return;
+    challenge = entry.querytime;
+    entry.querying = false;
+    AddSample(ij, challenge, response, now);
+    entry.nextquery = k + entry.stride;
+    for (unsigned i = 0; i < static_cast<unsigned>(msg.table_entry_size()); ++i)
     {
-        rlist = rit->second;
+        const ExchangeResponseMessage::TableEntry te = msg.table_entry(i);
+        std::string neighbor = te.uuid();
+        if(neighbor == peer.GetUUID() || neighbor == GetUUID())
+            continue;
+        boost::posix_time::time_duration cjl = boost::posix_time::seconds(te.offset_secs())+boost::posix_time::microseconds(te.offset_fracs());
+        double wjl = te.weight()-.1; // Abritrarily remove some trust to account for lag.
+        double fjl = te.skew();
+        std::size_t il = InternPeer(neighbor);
+        // InternPeer can grow the table, so entry may no longer be valid
+        SPeerClock& direct = m_peers[ij];
+        SPeerClock& indirect = m_peers[il];
+        if(!indirect.known)
+        {
+            indirect.known = true;
+            indirect.offset = boost::posix_time::milliseconds(0);
+            SetWeight(il, 0.0);
+            indirect.skew = 0.0;
+        }
+        if(GetWeight(il) < wjl)
+        {
+            indirect.offset = direct.offset + cjl;
+            SetWeight(il, wjl);
+            indirect.skew = direct.skew + fjl;
+        }
     }
-    // Add the newest response to the response list.
-    rlist.push_back(TimeTuple(response,challenge));
-    rlist.push_back(TimeTuple(response,now));
-    if(rlist.size() > MAX_REGRESSION_ENTRIES*2)
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::AddSample
+/// @description Adds one round trip to the response ring of a node and sets
+///     the offset and skew of the node from a linear regression over the
+///     ring. The round trip is either an exchange query and its response or
+///     a passive sample taken from the regular traffic.
+/// @limitations none
+/// @pre ij is an index of the peer table other than this node's.
+/// @post The node is known with full weight and its query stride is updated.
+/// @param ij The index of the node in the peer table.
+/// @param challenge When this node sent the message the reading answers.
+/// @param remote The unsynchronized time the other node sent its reading.
+/// @param local When this node received the reading.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::AddSample(std::size_t ij,
+    const boost::posix_time::ptime& challenge,
+    const boost::posix_time::ptime& remote, const boost::posix_time::ptime& local)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    SPeerClock& entry = m_peers[ij];
+    // Add the newest response to the response ring.
+    if(entry.responses.empty())
     {
-        rlist.pop_front();
-        rlist.pop_front();
+        entry.reference = remote;
     }
-    m_responses[ij] = rlist;
+    SResponse sample;
+    sample.remote = TDToDouble(remote - entry.reference);
+    sample.challenge = TDToDouble(challenge - entry.reference);
+    sample.local = TDToDouble(local - entry.reference);
+    AddResponse(entry, sample);
     // Now we can compute a linear regression on the contents
     // First, compute the average time
     // Pick a time to use as the base.
-    boost::posix_time::ptime base = now;
+    boost::posix_time::ptime base = local;
     /* A note -
     The original paper had you calculate a skew and apply it to your clock,
     which is bananas because you can't change the rate that a clock ticks,
@@ -211,46 +290,19 @@ void CClockSynchronizer::HandleExchangeResponse(const ExchangeResponseMessage& m
     to be in the past and we are going to determine the x intercept starting
     from now, which should be pretty close to what we want as an offset w/o
     having to apply any skew. */
-    boost::posix_time::time_duration sumx;
-    boost::posix_time::time_duration sumy;
-    boost::posix_time::time_duration sumlag;
-    bool even = false;
-    BOOST_FOREACH(TimeTuple t, rlist)
-    {
-        sumx += t.first-base;
-        sumy += t.second-base;
-        if(even == false)
-        {
-            sumlag -= t.second-base;
-            even = true;
-        }
-        else
-        {
-            sumlag += t.second-base;
-            even = false;
-        }
-    }
-    double lag = (TDToDouble(sumlag))/rlist.size();
-    Logger.Notice<<"Computed lag ("<<sender<<"): "<<lag<<std::endl;
-    double dxbar = TDToDouble(sumx)/rlist.size();
-    double dybar = TDToDouble(sumy)/rlist.size();
-    boost::posix_time::time_duration xbar = DoubleToTD(dxbar);
-    boost::posix_time::time_duration ybar = DoubleToTD(dybar);
+    // Each response is two points, (remote, challenge) and (remote, local)
+    double n = 2.0 * entry.responses.size();
+    double lag = entry.sumlag/n;
+    LOG_NOTICE(Logger)<<"Computed lag ("<<entry.uuid<<"): "<<lag<<std::endl;
+    double shift = TDToDouble(entry.reference - base);
+    double dxbar = entry.sumx/n + shift;
+    double dybar = entry.sumy/n + shift;
     // Now that the averages are computed we can compute Cij and fij
     double fij;
-    double tmp1 = 0.0;
-    double tmp2 = 0.0;
-    double tmp3 = 0.0;
-    double tmp4 = 0.0;
-    BOOST_FOREACH(TimeTuple t, rlist)
-    {
-        tmp1 = TDToDouble((t.first-base)-xbar);
-        tmp2 = TDToDouble((t.second-base)-ybar);
-        tmp3 += tmp1 * tmp2;
-        tmp4 += tmp1 * tmp1;
-    }
+    double tmp3 = entry.sumxy - entry.sumx * entry.sumy / n;
+    double tmp4 = entry.sumxx - entry.sumx * entry.sumx / n;
     //If there is no spread, then we only have one xcoordinate to use.
-    if(tmp4 != 0.0)
+    if(tmp4 > 0.0)
         fij = (tmp3/tmp4);
     else
         fij = 1.0;
@@ -261,34 +313,132 @@ void CClockSynchronizer::HandleExchangeResponse(const ExchangeResponseMessage& m
     else
         alpha -= lag;
     // Wowza!
-    m_offsets[ij] = -DoubleToTD(alpha);
+    // Query a peer less often once its skew stops moving
+    if(entry.known && entry.responses.size() >= STABLE_MIN_RESPONSES
+        && std::fabs(fij-1 - entry.skew) < STABLE_SKEW_CHANGE)
+    {
+        entry.stride = std::min(entry.stride * 2, MAX_EXCHANGE_STRIDE);
+    }
+    else
+    {
+        entry.stride = 1;
+    }
+    entry.known = true;
+    entry.offset = -DoubleToTD(alpha);
     SetWeight(ij, 1);
-    m_skews[ij] = fij-1;
-    for (unsigned i = 0; i < static_cast<unsigned>(msg.table_entry_size()); ++i)
+    entry.skew = fij-1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::StampWindow
+/// @description Puts the unsynchronized send time on a window to a peer, and
+///     echoes the send time of the last window received from the peer with
+///     how long this node held it. The peer takes a round trip from the echo
+///     without an exchange of its own. Nothing is stamped unless passive
+///     clock samples are enabled.
+/// @limitations none
+/// @pre None
+/// @post The window carries the clock readings.
+/// @param msg The window about to be written.
+/// @param peer The interned UUID of the recipient.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::StampWindow(ProtocolMessageWindow& msg, PeerId peer)
+{
+    if(!CGlobalConfiguration::Instance().GetPassiveClock())
+        return;
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    msg.set_clock_usec((now - EPOCH).total_microseconds());
+    boost::mutex::scoped_lock echolock(m_echomutex);
+    if(peer < m_echoes.size() && m_echoes[peer].remote != 0)
     {
-        const ExchangeResponseMessage::TableEntry te = msg.table_entry(i);
-        std::string neighbor = te.uuid();
-        if(neighbor == peer.GetUUID() || neighbor == GetUUID())
-            continue;
-        boost::posix_time::time_duration cjl = boost::posix_time::seconds(te.offset_secs())+boost::posix_time::microseconds(te.offset_fracs());
-        double wjl = te.weight()-.1; // Abritrarily remove some trust to account for lag.
-        double fjl = te.skew();
-        MapIndex il(GetUUID(),neighbor);
-        if(m_offsets.find(il) == m_offsets.end())
+        const SClockEcho& echo = m_echoes[peer];
+        msg.set_echo_usec(echo.remote);
+        msg.set_echo_hold_usec((now - echo.received).total_microseconds());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::ReadWindow
+/// @description Keeps the send time of a received window to echo back, and
+///     takes a passive sample if the window echoes one of this node's own:
+///     this node sent the echoed window, the peer held it, sent this window
+///     and this node received it, which is a round trip like an exchange
+///     query and its response. At most one sample per query interval is
+///     taken from a peer.
+/// @limitations none
+/// @pre None
+/// @post A passive sample may be scheduled on the strand.
+/// @param msg The window received from the peer.
+/// @param peer The interned UUID of the sender.
+/// @param received The kernel receive time, or not_a_date_time.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::ReadWindow(const ProtocolMessageWindow& msg,
+    PeerId peer, boost::posix_time::ptime received)
+{
+    if(!msg.has_clock_usec() || !CGlobalConfiguration::Instance().GetPassiveClock())
+        return;
+    boost::posix_time::ptime local =
+        received.is_not_a_date_time() ? CVirtualClock::Now() : received;
+    boost::posix_time::ptime remote =
+        EPOCH + boost::posix_time::microseconds(msg.clock_usec());
+    bool sample = false;
+    {
+        boost::mutex::scoped_lock echolock(m_echomutex);
+        if(peer >= m_echoes.size())
         {
-            m_offsets[il] = boost::posix_time::milliseconds(0);
-            SetWeight(il, 0.0);
-            m_skews[il] = 0.0;
+            SClockEcho none;
+            none.remote = 0;
+            m_echoes.resize(peer + 1, none);
         }
-        if(GetWeight(il) < wjl)
+        SClockEcho& echo = m_echoes[peer];
+        if(msg.has_echo_usec() && (echo.sampled.is_not_a_date_time() ||
+            local - echo.sampled >= boost::posix_time::milliseconds(QUERY_INTERVAL)))
         {
-            m_offsets[il] = m_offsets[ij] + cjl;
-            SetWeight(il, wjl);
-            m_skews[il] = m_skews[ij] + fjl;
+            echo.sampled = local;
+            sample = true;
         }
+        echo.remote = msg.clock_usec();
+        echo.received = local;
+    }
+    if(sample)
+    {
+        // The hold time is on the clock of the peer, which barely skews in it
+        boost::posix_time::ptime challenge = EPOCH
+            + boost::posix_time::microseconds(msg.echo_usec())
+            + boost::posix_time::microseconds(msg.echo_hold_usec());
+        CBroker::Instance().GetStrand().post(boost::bind(
+            &CClockSynchronizer::HandlePassiveSample, this, peer, challenge,
+            remote, local));
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::HandlePassiveSample
+/// @description Adds a round trip taken from the regular traffic to the
+///     regression of a peer. A peer sampled within the last few exchange
+///     rounds is not queried by the exchange.
+/// @limitations none
+/// @pre Called on the strand.
+/// @post The offset and skew of the peer are updated.
+/// @param peer The interned UUID of the peer.
+/// @param challenge When this node sent the echoed window, plus the hold.
+/// @param remote The unsynchronized time the peer sent its window.
+/// @param local When this node received the window of the peer.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::HandlePassiveSample(PeerId peer,
+    boost::posix_time::ptime challenge, boost::posix_time::ptime remote,
+    boost::posix_time::ptime local)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::size_t ij = InternPeer(peer);
+    if(ij == 0 || challenge > local)
+        return;
+    PassiveMetric.Increment();
+    AddSample(ij, challenge, remote, local);
+    m_peers[ij].passive = true;
+    m_peers[ij].lastpassive = m_kcounter;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CClockSynchronizer::Exchange
 /// @description Makes clock reading requests to the other processes in the
@@ -300,14 +450,15 @@ void CClockSynchronizer::HandleExchangeResponse(const ExchangeResponseMessage& m
 ///////////////////////////////////////////////////////////////////////////////
 void CClockSynchronizer::Exchange(const boost::system::error_code& err)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(err)
         return;
     // Loop through the peers and send them beacons
     std::deque< CPeerNode > tmplist;
     std::deque< CPeerNode > tmplist2;
     bool flop = false;
-    BOOST_FOREACH(CPeerNode peer, CGlobalPeerList::instance().PeerList() | boost::adaptors::map_values)
+    CGlobalPeerList::Snapshot known = CGlobalPeerList::instance().PeerList();
+    BOOST_FOREACH(const CPeerNode& peer, *known | boost::adaptors::map_values)
     {
         if(peer.GetUUID() == GetUUID())
            flop = true;
@@ -318,54 +469,179 @@ void CClockSynchronizer::Exchange(const boost::system::error_code& err)
     }
     // put elements from list b into list a
     tmplist.insert(tmplist.end(),tmplist2.begin(),tmplist2.end());
+    // Stable peers are only queried every few rounds, and peers with recent
+    // traffic not at all
+    std::deque< CPeerNode > pending;
+    BOOST_FOREACH(CPeerNode peer, tmplist)
+    {
+        const SPeerClock& entry = m_peers[InternPeer(peer.GetId())];
+        if(entry.passive && m_kcounter - entry.lastpassive < PASSIVE_ROUNDS)
+            continue;
+        if(entry.nextquery <= m_kcounter)
+            pending.push_back(peer);
+    }
+    tmplist.swap(pending);
+    // The whole exchange goes out as one multicast message if we can
+    CSerializedMessage::Pointer query = CreateExchangeMessage(m_kcounter);
+    std::vector<std::string> recipients;
+    BOOST_FOREACH(CPeerNode peer, tmplist)
+    {
+        recipients.push_back(peer.GetUUID());
+    }
+    bool multicast = !tmplist.empty()
+        && CMulticastChannel::Instance().Send(query, recipients);
     // This should do a circular shift of the queries, which SHOULD help with traffic if I have postulated correctly.
     BOOST_FOREACH(CPeerNode peer, tmplist)
     {
-        peer.Send(CreateExchangeMessage(m_kcounter));
-        MapIndex ij(GetUUID(),peer.GetUUID());
-        m_queries[ij] = QueryRecord(m_kcounter, boost::posix_time::microsec_clock::universal_time());
+        if(!multicast)
+        {
+            peer.Send(query);
+        }
+        SPeerClock& entry = m_peers[InternPeer(peer.GetId())];
+        entry.querying = true;
+        entry.query = m_kcounter;
+        entry.querytime = CVirtualClock::Now();
     }
     m_kcounter++;
     // Run this every so often
     m_exchangetimer.expires_from_now(boost::posix_time::milliseconds(QUERY_INTERVAL));
-    m_exchangetimer.async_wait(boost::bind(&CClockSynchronizer::Exchange,this,
-        boost::asio::placeholders::error));
+    m_exchangetimer.async_wait(CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CClockSynchronizer::Exchange,this,
+        boost::asio::placeholders::error)));
     //make sure the self referential entries stay sane.
-    MapIndex ii(GetUUID(),GetUUID());
-    m_offsets[ii] = boost::posix_time::milliseconds(0);
-    SetWeight(ii, 1.0);
-    m_skews[ii] = 0.0;
+    ResetSelf();
+    UpdateOffset();
+    ResetSelf();
+    NoteMemory();
+    SaveWarmState();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::UpdateOffset
+/// @description Sets the offset and skew of this node to the weighted mean of
+///     the offsets and skews it knows, and the clock skew of the
+///     configuration with it.
+/// @limitations none
+/// @pre The entry of this node is sane.
+/// @post m_myoffset and m_myskew are updated if any weight is known.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::UpdateOffset()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     //First, we compute our personal offset and skew:
     double tmp1 = 0.0;
     double tmp2 = 0.0;
     double tmp3 = 0.0;
-    OffsetMap::iterator oit;
-    for(oit = m_offsets.begin(); oit != m_offsets.end(); oit++)
+    for(std::size_t i = 0; i < m_peers.size(); i++)
     {
-        tmp1 += GetWeight(oit->first) * TDToDouble(oit->second);
-        tmp2 += GetWeight(oit->first);
-        tmp3 += GetWeight(oit->first) * m_skews[oit->first];
+        if(!m_peers[i].known)
+            continue;
+        double weight = GetWeight(i);
+        tmp1 += weight * TDToDouble(m_peers[i].offset);
+        tmp2 += weight;
+        tmp3 += weight * m_peers[i].skew;
     }
     if(tmp2 != 0.0)
     {
         tmp1 /= tmp2;
         tmp3 /= tmp2;
         m_myoffset = DoubleToTD(tmp1);
-        Logger.Notice<<"Adjusting Skew to "<<m_myoffset<<std::endl;
+        LOG_NOTICE(Logger)<<"Adjusting Skew to "<<m_myoffset<<std::endl;
         CGlobalConfiguration::Instance().SetClockSkew(m_myoffset);
         m_myskew = tmp3;
     }
     //Now we adjust the CRAP out of our offset and skew table.
     /*
-    for(oit = m_offsets.begin(); oit != m_offsets.end(); oit++)
+    for(std::size_t i = 0; i < m_peers.size(); i++)
     {
-        oit->second -= DoubleToTD(tmp1);
-        m_skews[oit->first] -= tmp3;
+        m_peers[i].offset -= DoubleToTD(tmp1);
+        m_peers[i].skew -= tmp3;
     }
     */
-    m_offsets[ii] = boost::posix_time::milliseconds(0);
-    SetWeight(ii, 1.0);
-    m_skews[ii] = 0.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::ResumeWarmState
+/// @description Starts the offset table from the offsets and skews of the
+///     last run, at a part of their weight, so the synchronized time is close
+///     from the start and the first responses quickly take over.
+/// @limitations The UUIDs of the peers must not have changed.
+/// @pre Called before the first exchange.
+/// @post The nodes of the warm state are known and the offset is updated.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::ResumeWarmState()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::vector<WarmClock> clocks = CWarmState::Instance().GetClockHints();
+    BOOST_FOREACH(const WarmClock& clock, clocks)
+    {
+        if(clock.uuid() == GetUUID())
+            continue;
+        std::size_t i = InternPeer(clock.uuid());
+        m_peers[i].known = true;
+        m_peers[i].offset = boost::posix_time::microseconds(clock.offset());
+        m_peers[i].skew = clock.skew();
+        SetWeight(i, clock.weight() * WARM_TRUST);
+    }
+    if(!clocks.empty())
+    {
+        LOG_NOTICE(Logger) << "Resumed " << clocks.size() << " clock offsets" << std::endl;
+        UpdateOffset();
+        ResetSelf();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::SaveWarmState
+/// @description Hands the known offsets, skews and decayed weights to the
+///     warm state.
+/// @limitations none
+/// @pre None
+/// @post The warm state holds the offset table if it is enabled.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::SaveWarmState()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!CWarmState::Instance().IsEnabled())
+        return;
+    std::vector<WarmClock> clocks;
+    for(std::size_t i = 1; i < m_peers.size(); i++)
+    {
+        if(!m_peers[i].known)
+            continue;
+        WarmClock clock;
+        clock.set_uuid(m_peers[i].uuid);
+        clock.set_offset(m_peers[i].offset.total_microseconds());
+        clock.set_skew(m_peers[i].skew);
+        clock.set_weight(GetWeight(i));
+        clocks.push_back(clock);
+    }
+    CWarmState::Instance().SaveClocks(clocks);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::NoteMemory
+/// @description Reports the sizes of the peer table, its index and the
+///     response rings. The table only grows as nodes are discovered, and each
+///     ring holds at most MAX_REGRESSION_ENTRIES responses.
+/// @limitations none
+/// @pre None
+/// @post The clk container metrics match the peer state.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::NoteMemory()
+{
+    std::size_t bytes = m_peers.capacity() * sizeof(SPeerClock)
+        + m_peerindex.capacity() * sizeof(std::size_t);
+    std::size_t responses = 0;
+    std::size_t slots = 0;
+    for(std::size_t i = 0; i < m_peers.size(); i++)
+    {
+        bytes += m_peers[i].uuid.capacity();
+        responses += m_peers[i].responses.size();
+        slots += m_peers[i].responses.capacity();
+    }
+    m_peermemory.Update(m_peers.size(), bytes);
+    m_responsememory.Update(responses, slots * sizeof(SResponse));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -379,13 +655,23 @@ void CClockSynchronizer::Exchange(const boost::system::error_code& err)
 ///		increasing value for each receiver 
 /// @return A prepared exchange message.
 ///////////////////////////////////////////////////////////////////////////////
-ModuleMessage CClockSynchronizer::CreateExchangeMessage(unsigned int k)
+CSerializedMessage::Pointer CClockSynchronizer::CreateExchangeMessage(unsigned int k)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    ClockSynchronizerMessage csm;
-    ExchangeMessage* em = csm.mutable_exchange_message();
-    em->set_query(k);
-    return PrepareForSending(csm);
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!m_exchange || m_exchangeepoch != CBroker::Instance().GetDigestEpoch())
+    {
+        // Only the query number and the load balance digest change
+        ClockSynchronizerMessage csm;
+        csm.mutable_exchange_message()->set_query(0);
+        ModuleMessage mm = PrepareForSending(csm);
+        m_exchangeepoch = CBroker::Instance().AttachStateDigest(mm);
+        m_exchange.reset(new CMessageTemplate(mm,
+            boost::assign::list_of<int>
+                (ModuleMessage::kClockSynchronizerMessageFieldNumber)
+                (ClockSynchronizerMessage::kExchangeMessageFieldNumber)
+                (ExchangeMessage::kQueryFieldNumber)));
+    }
+    return m_exchange->Instantiate(k);
 }
 
 
@@ -402,22 +688,27 @@ ModuleMessage CClockSynchronizer::CreateExchangeMessage(unsigned int k)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage CClockSynchronizer::CreateExchangeResponse(unsigned int k)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     ClockSynchronizerMessage csm;
     ExchangeResponseMessage* erm = csm.mutable_exchange_response_message();
     erm->set_response(k);
     erm->set_unsynchronized_sendtime(boost::posix_time::to_simple_string(
-        boost::posix_time::microsec_clock::universal_time()));
-    for(OffsetMap::iterator oit=m_offsets.begin(); oit != m_offsets.end(); oit++)
+        CVirtualClock::Now()));
+    for(std::size_t i = 0; i < m_peers.size(); i++)
     {
+        const SPeerClock& entry = m_peers[i];
+        if(!entry.known)
+            continue;
         ExchangeResponseMessage::TableEntry* te = erm->add_table_entry();
-        te->set_uuid(oit->first.second);
-        te->set_offset_secs(oit->second.total_seconds());
-        te->set_offset_fracs(oit->second.fractional_seconds());
-        te->set_skew(m_skews[oit->first]);
-        te->set_weight(GetWeight(oit->first));
+        te->set_uuid(entry.uuid);
+        te->set_offset_secs(entry.offset.total_seconds());
+        te->set_offset_fracs(entry.offset.fractional_seconds());
+        te->set_skew(entry.skew);
+        te->set_weight(GetWeight(i));
     }
-    return PrepareForSending(csm);
+    ModuleMessage mm = PrepareForSending(csm);
+    CBroker::Instance().AttachStateDigest(mm);
+    return mm;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -430,29 +721,87 @@ ModuleMessage CClockSynchronizer::CreateExchangeResponse(unsigned int k)
 ///////////////////////////////////////////////////////////////////////////////
 boost::posix_time::ptime CClockSynchronizer::GetSynchronizedTime() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::posix_time::ptime now = CVirtualClock::Now();
     return now + CGlobalConfiguration::Instance().GetClockSkew();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::InternPeer
+/// @description Finds the index of a node in the peer table. A node seen for
+///     the first time is appended with no offset and no outstanding query.
+/// @limitations Indices are never reused, so references into the table are
+///     invalidated when a new node is added.
+/// @pre None
+/// @post The node has an entry in the peer table.
+/// @param uuid The UUID of the node.
+/// @return The index of the node in the peer table.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CClockSynchronizer::InternPeer(const std::string& uuid)
+{
+    return InternPeer(CPeerIdTable::Instance().Intern(uuid));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::InternPeer
+/// @description Finds the index of a node in the peer table by the handle of
+///     its UUID, which indexes m_peerindex directly.
+/// @limitations Indices are never reused, so references into the table are
+///     invalidated when a new node is added.
+/// @pre None
+/// @post The node has an entry in the peer table.
+/// @param id The interned UUID of the node.
+/// @return The index of the node in the peer table.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CClockSynchronizer::InternPeer(PeerId id)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(id < m_peerindex.size() && m_peerindex[id] != NO_INDEX)
+        return m_peerindex[id];
+    SPeerClock entry;
+    entry.uuid = CPeerIdTable::Instance().GetUUID(id);
+    entry.known = false;
+    entry.offset = boost::posix_time::milliseconds(0);
+    entry.skew = 0.0;
+    entry.weight = 0.0;
+    entry.lastresponse = m_kcounter;
+    entry.querying = false;
+    entry.query = 0;
+    entry.nextresponse = 0;
+    entry.sumx = 0.0;
+    entry.sumy = 0.0;
+    entry.sumxx = 0.0;
+    entry.sumxy = 0.0;
+    entry.sumlag = 0.0;
+    entry.stride = 1;
+    entry.nextquery = 0;
+    entry.passive = false;
+    entry.lastpassive = 0;
+    m_peers.push_back(entry);
+    if(id >= m_peerindex.size())
+        m_peerindex.resize(id + 1, NO_INDEX);
+    m_peerindex[id] = m_peers.size()-1;
+    return m_peers.size()-1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CClockSynchronizer::GetWeight
 /// @description Returns the confidence in the relative offset between 2 nodes
 /// @limitations none
-/// @pre None
+/// @pre i is a known entry of the peer table
 /// @post None
+/// @param i The index of the other node in the peer table.
 /// @return The weight of a processes clock measurement.
 ///////////////////////////////////////////////////////////////////////////////
-double CClockSynchronizer::GetWeight(MapIndex i) const
+double CClockSynchronizer::GetWeight(std::size_t i) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    WeightMap::const_iterator it = m_weights.find(i);
-    boost::posix_time::ptime set;
-    if(i == MapIndex(GetUUID(),GetUUID()))
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(i == 0)
         return 1.0;
-    if(it == m_weights.end())
+    if(i >= m_peers.size() || !m_peers[i].known)
         throw std::runtime_error("Can't find that index in the weights table");
-    return it->second.first * pow(SYNCHRONIZER_LAMBDA,m_kcounter-m_lastresponse.find(i)->second);
+    const SPeerClock& entry = m_peers[i];
+    return entry.weight * pow(SYNCHRONIZER_LAMBDA,m_kcounter-entry.lastresponse);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -461,15 +810,108 @@ double CClockSynchronizer::GetWeight(MapIndex i) const
 /// @limitations none
 /// @pre None
 /// @post None
-/// @param i The weight to update
+/// @param i The index of the node whose weight to update
 /// @param w The amount of weight
 ///////////////////////////////////////////////////////////////////////////////
-void CClockSynchronizer::SetWeight(MapIndex i, double w)
+void CClockSynchronizer::SetWeight(std::size_t i, double w)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    DecayingWeight weight(w, boost::posix_time::microsec_clock::universal_time());
-    m_weights[i] = weight;
-    m_lastresponse[i] = m_kcounter;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_peers[i].weight = w;
+    m_peers[i].lastresponse = m_kcounter;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::ResetSelf
+/// @description Makes sure the self referential entry stays sane.
+/// @limitations none
+/// @pre InternPeer has been called for this node.
+/// @post This node has no offset or skew from itself and full weight.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::ResetSelf()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_peers[0].known = true;
+    m_peers[0].offset = boost::posix_time::milliseconds(0);
+    SetWeight(0, 1.0);
+    m_peers[0].skew = 0.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::AddResponse
+/// @description Puts a response in the ring of a node, replacing the oldest
+///     response once the ring is full, and updates the regression sums by
+///     the difference. The sums are recomputed each time the ring wraps so
+///     rounding errors cannot pile up.
+/// @limitations none
+/// @pre The response is relative to the reference of the entry.
+/// @post The sums cover the last MAX_REGRESSION_ENTRIES responses.
+/// @param entry The node that responded.
+/// @param response The new response.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::AddResponse(SPeerClock& entry, const SResponse& response)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(entry.responses.size() < static_cast<std::size_t>(MAX_REGRESSION_ENTRIES))
+    {
+        entry.responses.push_back(response);
+    }
+    else
+    {
+        const SResponse& old = entry.responses[entry.nextresponse];
+        entry.sumx -= 2 * old.remote;
+        entry.sumy -= old.challenge + old.local;
+        entry.sumxx -= 2 * old.remote * old.remote;
+        entry.sumxy -= old.remote * (old.challenge + old.local);
+        entry.sumlag -= old.local - old.challenge;
+        entry.responses[entry.nextresponse] = response;
+    }
+    entry.sumx += 2 * response.remote;
+    entry.sumy += response.challenge + response.local;
+    entry.sumxx += 2 * response.remote * response.remote;
+    entry.sumxy += response.remote * (response.challenge + response.local);
+    entry.sumlag += response.local - response.challenge;
+
+    entry.nextresponse++;
+    if(entry.nextresponse == static_cast<std::size_t>(MAX_REGRESSION_ENTRIES))
+    {
+        entry.nextresponse = 0;
+        RebaseResponses(entry);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CClockSynchronizer::RebaseResponses
+/// @description Moves the reference of a ring to its oldest response, which
+///     keeps the stored times small, and recomputes the regression sums.
+/// @limitations none
+/// @pre None
+/// @post The sums match the responses in the ring.
+/// @param entry The node whose ring to rebase.
+///////////////////////////////////////////////////////////////////////////////
+void CClockSynchronizer::RebaseResponses(SPeerClock& entry)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(entry.responses.empty())
+        return;
+    double shift = entry.responses[entry.nextresponse].remote;
+    entry.reference += DoubleToTD(shift);
+    shift = TDToDouble(DoubleToTD(shift));
+    entry.sumx = 0.0;
+    entry.sumy = 0.0;
+    entry.sumxx = 0.0;
+    entry.sumxy = 0.0;
+    entry.sumlag = 0.0;
+    BOOST_FOREACH(SResponse& r, entry.responses)
+    {
+        r.remote -= shift;
+        r.challenge -= shift;
+        r.local -= shift;
+        entry.sumx += 2 * r.remote;
+        entry.sumy += r.challenge + r.local;
+        entry.sumxx += 2 * r.remote * r.remote;
+        entry.sumxy += r.remote * (r.challenge + r.local);
+        entry.sumlag += r.local - r.challenge;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -483,7 +925,7 @@ void CClockSynchronizer::SetWeight(MapIndex i, double w)
 ///////////////////////////////////////////////////////////////////////////////
 double CClockSynchronizer::TDToDouble(boost::posix_time::time_duration td)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     double x = td.total_seconds() + (td.fractional_seconds()*1.0)/1000000;
     return x;
 }
@@ -499,7 +941,7 @@ double CClockSynchronizer::TDToDouble(boost::posix_time::time_duration td)
 ///////////////////////////////////////////////////////////////////////////////
 boost::posix_time::time_duration CClockSynchronizer::DoubleToTD(double td)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     double seconds, tmp, fractional;
     tmp = modf(td, &seconds);
     tmp *= 1000000; // Shift out to the microseconds
@@ -518,7 +960,7 @@ boost::posix_time::time_duration CClockSynchronizer::DoubleToTD(double td)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage CClockSynchronizer::PrepareForSending(const ClockSynchronizerMessage& message)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     ModuleMessage mm;
     mm.mutable_clock_synchronizer_message()->CopyFrom(message);
     mm.set_recipient_module("clk");
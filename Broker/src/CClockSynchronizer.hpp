@@ -23,14 +23,19 @@
 #ifndef FREEDM_CLOCK_HPP
 #define FREEDM_CLOCK_HPP
 
+#include "CMetrics.hpp"
+#include "CPeerIdTable.hpp"
 #include "IDGIModule.hpp"
+#include "CVirtualClock.hpp"
+#include "Messages.hpp"
 
-#include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
-#include <boost/asio/deadline_timer.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace freedm {
     namespace broker {
@@ -52,30 +57,87 @@ public:
     void Stop();
     /// Processes incoming messages from other modules.
     void HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer);
+    /// Puts the clock readings for a passive sample on a window to a peer
+    void StampWindow(ProtocolMessageWindow& msg, PeerId peer);
+    /// Takes a passive sample from the clock readings of a received window
+    void ReadWindow(const ProtocolMessageWindow& msg, PeerId peer,
+        boost::posix_time::ptime received);
 
 private:
-    /// Does the i,j referencing
-    typedef std::pair<std::string,std::string> MapIndex;
-    /// Stores the relative offsets
-    typedef std::map< MapIndex, boost::posix_time::time_duration > OffsetMap;
-    /// Query Tuple
-    typedef std::pair<unsigned int, boost::posix_time::ptime> QueryRecord;
-    /// Stores the outstanding clock queries
-    typedef std::map< MapIndex, QueryRecord > QueryMap;
-    /// Tuples of challenge query/response stuff
-    typedef std::pair<boost::posix_time::ptime, boost::posix_time::ptime> TimeTuple;
-    /// Stores the response pairs
-    typedef std::list< TimeTuple > ResponseList;
-    /// Stores the challenge responses
-    typedef std::map< MapIndex, ResponseList > ResponseMap;
-    /// Type used by skews
-    typedef std::map< MapIndex, double > SkewMap;
-    /// Container for decaying weights
-    typedef std::pair< double, boost::posix_time::ptime > DecayingWeight;
-    /// Type used by the weights
-    typedef std::map< MapIndex, DecayingWeight > WeightMap;
-    /// Last responses type
-    typedef std::map< MapIndex, unsigned int > LastResponseMap;
+    /// One answered query, in seconds after the reference of its ring
+    struct SResponse
+    {
+        /// The unsynchronized time the other node sent its response
+        double remote;
+        /// The time this node sent the query
+        double challenge;
+        /// The time this node received the response
+        double local;
+    };
+    /// Fixed-size ring of the answered queries
+    typedef std::vector< SResponse > ResponseRing;
+
+    /// Everything this node knows about its relation to one other node
+    struct SPeerClock
+    {
+        /// The UUID of the other node
+        std::string uuid;
+        /// True once the node has an entry in the offset table
+        bool known;
+        /// Relative offset
+        boost::posix_time::time_duration offset;
+        /// Relative skew
+        double skew;
+        /// Relative weight before its decay
+        double weight;
+        /// The k of the last time the weight was set
+        unsigned int lastresponse;
+        /// True while a clock query is outstanding
+        bool querying;
+        /// The k of the outstanding query
+        unsigned int query;
+        /// When the outstanding query was sent
+        boost::posix_time::ptime querytime;
+        /// Old responses, at most MAX_REGRESSION_ENTRIES
+        ResponseRing responses;
+        /// Where the next response goes in the ring
+        std::size_t nextresponse;
+        /// The time the response times are relative to
+        boost::posix_time::ptime reference;
+        /// Sum of the remote times of both points of each response
+        double sumx;
+        /// Sum of the challenge and local times
+        double sumy;
+        /// Sum of the squared remote times of both points
+        double sumxx;
+        /// Sum of the remote times multiplied by the local times
+        double sumxy;
+        /// Sum of the round trip times
+        double sumlag;
+        /// The number of exchange rounds between queries
+        unsigned int stride;
+        /// The k of the next query
+        unsigned int nextquery;
+        /// True once a passive sample was taken from the regular traffic
+        bool passive;
+        /// The k of the last passive sample
+        unsigned int lastpassive;
+    };
+    /// Peer state, indexed by the interned peer
+    typedef std::vector< SPeerClock > PeerClockTable;
+    /// Maps an interned UUID to its index in the peer state
+    typedef std::vector< std::size_t > PeerIndexMap;
+
+    /// The clock readings of the last window received from one peer
+    struct SClockEcho
+    {
+        /// The unsynchronized send time of the window, 0 if none arrived
+        google::protobuf::uint64 remote;
+        /// When this node received the window
+        boost::posix_time::ptime received;
+        /// When this node last took a passive sample from the peer
+        boost::posix_time::ptime sampled;
+    };
 
     /// Handler for clock exchange responses
     void HandleExchangeResponse(const ExchangeResponseMessage& msg, CPeerNode peer);
@@ -84,29 +146,32 @@ private:
     /// Sends clock exchange requests to other processes
     void Exchange(const boost::system::error_code& err );
 
+    /// Handler for a clock reading taken from the regular traffic
+    void HandlePassiveSample(PeerId peer, boost::posix_time::ptime challenge,
+        boost::posix_time::ptime remote, boost::posix_time::ptime local);
+    /// Updates the offset and skew of a node by one round trip
+    void AddSample(std::size_t ij, const boost::posix_time::ptime& challenge,
+        const boost::posix_time::ptime& remote, const boost::posix_time::ptime& local);
+
     /// Generate the exchange message
-    ModuleMessage CreateExchangeMessage(unsigned int k);
+    CSerializedMessage::Pointer CreateExchangeMessage(unsigned int k);
     /// Generate the exchange response message
     ModuleMessage CreateExchangeResponse(unsigned int k);
     /// Wraps a clock synchronizer message in a ModuleMessage
     static ModuleMessage PrepareForSending(const ClockSynchronizerMessage& message);
 
-    /// Relative offsets
-    OffsetMap m_offsets;
-    /// Relative skews
-    SkewMap m_skews;
-    /// Relative weights
-    WeightMap m_weights;
-    /// Outstanding Clock Queries
-    QueryMap m_queries;
-    /// Old responses
-    ResponseMap m_responses;
+    /// Offsets, skews, weights, queries and responses of every known node
+    PeerClockTable m_peers;
+    /// The index of each node in m_peers; this node is always index 0
+    PeerIndexMap m_peerindex;
     /// Time between interactions
     boost::posix_time::ptime m_lastinteraction;
     /// The current k for identifying the freshness
     unsigned int m_kcounter;
-    /// The last time a node responded
-    LastResponseMap m_lastresponse;
+    /// The exchange message, encoded again when the load balance digest changes
+    boost::shared_ptr<CMessageTemplate> m_exchange;
+    /// The epoch of the load balance digest m_exchange carries
+    google::protobuf::uint64 m_exchangeepoch;
 
     /// My offset
     boost::posix_time::time_duration m_myoffset;
@@ -114,13 +179,50 @@ private:
     double m_myskew;
 
     ///Time for the exchange
-    boost::asio::deadline_timer m_exchangetimer;
+    CVirtualTimer m_exchangetimer;
+
+    /// Size of m_peers and m_peerindex
+    CSizeTracker m_peermemory;
+    /// Size of the response rings of m_peers
+    CSizeTracker m_responsememory;
+
+    /// The last window received from each peer, by the interned UUID
+    std::vector< SClockEcho > m_echoes;
+    /// Lock for m_echoes, which the connections use off the strand
+    boost::mutex m_echomutex;
+
+    /// Gets the index of a node in m_peers, adding the node if it is new
+    std::size_t InternPeer(const std::string& uuid);
+
+    /// Gets the index of an interned node in m_peers, adding the node if it is new
+    std::size_t InternPeer(PeerId id);
 
     /// Gets the weight with a decay.
-    double GetWeight(MapIndex i) const;
+    double GetWeight(std::size_t i) const;
 
     /// Sets the weight for a process.
-    void SetWeight(MapIndex i, double w);
+    void SetWeight(std::size_t i, double w);
+
+    /// Resets the entry of this node to itself
+    void ResetSelf();
+
+    /// Reports the sizes of the peer state to the metrics
+    void NoteMemory();
+
+    /// Sets the offset and skew of this node from the offset table
+    void UpdateOffset();
+
+    /// Starts the offset table from the warm state of the last run
+    void ResumeWarmState();
+
+    /// Saves the offset table to the warm state
+    void SaveWarmState();
+
+    /// Adds a response to the regression of a node
+    static void AddResponse(SPeerClock& entry, const SResponse& response);
+
+    /// Moves the reference of a response ring and recomputes its sums
+    static void RebaseResponses(SPeerClock& entry);
 
     ///Turn a time duration into a double
     static double TDToDouble(boost::posix_time::time_duration td);
@@ -22,11 +22,14 @@
 /// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include "config.hpp"
+
 #include "CConnection.hpp"
 
 #include "CBroker.hpp"
 #include "CDispatcher.hpp"
 #include "CLogger.hpp"
+#include "CProtocolDatagram.hpp"
 #include "CProtocolSR.hpp"
 #include "messages/ModuleMessage.pb.h"
 #include "messages/ProtocolMessage.pb.h"
@@ -42,6 +45,21 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Creates the protocol of a lane. The realtime lane carries messages whose
+/// value expires before a resend could arrive, so it is best effort; every
+/// lane is when the broker is built with DATAGRAM.
+boost::shared_ptr<IProtocol> CreateProtocol(const std::string& uuid,
+    const boost::asio::ip::udp::endpoint& endpoint, EMessageLane lane)
+{
+#ifndef DATAGRAM
+    if(lane != LANE_REALTIME)
+    {
+        return boost::make_shared<CProtocolSR>(uuid, endpoint, lane);
+    }
+#endif
+    return boost::make_shared<CProtocolDatagram>(uuid, endpoint, lane);
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -52,9 +70,18 @@ CLocalLogger Logger(__FILE__);
 /// @param endpoint The target to send the messages to for this connection.
 ///////////////////////////////////////////////////////////////////////////////
 CConnection::CConnection(std::string uuid, boost::asio::ip::udp::endpoint endpoint)
-  : m_protocol(boost::make_shared<CProtocolSR>(uuid,endpoint))   // FIXME hardcoded protocol
+    : m_peer(CPeerIdTable::Instance().Intern(uuid))
+    , m_local(uuid == CGlobalConfiguration::Instance().GetUUID())
+    , m_active(false)
+    , m_idlerounds(0)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for(int lane = 0; lane < LANE_COUNT; lane++)
+    {
+        m_lanes.push_back(CreateProtocol(uuid, endpoint,
+            static_cast<EMessageLane>(lane)));
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -69,28 +96,39 @@ CConnection::~CConnection()
 /// CConnection::Stop
 /// @description Stops the protocol associated with this connection.
 /// @pre None.
-/// @post The message protocol's Stop method has been called.
+/// @post The Stop method of every lane's protocol has been called.
 ///////////////////////////////////////////////////////////////////////////////
 void CConnection::Stop()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    m_protocol->Stop();
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    for(std::size_t i = 0; i < m_lanes.size(); i++)
+    {
+        m_lanes[i]->Stop();
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnection::GetStopped
-/// @description Returns true if the underlying protocol has been stopped.
-/// @return True if the underlying protocol is stopped.
+/// @description Returns true if the protocol of any lane has been stopped.
+///     The lanes share the connection, so a lost lane replaces all of them.
+/// @return True if an underlying protocol is stopped.
 ///////////////////////////////////////////////////////////////////////////////
 bool CConnection::GetStopped()
 {
-    return m_protocol->GetStopped();
+    for(std::size_t i = 0; i < m_lanes.size(); i++)
+    {
+        if(m_lanes[i]->GetStopped())
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnection::ChangePhase
 /// @description An event that gets called when the broker changes the current
-///   phase.
+///   phase. A new round that follows one without traffic counts as idle.
 /// @pre None
 /// @post The protocol's ChangePhase event is called.
 /// @param newround If true, the phase change is also the start of an entirely
@@ -98,35 +136,112 @@ bool CConnection::GetStopped()
 ///////////////////////////////////////////////////////////////////////////////
 void CConnection::ChangePhase(bool newround)
 {
-    m_protocol->ChangePhase(newround);
+    if(newround)
+    {
+        m_idlerounds = m_active ? 0 : m_idlerounds + 1;
+        m_active = false;
+    }
+    for(std::size_t i = 0; i < m_lanes.size(); i++)
+    {
+        m_lanes[i]->ChangePhase(newround);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnection::Send
 /// @description Passes a message to the protocol to deliver it to the intended
 ///		recipient. If the intended recipient is this process, the delivery
-///		is done directly without the protocol.
+///		is done directly without the protocol, and the message is copied
+///		once but not serialized.
+/// @pre None.
+/// @post The message is scheduled to be delivered.
+/// @param msg The message to write to the channel.
+/// @return False if the protocol refused the message.
+///////////////////////////////////////////////////////////////////////////////
+bool CConnection::Send(const ModuleMessage& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_local)
+    {
+        return Send(boost::make_shared<const ModuleMessage>(msg));
+    }
+    return Send(boost::make_shared<const CSerializedMessage>(msg));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::Send
+/// @description Passes a shared message to the protocol. A message to this
+///		process is handed to the dispatcher as it is, and a message to
+///		another process is serialized without a copy.
+/// @pre The caller does not change the message after the call.
+/// @post The message is scheduled to be delivered.
+/// @param msg The message to write to the channel.
+/// @return False if the protocol refused the message.
+///////////////////////////////////////////////////////////////////////////////
+bool CConnection::Send(boost::shared_ptr<const ModuleMessage> msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_local)
+    {
+        GetSentMetric(msg->recipient_module()).Increment();
+        CDispatcher::Instance().HandleLocal(msg, m_peer);
+        return true;
+    }
+    return Send(boost::make_shared<const CSerializedMessage>(msg));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::Send
+/// @description Passes a serialized message to the protocol of its lane. The
+///     same serialized message can be given to several connections.
 /// @pre None.
 /// @post The message is scheduled to be delivered.
 /// @param msg The message to write to the channel.
+/// @return False if the send queue of the protocol is full.
 ///////////////////////////////////////////////////////////////////////////////
-void CConnection::Send(const ModuleMessage& msg)
+bool CConnection::Send(const CSerializedMessage::Pointer& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    GetSentMetric(msg->GetMessage().recipient_module()).Increment();
 
     // If the UUID of the recipient (The value stored by GetUUID of this
     // object) is the same as the this node's uuid, place the message directly
     // into the received Queue.
-    if(m_protocol->GetUUID() == CGlobalConfiguration::Instance().GetUUID())
+    // The delivered message is the copy kept by the serialized message,
+    // which stays alive until it has been handled, or parsed again from the
+    // bytes if a template patched them.
+    if(m_local)
     {
-        boost::shared_ptr<ModuleMessage> copy = boost::make_shared<ModuleMessage>();
-        copy->CopyFrom(msg);
-        CDispatcher::Instance().HandleRequest(copy, m_protocol->GetUUID());
+        CDispatcher::Instance().HandleLocal(CSerializedMessage::Unpack(msg), m_peer);
+        return true;
     }
-    else
+    m_active = true;
+    return m_lanes[msg->GetLane()]->Send(msg);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::GetSentMetric
+/// @description Gets the counter of the messages sent to a module, which is
+///     looked up in the registry only for the first message of each module.
+/// @pre Called on the broker strand, like Send.
+/// @post The counter of the module is cached in m_sent.
+/// @param module the recipient module of a message.
+/// @return The counter of the messages sent to the module.
+///////////////////////////////////////////////////////////////////////////////
+CCounter& CConnection::GetSentMetric(const std::string& module)
+{
+    std::map<std::string, CCounter*>::iterator it = m_sent.find(module);
+    if(it == m_sent.end())
     {
-        m_protocol->Send(msg);
+        CCounter* counter = &CMetrics::Instance().GetCounter(
+            "dgi_messages_sent_total", "Module messages sent, by recipient module",
+            CMetrics::Label("module", module));
+        it = m_sent.insert(std::make_pair(module, counter)).first;
     }
+    return *it->second;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -135,27 +250,39 @@ void CConnection::Send(const ModuleMessage& msg)
 /// @pre Initialized connection.
 /// @post Calls the protocol's ReceiveACK function
 /// @param msg The received acknowledge message.
+/// @param lane The lane of the window the message arrived in.
 ///////////////////////////////////////////////////////////////////////////////
-void CConnection::ReceiveACK(const ProtocolMessage& msg)
+void CConnection::ReceiveACK(const ProtocolMessage& msg, EMessageLane lane)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    m_protocol->ReceiveACK(msg);
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_active = true;
+    m_lanes[lane]->ReceiveACK(msg);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnection::Receive
 /// @description Handler for receiving a non-ACK message from the peer
 /// @pre Initialized connection.
-/// @post Calls the protocol's Receive method.
+/// @post Calls the protocol's Receive method. An accepted message is ACKed
+///     and handed to the protocol to learn if it completes a module message.
+/// @param window The received window that holds the message.
 /// @param msg The message received from the peer.
+/// @param lane The lane of the window the message arrived in.
+/// @param complete Set to the module message to dispatch, or left empty if
+///     the accepted message was only a piece of one.
+/// @return True if the protocol accepted the message.
 ///////////////////////////////////////////////////////////////////////////////
-bool CConnection::Receive(const ProtocolMessage& msg)
+bool CConnection::Receive(boost::shared_ptr<const ProtocolMessageWindow> window,
+    const ProtocolMessage& msg, EMessageLane lane,
+    boost::shared_ptr<const ModuleMessage>& complete)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    if(m_protocol->Receive(msg))
+    m_active = true;
+    if(m_lanes[lane]->Receive(msg))
     {
-        m_protocol->SendACK(msg);
+        m_lanes[lane]->SendACK(msg);
+        complete = m_lanes[lane]->Deliver(window, msg);
         return true;
     }
 
@@ -167,11 +294,12 @@ bool CConnection::Receive(const ProtocolMessage& msg)
 /// @description Handles performing some action after processing a received
 ///     window.
 /// @pre None
-/// @post Call's the protocol's OnReceive method.
+/// @post Call's the OnReceive method of the lane's protocol.
+/// @param lane The lane of the processed window.
 ///////////////////////////////////////////////////////////////////////////////
-void CConnection::OnReceive()
+void CConnection::OnReceive(EMessageLane lane)
 {
-    m_protocol->OnReceive();
+    m_lanes[lane]->OnReceive();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -183,9 +311,9 @@ void CConnection::OnReceive()
 ///////////////////////////////////////////////////////////////////////////////
 std::string CConnection::GetUUID() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    return m_protocol->GetUUID();
+    return m_lanes[LANE_CONTROL]->GetUUID();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -198,9 +326,28 @@ std::string CConnection::GetUUID() const
 ///////////////////////////////////////////////////////////////////////////////
 void CConnection::SetReliability(int r)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    return m_protocol->SetReliability(r);
+    for(std::size_t i = 0; i < m_lanes.size(); i++)
+    {
+        m_lanes[i]->SetReliability(r);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::SetPeerInflates
+/// @description Lets the protocols of every lane deflate the large windows
+///     they write, once the peer has asked for it in a window of its own.
+/// @pre None
+/// @post The lanes deflate their windows if the peer inflates them.
+/// @param inflates set if the last window of the peer asked for deflation
+///////////////////////////////////////////////////////////////////////////////
+void CConnection::SetPeerInflates(bool inflates)
+{
+    for(std::size_t i = 0; i < m_lanes.size(); i++)
+    {
+        m_lanes[i]->SetPeerInflates(inflates);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -212,9 +359,67 @@ void CConnection::SetReliability(int r)
 ///////////////////////////////////////////////////////////////////////////////
 int CConnection::GetReliability() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    return m_lanes[LANE_CONTROL]->GetReliability();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::GetStatistics
+/// @description Gets the round trip and retransmission statistics that the
+///     protocol of a lane has collected for this peer.
+/// @pre None.
+/// @post None.
+/// @param lane The lane to report on.
+/// @return The statistics of the protocol.
+///////////////////////////////////////////////////////////////////////////////
+SProtocolStatistics CConnection::GetStatistics(EMessageLane lane) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    return m_lanes[lane]->GetStatistics();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::IsIdle
+/// @description Checks if the connection went a number of rounds without a
+///     message sent or received, and no lane still holds a message.
+/// @pre None.
+/// @post None.
+/// @param rounds The idle rounds required.
+/// @return True if the connection can be dropped without losing a message.
+///////////////////////////////////////////////////////////////////////////////
+bool CConnection::IsIdle(unsigned int rounds) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_local || m_active || m_idlerounds < rounds)
+    {
+        return false;
+    }
+    for(std::size_t i = 0; i < m_lanes.size(); i++)
+    {
+        if(!m_lanes[i]->IsQuiet())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnection::IsCongested
+/// @description Checks if the bulk send window to the peer is full, so that
+///     new bulk messages have to wait for ACKs before they are written.
+/// @pre None.
+/// @post None.
+/// @return True if messages are queued behind the bulk send window.
+///////////////////////////////////////////////////////////////////////////////
+bool CConnection::IsCongested() const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    return m_protocol->GetReliability();
+    return m_lanes[LANE_BULK]->IsCongested();
 }
 
     } // namespace broker
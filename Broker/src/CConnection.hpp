@@ -26,11 +26,16 @@
 
 #include "CProtocolSR.hpp"
 #include "CDispatcher.hpp"
+#include "CMetrics.hpp"
 #include "SRemoteHost.hpp"
 
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace google {
   namespace protobuf {
@@ -74,16 +79,27 @@ public:
     bool GetStopped();
 
     /// Puts a message into the channel.
-    void Send(const ModuleMessage& msg);
+    bool Send(const ModuleMessage& msg);
+
+    /// Puts an already serialized message into the channel.
+    bool Send(const CSerializedMessage::Pointer& msg);
+
+    /// Puts a message the caller no longer changes into the channel.
+    bool Send(boost::shared_ptr<const ModuleMessage> msg);
+
+    /// Checks if messages are waiting for room in the send window.
+    bool IsCongested() const;
 
     /// Handles acknowledgement messages from the peer.
-    void ReceiveACK(const ProtocolMessage& msg);
+    void ReceiveACK(const ProtocolMessage& msg, EMessageLane lane);
 
     /// Handles messages from the peer.
-    bool Receive(const ProtocolMessage& msg);
+    bool Receive(boost::shared_ptr<const ProtocolMessageWindow> window,
+        const ProtocolMessage& msg, EMessageLane lane,
+        boost::shared_ptr<const ModuleMessage>& complete);
 
     /// Performs an action based on receiving a Protocol Message Window.
-    void OnReceive();
+    void OnReceive(EMessageLane lane);
     
     /// Allows protocols to peform an action when a phase ends.
     void ChangePhase(bool newround);
@@ -96,10 +112,37 @@ public:
     
     /// Get the connection reliability for DCUSTOMNETWORK
     int GetReliability() const;
+
+    /// Notes whether the peer asked for deflated windows.
+    void SetPeerInflates(bool inflates);
+
+    /// Gets the round trip and retransmission statistics of one lane.
+    SProtocolStatistics GetStatistics(EMessageLane lane = LANE_CONTROL) const;
+
+    /// Checks if the connection has been quiet for a number of rounds.
+    bool IsIdle(unsigned int rounds) const;
 private:
 
-    /// The network protocol to use for sending/receiving messages
-    boost::shared_ptr<IProtocol> m_protocol;
+    /// Gets the counter of the messages sent to a module.
+    CCounter& GetSentMetric(const std::string& module);
+
+    /// The interned UUID of the peer
+    PeerId m_peer;
+
+    /// Set if the peer is this process
+    bool m_local;
+
+    /// The network protocol of each priority lane, indexed by EMessageLane
+    std::vector<boost::shared_ptr<IProtocol> > m_lanes;
+
+    /// Counters of the messages sent, by recipient module
+    std::map<std::string, CCounter*> m_sent;
+
+    /// Set when a message is sent or received during the current round
+    bool m_active;
+
+    /// The rounds that ended without a message sent or received
+    unsigned int m_idlerounds;
 };
 
 typedef boost::shared_ptr<CConnection> ConnectionPtr;
@@ -30,16 +30,22 @@
 #include "CListener.hpp"
 #include "CLogger.hpp"
 #include "CGlobalConfiguration.hpp"
+#include "CMetrics.hpp"
+#include "CSharedMemoryTransport.hpp"
 
 #include <algorithm>
 
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/thread/locks.hpp>
 
+#include <sys/stat.h>
+
 namespace freedm {
 namespace broker {
 
@@ -48,6 +54,10 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Connections dropped after they went idle
+CCounter& ReapedMetric = CMetrics::Instance().GetCounter(
+    "dgi_connections_reaped_total", "Connections dropped after they went idle");
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -57,8 +67,10 @@ CLocalLogger Logger(__FILE__);
 /// @post Connection manager is ready for use
 ///////////////////////////////////////////////////////////////////////////////
 CConnectionManager::CConnectionManager()
+    : m_networkTime(0)
+    , m_networkRead(0)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -82,9 +94,9 @@ CConnectionManager& CConnectionManager::Instance()
 /// @pre The connection is initialized.
 /// @post The connection has been inserted into the connection map.
 ///////////////////////////////////////////////////////////////////////////////
-void CConnectionManager::PutConnection(std::string uuid, ConnectionPtr c)
+void CConnectionManager::PutConnection(const std::string& uuid, ConnectionPtr c)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     {
         boost::lock_guard< boost::mutex > scopedLock_( m_Mutex );
         m_connections.insert(connectionmap::value_type(uuid,c));
@@ -100,9 +112,9 @@ void CConnectionManager::PutConnection(std::string uuid, ConnectionPtr c)
 /// @param host The peer's hostname.
 /// @param port The port the peer listens on.
 ///////////////////////////////////////////////////////////////////////////////
-void CConnectionManager::PutHost(std::string u, std::string host, std::string port)
+void CConnectionManager::PutHost(const std::string& u, const std::string& host, const std::string& port)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     {
         boost::lock_guard< boost::mutex > scopedLock_( m_Mutex );
         if(m_hosts.count(u) != 0)
@@ -122,9 +134,9 @@ void CConnectionManager::PutHost(std::string u, std::string host, std::string po
 /// @param u the uuid to enter into the map.
 /// @param host The hostname and port to enter into the map.
 ///////////////////////////////////////////////////////////////////////////////
-void CConnectionManager::PutHost(std::string u, SRemoteHost host)
+void CConnectionManager::PutHost(const std::string& u, const SRemoteHost& host)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     {
         boost::lock_guard< boost::mutex > scopedLock_( m_Mutex );
         if(m_hosts.count(u) != 0)
@@ -142,14 +154,41 @@ void CConnectionManager::PutHost(std::string u, SRemoteHost host)
 ///////////////////////////////////////////////////////////////////////////////
 void CConnectionManager::Stop(ConnectionPtr c)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(m_connections.right.count(c))
     {
         m_connections.right.erase(c);
     }
+    Forget(c);
     c->Stop();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// CConnectionManager::Forget
+/// @description Removes a connection from the lookups by interned UUID and
+///     by endpoint, so the next lookup goes through the connection map.
+/// @pre None
+/// @post No cached lookup leads to the connection.
+/// @param c the connection to forget.
+///////////////////////////////////////////////////////////////////////////////
+void CConnectionManager::Forget(ConnectionPtr c)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::replace(m_peerConnections.begin(), m_peerConnections.end(), c,
+        ConnectionPtr());
+    for(routemap::iterator it = m_routes.begin(); it != m_routes.end(); )
+    {
+        if(it->second.connection == c)
+        {
+            it = m_routes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnectionManager::StopAll
 /// @description Stops all the connections registered with the connection
@@ -160,14 +199,16 @@ void CConnectionManager::Stop(ConnectionPtr c)
 ///////////////////////////////////////////////////////////////////////////////
 void CConnectionManager::StopAll()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     while(m_connections.size() > 0)
     {
       Stop((*m_connections.left.begin()).second); //Side effect of stop should make this map smaller
     }
     m_connections.clear();
+    m_peerConnections.clear();
+    m_routes.clear();
     CListener::Instance().Stop();
-    Logger.Debug << "All Connections Closed" << std::endl;
+    LOG_DEBUG(Logger) << "All Connections Closed" << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -182,15 +223,15 @@ void CConnectionManager::StopAll()
 ///		   Throws an exception of the connection couldn't be constructed.
 /// @return A pointer to the connection
 ///////////////////////////////////////////////////////////////////////////////
-ConnectionPtr CConnectionManager::GetConnectionByUUID(std::string uuid)
+ConnectionPtr CConnectionManager::GetConnectionByUUID(const std::string& uuid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     // See if there is a connection in the open connections already
     if(HasConnection(uuid))
         return m_connections.left.at(uuid);
 
-    Logger.Info << "Making Fresh Connection to " << uuid << std::endl;
+    LOG_INFO(Logger) << "Making Fresh Connection to " << uuid << std::endl;
 
     // Find the requested host from the list of known hosts
     std::map<std::string, SRemoteHost>::iterator mapIt;
@@ -204,7 +245,7 @@ ConnectionPtr CConnectionManager::GetConnectionByUUID(std::string uuid)
 
 
     // Initiate the UDP connection
-    Logger.Debug<<"Computing remote endpoint"<<std::endl;
+    LOG_DEBUG(Logger)<<"Computing remote endpoint"<<std::endl;
     boost::asio::ip::udp::resolver resolver(CBroker::Instance().GetIOService());
     boost::asio::ip::udp::resolver::query query(s, port);
     boost::asio::ip::udp::endpoint endpoint;
@@ -217,10 +258,93 @@ ConnectionPtr CConnectionManager::GetConnectionByUUID(std::string uuid)
         //Pass Couldn't resolve endpoint, let the protocol handle the bad connection
         //Exception thrown if no endpoints found.
     }
-    Logger.Info<<"Resolved: "<<endpoint<<std::endl;
+    LOG_INFO(Logger)<<"Resolved: "<<endpoint<<std::endl;
     return CreateConnection(uuid,endpoint);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// CConnectionManager::GetConnection
+/// @description Retrieves the connection to an interned UUID without looking
+///     up the UUID. A peer without a live connection goes through
+///     GetConnectionByUUID, which constructs one.
+/// @param peer The interned uuid of the peer you wish to connect to.
+/// @pre None
+/// @post As GetConnectionByUUID, if the peer has no live connection.
+/// @return A pointer to the connection
+///////////////////////////////////////////////////////////////////////////////
+ConnectionPtr CConnectionManager::GetConnection(PeerId peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(peer < m_peerConnections.size() && m_peerConnections[peer]
+        && !m_peerConnections[peer]->GetStopped())
+    {
+        return m_peerConnections[peer];
+    }
+    return GetConnectionByUUID(CPeerIdTable::Instance().GetUUID(peer));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnectionManager::ResolveConnection
+/// @description Finds the connection of a received datagram. The connection
+///     of each endpoint is cached, so a datagram from a known sender needs
+///     one hash lookup and a comparison of the UUID; the first datagram from
+///     an endpoint, or from a new sender on it, registers the host of the
+///     sender and creates the connection as needed.
+/// @pre None
+/// @post The sender's host is registered and its connection exists.
+/// @param uuid The UUID in the datagram.
+/// @param from The endpoint that sent the datagram.
+/// @param peer Set to the interned UUID of the sender.
+/// @return A pointer to the connection with the sender.
+///////////////////////////////////////////////////////////////////////////////
+ConnectionPtr CConnectionManager::ResolveConnection(const std::string& uuid,
+    const boost::asio::ip::udp::endpoint& from, PeerId& peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    routemap::iterator it = m_routes.find(from);
+    if(it != m_routes.end() && *it->second.uuid == uuid
+        && !it->second.connection->GetStopped())
+    {
+        peer = it->second.peer;
+        return it->second.connection;
+    }
+
+    SRoute route;
+    route.peer = CPeerIdTable::Instance().Intern(uuid, route.uuid);
+    SRemoteHost host = { from.address().to_string(),
+        boost::lexical_cast<std::string>(from.port()) };
+    PutHost(uuid, host);
+    route.connection = CreateConnection(uuid, from);
+    m_routes[from] = route;
+
+    peer = route.peer;
+    return route.connection;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CConnectionManager::SEndpointHash::operator()
+/// @description Hashes the address and port of an endpoint.
+/// @param ep the endpoint to hash.
+/// @return The hash of the endpoint.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CConnectionManager::SEndpointHash::operator()(
+    const boost::asio::ip::udp::endpoint& ep) const
+{
+    std::size_t seed = boost::hash_value(ep.port());
+    if(ep.address().is_v4())
+    {
+        boost::hash_combine(seed, ep.address().to_v4().to_ulong());
+    }
+    else
+    {
+        boost::asio::ip::address_v6::bytes_type bytes = ep.address().to_v6().to_bytes();
+        boost::hash_range(seed, bytes.begin(), bytes.end());
+    }
+    return seed;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnectionManager::HasConnection
 /// @description Checks to see if the connection manager has a connection to
@@ -231,7 +355,7 @@ ConnectionPtr CConnectionManager::GetConnectionByUUID(std::string uuid)
 ///	@param uuid The uuid of the peer.
 /// @return Returns true if the connection exists and has not stopped.
 //////////////////////////////////////////////////////////////////////////////
-bool CConnectionManager::HasConnection(std::string uuid)
+bool CConnectionManager::HasConnection(const std::string& uuid)
 {
     if(m_connections.left.count(uuid))
     {
@@ -244,7 +368,7 @@ bool CConnectionManager::HasConnection(std::string uuid)
         }
         else
         {
-            Logger.Warn <<"Connection to " << uuid << " has gone stale " << std::endl;
+            LOG_WARN(Logger) <<"Connection to " << uuid << " has gone stale " << std::endl;
             //The socket is not marked as open anymore, we
             //should stop it.
             Stop(m_connections.left.at(uuid));
@@ -261,18 +385,27 @@ bool CConnectionManager::HasConnection(std::string uuid)
 /// @param endpoint The network destination for the messages sent to this peer.
 /// @pre endpoint is a valid endpoint
 /// @post A new CConnection is created and bound to and endpoint. The resulting
-///		CConnection is inserted into the connection manager's map.
+///		CConnection is inserted into the connection manager's map. If the peer
+///		runs on this host, the shared memory transport is attached to it.
 ///////////////////////////////////////////////////////////////////////////////
-ConnectionPtr CConnectionManager::CreateConnection(std::string uuid, boost::asio::ip::udp::endpoint endpoint)
+ConnectionPtr CConnectionManager::CreateConnection(const std::string& uuid, boost::asio::ip::udp::endpoint endpoint)
 {
     if(HasConnection(uuid))
         return m_connections.left.at(uuid);
-    Logger.Warn<<"EP = "<<endpoint<<std::endl;
+    LOG_WARN(Logger)<<"EP = "<<endpoint<<std::endl;
     // Create a new CConnection object for this host
-    Logger.Debug<<"Constructing CConnection"<<std::endl;
+    LOG_DEBUG(Logger)<<"Constructing CConnection"<<std::endl;
     ConnectionPtr c = boost::make_shared<CConnection>(uuid, endpoint);
     // Add to the connection list
     PutConnection(uuid,c);
+    PeerId peer = CPeerIdTable::Instance().Intern(uuid);
+    if(peer >= m_peerConnections.size())
+    {
+        m_peerConnections.resize(peer + 1);
+    }
+    m_peerConnections[peer] = c;
+    // Peers on this host can be reached without the network stack
+    CSharedMemoryTransport::Instance().Attach(uuid, endpoint);
 #ifdef CUSTOMNETWORK
     LoadNetworkConfig();
 #endif
@@ -282,37 +415,72 @@ ConnectionPtr CConnectionManager::CreateConnection(std::string uuid, boost::asio
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnectionManager::ChangePhase
 /// @description called when the broker changes phases in the realtime scheduler
+///     At the start of a round, the connections that stayed idle for the
+///     configured number of rounds are stopped and nothing of them is kept.
+///     The peer stays in the list of known hosts, so the next message to or
+///     from it builds a new connection; the protocol resynchronizes it like
+///     one to a restarted peer.
 /// @pre None
 /// @post Each Connection's Change phase events is called.
 /// @param newround True if the phase change corresponds to a new round.
 ///////////////////////////////////////////////////////////////////////////////
 void CConnectionManager::ChangePhase(bool newround)
 {
+    unsigned int rounds = CGlobalConfiguration::Instance().GetConnectionIdleRounds();
+    std::vector<ConnectionPtr> idle;
     for(connectionmap::left_iterator it = m_connections.left.begin(); it != m_connections.left.end(); it++)
     {
         it->second->ChangePhase(newround);
+        if(newround && rounds > 0 && it->second->IsIdle(rounds))
+        {
+            idle.push_back(it->second);
+        }
+    }
+    BOOST_FOREACH(ConnectionPtr c, idle)
+    {
+        LOG_DEBUG(Logger) << "Reaping idle connection to " << c->GetUUID() << std::endl;
+        Stop(c);
+        ReapedMetric.Increment();
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CConnectionManager::LoadNetworkConfig
 /// @description Accesses the network.xml file and parses it, setting the
-///   network reliability for all specified interfaces.
+///   network reliability for all specified interfaces and the reliability
+///   of incoming datagrams. The file is parsed
+///   again only when it has been modified since it was last read. Its
+///   modification time only has a resolution of one second, so a file
+///   modified in the second it was read is parsed again as well.
 /// @pre  Only enabled with the -DCUSTOMNETWORK compile option
 /// @post All connections in the file are modified to behave as specified.
 ///////////////////////////////////////////////////////////////////////////////
 void CConnectionManager::LoadNetworkConfig()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    boost::property_tree::ptree pt;
-    boost::property_tree::read_xml("network.xml",pt);
-    BOOST_FOREACH(boost::property_tree::ptree::value_type & child, pt.get_child("network.outgoing"))
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    struct stat info;
+    if(stat("network.xml", &info) != 0 || info.st_mtime != m_networkTime
+        || info.st_mtime >= m_networkRead)
+    {
+        m_networkRead = std::time(0);
+        boost::property_tree::ptree pt;
+        boost::property_tree::read_xml("network.xml",pt);
+        CListener::Instance().SetReliability(
+            pt.get<int>("network.incoming.reliability", 100));
+        m_network.clear();
+        BOOST_FOREACH(boost::property_tree::ptree::value_type & child, pt.get_child("network.outgoing"))
+        {
+            std::string uuid = child.second.get<std::string>("<xmlattr>.uuid");
+            m_network[uuid] = child.second.get<int>("reliability");
+        }
+        m_networkTime = info.st_mtime;
+    }
+    std::map<std::string, int>::const_iterator it;
+    for(it = m_network.begin(); it != m_network.end(); it++)
     {
-        std::string uuid = child.second.get<std::string>("<xmlattr>.uuid");
-        int reliability = child.second.get<int>("reliability");
-        if(m_connections.left.count(uuid) != 0)
+        if(m_connections.left.count(it->first) != 0)
         {
-            m_connections.left.at(uuid)->SetReliability(reliability);
+            m_connections.left.at(it->first)->SetReliability(it->second);
         }
     }
 }
@@ -25,16 +25,20 @@
 #ifndef CONNECTIONMANAGER_HPP
 #define CONNECTIONMANAGER_HPP
 
+#include "CPeerIdTable.hpp"
 #include "SRemoteHost.hpp"
 
+#include <ctime>
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <boost/bimap.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/asio.hpp>
 
 namespace freedm {
@@ -60,13 +64,13 @@ public:
     static CConnectionManager& Instance();
 
     /// Place a host/port and uuid into the host / uuid map.
-    void PutHost(std::string u, std::string host, std::string port);
+    void PutHost(const std::string& u, const std::string& host, const std::string& port);
 
     /// Place a host/port and uuid into the host / uuid map.
-    void PutHost(std::string u, SRemoteHost host);
+    void PutHost(const std::string& u, const SRemoteHost& host);
 
     /// Register a connection with the manager once it has been built.
-    void PutConnection(std::string uuid, ConnectionPtr c);
+    void PutConnection(const std::string& uuid, ConnectionPtr c);
 
     /// Stop the specified connection.
     void Stop(ConnectionPtr c);
@@ -78,13 +82,20 @@ public:
     void ChangePhase(bool newround);
 
     /// Fetch a connection pointer via UUID
-    ConnectionPtr GetConnectionByUUID( std::string uuid );
+    ConnectionPtr GetConnectionByUUID(const std::string& uuid);
+
+    /// Fetch a connection pointer via an interned UUID
+    ConnectionPtr GetConnection(PeerId peer);
+
+    /// Finds the connection a datagram from an endpoint arrived on
+    ConnectionPtr ResolveConnection(const std::string& uuid,
+        const boost::asio::ip::udp::endpoint& from, PeerId& peer);
 
     /// Creates a connection by binding it to an endpoint
-    ConnectionPtr CreateConnection(std::string uuid, boost::asio::ip::udp::endpoint endpoint);
+    ConnectionPtr CreateConnection(const std::string& uuid, boost::asio::ip::udp::endpoint endpoint);
     
     /// Returns true if this map is currently tracking a connection to this peer.
-    bool HasConnection(std::string uuid);
+    bool HasConnection(const std::string& uuid);
 
     /// An iterator to the beginning of the hostname map.
     hostnamemap::iterator GetHostsBegin() { return m_hosts.begin(); };
@@ -93,7 +104,7 @@ public:
     hostnamemap::iterator GetHostsEnd() { return m_hosts.end(); };
 
     /// An iterator to the specified hostname.
-    hostnamemap::iterator GetHost(std::string uuid) { return m_hosts.find(uuid); };
+    hostnamemap::iterator GetHost(const std::string& uuid) { return m_hosts.find(uuid); };
 
     /// Iterator to the beginning of the connection map.
     connectionmap::iterator GetConnectionsBegin() { return m_connections.begin(); };
@@ -106,14 +117,49 @@ public:
     void LoadNetworkConfig();
 
 private:
+    /// The connection that the datagrams from an endpoint arrived on
+    struct SRoute
+    {
+        /// The interned UUID of the sender
+        PeerId peer;
+        /// The interned copy of the UUID of the sender
+        const std::string* uuid;
+        /// The connection with the sender
+        ConnectionPtr connection;
+    };
+
+    /// Hashes an endpoint by its address and port
+    struct SEndpointHash
+    {
+        /// Gets the hash of an endpoint
+        std::size_t operator()(const boost::asio::ip::udp::endpoint& ep) const;
+    };
+
+    /// Typedef for the map which handles endpoint to connection
+    typedef boost::unordered_map<boost::asio::ip::udp::endpoint, SRoute,
+        SEndpointHash> routemap;
+
     /// Private constructor for the singleton instance
     CConnectionManager();
+
+    /// Forgets the cached lookups that lead to a connection
+    void Forget(ConnectionPtr c);
     /// Mapping from uuid to host.
     hostnamemap m_hosts;
     /// Forward map (UUID->Connection)
     connectionmap m_connections;
+    /// The connections by interned UUID, empty where there is none
+    std::vector<ConnectionPtr> m_peerConnections;
+    /// The connections by the endpoint their datagrams arrive from
+    routemap m_routes;
     /// Mutex for protecting the handler maps above
     boost::mutex m_Mutex;
+    /// Reliability of each outgoing connection named in network.xml
+    std::map<std::string, int> m_network;
+    /// Modification time of network.xml when m_network was read
+    std::time_t m_networkTime;
+    /// Time network.xml was last read, to the second
+    std::time_t m_networkRead;
 };
 
 } // namespace broker
@@ -24,14 +24,25 @@
 
 #include "CBroker.hpp"
 #include "CDispatcher.hpp"
+#include "CGlobalConfiguration.hpp"
 #include "CGlobalPeerList.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CRelayTree.hpp"
+#include "CTraceLog.hpp"
 #include "IDGIModule.hpp"
+#include "Messages.hpp"
 
 #include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/thread/locks.hpp>
 
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 namespace freedm {
     namespace broker {
 
@@ -40,6 +51,31 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Messages addressed to a module that has no read handler
+CCounter& UnhandledMetric = CMetrics::Instance().GetCounter(
+    "dgi_dispatcher_unhandled_messages_total",
+    "Messages addressed to a module that is not registered");
+
+/// Messages dropped from a full module queue
+CCounter& DroppedMetric = CMetrics::Instance().GetCounter(
+    "dgi_dispatcher_dropped_messages_total",
+    "Messages dropped because the queue of their module was full");
+
+/// Waiting messages replaced by a newer one from the same peer
+CCounter& SupersededMetric = CMetrics::Instance().GetCounter(
+    "dgi_dispatcher_superseded_messages_total",
+    "Waiting messages replaced by a newer message of the same type and peer");
+
+/// Messages delivered on arrival rather than in the phase of their module
+CCounter& ImmediateMetric = CMetrics::Instance().GetCounter(
+    "dgi_dispatcher_immediate_messages_total",
+    "Messages whose handler ran on arrival, outside the phase of the module");
+
+/// Immediate handlers that ran past their time limit
+CCounter& OverrunMetric = CMetrics::Instance().GetCounter(
+    "dgi_dispatcher_immediate_overruns_total",
+    "Immediate message handlers that ran past the immediate limit");
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -59,47 +95,455 @@ CDispatcher& CDispatcher::Instance()
 /// CDispatcher::HandleRequest
 /// @description Given an input property tree determine which handlers should
 ///   be given the message out of a pool of modules and schedule the delievery
-///   of the message to those modules.
+///   of the message to those modules. A broadcast relayed down a tree is
+///   forwarded to the children of this node first.
+/// @pre Modules have registered their read handlers.
+/// @post Message is scheduled to be delivered to the module.
+/// @param msg The message to distribute to modules.
+/// @param peer The interned UUID of the DGI that sent the message.
+/// @param stamps The arrival stamps of a traced message, to which the time of
+///     the dispatch is added.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::HandleRequest(boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+    SDeliveryStamps stamps)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(msg->has_relay())
+    {
+        // a broadcast relayed down a tree is delivered as its sender's
+        peer = CRelayTree::Instance().Relay(msg, peer);
+    }
+
+    if(msg->has_trace())
+    {
+        stamps.dispatched = CLatencyTrace::Now();
+    }
+
+    Route(msg, peer, stamps, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::HandleLocal
+/// @description Delivers a message that a module of this node sent to this
+///   node. The message is shared with the sender rather than copied. If the
+///   inline self delivery option is set and the phase of a receiving module
+///   is running with nothing else queued, the module handles the message
+///   before this returns; otherwise it is scheduled like a received message.
+/// @pre Modules have registered their read handlers.
+/// @post Message is delivered or scheduled to be delivered.
+/// @param msg The message to distribute to modules, which must not change.
+/// @param self The interned UUID of this DGI.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::HandleLocal(boost::shared_ptr<const ModuleMessage> msg, PeerId self)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    Route(msg, self, SDeliveryStamps(), true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::Route
+/// @description Finds the modules a message is addressed to and hands the
+///   message to them. Every module shares the one parsed message, and the
+///   type of the message is named at most once for all of them.
 /// @pre Modules have registered their read handlers.
 /// @post Message is scheduled to be delivered to the module.
 /// @param msg The message to distribute to modules.
-/// @param uuid The UUID of the DGI that sent the message.
+/// @param peer The interned UUID of the DGI that sent the message.
+/// @param stamps The latency trace stamps of the message.
+/// @param local Set if the message was sent by this DGI.
 ///////////////////////////////////////////////////////////////////////////////
-void CDispatcher::HandleRequest(boost::shared_ptr<const ModuleMessage> msg, std::string uuid)
+void CDispatcher::Route(boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+    const SDeliveryStamps& stamps, bool local)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Debug << "Processing message addressed to: " << msg->recipient_module() << std::endl;
+    LOG_DEBUG(Logger) << "Processing message addressed to: " << msg->recipient_module() << std::endl;
+
+    const RegistrationList* targets = &m_everyone;
+    std::string type;
+
+    if(msg->has_lb_digest() && !m_digests.empty()
+        && msg->recipient_module() != "all" && msg->recipient_module() != "lb")
+    {
+        // the digest rides on a message of another module
+        Deliver(m_digests, msg, peer, stamps, local, type);
+    }
+
+    if(msg->recipient_module() != "all")
+    {
+        std::map<std::string, RegistrationList>::const_iterator it
+            = m_recipients.find(msg->recipient_module());
+        targets = (it != m_recipients.end() ? &it->second : 0);
+    }
 
-    bool processed = false;
+    if(targets == 0 || targets->empty())
+    {
+        UnhandledMetric.Increment();
+        LOG_WARN(Logger) << "Message was not processed by any module:\n" << msg->DebugString();
+        return;
+    }
 
-    for(std::multimap<boost::shared_ptr<IDGIModule>, const std::string>::const_iterator it
-            = m_registrations.begin();
-        it != m_registrations.end(); ++it)
+    if(CTraceLog::Instance().IsEnabled())
     {
-        if (it->second == msg->recipient_module() || msg->recipient_module() == "all")
+        CTraceLog::Instance().Emit(TRACE_DISPATCH, msg->recipient_module().c_str(),
+            CPeerIdTable::Instance().GetUUID(peer),
+            ComputeMessageHash(*msg), targets->size());
+    }
+
+    Deliver(*targets, msg, peer, stamps, local, type);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::Deliver
+/// @description Hands a message to each of a list of registrations.
+/// @pre None
+/// @post Scheduled modules receive the message in their next phase, through
+///     the waiting messages if they handle batches or the queues are bounded
+///     or superseded. Unscheduled modules, and the messages of an immediate
+///     type, are received immediately.
+/// @param targets the registrations that receive the message.
+/// @param msg The message to deliver.
+/// @param peer the handle of the DGI that sent the message.
+/// @param stamps the latency trace stamps of the message.
+/// @param local set if the message was sent by this DGI, which a module in its
+///     phase may handle inline.
+/// @param type the type name of the message, or empty if it has not been
+///     named yet, in which case it is named here when a registration needs it.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::Deliver(const RegistrationList& targets,
+    boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+    const SDeliveryStamps& stamps, bool local, std::string& type)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    bool queued = (m_capacity > 0 || !m_supersede.empty());
+    bool inlined = (local && m_inline == 0
+        && CGlobalConfiguration::Instance().GetInlineSelfDelivery());
+    bool immediate = false;
+
+    if(!m_immediate.empty())
+    {
+        if(type.empty())
+        {
+            type = GetMessageType(*msg, 2);
+        }
+        immediate = (m_immediate.count(type) > 0);
+    }
+
+    for(RegistrationList::const_iterator it = targets.begin();
+        it != targets.end(); ++it)
+    {
+        it->delivered->Increment();
+        if(type.empty() && (it->batched || !m_supersede.empty()))
+        {
+            type = GetMessageType(*msg, 2);
+        }
+        // Scheduled modules receive messages only during that module's phase.
+        // Unscheduled modules receive messages immediately.
+        if (immediate && CBroker::Instance().IsModuleRegistered(it->module))
         {
-            // Scheduled modules receive messages only during that module's phase.
-            // Unscheduled modules receive messages immediately.
-            if (CBroker::Instance().IsModuleRegistered(it->second))
+            DeliverImmediate(*it, msg, peer, stamps, type);
+        }
+        else if ((queued || it->batched)
+            && CBroker::Instance().IsModuleRegistered(it->module))
+        {
+            Enqueue(it->module, *it, msg, peer, stamps, type);
+        }
+        else if (inlined && CBroker::Instance().CanRunInline(it->module))
+        {
+            // A handler that sends to this node again schedules that message
+            m_inline++;
+            try
             {
-                CBroker::Instance().Schedule(
-                    it->second,
-                    boost::bind(
-                        &CDispatcher::ReadHandlerCallback, this, it->first, msg, uuid));
+                ReadHandlerCallback(it->handler, msg, peer, stamps);
             }
-            else
+            catch(...)
             {
-                ReadHandlerCallback(it->first, msg, uuid);
+                m_inline--;
+                throw;
             }
-            processed = true;
+            m_inline--;
+        }
+        else if (CBroker::Instance().IsModuleRegistered(it->module))
+        {
+            CBroker::Instance().Schedule(
+                it->module,
+                boost::bind(&CDispatcher::ReadHandlerCallback, this,
+                    it->handler, msg, peer, stamps));
+        }
+        else
+        {
+            ReadHandlerCallback(it->handler, msg, peer, stamps);
         }
     }
+}
 
-    if( processed == false )
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::DeliverImmediate
+/// @description Runs the handler of a message of an immediate type at once,
+///     in the middle of whatever phase is running. A handler that runs past
+///     the immediate limit takes time from that phase, so its type goes back
+///     to waiting for the phase of its module.
+/// @pre Called on the broker strand.
+/// @post The module has handled the message.
+/// @param target the registration that receives the message.
+/// @param msg The message to deliver.
+/// @param peer the handle of the DGI that sent the message.
+/// @param stamps the latency trace stamps of the message.
+/// @param type the type name of the message.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::DeliverImmediate(const SRegistration& target,
+    boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+    const SDeliveryStamps& stamps, const std::string& type)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+
+    // A handler that sends to this node again schedules that message
+    m_inline++;
+    try
+    {
+        ReadHandlerCallback(target.handler, msg, peer, stamps);
+    }
+    catch(...)
     {
-        Logger.Warn << "Message was not processed by any module:\n" << msg->DebugString();
+        m_inline--;
+        throw;
     }
+    m_inline--;
+    ImmediateMetric.Increment();
 
+    boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+    if(elapsed.total_microseconds() >
+        CGlobalConfiguration::Instance().GetImmediateLimit())
+    {
+        OverrunMetric.Increment();
+        m_immediate.erase(type);
+        LOG_WARN(Logger) << "The immediate handler of " << type << " ran for "
+            << elapsed.total_microseconds() << "us, its messages now wait for"
+            << " the phase of their module" << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::Enqueue
+/// @description Holds a message for a scheduled module until its phase. A
+///     message of a superseded type replaces the one from the same peer that
+///     is still waiting, in its place in the queue. When the queue of the
+///     module is full the oldest message is dropped to make room.
+/// @pre module is registered with the broker.
+/// @post Each waiting message has a DeliverNext task scheduled for the
+///     module.
+/// @param module the broker id of the module.
+/// @param target the registration that receives the message.
+/// @param msg The message to deliver.
+/// @param peer the handle of the DGI that sent the message.
+/// @param stamps the latency trace stamps of the message.
+/// @param type the type name of the message.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::Enqueue(unsigned int module, const SRegistration& target,
+    boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+    const SDeliveryStamps& stamps, const std::string& type)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock lock(m_inboundmutex);
+
+    if(module >= m_inbound.size())
+    {
+        m_inbound.resize(module + 1);
+    }
+    SInbound& inbound = m_inbound[module];
+
+    SPending pending;
+    pending.handler = target.handler;
+    pending.msg = msg;
+    pending.peer = peer;
+    pending.stamps = stamps;
+    pending.batched = target.batched;
+    pending.superseded = (m_supersede.count(type) > 0);
+    pending.key = SupersedeKey(std::make_pair(target.handler.get(), peer), type);
+
+    if(pending.superseded)
+    {
+        std::map<SupersedeKey, PendingList::iterator>::iterator it
+            = inbound.latest.find(pending.key);
+        if(it != inbound.latest.end())
+        {
+            LOG_DEBUG(Logger) << "Replaced a waiting " << type << std::endl;
+            SupersededMetric.Increment();
+            it->second->msg = msg;
+            it->second->stamps = stamps;
+            return;
+        }
+    }
+
+    // The task of the dropped message delivers the new one.
+    bool schedule = true;
+    if(m_capacity > 0 && inbound.messages.size() >= m_capacity)
+    {
+        const SPending& oldest = inbound.messages.front();
+        LOG_WARN(Logger) << "Dropped a message for module " << module
+            << ", its queue is full" << std::endl;
+        DroppedMetric.Increment();
+        if(oldest.superseded)
+        {
+            inbound.latest.erase(oldest.key);
+        }
+        inbound.messages.pop_front();
+        schedule = false;
+    }
+
+    inbound.messages.push_back(pending);
+    if(pending.superseded)
+    {
+        inbound.latest[pending.key] = --inbound.messages.end();
+    }
+    lock.unlock();
+
+    if(schedule)
+    {
+        CBroker::Instance().Schedule(CBroker::ModuleId(module),
+            boost::bind(&CDispatcher::DeliverNext, this, module));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::DeliverNext
+/// @description Delivers the message that has waited longest for a module.
+/// @pre The module is in its phase.
+/// @post The message is removed from the queue of the module.
+/// @param module the broker id of the module.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::DeliverNext(unsigned int module)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock lock(m_inboundmutex);
+
+    if(module >= m_inbound.size() || m_inbound[module].messages.empty())
+    {
+        return;
+    }
+    SInbound& inbound = m_inbound[module];
+    if(inbound.messages.front().batched)
+    {
+        DeliverBatch(inbound, lock);
+        return;
+    }
+    SPending pending = inbound.messages.front();
+    if(pending.superseded)
+    {
+        inbound.latest.erase(pending.key);
+    }
+    inbound.messages.pop_front();
+    lock.unlock();
+
+    ReadHandlerCallback(pending.handler, pending.msg, pending.peer,
+        pending.stamps);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::DeliverBatch
+/// @description Takes every waiting message of the handler of the oldest
+///     message out of the queue and hands them to the handler in one call,
+///     grouped by type. The tasks scheduled for the other messages of the
+///     batch find them gone and deliver the messages of other handlers, or
+///     nothing.
+/// @pre lock holds m_inboundmutex and the oldest message of inbound is for a
+///     module that handles batches.
+/// @post The messages of the handler are removed from the queue and
+///     delivered. The lock is released.
+/// @param inbound the waiting messages of the module.
+/// @param lock the held lock of the waiting messages.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::DeliverBatch(SInbound& inbound, boost::mutex::scoped_lock& lock)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::shared_ptr<IDGIModule> handler = inbound.messages.front().handler;
+    std::vector<SPending> taken;
+    PendingList::iterator it = inbound.messages.begin();
+    while(it != inbound.messages.end())
+    {
+        if(it->handler != handler)
+        {
+            ++it;
+            continue;
+        }
+        if(it->superseded)
+        {
+            inbound.latest.erase(it->key);
+        }
+        taken.push_back(*it);
+        it = inbound.messages.erase(it);
+    }
+    lock.unlock();
+
+    // Group the messages by type, keeping their order within a type
+    std::map<std::string, MessageBatch> types;
+    for(std::size_t i = 0; i < taken.size(); i++)
+    {
+        SIncomingMessage incoming;
+        if(!GetSender(taken[i].peer, incoming.peer))
+        {
+            continue;
+        }
+        incoming.msg = taken[i].msg;
+        incoming.type = taken[i].key.second;
+        if(incoming.msg->has_trace())
+        {
+            CLatencyTrace::Instance().Record(incoming.type,
+                incoming.msg->trace().enqueue_usec(), taken[i].stamps);
+        }
+        types[incoming.type].push_back(incoming);
+    }
+
+    MessageBatch batch;
+    batch.reserve(taken.size());
+    for(std::map<std::string, MessageBatch>::const_iterator type = types.begin();
+        type != types.end(); ++type)
+    {
+        batch.insert(batch.end(), type->second.begin(), type->second.end());
+    }
+
+    LOG_DEBUG(Logger) << "Delivering a batch of " << batch.size()
+        << " messages in " << types.size() << " types" << std::endl;
+    if(!batch.empty())
+    {
+        handler->HandleIncomingBatch(batch);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::GetSender
+/// @description Finds the peer node of the DGI that sent a message, creating
+///     it if the DGI is not a known peer yet.
+/// @pre None
+/// @post The peer may be added to the global peer list.
+/// @param handle the interned UUID of the DGI.
+/// @param peer set to the peer node of the DGI.
+/// @return False if there is no peer to create the node from, in which case
+///     the message should be dropped.
+///////////////////////////////////////////////////////////////////////////////
+bool CDispatcher::GetSender(PeerId handle, CPeerNode& peer)
+{
+    const std::string& uuid = CPeerIdTable::Instance().GetUUID(handle);
+    try
+    {
+        peer = CGlobalPeerList::instance().GetPeer(uuid);
+    }
+    catch(std::runtime_error& e)
+    {
+        if(CGlobalPeerList::instance().Empty())
+        {
+            LOG_INFO(Logger)<<"Didn't have a peer to construct the new peer from (might be ok)"<<std::endl;
+            return false;
+        }
+        peer = CGlobalPeerList::instance().Create(uuid);
+    }
+    return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -108,25 +552,24 @@ void CDispatcher::HandleRequest(boost::shared_ptr<const ModuleMessage> msg, std:
 ///		message. 
 /// @param h The module that will receive the message.
 /// @param msg The message to deliver to that module.
-/// @param uuid the UUID of the peer that sent the message.
+/// @param handle the interned UUID of the peer that sent the message.
+/// @param stamps the latency trace stamps of the message, which is recorded
+///     by its type as the handler starts.
 ///////////////////////////////////////////////////////////////////////////////
 void CDispatcher::ReadHandlerCallback(
-    boost::shared_ptr<IDGIModule> h, boost::shared_ptr<const ModuleMessage> msg, std::string uuid)
+    boost::shared_ptr<IDGIModule> h, boost::shared_ptr<const ModuleMessage> msg,
+    PeerId handle, SDeliveryStamps stamps)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     CPeerNode peer;
-    try
+    if(!GetSender(handle, peer))
     {
-        peer = CGlobalPeerList::instance().GetPeer(uuid);
+        return;
     }
-    catch(std::runtime_error& e)
+    if(msg->has_trace())
     {
-        if(CGlobalPeerList::instance().begin() == CGlobalPeerList::instance().end())
-        {
-            Logger.Info<<"Didn't have a peer to construct the new peer from (might be ok)"<<std::endl;
-            return;
-        }
-        peer = CGlobalPeerList::instance().Create(uuid);
+        CLatencyTrace::Instance().Record(GetMessageType(*msg, 2),
+            msg->trace().enqueue_usec(), stamps);
     }
     h->HandleIncomingMessage(msg, peer);
 }
@@ -140,13 +583,74 @@ void CDispatcher::ReadHandlerCallback(
 /// @param handler the module that will receive the message
 /// @param id this module will receive messages addressed to id. If id is "all"
 ///		the module will receiver every message from every other module.
+///     The broker id of the module and the list of recipients the
+///     registration belongs to, and its message counter, are looked up once
+///     here rather than for each message.
 ///////////////////////////////////////////////////////////////////////////////
 void CDispatcher::RegisterReadHandler(
     boost::shared_ptr<IDGIModule> handler, std::string id)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Debug << "Registered module listening on " << id << std::endl;
-    m_registrations.insert(std::make_pair(handler,id));
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_DEBUG(Logger) << "Registered module listening on " << id << std::endl;
+    SRegistration reg;
+    reg.handler = handler;
+    reg.module = CBroker::Instance().GetModuleId(id);
+    reg.delivered = &CMetrics::Instance().GetCounter(
+        "dgi_dispatcher_messages_total", "Messages delivered, by module",
+        CMetrics::Label("module", id));
+    reg.batched = handler->HandlesBatches();
+    m_recipients[id].push_back(reg);
+    m_everyone.push_back(reg);
+
+    std::vector<std::string> types =
+        CGlobalConfiguration::Instance().GetSupersededMessages();
+    m_supersede.insert(types.begin(), types.end());
+    m_capacity = CGlobalConfiguration::Instance().GetInboundQueue();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::RegisterImmediateHandler
+/// @description Delivers the messages of a type as soon as they arrive, to
+///     the scheduled modules that receive them, instead of holding them for
+///     the phase of the module. This suits a request that only needs a quick
+///     answer, whose sender would otherwise wait up to a round for it. The
+///     handler shares the broker strand with the phases, so it must be short;
+///     see CDispatcher::DeliverImmediate.
+/// @pre Called before the broker runs.
+/// @post Messages of the type are delivered on arrival.
+/// @param type the message type, such as gm.AreYouThereMessage.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::RegisterImmediateHandler(std::string type)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_DEBUG(Logger) << "Registered immediate message type " << type << std::endl;
+    m_immediate.insert(type);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CDispatcher::RegisterDigestHandler
+/// @description Delivers the messages of other modules that carry a load
+///     balance digest to a module as well, in the phase of that module. The
+///     module must tell such a message from one addressed to it by the
+///     recipient module.
+/// @pre Called before the broker runs.
+/// @post Messages with a digest are delivered to the module.
+/// @param handler the module that reads the digests.
+/// @param id the identifier the module is scheduled by.
+///////////////////////////////////////////////////////////////////////////////
+void CDispatcher::RegisterDigestHandler(
+    boost::shared_ptr<IDGIModule> handler, std::string id)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_DEBUG(Logger) << "Registered digest handler " << id << std::endl;
+    SRegistration reg;
+    reg.handler = handler;
+    reg.module = CBroker::Instance().GetModuleId(id);
+    reg.delivered = &CMetrics::Instance().GetCounter(
+        "dgi_dispatcher_digests_total", "Digest messages delivered, by module",
+        CMetrics::Label("module", id));
+    reg.batched = handler->HandlesBatches();
+    m_digests.push_back(reg);
 }
 
     } //namespace broker
@@ -34,18 +34,25 @@
 #ifndef CDISPATCHER_HPP
 #define CDISPATCHER_HPP
 
+#include "CLatencyTrace.hpp"
+#include "CPeerIdTable.hpp"
+#include "CPeerNode.hpp"
 #include "messages/ModuleMessage.pb.h"
 
 #include <boost/noncopyable.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 
+#include <list>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 namespace freedm {
     namespace broker {
 
+class CCounter;
 class IDGIModule;
 
 /// Handles applying read handlers to incoming messages
@@ -57,23 +64,136 @@ public:
     static CDispatcher& Instance();
 
     /// Schedules a message delivery to the receiving modules.
-    void HandleRequest(boost::shared_ptr<const ModuleMessage> msg, std::string uuid);
+    void HandleRequest(boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+        SDeliveryStamps stamps = SDeliveryStamps());
+
+    /// Delivers a message a module of this node sent to this node.
+    void HandleLocal(boost::shared_ptr<const ModuleMessage> msg, PeerId self);
 
     /// Registers a module's identifier with the dispatcher.
     void RegisterReadHandler(boost::shared_ptr<IDGIModule> p_handler, std::string id);
 
+    /// Delivers the messages of a type on arrival, outside the phases.
+    void RegisterImmediateHandler(std::string type);
+
+    /// Registers a module for the load balance digests other messages carry.
+    void RegisterDigestHandler(boost::shared_ptr<IDGIModule> p_handler, std::string id);
+
 private:
     /// Private constructor for the singleton instance
-    CDispatcher() {};
+    CDispatcher() : m_capacity(0), m_inline(0) {};
+
+    /// Finds the receiving modules of a message and delivers it to them
+    void Route(boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+        const SDeliveryStamps& stamps, bool local);
 
     /// Making the handler calls bindable
     void ReadHandlerCallback(
         boost::shared_ptr<IDGIModule> h,
         boost::shared_ptr<const ModuleMessage> msg,
-        std::string uuid);
+        PeerId peer,
+        SDeliveryStamps stamps);
+
+    /// A read handler registration
+    struct SRegistration
+    {
+        /// The module that receives the messages
+        boost::shared_ptr<IDGIModule> handler;
+        /// The CBroker::ModuleId of the recipient module
+        unsigned int module;
+        /// Counts the messages delivered to the registration
+        CCounter* delivered;
+        /// Set if the module receives its waiting messages in batches
+        bool batched;
+    };
+
+    /// A list of read handler registrations
+    typedef std::vector<SRegistration> RegistrationList;
+
+    /// Runs the handler of an immediate message and enforces its time limit
+    void DeliverImmediate(const SRegistration& target,
+        boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+        const SDeliveryStamps& stamps, const std::string& type);
+
+    /// Schedules a message delivery to a list of registrations
+    void Deliver(const RegistrationList& targets,
+        boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+        const SDeliveryStamps& stamps, bool local, std::string& type);
+
+    /// Identifies the message a newer one from the same peer replaces
+    typedef std::pair<std::pair<IDGIModule*, PeerId>, std::string> SupersedeKey;
+
+    /// A message waiting for the phase of its module
+    struct SPending
+    {
+        /// The module that receives the message
+        boost::shared_ptr<IDGIModule> handler;
+        /// The message to deliver
+        boost::shared_ptr<const ModuleMessage> msg;
+        /// The handle of the peer that sent the message
+        PeerId peer;
+        /// The latency trace stamps of the message
+        SDeliveryStamps stamps;
+        /// Set if the module receives the message in a batch
+        bool batched;
+        /// Set if a newer message replaces this one
+        bool superseded;
+        /// The key a newer message replaces this one by
+        SupersedeKey key;
+    };
+
+    /// A list of messages in the order they arrived
+    typedef std::list<SPending> PendingList;
+
+    /// The messages waiting for the phase of a module
+    struct SInbound
+    {
+        /// The waiting messages, oldest first
+        PendingList messages;
+        /// The waiting message of each key that can be replaced
+        std::map<SupersedeKey, PendingList::iterator> latest;
+    };
+
+    /// Queues a message for a module that is not in its phase
+    void Enqueue(unsigned int module, const SRegistration& target,
+        boost::shared_ptr<const ModuleMessage> msg, PeerId peer,
+        const SDeliveryStamps& stamps, const std::string& type);
+
+    /// Delivers the oldest waiting message of a module
+    void DeliverNext(unsigned int module);
+
+    /// Delivers the waiting messages of the handler of the oldest message
+    void DeliverBatch(SInbound& inbound, boost::mutex::scoped_lock& lock);
+
+    /// Finds the peer node of the DGI that sent a message
+    static bool GetSender(PeerId handle, CPeerNode& peer);
+
+    /// The registrations of each recipient module identifier
+    std::map<std::string, RegistrationList> m_recipients;
+
+    /// Every registration, which receives the messages addressed to "all"
+    RegistrationList m_everyone;
+
+    /// The registrations that also receive the messages with a digest
+    RegistrationList m_digests;
+
+    /// The waiting messages of each module, by CBroker::ModuleId
+    std::vector<SInbound> m_inbound;
+
+    /// The number of messages that can wait for a module, 0 for no limit
+    unsigned int m_capacity;
+
+    /// The message types a newer message from the same peer replaces
+    std::set<std::string> m_supersede;
+
+    /// The message types that are delivered on arrival
+    std::set<std::string> m_immediate;
+
+    /// Lock for the waiting messages
+    boost::mutex m_inboundmutex;
 
-    /// Reverse map to get the calling module from the handler pointer.
-    std::multimap<boost::shared_ptr<IDGIModule>, const std::string> m_registrations;
+    /// Depth of the handlers of local messages running inline, on the strand
+    unsigned int m_inline;
 };
 
 } // namespace broker
@@ -65,6 +65,14 @@ class CGlobalConfiguration : private boost::noncopyable
                 { m_clockskew = t; };
         /// Set the plug-and-play port number
         void SetFactoryPort(unsigned short port) { m_factory_port = port; }
+        /// Set the pending plug-and-play connections per acceptor
+        void SetFactoryBacklog(unsigned int n) { m_factoryBacklog = n; }
+        /// Set the number of acceptors that share the plug-and-play port
+        void SetFactoryAcceptors(unsigned int n) { m_factoryAcceptors = n; }
+        /// Set the change a delta plug-and-play command must exceed to be sent
+        void SetPnpDeltaDeadband(float d) { m_pnpDeltaDeadband = d; }
+        /// Set the delta plug-and-play command packets between full packets
+        void SetPnpDeltaRefresh(unsigned int n) { m_pnpDeltaRefresh = n; }
         /// Set the socket endpoint address
         void SetDevicesEndpoint(std::string e) { m_devicesEndpoint = e; };
         /// Set the path to the adapter configuration file
@@ -73,18 +81,172 @@ class CGlobalConfiguration : private boost::noncopyable
         void SetDeviceConfigPath(std::string p) { m_deviceConfigPath = p; }
         /// Set the path to the topology config file
         void SetTopologyConfigPath(std::string p) { m_topologyConfigPath = p; }
+        /// Set the path to the network emulation link file
+        void SetNetworkEmulationPath(std::string p) { m_networkEmulationPath = p; }
+        /// Set the path to the VVC feeder model file
+        void SetFeederModelPath(std::string p) { m_feederModelPath = p; }
+        /// Set the path to the VVC line impedance file
+        void SetFeederImpedancePath(std::string p) { m_feederImpedancePath = p; }
+        /// Set the path the accepted VVC feeder models are dumped to
+        void SetVVCDumpPath(std::string p) { m_vvcDumpPath = p; }
+        /// Set the file the warm state is saved to
+        void SetWarmStatePath(std::string p) { m_warmStatePath = p; }
+        /// Set the milliseconds between saves of the warm state
+        void SetWarmStateInterval(unsigned int ms) { m_warmStateInterval = ms; }
+        /// Set the oldest warm state in seconds a restart resumes from
+        void SetWarmStateMaxAge(unsigned int s) { m_warmStateMaxAge = s; }
         /// Set the size of a load balance migration
         void SetMigrationStep(float v) { m_migrationStep = v; }
+        /// Set the change that triggers a load balance round, 0 for none
+        void SetLoadBalanceDeadband(float v) { m_lbDeadband = v; }
+        /// Set the smoothing factor of the load balance forecast, 0 for none
+        void SetLoadBalanceForecast(float v) { m_lbForecast = v; }
+        /// Set the most demand nodes a supply node drafts in one round
+        void SetDraftPartners(unsigned int n) { m_draftPartners = n; }
+        /// Set the flag to advertise the load balance state on other messages
+        void SetLoadBalanceDigests(bool flag) { m_lbDigests = flag; }
         /// Set the malicious load balance flag
         void SetMaliciousFlag(bool flag) { m_malicious = flag; }
         /// Set the invariant check flag
         void SetInvariantCheck(bool flag) { m_invariant = flag; }
+        /// Set the VVC power flow warm start flag
+        void SetVVCWarmStart(bool flag) { m_vvcWarmStart = flag; }
+        /// Set the VVC parallel phase computation flag
+        void SetVVCParallelPhases(bool flag) { m_vvcParallelPhases = flag; }
+        /// Set the VVC compute offload flag
+        void SetVVCOffload(bool flag) { m_vvcOffload = flag; }
+        /// Set the boundary bus of the feeder segment this DGI solves
+        void SetVVCSegmentBus(int bus) { m_vvcSegmentBus = bus; }
+        /// Set the flag to send VVC gradients as half precision floats
+        void SetVVCHalfGradients(bool flag) { m_vvcHalfGradients = flag; }
+        /// Set the search that picks the VVC step size
+        void SetVVCOptimizer(std::string name) { m_vvcOptimizer = name; }
+        /// Set the precision VVC solves its sensitivities in
+        void SetVVCPrecision(std::string precision) { m_vvcPrecision = precision; }
+        /// Set the number of VVC what-if power flows solved at once
+        void SetVVCBatchThreads(unsigned int n) { m_vvcBatchThreads = n; }
+        /// Set the number of threads one VVC power flow sweeps laterals on
+        void SetVVCSweepThreads(unsigned int n) { m_vvcSweepThreads = n; }
+        /// Set the threads the BLAS/LAPACK uses for one operation
+        void SetBlasThreads(unsigned int n) { m_blasThreads = n; }
+        /// Set how far a node moves before VVC forms its sensitivities again
+        void SetVVCSensitivityTolerance(float t) { m_vvcSensitivityTolerance = t; }
+        /// Set how far a load moves before a quiet VVC round runs again
+        void SetVVCSkipDeadband(float d) { m_vvcSkipDeadband = d; }
+        /// Set the datagram size budget of a peer connection
+        void SetDatagramMTU(unsigned int mtu) { m_datagramMtu = mtu; }
+        /// Set the time a peer connection waits to coalesce messages
+        void SetFlushDelay(unsigned int ms) { m_flushDelay = ms; }
+        /// Set the time a peer connection may hold back its acks
+        void SetAckDelay(unsigned int us) { m_ackDelay = us; }
+        /// Set the messages whose acks are written without a delay
+        void SetAckCount(unsigned int n) { m_ackCount = n; }
+        /// Set the number of datagrams handled per system call
+        void SetDatagramBatch(unsigned int n) { m_datagramBatch = n; }
+        /// Set the receive buffer size of the listener sockets
+        void SetSocketReceiveBuffer(unsigned int bytes) { m_socketReceiveBuffer = bytes; }
+        /// Set the send buffer size of the listener sockets
+        void SetSocketSendBuffer(unsigned int bytes) { m_socketSendBuffer = bytes; }
+        /// Set the size auto-tuning may grow the receive buffers to
+        void SetSocketBufferLimit(unsigned int bytes) { m_socketBufferLimit = bytes; }
+        /// Set whether the datagrams the sockets dropped are counted
+        void SetSocketDrops(bool flag) { m_socketDrops = flag; }
+        /// Set the number of extra receive threads of the listener
+        void SetListenerThreads(unsigned int n) { m_listenerThreads = n; }
+        /// Set the number of threads that run the broker io_service
+        void SetBrokerThreads(unsigned int n) { m_brokerThreads = n; }
+        /// Set the number of unacknowledged messages of a peer connection
+        void SetSendWindow(unsigned int n) { m_sendWindow = n; }
+        /// Set the number of messages queued behind the send window
+        void SetSendQueue(unsigned int n) { m_sendQueue = n; }
+        /// Set the idle rounds before a peer connection is reaped, 0 for never
+        void SetConnectionIdleRounds(unsigned int n) { m_connectionIdleRounds = n; }
+        /// Set the multicast group address for group-wide messages
+        void SetMulticastAddress(std::string a) { m_multicastAddress = a; }
+        /// Set the port of the multicast group
+        void SetMulticastPort(unsigned short port) { m_multicastPort = port; }
+        /// Set the children of each node of a relayed group send, 0 for none
+        void SetRelayFanout(unsigned int n) { m_relayFanout = n; }
+        /// Set the shared memory transport flag
+        void SetSharedMemory(bool flag) { m_sharedMemory = flag; }
+        /// Set the flag to size the phases from the measured module workload
+        void SetAdaptivePhases(bool flag) { m_adaptivePhases = flag; }
+        /// Set the flag to time the phases with the monotonic phase clock
+        void SetPrecisePhases(bool flag) { m_precisePhases = flag; }
+        /// Set the microseconds the phase clock spins before a boundary
+        void SetPhaseSpin(unsigned int usec) { m_phaseSpin = usec; }
+        /// Set the flag to stamp received datagrams in the kernel
+        void SetKernelTimestamps(bool flag) { m_kernelTimestamps = flag; }
+        /// Set the flag to take clock samples from the regular traffic
+        void SetPassiveClock(bool flag) { m_passiveClock = flag; }
+        /// Set the flag to detect failures with the SWIM protocol
+        void SetSwimMembership(bool flag) { m_swimMembership = flag; }
+        /// Set the flag to form groups per feeder segment
+        void SetHierarchicalGroups(bool flag) { m_hierarchicalGroups = flag; }
+        /// Set the flag to name a standby for the group coordinator
+        void SetGroupStandby(bool flag) { m_groupStandby = flag; }
+        /// Set the flag to collect only the changed signals
+        void SetStateDelta(bool flag) { m_stateDelta = flag; }
+        /// Set the change a signal needs to be collected in delta mode
+        void SetStateDeadband(float v) { m_stateDeadband = v; }
+        /// Set the flag to report the collected signals by their index
+        void SetStatePacked(bool flag) { m_statePacked = flag; }
+        /// Set the flag to aggregate the collected state along a tree
+        void SetStateAggregate(bool flag) { m_stateAggregate = flag; }
+        /// Set the number of state collection snapshots in flight at once
+        void SetStateSnapshots(unsigned int n) { m_stateSnapshots = n; }
+        /// Set the kilobytes the snapshot recordings may hold, 0 for no limit
+        void SetStateRecordLimit(unsigned int kb) { m_stateRecordLimit = kb; }
+        /// Set the number of messages queued for a module outside its phase
+        void SetInboundQueue(unsigned int n) { m_inboundQueue = n; }
+        /// Set the bytes of window messages past which they are deflated
+        void SetCompressThreshold(unsigned int n) { m_compressThreshold = n; }
+        /// Set the ready queue depth past which bulk datagrams are refused
+        void SetAdmissionBacklog(unsigned int n) { m_admissionBacklog = n; }
+        /// Set the microseconds an immediate message handler may run
+        void SetImmediateLimit(unsigned int usec) { m_immediateLimit = usec; }
+        /// Set the milliseconds a scheduler task may run before it is sampled
+        void SetWatchdogThreshold(unsigned int ms) { m_watchdogThreshold = ms; }
+        /// Set the samples the profiler takes per second of CPU
+        void SetProfileRate(unsigned int hz) { m_profileRate = hz; }
+        /// Set the file the profile is written to on SIGUSR2
+        void SetProfileFile(std::string path) { m_profileFile = path; }
+        /// Set the message types a newer message of the same peer replaces
+        void SetSupersededMessages(std::vector<std::string> types) { m_supersededMessages = types; }
+        /// Set the path of the binary trace file
+        void SetTraceFile(std::string path) { m_traceFile = path; }
+        /// Set the number of records of the binary trace ring
+        void SetTraceRecords(unsigned int n) { m_traceRecords = n; }
+        /// Set the path of the device telemetry file
+        void SetTelemetryFile(std::string path) { m_telemetryFile = path; }
+        /// Set the number of device table rows queued for the telemetry file
+        void SetTelemetryQueue(unsigned int n) { m_telemetryQueue = n; }
+        /// Set the path the received datagrams are recorded to
+        void SetCaptureFile(std::string path) { m_captureFile = path; }
+        /// Set the path the received datagrams are replayed from
+        void SetReplayCapture(std::string path) { m_replayCapture = path; }
+        /// Set the speed of the replayed datagrams
+        void SetReplaySpeed(double speed) { m_replaySpeed = speed; }
+        /// Set the port of the metrics endpoint
+        void SetMetricsPort(unsigned short port) { m_metricsPort = port; }
+        /// Set whether outgoing messages carry latency trace stamps
+        void SetLatencyTrace(bool flag) { m_latencyTrace = flag; }
+        /// Set whether the traffic of each module, type and peer is counted
+        void SetTrafficAccounting(bool flag) { m_trafficAccounting = flag; }
+        /// Set the seconds between the traffic summaries
+        void SetTrafficSummary(unsigned int seconds) { m_trafficSummary = seconds; }
+        /// Set whether messages to this node may be handled as they are sent
+        void SetInlineSelfDelivery(bool flag) { m_inlineSelfDelivery = flag; }
+        /// Set the number of threads that run the device adapters
+        void SetDeviceThreads(unsigned int n) { m_deviceThreads = n; }
         /// Set the MQTT client identifier
         void SetMQTTId(std::string id) { m_mqtt_id = id; }
         /// Set the MQTT broker address
         void SetMQTTAddress(std::string address) { m_mqtt_address = address; }
         /// Set the MQTT subscriptions
         void SetMQTTSubscriptions(std::vector<std::string> subs) { m_mqtt_subscriptions = subs; }
+        /// Set the threads that handle the received MQTT messages
+        void SetMQTTWorkers(unsigned int n) { m_mqtt_workers = n; }
         /// Get the hostname
         std::string GetHostname() const { return m_hostname; };
         /// Get the port
@@ -98,6 +260,14 @@ class CGlobalConfiguration : private boost::noncopyable
                 { return m_clockskew; };
         /// Get the plug-and-play port number
         unsigned short GetFactoryPort() const { return m_factory_port; }
+        /// Get the pending plug-and-play connections per acceptor, 0 for the limit
+        unsigned int GetFactoryBacklog() const { return m_factoryBacklog; }
+        /// Get the number of acceptors that share the plug-and-play port
+        unsigned int GetFactoryAcceptors() const { return m_factoryAcceptors; }
+        /// Get the change a delta plug-and-play command must exceed to be sent
+        float GetPnpDeltaDeadband() const { return m_pnpDeltaDeadband; }
+        /// Get the delta plug-and-play command packets between full packets
+        unsigned int GetPnpDeltaRefresh() const { return m_pnpDeltaRefresh; }
         /// Get the socket endpoint address
         std::string GetDevicesEndpoint() const { return m_devicesEndpoint; };
         /// Get the path to the adapter configuration file
@@ -108,18 +278,172 @@ class CGlobalConfiguration : private boost::noncopyable
         static const short MAX_PACKET_SIZE = SHRT_MAX;
         /// Path to the topology specification file
         std::string GetTopologyConfigPath() const { return m_topologyConfigPath; }
+        /// Path to the network emulation link file, empty for no emulation
+        std::string GetNetworkEmulationPath() const { return m_networkEmulationPath; }
+        /// Path to the VVC feeder model file, empty for the built-in model
+        std::string GetFeederModelPath() const { return m_feederModelPath; }
+        /// Path to the VVC line impedance file, empty for the built-in table
+        std::string GetFeederImpedancePath() const { return m_feederImpedancePath; }
+        /// Path the accepted VVC feeder models are dumped to, empty for none
+        std::string GetVVCDumpPath() const { return m_vvcDumpPath; }
+        /// Get the file the warm state is saved to
+        std::string GetWarmStatePath() const { return m_warmStatePath; }
+        /// Get the milliseconds between saves of the warm state
+        unsigned int GetWarmStateInterval() const { return m_warmStateInterval; }
+        /// Get the oldest warm state in seconds a restart resumes from
+        unsigned int GetWarmStateMaxAge() const { return m_warmStateMaxAge; }
         /// Get the size of a load balance migration.
         float GetMigrationStep() const { return m_migrationStep; }
+        /// Get the change that triggers a load balance round, 0 for none
+        float GetLoadBalanceDeadband() const { return m_lbDeadband; }
+        /// Get the smoothing factor of the load balance forecast, 0 for none
+        float GetLoadBalanceForecast() const { return m_lbForecast; }
+        /// Get the most demand nodes a supply node drafts in one round
+        unsigned int GetDraftPartners() const { return m_draftPartners; }
+        /// Get the flag to advertise the load balance state on other messages
+        bool GetLoadBalanceDigests() const { return m_lbDigests; }
         /// Get the malicious load balance flag
         bool GetMaliciousFlag() const { return m_malicious; }
         /// Get the invariant check flag
         bool GetInvariantCheck() const { return m_invariant; }
+        /// Get the VVC power flow warm start flag
+        bool GetVVCWarmStart() const { return m_vvcWarmStart; }
+        /// Get the VVC parallel phase computation flag
+        bool GetVVCParallelPhases() const { return m_vvcParallelPhases; }
+        /// Get the VVC compute offload flag
+        bool GetVVCOffload() const { return m_vvcOffload; }
+        /// Get the boundary bus of the feeder segment, -1 for the whole feeder
+        int GetVVCSegmentBus() const { return m_vvcSegmentBus; }
+        /// Get the flag to send VVC gradients as half precision floats
+        bool GetVVCHalfGradients() const { return m_vvcHalfGradients; }
+        /// Get the search that picks the VVC step size, step or newton
+        std::string GetVVCOptimizer() const { return m_vvcOptimizer; }
+        /// Get the precision VVC solves its sensitivities in, double, single or check
+        std::string GetVVCPrecision() const { return m_vvcPrecision; }
+        /// Get the number of VVC what-if power flows solved at once
+        unsigned int GetVVCBatchThreads() const { return m_vvcBatchThreads; }
+        /// Get the number of threads one VVC power flow sweeps laterals on
+        unsigned int GetVVCSweepThreads() const { return m_vvcSweepThreads; }
+        /// Get the threads the BLAS/LAPACK uses for one operation
+        unsigned int GetBlasThreads() const { return m_blasThreads; }
+        /// Get how far a node moves before VVC forms its sensitivities again
+        float GetVVCSensitivityTolerance() const { return m_vvcSensitivityTolerance; }
+        /// Get how far a load moves before a quiet VVC round runs again
+        float GetVVCSkipDeadband() const { return m_vvcSkipDeadband; }
+        /// Get the datagram size budget of a peer connection
+        unsigned int GetDatagramMTU() const { return m_datagramMtu; }
+        /// Get the time in milliseconds a peer connection waits to coalesce
+        unsigned int GetFlushDelay() const { return m_flushDelay; }
+        /// Get the time in microseconds a peer connection may hold back acks
+        unsigned int GetAckDelay() const { return m_ackDelay; }
+        /// Get the messages whose acks are written without a delay
+        unsigned int GetAckCount() const { return m_ackCount; }
+        /// Get the number of datagrams handled per system call
+        unsigned int GetDatagramBatch() const { return m_datagramBatch; }
+        /// Get the receive buffer size of the listener sockets, 0 for the default
+        unsigned int GetSocketReceiveBuffer() const { return m_socketReceiveBuffer; }
+        /// Get the send buffer size of the listener sockets, 0 for the default
+        unsigned int GetSocketSendBuffer() const { return m_socketSendBuffer; }
+        /// Get the size auto-tuning may grow the receive buffers to, 0 if off
+        unsigned int GetSocketBufferLimit() const { return m_socketBufferLimit; }
+        /// Get whether the datagrams the sockets dropped are counted
+        bool GetSocketDrops() const { return m_socketDrops; }
+        /// Get the number of extra receive threads of the listener
+        unsigned int GetListenerThreads() const { return m_listenerThreads; }
+        /// Get the number of threads that run the broker io_service
+        unsigned int GetBrokerThreads() const { return m_brokerThreads; }
+        /// Get the number of unacknowledged messages of a peer connection
+        unsigned int GetSendWindow() const { return m_sendWindow; }
+        /// Get the number of messages queued behind the send window
+        unsigned int GetSendQueue() const { return m_sendQueue; }
+        /// Get the idle rounds before a peer connection is reaped, 0 for never
+        unsigned int GetConnectionIdleRounds() const { return m_connectionIdleRounds; }
+        /// Get the multicast group address, empty if multicast is off
+        std::string GetMulticastAddress() const { return m_multicastAddress; }
+        /// Get the port of the multicast group
+        unsigned short GetMulticastPort() const { return m_multicastPort; }
+        /// Get the children of each node of a relayed group send, 0 for none
+        unsigned int GetRelayFanout() const { return m_relayFanout; }
+        /// Get the shared memory transport flag
+        bool GetSharedMemory() const { return m_sharedMemory; }
+        /// Get the flag to size the phases from the measured module workload
+        bool GetAdaptivePhases() const { return m_adaptivePhases; }
+        /// Get the flag to time the phases with the monotonic phase clock
+        bool GetPrecisePhases() const { return m_precisePhases; }
+        /// Get the microseconds the phase clock spins before a boundary
+        unsigned int GetPhaseSpin() const { return m_phaseSpin; }
+        /// Get the flag to stamp received datagrams in the kernel
+        bool GetKernelTimestamps() const { return m_kernelTimestamps; }
+        /// Get the flag to take clock samples from the regular traffic
+        bool GetPassiveClock() const { return m_passiveClock; }
+        /// Get the flag to detect failures with the SWIM protocol
+        bool GetSwimMembership() const { return m_swimMembership; }
+        /// Get the flag to form groups per feeder segment
+        bool GetHierarchicalGroups() const { return m_hierarchicalGroups; }
+        /// Get the flag to name a standby for the group coordinator
+        bool GetGroupStandby() const { return m_groupStandby; }
+        /// Get the flag to collect only the changed signals
+        bool GetStateDelta() const { return m_stateDelta; }
+        /// Get the change a signal needs to be collected in delta mode
+        float GetStateDeadband() const { return m_stateDeadband; }
+        /// Get the flag to report the collected signals by their index
+        bool GetStatePacked() const { return m_statePacked; }
+        /// Get the flag to aggregate the collected state along a tree
+        bool GetStateAggregate() const { return m_stateAggregate; }
+        /// Get the number of state collection snapshots in flight at once
+        unsigned int GetStateSnapshots() const { return m_stateSnapshots; }
+        /// Get the kilobytes the snapshot recordings may hold, 0 for no limit
+        unsigned int GetStateRecordLimit() const { return m_stateRecordLimit; }
+        /// Get the number of messages queued for a module, 0 for no limit
+        unsigned int GetInboundQueue() const { return m_inboundQueue; }
+        /// Get the bytes of window messages past which they are deflated
+        unsigned int GetCompressThreshold() const { return m_compressThreshold; }
+        /// Get the ready queue depth past which bulk datagrams are refused
+        unsigned int GetAdmissionBacklog() const { return m_admissionBacklog; }
+        /// Get the microseconds an immediate message handler may run
+        unsigned int GetImmediateLimit() const { return m_immediateLimit; }
+        /// Get the milliseconds a scheduler task may run, 0 if not watched
+        unsigned int GetWatchdogThreshold() const { return m_watchdogThreshold; }
+        /// Get the samples the profiler takes per second of CPU, 0 if off
+        unsigned int GetProfileRate() const { return m_profileRate; }
+        /// Get the file the profile is written to on SIGUSR2
+        std::string GetProfileFile() const { return m_profileFile; }
+        /// Get the message types a newer message of the same peer replaces
+        std::vector<std::string> GetSupersededMessages() const { return m_supersededMessages; }
+        /// Get the path of the binary trace file, empty if tracing is off
+        std::string GetTraceFile() const { return m_traceFile; }
+        /// Get the number of records of the binary trace ring
+        unsigned int GetTraceRecords() const { return m_traceRecords; }
+        /// Get the path of the device telemetry file, empty if it is off
+        std::string GetTelemetryFile() const { return m_telemetryFile; }
+        /// Get the number of device table rows queued for the telemetry file
+        unsigned int GetTelemetryQueue() const { return m_telemetryQueue; }
+        /// Get the path the received datagrams are recorded to, empty if off
+        std::string GetCaptureFile() const { return m_captureFile; }
+        /// Get the path the received datagrams are replayed from, empty if off
+        std::string GetReplayCapture() const { return m_replayCapture; }
+        /// Get the speed of the replayed datagrams
+        double GetReplaySpeed() const { return m_replaySpeed; }
+        /// Get the port of the metrics endpoint, 0 if it is off
+        unsigned short GetMetricsPort() const { return m_metricsPort; }
+        /// Get whether outgoing messages carry latency trace stamps
+        bool GetLatencyTrace() const { return m_latencyTrace; }
+        /// Get whether the traffic of each module, type and peer is counted
+        bool GetTrafficAccounting() const { return m_trafficAccounting; }
+        /// Get the seconds between the traffic summaries, 0 if they are off
+        unsigned int GetTrafficSummary() const { return m_trafficSummary; }
+        /// Get whether messages to this node may be handled as they are sent
+        bool GetInlineSelfDelivery() const { return m_inlineSelfDelivery; }
+        /// Get the number of threads that run the device adapters
+        unsigned int GetDeviceThreads() const { return m_deviceThreads; }
         /// Get the MQTT client identifier
         std::string GetMQTTId() const { return m_mqtt_id; }
         /// Get the MQTT broker address
         std::string GetMQTTAddress() const { return m_mqtt_address; }
         /// Get the MQTT subscriptions
         std::vector<std::string> GetMQTTSubscriptions() const { return m_mqtt_subscriptions; }
+        /// Get the threads that handle the received MQTT messages
+        unsigned int GetMQTTWorkers() const { return m_mqtt_workers; }
     private:
         std::string m_hostname; /// Node hostname
         std::string m_port; /// Port number
@@ -127,16 +451,97 @@ class CGlobalConfiguration : private boost::noncopyable
         std::string m_address; /// The listening address.
         boost::posix_time::time_duration m_clockskew; /// The skew of the clock
         unsigned short m_factory_port; /// Port number for adapter factory
+        unsigned int m_factoryBacklog; /// Pending connections per acceptor
+        unsigned int m_factoryAcceptors; /// Acceptors of the factory port
+        float m_pnpDeltaDeadband; /// Change that sends a delta command
+        unsigned int m_pnpDeltaRefresh; /// Delta command packets between full ones
         std::string m_devicesEndpoint; /// Socket endpoint address for devices
         std::string m_adapterConfigPath; /// Path to the adapter configuration
         std::string m_deviceConfigPath; /// Path to the device class config
         std::string m_topologyConfigPath; /// Path to the topology config
+        std::string m_networkEmulationPath; /// Links the outgoing datagrams are shaped by
+        std::string m_feederModelPath; /// Path to the VVC feeder model
+        std::string m_feederImpedancePath; /// Path to the VVC line impedances
+        std::string m_vvcDumpPath; /// Debug dump of the VVC feeder model
+        std::string m_warmStatePath; /// File the warm state is saved to
+        unsigned int m_warmStateInterval; /// Milliseconds between saves
+        unsigned int m_warmStateMaxAge; /// Oldest warm state resumed from
         float m_migrationStep; /// Size of a load balance migration
+        float m_lbDeadband; /// Change that triggers a load balance round
+        float m_lbForecast; /// Smoothing factor of the net generation forecast
+        unsigned int m_draftPartners; /// Demand nodes drafted per round
+        bool m_lbDigests; // Flag to carry the load balance state on GM and clock messages
         bool m_malicious; // Flag to indicate whether load balance is malicious
         bool m_invariant; // Flag that indicates whether to check the invariant
+        bool m_vvcWarmStart; // Flag to seed the VVC power flow with the last solution
+        bool m_vvcParallelPhases; // Flag to run the VVC phases on separate threads
+        bool m_vvcOffload; // Flag to run VVC solves on a background thread
+        int m_vvcSegmentBus; /// Boundary bus of the VVC feeder segment
+        bool m_vvcHalfGradients; // Flag to send VVC gradients as half floats
+        std::string m_vvcOptimizer; /// Search that picks the VVC step size
+        std::string m_vvcPrecision; /// Precision of the VVC sensitivity solve
+        unsigned int m_vvcBatchThreads; /// VVC what-if power flows at once
+        unsigned int m_vvcSweepThreads; /// Threads of one VVC power flow
+        unsigned int m_blasThreads; /// Threads of one BLAS/LAPACK operation
+        float m_vvcSensitivityTolerance; /// Voltage change that reforms rows
+        float m_vvcSkipDeadband; /// Load change that ends a quiet VVC feeder
+        unsigned int m_datagramMtu; /// Datagram size budget in bytes
+        unsigned int m_flushDelay; /// Coalescing delay in milliseconds
+        unsigned int m_ackDelay; /// Delayed ack time in microseconds
+        unsigned int m_ackCount; /// Acked messages that end the ack delay
+        unsigned int m_datagramBatch; /// Datagrams per system call
+        unsigned int m_socketReceiveBuffer; /// Bytes of the socket receive buffers
+        unsigned int m_socketSendBuffer; /// Bytes of the socket send buffers
+        unsigned int m_socketBufferLimit; /// Largest auto-tuned receive buffer
+        bool m_socketDrops; /// Count the datagrams the sockets dropped
+        unsigned int m_listenerThreads; /// Extra listener receive threads
+        unsigned int m_brokerThreads; /// Threads of the broker io_service
+        unsigned int m_sendWindow; /// Messages in flight per connection
+        unsigned int m_sendQueue; /// Messages queued per connection
+        unsigned int m_connectionIdleRounds; /// Idle rounds before a connection is reaped
+        std::string m_multicastAddress; /// Multicast group address
+        unsigned short m_multicastPort; /// Multicast group port
+        unsigned int m_relayFanout; /// Children of each node of a relay tree
+        bool m_sharedMemory; // Flag to reach peers on this host in shared memory
+        bool m_adaptivePhases; // Flag to let the group leader size the phases
+        bool m_precisePhases; // Flag to time the phases with the phase clock
+        unsigned int m_phaseSpin; // Microseconds spun before a phase boundary
+        bool m_kernelTimestamps; // Flag to stamp received datagrams in the kernel
+        bool m_passiveClock; // Flag to take clock samples from the regular traffic
+        bool m_swimMembership; // Flag to detect failures with the SWIM protocol
+        bool m_hierarchicalGroups; // Flag to form groups per feeder segment
+        bool m_groupStandby; // Flag to name a standby for the coordinator
+        bool m_stateDelta; // Flag to collect only the changed signals
+        float m_stateDeadband; /// Change a signal needs in delta mode
+        bool m_statePacked; // Flag to report the signals by their index
+        bool m_stateAggregate; // Flag to aggregate the state along a tree
+        unsigned int m_stateSnapshots; /// Snapshots in flight at once
+        unsigned int m_stateRecordLimit; /// Kilobytes of recorded states
+        unsigned int m_inboundQueue; /// Messages queued per module
+        unsigned int m_compressThreshold; /// Bytes before a window is deflated
+        unsigned int m_admissionBacklog; /// Tasks queued before bulk is refused
+        unsigned int m_immediateLimit; /// Microseconds of an immediate handler
+        unsigned int m_watchdogThreshold; /// Milliseconds of a watched task
+        unsigned int m_profileRate; /// Profiler samples per second of CPU
+        std::string m_profileFile; /// Path the profile is dumped to
+        std::vector<std::string> m_supersededMessages; /// Latest-wins message types
+        std::string m_traceFile; /// Path of the binary trace file
+        unsigned int m_traceRecords; /// Records of the binary trace ring
+        std::string m_telemetryFile; /// Path of the device telemetry file
+        unsigned int m_telemetryQueue; /// Rows queued for the telemetry file
+        std::string m_captureFile; /// Path the received datagrams are recorded to
+        std::string m_replayCapture; /// Path the received datagrams are replayed from
+        double m_replaySpeed; /// Speed of the replayed datagrams
+        unsigned int m_deviceThreads; /// Threads of the device adapters
+        unsigned short m_metricsPort; /// Port of the metrics endpoint
+        bool m_latencyTrace; /// Stamp outgoing messages for latency tracing
+        bool m_trafficAccounting; /// Count the traffic by module, type and peer
+        unsigned int m_trafficSummary; /// Seconds between traffic summaries
+        bool m_inlineSelfDelivery; /// Handle messages to this node as sent
         std::string m_mqtt_id; /// Identifier of the MQTT client.
         std::string m_mqtt_address; /// Address of the MQTT broker.
         std::vector<std::string> m_mqtt_subscriptions; /// Subscription topics for MQTT.
+        unsigned int m_mqtt_workers; /// Threads that handle MQTT messages.
 };
 
 } // namespace broker
@@ -27,10 +27,22 @@
 #include <stdexcept>
 #include <string>
 
+#include <boost/make_shared.hpp>
+
 namespace freedm {
 
 namespace broker {
 
+////////////////////////////////////////////////////////
+/// CGlobalPeerList::CGlobalPeerList
+/// @description Creates the list with an empty snapshot.
+/// @pre None
+/// @post PeerList returns an empty map.
+////////////////////////////////////////////////////////
+CGlobalPeerList::CGlobalPeerList()
+    : m_peerlist(boost::make_shared<const PeerSet>())
+{
+}
 ////////////////////////////////////////////////////////
 /// CGlobalPeerList::GetPeer
 /// @description Fetch a peer based on uuid, throws an exception if they aren't found
@@ -38,10 +50,11 @@ namespace broker {
 /// @return A CPeerNode object for the specified peer.
 /// @ErrorHandling Runtime exception if no peer matches that description.
 ////////////////////////////////////////////////////////
-CPeerNode CGlobalPeerList::GetPeer(const std::string& uuid)
+CPeerNode CGlobalPeerList::GetPeer(const std::string& uuid) const
 {
-    PeerSetIterator pst = Find(uuid);
-    if(pst == end())
+    Snapshot peers = PeerList();
+    PeerSet::const_iterator pst = peers->find(uuid);
+    if(pst == peers->end())
     {
         throw EDgiNoSuchPeerError("Peer " + uuid + " was not found in the global table");
     }
@@ -53,48 +66,40 @@ CPeerNode CGlobalPeerList::GetPeer(const std::string& uuid)
 /// @param uuid The UUID of a peer.
 /// @return A count of all nodes with that uuid in the table. (should be 1 or 0)
 ////////////////////////////////////////////////////////
-int CGlobalPeerList::Count(const std::string& uuid)
-{
-    return m_peerlist.count(uuid);
-}
-///////////////////////////////////////////////////////
-/// CGlobalPeerList::Find
-/// @description Return an iterator to the peer with the given uuid
-/// @param uuid The UUID of the peer you are attempting to access
-/// @return An iterator to the peer if found or end() if not found.
-///////////////////////////////////////////////////////
-CGlobalPeerList::PeerSetIterator CGlobalPeerList::Find(const std::string& uuid)
+int CGlobalPeerList::Count(const std::string& uuid) const
 {
-    return m_peerlist.find(uuid);
+    return PeerList()->count(uuid);
 }
 //////////////////////////////////////////////////////
-/// CGlobalPeerList::begin
-/// @description Return an iterator to the beginning of the container's table.
-/// @return An iterator to the beginning of the peer list.
+/// CGlobalPeerList::Empty
+/// @description Checks if the current snapshot has no peers.
+/// @return True if no peer is known.
 //////////////////////////////////////////////////////
-CGlobalPeerList::PeerSetIterator CGlobalPeerList::begin()
+bool CGlobalPeerList::Empty() const
 {
-    return m_peerlist.begin();
-}
-//////////////////////////////////////////////////////
-/// CGlobalPeerList::end
-/// @description Return an iterator to the end of the container's table.
-/// @return An iterator to the end of the peer list.
-//////////////////////////////////////////////////////
-CGlobalPeerList::PeerSetIterator CGlobalPeerList::end()
-{
-    return m_peerlist.end();
+    return PeerList()->empty();
 }
 //////////////////////////////////////////////////////
 /// CGlobalPeerList::Insert
-/// @description Pushes a peer node into the set
+/// @description Pushes a peer node into the set by publishing a copy of the
+///     current snapshot with the peer added. Readers holding the old
+///     snapshot keep iterating it unchanged.
 ///	@pre None
 /// @post p has been added to the global peer list.
 /// @param p A CPeerNode to put into the container.
 //////////////////////////////////////////////////////
 void CGlobalPeerList::Insert(CPeerNode p)
 {
-    m_peerlist.insert(std::make_pair(p.GetUUID(),p));
+    boost::mutex::scoped_lock writelock(m_writeMutex);
+    Snapshot current = PeerList();
+    if(current->count(p.GetUUID()) > 0)
+    {
+        return;
+    }
+    boost::shared_ptr<PeerSet> next = boost::make_shared<PeerSet>(*current);
+    next->insert(std::make_pair(p.GetUUID(),p));
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_peerlist = next;
 }
 //////////////////////////////////////////////////////
 /// CGlobalPeerList::Create
@@ -107,21 +112,30 @@ void CGlobalPeerList::Insert(CPeerNode p)
 //////////////////////////////////////////////////////
 CPeerNode CGlobalPeerList::Create(std::string uuid)
 {
-    if(Count(uuid) > 0)
+    boost::mutex::scoped_lock writelock(m_writeMutex);
+    Snapshot current = PeerList();
+    PeerSet::const_iterator it = current->find(uuid);
+    if(it != current->end())
     {
-        return GetPeer(uuid);
+        return it->second;
     }
     CPeerNode p = CPeerNode(uuid);
-    Insert(p);
+    boost::shared_ptr<PeerSet> next = boost::make_shared<PeerSet>(*current);
+    next->insert(std::make_pair(uuid,p));
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_peerlist = next;
     return p;
 }
 /////////////////////////////////////////////////////
 /// CGlobalPeerList::PeerList
-/// @description Gets a copy of the global peer list.
-/// @return A copy of the global peer list
+/// @description Gets the current snapshot of the global peer list. The
+///     snapshot must be held, not just dereferenced, for as long as it is
+///     iterated.
+/// @return The current snapshot of the global peer list
 /////////////////////////////////////////////////////
-CGlobalPeerList::PeerSet& CGlobalPeerList::PeerList()
+CGlobalPeerList::Snapshot CGlobalPeerList::PeerList() const
 {
+    boost::mutex::scoped_lock lock(m_mutex);
     return m_peerlist;
 }
 
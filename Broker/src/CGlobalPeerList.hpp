@@ -27,29 +27,27 @@
 #include <string>
 
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace freedm {
 
 namespace broker {
 
-// We have to forward declare GMAgent (and its namespace!) to make it a friend.
-namespace gm {
-
-class GMAgent;
-
-}
-
 class CPeerNode;
 
+/// The peers are kept in immutable snapshots. A writer copies the current
+/// snapshot, changes the copy and swaps it in, so a reader can iterate the
+/// snapshot it holds without a lock while new peers arrive. Only the copy
+/// and the swap of the snapshot pointer itself are done under a short lock.
 class CGlobalPeerList
     : private boost::noncopyable
 {
     public:
-        friend class freedm::broker::gm::GMAgent;
         /// The peerset type
         typedef std::map<std::string, CPeerNode> PeerSet;
-        /// Provides and Iterator
-        typedef PeerSet::iterator PeerSetIterator;
+        /// A version of the peer list that never changes
+        typedef boost::shared_ptr<const PeerSet> Snapshot;
         /// Provides the global instance
         static CGlobalPeerList& instance()
         {
@@ -57,25 +55,26 @@ class CGlobalPeerList
             return inst;
         }
         /// Fetch a peer based on uuid, throws an exception if they aren't found
-        CPeerNode GetPeer(const std::string& uuid);
+        CPeerNode GetPeer(const std::string& uuid) const;
         /// Count the number of peers with a specified uuid (should be 1 or 0)
-        int Count(const std::string& uuid);
-        /// Return an iterator to the peer with the given uuid
-        PeerSetIterator Find(const std::string& uuid);
-        /// Iterator to the beginning of the peerset
-        PeerSetIterator begin();
-        /// Iterator to the end of the peerset
-        PeerSetIterator end();
-        /// Returns a copy of the peer map
-        PeerSet& PeerList();
+        int Count(const std::string& uuid) const;
+        /// Checks if no peer is known
+        bool Empty() const;
+        /// Returns the current version of the peer map
+        Snapshot PeerList() const;
         /// Construct a peer
         CPeerNode Create(std::string uuid);
         /// Pushes a peer node into the set
         void Insert(CPeerNode p);
     private:
-        /// The set of peers to present
-        PeerSet m_peerlist;
-
+        /// Starts with an empty snapshot
+        CGlobalPeerList();
+        /// The current version of the peers, read and replaced under m_mutex
+        Snapshot m_peerlist;
+        /// Guards m_peerlist itself, not the snapshot it points to
+        mutable boost::mutex m_mutex;
+        /// Serializes the writers so that none of their changes is lost
+        boost::mutex m_writeMutex;
 };
 
 }
@@ -0,0 +1,184 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CLatencyTrace.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Per-message-type delivery latency breakdowns
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CLatencyTrace.hpp"
+
+#include "CBroker.hpp"
+#include "CClockSynchronizer.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The universal time the stamps count from
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970,1,1));
+
+/// Converts the time between two stamps to seconds, 0 if it is negative
+double Seconds(boost::uint64_t from, boost::uint64_t to)
+{
+    return to > from ? (to - from) / 1e6 : 0.0;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLatencyTrace::Instance
+/// @description Access the singleton instance of the latency trace
+/// @pre None
+/// @post None
+/// @return A reference to the latency trace.
+///////////////////////////////////////////////////////////////////////////////
+CLatencyTrace& CLatencyTrace::Instance()
+{
+    static CLatencyTrace trace;
+    return trace;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLatencyTrace::Now
+/// @description Reads the clock of the synchronizer, which the stamps of every
+///     node are taken on so that they can be compared.
+/// @pre The broker has been created.
+/// @post None
+/// @return The synchronized time in microseconds since the Unix epoch.
+///////////////////////////////////////////////////////////////////////////////
+boost::uint64_t CLatencyTrace::Now()
+{
+    return (CBroker::Instance().GetClockSynchronizer().GetSynchronizedTime()
+        - EPOCH).total_microseconds();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLatencyTrace::ReceiveTime
+/// @description Stamps the arrival of a window. A kernel receive time is moved
+///     onto the synchronized clock by the age it has now; without one the
+///     window is stamped as it is processed.
+/// @pre None
+/// @post None
+/// @param received The kernel receive time of the window, or not_a_date_time.
+/// @return The synchronized arrival time in microseconds since the epoch.
+///////////////////////////////////////////////////////////////////////////////
+boost::uint64_t CLatencyTrace::ReceiveTime(const boost::posix_time::ptime& received)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::uint64_t now = Now();
+    if(!received.is_not_a_date_time())
+    {
+        boost::int64_t age = (boost::posix_time::microsec_clock::universal_time()
+            - received).total_microseconds();
+        if(age > 0 && static_cast<boost::uint64_t>(age) < now)
+        {
+            now -= age;
+        }
+    }
+
+    return now;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLatencyTrace::Record
+/// @description Adds the stages of a traced message to the histograms of its
+///     type. A stage whose stamps are missing, such as the network of a
+///     message this node sent to itself, is left out.
+/// @pre Called when the handler of the message is about to start.
+/// @post The stages are observed in dgi_message_latency_seconds.
+/// @param type The type name of the message, such as gm.InviteMessage.
+/// @param enqueued The stamp the sender took when it queued the message.
+/// @param stamps The stamps the receiver took.
+///////////////////////////////////////////////////////////////////////////////
+void CLatencyTrace::Record(const std::string& type, boost::uint64_t enqueued,
+    const SDeliveryStamps& stamps)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::uint64_t started = Now();
+    const SBreakdown& breakdown = GetBreakdown(type);
+
+    if(stamps.sent != 0)
+    {
+        breakdown.window->Observe(Seconds(enqueued, stamps.sent));
+    }
+    if(stamps.sent != 0 && stamps.received != 0)
+    {
+        breakdown.network->Observe(Seconds(stamps.sent, stamps.received));
+    }
+    if(stamps.received != 0 && stamps.dispatched != 0)
+    {
+        breakdown.listener->Observe(Seconds(stamps.received, stamps.dispatched));
+    }
+    if(stamps.dispatched != 0)
+    {
+        breakdown.queue->Observe(Seconds(stamps.dispatched, started));
+    }
+    breakdown.total->Observe(Seconds(enqueued, started));
+
+    LOG_DEBUG(Logger) << type << " took " << Seconds(enqueued, started)
+        << "s from enqueue to its handler" << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLatencyTrace::GetBreakdown
+/// @description Finds the histograms of a message type. The histograms of a
+///     type are registered with the metrics the first time it is traced.
+/// @pre None
+/// @post The type has an entry in m_types.
+/// @param type The type name of a message.
+/// @return The histograms of the type.
+///////////////////////////////////////////////////////////////////////////////
+const CLatencyTrace::SBreakdown& CLatencyTrace::GetBreakdown(const std::string& type)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    std::map<std::string, SBreakdown>::iterator it = m_types.find(type);
+    if(it == m_types.end())
+    {
+        const std::string name = "dgi_message_latency_seconds";
+        const std::string help = "Delivery times of traced messages, by type and stage";
+        const std::string label = CMetrics::Label("type", type) + ",";
+        CMetrics& metrics = CMetrics::Instance();
+
+        SBreakdown breakdown;
+        breakdown.window = &metrics.GetHistogram(name, help,
+            label + CMetrics::Label("stage", "window"));
+        breakdown.network = &metrics.GetHistogram(name, help,
+            label + CMetrics::Label("stage", "network"));
+        breakdown.listener = &metrics.GetHistogram(name, help,
+            label + CMetrics::Label("stage", "listener"));
+        breakdown.queue = &metrics.GetHistogram(name, help,
+            label + CMetrics::Label("stage", "queue"));
+        breakdown.total = &metrics.GetHistogram(name, help,
+            label + CMetrics::Label("stage", "total"));
+        it = m_types.insert(std::make_pair(type, breakdown)).first;
+    }
+    return it->second;
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CLatencyTrace.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare the per-message-type delivery latency breakdowns
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CLATENCYTRACE_HPP
+#define CLATENCYTRACE_HPP
+
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+class CHistogram;
+
+/// The stamps the receiver of a traced message takes
+struct SDeliveryStamps
+{
+    /// Creates the stamps of a message that is not traced
+    SDeliveryStamps() : sent(0), received(0), dispatched(0) { }
+
+    /// Send stamp of the window that carried the message, 0 if unknown
+    boost::uint64_t sent;
+    /// Time the window arrived, 0 if the message did not cross the network
+    boost::uint64_t received;
+    /// Time the dispatcher scheduled the delivery
+    boost::uint64_t dispatched;
+};
+
+/// Splits the delivery time of traced messages into its stages
+////////////////////////////////////////////////////////////////////////////////
+/// A traced message is stamped when the sender serializes it. The receiver
+/// keeps the send time of the window that carried it, the time the window
+/// arrived and the time the dispatcher scheduled the delivery alongside the
+/// message, and the breakdown is recorded when the module's handler starts:
+///
+///     window   enqueue to send: the send queue, the window and resends
+///     network  send to receive: the network and the peer's socket
+///     listener receive to dispatch: parsing and the broker strand
+///     queue    dispatch to handler: the ready queue and the module's phase
+///     total    enqueue to handler
+///
+/// The stamps are taken on the synchronized clock, so the stages that span
+/// two nodes are only as exact as the clocks; a negative stage counts as 0.
+/// Without kernel timestamps the arrival is stamped on the broker strand and
+/// the listener stage includes nothing but the dispatch itself.
+////////////////////////////////////////////////////////////////////////////////
+class CLatencyTrace
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CLatencyTrace
+    static CLatencyTrace& Instance();
+
+    /// Gets the synchronized time in microseconds since the Unix epoch
+    static boost::uint64_t Now();
+
+    /// Gets the synchronized arrival stamp of a window
+    static boost::uint64_t ReceiveTime(const boost::posix_time::ptime& received);
+
+    /// Records the stages of a traced message whose handler is starting
+    void Record(const std::string& type, boost::uint64_t enqueued,
+        const SDeliveryStamps& stamps);
+
+private:
+    /// The histograms of one message type
+    struct SBreakdown
+    {
+        /// Enqueue to send
+        CHistogram* window;
+        /// Send to receive
+        CHistogram* network;
+        /// Receive to dispatch
+        CHistogram* listener;
+        /// Dispatch to handler
+        CHistogram* queue;
+        /// Enqueue to handler
+        CHistogram* total;
+    };
+
+    /// Private constructor for the singleton instance
+    CLatencyTrace() { }
+
+    /// Gets the histograms of a message type, registering them on first use
+    const SBreakdown& GetBreakdown(const std::string& type);
+
+    /// The histograms by message type
+    std::map<std::string, SBreakdown> m_types;
+
+    /// Lock for m_types
+    boost::mutex m_mutex;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CLATENCYTRACE_HPP
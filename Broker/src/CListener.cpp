@@ -24,23 +24,41 @@
 #include "config.hpp"
 
 #include "CBroker.hpp"
+#include "CCaptureLog.hpp"
 #include "CConnectionManager.hpp"
 #include "CDispatcher.hpp"
 #include "CGlobalConfiguration.hpp"
+#include "CLatencyTrace.hpp"
 #include "CListener.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
 #include "CClockSynchronizer.hpp"
 #include "CConnection.hpp"
+#include "CThreadPolicy.hpp"
+#include "CTrafficAccounting.hpp"
+#include "IProtocol.hpp"
+#include "config.hpp"
 #include "messages/ModuleMessage.pb.h"
 #include "messages/ProtocolMessage.pb.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <vector>
 
+#include <sys/socket.h>
+
 #include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/system/error_code.hpp>
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <zlib.h>
+
 using boost::property_tree::ptree;
 
 namespace freedm {
@@ -51,6 +69,286 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Datagrams handed to the connections
+CCounter& DatagramsMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_datagrams_total", "Datagrams handed to the connections");
+
+/// Bytes of the datagrams read from the sockets
+CCounter& BytesMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_received_bytes_total",
+    "Bytes of the datagrams read from the listener sockets");
+
+/// Datagrams that could not be parsed
+CCounter& MalformedMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_dropped_datagrams_total", "Datagrams dropped, by reason",
+    CMetrics::Label("reason", "malformed"));
+
+/// Datagrams for a lane this DGI does not have
+CCounter& UnknownLaneMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_dropped_datagrams_total", "Datagrams dropped, by reason",
+    CMetrics::Label("reason", "lane"));
+
+/// Deflated datagrams that could not be inflated
+CCounter& InflateMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_dropped_datagrams_total", "Datagrams dropped, by reason",
+    CMetrics::Label("reason", "inflate"));
+
+/// Bulk datagrams refused while the ready queues were over their budget
+CCounter& OverloadMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_dropped_datagrams_total", "Datagrams dropped, by reason",
+    CMetrics::Label("reason", "overload"));
+
+/// Failed reads of the listener sockets
+CCounter& ReadErrorsMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_read_errors_total", "Failed reads of the listener sockets");
+
+/// Datagrams the listener socket could not send
+CCounter& SendErrorsMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_send_errors_total",
+    "Queued datagrams the listener socket could not send");
+
+#ifdef SO_REUSEPORT
+/// Socket option that lets several sockets bind the listening port.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>
+    ReusePort;
+#endif
+
+#ifdef SO_TIMESTAMPNS
+/// Socket option that makes the kernel stamp each received datagram.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_TIMESTAMPNS>
+    TimestampNs;
+#endif
+
+/// Room for the receive time and the drop count that come with a datagram.
+const std::size_t CONTROL_SIZE = CMSG_SPACE(sizeof(struct timespec))
+    + CSocketTuner::CONTROL_SIZE;
+
+///////////////////////////////////////////////////////////////////////////////
+/// ReadStamp
+/// @description Finds the kernel receive time among the control messages of
+///     a received datagram.
+/// @pre None.
+/// @post None.
+/// @param hdr The header filled in by recvmsg.
+/// @return The receive time, or not_a_date_time if the datagram has none.
+///////////////////////////////////////////////////////////////////////////////
+boost::posix_time::ptime ReadStamp(msghdr& hdr)
+{
+#ifdef SO_TIMESTAMPNS
+    for(cmsghdr* c = CMSG_FIRSTHDR(&hdr); c != NULL; c = CMSG_NXTHDR(&hdr, c))
+    {
+        if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return boost::posix_time::from_time_t(ts.tv_sec) +
+                boost::posix_time::microseconds(ts.tv_nsec / 1000);
+        }
+    }
+#endif
+    return boost::posix_time::ptime();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ReceiveStamped
+/// @description Reads one waiting datagram with the time the kernel received
+///     it and the drop count of the socket. The call does not block.
+/// @pre The kernel stamps the datagrams of the socket or counts its drops.
+/// @post One datagram has been read, unless ec is set. The tuner has read
+///     its drop count.
+/// @param socket The socket to read.
+/// @param tuner The tuner of the socket.
+/// @param data The buffer for the datagram.
+/// @param size The size of the buffer.
+/// @param from Set to the endpoint that sent the datagram.
+/// @param received Set to the kernel receive time.
+/// @param ec Set if no datagram could be read.
+/// @return The size of the datagram.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t ReceiveStamped(boost::asio::ip::udp::socket& socket,
+    CSocketTuner& tuner, char* data, std::size_t size,
+    boost::asio::ip::udp::endpoint& from, boost::posix_time::ptime& received,
+    boost::system::error_code& ec)
+{
+    char control[CONTROL_SIZE];
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+    msghdr hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_name = from.data();
+    hdr.msg_namelen = from.capacity();
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    ssize_t got = recvmsg(socket.native_handle(), &hdr, MSG_DONTWAIT);
+    if(got < 0)
+    {
+        ec = boost::system::error_code(errno, boost::system::system_category());
+        return 0;
+    }
+    ec = boost::system::error_code();
+    from.resize(hdr.msg_namelen);
+    received = ReadStamp(hdr);
+    tuner.ReadControl(hdr);
+    return got;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PeekLane
+/// @description Reads the lane of a datagram from its encoding, skipping over
+///     the messages without parsing them.
+/// @pre None.
+/// @post None.
+/// @param data The datagram.
+/// @param size The size of the datagram.
+/// @return The lane of the datagram, LANE_CONTROL if it names none.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int PeekLane(const char* data, std::size_t size)
+{
+    using google::protobuf::internal::WireFormatLite;
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const google::protobuf::uint8*>(data), size);
+    google::protobuf::uint32 tag;
+    while((tag = input.ReadTag()) != 0)
+    {
+        if(WireFormatLite::GetTagFieldNumber(tag) ==
+                ProtocolMessageWindow::kLaneFieldNumber &&
+            WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_VARINT)
+        {
+            google::protobuf::uint32 lane = LANE_CONTROL;
+            input.ReadVarint32(&lane);
+            return lane;
+        }
+        if(!WireFormatLite::SkipField(&input, tag))
+        {
+            break;
+        }
+    }
+    return LANE_CONTROL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Admit
+/// @description Decides whether a datagram is worth parsing. While the
+///     longest ready queue of the broker holds more tasks than the admission
+///     backlog, the datagrams of the bulk lane are refused before they are
+///     parsed. Their senders write them again once their resend timers run
+///     out, by which time the node has usually caught up; the control and
+///     realtime lanes are always admitted.
+/// @pre None.
+/// @post None.
+/// @param data The datagram.
+/// @param size The size of the datagram.
+/// @return False if the datagram should be dropped unparsed.
+///////////////////////////////////////////////////////////////////////////////
+bool Admit(const char* data, std::size_t size)
+{
+    unsigned int limit = CGlobalConfiguration::Instance().GetAdmissionBacklog();
+    if(limit == 0 || CBroker::Instance().GetBacklog() < limit)
+    {
+        return true;
+    }
+    if(PeekLane(data, size) != LANE_BULK)
+    {
+        return true;
+    }
+    OverloadMetric.Increment();
+    LOG_DEBUG(Logger)<<"Refused a bulk datagram, the broker is overloaded"
+        <<std::endl;
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Inflate
+/// @description Restores the messages of a window its sender deflated.
+/// @pre The window has compressed messages.
+/// @post None.
+/// @param pmw The deflated window.
+/// @return The window with its messages, or null if they cannot be inflated.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ProtocolMessageWindow> Inflate(
+    const ProtocolMessageWindow& pmw)
+{
+    // bound the memory a forged size could make this take
+    const uLongf limit = 16 * CGlobalConfiguration::MAX_PACKET_SIZE;
+    uLongf size = pmw.inflated_size();
+    if(size == 0 || size > limit)
+    {
+        return boost::shared_ptr<const ProtocolMessageWindow>();
+    }
+
+    std::string messages(size, '\0');
+    const std::string& compressed = pmw.compressed();
+    if(uncompress(reinterpret_cast<Bytef*>(&messages[0]), &size,
+            reinterpret_cast<const Bytef*>(compressed.data()),
+            compressed.size()) != Z_OK || size != pmw.inflated_size())
+    {
+        return boost::shared_ptr<const ProtocolMessageWindow>();
+    }
+
+    boost::shared_ptr<ProtocolMessageWindow> window =
+        boost::make_shared<ProtocolMessageWindow>(pmw);
+    window->clear_compressed();
+    window->clear_inflated_size();
+    if(!window->MergeFromString(messages))
+    {
+        return boost::shared_ptr<const ProtocolMessageWindow>();
+    }
+    return window;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// StampReceived
+/// @description Adds the kernel receive time to a clock exchange response,
+///     so the synchronizer does not measure the time the message spent in
+///     the broker's queues. Other messages are returned unchanged.
+/// @pre None.
+/// @post None.
+/// @param msg The message accepted from a peer.
+/// @param received The kernel receive time of its last datagram.
+/// @return The message to deliver.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ModuleMessage> StampReceived(
+    boost::shared_ptr<const ModuleMessage> msg, boost::posix_time::ptime received)
+{
+    if(!msg->has_clock_synchronizer_message() ||
+        !msg->clock_synchronizer_message().has_exchange_response_message())
+    {
+        return msg;
+    }
+    boost::shared_ptr<ModuleMessage> stamped = boost::make_shared<ModuleMessage>(*msg);
+    stamped->mutable_clock_synchronizer_message()->
+        mutable_exchange_response_message()->set_unsynchronized_receivetime(
+            boost::posix_time::to_simple_string(received));
+    return stamped;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// AccountReceived
+/// @description Counts the traffic of a message accepted from a peer, as a
+///     module message or as a piece of a split one.
+/// @pre Traffic accounting is on.
+/// @post The traffic accounting holds the message, unless it is neither.
+/// @param pm The accepted message.
+/// @param peer The UUID of the sender.
+///////////////////////////////////////////////////////////////////////////////
+void AccountReceived(const ProtocolMessage& pm, const std::string& peer)
+{
+    if(pm.has_fragment())
+    {
+        CTrafficAccounting::Instance().AccountFragment(
+            CTrafficAccounting::RECEIVED, peer, pm.fragment().size());
+    }
+    else if(pm.has_module_message())
+    {
+        CTrafficAccounting::Instance().Account(CTrafficAccounting::RECEIVED,
+            pm.module_message(), peer, pm.module_message().ByteSize());
+    }
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -62,8 +360,13 @@ CLocalLogger Logger(__FILE__);
 ///////////////////////////////////////////////////////////////////////////////
 CListener::CListener()
     : m_socket(CBroker::Instance().GetIOService())
+    , m_tuner(m_socket)
+    , m_batch(1)
+    , m_flush_pending(false)
+    , m_control(false)
+    , m_reliability(100)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -78,7 +381,9 @@ CListener& CListener::Instance()
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CListener::Start
-/// @description Causes the listener to start listening for new messages
+/// @description Causes the listener to start listening for new messages. The
+///     datagrams are read with their control messages if the kernel stamps
+///     them or attaches the drop count of the socket.
 /// @pre endpoint is a valid endpoint for the lister to listen on
 /// @post The listener is not listening for incoming messages on the socket
 ///     bound to endpoint
@@ -86,10 +391,46 @@ CListener& CListener::Instance()
 ///////////////////////////////////////////////////////////////////////////////
 void CListener::Start(boost::asio::ip::udp::endpoint& endpoint)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    unsigned int workers = CGlobalConfiguration::Instance().GetListenerThreads();
+
     m_socket.open(endpoint.protocol());
+    if(workers > 0)
+    {
+#ifdef SO_REUSEPORT
+        m_socket.set_option(ReusePort(true));
+#else
+        LOG_WARN(Logger) << "SO_REUSEPORT is not supported, receiving on the"
+            << " broker thread only" << std::endl;
+        workers = 0;
+#endif
+    }
+    bool timestamps = CGlobalConfiguration::Instance().GetKernelTimestamps();
+    if(timestamps)
+    {
+#ifdef SO_TIMESTAMPNS
+        m_socket.set_option(TimestampNs(true));
+#else
+        LOG_WARN(Logger) << "SO_TIMESTAMPNS is not supported, stamping"
+            << " datagrams in user space" << std::endl;
+        timestamps = false;
+#endif
+    }
+    m_tuner.Apply();
+    m_control = timestamps || m_tuner.CountsDrops();
     m_socket.bind(endpoint);
+    m_batch = std::max(1u, CGlobalConfiguration::Instance().GetDatagramBatch());
+    m_ring.resize((m_batch - 1) * CGlobalConfiguration::MAX_PACKET_SIZE);
     ScheduleListen();
+
+    // the kernel assigns each sender to one of the sockets, so the datagrams
+    // of a connection keep their order
+    for(unsigned int i = 0; i < workers; i++)
+    {
+        m_workers.push_back(boost::shared_ptr<CReceiveWorker>(
+            new CReceiveWorker(endpoint)));
+        m_workers.back()->Start();
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -100,7 +441,13 @@ void CListener::Start(boost::asio::ip::udp::endpoint& endpoint)
 ///////////////////////////////////////////////////////////////////////////////
 void CListener::Stop()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    BOOST_FOREACH(boost::shared_ptr<CReceiveWorker> worker, m_workers)
+    {
+        worker->Stop();
+    }
+    m_workers.clear();
 
     try
     {
@@ -108,8 +455,170 @@ void CListener::Stop()
     }
     catch (boost::system::system_error& e)
     {
-        Logger.Error << "Error calling close: " << e.what() << std::endl;
+        LOG_ERROR(Logger) << "Error calling close: " << e.what() << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::CReceiveWorker::CReceiveWorker
+/// @description Creates a socket that shares the listening port with the
+///     listener socket.
+/// @pre The platform supports SO_REUSEPORT.
+/// @post The worker socket is bound to endpoint.
+/// @param endpoint the endpoint the listener is bound to
+///////////////////////////////////////////////////////////////////////////////
+CListener::CReceiveWorker::CReceiveWorker(
+    const boost::asio::ip::udp::endpoint& endpoint)
+    : m_socket(m_ios)
+    , m_tuner(m_socket)
+    , m_control(false)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_socket.open(endpoint.protocol());
+#ifdef SO_REUSEPORT
+    m_socket.set_option(ReusePort(true));
+#endif
+#ifdef SO_TIMESTAMPNS
+    m_control = CGlobalConfiguration::Instance().GetKernelTimestamps();
+    if(m_control)
+    {
+        m_socket.set_option(TimestampNs(true));
+    }
+#endif
+    m_tuner.Apply();
+    m_control = m_control || m_tuner.CountsDrops();
+    m_socket.bind(endpoint);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::CReceiveWorker::Start
+/// @description Starts receiving on the worker thread.
+/// @pre None.
+/// @post The worker thread is waiting for a datagram.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::CReceiveWorker::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    ScheduleListen();
+    m_thread = boost::thread(boost::bind(&CReceiveWorker::Run, this));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::CReceiveWorker::Stop
+/// @description Stops the worker thread and closes the worker socket.
+/// @pre None.
+/// @post The worker thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::CReceiveWorker::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_ios.stop();
+    m_thread.join();
+
+    boost::system::error_code ec;
+    m_socket.close(ec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::CReceiveWorker::Run
+/// @description Runs the worker io_service until the worker is stopped.
+/// @pre None.
+/// @post None.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::CReceiveWorker::Run()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    CThreadPolicy::Instance().Apply("listener");
+    m_ios.run();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::CReceiveWorker::ScheduleListen
+/// @description Requests that HandleRead is called on the worker thread when
+///     a datagram arrives on the worker socket.
+/// @pre The worker socket is bound.
+/// @post HandleRead will be called when a datagram arrives at the socket
+///////////////////////////////////////////////////////////////////////////////
+void CListener::CReceiveWorker::ScheduleListen()
+{
+    if(m_control)
+    {
+        // wait for the socket to be readable and read the stamp in HandleRead
+        m_socket.async_receive(boost::asio::null_buffers(),
+            boost::bind(&CReceiveWorker::HandleRead, this,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+        return;
+    }
+    m_socket.async_receive_from(
+        boost::asio::buffer(m_buffer, CGlobalConfiguration::MAX_PACKET_SIZE),
+        m_recv_from, boost::bind(&CReceiveWorker::HandleRead, this,
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::CReceiveWorker::HandleRead
+/// @description Parses a datagram on the worker thread and posts it to the
+///     broker thread, where the protocol handles its messages, unless it is
+///     refused while the broker is overloaded.
+/// @param e The errorcode if any associated.
+/// @param bytes_transferred The size of the datagram being read.
+/// @pre A datagram has been placed in the buffer by the receive call.
+/// @post The parsed datagram is queued for the broker thread, and the worker
+///     is waiting for another datagram.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::CReceiveWorker::HandleRead(const boost::system::error_code& e,
+    std::size_t bytes_transferred)
+{
+    if(e == boost::asio::error::operation_aborted)
+    {
+        return;
     }
+
+    boost::system::error_code error = e;
+    boost::posix_time::ptime received;
+    if(!error && m_control)
+    {
+        bytes_transferred = ReceiveStamped(m_socket, m_tuner, m_buffer.begin(),
+            CGlobalConfiguration::MAX_PACKET_SIZE, m_recv_from, received, error);
+        if(error == boost::asio::error::would_block)
+        {
+            ScheduleListen();
+            return;
+        }
+    }
+
+    if(!error)
+    {
+        BytesMetric.Increment(bytes_transferred);
+    }
+    if(!error && Admit(m_buffer.begin(), bytes_transferred))
+    {
+        boost::shared_ptr<ProtocolMessageWindow> pmw = AcquireWindow();
+        if(pmw->ParseFromArray(m_buffer.begin(), bytes_transferred))
+        {
+            CBroker::Instance().GetStrand().post(
+                boost::bind(&CListener::HandleStamped, &CListener::Instance(),
+                    boost::shared_ptr<const ProtocolMessageWindow>(pmw),
+                    m_recv_from, received));
+        }
+        else
+        {
+            MalformedMetric.Increment();
+            LOG_ERROR_LIMITED(Logger, 1)<<"Failed to load protobuf"<<std::endl;
+        }
+    }
+    else if(error)
+    {
+        ReadErrorsMetric.Increment();
+        LOG_ERROR(Logger)<<"HandleRead failed: " << error.message() << std::endl;
+    }
+    ScheduleListen();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -127,67 +636,402 @@ void CListener::Stop()
 void CListener::HandleRead(const boost::system::error_code& e,
                            std::size_t bytes_transferred)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if (e)
     {
-        Logger.Error<<"HandleRead failed: " << e.message();
+        ReadErrorsMetric.Increment();
+        LOG_ERROR(Logger)<<"HandleRead failed: " << e.message();
         ScheduleListen();
+        return;
     }
 
-    Logger.Debug<<"Loading protobuf"<<std::endl;
-    ProtocolMessageWindow pmw;
-    if(!pmw.ParseFromArray(m_buffer.begin(), bytes_transferred))
+    // the bytes read in this wakeup were all in the receive buffer at once
+    std::size_t burst = 0;
+    if(m_control)
+    {
+        boost::system::error_code ec;
+        boost::posix_time::ptime received;
+        std::size_t size = ReceiveStamped(m_socket, m_tuner, m_buffer.begin(),
+            CGlobalConfiguration::MAX_PACKET_SIZE, m_recv_from, received, ec);
+        if(!ec)
+        {
+            burst += size;
+            ProcessDatagram(m_buffer.begin(), size, m_recv_from, received);
+        }
+        else if(ec != boost::asio::error::would_block)
+        {
+            ReadErrorsMetric.Increment();
+            LOG_ERROR(Logger)<<"HandleRead failed: " << ec.message() << std::endl;
+        }
+    }
+    else
+    {
+        burst += bytes_transferred;
+        ProcessDatagram(m_buffer.begin(), bytes_transferred, m_recv_from,
+            boost::posix_time::ptime());
+    }
+
+    if(IsBatching())
+    {
+        burst += DrainSocket();
+    }
+    m_tuner.NoteBurst(burst);
+    ScheduleListen();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::ProcessDatagram
+/// @description Parses a received datagram and passes it to ProcessWindow,
+///     unless it is refused while the broker is overloaded.
+/// @param data The datagram.
+/// @param size The size of the datagram.
+/// @param from The endpoint that sent the datagram.
+/// @param received The kernel receive time, or not_a_date_time.
+/// @pre None.
+/// @post The datagram has been processed by its connection, unless it was
+///     refused or could not be parsed.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::ProcessDatagram(const char* data, std::size_t size,
+    const boost::asio::ip::udp::endpoint& from,
+    const boost::posix_time::ptime& received)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    LOG_DEBUG(Logger)<<"Loading protobuf"<<std::endl;
+    BytesMetric.Increment(size);
+    if(!Admit(data, size))
     {
-        Logger.Error<<"Failed to load protobuf"<<std::endl;
-        ScheduleListen();
         return;
     }
+    boost::shared_ptr<ProtocolMessageWindow> pmw = AcquireWindow();
+    if(!pmw->ParseFromArray(data, size))
+    {
+        MalformedMetric.Increment();
+        LOG_ERROR_LIMITED(Logger, 1)<<"Failed to load protobuf"<<std::endl;
+        return;
+    }
+
+    ProcessWindow(pmw, from, received);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::HandleParsed
+/// @description Handles a datagram that a receive worker, or the shared
+///     memory transport, has parsed off the broker thread.
+/// @param pmw The parsed datagram.
+/// @param from The endpoint that sent the datagram.
+/// @pre Called on the broker thread.
+/// @post The datagram has been processed by its connection.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::HandleParsed(boost::shared_ptr<const ProtocolMessageWindow> pmw,
+    boost::asio::ip::udp::endpoint from)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    ProcessWindow(pmw, from, boost::posix_time::ptime());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::HandleStamped
+/// @description Handles a datagram that a receive worker has parsed off the
+///     broker thread, along with the time the kernel received it.
+/// @param pmw The parsed datagram.
+/// @param from The endpoint that sent the datagram.
+/// @param received The kernel receive time, or not_a_date_time.
+/// @pre Called on the broker thread.
+/// @post The datagram has been processed by its connection.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::HandleStamped(boost::shared_ptr<const ProtocolMessageWindow> pmw,
+    boost::asio::ip::udp::endpoint from, boost::posix_time::ptime received)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    ProcessWindow(pmw, from, received);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::ProcessWindow
+/// @description Passes the messages of a parsed datagram to the connection
+///     with the sender, on the lane named in the window header, and delivers
+///     the accepted ones to the dispatcher.
+///     The module messages that are delivered point into the window, which
+///     stays alive until the last of them has been handled. A window that
+///     was sent deflated is inflated first.
+/// @param window The parsed datagram.
+/// @param from The endpoint that sent the datagram.
+/// @param received The kernel receive time, or not_a_date_time.
+/// @pre Called on the broker thread.
+/// @post The accepted messages are scheduled for delivery by the dispatcher
+///     and the connection has written its window and acknowledgements.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::ProcessWindow(boost::shared_ptr<const ProtocolMessageWindow> window,
+    const boost::asio::ip::udp::endpoint& from,
+    const boost::posix_time::ptime& received)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(CCaptureLog::Instance().IsRecording())
+    {
+        CCaptureLog::Instance().Record(*window, from);
+    }
 
 #ifdef CUSTOMNETWORK
     if((rand()%100) >= GetReliability())
     {
-        Logger.Debug<<"Dropped datagram "<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
-        ScheduleListen();
+        LOG_INFO(Logger)<<"Incoming Packet Dropped ("<<GetReliability()
+            <<") <- "<<window->source_uuid()<<std::endl;
         return;
     }
 #endif
 
-    Logger.Debug<<"Fetching Connection"<<std::endl;
-    std::string uuid = pmw.source_uuid();
-    /// We can make the remote host from the endpoint:
-    SRemoteHost host = { m_recv_from.address().to_string(), boost::lexical_cast<std::string>(m_recv_from.port()) };
+    if(window->has_compressed())
+    {
+        window = Inflate(*window);
+        if(!window)
+        {
+            InflateMetric.Increment();
+            LOG_WARN(Logger)<<"Dropped a deflated datagram that does not inflate"
+                <<std::endl;
+            return;
+        }
+    }
+    const ProtocolMessageWindow& pmw = *window;
 
-    ///Make sure the hostname is registered:
-    CConnectionManager::Instance().PutHost(uuid,host);
+    if(pmw.lane() >= LANE_COUNT)
+    {
+        UnknownLaneMetric.Increment();
+        LOG_DEBUG(Logger)<<"Dropped datagram for unknown lane "<<pmw.lane()<<std::endl;
+        return;
+    }
+    EMessageLane lane = static_cast<EMessageLane>(pmw.lane());
+    DatagramsMetric.Increment();
 
-    ///Get the pointer to the connection:
-    ConnectionPtr conn = CConnectionManager::Instance().CreateConnection(uuid, m_recv_from);
-    //ConnectionPtr conn = CConnectionManager::Instance().GetConnectionByUUID(uuid);
-    Logger.Debug<<"Fetched Connection"<<std::endl;
+    LOG_DEBUG(Logger)<<"Fetching Connection"<<std::endl;
+    PeerId peer;
+    ///Get the pointer to the connection, registering the sender's host:
+    ConnectionPtr conn = CConnectionManager::Instance().ResolveConnection(
+        pmw.source_uuid(), from, peer);
+    LOG_DEBUG(Logger)<<"Fetched Connection"<<std::endl;
+    conn->SetPeerInflates(pmw.inflates());
+    CBroker::Instance().GetClockSynchronizer().ReadWindow(pmw, peer, received);
 
+    const bool accounting = CTrafficAccounting::IsEnabled();
+    boost::shared_ptr<const ModuleMessage> complete;
     BOOST_FOREACH(const ProtocolMessage &pm, pmw.messages())
     {
         if(pm.status() == ProtocolMessage::ACCEPTED)
         {
-            Logger.Debug<<"Processing Accept Message"<<std::endl;
-            Logger.Debug<<"Received ACK"<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
-            conn->ReceiveACK(pm);
+            LOG_DEBUG(Logger)<<"Processing Accept Message"<<std::endl;
+            LOG_DEBUG(Logger)<<"Received ACK"<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
+            conn->ReceiveACK(pm, lane);
         }
-        else if(conn->Receive(pm))
+        else if(conn->Receive(window, pm, lane, complete))
         {
-            Logger.Debug<<"Accepted message "<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
-            CDispatcher::Instance().HandleRequest(
-                boost::make_shared<const ModuleMessage>(
-                    ModuleMessage(pm.module_message())), uuid);
+            LOG_DEBUG(Logger)<<"Accepted message "<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
+            if(accounting)
+            {
+                AccountReceived(pm, pmw.source_uuid());
+            }
+            if(complete)
+            {
+                if(!received.is_not_a_date_time())
+                {
+                    complete = StampReceived(complete, received);
+                }
+                SDeliveryStamps stamps;
+                if(complete->has_trace())
+                {
+                    stamps.sent = pmw.send_usec();
+                    stamps.received = CLatencyTrace::ReceiveTime(received);
+                }
+                CDispatcher::Instance().HandleRequest(complete, peer, stamps);
+                complete.reset();
+            }
         }
         else if(pm.status() != ProtocolMessage::CREATED)
         {
-            Logger.Debug<<"Rejected message "<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
+            LOG_DEBUG(Logger)<<"Rejected message "<<pm.hash()<<":"<<pm.sequence_num()<<std::endl;
+        }
+    }
+    conn->OnReceive(lane);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::DrainSocket
+/// @description Reads the datagrams that arrived while the last one was being
+///     processed, up to one batch, without going back through the io_service.
+///     Where recvmmsg is available the whole batch is read with one system
+///     call into m_ring.
+/// @pre The socket is bound and batching is enabled.
+/// @post Up to m_batch - 1 waiting datagrams have been processed.
+/// @return The bytes of the datagrams that were read.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CListener::DrainSocket()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const std::size_t count = m_batch - 1;
+    const std::size_t slot = CGlobalConfiguration::MAX_PACKET_SIZE;
+    std::size_t bytes = 0;
+
+#ifdef HAVE_MMSG
+    std::vector<mmsghdr> hdrs(count);
+    std::vector<iovec> iovs(count);
+    std::vector<boost::asio::ip::udp::endpoint> from(count);
+    std::vector<char> control(m_control ? count * CONTROL_SIZE : 0);
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = &m_ring[i * slot];
+        iovs[i].iov_len = slot;
+        std::memset(&hdrs[i], 0, sizeof(mmsghdr));
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = from[i].data();
+        hdrs[i].msg_hdr.msg_namelen = from[i].capacity();
+        if(m_control)
+        {
+            hdrs[i].msg_hdr.msg_control = &control[i * CONTROL_SIZE];
+            hdrs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+        }
+    }
+
+    int got = recvmmsg(m_socket.native_handle(), &hdrs[0], count,
+        MSG_DONTWAIT, NULL);
+
+    for(int i = 0; i < got; i++)
+    {
+        from[i].resize(hdrs[i].msg_hdr.msg_namelen);
+        if(m_control)
+        {
+            m_tuner.ReadControl(hdrs[i].msg_hdr);
+        }
+        bytes += hdrs[i].msg_len;
+        ProcessDatagram(&m_ring[i * slot], hdrs[i].msg_len, from[i],
+            ReadStamp(hdrs[i].msg_hdr));
+    }
+#else
+    for(std::size_t i = 0; i < count && m_socket.available() > 0; i++)
+    {
+        boost::asio::ip::udp::endpoint from;
+        boost::system::error_code ec;
+        boost::posix_time::ptime received;
+        std::size_t size;
+        if(m_control)
+        {
+            size = ReceiveStamped(m_socket, m_tuner, &m_ring[0], slot, from,
+                received, ec);
+        }
+        else
+        {
+            size = m_socket.receive_from(
+                boost::asio::buffer(&m_ring[0], slot), from, 0, ec);
+        }
+        if(ec)
+        {
+            break;
+        }
+        bytes += size;
+        ProcessDatagram(&m_ring[0], size, from, received);
+    }
+#endif
+    return bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::QueueDatagram
+/// @description Queues a datagram so that every datagram written during the
+///     current handler is sent together once it returns.
+/// @param data The serialized datagram.
+/// @param size The size of the datagram.
+/// @param endpoint The destination of the datagram.
+/// @param owner The protocol to stop if the datagram cannot be sent.
+/// @pre Batching is enabled.
+/// @post The datagram is queued and a flush is posted to the io_service.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::QueueDatagram(const char* data, std::size_t size,
+    const boost::asio::ip::udp::endpoint& endpoint,
+    boost::shared_ptr<IProtocol> owner)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    PendingDatagram pending;
+    m_outgoing.push_back(pending);
+    m_outgoing.back().bytes.assign(data, size);
+    m_outgoing.back().endpoint = endpoint;
+    m_outgoing.back().owner = owner;
+
+    if(!m_flush_pending)
+    {
+        m_flush_pending = true;
+        CBroker::Instance().GetStrand().post(
+            boost::bind(&CListener::FlushDatagrams, this));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CListener::FlushDatagrams
+/// @description Sends the queued datagrams. Where sendmmsg is available they
+///     are sent in batches of m_batch per system call. A datagram the socket
+///     cannot take right away is sent on its own instead.
+/// @pre None.
+/// @post m_outgoing is empty. The protocol of each datagram that could not
+///     be sent has been stopped.
+///////////////////////////////////////////////////////////////////////////////
+void CListener::FlushDatagrams()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::vector<PendingDatagram> outgoing;
+    outgoing.swap(m_outgoing);
+    m_flush_pending = false;
+
+    std::size_t next = 0;
+#ifdef HAVE_MMSG
+    std::vector<mmsghdr> hdrs(outgoing.size());
+    std::vector<iovec> iovs(outgoing.size());
+
+    for(std::size_t i = 0; i < outgoing.size(); i++)
+    {
+        iovs[i].iov_base = &outgoing[i].bytes[0];
+        iovs[i].iov_len = outgoing[i].bytes.size();
+        std::memset(&hdrs[i], 0, sizeof(mmsghdr));
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = outgoing[i].endpoint.data();
+        hdrs[i].msg_hdr.msg_namelen = outgoing[i].endpoint.size();
+    }
+
+    while(next < outgoing.size())
+    {
+        std::size_t count = std::min(m_batch, outgoing.size() - next);
+        int sent = sendmmsg(m_socket.native_handle(), &hdrs[next], count,
+            MSG_DONTWAIT);
+        if(sent <= 0)
+        {
+            // the blocking send below handles a full socket buffer and
+            // reports the error of this datagram
+            break;
+        }
+        next += sent;
+    }
+#endif
+
+    for(; next < outgoing.size(); next++)
+    {
+        try
+        {
+            m_socket.send_to(boost::asio::buffer(outgoing[next].bytes),
+                outgoing[next].endpoint);
+        }
+        catch(boost::system::system_error &e)
+        {
+            LOG_DEBUG(Logger) << "Writing Failed: " << e.what() << std::endl;
+            SendErrorsMetric.Increment();
+            outgoing[next].owner->Stop();
         }
     }
-    conn->OnReceive();
-    ScheduleListen();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -200,15 +1044,26 @@ void CListener::HandleRead(const boost::system::error_code& e,
 ///////////////////////////////////////////////////////////////////////////////
 void CListener::ScheduleListen()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Debug<<"Listening for next message"<<std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_DEBUG(Logger)<<"Listening for next message"<<std::endl;
+    if(m_control)
+    {
+        // wait for the socket to be readable and read the stamp in HandleRead
+        m_socket.async_receive(boost::asio::null_buffers(),
+            CBroker::Instance().GetStrand().wrap(
+                boost::bind(&CListener::HandleRead, this,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred)));
+        return;
+    }
     // We don't care where the messages are coming from, but async_receive_from
     // requires that this variable remain valid until the handler is called.
     m_socket.async_receive_from(
         boost::asio::buffer(m_buffer, CGlobalConfiguration::MAX_PACKET_SIZE),
-        m_recv_from, boost::bind(&CListener::HandleRead, this,
+        m_recv_from, CBroker::Instance().GetStrand().wrap(
+            boost::bind(&CListener::HandleRead, this,
             boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+            boost::asio::placeholders::bytes_transferred)));
 }
 
     } // namespace broker
@@ -25,17 +25,25 @@
 #define CLISTENER_HPP
 
 #include "CGlobalConfiguration.hpp"
+#include "CSocketTuner.hpp"
+
+#include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 
 namespace freedm {
     namespace broker {
 
 class CBroker;
 class CConnectionManager;
+class IProtocol;
+class ProtocolMessageWindow;
 
 /// Represents a single CListener from a client.
 class CListener
@@ -53,7 +61,74 @@ public:
 
     /// Gets the listener socket
     boost::asio::ip::udp::socket& GetSocket() { return m_socket; };
+
+    /// Checks if datagrams are sent and received in batches
+    bool IsBatching() const { return m_batch > 1; }
+
+    /// Set the listener reliability for DCUSTOMNETWORK
+    void SetReliability(int r) { m_reliability = r; }
+
+    /// Get the listener reliability for DCUSTOMNETWORK
+    int GetReliability() const { return m_reliability; }
+
+    /// Queues a datagram to be sent with the next batch
+    void QueueDatagram(const char* data, std::size_t size,
+        const boost::asio::ip::udp::endpoint& endpoint,
+        boost::shared_ptr<IProtocol> owner);
+
+    /// Handles a datagram parsed by a receive worker or another transport
+    void HandleParsed(boost::shared_ptr<const ProtocolMessageWindow> pmw,
+        boost::asio::ip::udp::endpoint from);
+
+    /// Handles a parsed datagram with the time the kernel received it
+    void HandleStamped(boost::shared_ptr<const ProtocolMessageWindow> pmw,
+        boost::asio::ip::udp::endpoint from, boost::posix_time::ptime received);
 private:
+    /// A datagram waiting for the next batched send
+    struct PendingDatagram
+    {
+        /// Serialized datagram
+        std::string bytes;
+        /// Destination of the datagram
+        boost::asio::ip::udp::endpoint endpoint;
+        /// Protocol to stop if the datagram cannot be sent
+        boost::shared_ptr<IProtocol> owner;
+    };
+
+    /// A socket sharing the listening port that parses on its own thread
+    class CReceiveWorker
+        : private boost::noncopyable
+    {
+    public:
+        /// Binds the worker socket to the listening endpoint
+        explicit CReceiveWorker(const boost::asio::ip::udp::endpoint& endpoint);
+        /// Starts the worker thread
+        void Start();
+        /// Stops the worker thread and closes its socket
+        void Stop();
+    private:
+        /// Runs the worker io_service
+        void Run();
+        /// Asynchronously listen for a new message
+        void ScheduleListen();
+        /// Parses a datagram and hands it to the broker thread
+        void HandleRead(const boost::system::error_code& e, std::size_t bytes_transferred);
+        /// Service for the worker socket
+        boost::asio::io_service m_ios;
+        /// Socket bound to the listening port
+        boost::asio::ip::udp::socket m_socket;
+        /// Buffer sizes and drop counts of m_socket
+        CSocketTuner m_tuner;
+        /// Buffer for incoming data
+        boost::array<char, CGlobalConfiguration::MAX_PACKET_SIZE> m_buffer;
+        /// Endpoint for incoming message
+        boost::asio::ip::udp::endpoint m_recv_from;
+        /// Thread that runs m_ios
+        boost::thread m_thread;
+        /// True if the datagrams are read with their control messages
+        bool m_control;
+    };
+
     /// Private constructor for the singleton instance
     CListener();
 
@@ -63,14 +138,54 @@ private:
     /// Asynchronously listen for a new message
     void ScheduleListen();
 
+    /// Processes the datagrams that are already waiting on the socket
+    std::size_t DrainSocket();
+
+    /// Hands one received datagram to its connection
+    void ProcessDatagram(const char* data, std::size_t size,
+        const boost::asio::ip::udp::endpoint& from,
+        const boost::posix_time::ptime& received);
+
+    /// Sends every queued datagram
+    void FlushDatagrams();
+
+    /// Hands the messages of a parsed datagram to its connection
+    void ProcessWindow(boost::shared_ptr<const ProtocolMessageWindow> window,
+        const boost::asio::ip::udp::endpoint& from,
+        const boost::posix_time::ptime& received);
+
     /// Buffer for incoming data.
     boost::array<char, CGlobalConfiguration::MAX_PACKET_SIZE> m_buffer;
 
     /// Socket for the CConnection.
     boost::asio::ip::udp::socket m_socket;
 
+    /// Buffer sizes and drop counts of m_socket.
+    CSocketTuner m_tuner;
+
     /// Endpoint for incoming message
     boost::asio::ip::udp::endpoint m_recv_from;
+
+    /// Receive buffers for the datagrams drained after a wakeup.
+    std::vector<char> m_ring;
+
+    /// Largest number of datagrams handled per system call.
+    std::size_t m_batch;
+
+    /// Datagrams waiting to be sent at the end of the current handler.
+    std::vector<PendingDatagram> m_outgoing;
+
+    /// Set while a flush of m_outgoing is posted.
+    bool m_flush_pending;
+
+    /// True if the datagrams are read with their control messages.
+    bool m_control;
+
+    /// The reliability of incoming datagrams (FOR -DCUSTOMNETWORK)
+    int m_reliability;
+
+    /// Additional sockets that receive and parse on their own threads.
+    std::vector<boost::shared_ptr<CReceiveWorker> > m_workers;
 };
 
 
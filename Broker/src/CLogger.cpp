@@ -24,9 +24,19 @@
 #include "CLogger.hpp"
 #include "CGlobalConfiguration.hpp"
 
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/c_local_time_adjustor.hpp>
 #include <boost/program_options/options_description.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 using namespace boost::posix_time;
 
@@ -42,6 +52,360 @@ CLocalLogger Logger(__FILE__);
 /// Only one logger can write at a time.
 boost::mutex mutex;
 
+/// Bytes of log messages each thread can queue, a power of two
+const std::size_t RING_SIZE = 65536;
+
+/// Milliseconds the log writer waits when no messages are queued
+const unsigned int WRITER_SLEEP = 10;
+
+/// The universal time the log time stamps count from
+const ptime EPOCH(boost::gregorian::date(1970,1,1));
+
+/// The header of a message queued for the log writer
+struct SLogRecord
+{
+    /// The log the message was written to
+    const CLog* log;
+    /// Universal time of the message in microseconds since EPOCH
+    boost::int64_t stamp;
+    /// Number of characters of the message that follow the header
+    std::size_t size;
+};
+
+/// A message taken from a ring by the log writer
+typedef std::pair<SLogRecord, std::string> LogEntry;
+
+/// Orders messages by the time they were logged
+bool EarlierEntry(const LogEntry& a, const LogEntry& b)
+{
+    return a.first.stamp < b.first.stamp;
+}
+
+/// A queue of log messages written by one thread and read by the log writer
+class CLogRing : private boost::noncopyable
+{
+    ///////////////////////////////////////////////////////////////////////////
+    /// @description A single-producer, single-consumer ring of bytes. Each
+    ///     message is stored as its SLogRecord followed by its characters.
+    ///     Only the producer moves the head and only the consumer moves the
+    ///     tail, so neither side takes a lock.
+    ///
+    /// @limitations Messages that do not fit in the free space are dropped.
+    ///////////////////////////////////////////////////////////////////////////
+    public:
+        /// Creates an empty ring.
+        CLogRing() : m_buffer(RING_SIZE), m_head(0), m_tail(0), m_dropped(0) {}
+        /// Queues a message, called by the thread that owns the ring.
+        bool Push(const SLogRecord& record, const char* const s);
+        /// Takes the oldest message, called by the log writer.
+        bool Pop(SLogRecord& record, std::string& text);
+        /// Gets the number of messages dropped because the ring was full.
+        unsigned int GetDropped() const { return m_dropped; }
+    private:
+        /// Copies into the ring starting at a position, wrapping at the end.
+        void CopyIn(std::size_t pos, const void* from, std::size_t n);
+        /// Copies out of the ring starting at a position, wrapping at the end.
+        void CopyOut(std::size_t pos, void* to, std::size_t n) const;
+        /// The queued bytes.
+        std::vector<char> m_buffer;
+        /// Total bytes ever queued.
+        volatile std::size_t m_head;
+        /// Total bytes ever taken.
+        volatile std::size_t m_tail;
+        /// Number of dropped messages.
+        volatile unsigned int m_dropped;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLogRing::Push
+/// @description Queues a message behind the ones already in the ring.
+/// @pre Called only by the thread that owns the ring.
+/// @post The message is visible to the log writer, or counted as dropped.
+/// @param record the header of the message.
+/// @param s the record.size characters of the message.
+/// @return False if the ring did not have room for the message.
+///////////////////////////////////////////////////////////////////////////////
+bool CLogRing::Push(const SLogRecord& record, const char* const s)
+{
+    std::size_t head = m_head;
+    std::size_t need = sizeof(record) + record.size;
+    if(need > RING_SIZE - (head - m_tail))
+    {
+        m_dropped++;
+        return false;
+    }
+    CopyIn(head, &record, sizeof(record));
+    CopyIn(head + sizeof(record), s, record.size);
+    // The message must be complete before the writer can see the new head.
+    __sync_synchronize();
+    m_head = head + need;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLogRing::Pop
+/// @description Takes the oldest message out of the ring.
+/// @pre Called only by the log writer.
+/// @post The space of the message can be reused by the producer.
+/// @param record set to the header of the message.
+/// @param text set to the characters of the message.
+/// @return False if the ring was empty.
+///////////////////////////////////////////////////////////////////////////////
+bool CLogRing::Pop(SLogRecord& record, std::string& text)
+{
+    std::size_t tail = m_tail;
+    if(tail == m_head)
+    {
+        return false;
+    }
+    __sync_synchronize();
+    CopyOut(tail, &record, sizeof(record));
+    text.resize(record.size);
+    if(record.size > 0)
+    {
+        CopyOut(tail + sizeof(record), &text[0], record.size);
+    }
+    // The message must be read before the producer can overwrite it.
+    __sync_synchronize();
+    m_tail = tail + sizeof(record) + record.size;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLogRing::CopyIn
+/// @description Copies bytes into the ring, wrapping around at its end.
+/// @pre There are n free bytes at pos.
+/// @post The bytes are stored.
+/// @param pos the total byte count the copy starts at.
+/// @param from the bytes to copy.
+/// @param n the number of bytes.
+///////////////////////////////////////////////////////////////////////////////
+void CLogRing::CopyIn(std::size_t pos, const void* from, std::size_t n)
+{
+    pos &= RING_SIZE - 1;
+    std::size_t first = std::min(n, RING_SIZE - pos);
+    std::memcpy(&m_buffer[pos], from, first);
+    std::memcpy(&m_buffer[0], static_cast<const char*>(from) + first, n - first);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLogRing::CopyOut
+/// @description Copies bytes out of the ring, wrapping around at its end.
+/// @pre There are n queued bytes at pos.
+/// @post None
+/// @param pos the total byte count the copy starts at.
+/// @param to where to copy the bytes.
+/// @param n the number of bytes.
+///////////////////////////////////////////////////////////////////////////////
+void CLogRing::CopyOut(std::size_t pos, void* to, std::size_t n) const
+{
+    pos &= RING_SIZE - 1;
+    std::size_t first = std::min(n, RING_SIZE - pos);
+    std::memcpy(to, &m_buffer[pos], first);
+    std::memcpy(static_cast<char*>(to) + first, &m_buffer[0], n - first);
+}
+
+/// Does not delete the ring of an exiting thread; the log writer owns it.
+void KeepRing(CLogRing* /*ring*/)
+{
+    // pass
+}
+
+/// Formats and writes the logs of every thread on a background thread
+class CAsyncLog : private boost::noncopyable
+{
+    ///////////////////////////////////////////////////////////////////////////
+    /// @description Each thread that logs is given its own CLogRing the
+    ///     first time it logs. The writer thread empties all the rings in
+    ///     batches, orders each batch by time stamp, and writes it out.
+    ///
+    /// @limitations Singleton. The rings are kept until the program exits.
+    ///////////////////////////////////////////////////////////////////////////
+    public:
+        /// Gets the singleton instance.
+        static CAsyncLog& Instance();
+        /// Starts the writer thread.
+        void Start();
+        /// Writes out the queued messages and stops the writer thread.
+        void Stop();
+        /// True while messages are queued for the writer thread.
+        bool IsRunning() const { return m_running; }
+        /// Queues a message of the calling thread.
+        void Push(const CLog* log, const char* const s, std::streamsize n);
+    private:
+        /// Creates the writer with no rings.
+        CAsyncLog() : m_ring(&KeepRing), m_running(false), m_stopping(false),
+            m_reported(0) {}
+        /// The body of the writer thread.
+        void Run();
+        /// Writes out every queued message, returns false if there were none.
+        bool Drain();
+        /// The ring of each thread.
+        boost::thread_specific_ptr<CLogRing> m_ring;
+        /// Every ring given out.
+        std::vector< boost::shared_ptr<CLogRing> > m_rings;
+        /// Lock for m_rings
+        boost::mutex m_ringmutex;
+        /// The writer thread.
+        boost::shared_ptr<boost::thread> m_thread;
+        /// Set while messages are queued.
+        volatile bool m_running;
+        /// Set when the writer thread should exit.
+        volatile bool m_stopping;
+        /// The number of dropped messages already reported.
+        unsigned int m_reported;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// CAsyncLog::Instance
+/// @description Gets the log writer.
+/// @pre None
+/// @post None
+/// @return The singleton instance.
+///////////////////////////////////////////////////////////////////////////////
+CAsyncLog& CAsyncLog::Instance()
+{
+    static CAsyncLog writer;
+    return writer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CAsyncLog::Start
+/// @description Starts the writer thread; from then on the logs only copy
+///     their messages into the ring of the calling thread.
+/// @pre None
+/// @post The writer thread is running.
+///////////////////////////////////////////////////////////////////////////////
+void CAsyncLog::Start()
+{
+    if(m_thread)
+    {
+        return;
+    }
+    m_stopping = false;
+    m_thread.reset(new boost::thread(boost::bind(&CAsyncLog::Run, this)));
+    __sync_synchronize();
+    m_running = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CAsyncLog::Stop
+/// @description Switches the logs back to writing on the calling thread,
+///     then lets the writer thread write out what is queued and exit.
+/// @pre None
+/// @post The writer thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+void CAsyncLog::Stop()
+{
+    if(!m_thread)
+    {
+        return;
+    }
+    m_running = false;
+    __sync_synchronize();
+    m_stopping = true;
+    m_thread->join();
+    m_thread.reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CAsyncLog::Push
+/// @description Queues a message to be written by the writer thread. The
+///     time is taken here, the formatting is left to the writer.
+/// @pre None
+/// @post The message is queued, or dropped if the ring of the calling thread
+///     is full.
+/// @param log the log the message was written to.
+/// @param s the characters of the message.
+/// @param n the number of characters.
+///////////////////////////////////////////////////////////////////////////////
+void CAsyncLog::Push(const CLog* log, const char* const s, std::streamsize n)
+{
+    CLogRing* ring = m_ring.get();
+    if(ring == 0)
+    {
+        boost::shared_ptr<CLogRing> owned(new CLogRing);
+        {
+            boost::lock_guard<boost::mutex> lock(m_ringmutex);
+            m_rings.push_back(owned);
+        }
+        ring = owned.get();
+        m_ring.reset(ring);
+    }
+    SLogRecord record;
+    record.log = log;
+    record.stamp = (microsec_clock::universal_time() - EPOCH).total_microseconds();
+    record.size = n;
+    ring->Push(record, s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CAsyncLog::Run
+/// @description Writes out the queued messages until the writer is stopped.
+/// @pre None
+/// @post Every message queued before Stop was called has been written.
+///////////////////////////////////////////////////////////////////////////////
+void CAsyncLog::Run()
+{
+    while(!m_stopping)
+    {
+        if(!Drain())
+        {
+            boost::this_thread::sleep(milliseconds(WRITER_SLEEP));
+        }
+    }
+    while(Drain())
+    {
+        // pass
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CAsyncLog::Drain
+/// @description Takes a batch of messages from every ring and writes them in
+///     the order they were logged. Reports how many messages were dropped
+///     since the last batch.
+/// @pre Called by the writer thread.
+/// @post The batch is written to the streams of the logs.
+/// @return False if there were no messages.
+///////////////////////////////////////////////////////////////////////////////
+bool CAsyncLog::Drain()
+{
+    std::vector< boost::shared_ptr<CLogRing> > rings;
+    {
+        boost::lock_guard<boost::mutex> lock(m_ringmutex);
+        rings = m_rings;
+    }
+
+    std::vector<LogEntry> batch;
+    unsigned int dropped = 0;
+    for(std::size_t i = 0; i < rings.size(); i++)
+    {
+        LogEntry entry;
+        while(rings[i]->Pop(entry.first, entry.second))
+        {
+            batch.push_back(entry);
+        }
+        dropped += rings[i]->GetDropped();
+    }
+
+    std::stable_sort(batch.begin(), batch.end(), EarlierEntry);
+    for(std::size_t i = 0; i < batch.size(); i++)
+    {
+        batch[i].first.log->Print(EPOCH + microseconds(batch[i].first.stamp),
+            batch[i].second.data(), batch[i].second.size());
+    }
+
+    if(dropped != m_reported)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::clog << "Logger dropped " << (dropped - m_reported)
+                << " messages, the log queue was full" << std::endl;
+        m_reported = dropped;
+    }
+    return !batch.empty();
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -94,13 +458,37 @@ std::streamsize CLog::write(const char* const s, std::streamsize n)
 {
     if (GetOutputLevel() >= m_level)
     {
-        boost::lock_guard<boost::mutex> lock(mutex);
-        *m_ostream << microsec_clock::local_time() + CGlobalConfiguration::Instance().GetClockSkew() << " : "
-                << m_name << "(" << m_level << "):\n\t";
-        boost::iostreams::write(*m_ostream, s, n);
+        if (CAsyncLog::Instance().IsRunning())
+        {
+            CAsyncLog::Instance().Push(this, s, n);
+        }
+        else
+        {
+            Print(microsec_clock::universal_time(), s, n);
+        }
     }
     return n;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+/// CLog::Print
+/// @description Writes a message to the log's stream with the local time it
+///     was logged at and information about the log.
+/// @param stamp the universal time the message was logged at.
+/// @param s An array of characters to write to the log's stream.
+/// @param n The size of the array that will be written
+/// @pre None
+/// @post The message is written to the log's stream.
+///////////////////////////////////////////////////////////////////////////////
+void CLog::Print(const ptime& stamp, const char* const s, std::streamsize n) const
+{
+    typedef boost::date_time::c_local_adjustor<ptime> LocalAdjustor;
+    ptime local = LocalAdjustor::utc_to_local(stamp);
+    boost::lock_guard<boost::mutex> lock(mutex);
+    *m_ostream << local + CGlobalConfiguration::Instance().GetClockSkew() << " : "
+            << m_name << "(" << m_level << "):\n\t";
+    boost::iostreams::write(*m_ostream, s, n);
+}
 ///////////////////////////////////////////////////////////////////////////////
 /// CLog::GetOutputLevel
 /// @description Get's the output level (which messages to show) from the
@@ -172,6 +560,64 @@ void CLocalLogger::SetOutputLevel(const unsigned int level)
 {
     CGlobalLogger::instance().SetOutputLevel(m_name, level);
 }
+///////////////////////////////////////////////////////////////////////////////
+/// CLocalLogger::Admit
+/// @description Decides whether a rate limited statement is written. Each
+///     call site has a bucket of up to rate tokens that fills at rate tokens
+///     a second, and a statement is written only if it can take a token.
+///     When a statement is written after others were dropped, a line that
+///     counts them is written to the log first.
+/// @pre None
+/// @post The bucket of the call site is filled and maybe loses a token.
+/// @param log The log the statement is written to.
+/// @param line The line of the call site in the file of this logger.
+/// @param rate The average statements a second the call site may write.
+/// @return True if the statement should be written.
+///////////////////////////////////////////////////////////////////////////////
+bool CLocalLogger::Admit(std::ostream& log, const unsigned int line,
+        const double rate)
+{
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    double burst = std::max(rate, 1.0);
+    unsigned int suppressed;
+
+    {
+        boost::mutex::scoped_lock lock(m_bucketMutex);
+        std::map<unsigned int, SBucket>::iterator it = m_buckets.find(line);
+        if(it == m_buckets.end())
+        {
+            SBucket bucket;
+            bucket.tokens = burst;
+            bucket.filled = now;
+            bucket.suppressed = 0;
+            it = m_buckets.insert(std::make_pair(line, bucket)).first;
+        }
+
+        SBucket& bucket = it->second;
+        if(now > bucket.filled)
+        {
+            bucket.tokens = std::min(burst, bucket.tokens
+                + (now - bucket.filled).total_microseconds() * rate / 1e6);
+            bucket.filled = now;
+        }
+        if(bucket.tokens < 1.0)
+        {
+            bucket.suppressed++;
+            return false;
+        }
+        bucket.tokens -= 1.0;
+        suppressed = bucket.suppressed;
+        bucket.suppressed = 0;
+    }
+
+    if(suppressed > 0)
+    {
+        log << "Suppressed " << suppressed << " messages from line " << line
+            << std::endl;
+    }
+    return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CGlobalLogger::instance
 /// @description Gets the global logger which stores the configuration info
@@ -238,7 +684,7 @@ void CGlobalLogger::SetOutputLevel(const std::string logger,
 /// @param logger the name of the logger to fetch the output level for.
 /// @return The output level of the logger.
 ///////////////////////////////////////////////////////////////////////////////
-unsigned int CGlobalLogger::GetOutputLevel(const std::string logger) const
+unsigned int CGlobalLogger::GetOutputLevel(const std::string& logger) const
 {
     OutputMap::const_iterator it = m_loggers.find(logger);
     if (it == m_loggers.end())
@@ -279,7 +725,7 @@ void CGlobalLogger::SetInitialLoggerLevels(const std::string loggerCfgFile)
     ifs.open(loggerCfgFile.c_str());
     if (!ifs)
     {
-        Logger.Warn << "Unable to load logger config file: "
+        LOG_WARN(Logger) << "Unable to load logger config file: "
                 << loggerCfgFile << std::endl;
         return;
     }
@@ -296,7 +742,7 @@ void CGlobalLogger::SetInitialLoggerLevels(const std::string loggerCfgFile)
                     + e.get_option_name() + "' in " + loggerCfgFile );
         }
         po::notify(vm);
-        Logger.Info << "Logger config file " << loggerCfgFile <<
+        LOG_INFO(Logger) << "Logger config file " << loggerCfgFile <<
                 " successfully loaded." << std::endl;
     }
     ifs.close();
@@ -325,6 +771,30 @@ void CGlobalLogger::ListLoggers() const
         std::cout << ( *it ).first << "=" << ( *it ).second << std::endl;
     }
 }
+///////////////////////////////////////////////////////////////////////////////
+/// CGlobalLogger::StartAsync
+/// @description Starts a background thread that formats, time stamps and
+///     writes the log messages. Logging then only copies the message into a
+///     queue of the calling thread. Messages logged while that queue is full
+///     are dropped and counted.
+/// @pre None
+/// @post The logs are written by the background thread.
+///////////////////////////////////////////////////////////////////////////////
+void CGlobalLogger::StartAsync()
+{
+    CAsyncLog::Instance().Start();
+}
+///////////////////////////////////////////////////////////////////////////////
+/// CGlobalLogger::StopAsync
+/// @description Writes out the queued log messages and stops the background
+///     thread started by StartAsync.
+/// @pre None
+/// @post The logs are written by the thread that logs them.
+///////////////////////////////////////////////////////////////////////////////
+void CGlobalLogger::StopAsync()
+{
+    CAsyncLog::Instance().Stop();
+}
 
 } // namespace broker
 
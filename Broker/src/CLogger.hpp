@@ -24,8 +24,11 @@
 #ifndef CLOGGER_HPP
 #define CLOGGER_HPP
 
+#include "config.hpp"
+
 #include <cstdlib>
 #include <fstream>
+#include <map>
 #include <string>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -35,6 +38,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/program_options.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace po = boost::program_options;
 
@@ -45,6 +49,44 @@ namespace po = boost::program_options;
 std::string(" line ") + boost::lexical_cast<std::string>(__LINE__) ).c_str()
 #endif
 
+// The most verbose log level built into the DGI. Statements for the levels
+// above it are compiled out.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 8
+#endif
+
+// Write to one log of a local logger. The rest of the statement is only
+// evaluated when the level is compiled in and enabled, so a disabled
+// statement does not format its arguments:
+//     LOG_DEBUG(Logger) << "Sending " << msg.DebugString() << std::endl;
+#define FREEDM_LOG(logger, level, log) \
+    if (!(logger).IsEnabled(level)) {} else (logger).log
+#define LOG_TRACE(logger) FREEDM_LOG(logger, 8, Trace)
+#define LOG_DEBUG(logger) FREEDM_LOG(logger, 7, Debug)
+#define LOG_INFO(logger) FREEDM_LOG(logger, 6, Info)
+#define LOG_NOTICE(logger) FREEDM_LOG(logger, 5, Notice)
+#define LOG_STATUS(logger) FREEDM_LOG(logger, 4, Status)
+#define LOG_WARN(logger) FREEDM_LOG(logger, 3, Warn)
+#define LOG_ERROR(logger) FREEDM_LOG(logger, 2, Error)
+#define LOG_ALERT(logger) FREEDM_LOG(logger, 1, Alert)
+#define LOG_FATAL(logger) FREEDM_LOG(logger, 0, Fatal)
+
+// Write to one log of a local logger at most rate times a second on average
+// from this call site, with bursts of up to rate statements. The first
+// statement let through after some were dropped is preceded by a line that
+// counts them:
+//     LOG_WARN_LIMITED(Logger, 1) << "Dropped " << msg << std::endl;
+#define FREEDM_LOG_LIMITED(logger, level, log, rate) \
+    if (!(logger).IsEnabled(level) \
+        || !(logger).Admit((logger).log, __LINE__, rate)) {} else (logger).log
+#define LOG_DEBUG_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 7, Debug, rate)
+#define LOG_INFO_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 6, Info, rate)
+#define LOG_NOTICE_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 5, Notice, rate)
+#define LOG_STATUS_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 4, Status, rate)
+#define LOG_WARN_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 3, Warn, rate)
+#define LOG_ERROR_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 2, Error, rate)
+#define LOG_ALERT_LIMITED(logger, rate) FREEDM_LOG_LIMITED(logger, 1, Alert, rate)
+
 namespace freedm {
 namespace broker {
 
@@ -74,13 +116,17 @@ class CGlobalLogger : private boost::noncopyable
         /// Sets the logging level of a specific logger.
         void SetOutputLevel(const std::string logger, const unsigned int level);
         /// Fetch the logging level of a specific logger.
-        unsigned int GetOutputLevel(const std::string logger) const;
+        unsigned int GetOutputLevel(const std::string& logger) const;
         /// Sets the logging level of all loggers.
         void SetGlobalLevel(const unsigned int level);
         /// Reads the logging levels of all loggers from the config file.
         void SetInitialLoggerLevels(const std::string loggerCfgFile);
         /// Lists all the avaible loggers and their current levels
         void ListLoggers() const;
+        /// Moves the formatting and writing of logs to a background thread.
+        void StartAsync();
+        /// Writes out the queued logs and stops the background thread.
+        void StopAsync();
     private:
         /// What the output level is if not set specifically.
         unsigned int m_default;
@@ -105,6 +151,9 @@ class CLog : public boost::iostreams::sink
                 const std::string name_, std::ostream* const out_= &std::clog );
         /// Writes from a character array into the logger stream
         std::streamsize write( const char* const s, std::streamsize n);
+        /// Writes a message logged at the given universal time to the stream
+        void Print( const boost::posix_time::ptime& stamp, const char* const s,
+                std::streamsize n ) const;
         /// Determine the level of this logger
         unsigned int GetOutputLevel() const;
     private:
@@ -156,10 +205,29 @@ class CLocalLogger : private boost::noncopyable
         unsigned int GetOutputLevel() const;
         /// Sets the output level for this set of loggers.
         void SetOutputLevel(const unsigned int level);
+        /// Checks if the log of a level is compiled in and enabled.
+        bool IsEnabled(const unsigned int level) const
+            { return level <= LOG_COMPILE_LEVEL && GetOutputLevel() >= level; }
+        /// Takes a token from the bucket of a call site, true if it had one.
+        bool Admit(std::ostream& log, const unsigned int line, const double rate);
 
     private:
+        /// The token bucket of one rate limited call site
+        struct SBucket
+        {
+            /// Statements that may still be written at once
+            double tokens;
+            /// When the bucket was last filled
+            boost::posix_time::ptime filled;
+            /// Statements dropped since the last one written
+            unsigned int suppressed;
+        };
         /// The name of this logger
         const std::string m_name;
+        /// The buckets of the rate limited call sites by line
+        std::map<unsigned int, SBucket> m_buckets;
+        /// Guards m_buckets
+        boost::mutex m_bucketMutex;
 };
 
 } // namespace broker
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CMessagePool.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Pool of protocol buffer messages that are reused
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CMESSAGEPOOL_HPP
+#define CMESSAGEPOOL_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Hands out protocol buffer messages that return to the pool when released
+////////////////////////////////////////////////////////////////////////////////
+/// A cleared protocol buffer message keeps the memory of its strings and of
+/// the elements of its repeated fields, so parsing into a message that has
+/// been used before allocates only where the new contents are larger. The
+/// pool keeps up to its capacity of released messages for the next Acquire;
+/// messages released past that are deleted. Acquire and release may be called
+/// from any thread, and a message may outlive the pool.
+////////////////////////////////////////////////////////////////////////////////
+template <typename MessageType>
+class CMessagePool
+    : private boost::noncopyable
+{
+public:
+    /// Creates a pool that keeps at most capacity idle messages
+    explicit CMessagePool(std::size_t capacity)
+        : m_state(boost::make_shared<SState>(capacity)) { }
+
+    /// Gets an empty message, which returns to the pool when it is released
+    boost::shared_ptr<MessageType> Acquire()
+    {
+        MessageType* msg = 0;
+        {
+            boost::mutex::scoped_lock lock(m_state->mutex);
+            if(!m_state->idle.empty())
+            {
+                msg = m_state->idle.back();
+                m_state->idle.pop_back();
+            }
+        }
+        if(msg == 0)
+        {
+            msg = new MessageType();
+        }
+        return boost::shared_ptr<MessageType>(msg, SRecycler(m_state));
+    }
+
+private:
+    /// The idle messages, shared with the messages that are handed out
+    struct SState
+        : private boost::noncopyable
+    {
+        /// Creates an empty pool
+        explicit SState(std::size_t n) : capacity(n) { idle.reserve(n); }
+
+        /// Deletes the idle messages
+        ~SState()
+        {
+            for(std::size_t i = 0; i < idle.size(); i++)
+            {
+                delete idle[i];
+            }
+        }
+
+        /// Lock for idle
+        boost::mutex mutex;
+        /// Cleared messages waiting to be handed out again
+        std::vector<MessageType*> idle;
+        /// The most idle messages that are kept
+        std::size_t capacity;
+    };
+
+    /// Deleter that clears a released message and returns it to the pool
+    struct SRecycler
+    {
+        /// Creates a deleter for the pool with the given state
+        explicit SRecycler(boost::shared_ptr<SState> s) : state(s) { }
+
+        /// Returns the message to the pool, or deletes it if the pool is full
+        void operator()(MessageType* msg) const
+        {
+            msg->Clear();
+            {
+                boost::mutex::scoped_lock lock(state->mutex);
+                if(state->idle.size() < state->capacity)
+                {
+                    state->idle.push_back(msg);
+                    return;
+                }
+            }
+            delete msg;
+        }
+
+        /// The pool the message belongs to
+        boost::shared_ptr<SState> state;
+    };
+
+    /// The idle messages
+    boost::shared_ptr<SState> m_state;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CMESSAGEPOOL_HPP
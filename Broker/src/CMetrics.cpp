@@ -0,0 +1,663 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CMetrics.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Runtime metrics registry served in the Prometheus format
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CMetrics.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CProfiler.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Upper bounds in seconds of the buckets of a duration histogram
+const double DURATION_BOUNDS[] = { 0.00001, 0.00005, 0.0001, 0.0005, 0.001,
+    0.005, 0.01, 0.05, 0.1, 0.5, 1, 5 };
+
+/// Largest request the endpoint reads before it answers
+const std::size_t MAX_REQUEST_SIZE = 4096;
+
+/// Converts the bits of a double to an integer that can be swapped atomically
+boost::uint64_t ToBits(double value)
+{
+    boost::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/// Converts the bits stored by ToBits back to a double
+double FromBits(boost::uint64_t bits)
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/// Writes a sample line with its labels, and an extra label if one is given
+void WriteSample(std::ostream& out, const std::string& name,
+    const std::string& labels, const std::string& extra)
+{
+    out << name;
+    if(!labels.empty() || !extra.empty())
+    {
+        out << "{" << labels;
+        if(!labels.empty() && !extra.empty())
+        {
+            out << ",";
+        }
+        out << extra << "}";
+    }
+    out << " ";
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CCounter::Format
+/// @description Writes the count as one sample.
+/// @pre None
+/// @post The sample is written to out.
+/// @param out the stream to write to.
+/// @param name the name of the metric.
+/// @param labels the formatted labels of the metric.
+///////////////////////////////////////////////////////////////////////////////
+void CCounter::Format(std::ostream& out, const std::string& name,
+    const std::string& labels) const
+{
+    WriteSample(out, name, labels, "");
+    out << GetValue() << "\n";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGauge::Set
+/// @description Replaces the value of the gauge with a compare and swap, so
+///     that a concurrent Add is never lost.
+/// @pre None
+/// @post The gauge holds value.
+/// @param value the new value.
+///////////////////////////////////////////////////////////////////////////////
+void CGauge::Set(boost::int64_t value)
+{
+    boost::int64_t old = m_value;
+    while(!__sync_bool_compare_and_swap(&m_value, old, value))
+    {
+        old = m_value;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGauge::Raise
+/// @description Replaces the value of the gauge if the new value is higher,
+///     with a compare and swap so that concurrent raises keep the highest.
+/// @pre None
+/// @post The gauge holds at least value.
+/// @param value the value to raise the gauge to.
+///////////////////////////////////////////////////////////////////////////////
+void CGauge::Raise(boost::int64_t value)
+{
+    boost::int64_t old = m_value;
+    while(old < value && !__sync_bool_compare_and_swap(&m_value, old, value))
+    {
+        old = m_value;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGauge::Format
+/// @description Writes the value as one sample.
+/// @pre None
+/// @post The sample is written to out.
+/// @param out the stream to write to.
+/// @param name the name of the metric.
+/// @param labels the formatted labels of the metric.
+///////////////////////////////////////////////////////////////////////////////
+void CGauge::Format(std::ostream& out, const std::string& name,
+    const std::string& labels) const
+{
+    WriteSample(out, name, labels, "");
+    out << GetValue() << "\n";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CHistogram::CHistogram
+/// @description Creates an empty histogram. There is one bucket for each
+///     bound and one more for the observations above the last bound.
+/// @pre bounds is increasing.
+/// @post Every bucket is empty.
+/// @param bounds the upper bounds of the buckets.
+///////////////////////////////////////////////////////////////////////////////
+CHistogram::CHistogram(const std::vector<double>& bounds)
+    : m_bounds(bounds)
+    , m_counts(bounds.size() + 1, 0)
+    , m_sum(ToBits(0))
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CHistogram::Observe
+/// @description Counts a value in the first bucket whose bound holds it and
+///     adds it to the sum. The sum is replaced with a compare and swap of its
+///     bits, so observing takes no lock.
+/// @pre None
+/// @post The value is counted once.
+/// @param value the observation.
+///////////////////////////////////////////////////////////////////////////////
+void CHistogram::Observe(double value)
+{
+    std::size_t bucket = 0;
+    while(bucket < m_bounds.size() && value > m_bounds[bucket])
+    {
+        bucket++;
+    }
+    __sync_fetch_and_add(&m_counts[bucket], 1);
+
+    boost::uint64_t old = m_sum;
+    while(!__sync_bool_compare_and_swap(&m_sum, old,
+        ToBits(FromBits(old) + value)))
+    {
+        old = m_sum;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CHistogram::Format
+/// @description Writes the cumulative count of each bucket, then the sum and
+///     the count of the observations. Observations made while the histogram
+///     is written may show up in some lines and not others.
+/// @pre None
+/// @post The samples are written to out.
+/// @param out the stream to write to.
+/// @param name the name of the metric.
+/// @param labels the formatted labels of the metric.
+///////////////////////////////////////////////////////////////////////////////
+void CHistogram::Format(std::ostream& out, const std::string& name,
+    const std::string& labels) const
+{
+    boost::uint64_t total = 0;
+    for(std::size_t i = 0; i < m_counts.size(); i++)
+    {
+        std::ostringstream bound;
+        if(i < m_bounds.size())
+        {
+            bound << "le=\"" << m_bounds[i] << "\"";
+        }
+        else
+        {
+            bound << "le=\"+Inf\"";
+        }
+        total += *const_cast<volatile const boost::uint64_t*>(&m_counts[i]);
+        WriteSample(out, name + "_bucket", labels, bound.str());
+        out << total << "\n";
+    }
+    WriteSample(out, name + "_sum", labels, "");
+    out << FromBits(m_sum) << "\n";
+    WriteSample(out, name + "_count", labels, "");
+    out << total << "\n";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSizeTracker::CSizeTracker
+/// @description Looks up the gauges of a container.
+/// @pre None
+/// @post The tracker reports no elements until it is updated.
+/// @param module the module that owns the container, such as sc.
+/// @param container the name of the container within the module.
+///////////////////////////////////////////////////////////////////////////////
+CSizeTracker::CSizeTracker(const std::string& module, const std::string& container)
+    : m_items(CMetrics::Instance().GetGauge("dgi_container_items",
+        "Elements held by the container", CMetrics::Label("module", module)
+        + "," + CMetrics::Label("container", container)))
+    , m_bytes(CMetrics::Instance().GetGauge("dgi_container_bytes",
+        "Estimated bytes held by the container", CMetrics::Label("module",
+        module) + "," + CMetrics::Label("container", container)))
+    , m_peak(CMetrics::Instance().GetGauge("dgi_container_peak_bytes",
+        "Most estimated bytes the container has held at once",
+        CMetrics::Label("module", module) + "," +
+        CMetrics::Label("container", container)))
+    , m_lastitems(0)
+    , m_lastbytes(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSizeTracker::~CSizeTracker
+/// @description Takes what the tracker reported out of the totals, since its
+///     container is going away with it. The peak is kept.
+/// @pre None
+/// @post The gauges no longer include this tracker.
+///////////////////////////////////////////////////////////////////////////////
+CSizeTracker::~CSizeTracker()
+{
+    m_items.Add(-m_lastitems);
+    m_bytes.Add(-m_lastbytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSizeTracker::Update
+/// @description Moves the totals by the change since the last update and
+///     raises the peak if the bytes reached a new high.
+/// @pre Not called by two threads at once for the same tracker.
+/// @post The gauges include the given size in place of the last one.
+/// @param items the number of elements in the container.
+/// @param bytes the estimated bytes the container holds.
+///////////////////////////////////////////////////////////////////////////////
+void CSizeTracker::Update(std::size_t items, std::size_t bytes)
+{
+    boost::int64_t nitems = static_cast<boost::int64_t>(items);
+    boost::int64_t nbytes = static_cast<boost::int64_t>(bytes);
+    if(nitems != m_lastitems)
+    {
+        m_items.Add(nitems - m_lastitems);
+        m_lastitems = nitems;
+    }
+    if(nbytes != m_lastbytes)
+    {
+        m_bytes.Add(nbytes - m_lastbytes);
+        m_lastbytes = nbytes;
+        m_peak.Raise(m_bytes.GetValue());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::Instance
+/// @description Access the singleton instance of the metrics registry
+/// @pre None
+/// @post None
+/// @return A reference to the metrics registry.
+///////////////////////////////////////////////////////////////////////////////
+CMetrics& CMetrics::Instance()
+{
+    static CMetrics metrics;
+    return metrics;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::CMetrics
+/// @description Creates an empty registry with its endpoint closed.
+/// @pre None
+/// @post No metrics are registered.
+///////////////////////////////////////////////////////////////////////////////
+CMetrics::CMetrics()
+    : m_acceptor(m_service)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::~CMetrics
+/// @description Stops the endpoint if it is still running. Nothing is logged
+///     since the loggers may already be gone.
+/// @pre None
+/// @post The endpoint thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+CMetrics::~CMetrics()
+{
+    m_service.stop();
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::GetFamily
+/// @description Finds the family of a name, creating it on first use.
+/// @pre m_mutex is held.
+/// @post The family exists.
+/// @ErrorHandling Throws std::logic_error if the name was registered with
+///     another type.
+/// @param name the name of the metrics.
+/// @param type the Prometheus type of the metrics.
+/// @param help the description of the metrics.
+/// @return The family of the name.
+///////////////////////////////////////////////////////////////////////////////
+CMetrics::SFamily& CMetrics::GetFamily(const std::string& name,
+    const std::string& type, const std::string& help)
+{
+    std::map<std::string, SFamily>::iterator it = m_families.find(name);
+    if(it == m_families.end())
+    {
+        SFamily family;
+        family.type = type;
+        family.help = help;
+        it = m_families.insert(std::make_pair(name, family)).first;
+    }
+    else if(it->second.type != type)
+    {
+        throw std::logic_error("Metric " + name + " is a " + it->second.type
+            + ", not a " + type);
+    }
+    return it->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::GetCounter
+/// @description Gets the counter of a name and labels, registering it at
+///     zero the first time.
+/// @pre None
+/// @post The counter is registered.
+/// @param name the name of the counter, which should end in _total.
+/// @param help the description of the counter.
+/// @param labels the labels of the counter, formatted with Label.
+/// @return The counter, valid for the life of the process.
+///////////////////////////////////////////////////////////////////////////////
+CCounter& CMetrics::GetCounter(const std::string& name,
+    const std::string& help, const std::string& labels)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    boost::shared_ptr<IMetric>& metric =
+        GetFamily(name, "counter", help).metrics[labels];
+    if(!metric)
+    {
+        metric.reset(new CCounter());
+    }
+    return static_cast<CCounter&>(*metric);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::GetGauge
+/// @description Gets the gauge of a name and labels, registering it at zero
+///     the first time.
+/// @pre None
+/// @post The gauge is registered.
+/// @param name the name of the gauge.
+/// @param help the description of the gauge.
+/// @param labels the labels of the gauge, formatted with Label.
+/// @return The gauge, valid for the life of the process.
+///////////////////////////////////////////////////////////////////////////////
+CGauge& CMetrics::GetGauge(const std::string& name,
+    const std::string& help, const std::string& labels)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    boost::shared_ptr<IMetric>& metric =
+        GetFamily(name, "gauge", help).metrics[labels];
+    if(!metric)
+    {
+        metric.reset(new CGauge());
+    }
+    return static_cast<CGauge&>(*metric);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::GetHistogram
+/// @description Gets the histogram of a name and labels, registering it
+///     empty the first time. The buckets range from ten microseconds to five
+///     seconds.
+/// @pre None
+/// @post The histogram is registered.
+/// @param name the name of the histogram, which should end in _seconds.
+/// @param help the description of the histogram.
+/// @param labels the labels of the histogram, formatted with Label.
+/// @return The histogram, valid for the life of the process.
+///////////////////////////////////////////////////////////////////////////////
+CHistogram& CMetrics::GetHistogram(const std::string& name,
+    const std::string& help, const std::string& labels)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    boost::shared_ptr<IMetric>& metric =
+        GetFamily(name, "histogram", help).metrics[labels];
+    if(!metric)
+    {
+        std::vector<double> bounds(DURATION_BOUNDS, DURATION_BOUNDS
+            + sizeof(DURATION_BOUNDS) / sizeof(DURATION_BOUNDS[0]));
+        metric.reset(new CHistogram(bounds));
+    }
+    return static_cast<CHistogram&>(*metric);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::Label
+/// @description Formats a label for the lookup functions. Several labels are
+///     joined with commas.
+/// @pre None
+/// @post None
+/// @param key the name of the label.
+/// @param value the value of the label.
+/// @return The label as key="value", with the value escaped.
+///////////////////////////////////////////////////////////////////////////////
+std::string CMetrics::Label(const std::string& key, const std::string& value)
+{
+    std::string label = key + "=\"";
+    for(std::size_t i = 0; i < value.size(); i++)
+    {
+        if(value[i] == '\\' || value[i] == '"')
+        {
+            label += '\\';
+            label += value[i];
+        }
+        else if(value[i] == '\n')
+        {
+            label += "\\n";
+        }
+        else
+        {
+            label += value[i];
+        }
+    }
+    return label + "\"";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::Format
+/// @description Writes the HELP and TYPE lines of each name and the samples
+///     of each of its metrics.
+/// @pre None
+/// @post The metrics are written to out.
+/// @param out the stream to write to.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::Format(std::ostream& out) const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::map<std::string, SFamily>::const_iterator it;
+    for(it = m_families.begin(); it != m_families.end(); it++)
+    {
+        out << "# HELP " << it->first << " " << it->second.help << "\n";
+        out << "# TYPE " << it->first << " " << it->second.type << "\n";
+        std::map<std::string, boost::shared_ptr<IMetric> >::const_iterator jt;
+        for(jt = it->second.metrics.begin(); jt != it->second.metrics.end(); jt++)
+        {
+            jt->second->Format(out, it->first, jt->first);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::Start
+/// @description Opens the configured metrics port on the listen address and
+///     serves it from a thread of its own, so a scrape never waits for the
+///     broker and the broker never waits for a scrape.
+/// @pre None
+/// @post The endpoint is running if a metrics port is configured.
+/// @ErrorHandling Throws boost::system::system_error if the port cannot be
+///     opened.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    unsigned short port = CGlobalConfiguration::Instance().GetMetricsPort();
+    if(port == 0 || m_acceptor.is_open())
+    {
+        return;
+    }
+
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(
+        CGlobalConfiguration::Instance().GetListenAddress()), port);
+    m_acceptor.open(endpoint.protocol());
+    m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    m_acceptor.bind(endpoint);
+    m_acceptor.listen();
+    Accept();
+
+    m_thread = boost::thread(
+        boost::bind(&boost::asio::io_service::run, &m_service));
+    LOG_NOTICE(Logger) << "Serving metrics on port " << port << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::Stop
+/// @description Stops the endpoint thread and closes the port.
+/// @pre None
+/// @post The endpoint thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_service.stop();
+    if(m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    boost::system::error_code ignored;
+    m_acceptor.close(ignored);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::Accept
+/// @description Waits for the next connection to the endpoint.
+/// @pre The acceptor is listening.
+/// @post HandleAccept is called with the next connection.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::Accept()
+{
+    boost::shared_ptr<boost::asio::ip::tcp::socket> socket(
+        new boost::asio::ip::tcp::socket(m_service));
+    m_acceptor.async_accept(*socket, boost::bind(&CMetrics::HandleAccept,
+        this, socket, boost::asio::placeholders::error));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::HandleAccept
+/// @description Reads the request headers of a new connection and waits for
+///     the next one.
+/// @pre Called on the endpoint thread.
+/// @post HandleRequest is called once the headers have been read.
+/// @param socket the new connection.
+/// @param error the result of the accept.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::HandleAccept(boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+    const boost::system::error_code& error)
+{
+    if(error == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+    if(!error)
+    {
+        boost::shared_ptr<boost::asio::streambuf> request =
+            boost::make_shared<boost::asio::streambuf>(MAX_REQUEST_SIZE);
+        boost::asio::async_read_until(*socket, *request, "\r\n\r\n",
+            boost::bind(&CMetrics::HandleRequest, this, socket, request,
+            boost::asio::placeholders::error));
+    }
+    else
+    {
+        LOG_WARN(Logger) << "Metrics accept failed: " << error.message()
+            << std::endl;
+    }
+    Accept();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::HandleRequest
+/// @description Answers a GET of /profile with the samples of the
+///     profiler, a GET of any other path with the metrics, and anything
+///     else with 405. The connection is closed after the answer.
+/// @pre Called on the endpoint thread.
+/// @post The answer is being written.
+/// @param socket the connection.
+/// @param request the request headers.
+/// @param error the result of the read.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::HandleRequest(boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+    boost::shared_ptr<boost::asio::streambuf> request,
+    const boost::system::error_code& error)
+{
+    if(error)
+    {
+        return;
+    }
+
+    std::istream headers(request.get());
+    std::string method, path;
+    headers >> method >> path;
+
+    std::ostringstream body;
+    std::string status = "200 OK";
+    if(method == "GET" && path == "/profile")
+    {
+        CProfiler::Instance().Format(body);
+    }
+    else if(method == "GET")
+    {
+        Format(body);
+    }
+    else
+    {
+        status = "405 Method Not Allowed";
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.0 " << status << "\r\n"
+        << "Content-Type: text/plain; version=0.0.4\r\n"
+        << "Content-Length: " << body.str().size() << "\r\n"
+        << "Connection: close\r\n\r\n" << body.str();
+    boost::shared_ptr<std::string> text =
+        boost::make_shared<std::string>(response.str());
+    boost::asio::async_write(*socket, boost::asio::buffer(*text),
+        boost::bind(&CMetrics::HandleWrite, this, socket, text,
+        boost::asio::placeholders::error));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMetrics::HandleWrite
+/// @description Closes a connection whose answer has been written.
+/// @pre Called on the endpoint thread.
+/// @post The connection is closed.
+/// @param socket the connection.
+/// @param response the answer, kept alive until it is written.
+/// @param error the result of the write.
+///////////////////////////////////////////////////////////////////////////////
+void CMetrics::HandleWrite(boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+    boost::shared_ptr<std::string> /*response*/,
+    const boost::system::error_code& /*error*/)
+{
+    boost::system::error_code ignored;
+    socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+    socket->close(ignored);
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,282 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CMetrics.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare the runtime metrics registry and its HTTP endpoint
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CMETRICS_HPP
+#define CMETRICS_HPP
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// A value the registry can write in the Prometheus text format
+class IMetric
+    : private boost::noncopyable
+{
+public:
+    /// Virtual destructor for the metric types
+    virtual ~IMetric() { }
+
+    /// Writes the samples of the metric
+    virtual void Format(std::ostream& out, const std::string& name,
+        const std::string& labels) const = 0;
+};
+
+/// A count that only goes up
+class CCounter
+    : public IMetric
+{
+public:
+    /// Creates a counter at zero
+    CCounter() : m_value(0) { }
+
+    /// Adds to the count
+    void Increment(boost::uint64_t n = 1) { __sync_fetch_and_add(&m_value, n); }
+
+    /// Gets the count
+    boost::uint64_t GetValue() const { return m_value; }
+
+    /// Writes the count
+    void Format(std::ostream& out, const std::string& name,
+        const std::string& labels) const;
+
+private:
+    /// The count
+    volatile boost::uint64_t m_value;
+};
+
+/// A value that goes up and down
+class CGauge
+    : public IMetric
+{
+public:
+    /// Creates a gauge at zero
+    CGauge() : m_value(0) { }
+
+    /// Replaces the value
+    void Set(boost::int64_t value);
+
+    /// Adds to the value, which may be negative
+    void Add(boost::int64_t n) { __sync_fetch_and_add(&m_value, n); }
+
+    /// Raises the value to at least the given value
+    void Raise(boost::int64_t value);
+
+    /// Gets the value
+    boost::int64_t GetValue() const { return m_value; }
+
+    /// Writes the value
+    void Format(std::ostream& out, const std::string& name,
+        const std::string& labels) const;
+
+private:
+    /// The value
+    volatile boost::int64_t m_value;
+};
+
+/// Counts observations in buckets by their upper bounds
+class CHistogram
+    : public IMetric
+{
+public:
+    /// Creates a histogram with the given increasing bucket bounds
+    explicit CHistogram(const std::vector<double>& bounds);
+
+    /// Adds an observation
+    void Observe(double value);
+
+    /// Writes the cumulative buckets, the sum and the count
+    void Format(std::ostream& out, const std::string& name,
+        const std::string& labels) const;
+
+private:
+    /// Upper bounds of the buckets, the last bucket has no bound
+    std::vector<double> m_bounds;
+
+    /// Observations by bucket, not cumulative
+    std::vector<boost::uint64_t> m_counts;
+
+    /// Bits of the double sum of the observations
+    volatile boost::uint64_t m_sum;
+};
+
+/// Reports the size of a container of a module
+////////////////////////////////////////////////////////////////////////////////
+/// Every tracker of the same module and container adds to the same gauges, so
+/// the containers of the connections of a node appear as one total:
+///
+///     dgi_container_items       elements held
+///     dgi_container_bytes       estimated bytes held
+///     dgi_container_peak_bytes  most bytes held at once since the start
+///
+/// The owner of the container calls Update after it changes the container.
+/// The bytes are an estimate the owner makes, the elements themselves plus
+/// the memory they own where that is cheap to find, and leave out the
+/// overhead of the allocator. A tracker takes its values back out of the
+/// gauges when it is destroyed; it must be updated by one thread at a time.
+////////////////////////////////////////////////////////////////////////////////
+class CSizeTracker
+    : private boost::noncopyable
+{
+public:
+    /// Creates a tracker that reports nothing yet
+    CSizeTracker(const std::string& module, const std::string& container);
+
+    /// Takes the last reported size out of the totals
+    ~CSizeTracker();
+
+    /// Reports the current size of the container
+    void Update(std::size_t items, std::size_t bytes);
+
+    /// Reports the size of a container whose elements own no memory
+    template <typename Container>
+    void Update(const Container& container)
+    {
+        Update(container.size(),
+            container.size() * sizeof(typename Container::value_type));
+    }
+
+private:
+    /// Elements held by every tracker of the container
+    CGauge& m_items;
+    /// Bytes held by every tracker of the container
+    CGauge& m_bytes;
+    /// Highest value m_bytes has had
+    CGauge& m_peak;
+    /// The elements this tracker last reported
+    boost::int64_t m_lastitems;
+    /// The bytes this tracker last reported
+    boost::int64_t m_lastbytes;
+};
+
+/// Process-wide registry of counters, gauges and histograms
+////////////////////////////////////////////////////////////////////////////////
+/// Metrics are looked up by name and labels. A lookup takes the registry lock,
+/// so callers look a metric up once, usually when their file is loaded or
+/// when a module registers, and keep the reference; updates are atomic and
+/// take no lock. A metric is never removed once it has been registered.
+///
+/// When a metrics port is configured, Start runs a small HTTP server on its
+/// own thread that answers every request with the metrics in the Prometheus
+/// text format.
+////////////////////////////////////////////////////////////////////////////////
+class CMetrics
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CMetrics
+    static CMetrics& Instance();
+
+    /// Gets or registers a counter
+    CCounter& GetCounter(const std::string& name, const std::string& help,
+        const std::string& labels = "");
+
+    /// Gets or registers a gauge
+    CGauge& GetGauge(const std::string& name, const std::string& help,
+        const std::string& labels = "");
+
+    /// Gets or registers a histogram of durations in seconds
+    CHistogram& GetHistogram(const std::string& name, const std::string& help,
+        const std::string& labels = "");
+
+    /// Formats a label pair, escaping the value
+    static std::string Label(const std::string& key, const std::string& value);
+
+    /// Writes every metric in the Prometheus text format
+    void Format(std::ostream& out) const;
+
+    /// Starts the HTTP endpoint, if a metrics port is configured
+    void Start();
+
+    /// Stops the HTTP endpoint
+    void Stop();
+
+private:
+    /// The metrics of one name
+    struct SFamily
+    {
+        /// The Prometheus type of the metrics
+        std::string type;
+        /// The description of the metrics
+        std::string help;
+        /// The metrics by their formatted labels
+        std::map<std::string, boost::shared_ptr<IMetric> > metrics;
+    };
+
+    /// Private constructor for the singleton instance
+    CMetrics();
+
+    /// Stops the HTTP endpoint
+    ~CMetrics();
+
+    /// Finds or creates the family of a name, checking its type
+    SFamily& GetFamily(const std::string& name, const std::string& type,
+        const std::string& help);
+
+    /// Waits for the next connection to the endpoint
+    void Accept();
+
+    /// Reads the request of a connection
+    void HandleAccept(boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+        const boost::system::error_code& error);
+
+    /// Answers a request with the metrics
+    void HandleRequest(boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+        boost::shared_ptr<boost::asio::streambuf> request,
+        const boost::system::error_code& error);
+
+    /// Closes a connection once its answer is written
+    void HandleWrite(boost::shared_ptr<boost::asio::ip::tcp::socket> socket,
+        boost::shared_ptr<std::string> response,
+        const boost::system::error_code& error);
+
+    /// The metrics by name
+    std::map<std::string, SFamily> m_families;
+
+    /// Lock for m_families
+    mutable boost::mutex m_mutex;
+
+    /// Runs the HTTP endpoint
+    boost::asio::io_service m_service;
+
+    /// Accepts the connections of the HTTP endpoint
+    boost::asio::ip::tcp::acceptor m_acceptor;
+
+    /// The thread of the HTTP endpoint
+    boost::thread m_thread;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CMETRICS_HPP
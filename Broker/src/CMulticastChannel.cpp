@@ -0,0 +1,446 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CMulticastChannel.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Sends group-wide messages with one multicast datagram and
+///               repeats the ones receivers report missing.
+///
+/// @functions
+///     CMulticastChannel::Instance
+///     CMulticastChannel::CMulticastChannel
+///     CMulticastChannel::Start
+///     CMulticastChannel::Stop
+///     CMulticastChannel::Send
+///     CMulticastChannel::ScheduleListen
+///     CMulticastChannel::HandleRead
+///     CMulticastChannel::HandleMessage
+///     CMulticastChannel::HandleNack
+///     CMulticastChannel::Write
+///     CMulticastChannel::WriteDatagram
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CMulticastChannel.hpp"
+
+#include "CBroker.hpp"
+#include "CDispatcher.hpp"
+#include "CLogger.hpp"
+#include "CTimings.hpp"
+#include "messages/ProtocolMessage.pb.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::Instance
+/// @description Access the singleton instance of the CMulticastChannel
+/// @pre None
+/// @post The channel has been constructed
+/// @return The CMulticastChannel
+///////////////////////////////////////////////////////////////////////////////
+CMulticastChannel& CMulticastChannel::Instance()
+{
+    static CMulticastChannel instance;
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::CMulticastChannel
+/// @description Constructor. Creates the socket of the channel, which is only
+///     opened by Start.
+/// @pre None
+/// @post A socket is created using the Broker's io service.
+///////////////////////////////////////////////////////////////////////////////
+CMulticastChannel::CMulticastChannel()
+    : m_socket(CBroker::Instance().GetIOService())
+    , m_enabled(false)
+    , m_epoch(0)
+    , m_outseq(0)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::Start
+/// @description Joins the multicast group given by the configuration. Every
+///     DGI of the group binds the same port, so the socket reuses the
+///     address. If the group cannot be joined, group sends fall back to one
+///     message per peer.
+/// @pre None
+/// @post If a group is configured and could be joined, the channel listens
+///     for multicast messages and IsEnabled returns true.
+///////////////////////////////////////////////////////////////////////////////
+void CMulticastChannel::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string address = CGlobalConfiguration::Instance().GetMulticastAddress();
+    if(address.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        m_group = boost::asio::ip::udp::endpoint(
+            boost::asio::ip::address::from_string(address),
+            CGlobalConfiguration::Instance().GetMulticastPort());
+        m_socket.open(m_group.protocol());
+        m_socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+        m_socket.bind(boost::asio::ip::udp::endpoint(m_group.protocol(),
+            m_group.port()));
+        m_socket.set_option(boost::asio::ip::multicast::join_group(
+            m_group.address()));
+        // several DGI may run on one host
+        m_socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+    }
+    catch(boost::system::system_error& e)
+    {
+        LOG_WARN(Logger) << "Could not join multicast group " << address << ": "
+            << e.what() << std::endl;
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
+        return;
+    }
+
+    m_epoch = (boost::posix_time::microsec_clock::universal_time() -
+        boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1)))
+        .total_microseconds();
+    m_enabled = true;
+    LOG_STATUS(Logger) << "Joined multicast group " << m_group << std::endl;
+    ScheduleListen();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::Stop
+/// @description Closes the multicast socket.
+/// @pre None
+/// @post The socket is closed and group sends use unicast.
+///////////////////////////////////////////////////////////////////////////////
+void CMulticastChannel::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_enabled = false;
+    if(m_socket.is_open())
+    {
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::Send
+/// @description Sends a message to several peers with one datagram to the
+///     multicast group. The message is numbered and kept until it expires, so
+///     that it can be repeated to receivers that NACK it. Messages sent this
+///     way are not ordered with the messages sent over the peer connections.
+/// @pre None
+/// @post If the channel is enabled, there is more than one recipient and the
+///     message fits a datagram, the message has been written to the group.
+/// @param msg The message to send.
+/// @param recipients The peers that should deliver the message.
+/// @return False if the message was not sent, and the caller has to send it
+///     to each peer instead.
+///////////////////////////////////////////////////////////////////////////////
+bool CMulticastChannel::Send(const CSerializedMessage::Pointer& msg,
+    const std::vector<std::string>& recipients)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_enabled || recipients.size() < 2)
+    {
+        return false;
+    }
+
+    boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time();
+    while(!m_sent.empty() &&
+        (m_sent.size() >= MAX_HISTORY || m_sent.front().expires < now))
+    {
+        m_sent.pop_front();
+    }
+
+    SentMessage sent;
+    sent.sequence = m_outseq++;
+    sent.recipients = recipients;
+    sent.body = msg;
+    sent.expires = now +
+        CTimings::GetDuration(CTimings::CSRC_DEFAULT_TIMEOUT);
+    if(!Write(sent, m_group))
+    {
+        m_outseq--;
+        return false;
+    }
+    m_sent.push_back(sent);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::ScheduleListen
+/// @description Start an asynchronous read on the multicast socket.
+/// @pre The socket is open.
+/// @post HandleRead is called when a datagram arrives.
+///////////////////////////////////////////////////////////////////////////////
+void CMulticastChannel::ScheduleListen()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_socket.async_receive_from(boost::asio::buffer(m_buffer, CGlobalConfiguration::MAX_PACKET_SIZE),
+        m_recv_from, CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CMulticastChannel::HandleRead, this,
+        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::HandleRead
+/// @description Parses a datagram received on the multicast socket and
+///     passes it on as a message or a NACK.
+/// @param e The error code of the read.
+/// @param bytes_transferred The size of the datagram.
+/// @pre ScheduleListen was called.
+/// @post The datagram has been handled and the next read is scheduled.
+///////////////////////////////////////////////////////////////////////////////
+void CMulticastChannel::HandleRead(const boost::system::error_code& e,
+    std::size_t bytes_transferred)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(e == boost::asio::error::operation_aborted || !m_enabled)
+    {
+        return;
+    }
+    if(e)
+    {
+        LOG_ERROR(Logger) << "HandleRead failed: " << e.message() << std::endl;
+        ScheduleListen();
+        return;
+    }
+
+    MulticastMessage mm;
+    if(!mm.ParseFromArray(m_buffer.begin(), bytes_transferred))
+    {
+        LOG_ERROR(Logger) << "Failed to load multicast protobuf" << std::endl;
+    }
+    else if(mm.source_uuid() != CGlobalConfiguration::Instance().GetUUID())
+    {
+        if(mm.missing_size() > 0)
+        {
+            HandleNack(mm, m_recv_from);
+        }
+        else if(mm.has_module_message() && mm.has_sequence_num())
+        {
+            HandleMessage(mm, m_recv_from);
+        }
+    }
+    ScheduleListen();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::HandleMessage
+/// @description Tracks the sequence numbers received from the sender and
+///     NACKs the gaps, then delivers the message if this node is one of its
+///     recipients. Duplicates are dropped. Gaps that are older than the
+///     sender's history are given up on.
+/// @param mm The received message.
+/// @param from The endpoint of the sender's multicast socket.
+/// @pre None
+/// @post The message is scheduled for delivery by the dispatcher, unless it
+///     is a duplicate or addressed to other peers.
+///////////////////////////////////////////////////////////////////////////////
+void CMulticastChannel::HandleMessage(const MulticastMessage& mm,
+    const boost::asio::ip::udp::endpoint& from)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    unsigned int seq = mm.sequence_num();
+    std::map<std::string, SourceState>::iterator it =
+        m_sources.find(mm.source_uuid());
+    if(it == m_sources.end() || it->second.epoch != mm.epoch())
+    {
+        // messages from before we heard of the sender are not requested
+        SourceState fresh;
+        fresh.epoch = mm.epoch();
+        fresh.next = seq;
+        it = m_sources.insert(std::make_pair(mm.source_uuid(), fresh)).first;
+        it->second = fresh;
+    }
+    SourceState& source = it->second;
+
+    if(seq < source.next || source.early.count(seq) > 0)
+    {
+        LOG_DEBUG(Logger) << "Duplicate multicast " << seq << " from "
+            << mm.source_uuid() << std::endl;
+        return;
+    }
+
+    if(seq == source.next)
+    {
+        source.next++;
+    }
+    else
+    {
+        MulticastMessage nack;
+        nack.set_source_uuid(CGlobalConfiguration::Instance().GetUUID());
+        nack.set_epoch(mm.epoch());
+        for(unsigned int i = source.next; i < seq && static_cast<unsigned int>(
+            nack.missing_size()) < MAX_NACK; i++)
+        {
+            if(source.early.count(i) == 0)
+            {
+                nack.add_missing(i);
+            }
+        }
+        LOG_DEBUG(Logger) << "Requesting " << nack.missing_size()
+            << " multicast messages from " << mm.source_uuid() << std::endl;
+        WriteDatagram(nack, from);
+
+        source.early.insert(seq);
+        if(seq - source.next > MAX_HISTORY)
+        {
+            source.next = seq - MAX_HISTORY;
+            source.early.erase(source.early.begin(),
+                source.early.lower_bound(source.next));
+        }
+    }
+    while(!source.early.empty() && *source.early.begin() == source.next)
+    {
+        source.early.erase(source.early.begin());
+        source.next++;
+    }
+
+    if(std::find(mm.recipients().begin(), mm.recipients().end(),
+        CGlobalConfiguration::Instance().GetUUID()) != mm.recipients().end())
+    {
+        CDispatcher::Instance().HandleRequest(
+            boost::make_shared<const ModuleMessage>(mm.module_message()),
+            CPeerIdTable::Instance().Intern(mm.source_uuid()));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::HandleNack
+/// @description Repeats the requested messages that are still in the history
+///     to the peer that is missing them.
+/// @param mm The NACK.
+/// @param from The endpoint of the requesting peer's multicast socket.
+/// @pre None
+/// @post The unexpired messages of the NACK have been written to the peer.
+///////////////////////////////////////////////////////////////////////////////
+void CMulticastChannel::HandleNack(const MulticastMessage& mm,
+    const boost::asio::ip::udp::endpoint& from)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(mm.epoch() != m_epoch || m_sent.empty())
+    {
+        return;
+    }
+
+    boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time();
+    unsigned int first = m_sent.front().sequence;
+    for(int i = 0; i < mm.missing_size(); i++)
+    {
+        unsigned int seq = mm.missing(i);
+        if(seq >= first && seq - first < m_sent.size() &&
+            m_sent[seq - first].expires >= now)
+        {
+            Write(m_sent[seq - first], from);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::Write
+/// @description Writes a sent message to the group or to a single peer.
+/// @param sent The message and its multicast header fields.
+/// @param to The group, or the peer that NACKed the message.
+/// @pre The channel is enabled.
+/// @post The message has been written to the socket.
+/// @return False if the message could not be written.
+///////////////////////////////////////////////////////////////////////////////
+bool CMulticastChannel::Write(const SentMessage& sent,
+    const boost::asio::ip::udp::endpoint& to)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    MulticastMessage mm;
+    mm.set_source_uuid(CGlobalConfiguration::Instance().GetUUID());
+    mm.set_epoch(m_epoch);
+    mm.set_sequence_num(sent.sequence);
+    for(std::size_t i = 0; i < sent.recipients.size(); i++)
+    {
+        mm.add_recipients(sent.recipients[i]);
+    }
+    if(sent.body->IsPatched())
+    {
+        mm.mutable_module_message()->ParseFromString(sent.body->GetBytes());
+    }
+    else
+    {
+        mm.mutable_module_message()->CopyFrom(sent.body->GetMessage());
+    }
+    return WriteDatagram(mm, to);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMulticastChannel::WriteDatagram
+/// @description Serializes a multicast message and writes it to the socket.
+/// @param mm The message to write.
+/// @param to The destination of the datagram.
+/// @pre The channel is enabled.
+/// @post The datagram has been written, or the failure has been logged.
+/// @return False if the datagram is too large or could not be written.
+///////////////////////////////////////////////////////////////////////////////
+bool CMulticastChannel::WriteDatagram(const MulticastMessage& mm,
+    const boost::asio::ip::udp::endpoint& to)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string bytes;
+    mm.SerializeToString(&bytes);
+    if(bytes.size() > static_cast<std::size_t>(CGlobalConfiguration::MAX_PACKET_SIZE))
+    {
+        LOG_WARN(Logger) << "Multicast message too long for buffer" << std::endl;
+        return false;
+    }
+
+    try
+    {
+        m_socket.send_to(boost::asio::buffer(bytes), to);
+    }
+    catch(boost::system::system_error& e)
+    {
+        LOG_DEBUG(Logger) << "Writing multicast failed: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+    } // namespace broker
+} // namespace freedm
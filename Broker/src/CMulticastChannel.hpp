@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CMulticastChannel.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare the CMulticastChannel class
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CMULTICASTCHANNEL_HPP
+#define CMULTICASTCHANNEL_HPP
+
+#include "CGlobalConfiguration.hpp"
+#include "Messages.hpp"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace freedm {
+    namespace broker {
+
+class MulticastMessage;
+
+/// Sends messages meant for several peers to a multicast group in one datagram
+class CMulticastChannel
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CMulticastChannel
+    static CMulticastChannel& Instance();
+
+    /// Joins the configured multicast group, if there is one
+    void Start();
+
+    /// Leaves the multicast group and closes the socket
+    void Stop();
+
+    /// Checks if a multicast group has been joined
+    bool IsEnabled() const { return m_enabled; }
+
+    /// Sends one copy of a message to several peers, false if not multicast
+    bool Send(const CSerializedMessage::Pointer& msg,
+        const std::vector<std::string>& recipients);
+private:
+    /// A multicast message kept to answer NACKs
+    struct SentMessage
+    {
+        /// Sequence number of the message
+        unsigned int sequence;
+        /// Peers that should deliver the message
+        std::vector<std::string> recipients;
+        /// Message that was sent
+        CSerializedMessage::Pointer body;
+        /// Time after which the message is no longer repeated
+        boost::posix_time::ptime expires;
+    };
+
+    /// Receive state of the multicast messages of one peer
+    struct SourceState
+    {
+        /// Start time of the peer, identifies its sequence numbers
+        google::protobuf::uint64 epoch;
+        /// Lowest sequence number that has not been received yet
+        unsigned int next;
+        /// Sequence numbers received out of order, all above next
+        std::set<unsigned int> early;
+    };
+
+    /// Private constructor for the singleton instance
+    CMulticastChannel();
+
+    /// Asynchronously listen for a new datagram
+    void ScheduleListen();
+
+    /// Handle completion of a read operation
+    void HandleRead(const boost::system::error_code& e, std::size_t bytes_transferred);
+
+    /// Tracks and delivers a message from the group
+    void HandleMessage(const MulticastMessage& mm,
+        const boost::asio::ip::udp::endpoint& from);
+
+    /// Repeats the messages a peer is missing
+    void HandleNack(const MulticastMessage& mm,
+        const boost::asio::ip::udp::endpoint& from);
+
+    /// Writes a multicast message to a destination
+    bool Write(const SentMessage& sent, const boost::asio::ip::udp::endpoint& to);
+
+    /// Writes a serialized datagram to a destination
+    bool WriteDatagram(const MulticastMessage& mm,
+        const boost::asio::ip::udp::endpoint& to);
+
+    /// Socket bound to the multicast port
+    boost::asio::ip::udp::socket m_socket;
+
+    /// The multicast group
+    boost::asio::ip::udp::endpoint m_group;
+
+    /// Buffer for incoming data
+    boost::array<char, CGlobalConfiguration::MAX_PACKET_SIZE> m_buffer;
+
+    /// Endpoint for incoming message
+    boost::asio::ip::udp::endpoint m_recv_from;
+
+    /// Set once the group has been joined
+    bool m_enabled;
+
+    /// Start time of this process, sent as the epoch
+    google::protobuf::uint64 m_epoch;
+
+    /// Sequence number of the next multicast message
+    unsigned int m_outseq;
+
+    /// Recently sent messages, by increasing sequence number
+    std::deque<SentMessage> m_sent;
+
+    /// Receive state of each peer that has multicast to this node
+    std::map<std::string, SourceState> m_sources;
+
+    /// Largest number of sent messages kept for NACKs
+    static const unsigned int MAX_HISTORY = 256;
+
+    /// Largest number of sequence numbers requested by one NACK
+    static const unsigned int MAX_NACK = 64;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CMULTICASTCHANNEL_HPP
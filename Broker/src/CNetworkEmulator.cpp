@@ -0,0 +1,384 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CNetworkEmulator.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Shapes outgoing datagrams to emulate the links between DGIs
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CNetworkEmulator.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Datagrams the emulated links lost
+CCounter& DroppedMetric = CMetrics::Instance().GetCounter(
+    "dgi_netem_dropped_total", "Datagrams lost on the emulated links");
+
+/// Datagrams the emulated links held back before sending
+CCounter& DelayedMetric = CMetrics::Instance().GetCounter(
+    "dgi_netem_delayed_total", "Datagrams delayed on the emulated links");
+
+/// The wildcard that matches any DGI in the link file
+const std::string ANY_PEER = "*";
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::Instance
+/// @description Returns the singleton instance of the network emulator.
+/// @pre None
+/// @post The singleton instance is created if it did not exist.
+/// @return The CNetworkEmulator singleton.
+///////////////////////////////////////////////////////////////////////////////
+CNetworkEmulator& CNetworkEmulator::Instance()
+{
+    static CNetworkEmulator emulator;
+    return emulator;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::CNetworkEmulator
+/// @description Creates an emulator that shapes nothing.
+/// @pre None
+/// @post IsEnabled returns false until Start loads a file.
+///////////////////////////////////////////////////////////////////////////////
+CNetworkEmulator::CNetworkEmulator()
+    : m_enabled(false)
+    , m_hasDefault(false)
+    , m_queueLimit(1000)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::Start
+/// @description Reads the links of this DGI from the network emulation file.
+///     The random source is seeded from the clock unless the file gives a
+///     seed, so a run can be repeated.
+/// @pre CGlobalConfiguration has the UUID of this DGI.
+/// @post IsEnabled returns true if a file is configured.
+/// @ErrorHandling Throws std::runtime_error if the file cannot be opened or
+///     an entry is malformed.
+///////////////////////////////////////////////////////////////////////////////
+void CNetworkEmulator::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    const std::string LINK_TOKEN = "link";
+    const std::string QUEUE_TOKEN = "queue";
+    const std::string SEED_TOKEN = "seed";
+
+    std::string fp = CGlobalConfiguration::Instance().GetNetworkEmulationPath();
+    if(fp.empty())
+    {
+        return;
+    }
+    std::ifstream input(fp.c_str());
+    if(!input.is_open())
+    {
+        throw std::runtime_error("Network Emulation: Couldn't open link file.");
+    }
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_random.seed(static_cast<boost::uint32_t>(std::time(0)));
+
+    std::string token;
+    while(input >> token)
+    {
+        if(token[0] == '#')
+        {
+            std::getline(input, token);
+        }
+        else if(token == LINK_TOKEN)
+        {
+            ReadLink(input);
+        }
+        else if(token == QUEUE_TOKEN)
+        {
+            if(!(input >> m_queueLimit) || m_queueLimit < 0)
+            {
+                throw std::runtime_error("Failed Reading Queue Emulation Entry");
+            }
+        }
+        else if(token == SEED_TOKEN)
+        {
+            boost::uint32_t seed;
+            if(!(input >> seed))
+            {
+                throw std::runtime_error("Failed Reading Seed Emulation Entry");
+            }
+            m_random.seed(seed);
+        }
+        else
+        {
+            LOG_ERROR(Logger)<<"Expected link token, saw '"<<token<<"'"<<std::endl;
+            throw std::runtime_error("Network Emulation: Input link file is malformed.");
+        }
+    }
+
+    m_enabled = true;
+    LOG_STATUS(Logger) << "Emulating " << m_links.size() << " links"
+        << (m_hasDefault ? " and a default link" : "") << " from " << fp
+        << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::ReadLink
+/// @description Reads the fields after a link token. A link from another DGI
+///     is skipped, and a wildcard link does not replace one that named this
+///     DGI, whichever comes first in the file.
+/// @pre The link token was read from input and m_mutex is held.
+/// @post The link is stored if it applies to this DGI.
+/// @param input the link file
+/// @ErrorHandling Throws std::runtime_error if a field is missing or out of
+///     range.
+///////////////////////////////////////////////////////////////////////////////
+void CNetworkEmulator::ReadLink(std::istream& input)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string from, to, distribution;
+    double burst;
+    SLink link;
+    if(!(input >> from >> to >> distribution >> link.delay >> link.jitter
+        >> link.bandwidth >> link.loss >> burst >> link.reorder))
+    {
+        throw std::runtime_error("Failed Reading Link Emulation Entry (EOF?)");
+    }
+
+    if(distribution == "constant")
+        link.distribution = DIST_CONSTANT;
+    else if(distribution == "uniform")
+        link.distribution = DIST_UNIFORM;
+    else if(distribution == "normal")
+        link.distribution = DIST_NORMAL;
+    else if(distribution == "exponential")
+        link.distribution = DIST_EXPONENTIAL;
+    else
+        throw std::runtime_error("Network Emulation: Unknown distribution '"
+            + distribution + "'");
+
+    if(link.delay < 0 || link.jitter < 0 || link.bandwidth < 0 || burst < 0
+        || link.loss < 0 || link.loss > 100
+        || link.reorder < 0 || link.reorder > 100)
+    {
+        throw std::runtime_error("Network Emulation: Link field out of range.");
+    }
+
+    if(from != ANY_PEER && from != CGlobalConfiguration::Instance().GetUUID())
+    {
+        return;
+    }
+    LOG_DEBUG(Logger)<<"Got Link: "<<from<<"->"<<to<<std::endl;
+
+    link.loss /= 100;
+    link.reorder /= 100;
+    // the stationary chance of the bad state of the chain is the loss chance
+    link.goodToBad = 0;
+    link.badToGood = 0;
+    if(burst > 1 && link.loss > 0 && link.loss < 1)
+    {
+        link.badToGood = 1 / burst;
+        link.goodToBad = link.loss * link.badToGood / (1 - link.loss);
+    }
+    link.bad = false;
+    link.exact = (from != ANY_PEER);
+
+    if(to == ANY_PEER)
+    {
+        if(!m_hasDefault || link.exact || !m_default.exact)
+        {
+            m_default = link;
+            m_hasDefault = true;
+        }
+        return;
+    }
+    std::map<std::string, SLink>::iterator it = m_links.find(to);
+    if(it == m_links.end() || link.exact || !it->second.exact)
+    {
+        m_links[to] = link;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::Find
+/// @description Finds the link a datagram to a peer is sent over.
+/// @pre m_mutex is held.
+/// @post None
+/// @param uuid the peer the datagram is sent to
+/// @return The link, or null if datagrams to the peer are not shaped.
+///////////////////////////////////////////////////////////////////////////////
+CNetworkEmulator::SLink* CNetworkEmulator::Find(const std::string& uuid)
+{
+    std::map<std::string, SLink>::iterator it = m_links.find(uuid);
+    if(it != m_links.end())
+    {
+        return &it->second;
+    }
+    return m_hasDefault ? &m_default : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::Uniform
+/// @description Draws a number uniformly from [0, 1).
+/// @pre m_mutex is held.
+/// @post The random source advanced.
+/// @return The number drawn.
+///////////////////////////////////////////////////////////////////////////////
+double CNetworkEmulator::Uniform()
+{
+    return m_random() / (static_cast<double>(boost::mt19937::max()) + 1.0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::Jitter
+/// @description Draws the jitter added to the base delay of a link. Uniform
+///     jitter is within plus or minus the scale, normal jitter has the scale
+///     as its deviation, and exponential jitter only adds to the delay, by
+///     the scale on average.
+/// @pre m_mutex is held.
+/// @post The random source advanced.
+/// @param link the link the datagram is sent over
+/// @return The jitter in milliseconds.
+///////////////////////////////////////////////////////////////////////////////
+double CNetworkEmulator::Jitter(const SLink& link)
+{
+    const double PI = 3.14159265358979323846;
+
+    if(link.jitter == 0)
+    {
+        return 0;
+    }
+    switch(link.distribution)
+    {
+    case DIST_UNIFORM:
+        return link.jitter * (2 * Uniform() - 1);
+    case DIST_NORMAL:
+    {
+        // Box-Muller, 1 - U keeps the logarithm finite
+        double radius = std::sqrt(-2 * std::log(1 - Uniform()));
+        return link.jitter * radius * std::cos(2 * PI * Uniform());
+    }
+    case DIST_EXPONENTIAL:
+        return -link.jitter * std::log(1 - Uniform());
+    default:
+        return 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CNetworkEmulator::Shape
+/// @description Decides whether a datagram to a peer is lost and how long it
+///     is held back. The delay is the time the datagram waits for the data
+///     queued on its link, the time to send it at the link's bandwidth, and
+///     the base delay with jitter, which is never negative. A datagram that
+///     would wait longer than the queue limit is dropped, like a full router
+///     buffer.
+/// @pre Start was called.
+/// @post The loss chain and the queue of the link advanced.
+/// @param uuid the peer the datagram is sent to
+/// @param size the length of the datagram in bytes
+/// @param delay set to how long the datagram is held back
+/// @return False if the datagram is lost.
+///////////////////////////////////////////////////////////////////////////////
+bool CNetworkEmulator::Shape(const std::string& uuid, std::size_t size,
+    boost::posix_time::time_duration& delay)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    delay = boost::posix_time::time_duration(0, 0, 0);
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    SLink* link = Find(uuid);
+    if(link == 0)
+    {
+        return true;
+    }
+
+    bool lost;
+    if(link->badToGood > 0)
+    {
+        if(Uniform() < (link->bad ? link->badToGood : link->goodToBad))
+        {
+            link->bad = !link->bad;
+        }
+        lost = link->bad;
+    }
+    else
+    {
+        lost = link->loss >= 1 || Uniform() < link->loss;
+    }
+    if(lost)
+    {
+        DroppedMetric.Increment();
+        return false;
+    }
+
+    double milliseconds = 0;
+    if(link->bandwidth > 0)
+    {
+        boost::posix_time::ptime now =
+            boost::posix_time::microsec_clock::universal_time();
+        if(link->free.is_not_a_date_time() || link->free < now)
+        {
+            link->free = now;
+        }
+        milliseconds = (link->free - now).total_microseconds() / 1000.0;
+        if(milliseconds > m_queueLimit)
+        {
+            DroppedMetric.Increment();
+            return false;
+        }
+        // bits over kbit/s is milliseconds
+        double transfer = size * 8.0 / link->bandwidth;
+        link->free += boost::posix_time::microseconds(
+            static_cast<boost::int64_t>(transfer * 1000));
+        milliseconds += transfer;
+    }
+    milliseconds += std::max(0.0, link->delay + Jitter(*link));
+    if(link->reorder > 0 && Uniform() < link->reorder)
+    {
+        milliseconds += std::max(link->delay, 1.0);
+    }
+
+    delay = boost::posix_time::microseconds(
+        static_cast<boost::int64_t>(milliseconds * 1000));
+    if(milliseconds > 0)
+    {
+        DelayedMetric.Increment();
+    }
+    return true;
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CNetworkEmulator.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Shapes outgoing datagrams to emulate the links between DGIs
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CNETWORKEMULATOR_HPP
+#define CNETWORKEMULATOR_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Emulates latency, jitter, bandwidth and loss on the links to other DGIs
+////////////////////////////////////////////////////////////////////////////////
+/// The links are read at startup from a text file of lines such as
+///
+///     link <from> <to> <distribution> <delay> <jitter> <bandwidth> <loss>
+///         <burst> <reorder>
+///
+/// where from and to are UUIDs or * for any DGI, the delay and jitter are in
+/// milliseconds, the bandwidth in kbit/s with 0 for unlimited, and the loss
+/// and reorder chances in percent. The distribution of the jitter is one of
+/// constant, uniform, normal or exponential. A burst above 1 is the mean
+/// length of a run of lost datagrams, drawn from a two state Gilbert-Elliott
+/// chain whose long run loss is still the given chance. A reordered datagram
+/// is held back for one more base delay. A line "queue <ms>" bounds the time
+/// a datagram may wait for the bandwidth of its link before it is dropped.
+///
+/// Only the lines whose from matches this DGI are kept, and a line naming
+/// both UUIDs wins over one with a wildcard. Unlike the CUSTOMNETWORK build,
+/// this is chosen at runtime and a DGI without a file pays one test per write.
+////////////////////////////////////////////////////////////////////////////////
+class CNetworkEmulator
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CNetworkEmulator
+    static CNetworkEmulator& Instance();
+
+    /// Reads the links from the configured file, if there is one
+    void Start();
+
+    /// True if datagrams are shaped
+    bool IsEnabled() const { return m_enabled; }
+
+    /// Decides the fate of a datagram, false if it is lost
+    bool Shape(const std::string& uuid, std::size_t size,
+        boost::posix_time::time_duration& delay);
+
+private:
+    /// The distribution jitter is drawn from
+    enum EDistribution { DIST_CONSTANT, DIST_UNIFORM, DIST_NORMAL,
+        DIST_EXPONENTIAL };
+
+    /// The emulated link to one peer
+    struct SLink
+    {
+        /// The distribution of the jitter
+        EDistribution distribution;
+        /// The base delay in milliseconds
+        double delay;
+        /// The scale of the jitter in milliseconds
+        double jitter;
+        /// The bandwidth in kbit/s, 0 for unlimited
+        double bandwidth;
+        /// The long run chance a datagram is lost
+        double loss;
+        /// The chance a good link turns bad
+        double goodToBad;
+        /// The chance a bad link turns good
+        double badToGood;
+        /// The chance a datagram is held back
+        double reorder;
+        /// True if the loss chain is in its bad state
+        bool bad;
+        /// True if the line named this DGI rather than a wildcard
+        bool exact;
+        /// The time the link finishes sending what is queued on it
+        boost::posix_time::ptime free;
+    };
+
+    /// Private constructor for the singleton instance
+    CNetworkEmulator();
+
+    /// Reads one link line from the file
+    void ReadLink(std::istream& input);
+
+    /// Finds the link to a peer, or null if it is not shaped
+    SLink* Find(const std::string& uuid);
+
+    /// Draws a number from [0, 1)
+    double Uniform();
+
+    /// Draws the jitter of a datagram in milliseconds
+    double Jitter(const SLink& link);
+
+    /// True if a file was loaded
+    bool m_enabled;
+
+    /// The links to named peers
+    std::map<std::string, SLink> m_links;
+
+    /// The link to any other peer
+    SLink m_default;
+
+    /// True if m_default was given
+    bool m_hasDefault;
+
+    /// Longest wait in milliseconds for the bandwidth of a link
+    double m_queueLimit;
+
+    /// The source of the random draws
+    boost::mt19937 m_random;
+
+    /// Guards the links and the random source
+    boost::mutex m_mutex;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CNETWORKEMULATOR_HPP
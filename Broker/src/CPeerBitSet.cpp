@@ -0,0 +1,280 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CPeerBitSet.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A set of peers stored as bits over interned peer indices
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CPeerBitSet.hpp"
+
+#include <map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+namespace broker {
+
+namespace {
+
+/// The peer of each interned index
+std::vector<CPeerNode> InternedPeers;
+
+/// The interned index of each peer
+std::map<std::string, std::size_t> InternedIndex;
+
+/// Guards the interned peers, which every module shares
+boost::mutex InternMutex;
+
+/// Gets the index of a peer, interning it if it is new
+std::size_t Intern(const CPeerNode& peer)
+{
+    boost::mutex::scoped_lock lock(InternMutex);
+    std::map<std::string, std::size_t>::iterator it = InternedIndex.find(peer.GetUUID());
+    if(it != InternedIndex.end())
+    {
+        return it->second;
+    }
+    std::size_t index = InternedPeers.size();
+    InternedPeers.push_back(peer);
+    InternedIndex[peer.GetUUID()] = index;
+    return index;
+}
+
+/// Finds the index of a peer, if it was ever interned
+bool Lookup(const std::string& uuid, std::size_t& index)
+{
+    boost::mutex::scoped_lock lock(InternMutex);
+    std::map<std::string, std::size_t>::iterator it = InternedIndex.find(uuid);
+    if(it == InternedIndex.end())
+    {
+        return false;
+    }
+    index = it->second;
+    return true;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::CPeerBitSet
+/// @description Creates a set with no peers.
+/// @pre None
+/// @post The set is empty.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet::CPeerBitSet()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::CPeerBitSet
+/// @description Creates a set with the peers of a PeerSet.
+/// @pre None
+/// @post The peers are interned and in the set.
+/// @param peers The peers to add.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet::CPeerBitSet(const PeerSet& peers)
+{
+    for(PeerSet::const_iterator it = peers.begin(); it != peers.end(); it++)
+    {
+        Insert(it->second);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::Insert
+/// @description Adds a peer, interning it if no set has held it before.
+/// @pre None
+/// @post The peer is in the set.
+/// @param peer The peer to add.
+///////////////////////////////////////////////////////////////////////////////
+void CPeerBitSet::Insert(const CPeerNode& peer)
+{
+    std::size_t index = Intern(peer);
+    Reserve(index + 1);
+    m_bits.set(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::Erase
+/// @description Removes a peer from the set.
+/// @pre None
+/// @post The peer is not in the set.
+/// @param uuid The UUID of the peer to remove.
+///////////////////////////////////////////////////////////////////////////////
+void CPeerBitSet::Erase(const std::string& uuid)
+{
+    std::size_t index;
+    if(Lookup(uuid, index) && index < m_bits.size())
+    {
+        m_bits.reset(index);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::Contains
+/// @description Tests the bit of a peer.
+/// @pre None
+/// @post None
+/// @param uuid The UUID of the peer to look for.
+/// @return True if the peer is in the set.
+///////////////////////////////////////////////////////////////////////////////
+bool CPeerBitSet::Contains(const std::string& uuid) const
+{
+    std::size_t index;
+    return Lookup(uuid, index) && index < m_bits.size() && m_bits.test(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::operator|=
+/// @description Adds the peers of another set, a word at a time.
+/// @pre None
+/// @post The set holds the union of both sets.
+/// @param other The set to add.
+/// @return This set.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet& CPeerBitSet::operator|=(const CPeerBitSet& other)
+{
+    Reserve(other.m_bits.size());
+    if(other.m_bits.size() == m_bits.size())
+    {
+        m_bits |= other.m_bits;
+    }
+    else
+    {
+        boost::dynamic_bitset<> bits = other.m_bits;
+        bits.resize(m_bits.size());
+        m_bits |= bits;
+    }
+    return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::operator&=
+/// @description Keeps the peers also in another set, a word at a time.
+/// @pre None
+/// @post The set holds the intersection of both sets.
+/// @param other The set to intersect with.
+/// @return This set.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet& CPeerBitSet::operator&=(const CPeerBitSet& other)
+{
+    Reserve(other.m_bits.size());
+    if(other.m_bits.size() == m_bits.size())
+    {
+        m_bits &= other.m_bits;
+    }
+    else
+    {
+        boost::dynamic_bitset<> bits = other.m_bits;
+        bits.resize(m_bits.size());
+        m_bits &= bits;
+    }
+    return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::operator-=
+/// @description Removes the peers of another set, a word at a time.
+/// @pre None
+/// @post The set holds the peers that are not in other.
+/// @param other The set to remove.
+/// @return This set.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet& CPeerBitSet::operator-=(const CPeerBitSet& other)
+{
+    Reserve(other.m_bits.size());
+    if(other.m_bits.size() == m_bits.size())
+    {
+        m_bits -= other.m_bits;
+    }
+    else
+    {
+        boost::dynamic_bitset<> bits = other.m_bits;
+        bits.resize(m_bits.size());
+        m_bits -= bits;
+    }
+    return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::ToPeerSet
+/// @description Looks up the peer of every bit that is set.
+/// @pre None
+/// @post None
+/// @return A PeerSet with the same peers.
+///////////////////////////////////////////////////////////////////////////////
+PeerSet CPeerBitSet::ToPeerSet() const
+{
+    PeerSet peers;
+    boost::mutex::scoped_lock lock(InternMutex);
+    for(std::size_t i = m_bits.find_first(); i != boost::dynamic_bitset<>::npos;
+        i = m_bits.find_next(i))
+    {
+        const CPeerNode& peer = InternedPeers[i];
+        peers.insert(std::make_pair(peer.GetUUID(), peer));
+    }
+    return peers;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerBitSet::Reserve
+/// @description Grows the bits so that a size of indices fit. Sets only grow
+///     when a peer is interned after they were made.
+/// @pre None
+/// @post The set has at least size bits.
+/// @param size The number of indices needed.
+///////////////////////////////////////////////////////////////////////////////
+void CPeerBitSet::Reserve(std::size_t size)
+{
+    if(m_bits.size() < size)
+    {
+        m_bits.resize(size);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// operator|
+/// @description Unites two peer sets.
+/// @return The peers in either set.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet operator|(CPeerBitSet lhs, const CPeerBitSet& rhs)
+{
+    return lhs |= rhs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// operator&
+/// @description Intersects two peer sets.
+/// @return The peers in both sets.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet operator&(CPeerBitSet lhs, const CPeerBitSet& rhs)
+{
+    return lhs &= rhs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// operator-
+/// @description Subtracts a peer set from another.
+/// @return The peers in lhs that are not in rhs.
+///////////////////////////////////////////////////////////////////////////////
+CPeerBitSet operator-(CPeerBitSet lhs, const CPeerBitSet& rhs)
+{
+    return lhs -= rhs;
+}
+
+} // namespace broker
+} // namespace freedm
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CPeerBitSet.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A set of peers stored as bits over interned peer indices
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CPEERBITSET_HPP
+#define CPEERBITSET_HPP
+
+#include "CPeerNode.hpp"
+#include "PeerSets.hpp"
+
+#include <cstddef>
+#include <string>
+
+#include <boost/dynamic_bitset.hpp>
+
+namespace freedm {
+namespace broker {
+
+/// A PeerSet alternative for sets that are combined or moved between often.
+///
+/// Every peer is interned once per process to a dense index, and a set keeps
+/// one bit per index. Union, intersection and difference then work a machine
+/// word at a time, and membership does not compare UUID strings. Convert to a
+/// PeerSet with ToPeerSet to iterate or send to the peers.
+class CPeerBitSet
+{
+public:
+    /// Creates an empty set
+    CPeerBitSet();
+    /// Creates a set with the peers of a PeerSet
+    explicit CPeerBitSet(const PeerSet& peers);
+
+    /// Adds a peer to the set
+    void Insert(const CPeerNode& peer);
+    /// Removes a peer from the set
+    void Erase(const std::string& uuid);
+    /// Removes a peer from the set
+    void Erase(const CPeerNode& peer) { Erase(peer.GetUUID()); }
+    /// True if the peer is in the set
+    bool Contains(const std::string& uuid) const;
+    /// True if the peer is in the set
+    bool Contains(const CPeerNode& peer) const { return Contains(peer.GetUUID()); }
+    /// Gets the number of peers in the set
+    std::size_t Size() const { return m_bits.count(); }
+    /// True if the set has no peers
+    bool Empty() const { return m_bits.none(); }
+    /// Removes every peer from the set
+    void Clear() { m_bits.reset(); }
+
+    /// Adds the peers of another set
+    CPeerBitSet& operator|=(const CPeerBitSet& other);
+    /// Keeps only the peers also in another set
+    CPeerBitSet& operator&=(const CPeerBitSet& other);
+    /// Removes the peers of another set
+    CPeerBitSet& operator-=(const CPeerBitSet& other);
+
+    /// Lists the peers of the set
+    PeerSet ToPeerSet() const;
+
+private:
+    /// Grows the set to have a bit for every index of another set
+    void Reserve(std::size_t size);
+
+    /// One bit per interned peer
+    boost::dynamic_bitset<> m_bits;
+};
+
+/// The peers in either set
+CPeerBitSet operator|(CPeerBitSet lhs, const CPeerBitSet& rhs);
+/// The peers in both sets
+CPeerBitSet operator&(CPeerBitSet lhs, const CPeerBitSet& rhs);
+/// The peers in the first set only
+CPeerBitSet operator-(CPeerBitSet lhs, const CPeerBitSet& rhs);
+
+} // namespace broker
+} // namespace freedm
+
+#endif // CPEERBITSET_HPP
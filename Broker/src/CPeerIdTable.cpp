@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CPeerIdTable.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Table of interned peer identifiers
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CPeerIdTable.hpp"
+
+#include <stdexcept>
+
+#include <boost/thread/locks.hpp>
+
+namespace freedm {
+    namespace broker {
+
+const PeerId CPeerIdTable::NO_PEER;
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerIdTable::Instance
+/// @description Access the singleton instance of the peer identifier table
+/// @pre None
+/// @post None
+/// @return A reference to the table.
+///////////////////////////////////////////////////////////////////////////////
+CPeerIdTable& CPeerIdTable::Instance()
+{
+    static CPeerIdTable table;
+    return table;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerIdTable::CPeerIdTable
+/// @description Creates a table that holds only the empty UUID.
+/// @pre None
+/// @post The empty UUID has the handle NO_PEER.
+///////////////////////////////////////////////////////////////////////////////
+CPeerIdTable::CPeerIdTable()
+{
+    const std::string* interned;
+    Intern("", interned);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerIdTable::Intern
+/// @description Gets the handle of a UUID. A UUID seen for the first time gets
+///     the next handle.
+/// @pre None
+/// @post The UUID has a handle.
+/// @param uuid the UUID of a DGI.
+/// @return The handle of the UUID.
+///////////////////////////////////////////////////////////////////////////////
+PeerId CPeerIdTable::Intern(const std::string& uuid)
+{
+    const std::string* interned;
+    return Intern(uuid, interned);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerIdTable::Intern
+/// @description Gets the handle of a UUID along with the interned copy of the
+///     UUID, which stays valid for the life of the process.
+/// @pre None
+/// @post The UUID has a handle.
+/// @param uuid the UUID of a DGI.
+/// @param interned set to the interned copy of the UUID.
+/// @return The handle of the UUID.
+///////////////////////////////////////////////////////////////////////////////
+PeerId CPeerIdTable::Intern(const std::string& uuid, const std::string*& interned)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::map<std::string, PeerId>::iterator it = m_ids.lower_bound(uuid);
+    if(it == m_ids.end() || it->first != uuid)
+    {
+        it = m_ids.insert(it, std::make_pair(uuid, PeerId(m_uuids.size())));
+        m_uuids.push_back(&it->first);
+    }
+    interned = &it->first;
+    return it->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerIdTable::GetUUID
+/// @description Gets the UUID a handle was given for.
+/// @pre id was returned by Intern.
+/// @post None
+/// @param id the handle of a DGI.
+/// @return The interned UUID, valid for the life of the process.
+/// @ErrorHandling Throws std::out_of_range for an unknown handle.
+///////////////////////////////////////////////////////////////////////////////
+const std::string& CPeerIdTable::GetUUID(PeerId id) const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if(id >= m_uuids.size())
+    {
+        throw std::out_of_range("Unknown peer identifier");
+    }
+    return *m_uuids[id];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPeerIdTable::Size
+/// @description Counts the interned UUIDs, including the empty one.
+/// @pre None
+/// @post None
+/// @return The number of handles given out.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CPeerIdTable::Size() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_uuids.size();
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CPeerIdTable.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare the table of interned peer identifiers
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CPEERIDTABLE_HPP
+#define CPEERIDTABLE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// A small handle for the UUID of a DGI, the same for the life of the process
+typedef unsigned int PeerId;
+
+/// Maps the UUID of each DGI to a PeerId
+////////////////////////////////////////////////////////////////////////////////
+/// A UUID is interned the first time it is seen, when a window from the DGI
+/// arrives or a peer node is made for it, and is never released. Comparing
+/// handles replaces comparing strings, and the UUID of a handle is a
+/// reference to the one interned copy. The empty UUID of a default peer node
+/// is always NO_PEER.
+////////////////////////////////////////////////////////////////////////////////
+class CPeerIdTable
+    : private boost::noncopyable
+{
+public:
+    /// The handle of the empty UUID
+    static const PeerId NO_PEER = 0;
+
+    /// Access the singleton instance of the CPeerIdTable
+    static CPeerIdTable& Instance();
+
+    /// Gets the handle of a UUID, interning it on first use
+    PeerId Intern(const std::string& uuid);
+
+    /// Gets the handle of a UUID and the interned copy of the UUID
+    PeerId Intern(const std::string& uuid, const std::string*& interned);
+
+    /// Gets the UUID of a handle
+    const std::string& GetUUID(PeerId id) const;
+
+    /// Gets the number of interned UUIDs
+    std::size_t Size() const;
+
+private:
+    /// Private constructor for the singleton instance
+    CPeerIdTable();
+
+    /// The handles of the interned UUIDs
+    std::map<std::string, PeerId> m_ids;
+
+    /// The interned UUIDs, which are the keys of m_ids, by handle
+    std::vector<const std::string*> m_uuids;
+
+    /// Lock for the table
+    mutable boost::mutex m_mutex;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CPEERIDTABLE_HPP
@@ -26,6 +26,7 @@
 #include "CPeerNode.hpp"
 #include "CConnectionManager.hpp"
 #include "CConnection.hpp"
+#include "Messages.hpp"
 #include "messages/ModuleMessage.pb.h"
 
 #include <map>
@@ -48,28 +49,33 @@ CLocalLogger Logger(__FILE__);
 /// CPeerNode::CPeerNode
 /// @description Prepares a peer node. Provides node status
 ///   and sending functions to the agent in a very clean manner.
+///   The uuid is interned, so copies of the node share it.
 /// @param uuid The uuid of the node
 /////////////////////////////////////////////////////////////
-CPeerNode::CPeerNode(std::string uuid)
-    : m_uuid(uuid)
+CPeerNode::CPeerNode(const std::string& uuid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_id = CPeerIdTable::Instance().Intern(uuid, m_uuid);
 }
-CPeerNode::CPeerNode()
+
+/////////////////////////////////////////////////////////////
+/// CPeerNode::CPeerNode
+/// @description Prepares a peer node for a uuid that has
+///   already been interned.
+/// @param id The handle of the uuid of the node
+/////////////////////////////////////////////////////////////
+CPeerNode::CPeerNode(PeerId id)
+    : m_id(id)
+    , m_uuid(&CPeerIdTable::Instance().GetUUID(id))
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
-
-////////////////////////////////////////////////////////////
-/// CPeerNode::GetUUID
-/// @description Returns the uuid of this peer node as a
-///              string.
-///	@return The uuid of the peer.
-/////////////////////////////////////////////////////////////
-std::string CPeerNode::GetUUID() const
+CPeerNode::CPeerNode()
+    : m_id(CPeerIdTable::NO_PEER)
+    , m_uuid(&CPeerIdTable::Instance().GetUUID(CPeerIdTable::NO_PEER))
 {
-    return m_uuid;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 /////////////////////////////////////////////////////////////
@@ -110,43 +116,105 @@ std::string CPeerNode::GetPort() const
 /// @post A message is sent to the peer represented by this
 ///   object
 /// @param msg the message to write to channel.
+/// @return True if the message was sent, false if the send
+///   queue to the peer is full and the message was dropped.
+/////////////////////////////////////////////////////////////
+bool CPeerNode::Send(const ModuleMessage& msg)
+{
+    return GetConnection()->Send(msg);
+}
+
+/////////////////////////////////////////////////////////////
+/// CPeerNode::Send
+/// @description Sends a message that has been serialized once
+///   so that it can be shared between several peers.
+/// @pre None
+/// @post A message is sent to the peer represented by this
+///   object
+/// @param msg the serialized message to write to channel.
+/// @return True if the message was sent.
+/////////////////////////////////////////////////////////////
+bool CPeerNode::Send(const boost::shared_ptr<const CSerializedMessage>& msg)
+{
+    return GetConnection()->Send(msg);
+}
+
+/////////////////////////////////////////////////////////////
+/// CPeerNode::Send
+/// @description Sends a message that the caller shares rather
+///   than copies. A message to this process is delivered as it
+///   is, so the caller must not change it afterwards.
+/// @pre None
+/// @post A message is sent to the peer represented by this
+///   object
+/// @param msg the message to write to channel.
 /// @return True if the message was sent.
 /////////////////////////////////////////////////////////////
-void CPeerNode::Send(const ModuleMessage& msg)
+bool CPeerNode::Send(const boost::shared_ptr<const ModuleMessage>& msg)
+{
+    return GetConnection()->Send(msg);
+}
+
+/////////////////////////////////////////////////////////////
+/// CPeerNode::GetConnection
+/// @description Finds the connection to the peer this object
+///   represents, creating it if needed.
+/// @pre None
+/// @post None
+/// @return The connection to the peer.
+/// @ErrorHandling Throws a std::runtime_error if the node is
+///   empty or the connection could not be made.
+/////////////////////////////////////////////////////////////
+boost::shared_ptr<CConnection> CPeerNode::GetConnection() const
 {
-    if(m_uuid.size() == 0)
+    if(m_id == CPeerIdTable::NO_PEER)
     {
         throw std::runtime_error("Couldn't send to peer, CPeerNode is empty");
     }
     boost::shared_ptr<CConnection> c
-            = CConnectionManager::Instance().GetConnectionByUUID(m_uuid);
-    if(c.get() != NULL)
-    {
-        c->Send(msg);
-    }
-    else
+            = CConnectionManager::Instance().GetConnection(m_id);
+    if(c.get() == NULL)
     {
-        Logger.Error << "Got empty pointer back for peer: "<<m_uuid<<std::endl;        
+        LOG_ERROR(Logger) << "Got empty pointer back for peer: "<<*m_uuid<<std::endl;        
         throw std::runtime_error("Couldn't send to peer, CConnectionManager returned empty pointer");
     }
+    return c;
+}
+
+/////////////////////////////////////////////////////////////
+/// CPeerNode::IsCongested
+/// @description Checks if the connection to the peer has more
+///   bulk messages than fit in the bulk lane's send window.
+///   Senders of bulk data can use this to hold back until the
+///   peer catches up.
+/// @pre None
+/// @post None
+/// @return True if messages are queued behind the send window.
+/////////////////////////////////////////////////////////////
+bool CPeerNode::IsCongested() const
+{
+    boost::shared_ptr<CConnection> c
+            = CConnectionManager::Instance().GetConnection(m_id);
+    return c.get() != NULL && c->IsCongested();
 }
 ///////////////////////////////////////////////////////////////////////////////
 /// @fn operator==
-/// @description Compares two peernodes.
+/// @description Compares two peernodes by their interned uuids.
 /// @return True if the peer nodes have the same uuid.
 ///////////////////////////////////////////////////////////////////////////////
 bool operator==(const CPeerNode& a, const CPeerNode& b)
 {
-  return (a.GetUUID() == b.GetUUID());
+  return (a.GetId() == b.GetId());
 }
 //////////////////////////////////////////////////////////////////////////////
 /// @fn operator<
 /// @description Provides a < operator for the maps these get stored in.
+///   The nodes keep the order of their uuids, which the handles do not have.
 /// @return True if a's uuid is < b's.
 /////////////////////////////////////////////////////////////////////////////
 bool operator<(const CPeerNode& a, const CPeerNode& b)
 {
-  return (a.GetUUID() < b.GetUUID());
+  return (a.GetId() != b.GetId() && a.GetUUID() < b.GetUUID());
 }
 
 } // namespace broker
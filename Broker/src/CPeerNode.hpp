@@ -25,12 +25,18 @@
 #ifndef CPEERNODE_HPP_
 #define CPEERNODE_HPP_
 
+#include "CPeerIdTable.hpp"
+
 #include <string>
 
+#include <boost/shared_ptr.hpp>
+
 namespace freedm {
 
 namespace broker {
 
+class CConnection;
+class CSerializedMessage;
 class ModuleMessage;
 
 /// Base interface for agents/broker modules
@@ -40,17 +46,30 @@ class CPeerNode
         /// Construct a peer node
         CPeerNode();
         /// Construct a peer node
-        CPeerNode(std::string uuid);
+        CPeerNode(const std::string& uuid);
+        /// Construct a peer node from an interned uuid
+        explicit CPeerNode(PeerId id);
         /// Gets the uuid of the node this addresses
-        std::string GetUUID() const;
+        const std::string& GetUUID() const { return *m_uuid; }
+        /// Gets the interned handle of the uuid
+        PeerId GetId() const { return m_id; }
         /// Gets the hostname of this peer
         std::string GetHostname() const;
         /// Gets the port of this peer.
         std::string GetPort() const;
         /// Sends a message to peer
-        void Send(const ModuleMessage& msg);
+        bool Send(const ModuleMessage& msg);
+        /// Sends a message serialized for several peers
+        bool Send(const boost::shared_ptr<const CSerializedMessage>& msg);
+        /// Sends a message the caller no longer changes, without copying it
+        bool Send(const boost::shared_ptr<const ModuleMessage>& msg);
+        /// Checks if messages to the peer are waiting for the send window
+        bool IsCongested() const;
     private:
-        std::string m_uuid; /// This node's uuid.
+        /// Gets the connection to the peer
+        boost::shared_ptr<CConnection> GetConnection() const;
+        PeerId m_id; /// The handle of this node's uuid.
+        const std::string* m_uuid; /// This node's interned uuid.
 };
 
 bool operator==(const CPeerNode& a, const CPeerNode& b);
@@ -0,0 +1,176 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CPhaseClock.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A timer for the phase boundaries on the monotonic clock
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CPhaseClock.hpp"
+
+#include "CLogger.hpp"
+#include "CVirtualClock.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Nanoseconds in a second
+const boost::int64_t NANOSECONDS = 1000000000;
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhaseClock::CPhaseClock
+/// @description Creates a phase clock without a timerfd.
+/// @pre None
+/// @post The clock can be opened.
+/// @param ios the io_service that waits on the timerfd.
+///////////////////////////////////////////////////////////////////////////////
+CPhaseClock::CPhaseClock(boost::asio::io_service& ios)
+    : m_descriptor(ios)
+    , m_spin(0, 0, 0)
+    , m_expirations(0)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhaseClock::Open
+/// @description Creates a non-blocking timerfd on CLOCK_MONOTONIC.
+/// @pre None
+/// @post The phase clock can be armed if it returns true.
+/// @param spin how long before each deadline the timerfd goes off.
+/// @return False if the timerfd could not be created.
+///////////////////////////////////////////////////////////////////////////////
+bool CPhaseClock::Open(boost::posix_time::time_duration spin)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0)
+    {
+        LOG_WARN(Logger)<<"Cannot create the phase timerfd: "
+            <<std::strerror(errno)<<std::endl;
+        return false;
+    }
+    m_descriptor.assign(fd);
+    m_spin = spin;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhaseClock::Arm
+/// @description Sets the timerfd to the monotonic time the virtual deadline
+///     falls on, less the spin tail. The monotonic time is read once, so the
+///     deadline does not move by the time it takes to arm the timer.
+/// @pre The clock is open and not armed.
+/// @post The handler is called at the deadline, unless the clock is closed
+///     first.
+/// @param deadline the virtual time the handler is due.
+/// @param handler the function to call at the deadline.
+///////////////////////////////////////////////////////////////////////////////
+void CPhaseClock::Arm(const boost::posix_time::ptime& deadline, Handler handler)
+{
+    m_deadline = deadline;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    boost::int64_t wait = CVirtualClock::ToReal(deadline
+        - CVirtualClock::Now() - m_spin).total_microseconds() * 1000;
+    // a zero expiry disarms the timerfd, so a due deadline expires at once
+    if(wait < 1)
+    {
+        wait = 1;
+    }
+    boost::int64_t expiry = now.tv_sec * NANOSECONDS + now.tv_nsec + wait;
+
+    itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = expiry / NANOSECONDS;
+    spec.it_value.tv_nsec = expiry % NANOSECONDS;
+    if(timerfd_settime(m_descriptor.native_handle(), TFD_TIMER_ABSTIME, &spec, 0) != 0)
+    {
+        LOG_ERROR(Logger)<<"Cannot arm the phase timerfd: "
+            <<std::strerror(errno)<<std::endl;
+    }
+
+    m_descriptor.async_read_some(
+        boost::asio::buffer(&m_expirations, sizeof(m_expirations)),
+        boost::bind(&CPhaseClock::HandleExpire, this,
+            boost::asio::placeholders::error, handler));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhaseClock::Close
+/// @description Cancels the wait on the timerfd and closes it.
+/// @pre None
+/// @post A pending handler is not called.
+///////////////////////////////////////////////////////////////////////////////
+void CPhaseClock::Close()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::system::error_code ec;
+    m_descriptor.close(ec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhaseClock::HandleExpire
+/// @description Waits out the spin tail on the CPU once the timerfd has gone
+///     off, then calls the handler.
+/// @pre The timerfd expired or the clock was closed.
+/// @post The handler has been called if the timerfd expired.
+/// @param e the error of the read of the timerfd.
+/// @param handler the function to call at the deadline.
+///////////////////////////////////////////////////////////////////////////////
+void CPhaseClock::HandleExpire(const boost::system::error_code& e, Handler handler)
+{
+    if(e)
+    {
+        if(e != boost::asio::error::operation_aborted)
+        {
+            LOG_ERROR(Logger)<<"Phase timerfd failed: "<<e.message()<<std::endl;
+        }
+        return;
+    }
+    if(!m_spin.is_zero())
+    {
+        while(CVirtualClock::Now() < m_deadline)
+        {
+        }
+    }
+    handler(e);
+}
+
+    } // namespace broker
+} // namespace freedm
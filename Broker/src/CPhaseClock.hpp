@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CPhaseClock.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A timer for the phase boundaries on the monotonic clock
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CPHASECLOCK_HPP
+#define CPHASECLOCK_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Wakes the scheduler at an absolute phase boundary with little jitter
+////////////////////////////////////////////////////////////////////////////////
+/// The deadline is set on a timerfd of CLOCK_MONOTONIC as an absolute time,
+/// so neither the time it takes to rearm the timer nor a step of the system
+/// clock moves the boundary, and the io_service waits on the descriptor like
+/// any other. The timer can go off a spin tail early; the remaining few
+/// hundred microseconds are then waited out on the CPU, which trades some
+/// processor time for a wakeup that does not depend on the kernel scheduler.
+////////////////////////////////////////////////////////////////////////////////
+class CPhaseClock
+    : private boost::noncopyable
+{
+public:
+    /// The handler called at the deadline
+    typedef boost::function<void (const boost::system::error_code&)> Handler;
+
+    /// Creates a phase clock on an io_service
+    explicit CPhaseClock(boost::asio::io_service& ios);
+
+    /// Creates the timerfd, false if the system has none
+    bool Open(boost::posix_time::time_duration spin);
+
+    /// True if the timerfd was created
+    bool IsOpen() const { return m_descriptor.is_open(); }
+
+    /// Calls the handler at a virtual time
+    void Arm(const boost::posix_time::ptime& deadline, Handler handler);
+
+    /// Closes the timerfd, dropping the pending handler
+    void Close();
+
+private:
+    /// Spins out the tail of the wait and calls the handler
+    void HandleExpire(const boost::system::error_code& e, Handler handler);
+
+    /// The timerfd, read when it expires
+    boost::asio::posix::stream_descriptor m_descriptor;
+
+    /// How long before the deadline the timerfd goes off
+    boost::posix_time::time_duration m_spin;
+
+    /// The virtual time the handler is due
+    boost::posix_time::ptime m_deadline;
+
+    /// The expiration count read from the timerfd
+    boost::uint64_t m_expirations;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CPHASECLOCK_HPP
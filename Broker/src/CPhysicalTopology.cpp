@@ -25,8 +25,21 @@
 #include "CLogger.hpp"
 
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <queue>
 #include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
 
 namespace freedm {
     namespace broker {
@@ -40,6 +53,122 @@ CLocalLogger Logger(__FILE__);
 /// A Prefix so that virtual names can't collide with real ones.
 static const std::string VNAME_PREFIX = "*VIRTUAL__";
 
+/// FID changes since the last query that are applied to its components
+/// rather than traversing the whole topology
+const std::size_t MAX_INCREMENTAL_FIDS = 4;
+
+/// FID states whose components are kept
+const std::size_t MAX_MEMOIZED_MASKS = 64;
+
+/// The first bytes of a file in the binary topology format
+const char TOPOLOGY_MAGIC[8] = { 'F', 'R', 'E', 'E', 'D', 'M', 'T', 'P' };
+
+/// The version of the binary topology format
+const boost::uint32_t TOPOLOGY_VERSION = 1;
+
+/// Reads differently from a file written on a machine of the other byte order
+const boost::uint32_t TOPOLOGY_BYTE_ORDER = 0x01020304;
+
+/// The header of a binary topology image. It is followed by the words of
+/// the vertex name offsets (vertices + 1), the FID name offsets (fids + 1),
+/// the first edge of each vertex (vertices + 1), the far vertex of each edge
+/// (edges), the first FID of each edge (edges + 1) and the FIDs of the edges
+/// (edge_fids), and then by the name_bytes of the names.
+struct STopologyHeader
+{
+    /// TOPOLOGY_MAGIC
+    char magic[8];
+    /// TOPOLOGY_BYTE_ORDER as the writer stored it
+    boost::uint32_t byte_order;
+    /// TOPOLOGY_VERSION
+    boost::uint32_t version;
+    /// The number of vertices
+    boost::uint32_t vertices;
+    /// The number of edges, counting each direction
+    boost::uint32_t edges;
+    /// The number of FIDs
+    boost::uint32_t fids;
+    /// The number of FIDs of all the edges together
+    boost::uint32_t edge_fids;
+    /// The length of the names
+    boost::uint32_t name_bytes;
+};
+
+/// A directed edge between two vertex indices
+typedef std::pair<boost::uint32_t, boost::uint32_t> IndexPair;
+
+/// An FID that controls a directed edge
+typedef std::pair<IndexPair, boost::uint32_t> IndexControl;
+
+///////////////////////////////////////////////////////////////////////////////
+/// NextToken
+/// @description Reads the next whitespace separated token of a text.
+/// @pre None
+/// @post pos is past the token.
+/// @param text The text to read.
+/// @param pos Where to start reading.
+/// @param token Set to the token that was read.
+/// @return False if the text has no more tokens.
+///////////////////////////////////////////////////////////////////////////////
+bool NextToken(const std::string& text, std::size_t& pos, std::string& token)
+{
+    while(pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+    {
+        pos++;
+    }
+    if(pos == text.size())
+    {
+        return false;
+    }
+    std::size_t start = pos;
+    while(pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos])))
+    {
+        pos++;
+    }
+    token.assign(text, start, pos - start);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Intern
+/// @description Numbers the virtual names of a text topology.
+/// @pre None
+/// @post The symbol is numbered.
+/// @param symbols The number of each symbol seen so far.
+/// @param names The symbols in number order.
+/// @param symbol The symbol to number.
+/// @return The number of the symbol.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t Intern(std::map<std::string, std::size_t>& symbols,
+    std::vector<std::string>& names, const std::string& symbol)
+{
+    std::map<std::string, std::size_t>::iterator it = symbols.find(symbol);
+    if(it != symbols.end())
+    {
+        return it->second;
+    }
+    symbols[symbol] = names.size();
+    names.push_back(symbol);
+    return names.size() - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// AppendWords
+/// @description Appends the words of an array to a topology image.
+/// @pre None
+/// @post The words are at the end of the image.
+/// @param image The image being written.
+/// @param words The words to append.
+///////////////////////////////////////////////////////////////////////////////
+void AppendWords(std::vector<char>& image, const std::vector<boost::uint32_t>& words)
+{
+    if(!words.empty())
+    {
+        const char* start = reinterpret_cast<const char*>(&words[0]);
+        image.insert(image.end(), start, start + words.size() * sizeof(boost::uint32_t));
+    }
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -59,12 +188,39 @@ CPhysicalTopology& CPhysicalTopology::Instance()
 /// @post LoadTopology has been called.
 ///////////////////////////////////////////////////////////////////////////////
 CPhysicalTopology::CPhysicalTopology()
+    : m_available(false)
+    , m_mapping(0)
+    , m_mappedlength(0)
+    , m_base(0)
+    , m_length(0)
+    , m_vertexcount(0)
+    , m_fidcount(0)
+    , m_vertexnames(0)
+    , m_fidnames(0)
+    , m_edgestart(0)
+    , m_edgeto(0)
+    , m_edgefidstart(0)
+    , m_edgefids(0)
+    , m_names(0)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    m_available = false;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadTopology();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::~CPhysicalTopology
+/// @description Unmaps the topology file, if one was mapped.
+/// @pre None
+/// @post The tables no longer point at the file.
+///////////////////////////////////////////////////////////////////////////////
+CPhysicalTopology::~CPhysicalTopology()
+{
+    if(m_mapping != 0)
+    {
+        munmap(m_mapping, m_mappedlength);
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CPhysicalTopology::IsAvailable
 /// @description Indicates whether or not a physical topology is available
@@ -78,270 +234,851 @@ bool CPhysicalTopology::IsAvailable()
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @description Find the reachable peers. Performs a BFS on the physical topology 
-/// starting at a source vertex. Nodes with FID are checked for the status of 
-/// their FID. If the FID status is unavailable or the FID is open, the edge is
-/// considered Broken
+/// @description Find the reachable peers. The topology is split into its
+/// connected components for the given FID states, with an edge broken if any
+/// FID that controls it is open or has an unknown state. The components are
+/// memoized per set of FID states, and when only a few FIDs changed since the
+/// last query they are updated from the last components instead of
+/// traversing the whole topology again.
 /// @pre A physical topology has been loaded.
-/// @post No change to class state.
+/// @post The components for fidstate are memoized.
 /// @returns A set of UUIDs of hostnames that are still reachable.
 /// @param source The initial vertex to perform BFS from.
 /// @param fidstate a map that is FID Name -> State. A closed FID is true, an
 ///     open FID is false. If an FID is open edges it controls are not used.
 ///////////////////////////////////////////////////////////////////////////////
-CPhysicalTopology::VertexSet CPhysicalTopology::ReachablePeers(std::string source,
-    CPhysicalTopology::FIDState fidstate)
+CPhysicalTopology::VertexSet CPhysicalTopology::ReachablePeers(const std::string& source,
+    const CPhysicalTopology::FIDState& fidstate)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    typedef std::pair<int, std::string> BFSExplorer;
-    typedef std::priority_queue< BFSExplorer > BFSPQueue;
-
-    BFSPQueue openset;
-    std::set<std::string> closedset;
-    std::set<std::string> solutionset;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock lock(m_mutex);
 
     // If the source isn't the adjacency list, let's throw an exception so
     // We can detect bad configurations, I assume that there's no instance
     // where you'd want a vertex (that is running ReachablePeers) to have
     // no possible reachable peers.
-    if(m_adjlist.count(source) == 0)
+    std::size_t vertex = FindName(m_vertexnames, m_vertexcount, source);
+    if(vertex == m_vertexcount)
     {
         // This will happen if you mistype a name in the topology config.
         throw std::runtime_error("Source node doesn't have any peers in adjacency list.");
     }
 
-    openset.push(BFSExplorer(0,source));
-    while(openset.size() > 0)
+    ComponentsPointer comps = Components(MaskFromState(fidstate));
+    std::size_t label = comps->label[vertex];
+    std::map<std::size_t, VertexSet>::iterator it = comps->peers.find(label);
+    if(it == comps->peers.end())
     {
-        BFSExplorer tmp = openset.top();
-        openset.pop();
-        std::string consider = tmp.second;
-        int hops = tmp.first;
-        closedset.insert(consider);
+        VertexSet& solutionset = comps->peers[label];
+        for(std::size_t i = 0; i < m_vertexcount; i++)
+        {
+            if(comps->label[i] == label && !m_virtual[i])
+            {
+                solutionset.insert(VertexName(i));
+            }
+        }
+        LOG_DEBUG(Logger)<<"Component of "<<source<<" has "<<solutionset.size()
+                    <<" peers"<<std::endl;
+        return solutionset;
+    }
+    return it->second;
+}
 
-        if(consider.find(VNAME_PREFIX) == std::string::npos)
-            solutionset.insert(consider);
-        
-        Logger.Debug<<"Considering "<<consider<<" ("<<hops<<" hops) ("
-                    <<m_adjlist[consider].size()<<" Neighbors)"<<std::endl;
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::AdjacentPeers
+/// @description Finds the neighbors of a vertex: the peers reached by a BFS
+///     that crosses virtual vertices but stops at the first peer on each path.
+///     Edges with an FID that is open or has an unknown state are not used.
+/// @pre A physical topology has been loaded.
+/// @post None
+/// @param source The vertex whose neighbors are wanted.
+/// @param fidstate a map that is FID Name -> State, true if closed.
+/// @return The UUIDs of the neighboring peers, empty for an unknown source.
+///////////////////////////////////////////////////////////////////////////////
+CPhysicalTopology::VertexSet CPhysicalTopology::AdjacentPeers(const std::string& source,
+    const CPhysicalTopology::FIDState& fidstate)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::mutex::scoped_lock lock(m_mutex);
 
-        BOOST_FOREACH( std::string neighbor, m_adjlist[consider] )
+    VertexSet neighbors;
+    std::size_t vertex = FindName(m_vertexnames, m_vertexcount, source);
+    if(vertex == m_vertexcount)
+    {
+        return neighbors;
+    }
+
+    FIDMask mask = MaskFromState(fidstate);
+    std::vector<bool> seen(m_vertexcount, false);
+    std::queue<std::size_t> openset;
+    openset.push(vertex);
+    seen[vertex] = true;
+    while(!openset.empty())
+    {
+        std::size_t consider = openset.front();
+        openset.pop();
+        for(std::size_t e = m_edgestart[consider]; e < m_edgestart[consider+1]; e++)
         {
-            Logger.Debug<<"Neighbor: "<<neighbor;
-            if(closedset.count(neighbor) > 0)
+            std::size_t to = m_edgeto[e];
+            if(seen[to] || !IsUsable(e, mask))
             {
-                Logger.Debug<<" closed!"<<std::endl;
                 continue;
             }
+            seen[to] = true;
+            if(!m_virtual[to])
+            {
+                neighbors.insert(VertexName(to));
+            }
             else
             {
-                Logger.Debug<<std::endl;
+                openset.push(to);
+            }
+        }
+    }
+    return neighbors;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::VertexName
+/// @description Gets the name of a vertex from the name table.
+/// @pre vertex is less than m_vertexcount.
+/// @post None
+/// @param vertex The index of the vertex.
+/// @return The UUID of the vertex, or its prefixed virtual name.
+///////////////////////////////////////////////////////////////////////////////
+std::string CPhysicalTopology::VertexName(std::size_t vertex) const
+{
+    return std::string(m_names + m_vertexnames[vertex],
+        m_vertexnames[vertex+1] - m_vertexnames[vertex]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::FindName
+/// @description Finds a name in a name table by binary search.
+/// @pre The names of the table are in sorted order.
+/// @post None
+/// @param offsets The offset of each name and the end of the last one.
+/// @param count The number of names in the table.
+/// @param name The name to find.
+/// @return The index of the name, or count if the table does not have it.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CPhysicalTopology::FindName(const Word* offsets, std::size_t count,
+    const std::string& name) const
+{
+    std::size_t low = 0, high = count;
+    while(low < high)
+    {
+        std::size_t mid = low + (high - low) / 2;
+        int order = name.compare(0, name.size(), m_names + offsets[mid],
+            offsets[mid+1] - offsets[mid]);
+        if(order == 0)
+        {
+            return mid;
+        }
+        else if(order < 0)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::MaskFromState
+/// @description Converts FID states by name to one bit per FID of the
+///     topology. FIDs missing from the topology are ignored.
+/// @pre A topology image is attached.
+/// @post None
+/// @param fidstate a map that is FID Name -> State, true if closed.
+/// @return The mask, with the FIDs of unknown state open.
+///////////////////////////////////////////////////////////////////////////////
+CPhysicalTopology::FIDMask CPhysicalTopology::MaskFromState(
+    const CPhysicalTopology::FIDState& fidstate) const
+{
+    FIDMask mask(m_fidcount, false);
+    BOOST_FOREACH( const FIDState::value_type& fid, fidstate )
+    {
+        if(!fid.second)
+        {
+            continue;
+        }
+        std::size_t index = FindName(m_fidnames, m_fidcount, fid.first);
+        if(index != m_fidcount)
+        {
+            mask[index] = true;
+        }
+    }
+    return mask;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::Components
+/// @description Finds the connected components for a mask. Memoized masks are
+///     returned as they are. Otherwise, if the mask differs from the last one
+///     queried in at most MAX_INCREMENTAL_FIDS FIDs, only the components next
+///     to those FIDs are changed: those split by an opened FID are traversed
+///     again and those joined by a closed FID are relabeled.
+/// @pre The caller holds m_mutex.
+/// @post The components of mask are memoized and mask is the last mask.
+/// @param mask The state of the FIDs.
+/// @return The components.
+///////////////////////////////////////////////////////////////////////////////
+CPhysicalTopology::ComponentsPointer CPhysicalTopology::Components(
+    const CPhysicalTopology::FIDMask& mask)
+{
+    std::map<FIDMask, ComponentsPointer>::iterator cached = m_components.find(mask);
+    if(cached != m_components.end())
+    {
+        m_lastmask = mask;
+        return cached->second;
+    }
+
+    std::vector<std::size_t> opened;
+    std::vector<std::size_t> closed;
+    for(std::size_t i = 0; i < mask.size(); i++)
+    {
+        if(mask[i] && !m_lastmask[i])
+            closed.push_back(i);
+        else if(!mask[i] && m_lastmask[i])
+            opened.push_back(i);
+    }
+
+    std::map<FIDMask, ComponentsPointer>::iterator last = m_components.find(m_lastmask);
+    ComponentsPointer comps(new SComponents);
+    std::vector<bool> seen(m_vertexcount, false);
+
+    if(last != m_components.end()
+        && opened.size() + closed.size() <= MAX_INCREMENTAL_FIDS)
+    {
+        comps->label = last->second->label;
+
+        // An opened FID may split the components next to it
+        std::set<std::size_t> split;
+        BOOST_FOREACH( std::size_t fid, opened )
+        {
+            BOOST_FOREACH( std::size_t v, m_fidvertices[fid] )
+            {
+                split.insert(comps->label[v]);
             }
-            CPhysicalTopology::VertexPair vx = CPhysicalTopology::VertexPair(consider,neighbor);
-            bool good_edge = true;
-            std::pair<FIDControlMap::iterator,FIDControlMap::iterator>
-                range = m_fidcontrol.equal_range(vx);
-            for(FIDControlMap::iterator it=range.first; it != range.second; it++)
+        }
+        if(!split.empty())
+        {
+            std::vector<std::size_t> label = comps->label;
+            for(std::size_t v = 0; v < m_vertexcount; v++)
             {
-                std::string controlfid = it->second;
-                // An FID controls this edge
-                if(fidstate.count(controlfid) == 0
-                    || fidstate[controlfid] == false)
+                if(!seen[v] && split.count(label[v]) > 0)
                 {
-                    // If we don't have the state of an FID, assume it is OPEN.
-                    // If the fid is OPEN (false) then that edge is not
-                    // available.
-                    Logger.Debug<<"Edge to "<<neighbor<<" is bad: "<<controlfid
-                                <<" Is Open or undefined"<<std::endl;
-                    good_edge = false;
-                    break;
+                    Explore(v, mask, *comps, seen);
                 }
             }
-            if(good_edge)
+        }
+
+        // A closed FID may join the components on either side of it
+        BOOST_FOREACH( std::size_t fid, closed )
+        {
+            BOOST_FOREACH( std::size_t v, m_fidvertices[fid] )
+            {
+                for(std::size_t e = m_edgestart[v]; e < m_edgestart[v+1]; e++)
+                {
+                    std::size_t from = comps->label[v];
+                    std::size_t to = comps->label[m_edgeto[e]];
+                    if(from == to || !IsUsable(e, mask))
+                        continue;
+                    for(std::size_t u = 0; u < m_vertexcount; u++)
+                    {
+                        if(comps->label[u] == to)
+                            comps->label[u] = from;
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        comps->label.assign(m_vertexcount, 0);
+        for(std::size_t v = 0; v < m_vertexcount; v++)
+        {
+            if(!seen[v])
+            {
+                Explore(v, mask, *comps, seen);
+            }
+        }
+    }
+
+    if(m_components.size() >= MAX_MEMOIZED_MASKS)
+    {
+        m_components.clear();
+    }
+    m_components[mask] = comps;
+    m_lastmask = mask;
+    return comps;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::IsUsable
+/// @description Checks the FIDs that control an edge.
+/// @pre None
+/// @post None
+/// @param edge The index of the edge to check.
+/// @param mask The state of the FIDs.
+/// @return True if no FID that controls the edge is open.
+///////////////////////////////////////////////////////////////////////////////
+bool CPhysicalTopology::IsUsable(std::size_t edge, const FIDMask& mask) const
+{
+    for(std::size_t i = m_edgefidstart[edge]; i < m_edgefidstart[edge+1]; i++)
+    {
+        if(!mask[m_edgefids[i]])
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::Explore
+/// @description Performs a BFS from a vertex and labels every vertex it
+///     reaches with the index of the start vertex.
+/// @pre None
+/// @post The component of start is labeled and marked as seen.
+/// @param start The vertex to explore from.
+/// @param mask The state of the FIDs.
+/// @param comps The components to label.
+/// @param seen The vertices labeled so far.
+///////////////////////////////////////////////////////////////////////////////
+void CPhysicalTopology::Explore(std::size_t start, const FIDMask& mask,
+    SComponents& comps, std::vector<bool>& seen) const
+{
+    std::queue<std::size_t> openset;
+    openset.push(start);
+    seen[start] = true;
+    while(!openset.empty())
+    {
+        std::size_t consider = openset.front();
+        openset.pop();
+        comps.label[consider] = start;
+        for(std::size_t e = m_edgestart[consider]; e < m_edgestart[consider+1]; e++)
+        {
+            std::size_t to = m_edgeto[e];
+            if(!seen[to] && IsUsable(e, mask))
+            {
+                seen[to] = true;
+                openset.push(to);
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::Attach
+/// @description Points the tables at a topology image after checking that
+///     every offset and index in it stays within the image, so a damaged
+///     file cannot make a traversal read outside of it. The FIDs of each edge
+///     are turned around into the vertices each FID controls.
+/// @pre The image outlives the topology.
+/// @post The tables point into the image and no components are memoized.
+/// @ErrorHandling Throws std::runtime_error if the image is malformed.
+/// @param image The start of the image, aligned for its words.
+/// @param length The length of the image.
+///////////////////////////////////////////////////////////////////////////////
+void CPhysicalTopology::Attach(const char* image, std::size_t length)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const std::string MALFORMED = "Physical Topology: Binary topology file is malformed.";
+    STopologyHeader header;
+    if(length < sizeof(header))
+    {
+        throw std::runtime_error(MALFORMED);
+    }
+    std::memcpy(&header, image, sizeof(header));
+    if(std::memcmp(header.magic, TOPOLOGY_MAGIC, sizeof(header.magic)) != 0
+        || header.byte_order != TOPOLOGY_BYTE_ORDER
+        || header.version != TOPOLOGY_VERSION)
+    {
+        throw std::runtime_error("Physical Topology: Unsupported binary topology file.");
+    }
+
+    boost::uint64_t words = boost::uint64_t(header.vertices) * 2 + 2
+        + boost::uint64_t(header.fids) + 1 + boost::uint64_t(header.edges) * 2 + 1
+        + header.edge_fids;
+    if(sizeof(header) + words * sizeof(Word) + header.name_bytes > length)
+    {
+        throw std::runtime_error(MALFORMED);
+    }
+
+    const Word* word = reinterpret_cast<const Word*>(image + sizeof(header));
+    const Word* vertexnames = word;
+    const Word* fidnames = vertexnames + header.vertices + 1;
+    const Word* edgestart = fidnames + header.fids + 1;
+    const Word* edgeto = edgestart + header.vertices + 1;
+    const Word* edgefidstart = edgeto + header.edges;
+    const Word* edgefids = edgefidstart + header.edges + 1;
+    const char* names = reinterpret_cast<const char*>(edgefids + header.edge_fids);
+
+    // The names must be sorted for FindName and within the image
+    const Word* tables[2] = { vertexnames, fidnames };
+    std::size_t counts[2] = { header.vertices, header.fids };
+    for(int t = 0; t < 2; t++)
+    {
+        if(tables[t][counts[t]] > header.name_bytes)
+        {
+            throw std::runtime_error(MALFORMED);
+        }
+        for(std::size_t i = 0; i < counts[t]; i++)
+        {
+            if(tables[t][i] > tables[t][i+1])
+            {
+                throw std::runtime_error(MALFORMED);
+            }
+            if(i > 0 && std::string(names + tables[t][i-1], tables[t][i] - tables[t][i-1])
+                >= std::string(names + tables[t][i], tables[t][i+1] - tables[t][i]))
             {
-                Logger.Debug<<"Node "<<neighbor<<" is reachable"<<std::endl;
-                // This edge is not controlled by an FID, assume it is open.
-                openset.push(BFSExplorer(hops+1, neighbor));
+                throw std::runtime_error(MALFORMED);
             }
         }
-    } 
-    return solutionset;
+    }
+    if(edgestart[0] != 0 || edgestart[header.vertices] != header.edges
+        || edgefidstart[0] != 0 || edgefidstart[header.edges] != header.edge_fids)
+    {
+        throw std::runtime_error(MALFORMED);
+    }
+    for(std::size_t v = 0; v < header.vertices; v++)
+    {
+        if(edgestart[v] > edgestart[v+1])
+        {
+            throw std::runtime_error(MALFORMED);
+        }
+    }
+    for(std::size_t e = 0; e < header.edges; e++)
+    {
+        if(edgeto[e] >= header.vertices || edgefidstart[e] > edgefidstart[e+1])
+        {
+            throw std::runtime_error(MALFORMED);
+        }
+    }
+    for(std::size_t i = 0; i < header.edge_fids; i++)
+    {
+        if(edgefids[i] >= header.fids)
+        {
+            throw std::runtime_error(MALFORMED);
+        }
+    }
+
+    m_base = image;
+    m_length = length;
+    m_vertexcount = header.vertices;
+    m_fidcount = header.fids;
+    m_vertexnames = vertexnames;
+    m_fidnames = fidnames;
+    m_edgestart = edgestart;
+    m_edgeto = edgeto;
+    m_edgefidstart = edgefidstart;
+    m_edgefids = edgefids;
+    m_names = names;
+
+    m_virtual.assign(m_vertexcount, false);
+    m_fidvertices.assign(m_fidcount, std::vector<std::size_t>());
+    for(std::size_t v = 0; v < m_vertexcount; v++)
+    {
+        m_virtual[v] = VertexName(v).find(VNAME_PREFIX) != std::string::npos;
+        for(std::size_t e = m_edgestart[v]; e < m_edgestart[v+1]; e++)
+        {
+            for(std::size_t i = m_edgefidstart[e]; i < m_edgefidstart[e+1]; i++)
+            {
+                std::vector<std::size_t>& controlled = m_fidvertices[m_edgefids[i]];
+                if(controlled.empty() || controlled.back() != v)
+                {
+                    controlled.push_back(v);
+                }
+            }
+        }
+    }
+    m_components.clear();
+    m_lastmask.assign(m_fidcount, false);
+    LOG_DEBUG(Logger)<<"Indexed "<<m_vertexcount<<" vertices, "<<header.edges
+                <<" edges and "<<m_fidcount<<" FIDs"<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::Segments
+/// @description Splits the topology into feeder segments: the sets of peers
+///     that can reach each other whatever the state of the FIDs. Every edge
+///     an FID controls separates two segments.
+/// @pre A physical topology has been loaded.
+/// @post No change to class state.
+/// @return The UUIDs of the peers in each segment. Segments with only
+///     virtual vertices are left out.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<CPhysicalTopology::VertexSet> CPhysicalTopology::Segments()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::vector<VertexSet> segments;
+    VertexSet placed;
+
+    for(std::size_t v = 0; v < m_vertexcount; v++)
+    {
+        std::string name = VertexName(v);
+        if(m_virtual[v] || placed.count(name) > 0)
+        {
+            continue;
+        }
+        // With no FID states known, every FID is taken to be open
+        VertexSet segment = ReachablePeers(name, FIDState());
+        placed.insert(segment.begin(), segment.end());
+        segments.push_back(segment);
+    }
+    return segments;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CPhysicalTopology::LoadTopology
-/// @description Load the topology from a file
+/// @description Load the topology from a file. A file that starts with
+///     TOPOLOGY_MAGIC is mapped, any other file is parsed as text.
 /// @pre The topology is correctly specified in a topology config file. The
 ///     CGlobalConfiguration class has an entry loaded with a working path to
 ///     the topology file.
-/// @post The topology is loaded into the related maps: the adjacency list is
-///     loaded into m_adjlist, and the map of which edges FIDs control is
-///     loaded into m_fidcontrol.
+/// @post The tables point at the image of the topology.
 /// @returns None
 ///////////////////////////////////////////////////////////////////////////////
 void CPhysicalTopology::LoadTopology()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    const std::string EDGE_TOKEN = "edge";
-    const std::string VERTEX_TOKEN = "sst";
-    const std::string CONTROL_TOKEN = "fid";
-    
-    CPhysicalTopology::AdjacencyListMap altmp;
-    CPhysicalTopology::FIDControlMap fctmp;
-    CPhysicalTopology::VertexSet seennames;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     std::string fp = CGlobalConfiguration::Instance().GetTopologyConfigPath();
     if(fp == "")
     {
-        Logger.Warn<<"No topology configuration file specified"<<std::endl;
+        LOG_WARN(Logger)<<"No topology configuration file specified"<<std::endl;
         return;
     }
-    std::ifstream topf(fp.c_str());
 
-    std::string token;
-    
+    char magic[sizeof(TOPOLOGY_MAGIC)];
+    std::ifstream topf(fp.c_str(), std::ios::in | std::ios::binary);
     if(!topf.is_open())
     {
         //raise exception, couldn't open topology.
         throw std::runtime_error("Physical Topology: Couldn't open topology file.");
     }
+    bool binary = topf.read(magic, sizeof(magic))
+        && std::memcmp(magic, TOPOLOGY_MAGIC, sizeof(magic)) == 0;
+    topf.close();
+
+    if(binary)
+    {
+        MapTopology(fp);
+    }
+    else
+    {
+        ImportTopology(fp);
+    }
+    // Done, yay!
+    m_available = true; // Mark that a topology loaded successfully.
+    LOG_INFO(Logger)<<"Loaded the topology of "<<m_vertexcount<<" vertices from "
+                <<fp<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::MapTopology
+/// @description Maps a file in the binary topology format. The pages of the
+///     file are shared with the page cache and read in as they are used.
+/// @pre The file starts with TOPOLOGY_MAGIC.
+/// @post The tables point into the mapped file.
+/// @ErrorHandling Throws std::runtime_error if the file cannot be mapped or
+///     is malformed.
+/// @param path The topology file.
+///////////////////////////////////////////////////////////////////////////////
+void CPhysicalTopology::MapTopology(const std::string& path)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::string error = std::strerror(errno);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error("Physical Topology: Couldn't open topology file: "
+            + error);
+    }
+
+    std::size_t length = info.st_size;
+    void* base = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        throw std::runtime_error("Physical Topology: Couldn't map topology file.");
+    }
+
+    try
+    {
+        Attach(static_cast<const char*>(base), length);
+    }
+    catch(std::exception&)
+    {
+        munmap(base, length);
+        throw;
+    }
+    m_mapping = base;
+    m_mappedlength = length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CPhysicalTopology::ImportTopology
+/// @description Parses a file in the text topology format. The names are
+///     numbered as they are read, and the edges and controls are kept as
+///     pairs of numbers. They are sorted into the image once the whole file
+///     is read, since an sst line may follow the edges that name it.
+/// @pre None
+/// @post The tables point at m_image.
+/// @ErrorHandling Throws std::runtime_error if the file is malformed.
+/// @param path The topology file.
+///////////////////////////////////////////////////////////////////////////////
+void CPhysicalTopology::ImportTopology(const std::string& path)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    const std::string EDGE_TOKEN = "edge";
+    const std::string VERTEX_TOKEN = "sst";
+    const std::string CONTROL_TOKEN = "fid";
+
+    std::map<std::string, std::size_t> symbols;
+    std::vector<std::string> symbolnames;
+    std::map<std::string, std::string> strans; // Fake to real translation table
+    std::vector< std::pair<std::size_t, std::size_t> > edges;
+    std::vector< std::pair<std::pair<std::size_t, std::size_t>, std::string> > controls;
+    std::vector<bool> onedge;
+
+    std::string text;
+    {
+        std::ifstream topf(path.c_str(), std::ios::in | std::ios::binary);
+        if(!topf.is_open())
+        {
+            throw std::runtime_error("Physical Topology: Couldn't open topology file.");
+        }
+        std::ostringstream contents;
+        contents << topf.rdbuf();
+        text = contents.str();
+    }
 
     // Read from the input file
-    while(topf >> token)
+    std::size_t pos = 0;
+    std::string token, v_symbol1, v_symbol2, third;
+    while(NextToken(text, pos, token))
     {
         if(token == EDGE_TOKEN)
         {
-            std::string v_symbol1;
-            std::string v_symbol2;
-            if(!(topf>>v_symbol1>>v_symbol2))
+            if(!NextToken(text, pos, v_symbol1) || !NextToken(text, pos, v_symbol2))
             {
                 throw std::runtime_error("Failed Reading Edge Topology Entry (EOF?)");
             }
-            Logger.Debug<<"Got Edge: "<<v_symbol1<<","<<v_symbol2<<std::endl;
-
-            if(!altmp.count(v_symbol1))
-                altmp[v_symbol1] = VertexSet();
-            if(!altmp.count(v_symbol2))
-                altmp[v_symbol2] = VertexSet();
-            
-            //Bi directional!
-            altmp[v_symbol1].insert(v_symbol2);
-            altmp[v_symbol2].insert(v_symbol1);
-
-            seennames.insert(v_symbol1);
-            seennames.insert(v_symbol2);
+            LOG_DEBUG(Logger)<<"Got Edge: "<<v_symbol1<<","<<v_symbol2<<std::endl;
+            std::size_t a = Intern(symbols, symbolnames, v_symbol1);
+            std::size_t b = Intern(symbols, symbolnames, v_symbol2);
+            edges.push_back(std::make_pair(a, b));
+            onedge.resize(symbolnames.size(), false);
+            onedge[a] = onedge[b] = true;
         }
         else if(token == VERTEX_TOKEN)
         {
-            std::string uuid;
-            std::string vsymbol;
-            if(!(topf>>vsymbol>>uuid))
+            if(!NextToken(text, pos, v_symbol1) || !NextToken(text, pos, third))
             {
                 throw std::runtime_error("Failed Reading Vertex Topology Entry (EOF?)");
             }
-            m_strans[vsymbol] = uuid;
-            Logger.Debug<<"Got Vertex: "<<vsymbol<<"->"<<uuid<<std::endl;
+            strans[v_symbol1] = third;
+            LOG_DEBUG(Logger)<<"Got Vertex: "<<v_symbol1<<"->"<<third<<std::endl;
         }
         else if(token == CONTROL_TOKEN)
         {
-            std::string v_symbol1;
-            std::string v_symbol2;
-            std::string fidname;
-            VertexPair vx1, vx2;
-
-            if(!(topf>>v_symbol1>>v_symbol2>>fidname))
+            if(!NextToken(text, pos, v_symbol1) || !NextToken(text, pos, v_symbol2)
+                || !NextToken(text, pos, third))
             {
                 throw std::runtime_error("Failed Reading Control Topology Entry (EOF?)");
             }
-            Logger.Debug<<"Got Control: "<<v_symbol1<<","<<v_symbol2<<" via "<<fidname<<std::endl;
-            // Bi directional!
-            vx1 = VertexPair(v_symbol1, v_symbol2);
-            vx2 = VertexPair(v_symbol2, v_symbol1);
-
-            fctmp.insert(FIDControlMap::value_type(vx1,fidname));
-            fctmp.insert(FIDControlMap::value_type(vx2,fidname));
-            
-            seennames.insert(v_symbol1);
-            seennames.insert(v_symbol2);
+            LOG_DEBUG(Logger)<<"Got Control: "<<v_symbol1<<","<<v_symbol2<<" via "<<third<<std::endl;
+            std::size_t a = Intern(symbols, symbolnames, v_symbol1);
+            std::size_t b = Intern(symbols, symbolnames, v_symbol2);
+            controls.push_back(std::make_pair(std::make_pair(a, b), third));
         }
         else
         {
-            Logger.Error<<"Expected control token, saw '"<<token<<"'"<<std::endl;
+            LOG_ERROR(Logger)<<"Expected control token, saw '"<<token<<"'"<<std::endl;
             // raise exception, malformed input
             throw std::runtime_error("Physical Topology: Input topology file is malformed.");
         }
-        token = "";
     }
-    topf.close();
+    text.clear();
+    onedge.resize(symbolnames.size(), false);
 
-    // Verify that all the virtual names have a real translation.
-    // bool all_valid = true;
-    BOOST_FOREACH( std::string vname, seennames )
+    // Translate the virtual names into the real ones. A name without an sst
+    // line keeps its virtual name behind VNAME_PREFIX.
+    std::vector<std::string> realnames(symbolnames.size());
+    std::vector<std::string> vertices;
+    for(std::size_t i = 0; i < symbolnames.size(); i++)
     {
-        if(m_strans.count(vname) == 0)
+        std::map<std::string, std::string>::const_iterator it = strans.find(symbolnames[i]);
+        if(it == strans.end())
         {
-            //all_valid = false;
             // Warn user about bad name.
-            Logger.Status<<"Couldn't find UUID for virtualname: "<<vname<<" (Might be OK)"<<std::endl;
+            LOG_STATUS(Logger)<<"Couldn't find UUID for virtualname: "<<symbolnames[i]<<" (Might be OK)"<<std::endl;
+            realnames[i] = VNAME_PREFIX + symbolnames[i];
+        }
+        else
+        {
+            realnames[i] = it->second;
+        }
+        if(onedge[i])
+        {
+            vertices.push_back(realnames[i]);
         }
     }
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
 
-    /* Turns out, we don't want this.
-    if(all_valid == false)
+    std::vector<std::size_t> vertexof(symbolnames.size(), vertices.size());
+    for(std::size_t i = 0; i < symbolnames.size(); i++)
     {
-        // raise exception missing real name.
-        throw std::runtime_error("Physical Topology: UUID for virtual name missing.");
+        if(onedge[i])
+        {
+            vertexof[i] = std::lower_bound(vertices.begin(), vertices.end(),
+                realnames[i]) - vertices.begin();
+        }
+    }
+
+    //Bi directional!
+    std::vector<IndexPair> directed;
+    directed.reserve(edges.size() * 2);
+    for(std::size_t i = 0; i < edges.size(); i++)
+    {
+        Word a = vertexof[edges[i].first], b = vertexof[edges[i].second];
+        directed.push_back(IndexPair(a, b));
+        directed.push_back(IndexPair(b, a));
     }
-    */
+    std::sort(directed.begin(), directed.end());
+    directed.erase(std::unique(directed.begin(), directed.end()), directed.end());
 
-    // Now we have to take the temporary ones and translate that into the real ones (Ugh!)
-    BOOST_FOREACH( const AdjacencyListMap::value_type& mp, altmp )
+    std::vector<std::string> fids;
+    for(std::size_t i = 0; i < controls.size(); i++)
     {
-        std::string name = RealNameFromVirtual(mp.first);
-        VertexSet t = mp.second;
-        VertexSet n;
-        BOOST_FOREACH( std::string vname, t )
+        fids.push_back(controls[i].second);
+    }
+    std::sort(fids.begin(), fids.end());
+    fids.erase(std::unique(fids.begin(), fids.end()), fids.end());
+
+    // Mark how edges are controlled, in both directions
+    std::vector<IndexControl> controlled;
+    for(std::size_t i = 0; i < controls.size(); i++)
+    {
+        std::size_t a = vertexof[controls[i].first.first];
+        std::size_t b = vertexof[controls[i].first.second];
+        if(a == vertices.size() || b == vertices.size())
         {
-            std::string name2 = RealNameFromVirtual(vname);
-            n.insert(name2);
+            continue;
         }
-        m_adjlist[name] = n;
+        Word fid = std::lower_bound(fids.begin(), fids.end(), controls[i].second)
+            - fids.begin();
+        controlled.push_back(IndexControl(IndexPair(a, b), fid));
+        controlled.push_back(IndexControl(IndexPair(b, a), fid));
     }
+    std::sort(controlled.begin(), controlled.end());
+    controlled.erase(std::unique(controlled.begin(), controlled.end()), controlled.end());
 
-    // Mark how edges are controlled.
-    BOOST_FOREACH( const FIDControlMap::value_type& mp, fctmp )
+    // Lay out the rows of the edges and of their FIDs
+    std::vector<Word> edgestart(vertices.size() + 1, 0);
+    std::vector<Word> edgeto, edgefidstart, edgefids;
+    edgeto.reserve(directed.size());
+    edgefidstart.reserve(directed.size() + 1);
+    std::size_t next = 0;
+    for(std::size_t e = 0; e < directed.size(); e++)
     {
-        std::string namea = RealNameFromVirtual(mp.first.first);
-        std::string nameb = RealNameFromVirtual(mp.first.second);
-        std::string fidname = mp.second;
-        // Bidirectional
-        m_fidcontrol.insert(FIDControlMap::value_type(VertexPair(namea,nameb), fidname));        
-        m_fidcontrol.insert(FIDControlMap::value_type(VertexPair(nameb,namea), fidname));        
+        edgestart[directed[e].first + 1]++;
+        edgeto.push_back(directed[e].second);
+        edgefidstart.push_back(edgefids.size());
+        while(next < controlled.size() && controlled[next].first < directed[e])
+        {
+            next++;
+        }
+        while(next < controlled.size() && controlled[next].first == directed[e])
+        {
+            edgefids.push_back(controlled[next].second);
+            next++;
+        }
     }
-    // Done, yay!
-    m_available = true; // Mark that a topology loaded successfully.    
+    edgefidstart.push_back(edgefids.size());
+    for(std::size_t v = 0; v < vertices.size(); v++)
+    {
+        edgestart[v+1] += edgestart[v];
+    }
+
+    std::string names;
+    std::vector<Word> vertexnames, fidnames;
+    BOOST_FOREACH( const std::string& name, vertices )
+    {
+        vertexnames.push_back(names.size());
+        names += name;
+    }
+    vertexnames.push_back(names.size());
+    BOOST_FOREACH( const std::string& name, fids )
+    {
+        fidnames.push_back(names.size());
+        names += name;
+    }
+    fidnames.push_back(names.size());
+
+    STopologyHeader header;
+    std::memcpy(header.magic, TOPOLOGY_MAGIC, sizeof(header.magic));
+    header.byte_order = TOPOLOGY_BYTE_ORDER;
+    header.version = TOPOLOGY_VERSION;
+    header.vertices = vertices.size();
+    header.edges = edgeto.size();
+    header.fids = fids.size();
+    header.edge_fids = edgefids.size();
+    header.name_bytes = names.size();
+
+    m_image.clear();
+    m_image.insert(m_image.end(), reinterpret_cast<const char*>(&header),
+        reinterpret_cast<const char*>(&header + 1));
+    AppendWords(m_image, vertexnames);
+    AppendWords(m_image, fidnames);
+    AppendWords(m_image, edgestart);
+    AppendWords(m_image, edgeto);
+    AppendWords(m_image, edgefidstart);
+    AppendWords(m_image, edgefids);
+    m_image.insert(m_image.end(), names.begin(), names.end());
+    Attach(&m_image[0], m_image.size());
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// CPhysicalTopology::RealNameFromVirtual
-/// @description Translates a virtual edge name to a real one.
-/// @pre The m_strans member property has been populated (happens as part of
-///     the topology loading process)
-/// @post Returns the real name of the node in the physical topology.
-/// @return The real name of the node in the physical topology. If the node
-///     is named by an SST entry, it gives that name. Otherwise it is the
-///     virtual name prepended by the VNAME_PREFIX.
-/// @param vname the virtual name to look up.
+/// CPhysicalTopology::SaveTopology
+/// @description Writes the image of the loaded topology to a file, which
+///     can then be given as the topology-config to be mapped at startup
+///     instead of parsed. The file is only readable on machines with the
+///     byte order of this one.
+/// @pre A physical topology has been loaded.
+/// @post The file holds the topology in the binary topology format.
+/// @ErrorHandling Throws std::runtime_error if no topology is loaded or the
+///     file cannot be written.
+/// @param path The file to write.
 ///////////////////////////////////////////////////////////////////////////////
-std::string CPhysicalTopology::RealNameFromVirtual(std::string vname)
+void CPhysicalTopology::SaveTopology(const std::string& path)
 {
-    if(m_strans.count(vname))
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_available)
+    {
+        throw std::runtime_error("Physical Topology: No topology is loaded.");
+    }
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.write(m_base, m_length) || !out.flush())
     {
-        return m_strans[vname];
+        throw std::runtime_error("Physical Topology: Couldn't write " + path);
     }
-    return VNAME_PREFIX+vname;
+    LOG_NOTICE(Logger)<<"Wrote the topology of "<<m_vertexcount<<" vertices to "
+                <<path<<std::endl;
 }
 
     } // namespace broker
 } // namespace freedm
-
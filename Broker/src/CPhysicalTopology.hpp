@@ -23,10 +23,15 @@
 #ifndef FREEDM_PHYSICAL_TOPOLOGY_HPP
 #define FREEDM_PHYSICAL_TOPOLOGY_HPP
 
+#include <boost/cstdint.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstddef>
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace freedm {
     namespace broker {
@@ -36,46 +41,118 @@ namespace freedm {
 /// Provides the physical topology of the power system. It gets read from a
 /// file. There is documentation on the wiki. 
 ///
-/// It's really important that we have this long documentation, even though
-/// there is nothing to say that would actually be helpful: look at the only
-/// (public) function in this class.
+/// The topology is held as one image: the vertex and FID names in sorted
+/// tables, the edges leaving each vertex as a compressed sparse row, and the
+/// FIDs of each edge as a second one. A file in the binary topology format is
+/// that image and is mapped as it is. A text file is parsed into an image in
+/// memory, which SaveTopology can write out so the next start maps it.
 ///////////////////////////////////////////////////////////////////////////////
 class CPhysicalTopology : private boost::noncopyable
 {
 public:
-    typedef std::pair< std::string, std::string > VertexPair;
     typedef std::set<std::string> VertexSet;
-    typedef std::map<std::string, VertexSet > AdjacencyListMap;
-    typedef std::multimap<VertexPair,  std::string> FIDControlMap;
     typedef std::map<std::string, bool> FIDState;
 
     /// Get the singleton instance of this class
     static CPhysicalTopology& Instance();
 	
     /// Find the reachable peers.
-    VertexSet ReachablePeers(std::string source, FIDState fidstate);
+    VertexSet ReachablePeers(const std::string& source, const FIDState& fidstate);
+
+    /// Find the nearest peers that can be reached without another peer between.
+    VertexSet AdjacentPeers(const std::string& source, const FIDState& fidstate);
+
+    /// Split the topology into the segments bounded by FIDs.
+    std::vector<VertexSet> Segments();
 
     /// Returns if the physical topology is available.
     bool IsAvailable();
 
+    /// Writes the loaded topology in the binary topology format.
+    void SaveTopology(const std::string& path);
+
 private:
+    /// The state of every FID of the topology, true if closed
+    typedef std::vector<bool> FIDMask;
+
+    /// A word of the topology image
+    typedef boost::uint32_t Word;
+
+    /// The connected components of the topology for one FIDMask
+    struct SComponents
+    {
+        /// For each vertex, the index of a vertex of its component
+        std::vector<std::size_t> label;
+        /// The real names in each component, filled in when asked for
+        std::map<std::size_t, VertexSet> peers;
+    };
+
+    typedef boost::shared_ptr<SComponents> ComponentsPointer;
+
     /// Private constructor for the singleton instance
     CPhysicalTopology();
 
+    /// Unmaps the topology file
+    ~CPhysicalTopology();
+
+    /// Points the tables at a topology image and checks them
+    void Attach(const char* image, std::size_t length);
+
+    /// Gets the name of a vertex
+    std::string VertexName(std::size_t vertex) const;
+
+    /// Finds a name in a sorted name table
+    std::size_t FindName(const Word* offsets, std::size_t count,
+        const std::string& name) const;
+
+    /// Converts FID states by name to a mask over the topology's FIDs
+    FIDMask MaskFromState(const FIDState& fidstate) const;
+
+    /// Gets the components for a mask, computing them if needed
+    ComponentsPointer Components(const FIDMask& mask);
+
+    /// True if every FID that controls the edge is closed
+    bool IsUsable(std::size_t edge, const FIDMask& mask) const;
+
+    /// Labels the component of a vertex by a traversal
+    void Explore(std::size_t start, const FIDMask& mask, SComponents& comps,
+        std::vector<bool>& seen) const;
+
     /// Load the topology from a file
     void LoadTopology();
 
-    /// Gets the realname from the virtual name
-    std::string RealNameFromVirtual(std::string vname);
+    /// Maps a file in the binary topology format
+    void MapTopology(const std::string& path);
+
+    /// Parses a file in the text topology format into an image
+    void ImportTopology(const std::string& path);
 
-    AdjacencyListMap m_adjlist; /// Structure of physical layer
-    FIDControlMap m_fidcontrol; /// Which edges FIDs control.
     bool m_available; /// If a physical topology has been loaded
-    std::map<std::string, std::string> m_strans; /// Fake to real translation table
+
+    std::vector<char> m_image; /// The image of an imported text file
+    void* m_mapping; /// The mapped binary file, or null
+    std::size_t m_mappedlength; /// The length of the mapped file
+    const char* m_base; /// The start of the image
+    std::size_t m_length; /// The length of the image
+
+    std::size_t m_vertexcount; /// The number of vertices
+    std::size_t m_fidcount; /// The number of FIDs
+    const Word* m_vertexnames; /// Offset of each vertex name, in name order
+    const Word* m_fidnames; /// Offset of each FID name, in name order
+    const Word* m_edgestart; /// First edge leaving each vertex
+    const Word* m_edgeto; /// The vertex at the other end of each edge
+    const Word* m_edgefidstart; /// First FID of each edge
+    const Word* m_edgefids; /// The FIDs that must be closed to use each edge
+    const char* m_names; /// The text of the names
+    std::vector<bool> m_virtual; /// True for the vertices without an SST
+    /// For each FID, the vertices with an edge the FID controls
+    std::vector< std::vector<std::size_t> > m_fidvertices;
+    std::map<FIDMask, ComponentsPointer> m_components; /// Memoized components
+    FIDMask m_lastmask; /// The mask of the last query
+    boost::mutex m_mutex; /// Guards the memoized components
 };
 
     } // namespace broker
 } // namespace freedm
 
 #endif // FREEDM_PHYSICAL_TOPOLOGY_HPP
-
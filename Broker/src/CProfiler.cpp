@@ -0,0 +1,397 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CProfiler.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A low rate sampling profiler built into the DGI
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CProfiler.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The slots of the sample table, a power of two
+const std::size_t SAMPLE_SLOTS = 16384;
+
+/// How many slots a sample is tried in before it is dropped
+const std::size_t SAMPLE_PROBES = 32;
+
+/// The bits of a table key that hold the program counter
+const boost::uint64_t PC_MASK = (boost::uint64_t(1) << 48) - 1;
+
+/// The bit of the tag set for a sample taken inside a scheduler task
+const boost::uint64_t TASK_TAG = 0x8000;
+
+/// A program counter and its tag, and the times it was sampled
+struct SSample
+{
+    /// The program counter in the low bits, the tag above, 0 if free
+    volatile boost::uint64_t key;
+    /// The times the key was sampled
+    volatile boost::uint64_t count;
+};
+
+/// The samples, updated by the signal handler
+SSample Samples[SAMPLE_SLOTS];
+
+/// The samples that found no free slot
+volatile boost::uint64_t Dropped = 0;
+
+/// The active phase plus one, 0 before the first phase
+volatile boost::uint64_t ActivePhase = 0;
+
+/// Set while a scheduler task runs
+volatile int TaskRunning = 0;
+
+/// The thread that runs the scheduler task
+pthread_t TaskThread;
+
+/// Reads the program counter of an interrupted thread
+boost::uint64_t ProgramCounter(void* context)
+{
+    ucontext_t* uc = static_cast<ucontext_t*>(context);
+#if defined(__x86_64__)
+    return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return uc->uc_mcontext.pc;
+#elif defined(__arm__)
+    return uc->uc_mcontext.arm_pc;
+#else
+    (void)uc;
+    return 0;
+#endif
+}
+
+/// Records the program counter of the interrupted thread
+void HandleProfile(int, siginfo_t*, void* context)
+{
+    boost::uint64_t tag = ActivePhase;
+    if(TaskRunning && pthread_equal(TaskThread, pthread_self()))
+    {
+        tag |= TASK_TAG;
+    }
+    boost::uint64_t key = (ProgramCounter(context) & PC_MASK) | (tag << 48);
+    if(key == 0)
+    {
+        return;
+    }
+
+    std::size_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 50;
+    for(std::size_t probe = 0; probe < SAMPLE_PROBES; probe++)
+    {
+        SSample& sample = Samples[(slot + probe) & (SAMPLE_SLOTS - 1)];
+        if(sample.key == 0)
+        {
+            __sync_bool_compare_and_swap(&sample.key, 0, key);
+        }
+        if(sample.key == key)
+        {
+            __sync_fetch_and_add(&sample.count, 1);
+            return;
+        }
+    }
+    __sync_fetch_and_add(&Dropped, 1);
+}
+
+/// Names the function a program counter is in
+std::string FunctionName(boost::uint64_t pc)
+{
+    Dl_info info;
+    if(dladdr(reinterpret_cast<void*>(pc), &info) == 0 || info.dli_sname == 0)
+    {
+        if(info.dli_fname != 0)
+        {
+            return std::string("?? in ") + info.dli_fname;
+        }
+        return "??";
+    }
+    int status;
+    char* name = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+    std::string result = (status == 0 && name != 0) ? name : info.dli_sname;
+    std::free(name);
+    return result;
+}
+
+/// Orders the aggregated functions by their sample counts, largest first
+bool BySamples(const std::pair<std::string, boost::uint64_t>& a,
+    const std::pair<std::string, boost::uint64_t>& b)
+{
+    return a.second > b.second;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::Instance
+/// @description Access the singleton instance of the profiler
+/// @pre None
+/// @post None
+/// @return A reference to the profiler.
+///////////////////////////////////////////////////////////////////////////////
+CProfiler& CProfiler::Instance()
+{
+    static CProfiler instance;
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::CProfiler
+/// @description Creates a profiler that does not sample.
+/// @pre None
+/// @post The profile is empty.
+///////////////////////////////////////////////////////////////////////////////
+CProfiler::CProfiler()
+    : m_timer(0)
+    , m_phases(1, "none")
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::Start
+/// @description Installs the SIGPROF handler and arms a timer on the CPU time
+///     of the process at the configured rate, and waits for SIGUSR2 on the
+///     given io_service to dump the profile.
+/// @ErrorHandling A timer that cannot be created is logged and the program
+///     is not sampled.
+/// @pre None
+/// @post The program is sampled if a rate is configured.
+/// @param ios the io_service that waits for the dump signal.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Start(boost::asio::io_service& ios)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    unsigned int rate = CGlobalConfiguration::Instance().GetProfileRate();
+    if(rate == 0 || m_timer != 0)
+    {
+        return;
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = HandleProfile;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigaction(SIGPROF, &action, 0);
+
+    sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    timer_t timer;
+    if(timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &timer) != 0)
+    {
+        LOG_WARN(Logger)<<"Cannot create the profiler timer: "
+            <<std::strerror(errno)<<std::endl;
+        return;
+    }
+
+    itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_sec = 0;
+    spec.it_interval.tv_nsec = 1000000000 / rate;
+    spec.it_value = spec.it_interval;
+    timer_settime(timer, 0, &spec, 0);
+    m_timer = timer;
+
+    m_dump.reset(new boost::asio::signal_set(ios, SIGUSR2));
+    m_dump->async_wait(boost::bind(&CProfiler::HandleDump, this, _1, _2));
+    LOG_NOTICE(Logger)<<"Sampling the program "<<rate
+        <<" times per second of CPU"<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::Stop
+/// @description Deletes the sampling timer and stops waiting for SIGUSR2.
+/// @pre None
+/// @post No more samples are taken.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_timer == 0)
+    {
+        return;
+    }
+    timer_delete(static_cast<timer_t>(m_timer));
+    m_timer = 0;
+    boost::system::error_code ec;
+    m_dump->cancel(ec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::SetPhase
+/// @description Tags the samples that follow with the phase that started.
+/// @pre Called by the scheduler as the phase changes.
+/// @post Samples are recorded for the phase.
+/// @param phase the index of the phase.
+/// @param module the module the phase belongs to.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::SetPhase(unsigned int phase, const std::string& module)
+{
+    if(m_timer == 0)
+    {
+        return;
+    }
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(m_phases.size() <= phase + 1)
+        {
+            m_phases.resize(phase + 2);
+        }
+        m_phases[phase + 1] = module;
+    }
+    ActivePhase = phase + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::BeginTask
+/// @description Tags the samples of the calling thread as samples of a task.
+/// @pre No task is running.
+/// @post The samples of the thread are tagged until EndTask.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::BeginTask()
+{
+    if(m_timer == 0)
+    {
+        return;
+    }
+    TaskThread = pthread_self();
+    __sync_synchronize();
+    TaskRunning = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::EndTask
+/// @description Ends the tagging of BeginTask.
+/// @pre BeginTask was called.
+/// @post No task is running.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::EndTask()
+{
+    TaskRunning = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::Format
+/// @description Prints the samples since the start, per phase and function,
+///     with the samples taken in the tasks of the phase apart from those of
+///     other work done during it, most sampled first.
+/// @pre None
+/// @post None
+/// @param out the stream to print to.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Format(std::ostream& out)
+{
+    typedef std::map<std::string, boost::uint64_t> FunctionMap;
+    FunctionMap functions;
+    std::vector<std::string> phases;
+    boost::uint64_t total = 0;
+
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        phases = m_phases;
+    }
+
+    for(std::size_t i = 0; i < SAMPLE_SLOTS; i++)
+    {
+        boost::uint64_t key = Samples[i].key;
+        boost::uint64_t count = Samples[i].count;
+        if(key == 0 || count == 0)
+        {
+            continue;
+        }
+        boost::uint64_t tag = key >> 48;
+        boost::uint64_t phase = tag & ~TASK_TAG;
+        std::string name = phase < phases.size() ? phases[phase] : "unknown";
+        name += (tag & TASK_TAG) ? " task " : " other ";
+        functions[name + FunctionName(key & PC_MASK)] += count;
+        total += count;
+    }
+
+    std::vector<std::pair<std::string, boost::uint64_t> > sorted(
+        functions.begin(), functions.end());
+    std::sort(sorted.begin(), sorted.end(), BySamples);
+
+    out<<"# samples "<<total<<" dropped "<<Dropped<<" rate "
+        <<CGlobalConfiguration::Instance().GetProfileRate()<<"\n";
+    out<<"# samples phase task|other function\n";
+    for(std::size_t i = 0; i < sorted.size(); i++)
+    {
+        out<<sorted[i].second<<" "<<sorted[i].first<<"\n";
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProfiler::HandleDump
+/// @description Writes the profile to the profile file on SIGUSR2 and waits
+///     for the signal again.
+/// @pre Called on the broker io_service.
+/// @post The file holds the profile so far.
+/// @param error the result of the wait.
+/// @param signum the signal received.
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::HandleDump(const boost::system::error_code& error, int)
+{
+    if(error)
+    {
+        return;
+    }
+
+    std::string path = CGlobalConfiguration::Instance().GetProfileFile();
+    std::ofstream file(path.c_str());
+    Format(file);
+    if(file)
+    {
+        LOG_NOTICE(Logger)<<"Wrote the profile to "<<path<<std::endl;
+    }
+    else
+    {
+        LOG_WARN(Logger)<<"Cannot write the profile to "<<path<<std::endl;
+    }
+    m_dump->async_wait(boost::bind(&CProfiler::HandleDump, this, _1, _2));
+}
+
+    } // namespace broker
+} // namespace freedm
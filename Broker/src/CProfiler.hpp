@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CProfiler.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A low rate sampling profiler built into the DGI
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CPROFILER_HPP
+#define CPROFILER_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Samples the program counter of the DGI on a CPU time timer
+////////////////////////////////////////////////////////////////////////////////
+/// A POSIX timer on the CPU time of the process raises SIGPROF a configured
+/// number of times per second of CPU, on whichever thread is running. The
+/// handler records the program counter with the module whose phase is active
+/// and whether the thread was running one of its tasks, in a fixed table it
+/// updates with atomic adds. Nothing is allocated or locked in the handler,
+/// so a few dozen samples a second cost next to nothing. The samples are
+/// aggregated by function when the profile is printed, on SIGUSR2 to the
+/// profile file or at the /profile path of the metrics endpoint.
+////////////////////////////////////////////////////////////////////////////////
+class CProfiler
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CProfiler
+    static CProfiler& Instance();
+
+    /// Starts sampling at the configured rate, if there is one
+    void Start(boost::asio::io_service& ios);
+
+    /// Stops sampling
+    void Stop();
+
+    /// True if the program is being sampled
+    bool IsEnabled() const { return m_timer != 0; }
+
+    /// Notes the module whose phase has started
+    void SetPhase(unsigned int phase, const std::string& module);
+
+    /// Notes that the calling thread runs a task of the active phase
+    void BeginTask();
+
+    /// Notes that the task has returned
+    void EndTask();
+
+    /// Prints the profile aggregated by phase and function
+    void Format(std::ostream& out);
+
+private:
+    /// Private constructor for the singleton instance
+    CProfiler();
+
+    /// Writes the profile to the profile file
+    void HandleDump(const boost::system::error_code& error, int signum);
+
+    /// The POSIX timer, 0 if the program is not sampled
+    void* m_timer;
+
+    /// The module of each phase, by the phase index plus one
+    std::vector<std::string> m_phases;
+
+    /// Guards the module names
+    boost::mutex m_mutex;
+
+    /// Waits for the signal that dumps the profile
+    boost::scoped_ptr<boost::asio::signal_set> m_dump;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CPROFILER_HPP
@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CProtocolDatagram.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Define CProtocolDatagram class
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CProtocolDatagram.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CTimings.hpp"
+#include "CTrafficAccounting.hpp"
+#include "Messages.hpp"
+#include "messages/ProtocolMessage.pb.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Messages written by the datagram connections
+CCounter& WritesMetric = CMetrics::Instance().GetCounter(
+    "dgi_datagram_writes_total", "Messages written by the datagram connections");
+
+/// Messages received by the datagram connections after they expired
+CCounter& ExpiredMetric = CMetrics::Instance().GetCounter(
+    "dgi_datagram_expired_total",
+    "Messages the datagram connections received after they expired");
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolDatagram::CProtocolDatagram
+/// @description Constructor for the CProtocolDatagram class.
+/// @pre None
+/// @post The protocol can write to the peer.
+/// @param uuid The peer this connection is made to.
+/// @param endpoint The endpoint that will be the destination for sent messages
+/// @param lane The priority lane the protocol sends over
+///////////////////////////////////////////////////////////////////////////////
+CProtocolDatagram::CProtocolDatagram(std::string uuid,
+    boost::asio::ip::udp::endpoint endpoint, EMessageLane lane)
+    : IProtocol(uuid, endpoint, lane)
+    , m_writes(0)
+    , m_refused(0)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolDatagram::Send
+/// @description Writes a message to the channel in a window of its own. The
+///     message carries an expiration time so the receiver can drop it if it
+///     was held up on the way, but it is never written again.
+/// @pre None
+/// @post The message was written to the channel, unless it was refused.
+/// @param msg The message to write to the channel.
+/// @return False if the message does not fit in one datagram.
+///////////////////////////////////////////////////////////////////////////////
+bool CProtocolDatagram::Send(const CSerializedMessage::Pointer& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const std::string& bytes = msg->GetBytes();
+    const std::size_t header = CGlobalConfiguration::Instance().GetUUID().size()
+        + WINDOW_HEADER_SIZE + MESSAGE_OVERHEAD;
+    if(header + bytes.size() > CGlobalConfiguration::Instance().GetDatagramMTU()
+        || header + bytes.size() >
+            static_cast<std::size_t>(CGlobalConfiguration::MAX_PACKET_SIZE))
+    {
+        m_refused++;
+        LOG_WARN(Logger)<<"Message of "<<bytes.size()<<" bytes to "<<GetUUID()
+            <<" does not fit in a datagram, dropping message"<<std::endl;
+        return false;
+    }
+
+    ProtocolMessage pm;
+    pm.set_status(ProtocolMessage::MESSAGE);
+    pm.set_sequence_num(0);
+    pm.set_hash(msg->GetHash());
+    SetExpirationTimeFromNow(pm, CTimings::GetDuration(CTimings::CSRC_DEFAULT_TIMEOUT));
+
+    std::string entry, packed;
+    pm.SerializeToString(&entry);
+    AppendField(entry, ProtocolMessage::kModuleMessageFieldNumber, bytes);
+    AppendField(packed, ProtocolMessageWindow::kMessagesFieldNumber, entry);
+
+    ProtocolMessageWindow outmsg;
+    WritePacked(outmsg, packed);
+    m_writes++;
+    WritesMetric.Increment();
+    if(CTrafficAccounting::IsEnabled())
+    {
+        CTrafficAccounting::Instance().Account(CTrafficAccounting::SENT,
+            msg->GetMessage(), GetUUID(), bytes.size());
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolDatagram::Receive
+/// @description Accepts a received message unless it expired or is not a
+///     whole module message. Duplicates are not detected; the datagram lane
+///     never resends, so only the network can duplicate a message.
+/// @pre None
+/// @post None
+/// @param msg The received message
+/// @return True if the message should be delivered.
+///////////////////////////////////////////////////////////////////////////////
+bool CProtocolDatagram::Receive(const ProtocolMessage& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(msg.status() != ProtocolMessage::MESSAGE || !msg.has_module_message())
+    {
+        LOG_DEBUG(Logger)<<"Ignored datagram message with status "
+            <<msg.status()<<" from "<<GetUUID()<<std::endl;
+        return false;
+    }
+    if(MessageIsExpired(msg))
+    {
+        ExpiredMetric.Increment();
+        LOG_DEBUG(Logger)<<"Dropped expired datagram message from "
+            <<GetUUID()<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolDatagram::GetStatistics
+/// @description Gets the messages written and refused. There are no round
+///     trips or resends to report.
+/// @pre None
+/// @post None
+/// @return The statistics of the connection.
+///////////////////////////////////////////////////////////////////////////////
+SProtocolStatistics CProtocolDatagram::GetStatistics() const
+{
+    SProtocolStatistics stats;
+    stats.writes = m_writes;
+    stats.refused = m_refused;
+    return stats;
+}
+
+    }
+}
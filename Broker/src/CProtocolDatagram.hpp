@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CProtocolDatagram.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare CProtocolDatagram class
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CPROTOCOLDATAGRAM_HPP
+#define CPROTOCOLDATAGRAM_HPP
+
+#include "IProtocol.hpp"
+
+#include <string>
+
+namespace freedm {
+    namespace broker {
+
+/// A best-effort protocol without sequence numbers, ACKs or resends.
+////////////////////////////////////////////////////////////////////////////////
+/// Each message is written at once in a datagram of its own and delivered in
+/// whatever order it arrives, unless it expired on the way. A lost message is
+/// never written again, so it costs nothing but its own value, and there is
+/// no window for a late message to hold up. This suits the messages whose
+/// value expires quickly and that their module repeats anyway, such as
+/// clock exchanges and group liveness checks; a message too large for one
+/// datagram is refused rather than split.
+////////////////////////////////////////////////////////////////////////////////
+class CProtocolDatagram
+    : public IProtocol
+{
+    public:
+        /// Initializes the protocol with the underlying connection
+        CProtocolDatagram(std::string uuid, boost::asio::ip::udp::endpoint endpoint,
+            EMessageLane lane = LANE_CONTROL);
+        /// Writes the message to the channel at once
+        bool Send(const CSerializedMessage::Pointer& msg);
+        /// Nothing is acknowledged
+        void ReceiveACK(const ProtocolMessage&) { }
+        /// Accepts any message that has not expired
+        bool Receive(const ProtocolMessage& msg);
+        /// Nothing is acknowledged
+        void OnReceive() { }
+        /// Nothing is acknowledged
+        void SendACK(const ProtocolMessage&) { }
+        /// Stops the protocol; there are no timers
+        void Stop() { SetStopped(true); }
+        /// Gets the write statistics
+        SProtocolStatistics GetStatistics() const;
+    private:
+        /// Messages written to the channel
+        unsigned int m_writes;
+        /// Messages refused because they do not fit in a datagram
+        unsigned int m_refused;
+        /// Bytes reserved for the window fields other than the uuid
+        static const unsigned int WINDOW_HEADER_SIZE = 16;
+        /// Bytes reserved for the protocol fields of a message
+        static const unsigned int MESSAGE_OVERHEAD = 64;
+};
+
+    }
+}
+
+#endif // CPROTOCOLDATAGRAM_HPP
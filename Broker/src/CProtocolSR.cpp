@@ -21,21 +21,29 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
 #include "CProtocolSR.hpp"
 #include "CTimings.hpp"
+#include "CTraceLog.hpp"
+#include "CTrafficAccounting.hpp"
 #include "CBroker.hpp"
 
 #include "Messages.hpp"
 #include "messages/ProtocolMessage.pb.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iomanip>
 #include <set>
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 
 #include <google/protobuf/message.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 namespace freedm {
     namespace broker {
@@ -45,6 +53,59 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Registers a counter for each SR event, indexed by ETraceEvent
+std::vector<CCounter*> RegisterEventMetrics()
+{
+    std::vector<CCounter*> counters(TRACE_SR_RESET + 1, static_cast<CCounter*>(0));
+    for(unsigned int event = TRACE_SR_QUEUE; event <= TRACE_SR_RESET; event++)
+    {
+        counters[event] = &CMetrics::Instance().GetCounter("dgi_sr_events_total",
+            "Events of the SR connections, by event",
+            CMetrics::Label("event", GetTraceEventName(event)));
+    }
+    return counters;
+}
+
+/// Events of the SR connections
+const std::vector<CCounter*> EventMetrics = RegisterEventMetrics();
+
+/// Messages written by the SR connections
+CCounter& WritesMetric = CMetrics::Instance().GetCounter("dgi_sr_writes_total",
+    "Messages written by the SR connections");
+
+/// Writes that repeated an earlier write
+CCounter& ResendsMetric = CMetrics::Instance().GetCounter("dgi_sr_resends_total",
+    "Writes of the SR connections that repeated an earlier write");
+
+/// Round trip times of the SR connections
+CHistogram& RttMetric = CMetrics::Instance().GetHistogram("dgi_sr_rtt_seconds",
+    "Round trip times measured by the SR connections");
+
+/// Times from a SYN to its ACK
+CHistogram& ResyncMetric = CMetrics::Instance().GetHistogram(
+    "dgi_sr_resync_seconds",
+    "Times from the SYN of an SR connection to its ACK");
+
+/// Expired messages dropped behind a SYN
+CCounter& ResyncDroppedMetric = CMetrics::Instance().GetCounter(
+    "dgi_sr_resync_dropped_total",
+    "Expired messages the SR connections dropped at once while resyncing");
+
+/// Received windows whose acks were held back
+CCounter& DelayedAcksMetric = CMetrics::Instance().GetCounter(
+    "dgi_sr_delayed_acks_total",
+    "Received windows whose acks the SR connections held back");
+
+/// Held acks written along with outgoing messages
+CCounter& CarriedAcksMetric = CMetrics::Instance().GetCounter(
+    "dgi_sr_carried_acks_total",
+    "Held acks the SR connections wrote along with a flush or resend of messages");
+
+/// Requests to resync sent to peers
+CCounter& BadRequestsMetric = CMetrics::Instance().GetCounter(
+    "dgi_sr_bad_requests_total",
+    "Requests to resync the SR connections sent to their peers");
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -56,26 +117,62 @@ CLocalLogger Logger(__FILE__);
 ///       message will be numbered as 0 for outgoing and the timer is not set.
 /// @param uuid The peer this connection is made to.
 /// @param endpoint The endpoint that will be the destination for sent messages
+/// @param lane The priority lane whose sequence numbers this protocol keeps
 ///////////////////////////////////////////////////////////////////////////////
-CProtocolSR::CProtocolSR(std::string uuid, boost::asio::ip::udp::endpoint endpoint)
-    : IProtocol(uuid, endpoint),
+CProtocolSR::CProtocolSR(std::string uuid, boost::asio::ip::udp::endpoint endpoint,
+    EMessageLane lane)
+    : IProtocol(uuid, endpoint, lane),
       m_timeout(CBroker::Instance().GetIOService()),
-      m_timer_active(false)
+      m_flush(CBroker::Instance().GetIOService()),
+      m_flush_pending(false),
+      m_ack_timer(CBroker::Instance().GetIOService()),
+      m_ack_pending(false),
+      m_ack_delay(CGlobalConfiguration::Instance().GetAckDelay()),
+      m_ack_held(0),
+      m_ack_now(false),
+      m_srtt(0),
+      m_rttvar(0),
+      m_rto(CTimings::Get(CTimings::CSRC_RESEND_TIME)),
+      m_backoff(0),
+      m_writes(0),
+      m_retransmits(0),
+      m_max_window(CGlobalConfiguration::Instance().GetSendWindow()),
+      m_max_queue(CGlobalConfiguration::Instance().GetSendQueue()),
+      m_refused(0),
+      m_fragment_next(0),
+      m_timer_active(false),
+      m_windowbytes(0),
+      m_backlogbytes(0),
+      m_windowmemory("sr", "window"),
+      m_ackmemory("sr", "ack_window"),
+      m_backlogmemory("sr", "backlog")
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     //Sequence Numbers
     m_outseq = 0;
     m_inseq = 0;
     //Inbound Message Sequencing
     m_insync = false;
-    //m_insynctime
+    m_insynctime = 0;
     m_inresyncs = 0;
     //Outbound message sequencing
     m_outsync = false;
+    m_outsynchash = 0;
     // Message killing (SEND)
     m_sendkills = false;
     m_sendkill = 0;
     m_dropped = 0;
+    // The window has to stay below half the sequence space so the receiver
+    // can tell a new message from a resend, even across a wrap.
+    if(m_max_window == 0 || m_max_window > SEQUENCE_MODULO/2 - 1)
+    {
+        m_max_window = SEQUENCE_MODULO/2 - 1;
+    }
+    // A held ack must reach the peer before its shortest resend timer.
+    if(m_ack_delay > MAX_ACK_DELAY)
+    {
+        m_ack_delay = MAX_ACK_DELAY;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -85,37 +182,250 @@ CProtocolSR::CProtocolSR(std::string uuid, boost::asio::ip::udp::endpoint endpoi
 ///   delivery won't be attempted after the deadline is passed. Killed messages
 ///   are noted in the next outgoing message. The receiver tracks the killed
 ///   messages and uses them to help maintain ordering.
+///   At most send-window messages are in flight; the rest wait in a backlog
+///   of send-queue messages and get their sequence numbers as ACKs make room.
+///   A module message larger than one datagram is split into pieces that are
+///   numbered, acknowledged and resent like separate messages, so only the
+///   pieces that were lost are written again.
 /// @pre The protocol is intialized.
-/// @post At least one message is in the channel and actively being resent.
-///     The send window is greater than or equal to one. The timer for the
-///     resend is freshly set or is currently running for a resend.
-///     If a message is written to the channel, the m_killable flag is set.
-/// @param msg The message to write to the channel.
+/// @post The message is queued in the send window and a flush is scheduled
+///     for the configured flush delay, so that messages sent in a burst are
+///     written to the channel together.  The flush starts the resends.
+/// @param msg The message to write to the channel. Its bytes are kept for
+///     the resends instead of a copy of the message.
+/// @return False if the backlog is full and the message was dropped.
 ///////////////////////////////////////////////////////////////////////////////
-void CProtocolSR::Send(const ModuleMessage& msg)
+bool CProtocolSR::Send(const CSerializedMessage::Pointer& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const std::string& bytes = msg->GetBytes();
+    const std::size_t piece = GetFragmentSize();
+    std::size_t count = 1;
+    if(bytes.size() > piece)
+    {
+        count = (bytes.size() + piece - 1) / piece;
+    }
+
+    if(count > MAX_FRAGMENTS)
+    {
+        m_refused++;
+        EventMetrics[TRACE_SR_REFUSE]->Increment();
+        LOG_WARN(Logger)<<"Message of "<<bytes.size()<<" bytes to "<<GetUUID()
+            <<" is too large, dropping message"<<std::endl;
+        return false;
+    }
+
+    if(m_backlog.size() + count > m_max_queue)
+    {
+        m_refused++;
+        Trace(TRACE_SR_REFUSE, msg->GetHash());
+        LOG_WARN(Logger)<<"Send queue to "<<GetUUID()<<" is full, dropping message"
+            <<std::endl;
+        return false;
+    }
 
     if(m_outsync == false)
     {
         SendSYN();
     }
     
-    ProtocolMessage pm;
-    pm.mutable_module_message()->CopyFrom(msg);
+    QueuedMessage qm;
+    qm.header.set_status(ProtocolMessage::MESSAGE);
 
-    unsigned int msgseq = m_outseq;
-    pm.set_sequence_num(msgseq);
-    m_outseq = (m_outseq+1) % SEQUENCE_MODULO;
-    pm.set_hash(ComputeMessageHash(pm.module_message()));
-    pm.set_status(ProtocolMessage::MESSAGE);
+    SetExpirationTimeFromNow(qm.header, CTimings::GetDuration(CTimings::CSRC_DEFAULT_TIMEOUT));
+    LOG_DEBUG(Logger)<<"Set Expire time: "<< qm.header.expire_usec() << std::endl;
 
-    SetExpirationTimeFromNow(pm, boost::posix_time::millisec(CTimings::Get("CSRC_DEFAULT_TIMEOUT")));
-    Logger.Debug<<"Set Expire time: "<< pm.expire_time() << std::endl;
+    if(count == 1)
+    {
+        qm.body = msg;
+        qm.header.set_hash(msg->GetHash());
+        m_backlog.push_back(qm);
+        m_backlogbytes += bytes.size();
+    }
+    else
+    {
+        LOG_DEBUG(Logger)<<"Splitting message of "<<bytes.size()<<" bytes into "
+            <<count<<" pieces"<<std::endl;
+        qm.header.set_fragment_count(count);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            qm.header.set_fragment_index(i);
+            qm.header.set_fragment(bytes.substr(i * piece, piece));
+            qm.header.set_hash(ComputeMessageHash(qm.header.fragment()));
+            m_backlog.push_back(qm);
+            m_backlogbytes += qm.header.fragment().size();
+        }
+    }
+    Trace(TRACE_SR_QUEUE, msg->GetHash(), count);
+    FillWindow();
+    NoteMemory();
+
+    if(!m_flush_pending)
+    {
+        m_flush_pending = true;
+        m_flush.expires_from_now(boost::posix_time::milliseconds(
+            CGlobalConfiguration::Instance().GetFlushDelay()));
+        m_flush.async_wait(CBroker::Instance().GetStrand().wrap(
+            boost::bind(&CProtocolSR::Flush,
+            boost::static_pointer_cast<CProtocolSR>(shared_from_this()),
+            boost::asio::placeholders::error)));
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::NoteMemory
+/// @description Reports the sizes of the send window and the backlog. Their
+///     elements are counted by size along with the module messages they
+///     carry; a message sent to several peers is counted once for each.
+/// @pre None
+/// @post The sr container metrics include the current sizes.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::NoteMemory()
+{
+    m_windowmemory.Update(m_window.size(),
+        m_window.size() * sizeof(ProtocolMessage) + m_outgoing.capacity() *
+        sizeof(OutgoingMessage) + m_windowbytes);
+    m_backlogmemory.Update(m_backlog.size(),
+        m_backlog.size() * sizeof(QueuedMessage) + m_backlogbytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetBodySize
+/// @description Finds how many bytes of a module message a message carries,
+///     either its serialized body or its piece of a larger one.
+/// @pre None
+/// @post None
+/// @param header the protocol fields of the message.
+/// @param body the serialized module message, or null for a piece.
+/// @return The bytes of the body or of the piece.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CProtocolSR::GetBodySize(const ProtocolMessage& header,
+    const CSerializedMessage::Pointer& body)
+{
+    return body ? body->GetBytes().size() : header.fragment().size();
+}
 
-	m_window.push_back(pm);
-    boost::system::error_code x;
-    Resend(x);
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::Trace
+/// @description Counts an event of this connection in the metrics and
+///     records it in the binary trace. The peer UUID is only copied when
+///     tracing is enabled.
+/// @pre None
+/// @post The event is counted, and recorded if tracing is enabled.
+/// @param event the kind of event.
+/// @param hash the hash of the message involved, or 0.
+/// @param value a number that depends on the event.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::Trace(ETraceEvent event, boost::uint64_t hash, boost::uint32_t value)
+{
+    if(static_cast<std::size_t>(event) < EventMetrics.size() && EventMetrics[event])
+    {
+        EventMetrics[event]->Increment();
+    }
+    if(CTraceLog::Instance().IsEnabled())
+    {
+        CTraceLog::Instance().Emit(event, "sr", GetUUID(), hash, value);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetFragmentSize
+/// @description Gets the number of bytes of a module message that fit in one
+///     datagram next to the window header and the protocol fields.
+/// @pre None
+/// @post None
+/// @return The size of the pieces a larger module message is split into.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CProtocolSR::GetFragmentSize() const
+{
+    std::size_t budget = CGlobalConfiguration::Instance().GetDatagramMTU();
+    const std::size_t header = CGlobalConfiguration::Instance().GetUUID().size()
+        + WINDOW_HEADER_SIZE + FRAGMENT_OVERHEAD;
+    if(budget > static_cast<std::size_t>(CGlobalConfiguration::MAX_PACKET_SIZE))
+    {
+        budget = CGlobalConfiguration::MAX_PACKET_SIZE;
+    }
+    if(budget < header + MIN_FRAGMENT_SIZE)
+    {
+        return MIN_FRAGMENT_SIZE;
+    }
+    return budget - header;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetInFlight
+/// @description Counts the module messages of the send window, leaving out a
+///     SYN at its head.
+/// @pre None
+/// @post None
+/// @return The number of messages awaiting an ACK.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CProtocolSR::GetInFlight() const
+{
+    unsigned int count = m_window.size();
+    if(count > 0 && m_window.front().status() == ProtocolMessage::CREATED)
+    {
+        count--;
+    }
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::FillWindow
+/// @description Numbers queued messages and moves them into the send window
+///     until the window is full. Messages that expired while they were
+///     queued were never written, so they are dropped without a kill.
+/// @pre None
+/// @post The window holds up to m_max_window messages, or the backlog is
+///     empty.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::FillWindow()
+{
+    while(!m_backlog.empty() && GetInFlight() < m_max_window)
+    {
+        QueuedMessage& qm = m_backlog.front();
+        std::size_t size = GetBodySize(qm.header, qm.body);
+        m_backlogbytes -= size;
+        if(MessageIsExpired(qm.header))
+        {
+            LOG_DEBUG(Logger)<<"Queued message expired before it was sent"<<std::endl;
+            m_backlog.pop_front();
+            continue;
+        }
+        unsigned int msgseq = m_outseq;
+        m_outseq = (m_outseq+1) % SEQUENCE_MODULO;
+        qm.header.set_sequence_num(msgseq);
+        if(m_window.size() >= m_outgoing.size())
+        {
+            GrowOutgoing();
+        }
+        GetOutgoing(msgseq).body = qm.body;
+        m_window.push_back(qm.header);
+        m_windowbytes += size;
+        m_backlog.pop_front();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::Flush
+/// @description Writes the messages queued by Send since the flush was
+///     scheduled and starts the resend timer for them.
+/// @pre A flush was scheduled by Send.
+/// @post The send window has been written to the channel, unless the flush
+///     was cancelled by stopping the connection.
+/// @param err The timer error code. If the err is 0 then the timer expired
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::Flush(const boost::system::error_code& err)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_flush_pending = false;
+    if(!err)
+    {
+        boost::system::error_code x;
+        Resend(x);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -140,41 +450,38 @@ void CProtocolSR::Send(const ModuleMessage& msg)
 ///////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::Resend(const boost::system::error_code& err)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 	if(!err && !GetStopped())
     {
-        std::deque<ProtocolMessage>::iterator it;
-        it = m_window.begin();
-        unsigned int todrop = 0;
-        if(it != m_window.end() && m_window.front().status() == ProtocolMessage::CREATED)
+        if(!m_window.empty() && m_window.front().status() == ProtocolMessage::CREATED)
         {
-            it++;
-            for(; it != m_window.end(); it++)
-            {
-                if(MessageIsExpired(*it))
-                    todrop++;
-            }   
+            m_dropped += DropExpired();
         }
         else
         {
             while(m_window.size() > 0 && m_window.front().status() != ProtocolMessage::CREATED && MessageIsExpired(m_window.front()))
             {
-                Logger.Trace<<__PRETTY_FUNCTION__<<" Flushing"<<std::endl;
+                LOG_TRACE(Logger)<<__PRETTY_FUNCTION__<<" Flushing"<<std::endl;
                 //First message in the window should be the only one
                 //ever to have been written.
                 m_sendkills = true;
-                Logger.Debug<<"Message Expired: "<<m_window.front().DebugString();
-                m_window.pop_front();
+                LOG_DEBUG(Logger)<<"Message Expired: "<<m_window.front().DebugString();
+                Trace(TRACE_SR_EXPIRE, m_window.front().hash(),
+                    m_window.front().sequence_num());
+                PopWindow();
                 m_dropped++;
             }
         }
-        if(m_dropped > MAX_DROPPED_MSGS || todrop > MAX_DROPPED_MSGS)
+        if(m_dropped > MAX_DROPPED_MSGS)
         {
-            Logger.Warn<<"Connection to "<<GetUUID()<<" has lost "<<m_dropped<<" messages. Attempting to reconnect."<<std::endl;
+            LOG_WARN(Logger)<<"Connection to "<<GetUUID()<<" has lost "<<m_dropped<<" messages. Attempting to reconnect."<<std::endl;
+            Trace(TRACE_SR_RESET, 0, m_dropped);
             Stop();
             return;
         }
-        Logger.Trace<<__PRETTY_FUNCTION__<<" Flushed Expired"<<std::endl;
+        LOG_TRACE(Logger)<<__PRETTY_FUNCTION__<<" Flushed Expired"<<std::endl;
+        FillWindow();
+        NoteMemory();
         if(m_window.size() > 0)
         {
             if(m_sendkills &&  m_sendkill > m_window.front().sequence_num())
@@ -195,14 +502,166 @@ void CProtocolSR::Resend(const boost::system::error_code& err)
             }
         }
         WriteWindow();
-        /// We use static pointer cast to convert the IPROTOCOL pointer to this
-        /// derived type
-        m_timeout.expires_from_now(boost::posix_time::milliseconds(CTimings::Get("CSRC_RESEND_TIME")));
-        m_timeout.async_wait(boost::bind(&CProtocolSR::Resend,
-            boost::static_pointer_cast<CProtocolSR>(shared_from_this()),
-            boost::asio::placeholders::error));
+        if(m_ack_pending)
+        {
+            // the held acks went out with the messages
+            CarriedAcksMetric.Increment();
+            ClearACK();
+        }
+        ScheduleResend();
+    }
+    LOG_TRACE(Logger)<<__PRETTY_FUNCTION__<<" Resend Finished"<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::ScheduleResend
+/// @description Sets the resend timer to the current retransmission timeout,
+///     replacing a wait that is already pending.
+/// @pre None
+/// @post ResendTimeout is called when the timeout passes.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::ScheduleResend()
+{
+    /// We use static pointer cast to convert the IPROTOCOL pointer to this
+    /// derived type
+    m_timeout.expires_from_now(boost::posix_time::milliseconds(GetRTO()));
+    m_timeout.async_wait(CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CProtocolSR::ResendTimeout,
+        boost::static_pointer_cast<CProtocolSR>(shared_from_this()),
+        boost::asio::placeholders::error)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::DropExpired
+/// @description Drops the expired messages behind a SYN at the head of the
+///     window in one pass, against one reading of the clock. Kills cannot
+///     skip them, since the receiver has not synced yet; instead the SYN is
+///     renumbered to come just before the first message that is left, and
+///     given a new expiration time so the receiver takes it for a new SYN.
+///     Only the expired run at the front of the window is dropped, which
+///     keeps the sequence numbers after the SYN contiguous.
+/// @pre The head of the window is a SYN.
+/// @post The message after the SYN has not expired, or there is none.
+/// @return The number of messages dropped.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CProtocolSR::DropExpired()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    const google::protobuf::uint64 now = GetExpirationClock();
+    ProtocolMessage syn = m_window.front();
+    unsigned int dropped = 0;
+
+    m_window.pop_front();
+    while(!m_window.empty() && MessageIsExpired(m_window.front(), now))
+    {
+        Trace(TRACE_SR_EXPIRE, m_window.front().hash(),
+            m_window.front().sequence_num());
+        PopWindow();
+        dropped++;
+    }
+    if(dropped > 0)
+    {
+        unsigned int next = m_window.empty() ? m_outseq
+            : m_window.front().sequence_num();
+        syn.set_sequence_num((next + SEQUENCE_MODULO - 1) % SEQUENCE_MODULO);
+        SetExpirationTimeFromNow(syn, CTimings::GetDuration(CTimings::CSRC_DEFAULT_TIMEOUT));
+        ResyncDroppedMetric.Increment(dropped);
+        LOG_DEBUG(Logger)<<"Dropped "<<dropped<<" expired messages to "<<GetUUID()
+            <<" behind a SYN"<<std::endl;
+    }
+    m_window.push_front(syn);
+    return dropped;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::ResendTimeout
+/// @description Handles the expiration of the resend timer. If messages are
+///     still unacknowledged the retransmission timeout is doubled, up to
+///     MAX_BACKOFF times, before the window is resent.
+/// @pre The resend timer was set by Resend.
+/// @post The window has been resent and the timer is set with the new timeout.
+/// @param err The timer error code. If the err is 0 then the timer expired
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::ResendTimeout(const boost::system::error_code& err)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!err && !m_window.empty() && m_backoff < MAX_BACKOFF)
+    {
+        m_backoff++;
+        LOG_DEBUG(Logger)<<"Retransmission timeout to "<<GetUUID()<<" backed off to "
+            <<GetRTO()<<" ms"<<std::endl;
     }
-    Logger.Trace<<__PRETTY_FUNCTION__<<" Resend Finished"<<std::endl;
+    Resend(err);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::SampleRTT
+/// @description Updates the smoothed round trip time and its variation with
+///     a new measurement, then computes the retransmission timeout from them
+///     as described by Jacobson and Karels (RFC 6298).
+/// @pre The sample was taken from a message that was written only once.
+/// @post m_srtt, m_rttvar and m_rto reflect the new sample.
+/// @param rtt The time between the write of a message and its ACK.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::SampleRTT(const boost::posix_time::time_duration& rtt)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    double r = rtt.total_microseconds() / 1000.0;
+    if(r < 0)
+    {
+        return;
+    }
+    RttMetric.Observe(r / 1000.0);
+    if(m_srtt == 0 && m_rttvar == 0)
+    {
+        m_srtt = r;
+        m_rttvar = r / 2;
+    }
+    else
+    {
+        m_rttvar = 0.75 * m_rttvar + 0.25 * std::fabs(m_srtt - r);
+        m_srtt = 0.875 * m_srtt + 0.125 * r;
+    }
+    double rto = m_srtt + std::max(1.0, 4 * m_rttvar);
+    m_rto = static_cast<unsigned int>(std::ceil(rto));
+    if(m_rto < REFIRE_TIME)
+        m_rto = REFIRE_TIME;
+    if(m_rto > MAX_REFIRE_TIME)
+        m_rto = MAX_REFIRE_TIME;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetRTO
+/// @description Gets the time to wait before the window is resent.
+/// @pre None
+/// @post None
+/// @return The retransmission timeout in milliseconds, including backoff.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CProtocolSR::GetRTO() const
+{
+    unsigned int rto = m_rto << m_backoff;
+    return (rto > MAX_REFIRE_TIME) ? MAX_REFIRE_TIME : rto;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetStatistics
+/// @description Gets the round trip and retransmission statistics of this
+///     connection.
+/// @pre None
+/// @post None
+/// @return The current statistics.
+///////////////////////////////////////////////////////////////////////////////
+SProtocolStatistics CProtocolSR::GetStatistics() const
+{
+    SProtocolStatistics stats;
+    stats.rtt = m_srtt;
+    stats.rto = GetRTO();
+    stats.writes = m_writes;
+    stats.retransmits = m_retransmits;
+    stats.inflight = GetInFlight();
+    stats.queued = m_backlog.size();
+    stats.refused = m_refused;
+    return stats;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -220,23 +679,141 @@ void CProtocolSR::Resend(const boost::system::error_code& err)
 ///////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::ReceiveACK(const ProtocolMessage& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     unsigned int seq = msg.sequence_num();
     if(m_window.size() > 0)
     {
         // Assuming hash collisions are small, we will check the hash
-        // of the front message. On hit, we can accept the acknowledge.
-        unsigned int fseq = m_window.front().sequence_num();
-        Logger.Debug<<"Received ACK "<<seq<<" expecting ACK "<<fseq<<std::endl;
-        google::protobuf::uint64 expectedHash = m_window.front().hash();
-        if(fseq == seq && expectedHash == msg.hash())
+        // of the acknowledged message. On hit, we can accept the acknowledge.
+        // A cumulative ACK may name any message of the window, older peers
+        // only acknowledge the front.
+        unsigned int depth = msg.cumulative() ? m_window.size() : 1;
+        unsigned int index = GetWindowIndex(seq);
+        LOG_DEBUG(Logger)<<"Received ACK "<<seq<<" expecting ACK "
+            <<m_window.front().sequence_num()<<std::endl;
+        if(index >= depth || m_window[index].hash() != msg.hash())
+        {
+            return;
+        }
+        // Karn's rule: an ACK of a repeated write is ambiguous
+        if(m_window[index].status() == ProtocolMessage::MESSAGE &&
+            GetOutgoing(seq).writes == 1)
+        {
+            SampleRTT(boost::posix_time::microsec_clock::universal_time()
+                - GetOutgoing(seq).sent);
+        }
+        Trace(TRACE_SR_ACK, msg.hash(), seq);
+        if(m_window.front().status() == ProtocolMessage::CREATED &&
+            !m_synsent.is_not_a_date_time())
+        {
+            ResyncMetric.Observe((boost::posix_time::microsec_clock::universal_time()
+                - m_synsent).total_microseconds() / 1000000.0);
+            m_synsent = boost::posix_time::ptime();
+        }
+        // Retire the acknowledged message and everything before it
+        for(unsigned int i = 0; i <= index; i++)
+        {
+            PopWindow();
+        }
+        m_backoff = 0;
+        m_sendkill = seq;
+        m_sendkills = false;
+        m_dropped = 0;
+        FillWindow();
+        NoteMemory();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::PopWindow
+/// @description Removes the message at the head of the send window along with
+///     its serialized body.
+/// @pre The window is not empty.
+/// @post The head of the window is removed and its slot in m_outgoing is
+///     cleared.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::PopWindow()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(m_window.front().status() == ProtocolMessage::MESSAGE)
+    {
+        OutgoingMessage& slot = GetOutgoing(m_window.front().sequence_num());
+        m_windowbytes -= GetBodySize(m_window.front(), slot.body);
+        slot = OutgoingMessage();
+    }
+    m_window.pop_front();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetWindowIndex
+/// @description Finds a message of the send window by its sequence number.
+///     The window always holds consecutive sequence numbers, a SYN at its
+///     head being numbered just before the first message, so the position
+///     is the distance from the head and no search is needed.
+/// @pre None
+/// @post None
+/// @param seq the sequence number to find.
+/// @return The index of the message in m_window, or the size of the window
+///     if no message of the window has the number.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CProtocolSR::GetWindowIndex(unsigned int seq) const
+{
+    if(m_window.empty())
+    {
+        return 0;
+    }
+    unsigned int index = (seq + SEQUENCE_MODULO - m_window.front().sequence_num())
+        % SEQUENCE_MODULO;
+    if(index >= m_window.size() || m_window[index].sequence_num() != seq)
+    {
+        return m_window.size();
+    }
+    return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GetOutgoing
+/// @description Gets the slot of a message of the send window in the ring of
+///     outgoing messages. The ring is a power of two no smaller than the
+///     window, which divides the sequence modulo, so the sequence numbers of
+///     the window map to distinct slots even across a wrap.
+/// @pre The ring has been sized by GrowOutgoing.
+/// @post None
+/// @param seq the sequence number of the message.
+/// @return The slot of the message.
+///////////////////////////////////////////////////////////////////////////////
+CProtocolSR::OutgoingMessage& CProtocolSR::GetOutgoing(unsigned int seq)
+{
+    return m_outgoing[seq & (m_outgoing.size() - 1)];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::GrowOutgoing
+/// @description Doubles the ring of outgoing messages and moves the messages
+///     of the window to their slots in the larger ring. The ring only grows
+///     as far as the window does, so a connection that keeps a few messages
+///     in flight keeps a small ring.
+/// @pre None
+/// @post The ring has room for one more message than the window holds.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::GrowOutgoing()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::size_t size = m_outgoing.empty() ? MIN_OUTGOING : m_outgoing.size();
+    while(size <= m_window.size())
+    {
+        size *= 2;
+    }
+    std::vector<OutgoingMessage> ring(size);
+    std::deque<ProtocolMessage>::const_iterator it;
+    for(it = m_window.begin(); it != m_window.end(); it++)
+    {
+        if(it->status() == ProtocolMessage::MESSAGE)
         {
-            m_sendkill = fseq;
-            m_window.pop_front();
-            m_sendkills = false;
-            m_dropped = 0;
+            ring[it->sequence_num() & (size - 1)] = GetOutgoing(it->sequence_num());
         }
     }
+    m_outgoing.swap(ring);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -280,36 +857,49 @@ void CProtocolSR::ReceiveACK(const ProtocolMessage& msg)
 ///////////////////////////////////////////////////////////////////////////////
 bool CProtocolSR::Receive(const ProtocolMessage& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;  
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;  
     if(msg.status() == ProtocolMessage::BAD_REQUEST)
     {
+        // The peer answered, so it only lost its state and is not dead
+        m_dropped = 0;
         //See if we are already trying to sync:
-        if(m_window.front().status() != ProtocolMessage::CREATED)
+        if(m_window.empty() || m_window.front().status() != ProtocolMessage::CREATED)
         {
 			// See if we are getting a bad request we've already synced for.
             if(msg.hash() != m_outsynchash)
             {
-                Logger.Debug<<"Syncronizing Connection (BAD REQUEST)"<<std::endl;
+                LOG_DEBUG(Logger)<<"Syncronizing Connection (BAD REQUEST)"<<std::endl;
                 m_outsynchash = msg.hash();
                 SendSYN();
+                // The SYN carries the base of the window; whatever expired
+                // while the peer was away goes at once. OnReceive writes the
+                // SYN for this datagram, so the resync takes one round trip
+                // instead of waiting out a backed off timeout.
+                DropExpired();
+                m_backoff = 0;
+                m_ack_now = true;
+                ScheduleResend();
             }
             else
             {
-                Logger.Debug<<"Already synced for this time"<<std::endl;
+                LOG_DEBUG(Logger)<<"Already synced for this time"<<std::endl;
             }
         }
         return false;
     }
     else if(msg.status() == ProtocolMessage::CREATED)
     {
-		boost::posix_time::ptime sendtime = boost::posix_time::time_from_string(msg.expire_time());
+		google::protobuf::uint64 sendtime = GetExpirationTime(msg);
         //Check to see if we've already seen this SYN:
         if(sendtime == m_insynctime)
         {
-		    Logger.Debug<<"Duplicate Sync"<<std::endl;
+		    LOG_DEBUG(Logger)<<"Duplicate Sync"<<std::endl;
             return false;
         }
-        Logger.Debug<<"Got Sync"<<std::endl;
+        LOG_DEBUG(Logger)<<"Got Sync"<<std::endl;
+        Trace(TRACE_SR_SYNC, msg.hash(), msg.sequence_num());
+        m_reassembly.clear();
+        m_fragment_next = 0;
         m_inseq = (msg.sequence_num()+1)%SEQUENCE_MODULO;
         m_insynctime = sendtime;
         m_inresyncs++;
@@ -319,17 +909,28 @@ bool CProtocolSR::Receive(const ProtocolMessage& msg)
     }
     else if(m_insync == false)
     {
-        Logger.Debug<<"Connection Needs Resync"<<std::endl;
+        LOG_DEBUG(Logger)<<"Connection Needs Resync"<<std::endl;
         //If the connection hasn't been synchronized, we want to
         //tell them it is a bad request so they know they need to sync.
+        // One request per received window is enough; it is written with
+        // the acks by OnReceive instead of once for every message.
+        std::deque<ProtocolMessage>::const_iterator it;
+        for(it = m_ack_window.begin(); it != m_ack_window.end(); it++)
+        {
+            if(it->status() == ProtocolMessage::BAD_REQUEST)
+            {
+                return false;
+            }
+        }
         ProtocolMessage outmsg;
         // Presumably, if we are here, the connection is registered
         outmsg.set_status(ProtocolMessage::BAD_REQUEST);
         outmsg.set_hash(msg.hash());
         outmsg.set_sequence_num(m_inresyncs%SEQUENCE_MODULO);
-        ProtocolMessageWindow cmsg;
-        *cmsg.add_messages() = outmsg;
-        Write(cmsg);
+        m_ack_window.push_back(outmsg);
+        m_ackmemory.Update(m_ack_window);
+        m_ack_now = true;
+        BadRequestsMetric.Increment();
         return false;
     }
     else if(msg.status() == ProtocolMessage::MESSAGE)
@@ -356,52 +957,137 @@ bool CProtocolSR::Receive(const ProtocolMessage& msg)
         //Consider the window you expect to see
         // If the killed message is the one immediately preceeding this
         // message in terms of sequence number we should accept it
-        Logger.Debug<<"Recv: "<<msg.sequence_num()<<" Expected "<<m_inseq<<" Using kill: "<<usekill<<" with "<<kill<<std::endl;
+        LOG_DEBUG(Logger)<<"Recv: "<<msg.sequence_num()<<" Expected "<<m_inseq<<" Using kill: "<<usekill<<" with "<<kill<<std::endl;
         if(msg.sequence_num() == m_inseq)
         {
             m_inseq = (m_inseq+1)%SEQUENCE_MODULO;
+            Trace(TRACE_SR_ACCEPT, msg.hash(), msg.sequence_num());
             return true;
         }
         else if(usekill == true && kill < m_inseq && msg.sequence_num() > m_inseq)
         {
             //m_inseq will be right for the next expected message.
             m_inseq = (msg.sequence_num()+1)%SEQUENCE_MODULO;
+            Trace(TRACE_SR_ACCEPT, msg.hash(), msg.sequence_num());
             return true;
         }
         else if(usekill == true)
         {
-            Logger.Debug<<"KILL: "<<kill<<" INSEQ "<<m_inseq<<" SEQ: "
+            LOG_DEBUG(Logger)<<"KILL: "<<kill<<" INSEQ "<<m_inseq<<" SEQ: "
                           <<msg.sequence_num()<<std::endl;
         }
         // Justin case.
+        Trace(TRACE_SR_REJECT, msg.hash(), msg.sequence_num());
         return false;
     }
     throw std::runtime_error("Receive didn't do anything with a message.");
     return false; 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::Deliver
+/// @description Collects the pieces of a split module message. Messages are
+///     accepted in order, so the pieces arrive one after the other; a gap
+///     means a piece expired at the sender and the message is abandoned.
+/// @pre Receive returned true for the message.
+/// @post The piece is added to m_reassembly, or m_reassembly is cleared when
+///     the message is complete or can no longer be completed.
+/// @param window the received window that holds msg
+/// @param msg the accepted message
+/// @return The module message, or an empty pointer while pieces are missing.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ModuleMessage> CProtocolSR::Deliver(
+    boost::shared_ptr<const ProtocolMessageWindow> window, const ProtocolMessage& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    boost::shared_ptr<const ModuleMessage> complete;
+
+    if(!msg.has_fragment_count())
+    {
+        if(m_fragment_next != 0)
+        {
+            LOG_WARN(Logger)<<"Dropped an incomplete message from "<<GetUUID()<<std::endl;
+            m_reassembly.clear();
+            m_fragment_next = 0;
+        }
+        return IProtocol::Deliver(window, msg);
+    }
+
+    if(msg.fragment_index() == 0 && m_fragment_next != 0)
+    {
+        LOG_WARN(Logger)<<"Dropped an incomplete message from "<<GetUUID()<<std::endl;
+        m_reassembly.clear();
+        m_fragment_next = 0;
+    }
+    if(msg.fragment_index() != m_fragment_next ||
+        msg.fragment_count() > MAX_FRAGMENTS)
+    {
+        if(m_fragment_next != 0)
+        {
+            LOG_WARN(Logger)<<"Dropped an incomplete message from "<<GetUUID()<<std::endl;
+        }
+        m_reassembly.clear();
+        m_fragment_next = 0;
+        return complete;
+    }
+
+    m_reassembly.append(msg.fragment());
+    m_fragment_next++;
+    if(m_fragment_next == msg.fragment_count())
+    {
+        boost::shared_ptr<ModuleMessage> mm = boost::make_shared<ModuleMessage>();
+        if(mm->ParseFromString(m_reassembly))
+        {
+            complete = mm;
+        }
+        else
+        {
+            LOG_ERROR(Logger)<<"Reassembled message from "<<GetUUID()
+                <<" could not be parsed"<<std::endl;
+        }
+        m_reassembly.clear();
+        m_fragment_next = 0;
+    }
+    return complete;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// CProtocolSR::SendACK
 /// @description Composes an ack and PrepareAndWrites it to the channel. ACKS are saved
 ///     to the protocol's state and are written again during resends to try and
-///     maximize througput.
+///     maximize througput. Messages are only accepted in order, so the ack is
+///     cumulative and replaces any ack queued earlier in the same window.
+///     The ack of a SYN is never held back, so a resync is not slowed down.
 /// @param msg The message to ACK.
 /// @pre A message has been accepted.
-/// @post The m_currentack member is set to the ack and the message will
-///     be resent during resend until it expires.
+/// @post The m_ack_window holds a single cumulative ack for the message.
 ///////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::SendACK(const ProtocolMessage& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     unsigned int seq = msg.sequence_num();
     ProtocolMessage outmsg;
     // Presumably, if we are here, the connection is registered
     outmsg.set_status(ProtocolMessage::ACCEPTED);
     outmsg.set_sequence_num(seq);
-    Logger.Debug<<"Generating ACK. Source exp time "<<msg.expire_time()<<std::endl;
-    outmsg.set_expire_time(msg.expire_time());
+    LOG_DEBUG(Logger)<<"Generating ACK. Source exp time "<<GetExpirationTime(msg)<<std::endl;
+    CopyExpirationTime(msg, outmsg);
     outmsg.set_hash(msg.hash());
-    m_ack_window.push_back(outmsg);
+    outmsg.set_cumulative(true);
+    if(m_ack_window.size() > 0 && m_ack_window.back().cumulative())
+    {
+        m_ack_window.back() = outmsg;
+    }
+    else
+    {
+        m_ack_window.push_back(outmsg);
+    }
+    m_ackmemory.Update(m_ack_window);
+    m_ack_held++;
+    if(msg.status() == ProtocolMessage::CREATED)
+    {
+        m_ack_now = true;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -412,7 +1098,7 @@ void CProtocolSR::SendACK(const ProtocolMessage& msg)
 ///////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::SendSYN()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     unsigned int seq = m_outseq;
     if(m_window.size() == 0)
     {
@@ -440,47 +1126,169 @@ void CProtocolSR::SendSYN()
     ProtocolMessage outmsg;
     outmsg.set_status(ProtocolMessage::CREATED);
     outmsg.set_sequence_num(seq);
-    SetExpirationTimeFromNow(outmsg, boost::posix_time::millisec(CTimings::Get("CSRC_DEFAULT_TIMEOUT")));
+    SetExpirationTimeFromNow(outmsg, CTimings::GetDuration(CTimings::CSRC_DEFAULT_TIMEOUT));
     m_window.push_front(outmsg);
     m_outsync = true;
+    m_synsent = boost::posix_time::microsec_clock::universal_time();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CProtocolSR::OnReceive
 /// @description When a message is received, write the window to the channel,
-///     then flush the ack queue.
+///     then flush the ack queue. With csrc-ack-delay set, the acks of a
+///     window are held back for up to the delay instead, so the acks of the
+///     windows that arrive meanwhile go out in one datagram, or along with
+///     the next flush or resend of this connection. They are written at once
+///     when csrc-ack-count messages wait for them, or when they carry a SYN,
+///     its ack or a request to resync.
 /// @pre None
 /// @post There are no acks queued and the message has been written to the
-///     channel.
+///     channel, or the ack timer is set.
 ///////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::OnReceive()
 {
+    if(m_ack_delay > 0 && !m_ack_now && !m_ack_window.empty()
+        && m_ack_held < CGlobalConfiguration::Instance().GetAckCount())
+    {
+        DelayedAcksMetric.Increment();
+        if(!m_ack_pending)
+        {
+            m_ack_pending = true;
+            m_ack_timer.expires_from_now(boost::posix_time::microseconds(m_ack_delay));
+            m_ack_timer.async_wait(CBroker::Instance().GetStrand().wrap(
+                boost::bind(&CProtocolSR::FlushACK,
+                boost::static_pointer_cast<CProtocolSR>(shared_from_this()),
+                boost::asio::placeholders::error)));
+        }
+        return;
+    }
     WriteWindow();
+    ClearACK();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::FlushACK
+/// @description Writes the window with the acks that were held back, once
+///     the ack delay has passed without a write that carried them.
+/// @pre The ack timer was set by OnReceive.
+/// @post There are no acks queued, unless the timer was cancelled.
+/// @param err The timer error code. If the err is 0 then the timer expired
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::FlushACK(const boost::system::error_code& err)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!err && m_ack_pending && !GetStopped())
+    {
+        WriteWindow();
+        ClearACK();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CProtocolSR::ClearACK
+/// @description Empties the ack queue after it has been written and stops
+///     the ack timer.
+/// @pre The acks of m_ack_window were written to the channel.
+/// @post There are no acks queued or held back.
+///////////////////////////////////////////////////////////////////////////////
+void CProtocolSR::ClearACK()
+{
     m_ack_window.clear();
+    m_ackmemory.Update(m_ack_window);
+    m_ack_held = 0;
+    m_ack_now = false;
+    if(m_ack_pending)
+    {
+        m_ack_pending = false;
+        m_ack_timer.cancel();
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CProtocolSR::WriteWindow
-/// @description Creates a message bundle of outstanding messages to write to
-///     the channel.
+/// @description Creates message bundles of the outstanding ACKs and messages
+///     and writes them to the channel. The ACKs ride along with the data, and
+///     each bundle is filled up to the configured datagram size before a new
+///     one is started, keeping the order of the window.
 /// @pre None
-/// @post Writes the window to the channel.
+/// @post Writes the window to the channel in one or more datagrams. A message
+///     that alone exceeds the datagram size is sent in a datagram of its own.
 //////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::WriteWindow()
 {
+    std::deque<ProtocolMessage>::const_iterator it;
+    const boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time();
+    const std::size_t budget = CGlobalConfiguration::Instance().GetDatagramMTU();
+    const std::size_t header = CGlobalConfiguration::Instance().GetUUID().size()
+        + WINDOW_HEADER_SIZE;
+
+    const bool accounting = CTrafficAccounting::IsEnabled();
+
     ProtocolMessageWindow outmsg;
-    BOOST_FOREACH(const ProtocolMessage& msg, m_ack_window)
+    std::string packed, entry;
+    for(int pass = 0; pass < 2; pass++)
     {
-        *outmsg.add_messages() = msg;
+        const std::deque<ProtocolMessage>& queue =
+            (pass == 0) ? m_ack_window : m_window;
+        for(it = queue.begin(); it != queue.end(); it++)
+        {
+            // the protocol fields are re-encoded since the kill can change,
+            // the module message is spliced in from its cached encoding
+            it->SerializeToString(&entry);
+            if(pass == 1 && it->status() == ProtocolMessage::MESSAGE)
+            {
+                OutgoingMessage& body = GetOutgoing(it->sequence_num());
+                // a piece of a split message carries its bytes itself
+                if(body.body)
+                {
+                    AppendField(entry, ProtocolMessage::kModuleMessageFieldNumber,
+                        body.body->GetBytes());
+                }
+                if(body.writes == 0)
+                {
+                    body.sent = now;
+                }
+                else
+                {
+                    m_retransmits++;
+                    ResendsMetric.Increment();
+                }
+                if(accounting)
+                {
+                    CTrafficAccounting::EDirection direction = (body.writes == 0)
+                        ? CTrafficAccounting::SENT : CTrafficAccounting::RESENT;
+                    if(body.body)
+                    {
+                        CTrafficAccounting::Instance().Account(direction,
+                            body.body->GetMessage(), GetUUID(),
+                            body.body->GetBytes().size());
+                    }
+                    else
+                    {
+                        CTrafficAccounting::Instance().AccountFragment(direction,
+                            GetUUID(), it->fragment().size());
+                    }
+                }
+                body.writes++;
+                m_writes++;
+                WritesMetric.Increment();
+            }
+            // field tag, length prefix and the message itself
+            std::size_t size = 1 + entry.size() +
+                google::protobuf::io::CodedOutputStream::VarintSize32(entry.size());
+            if(!packed.empty() && header + packed.size() + size > budget)
+            {
+                WritePacked(outmsg, packed);
+                packed.clear();
+            }
+            AppendField(packed, ProtocolMessageWindow::kMessagesFieldNumber, entry);
+        }
     }
-    BOOST_FOREACH(const ProtocolMessage& msg, m_window)
+    if(!packed.empty())
     {
-        *outmsg.add_messages() = msg;
+        WritePacked(outmsg, packed);
     }
-    if(outmsg.messages().size() > 0)
-    {
-        Write(outmsg);
-    } 
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -493,7 +1301,7 @@ void CProtocolSR::WriteWindow()
 ///////////////////////////////////////////////////////////////////////////////
 void CProtocolSR::Write(ProtocolMessageWindow& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
 
     IProtocol::Write(msg);
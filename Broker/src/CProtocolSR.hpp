@@ -24,11 +24,16 @@
 #ifndef CPROTOCOLSR_HPP
 #define CPROTOCOLSR_HPP
 
+#include "CMetrics.hpp"
+#include "CTraceLog.hpp"
 #include "IProtocol.hpp"
 
 #include "messages/ProtocolMessage.pb.h"
 
 #include <deque>
+#include <map>
+#include <string>
+#include <vector>
 
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -42,13 +47,18 @@ class CProtocolSR
 {
     public:
         /// Initializes the protocol with the underlying connection
-        explicit CProtocolSR(std::string uuid, boost::asio::ip::udp::endpoint endpoint);
+        CProtocolSR(std::string uuid, boost::asio::ip::udp::endpoint endpoint,
+            EMessageLane lane = LANE_CONTROL);
         /// Public facing send function that sends a message
-        void Send(const ModuleMessage& msg);
+        bool Send(const CSerializedMessage::Pointer& msg);
         /// Public facing function that handles marking down ACKs for sent messages
         void ReceiveACK(const ProtocolMessage& msg);
         /// deterimines if a  messageshould be given to the dispatcher
         bool Receive(const ProtocolMessage& msg);
+        /// Reassembles split module messages from their accepted pieces
+        boost::shared_ptr<const ModuleMessage> Deliver(
+            boost::shared_ptr<const ProtocolMessageWindow> window,
+            const ProtocolMessage& msg);
         /// Writes the window (with acks on message receipt)
         void OnReceive();
         /// Handles Writing an ack for the input message to the channel
@@ -56,16 +66,94 @@ class CProtocolSR
         /// Sends a synchronizer
         void SendSYN();
         /// Stops the timers
-        void Stop() { m_timeout.cancel(); SetStopped(true);  };
+        void Stop() { m_timeout.cancel(); m_flush.cancel(); m_ack_timer.cancel(); SetStopped(true);  };
         /// Handles writing the message to the underlying connection
         void Write(ProtocolMessageWindow & msg);
         /// Writes a whole window to the channel
         void WriteWindow();
+        /// Checks if messages are waiting for room in the send window
+        bool IsCongested() const { return !m_backlog.empty(); }
+        /// Checks if nothing is in flight, queued or half reassembled
+        bool IsQuiet() const
+            { return m_window.empty() && m_backlog.empty() && m_ack_window.empty()
+                && m_reassembly.empty(); }
+        /// Gets the round trip and retransmission statistics
+        SProtocolStatistics GetStatistics() const;
     private:
+        /// Bookkeeping for a module message in the send window
+        struct OutgoingMessage
+        {
+            OutgoingMessage() : writes(0) { }
+            /// Serialized module message
+            CSerializedMessage::Pointer body;
+            /// Time of the first write
+            boost::posix_time::ptime sent;
+            /// Number of times the message has been written
+            unsigned int writes;
+        };
+        /// A module message waiting for room in the send window
+        struct QueuedMessage
+        {
+            /// Protocol fields other than the sequence number
+            ProtocolMessage header;
+            /// Serialized module message
+            CSerializedMessage::Pointer body;
+        };
         /// Resend outstanding messages
         void Resend(const boost::system::error_code& err);
+        /// Backs off the retransmission timeout and resends
+        void ResendTimeout(const boost::system::error_code& err);
+        /// Sets the resend timer to the retransmission timeout
+        void ScheduleResend();
+        /// Drops the expired messages behind a SYN at once
+        unsigned int DropExpired();
+        /// Updates the retransmission timeout with a round trip sample
+        void SampleRTT(const boost::posix_time::time_duration& rtt);
+        /// Gets the retransmission timeout including the backoff
+        unsigned int GetRTO() const;
+        /// Removes the head of the send window
+        void PopWindow();
+        /// Finds a message of the send window by its sequence number
+        unsigned int GetWindowIndex(unsigned int seq) const;
+        /// Gets the ring slot of a message of the send window
+        OutgoingMessage& GetOutgoing(unsigned int seq);
+        /// Makes the ring of outgoing messages larger than the window
+        void GrowOutgoing();
+        /// Gets the largest piece of a module message sent in one message
+        std::size_t GetFragmentSize() const;
+        /// Counts the messages of the send window
+        unsigned int GetInFlight() const;
+        /// Moves queued messages into the send window as room permits
+        void FillWindow();
+        /// Writes the messages queued since the last flush
+        void Flush(const boost::system::error_code& err);
+        /// Writes the acks held back by the delayed ack policy
+        void FlushACK(const boost::system::error_code& err);
+        /// Empties the ack queue once it has been written
+        void ClearACK();
+        /// Reports the sizes of the windows and the backlog to the metrics
+        void NoteMemory();
+        /// Gets the bytes of module message a queued message carries
+        static std::size_t GetBodySize(const ProtocolMessage& header,
+            const CSerializedMessage::Pointer& body);
+        /// Records an event of this connection in the binary trace
+        void Trace(ETraceEvent event, boost::uint64_t hash, boost::uint32_t value = 0);
         /// Timeout for resends
         boost::asio::deadline_timer m_timeout;
+        /// Deadline for coalescing newly sent messages
+        boost::asio::deadline_timer m_flush;
+        /// Indicates if a flush is scheduled.
+        bool m_flush_pending;
+        /// Deadline for the acks held back by the delayed ack policy
+        boost::asio::deadline_timer m_ack_timer;
+        /// Indicates if the ack timer is set.
+        bool m_ack_pending;
+        /// Microseconds an ack may be held back, 0 to write it at once
+        unsigned int m_ack_delay;
+        /// Messages acked since the acks were last written
+        unsigned int m_ack_held;
+        /// Set when the queued acks must be written at once
+        bool m_ack_now;
         /// The expected next in sequence number
         unsigned int m_inseq;
         /// The next number to assign to an outgoing message
@@ -75,11 +163,13 @@ class CProtocolSR
         /// Counts the number of times this one has been resynced
         unsigned int m_inresyncs;
         /// Time the last accepted sync was
-        boost::posix_time::ptime m_insynctime;
+        google::protobuf::uint64 m_insynctime;
         /// Marks if we've sent the outsync for this connection
         bool m_outsync;
         /// Keeps track of the last resync that we've seen
         google::protobuf::uint64 m_outsynchash;
+        /// Time the SYN at the head of the window was created
+        boost::posix_time::ptime m_synsent;
         /// Marks if we should send the kill hash.
         bool m_sendkills;
         /// The hash to... MURDER.
@@ -87,16 +177,70 @@ class CProtocolSR
         /// The window
         std::deque<ProtocolMessage> m_window;
         std::deque<ProtocolMessage> m_ack_window;
+        /// Module messages of the window, indexed by sequence number modulo
+        /// the size of the ring
+        std::vector<OutgoingMessage> m_outgoing;
+        /// Smoothed round trip time in MS
+        double m_srtt;
+        /// Round trip time variation in MS
+        double m_rttvar;
+        /// Retransmission timeout in MS before the backoff
+        unsigned int m_rto;
+        /// Number of consecutive timeouts without an ACK
+        unsigned int m_backoff;
+        /// Messages written to the channel
+        unsigned int m_writes;
+        /// Writes that repeated an earlier write of the same message
+        unsigned int m_retransmits;
+        /// Messages that have not been given a sequence number yet
+        std::deque<QueuedMessage> m_backlog;
+        /// Largest number of messages in the window at once
+        unsigned int m_max_window;
+        /// Largest number of messages waiting behind the window
+        unsigned int m_max_queue;
+        /// Messages refused because the backlog was full
+        unsigned int m_refused;
+        /// Pieces of the module message being reassembled
+        std::string m_reassembly;
+        /// Index of the next piece expected for m_reassembly
+        unsigned int m_fragment_next;
         /// Sequence modulo
-        static const unsigned int SEQUENCE_MODULO = 1024;
-        /// Refire time in MS
+        static const unsigned int SEQUENCE_MODULO = 65536;
+        /// Smallest ring of outgoing messages, a power of two
+        static const unsigned int MIN_OUTGOING = 16;
+        /// Bytes reserved for the window fields other than the uuid
+        static const unsigned int WINDOW_HEADER_SIZE = 16;
+        /// Bytes reserved for the protocol fields of a piece
+        static const unsigned int FRAGMENT_OVERHEAD = 64;
+        /// Smallest piece a module message is split into
+        static const unsigned int MIN_FRAGMENT_SIZE = 256;
+        /// Largest number of pieces of one module message
+        static const unsigned int MAX_FRAGMENTS = 1024;
+        /// Refire time in MS, the shortest retransmission timeout
         static const unsigned int REFIRE_TIME = 10;
+        /// The longest ack delay in microseconds, half the refire time so a
+        /// held ack cannot outlast the shortest resend timer of the peer
+        static const unsigned int MAX_ACK_DELAY = REFIRE_TIME * 1000 / 2;
+        /// The longest retransmission timeout in MS
+        static const unsigned int MAX_REFIRE_TIME = 2000;
+        /// The largest number of doublings of the retransmission timeout
+        static const unsigned int MAX_BACKOFF = 6;
         /// The number of messages that have to be dropped before the connection is dead
         static const unsigned int MAX_DROPPED_MSGS = 3;
         /// The number that have been dropped.
         unsigned int m_dropped;
 		/// Indicates if the timer is active.
 		bool m_timer_active;
+        /// Bytes of module message held by the window
+        std::size_t m_windowbytes;
+        /// Bytes of module message held by the backlog
+        std::size_t m_backlogbytes;
+        /// Size of m_window and m_outgoing
+        CSizeTracker m_windowmemory;
+        /// Size of m_ack_window
+        CSizeTracker m_ackmemory;
+        /// Size of m_backlog
+        CSizeTracker m_backlogmemory;
 };
 
     }
@@ -0,0 +1,242 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CRelayTree.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Relays group broadcasts down a spanning tree of the
+///               recipients
+///
+/// @functions
+///     CRelayTree::Instance
+///     CRelayTree::Send
+///     CRelayTree::Relay
+///     CRelayTree::Layout
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CRelayTree.hpp"
+
+#include "CConnection.hpp"
+#include "CConnectionManager.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CPeerNode.hpp"
+#include "messages/ModuleMessage.pb.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <boost/make_shared.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The most sets of recipients whose tree order is kept
+const std::size_t MAX_LAYOUTS = 16;
+
+/// Broadcasts this node sent down a relay tree
+CCounter& SentMetric = CMetrics::Instance().GetCounter(
+    "dgi_relay_sent_messages_total",
+    "Group broadcasts sent down a relay tree instead of to every recipient");
+
+/// Copies of relayed messages this node forwarded to its children
+CCounter& ForwardedMetric = CMetrics::Instance().GetCounter(
+    "dgi_relay_forwarded_messages_total",
+    "Copies of relayed broadcasts forwarded to the children of this node");
+
+/// Tree orders built for a new set of recipients
+CCounter& LayoutMetric = CMetrics::Instance().GetCounter(
+    "dgi_relay_layouts_total",
+    "Relay trees ordered for a new set of recipients");
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CRelayTree::Instance
+/// @description Access the singleton instance of the relay tree
+/// @pre None
+/// @post None
+/// @return A reference to the relay tree.
+///////////////////////////////////////////////////////////////////////////////
+CRelayTree& CRelayTree::Instance()
+{
+    static CRelayTree tree;
+    return tree;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CRelayTree::Send
+/// @description Appends a relay plan to the encoding of a message and writes
+///     it to the children of this node. The message is not encoded again:
+///     the plan is a field of its own, so it is appended to the bytes.
+/// @pre None
+/// @post If the message is relayed, the first recipients in tree order have
+///     been sent the message with its plan.
+/// @param msg the message to broadcast
+/// @param recipients the remote peers that should receive the message
+/// @return False if relaying is off, there are too few recipients for a tree
+///     or the message is already relayed, in which case nothing is sent.
+///////////////////////////////////////////////////////////////////////////////
+bool CRelayTree::Send(const CSerializedMessage::Pointer& msg,
+    const std::vector<std::string>& recipients)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    unsigned int fanout = CGlobalConfiguration::Instance().GetRelayFanout();
+    if(fanout == 0 || recipients.size() <= fanout || msg->GetMessage().has_relay())
+    {
+        return false;
+    }
+
+    RelayPlan plan;
+    plan.add_members(CGlobalConfiguration::Instance().GetUUID());
+    std::vector<std::string> order = Layout(recipients);
+    for(std::size_t i = 0; i < order.size(); i++)
+    {
+        plan.add_members(order[i]);
+    }
+    plan.set_fanout(fanout);
+
+    std::string bytes(msg->GetBytes());
+    AppendField(bytes, ModuleMessage::kRelayFieldNumber, plan.SerializeAsString());
+    CSerializedMessage::Pointer relayed = boost::make_shared<const CSerializedMessage>(
+        CSerializedMessage::Unpack(msg), bytes);
+
+    LOG_DEBUG(Logger) << "Relaying a broadcast to " << recipients.size()
+        << " peers through " << fanout << " children" << std::endl;
+    for(int i = 1; i <= static_cast<int>(fanout); i++)
+    {
+        CPeerNode(plan.members(i)).Send(relayed);
+    }
+    SentMetric.Increment();
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CRelayTree::Relay
+/// @description Finds this node in the plan of a relayed message and writes
+///     the message to its children. The message is delivered as a message of
+///     the node that started the relay.
+/// @pre msg has a relay plan.
+/// @post If the message came from the parent of this node in the plan, the
+///     children of this node have been sent the message.
+/// @param msg the received message
+/// @param peer the handle of the peer the message came from
+/// @return The handle of the node that started the relay, or peer if the
+///     message did not come down the tree.
+///////////////////////////////////////////////////////////////////////////////
+PeerId CRelayTree::Relay(boost::shared_ptr<const ModuleMessage> msg, PeerId peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const RelayPlan& plan = msg->relay();
+    const std::string me = CGlobalConfiguration::Instance().GetUUID();
+    const std::size_t fanout = plan.fanout();
+    const std::size_t size = plan.members_size();
+
+    std::size_t self = 0;
+    while(self < size && plan.members(self) != me)
+    {
+        self++;
+    }
+    if(fanout == 0 || self == 0 || self == size
+        || plan.members((self - 1) / fanout) != CPeerIdTable::Instance().GetUUID(peer))
+    {
+        LOG_DEBUG(Logger) << "Delivering a relayed message that did not come"
+            << " down its tree" << std::endl;
+        return peer;
+    }
+
+    std::size_t first = self * fanout + 1;
+    if(first < size)
+    {
+        CSerializedMessage::Pointer copy(new CSerializedMessage(msg));
+        std::size_t end = std::min(first + fanout, size);
+        for(std::size_t i = first; i < end; i++)
+        {
+            CPeerNode(plan.members(i)).Send(copy);
+            ForwardedMetric.Increment();
+        }
+    }
+    return CPeerIdTable::Instance().Intern(plan.members(0));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CRelayTree::Layout
+/// @description Orders a set of recipients for the tree. The recipients this
+///     node has the shortest round trip times to come first, so they are the
+///     ones that forward; a peer without a measured time goes last. The order
+///     is kept for the set, so each membership is laid out once.
+/// @pre None
+/// @post The order of the set is kept. Once too many sets have been laid
+///     out, the orders kept before are forgotten.
+/// @param recipients the remote peers of a broadcast
+/// @return The recipients in tree order.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<std::string> CRelayTree::Layout(const std::vector<std::string>& recipients)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::map<std::vector<std::string>, std::vector<std::string> >::const_iterator it
+        = m_layouts.find(recipients);
+    if(it != m_layouts.end())
+    {
+        return it->second;
+    }
+
+    std::vector<std::pair<double, std::string> > measured;
+    for(std::size_t i = 0; i < recipients.size(); i++)
+    {
+        double rtt = std::numeric_limits<double>::max();
+        if(CConnectionManager::Instance().HasConnection(recipients[i]))
+        {
+            SProtocolStatistics stats = CConnectionManager::Instance()
+                .GetConnectionByUUID(recipients[i])->GetStatistics();
+            if(stats.rtt > 0)
+            {
+                rtt = stats.rtt;
+            }
+        }
+        measured.push_back(std::make_pair(rtt, recipients[i]));
+    }
+    std::sort(measured.begin(), measured.end());
+
+    std::vector<std::string> order;
+    for(std::size_t i = 0; i < measured.size(); i++)
+    {
+        order.push_back(measured[i].second);
+    }
+
+    if(m_layouts.size() >= MAX_LAYOUTS)
+    {
+        m_layouts.clear();
+    }
+    m_layouts[recipients] = order;
+    LayoutMetric.Increment();
+    LOG_DEBUG(Logger) << "Laid out a relay tree of " << order.size()
+        << " peers" << std::endl;
+    return order;
+}
+
+    } // namespace broker
+} // namespace freedm
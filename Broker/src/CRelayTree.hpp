@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CRelayTree.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Relays group broadcasts down a spanning tree of the
+///               recipients
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CRELAYTREE_HPP
+#define CRELAYTREE_HPP
+
+#include "CPeerIdTable.hpp"
+#include "Messages.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Sends one copy of a group broadcast to a few peers, which forward it on
+////////////////////////////////////////////////////////////////////////////////
+/// A broadcast to more recipients than the relay-fanout option carries a
+/// RelayPlan: the sender, then the recipients in the order of a k-ary tree,
+/// where k is the fanout. The sender writes the message to its k children
+/// and each member forwards the same message to its own children, so the
+/// copies one node writes no longer grow with the group. Every member finds
+/// its children from its position in the plan, so the plan is the same for
+/// all of them and the message is forwarded without being changed.
+///
+/// The sender orders the recipients by its smoothed round trip times to them,
+/// so the nearest ones forward to the rest. The order is built once for each
+/// set of recipients, and a new membership gets a new order.
+///
+/// A member delivers a relayed message as if the sender had sent it directly,
+/// but only if it came from its parent in the plan; a module that sends on a
+/// message it received does not start the relay again.
+///
+/// @limitations The members below a node that has failed miss the message.
+////////////////////////////////////////////////////////////////////////////////
+class CRelayTree
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CRelayTree
+    static CRelayTree& Instance();
+
+    /// Sends a message down a tree of the recipients, false if not relayed
+    bool Send(const CSerializedMessage::Pointer& msg,
+        const std::vector<std::string>& recipients);
+
+    /// Forwards a relayed message to the children of this node
+    PeerId Relay(boost::shared_ptr<const ModuleMessage> msg, PeerId peer);
+
+private:
+    /// Private constructor for the singleton instance
+    CRelayTree() { }
+
+    /// Gets the tree order of a set of recipients, nearest first
+    std::vector<std::string> Layout(const std::vector<std::string>& recipients);
+
+    /// The tree order of each recent set of recipients
+    std::map<std::vector<std::string>, std::vector<std::string> > m_layouts;
+
+    /// Lock for m_layouts
+    boost::mutex m_mutex;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CRELAYTREE_HPP
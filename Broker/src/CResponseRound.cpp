@@ -0,0 +1,164 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CResponseRound.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Waits on the responses of a set of peers or a deadline
+///
+/// @functions
+///     CResponseRound::CResponseRound
+///     CResponseRound::Start
+///     CResponseRound::Expect
+///     CResponseRound::Respond
+///     CResponseRound::Finish
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CResponseRound.hpp"
+#include "CLogger.hpp"
+#include "CVirtualClock.hpp"
+
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+
+namespace freedm {
+namespace broker {
+
+namespace {
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CResponseRound::CResponseRound
+/// @description Creates a round that waits on nothing until it is started.
+/// @pre None
+/// @post The round is not open.
+///////////////////////////////////////////////////////////////////////////////
+CResponseRound::CResponseRound()
+    : m_timer(0)
+    , m_round(0)
+    , m_open(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CResponseRound::Start
+/// @description Opens a round that waits for a response from each of a set
+///     of peers. A round that was open is replaced; its task runs with
+///     operation_aborted if it shared the timer with this one.
+/// @pre The timer belongs to the module the responses are handled by.
+/// @post The task is scheduled on the timer for the timeout, and queued at
+///     once instead if no peer is expected.
+/// @param timer the timer to schedule the task on
+/// @param timeout the longest to wait for the responses
+/// @param expected the peers the round waits on
+/// @param task the task to run when the round ends
+///////////////////////////////////////////////////////////////////////////////
+void CResponseRound::Start(CBroker::TimerHandle timer,
+    boost::posix_time::time_duration timeout,
+    const std::set<std::string>& expected, CBroker::Scheduleable task)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_timer = timer;
+    m_expected = expected;
+    m_round++;
+    m_open = true;
+    m_start = CVirtualClock::Now();
+    // the expiry runs ahead of the message handlers queued before it
+    CBroker::Instance().Schedule(m_timer, timeout,
+        boost::bind(&CResponseRound::Finish, this, boost::asio::placeholders::error,
+            m_round, task), boost::posix_time::milliseconds(0));
+    if(m_expected.empty())
+    {
+        m_open = false;
+        CBroker::Instance().Expire(m_timer);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CResponseRound::Expect
+/// @description Adds a peer to wait on, such as one a response named.
+/// @pre None
+/// @post If the round is open, it waits on the peer as well.
+/// @param uuid the peer to wait on
+///////////////////////////////////////////////////////////////////////////////
+void CResponseRound::Expect(const std::string& uuid)
+{
+    if(m_open)
+    {
+        m_expected.insert(uuid);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CResponseRound::Respond
+/// @description Notes that a peer responded. Once every expected peer has,
+///     the timer of the round expires early.
+/// @pre None
+/// @post The peer is no longer waited on. If none are left, the task of the
+///     round is queued without an error and the round is closed.
+/// @param uuid the peer that responded
+/// @return true if this response ended the round
+///////////////////////////////////////////////////////////////////////////////
+bool CResponseRound::Respond(const std::string& uuid)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_open)
+    {
+        return false;
+    }
+    m_expected.erase(uuid);
+    if(!m_expected.empty())
+    {
+        return false;
+    }
+    LOG_INFO(Logger) << "All responses in after "
+        << (CVirtualClock::Now() - m_start) << std::endl;
+    m_open = false;
+    return CBroker::Instance().Expire(m_timer) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CResponseRound::Finish
+/// @description Runs the task of a round when its timer expires or is set
+///     again.
+/// @pre Called by the scheduler.
+/// @post If the task belongs to the current round, the round is closed.
+/// @param err the error code of the timer
+/// @param round the round the task was scheduled for
+/// @param task the task of that round
+///////////////////////////////////////////////////////////////////////////////
+void CResponseRound::Finish(const boost::system::error_code& err,
+    unsigned int round, CBroker::Scheduleable task)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(round == m_round)
+    {
+        if(m_open && !err)
+        {
+            LOG_INFO(Logger) << "Response timeout with " << m_expected.size()
+                << " peers outstanding" << std::endl;
+        }
+        m_open = false;
+        m_expected.clear();
+    }
+    task(err);
+}
+
+} // namespace broker
+} // namespace freedm
@@ -0,0 +1,81 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CResponseRound.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Waits on the responses of a set of peers or a deadline
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CRESPONSEROUND_HPP
+#define CRESPONSEROUND_HPP
+
+#include "CBroker.hpp"
+
+#include <cstddef>
+#include <set>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace freedm {
+namespace broker {
+
+/// A request sent to several peers that ends once all of them respond.
+///
+/// A module starts a round on one of its timers with the peers it asked and
+/// the longest it will wait. The task of the round runs without an error once
+/// every expected peer has responded, or when the timeout passes, whichever
+/// is first, so a round whose responses are all in does not wait out the
+/// timeout. The task is scheduled on the timer as any other, and runs with
+/// operation_aborted if the timer is set again while the round is open.
+class CResponseRound
+{
+public:
+    /// Creates a round that is not open
+    CResponseRound();
+    /// Opens a round that waits on a set of peers
+    void Start(CBroker::TimerHandle timer, boost::posix_time::time_duration timeout,
+        const std::set<std::string>& expected, CBroker::Scheduleable task);
+    /// Adds a peer the open round waits on
+    void Expect(const std::string& uuid);
+    /// Notes the response of a peer, ending the round if it was the last
+    bool Respond(const std::string& uuid);
+    /// True from Start until the task of the round is queued
+    bool IsOpen() const { return m_open; }
+    /// Gets the number of expected peers that have not responded
+    std::size_t Outstanding() const { return m_expected.size(); }
+
+private:
+    /// Closes the round and runs its task
+    void Finish(const boost::system::error_code& err, unsigned int round,
+        CBroker::Scheduleable task);
+
+    /// The timer the task of the round is scheduled on
+    CBroker::TimerHandle m_timer;
+    /// The peers that have not responded
+    std::set<std::string> m_expected;
+    /// Counts the rounds started, so a task aborted by the next round of
+    /// the same timer leaves that round open
+    unsigned int m_round;
+    /// True while the round waits
+    bool m_open;
+    /// The time the round was opened, for the log
+    boost::posix_time::ptime m_start;
+};
+
+} // namespace broker
+} // namespace freedm
+
+#endif // CRESPONSEROUND_HPP
@@ -0,0 +1,574 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSharedMemoryTransport.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Carries datagrams between DGI processes on the same host
+///               through rings in POSIX shared memory instead of UDP sockets.
+///
+/// @functions
+///     CSharedMemoryTransport::CRing::CRing
+///     CSharedMemoryTransport::CRing::~CRing
+///     CSharedMemoryTransport::CRing::Push
+///     CSharedMemoryTransport::CRing::Pop
+///     CSharedMemoryTransport::Instance
+///     CSharedMemoryTransport::CSharedMemoryTransport
+///     CSharedMemoryTransport::Start
+///     CSharedMemoryTransport::Stop
+///     CSharedMemoryTransport::Attach
+///     CSharedMemoryTransport::Write
+///     CSharedMemoryTransport::RingName
+///     CSharedMemoryTransport::IsLocal
+///     CSharedMemoryTransport::Run
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.hpp"
+
+#include "CSharedMemoryTransport.hpp"
+
+#include "CBroker.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CListener.hpp"
+#include "CLogger.hpp"
+#include "Messages.hpp"
+#include "messages/ProtocolMessage.pb.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef HAVE_SHM_OPEN
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/make_shared.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Marks a ring whose header has been initialized by its owner
+const boost::uint32_t RING_MAGIC = 0x46444752;
+
+/// Number of datagrams a ring holds
+const boost::uint32_t RING_SLOTS = 32;
+
+/// Bytes of a ring slot: the datagram size followed by the datagram
+const boost::uint32_t SLOT_SIZE =
+    (sizeof(boost::uint32_t) + CGlobalConfiguration::MAX_PACKET_SIZE + 7) & ~7u;
+
+/// Microseconds the reader sleeps when every ring is empty
+const unsigned int POLL_INTERVAL = 50;
+
+/// Keeps the producer and the consumer indices on separate cache lines
+const std::size_t CACHE_LINE = 64;
+
+/// Layout of the start of a ring segment, followed by the slots
+struct SRingHeader
+{
+    boost::uint32_t magic;
+    boost::uint32_t slots;
+    boost::uint32_t slotsize;
+    char pad0[CACHE_LINE - 3 * sizeof(boost::uint32_t)];
+    /// Number of datagrams written, only changed by the producer
+    volatile boost::uint32_t head;
+    char pad1[CACHE_LINE - sizeof(boost::uint32_t)];
+    /// Number of datagrams read, only changed by the consumer
+    volatile boost::uint32_t tail;
+    char pad2[CACHE_LINE - sizeof(boost::uint32_t)];
+};
+
+}
+
+/// A single producer, single consumer ring of datagrams in shared memory
+class CSharedMemoryTransport::CRing
+    : private boost::noncopyable
+{
+public:
+    /// Creates the ring as its consumer, or opens it as its producer
+    CRing(const std::string& name, bool create);
+    /// Unmaps the ring, and removes it if this process created it
+    ~CRing();
+    /// Appends a datagram, false if the ring is full
+    bool Push(const char* data, std::size_t size);
+    /// Removes the oldest datagram, false if the ring is empty
+    bool Pop(char* data, std::size_t& size);
+private:
+    /// Gets the slot for an index
+    char* Slot(boost::uint32_t index)
+        { return m_base + sizeof(SRingHeader) + (index % RING_SLOTS) * SLOT_SIZE; }
+    /// Name of the shared memory object
+    std::string m_name;
+    /// Set if this process created the ring
+    bool m_owner;
+    /// Start of the mapping
+    char* m_base;
+    /// Header of the mapping
+    SRingHeader* m_header;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::CRing::CRing
+/// @description Maps a ring. The consumer creates the ring, replacing one
+///     left behind by an earlier process, and initializes its header. The
+///     producer only opens a ring that the consumer has created, so nothing is
+///     written to a ring that no one reads.
+/// @pre None
+/// @post The ring is mapped into this process.
+/// @ErrorHandling Throws std::runtime_error if the ring cannot be mapped or
+///     was not initialized by its consumer.
+/// @param name The name of the shared memory object
+/// @param create True to create the ring as its consumer
+///////////////////////////////////////////////////////////////////////////////
+CSharedMemoryTransport::CRing::CRing(const std::string& name, bool create)
+    : m_name(name)
+    , m_owner(false)
+    , m_base(0)
+    , m_header(0)
+{
+#ifdef HAVE_SHM_OPEN
+    const std::size_t length = sizeof(SRingHeader) + RING_SLOTS * SLOT_SIZE;
+    int fd;
+    if(create)
+    {
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(fd >= 0 && ftruncate(fd, length) != 0)
+        {
+            close(fd);
+            shm_unlink(name.c_str());
+            fd = -1;
+        }
+    }
+    else
+    {
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+    }
+    if(fd < 0)
+    {
+        throw std::runtime_error("Could not open shared memory " + name + ": "
+            + std::strerror(errno));
+    }
+    m_owner = create;
+
+    void* base = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        if(m_owner)
+        {
+            shm_unlink(name.c_str());
+        }
+        throw std::runtime_error("Could not map shared memory " + name);
+    }
+    m_base = static_cast<char*>(base);
+    m_header = reinterpret_cast<SRingHeader*>(m_base);
+
+    if(create)
+    {
+        m_header->slots = RING_SLOTS;
+        m_header->slotsize = SLOT_SIZE;
+        m_header->head = 0;
+        m_header->tail = 0;
+        __sync_synchronize();
+        m_header->magic = RING_MAGIC;
+    }
+    else if(m_header->magic != RING_MAGIC || m_header->slots != RING_SLOTS ||
+        m_header->slotsize != SLOT_SIZE)
+    {
+        munmap(m_base, length);
+        m_base = 0;
+        throw std::runtime_error("Shared memory " + name + " is not a ring");
+    }
+#else
+    static_cast<void>(create);
+    throw std::runtime_error("Shared memory is not supported");
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::CRing::~CRing
+/// @description Unmaps the ring. The consumer also removes its name, so a
+///     producer that still has it mapped can no longer be found by new ones.
+/// @pre None
+/// @post The ring is unmapped.
+///////////////////////////////////////////////////////////////////////////////
+CSharedMemoryTransport::CRing::~CRing()
+{
+#ifdef HAVE_SHM_OPEN
+    if(m_base != 0)
+    {
+        munmap(m_base, sizeof(SRingHeader) + RING_SLOTS * SLOT_SIZE);
+    }
+    if(m_owner)
+    {
+        shm_unlink(m_name.c_str());
+    }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::CRing::Push
+/// @description Copies a datagram into the next free slot and then publishes
+///     it by advancing the head. The barrier orders the copy before the new
+///     head, so the consumer never sees a partly written slot.
+/// @pre Only one thread of one process pushes to the ring.
+/// @post The datagram is in the ring, unless it was full.
+/// @param data The datagram
+/// @param size The size of the datagram
+/// @return False if the ring is full or the datagram does not fit a slot.
+///////////////////////////////////////////////////////////////////////////////
+bool CSharedMemoryTransport::CRing::Push(const char* data, std::size_t size)
+{
+    if(size > SLOT_SIZE - sizeof(boost::uint32_t))
+    {
+        return false;
+    }
+    boost::uint32_t head = m_header->head;
+    __sync_synchronize();
+    if(head - m_header->tail >= RING_SLOTS)
+    {
+        return false;
+    }
+    char* slot = Slot(head);
+    boost::uint32_t length = size;
+    std::memcpy(slot, &length, sizeof(length));
+    std::memcpy(slot + sizeof(length), data, size);
+    __sync_synchronize();
+    m_header->head = head + 1;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::CRing::Pop
+/// @description Copies the oldest datagram out of the ring and then frees its
+///     slot by advancing the tail.
+/// @pre Only one thread of one process pops from the ring. data holds at
+///     least MAX_PACKET_SIZE bytes.
+/// @post The oldest datagram has been removed, unless the ring was empty.
+/// @param data Receives the datagram
+/// @param size Receives the size of the datagram
+/// @return False if the ring is empty.
+///////////////////////////////////////////////////////////////////////////////
+bool CSharedMemoryTransport::CRing::Pop(char* data, std::size_t& size)
+{
+    boost::uint32_t tail = m_header->tail;
+    if(tail == m_header->head)
+    {
+        return false;
+    }
+    __sync_synchronize();
+    const char* slot = Slot(tail);
+    boost::uint32_t length;
+    std::memcpy(&length, slot, sizeof(length));
+    if(length > SLOT_SIZE - sizeof(length))
+    {
+        length = 0;
+    }
+    std::memcpy(data, slot + sizeof(length), length);
+    size = length;
+    __sync_synchronize();
+    m_header->tail = tail + 1;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::Instance
+/// @description Access the singleton instance of the CSharedMemoryTransport
+/// @pre None
+/// @post The transport has been constructed
+/// @return The CSharedMemoryTransport
+///////////////////////////////////////////////////////////////////////////////
+CSharedMemoryTransport& CSharedMemoryTransport::Instance()
+{
+    static CSharedMemoryTransport instance;
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::CSharedMemoryTransport
+/// @description Constructor. The transport is disabled until Start.
+/// @pre None
+/// @post The transport is disabled.
+///////////////////////////////////////////////////////////////////////////////
+CSharedMemoryTransport::CSharedMemoryTransport()
+    : m_enabled(false)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::Start
+/// @description Enables the transport if the configuration asks for it and
+///     starts the thread that reads the rings from local peers.
+/// @pre The listener has been started.
+/// @post If enabled, connections to peers on this host made after this call
+///     use shared memory.
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryTransport::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!CGlobalConfiguration::Instance().GetSharedMemory())
+    {
+        return;
+    }
+#ifdef HAVE_SHM_OPEN
+    m_enabled = true;
+    m_thread = boost::thread(boost::bind(&CSharedMemoryTransport::Run, this));
+#else
+    LOG_WARN(Logger) << "Shared memory is not supported, local peers use UDP"
+        << std::endl;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::Stop
+/// @description Stops the reader thread and releases every ring.
+/// @pre None
+/// @post The transport is disabled and the inbound rings are removed.
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryTransport::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_enabled)
+    {
+        return;
+    }
+    m_enabled = false;
+    m_thread.interrupt();
+    m_thread.join();
+    m_outbound.clear();
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_inbound.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::Attach
+/// @description Called for each new connection. If the peer runs on this
+///     host, creates the ring it writes to this node and forgets the ring to
+///     the peer, which is opened again by the next Write. A new connection
+///     usually means the peer has restarted with a new ring.
+/// @pre Called on the broker thread.
+/// @post The inbound ring from a local peer exists.
+/// @param uuid The peer of the connection
+/// @param endpoint The UDP endpoint of the peer
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryTransport::Attach(const std::string& uuid,
+    const boost::asio::ip::udp::endpoint& endpoint)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string me = CGlobalConfiguration::Instance().GetUUID();
+    if(!m_enabled || uuid == me || !IsLocal(endpoint))
+    {
+        return;
+    }
+
+    m_outbound[uuid] = SOutbound();
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    if(m_inbound.count(uuid) == 0)
+    {
+        try
+        {
+            SInbound inbound;
+            inbound.ring = boost::make_shared<CRing>(RingName(uuid, me), true);
+            inbound.endpoint = endpoint;
+            m_inbound[uuid] = inbound;
+            LOG_INFO(Logger) << "Receiving from " << uuid << " in shared memory"
+                << std::endl;
+        }
+        catch(std::runtime_error& e)
+        {
+            LOG_WARN(Logger) << e.what() << std::endl;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::Write
+/// @description Writes a datagram into the ring to a local peer. The ring is
+///     opened on first use once the peer has created it; until then, and
+///     whenever the ring is full, the caller sends the datagram over UDP.
+/// @pre Called on the broker thread.
+/// @post The datagram is in the peer's ring, or false is returned.
+/// @param uuid The destination peer
+/// @param data The datagram
+/// @param size The size of the datagram
+/// @return True if the datagram was written to shared memory.
+///////////////////////////////////////////////////////////////////////////////
+bool CSharedMemoryTransport::Write(const std::string& uuid, const char* data,
+    std::size_t size)
+{
+    std::map<std::string, SOutbound>::iterator it = m_outbound.find(uuid);
+    if(!m_enabled || it == m_outbound.end())
+    {
+        return false;
+    }
+    SOutbound& outbound = it->second;
+    if(!outbound.ring)
+    {
+        boost::posix_time::ptime now =
+            boost::posix_time::microsec_clock::universal_time();
+        if(!outbound.retry.is_not_a_date_time() && now < outbound.retry)
+        {
+            return false;
+        }
+        try
+        {
+            outbound.ring = boost::make_shared<CRing>(
+                RingName(CGlobalConfiguration::Instance().GetUUID(), uuid), false);
+            LOG_INFO(Logger) << "Sending to " << uuid << " in shared memory" << std::endl;
+        }
+        catch(std::runtime_error& e)
+        {
+            LOG_DEBUG(Logger) << e.what() << std::endl;
+            outbound.retry = now + boost::posix_time::seconds(1);
+            return false;
+        }
+    }
+    return outbound.ring->Push(data, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::RingName
+/// @description Gets the name of the ring from one DGI to another. The uuids
+///     are hashed since they may hold characters a name cannot.
+/// @pre None
+/// @post None
+/// @param from The producer of the ring
+/// @param to The consumer of the ring
+/// @return The shared memory object name.
+///////////////////////////////////////////////////////////////////////////////
+std::string CSharedMemoryTransport::RingName(const std::string& from,
+    const std::string& to)
+{
+    boost::hash<std::string> string_hash;
+    std::stringstream name;
+    name << "/freedm-" << std::hex << std::setfill('0')
+        << std::setw(16) << string_hash(from) << "-"
+        << std::setw(16) << string_hash(to);
+    return name.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::IsLocal
+/// @description Checks if an endpoint is a loopback address or the address
+///     the listener is bound to.
+/// @pre None
+/// @post None
+/// @param endpoint The endpoint of a peer
+/// @return True if the peer runs on this host.
+///////////////////////////////////////////////////////////////////////////////
+bool CSharedMemoryTransport::IsLocal(const boost::asio::ip::udp::endpoint& endpoint)
+{
+    const boost::asio::ip::address& address = endpoint.address();
+    if(address.is_v4() && (address.to_v4().to_ulong() >> 24) == 127)
+    {
+        return true;
+    }
+    if(address.is_v6() && address.to_v6() == boost::asio::ip::address_v6::loopback())
+    {
+        return true;
+    }
+    boost::system::error_code ec;
+    boost::asio::ip::address listen = boost::asio::ip::address::from_string(
+        CGlobalConfiguration::Instance().GetListenAddress(), ec);
+    return !ec && listen == address && listen != boost::asio::ip::address_v4::any();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSharedMemoryTransport::Run
+/// @description Reads the inbound rings and hands their datagrams to the
+///     listener on the broker thread, as the listener's receive workers do.
+///     When every ring is empty the thread sleeps for POLL_INTERVAL.
+/// @pre Started by Start.
+/// @post Runs until the thread is interrupted.
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryTransport::Run()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::vector<char> buffer(CGlobalConfiguration::MAX_PACKET_SIZE);
+    std::vector<SInbound> rings;
+    try
+    {
+        while(true)
+        {
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                rings.clear();
+                std::map<std::string, SInbound>::iterator it;
+                for(it = m_inbound.begin(); it != m_inbound.end(); it++)
+                {
+                    rings.push_back(it->second);
+                }
+            }
+
+            bool idle = true;
+            for(std::size_t i = 0; i < rings.size(); i++)
+            {
+                std::size_t size;
+                while(rings[i].ring->Pop(&buffer[0], size))
+                {
+                    idle = false;
+                    boost::shared_ptr<ProtocolMessageWindow> pmw = AcquireWindow();
+                    if(pmw->ParseFromArray(&buffer[0], size))
+                    {
+                        CBroker::Instance().GetStrand().post(
+                            boost::bind(&CListener::HandleParsed, &CListener::Instance(),
+                                boost::shared_ptr<const ProtocolMessageWindow>(pmw),
+                                rings[i].endpoint));
+                    }
+                    else
+                    {
+                        LOG_ERROR(Logger) << "Failed to load protobuf" << std::endl;
+                    }
+                }
+            }
+
+            if(idle)
+            {
+                boost::this_thread::sleep(
+                    boost::posix_time::microseconds(POLL_INTERVAL));
+            }
+            else
+            {
+                boost::this_thread::interruption_point();
+            }
+        }
+    }
+    catch(boost::thread_interrupted&)
+    {
+        LOG_DEBUG(Logger) << "Shared memory reader stopped" << std::endl;
+    }
+}
+
+    } // namespace broker
+} // namespace freedm
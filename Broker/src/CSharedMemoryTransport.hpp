@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSharedMemoryTransport.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare the CSharedMemoryTransport class
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSHAREDMEMORYTRANSPORT_HPP
+#define CSHAREDMEMORYTRANSPORT_HPP
+
+#include <map>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Carries the datagrams between DGI processes on one host in shared memory
+class CSharedMemoryTransport
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CSharedMemoryTransport
+    static CSharedMemoryTransport& Instance();
+
+    /// Starts the thread that reads the inbound rings, if enabled
+    void Start();
+
+    /// Stops the reader thread and removes the inbound rings
+    void Stop();
+
+    /// Prepares the rings to a peer if it runs on this host
+    void Attach(const std::string& uuid, const boost::asio::ip::udp::endpoint& endpoint);
+
+    /// Writes a datagram to a local peer, false if it has to go over UDP
+    bool Write(const std::string& uuid, const char* data, std::size_t size);
+private:
+    /// A single producer, single consumer ring of datagrams in shared memory
+    class CRing;
+
+    /// Handle to a mapped ring
+    typedef boost::shared_ptr<CRing> RingPtr;
+
+    /// The ring this node writes to a peer
+    struct SOutbound
+    {
+        /// The ring, empty until the peer has created it
+        RingPtr ring;
+        /// Earliest time to try opening the ring again
+        boost::posix_time::ptime retry;
+    };
+
+    /// The ring a peer writes to this node
+    struct SInbound
+    {
+        /// The ring, owned by this node
+        RingPtr ring;
+        /// UDP endpoint of the peer, reported as the sender
+        boost::asio::ip::udp::endpoint endpoint;
+    };
+
+    /// Private constructor for the singleton instance
+    CSharedMemoryTransport();
+
+    /// Gets the shared memory name of the ring from one DGI to another
+    static std::string RingName(const std::string& from, const std::string& to);
+
+    /// Checks if an endpoint refers to this host
+    static bool IsLocal(const boost::asio::ip::udp::endpoint& endpoint);
+
+    /// Reads the inbound rings until the thread is interrupted
+    void Run();
+
+    /// Set when the transport is configured and supported
+    bool m_enabled;
+
+    /// Rings to local peers, only used by the broker thread
+    std::map<std::string, SOutbound> m_outbound;
+
+    /// Rings from local peers, read by the reader thread
+    std::map<std::string, SInbound> m_inbound;
+
+    /// Protects m_inbound
+    boost::mutex m_mutex;
+
+    /// Thread that reads the inbound rings
+    boost::thread m_thread;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CSHAREDMEMORYTRANSPORT_HPP
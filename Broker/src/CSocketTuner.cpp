@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSocketTuner.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Sizes the buffers of a UDP socket and counts its kernel drops
+///
+/// @functions
+///     CSocketTuner::CSocketTuner
+///     CSocketTuner::Apply
+///     CSocketTuner::ReadControl
+///     CSocketTuner::NoteBurst
+///     CSocketTuner::Grow
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CSocketTuner.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+
+#include <cstring>
+
+#include <boost/asio/socket_base.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Datagrams the kernel dropped before the listener could read them
+CCounter& SocketDropsMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_dropped_datagrams_total", "Datagrams dropped, by reason",
+    CMetrics::Label("reason", "socket"));
+
+/// Growths of the receive buffers by auto-tuning
+CCounter& GrowthsMetric = CMetrics::Instance().GetCounter(
+    "dgi_listener_buffer_growths_total",
+    "Times auto-tuning grew the receive buffer of a listener socket");
+
+#ifdef SO_RXQ_OVFL
+/// Socket option that attaches the drop count of the socket to a datagram.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_RXQ_OVFL>
+    ReceiveOverflow;
+#endif
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSocketTuner::CSocketTuner
+/// @description Creates the tuner of a socket. Nothing is set until Apply.
+/// @pre None
+/// @post None
+/// @param socket The socket to tune, which outlives the tuner.
+///////////////////////////////////////////////////////////////////////////////
+CSocketTuner::CSocketTuner(boost::asio::ip::udp::socket& socket)
+    : m_socket(socket)
+    , m_counting(false)
+    , m_drops(0)
+    , m_receive(0)
+    , m_limit(0)
+    , m_capped(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSocketTuner::Apply
+/// @description Sets the buffer sizes of the configuration and asks the
+///     kernel to attach the drop counts, if they are counted or auto-tuning
+///     is on.
+/// @pre The socket is open.
+/// @post The buffers have the configured sizes, as far as the kernel allows.
+///////////////////////////////////////////////////////////////////////////////
+void CSocketTuner::Apply()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const CGlobalConfiguration& config = CGlobalConfiguration::Instance();
+    boost::system::error_code ec;
+
+    if(config.GetSocketSendBuffer() > 0)
+    {
+        m_socket.set_option(boost::asio::socket_base::send_buffer_size(
+            config.GetSocketSendBuffer()), ec);
+        if(ec)
+        {
+            LOG_WARN(Logger) << "Could not set the send buffer to "
+                << config.GetSocketSendBuffer() << " bytes: " << ec.message()
+                << std::endl;
+        }
+    }
+    if(config.GetSocketReceiveBuffer() > 0)
+    {
+        m_socket.set_option(boost::asio::socket_base::receive_buffer_size(
+            config.GetSocketReceiveBuffer()), ec);
+        if(ec)
+        {
+            LOG_WARN(Logger) << "Could not set the receive buffer to "
+                << config.GetSocketReceiveBuffer() << " bytes: " << ec.message()
+                << std::endl;
+        }
+    }
+
+    boost::asio::socket_base::receive_buffer_size size;
+    m_socket.get_option(size, ec);
+    m_receive = ec ? 0 : size.value();
+    m_limit = config.GetSocketBufferLimit();
+
+    if(config.GetSocketDrops() || m_limit > 0)
+    {
+#ifdef SO_RXQ_OVFL
+        m_socket.set_option(ReceiveOverflow(true), ec);
+        m_counting = !ec;
+#endif
+        if(!m_counting)
+        {
+            LOG_WARN(Logger) << "SO_RXQ_OVFL is not supported, the socket"
+                << " drops are not counted" << std::endl;
+        }
+    }
+    LOG_INFO(Logger) << "Listener socket receive buffer is " << m_receive
+        << " bytes" << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSocketTuner::ReadControl
+/// @description Finds the drop count among the control messages of a read
+///     datagram. The kernel attaches it once the socket has dropped one, and
+///     the count only grows, so the drops since the last read are the
+///     difference to the count seen last.
+/// @pre The datagram was read with recvmsg and room for CONTROL_SIZE.
+/// @post The new drops are counted, and the receive buffer has grown if
+///     auto-tuning is on.
+/// @param hdr The header filled in by recvmsg.
+///////////////////////////////////////////////////////////////////////////////
+void CSocketTuner::ReadControl(msghdr& hdr)
+{
+#ifdef SO_RXQ_OVFL
+    if(!m_counting)
+    {
+        return;
+    }
+    for(cmsghdr* c = CMSG_FIRSTHDR(&hdr); c != NULL; c = CMSG_NXTHDR(&hdr, c))
+    {
+        if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+        {
+            boost::uint32_t drops;
+            std::memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+            if(drops != m_drops)
+            {
+                boost::uint32_t lost = drops - m_drops;
+                m_drops = drops;
+                SocketDropsMetric.Increment(lost);
+                LOG_WARN_LIMITED(Logger, 1) << "The listener socket dropped "
+                    << lost << " datagrams with a " << m_receive
+                    << " byte receive buffer" << std::endl;
+                Grow(2 * m_receive);
+            }
+            return;
+        }
+    }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSocketTuner::NoteBurst
+/// @description Notes the bytes read in one wakeup of the listener, which
+///     were all waiting in the receive buffer at once.
+/// @pre None
+/// @post The receive buffer holds four times the burst, if auto-tuning is on.
+/// @param bytes The bytes of the datagrams read in the wakeup.
+///////////////////////////////////////////////////////////////////////////////
+void CSocketTuner::NoteBurst(std::size_t bytes)
+{
+    if(m_limit > 0 && 4 * bytes > m_receive)
+    {
+        Grow(4 * bytes);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSocketTuner::Grow
+/// @description Asks the kernel for a larger receive buffer, up to the
+///     limit. Linux reports twice the size it was asked for, which makes up
+///     its bookkeeping, so the buffer is kept as the size it reports.
+/// @pre None
+/// @post The receive buffer is at least the given size, or as large as the
+///     limit and the kernel allow.
+/// @param bytes The receive buffer size wanted.
+///////////////////////////////////////////////////////////////////////////////
+void CSocketTuner::Grow(std::size_t bytes)
+{
+    if(m_limit == 0 || m_capped || m_receive >= m_limit || bytes <= m_receive)
+    {
+        return;
+    }
+    if(bytes > m_limit)
+    {
+        bytes = m_limit;
+    }
+
+    boost::system::error_code ec;
+    m_socket.set_option(boost::asio::socket_base::receive_buffer_size(bytes), ec);
+    boost::asio::socket_base::receive_buffer_size size;
+    if(!ec)
+    {
+        m_socket.get_option(size, ec);
+    }
+    if(ec || static_cast<std::size_t>(size.value()) <= m_receive)
+    {
+        m_capped = true;
+        LOG_WARN(Logger) << "The kernel kept the receive buffer at "
+            << m_receive << " bytes instead of " << bytes
+            << ", raise net.core.rmem_max to auto-tune it" << std::endl;
+        return;
+    }
+    m_receive = size.value();
+    GrowthsMetric.Increment();
+    LOG_NOTICE(Logger) << "Grew the listener socket receive buffer to "
+        << m_receive << " bytes" << std::endl;
+}
+
+    } // namespace broker
+} // namespace freedm
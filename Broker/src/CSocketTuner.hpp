@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSocketTuner.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Sizes the buffers of a UDP socket and counts its kernel drops
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSOCKETTUNER_HPP
+#define CSOCKETTUNER_HPP
+
+#include <cstddef>
+
+#include <sys/socket.h>
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Sizes the buffers of one UDP socket and counts the datagrams it dropped
+////////////////////////////////////////////////////////////////////////////////
+/// The kernel drops a datagram that arrives while the receive buffer of its
+/// socket is full, before the listener reads it, and only a resend of the
+/// sending connection makes up for it. The tuner sets the buffer sizes of
+/// socket-receive-buffer and socket-send-buffer, and with socket-drops asks
+/// the kernel for SO_RXQ_OVFL, which attaches the count of the datagrams the
+/// socket has dropped so far to each datagram it reads. The drops between two
+/// reads are counted in dgi_listener_dropped_datagrams_total{reason="socket"}.
+///
+/// With socket-buffer-limit set, the receive buffer grows on its own: to
+/// twice its size once the socket drops a datagram, and to four times the
+/// bytes of the largest burst read in one wakeup, since the kernel charges
+/// each datagram with its bookkeeping as well. It never grows past the limit
+/// and never shrinks.
+///
+/// @limitations The kernel caps the buffers at net.core.rmem_max and
+///     net.core.wmem_max; a smaller size than requested is logged once.
+////////////////////////////////////////////////////////////////////////////////
+class CSocketTuner
+    : private boost::noncopyable
+{
+public:
+    /// Room for the drop count among the control messages of a datagram
+#ifdef SO_RXQ_OVFL
+    static const std::size_t CONTROL_SIZE = CMSG_SPACE(sizeof(boost::uint32_t));
+#else
+    static const std::size_t CONTROL_SIZE = 0;
+#endif
+
+    /// Creates the tuner of a socket that is open but not bound yet
+    explicit CSocketTuner(boost::asio::ip::udp::socket& socket);
+
+    /// Sets the configured buffer sizes and asks for the drop counts
+    void Apply();
+
+    /// Checks if the datagrams carry the drop count of the socket
+    bool CountsDrops() const { return m_counting; }
+
+    /// Reads the drop count among the control messages of a datagram
+    void ReadControl(msghdr& hdr);
+
+    /// Notes the bytes read from the socket in one wakeup
+    void NoteBurst(std::size_t bytes);
+
+private:
+    /// Grows the receive buffer to the given size, up to the limit
+    void Grow(std::size_t bytes);
+
+    /// The socket the tuner sizes
+    boost::asio::ip::udp::socket& m_socket;
+
+    /// True if the kernel attaches the drop count to the datagrams
+    bool m_counting;
+
+    /// The drop count of the last datagram
+    boost::uint32_t m_drops;
+
+    /// The receive buffer size requested from the kernel
+    std::size_t m_receive;
+
+    /// The largest receive buffer auto-tuning may ask for, 0 if it is off
+    std::size_t m_limit;
+
+    /// True once a size smaller than requested has been logged
+    bool m_capped;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CSOCKETTUNER_HPP
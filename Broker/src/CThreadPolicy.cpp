@@ -0,0 +1,313 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CThreadPolicy.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Pins the DGI threads and sets their scheduling policy
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CThreadPolicy.hpp"
+
+#include "CLogger.hpp"
+#include "FreedmExceptions.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Gets the name of a SCHED_ policy
+const char* PolicyName(int policy)
+{
+    switch(policy)
+    {
+        case SCHED_FIFO: return "fifo";
+        case SCHED_RR: return "rr";
+        case SCHED_OTHER: return "other";
+        default: return "unknown";
+    }
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::Instance
+/// @description Access the singleton instance of the thread policy
+/// @pre None
+/// @post None
+/// @return A reference to the thread policy.
+///////////////////////////////////////////////////////////////////////////////
+CThreadPolicy& CThreadPolicy::Instance()
+{
+    static CThreadPolicy instance;
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::Configure
+/// @description Reads the policies given as role:policy[:priority[:cpus]].
+/// @ErrorHandling Throws EDgiConfigError for an unknown role or policy, a
+///     priority outside the range of the policy, or a malformed CPU list.
+/// @pre Called before the threads start.
+/// @post Each named role has a policy.
+/// @param specs the policy of each role.
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPolicy::Configure(const std::vector<std::string>& specs)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for(std::size_t i = 0; i < specs.size(); i++)
+    {
+        std::vector<std::string> fields;
+        boost::algorithm::split(fields, specs[i], boost::algorithm::is_any_of(":"));
+
+        const std::string& role = fields[0];
+        if(role != "broker" && role != "listener" && role != "devices"
+            && role != "mqtt")
+        {
+            throw EDgiConfigError("unknown thread role: " + specs[i]);
+        }
+        if(fields.size() < 2 || fields.size() > 4)
+        {
+            throw EDgiConfigError("invalid thread policy: " + specs[i]);
+        }
+
+        SPolicy policy;
+        if(fields[1] == "other")
+        {
+            policy.policy = SCHED_OTHER;
+        }
+        else if(fields[1] == "fifo")
+        {
+            policy.policy = SCHED_FIFO;
+        }
+        else if(fields[1] == "rr")
+        {
+            policy.policy = SCHED_RR;
+        }
+        else
+        {
+            throw EDgiConfigError("unknown scheduling policy: " + specs[i]);
+        }
+
+        policy.priority = 0;
+        if(fields.size() > 2 && !fields[2].empty())
+        {
+            try
+            {
+                policy.priority = boost::lexical_cast<int>(fields[2]);
+            }
+            catch(boost::bad_lexical_cast&)
+            {
+                throw EDgiConfigError("invalid thread priority: " + specs[i]);
+            }
+        }
+        if(policy.priority < sched_get_priority_min(policy.policy)
+            || policy.priority > sched_get_priority_max(policy.policy))
+        {
+            throw EDgiConfigError("thread priority out of range: " + specs[i]);
+        }
+
+        if(fields.size() > 3)
+        {
+            policy.cpus = ParseCpus(fields[3]);
+            if(policy.cpus.empty())
+            {
+                throw EDgiConfigError("invalid cpu list: " + specs[i]);
+            }
+        }
+        m_policies[role] = policy;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::ParseCpus
+/// @description Reads a list of CPUs and ranges of CPUs such as 0,2-3.
+/// @pre None
+/// @post None
+/// @param text the list of CPUs.
+/// @return The CPUs, or an empty list if the text is malformed.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<int> CThreadPolicy::ParseCpus(const std::string& text)
+{
+    std::vector<std::string> ranges;
+    std::vector<int> cpus;
+    boost::algorithm::split(ranges, text, boost::algorithm::is_any_of(","));
+
+    try
+    {
+        for(std::size_t i = 0; i < ranges.size(); i++)
+        {
+            std::string::size_type dash = ranges[i].find('-');
+            int first = boost::lexical_cast<int>(ranges[i].substr(0, dash));
+            int last = first;
+            if(dash != std::string::npos)
+            {
+                last = boost::lexical_cast<int>(ranges[i].substr(dash + 1));
+            }
+            if(first < 0 || last < first || last >= CPU_SETSIZE)
+            {
+                return std::vector<int>();
+            }
+            for(int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    catch(boost::bad_lexical_cast&)
+    {
+        return std::vector<int>();
+    }
+    return cpus;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::Apply
+/// @description Sets the affinity and scheduling of the calling thread to the
+///     policy of its role, then reports what the thread runs with.
+/// @ErrorHandling A setting the OS refuses, usually for want of privileges,
+///     is logged and the thread keeps running as it was.
+/// @pre Configure has been called.
+/// @post The calling thread runs with the policy of its role.
+/// @param role the role of the calling thread.
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPolicy::Apply(const std::string& role)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<std::string, SPolicy>::const_iterator it = m_policies.find(role);
+    if(it == m_policies.end())
+    {
+        return;
+    }
+    const SPolicy& policy = it->second;
+
+    if(!policy.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(std::size_t i = 0; i < policy.cpus.size(); i++)
+        {
+            CPU_SET(policy.cpus[i], &set);
+        }
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(error != 0)
+        {
+            LOG_WARN(Logger)<<"Cannot pin the "<<role<<" thread: "
+                <<std::strerror(error)<<std::endl;
+        }
+    }
+
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = policy.priority;
+    int error = pthread_setschedparam(pthread_self(), policy.policy, &param);
+    if(error != 0)
+    {
+        LOG_WARN(Logger)<<"Cannot set the "<<PolicyName(policy.policy)
+            <<" policy of the "<<role<<" thread: "<<std::strerror(error)<<std::endl;
+    }
+
+    Report(role);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::ApplyOnce
+/// @description Applies the policy of a role on the first call from each
+///     thread, for the threads a library creates and calls back on.
+/// @pre Configure has been called.
+/// @post The calling thread runs with the policy of its role.
+/// @param role the role of the calling thread.
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPolicy::ApplyOnce(const std::string& role)
+{
+    if(m_policies.empty() || m_applied.get() != 0)
+    {
+        return;
+    }
+    m_applied.reset(new bool(true));
+    Apply(role);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::Report
+/// @description Logs the policy, priority and CPUs of the calling thread as
+///     the OS reports them.
+/// @pre None
+/// @post None
+/// @param role the role of the calling thread.
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPolicy::Report(const std::string& role)
+{
+    int policy;
+    sched_param param;
+    cpu_set_t set;
+    std::ostringstream cpus;
+
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    if(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if(CPU_ISSET(cpu, &set))
+            {
+                cpus<<(cpus.tellp() > 0 ? "," : "")<<cpu;
+            }
+        }
+    }
+    LOG_NOTICE(Logger)<<"The "<<role<<" thread runs with the "<<PolicyName(policy)
+        <<" policy at priority "<<param.sched_priority<<" on cpus "
+        <<cpus.str()<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CThreadPolicy::LockMemory
+/// @description Locks the current and future pages of the process in memory,
+///     so a page fault never waits for the disk.
+/// @ErrorHandling A refusal of the OS is logged and the memory stays pageable.
+/// @pre None
+/// @post The memory of the process is locked if the OS allows it.
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPolicy::LockMemory()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        LOG_WARN(Logger)<<"Cannot lock the memory of the process: "
+            <<std::strerror(errno)<<std::endl;
+        return;
+    }
+    LOG_NOTICE(Logger)<<"The memory of the process is locked"<<std::endl;
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CThreadPolicy.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Pins the DGI threads and sets their scheduling policy
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CTHREADPOLICY_HPP
+#define CTHREADPOLICY_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Applies the configured CPU affinity and scheduling of each thread role
+////////////////////////////////////////////////////////////////////////////////
+/// A policy is given as role:policy[:priority[:cpus]], where the role is one
+/// of broker, listener, devices or mqtt, the policy one of other, fifo or rr,
+/// the priority a real time priority for fifo and rr, and the cpus a list
+/// such as 0,2-3. Each thread applies the policy of its role as it starts and
+/// reports what it got, so a missing privilege shows in the log rather than
+/// stopping the DGI. A role without a policy keeps what the OS gives it.
+////////////////////////////////////////////////////////////////////////////////
+class CThreadPolicy
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CThreadPolicy
+    static CThreadPolicy& Instance();
+
+    /// Reads the policy of each role
+    void Configure(const std::vector<std::string>& specs);
+
+    /// Applies the policy of a role to the calling thread
+    void Apply(const std::string& role);
+
+    /// Applies the policy of a role the first time a thread calls it
+    void ApplyOnce(const std::string& role);
+
+    /// Locks the process memory so that it is never paged out
+    static void LockMemory();
+
+private:
+    /// The policy of a thread role
+    struct SPolicy
+    {
+        /// The SCHED_ policy
+        int policy;
+        /// The real time priority, 0 for SCHED_OTHER
+        int priority;
+        /// The CPUs the thread may run on, empty for any
+        std::vector<int> cpus;
+    };
+
+    /// Private constructor for the singleton instance
+    CThreadPolicy() { }
+
+    /// Reads a list of CPUs such as 0,2-3
+    static std::vector<int> ParseCpus(const std::string& text);
+
+    /// Logs the policy the calling thread runs with
+    static void Report(const std::string& role);
+
+    /// The policy of each role
+    std::map<std::string, SPolicy> m_policies;
+
+    /// Set on the threads that applied their policy
+    boost::thread_specific_ptr<bool> m_applied;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CTHREADPOLICY_HPP
@@ -25,6 +25,7 @@
 #include "FreedmExceptions.hpp"
 
 #include <fstream>
+#include <stdexcept>
 
 #include <boost/foreach.hpp>
 #include <boost/range/adaptor/map.hpp>
@@ -39,14 +40,48 @@ CLocalLogger Logger(__FILE__);
 
 }
 
-CTimings::TimingMap CTimings::timing_values;
+const char* const CTimings::TIMING_NAMES[CTimings::TIMING_COUNT] =
+{
+    "GM_AYC_RESPONSE_TIMEOUT",
+    "GM_PREMERGE_MAX_TIMEOUT",
+    "GM_INVITE_RESPONSE_TIMEOUT",
+    "GM_AYT_RESPONSE_TIMEOUT",
+    "GM_PREMERGE_MIN_TIMEOUT",
+    "GM_PREMERGE_GRANULARITY",
+    "GM_PHASE_TIME",
+    "LB_PHASE_TIME",
+    "LB_ROUND_TIME",
+    "LB_REQUEST_TIMEOUT",
+    "VVC_PHASE_TIME",
+    "VVC_ROUND_TIME",
+    "VVC_REQUEST_TIMEOUT",
+    "SC_PHASE_TIME",
+    "DEV_PNP_HEARTBEAT",
+    "DEV_RTDS_DELAY",
+    "DEV_SOCKET_TIMEOUT",
+    "CSRC_RESEND_TIME",
+    "CSRC_DEFAULT_TIMEOUT"
+    /////////////////////////////////////////////
+    // ADD YOUR TIMING PARAMETERS ABOVE HERE
+    /////////////////////////////////////////////
+};
+
+CTimings::TimingMap CTimings::timing_handles;
+
+unsigned int CTimings::timing_values[CTimings::TIMING_COUNT];
+
+boost::posix_time::time_duration CTimings::timing_durations[CTimings::TIMING_COUNT];
+
+std::string CTimings::timings_file;
+
+unsigned int CTimings::timing_version = 0;
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CTimings::TimingParameters
 /// @description Registers all the expected timing values with the
 ///     configuration file loader. If a programmer needs to add timing values,
-///     they should make additional calls to RegisterTimingValue in this
-///     function, which will add their value to the DGI.
+///     they should add a handle to ETiming and its name to TIMING_NAMES,
+///     which will add their value to the DGI.
 /// @pre None
 /// @post The program options have been modified to include the new timings
 ///     options added by this function
@@ -55,40 +90,18 @@ CTimings::TimingMap CTimings::timing_values;
 ///////////////////////////////////////////////////////////////////////////////
 void CTimings::TimingParameters(po::options_description& opts)
 {
-
-    RegisterTimingValue(opts,"GM_AYC_RESPONSE_TIMEOUT");
-    RegisterTimingValue(opts,"GM_PREMERGE_MAX_TIMEOUT");
-    RegisterTimingValue(opts,"GM_INVITE_RESPONSE_TIMEOUT");
-    RegisterTimingValue(opts,"GM_AYT_RESPONSE_TIMEOUT");
-    RegisterTimingValue(opts,"GM_PREMERGE_MIN_TIMEOUT");
-    RegisterTimingValue(opts,"GM_PREMERGE_GRANULARITY");
-    RegisterTimingValue(opts,"GM_PHASE_TIME");
-    RegisterTimingValue(opts,"LB_PHASE_TIME");
-    RegisterTimingValue(opts,"LB_ROUND_TIME");
-    RegisterTimingValue(opts,"LB_REQUEST_TIMEOUT");
-    RegisterTimingValue(opts,"VVC_PHASE_TIME");
-    RegisterTimingValue(opts,"VVC_ROUND_TIME");
-    RegisterTimingValue(opts,"VVC_REQUEST_TIMEOUT");    
-    RegisterTimingValue(opts,"SC_PHASE_TIME");
-    RegisterTimingValue(opts,"DEV_PNP_HEARTBEAT");
-    RegisterTimingValue(opts,"DEV_RTDS_DELAY");
-    RegisterTimingValue(opts,"DEV_SOCKET_TIMEOUT");
-    RegisterTimingValue(opts,"CSRC_RESEND_TIME");
-    RegisterTimingValue(opts,"CSRC_DEFAULT_TIMEOUT");
-    /////////////////////////////////////////////
-    // ADD YOUR TIMING PARAMETERS BELOW HERE
-    /////////////////////////////////////////////
-
-    /////////////////////////////////////////////
-    // ADD YOUR TIMING PARAMETERS ABOVE HERE
-    ////////////////////////////////////////////
+    for(int param = 0; param < TIMING_COUNT; param++)
+    {
+        RegisterTimingValue(opts, static_cast<ETiming>(param));
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CTimings::Get
 /// @description Returns the value of the specified timing parameter, in
 ///     milliseconds, or throws an exception if the timing parameter does not
-///     exist in the timings set.
+///     exist in the timings set. The modules use the handles of ETiming
+///     instead, which do not look up the name each time.
 /// @pre None
 /// @post Throws exception if timing parameter has not been registered.
 /// @return The requested timing parameter in ms.
@@ -96,10 +109,28 @@ void CTimings::TimingParameters(po::options_description& opts)
 unsigned int CTimings::Get(std::string param)
 {
     TimingMapIterator it;
-    it = timing_values.find(param);
-    if(it == timing_values.end())
+    it = timing_handles.find(param);
+    if(it == timing_handles.end())
         throw std::runtime_error("CTimings:: Requested timing parameter, "+param+", does not exist");
-    return it->second;  
+    return timing_values[it->second];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTimings::Set
+/// @description Changes the value of a timing parameter. Timers armed after
+///     the change use the new value; the modules that copied a value when
+///     they were created keep the old one.
+/// @pre Called on the broker strand, like the timers that read the value.
+/// @post Get and GetDuration return the new value.
+/// @param param the timing parameter to change.
+/// @param ms the new value in milliseconds.
+///////////////////////////////////////////////////////////////////////////////
+void CTimings::Set(ETiming param, unsigned int ms)
+{
+    timing_values[param] = ms;
+    timing_durations[param] = boost::posix_time::milliseconds(ms);
+    LOG_NOTICE(Logger) << TIMING_NAMES[param] << " set to " << ms << " ms"
+        << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -108,18 +139,19 @@ unsigned int CTimings::Get(std::string param)
 ///     parser.
 /// @pre None
 /// @post The configuration file parser expects a new parameter when loading
-///     the file. The timing value for the parameter is defaulted to zero.
+///     the file.
 /// @param opts The options parser that will parse the timings config
-/// @param param the name of the timing parameter being added.
+/// @param param the timing parameter being added.
 ///////////////////////////////////////////////////////////////////////////////
-void CTimings::RegisterTimingValue(po::options_description& opts, const std::string param)
+void CTimings::RegisterTimingValue(po::options_description& opts, ETiming param)
 {
-    std::string desc = "The timing value "+param;
+    const std::string name = TIMING_NAMES[param];
+    std::string desc = "The timing value "+name;
     opts.add_options()
-        (param.c_str(),
+        (name.c_str(),
         po::value<unsigned int>( ),
         desc.c_str() );
-    timing_values[param] = 0;    
+    timing_handles[name] = param;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -130,10 +162,67 @@ void CTimings::RegisterTimingValue(po::options_description& opts, const std::str
 /// @pre None
 /// @post The timings values are loaded from the specified file, or an
 ///     exception is thrown because the file was missing one or more timing
-///     parameters.
+///     parameters. The file is remembered for Reload.
 /// @param timingsFile The name of the file that contains the timings config.
 ///////////////////////////////////////////////////////////////////////////////
 void CTimings::SetTimings(const std::string timingsFile)
+{
+    unsigned int values[TIMING_COUNT];
+
+    Load(timingsFile, values);
+    for(int i = 0; i < TIMING_COUNT; i++)
+    {
+        timing_values[i] = values[i];
+        timing_durations[i] = boost::posix_time::milliseconds(values[i]);
+    }
+    timings_file = timingsFile;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTimings::Reload
+/// @description Loads the timing configuration file given to SetTimings
+///     again. Like Set, the timers armed after the reload use the new values.
+///     The file is read in full before any value changes, so a file that
+///     cannot be read leaves every value as it was.
+/// @pre SetTimings has loaded a file. Called on the broker strand.
+/// @post The values are those of the file and GetVersion has changed, or an
+///     exception is thrown and nothing changed.
+/// @ErrorHandling Throws EDgiConfigError if the file cannot be read or is
+///     missing a parameter.
+/// @return The number of values that changed.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CTimings::Reload()
+{
+    unsigned int values[TIMING_COUNT];
+    unsigned int changed = 0;
+
+    Load(timings_file, values);
+    for(int i = 0; i < TIMING_COUNT; i++)
+    {
+        if(timing_values[i] != values[i])
+        {
+            LOG_NOTICE(Logger) << TIMING_NAMES[i] << " reloaded from "
+                << timing_values[i] << " to " << values[i] << " ms" << std::endl;
+            timing_values[i] = values[i];
+            timing_durations[i] = boost::posix_time::milliseconds(values[i]);
+            changed++;
+        }
+    }
+    timing_version++;
+    return changed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTimings::Load
+/// @description Reads every timing value from a timing configuration file.
+/// @pre None
+/// @post values holds the value of each parameter, by handle.
+/// @ErrorHandling Throws EDgiConfigError if the file cannot be opened or is
+///     missing a parameter.
+/// @param timingsFile The name of the file that contains the timings config.
+/// @param values Where to store the values in milliseconds.
+///////////////////////////////////////////////////////////////////////////////
+void CTimings::Load(const std::string& timingsFile, unsigned int values[])
 {
     std::ifstream ifs;
 
@@ -153,27 +242,25 @@ void CTimings::SetTimings(const std::string timingsFile)
         // Process the config
         po::store(parse_config_file(ifs, opts), vm);
         po::notify(vm);
-        Logger.Info << "timer config file " << timingsFile <<
+        LOG_INFO(Logger) << "timer config file " << timingsFile <<
                 " successfully loaded." << std::endl;
     }
     ifs.close();
 
-    TimingMapIterator it;
-    for(it=timing_values.begin(); it!=timing_values.end(); it++)
+    for(int i = 0; i < TIMING_COUNT; i++)
     {
-        param = it->first;
+        param = TIMING_NAMES[i];
         try
         {
-            timing_values[param] = vm[param].as<unsigned int>();
+            values[i] = vm[param].as<unsigned int>();
         }
         catch (boost::bad_any_cast& e)
         {
             throw EDgiConfigError(
                     param+" is missing, please check your timings config");
         }
-    } 
+    }
 }
 
 }
 }
-
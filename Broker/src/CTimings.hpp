@@ -23,6 +23,7 @@
 #include <string>
 #include <map>
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/program_options.hpp>
 #include <boost/program_options/options_description.hpp>
 
@@ -36,21 +37,73 @@ namespace broker {
 class CTimings
 {
 public:
+    /// Handles of the timing parameters, in the order of TIMING_NAMES
+    enum ETiming
+    {
+        GM_AYC_RESPONSE_TIMEOUT,
+        GM_PREMERGE_MAX_TIMEOUT,
+        GM_INVITE_RESPONSE_TIMEOUT,
+        GM_AYT_RESPONSE_TIMEOUT,
+        GM_PREMERGE_MIN_TIMEOUT,
+        GM_PREMERGE_GRANULARITY,
+        GM_PHASE_TIME,
+        LB_PHASE_TIME,
+        LB_ROUND_TIME,
+        LB_REQUEST_TIMEOUT,
+        VVC_PHASE_TIME,
+        VVC_ROUND_TIME,
+        VVC_REQUEST_TIMEOUT,
+        SC_PHASE_TIME,
+        DEV_PNP_HEARTBEAT,
+        DEV_RTDS_DELAY,
+        DEV_SOCKET_TIMEOUT,
+        CSRC_RESEND_TIME,
+        CSRC_DEFAULT_TIMEOUT,
+        /////////////////////////////////////////////
+        // ADD YOUR TIMING PARAMETERS ABOVE HERE
+        // AND THEIR NAMES TO TIMING_NAMES
+        /////////////////////////////////////////////
+        /// The number of timing parameters
+        TIMING_COUNT
+    };
     /// Loads timings values from the specified file
     static void SetTimings(const std::string timingsFile);
-    /// Returns the value of the specified timing parameter
+    /// Returns the value of a timing parameter in milliseconds
+    static unsigned int Get(ETiming param) { return timing_values[param]; }
+    /// Returns the value of a timing parameter as a duration
+    static const boost::posix_time::time_duration& GetDuration(ETiming param)
+        { return timing_durations[param]; }
+    /// Returns the value of the timing parameter with the specified name
     static unsigned int Get(const std::string param);
+    /// Changes the value of a timing parameter while the DGI runs
+    static void Set(ETiming param, unsigned int ms);
+    /// Loads the timings file again while the DGI runs
+    static unsigned int Reload();
+    /// Returns how many times the timings file has been reloaded
+    static unsigned int GetVersion() { return timing_version; }
 private:
-    /// Typedef for timing datastore.
-    typedef std::map<std::string, unsigned int> TimingMap;
+    /// Typedef for the handles by name.
+    typedef std::map<std::string, ETiming> TimingMap;
     /// Typedef for timing datastore iterator
-    typedef TimingMap::iterator TimingMapIterator;
+    typedef TimingMap::const_iterator TimingMapIterator;
     /// Registers all the expected timing parameters
     static void TimingParameters(po::options_description& opts);
     /// Adds individual parameter to the expected options
-	static void RegisterTimingValue(po::options_description&, const std::string param);
-    /// Data store for the timing parameter values
-    static TimingMap timing_values;
+	static void RegisterTimingValue(po::options_description&, ETiming param);
+    /// Reads every timing value from a file
+    static void Load(const std::string& timingsFile, unsigned int values[]);
+    /// The names of the parameters in the timings file, by handle
+    static const char* const TIMING_NAMES[TIMING_COUNT];
+    /// The handles of the parameters, by name
+    static TimingMap timing_handles;
+    /// Data store for the timing parameter values in milliseconds
+    static unsigned int timing_values[TIMING_COUNT];
+    /// The timing parameter values as durations
+    static boost::posix_time::time_duration timing_durations[TIMING_COUNT];
+    /// The file the timing values were loaded from
+    static std::string timings_file;
+    /// The number of reloads of the timings file
+    static unsigned int timing_version;
 
 };
 
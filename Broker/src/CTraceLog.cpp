@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CTraceLog.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Binary event trace written to a memory-mapped ring file
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CTraceLog.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The universal time the trace time stamps count from
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970,1,1));
+
+/// Copies a string into a fixed field, truncated and padded with zeros
+void CopyField(char* field, std::size_t size, const char* text)
+{
+    std::strncpy(field, text, size);
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTraceLog::Instance
+/// @description Access the singleton instance of the trace log
+/// @pre None
+/// @post None
+/// @return A reference to the trace log.
+///////////////////////////////////////////////////////////////////////////////
+CTraceLog& CTraceLog::Instance()
+{
+    static CTraceLog trace;
+    return trace;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTraceLog::CTraceLog
+/// @description Creates a trace log that records nothing until Start.
+/// @pre None
+/// @post The trace log is disabled.
+///////////////////////////////////////////////////////////////////////////////
+CTraceLog::CTraceLog()
+    : m_header(0)
+    , m_records(0)
+    , m_length(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTraceLog::~CTraceLog
+/// @description Unmaps the trace file. The records stay in the file.
+/// @pre None
+/// @post The trace file is unmapped.
+///////////////////////////////////////////////////////////////////////////////
+CTraceLog::~CTraceLog()
+{
+    if(m_header != 0)
+    {
+        munmap(m_header, m_length);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTraceLog::Start
+/// @description Creates the configured trace file with room for the
+///     configured number of records and maps it. The file is shared with the
+///     kernel page cache, so the records written before a crash are kept.
+/// @pre None
+/// @post Events are recorded if a trace file is configured.
+/// @ErrorHandling Throws std::runtime_error if the file cannot be created
+///     or mapped.
+///////////////////////////////////////////////////////////////////////////////
+void CTraceLog::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string path = CGlobalConfiguration::Instance().GetTraceFile();
+    boost::uint64_t capacity = CGlobalConfiguration::Instance().GetTraceRecords();
+
+    if(path.empty() || m_header != 0)
+    {
+        return;
+    }
+
+    std::size_t length = sizeof(STraceHeader) + capacity * sizeof(STraceRecord);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || ftruncate(fd, length) != 0)
+    {
+        std::string error = std::strerror(errno);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error("Could not create trace file " + path + ": "
+            + error);
+    }
+
+    void* base = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map trace file " + path);
+    }
+
+    STraceHeader* header = static_cast<STraceHeader*>(base);
+    std::memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->record_size = sizeof(STraceRecord);
+    header->capacity = capacity;
+    header->head = 0;
+
+    m_length = length;
+    m_header = header;
+    __sync_synchronize();
+    m_records = reinterpret_cast<STraceRecord*>(header + 1);
+    LOG_NOTICE(Logger) << "Tracing " << capacity << " events to " << path
+            << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTraceLog::Emit
+/// @description Writes an event to the next record of the ring, overwriting
+///     the oldest one once the ring is full. Threads claim records with an
+///     atomic increment, so emitting takes no lock.
+/// @pre None
+/// @post The event is recorded if the trace log is enabled.
+/// @param event the kind of event.
+/// @param module the module the event belongs to.
+/// @param peer the UUID of the peer involved, or empty.
+/// @param hash the hash of the message involved, or 0.
+/// @param value a number that depends on the event.
+///////////////////////////////////////////////////////////////////////////////
+void CTraceLog::Emit(ETraceEvent event, const char* module,
+    const std::string& peer, boost::uint64_t hash, boost::uint32_t value)
+{
+    if(m_records == 0)
+    {
+        return;
+    }
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    now += CGlobalConfiguration::Instance().GetClockSkew();
+
+    boost::uint64_t seq = __sync_fetch_and_add(&m_header->head, 1);
+    STraceRecord& record = m_records[seq % m_header->capacity];
+    record.sequence = 0;
+    __sync_synchronize();
+    record.time = (now - EPOCH).total_microseconds();
+    record.hash = hash;
+    record.event = event;
+    record.value = value;
+    CopyField(record.module, sizeof(record.module), module);
+    CopyField(record.peer, sizeof(record.peer), peer.c_str());
+    __sync_synchronize();
+    record.sequence = seq + 1;
+}
+
+    } // namespace broker
+} // namespace freedm
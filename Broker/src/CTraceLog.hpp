@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CTraceLog.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Declare the CTraceLog class and the trace file layout
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CTRACELOG_HPP
+#define CTRACELOG_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// The events recorded in the trace file
+enum ETraceEvent
+{
+    /// A module's phase started; value is the phase length in milliseconds
+    TRACE_PHASE = 1,
+    /// A message was handed to the modules listening on its recipient
+    TRACE_DISPATCH = 2,
+    /// A message was queued by a SR connection; value is its piece count
+    TRACE_SR_QUEUE = 3,
+    /// A SR connection refused a message because its queue was full
+    TRACE_SR_REFUSE = 4,
+    /// An acknowledgement retired a message of a SR connection
+    TRACE_SR_ACK = 5,
+    /// A SR message expired before it was acknowledged
+    TRACE_SR_EXPIRE = 6,
+    /// A SR message was accepted; value is its sequence number
+    TRACE_SR_ACCEPT = 7,
+    /// A SR message was rejected as old or out of order
+    TRACE_SR_REJECT = 8,
+    /// A SR connection was synchronized by its peer
+    TRACE_SR_SYNC = 9,
+    /// A SR connection gave up on its peer
+    TRACE_SR_RESET = 10
+};
+
+/// Gets the name of a trace event, used by the decoder
+inline const char* GetTraceEventName(unsigned int event)
+{
+    switch(event)
+    {
+        case TRACE_PHASE: return "phase";
+        case TRACE_DISPATCH: return "dispatch";
+        case TRACE_SR_QUEUE: return "sr-queue";
+        case TRACE_SR_REFUSE: return "sr-refuse";
+        case TRACE_SR_ACK: return "sr-ack";
+        case TRACE_SR_EXPIRE: return "sr-expire";
+        case TRACE_SR_ACCEPT: return "sr-accept";
+        case TRACE_SR_REJECT: return "sr-reject";
+        case TRACE_SR_SYNC: return "sr-sync";
+        case TRACE_SR_RESET: return "sr-reset";
+        default: return "unknown";
+    }
+}
+
+/// The header at the start of a trace file
+struct STraceHeader
+{
+    /// TRACE_MAGIC
+    char magic[8];
+    /// TRACE_VERSION
+    boost::uint32_t version;
+    /// The size of a record in bytes
+    boost::uint32_t record_size;
+    /// The number of records in the ring
+    boost::uint64_t capacity;
+    /// The number of records ever written
+    volatile boost::uint64_t head;
+    /// Unused, keeps the records aligned
+    char reserved[32];
+};
+
+/// One event in a trace file
+struct STraceRecord
+{
+    /// Position of the record in the trace plus one, 0 while it is written
+    volatile boost::uint64_t sequence;
+    /// Synchronized microseconds since the epoch
+    boost::uint64_t time;
+    /// Hash of the message, 0 if the event has no message
+    boost::uint64_t hash;
+    /// The ETraceEvent
+    boost::uint32_t event;
+    /// A number that depends on the event
+    boost::uint32_t value;
+    /// The module, padded with zeros
+    char module[8];
+    /// The first characters of the peer's UUID, padded with zeros
+    char peer[8];
+};
+
+/// Identifies a trace file
+const char TRACE_MAGIC[8] = { 'F', 'R', 'E', 'E', 'D', 'M', 'T', 'R' };
+
+/// The layout version of the trace file
+const boost::uint32_t TRACE_VERSION = 1;
+
+/// Records fixed-size events in a memory-mapped ring file
+class CTraceLog
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CTraceLog
+    static CTraceLog& Instance();
+
+    /// Creates and maps the trace file, if one is configured
+    void Start();
+
+    /// True if events are being recorded
+    bool IsEnabled() const { return m_records != 0; }
+
+    /// Records an event
+    void Emit(ETraceEvent event, const char* module,
+        const std::string& peer, boost::uint64_t hash, boost::uint32_t value = 0);
+
+private:
+    /// Private constructor for the singleton instance
+    CTraceLog();
+
+    /// Unmaps the trace file
+    ~CTraceLog();
+
+    /// The mapped header
+    STraceHeader* m_header;
+
+    /// The mapped records
+    STraceRecord* m_records;
+
+    /// The size of the mapping in bytes
+    std::size_t m_length;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CTRACELOG_HPP
@@ -0,0 +1,255 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CTrafficAccounting.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Counts the traffic of each module, message type and peer
+///
+/// @functions
+///     CTrafficAccounting::Instance
+///     CTrafficAccounting::IsEnabled
+///     CTrafficAccounting::CTrafficAccounting
+///     CTrafficAccounting::Account
+///     CTrafficAccounting::AccountFragment
+///     CTrafficAccounting::Add
+///     CTrafficAccounting::Summarize
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CTrafficAccounting.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "Messages.hpp"
+#include "messages/ModuleMessage.pb.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The most tallies a summary lists
+const std::size_t SUMMARY_SIZE = 10;
+
+/// Orders the tallies of a summary by their bytes, largest first
+template <typename EntryType>
+bool MoreBytes(const EntryType& a, const EntryType& b)
+{
+    return a.first > b.first;
+}
+
+/// The label value of each direction
+const char* DirectionName(CTrafficAccounting::EDirection direction)
+{
+    switch(direction)
+    {
+        case CTrafficAccounting::SENT:
+            return "sent";
+        case CTrafficAccounting::RESENT:
+            return "resent";
+        default:
+            return "received";
+    }
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::Instance
+/// @description Access the singleton instance of the traffic accounting
+/// @pre None
+/// @post None
+/// @return A reference to the traffic accounting.
+///////////////////////////////////////////////////////////////////////////////
+CTrafficAccounting& CTrafficAccounting::Instance()
+{
+    static CTrafficAccounting accounting;
+    return accounting;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::IsEnabled
+/// @description Checks if the traffic of the messages should be counted.
+/// @pre None
+/// @post None
+/// @return The traffic-accounting option.
+///////////////////////////////////////////////////////////////////////////////
+bool CTrafficAccounting::IsEnabled()
+{
+    return CGlobalConfiguration::Instance().GetTrafficAccounting();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::CTrafficAccounting
+/// @description Starts the first summary interval.
+/// @pre None
+/// @post The first summary is due one interval from now.
+///////////////////////////////////////////////////////////////////////////////
+CTrafficAccounting::CTrafficAccounting()
+    : m_summarized(boost::posix_time::microsec_clock::universal_time())
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::Account
+/// @description Counts a module message under the module it is addressed to
+///     and the type of the message it carries.
+/// @pre None
+/// @post The tally of the message has grown by one message and its bytes.
+/// @param direction Whether the message was sent, resent or received.
+/// @param msg The module message.
+/// @param peer The UUID of the peer the message was written to or read from.
+/// @param bytes The size of the module message on the wire.
+///////////////////////////////////////////////////////////////////////////////
+void CTrafficAccounting::Account(EDirection direction, const ModuleMessage& msg,
+    const std::string& peer, std::size_t bytes)
+{
+    Add(direction, msg.recipient_module(), GetMessageType(msg, 2), peer, bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::AccountFragment
+/// @description Counts a piece of a split message, which no longer names the
+///     module or the type of the message it belongs to.
+/// @pre None
+/// @post The tally of the split pieces has grown by one message and its bytes.
+/// @param direction Whether the piece was sent, resent or received.
+/// @param peer The UUID of the peer the piece was written to or read from.
+/// @param bytes The size of the piece.
+///////////////////////////////////////////////////////////////////////////////
+void CTrafficAccounting::AccountFragment(EDirection direction,
+    const std::string& peer, std::size_t bytes)
+{
+    Add(direction, "split", "fragment", peer, bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::Add
+/// @description Adds a message to the tally of its labels. The counters of a
+///     tally are registered with the metrics the first time it is used. The
+///     summary is logged from here once its interval has passed.
+/// @pre None
+/// @post The tally of the labels has grown by one message and its bytes.
+/// @param direction Whether the message was sent, resent or received.
+/// @param module The module label.
+/// @param type The message type label.
+/// @param peer The peer label.
+/// @param bytes The size of the message.
+///////////////////////////////////////////////////////////////////////////////
+void CTrafficAccounting::Add(EDirection direction, const std::string& module,
+    const std::string& type, const std::string& peer, std::size_t bytes)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const std::string label = CMetrics::Label("direction", DirectionName(direction))
+        + "," + CMetrics::Label("module", module)
+        + "," + CMetrics::Label("type", type)
+        + "," + CMetrics::Label("peer", peer);
+
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    std::map<std::string, STally>::iterator it = m_tallies.find(label);
+    if(it == m_tallies.end())
+    {
+        CMetrics& metrics = CMetrics::Instance();
+
+        STally tally;
+        tally.bytes = &metrics.GetCounter("dgi_traffic_bytes_total",
+            "Module message bytes by direction, module, message type and peer",
+            label);
+        tally.messages = &metrics.GetCounter("dgi_traffic_messages_total",
+            "Module messages by direction, module, message type and peer",
+            label);
+        tally.recentBytes = 0;
+        tally.recentMessages = 0;
+        it = m_tallies.insert(std::make_pair(label, tally)).first;
+    }
+    it->second.bytes->Increment(bytes);
+    it->second.messages->Increment();
+    it->second.recentBytes += bytes;
+    it->second.recentMessages++;
+
+    unsigned int interval = CGlobalConfiguration::Instance().GetTrafficSummary();
+    if(interval > 0)
+    {
+        boost::posix_time::ptime now =
+            boost::posix_time::microsec_clock::universal_time();
+        if(now - m_summarized >= boost::posix_time::seconds(interval))
+        {
+            Summarize(now);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CTrafficAccounting::Summarize
+/// @description Logs the tallies with the most bytes since the last summary,
+///     largest first, and starts a new summary interval.
+/// @pre m_mutex is held.
+/// @post The recent counts of every tally are zero.
+/// @param now The time of the summary.
+///////////////////////////////////////////////////////////////////////////////
+void CTrafficAccounting::Summarize(const boost::posix_time::ptime& now)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    typedef std::pair<boost::uint64_t, std::map<std::string, STally>::iterator> Entry;
+    std::vector<Entry> entries;
+    boost::uint64_t total = 0;
+
+    std::map<std::string, STally>::iterator it;
+    for(it = m_tallies.begin(); it != m_tallies.end(); it++)
+    {
+        if(it->second.recentMessages > 0)
+        {
+            entries.push_back(Entry(it->second.recentBytes, it));
+            total += it->second.recentBytes;
+        }
+    }
+
+    std::size_t count = std::min(entries.size(), SUMMARY_SIZE);
+    std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+        MoreBytes<Entry>);
+
+    LOG_NOTICE(Logger) << "Traffic of the last " << (now - m_summarized)
+        << ": " << total << " bytes in " << entries.size() << " tallies"
+        << std::endl;
+    for(std::size_t i = 0; i < count; i++)
+    {
+        LOG_NOTICE(Logger) << "  " << entries[i].first << " bytes, "
+            << entries[i].second->second.recentMessages << " messages: "
+            << entries[i].second->first << std::endl;
+    }
+
+    for(it = m_tallies.begin(); it != m_tallies.end(); it++)
+    {
+        it->second.recentBytes = 0;
+        it->second.recentMessages = 0;
+    }
+    m_summarized = now;
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CTrafficAccounting.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Counts the traffic of each module, message type and peer
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CTRAFFICACCOUNTING_HPP
+#define CTRAFFICACCOUNTING_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace freedm {
+    namespace broker {
+
+class CCounter;
+class ModuleMessage;
+
+/// Counts the bytes and messages of each module, message type and peer
+////////////////////////////////////////////////////////////////////////////////
+/// Every module message written to or accepted from a peer is counted in the
+/// dgi_traffic_bytes_total and dgi_traffic_messages_total counters, labeled
+/// by direction, by the module it is addressed to, by its message type and
+/// by the peer. The bytes are those of the module message on the wire; the
+/// headers of the protocol and the window are not counted. A message that is
+/// written again counts as resent, so the resends of a type can be told from
+/// its first sends. The pieces of a split message do not carry the module
+/// message, so they are counted as module split and type fragment.
+///
+/// The tallies since the last summary are logged at notice level, largest
+/// first, once per summary interval.
+////////////////////////////////////////////////////////////////////////////////
+class CTrafficAccounting
+    : private boost::noncopyable
+{
+public:
+    /// The ways a message crosses the network
+    enum EDirection { SENT, RESENT, RECEIVED };
+
+    /// Access the singleton instance of the CTrafficAccounting
+    static CTrafficAccounting& Instance();
+
+    /// Checks if traffic accounting is on
+    static bool IsEnabled();
+
+    /// Counts a module message written to or accepted from a peer
+    void Account(EDirection direction, const ModuleMessage& msg,
+        const std::string& peer, std::size_t bytes);
+
+    /// Counts a piece of a split message written to or accepted from a peer
+    void AccountFragment(EDirection direction, const std::string& peer,
+        std::size_t bytes);
+
+private:
+    /// The counters of one direction, module, type and peer
+    struct STally
+    {
+        /// Bytes over the lifetime of the process
+        CCounter* bytes;
+        /// Messages over the lifetime of the process
+        CCounter* messages;
+        /// Bytes since the last summary
+        boost::uint64_t recentBytes;
+        /// Messages since the last summary
+        boost::uint64_t recentMessages;
+    };
+
+    /// Private constructor for the singleton instance
+    CTrafficAccounting();
+
+    /// Adds a message to its tally, registering the counters on first use
+    void Add(EDirection direction, const std::string& module,
+        const std::string& type, const std::string& peer, std::size_t bytes);
+
+    /// Logs the largest tallies since the last summary and clears them
+    void Summarize(const boost::posix_time::ptime& now);
+
+    /// The tallies by their labels
+    std::map<std::string, STally> m_tallies;
+
+    /// Time of the last summary
+    boost::posix_time::ptime m_summarized;
+
+    /// Lock for m_tallies and m_summarized
+    boost::mutex m_mutex;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CTRAFFICACCOUNTING_HPP
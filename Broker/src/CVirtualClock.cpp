@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CVirtualClock.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A clock that can run faster than real time
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CVirtualClock.hpp"
+
+#include "CLogger.hpp"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+}
+
+boost::posix_time::ptime CVirtualClock::s_origin;
+double CVirtualClock::s_scale = 1.0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// CVirtualClock::Start
+/// @description Starts the virtual clock at the current universal time. A
+///     scale of 1 leaves the clock on real time.
+/// @pre Called once, before any timer is set on the virtual clock.
+/// @post Now runs scale times faster than real time.
+/// @param scale How many times faster than real time the clock runs.
+///////////////////////////////////////////////////////////////////////////////
+void CVirtualClock::Start(double scale)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    s_origin = boost::posix_time::microsec_clock::universal_time();
+    s_scale = scale;
+    if(s_scale != 1.0)
+    {
+        LOG_NOTICE(Logger)<<"The virtual clock runs "<<s_scale
+            <<" times faster than real time"<<std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CVirtualClock::Now
+/// @description Gets the current virtual time, which is the universal time
+///     unless the clock was started with another scale.
+/// @pre None
+/// @post None
+/// @return The current virtual time.
+///////////////////////////////////////////////////////////////////////////////
+boost::posix_time::ptime CVirtualClock::Now()
+{
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if(s_scale == 1.0)
+    {
+        return now;
+    }
+    boost::int64_t elapsed = (now - s_origin).total_microseconds();
+    return s_origin + boost::posix_time::microseconds(
+        static_cast<boost::int64_t>(elapsed * s_scale));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CVirtualClock::ToReal
+/// @description Converts a virtual duration to the real time it takes.
+/// @pre None
+/// @post None
+/// @param duration The virtual duration.
+/// @return The duration divided by the scale.
+///////////////////////////////////////////////////////////////////////////////
+boost::posix_time::time_duration CVirtualClock::ToReal(
+    const boost::posix_time::time_duration& duration)
+{
+    if(s_scale == 1.0 || duration.is_special())
+    {
+        return duration;
+    }
+    return boost::posix_time::microseconds(static_cast<boost::int64_t>(
+        duration.total_microseconds() / s_scale));
+}
+
+    } // namespace broker
+} // namespace freedm
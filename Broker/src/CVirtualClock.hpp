@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CVirtualClock.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  A clock that can run faster than real time
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CVIRTUALCLOCK_HPP
+#define CVIRTUALCLOCK_HPP
+
+#include <boost/asio/basic_deadline_timer.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// The time the scheduler and the simulated devices run on
+////////////////////////////////////////////////////////////////////////////////
+/// The virtual clock reads the universal time until it is started with a
+/// scale above 1; from then on it runs that many times faster than the real
+/// clock, counted from the moment it was started. Every timer that is set on
+/// the virtual clock waits the virtual duration divided by the scale, so the
+/// phases, the module timers and the simulated adapters keep their order and
+/// their proportions while a long study finishes in a fraction of the time.
+/// The scale should stay low enough that the phases do not run late; the
+/// late phases of the scheduler statistics show when it is too high.
+////////////////////////////////////////////////////////////////////////////////
+class CVirtualClock
+{
+public:
+    /// Starts the clock at the current time with the given scale
+    static void Start(double scale);
+
+    /// Gets the current virtual time
+    static boost::posix_time::ptime Now();
+
+    /// Gets how many times faster than real time the clock runs
+    static double GetScale() { return s_scale; }
+
+    /// Converts a virtual duration to the real time it takes
+    static boost::posix_time::time_duration ToReal(
+        const boost::posix_time::time_duration& duration);
+
+private:
+    /// The real and virtual time the clock was started at
+    static boost::posix_time::ptime s_origin;
+
+    /// How many times faster than real time the clock runs
+    static double s_scale;
+};
+
+/// The asio time traits of timers that are set on the virtual clock
+struct SVirtualTimeTraits
+{
+    /// The type of the time points
+    typedef boost::posix_time::ptime time_type;
+    /// The type of the durations
+    typedef boost::posix_time::time_duration duration_type;
+
+    /// Gets the current virtual time
+    static time_type now() { return CVirtualClock::Now(); }
+
+    /// Adds a duration to a time point
+    static time_type add(const time_type& t, const duration_type& d)
+    {
+        return t + d;
+    }
+
+    /// Gets the duration between two time points
+    static duration_type subtract(const time_type& t1, const time_type& t2)
+    {
+        return t1 - t2;
+    }
+
+    /// True if the first time point is before the second
+    static bool less_than(const time_type& t1, const time_type& t2)
+    {
+        return t1 < t2;
+    }
+
+    /// Gets the real time a virtual duration takes
+    static boost::posix_time::time_duration to_posix_duration(
+        const duration_type& d)
+    {
+        return CVirtualClock::ToReal(d);
+    }
+};
+
+/// A timer that is set on the virtual clock
+typedef boost::asio::basic_deadline_timer<boost::posix_time::ptime,
+    SVirtualTimeTraits> CVirtualTimer;
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CVIRTUALCLOCK_HPP
@@ -0,0 +1,367 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CWarmState.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Saves the state a DGI resumes from after a restart
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CWarmState.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The universal time the save time counts from
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970,1,1));
+
+/// Gets the universal time in seconds since the epoch
+boost::uint64_t Now()
+{
+    return (boost::posix_time::second_clock::universal_time() - EPOCH).total_seconds();
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::Instance
+/// @description Access the singleton instance of the warm state
+/// @pre None
+/// @post None
+/// @return A reference to the warm state.
+///////////////////////////////////////////////////////////////////////////////
+CWarmState& CWarmState::Instance()
+{
+    static CWarmState state;
+    return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::CWarmState
+/// @description Creates a warm state that saves nothing until Start.
+/// @pre None
+/// @post The warm state is disabled and has no hints.
+///////////////////////////////////////////////////////////////////////////////
+CWarmState::CWarmState()
+    : m_loaded(false)
+    , m_dirty(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::~CWarmState
+/// @description Stops the writer thread if Stop was not called. Nothing is
+///     written or logged since the loggers may already be gone.
+/// @pre None
+/// @post The writer thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+CWarmState::~CWarmState()
+{
+    if(m_thread.joinable())
+    {
+        m_thread.interrupt();
+        m_thread.join();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::Start
+/// @description Reads the hints from the configured warm state file and
+///     starts the thread that saves this run's state to it.
+/// @pre None
+/// @post The state is saved every interval if a warm state file is set.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_path = CGlobalConfiguration::Instance().GetWarmStatePath();
+    if(m_path.empty() || m_thread.joinable())
+    {
+        return;
+    }
+    m_state.set_uuid(CGlobalConfiguration::Instance().GetUUID());
+    m_state.set_saved(0);
+    Load();
+    m_thread = boost::thread(boost::bind(&CWarmState::RunWriter, this));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::Stop
+/// @description Stops the writer thread and writes the state one last time,
+///     so a clean shutdown leaves the newest state behind.
+/// @pre None
+/// @post The writer thread has exited and the file holds the last state.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_thread.joinable())
+    {
+        return;
+    }
+    m_thread.interrupt();
+    m_thread.join();
+    Write();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::Load
+/// @description Parses the warm state file. A missing file is the normal
+///     case for the first run; a file that cannot be parsed, that another
+///     node saved, or that is older than the configured age gives no hints.
+/// @pre m_path is set.
+/// @post m_loaded is true if m_hints may be used.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::Load()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::ifstream file(m_path.c_str(), std::ios::in | std::ios::binary);
+    if(!file)
+    {
+        LOG_NOTICE(Logger) << "No warm state in " << m_path << std::endl;
+        return;
+    }
+    if(!m_hints.ParseFromIstream(&file))
+    {
+        LOG_WARN(Logger) << "Ignoring unreadable warm state " << m_path << std::endl;
+        m_hints.Clear();
+        return;
+    }
+    if(m_hints.uuid() != CGlobalConfiguration::Instance().GetUUID())
+    {
+        LOG_WARN(Logger) << "Ignoring warm state of " << m_hints.uuid() << std::endl;
+        m_hints.Clear();
+        return;
+    }
+    boost::uint64_t now = Now();
+    boost::uint64_t age = now > m_hints.saved() ? now - m_hints.saved() : 0;
+    if(age > CGlobalConfiguration::Instance().GetWarmStateMaxAge())
+    {
+        LOG_NOTICE(Logger) << "Ignoring warm state saved " << age
+                           << " seconds ago" << std::endl;
+        m_hints.Clear();
+        return;
+    }
+    LOG_STATUS(Logger) << "Resuming from warm state saved " << age
+                       << " seconds ago" << std::endl;
+    m_loaded = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::Write
+/// @description Serializes the state under the lock and writes it outside of
+///     it, to a temporary file that then replaces the warm state file.
+/// @pre None
+/// @post The file holds the state if it had changed.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::Write()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string data;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if(!m_dirty)
+        {
+            return;
+        }
+        m_state.set_saved(Now());
+        m_state.SerializeToString(&data);
+        m_dirty = false;
+    }
+
+    std::string temporary = m_path + ".tmp";
+    std::ofstream file(temporary.c_str(),
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    file.close();
+    if(!file || std::rename(temporary.c_str(), m_path.c_str()) != 0)
+    {
+        LOG_WARN(Logger) << "Failed to save the warm state to " << m_path << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::RunWriter
+/// @description Body of the writer thread. The failure of one write is only
+///     logged; the next interval tries again.
+/// @pre Start has set m_path.
+/// @post Returns once the thread is interrupted.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::RunWriter()
+{
+    boost::posix_time::milliseconds interval(
+        CGlobalConfiguration::Instance().GetWarmStateInterval());
+    try
+    {
+        while(true)
+        {
+            boost::this_thread::sleep(interval);
+            Write();
+        }
+    }
+    catch(boost::thread_interrupted&)
+    {
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::GetGroupHint
+/// @description Gets the group this node was in when the last run saved.
+/// @pre None
+/// @post None
+/// @return The group, or null if there is no hint.
+///////////////////////////////////////////////////////////////////////////////
+const WarmGroup* CWarmState::GetGroupHint() const
+{
+    return m_loaded && m_hints.has_group() ? &m_hints.group() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::GetClockHints
+/// @description Gets the clock offsets the last run had learned.
+/// @pre None
+/// @post None
+/// @return The offsets, empty if there is no hint.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<WarmClock> CWarmState::GetClockHints() const
+{
+    std::vector<WarmClock> clocks;
+    if(m_loaded)
+    {
+        clocks.assign(m_hints.clock().begin(), m_hints.clock().end());
+    }
+    return clocks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::GetVoltVarHint
+/// @description Gets the last power flow solution of the last run.
+/// @pre None
+/// @post None
+/// @return The solution, or null if there is no hint.
+///////////////////////////////////////////////////////////////////////////////
+const WarmVoltVar* CWarmState::GetVoltVarHint() const
+{
+    return m_loaded && m_hints.has_vvc() ? &m_hints.vvc() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::GetLoadBalanceHint
+/// @description Gets the load balance state of the last run.
+/// @pre None
+/// @post None
+/// @return The state, or null if there is no hint.
+///////////////////////////////////////////////////////////////////////////////
+const WarmLoadBalance* CWarmState::GetLoadBalanceHint() const
+{
+    return m_loaded && m_hints.has_lb() ? &m_hints.lb() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::SaveGroup
+/// @description Records the group of this node for the next write.
+/// @pre None
+/// @post The group is saved with the next write, if saving is enabled.
+/// @param group the group, its coordinator and its members.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::SaveGroup(const WarmGroup& group)
+{
+    if(!IsEnabled())
+    {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_state.mutable_group()->CopyFrom(group);
+    m_dirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::SaveClocks
+/// @description Records the clock offsets for the next write, replacing the
+///     ones recorded before.
+/// @pre None
+/// @post The offsets are saved with the next write, if saving is enabled.
+/// @param clocks the offset, skew and weight of each known node.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::SaveClocks(const std::vector<WarmClock>& clocks)
+{
+    if(!IsEnabled())
+    {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_state.clear_clock();
+    for(std::size_t i = 0; i < clocks.size(); i++)
+    {
+        m_state.add_clock()->CopyFrom(clocks[i]);
+    }
+    m_dirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::SaveVoltVar
+/// @description Records the power flow solution for the next write.
+/// @pre None
+/// @post The solution is saved with the next write, if saving is enabled.
+/// @param vvc the bus voltages and substation current.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::SaveVoltVar(const WarmVoltVar& vvc)
+{
+    if(!IsEnabled())
+    {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_state.mutable_vvc()->CopyFrom(vvc);
+    m_dirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWarmState::SaveLoadBalance
+/// @description Records the load balance state for the next write.
+/// @pre None
+/// @post The state is saved with the next write, if saving is enabled.
+/// @param lb the gateway and the gross power flow of the group.
+///////////////////////////////////////////////////////////////////////////////
+void CWarmState::SaveLoadBalance(const WarmLoadBalance& lb)
+{
+    if(!IsEnabled())
+    {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_state.mutable_lb()->CopyFrom(lb);
+    m_dirty = true;
+}
+
+    } // namespace broker
+} // namespace freedm
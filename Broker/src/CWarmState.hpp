@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CWarmState.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Saves the state a DGI resumes from after a restart
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CWARMSTATE_HPP
+#define CWARMSTATE_HPP
+
+#include "messages/WarmState.pb.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Keeps the last group, clock offsets, VVC solution and LB state on disk
+////////////////////////////////////////////////////////////////////////////////
+/// When a warm state file is configured, the modules hand their state to the
+/// singleton as it changes, which only copies it under a lock. A thread of
+/// its own writes the file every few seconds if anything changed, to a
+/// temporary file that is renamed over the last one, so a crash leaves either
+/// the old state or the new one.
+///
+/// Start reads the file a previous run left behind. Its contents are hints:
+/// they are dropped if the file belongs to another UUID or is older than the
+/// configured age, and each module checks a hint against what it finds before
+/// it uses it. A module never waits for the file.
+////////////////////////////////////////////////////////////////////////////////
+class CWarmState
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CWarmState
+    static CWarmState& Instance();
+
+    /// Reads the hints of the last run and starts saving, if configured
+    void Start();
+
+    /// Stops the writer thread and saves the state one last time
+    void Stop();
+
+    /// True if the state is being saved
+    bool IsEnabled() const { return !m_path.empty(); }
+
+    /// Gets the group of the last run, or null if there is no hint
+    const WarmGroup* GetGroupHint() const;
+
+    /// Gets the clock offsets of the last run
+    std::vector<WarmClock> GetClockHints() const;
+
+    /// Gets the power flow solution of the last run, or null
+    const WarmVoltVar* GetVoltVarHint() const;
+
+    /// Gets the load balance state of the last run, or null
+    const WarmLoadBalance* GetLoadBalanceHint() const;
+
+    /// Records the group this node is in
+    void SaveGroup(const WarmGroup& group);
+
+    /// Records the clock offsets of the other nodes
+    void SaveClocks(const std::vector<WarmClock>& clocks);
+
+    /// Records the last converged power flow solution
+    void SaveVoltVar(const WarmVoltVar& vvc);
+
+    /// Records the load balance state
+    void SaveLoadBalance(const WarmLoadBalance& lb);
+
+private:
+    /// Private constructor for the singleton instance
+    CWarmState();
+
+    /// Stops the writer thread
+    ~CWarmState();
+
+    /// Reads the file a previous run saved
+    void Load();
+
+    /// Writes the state to the file if it changed
+    void Write();
+
+    /// Writes the state every interval until interrupted
+    void RunWriter();
+
+    /// The file the state is saved to, empty if it is not saved
+    std::string m_path;
+
+    /// The state saved by the last run
+    WarmStateMessage m_hints;
+
+    /// True if m_hints holds a usable state
+    bool m_loaded;
+
+    /// The state of this run
+    WarmStateMessage m_state;
+
+    /// True if m_state changed since it was written
+    bool m_dirty;
+
+    /// Guards m_state and m_dirty
+    boost::mutex m_mutex;
+
+    /// Writes the file off the module threads
+    boost::thread m_thread;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CWARMSTATE_HPP
@@ -0,0 +1,301 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CWatchdog.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Reports the scheduler tasks that run too long
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CWatchdog.hpp"
+
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <execinfo.h>
+#include <time.h>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace freedm {
+    namespace broker {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The signal that samples the stack of the broker thread
+const int SAMPLE_SIGNAL = SIGRTMIN + 1;
+
+/// The most frames a sample records
+const int SAMPLE_FRAMES = 48;
+
+/// How many times per threshold the watchdog wakes up
+const int CHECKS_PER_THRESHOLD = 4;
+
+/// The milliseconds the watchdog waits for a sample
+const int SAMPLE_WAIT = 100;
+
+/// The frames of the last sample, written by the signal handler
+void* SampleFrames[SAMPLE_FRAMES];
+
+/// The number of frames of the last sample, -1 until it is taken
+volatile int SampleDepth = -1;
+
+/// Records the stack of the thread the signal was delivered to
+void HandleSample(int)
+{
+    int depth = backtrace(SampleFrames, SAMPLE_FRAMES);
+    __sync_synchronize();
+    SampleDepth = depth;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::Instance
+/// @description Access the singleton instance of the watchdog
+/// @pre None
+/// @post None
+/// @return A reference to the watchdog.
+///////////////////////////////////////////////////////////////////////////////
+CWatchdog& CWatchdog::Instance()
+{
+    static CWatchdog instance;
+    return instance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::CWatchdog
+/// @description Creates a watchdog without a thread.
+/// @pre None
+/// @post No task is running.
+///////////////////////////////////////////////////////////////////////////////
+CWatchdog::CWatchdog()
+    : m_threshold(0)
+    , m_started(0)
+    , m_task(0)
+    , m_sampled(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::~CWatchdog
+/// @description Stops the watchdog thread if Stop was not called.
+/// @pre None
+/// @post The watchdog thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+CWatchdog::~CWatchdog()
+{
+    if(m_watcher.joinable())
+    {
+        m_watcher.interrupt();
+        m_watcher.join();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::Start
+/// @description Installs the handler of the sample signal and starts the
+///     watchdog thread. The first backtrace is taken here, since it loads
+///     the unwinder, which must not happen inside the signal handler.
+/// @pre None
+/// @post The tasks are watched if a threshold is configured.
+///////////////////////////////////////////////////////////////////////////////
+void CWatchdog::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_threshold = CGlobalConfiguration::Instance().GetWatchdogThreshold() * 1000;
+    if(m_threshold == 0 || m_watcher.joinable())
+    {
+        return;
+    }
+
+    backtrace(SampleFrames, SAMPLE_FRAMES);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = HandleSample;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SAMPLE_SIGNAL, &action, 0);
+
+    m_watcher = boost::thread(boost::bind(&CWatchdog::Run, this));
+    LOG_NOTICE(Logger)<<"Watching for tasks that run over "
+        <<m_threshold / 1000<<" ms"<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::Stop
+/// @description Stops the watchdog thread.
+/// @pre None
+/// @post The watchdog thread has exited.
+///////////////////////////////////////////////////////////////////////////////
+void CWatchdog::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_watcher.joinable())
+    {
+        m_watcher.interrupt();
+        m_watcher.join();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::BeginTask
+/// @description Marks the start of a task on the calling thread.
+/// @pre No task is running.
+/// @post The watchdog times the task.
+/// @param module the module the task runs for.
+///////////////////////////////////////////////////////////////////////////////
+void CWatchdog::BeginTask(const std::string& module)
+{
+    if(m_threshold == 0)
+    {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_module = module;
+    m_thread = pthread_self();
+    m_started = Now();
+    m_task++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::EndTask
+/// @description Marks the end of the running task.
+/// @pre BeginTask was called.
+/// @post No task is running.
+///////////////////////////////////////////////////////////////////////////////
+void CWatchdog::EndTask()
+{
+    if(m_threshold == 0)
+    {
+        return;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_started = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::Run
+/// @description Body of the watchdog thread. Checks the running task a few
+///     times per threshold and samples a task that has run past it.
+/// @pre Start has set the threshold.
+/// @post Returns once the thread is interrupted.
+///////////////////////////////////////////////////////////////////////////////
+void CWatchdog::Run()
+{
+    boost::posix_time::microseconds interval(m_threshold / CHECKS_PER_THRESHOLD);
+    try
+    {
+        while(true)
+        {
+            boost::this_thread::sleep(interval);
+
+            std::string module;
+            pthread_t thread;
+            boost::int64_t elapsed = 0;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                if(m_started == 0 || m_sampled == m_task
+                    || Now() - m_started < m_threshold)
+                {
+                    continue;
+                }
+                m_sampled = m_task;
+                module = m_module;
+                thread = m_thread;
+                elapsed = Now() - m_started;
+            }
+            Sample(thread, module, elapsed);
+        }
+    }
+    catch(boost::thread_interrupted&)
+    {
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::Sample
+/// @description Counts an overrun of a module and logs the stack of the
+///     thread that runs its task.
+/// @ErrorHandling If the thread does not answer the signal in time, the
+///     overrun is logged without frames.
+/// @pre Called on the watchdog thread.
+/// @post The overrun is counted and logged.
+/// @param thread the thread that runs the task.
+/// @param module the module of the task.
+/// @param elapsed the microseconds the task has run.
+///////////////////////////////////////////////////////////////////////////////
+void CWatchdog::Sample(pthread_t thread, const std::string& module,
+    boost::int64_t elapsed)
+{
+    CMetrics::Instance().GetCounter("dgi_broker_watchdog_overruns_total",
+        "Scheduler tasks that ran past the watchdog threshold",
+        CMetrics::Label("module", module)).Increment();
+
+    SampleDepth = -1;
+    __sync_synchronize();
+    if(pthread_kill(thread, SAMPLE_SIGNAL) == 0)
+    {
+        for(int i = 0; i < SAMPLE_WAIT && SampleDepth < 0; i++)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+    __sync_synchronize();
+
+    std::ostringstream frames;
+    int depth = SampleDepth;
+    if(depth > 0)
+    {
+        char** symbols = backtrace_symbols(SampleFrames, depth);
+        // the first frames are the signal handler and the trampoline
+        for(int i = 2; symbols != 0 && i < depth; i++)
+        {
+            frames<<"\n    "<<symbols[i];
+        }
+        std::free(symbols);
+    }
+    LOG_WARN(Logger)<<"A task of "<<module<<" has run for "<<elapsed / 1000
+        <<" ms"<<(depth > 0 ? ":" : ", no stack sample")<<frames.str()<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CWatchdog::Now
+/// @description Gets the monotonic time, which the tasks are timed on.
+/// @pre None
+/// @post None
+/// @return Microseconds of CLOCK_MONOTONIC.
+///////////////////////////////////////////////////////////////////////////////
+boost::int64_t CWatchdog::Now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<boost::int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+    } // namespace broker
+} // namespace freedm
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CWatchdog.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Reports the scheduler tasks that run too long
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CWATCHDOG_HPP
+#define CWATCHDOG_HPP
+
+#include <string>
+
+#include <pthread.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace freedm {
+    namespace broker {
+
+/// Watches the tasks of the scheduler from a thread of its own
+////////////////////////////////////////////////////////////////////////////////
+/// The worker of the broker marks the start and end of each task. A thread
+/// of the watchdog wakes several times per threshold, and when the running
+/// task has gone on longer than the threshold it counts the overrun for the
+/// module and samples the stack of the broker thread with a signal, once
+/// per task. The sampled frames are logged with the module and the time the
+/// task has run so far, so the code that holds up the phases can be found
+/// while it still holds them up.
+////////////////////////////////////////////////////////////////////////////////
+class CWatchdog
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CWatchdog
+    static CWatchdog& Instance();
+
+    /// Starts the watchdog thread, if a threshold is configured
+    void Start();
+
+    /// Stops the watchdog thread
+    void Stop();
+
+    /// Marks the start of a task of a module on the calling thread
+    void BeginTask(const std::string& module);
+
+    /// Marks the end of the running task
+    void EndTask();
+
+private:
+    /// Private constructor for the singleton instance
+    CWatchdog();
+
+    /// Stops the watchdog thread if Stop was not called
+    ~CWatchdog();
+
+    /// Body of the watchdog thread
+    void Run();
+
+    /// Samples the stack of a thread and logs it
+    void Sample(pthread_t thread, const std::string& module,
+        boost::int64_t elapsed);
+
+    /// Gets the monotonic time in microseconds
+    static boost::int64_t Now();
+
+    /// Longest run of a task in microseconds, 0 if there is no watchdog
+    boost::int64_t m_threshold;
+
+    /// Guards the running task
+    boost::mutex m_mutex;
+
+    /// The module of the running task
+    std::string m_module;
+
+    /// The thread that runs the task
+    pthread_t m_thread;
+
+    /// When the running task started, 0 if no task runs
+    boost::int64_t m_started;
+
+    /// Counts the tasks, so each one is sampled once
+    boost::uint64_t m_task;
+
+    /// The last task that was sampled
+    boost::uint64_t m_sampled;
+
+    /// The watchdog thread
+    boost::thread m_watcher;
+};
+
+    } // namespace broker
+} // namespace freedm
+
+#endif // CWATCHDOG_HPP
@@ -0,0 +1,455 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         DeviceBenchmark.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Measures the throughput of the device layer as it grows
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CAdapterFactory.hpp"
+#include "CDeviceManager.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <unistd.h>
+
+using namespace freedm::broker;
+using namespace freedm::broker::device;
+
+namespace {
+
+/// The device type every benchmark device has.
+const char * DEVICE_TYPE = "Bench";
+
+/// The state and command of the benchmark devices.
+const char * DEVICE_SIGNAL = "value";
+
+/// The adapters a run can populate the manager with.
+enum EAdapter { ADAPTER_FAKE, ADAPTER_BUFFER };
+
+/// Settings of a run.
+struct SOptions
+{
+    bool csv;
+    double budget;
+    unsigned int threads;
+};
+
+/// The devices of one populated manager.
+struct SPopulation
+{
+    std::string adapter;
+    std::vector<CDevice::Pointer> devices;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// WriteDeviceConfig
+/// @description Writes a device class file with the one benchmark type.
+/// @return The path of the file.
+///////////////////////////////////////////////////////////////////////////////
+std::string WriteDeviceConfig()
+{
+    char path[] = "/tmp/dgi-device-benchXXXXXX";
+    int fd = mkstemp(path);
+
+    if(fd == -1)
+    {
+        throw std::runtime_error("could not create the device class file");
+    }
+    close(fd);
+
+    std::ofstream out(path);
+    out << "<root><deviceType><id>" << DEVICE_TYPE << "</id><state>"
+        << DEVICE_SIGNAL << "</state><command>" << DEVICE_SIGNAL
+        << "</command></deviceType></root>" << std::endl;
+    return path;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Configure
+/// @description Gives the settings the device layer reads the defaults of
+///     PosixMain, without plug and play, MQTT or configured adapters.
+/// @param devices the path of the device class file.
+///////////////////////////////////////////////////////////////////////////////
+void Configure(const std::string & devices)
+{
+    CGlobalConfiguration & config = CGlobalConfiguration::Instance();
+
+    config.SetClockSkew(boost::posix_time::milliseconds(0));
+    config.SetDeviceThreads(1);
+    config.SetDeviceConfigPath(devices);
+    config.SetAdapterConfigPath("");
+    config.SetDevicesEndpoint("");
+    config.SetFactoryPort(0);
+    config.SetFactoryBacklog(0);
+    config.SetFactoryAcceptors(1);
+    config.SetPnpDeltaDeadband(0);
+    config.SetPnpDeltaRefresh(10);
+    config.SetMQTTId("");
+    config.SetMQTTAddress("");
+    config.SetMQTTWorkers(1);
+    config.SetTelemetryFile("");
+    config.SetTelemetryQueue(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Populate
+/// @description Creates an adapter with a number of benchmark devices and
+///     waits until the device manager shows all of them. A fake adapter
+///     stores its signals in a map, and a buffer adapter is a synthetic
+///     adapter that publishes its states once a second.
+/// @param kind the adapter to create.
+/// @param count the number of devices.
+/// @return The adapter name and its devices.
+///////////////////////////////////////////////////////////////////////////////
+SPopulation Populate(EAdapter kind, unsigned int count)
+{
+    boost::property_tree::ptree p, entry;
+    std::string prefix = (kind == ADAPTER_FAKE ? "Fake" : "Buffer");
+    SPopulation population;
+
+    population.adapter = prefix + boost::lexical_cast<std::string>(count);
+    p.put("<xmlattr>.name", population.adapter);
+    p.put("<xmlattr>.type", kind == ADAPTER_FAKE ? "fake" : "synthetic");
+    p.put_child("info", boost::property_tree::ptree());
+
+    if(kind == ADAPTER_FAKE)
+    {
+        p.put_child("state", boost::property_tree::ptree());
+        p.put_child("command", boost::property_tree::ptree());
+        for(unsigned int i = 0; i < count; i++)
+        {
+            entry.put("type", DEVICE_TYPE);
+            entry.put("device", prefix + boost::lexical_cast<std::string>(i + 1));
+            entry.put("signal", DEVICE_SIGNAL);
+            entry.put("<xmlattr>.index", i + 1);
+            p.add_child("state.entry", entry);
+            p.add_child("command.entry", entry);
+        }
+    }
+    else
+    {
+        p.put("info.period", 1000);
+        entry.put("type", DEVICE_TYPE);
+        entry.put("count", count);
+        entry.put("prefix", prefix);
+        p.add_child("generate", entry);
+    }
+
+    CAdapterFactory::Instance().CreateAdapter(p);
+
+    // the synthetic adapter reveals its devices on its first update
+    while(CDeviceManager::Instance().GetDevicesOfType(DEVICE_TYPE).size() < count)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        population.devices.push_back(CDeviceManager::Instance().GetDevice(
+            prefix + boost::lexical_cast<std::string>(i + 1)));
+    }
+    return population;
+}
+
+/// Reads the state of every device once.
+unsigned long ReadStates(const SPopulation & population)
+{
+    float sum = 0;
+    for(std::size_t i = 0; i < population.devices.size(); i++)
+    {
+        sum += population.devices[i]->GetState(DEVICE_SIGNAL);
+    }
+    volatile float sink = sum;
+    (void)sink;
+    return population.devices.size();
+}
+
+/// Sets the command of every device once.
+unsigned long WriteCommands(const SPopulation & population)
+{
+    for(std::size_t i = 0; i < population.devices.size(); i++)
+    {
+        population.devices[i]->SetCommand(DEVICE_SIGNAL, static_cast<SignalValue>(i));
+    }
+    return population.devices.size();
+}
+
+/// Finds the devices of the benchmark type.
+unsigned long FindDevices()
+{
+    volatile std::size_t size = CDeviceManager::Instance().GetDevicesOfType(DEVICE_TYPE).size();
+    (void)size;
+    return 1;
+}
+
+/// Sums the state of every device of the benchmark type.
+unsigned long NetValue()
+{
+    volatile SignalValue value = CDeviceManager::Instance().GetNetValue(DEVICE_TYPE, DEVICE_SIGNAL);
+    (void)value;
+    return 1;
+}
+
+/// Collects the state of every device of the benchmark type.
+unsigned long Values()
+{
+    volatile std::size_t size = CDeviceManager::Instance().GetValues(DEVICE_TYPE, DEVICE_SIGNAL).size();
+    (void)size;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Print
+/// @description Prints one result as a table or CSV row.
+/// @param options the settings of the run.
+/// @param devices the number of devices.
+/// @param adapter the name of the adapter kind.
+/// @param call the name of the measured call.
+/// @param threads the threads that made the calls.
+/// @param ops the calls made by all the threads.
+/// @param seconds the time the calls took.
+///////////////////////////////////////////////////////////////////////////////
+void Print(const SOptions & options, unsigned int devices, const std::string & adapter,
+        const std::string & call, unsigned int threads, unsigned long ops, double seconds)
+{
+    double rate = ops / seconds;
+    double nsec = seconds * 1e9 * threads / ops;
+
+    if(options.csv)
+    {
+        std::cout << devices << "," << adapter << "," << call << "," << threads
+            << "," << ops << "," << rate << "," << nsec << std::endl;
+    }
+    else
+    {
+        std::cout << std::setw(7) << devices << "  " << std::left << std::setw(8)
+            << adapter << std::setw(22) << call << std::right << std::setw(4)
+            << threads << std::setw(12) << ops << std::setw(14) << std::fixed
+            << std::setprecision(0) << rate << std::setw(12)
+            << std::setprecision(1) << nsec << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Measure
+/// @description Calls a function on one thread until the time budget is
+///     spent, and prints the calls of the device layer it made per second.
+/// @param options the settings of the run.
+/// @param devices the number of devices.
+/// @param adapter the name of the adapter kind.
+/// @param call the name of the measured call.
+/// @param run makes some calls and returns how many.
+///////////////////////////////////////////////////////////////////////////////
+void Measure(const SOptions & options, unsigned int devices, const std::string & adapter,
+        const std::string & call, boost::function<unsigned long ()> run)
+{
+    using namespace boost::posix_time;
+
+    unsigned long ops = 0;
+    ptime start = microsec_clock::universal_time();
+    time_duration elapsed;
+
+    do
+    {
+        ops += run();
+        elapsed = microsec_clock::universal_time() - start;
+    }
+    while(elapsed.total_microseconds() < options.budget * 1e6);
+
+    Print(options, devices, adapter, call, 1, ops, elapsed.total_microseconds() / 1e6);
+}
+
+/// Repeats a function until the stop flag is raised.
+void Repeat(boost::function<unsigned long ()> run, volatile bool * stop,
+        unsigned long * ops)
+{
+    while(!*stop)
+    {
+        *ops += run();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MeasureContended
+/// @description Reads the states of every device on several threads while
+///     one more thread sets their commands, and prints the reads and the
+///     writes per second.
+/// @param options the settings of the run.
+/// @param population the devices to read and write.
+/// @param adapter the name of the adapter kind.
+///////////////////////////////////////////////////////////////////////////////
+void MeasureContended(const SOptions & options, const SPopulation & population,
+        const std::string & adapter)
+{
+    using namespace boost::posix_time;
+
+    volatile bool stop = false;
+    std::vector<unsigned long> reads(options.threads, 0);
+    unsigned long writes = 0;
+    boost::thread_group pool;
+
+    ptime start = microsec_clock::universal_time();
+    for(unsigned int t = 0; t < options.threads; t++)
+    {
+        pool.create_thread(boost::bind(&Repeat,
+            boost::function<unsigned long ()>(boost::bind(&ReadStates, boost::cref(population))),
+            &stop, &reads[t]));
+    }
+    pool.create_thread(boost::bind(&Repeat,
+        boost::function<unsigned long ()>(boost::bind(&WriteCommands, boost::cref(population))),
+        &stop, &writes));
+
+    boost::this_thread::sleep(microseconds(static_cast<long>(options.budget * 1e6)));
+    stop = true;
+    pool.join_all();
+    double seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+    unsigned long total = 0;
+    for(unsigned int t = 0; t < options.threads; t++)
+    {
+        total += reads[t];
+    }
+    unsigned int devices = population.devices.size();
+    Print(options, devices, adapter, "GetState (contended)", options.threads, total, seconds);
+    Print(options, devices, adapter, "SetCommand (contended)", 1, writes, seconds);
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[])
+{
+    SOptions options;
+    std::vector<unsigned int> sizes;
+
+    options.csv = false;
+    options.budget = 0.5;
+    options.threads = 4;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--csv") == 0)
+        {
+            options.csv = true;
+        }
+        else if(std::strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+        {
+            options.budget = std::atof(argv[++i]);
+        }
+        else if(std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            options.threads = std::atoi(argv[++i]);
+        }
+        else if(std::atoi(argv[i]) > 0)
+        {
+            sizes.push_back(std::atoi(argv[i]));
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--csv] [--time seconds]"
+                << " [--threads readers] [devices ...]" << std::endl;
+            return 1;
+        }
+    }
+
+    if(sizes.empty())
+    {
+        sizes.push_back(10);
+        sizes.push_back(100);
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+    }
+    if(options.budget <= 0 || options.threads < 1)
+    {
+        std::cerr << "--time and --threads must be positive" << std::endl;
+        return 1;
+    }
+
+    // the device layer logs every device it creates
+    CGlobalLogger::instance().SetGlobalLevel(2);
+
+    std::string devices;
+    try
+    {
+        devices = WriteDeviceConfig();
+        Configure(devices);
+
+        if(options.csv)
+        {
+            std::cout << "devices,adapter,call,threads,ops,ops_per_sec,nsec_per_op"
+                << std::endl;
+        }
+        else
+        {
+            std::cout << "devices  adapter call                  thr         ops"
+                << "       ops/sec     nsec/op" << std::endl;
+        }
+
+        for(std::size_t i = 0; i < sizes.size(); i++)
+        {
+            for(int k = 0; k < 2; k++)
+            {
+                EAdapter kind = (k == 0 ? ADAPTER_FAKE : ADAPTER_BUFFER);
+                std::string adapter = (kind == ADAPTER_FAKE ? "fake" : "buffer");
+
+                boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+                SPopulation population = Populate(kind, sizes[i]);
+                double seconds = (boost::posix_time::microsec_clock::universal_time()
+                    - start).total_microseconds() / 1e6;
+                Print(options, sizes[i], adapter, "populate", 1, sizes[i], seconds);
+
+                Measure(options, sizes[i], adapter, "GetState",
+                    boost::bind(&ReadStates, boost::cref(population)));
+                Measure(options, sizes[i], adapter, "SetCommand",
+                    boost::bind(&WriteCommands, boost::cref(population)));
+                Measure(options, sizes[i], adapter, "GetDevicesOfType", &FindDevices);
+                Measure(options, sizes[i], adapter, "GetNetValue", &NetValue);
+                Measure(options, sizes[i], adapter, "GetValues", &Values);
+                MeasureContended(options, population, adapter);
+
+                population.devices.clear();
+                CAdapterFactory::Instance().RemoveAdapter(population.adapter);
+            }
+        }
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << "device benchmark failed: " << e.what() << std::endl;
+        std::remove(devices.c_str());
+        return 1;
+    }
+
+    CAdapterFactory::Instance().Stop();
+    std::remove(devices.c_str());
+    return 0;
+}
@@ -38,6 +38,23 @@ IDGIModule::IDGIModule()
     //Pass
 }
 ///////////////////////////////////////////////////////////////////////////////
+/// HandleIncomingBatch
+/// @description Handles each message of a batch in turn. A module that
+///  returns true from HandlesBatches receives every message that waited for
+///  its phase in one call, grouped by type and in the order they arrived
+///  within a type, and overrides this to process the messages together.
+/// @pre None
+/// @post Each message has been passed to HandleIncomingMessage.
+/// @param batch the received messages
+///////////////////////////////////////////////////////////////////////////////
+void IDGIModule::HandleIncomingBatch(const MessageBatch& batch)
+{
+    for(MessageBatch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        HandleIncomingMessage(it->msg, it->peer);
+    }
+}
+///////////////////////////////////////////////////////////////////////////////
 /// GetUUID
 /// @description Gets this process's UUID.
 /// @return This process's UUID
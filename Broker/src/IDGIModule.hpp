@@ -25,6 +25,9 @@
 
 #include "messages/ModuleMessage.pb.h"
 
+#include <string>
+#include <vector>
+
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -32,6 +35,20 @@ namespace freedm {
 
 namespace broker {
 
+/// A received message of a batch
+struct SIncomingMessage
+{
+    /// The message
+    boost::shared_ptr<const ModuleMessage> msg;
+    /// The node that sent the message
+    CPeerNode peer;
+    /// The type of the message, such as gm.PeerListMessage
+    std::string type;
+};
+
+/// The messages a module receives at once, grouped by type
+typedef std::vector<SIncomingMessage> MessageBatch;
+
 ///An interface for an object which can handle recieving incoming messages
 class IDGIModule
     : private boost::noncopyable
@@ -48,10 +65,16 @@ public:
     /// Virtual destructor for inhertiance
     virtual ~IDGIModule() {};
 
-    /// Handles received messages
+    /// Handles a received message, which all the receiving modules share
     virtual void HandleIncomingMessage(
         boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer) = 0;
 
+    /// Tells the dispatcher to deliver the waiting messages in batches
+    virtual bool HandlesBatches() const { return false; }
+
+    /// Handles the messages that waited for the phase of the module
+    virtual void HandleIncomingBatch(const MessageBatch& batch);
+
 protected:
     /// Gets the UUID of this process.
     std::string GetUUID() const;
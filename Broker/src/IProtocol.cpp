@@ -28,13 +28,25 @@
 #include "CConnection.hpp"
 #include "CConnectionManager.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
 #include "Messages.hpp"
+#include "messages/ModuleMessage.pb.h"
 #include "messages/ProtocolMessage.pb.h"
 #include "CBroker.hpp"
+#include "CClockSynchronizer.hpp"
 #include "CListener.hpp"
+#include "CPeerIdTable.hpp"
+#include "CNetworkEmulator.hpp"
+#include "CSharedMemoryTransport.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <zlib.h>
+
 namespace freedm {
     namespace broker {
 
@@ -43,13 +55,49 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Bytes of the messages of the windows that were deflated
+CCounter& DeflatedMetric = CMetrics::Instance().GetCounter(
+    "dgi_protocol_deflated_bytes_total",
+    "Bytes of the window messages that were deflated before they were sent");
+
+/// Bytes the deflated windows took on the wire
+CCounter& CompressedMetric = CMetrics::Instance().GetCounter(
+    "dgi_protocol_compressed_bytes_total",
+    "Bytes the deflated window messages took once deflated");
+
+///////////////////////////////////////////////////////////////////////////////
+/// Deflate
+/// @description Deflates the encoded messages of a window with zlib.
+/// @pre None
+/// @post None
+/// @param messages the encoded messages fields of the window
+/// @param compressed set to the deflated bytes
+/// @return False if the messages do not get any smaller.
+///////////////////////////////////////////////////////////////////////////////
+bool Deflate(const std::string& messages, std::string& compressed)
+{
+    uLongf size = compressBound(messages.size());
+    compressed.resize(size);
+    if(compress2(reinterpret_cast<Bytef*>(&compressed[0]), &size,
+        reinterpret_cast<const Bytef*>(messages.data()), messages.size(),
+        Z_DEFAULT_COMPRESSION) != Z_OK || size >= messages.size())
+    {
+        return false;
+    }
+    compressed.resize(size);
+    return true;
+}
+
 }
 
-IProtocol::IProtocol(std::string uuid, boost::asio::ip::udp::endpoint endpoint)
+IProtocol::IProtocol(std::string uuid, boost::asio::ip::udp::endpoint endpoint,
+    EMessageLane lane)
     : m_endpoint(endpoint)
     , m_uuid(uuid)
     , m_stopped(false)
     , m_reliability(100)
+    , m_lane(lane)
+    , m_inflates(false)
 {
     //pass
 }
@@ -73,52 +121,205 @@ IProtocol::IProtocol(std::string uuid, boost::asio::ip::udp::endpoint endpoint)
 ///////////////////////////////////////////////////////////////////////////////
 void IProtocol::Write(ProtocolMessageWindow& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    WritePacked(msg, std::string());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IProtocol::WritePacked
+/// @description Sends a window whose messages have been serialized by the
+///     caller. The encoded messages are appended to the encoding of the window
+///     header, which yields the same datagram as adding the messages to the
+///     window and serializing it, without encoding the messages again.
+///     Messages of at least the compress threshold are sent deflated if the
+///     peer asked for it and they get smaller.
+/// @pre messages holds zero or more encoded messages fields of the window
+/// @post Writes the window using the listening socket to the Protocol's
+///     endpoint
+/// @param msg the window header to send, transfer-none
+/// @param messages the serialized messages fields of the window
+///////////////////////////////////////////////////////////////////////////////
+void IProtocol::WritePacked(ProtocolMessageWindow& msg, const std::string& messages)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     msg.set_source_uuid(CGlobalConfiguration::Instance().GetUUID());
     StampMessageSendtime(msg);
+    CBroker::Instance().GetClockSynchronizer().StampWindow(msg,
+        CPeerIdTable::Instance().Intern(m_uuid));
+    if(m_lane != LANE_CONTROL)
+    {
+        msg.set_lane(m_lane);
+    }
+
+    unsigned int threshold = CGlobalConfiguration::Instance().GetCompressThreshold();
+    if(threshold > 0)
+    {
+        msg.set_inflates(true);
+    }
 
     msg.CheckInitialized();
 
     if(m_stopped)
         return;
 
+    // the deflated messages go in a copy of the header, which the caller
+    // may reuse for its next window
+    ProtocolMessageWindow deflated;
+    ProtocolMessageWindow* header = &msg;
+    const std::string* payload = &messages;
+    std::string compressed;
+    if(threshold > 0 && m_inflates && messages.size() >= threshold
+        && Deflate(messages, compressed))
+    {
+        DeflatedMetric.Increment(messages.size());
+        CompressedMetric.Increment(compressed.size());
+        deflated = msg;
+        deflated.set_inflated_size(messages.size());
+        deflated.set_compressed(compressed);
+        header = &deflated;
+        compressed.clear();
+        payload = &compressed;
+    }
+
+    std::size_t size = header->ByteSize() + payload->size();
+
     /// Check to make sure it isn't going to overfill our message packet
-    if(msg.ByteSize() > CGlobalConfiguration::MAX_PACKET_SIZE)
+    if(size > static_cast<std::size_t>(CGlobalConfiguration::MAX_PACKET_SIZE))
     {
-        Logger.Warn << "Message too long for buffer: " << std::endl
-                << msg.DebugString() << std::endl;
+        LOG_WARN(Logger) << "Message too long for buffer: " << std::endl
+                << header->DebugString() << std::endl;
         throw std::runtime_error("Outgoing message is too long for buffer");
     }
 
     #ifdef CUSTOMNETWORK
     if((rand()%100) >= GetReliability())
     {
-        Logger.Info<<"Outgoing Packet Dropped ("<<GetReliability()
+        LOG_INFO(Logger)<<"Outgoing Packet Dropped ("<<GetReliability()
                       <<") -> "<<GetUUID()<<std::endl;
         return;
     }
     #endif
 
+    boost::posix_time::time_duration delay;
+    if(CNetworkEmulator::Instance().IsEnabled()
+        && !CNetworkEmulator::Instance().Shape(m_uuid, size, delay))
+    {
+        LOG_DEBUG(Logger)<<"Outgoing Packet Lost On Emulated Link -> "
+                      <<GetUUID()<<std::endl;
+        return;
+    }
+
     boost::array<char, CGlobalConfiguration::MAX_PACKET_SIZE> write_buffer;
-    msg.SerializeToArray(&write_buffer[0], CGlobalConfiguration::MAX_PACKET_SIZE);
+    header->SerializeToArray(&write_buffer[0], CGlobalConfiguration::MAX_PACKET_SIZE);
+    std::copy(payload->begin(), payload->end(),
+        write_buffer.begin() + header->GetCachedSize());
+
+    if(delay > boost::posix_time::time_duration(0, 0, 0))
+    {
+        // the emulated link holds a copy of the datagram until it arrives
+        boost::shared_ptr<std::string> datagram =
+            boost::make_shared<std::string>(&write_buffer[0], size);
+        boost::shared_ptr<boost::asio::deadline_timer> timer(
+            new boost::asio::deadline_timer(
+                CBroker::Instance().GetIOService(), delay));
+        timer->async_wait(CBroker::Instance().GetStrand().wrap(
+            boost::bind(&IProtocol::TransmitDelayed, shared_from_this(),
+                timer, datagram, boost::asio::placeholders::error)));
+        return;
+    }
+
+    Transmit(&write_buffer[0], size);
+}
 
-    Logger.Debug<<"Writing "<<msg.ByteSize()<<" bytes to channel"<<std::endl;
+///////////////////////////////////////////////////////////////////////////////
+/// IProtocol::Transmit
+/// @description Hands a serialized window to the shared memory transport if
+///     the peer is on this host, to the batch of the listener if batching is
+///     on, and to the listening socket otherwise.
+/// @pre None
+/// @post The datagram was sent or queued, or the protocol is stopped if the
+///     socket refused it.
+/// @param data the datagram to send
+/// @param size the length of the datagram in bytes
+///////////////////////////////////////////////////////////////////////////////
+void IProtocol::Transmit(const char* data, std::size_t size)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    LOG_DEBUG(Logger)<<"Writing "<<size<<" bytes to channel"<<std::endl;
+
+    if(CSharedMemoryTransport::Instance().Write(m_uuid, data, size))
+    {
+        return;
+    }
+
+    if(CListener::Instance().IsBatching())
+    {
+        CListener::Instance().QueueDatagram(data, size,
+            m_endpoint, shared_from_this());
+        return;
+    }
 
     try
     {
         CListener::Instance().GetSocket().send_to(
-            boost::asio::buffer(&write_buffer[0], msg.ByteSize()),
+            boost::asio::buffer(data, size),
             m_endpoint
         );
     }
     catch(boost::system::system_error &e)
     {
-        Logger.Debug << "Writing Failed: " << e.what() << std::endl;
+        LOG_DEBUG(Logger) << "Writing Failed: " << e.what() << std::endl;
         Stop();
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// IProtocol::TransmitDelayed
+/// @description Sends a datagram the network emulator held back, unless the
+///     protocol stopped in the meantime.
+/// @pre The timer was started by WritePacked.
+/// @post The datagram was handed to Transmit if the timer expired.
+/// @param timer the timer that held the datagram back, kept alive until now
+/// @param datagram the copy of the datagram
+/// @param error the outcome of the wait
+///////////////////////////////////////////////////////////////////////////////
+void IProtocol::TransmitDelayed(
+    boost::shared_ptr<boost::asio::deadline_timer> /* timer */,
+    boost::shared_ptr<std::string> datagram,
+    const boost::system::error_code& error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!error && !m_stopped)
+    {
+        Transmit(datagram->data(), datagram->size());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IProtocol::Deliver
+/// @description Gets the module message to dispatch for a message that was
+///     accepted by Receive. Protocols that split module messages override this
+///     to hold the pieces back until the whole message has arrived.
+///     The module message is not copied out of the window; the pointer keeps
+///     the window alive instead.
+/// @pre Receive returned true for the message.
+/// @post None
+/// @param window the received window that holds msg
+/// @param msg the accepted message
+/// @return The module message carried by msg.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ModuleMessage> IProtocol::Deliver(
+    boost::shared_ptr<const ProtocolMessageWindow> window, const ProtocolMessage& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    return boost::shared_ptr<const ModuleMessage>(window, &msg.module_message());
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// IProtocol::GetUUID
 /// @description Gets the UUID of the DGI on the other end of this connection.
@@ -128,7 +329,7 @@ void IProtocol::Write(ProtocolMessageWindow& msg)
 ///////////////////////////////////////////////////////////////////////////////
 std::string IProtocol::GetUUID() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     return m_uuid;
 }
@@ -143,7 +344,7 @@ std::string IProtocol::GetUUID() const
 ///////////////////////////////////////////////////////////////////////////////
 void IProtocol::SetReliability(int r)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     m_reliability = r;
 }
@@ -157,7 +358,7 @@ void IProtocol::SetReliability(int r)
 ///////////////////////////////////////////////////////////////////////////////
 int IProtocol::GetReliability() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     return m_reliability;
 }
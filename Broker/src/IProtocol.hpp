@@ -25,12 +25,15 @@
 #define IPROTOCOL_HPP
 
 #include "CGlobalConfiguration.hpp"
+#include "Messages.hpp"
 #include <memory>
 #include <set>
+#include <string>
 
 #include <boost/asio.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace freedm {
     namespace broker {
@@ -39,6 +42,20 @@ class ModuleMessage;
 class ProtocolMessage;
 class ProtocolMessageWindow;
 
+/// Transmission statistics of a connection
+struct SProtocolStatistics
+{
+    SProtocolStatistics() : rtt(0), rto(0), writes(0), retransmits(0),
+        inflight(0), queued(0), refused(0) { }
+    double rtt; /// Smoothed round trip time in milliseconds
+    unsigned int rto; /// Current retransmission timeout in milliseconds
+    unsigned int writes; /// Messages written to the channel
+    unsigned int retransmits; /// Writes that repeated an earlier write
+    unsigned int inflight; /// Messages written and not yet acknowledged
+    unsigned int queued; /// Messages waiting for room in the send window
+    unsigned int refused; /// Messages refused because the queue was full
+};
+
 /// A connection protocol
 class IProtocol
     : private boost::noncopyable,
@@ -47,12 +64,16 @@ class IProtocol
     public:
         /// Destroy all humans
         virtual ~IProtocol() { };
-        /// Public write to channel function
-        virtual void Send(const ModuleMessage& msg) = 0;
+        /// Public write to channel function, false if the message was refused
+        virtual bool Send(const CSerializedMessage::Pointer& msg) = 0;
         /// Public facing function that handles marking ACKS
         virtual void ReceiveACK(const ProtocolMessage& msg) = 0;
         /// Function that determines if a message should dispatched
         virtual bool Receive(const ProtocolMessage& msg) = 0;
+        /// Gets the module message an accepted message completes, if any
+        virtual boost::shared_ptr<const ModuleMessage> Deliver(
+            boost::shared_ptr<const ProtocolMessageWindow> window,
+            const ProtocolMessage& msg);
         /// Peforms an actions after finishing looking through a sliding window
         virtual void OnReceive() = 0;
         /// Handles Writing an ack for the input message to the channel
@@ -61,6 +82,13 @@ class IProtocol
         virtual void Stop() = 0;
         /// Handles the change phase even
         virtual void ChangePhase(bool) { };
+        /// Checks if messages are waiting for room in the send window
+        virtual bool IsCongested() const { return false; };
+        /// Checks if no message waits to be sent or acknowledged
+        virtual bool IsQuiet() const { return true; };
+        /// Gets the transmission statistics of the connection
+        virtual SProtocolStatistics GetStatistics() const
+            { return SProtocolStatistics(); };
         /// Handles checking to see if the connection is stopped
         bool GetStopped() { return m_stopped; };
         /// Handles setting the stopped variable
@@ -73,14 +101,28 @@ class IProtocol
         int GetReliability() const;
         /// Gets the uuid:
         std::string GetUUID() const;
+        /// Gets the priority lane the protocol sends over
+        EMessageLane GetLane() const { return m_lane; };
+        /// Notes whether the peer asked for deflated windows
+        void SetPeerInflates(bool v) { m_inflates = v; };
     protected:
         /// Initializes the protocol with the underlying connection
-        IProtocol(std::string uuid, boost::asio::ip::udp::endpoint endpoint);
+        IProtocol(std::string uuid, boost::asio::ip::udp::endpoint endpoint,
+            EMessageLane lane);
         /// Callback for when a write completes.
         virtual void WriteCallback(const boost::system::error_code&) { }
         /// Handles writing the message to the underlying connection
         virtual void Write(ProtocolMessageWindow& msg);
+        /// Writes a window whose messages are already serialized
+        void WritePacked(ProtocolMessageWindow& msg, const std::string& messages);
     private:
+        /// Sends a serialized window over the fastest path to the peer
+        void Transmit(const char* data, std::size_t size);
+        /// Sends a window the network emulator held back
+        void TransmitDelayed(boost::shared_ptr<boost::asio::deadline_timer> timer,
+            boost::shared_ptr<std::string> datagram,
+            const boost::system::error_code& error);
+
         /// Datagram socket connected to a single peer DGI
         boost::asio::ip::udp::endpoint m_endpoint;
  
@@ -92,6 +134,12 @@ class IProtocol
 
         /// The reliability of the connection (FOR -DCUSTOMNETWORK)
         int m_reliability;
+
+        /// The priority lane written in the headers of outgoing windows
+        EMessageLane m_lane;
+
+        /// Set if the peer asked for deflated windows
+        bool m_inflates;
 };
 
     }
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         LinearAlgebra.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Reports and configures the BLAS/LAPACK under armadillo
+///
+/// @functions
+///     LinearAlgebraBackend
+///     SetLinearAlgebraThreads
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "LinearAlgebra.hpp"
+#include "CLogger.hpp"
+#include "config.hpp"
+
+#include <cstdlib>
+
+#include <boost/lexical_cast.hpp>
+
+#if defined(LINALG_OPENBLAS)
+extern "C" void openblas_set_num_threads(int threads);
+#elif defined(LINALG_MKL)
+extern "C" void MKL_Set_Num_Threads(int threads);
+#endif
+
+namespace freedm {
+namespace broker {
+
+namespace {
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// LinearAlgebraBackend
+/// @description Names the BLAS/LAPACK chosen with LINALG_BACKEND at build
+///     time, or armadillo when it runs on its own kernels.
+/// @pre None.
+/// @post None.
+/// @return The name of the backend.
+///////////////////////////////////////////////////////////////////////////////
+std::string LinearAlgebraBackend()
+{
+    return LINALG_BACKEND;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SetLinearAlgebraThreads
+/// @description Sets how many threads the BLAS/LAPACK uses for a product or
+///     a solve. The VVC module already runs the phases and the candidate power
+///     flows on threads of its own, so each of those should get few.
+/// @pre Called before the first armadillo operation, which BLIS needs.
+/// @post The threaded backend uses at most the given number of threads.
+/// @param threads The thread count, at least 1.
+///////////////////////////////////////////////////////////////////////////////
+void SetLinearAlgebraThreads(unsigned int threads)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+#if defined(LINALG_OPENBLAS)
+    openblas_set_num_threads(static_cast<int>(threads));
+#elif defined(LINALG_MKL)
+    MKL_Set_Num_Threads(static_cast<int>(threads));
+#elif defined(LINALG_BLIS)
+    // BLIS reads the count when it initializes on first use
+    setenv("BLIS_NUM_THREADS",
+        boost::lexical_cast<std::string>(threads).c_str(), 1);
+#else
+    LOG_DEBUG(Logger) << "Armadillo runs on its own kernels; " << threads
+                      << " BLAS threads requested" << std::endl;
+#endif
+}
+
+} // namespace broker
+} // namespace freedm
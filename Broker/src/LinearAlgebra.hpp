@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         LinearAlgebra.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Reports and configures the BLAS/LAPACK under armadillo
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LINEAR_ALGEBRA_HPP
+#define LINEAR_ALGEBRA_HPP
+
+#include <string>
+
+namespace freedm {
+namespace broker {
+
+/// Gets the name of the BLAS/LAPACK the build links, set by LINALG_BACKEND
+std::string LinearAlgebraBackend();
+/// Limits the threads the BLAS/LAPACK may start for one operation
+void SetLinearAlgebraThreads(unsigned int threads);
+
+} // namespace broker
+} // namespace freedm
+
+#endif // LINEAR_ALGEBRA_HPP
@@ -22,7 +22,11 @@
 
 #include "Messages.hpp"
 
+#include "CGlobalConfiguration.hpp"
+#include "CLatencyTrace.hpp"
 #include "CLogger.hpp"
+#include "CMessagePool.hpp"
+#include "CVirtualClock.hpp"
 #include "messages/ModuleMessage.pb.h"
 #include "messages/ProtocolMessage.pb.h"
 
@@ -30,7 +34,10 @@
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/functional/hash.hpp>
+#include <boost/make_shared.hpp>
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 namespace freedm {
 namespace broker {
@@ -40,6 +47,30 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Origin of the binary timestamps.
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+
+/// Converts a UTC time to microseconds since EPOCH.
+google::protobuf::uint64 ToMicroseconds(const boost::posix_time::ptime& t)
+{
+    return (t - EPOCH).total_microseconds();
+}
+
+/// Received windows kept for reuse, enough for the datagrams in flight.
+const std::size_t WINDOW_POOL_SIZE = 64;
+
+/// Bytes of the longest varint, which any varint field can be padded to.
+const std::size_t PADDED_VARINT_SIZE = 10;
+
+/// Package prefix left off the message type names
+const std::string TYPE_PREFIX = "freedm.broker.";
+
+/// Current UTC time in microseconds since EPOCH.
+google::protobuf::uint64 NowMicroseconds()
+{
+    return ToMicroseconds(CVirtualClock::Now());
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -50,10 +81,282 @@ CLocalLogger Logger(__FILE__);
 ///////////////////////////////////////////////////////////////////////////////
 google::protobuf::uint64 ComputeMessageHash(const ModuleMessage& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    return ComputeMessageHash(msg.SerializeAsString());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ComputeMessageHash
+/// @description Hash the serialized form of a message. The hash only has to
+///     match the one the receiver echoes back in its ACK, so it is taken over
+///     the wire encoding rather than a text rendering of the message.
+/// @param bytes the serialized message to hash
+/// @return a hash of the message
+///////////////////////////////////////////////////////////////////////////////
+google::protobuf::uint64 ComputeMessageHash(const std::string& bytes)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     static boost::hash<std::string> string_hash;
-    return static_cast<google::protobuf::uint64>(string_hash(msg.ShortDebugString()));
+    return static_cast<google::protobuf::uint64>(string_hash(bytes));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GetMessageLane
+/// @description Classifies a message by how much its delivery suffers from
+///     waiting behind other traffic to the same peer. Clock exchanges and
+///     group liveness checks are timed by their receivers, so they must not
+///     queue behind large state collection or peer list messages. A stale
+///     sample is worth nothing, so the realtime lane is never resent and has
+///     no window for a lost message to hold up.
+/// @param msg the message to classify
+/// @return the lane the message is sent over
+///////////////////////////////////////////////////////////////////////////////
+EMessageLane GetMessageLane(const ModuleMessage& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(msg.has_clock_synchronizer_message())
+    {
+        return LANE_REALTIME;
+    }
+    if(msg.has_state_collection_message())
+    {
+        return LANE_BULK;
+    }
+    if(msg.has_group_management_message())
+    {
+        const gm::GroupManagementMessage& gmm = msg.group_management_message();
+        if(gmm.has_are_you_there_message() ||
+            gmm.has_are_you_there_response_message())
+        {
+            return LANE_REALTIME;
+        }
+        if(gmm.has_peer_list_message())
+        {
+            return LANE_BULK;
+        }
+    }
+    return LANE_CONTROL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GetMessageType
+/// @description Names the message a module message carries, such as
+///     gm.PeerListMessage for a group management peer list. The module
+///     message holds the message of a module, which holds one of its kinds.
+/// @pre None
+/// @post None
+/// @param msg the message to name.
+/// @param depth how many nested messages to look through.
+/// @return The type name without the freedm.broker package.
+///////////////////////////////////////////////////////////////////////////////
+std::string GetMessageType(const google::protobuf::Message& msg, unsigned int depth)
+{
+    if(depth > 0)
+    {
+        std::vector<const google::protobuf::FieldDescriptor*> fields;
+        msg.GetReflection()->ListFields(msg, &fields);
+        for(unsigned int i=0; i < fields.size(); i++)
+        {
+            if(fields[i]->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE
+                && !fields[i]->is_repeated())
+            {
+                return GetMessageType(
+                    msg.GetReflection()->GetMessage(msg, fields[i]), depth - 1);
+            }
+        }
+    }
+    std::string type = msg.GetDescriptor()->full_name();
+    if(type.compare(0, TYPE_PREFIX.size(), TYPE_PREFIX) == 0)
+    {
+        type.erase(0, TYPE_PREFIX.size());
+    }
+    return type;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSerializedMessage::CSerializedMessage
+/// @description Serializes and hashes a copy of a module message so that it
+///     can be sent to several peers and resent without being encoded again.
+/// @pre msg is fully initialized.
+/// @post The serialized bytes and their hash are stored.
+/// @param msg the message to serialize
+///////////////////////////////////////////////////////////////////////////////
+CSerializedMessage::CSerializedMessage(const ModuleMessage& msg)
+    : m_lane(GetMessageLane(msg))
+    , m_patched(false)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    Serialize(boost::make_shared<ModuleMessage>(msg));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSerializedMessage::CSerializedMessage
+/// @description Serializes and hashes a shared module message, which is kept
+///     as it is. The message is only copied if it has to be stamped, when
+///     latency tracing is on or the message carries the stamps of a sender
+///     it is being forwarded from.
+/// @pre msg is fully initialized and is no longer changed.
+/// @post The serialized bytes and their hash are stored.
+/// @param msg the message to serialize
+///////////////////////////////////////////////////////////////////////////////
+CSerializedMessage::CSerializedMessage(boost::shared_ptr<const ModuleMessage> msg)
+    : m_message(msg)
+    , m_lane(GetMessageLane(*msg))
+    , m_patched(false)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::shared_ptr<ModuleMessage> copy;
+    if(msg->has_trace() || CGlobalConfiguration::Instance().GetLatencyTrace())
+    {
+        copy = boost::make_shared<ModuleMessage>(*msg);
+    }
+    Serialize(copy);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSerializedMessage::CSerializedMessage
+/// @description Hashes bytes a message template patched. The prototype gives
+///     the lane and the recipient, but only the bytes hold the patched field,
+///     so the message is parsed again for a copy that stays in this process.
+/// @pre The bytes are the prototype's encoding with some fields overridden.
+/// @post The bytes and their hash are stored.
+/// @param prototype the message the bytes were encoded from
+/// @param bytes the patched encoding
+///////////////////////////////////////////////////////////////////////////////
+CSerializedMessage::CSerializedMessage(boost::shared_ptr<const ModuleMessage> prototype,
+    const std::string& bytes)
+    : m_message(prototype)
+    , m_bytes(bytes)
+    , m_hash(ComputeMessageHash(bytes))
+    , m_lane(GetMessageLane(*prototype))
+    , m_patched(true)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSerializedMessage::Unpack
+/// @description Gets the module message a serialized message stands for, to
+///     deliver it in this process. The message it was serialized from is
+///     shared, a patched one is parsed from its bytes.
+/// @pre None
+/// @post None
+/// @param msg the serialized message
+/// @return The message with the fields it has on the wire.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ModuleMessage> CSerializedMessage::Unpack(const Pointer& msg)
+{
+    if(!msg->m_patched)
+    {
+        return boost::shared_ptr<const ModuleMessage>(msg, &msg->GetMessage());
+    }
+    boost::shared_ptr<ModuleMessage> parsed = boost::make_shared<ModuleMessage>();
+    parsed->ParseFromString(msg->GetBytes());
+    return parsed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMessageTemplate::CMessageTemplate
+/// @description Encodes the prototype and appends the field to patch: each
+///     number of the path but the last is a submessage field, the last is a
+///     varint field, such as an int32, uint32, int64, uint64, bool or enum.
+///     The varint is padded to its longest encoding, so every value fits in
+///     the same ten bytes and no length on the path changes.
+/// @pre The path names fields of the message types on it; sint fields are
+///     not supported.
+/// @post The encoding is ready to patch.
+/// @param prototype the message every copy is made from
+/// @param path the field numbers from the module message to the field
+///////////////////////////////////////////////////////////////////////////////
+CMessageTemplate::CMessageTemplate(const ModuleMessage& prototype,
+    const std::vector<int>& path)
+    : m_prototype(boost::make_shared<ModuleMessage>(prototype))
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    using google::protobuf::internal::WireFormatLite;
+    using google::protobuf::io::CodedOutputStream;
+
+    assert(!path.empty());
+    // build the nested field from the inside out
+    google::protobuf::uint8 buffer[10];
+    google::protobuf::uint8* end = CodedOutputStream::WriteTagToArray(
+        WireFormatLite::MakeTag(path.back(), WireFormatLite::WIRETYPE_VARINT), buffer);
+    std::string field(reinterpret_cast<const char*>(buffer), end - buffer);
+    std::size_t offset = field.size();
+    field.append(PADDED_VARINT_SIZE, '\0');
+    for(std::size_t i = path.size() - 1; i > 0; i--)
+    {
+        std::string outer;
+        AppendField(outer, path[i - 1], field);
+        offset += outer.size() - field.size();
+        field.swap(outer);
+    }
+
+    m_prototype->SerializeToString(&m_bytes);
+    m_offset = m_bytes.size() + offset;
+    m_bytes.append(field);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CMessageTemplate::Instantiate
+/// @description Copies the encoding and writes the value into its padded
+///     varint. With latency tracing on, the copy is parsed and serialized
+///     again so it carries its stamps.
+/// @pre None
+/// @post None
+/// @param value the value of the field, a negative int32 or int64 cast to
+///     uint64
+/// @return The serialized copy.
+///////////////////////////////////////////////////////////////////////////////
+CSerializedMessage::Pointer CMessageTemplate::Instantiate(google::protobuf::uint64 value) const
+{
+    std::string bytes(m_bytes);
+    for(std::size_t i = 0; i < PADDED_VARINT_SIZE; i++)
+    {
+        google::protobuf::uint8 byte = (value >> (7 * i)) & 0x7F;
+        if(i + 1 < PADDED_VARINT_SIZE)
+        {
+            byte |= 0x80;
+        }
+        bytes[m_offset + i] = static_cast<char>(byte);
+    }
+
+    if(CGlobalConfiguration::Instance().GetLatencyTrace())
+    {
+        ModuleMessage msg;
+        msg.ParseFromString(bytes);
+        return boost::make_shared<const CSerializedMessage>(msg);
+    }
+    return boost::make_shared<const CSerializedMessage>(m_prototype, bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSerializedMessage::Serialize
+/// @description Encodes the message. When latency tracing is on the message
+///     is stamped with the time it was queued; the stamps of a message being
+///     forwarded are always replaced.
+/// @pre copy is a copy of the message that may be stamped, or null if the
+///     message in m_message needs no stamps.
+/// @post m_message, the serialized bytes and their hash are stored.
+/// @param copy the copy to stamp and keep.
+///////////////////////////////////////////////////////////////////////////////
+void CSerializedMessage::Serialize(boost::shared_ptr<ModuleMessage> copy)
+{
+    if(copy)
+    {
+        copy->clear_trace();
+        if(CGlobalConfiguration::Instance().GetLatencyTrace())
+        {
+            copy->mutable_trace()->set_enqueue_usec(CLatencyTrace::Now());
+        }
+        m_message = copy;
+    }
+    m_message->SerializeToString(&m_bytes);
+    m_hash = ComputeMessageHash(m_bytes);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -65,13 +368,82 @@ google::protobuf::uint64 ComputeMessageHash(const ModuleMessage& msg)
 ///////////////////////////////////////////////////////////////////////////////
 bool MessageIsExpired(const ProtocolMessage& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!msg.has_expire_usec() && !msg.has_expire_time())
+        return false;
+
+    return GetExpirationTime(msg) < NowMicroseconds();
+}
 
+///////////////////////////////////////////////////////////////////////////////
+/// MessageIsExpired
+/// @description Determines whether the message had expired at a given time,
+///     so many messages can be checked against one reading of the clock. The
+///     binary expiration time is compared directly.
+/// @param msg the message to check
+/// @param now the time to check against, from GetExpirationClock
+/// @return true if the message had expired by now; false otherwise
+///         (including if the message has no expiration time set)
+///////////////////////////////////////////////////////////////////////////////
+bool MessageIsExpired(const ProtocolMessage& msg, google::protobuf::uint64 now)
+{
+    if(msg.has_expire_usec())
+        return msg.expire_usec() < now;
     if(!msg.has_expire_time())
         return false;
+    return GetExpirationTime(msg) < now;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GetExpirationClock
+/// @description Gets the current time in the units of GetExpirationTime.
+/// @return the UTC time in microseconds since the Unix epoch
+///////////////////////////////////////////////////////////////////////////////
+google::protobuf::uint64 GetExpirationClock()
+{
+    return NowMicroseconds();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GetExpirationTime
+/// @description Gets the expiration time of the message. Messages from older
+///     DGI versions carry the time as a string, which is parsed in that case.
+/// @param msg the message to check
+/// @return the expiration time in microseconds since the Unix epoch, or 0 if
+///         the message has no expiration time set
+///////////////////////////////////////////////////////////////////////////////
+google::protobuf::uint64 GetExpirationTime(const ProtocolMessage& msg)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(msg.has_expire_usec())
+        return msg.expire_usec();
+
+    if(msg.has_expire_time())
+        return ToMicroseconds(
+            boost::posix_time::time_from_string(msg.expire_time()));
 
-    return boost::posix_time::time_from_string(msg.expire_time())
-        < boost::posix_time::microsec_clock::universal_time();
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CopyExpirationTime
+/// @description Copies the expiration time of a message to another message,
+///     in the same representation the source message used.
+/// @param from the message to copy the time from
+/// @param to the message to modify
+/// @pre None
+/// @post to has the same expiration time fields as from.
+///////////////////////////////////////////////////////////////////////////////
+void CopyExpirationTime(const ProtocolMessage& from, ProtocolMessage& to)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(from.has_expire_usec())
+        to.set_expire_usec(from.expire_usec());
+    if(from.has_expire_time())
+        to.set_expire_time(from.expire_time());
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -84,27 +456,83 @@ bool MessageIsExpired(const ProtocolMessage& msg)
 ///////////////////////////////////////////////////////////////////////////////
 void SetExpirationTimeFromNow(ProtocolMessage& msg, const boost::posix_time::time_duration& expires_in)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    msg.set_expire_time(
-        boost::posix_time::to_simple_string(
-            boost::posix_time::microsec_clock::universal_time() + expires_in));
+    msg.set_expire_usec(NowMicroseconds() + expires_in.total_microseconds());
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// StampMessageSendtime
-/// @description Sets the message's timestamp to the current time.
+/// @description Sets the message's timestamp to the current time of the
+///     synchronized clock, which the latency trace of the receiver compares
+///     with its own stamps.
 /// @param msg the message to stamp, transfer-none
 /// @pre None
-/// @post Sets the send time for the message to the current UTC time.
+/// @post Sets the send time for the message to the synchronized time.
 ///////////////////////////////////////////////////////////////////////////////
 void StampMessageSendtime(ProtocolMessageWindow& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    msg.set_send_usec(CLatencyTrace::Now());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// AppendField
+/// @description Appends the tag, length and bytes of a length-delimited
+///     field to a serialized message, which is how an already encoded module
+///     message is spliced into a protocol message without encoding it again.
+/// @pre None
+/// @post The field is at the end of out.
+/// @param out the serialized message to extend.
+/// @param field the number of the field.
+/// @param bytes the contents of the field.
+///////////////////////////////////////////////////////////////////////////////
+void AppendField(std::string& out, int field, const std::string& bytes)
+{
+    using google::protobuf::internal::WireFormatLite;
+    using google::protobuf::io::CodedOutputStream;
+
+    google::protobuf::uint8 prefix[10];
+    google::protobuf::uint8* end = CodedOutputStream::WriteTagToArray(
+        WireFormatLite::MakeTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED),
+        prefix);
+    end = CodedOutputStream::WriteVarint32ToArray(bytes.size(), end);
+    out.append(reinterpret_cast<const char*>(prefix), end - prefix);
+    out.append(bytes);
+}
 
-    msg.set_send_time(
-        boost::posix_time::to_simple_string(
-            boost::posix_time::microsec_clock::universal_time()));
+///////////////////////////////////////////////////////////////////////////////
+/// ShareMessage
+/// @description Makes a shared message out of one that is finished, without
+///     copying it: the contents are swapped into the new message. The shared
+///     message can be delivered to this node and serialized for the others
+///     as it is.
+/// @pre None
+/// @post msg is empty.
+/// @param msg the message to share.
+/// @return The shared message with the contents msg had.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ModuleMessage> ShareMessage(ModuleMessage& msg)
+{
+    boost::shared_ptr<ModuleMessage> shared = boost::make_shared<ModuleMessage>();
+    shared->Swap(&msg);
+    return shared;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// AcquireWindow
+/// @description Gets a window to parse a received datagram into. The window
+///     returns to a shared pool once the last module message that points into
+///     it has been handled, and parsing into it again reuses its memory.
+/// @pre None
+/// @post None
+/// @return An empty window.
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<ProtocolMessageWindow> AcquireWindow()
+{
+    static CMessagePool<ProtocolMessageWindow> pool(WINDOW_POOL_SIZE);
+    return pool.Acquire();
 }
 
 } // namespace broker
@@ -26,8 +26,11 @@
 #include "messages/ModuleMessage.pb.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/shared_ptr.hpp>
 #include <google/protobuf/message.h>
 
 namespace freedm {
@@ -39,15 +42,123 @@ class ProtocolMessageWindow;
 /// Hash a message.
 google::protobuf::uint64 ComputeMessageHash(const ModuleMessage& msg);
 
+/// Hash the serialized bytes of a message.
+google::protobuf::uint64 ComputeMessageHash(const std::string& bytes);
+
+/// Priority classes of module messages, each sent over its own ordering lane.
+enum EMessageLane
+{
+    /// Group formation, load balancing and everything not listed below
+    LANE_CONTROL = 0,
+    /// Clock synchronization and group liveness checks, sent best effort
+    LANE_REALTIME,
+    /// State collection and peer lists
+    LANE_BULK,
+    /// The number of lanes
+    LANE_COUNT
+};
+
+/// Determines the priority lane a message is sent over.
+EMessageLane GetMessageLane(const ModuleMessage& msg);
+
+/// Names the message nested a number of levels within a message.
+std::string GetMessageType(const google::protobuf::Message& msg, unsigned int depth);
+
+/// A module message that is serialized and hashed once for all its sends.
+class CSerializedMessage
+{
+    public:
+        /// Shared handle used by every peer and resend of the message
+        typedef boost::shared_ptr<const CSerializedMessage> Pointer;
+        /// Serializes and hashes a copy of the message
+        explicit CSerializedMessage(const ModuleMessage& msg);
+        /// Serializes and hashes a message without copying it
+        explicit CSerializedMessage(boost::shared_ptr<const ModuleMessage> msg);
+        /// Hashes bytes patched from the encoding of a prototype message
+        CSerializedMessage(boost::shared_ptr<const ModuleMessage> prototype,
+            const std::string& bytes);
+        /// Gets the message the bytes were produced from, or the prototype
+        const ModuleMessage& GetMessage() const { return *m_message; }
+        /// Checks if the bytes were patched, so only they hold every field
+        bool IsPatched() const { return m_patched; }
+        /// Gets the message as it is on the wire, parsed again if patched
+        static boost::shared_ptr<const ModuleMessage> Unpack(const Pointer& msg);
+        /// Gets the wire encoding of the message
+        const std::string& GetBytes() const { return m_bytes; }
+        /// Gets the hash of the wire encoding
+        google::protobuf::uint64 GetHash() const { return m_hash; }
+        /// Gets the priority lane of the message
+        EMessageLane GetLane() const { return m_lane; }
+    private:
+        /// Stamps the message if tracing is on, then serializes and hashes it
+        void Serialize(boost::shared_ptr<ModuleMessage> copy);
+        /// The message, for delivery to this process
+        boost::shared_ptr<const ModuleMessage> m_message;
+        /// Serialized message
+        std::string m_bytes;
+        /// Hash of m_bytes
+        google::protobuf::uint64 m_hash;
+        /// Priority lane of the message
+        EMessageLane m_lane;
+        /// Set if the bytes were patched after they were encoded
+        bool m_patched;
+};
+
+/// A module message encoded once, with one integer field patched per copy.
+////////////////////////////////////////////////////////////////////////////////
+/// Periodic control messages, such as heartbeats and clock queries, differ
+/// from one send to the next only in a sequence number. The template encodes
+/// the prototype once and appends the patched field, nested in the messages
+/// on its path, with its varint padded to ten bytes. Protobuf merges the
+/// repeated submessages on parse and the last value of a field wins, so each
+/// copy is the prototype bytes with ten bytes overwritten in place.
+////////////////////////////////////////////////////////////////////////////////
+class CMessageTemplate
+{
+    public:
+        /// Encodes a prototype with room for a varint field on a path
+        CMessageTemplate(const ModuleMessage& prototype, const std::vector<int>& path);
+        /// Gets a serialized message of the prototype with the field set
+        CSerializedMessage::Pointer Instantiate(google::protobuf::uint64 value) const;
+    private:
+        /// The prototype, for the lane, the recipient and local delivery
+        boost::shared_ptr<const ModuleMessage> m_prototype;
+        /// The encoded prototype with the patched field appended
+        std::string m_bytes;
+        /// Position of the padded varint in m_bytes
+        std::size_t m_offset;
+};
+
 /// Determines whether the message has expired.
 bool MessageIsExpired(const ProtocolMessage& msg);
 
+/// Determines whether the message had expired at a time of GetExpirationClock.
+bool MessageIsExpired(const ProtocolMessage& msg, google::protobuf::uint64 now);
+
+/// Gets the current time of the clock expiration times are kept on.
+google::protobuf::uint64 GetExpirationClock();
+
+/// Gets the expiration time of the message in microseconds since the epoch.
+google::protobuf::uint64 GetExpirationTime(const ProtocolMessage& msg);
+
+/// Copies the expiration time of one message to another.
+void CopyExpirationTime(const ProtocolMessage& from, ProtocolMessage& to);
+
 /// Set the expiration time for this message.
 void SetExpirationTimeFromNow(ProtocolMessage& msg, const boost::posix_time::time_duration& expires_in);
 
 /// Sets the message's timestamp to the current time.
 void StampMessageSendtime(ProtocolMessageWindow& msg);
 
+/// Appends a length-delimited field holding bytes to a serialized message.
+void AppendField(std::string& out, int field, const std::string& bytes);
+
+/// Moves the contents of a message into a new shared message.
+boost::shared_ptr<const ModuleMessage> ShareMessage(ModuleMessage& msg);
+
+/// Gets an empty window to parse a datagram into, from a pool of used ones.
+boost::shared_ptr<ProtocolMessageWindow> AcquireWindow();
+
 } // namespace broker
 } // namespace freedm
 
@@ -20,8 +20,13 @@
 
 #include <algorithm>
 #include <exception>
+#include <vector>
 
 #include "PeerSets.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CMulticastChannel.hpp"
+#include "CRelayTree.hpp"
+#include "Messages.hpp"
 
 namespace freedm {
 namespace broker {
@@ -163,5 +168,113 @@ void InsertInTimedPeerSet(TimedPeerSet& tps,
     tps[m.GetUUID()] = std::make_pair(m, time);
 }
 
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////
+/// SendToGroup
+/// @description Sends a serialized message to every peer of a PeerSet. The
+///     copy for this node is delivered directly, the remote peers share a
+///     multicast datagram or, if allowed, a relay tree, and otherwise each
+///     gets its own copy over its connection.
+/// @param ps The peers to send the message to
+/// @param bytes The serialized message to send
+/// @param relay Set if the message may go down a relay tree
+/// @pre None
+/// @post The message is sent to all processes in ps
+///////////////////////////////////////////////////////////////////////////////
+void SendToGroup(const PeerSet& ps,
+    const boost::shared_ptr<const CSerializedMessage>& bytes, bool relay)
+{
+    std::string me = CGlobalConfiguration::Instance().GetUUID();
+    std::vector<std::string> remote;
+
+    for(PeerSet::const_iterator it = ps.begin(); it != ps.end(); it++)
+    {
+        if(it->first == me)
+        {
+            CPeerNode(it->second).Send(bytes);
+        }
+        else
+        {
+            remote.push_back(it->first);
+        }
+    }
+    if(!CMulticastChannel::Instance().Send(bytes, remote)
+        && !(relay && CRelayTree::Instance().Send(bytes, remote)))
+    {
+        for(std::size_t i = 0; i < remote.size(); i++)
+        {
+            CPeerNode(remote[i]).Send(bytes);
+        }
+    }
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SendToPeers
+/// @description Sends a message to every peer of a PeerSet. The message is
+///     serialized once. If the multicast channel is enabled, the remote peers
+///     share one multicast datagram, otherwise each gets its own copy over
+///     its connection. A copy for this node is always delivered directly.
+/// @param ps The peers to send the message to
+/// @param m The message to send
+/// @pre None
+/// @post m is sent to all processes in ps
+///////////////////////////////////////////////////////////////////////////////
+void SendToPeers(const PeerSet& ps, const ModuleMessage& m)
+{
+    SendToPeers(ps, CSerializedMessage::Pointer(new CSerializedMessage(m)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SendToPeers
+/// @description Sends a message that is already serialized to every peer of
+///     a PeerSet, so that the caller can also send it elsewhere.
+/// @param ps The peers to send the message to
+/// @param bytes The serialized message to send
+/// @pre None
+/// @post The message is sent to all processes in ps
+///////////////////////////////////////////////////////////////////////////////
+void SendToPeers(const PeerSet& ps,
+    const boost::shared_ptr<const CSerializedMessage>& bytes)
+{
+    SendToGroup(ps, bytes, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// BroadcastToPeers
+/// @description Sends a message that every member of a group needs, such as
+///     a peer list or a load balance state change. Unless the multicast
+///     channel carries it, the message goes down a relay tree when the
+///     relay-fanout option is set, so this node only writes a few copies.
+///     Messages whose recipients are not known to be up, such as invitations,
+///     should use SendToPeers instead, since a failed node cuts off those
+///     below it in the tree.
+/// @param ps The peers to send the message to
+/// @param m The message to send
+/// @pre None
+/// @post m is sent to all processes in ps
+///////////////////////////////////////////////////////////////////////////////
+void BroadcastToPeers(const PeerSet& ps, const ModuleMessage& m)
+{
+    BroadcastToPeers(ps, CSerializedMessage::Pointer(new CSerializedMessage(m)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// BroadcastToPeers
+/// @description Sends a group broadcast that is already serialized, so that
+///     the caller can also send it elsewhere.
+/// @param ps The peers to send the message to
+/// @param bytes The serialized message to send
+/// @pre None
+/// @post The message is sent to all processes in ps
+///////////////////////////////////////////////////////////////////////////////
+void BroadcastToPeers(const PeerSet& ps,
+    const boost::shared_ptr<const CSerializedMessage>& bytes)
+{
+    SendToGroup(ps, bytes, true);
+}
+
 } // namespace freedm
 } // namespace broker
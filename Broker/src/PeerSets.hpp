@@ -43,6 +43,16 @@ PeerSetIterator FindInPeerSet(PeerSet& ps, const CPeerNode& m);
 void EraseInPeerSet(PeerSet& ps, const CPeerNode& m);
 /// Provides insert() for a PeerSet
 void InsertInPeerSet(PeerSet& ps, const CPeerNode& m);
+/// Sends a message to every peer of a PeerSet, multicast if possible
+void SendToPeers(const PeerSet& ps, const ModuleMessage& m);
+/// Sends a serialized message to every peer of a PeerSet, multicast if possible
+void SendToPeers(const PeerSet& ps,
+    const boost::shared_ptr<const CSerializedMessage>& bytes);
+/// Sends a group broadcast to a PeerSet, down a relay tree if there is one
+void BroadcastToPeers(const PeerSet& ps, const ModuleMessage& m);
+/// Sends a serialized group broadcast to a PeerSet, down a relay tree if there is one
+void BroadcastToPeers(const PeerSet& ps,
+    const boost::shared_ptr<const CSerializedMessage>& bytes);
 
 /// Similar to a PeerSet, but also tracks the time a peer was inserted
 typedef std::map<std::string,
@@ -26,16 +26,23 @@
 #include "CDispatcher.hpp"
 #include "CGlobalConfiguration.hpp"
 #include "CLogger.hpp"
+#include "CPhysicalTopology.hpp"
 #include "config.hpp"
 #include "gm/GroupManagement.hpp"
 #include "lb/LoadBalance.hpp"
+#include "lb/GossipBalance.hpp"
 #include "sc/StateCollection.hpp"
 #include "vvc/VoltVarCtrl.hpp"
 #include "CTimings.hpp"
+#include "CThreadPolicy.hpp"
+#include "CVirtualClock.hpp"
 #include "SRemoteHost.hpp"
 #include "FreedmExceptions.hpp"
+#include "LinearAlgebra.hpp"
 
 #include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <set>
 #include <sstream>
@@ -56,6 +63,12 @@
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/thread.hpp>
 
+#include <csignal>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
 namespace po = boost::program_options;
 
 using namespace freedm;
@@ -107,6 +120,40 @@ unsigned short GetPortFromString(const std::string str)
     return static_cast<unsigned short>(port);
 }
 
+/// Forks a process for each instance after the first, and returns the
+/// position of the instance the calling process runs.
+unsigned int ForkInstances(unsigned int instances)
+{
+    for(unsigned int i = 1; i < instances; i++)
+    {
+        pid_t pid = fork();
+        if(pid < 0)
+        {
+            throw std::runtime_error(std::string("cannot fork instance: ")
+                + std::strerror(errno));
+        }
+        if(pid == 0)
+        {
+#ifdef __linux__
+            // the instances stop with the first one
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+            return i;
+        }
+    }
+    return 0;
+}
+
+/// Gives each instance after the first its own copy of an output file.
+std::string InstancePath(const std::string& path, unsigned int instance)
+{
+    if(path.empty() || instance == 0)
+    {
+        return path;
+    }
+    return path + "." + boost::lexical_cast<std::string>(instance);
+}
+
 } // unnamed namespace
 
 /// Broker entry point
@@ -119,10 +166,31 @@ int main(int argc, char* argv[])
     po::variables_map vm;
     std::ifstream ifs;
     std::string cfgFile, loggerCfgFile, timingsFile, adapterCfgFile, topologyCfgFile;
+    std::string compileTopologyFile, telemetryFile, captureFile, replayCapture;
+    std::string networkEmulationFile;
     std::string deviceCfgFile, listenIP, port, hostname, fport, id, mqttID, mqttAddress;
-    unsigned int globalVerbosity;
-    float migrationStep;
-    bool malicious, invariant;
+    std::string feederModelFile, feederImpedanceFile, traceFile, vvcDumpFile;
+    std::string warmStateFile, profileFile;
+    unsigned int globalVerbosity, datagramMtu, flushDelay, ackDelay, ackCount, datagramBatch;
+    unsigned int socketReceiveBuffer, socketSendBuffer, socketBufferLimit;
+    bool socketDrops;
+    unsigned int listenerThreads, brokerThreads, sendWindow, sendQueue, idleRounds, relayFanout;
+    unsigned int inboundQueue, admissionBacklog, compressThreshold, immediateLimit, phaseSpin, watchdogThreshold, profileRate, traceRecords, telemetryQueue, scSnapshots, scRecordLimit, deviceThreads;
+    unsigned int factoryBacklog, factoryAcceptors, pnpDeltaRefresh, draftPartners, instances;
+    unsigned int mqttWorkers;
+    unsigned int vvcBatchThreads, vvcSweepThreads, blasThreads, warmStateInterval, warmStateMaxAge;
+    int vvcSegmentBus;
+    unsigned short multicastPort, metricsPort;
+    std::string multicastAddress, lbAlgorithm, vvcOptimizer, vvcPrecision;
+    float migrationStep, lbDeadband, lbForecast, scDeadband, vvcSensitivityTolerance;
+    float vvcSkipDeadband, pnpDeltaDeadband;
+    double replaySpeed, timeScale;
+    bool malicious, invariant, vvcWarmStart, vvcParallelPhases, vvcOffload;
+    bool vvcHalfGradients;
+    bool sharedMemory, adaptivePhases, precisePhases, lockMemory, asyncLogging, kernelTimestamps;
+    bool swimMembership, hierarchicalGroups, groupStandby, scDelta, scPacked, scAggregate;
+    bool latencyTrace, inlineSelfDelivery, lbDigests, passiveClock, trafficAccounting;
+    unsigned int trafficSummary;
 
     try
     {
@@ -148,8 +216,23 @@ int main(int argc, char* argv[])
                 ( "port,p",
                 po::value<std::string > ( &port )->default_value("1870"),
                 "TCP port to listen for peers on" )
+                ( "instances",
+                po::value<unsigned int> ( &instances )->default_value(1),
+                "DGIs to run from this configuration, each in its own process on the next port" )
                 ( "factory-port", po::value<std::string>(&fport),
                 "port for plug and play session protocol" )
+                ( "factory-backlog",
+                po::value<unsigned int> ( &factoryBacklog )->default_value(0),
+                "Pending plug and play connections per acceptor, 0 for the system limit" )
+                ( "factory-acceptors",
+                po::value<unsigned int> ( &factoryAcceptors )->default_value(1),
+                "SO_REUSEPORT acceptors that share the plug and play port, at least 1" )
+                ( "pnp-delta-deadband",
+                po::value<float> ( &pnpDeltaDeadband )->default_value(0),
+                "Change a command must exceed to be sent in a delta plug and play packet" )
+                ( "pnp-delta-refresh",
+                po::value<unsigned int> ( &pnpDeltaRefresh )->default_value(10),
+                "Delta plug and play command packets between two full packets, at least 1" )
                 ( "mqtt-id", po::value<std::string>(&mqttID)->default_value("DGIClient"),
                 "id of the DGI MQTT client (optional)" )
                 ( "mqtt-address",
@@ -158,6 +241,9 @@ int main(int argc, char* argv[])
                 ( "mqtt-subscribe",
                 po::value<std::vector<std::string> >( )->composing(),
                 "MQTT subscription topic" )
+                ( "mqtt-workers",
+                po::value<unsigned int> ( &mqttWorkers )->default_value(2),
+                "Threads that handle received MQTT messages, each for its own devices" )
                 ( "device-config",
                 po::value<std::string>(&deviceCfgFile)->default_value(""),
                 "filename of the XML device class specification" )
@@ -175,15 +261,266 @@ int main(int argc, char* argv[])
                 po::value<std::string > ( &topologyCfgFile )->
                 default_value(""),
                 "name of the topology configuration file" )
+                ( "compile-topology",
+                po::value<std::string > ( &compileTopologyFile ),
+                "write the topology-config in the binary topology format to this file and exit" )
+                ( "network-emulation",
+                po::value<std::string > ( &networkEmulationFile )->
+                default_value(""),
+                "filename of the latency, jitter, bandwidth and loss of the emulated links to other DGI" )
+                ( "feeder-model",
+                po::value<std::string > ( &feederModelFile )->
+                default_value(""),
+                "filename of the VVC feeder model (Dl) saved by armadillo" )
+                ( "feeder-impedance",
+                po::value<std::string > ( &feederImpedanceFile )->
+                default_value(""),
+                "filename of the VVC line impedances [R X] saved by armadillo" )
+                ( "vvc-dump",
+                po::value<std::string > ( &vvcDumpFile )->
+                default_value(""),
+                "filename the VVC feeder model with new set points is saved to for debugging" )
+                ( "warm-state",
+                po::value<std::string > ( &warmStateFile )->
+                default_value(""),
+                "filename the state a restart resumes from is saved to" )
+                ( "warm-state-interval",
+                po::value<unsigned int> ( &warmStateInterval )->default_value(5000),
+                "Milliseconds between saves of the warm state" )
+                ( "warm-state-max-age",
+                po::value<unsigned int> ( &warmStateMaxAge )->default_value(300),
+                "Seconds after which a saved warm state is ignored at startup" )
                 ( "migration-step",
                 po::value<float>(&migrationStep)->default_value(1),
                  "Size of power migrations in load balance" )
+                ( "lb-algorithm",
+                po::value<std::string> ( &lbAlgorithm )->default_value("draft"),
+                "Load balance algorithm: draft to migrate by drafting, gossip to average the imbalance by push-sum" )
+                ( "lb-deadband",
+                po::value<float> ( &lbDeadband )->default_value(0),
+                "Change of the gateway or net generation that starts a load balance round at once, 0 to use only the periodic rounds" )
+                ( "lb-forecast",
+                po::value<float> ( &lbForecast )->default_value(0),
+                "Smoothing factor from 0 to 1 of the net generation trend load balance plans a round ahead with, 0 to act on the readings alone" )
+                ( "lb-draft-partners",
+                po::value<unsigned int> ( &draftPartners )->default_value(1),
+                "Most demand nodes a supply node splits its surplus across in one load balance round" )
+                ( "lb-digests",
+                po::value<bool> ( &lbDigests )->default_value(false),
+                "Advertise the load balance state on the group management and clock messages instead of in rounds of its own" )
                 ( "malicious-behavior",
                 po::value<bool> ( &malicious )->default_value(false),
                 "Disable acept messages when node is in demand" )
                 ( "check-invariant",
                 po::value<bool> ( &invariant )->default_value(false),
                 "Check the invariant prior to power migrations" )
+                ( "vvc-warm-start",
+                po::value<bool> ( &vvcWarmStart )->default_value(false),
+                "Start each VVC power flow from the last converged solution" )
+                ( "vvc-parallel-phases",
+                po::value<bool> ( &vvcParallelPhases )->default_value(false),
+                "Compute the VVC gradient of each phase on its own thread" )
+                ( "vvc-offload",
+                po::value<bool> ( &vvcOffload )->default_value(false),
+                "Run VVC solves on a background thread outside the VVC phase" )
+                ( "vvc-segment-bus",
+                po::value<int> ( &vvcSegmentBus )->default_value(-1),
+                "Feeder bus the VVC segment of this DGI hangs from, -1 to solve the whole feeder" )
+                ( "vvc-half-gradients",
+                po::value<bool> ( &vvcHalfGradients )->default_value(false),
+                "Send VVC gradients as packed half precision floats" )
+                ( "vvc-optimizer",
+                po::value<std::string> ( &vvcOptimizer )->default_value("step"),
+                "Search for the VVC step size: step (growing steps) or newton (parabolic line search)" )
+                ( "vvc-precision",
+                po::value<std::string> ( &vvcPrecision )->default_value("double"),
+                "Precision of the VVC sensitivity solve: double, single, or check (single, compared to double)" )
+                ( "vvc-batch-threads",
+                po::value<unsigned int> ( &vvcBatchThreads )->default_value(1),
+                "Threads the newton VVC search solves its candidate power flows on" )
+                ( "vvc-sweep-threads",
+                po::value<unsigned int> ( &vvcSweepThreads )->default_value(1),
+                "Threads one VVC power flow sweeps the laterals of the feeder on" )
+                ( "vvc-sensitivity-tolerance",
+                po::value<float> ( &vvcSensitivityTolerance )->default_value(0),
+                "Voltage change in p.u. (angle in rad) before VVC forms the sensitivities of a node again" )
+                ( "vvc-skip-deadband",
+                po::value<float> ( &vvcSkipDeadband )->default_value(0),
+                "Load change in kW or kVar before VVC solves a feeder within its bounds again" )
+                ( "blas-threads",
+                po::value<unsigned int> ( &blasThreads )->default_value(1),
+                "Threads an optimized BLAS/LAPACK backend uses for one operation" )
+                ( "datagram-mtu",
+                po::value<unsigned int> ( &datagramMtu )->default_value(1472),
+                "Largest datagram in bytes a peer connection packs messages into" )
+                ( "csrc-flush-delay",
+                po::value<unsigned int> ( &flushDelay )->default_value(0),
+                "Milliseconds a peer connection waits to coalesce new messages" )
+                ( "csrc-ack-delay",
+                po::value<unsigned int> ( &ackDelay )->default_value(0),
+                "Microseconds a peer connection may hold back its acks, 0 to ack at once" )
+                ( "csrc-ack-count",
+                po::value<unsigned int> ( &ackCount )->default_value(8),
+                "Received messages whose acks are written at once despite the ack delay" )
+                ( "datagram-batch",
+                po::value<unsigned int> ( &datagramBatch )->default_value(1),
+                "Datagrams received or sent per system call, 1 to disable batching" )
+                ( "socket-receive-buffer",
+                po::value<unsigned int> ( &socketReceiveBuffer )->default_value(0),
+                "Bytes of the receive buffer of the listener sockets, 0 for the kernel default" )
+                ( "socket-send-buffer",
+                po::value<unsigned int> ( &socketSendBuffer )->default_value(0),
+                "Bytes of the send buffer of the listener sockets, 0 for the kernel default" )
+                ( "socket-buffer-limit",
+                po::value<unsigned int> ( &socketBufferLimit )->default_value(0),
+                "Bytes the receive buffers may grow to on drops and bursts, 0 to disable" )
+                ( "socket-drops",
+                po::value<bool> ( &socketDrops )->default_value(false),
+                "Count the datagrams the kernel dropped from the listener sockets" )
+                ( "listener-threads",
+                po::value<unsigned int> ( &listenerThreads )->default_value(0),
+                "Extra SO_REUSEPORT sockets that receive and parse on their own threads" )
+                ( "broker-threads",
+                po::value<unsigned int> ( &brokerThreads )->default_value(1),
+                "Threads that run the broker io_service, at least 1" )
+                ( "send-window",
+                po::value<unsigned int> ( &sendWindow )->default_value(64),
+                "Unacknowledged messages a peer connection keeps in flight" )
+                ( "send-queue",
+                po::value<unsigned int> ( &sendQueue )->default_value(1024),
+                "Messages a peer connection queues behind a full send window" )
+                ( "connection-idle-rounds",
+                po::value<unsigned int> ( &idleRounds )->default_value(0),
+                "Rounds without traffic before a peer connection is reaped, 0 to keep every connection" )
+                ( "multicast-address",
+                po::value<std::string> ( &multicastAddress )->default_value(""),
+                "Multicast group for messages sent to a whole group, empty to disable" )
+                ( "multicast-port",
+                po::value<unsigned short> ( &multicastPort )->default_value(51870),
+                "Port of the multicast group" )
+                ( "relay-fanout",
+                po::value<unsigned int> ( &relayFanout )->default_value(0),
+                "Peers each node forwards a group broadcast to over a spanning tree, 0 to send to every peer" )
+                ( "shared-memory",
+                po::value<bool> ( &sharedMemory )->default_value(false),
+                "Exchange datagrams with DGI on the same host in shared memory" )
+                ( "adaptive-phases",
+                po::value<bool> ( &adaptivePhases )->default_value(false),
+                "Let the group leader resize the phases from the measured module workload" )
+                ( "precise-phases",
+                po::value<bool> ( &precisePhases )->default_value(false),
+                "Time the phase boundaries with a monotonic timerfd at absolute deadlines" )
+                ( "phase-spin",
+                po::value<unsigned int> ( &phaseSpin )->default_value(0),
+                "Microseconds before a precise phase boundary that are waited out on the CPU" )
+                ( "async-logging",
+                po::value<bool> ( &asyncLogging )->default_value(false),
+                "Format and write the logs on a background thread" )
+                ( "kernel-timestamps",
+                po::value<bool> ( &kernelTimestamps )->default_value(false),
+                "Stamp received datagrams in the kernel for clock synchronization" )
+                ( "clock-passive",
+                po::value<bool> ( &passiveClock )->default_value(false),
+                "Take clock synchronization samples from the regular traffic and query only the quiet peers" )
+                ( "swim-membership",
+                po::value<bool> ( &swimMembership )->default_value(false),
+                "Detect failed group members with SWIM probes instead of polling every node" )
+                ( "hierarchical-groups",
+                po::value<bool> ( &hierarchicalGroups )->default_value(false),
+                "Form a group per feeder segment and federate the segment coordinators" )
+                ( "gm-standby",
+                po::value<bool> ( &groupStandby )->default_value(false),
+                "Name a group member that takes over at once when the coordinator fails" )
+                ( "sc-delta",
+                po::value<bool> ( &scDelta )->default_value(false),
+                "Report only the signals that changed since the last collected state" )
+                ( "sc-deadband",
+                po::value<float> ( &scDeadband )->default_value(0),
+                "Change a signal needs before a delta state collection reports it" )
+                ( "sc-packed",
+                po::value<bool> ( &scPacked )->default_value(false),
+                "Have the peers report each collected signal by its index in the marker" )
+                ( "sc-aggregate",
+                po::value<bool> ( &scAggregate )->default_value(false),
+                "Sum the collected states up a tree of group members instead of at the leader" )
+                ( "sc-snapshots",
+                po::value<unsigned int> ( &scSnapshots )->default_value(1),
+                "State collection snapshots that can be in flight at once" )
+                ( "sc-record-limit",
+                po::value<unsigned int> ( &scRecordLimit )->default_value(0),
+                "Kilobytes the states recorded for the snapshots in flight may hold, 0 for no limit" )
+                ( "trace-file",
+                po::value<std::string> ( &traceFile )->default_value(""),
+                "File the binary event trace is written to, empty to disable" )
+                ( "trace-records",
+                po::value<unsigned int> ( &traceRecords )->default_value(65536),
+                "Events kept in the binary trace before the oldest are overwritten" )
+                ( "telemetry-file",
+                po::value<std::string> ( &telemetryFile )->default_value(""),
+                "File the device tables are recorded to each adapter cycle, empty to disable" )
+                ( "telemetry-queue",
+                po::value<unsigned int> ( &telemetryQueue )->default_value(1024),
+                "Device table rows queued for the telemetry file before rows are dropped" )
+                ( "capture-file",
+                po::value<std::string> ( &captureFile )->default_value(""),
+                "File the received datagrams are recorded to, empty to disable" )
+                ( "replay-capture",
+                po::value<std::string> ( &replayCapture )->default_value(""),
+                "Capture file whose datagrams are replayed in place of the peers" )
+                ( "replay-speed",
+                po::value<double> ( &replaySpeed )->default_value(1.0),
+                "Speed of the replayed datagrams relative to the recording" )
+                ( "time-scale",
+                po::value<double> ( &timeScale )->default_value(1.0),
+                "How many times faster than real time the scheduler and simulated devices run" )
+                ( "inbound-queue",
+                po::value<unsigned int> ( &inboundQueue )->default_value(0),
+                "Messages queued for a module outside its phase, 0 for no limit" )
+                ( "compress-threshold",
+                po::value<unsigned int> ( &compressThreshold )->default_value(0),
+                "Bytes of window messages past which they are deflated for peers that ask, 0 to disable" )
+                ( "admission-backlog",
+                po::value<unsigned int> ( &admissionBacklog )->default_value(0),
+                "Tasks waiting for a module past which bulk datagrams are refused, 0 to admit all" )
+                ( "immediate-limit",
+                po::value<unsigned int> ( &immediateLimit )->default_value(1000),
+                "Microseconds a handler of an immediate message may run before its messages wait for the phase" )
+                ( "supersede-message",
+                po::value<std::vector<std::string> >( )->composing(),
+                "Message type, e.g. gm.PeerListMessage, whose queued copy from a peer is replaced by a newer one" )
+                ( "watchdog-threshold",
+                po::value<unsigned int> ( &watchdogThreshold )->default_value(0),
+                "Milliseconds a scheduler task may run before its stack is sampled, 0 to disable" )
+                ( "profile-rate",
+                po::value<unsigned int> ( &profileRate )->default_value(0),
+                "Samples per second of CPU taken by the built-in profiler, 0 to disable" )
+                ( "profile-file",
+                po::value<std::string> ( &profileFile )->default_value("dgi-profile.txt"),
+                "File the profile is written to on SIGUSR2" )
+                ( "thread-policy",
+                po::value<std::vector<std::string> >( )->composing(),
+                "Scheduling of a thread role as role:policy[:priority[:cpus]], e.g. broker:fifo:50:2" )
+                ( "lock-memory",
+                po::value<bool> ( &lockMemory )->default_value(false),
+                "Lock the memory of the process so that it is never paged out" )
+                ( "device-threads",
+                po::value<unsigned int> ( &deviceThreads )->default_value(1),
+                "Threads that run the device adapters, at least 1" )
+                ( "metrics-port",
+                po::value<unsigned short> ( &metricsPort )->default_value(0),
+                "TCP port that serves the runtime metrics in the Prometheus format, 0 to disable" )
+                ( "latency-trace",
+                po::value<bool> ( &latencyTrace )->default_value(false),
+                "Stamp outgoing messages to measure where their delivery time goes" )
+                ( "traffic-accounting",
+                po::value<bool> ( &trafficAccounting )->default_value(false),
+                "Count the bytes and messages of each module, message type and peer" )
+                ( "traffic-summary",
+                po::value<unsigned int> ( &trafficSummary )->default_value(60),
+                "Seconds between the logged traffic summaries, 0 to disable" )
+                ( "inline-self-delivery",
+                po::value<bool> ( &inlineSelfDelivery )->default_value(false),
+                "Handle a message a module sends to this DGI at once during its own phase" )
                 ( "verbose,v",
                 po::value<unsigned int>( &globalVerbosity )->
                 implicit_value(5)->default_value(5),
@@ -220,7 +557,7 @@ int main(int argc, char* argv[])
             if (!vm.count("help") && !vm.count("version") &&
                 !vm.count("uuid") && !vm.count("list-loggers"))
             {
-                Logger.Status << "Config file " << cfgFile
+                LOG_STATUS(Logger) << "Config file " << cfgFile
                             << " successfully loaded." << std::endl;
             }
         }
@@ -252,6 +589,40 @@ int main(int argc, char* argv[])
             return 0;
         }
 
+        // The instances fork before any singleton starts a thread or opens
+        // a socket, and each takes the ports and output files of its place.
+        if( instances == 0 )
+        {
+            throw EDgiConfigError("invalid instances: 0");
+        }
+        unsigned short baseport = 0;
+        unsigned int instance = 0;
+        if( instances > 1 && !vm.count("uuid") )
+        {
+            baseport = GetPortFromString(port);
+            if( baseport + instances - 1 > 65535 )
+            {
+                throw EDgiConfigError("too many instances for port " + port);
+            }
+            instance = ForkInstances(instances);
+            port = boost::lexical_cast<std::string>(baseport + instance);
+            if( metricsPort != 0 )
+            {
+                metricsPort += instance;
+            }
+            if( vm.count("factory-port") )
+            {
+                fport = boost::lexical_cast<std::string>(
+                    GetPortFromString(fport) + instance);
+            }
+            traceFile = InstancePath(traceFile, instance);
+            telemetryFile = InstancePath(telemetryFile, instance);
+            captureFile = InstancePath(captureFile, instance);
+            profileFile = InstancePath(profileFile, instance);
+            vvcDumpFile = InstancePath(vvcDumpFile, instance);
+            warmStateFile = InstancePath(warmStateFile, instance);
+        }
+
         hostname = boost::asio::ip::host_name();
         id = GenerateUuid(hostname, port);
         if (vm.count("uuid"))
@@ -261,7 +632,12 @@ int main(int argc, char* argv[])
         }
         else
         {
-            Logger.Info << "Generated UUID: " << id << std::endl;
+            LOG_INFO(Logger) << "Generated UUID: " << id << std::endl;
+        }
+        if( instances > 1 )
+        {
+            LOG_STATUS(Logger) << "Running instance " << instance << " of "
+                << instances << " on port " << port << std::endl;
         }
 
         // Load timings from files
@@ -280,6 +656,26 @@ int main(int argc, char* argv[])
         CGlobalConfiguration::Instance().SetClockSkew(
                 boost::posix_time::milliseconds(0));
         CGlobalConfiguration::Instance().SetMigrationStep(migrationStep);
+        if( lbAlgorithm != "draft" && lbAlgorithm != "gossip" )
+        {
+            throw EDgiConfigError("invalid lb algorithm: " + lbAlgorithm);
+        }
+        if( lbDeadband < 0 )
+        {
+            throw EDgiConfigError("invalid lb deadband: negative");
+        }
+        CGlobalConfiguration::Instance().SetLoadBalanceDeadband(lbDeadband);
+        if( lbForecast < 0 || lbForecast > 1 )
+        {
+            throw EDgiConfigError("invalid lb forecast: outside 0 to 1");
+        }
+        CGlobalConfiguration::Instance().SetLoadBalanceForecast(lbForecast);
+        if( draftPartners == 0 )
+        {
+            throw EDgiConfigError("invalid lb draft partners: 0");
+        }
+        CGlobalConfiguration::Instance().SetDraftPartners(draftPartners);
+        CGlobalConfiguration::Instance().SetLoadBalanceDigests(lbDigests);
         CGlobalConfiguration::Instance().SetMaliciousFlag(malicious);
         CGlobalConfiguration::Instance().SetMQTTId(mqttID);
         CGlobalConfiguration::Instance().SetMQTTAddress(mqttAddress);
@@ -289,7 +685,200 @@ int main(int argc, char* argv[])
             std::vector<std::string> subscriptions = vm["mqtt-subscribe"].as<std::vector<std::string> >();
             CGlobalConfiguration::Instance().SetMQTTSubscriptions(subscriptions);
         }
+        if( mqttWorkers == 0 )
+        {
+            throw EDgiConfigError("invalid mqtt workers: 0");
+        }
+        CGlobalConfiguration::Instance().SetMQTTWorkers(mqttWorkers);
         CGlobalConfiguration::Instance().SetInvariantCheck(invariant);
+        CGlobalConfiguration::Instance().SetVVCWarmStart(vvcWarmStart);
+        CGlobalConfiguration::Instance().SetVVCParallelPhases(vvcParallelPhases);
+        CGlobalConfiguration::Instance().SetVVCOffload(vvcOffload);
+        if( vvcSegmentBus < -1 )
+        {
+            throw EDgiConfigError("invalid vvc segment bus: "
+                    + boost::lexical_cast<std::string>(vvcSegmentBus));
+        }
+        CGlobalConfiguration::Instance().SetVVCSegmentBus(vvcSegmentBus);
+        CGlobalConfiguration::Instance().SetVVCHalfGradients(vvcHalfGradients);
+        if( vvcOptimizer != "step" && vvcOptimizer != "newton" )
+        {
+            throw EDgiConfigError("invalid vvc optimizer: " + vvcOptimizer);
+        }
+        CGlobalConfiguration::Instance().SetVVCOptimizer(vvcOptimizer);
+        if( vvcPrecision != "double" && vvcPrecision != "single" && vvcPrecision != "check" )
+        {
+            throw EDgiConfigError("invalid vvc precision: " + vvcPrecision);
+        }
+        CGlobalConfiguration::Instance().SetVVCPrecision(vvcPrecision);
+        if( vvcBatchThreads == 0 )
+        {
+            throw EDgiConfigError("invalid vvc batch threads: 0");
+        }
+        CGlobalConfiguration::Instance().SetVVCBatchThreads(vvcBatchThreads);
+        if( vvcSweepThreads == 0 )
+        {
+            throw EDgiConfigError("invalid vvc sweep threads: 0");
+        }
+        CGlobalConfiguration::Instance().SetVVCSweepThreads(vvcSweepThreads);
+        if( vvcSensitivityTolerance < 0 )
+        {
+            throw EDgiConfigError("invalid vvc sensitivity tolerance: negative");
+        }
+        CGlobalConfiguration::Instance().SetVVCSensitivityTolerance(vvcSensitivityTolerance);
+        if( vvcSkipDeadband < 0 )
+        {
+            throw EDgiConfigError("invalid vvc skip deadband: negative");
+        }
+        CGlobalConfiguration::Instance().SetVVCSkipDeadband(vvcSkipDeadband);
+        if( blasThreads == 0 )
+        {
+            throw EDgiConfigError("invalid blas threads: 0");
+        }
+        CGlobalConfiguration::Instance().SetBlasThreads(blasThreads);
+        SetLinearAlgebraThreads(blasThreads);
+        LOG_STATUS(Logger) << "Linear algebra backend: " << LinearAlgebraBackend()
+                           << " with " << blasThreads << " threads" << std::endl;
+
+        if( datagramMtu == 0 || datagramMtu > static_cast<unsigned int>(
+                CGlobalConfiguration::MAX_PACKET_SIZE) )
+        {
+            throw EDgiConfigError("invalid datagram mtu: "
+                    + boost::lexical_cast<std::string>(datagramMtu));
+        }
+        CGlobalConfiguration::Instance().SetDatagramMTU(datagramMtu);
+        CGlobalConfiguration::Instance().SetFlushDelay(flushDelay);
+        if( ackCount == 0 )
+        {
+            throw EDgiConfigError("invalid csrc ack count: 0");
+        }
+        CGlobalConfiguration::Instance().SetAckDelay(ackDelay);
+        CGlobalConfiguration::Instance().SetAckCount(ackCount);
+        CGlobalConfiguration::Instance().SetDatagramBatch(datagramBatch);
+        CGlobalConfiguration::Instance().SetSocketReceiveBuffer(socketReceiveBuffer);
+        CGlobalConfiguration::Instance().SetSocketSendBuffer(socketSendBuffer);
+        CGlobalConfiguration::Instance().SetSocketBufferLimit(socketBufferLimit);
+        CGlobalConfiguration::Instance().SetSocketDrops(socketDrops);
+        CGlobalConfiguration::Instance().SetListenerThreads(listenerThreads);
+        if( brokerThreads == 0 )
+        {
+            throw EDgiConfigError("invalid broker threads: 0");
+        }
+        CGlobalConfiguration::Instance().SetBrokerThreads(brokerThreads);
+        if( sendWindow == 0 )
+        {
+            throw EDgiConfigError("invalid send window: 0");
+        }
+        CGlobalConfiguration::Instance().SetSendWindow(sendWindow);
+        CGlobalConfiguration::Instance().SetSendQueue(sendQueue);
+        CGlobalConfiguration::Instance().SetConnectionIdleRounds(idleRounds);
+        CGlobalConfiguration::Instance().SetMulticastAddress(multicastAddress);
+        CGlobalConfiguration::Instance().SetMulticastPort(multicastPort);
+        CGlobalConfiguration::Instance().SetRelayFanout(relayFanout);
+        CGlobalConfiguration::Instance().SetSharedMemory(sharedMemory);
+        CGlobalConfiguration::Instance().SetAdaptivePhases(adaptivePhases);
+        if( phaseSpin >= 1000 )
+        {
+            throw EDgiConfigError("invalid phase spin: "
+                + boost::lexical_cast<std::string>(phaseSpin));
+        }
+        CGlobalConfiguration::Instance().SetPrecisePhases(precisePhases);
+        CGlobalConfiguration::Instance().SetPhaseSpin(phaseSpin);
+        CGlobalConfiguration::Instance().SetKernelTimestamps(kernelTimestamps);
+        CGlobalConfiguration::Instance().SetPassiveClock(passiveClock);
+        CGlobalConfiguration::Instance().SetSwimMembership(swimMembership);
+        CGlobalConfiguration::Instance().SetHierarchicalGroups(hierarchicalGroups);
+        CGlobalConfiguration::Instance().SetGroupStandby(groupStandby);
+        if( scDeadband < 0 )
+        {
+            throw EDgiConfigError("invalid sc deadband: negative");
+        }
+        CGlobalConfiguration::Instance().SetStateDelta(scDelta);
+        CGlobalConfiguration::Instance().SetStateDeadband(scDeadband);
+        CGlobalConfiguration::Instance().SetStatePacked(scPacked);
+        CGlobalConfiguration::Instance().SetStateAggregate(scAggregate);
+        if( scSnapshots == 0 )
+        {
+            throw EDgiConfigError("invalid sc snapshots: 0");
+        }
+        CGlobalConfiguration::Instance().SetStateSnapshots(scSnapshots);
+        CGlobalConfiguration::Instance().SetStateRecordLimit(scRecordLimit);
+        CGlobalConfiguration::Instance().SetInboundQueue(inboundQueue);
+        CGlobalConfiguration::Instance().SetAdmissionBacklog(admissionBacklog);
+        CGlobalConfiguration::Instance().SetCompressThreshold(compressThreshold);
+        if( immediateLimit == 0 )
+        {
+            throw EDgiConfigError("invalid immediate limit: 0");
+        }
+        CGlobalConfiguration::Instance().SetImmediateLimit(immediateLimit);
+        CGlobalConfiguration::Instance().SetWatchdogThreshold(watchdogThreshold);
+        if( profileRate > 1000 )
+        {
+            throw EDgiConfigError("invalid profile rate: "
+                + boost::lexical_cast<std::string>(profileRate));
+        }
+        CGlobalConfiguration::Instance().SetProfileRate(profileRate);
+        CGlobalConfiguration::Instance().SetProfileFile(profileFile);
+        if( traceRecords == 0 )
+        {
+            throw EDgiConfigError("invalid trace records: 0");
+        }
+        CGlobalConfiguration::Instance().SetTraceFile(traceFile);
+        CGlobalConfiguration::Instance().SetTraceRecords(traceRecords);
+        if( telemetryQueue == 0 )
+        {
+            throw EDgiConfigError("invalid telemetry queue: 0");
+        }
+        CGlobalConfiguration::Instance().SetTelemetryFile(telemetryFile);
+        CGlobalConfiguration::Instance().SetTelemetryQueue(telemetryQueue);
+
+        if( replaySpeed <= 0 )
+        {
+            throw EDgiConfigError("invalid replay speed: "
+                + boost::lexical_cast<std::string>(replaySpeed));
+        }
+        if( !captureFile.empty() && captureFile == replayCapture )
+        {
+            throw EDgiConfigError("the capture file cannot be replayed: "
+                + captureFile);
+        }
+        CGlobalConfiguration::Instance().SetCaptureFile(captureFile);
+        CGlobalConfiguration::Instance().SetReplayCapture(replayCapture);
+        CGlobalConfiguration::Instance().SetReplaySpeed(replaySpeed);
+
+        if( timeScale <= 0 )
+        {
+            throw EDgiConfigError("invalid time scale: "
+                + boost::lexical_cast<std::string>(timeScale));
+        }
+        // the clock starts before the first timer is set on it
+        CVirtualClock::Start(timeScale);
+        if( deviceThreads == 0 )
+        {
+            throw EDgiConfigError("invalid device threads: 0");
+        }
+        CGlobalConfiguration::Instance().SetDeviceThreads(deviceThreads);
+        CGlobalConfiguration::Instance().SetMetricsPort(metricsPort);
+        CGlobalConfiguration::Instance().SetLatencyTrace(latencyTrace);
+        CGlobalConfiguration::Instance().SetTrafficAccounting(trafficAccounting);
+        CGlobalConfiguration::Instance().SetTrafficSummary(trafficSummary);
+        CGlobalConfiguration::Instance().SetInlineSelfDelivery(inlineSelfDelivery);
+
+        if (vm.count("thread-policy"))
+        {
+            CThreadPolicy::Instance().Configure(
+                vm["thread-policy"].as<std::vector<std::string> >());
+        }
+        if (lockMemory)
+        {
+            CThreadPolicy::LockMemory();
+        }
+
+        if (vm.count("supersede-message"))
+        {
+            CGlobalConfiguration::Instance().SetSupersededMessages(
+                vm["supersede-message"].as<std::vector<std::string> >());
+        }
 
         // Specify socket endpoint address, if provided
         if( vm.count("devices-endpoint") )
@@ -310,17 +899,33 @@ int main(int argc, char* argv[])
         {
             CGlobalConfiguration::Instance().SetFactoryPort(0);
         }
+        if( factoryAcceptors == 0 )
+        {
+            throw EDgiConfigError("invalid factory acceptors: 0");
+        }
+        CGlobalConfiguration::Instance().SetFactoryBacklog(factoryBacklog);
+        CGlobalConfiguration::Instance().SetFactoryAcceptors(factoryAcceptors);
+        if( pnpDeltaDeadband < 0 )
+        {
+            throw EDgiConfigError("invalid pnp delta deadband: negative");
+        }
+        if( pnpDeltaRefresh == 0 )
+        {
+            throw EDgiConfigError("invalid pnp delta refresh: 0");
+        }
+        CGlobalConfiguration::Instance().SetPnpDeltaDeadband(pnpDeltaDeadband);
+        CGlobalConfiguration::Instance().SetPnpDeltaRefresh(pnpDeltaRefresh);
 
         if (vm.count("adapter-config"))
         {
             CGlobalConfiguration::Instance().SetAdapterConfigPath(
                 adapterCfgFile);
-            Logger.Status << "set adapter config" << std::endl;
+            LOG_STATUS(Logger) << "set adapter config" << std::endl;
         }
         else
         {
             CGlobalConfiguration::Instance().SetAdapterConfigPath("");
-            Logger.Status << "adatper config not set" << std::endl;
+            LOG_STATUS(Logger) << "adatper config not set" << std::endl;
         }
 
 
@@ -334,39 +939,77 @@ int main(int argc, char* argv[])
             CGlobalConfiguration::Instance().SetTopologyConfigPath("");
         }
 
+        if (vm.count("compile-topology"))
+        {
+            CPhysicalTopology::Instance().SaveTopology(compileTopologyFile);
+            return 0;
+        }
+
+        CGlobalConfiguration::Instance().SetNetworkEmulationPath(networkEmulationFile);
         CGlobalConfiguration::Instance().SetDeviceConfigPath(deviceCfgFile);
+        CGlobalConfiguration::Instance().SetFeederModelPath(feederModelFile);
+        CGlobalConfiguration::Instance().SetFeederImpedancePath(feederImpedanceFile);
+        CGlobalConfiguration::Instance().SetVVCDumpPath(vvcDumpFile);
+        if( warmStateInterval == 0 )
+        {
+            throw EDgiConfigError("invalid warm state interval: 0");
+        }
+        CGlobalConfiguration::Instance().SetWarmStatePath(warmStateFile);
+        CGlobalConfiguration::Instance().SetWarmStateInterval(warmStateInterval);
+        CGlobalConfiguration::Instance().SetWarmStateMaxAge(warmStateMaxAge);
+
+        if (asyncLogging)
+        {
+            CGlobalLogger::instance().StartAsync();
+        }
     }
     catch (std::exception & e)
     {
-        Logger.Status << "Exception caught in main during start up: " << e.what() << std::endl;
+        LOG_STATUS(Logger) << "Exception caught in main during start up: " << e.what() << std::endl;
         return 1;
     }
 
     // Initialize modules
     boost::shared_ptr<IDGIModule> GM = boost::make_shared<gm::GMAgent>();
     boost::shared_ptr<IDGIModule> SC = boost::make_shared<sc::SCAgent>();
-    boost::shared_ptr<IDGIModule> LB = boost::make_shared<lb::LBAgent>();
-    boost::shared_ptr<IDGIModule> VVC = boost::make_shared<vvc::VVCAgent>();
+    boost::shared_ptr<IDGIModule> LB;
+    boost::shared_ptr<IDGIModule> VVC;
+
+    if (lbAlgorithm == "gossip")
+    {
+        LB = boost::make_shared<lb::GossipAgent>();
+    }
+    else
+    {
+        LB = boost::make_shared<lb::LBAgent>();
+    }
 
     try
     {
+        // The VVC agent loads its feeder model here and may reject it
+        VVC = boost::make_shared<vvc::VVCAgent>();
+
         // Instantiate and register the group management module
-        CBroker::Instance().RegisterModule("gm",boost::posix_time::milliseconds(CTimings::Get("GM_PHASE_TIME")));
+        CBroker::Instance().RegisterModule("gm",CTimings::GM_PHASE_TIME);
         CDispatcher::Instance().RegisterReadHandler(GM, "gm");
         // Instantiate and register the state collection module
-        CBroker::Instance().RegisterModule("sc",boost::posix_time::milliseconds(CTimings::Get("SC_PHASE_TIME")));
+        CBroker::Instance().RegisterModule("sc",CTimings::SC_PHASE_TIME);
         CDispatcher::Instance().RegisterReadHandler(SC, "sc");
 
         // StateCollection wants to receive Accept messages addressed to lb.
         CDispatcher::Instance().RegisterReadHandler(SC, "lb");
         // Instantiate and register the power management module
-        CBroker::Instance().RegisterModule("lb",boost::posix_time::milliseconds(CTimings::Get("LB_PHASE_TIME")));
+        CBroker::Instance().RegisterModule("lb",CTimings::LB_PHASE_TIME);
         CDispatcher::Instance().RegisterReadHandler(LB, "lb");
+        if(lbDigests)
+        {
+            CDispatcher::Instance().RegisterDigestHandler(LB, "lb");
+        }
 
         // StateCollection wants to receive Accept messages addressed to vvc.
         CDispatcher::Instance().RegisterReadHandler(SC, "vvc");
         // Instantiate and register the power management module
-        CBroker::Instance().RegisterModule("vvc",boost::posix_time::milliseconds(CTimings::Get("VVC_PHASE_TIME")));
+        CBroker::Instance().RegisterModule("vvc",CTimings::VVC_PHASE_TIME);
         CDispatcher::Instance().RegisterReadHandler(VVC, "vvc");
 
         // The peerlist should be passed into constructors as references or
@@ -397,21 +1040,42 @@ int main(int argc, char* argv[])
         }
         else
         {
-            Logger.Info << "Not adding any hosts on startup." << std::endl;
+            LOG_INFO(Logger) << "Not adding any hosts on startup." << std::endl;
+        }
+
+        // The other instances of this process are peers as well
+        for(unsigned int i = 0; instances > 1 && i < instances; i++)
+        {
+            std::string peerport = boost::lexical_cast<std::string>(baseport + i);
+            if(peerport != port)
+            {
+                CConnectionManager::Instance().PutHost(
+                    GenerateUuid(hostname, peerport), "localhost", peerport);
+            }
         }
 
         // Add the local connection to the hostname list
         CConnectionManager::Instance().PutHost(id, "localhost", port);
 
-        Logger.Debug << "Starting thread of Modules" << std::endl;
+        LOG_DEBUG(Logger) << "Starting thread of Modules" << std::endl;
         CBroker::Instance().Schedule(
             "gm",
             boost::bind(&gm::GMAgent::Run, boost::dynamic_pointer_cast<gm::GMAgent>(GM)),
             false);
-        CBroker::Instance().Schedule(
-            "lb",
-            boost::bind(&lb::LBAgent::Run, boost::dynamic_pointer_cast<lb::LBAgent>(LB)),
-            false);
+        if (lbAlgorithm == "gossip")
+        {
+            CBroker::Instance().Schedule(
+                "lb",
+                boost::bind(&lb::GossipAgent::Run, boost::dynamic_pointer_cast<lb::GossipAgent>(LB)),
+                false);
+        }
+        else
+        {
+            CBroker::Instance().Schedule(
+                "lb",
+                boost::bind(&lb::LBAgent::Run, boost::dynamic_pointer_cast<lb::LBAgent>(LB)),
+                false);
+        }
          CBroker::Instance().Schedule(
             "vvc",
             boost::bind(&vvc::VVCAgent::Run, boost::dynamic_pointer_cast<vvc::VVCAgent>(VVC)),
@@ -419,7 +1083,8 @@ int main(int argc, char* argv[])
     }
     catch (std::exception & e)
     {
-        Logger.Fatal << "Exception caught in module initialization: " << e.what() << std::endl;
+        LOG_FATAL(Logger) << "Exception caught in module initialization: " << e.what() << std::endl;
+        CGlobalLogger::instance().StopAsync();
         return 1;
     }
 
@@ -429,8 +1094,9 @@ int main(int argc, char* argv[])
     }
     catch (std::exception & e)
     {
-        Logger.Fatal << "Exception caught in Broker: " << e.what() << std::endl;
+        LOG_FATAL(Logger) << "Exception caught in Broker: " << e.what() << std::endl;
         CBroker::Instance().Stop();
+        CGlobalLogger::instance().StopAsync();
         return 1;
     }
 
@@ -0,0 +1,692 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         SRBenchmark.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Measures the throughput and latency of the SR protocol
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.hpp"
+
+#include "CBroker.hpp"
+#include "CConnection.hpp"
+#include "CConnectionManager.hpp"
+#include "CDispatcher.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CTimings.hpp"
+#include "IDGIModule.hpp"
+#include "messages/ModuleMessage.pb.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace freedm::broker;
+namespace po = boost::program_options;
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Settings shared by every endpoint of a run.
+struct SOptions
+{
+    unsigned int nodes;
+    unsigned short port;
+    unsigned int size;
+    unsigned int rate;
+    unsigned int duration;
+    unsigned int drain;
+    unsigned int loss;
+    unsigned int window;
+    unsigned int queue;
+};
+
+/// Counters one endpoint reports back to the harness.
+struct SSummary
+{
+    boost::uint64_t sent;
+    boost::uint64_t refused;
+    boost::uint64_t received;
+    boost::uint64_t writes;
+    boost::uint64_t retransmits;
+    boost::uint64_t samples;
+};
+
+/// Microseconds since the epoch.
+boost::uint64_t Now()
+{
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (boost::posix_time::microsec_clock::universal_time() - epoch)
+        .total_microseconds();
+}
+
+/// UUID of the endpoint at a port, as PosixMain generates it.
+std::string EndpointUuid(unsigned short port)
+{
+    return "localhost:" + boost::lexical_cast<std::string>(port);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @class CBenchmarkEndpoint
+/// @description Sends benchmark messages to every other endpoint at a fixed
+///     rate and records the one way latency of the ones it receives. The
+///     endpoints run on the same host, so their clocks agree.
+///////////////////////////////////////////////////////////////////////////////
+class CBenchmarkEndpoint
+    : public IDGIModule
+{
+public:
+    /// Prepares an endpoint that writes its results to a pipe.
+    CBenchmarkEndpoint(const SOptions & options, int output);
+
+    /// Schedules the first round of messages.
+    void Start();
+
+    /// Records the latency of a benchmark message.
+    void HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg,
+        CPeerNode peer);
+
+private:
+    /// Sends one message to each peer and schedules the next round.
+    void Send(const boost::system::error_code & error);
+
+    /// Writes the results and stops the broker.
+    void Finish(const boost::system::error_code & error);
+
+    /// The settings of the run.
+    SOptions m_options;
+
+    /// The pipe the results are written to.
+    int m_output;
+
+    /// The UUIDs of the other endpoints.
+    std::vector<std::string> m_peers;
+
+    /// Timer for the rounds of messages and the end of the run.
+    boost::asio::deadline_timer m_timer;
+
+    /// When the next round of messages is due.
+    boost::posix_time::ptime m_next;
+
+    /// When the endpoint stops sending.
+    boost::posix_time::ptime m_stop;
+
+    /// The payload of every message.
+    std::string m_payload;
+
+    /// Sequence number of the next message.
+    boost::uint32_t m_sequence;
+
+    /// The counters reported to the harness.
+    SSummary m_summary;
+
+    /// One way latencies in microseconds.
+    std::vector<boost::uint32_t> m_latency;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// CBenchmarkEndpoint::CBenchmarkEndpoint
+/// @description Stores the settings and the UUIDs of the other endpoints.
+/// @pre The global configuration holds the UUID of this endpoint.
+/// @post The endpoint is ready to start.
+/// @param options the settings of the run.
+/// @param output the pipe the results are written to.
+///////////////////////////////////////////////////////////////////////////////
+CBenchmarkEndpoint::CBenchmarkEndpoint(const SOptions & options, int output)
+    : m_options(options)
+    , m_output(output)
+    , m_timer(CBroker::Instance().GetIOService())
+    , m_payload(options.size, 'x')
+    , m_sequence(0)
+    , m_summary(SSummary())
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for(unsigned int i = 0; i < options.nodes; i++)
+    {
+        std::string uuid = EndpointUuid(options.port + i);
+        if(uuid != GetUUID())
+        {
+            m_peers.push_back(uuid);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CBenchmarkEndpoint::Start
+/// @description Gives the other endpoints a second to bind their sockets,
+///     then starts sending.
+/// @pre The broker is about to run.
+/// @post The first round is scheduled.
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmarkEndpoint::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_next = boost::posix_time::microsec_clock::universal_time()
+        + boost::posix_time::seconds(1);
+    m_stop = m_next + boost::posix_time::seconds(m_options.duration);
+    m_timer.expires_at(m_next);
+    m_timer.async_wait(CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CBenchmarkEndpoint::Send, this, _1)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CBenchmarkEndpoint::Send
+/// @description Sends one message to each peer. The rounds are scheduled on
+///     absolute times, so a slow round does not lower the rate.
+/// @pre None
+/// @post The next round or the end of the run is scheduled.
+/// @param error set if the timer was cancelled.
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmarkEndpoint::Send(const boost::system::error_code & error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(error)
+    {
+        return;
+    }
+
+    BOOST_FOREACH(const std::string & uuid, m_peers)
+    {
+        ModuleMessage mm;
+        BenchmarkMessage * bm = mm.mutable_benchmark_message();
+        bm->set_send_time(Now());
+        bm->set_sequence(m_sequence++);
+        bm->set_payload(m_payload);
+        mm.set_recipient_module("bench");
+
+        if(CPeerNode(uuid).Send(mm))
+        {
+            m_summary.sent++;
+        }
+        else
+        {
+            m_summary.refused++;
+        }
+    }
+
+    m_next += boost::posix_time::microseconds(1000000 / m_options.rate);
+    if(m_next < m_stop)
+    {
+        m_timer.expires_at(m_next);
+        m_timer.async_wait(CBroker::Instance().GetStrand().wrap(
+            boost::bind(&CBenchmarkEndpoint::Send, this, _1)));
+    }
+    else
+    {
+        // leave time for the resends of the last messages
+        m_timer.expires_at(m_stop + boost::posix_time::seconds(m_options.drain));
+        m_timer.async_wait(CBroker::Instance().GetStrand().wrap(
+            boost::bind(&CBenchmarkEndpoint::Finish, this, _1)));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CBenchmarkEndpoint::HandleIncomingMessage
+/// @description Records the one way latency of a benchmark message.
+/// @pre None
+/// @post The latency of the message is stored.
+/// @param msg the received message.
+/// @param peer the endpoint that sent the message.
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmarkEndpoint::HandleIncomingMessage(
+    boost::shared_ptr<const ModuleMessage> msg, CPeerNode /*peer*/)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!msg->has_benchmark_message())
+    {
+        return;
+    }
+
+    boost::uint64_t now = Now();
+    boost::uint64_t sent = msg->benchmark_message().send_time();
+    boost::uint64_t latency = now > sent ? now - sent : 0;
+    m_latency.push_back(static_cast<boost::uint32_t>(
+        std::min<boost::uint64_t>(latency, UINT_MAX)));
+    m_summary.received++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CBenchmarkEndpoint::Finish
+/// @description Collects the statistics of the connections, writes the
+///     counters and latencies to the pipe and stops the broker.
+/// @pre Sending has ended.
+/// @post The broker is stopping.
+/// @param error set if the timer was cancelled.
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmarkEndpoint::Finish(const boost::system::error_code & error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(error)
+    {
+        return;
+    }
+
+    BOOST_FOREACH(const std::string & uuid, m_peers)
+    {
+        ConnectionPtr c = CConnectionManager::Instance().GetConnectionByUUID(uuid);
+        if(c)
+        {
+            SProtocolStatistics stats = c->GetStatistics(LANE_CONTROL);
+            m_summary.writes += stats.writes;
+            m_summary.retransmits += stats.retransmits;
+        }
+    }
+    m_summary.samples = m_latency.size();
+
+    std::string bytes((const char *)&m_summary, sizeof(m_summary));
+    if(!m_latency.empty())
+    {
+        bytes.append((const char *)&m_latency[0],
+            m_latency.size() * sizeof(boost::uint32_t));
+    }
+    for(std::size_t done = 0; done < bytes.size(); )
+    {
+        ssize_t n = write(m_output, bytes.data() + done, bytes.size() - done);
+        if(n <= 0 && errno != EINTR)
+        {
+            break;
+        }
+        done += (n > 0 ? n : 0);
+    }
+    close(m_output);
+
+    CBroker::Instance().Stop(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Configure
+/// @description Gives every setting of the global configuration the default
+///     PosixMain uses, for an endpoint that listens on a loopback port.
+/// @param options the settings of the run.
+/// @param port the port of the endpoint.
+///////////////////////////////////////////////////////////////////////////////
+void Configure(const SOptions & options, unsigned short port)
+{
+    CGlobalConfiguration & config = CGlobalConfiguration::Instance();
+    std::string text = boost::lexical_cast<std::string>(port);
+
+    config.SetHostname("localhost");
+    config.SetUUID(EndpointUuid(port));
+    config.SetListenPort(text);
+    config.SetListenAddress("127.0.0.1");
+    config.SetClockSkew(boost::posix_time::milliseconds(0));
+    config.SetMigrationStep(1);
+    config.SetLoadBalanceDeadband(0);
+    config.SetLoadBalanceForecast(0);
+    config.SetDraftPartners(1);
+    config.SetMaliciousFlag(false);
+    config.SetMQTTId("DGIClient");
+    config.SetMQTTAddress("tcp://localhost:1883");
+    config.SetMQTTWorkers(2);
+    config.SetInvariantCheck(false);
+    config.SetVVCWarmStart(false);
+    config.SetVVCParallelPhases(false);
+    config.SetVVCOffload(false);
+    config.SetVVCSegmentBus(-1);
+    config.SetVVCHalfGradients(false);
+    config.SetVVCOptimizer("step");
+    config.SetVVCPrecision("double");
+    config.SetVVCBatchThreads(1);
+    config.SetVVCSweepThreads(1);
+    config.SetVVCSensitivityTolerance(0);
+    config.SetVVCSkipDeadband(0);
+    config.SetBlasThreads(1);
+    config.SetDatagramMTU(1472);
+    config.SetFlushDelay(0);
+    config.SetAckDelay(0);
+    config.SetAckCount(8);
+    config.SetDatagramBatch(1);
+    config.SetSocketReceiveBuffer(0);
+    config.SetSocketSendBuffer(0);
+    config.SetSocketBufferLimit(0);
+    config.SetSocketDrops(false);
+    config.SetListenerThreads(0);
+    config.SetBrokerThreads(1);
+    config.SetSendWindow(options.window);
+    config.SetSendQueue(options.queue);
+    config.SetConnectionIdleRounds(0);
+    config.SetMulticastAddress("");
+    config.SetMulticastPort(51870);
+    config.SetRelayFanout(0);
+    config.SetSharedMemory(false);
+    config.SetAdaptivePhases(false);
+    config.SetLoadBalanceDigests(false);
+    config.SetKernelTimestamps(false);
+    config.SetPassiveClock(false);
+    config.SetSwimMembership(false);
+    config.SetHierarchicalGroups(false);
+    config.SetGroupStandby(false);
+    config.SetStateDelta(false);
+    config.SetStateDeadband(0);
+    config.SetStatePacked(false);
+    config.SetStateAggregate(false);
+    config.SetStateSnapshots(1);
+    config.SetStateRecordLimit(0);
+    config.SetInboundQueue(0);
+    config.SetCompressThreshold(0);
+    config.SetAdmissionBacklog(0);
+    config.SetTraceFile("");
+    config.SetTraceRecords(65536);
+    config.SetDeviceThreads(1);
+    config.SetMetricsPort(0);
+    config.SetLatencyTrace(false);
+    config.SetTrafficAccounting(false);
+    config.SetTrafficSummary(0);
+    config.SetInlineSelfDelivery(false);
+    config.SetDevicesEndpoint("");
+    config.SetFactoryPort(0);
+    config.SetFactoryBacklog(0);
+    config.SetFactoryAcceptors(1);
+    config.SetPnpDeltaDeadband(0);
+    config.SetPnpDeltaRefresh(10);
+    config.SetAdapterConfigPath("");
+    config.SetTopologyConfigPath("");
+    config.SetNetworkEmulationPath("");
+    config.SetDeviceConfigPath("");
+    config.SetFeederModelPath("");
+    config.SetFeederImpedancePath("");
+    config.SetVVCDumpPath("");
+    config.SetWarmStatePath("");
+    config.SetWarmStateInterval(5000);
+    config.SetWarmStateMaxAge(300);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// RunEndpoint
+/// @description Runs one endpoint in a child process until it has sent its
+///     messages and written its results.
+/// @param options the settings of the run.
+/// @param index the position of the endpoint, which sets its port.
+/// @param output the pipe the results are written to.
+/// @return The exit status of the child.
+///////////////////////////////////////////////////////////////////////////////
+int RunEndpoint(const SOptions & options, unsigned int index, int output)
+{
+    try
+    {
+        Configure(options, options.port + index);
+
+        for(unsigned int i = 0; i < options.nodes; i++)
+        {
+            unsigned short port = options.port + i;
+            CConnectionManager::Instance().PutHost(EndpointUuid(port),
+                "localhost", boost::lexical_cast<std::string>(port));
+        }
+
+        boost::shared_ptr<CBenchmarkEndpoint> endpoint =
+            boost::make_shared<CBenchmarkEndpoint>(options, output);
+        CDispatcher::Instance().RegisterReadHandler(endpoint, "bench");
+        endpoint->Start();
+
+        CBroker::Instance().Run();
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << "endpoint " << index << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ReadAll
+/// @description Reads a pipe until its writer closes it.
+/// @param input the pipe.
+/// @return Everything written to the pipe.
+///////////////////////////////////////////////////////////////////////////////
+std::string ReadAll(int input)
+{
+    std::string bytes;
+    char buffer[4096];
+    ssize_t n;
+    while((n = read(input, buffer, sizeof(buffer))) != 0)
+    {
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        bytes.append(buffer, n);
+    }
+    close(input);
+    return bytes;
+}
+
+/// Latency at a quantile of sorted samples, or 0 without samples.
+boost::uint32_t Quantile(const std::vector<boost::uint32_t> & sorted, double q)
+{
+    if(sorted.empty())
+    {
+        return 0;
+    }
+    std::size_t rank = static_cast<std::size_t>(q * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[])
+{
+    po::options_description opts("SR protocol benchmark options");
+    po::variables_map vm;
+    SOptions options;
+    std::string timingsFile;
+    unsigned int verbosity;
+
+    opts.add_options()
+        ( "help,h", "print usage help (this screen)" )
+        ( "nodes,n", po::value<unsigned int>(&options.nodes)->default_value(3),
+          "endpoints to run, at least 2" )
+        ( "port,p", po::value<unsigned short>(&options.port)->default_value(51900),
+          "loopback port of the first endpoint, the others follow it" )
+        ( "size,s", po::value<unsigned int>(&options.size)->default_value(64),
+          "payload bytes of each message" )
+        ( "rate,r", po::value<unsigned int>(&options.rate)->default_value(100),
+          "messages per second each endpoint sends to each other endpoint" )
+        ( "duration,d", po::value<unsigned int>(&options.duration)->default_value(5),
+          "seconds to send for" )
+        ( "drain", po::value<unsigned int>(&options.drain)->default_value(2),
+          "seconds to wait for resends after sending stops" )
+        ( "loss,l", po::value<unsigned int>(&options.loss)->default_value(0),
+          "percent of outgoing datagrams to drop, needs -DCUSTOMNETWORK and"
+          " writes network.xml in the working directory" )
+        ( "send-window", po::value<unsigned int>(&options.window)->default_value(64),
+          "unacknowledged messages a connection keeps in flight" )
+        ( "send-queue", po::value<unsigned int>(&options.queue)->default_value(1024),
+          "messages a connection queues behind a full send window" )
+        ( "timings-config",
+          po::value<std::string>(&timingsFile)->default_value("./config/timings.cfg"),
+          "name of the timings configuration file" )
+        ( "verbose,v", po::value<unsigned int>(&verbosity)->default_value(1),
+          "verbosity of the endpoint logs" );
+
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, opts), vm);
+        po::notify(vm);
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << e.what() << std::endl << opts << std::endl;
+        return 1;
+    }
+
+    if(vm.count("help"))
+    {
+        std::cout << opts << std::endl;
+        return 0;
+    }
+    if(options.nodes < 2 || options.rate < 1 || options.rate > 1000000 ||
+        options.loss > 100 || options.port + options.nodes > USHRT_MAX)
+    {
+        std::cerr << "need at least 2 nodes, a rate of 1 to 1000000, a loss of"
+            << " at most 100 and ports that fit after --port" << std::endl;
+        return 1;
+    }
+
+    CGlobalLogger::instance().SetGlobalLevel(verbosity);
+    try
+    {
+        CTimings::SetTimings(timingsFile);
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << "Unable to load timings: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if(options.loss > 0)
+    {
+#ifdef CUSTOMNETWORK
+        // the endpoints read the reliability of each connection from here
+        std::ofstream network("network.xml");
+        network << "<network>\n  <outgoing>\n";
+        for(unsigned int i = 0; i < options.nodes; i++)
+        {
+            network << "    <channel uuid=\"" << EndpointUuid(options.port + i)
+                << "\">\n      <reliability>" << (100 - options.loss)
+                << "</reliability>\n    </channel>\n";
+        }
+        network << "  </outgoing>\n</network>\n";
+        network.close();
+        if(!network)
+        {
+            std::cerr << "Unable to write network.xml" << std::endl;
+            return 1;
+        }
+#else
+        std::cerr << "--loss needs a broker built with -DCUSTOMNETWORK=ON" << std::endl;
+        return 1;
+#endif
+    }
+
+    std::vector<pid_t> children;
+    std::vector<int> inputs;
+    for(unsigned int i = 0; i < options.nodes; i++)
+    {
+        int fds[2];
+        if(pipe(fds) != 0)
+        {
+            std::perror("pipe");
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if(pid < 0)
+        {
+            std::perror("fork");
+            return 1;
+        }
+        if(pid == 0)
+        {
+            close(fds[0]);
+            for(std::size_t j = 0; j < inputs.size(); j++)
+            {
+                close(inputs[j]);
+            }
+            // skip the destructors of the singletons, which the broker
+            // does not expect to run
+            _exit(RunEndpoint(options, i, fds[1]));
+        }
+        close(fds[1]);
+        children.push_back(pid);
+        inputs.push_back(fds[0]);
+    }
+
+    SSummary total = SSummary();
+    std::vector<boost::uint32_t> latency;
+    int failed = 0;
+
+    for(unsigned int i = 0; i < options.nodes; i++)
+    {
+        std::string bytes = ReadAll(inputs[i]);
+        SSummary summary;
+        if(bytes.size() < sizeof(summary))
+        {
+            std::cerr << "endpoint " << i << " reported no results" << std::endl;
+            failed++;
+            continue;
+        }
+        std::copy(bytes.begin(), bytes.begin() + sizeof(summary), (char *)&summary);
+        std::size_t count = std::min<std::size_t>(summary.samples,
+            (bytes.size() - sizeof(summary)) / sizeof(boost::uint32_t));
+        const boost::uint32_t * samples =
+            (const boost::uint32_t *)(bytes.data() + sizeof(summary));
+        latency.insert(latency.end(), samples, samples + count);
+
+        total.sent += summary.sent;
+        total.refused += summary.refused;
+        total.received += summary.received;
+        total.writes += summary.writes;
+        total.retransmits += summary.retransmits;
+    }
+    for(std::size_t i = 0; i < children.size(); i++)
+    {
+        int status;
+        waitpid(children[i], &status, 0);
+    }
+
+    std::sort(latency.begin(), latency.end());
+
+    std::cout << "endpoints        " << options.nodes << std::endl
+        << "payload bytes    " << options.size << std::endl
+        << "offered rate     " << options.rate * (options.nodes - 1) * options.nodes
+        << " msg/s" << std::endl
+        << "loss             " << options.loss << "%" << std::endl
+        << "sent             " << total.sent << std::endl
+        << "refused          " << total.refused << std::endl
+        << "received         " << total.received << std::endl
+        << "throughput       " << std::fixed << std::setprecision(1)
+        << static_cast<double>(total.received) / options.duration << " msg/s" << std::endl
+        << "latency p50      " << Quantile(latency, 0.5) << " us" << std::endl
+        << "latency p99      " << Quantile(latency, 0.99) << " us" << std::endl
+        << "latency p999     " << Quantile(latency, 0.999) << " us" << std::endl
+        << "latency max      " << (latency.empty() ? 0 : latency.back()) << " us" << std::endl
+        << "writes           " << total.writes << std::endl
+        << "resends          " << total.retransmits << std::endl;
+
+    return failed > 0 ? 1 : 0;
+}
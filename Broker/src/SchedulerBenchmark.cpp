@@ -0,0 +1,661 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         SchedulerBenchmark.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Measures the task, timer and phase costs of the scheduler
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.hpp"
+
+#include "CBroker.hpp"
+#include "CConnectionManager.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CTimings.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+#include <unistd.h>
+
+using namespace freedm::broker;
+namespace po = boost::program_options;
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Most latency samples kept of each kind.
+const std::size_t MAX_SAMPLES = 1 << 20;
+
+/// Settings of a run.
+struct SOptions
+{
+    unsigned short port;
+    unsigned int modules;
+    unsigned int phase;
+    unsigned int depth;
+    unsigned int timers;
+    unsigned int rounds;
+    unsigned int warmup;
+    unsigned int duration;
+    unsigned int threads;
+    bool byname;
+};
+
+/// Microseconds since the epoch.
+boost::uint64_t Now()
+{
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (boost::posix_time::microsec_clock::universal_time() - epoch)
+        .total_microseconds();
+}
+
+/// Keeps a latency sample unless enough are kept already.
+void Sample(std::vector<boost::uint32_t> & samples, boost::uint64_t usec)
+{
+    if(samples.size() < MAX_SAMPLES)
+    {
+        samples.push_back(static_cast<boost::uint32_t>(
+            std::min<boost::uint64_t>(usec, UINT_MAX)));
+    }
+}
+
+/// Latency at a quantile of sorted samples, or 0 without samples.
+boost::uint32_t Quantile(const std::vector<boost::uint32_t> & sorted, double q)
+{
+    if(sorted.empty())
+    {
+        return 0;
+    }
+    std::size_t rank = static_cast<std::size_t>(q * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @class CSchedulerBenchmark
+/// @description Drives the scheduler with synthetic modules that do no work.
+///     Each module keeps a few tasks in its ready queue that schedule their
+///     own replacement, so its phase is spent entirely in the scheduler, and
+///     holds a next round timer that fires once per round to time the phase
+///     boundaries. Once the warmup ends, one task times the arming and the
+///     cancelling of a batch of wheel timers. Everything runs on the broker
+///     strand, so the counters need no lock.
+///////////////////////////////////////////////////////////////////////////////
+class CSchedulerBenchmark
+{
+public:
+    /// Registers the modules and allocates their timers.
+    CSchedulerBenchmark(const SOptions & options);
+
+    /// Queues the first tasks and sets the end of the warmup.
+    void Start();
+
+    /// Prints the results of the run.
+    void Report(std::ostream & out);
+
+private:
+    /// Records the latency of a task and schedules the next one.
+    void Task(unsigned int module, boost::uint64_t queued);
+
+    /// Queues a task of a module that records when it was queued.
+    void Queue(unsigned int module);
+
+    /// Records the time a module's phase started and waits for the next.
+    void PhaseStart(unsigned int module, const boost::system::error_code & error);
+
+    /// Times arming the wheel timers and arming them again, which cancels.
+    void TimeTimers();
+
+    /// Runs the task of a wheel timer, which does nothing.
+    void WheelTask(const boost::system::error_code & error);
+
+    /// Starts measuring at the end of the warmup.
+    void Measure(const boost::system::error_code & error);
+
+    /// Stops the broker at the end of the run.
+    void Finish(const boost::system::error_code & error);
+
+    /// The settings of the run.
+    SOptions m_options;
+
+    /// The names of the modules.
+    std::vector<std::string> m_names;
+
+    /// The scheduler ids of the modules.
+    std::vector<CBroker::ModuleId> m_ids;
+
+    /// The next round timer of each module.
+    std::vector<CBroker::TimerHandle> m_phasetimers;
+
+    /// The wheel timers that are armed and cancelled.
+    std::vector<CBroker::TimerHandle> m_wheeltimers;
+
+    /// Microseconds each module's last phase started at, or 0.
+    std::vector<boost::uint64_t> m_phasestart;
+
+    /// Timer for the end of the warmup and of the run.
+    boost::asio::deadline_timer m_timer;
+
+    /// Set between the end of the warmup and the end of the run.
+    bool m_measuring;
+
+    /// Microseconds the measurement started and ended at.
+    boost::uint64_t m_begin;
+    boost::uint64_t m_end;
+
+    /// Tasks run while measuring.
+    boost::uint64_t m_tasks;
+
+    /// Microseconds from queueing a task to running it.
+    std::vector<boost::uint32_t> m_queuelatency;
+
+    /// Microseconds each round was off the round length.
+    std::vector<boost::uint32_t> m_jitter;
+
+    /// Nanoseconds per call of AllocateTimer, arming and arming again.
+    double m_allocate;
+    double m_arm;
+    double m_rearm;
+
+    /// Phase changes when the measurement started.
+    SSchedulerStatistics m_basestats;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::CSchedulerBenchmark
+/// @description Registers the modules with the scheduler and allocates a
+///     next round timer for each, and the wheel timers of the first.
+/// @pre The broker is not running.
+/// @post The modules are registered.
+/// @param options the settings of the run.
+///////////////////////////////////////////////////////////////////////////////
+CSchedulerBenchmark::CSchedulerBenchmark(const SOptions & options)
+    : m_options(options)
+    , m_timer(CBroker::Instance().GetIOService())
+    , m_measuring(false)
+    , m_begin(0)
+    , m_end(0)
+    , m_tasks(0)
+    , m_allocate(0)
+    , m_arm(0)
+    , m_rearm(0)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for(unsigned int i = 0; i < options.modules; i++)
+    {
+        std::string name = "bench" + boost::lexical_cast<std::string>(i);
+        CBroker::Instance().RegisterModule(name,
+            boost::posix_time::milliseconds(options.phase));
+        m_names.push_back(name);
+        m_ids.push_back(CBroker::Instance().GetModuleId(name));
+        m_phasetimers.push_back(CBroker::Instance().AllocateTimer(name));
+        m_phasestart.push_back(0);
+    }
+
+    boost::uint64_t start = Now();
+    for(unsigned int i = 0; i < options.timers; i++)
+    {
+        m_wheeltimers.push_back(CBroker::Instance().AllocateTimer(m_names[0]));
+    }
+    m_allocate = (Now() - start) * 1000.0 / std::max(options.timers, 1u);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::Start
+/// @description Fills the ready queue of each module, sets its next round
+///     timer and the timer for the end of the warmup.
+/// @pre The broker is about to run.
+/// @post The modules have work queued.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for(unsigned int i = 0; i < m_options.modules; i++)
+    {
+        for(unsigned int k = 0; k < m_options.depth; k++)
+        {
+            Queue(i);
+        }
+        CBroker::Instance().Schedule(m_phasetimers[i],
+            boost::posix_time::not_a_date_time,
+            boost::bind(&CSchedulerBenchmark::PhaseStart, this, i, _1));
+    }
+
+    m_timer.expires_from_now(boost::posix_time::seconds(m_options.warmup));
+    m_timer.async_wait(CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CSchedulerBenchmark::Measure, this, _1)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::Queue
+/// @description Schedules a task for a module, by name if the run asks for
+///     it so the cost of the name lookup is included.
+/// @pre Called on the broker strand.
+/// @post The task is in the module's ready queue unless the broker stops.
+/// @param module the position of the module.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::Queue(unsigned int module)
+{
+    CBroker::BoundScheduleable task = boost::bind(&CSchedulerBenchmark::Task,
+        this, module, Now());
+
+    if(m_options.byname)
+    {
+        CBroker::Instance().Schedule(m_names[module], task);
+    }
+    else
+    {
+        CBroker::Instance().Schedule(m_ids[module], task);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::Task
+/// @description Records how long the task waited and queues another. A task
+///     queued near the end of a phase waits for the next round, which shows
+///     up in the tail of the queue latency.
+/// @pre Run by the worker of the module's phase.
+/// @post Another task of the module is queued.
+/// @param module the position of the module.
+/// @param queued microseconds the task was queued at.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::Task(unsigned int module, boost::uint64_t queued)
+{
+    if(m_measuring)
+    {
+        boost::uint64_t now = Now();
+        m_tasks++;
+        Sample(m_queuelatency, now > queued ? now - queued : 0);
+    }
+    Queue(module);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::PhaseStart
+/// @description Compares the time since the module's last phase started with
+///     the length of a round. The timer fires when the phase ends and its
+///     task runs when the phase starts again, behind the tasks queued before
+///     it, which are few and do nothing.
+/// @pre The next round timer of the module expired or was cancelled.
+/// @post The timer is set for the next round.
+/// @param module the position of the module.
+/// @param error set if the timer was cancelled.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::PhaseStart(unsigned int module,
+    const boost::system::error_code & error)
+{
+    if(error)
+    {
+        return;
+    }
+
+    boost::uint64_t now = Now();
+    if(m_measuring && m_phasestart[module] != 0)
+    {
+        boost::int64_t round = m_options.phase * m_options.modules * 1000;
+        boost::int64_t off = static_cast<boost::int64_t>(now - m_phasestart[module]) - round;
+        Sample(m_jitter, off < 0 ? -off : off);
+    }
+    m_phasestart[module] = now;
+
+    CBroker::Instance().Schedule(m_phasetimers[module],
+        boost::posix_time::not_a_date_time,
+        boost::bind(&CSchedulerBenchmark::PhaseStart, this, module, _1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::TimeTimers
+/// @description Arms every wheel timer far in the future, then arms them
+///     again a number of times. Arming an armed timer cancels it first and
+///     queues its task with operation_aborted, so the difference of the two
+///     costs is the cost of a cancel.
+/// @pre Run by the worker of the first module's phase.
+/// @post The costs are recorded, the timers are armed.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::TimeTimers()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const boost::posix_time::time_duration wait = boost::posix_time::hours(1);
+    CBroker::Scheduleable task = boost::bind(&CSchedulerBenchmark::WheelTask, this, _1);
+    double calls = std::max(m_options.timers, 1u);
+
+    boost::uint64_t start = Now();
+    for(unsigned int i = 0; i < m_options.timers; i++)
+    {
+        CBroker::Instance().Schedule(m_wheeltimers[i], wait, task);
+    }
+    m_arm = (Now() - start) * 1000.0 / calls;
+
+    start = Now();
+    for(unsigned int r = 0; r < m_options.rounds; r++)
+    {
+        for(unsigned int i = 0; i < m_options.timers; i++)
+        {
+            CBroker::Instance().Schedule(m_wheeltimers[i], wait, task);
+        }
+    }
+    m_rearm = (Now() - start) * 1000.0 / (calls * std::max(m_options.rounds, 1u));
+}
+
+/// The cancelled wheel timers queue their tasks, which do nothing.
+void CSchedulerBenchmark::WheelTask(const boost::system::error_code & /*error*/)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::Measure
+/// @description Starts counting tasks, queues the timer measurement and sets
+///     the timer for the end of the run.
+/// @pre The warmup has ended.
+/// @post The measurement is running.
+/// @param error set if the timer was cancelled.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::Measure(const boost::system::error_code & error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(error)
+    {
+        return;
+    }
+
+    m_measuring = true;
+    m_begin = Now();
+    m_basestats = CBroker::Instance().GetSchedulerStatistics();
+    CBroker::Instance().Schedule(m_ids[0],
+        boost::bind(&CSchedulerBenchmark::TimeTimers, this));
+
+    m_timer.expires_from_now(boost::posix_time::seconds(m_options.duration));
+    m_timer.async_wait(CBroker::Instance().GetStrand().wrap(
+        boost::bind(&CSchedulerBenchmark::Finish, this, _1)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::Finish
+/// @description Stops counting and stops the broker.
+/// @pre The run has ended.
+/// @post The broker is stopping.
+/// @param error set if the timer was cancelled.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::Finish(const boost::system::error_code & error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(error)
+    {
+        return;
+    }
+
+    m_measuring = false;
+    m_end = Now();
+    CBroker::Instance().Stop(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSchedulerBenchmark::Report
+/// @description Prints the throughput, latencies and costs of the run, and
+///     the phase change statistics the scheduler kept while it was measured.
+/// @pre The broker has stopped.
+/// @post None
+/// @param out the stream to print to.
+///////////////////////////////////////////////////////////////////////////////
+void CSchedulerBenchmark::Report(std::ostream & out)
+{
+    SSchedulerStatistics stats = CBroker::Instance().GetSchedulerStatistics();
+    double seconds = m_end > m_begin ? (m_end - m_begin) / 1e6 : 0;
+
+    std::sort(m_queuelatency.begin(), m_queuelatency.end());
+    std::sort(m_jitter.begin(), m_jitter.end());
+
+    out << "modules          " << m_options.modules << " x " << m_options.phase
+        << " ms" << std::endl
+        << "queued tasks     " << m_options.depth << " per module"
+        << (m_options.byname ? ", by name" : ", by id") << std::endl
+        << "broker threads   " << m_options.threads << std::endl
+        << "tasks            " << m_tasks << std::endl
+        << "throughput       " << std::fixed << std::setprecision(0)
+        << (seconds > 0 ? m_tasks / seconds : 0) << " tasks/s" << std::endl
+        << "queue p50        " << Quantile(m_queuelatency, 0.5) << " us" << std::endl
+        << "queue p99        " << Quantile(m_queuelatency, 0.99) << " us" << std::endl
+        << "queue max        " << (m_queuelatency.empty() ? 0 : m_queuelatency.back())
+        << " us" << std::endl
+        << "allocate timer   " << std::setprecision(1) << m_allocate << " ns" << std::endl
+        << "arm timer        " << m_arm << " ns" << std::endl
+        << "cancel and arm   " << m_rearm << " ns" << std::endl
+        << "rounds           " << m_jitter.size() << std::endl
+        << "jitter p50       " << Quantile(m_jitter, 0.5) << " us" << std::endl
+        << "jitter p99       " << Quantile(m_jitter, 0.99) << " us" << std::endl
+        << "jitter max       " << (m_jitter.empty() ? 0 : m_jitter.back()) << " us" << std::endl
+        << "phase changes    " << stats.changes - m_basestats.changes << std::endl
+        << "late changes     " << stats.late - m_basestats.late << std::endl
+        << "latest change    " << stats.maxlate.total_microseconds() << " us" << std::endl
+        << "misaligned       " << stats.misaligned - m_basestats.misaligned << std::endl
+        << "max drift        " << stats.maxdrift << " ms" << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Configure
+/// @description Gives every setting of the global configuration the default
+///     PosixMain uses, for a lone broker that listens on a loopback port.
+/// @param options the settings of the run.
+///////////////////////////////////////////////////////////////////////////////
+void Configure(const SOptions & options)
+{
+    CGlobalConfiguration & config = CGlobalConfiguration::Instance();
+    std::string text = boost::lexical_cast<std::string>(options.port);
+
+    config.SetHostname("localhost");
+    config.SetUUID("localhost:" + text);
+    config.SetListenPort(text);
+    config.SetListenAddress("127.0.0.1");
+    config.SetClockSkew(boost::posix_time::milliseconds(0));
+    config.SetMigrationStep(1);
+    config.SetLoadBalanceDeadband(0);
+    config.SetLoadBalanceForecast(0);
+    config.SetDraftPartners(1);
+    config.SetMaliciousFlag(false);
+    config.SetMQTTId("DGIClient");
+    config.SetMQTTAddress("tcp://localhost:1883");
+    config.SetMQTTWorkers(2);
+    config.SetInvariantCheck(false);
+    config.SetVVCWarmStart(false);
+    config.SetVVCParallelPhases(false);
+    config.SetVVCOffload(false);
+    config.SetVVCSegmentBus(-1);
+    config.SetVVCHalfGradients(false);
+    config.SetVVCOptimizer("step");
+    config.SetVVCPrecision("double");
+    config.SetVVCBatchThreads(1);
+    config.SetVVCSweepThreads(1);
+    config.SetVVCSensitivityTolerance(0);
+    config.SetVVCSkipDeadband(0);
+    config.SetBlasThreads(1);
+    config.SetDatagramMTU(1472);
+    config.SetFlushDelay(0);
+    config.SetAckDelay(0);
+    config.SetAckCount(8);
+    config.SetDatagramBatch(1);
+    config.SetSocketReceiveBuffer(0);
+    config.SetSocketSendBuffer(0);
+    config.SetSocketBufferLimit(0);
+    config.SetSocketDrops(false);
+    config.SetListenerThreads(0);
+    config.SetBrokerThreads(options.threads);
+    config.SetSendWindow(64);
+    config.SetSendQueue(1024);
+    config.SetConnectionIdleRounds(0);
+    config.SetMulticastAddress("");
+    config.SetMulticastPort(51870);
+    config.SetRelayFanout(0);
+    config.SetSharedMemory(false);
+    config.SetAdaptivePhases(false);
+    config.SetLoadBalanceDigests(false);
+    config.SetKernelTimestamps(false);
+    config.SetPassiveClock(false);
+    config.SetSwimMembership(false);
+    config.SetHierarchicalGroups(false);
+    config.SetGroupStandby(false);
+    config.SetStateDelta(false);
+    config.SetStateDeadband(0);
+    config.SetStatePacked(false);
+    config.SetStateAggregate(false);
+    config.SetStateSnapshots(1);
+    config.SetStateRecordLimit(0);
+    config.SetInboundQueue(0);
+    config.SetCompressThreshold(0);
+    config.SetAdmissionBacklog(0);
+    config.SetTraceFile("");
+    config.SetTraceRecords(65536);
+    config.SetDeviceThreads(1);
+    config.SetMetricsPort(0);
+    config.SetLatencyTrace(false);
+    config.SetTrafficAccounting(false);
+    config.SetTrafficSummary(0);
+    config.SetInlineSelfDelivery(false);
+    config.SetDevicesEndpoint("");
+    config.SetFactoryPort(0);
+    config.SetFactoryBacklog(0);
+    config.SetFactoryAcceptors(1);
+    config.SetPnpDeltaDeadband(0);
+    config.SetPnpDeltaRefresh(10);
+    config.SetAdapterConfigPath("");
+    config.SetTopologyConfigPath("");
+    config.SetNetworkEmulationPath("");
+    config.SetDeviceConfigPath("");
+    config.SetFeederModelPath("");
+    config.SetFeederImpedancePath("");
+    config.SetVVCDumpPath("");
+    config.SetWarmStatePath("");
+    config.SetWarmStateInterval(5000);
+    config.SetWarmStateMaxAge(300);
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[])
+{
+    po::options_description opts("Scheduler benchmark options");
+    po::variables_map vm;
+    SOptions options;
+    std::string timingsFile;
+    unsigned int verbosity;
+
+    opts.add_options()
+        ( "help,h", "print usage help (this screen)" )
+        ( "port,p", po::value<unsigned short>(&options.port)->default_value(51950),
+          "loopback port of the broker" )
+        ( "modules,m", po::value<unsigned int>(&options.modules)->default_value(3),
+          "synthetic modules to register" )
+        ( "phase", po::value<unsigned int>(&options.phase)->default_value(100),
+          "milliseconds of each module's phase" )
+        ( "depth", po::value<unsigned int>(&options.depth)->default_value(4),
+          "tasks each module keeps in its ready queue" )
+        ( "timers", po::value<unsigned int>(&options.timers)->default_value(1000),
+          "wheel timers to arm and cancel" )
+        ( "timer-rounds", po::value<unsigned int>(&options.rounds)->default_value(10),
+          "times every wheel timer is cancelled and armed again" )
+        ( "warmup", po::value<unsigned int>(&options.warmup)->default_value(1),
+          "seconds to run before measuring" )
+        ( "duration,d", po::value<unsigned int>(&options.duration)->default_value(5),
+          "seconds to measure for" )
+        ( "broker-threads", po::value<unsigned int>(&options.threads)->default_value(1),
+          "threads that run the broker ioservice" )
+        ( "by-name", "schedule the tasks by module name instead of by id" )
+        ( "timings-config",
+          po::value<std::string>(&timingsFile)->default_value("./config/timings.cfg"),
+          "name of the timings configuration file" )
+        ( "verbose,v", po::value<unsigned int>(&verbosity)->default_value(1),
+          "verbosity of the broker logs" );
+
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, opts), vm);
+        po::notify(vm);
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << e.what() << std::endl << opts << std::endl;
+        return 1;
+    }
+
+    if(vm.count("help"))
+    {
+        std::cout << opts << std::endl;
+        return 0;
+    }
+    options.byname = vm.count("by-name") > 0;
+    if(options.modules < 1 || options.phase < 1 || options.depth < 1 ||
+        options.duration < 1 || options.threads < 1)
+    {
+        std::cerr << "need at least 1 module, a phase of at least 1 ms, a depth"
+            << " of at least 1, a duration of at least 1 s and a broker thread"
+            << std::endl;
+        return 1;
+    }
+
+    CGlobalLogger::instance().SetGlobalLevel(verbosity);
+    try
+    {
+        CTimings::SetTimings(timingsFile);
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << "Unable to load timings: " << e.what() << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        Configure(options);
+        CConnectionManager::Instance().PutHost(
+            CGlobalConfiguration::Instance().GetUUID(), "localhost",
+            boost::lexical_cast<std::string>(options.port));
+
+        CSchedulerBenchmark benchmark(options);
+        CBroker::Instance().GetStrand().post(
+            boost::bind(&CSchedulerBenchmark::Start, &benchmark));
+        CBroker::Instance().Run();
+
+        benchmark.Report(std::cout);
+    }
+    catch(std::exception & e)
+    {
+        std::cerr << "scheduler benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // skip the destructors of the singletons, which the broker does not
+    // expect to run
+    std::cout.flush();
+    _exit(0);
+}
@@ -0,0 +1,154 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         TelemetryDecoder.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Prints the device tables of a telemetry file as CSV
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "device/TelemetryFormat.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace freedm::broker::device;
+
+namespace {
+
+/// The columns of an adapter in the telemetry file
+struct SStreamInfo
+{
+    /// The name of the adapter
+    std::string name;
+    /// The number of state columns
+    boost::uint32_t states;
+    /// The number of command columns
+    boost::uint32_t commands;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// PrintChunk
+/// @description Turns the columns of a chunk back into rows and prints them.
+/// @param info the adapter of the chunk.
+/// @param pos the start of the chunk.
+/// @param end the end of the chunk.
+/// @return False if the chunk is malformed.
+///////////////////////////////////////////////////////////////////////////////
+bool PrintChunk(const SStreamInfo& info, const char* pos, const char* end)
+{
+    STelemetryChunk header;
+    std::vector<boost::uint64_t> times;
+    std::vector<float> values;
+    std::size_t width = info.states + info.commands;
+
+    if(!DecodeChunk(pos, end, width, header, times, values))
+    {
+        return false;
+    }
+
+    if(header.dropped > 0)
+    {
+        std::cout << "# " << info.name << " dropped " << header.dropped
+                << " rows" << std::endl;
+    }
+
+    for(std::size_t r = 0; r < times.size(); r++)
+    {
+        std::cout << info.name << "," << times[r];
+        for(std::size_t c = 0; c < width; c++)
+        {
+            std::cout << "," << values[r * width + c];
+        }
+        std::cout << std::endl;
+    }
+    return true;
+}
+}
+
+/// Decoder entry point
+int main(int argc, char* argv[])
+{
+    if(argc != 2)
+    {
+        std::cerr << "usage: " << argv[0] << " telemetry-file" << std::endl;
+        return 1;
+    }
+
+    std::string path = argv[1];
+    std::ifstream file(path.c_str(), std::ios::binary);
+    STelemetryHeader header;
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, TELEMETRY_MAGIC, sizeof(header.magic)) != 0)
+    {
+        std::cerr << path << " is not a telemetry file" << std::endl;
+        return 1;
+    }
+    if(header.version != TELEMETRY_VERSION || header.value_size != sizeof(float))
+    {
+        std::cerr << path << " has telemetry version " << header.version
+                << ", expected " << TELEMETRY_VERSION << std::endl;
+        return 1;
+    }
+
+    std::map<boost::uint32_t, SStreamInfo> streams;
+    STelemetryBlock block;
+    std::vector<char> payload;
+
+    while(file.read(reinterpret_cast<char*>(&block), sizeof(block)))
+    {
+        payload.resize(block.length + 1);
+        // Stops at a block cut short when the writer stopped
+        if(!file.read(&payload[0], block.length))
+        {
+            break;
+        }
+        const char* pos = &payload[0];
+        const char* end = pos + block.length;
+
+        if(block.kind == TELEMETRY_STREAM)
+        {
+            STelemetryStream info;
+            if(block.length < sizeof(info))
+            {
+                std::cerr << path << " has a malformed stream block" << std::endl;
+                return 1;
+            }
+            std::memcpy(&info, pos, sizeof(info));
+            SStreamInfo& stream = streams[block.stream];
+            stream.name.assign(pos + sizeof(info), end);
+            stream.states = info.states;
+            stream.commands = info.commands;
+            std::cout << "# " << stream.name << " has " << stream.states
+                    << " states then " << stream.commands << " commands"
+                    << std::endl;
+        }
+        else if(block.kind == TELEMETRY_CHUNK)
+        {
+            std::map<boost::uint32_t, SStreamInfo>::const_iterator it =
+                streams.find(block.stream);
+            if(it == streams.end() || !PrintChunk(it->second, pos, end))
+            {
+                std::cerr << path << " has a malformed chunk" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
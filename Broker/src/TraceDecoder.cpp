@@ -0,0 +1,156 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         TraceDecoder.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Prints the events of a binary trace file as text or CSV
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CTraceLog.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace freedm::broker;
+
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////
+/// Field
+/// @description Reads a fixed text field of a record.
+/// @param field the zero padded field.
+/// @param size the size of the field.
+/// @return The text of the field.
+///////////////////////////////////////////////////////////////////////////////
+std::string Field(const char* field, std::size_t size)
+{
+    return std::string(field, strnlen(field, size));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FormatTime
+/// @description Formats synchronized microseconds since the epoch as UTC.
+/// @param usec the time stamp of a record.
+/// @return The time as YYYY-MM-DD HH:MM:SS.uuuuuu
+///////////////////////////////////////////////////////////////////////////////
+std::string FormatTime(boost::uint64_t usec)
+{
+    std::time_t seconds = static_cast<std::time_t>(usec / 1000000);
+    std::tm parts;
+    gmtime_r(&seconds, &parts);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &parts);
+    char result[48];
+    std::sprintf(result, "%s.%06u", text, static_cast<unsigned int>(usec % 1000000));
+    return result;
+}
+
+}
+
+/// Decoder entry point
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    std::string path;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--csv") == 0)
+        {
+            csv = true;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+
+    if(path.empty())
+    {
+        std::cerr << "usage: " << argv[0] << " [--csv] trace-file" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file(path.c_str(), std::ios::binary);
+    STraceHeader header;
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        std::cerr << path << " is not a trace file" << std::endl;
+        return 1;
+    }
+    if(header.version != TRACE_VERSION || header.record_size != sizeof(STraceRecord)
+        || header.capacity == 0)
+    {
+        std::cerr << path << " has trace version " << header.version
+                << ", expected " << TRACE_VERSION << std::endl;
+        return 1;
+    }
+
+    std::vector<STraceRecord> records(header.capacity);
+    file.read(reinterpret_cast<char*>(&records[0]),
+        header.capacity * sizeof(STraceRecord));
+
+    boost::uint64_t head = header.head;
+    boost::uint64_t first = head > header.capacity ? head - header.capacity : 0;
+
+    if(csv)
+    {
+        std::cout << "sequence,time,module,event,peer,hash,value" << std::endl;
+    }
+
+    for(boost::uint64_t seq = first; seq < head; seq++)
+    {
+        const STraceRecord& record = records[seq % header.capacity];
+        // Skips records that were being written when the trace stopped
+        if(record.sequence != seq + 1)
+        {
+            continue;
+        }
+
+        char hash[20];
+        std::sprintf(hash, "%016llx", static_cast<unsigned long long>(record.hash));
+        std::string module = Field(record.module, sizeof(record.module));
+        std::string peer = Field(record.peer, sizeof(record.peer));
+
+        if(csv)
+        {
+            std::cout << seq << "," << record.time << "," << module << ","
+                    << GetTraceEventName(record.event) << "," << peer << ","
+                    << hash << "," << record.value << std::endl;
+        }
+        else
+        {
+            std::cout << FormatTime(record.time) << " " << module << " "
+                    << GetTraceEventName(record.event);
+            if(!peer.empty())
+            {
+                std::cout << " peer " << peer;
+            }
+            if(record.hash != 0)
+            {
+                std::cout << " hash " << hash;
+            }
+            std::cout << " value " << record.value << std::endl;
+        }
+    }
+
+    return 0;
+}
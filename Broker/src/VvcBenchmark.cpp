@@ -0,0 +1,633 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         VvcBenchmark.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Times the VVC numerical kernels on synthetic radial feeders
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "vvc/fun_return.h"
+#include "vvc/load_system_data.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/ref.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <armadillo>
+
+namespace {
+
+/// Heap allocations made by the process so far.
+volatile unsigned long g_allocations = 0;
+
+} // unnamed namespace
+
+#ifdef __GLIBC__
+// Counts every heap allocation, including the ones armadillo makes with
+// posix_memalign, by forwarding the allocator entry points to glibc.
+extern "C" {
+
+void * __libc_malloc(std::size_t size);
+void * __libc_calloc(std::size_t count, std::size_t size);
+void * __libc_realloc(void * ptr, std::size_t size);
+void * __libc_memalign(std::size_t alignment, std::size_t size);
+
+void * malloc(std::size_t size) throw()
+{
+    __sync_fetch_and_add(&g_allocations, 1);
+    return __libc_malloc(size);
+}
+
+void * calloc(std::size_t count, std::size_t size) throw()
+{
+    __sync_fetch_and_add(&g_allocations, 1);
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, std::size_t size) throw()
+{
+    __sync_fetch_and_add(&g_allocations, 1);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void ** ptr, std::size_t alignment, std::size_t size) throw()
+{
+    __sync_fetch_and_add(&g_allocations, 1);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+} // extern "C"
+#endif
+
+namespace {
+
+/// Stream buffer that discards the progress output of the kernels.
+class CNullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) { return c == EOF ? 0 : c; }
+};
+
+/// Everything the kernels of one VVC round read and produce.
+struct SFeeder
+{
+    sysdata sysinfo;
+    arma::mat Dl;
+    y_re Y;
+    dpf_plan plan;
+    dpf_warm warm;
+    VPQ dpf;
+    arma::mat profiles;
+    Vabc V;
+    newbrn brn;
+    arma::mat Node_f, Load_a, Load_b, Load_c;
+    arma::cx_mat brn_a, brn_b, brn_c;
+    int Lla, Llb, Llc;
+    bool parallel;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// SyntheticFeeder
+/// @description Builds a radial feeder in the layout of load_system_data.
+///     The substation transformer feeds bus 1, and the buses are strung into
+///     laterals of a fixed length. Each lateral after the first starts from
+///     the middle bus of an earlier one, so the laterals form a binary tree.
+///     The loads sum to the load of the built-in feeder, every fifth bus is
+///     a generator, and the lines get shorter as the feeder grows so the
+///     voltage at the end of the feeder stays in range.
+/// @param nodes the number of buses, including the substation bus.
+/// @param lateral the number of branches in a lateral.
+/// @return The Dl matrix of the feeder, with an empty row between laterals.
+///////////////////////////////////////////////////////////////////////////////
+arma::mat SyntheticFeeder(int nodes, int lateral)
+{
+    const int lines = nodes - 2;
+    const int laterals = (lines + lateral - 1) / lateral;
+    const double load = 300.0 / (nodes - 2);
+    const double length = std::min(1.0, 10.0 / nodes);
+
+    arma::mat Dl = arma::zeros(1 + lines + laterals - 1, 13);
+    Dl(0, 0) = 1;
+    Dl(0, 2) = 1;
+    Dl(0, 3) = 2;
+    Dl(0, 4) = 1;
+    Dl(0, 5) = 1;
+
+    int row = 1;
+    for(int k = 0; k < lines; k++)
+    {
+        int bus = k + 2;
+        int l = k / lateral;
+        int sbus = bus - 1;
+
+        if(k % lateral == 0)
+        {
+            if(l == 0)
+            {
+                sbus = 1;
+            }
+            else
+            {
+                // the empty row that closes the previous lateral
+                row++;
+                sbus = 2 + ((l - 1) / 2) * lateral + lateral / 2;
+            }
+        }
+
+        double p = load * (1 + 0.5 * std::sin(static_cast<double>(bus)));
+        if(bus % 5 == 0)
+        {
+            p = -p / 3;
+        }
+
+        Dl(row, 0) = bus;
+        Dl(row, 1) = sbus;
+        Dl(row, 2) = bus;
+        Dl(row, 3) = 1;
+        Dl(row, 4) = length;
+        Dl(row, 5) = 1;
+        Dl(row, 6) = p;
+        Dl(row, 8) = p;
+        Dl(row, 10) = p;
+        row++;
+    }
+    return Dl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// BuildTopology
+/// @description Computes the node and load index vectors, the admittance
+///     matrices, the per-phase branch tables and the sweep plan, the same
+///     way VVCAgent::BuildTopology does.
+/// @param f the feeder to fill in.
+/// @return Zero, the topology has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int BuildTopology(SFeeder & f)
+{
+    const arma::mat & Dl = f.Dl;
+    int Ldl = Dl.n_rows;
+    int cnt_nodes = 1;
+
+    f.Lla = f.Llb = f.Llc = 0;
+    for(int i = 0; i < Ldl; i++)
+    {
+        if((int)Dl(i, 0) != 0) cnt_nodes++;
+        if((int)Dl(i, 6) != 0) f.Lla++;
+        if((int)Dl(i, 8) != 0) f.Llb++;
+        if((int)Dl(i, 10) != 0) f.Llc++;
+    }
+
+    f.Node_f = arma::zeros(1, cnt_nodes);
+    f.Load_a = arma::zeros(1, f.Lla);
+    f.Load_b = arma::zeros(1, f.Llb);
+    f.Load_c = arma::zeros(1, f.Llc);
+
+    int j = 1, ja = 0, jb = 0, jc = 0;
+    for(int i = 0; i < Ldl; i++)
+    {
+        if((int)Dl(i, 2) != 0) f.Node_f(0, j++) = Dl(i, 2);
+        if((int)Dl(i, 6) != 0) f.Load_a(ja++) = Dl(i, 2);
+        if((int)Dl(i, 8) != 0) f.Load_b(jb++) = Dl(i, 2);
+        if((int)Dl(i, 10) != 0) f.Load_c(jc++) = Dl(i, 2);
+    }
+    f.Node_f = f.Node_f.st();
+
+    f.Y = form_Y_abc(Dl, f.sysinfo.Z, f.sysinfo.bkva, f.sysinfo.bkv);
+
+    const arma::cx_mat & brnches = f.Y.brnches;
+    arma::mat empty_a = arma::zeros(f.Y.Lnum_a, brnches.n_cols);
+    arma::mat empty_b = arma::zeros(f.Y.Lnum_b, brnches.n_cols);
+    arma::mat empty_c = arma::zeros(f.Y.Lnum_c, brnches.n_cols);
+    f.brn_a = arma::cx_mat(empty_a, empty_a);
+    f.brn_b = arma::cx_mat(empty_b, empty_b);
+    f.brn_c = arma::cx_mat(empty_c, empty_c);
+
+    ja = jb = jc = 0;
+    for(unsigned int i = 0; i < brnches.n_rows; i++)
+    {
+        if(std::abs(brnches(i, 2)) != 0 && ja < f.Y.Lnum_a)
+            f.brn_a.row(ja++) = brnches.row(i);
+        if(std::abs(brnches(i, 3)) != 0 && jb < f.Y.Lnum_b)
+            f.brn_b.row(jb++) = brnches.row(i);
+        if(std::abs(brnches(i, 4)) != 0 && jc < f.Y.Lnum_c)
+            f.brn_c.row(jc++) = brnches.row(i);
+    }
+
+    f.plan = DPF_plan(Dl, f.sysinfo.Z, f.sysinfo.bkva, f.sysinfo.bkv);
+    f.warm = dpf_warm();
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FormY
+/// @description Forms the three phase admittance matrices.
+/// @param f the feeder.
+/// @return Zero, form_Y_abc has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int FormY(SFeeder & f)
+{
+    f.Y = form_Y_abc(f.Dl, f.sysinfo.Z, f.sysinfo.bkva, f.sysinfo.bkv);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PlanDpf
+/// @description Flattens the feeder into a sweep plan.
+/// @param f the feeder.
+/// @return Zero, DPF_plan has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int PlanDpf(SFeeder & f)
+{
+    f.plan = DPF_plan(f.Dl, f.sysinfo.Z, f.sysinfo.bkva, f.sysinfo.bkv);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ColdDpf
+/// @description Runs the power flow from a flat start.
+/// @param f the feeder.
+/// @return The sweeps the power flow used.
+///////////////////////////////////////////////////////////////////////////////
+int ColdDpf(SFeeder & f)
+{
+    f.dpf = DPF_return7(f.Dl, f.sysinfo.Z, f.plan);
+    return f.dpf.iterations;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// WarmDpf
+/// @description Runs the power flow from the last converged solution.
+/// @param f the feeder.
+/// @return The sweeps the power flow used.
+///////////////////////////////////////////////////////////////////////////////
+int WarmDpf(SFeeder & f)
+{
+    f.dpf = DPF_return7(f.Dl, f.sysinfo.Z, f.plan, &f.warm);
+    return f.dpf.iterations;
+}
+
+/// Sink that adds up the sweeps of a time series power flow.
+class CSeriesSink : public dpf_series_sink
+{
+public:
+    CSeriesSink() : iterations(0) { }
+    void point(unsigned int, const dpf_point & result, const arma::cx_mat &)
+    {
+        iterations += result.iterations;
+    }
+    int iterations;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// SeriesDpf
+/// @description Runs the power flow over a day of hourly load profiles, on
+///     in blocks of six hours on three threads with --parallel.
+/// @param f the feeder.
+/// @return The sweeps of all the time points.
+///////////////////////////////////////////////////////////////////////////////
+int SeriesDpf(SFeeder & f)
+{
+    if(f.profiles.n_cols == 0)
+    {
+        // a daily load curve between 60% and 100% of the base case
+        f.profiles.set_size(1, 24);
+        for(unsigned int h = 0; h < 24; h++)
+        {
+            f.profiles(0, h) = 0.8 - 0.2 * std::cos(2 * arma::datum::pi * h / 24.0);
+        }
+    }
+    CSeriesSink sink;
+    DPF_series(f.Dl, f.profiles, f.plan, 0, f.parallel ? 3 : 1, 6, sink);
+    return sink.iterations;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ListVoltages
+/// @description Splits the power flow solution into its phases.
+/// @param f the feeder, with a power flow solution.
+/// @return Zero, V_abc_list has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int ListVoltages(SFeeder & f)
+{
+    f.V = V_abc_list(f.dpf.Vpolar, f.Node_f, f.dpf.Vpolar.n_rows,
+        f.Y.Lnum_a, f.Y.Lnum_b, f.Y.Lnum_c);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// RenameBranches
+/// @description Renumbers the branch tables into the per-phase node lists.
+/// @param f the feeder, with the per-phase node lists.
+/// @return Zero, rename_brn has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int RenameBranches(SFeeder & f)
+{
+    f.brn = rename_brn(f.V.Node_a, f.V.Node_b, f.V.Node_c, f.brn_a, f.brn_b,
+        f.brn_c, f.Y.Lnum_a, f.Y.Lnum_b, f.Y.Lnum_c, f.V.Lna, f.V.Lnb, f.V.Lnc);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FormFtheta
+/// @description Forms the loss derivatives by angle of phase a, on the same
+///     representation of Y that vvc_compute would use.
+/// @param f the feeder, with its branch tables renamed.
+/// @return Zero, form_Ftheta has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int FormFtheta(SFeeder & f)
+{
+    if(f.Y.sparse)
+        form_Ftheta(f.Y.Ysp_a, f.V.V_a, f.V.theta_a, f.brn.newbrn_a, f.V.Lna, f.Y.Lnum_a);
+    else
+        form_Ftheta(f.Y.Y_a, f.V.V_a, f.V.theta_a, f.brn.newbrn_a, f.V.Lna, f.Y.Lnum_a);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FormFv
+/// @description Forms the loss derivatives by magnitude of phase a.
+/// @param f the feeder, with its branch tables renamed.
+/// @return Zero, form_Fv has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int FormFv(SFeeder & f)
+{
+    if(f.Y.sparse)
+        form_Fv(f.Y.Ysp_a, f.V.V_a, f.V.theta_a, f.brn.newbrn_a, f.V.Lna, f.Y.Lnum_a);
+    else
+        form_Fv(f.Y.Y_a, f.V.V_a, f.V.theta_a, f.brn.newbrn_a, f.V.Lna, f.Y.Lnum_a);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FormJ
+/// @description Forms the power flow Jacobian of phase a.
+/// @param f the feeder, with a power flow solution.
+/// @return Zero, form_J has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int FormJ(SFeeder & f)
+{
+    if(f.Y.sparse)
+        form_J(f.Y.Ysp_a, f.V.V_a, f.V.theta_a, f.V.Lna);
+    else
+        form_J(f.Y.Y_a, f.V.V_a, f.V.theta_a, f.V.Lna);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Gradients
+/// @description Computes the loss gradient of all three phases.
+/// @param f the feeder, with its branch tables renamed.
+/// @param single true to solve for lambda in single precision.
+/// @return Zero, the gradient has no iterations.
+///////////////////////////////////////////////////////////////////////////////
+int Gradients(SFeeder & f, bool single)
+{
+    const arma::mat * load[3] = { &f.Load_a, &f.Load_b, &f.Load_c };
+    const int Ll[3] = { f.Lla, f.Llb, f.Llc };
+    phase_input ph[3];
+
+    ph[0].Y = &f.Y.Y_a;
+    ph[1].Y = &f.Y.Y_b;
+    ph[2].Y = &f.Y.Y_c;
+    ph[0].Ysp = &f.Y.Ysp_a;
+    ph[1].Ysp = &f.Y.Ysp_b;
+    ph[2].Ysp = &f.Y.Ysp_c;
+    ph[0].brn = &f.brn.newbrn_a;
+    ph[1].brn = &f.brn.newbrn_b;
+    ph[2].brn = &f.brn.newbrn_c;
+    ph[0].Node = &f.V.Node_a;
+    ph[1].Node = &f.V.Node_b;
+    ph[2].Node = &f.V.Node_c;
+    ph[0].V = f.V.V_a; ph[0].theta = f.V.theta_a; ph[0].Ln = f.V.Lna; ph[0].Lnum = f.Y.Lnum_a;
+    ph[1].V = f.V.V_b; ph[1].theta = f.V.theta_b; ph[1].Ln = f.V.Lnb; ph[1].Lnum = f.Y.Lnum_b;
+    ph[2].V = f.V.V_c; ph[2].theta = f.V.theta_c; ph[2].Ln = f.V.Lnc; ph[2].Lnum = f.Y.Lnum_c;
+    for(int p = 0; p < 3; p++)
+    {
+        ph[p].sparse = f.Y.sparse;
+        ph[p].Load = load[p];
+        ph[p].Ll = Ll[p];
+        ph[p].cache = 0;
+        ph[p].single = single;
+        ph[p].deviation = 0;
+    }
+
+    arma::mat g_vq[3];
+    phase_gradients(ph, g_vq, f.parallel);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Pipeline
+/// @description Runs the part of a vvc_compute round that precedes the step
+///     size search: the topology, a cold power flow, the per-phase lists,
+///     the renamed branch tables and the gradient.
+/// @param f the feeder.
+/// @return The sweeps the power flow used.
+///////////////////////////////////////////////////////////////////////////////
+int Pipeline(SFeeder & f)
+{
+    BuildTopology(f);
+    int iterations = ColdDpf(f);
+    ListVoltages(f);
+    RenameBranches(f);
+    Gradients(f);
+    return iterations;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Measure
+/// @description Calls a kernel until the time budget or the call limit is
+///     reached, and prints the time, iterations and allocations per call.
+/// @param out the stream the result is printed to.
+/// @param csv true to print a CSV row instead of a table row.
+/// @param nodes the size of the feeder.
+/// @param kernel the name of the kernel.
+/// @param run calls the kernel once and returns its iterations.
+/// @param budget the seconds to spend on the kernel.
+/// @param limit the largest number of calls.
+///////////////////////////////////////////////////////////////////////////////
+void Measure(std::ostream & out, bool csv, int nodes, const std::string & kernel,
+        boost::function<int ()> run, double budget, unsigned int limit)
+{
+    using namespace boost::posix_time;
+
+    unsigned long allocations = g_allocations;
+    unsigned long iterations = 0;
+    unsigned int calls = 0;
+    ptime start = microsec_clock::universal_time();
+    time_duration elapsed;
+
+    do
+    {
+        iterations += run();
+        calls++;
+        elapsed = microsec_clock::universal_time() - start;
+    }
+    while(elapsed.total_microseconds() < budget * 1e6 && calls < limit);
+
+    double usec = static_cast<double>(elapsed.total_microseconds()) / calls;
+    double sweeps = static_cast<double>(iterations) / calls;
+    double allocs = static_cast<double>(g_allocations - allocations) / calls;
+
+    if(csv)
+    {
+        out << nodes << "," << kernel << "," << calls << "," << usec << ","
+            << sweeps << "," << allocs << std::endl;
+    }
+    else
+    {
+        out << std::setw(7) << nodes << "  " << std::left << std::setw(20)
+            << kernel << std::right << std::setw(8) << calls
+            << std::setw(14) << std::fixed << std::setprecision(1) << usec
+            << std::setw(8) << std::setprecision(1) << sweeps
+            << std::setw(10) << std::setprecision(1) << allocs << std::endl;
+    }
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    bool parallel = false;
+    int lateral = 10;
+    double budget = 0.5;
+    unsigned int limit = 1000;
+    std::vector<int> sizes;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--csv") == 0)
+        {
+            csv = true;
+        }
+        else if(std::strcmp(argv[i], "--parallel") == 0)
+        {
+            parallel = true;
+        }
+        else if(std::strcmp(argv[i], "--lateral") == 0 && i + 1 < argc)
+        {
+            lateral = std::atoi(argv[++i]);
+        }
+        else if(std::strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+        {
+            budget = std::atof(argv[++i]);
+        }
+        else if(std::strcmp(argv[i], "--calls") == 0 && i + 1 < argc)
+        {
+            limit = std::atoi(argv[++i]);
+        }
+        else if(std::atoi(argv[i]) > 0)
+        {
+            sizes.push_back(std::atoi(argv[i]));
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--csv] [--parallel]"
+                << " [--lateral branches] [--time seconds] [--calls count]"
+                << " [nodes ...]" << std::endl;
+            return 1;
+        }
+    }
+
+    if(sizes.empty())
+    {
+        sizes.push_back(10);
+        sizes.push_back(100);
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+    }
+    if(lateral < 1 || limit < 1)
+    {
+        std::cerr << "--lateral and --calls must be positive" << std::endl;
+        return 1;
+    }
+
+    // the kernels print their progress, which would swamp the timings
+    std::ostream out(std::cout.rdbuf());
+    CNullBuffer null;
+    std::cout.rdbuf(&null);
+
+#ifndef __GLIBC__
+    out << "allocations are not counted on this platform" << std::endl;
+#endif
+    if(csv)
+    {
+        out << "nodes,kernel,calls,usec_per_call,iterations_per_call,"
+            << "allocations_per_call" << std::endl;
+    }
+    else
+    {
+        out << "  nodes  kernel                 calls      usec/call"
+            << "   iters    allocs" << std::endl;
+    }
+
+    for(std::size_t i = 0; i < sizes.size(); i++)
+    {
+        if(sizes[i] < 3)
+        {
+            std::cerr << "a feeder needs at least 3 nodes" << std::endl;
+            continue;
+        }
+
+        SFeeder f;
+        f.sysinfo = load_system_data();
+        f.Dl = SyntheticFeeder(sizes[i], lateral);
+        f.parallel = parallel;
+
+        try
+        {
+            // fill every input once, then time each stage on its own
+            Pipeline(f);
+            WarmDpf(f);
+
+            boost::reference_wrapper<SFeeder> rf = boost::ref(f);
+            Measure(out, csv, sizes[i], "form_Y_abc", boost::bind(&FormY, rf), budget, limit);
+            Measure(out, csv, sizes[i], "DPF_plan", boost::bind(&PlanDpf, rf), budget, limit);
+            Measure(out, csv, sizes[i], "DPF_return7", boost::bind(&ColdDpf, rf), budget, limit);
+            Measure(out, csv, sizes[i], "DPF_return7 (warm)", boost::bind(&WarmDpf, rf), budget, limit);
+            Measure(out, csv, sizes[i], "DPF_series (24 points)", boost::bind(&SeriesDpf, rf), budget, limit);
+            Measure(out, csv, sizes[i], "V_abc_list", boost::bind(&ListVoltages, rf), budget, limit);
+            Measure(out, csv, sizes[i], "rename_brn", boost::bind(&RenameBranches, rf), budget, limit);
+            Measure(out, csv, sizes[i], "form_Ftheta", boost::bind(&FormFtheta, rf), budget, limit);
+            Measure(out, csv, sizes[i], "form_Fv", boost::bind(&FormFv, rf), budget, limit);
+            Measure(out, csv, sizes[i], "form_J", boost::bind(&FormJ, rf), budget, limit);
+            Measure(out, csv, sizes[i], "phase_gradients", boost::bind(&Gradients, rf, false), budget, limit);
+            Measure(out, csv, sizes[i], "phase_gradients (single)", boost::bind(&Gradients, rf, true), budget, limit);
+            Measure(out, csv, sizes[i], "vvc round", boost::bind(&Pipeline, rf), budget, limit);
+        }
+        catch(std::exception & e)
+        {
+            std::cerr << sizes[i] << " nodes: " << e.what() << std::endl;
+        }
+    }
+
+    std::cout.rdbuf(out.rdbuf());
+    return 0;
+}
@@ -25,6 +25,15 @@
 
 #cmakedefine DATAGRAM
 #cmakedefine CUSTOMNETWORK
+#cmakedefine HAVE_MMSG
+#cmakedefine HAVE_SHM_OPEN
+
+#define LINALG_BACKEND "@LINALG_BACKEND@"
+#cmakedefine LINALG_OPENBLAS
+#cmakedefine LINALG_MKL
+#cmakedefine LINALG_BLIS
+
+#define LOG_COMPILE_LEVEL @LOG_COMPILE_LEVEL@
 
 #endif // CONFIG_HPP
 
@@ -12,16 +12,21 @@
 ///     CAdapterFactory::CAdapterFactory
 ///     CAdapterFactory::Instance
 ///     CAdapterFactory::RunService
+///     CAdapterFactory::GetService
 ///     CAdapterFactory::Stop
 ///     CAdapterFactory::CreateAdapter
 ///     CAdapterFactory::RemoveAdapter
 ///     CAdapterFactory::InitializeAdapter
+///     CAdapterFactory::GenerateDevices
 ///     CAdapterFactory::CreateDevice
 ///     CAdapterFactory::StartSessionProtocol
 ///     CAdapterFactory::StartSession
 ///     CAdapterFactory::HandleRead
 ///     CAdapterFactory::Timeout
 ///     CAdapterFactory::SessionProtocol
+///     CAdapterFactory::GetHeartbeatDeadline
+///     CAdapterFactory::WatchHeartbeat
+///     CAdapterFactory::TickWheel
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -39,9 +44,13 @@
 #include "CAdapterFactory.hpp"
 #include "IBufferAdapter.hpp"
 #include "COpenDssAdapter.hpp"
+#include "CDssDirectAdapter.hpp"
 #include "CPnpAdapter.hpp"
 #include "CMqttAdapter.hpp"
 #include "CRtdsAdapter.hpp"
+#include "CSyntheticAdapter.hpp"
+#include "CReplayAdapter.hpp"
+#include "CSharedMemoryAdapter.hpp"
 
 #include "CDeviceManager.hpp"
 #include "CGlobalConfiguration.hpp"
@@ -49,7 +58,12 @@
 #include "PlugNPlayExceptions.hpp"
 #include "SynchronousTimeout.hpp"
 #include "CTimings.hpp"
+#include "CThreadPolicy.hpp"
 
+#include <sstream>
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/regex.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 
@@ -60,6 +74,9 @@ namespace freedm {
             namespace {
 /// This file's logger.
                 CLocalLogger Logger(__FILE__);
+
+/// Number of heartbeat wheel ticks in one DEV_PNP_HEARTBEAT period.
+                const unsigned int HEARTBEAT_WHEEL_RESOLUTION = 8;
             }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -68,18 +85,29 @@ namespace freedm {
 /// @pre None.
 /// @post Registers the known device classes.
 /// @post Initializes the session protocol TCP server.
+/// @post Starts one thread per device thread beyond the first.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
             CAdapterFactory::CAdapterFactory()
-                    : m_timeout(m_ios) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                    : m_nextService(0)
+                    , m_wheelTimer(m_ios)
+                    , m_tick(0)
+                    , m_tickLength(1)
+                    , m_heartbeatTicks(0) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                unsigned int threads = CGlobalConfiguration::Instance().GetDeviceThreads();
+                for (unsigned int i = 1; i < threads; i++) {
+                    m_pool.push_back(boost::shared_ptr<boost::asio::io_service>(
+                            new boost::asio::io_service()));
+                }
 
                 std::string deviceCfgFile =
                         CGlobalConfiguration::Instance().GetDeviceConfigPath();
 
                 if (deviceCfgFile.empty()) {
-                    Logger.Status << "System will start no device classes." << std::endl;
+                    LOG_STATUS(Logger) << "System will start no device classes." << std::endl;
                 } else {
                     m_builder = CDeviceBuilder(deviceCfgFile);
                 }
@@ -88,31 +116,31 @@ namespace freedm {
                         CGlobalConfiguration::Instance().GetFactoryPort();
 
                 if (factoryPort) {
-                    Logger.Status << "Plug and play devices enabled." << std::endl;
+                    LOG_STATUS(Logger) << "Plug and play devices enabled." << std::endl;
                     StartSessionProtocol(factoryPort);
                 } else {
-                    Logger.Status << "Plug and play devices disabled." << std::endl;
+                    LOG_STATUS(Logger) << "Plug and play devices disabled." << std::endl;
                 }
 
                 std::string mqttId = CGlobalConfiguration::Instance().GetMQTTId();
                 std::string mqttAddress = CGlobalConfiguration::Instance().GetMQTTAddress();
 
                 if (mqttId != "") {
-                    Logger.Status << "MQTT client enabled." << std::endl;
+                    LOG_STATUS(Logger) << "MQTT client enabled." << std::endl;
                     //   IAdapter::Pointer mqttClient = CMqttAdapter::Create(mqttId, mqttAddress);
                     //  m_adapters[mqttId] = mqttClient;
                     //  mqttClient->Start();
                 } else {
-                    Logger.Status << "MQTT client disabled." << std::endl;
+                    LOG_STATUS(Logger) << "MQTT client disabled." << std::endl;
                 }
 
                 std::string adapterCfgFile =
                         CGlobalConfiguration::Instance().GetAdapterConfigPath();
 
                 if (adapterCfgFile.empty()) {
-                    Logger.Status << "System will start without adapters." << std::endl;
+                    LOG_STATUS(Logger) << "System will start without adapters." << std::endl;
                 } else {
-                    Logger.Status << "Using devices in " << adapterCfgFile << std::endl;
+                    LOG_STATUS(Logger) << "Using devices in " << adapterCfgFile << std::endl;
 
                     try {
                         boost::property_tree::ptree adapterList;
@@ -133,7 +161,12 @@ namespace freedm {
                 }
 
                 // Last because we don't want this thread to run if construction fails.
-                m_thread = boost::thread(boost::bind(&CAdapterFactory::RunService, this));
+                m_thread = boost::thread(boost::bind(&CAdapterFactory::RunService,
+                                                     this, boost::ref(m_ios)));
+                for (std::size_t i = 0; i < m_pool.size(); i++) {
+                    m_poolThreads.create_thread(boost::bind(&CAdapterFactory::RunService,
+                                                            this, boost::ref(*m_pool[i])));
+                }
             }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -146,7 +179,7 @@ namespace freedm {
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
             CAdapterFactory &CAdapterFactory::Instance() {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 static CAdapterFactory instance;
                 return instance;
             }
@@ -155,27 +188,29 @@ namespace freedm {
 /// Runs the i/o service with an infinite workload.
 ///
 /// @pre None.
-/// @post Runs m_ios and blocks the calling thread.
+/// @post Runs ios and blocks the calling thread.
+/// @param ios The i/o service to run, m_ios or one of m_pool.
 ///
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-            void CAdapterFactory::RunService() {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+            void CAdapterFactory::RunService(boost::asio::io_service &ios) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-                boost::asio::io_service::work workload(m_ios);
+                boost::asio::io_service::work workload(ios);
+                CThreadPolicy::Instance().Apply("devices");
 
                 try {
-                    Logger.Status << "Starting the adapter i/o service." << std::endl;
-                    m_ios.run();
+                    LOG_STATUS(Logger) << "Starting the adapter i/o service." << std::endl;
+                    ios.run();
                 }
                 catch (std::exception &e) {
-                    Logger.Fatal << "Fatal exception in the device ioservice: "
+                    LOG_FATAL(Logger) << "Fatal exception in the device ioservice: "
                                  << e.what() << std::endl;
                     // The Broker will stop us.
                     raise(SIGTERM);
                 }
 
-                Logger.Status << "The adapter i/o service has stopped." << std::endl;
+                LOG_STATUS(Logger) << "The adapter i/o service has stopped." << std::endl;
             }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -190,7 +225,7 @@ namespace freedm {
 /// @limitations MUST be called from outside the devices thread.
 ///////////////////////////////////////////////////////////////////////////////
             void CAdapterFactory::Stop() {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 assert(boost::this_thread::get_id() != m_thread.get_id());
 
@@ -207,10 +242,14 @@ namespace freedm {
                     }
 
                     m_ios.stop();
+                    for (std::size_t i = 0; i < m_pool.size(); i++) {
+                        m_pool[i]->stop();
+                    }
                     m_thread.join();
+                    m_poolThreads.join_all();
                 }
                 catch (std::exception &e) {
-                    Logger.Error << "Caught exception when stopping AdapterFactory: "
+                    LOG_ERROR(Logger) << "Caught exception when stopping AdapterFactory: "
                                  << e.what() << std::endl;
                 }
             }
@@ -233,9 +272,30 @@ namespace freedm {
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
             void CAdapterFactory::CreateAdapter(const boost::property_tree::ptree &p) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-                boost::property_tree::ptree subtree;
+                CreateAdapter(p, CTcpServer::Connection());
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Creates a new adapter as CAdapterFactory::CreateAdapter does.  A plug and
+/// play adapter takes over the connection of the client that sent its hello.
+///
+/// @ErrorHandling Throws an EDgiConfigError if the property tree is bad, or
+/// specifies a plug and play adapter without a client.
+/// @pre The adapter's devices must not be specified in other adapters.
+/// @post Starts the adapter through IAdapter::Start.
+/// @param p The property tree that specifies a single adapter.
+/// @param client The connection of a plug and play client, or null.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            void CAdapterFactory::CreateAdapter(const boost::property_tree::ptree &p,
+                                                CTcpServer::Connection client) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                boost::property_tree::ptree subtree, generated;
+                const boost::property_tree::ptree *spec = &p;
                 IAdapter::Pointer adapter;
                 std::string name, type;
 
@@ -250,7 +310,7 @@ namespace freedm {
                                           + std::string(e.what()));
                 }
 
-                Logger.Debug << "Building " << type << " adapter " << name << std::endl;
+                LOG_DEBUG(Logger) << "Building " << type << " adapter " << name << std::endl;
 
                 // range check the properties
                 if (name.empty()) {
@@ -262,26 +322,114 @@ namespace freedm {
                 // create the adapter
                 // FIXME - use plugins or something, this sucks
                 if (type == "rtds") {
-                   adapter = CRtdsAdapter::Create(m_ios, subtree);
+                   adapter = CRtdsAdapter::Create(GetService(p), subtree);
                 } else if (type == "pnp") {
-                    adapter = CPnpAdapter::Create(m_ios, subtree, m_server->GetClient());
+                    if (!client) {
+                        throw EDgiConfigError("Plug and play adapters need a client.");
+                    }
+                    adapter = CPnpAdapter::Create(m_ios, subtree, client);
                 } else if (type == "fake") {
                     adapter = CFakeAdapter::Create();
                 } else if (type == "opendss") {
-                    adapter = COpenDssAdapter::Create(m_ios, subtree);
+                    adapter = COpenDssAdapter::Create(GetService(p), subtree);
+                } else if (type == "dss") {
+                    adapter = CDssDirectAdapter::Create(GetService(p), subtree);
+                } else if (type == "shm") {
+                    adapter = CSharedMemoryAdapter::Create(GetService(p), subtree);
+                } else if (type == "synthetic") {
+                    adapter = CSyntheticAdapter::Create(GetService(p), subtree);
+                    generated = GenerateDevices(p,
+                            boost::dynamic_pointer_cast<CSyntheticAdapter>(adapter));
+                    spec = &generated;
+                } else if (type == "replay") {
+                    adapter = CReplayAdapter::Create(GetService(p), subtree);
                 } else {
                     throw EDgiConfigError("Unregistered adapter type: " + type);
                 }
 
+                IBufferAdapter::Pointer buffer =
+                        boost::dynamic_pointer_cast<IBufferAdapter>(adapter);
+                if (buffer) {
+                    buffer->SetMetricsName(name);
+                }
+
+                std::string cycle = p.get<std::string>("<xmlattr>.cycle", "delay");
+                if (cycle != "delay" && cycle != "fixed") {
+                    throw EDgiConfigError("Unknown adapter cycle: " + cycle);
+                }
+                if (cycle == "fixed") {
+                    if (!buffer) {
+                        throw EDgiConfigError("The " + type
+                                              + " adapter " + name + " cannot run at a fixed rate.");
+                    }
+                    buffer->SetFixedRate(true);
+                }
+
+                if (p.get_child_optional("<xmlattr>.history")) {
+                    if (!buffer) {
+                        throw EDgiConfigError("The " + type
+                                              + " adapter " + name + " cannot keep a history.");
+                    }
+                    try {
+                        buffer->SetHistoryCapacity(p.get<std::size_t>("<xmlattr>.history"));
+                    }
+                    catch (std::exception &e) {
+                        throw EDgiConfigError("Bad adapter history: " + std::string(e.what()));
+                    }
+                }
+
                 // store the adapter; note that InitializeAdapter can throw EBadRequest
-                InitializeAdapter(adapter, p);
+                InitializeAdapter(adapter, *spec);
                 m_adapters[name] = adapter;
-                Logger.Info << "Created the " << type << " adapter " << name << std::endl;
+                LOG_INFO(Logger) << "Created the " << type << " adapter " << name << std::endl;
 
                 // signal construction complete
                 adapter->Start();
             }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Picks the i/o service that runs a configured adapter.  Thread 0 is the
+/// thread of m_ios, and thread i > 0 runs m_pool[i-1].  An adapter without a
+/// thread attribute gets the next extra i/o service in turn, or m_ios when
+/// there is only one device thread.
+///
+/// @ErrorHandling Throws an EDgiConfigError if the thread attribute is not a
+/// device thread.
+/// @pre None.
+/// @post Advances m_nextService for an unpinned adapter.
+/// @param p The property tree that specifies a single adapter.
+/// @return The i/o service the adapter should be created on.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            boost::asio::io_service &CAdapterFactory::GetService(
+                    const boost::property_tree::ptree &p) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                std::size_t thread;
+
+                if (!p.get_child_optional("<xmlattr>.thread")) {
+                    if (m_pool.empty()) {
+                        return m_ios;
+                    }
+                    return *m_pool[m_nextService++ % m_pool.size()];
+                }
+
+                try {
+                    thread = p.get<std::size_t>("<xmlattr>.thread");
+                }
+                catch (std::exception &e) {
+                    throw EDgiConfigError("Bad adapter thread: " + std::string(e.what()));
+                }
+
+                if (thread > m_pool.size()) {
+                    throw EDgiConfigError("Adapter thread "
+                                          + boost::lexical_cast<std::string>(thread)
+                                          + " exceeds the device threads.");
+                }
+                return thread == 0 ? m_ios : *m_pool[thread - 1];
+            }
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Removes an adapter and all of its associated devices.
 ///
@@ -294,7 +442,7 @@ namespace freedm {
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
             void CAdapterFactory::RemoveAdapter(const std::string identifier) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 std::set<std::string> devices;
 
@@ -306,11 +454,9 @@ namespace freedm {
 
                 m_adapters[identifier]->Stop();
                 m_adapters.erase(identifier);
-                Logger.Info << "Removed the adapter: " << identifier << std::endl;
+                LOG_INFO(Logger) << "Removed the adapter: " << identifier << std::endl;
 
-                BOOST_FOREACH(std::string device, devices) {
-                                CDeviceManager::Instance().RemoveDevice(device);
-                            }
+                CDeviceManager::Instance().RemoveDevices(devices);
             }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -321,6 +467,7 @@ namespace freedm {
 /// CPnpAdapter and the Hello message assigns an unexpected signal to a device.
 /// @pre The property tree must contain an adapter specification.
 /// @post Associates a set of device signals with the passed adapter.
+/// @post Stores the devices of the adapter as hidden devices in one batch.
 /// @param adapter The adapter to initialize.
 /// @param p The property tree that contains the buffer data.
 ///
@@ -328,13 +475,15 @@ namespace freedm {
 ////////////////////////////////////////////////////////////////////////////////
             void CAdapterFactory::InitializeAdapter(IAdapter::Pointer adapter,
                                                     const boost::property_tree::ptree &p) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 boost::property_tree::ptree subtree;
                 boost::optional<SignalValue> value;
                 CDevice::Pointer device;
 
                 std::map<std::string, std::string> devtype;
+                std::map<std::string, CDevice::Pointer> created;
+                std::vector<CDevice::Pointer> devices;
                 std::map<std::string, unsigned int> states;
                 std::map<std::string, unsigned int> commands;
                 std::map<std::string, unsigned int>::iterator it;
@@ -360,7 +509,7 @@ namespace freedm {
                 // i = 0 parses state information
                 // i = 1 parses command information
                 for (int i = 0; i < 2; i++) {
-                    Logger.Debug << "Reading the " << (i == 0 ? "state" : "command")
+                    LOG_DEBUG(Logger) << "Reading the " << (i == 0 ? "state" : "command")
                                  << " property tree specification." << std::endl;
 
                     try {
@@ -391,12 +540,13 @@ namespace freedm {
                                                               + std::string(e.what()));
                                     }
 
-                                    Logger.Debug << "At index " << index << " for the device signal ("
+                                    LOG_DEBUG(Logger) << "At index " << index << " for the device signal ("
                                                  << name << "," << signal << ")." << std::endl;
 
                                     // create the device when first seen
                                     if (devtype.count(name) == 0) {
-                                        CreateDevice(name, type, adapter);
+                                        created[name] = CreateDevice(name, type, adapter);
+                                        devices.push_back(created[name]);
                                         adapter->RegisterDevice(name);
                                         devtype[name] = type;
                                         states[name] = 0;
@@ -410,7 +560,7 @@ namespace freedm {
                                     }
 
                                     // check if the device recognizes the associated signal
-                                    device = CDeviceManager::Instance().m_hidden_devices.at(name);
+                                    device = created[name];
 
                                     if (i == 0 && device->HasState(signal)) {
                                         ++states[name];
@@ -428,10 +578,10 @@ namespace freedm {
                                     }
 
                                     if (buffer && i == 0) {
-                                        Logger.Debug << "Registering state info." << std::endl;
+                                        LOG_DEBUG(Logger) << "Registering state info." << std::endl;
                                         buffer->RegisterStateInfo(name, signal, index);
                                     } else if (buffer && i == 1) {
-                                        Logger.Debug << "Registering command info." << std::endl;
+                                        LOG_DEBUG(Logger) << "Registering command info." << std::endl;
                                         buffer->RegisterCommandInfo(name, signal, index);
                                     } else if (fake && value) {
                                         SignalValue oldval = fake->GetState(name, signal);
@@ -445,7 +595,7 @@ namespace freedm {
 
                 for (it = states.begin(); it != states.end(); it++)
                 {
-                    device = CDeviceManager::Instance().m_hidden_devices.at(it->first);
+                    device = created[it->first];
 
                     if (device->GetStateSet().size() != it->second) {
                         std::string what = "Failed to create adapter: The device "
@@ -459,7 +609,7 @@ namespace freedm {
                 }
                 for (it = commands.begin(); it != commands.end(); it++)
                 {
-                    device = CDeviceManager::Instance().m_hidden_devices.at(it->first);
+                    device = created[it->first];
 
                     if (device->GetCommandSet().size() != it->second) {
                         std::string what = "Failed to create adapter: The device "
@@ -472,26 +622,107 @@ namespace freedm {
                     }
                 }
 
-                Logger.Debug << "Initialized the device adapter." << std::endl;
+                // the whole adapter is stored with one lock of the manager
+                CDeviceManager::Instance().AddDevices(devices);
+                LOG_DEBUG(Logger) << "Initialized the device adapter." << std::endl;
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Builds the state and command tags of a synthetic adapter.  Each generate
+/// tag of the adapter asks for count devices of a type, which are named with
+/// the prefix of the tag, or the type, and a number from 1 to count.  Every
+/// state and command of the type gets the next entry of the state and command
+/// tags, and the position of the device within its tag sets its phase.
+///
+/// @ErrorHandling Throws an EDgiConfigError if the adapter lists its own state
+/// or command tags, or if a generate tag is bad or names an unknown type.
+/// @pre m_builder knows the generated device types.
+/// @post The generated devices are classified on the adapter.
+/// @param p The property tree that specifies the synthetic adapter.
+/// @param adapter The synthetic adapter created from p.
+/// @return A property tree with the state and command tags of the devices.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            boost::property_tree::ptree CAdapterFactory::GenerateDevices(
+                    const boost::property_tree::ptree &p,
+                    CSyntheticAdapter::Pointer adapter) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                boost::property_tree::ptree spec;
+                std::size_t states = 0, commands = 0;
+
+                if (p.count("state") > 0 || p.count("command") > 0) {
+                    throw EDgiConfigError("Synthetic adapters generate their own "
+                                          "state and command tags.");
+                }
+                spec.put_child("state", boost::property_tree::ptree());
+                spec.put_child("command", boost::property_tree::ptree());
+
+                BOOST_FOREACH(const boost::property_tree::ptree::value_type &child, p) {
+                                if (child.first != "generate") {
+                                    continue;
+                                }
+
+                                std::string type, prefix;
+                                unsigned int count;
+                                DeviceInfo info;
+
+                                try {
+                                    type = child.second.get<std::string>("type");
+                                    count = child.second.get<unsigned int>("count");
+                                    prefix = child.second.get<std::string>("prefix", type);
+                                    info = m_builder.GetDeviceInfo(type);
+                                }
+                                catch (std::exception &e) {
+                                    throw EDgiConfigError("Failed to generate devices: "
+                                                          + std::string(e.what()));
+                                }
+
+                                for (unsigned int i = 0; i < count; i++) {
+                                    std::string name = prefix + boost::lexical_cast<std::string>(i + 1);
+                                    adapter->ClassifyDevice(name, type, double(i) / count);
+
+                                    for (int j = 0; j < 2; j++) {
+                                        const std::set<std::string> &signals =
+                                                (j == 0 ? info.s_state : info.s_command);
+                                        BOOST_FOREACH(const std::string &signal, signals) {
+                                                        boost::property_tree::ptree entry;
+                                                        entry.put("type", type);
+                                                        entry.put("device", name);
+                                                        entry.put("signal", signal);
+                                                        entry.put("<xmlattr>.index",
+                                                                  j == 0 ? ++states : ++commands);
+                                                        spec.add_child(j == 0 ? "state.entry" : "command.entry",
+                                                                       entry);
+                                                    }
+                                    }
+                                }
+                                LOG_INFO(Logger) << "Generated " << count << " " << type
+                                                 << " devices" << std::endl;
+                            }
+
+                return spec;
             }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Creates a new device and registers it with the device manager.
+/// Creates a new device. The device is not registered with the device
+/// manager, so the devices of an adapter can be added in one batch.
 ///
 /// @ErrorHandling Throws a std::runtime_error if the name is already in use,
 /// the type is not recognized, or the adapter is null.
 /// @pre Type must be registered with CAdapterFactory::RegisterDevicePrototype.
 /// @post Creates a new device using m_prototype[type].
-/// @post Adds the new device to the device manager.
 /// @param name The unique identifier for the device to be created.
 /// @param type The string identifier for the type of device to create.
 /// @param adapter The adapter that will handle the data of the new device.
+/// @return The new device.
 ///
 /// @limitations The device types must be registered prior to this call.
 ////////////////////////////////////////////////////////////////////////////////
-            void CAdapterFactory::CreateDevice(const std::string name,
+            CDevice::Pointer CAdapterFactory::CreateDevice(const std::string name,
                                                const std::string type, IAdapter::Pointer adapter) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 if (CDeviceManager::Instance().DeviceExists(name)) {
                     throw std::runtime_error("The device " + name + " already exists.");
@@ -502,9 +733,9 @@ namespace freedm {
                 }
 
                 CDevice::Pointer device = m_builder.CreateDevice(name, type, adapter);
-                CDeviceManager::Instance().AddDevice(device);
 
-                Logger.Info << "Created new device: " << name << std::endl;
+                LOG_INFO(Logger) << "Created new device: " << name << std::endl;
+                return device;
             }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -516,6 +747,7 @@ namespace freedm {
 /// initialized through a prior call to this function.
 /// @pre m_server must not be initialized by a prior call to this function.
 /// @post m_server is created to accept connections from plug and play devices.
+/// @post m_wheelTimer is started to check the plug and play heartbeats.
 ///
 /// @limitations This function must be called at most once.
 ////////////////////////////////////////////////////////////////////////////////
@@ -526,34 +758,50 @@ namespace freedm {
                     throw std::logic_error("Session protocol already started.");
                 } else {
                     // initialize the TCP variant of the session layer protocol
-                    handler = boost::bind(&CAdapterFactory::StartSession, this);
+                    handler = boost::bind(&CAdapterFactory::StartSession, this, _1);
                     m_server = CTcpServer::Create(m_ios, port,
-                                                  CGlobalConfiguration::Instance().GetDevicesEndpoint());
+                                                  CGlobalConfiguration::Instance().GetDevicesEndpoint(),
+                                                  CGlobalConfiguration::Instance().GetFactoryBacklog(),
+                                                  CGlobalConfiguration::Instance().GetFactoryAcceptors());
                     m_server->RegisterHandler(handler);
+
+                    unsigned int heartbeat = CTimings::Get(CTimings::DEV_PNP_HEARTBEAT);
+                    m_tickLength = std::max(1u, heartbeat / HEARTBEAT_WHEEL_RESOLUTION);
+                    m_heartbeatTicks = (heartbeat + m_tickLength - 1) / m_tickLength;
+                    m_wheel.resize(m_heartbeatTicks + 1);
+
+                    m_wheelTimer.expires_from_now(boost::posix_time::milliseconds(m_tickLength));
+                    m_wheelTimer.async_wait(boost::bind(&CAdapterFactory::TickWheel, this,
+                                                        boost::asio::placeholders::error));
                 }
             }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Prepares to read the hello message from a new plug and play device.
+/// Prepares to read the hello message from a new plug and play device.  Each
+/// client has its own handshake state, so new clients do not wait for the
+/// hello of the clients before them.
 ///
-/// @pre m_server must be connected to a remote endpoint.
-/// @post m_timeout is started to disconnect the device if it does not respond.
-/// @post Schedules a read into m_buffer from the current m_server connection.
+/// @pre client must be connected to a remote endpoint.
+/// @post A timer is started to disconnect the device if it does not respond.
+/// @post Schedules a read of the hello message from client.
+/// @param client The connection accepted by m_server.
 ///
 /// @limitations This function must only be called by m_server.
 ////////////////////////////////////////////////////////////////////////////////
-            void CAdapterFactory::StartSession() {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+            void CAdapterFactory::StartSession(CTcpServer::Connection client) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                LOG_NOTICE(Logger) << "A wild client appears!" << std::endl;
+                Handshake session(new SHandshake(client, m_ios));
 
-                Logger.Notice << "A wild client appears!" << std::endl;
-                m_timeout.expires_from_now(boost::posix_time::seconds(CTimings::Get("DEV_PNP_HEARTBEAT")));
-                m_timeout.async_wait(boost::bind(&CAdapterFactory::Timeout, this,
-                                                 boost::asio::placeholders::error));
+                session->timeout.expires_from_now(boost::posix_time::milliseconds(
+                        CTimings::Get(CTimings::DEV_PNP_HEARTBEAT)));
+                session->timeout.async_wait(boost::bind(&CAdapterFactory::Timeout, this,
+                                                        session, boost::asio::placeholders::error));
 
-                m_buffer.consume(m_buffer.size());
-                boost::asio::async_read_until(*m_server->GetClient(), m_buffer, "\r\n\r\n",
+                boost::asio::async_read_until(*client, session->buffer, "\r\n\r\n",
                                               boost::bind(&CAdapterFactory::HandleRead, this,
-                                                          boost::asio::placeholders::error));
+                                                          session, boost::asio::placeholders::error));
             }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -561,21 +809,25 @@ namespace freedm {
 ///
 /// @pre None.
 /// @post If a successful read, calls CAdapterFactory::SessionProtocol.
+/// @param session The handshake of the client that sent the packet.
 /// @param e The error code associated with the last read operation.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-            void CAdapterFactory::HandleRead(const boost::system::error_code &e) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+            void CAdapterFactory::HandleRead(Handshake session, const boost::system::error_code &e) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 if (!e) {
-                    if (m_timeout.cancel() == 1) {
-                        SessionProtocol();
+                    if (session->timeout.cancel() == 1) {
+                        SessionProtocol(session);
                     } else {
-                        Logger.Notice << "Dropped packet due to timeout." << std::endl;
+                        LOG_NOTICE(Logger) << "Dropped packet due to timeout." << std::endl;
                     }
                 } else if (e == boost::asio::error::operation_aborted) {
-                    Logger.Notice << "Controller failed to send valid Hello." << std::endl;
+                    LOG_NOTICE(Logger) << "Controller failed to send valid Hello." << std::endl;
+                } else {
+                    session->timeout.cancel();
+                    LOG_WARN(Logger) << "Connection closed: " << e.message() << std::endl;
                 }
             }
 
@@ -583,68 +835,94 @@ namespace freedm {
 /// Closes a plug and play connection if it does not send a well-formed packet.
 ///
 /// @pre None.
-/// @post If timeout or error, closes the current m_server connection.
+/// @post If timeout, tells the client and closes its connection.
+/// @param session The handshake of the client.
 /// @param e The error code associated with the timer.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-            void CAdapterFactory::Timeout(const boost::system::error_code &e) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+            void CAdapterFactory::Timeout(Handshake session, const boost::system::error_code &e) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 if (!e) {
-                    Logger.Notice << "Connection closed due to timeout." << std::endl;
+                    LOG_NOTICE(Logger) << "Connection closed due to timeout." << std::endl;
 
-                    try {
-                        std::string msg;
-                        msg = "Error\r\nConnection closed due to timeout.\r\n\r\n";
-                        TimedWrite(*m_server->GetClient(), boost::asio::buffer(msg),
-                                   CTimings::Get("DEV_SOCKET_TIMEOUT"));
-                    }
-                    catch (std::exception &e) {
-                        Logger.Info << "Failed to tell client about timeout." << std::endl;
-                    }
+                    std::ostream response_stream(&session->response);
+                    response_stream << "Error\r\nConnection closed due to timeout.\r\n\r\n";
 
-                    m_server->GetClient()->cancel();
-                    m_server->StartAccept();
+                    session->client->cancel();
+                    boost::asio::async_write(*session->client, session->response,
+                                             boost::bind(&CAdapterFactory::HandleReply, this,
+                                                         session, boost::asio::placeholders::error));
                 } else if (e == boost::asio::error::operation_aborted) {
                     // Timeout was cancelled. Hopefully a good Hello was received!
                 } else {
-                    Logger.Warn << "Connection closed: " << e.message() << std::endl;
-                    m_server->GetClient()->cancel();
-                    m_server->StartAccept();
+                    LOG_WARN(Logger) << "Connection closed: " << e.message() << std::endl;
+                    session->client->cancel();
+                }
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Logs the outcome of the response to a session packet.  The connection
+/// closes when the last handler of the handshake returns, unless a plug and
+/// play adapter has taken it over.
+///
+/// @pre None.
+/// @post Logs a warning and closes the connection if the response could not
+/// be sent.
+/// @param session The handshake of the client.
+/// @param e The error code associated with the last write operation.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            void CAdapterFactory::HandleReply(Handshake session, const boost::system::error_code &e) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                if (e) {
+                    LOG_WARN(Logger) << "Failed to respond to client: " << e.message() << std::endl;
+
+                    boost::system::error_code ignored;
+                    session->client->close(ignored);
                 }
             }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Handles the hello message for the plug and play session protoocl.
 ///
-/// @pre m_buffer must contain the device hello packet.
+/// @pre The buffer of session must contain the device hello packet.
 /// @post If the packet is well-formed, creates a new adapter and responds to
 /// the plug and play connection with a start packet.
+/// @post A HelloBinary packet selects binary framing for the new adapter, and
+/// its start packet lists the state and command signals in index order.
+/// @post A HelloDelta packet lets the new adapter exchange delta packets.
 /// @post Otherwise, responds with a bad request that indicates the error.
+/// @param session The handshake of the client that sent the hello.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-            void CAdapterFactory::SessionProtocol() {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+            void CAdapterFactory::SessionProtocol(Handshake session) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-                std::istream packet(&m_buffer);
-                boost::asio::streambuf response;
-                std::ostream response_stream(&response);
+                std::istream packet(&session->buffer);
+                std::ostream response_stream(&session->response);
 
                 boost::property_tree::ptree config;
 
                 std::set<std::string> states, commands;
                 std::string host, header, type, name, entry;
+                std::stringstream slist, clist;
                 int sindex = 1, cindex = 1;
+                bool binary = false, delta = false;
 
                 try {
                     packet >> header >> host;
-                    Logger.Info << "Received " << header << " from " << host << std::endl;
+                    LOG_INFO(Logger) << "Received " << header << " from " << host << std::endl;
 
-                    if (header != "Hello") {
+                    if (header != "Hello" && header != "HelloBinary" && header != "HelloDelta") {
                         throw EBadRequest("Expected 'Hello' message: " + header);
                     }
+                    binary = (header == "HelloBinary");
+                    delta = (header == "HelloDelta");
                     if (m_adapters.count(host) > 0) {
                         throw EDuplicateSession("Duplicate session for " + host);
                     }
@@ -655,11 +933,13 @@ namespace freedm {
                     config.put("<xmlattr>.name", host);
                     config.put("<xmlattr>.type", "pnp");
                     config.put("info.identifier", host);
+                    config.put("info.binary", binary);
+                    config.put("info.delta", delta);
                     config.put("state", "");
                     config.put("command", "");
 
                     for (int i = 0; packet >> type >> name; i++) {
-                        Logger.Debug << "Processing " << type << ":" << name << std::endl;
+                        LOG_DEBUG(Logger) << "Processing " << type << ":" << name << std::endl;
 
                         try {
                             DeviceInfo info = m_builder.GetDeviceInfo(type);
@@ -670,12 +950,15 @@ namespace freedm {
                             throw EBadRequest("Unknown device type: " + type);
                         }
 
+                        // binary clients are told the index order by their own names
+                        entry = name;
                         name = host + ":" + name;
                         boost::replace_all(name, ".", ":");
-                        Logger.Debug << "Using adapter name " << name << std::endl;
+                        LOG_DEBUG(Logger) << "Using adapter name " << name << std::endl;
 
                         BOOST_FOREACH(std::string signal, states) {
-                                        Logger.Debug << "Adding state for " << signal << std::endl;
+                                        LOG_DEBUG(Logger) << "Adding state for " << signal << std::endl;
+                                        slist << "State " << entry << " " << signal << "\r\n";
 
                                         boost::property_tree::ptree temp;
                                         temp.put("type", type);
@@ -690,7 +973,8 @@ namespace freedm {
                                     }
 
                         BOOST_FOREACH(std::string signal, commands) {
-                                        Logger.Debug << "Adding command for " << signal << std::endl;
+                                        LOG_DEBUG(Logger) << "Adding command for " << signal << std::endl;
+                                        clist << "Command " << entry << " " << signal << "\r\n";
 
                                         boost::property_tree::ptree temp;
                                         temp.put("type", type);
@@ -709,7 +993,7 @@ namespace freedm {
 ////////////////////////////////////////////////////////////////////////////////
 
                     try {
-                        CreateAdapter(config);
+                        CreateAdapter(config, session->client);
                     }
                     catch (EDgiConfigError &e) {
                         throw std::logic_error("Caught EDgiConfigError from "
@@ -718,32 +1002,120 @@ namespace freedm {
                                                + std::string(e.what()));
                     }
 
-                    response_stream << "Start\r\n\r\n";
-                    Logger.Status << "Blocking to send Start to client" << std::endl;
+                    response_stream << "Start\r\n";
+                    if (binary) {
+                        response_stream << slist.str() << clist.str();
+                    }
+                    response_stream << "\r\n";
+                    LOG_STATUS(Logger) << "Sending Start to client" << std::endl;
                 }
                 catch (EBadRequest &e) {
-                    Logger.Warn << "Rejected client: " << e.what() << std::endl;
+                    LOG_WARN(Logger) << "Rejected client: " << e.what() << std::endl;
 
                     response_stream << "BadRequest\r\n";
                     response_stream << e.what() << "\r\n\r\n";
 
-                    Logger.Status << "Blocking to send BadRequest to client" << std::endl;
+                    LOG_STATUS(Logger) << "Sending BadRequest to client" << std::endl;
                 }
                 catch (std::exception &e) {
-                    Logger.Warn << "Rejected client: " << e.what() << std::endl;
+                    LOG_WARN(Logger) << "Rejected client: " << e.what() << std::endl;
                     response_stream << "Error\r\n" << e.what() << "\r\n\r\n";
-                    Logger.Status << "Blocking to send Error to client" << std::endl;
+                    LOG_STATUS(Logger) << "Sending Error to client" << std::endl;
                 }
 
-                try {
-                    TimedWrite(*m_server->GetClient(), response,
-                               CTimings::Get("DEV_SOCKET_TIMEOUT"));
+                boost::asio::async_write(*session->client, session->response,
+                                         boost::bind(&CAdapterFactory::HandleReply, this,
+                                                     session, boost::asio::placeholders::error));
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the wheel tick at which a heartbeat given now expires.
+///
+/// @pre None.
+/// @post None.
+/// @return The tick after which an adapter without a newer heartbeat expires.
+///
+/// @limitations Must be called from the thread of m_ios.
+////////////////////////////////////////////////////////////////////////////////
+            boost::uint64_t CAdapterFactory::GetHeartbeatDeadline() const {
+                return m_tick + m_heartbeatTicks;
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Files a plug and play adapter in the heartbeat wheel.  The wheel holds a
+/// weak pointer, so it never keeps a removed adapter alive.
+///
+/// @pre The heartbeat deadline of the adapter must be set.
+/// @post The adapter is filed in the slot of its deadline.
+/// @param adapter The adapter whose heartbeat is checked.
+///
+/// @limitations Must be called from the thread of m_ios.
+////////////////////////////////////////////////////////////////////////////////
+            void CAdapterFactory::WatchHeartbeat(boost::shared_ptr<CPnpAdapter> adapter) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                if (m_wheel.empty()) {
+                    throw std::logic_error("Session protocol not started.");
                 }
-                catch (std::exception &e) {
-                    Logger.Warn << "Failed to respond to client: " << e.what() << std::endl;
+                m_wheel[adapter->m_deadline % m_wheel.size()].push_back(adapter);
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Advances the heartbeat wheel by one tick.  The adapters in the slot of the
+/// new tick either expire or, if a heartbeat moved their deadline since they
+/// were filed, move to the slot of their new deadline.  An adapter therefore
+/// expires between DEV_PNP_HEARTBEAT and one tick later after its last
+/// heartbeat.
+///
+/// @pre None.
+/// @post Calls CPnpAdapter::Timeout for every expired adapter in the slot.
+/// @post Schedules the next tick unless the timer was canceled.
+/// @param e The error code associated with the timer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            void CAdapterFactory::TickWheel(const boost::system::error_code &e) {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                if (e) {
+                    return;
+                }
+
+                m_tick++;
+
+                std::list<boost::weak_ptr<CPnpAdapter> > &slot = m_wheel[m_tick % m_wheel.size()];
+                std::list<boost::weak_ptr<CPnpAdapter> > expired;
+                std::list<boost::weak_ptr<CPnpAdapter> >::iterator it = slot.begin();
+
+                while (it != slot.end()) {
+                    boost::shared_ptr<CPnpAdapter> adapter = it->lock();
+                    std::list<boost::weak_ptr<CPnpAdapter> >::iterator next = it;
+                    next++;
+
+                    if (!adapter) {
+                        slot.erase(it);
+                    } else if (adapter->m_deadline <= m_tick) {
+                        expired.splice(expired.end(), slot, it);
+                    } else {
+                        std::list<boost::weak_ptr<CPnpAdapter> > &later =
+                                m_wheel[adapter->m_deadline % m_wheel.size()];
+                        later.splice(later.end(), slot, it);
+                    }
+                    it = next;
                 }
 
-                m_server->StartAccept();
+                m_wheelTimer.expires_at(m_wheelTimer.expires_at()
+                                        + boost::posix_time::milliseconds(m_tickLength));
+                m_wheelTimer.async_wait(boost::bind(&CAdapterFactory::TickWheel, this,
+                                                    boost::asio::placeholders::error));
+
+                // Timeout removes adapters, so it runs after the wheel is consistent
+                BOOST_FOREACH(boost::weak_ptr<CPnpAdapter> entry, expired) {
+                                boost::shared_ptr<CPnpAdapter> adapter = entry.lock();
+                                if (adapter) {
+                                    adapter->Timeout();
+                                }
+                            }
             }
 
         } // namespace device
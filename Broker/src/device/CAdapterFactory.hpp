@@ -29,13 +29,18 @@
 #include "CDeviceBuilder.hpp"
 
 #include <map>
+#include <list>
 #include <set>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <stdexcept>
 
 #include <boost/thread.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/deadline_timer.hpp>
@@ -45,10 +50,25 @@ namespace freedm {
 namespace broker {
 namespace device {
 
+class CPnpAdapter;
+class CSyntheticAdapter;
+
 /// Handles the creation of adapters and their associated devices.
 ////////////////////////////////////////////////////////////////////////////////
 /// Singleton factory that creates, stores, and runs new device adapters.
 ///
+/// The plug and play sessions run on m_ios. With device-threads greater than
+/// one, the configured adapters are spread over a pool of i/o services with
+/// one thread each, so a blocked adapter only stalls the adapters that share
+/// its thread. An adapter is pinned to a thread with its thread attribute.
+///
+/// The plug and play heartbeats share one timer wheel. A heartbeat only moves
+/// the deadline of its adapter, and each tick of m_wheelTimer checks the
+/// adapters filed in a single slot of m_wheel.
+///
+/// Each plug and play client gets its own SHandshake, so any number of hello
+/// messages can be pending at once.
+///
 /// @limitations This class is not thread safe.
 ////////////////////////////////////////////////////////////////////////////////
 class CAdapterFactory
@@ -69,32 +89,78 @@ public:
 
     /// Stop everything!
     void Stop();
+
+    /// Gets the wheel tick at which a heartbeat given now expires.
+    boost::uint64_t GetHeartbeatDeadline() const;
+
+    /// Starts to check the heartbeat of a plug and play adapter.
+    void WatchHeartbeat(boost::shared_ptr<CPnpAdapter> adapter);
 private:
+    /// State of one plug and play client that has not been answered yet.
+    struct SHandshake
+    {
+        /// Constructs the state of a new client.
+        SHandshake(CTcpServer::Connection c, boost::asio::io_service & ios)
+            : client(c), timeout(ios) {}
+
+        /// Socket of the client.
+        CTcpServer::Connection client;
+
+        /// Hello packet received from the client.
+        boost::asio::streambuf buffer;
+
+        /// Response sent to the client.
+        boost::asio::streambuf response;
+
+        /// Timer that drops the client if the hello does not arrive.
+        boost::asio::deadline_timer timeout;
+    };
+
+    /// Convenience type for a shared pointer to a handshake.
+    typedef boost::shared_ptr<SHandshake> Handshake;
+
     /// Constructs the factory.
     CAdapterFactory();
 
-    /// Runs the adapter i/o service.
-    void RunService();
+    /// Creates a new adapter, using client for a plug and play adapter.
+    void CreateAdapter(const boost::property_tree::ptree & p,
+            CTcpServer::Connection client);
 
-    /// Clones a device prototype and registers it with the system.
-    void CreateDevice(const std::string name, const std::string type,
+    /// Runs an adapter i/o service.
+    void RunService(boost::asio::io_service & ios);
+
+    /// Picks the i/o service of a configured adapter.
+    boost::asio::io_service & GetService(const boost::property_tree::ptree & p);
+
+    /// Clones a device prototype for the adapter to register.
+    CDevice::Pointer CreateDevice(const std::string name, const std::string type,
             IAdapter::Pointer adapter);
 
     /// Initializes the devices stored on an adapter.
     void InitializeAdapter(IAdapter::Pointer adapter,
             const boost::property_tree::ptree & p);
 
+    /// Builds the device specification of a synthetic adapter.
+    boost::property_tree::ptree GenerateDevices(const boost::property_tree::ptree & p,
+            boost::shared_ptr<CSyntheticAdapter> adapter);
+
     /// Session layer protocol for plug-and-play devices.
-    void SessionProtocol();
+    void SessionProtocol(Handshake session);
 
     /// Handles one plug and play device session.
-    void StartSession();
+    void StartSession(CTcpServer::Connection client);
 
     /// Handles plug and play devices that send a session packet.
-    void HandleRead(const boost::system::error_code & e);
+    void HandleRead(Handshake session, const boost::system::error_code & e);
 
     /// Disconnects plug and play devices that timeout.
-    void Timeout(const boost::system::error_code & e);
+    void Timeout(Handshake session, const boost::system::error_code & e);
+
+    /// Handles when the response to a session packet has been sent.
+    void HandleReply(Handshake session, const boost::system::error_code & e);
+
+    /// Advances the heartbeat wheel by one tick.
+    void TickWheel(const boost::system::error_code & e);
 
     /// Set of device adapters managed by the factory.
     std::map<std::string, IAdapter::Pointer> m_adapters;
@@ -108,11 +174,29 @@ private:
     /// Thread for the adapter i/o service.
     boost::thread m_thread;
 
-    /// Packet received from plug and play device.
-    boost::asio::streambuf m_buffer;
+    /// Extra i/o services that each run on a thread of m_poolThreads.
+    std::vector<boost::shared_ptr<boost::asio::io_service> > m_pool;
+
+    /// Threads for the extra i/o services.
+    boost::thread_group m_poolThreads;
+
+    /// Index of the extra i/o service given to the next unpinned adapter.
+    std::size_t m_nextService;
+
+    /// Timer that advances the heartbeat wheel.
+    boost::asio::deadline_timer m_wheelTimer;
+
+    /// Plug and play adapters filed by heartbeat deadline, one slot per tick.
+    std::vector<std::list<boost::weak_ptr<CPnpAdapter> > > m_wheel;
+
+    /// Number of wheel ticks since the session protocol started.
+    boost::uint64_t m_tick;
+
+    /// Length of a wheel tick in milliseconds.
+    unsigned int m_tickLength;
 
-    /// Timer for bad plug and play sessions.
-    boost::asio::deadline_timer m_timeout;
+    /// Number of wheel ticks a heartbeat keeps an adapter alive.
+    unsigned int m_heartbeatTicks;
 
     /// Constructs the structure of devices.
     CDeviceBuilder m_builder;
@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CControlLoop.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Measures the time from a device state to the commands it
+///               led to.
+///
+/// @functions
+///     SControlStamp::Merge
+///     CControlLoop::CScope::CScope
+///     CControlLoop::CScope::~CScope
+///     CControlLoop::Observe
+///     CControlLoop::Current
+///     CControlLoop::Path
+///     CControlLoop::Deliver
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CControlLoop.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+namespace {
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The scope open on a thread.
+struct SContext
+{
+    SContext() : active(false) { }
+    /// The control path of the scope.
+    std::string path;
+    /// The oldest state table read within the scope.
+    SControlStamp stamp;
+    /// True while a scope is open.
+    bool active;
+};
+
+/// The scope of each thread, created by its first scope.
+boost::thread_specific_ptr<SContext> g_context;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Keeps the older of two stamps, or the one that is set.
+///
+/// @pre None.
+/// @post This stamp names the older publish of the two.
+/// @param other The stamp to merge into this one.
+////////////////////////////////////////////////////////////////////////////////
+void SControlStamp::Merge(const SControlStamp & other)
+{
+    if( other.IsSet() && (!IsSet() || other.published < published) )
+    {
+        *this = other;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Opens a scope for a control path on the calling thread.  The scope that
+/// was open before is saved and comes back when this one closes, so a scope
+/// can be opened to collect the stamps of a few reads on their own.  A
+/// command should be written in the scope that read the states behind it.
+///
+/// @pre None.
+/// @post The states read on this thread are merged into this scope.
+/// @param path The control path the decision belongs to.
+////////////////////////////////////////////////////////////////////////////////
+CControlLoop::CScope::CScope(const std::string & path)
+{
+    if( g_context.get() == 0 )
+    {
+        g_context.reset(new SContext());
+    }
+    SContext & context = *g_context;
+    m_path.swap(context.path);
+    m_stamp = context.stamp;
+    m_active = context.active;
+    context.path = path;
+    context.stamp = SControlStamp();
+    context.active = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Closes the scope and opens the one it replaced again.  The states read
+/// within this scope were read for the outer scope as well.
+///
+/// @pre The scope is the innermost one of its thread.
+/// @post The scope open before this one collects the stamps again, and
+///     holds the older of its stamp and the stamp of this scope.
+////////////////////////////////////////////////////////////////////////////////
+CControlLoop::CScope::~CScope()
+{
+    SContext & context = *g_context;
+    context.path.swap(m_path);
+    m_stamp.Merge(context.stamp);
+    context.stamp = m_stamp;
+    context.active = m_active;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Notes that the calling thread read a state table with the given stamp.
+///
+/// @pre None.
+/// @post The open scope holds the older of its stamp and the given one.
+/// @param stamp The stamp of the state table that was read.
+////////////////////////////////////////////////////////////////////////////////
+void CControlLoop::Observe(const SControlStamp & stamp)
+{
+    SContext * context = g_context.get();
+    if( context != 0 && context->active )
+    {
+        context->stamp.Merge(stamp);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the stamp of the oldest state table read within the open scope.
+///
+/// @pre None.
+/// @post None.
+/// @return The stamp, which is not set outside a scope or before a read.
+////////////////////////////////////////////////////////////////////////////////
+SControlStamp CControlLoop::Current()
+{
+    SContext * context = g_context.get();
+    if( context == 0 || !context->active )
+    {
+        return SControlStamp();
+    }
+    return context->stamp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the control path of the scope open on the calling thread.
+///
+/// @pre None.
+/// @post None.
+/// @return The path, or an empty string outside a scope.
+////////////////////////////////////////////////////////////////////////////////
+std::string CControlLoop::Path()
+{
+    SContext * context = g_context.get();
+    if( context == 0 || !context->active )
+    {
+        return std::string();
+    }
+    return context->path;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Records the time from the publish of a state table to now, when the
+/// commands decided from it leave the DGI.
+///
+/// @pre None.
+/// @post The latency is added to the histogram of the path, unless the path
+///     is empty or the stamp is not set.
+/// @param path The control path that decided the commands.
+/// @param stamp The oldest state table the decision read.
+////////////////////////////////////////////////////////////////////////////////
+void CControlLoop::Deliver(const std::string & path, const SControlStamp & stamp)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( path.empty() || !stamp.IsSet() )
+    {
+        return;
+    }
+
+    boost::posix_time::time_duration latency =
+            boost::posix_time::microsec_clock::universal_time() - stamp.published;
+    LOG_DEBUG(Logger) << "Commands of " << path << " left " << latency
+            << " after state table " << stamp.sequence << std::endl;
+    CMetrics::Instance().GetHistogram("dgi_control_loop_seconds",
+            "Times from a published device state to the commands decided from it, by control path",
+            CMetrics::Label("path", path)).Observe(latency.total_microseconds() / 1e6);
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CControlLoop.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Measures the time from a device state to the commands it
+///               led to.
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_CONTROL_LOOP_HPP
+#define C_CONTROL_LOOP_HPP
+
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// The publish of a state table that a control decision read.
+struct SControlStamp
+{
+    /// Creates a stamp of no publish.
+    SControlStamp() : sequence(0) { }
+
+    /// True if the stamp names a publish.
+    bool IsSet() const { return !published.is_not_a_date_time(); }
+
+    /// Keeps the older of this stamp and another.
+    void Merge(const SControlStamp & other);
+
+    /// The number of the publish within its adapter.
+    unsigned long sequence;
+
+    /// The universal time of the publish.
+    boost::posix_time::ptime published;
+};
+
+/// Times the control loop from the states a module read to its commands.
+////////////////////////////////////////////////////////////////////////////////
+/// Each buffer adapter stamps the state tables it publishes.  A module opens
+/// a CScope named after its control path around a decision, and every state
+/// read on that thread within the scope merges the stamp of its table into
+/// the scope, so the scope holds the oldest state the decision is based on.
+/// A command written through a buffer adapter within the scope carries that
+/// stamp until the adapter sends its command table, and Deliver then records
+/// the time since the state was published in the dgi_control_loop_seconds
+/// histogram of the path.  A module that sends its commands elsewhere, or
+/// from another thread, keeps Current and calls Deliver itself.
+///
+/// @limitations Only the adapters that use state buffers stamp their states.
+////////////////////////////////////////////////////////////////////////////////
+class CControlLoop
+    : private boost::noncopyable
+{
+public:
+    /// Marks a decision of a control path on the calling thread.
+    class CScope
+        : private boost::noncopyable
+    {
+    public:
+        /// Starts collecting the stamps of the states read.
+        explicit CScope(const std::string & path);
+
+        /// Restores the scope that was open before.
+        ~CScope();
+    private:
+        /// The path of the scope this one replaced.
+        std::string m_path;
+
+        /// The stamp of the scope this one replaced.
+        SControlStamp m_stamp;
+
+        /// True if a scope was open before this one.
+        bool m_active;
+    };
+
+    /// Merges the stamp of a state table into the open scope, if any.
+    static void Observe(const SControlStamp & stamp);
+
+    /// Gets the oldest state table read within the open scope.
+    static SControlStamp Current();
+
+    /// Gets the control path of the open scope, empty outside a scope.
+    static std::string Path();
+
+    /// Records the latency of commands of a path that leave now.
+    static void Deliver(const std::string & path, const SControlStamp & stamp);
+};
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // C_CONTROL_LOOP_HPP
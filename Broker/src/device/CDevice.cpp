@@ -8,15 +8,26 @@
 /// @description  Defines the interface for physical devices.
 ///
 /// @functions
+///     CDeviceType::CDeviceType
+///     CDeviceType::FindSlot
+///     CDeviceType::GetStateSlot
+///     CDeviceType::GetCommandSlot
+///     CDeviceType::GetStateName
+///     CDeviceType::GetCommandName
 ///     CDevice::CDevice
 ///     CDevice::GetID
 ///     CDevice::HasType
 ///     CDevice::HasState
 ///     CDevice::HasCommand
 ///     CDevice::GetState
+///     CDevice::GetStateHandle
+///     CDevice::GetHistory
+///     CDevice::GetTrend
+///     CDevice::GetTypeSet
 ///     CDevice::GetStateSet
 ///     CDevice::GetCommandSet
 ///     CDevice::SetCommand
+///     CDevice::GetCommandHandle
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -33,6 +44,10 @@
 
 #include "CDevice.hpp"
 #include "CLogger.hpp"
+#include "IBufferAdapter.hpp"
+
+#include <algorithm>
+#include <stdexcept>
 
 namespace freedm {
 namespace broker {
@@ -78,7 +93,136 @@ std::ostream & operator<<(std::ostream & os, const DeviceInfo & info)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Constructor for device objects.
+/// Builds the signal tables of a device type.  The sets of the structure are
+/// already in name order, which becomes the slot order.
+///
+/// @pre None.
+/// @post Constructs a device type.
+/// @param info The structure of the devices of the type.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+const std::size_t CDeviceType::NO_SLOT;
+
+CDeviceType::CDeviceType(const DeviceInfo & info)
+    : m_info(info)
+    , m_states(info.s_state.begin(), info.s_state.end())
+    , m_commands(info.s_command.begin(), info.s_command.end())
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Finds the slot of a signal in a table sorted by name.
+///
+/// @pre table is sorted.
+/// @post None.
+/// @param table The signals of the type in slot order.
+/// @param signal The string identifier of the signal.
+/// @return The slot of the signal, or NO_SLOT if it is not in the table.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+std::size_t CDeviceType::FindSlot(const std::vector<std::string> & table,
+        const std::string & signal)
+{
+    std::vector<std::string>::const_iterator it =
+            std::lower_bound(table.begin(), table.end(), signal);
+
+    if( it == table.end() || *it != signal )
+    {
+        return NO_SLOT;
+    }
+    return it - table.begin();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the slot of a state signal.
+///
+/// @pre None.
+/// @post None.
+/// @param signal The string identifier of some state signal.
+/// @return The slot of the signal, or NO_SLOT if the type does not have it.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+std::size_t CDeviceType::GetStateSlot(const std::string & signal) const
+{
+    return FindSlot(m_states, signal);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the slot of a command signal.
+///
+/// @pre None.
+/// @post None.
+/// @param signal The string identifier of some command signal.
+/// @return The slot of the signal, or NO_SLOT if the type does not have it.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+std::size_t CDeviceType::GetCommandSlot(const std::string & signal) const
+{
+    return FindSlot(m_commands, signal);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the name of the state signal in a slot.
+///
+/// @ErrorHandling Throws a std::out_of_range if the slot is invalid.
+/// @pre None.
+/// @post None.
+/// @param slot A slot returned by GetStateSlot.
+/// @return The string identifier of the state signal.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+const std::string & CDeviceType::GetStateName(std::size_t slot) const
+{
+    return m_states.at(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the name of the command signal in a slot.
+///
+/// @ErrorHandling Throws a std::out_of_range if the slot is invalid.
+/// @pre None.
+/// @post None.
+/// @param slot A slot returned by GetCommandSlot.
+/// @return The string identifier of the command signal.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+const std::string & CDeviceType::GetCommandName(std::size_t slot) const
+{
+    return m_commands.at(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor for device objects of a shared type.
+///
+/// @pre The adapter must be configured to store the new device object.
+/// @post Constructs a device object.
+/// @param id The unique identifier for this device object.
+/// @param type The shared structure of the devices of this type.
+/// @param adapter The adapter that handles storage for this device object.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+CDevice::CDevice(const std::string & id, CDeviceType::Pointer type,
+        IAdapter::Pointer adapter)
+    : m_devid(id)
+    , m_type(type)
+    , m_adapter(adapter)
+    , m_buffer(boost::dynamic_pointer_cast<IBufferAdapter>(adapter))
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_STATUS(Logger) << "CREATED NEW DEVICE:\n" << m_devid << "\n"
+            << m_type->GetInfo() << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor for device objects with a structure of their own.
 ///
 /// @pre The adapter must be configured to store the new device object.
 /// @post Constructs a device object.
@@ -88,13 +232,15 @@ std::ostream & operator<<(std::ostream & os, const DeviceInfo & info)
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-CDevice::CDevice(std::string id, DeviceInfo info, IAdapter::Pointer adapter)
+CDevice::CDevice(const std::string & id, const DeviceInfo & info,
+        IAdapter::Pointer adapter)
     : m_devid(id)
-    , m_devinfo(info)
+    , m_type(new CDeviceType(info))
     , m_adapter(adapter)
+    , m_buffer(boost::dynamic_pointer_cast<IBufferAdapter>(adapter))
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Status << "CREATED NEW DEVICE:\n" << m_devid << "\n" << m_devinfo
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_STATUS(Logger) << "CREATED NEW DEVICE:\n" << m_devid << "\n" << info
             << std::endl;
 }
 
@@ -109,7 +255,7 @@ CDevice::CDevice(std::string id, DeviceInfo info, IAdapter::Pointer adapter)
 ////////////////////////////////////////////////////////////////////////////////
 std::string CDevice::GetID() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return m_devid;
 }
 
@@ -117,48 +263,48 @@ std::string CDevice::GetID() const
 /// Checks if the device can be used as a specific type.
 ///
 /// @pre None.
-/// @post Returns true if m_devinfo.s_type contains the passed value.
+/// @post Returns true if the types of m_type contain the passed value.
 /// @param type The string identifier of some device type.
 /// @return True if this device can be used as the specified type.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-bool CDevice::HasType(std::string type) const
+bool CDevice::HasType(const std::string & type) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return m_devinfo.s_type.count(type) > 0;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_type->GetInfo().s_type.count(type) > 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Checks if the device has some specified state.
 ///
 /// @pre None.
-/// @post Returns true if m_devinfo.s_state contains the passed value.
+/// @post Returns true if m_type has a slot for the passed value.
 /// @param signal The string identifier of some state signal.
 /// @return True if this device has the specified state.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-bool CDevice::HasState(std::string signal) const
+bool CDevice::HasState(const std::string & signal) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return m_devinfo.s_state.count(signal) > 0;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_type->GetStateSlot(signal) != CDeviceType::NO_SLOT;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Checks if the device has some specified command.
 ///
 /// @pre None.
-/// @post Returns true if m_devinfo.s_command contains the passed value.
+/// @post Returns true if m_type has a slot for the passed value.
 /// @param signal The string identifier of some command signal.
 /// @return True if this device has the specified command.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-bool CDevice::HasCommand(std::string signal) const
+bool CDevice::HasCommand(const std::string & signal) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return m_devinfo.s_command.count(signal) > 0;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_type->GetCommandSlot(signal) != CDeviceType::NO_SLOT;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,15 +321,15 @@ bool CDevice::HasCommand(std::string signal) const
 /// true. This case happens when m_adapter is not configured to store all the
 /// data required for this device.
 ////////////////////////////////////////////////////////////////////////////////
-SignalValue CDevice::GetState(std::string signal) const
+SignalValue CDevice::GetState(const std::string & signal) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if( !HasState(signal) )
     {
         //error not warning ....should record error if state not right
-        Logger.Warn << "Bad Device State: " << signal << "\n" << m_devid
-                << "\n" << m_devinfo << std::endl;
+        LOG_WARN(Logger) << "Bad Device State: " << signal << "\n" << m_devid
+                << "\n" << m_type->GetInfo() << std::endl;
        // throw std::runtime_error("Bad Device State: " + signal);
         return 0;
     }
@@ -191,34 +337,164 @@ SignalValue CDevice::GetState(std::string signal) const
     return m_adapter->GetState(m_devid, signal);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Resolves a device state to a handle that CDevice::GetState can read without
+/// repeating the signal lookup. Modules that poll the same signal every round
+/// should resolve it once and keep the handle.
+///
+/// @ErrorHandling Throws a std::runtime_error if CDevice::HasState returns
+/// false for the passed string identifier, or if m_adapter does not store the
+/// signal.
+/// @pre The device must recognize the passed signal.
+/// @post If m_adapter uses buffers, it is queried for the buffer index.
+/// @param signal The string identifier for the state signal to resolve.
+/// @return A handle for the state signal valid for the life of the device.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+SignalHandle CDevice::GetStateHandle(const std::string & signal) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::size_t slot = m_type->GetStateSlot(signal);
+
+    if( slot == CDeviceType::NO_SLOT )
+    {
+        throw std::runtime_error("Bad Device State: " + signal);
+    }
+
+    if( m_buffer )
+    {
+        return m_buffer->GetStateHandle(m_devid, signal);
+    }
+
+    return slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the value of a device state resolved by CDevice::GetStateHandle.
+///
+/// @ErrorHandling Throws a std::runtime_error if the handle is invalid.
+/// @pre The handle must come from GetStateHandle on this device.
+/// @post m_adapter is queried for the value of the signal.
+/// @param handle The handle of the state signal to retrieve.
+/// @return The current value of the specified state signal.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+SignalValue CDevice::GetState(SignalHandle handle) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_buffer )
+    {
+        return m_buffer->GetState(handle);
+    }
+
+    return m_adapter->GetState(m_devid, m_type->GetStateName(handle));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the last values of a state signal that the adapter kept.  Only buffer
+/// adapters with a history attribute keep values, and reading them takes no
+/// lock, so a module can call this every round.
+///
+/// @ErrorHandling Throws a std::runtime_error if the device does not have
+/// the state signal or if m_adapter keeps no history.
+/// @pre The device must recognize the passed signal.
+/// @post m_adapter is queried for the history of the signal.
+/// @param signal The string identifier for the state signal.
+/// @param count The number of values wanted.
+/// @return Up to count of the newest values, oldest first.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+std::vector<SignalSample> CDevice::GetHistory(const std::string & signal,
+        std::size_t count) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::vector<SignalSample> samples;
+
+    if( !m_buffer || m_buffer->GetHistoryCapacity() == 0 )
+    {
+        throw std::runtime_error("No history is kept for device " + m_devid);
+    }
+
+    m_buffer->GetHistory(GetStateHandle(signal), count, samples);
+    return samples;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gets the mean and extremes of a state signal over the values its adapter
+/// published within a recent window.
+///
+/// @ErrorHandling Throws a std::runtime_error if the device does not have
+/// the state signal or if m_adapter keeps no history.
+/// @pre The device must recognize the passed signal.
+/// @post m_adapter is queried for the history of the signal.
+/// @param signal The string identifier for the state signal.
+/// @param window How far back from now to look.
+/// @return The trend of the signal, with a count of 0 for an empty window.
+///
+/// @limitations The window only reaches back as far as the history capacity.
+////////////////////////////////////////////////////////////////////////////////
+SignalTrend CDevice::GetTrend(const std::string & signal,
+        boost::posix_time::time_duration window) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( !m_buffer || m_buffer->GetHistoryCapacity() == 0 )
+    {
+        throw std::runtime_error("No history is kept for device " + m_devid);
+    }
+
+    return m_buffer->GetTrend(GetStateHandle(signal), window);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Accessor for the set of recognized types.
+///
+/// @pre None.
+/// @post Returns the types of m_type.
+/// @return The set of recognized types.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+std::set<std::string> CDevice::GetTypeSet() const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_type->GetInfo().s_type;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Accessor for the set of recognized state signals.
 ///
 /// @pre None.
-/// @post Returns m_devinfo.s_state.
+/// @post Returns the states of m_type.
 /// @return The set of recognized state signals.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 std::set<std::string> CDevice::GetStateSet() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return m_devinfo.s_state;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_type->GetInfo().s_state;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Accessor for the set of recognized command signals.
 ///
 /// @pre None.
-/// @post Returns m_devinfo.s_command.
+/// @post Returns the commands of m_type.
 /// @return The set of recognized command signals.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 std::set<std::string> CDevice::GetCommandSet() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return m_devinfo.s_command;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return m_type->GetInfo().s_command;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -235,19 +511,77 @@ std::set<std::string> CDevice::GetCommandSet() const
 /// true. This case happens when m_adapter is not configured to store all the
 /// data required for this device.
 ////////////////////////////////////////////////////////////////////////////////
-void CDevice::SetCommand(std::string signal, SignalValue value)
+void CDevice::SetCommand(const std::string & signal, SignalValue value)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if( !HasCommand(signal) )
     {
-        Logger.Error << "Bad Device Command: " << signal << "\n" << m_devid
-                << "\n" << m_devinfo << std::endl;
+        LOG_ERROR(Logger) << "Bad Device Command: " << signal << "\n" << m_devid
+                << "\n" << m_type->GetInfo() << std::endl;
         throw std::runtime_error("Bad Device Command: " + signal);
     }
 
     m_adapter->SetCommand(m_devid, signal, value);
-    Logger.Status << "Fired" << std::endl;
+    LOG_STATUS(Logger) << "Fired" << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Resolves a device command to a handle that CDevice::SetCommand can write
+/// without repeating the signal lookup.
+///
+/// @ErrorHandling Throws a std::runtime_error if CDevice::HasCommand returns
+/// false for the passed string identifier, or if m_adapter does not store the
+/// signal.
+/// @pre The device must recognize the passed signal.
+/// @post If m_adapter uses buffers, it is queried for the buffer index.
+/// @param signal The string identifier for the command signal to resolve.
+/// @return A handle for the command signal valid for the life of the device.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+SignalHandle CDevice::GetCommandHandle(const std::string & signal) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::size_t slot = m_type->GetCommandSlot(signal);
+
+    if( slot == CDeviceType::NO_SLOT )
+    {
+        throw std::runtime_error("Bad Device Command: " + signal);
+    }
+
+    if( m_buffer )
+    {
+        return m_buffer->GetCommandHandle(m_devid, signal);
+    }
+
+    return slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sets the value of a device command resolved by CDevice::GetCommandHandle.
+///
+/// @ErrorHandling Throws a std::runtime_error if the handle is invalid.
+/// @pre The handle must come from GetCommandHandle on this device.
+/// @post m_adapter is updated with the value of the signal.
+/// @param handle The handle of the command signal to set.
+/// @param value The value to set for the command signal.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CDevice::SetCommand(SignalHandle handle, SignalValue value)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_buffer )
+    {
+        m_buffer->SetCommand(handle, value);
+    }
+    else
+    {
+        m_adapter->SetCommand(m_devid, m_type->GetCommandName(handle), value);
+    }
 }
 
 } // namespace device
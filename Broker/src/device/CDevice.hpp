@@ -26,8 +26,10 @@
 #include "IAdapter.hpp"
 
 #include <set>
+#include <cstddef>
 #include <iosfwd>
 #include <string>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
@@ -36,6 +38,8 @@ namespace freedm {
 namespace broker {
 namespace device {
 
+class IBufferAdapter;
+
 /// Stores the internal structure of a device object.
 struct DeviceInfo
 {
@@ -52,6 +56,59 @@ struct DeviceInfo
 /// Outputs the device information to the passed output stream.
 std::ostream & operator<<(std::ostream & os, const DeviceInfo & info);
 
+/// The shared, immutable structure of every device of one type.
+////////////////////////////////////////////////////////////////////////////////
+/// A device type numbers its state and command signals in name order, so a
+/// signal is validated by a binary search of one contiguous table and mapped
+/// to the slot that CDevice uses as its handle for adapters without buffers.
+/// The builder creates one instance per type and every device of that type
+/// points to it, so a device stores no more than its identifier and adapter.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+class CDeviceType
+    : private boost::noncopyable
+{
+public:
+    /// Pointer to a shared device type.
+    typedef boost::shared_ptr<const CDeviceType> Pointer;
+
+    /// The slot of a signal the type does not recognize.
+    static const std::size_t NO_SLOT = static_cast<std::size_t>(-1);
+
+    /// Builds the signal tables of a device structure.
+    explicit CDeviceType(const DeviceInfo & info);
+
+    /// Gets the structure the type was built from.
+    const DeviceInfo & GetInfo() const { return m_info; }
+
+    /// Gets the slot of a state signal, or NO_SLOT.
+    std::size_t GetStateSlot(const std::string & signal) const;
+
+    /// Gets the slot of a command signal, or NO_SLOT.
+    std::size_t GetCommandSlot(const std::string & signal) const;
+
+    /// Gets the name of the state signal in a slot.
+    const std::string & GetStateName(std::size_t slot) const;
+
+    /// Gets the name of the command signal in a slot.
+    const std::string & GetCommandName(std::size_t slot) const;
+
+private:
+    /// Finds the slot of a signal in a sorted table.
+    static std::size_t FindSlot(const std::vector<std::string> & table,
+            const std::string & signal);
+
+    /// The structure of the type.
+    DeviceInfo m_info;
+
+    /// State signals in slot order.
+    std::vector<std::string> m_states;
+
+    /// Command signals in slot order.
+    std::vector<std::string> m_commands;
+};
+
 /// Defines the interface used to access physical hardware.
 ////////////////////////////////////////////////////////////////////////////////
 /// The CDevice class provides the universal interface for how modules in the
@@ -76,23 +133,45 @@ public:
     /// Pointer to physical device interface.
     typedef boost::shared_ptr<CDevice> Pointer;
 
-    /// Constructs a device with a specific structure and adapter.
-    CDevice(std::string id, DeviceInfo info, IAdapter::Pointer adapter);
+    /// Constructs a device of a shared type with an adapter.
+    CDevice(const std::string & id, CDeviceType::Pointer type,
+            IAdapter::Pointer adapter);
+
+    /// Constructs a device with a structure of its own and an adapter.
+    CDevice(const std::string & id, const DeviceInfo & info,
+            IAdapter::Pointer adapter);
 
     /// Gets the unique identifier for this device.
     std::string GetID() const;
 
     /// Checks if the device recognizes a type.
-    bool HasType(std::string type) const;
+    bool HasType(const std::string & type) const;
 
     /// Checks if the device recognizes a state signal.
-    bool HasState(std::string signal) const;
+    bool HasState(const std::string & signal) const;
 
     /// Checks if the device recognizes a command signal.
-    bool HasCommand(std::string signal) const;
+    bool HasCommand(const std::string & signal) const;
 
     /// Gets the current state of some signal from the adapter.
-    SignalValue GetState(std::string signal) const;
+    SignalValue GetState(const std::string & signal) const;
+
+    /// Resolves a state signal to a handle for repeated reads.
+    SignalHandle GetStateHandle(const std::string & signal) const;
+
+    /// Gets the current state of a signal resolved by GetStateHandle.
+    SignalValue GetState(SignalHandle handle) const;
+
+    /// Gets the last values of a state signal kept by the adapter.
+    std::vector<SignalSample> GetHistory(const std::string & signal,
+            std::size_t count) const;
+
+    /// Gets the mean and extremes of a state signal over a recent window.
+    SignalTrend GetTrend(const std::string & signal,
+            boost::posix_time::time_duration window) const;
+
+    /// Gets the set of types recognized by the device.
+    std::set<std::string> GetTypeSet() const;
 
     /// Gets the set of state signals recognized by the device.
     std::set<std::string> GetStateSet() const;
@@ -101,17 +180,29 @@ public:
     std::set<std::string> GetCommandSet() const;
 
     /// Sets the next command for some signal in the adapter.
-    void SetCommand(std::string signal, SignalValue value);
+    void SetCommand(const std::string & signal, SignalValue value);
+
+    /// Resolves a command signal to a handle for repeated writes.
+    SignalHandle GetCommandHandle(const std::string & signal) const;
+
+    /// Sets the next command for a signal resolved by GetCommandHandle.
+    void SetCommand(SignalHandle handle, SignalValue value);
 
 private:
+    /// CDeviceManager groups the signals of a snapshot by adapter.
+    friend class CDeviceManager;
+
     /// Unique identifier for this device.
     std::string m_devid;
 
-    /// Internal structure of this device.
-    DeviceInfo m_devinfo;
+    /// Internal structure of this device, shared with its type.
+    CDeviceType::Pointer m_type;
 
     /// Adapter that handles the storage for this device.
     IAdapter::Pointer m_adapter;
+
+    /// m_adapter if it stores its signals in buffers, otherwise null.
+    boost::shared_ptr<IBufferAdapter> m_buffer;
 };
 
 } // namespace device
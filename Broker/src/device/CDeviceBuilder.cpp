@@ -60,16 +60,15 @@ CLocalLogger Logger(__FILE__);
 ////////////////////////////////////////////////////////////////////////////////
 CDeviceBuilder::CDeviceBuilder(std::string filename)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    typedef std::map<std::string, DeviceInfo> map_type;
     using namespace boost::property_tree;
     ptree root;
     BuildVars vars;
 
     try
     {
-        Logger.Debug << "read_xml with the path: " << filename << std::endl;
+        LOG_DEBUG(Logger) << "read_xml with the path: " << filename << std::endl;
         read_xml(filename, root);
     }
     catch(std::exception & e)
@@ -86,7 +85,7 @@ CDeviceBuilder::CDeviceBuilder(std::string filename)
 
     BOOST_FOREACH(ptree::value_type & type, device_xml)
     {
-        Logger.Debug << "Processing the next device class..." << std::endl;
+        LOG_DEBUG(Logger) << "Processing the next device class..." << std::endl;
 
         if( type.first != "deviceType" )
         {
@@ -122,17 +121,17 @@ CDeviceBuilder::CDeviceBuilder(std::string filename)
             {
                 if( m_type_to_info.count(value) > 0 )
                 {
-                    Logger.Error << "XML error for type " << id << std::endl;
+                    LOG_ERROR(Logger) << "XML error for type " << id << std::endl;
                     throw std::runtime_error("Duplicate ID: " + value);
                 }
                 info.s_type.insert(value);
-                Logger.Debug << "id = " << value << std::endl;
+                LOG_DEBUG(Logger) << "id = " << value << std::endl;
             }
             else if( header == "extends" )
             {
                 if( info.s_type.count(value) > 0 )
                 {
-                    Logger.Error << "XML error for type " << id << std::endl;
+                    LOG_ERROR(Logger) << "XML error for type " << id << std::endl;
                     throw std::runtime_error("Duplicate Extend: " + value);
                 }
                 if( m_type_to_info.count(value) == 0 )
@@ -140,58 +139,60 @@ CDeviceBuilder::CDeviceBuilder(std::string filename)
                     vars.s_undefined_type.insert(value);
                 }
                 info.s_type.insert(value);
-                Logger.Debug << "type = " << value << std::endl;
+                LOG_DEBUG(Logger) << "type = " << value << std::endl;
             }
             else if( header == "state" )
             {
                 if( info.s_state.count(value) > 0 )
                 {
-                    Logger.Error << "XML error for type " << id << std::endl;
+                    LOG_ERROR(Logger) << "XML error for type " << id << std::endl;
                     throw std::runtime_error("Duplicate State: " + value);
                 }
                 info.s_state.insert(value);
-                Logger.Debug << "state = " << value << std::endl;
+                LOG_DEBUG(Logger) << "state = " << value << std::endl;
 
                 // Register conflict when another type has the same state.
-                BOOST_FOREACH(map_type::value_type & i, m_type_to_info)
+                BOOST_FOREACH(const std::string & other, vars.s_state_types[value])
                 {
-                    if( i.second.s_state.count(value) > 0 )
-                    {
-                        // It's fine if this overrides an existing conflict.
-                        // We just need to know if at least one conflict exists.
-                        vars.s_conflict[std::make_pair(id, i.first)] = value;
-                    }
+                    // It's fine if this overrides an existing conflict.
+                    // We just need to know if at least one conflict exists.
+                    vars.s_conflict[std::make_pair(id, other)] = value;
                 }
             }
             else if( header == "command" )
             {
                 if( info.s_command.count(value) > 0 )
                 {
-                    Logger.Error << "XML error for type " << id << std::endl;
+                    LOG_ERROR(Logger) << "XML error for type " << id << std::endl;
                     throw std::runtime_error("Duplicate Command: " + value);
                 }
                 info.s_command.insert(value);
-                Logger.Debug << "command = " << value << std::endl;
+                LOG_DEBUG(Logger) << "command = " << value << std::endl;
 
                 // Register conflict when another type has the same command.
-                BOOST_FOREACH(map_type::value_type & i, m_type_to_info)
+                BOOST_FOREACH(const std::string & other, vars.s_command_types[value])
                 {
-                    if( i.second.s_command.count(value) > 0 )
-                    {
-                        // It's fine if this overrides an existing conflict.
-                        // We just need to know if at least one conflict exists.
-                        vars.s_conflict[std::make_pair(id, i.first)] = value;
-                    }
+                    // It's fine if this overrides an existing conflict.
+                    // We just need to know if at least one conflict exists.
+                    vars.s_conflict[std::make_pair(id, other)] = value;
                 }
             }
             else
             {
-                Logger.Error << "XML error for type " << id << std::endl;
+                LOG_ERROR(Logger) << "XML error for type " << id << std::endl;
                 throw std::runtime_error("Unknown Tag: " + value);
             }
         }
 
         m_type_to_info[id] = info;
+        BOOST_FOREACH(const std::string & state, info.s_state)
+        {
+            vars.s_state_types[state].push_back(id);
+        }
+        BOOST_FOREACH(const std::string & command, info.s_command)
+        {
+            vars.s_command_types[command].push_back(id);
+        }
         vars.s_undefined_type.erase(id);
         vars.s_uninitialized_type.insert(id);
     }
@@ -229,8 +230,8 @@ CDeviceBuilder::CDeviceBuilder(std::string filename)
 void CDeviceBuilder::ExpandInfo(std::string target, std::set<std::string> path,
         BuildVars & vars)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Debug << "ExpandInfo on target: " << target << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_DEBUG(Logger) << "ExpandInfo on target: " << target << std::endl;
 
     typedef std::map<std::pair<std::string, std::string>, std::string> map_type;
     DeviceInfo & info = m_type_to_info.at(target);
@@ -241,7 +242,7 @@ void CDeviceBuilder::ExpandInfo(std::string target, std::set<std::string> path,
     {
         if( path.count(target) > 0 )
         {
-            Logger.Error << "Cyclic extend from " << target << std::endl;
+            LOG_ERROR(Logger) << "Cyclic extend from " << target << std::endl;
             throw std::runtime_error("Device XML has cyclic inheritance.");
         }
         path.insert(target);
@@ -273,7 +274,7 @@ void CDeviceBuilder::ExpandInfo(std::string target, std::set<std::string> path,
             if( info.s_type.count(t.first.first) > 0 &&
                     info.s_type.count(t.first.second) > 0 )
             {
-                Logger.Error << "Signal conflict in device type: " << target
+                LOG_ERROR(Logger) << "Signal conflict in device type: " << target
                         << "\nSignal Name: " << t.second << "\nDefined By: "
                         << t.first.first << " and " << t.first.second
                         << std::endl;
@@ -309,6 +310,8 @@ DeviceInfo CDeviceBuilder::GetDeviceInfo(std::string type)
 /// the specified device type.
 /// @pre The passed type must be a valid key for the m_type_to_info map.
 /// @post Creates a new CDevice instance and returns a shared pointer to it.
+/// @post The first device of a type creates the CDeviceType shared by the
+/// devices of that type.
 /// @param id The unique identifier for the new device.
 /// @param type The device type to assign to the new device.
 /// @param adapter The adapter that handles data for the new device.
@@ -319,14 +322,23 @@ DeviceInfo CDeviceBuilder::GetDeviceInfo(std::string type)
 CDevice::Pointer CDeviceBuilder::CreateDevice(std::string id, std::string type,
         IAdapter::Pointer adapter)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    if( m_type_to_info.count(type) == 0 )
+    std::map<std::string, DeviceInfo>::const_iterator it = m_type_to_info.find(type);
+
+    if( it == m_type_to_info.end() )
     {
         throw std::runtime_error("Invalid Device Type: " + type);
     }
 
-    return CDevice::Pointer(new CDevice(id, m_type_to_info[type], adapter));
+    // every device of the type shares one structure
+    CDeviceType::Pointer & shared = m_type_to_device[type];
+    if( !shared )
+    {
+        shared.reset(new CDeviceType(it->second));
+    }
+
+    return CDevice::Pointer(new CDevice(id, shared, adapter));
 }
 
 } // namespace device
@@ -29,6 +29,7 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace freedm {
 namespace broker {
@@ -71,6 +72,12 @@ private:
 
         /// Stores the device types that have no type information.
         std::set<std::string> s_uninitialized_type;
+
+        /// Maps a state name to the device types that define it.
+        std::map<std::string, std::vector<std::string> > s_state_types;
+
+        /// Maps a command name to the device types that define it.
+        std::map<std::string, std::vector<std::string> > s_command_types;
     };
 
     /// Recursive function to populate the device information map.
@@ -79,6 +86,9 @@ private:
 
     /// Map from device type to its associated device information.
     std::map<std::string, DeviceInfo> m_type_to_info;
+
+    /// Map from device type to the structure its devices share.
+    std::map<std::string, CDeviceType::Pointer> m_type_to_device;
 };
 
 } // namespace device
@@ -15,12 +15,33 @@
 ///     CDeviceManager::begin
 ///     CDeviceManager::end
 ///     CDeviceManager::AddDevice
+///     CDeviceManager::AddDevices
 ///     CDeviceManager::RevealDevice
+///     CDeviceManager::RevealDevices
 ///     CDeviceManager::RemoveDevice
+///     CDeviceManager::RemoveDevices
+///     CDeviceManager::IndexDevices
+///     CDeviceManager::GetTable
+///     CDeviceManager::PublishTable
 ///     CDeviceManager::DeviceExists
 ///     CDeviceManager::GetDevice
 ///     CDeviceManager::DeviceCount
 ///     CDeviceManager::GetValues
+///     CDeviceManager::Reduce
+///     CDeviceManager::GetDeviceView
+///     CDeviceManager::GetNetValue
+///     CDeviceManager::GetAggregate
+///     CDeviceManager::InvalidateAggregates
+///     CDeviceManager::ResolveSnapshot
+///     CDeviceManager::Snapshot
+///     CDeviceManager::StageCommand
+///     CDeviceManager::CommitCommands
+///     CDeviceManager::Subscribe
+///     CDeviceManager::SubscribeEach
+///     CDeviceManager::Unsubscribe
+///     CDeviceManager::NotifySubscribers
+///     CDeviceManager::ReadEach
+///     CDeviceManager::DeliverChange
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -36,10 +57,17 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "CDeviceManager.hpp"
+#include "CBroker.hpp"
 #include "CLogger.hpp"
+#include "IBufferAdapter.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
 #include <stdexcept>
 
+#include <boost/bind.hpp>
+
 namespace freedm {
 namespace broker {
 namespace device {
@@ -47,6 +75,9 @@ namespace device {
 namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
+
+/// The view returned for a type without devices.
+const CDeviceManager::DeviceSetView NO_DEVICES(new CDeviceManager::DeviceSet());
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -60,7 +91,7 @@ CLocalLogger Logger(__FILE__);
 ///////////////////////////////////////////////////////////////////////////////
 CDeviceManager & CDeviceManager::Instance()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     static CDeviceManager instance;
     return instance;
 }
@@ -74,8 +105,11 @@ CDeviceManager & CDeviceManager::Instance()
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 CDeviceManager::CDeviceManager()
+    : m_table(new SDeviceTable())
+    , m_generation(0)
+    , m_nextSubscription(0)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -85,28 +119,77 @@ CDeviceManager::CDeviceManager()
 /// registered with the same device identifier.
 /// @SharedMemory Stores a shared pointer to the given device.
 /// @pre There must not be a device registered with the same identifier.
-/// @post The device is stored in the device set m_devices.
+/// @post The device is stored in the device set m_hidden_devices.
 /// @param device The device pointer to store in the manager.
 ///
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 void CDeviceManager::AddDevice(CDevice::Pointer device)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    AddDevices(std::vector<CDevice::Pointer>(1, device));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Registers a set of devices with one acquisition of the write lock. Hidden
+/// devices wait for RevealDevices; revealed devices are published in one new
+/// device table, so a burst of devices that come online together costs one
+/// copy of the table and one round of subscriber events.
+///
+/// @ErrorHandling Throws a std::runtime_error if one of the identifiers is
+///     already registered or repeats in the batch, in which case none of the
+///     devices are stored.
+/// @SharedMemory Stores a shared pointer to each of the given devices.
+/// @pre There must not be a device registered with any of the identifiers.
+/// @post The devices are stored in m_hidden_devices, or in m_table if reveal
+///     is set.
+/// @param devices The device pointers to store in the manager.
+/// @param reveal True to make the devices visible at once.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::AddDevices(const std::vector<CDevice::Pointer> & devices,
+        bool reveal)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+    boost::lock_guard<boost::mutex> lock(m_writeMutex);
+    DeviceTable current = GetTable();
+    std::set<std::string> devids;
 
-    if( m_devices.count(device->GetID()) > 0 )
+    BOOST_FOREACH(CDevice::Pointer device, devices)
     {
-        throw std::runtime_error("Duplicate device ID: " + device->GetID());
+        if( current->devices.count(device->GetID()) > 0
+                || m_hidden_devices.count(device->GetID()) > 0
+                || !devids.insert(device->GetID()).second )
+        {
+            throw std::runtime_error("Duplicate device ID: " + device->GetID());
+        }
     }
-    if( m_hidden_devices.count(device->GetID()) > 0 )
+    if( devices.empty() )
     {
-        throw std::runtime_error("Duplicate device ID: " + device->GetID());
+        return;
     }
 
-    m_hidden_devices[device->GetID()] = device;
-    Logger.Info << "Stored " << device->GetID() << " as hidden device." << std::endl;
+    if( !reveal )
+    {
+        BOOST_FOREACH(CDevice::Pointer device, devices)
+        {
+            m_hidden_devices[device->GetID()] = device;
+            LOG_INFO(Logger) << "Stored " << device->GetID() << " as hidden device." << std::endl;
+        }
+        return;
+    }
+
+    boost::shared_ptr<SDeviceTable> table(new SDeviceTable(*current));
+    BOOST_FOREACH(CDevice::Pointer device, devices)
+    {
+        table->devices[device->GetID()] = device;
+    }
+    IndexDevices(*table, devices, true);
+    PublishTable(table);
+    LOG_STATUS(Logger) << "Stored and revealed " << devices.size() << " devices." << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -114,26 +197,68 @@ void CDeviceManager::AddDevice(CDevice::Pointer device)
 ///
 /// @ErrorHandling Throws a std::runtime_error if no such device exists.
 /// @pre m_hidden_devices stores the passed identifier.
-/// @post Moves a pointer from m_hidden_devices into m_devices.
+/// @post Moves a pointer from m_hidden_devices into m_table.
 /// @param devid The identifier of the device pointer to move.
 ///
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 void CDeviceManager::RevealDevice(std::string devid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+    std::set<std::string> devids;
+    devids.insert(devid);
+    RevealDevices(devids);
+}
 
-    if( m_hidden_devices.count(devid) == 0 )
+///////////////////////////////////////////////////////////////////////////////
+/// Reveals a set of hidden devices. The new device table is built from one
+/// copy of the current one, so readers are only blocked while it is
+/// published, and the devices of an adapter cost one copy rather than one
+/// copy each.
+///
+/// @ErrorHandling Throws a std::runtime_error if one of the devices does not
+///     exist, in which case none of them is revealed.
+/// @pre m_hidden_devices stores the passed identifiers.
+/// @post Moves the pointers from m_hidden_devices into m_table.
+/// @param devids The identifiers of the device pointers to move.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::RevealDevices(const std::set<std::string> & devids)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(m_writeMutex);
+    std::vector<CDevice::Pointer> devices;
+
+    BOOST_FOREACH(const std::string & devid, devids)
+    {
+        PhysicalDeviceSet::iterator it = m_hidden_devices.find(devid);
+        if( it == m_hidden_devices.end() )
+        {
+            throw std::runtime_error("Unknown hidden device: " + devid);
+        }
+        devices.push_back(it->second);
+    }
+    if( devices.empty() )
     {
-        throw std::runtime_error("Unknown hidden device: " + devid);
+        return;
     }
 
-    m_devices[devid] = m_hidden_devices[devid];
-    m_hidden_devices.erase(devid);
+    boost::shared_ptr<SDeviceTable> table(new SDeviceTable(*GetTable()));
+    BOOST_FOREACH(CDevice::Pointer device, devices)
+    {
+        table->devices[device->GetID()] = device;
+    }
+    IndexDevices(*table, devices, true);
 
-    Logger.Status<< "Revealed the hidden device " << devid << std::endl;
+    PublishTable(table);
+    BOOST_FOREACH(const std::string & devid, devids)
+    {
+        m_hidden_devices.erase(devid);
+        LOG_STATUS(Logger)<< "Revealed the hidden device " << devid << std::endl;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -141,7 +266,8 @@ void CDeviceManager::RevealDevice(std::string devid)
 ///
 /// @ErrorHandling Will output a warning if the device cannot be found.
 /// @pre None.
-/// @post The device with the matching identifier is removed from m_devices.
+/// @post The device with the matching identifier is removed from m_table or
+///     m_hidden_devices.
 /// @param devid The identifier of the device to remove.
 /// @return True if a device has been removed, false otherwise.
 ///
@@ -149,24 +275,170 @@ void CDeviceManager::RevealDevice(std::string devid)
 ///////////////////////////////////////////////////////////////////////////////
 bool CDeviceManager::RemoveDevice(std::string devid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::set<std::string> devids;
+    devids.insert(devid);
+    return RemoveDevices(devids) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Removes a set of devices from the manager with one copy of the device
+/// table.
+///
+/// @ErrorHandling Will output a warning for each device that cannot be found.
+/// @pre None.
+/// @post The devices with the matching identifiers are removed from m_table
+///     or m_hidden_devices.
+/// @param devids The identifiers of the devices to remove.
+/// @return The number of devices that have been removed.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CDeviceManager::RemoveDevices(const std::set<std::string> & devids)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(m_writeMutex);
 
-    boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+    DeviceTable current = GetTable();
+    std::vector<CDevice::Pointer> visible;
+    std::size_t removed = 0;
 
-    if( m_devices.erase(devid) != 1 && m_hidden_devices.erase(devid) != 1 )
+    BOOST_FOREACH(const std::string & devid, devids)
     {
-        Logger.Warn << "Could not remove the device " << devid << " from the "
-                << " device manager: no such device exists." << std::endl;
-        return false;
+        const_iterator it = current->devices.find(devid);
+        if( it != current->devices.end() )
+        {
+            visible.push_back(it->second);
+        }
+        else if( m_hidden_devices.erase(devid) != 1 )
+        {
+            LOG_WARN(Logger) << "Could not remove the device " << devid << " from the "
+                    << " device manager: no such device exists." << std::endl;
+            continue;
+        }
+        removed++;
+    }
+
+    if( !visible.empty() )
+    {
+        boost::shared_ptr<SDeviceTable> table(new SDeviceTable(*current));
+        IndexDevices(*table, visible, false);
+        BOOST_FOREACH(CDevice::Pointer device, visible)
+        {
+            table->devices.erase(device->GetID());
+        }
+        PublishTable(table);
+    }
+    return removed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Adds or removes visible devices in the sets of each of their types. The
+/// set of a type is copied once for the batch and the copy is stored, so
+/// views handed out before the change keep their contents.
+///
+/// @pre The table has not been published yet.
+/// @post The table lists the devices under each of their types if insert is
+///     set, and under none of them otherwise.
+/// @param table The unpublished device table to change.
+/// @param devices The devices to add or remove.
+/// @param insert True to add the devices, false to remove them.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::IndexDevices(SDeviceTable & table,
+        const std::vector<CDevice::Pointer> & devices, bool insert)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<std::string, boost::shared_ptr<DeviceSet> > copies;
+
+    BOOST_FOREACH(CDevice::Pointer device, devices)
+    {
+        BOOST_FOREACH(const std::string & type, device->GetTypeSet())
+        {
+            boost::shared_ptr<DeviceSet> & set = copies[type];
+            if( !set )
+            {
+                TypeIndex::iterator it = table.types.find(type);
+                set.reset(it != table.types.end()
+                        ? new DeviceSet(*it->second) : new DeviceSet());
+            }
+
+            if( insert )
+            {
+                set->insert(device);
+            }
+            else
+            {
+                set->erase(device);
+            }
+        }
+    }
+
+    std::map<std::string, boost::shared_ptr<DeviceSet> >::iterator it;
+    for( it = copies.begin(); it != copies.end(); it++ )
+    {
+        if( it->second->empty() )
+        {
+            table.types.erase(it->first);
+        }
+        else
+        {
+            table.types[it->first] = it->second;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Gets the device table published last. The lock is held only to copy the
+/// pointer, and the table can be read without it.
+///
+/// @pre None.
+/// @post Copies m_table.
+/// @return The current device table.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::DeviceTable CDeviceManager::GetTable() const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+    return m_table;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Replaces the device table and invalidates the aggregates of its devices.
+/// The devices that joined or left can move the net values the modules
+/// subscribed to, so the subscribers are notified once for the whole table
+/// rather than once per device.
+///
+/// @pre The caller holds m_writeMutex.
+/// @post m_table is the passed table.
+/// @param table The device table to publish.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::PublishTable(DeviceTable table)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    {
+        boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+        m_table.swap(table);
     }
-    return true;
+    InvalidateAggregates();
+    NotifySubscribers();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Tests to see if the device exists in the devices manager.
 ///
 /// @pre None
-/// @post Searches m_device for the device.
+/// @post Searches m_table for the device.
 /// @param devid The identifier of the device to find.
 /// @return True if the device is in the device manager, false otherwise
 ///
@@ -174,9 +446,8 @@ bool CDeviceManager::RemoveDevice(std::string devid)
 ///////////////////////////////////////////////////////////////////////////////
 bool CDeviceManager::DeviceExists(std::string devid) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
-    return( m_devices.count(devid) == 1 );
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return( GetTable()->devices.count(devid) == 1 );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -184,7 +455,7 @@ bool CDeviceManager::DeviceExists(std::string devid) const
 ///
 /// @ErrorHandling Will output a warning if the device cannot be found.
 /// @pre The device must be stored in the device manager.
-/// @post Searches m_devices for a device with the passed identifier.
+/// @post Searches m_table for a device with the passed identifier.
 /// @param devid the ID of the device to get.
 /// @return A shared pointer to the device, or NULL if it wasn't found.
 ///
@@ -195,17 +466,17 @@ bool CDeviceManager::DeviceExists(std::string devid) const
 ///////////////////////////////////////////////////////////////////////////////
 CDevice::Pointer CDeviceManager::GetDevice(std::string devid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
-    iterator it = m_devices.find(devid);
-    if( it != m_devices.end() )
+    DeviceTable table = GetTable();
+    const_iterator it = table->devices.find(devid);
+    if( it != table->devices.end() )
     {
         return it->second;
     }
     else
     {
-        Logger.Warn << "Could not get the device " << devid << " from the "
+        LOG_WARN(Logger) << "Could not get the device " << devid << " from the "
                 << " device manager: no such device exists." << std::endl;
         return CDevice::Pointer();
     }
@@ -215,16 +486,15 @@ CDevice::Pointer CDeviceManager::GetDevice(std::string devid)
 /// Returns a count of the number of devices stored by the device manager.
 ///
 /// @pre None
-/// @post Returns the size of m_devices.
+/// @post Returns the size of the device table.
 /// @return The number of devices currently stored.
 ///
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 std::size_t CDeviceManager::DeviceCount() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
-    return m_devices.size();
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return GetTable()->devices.size();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -233,25 +503,35 @@ std::size_t CDeviceManager::DeviceCount() const
 /// @pre None.
 /// @post Places each device that recognizes the type in the result set.
 /// @param type The string identifier for the type of device to retrieve.
-/// @return A set that contains the matching subset of m_devices.
+/// @return A set that contains the matching subset of the visible devices.
 ///
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 std::set<CDevice::Pointer> CDeviceManager::GetDevicesOfType(std::string type)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return *GetDeviceView(type);
+}
 
-    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
-    std::set<CDevice::Pointer> result;
+///////////////////////////////////////////////////////////////////////////////
+/// Gets the stored devices of the given type without copying them. The view
+/// is a snapshot: devices revealed or removed later do not change it.
+///
+/// @pre None.
+/// @post Looks the type up in the device table.
+/// @param type The string identifier for the type of device to retrieve.
+/// @return A shared, read only set of the matching subset of the visible devices.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::DeviceSetView CDeviceManager::GetDeviceView(
+        const std::string & type) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    for( iterator it = m_devices.begin(); it != m_devices.end(); it++ )
-    {
-        if( it->second->HasType(type) )
-        {
-            result.insert(it->second);
-        }
-    }
-    return result;
+    DeviceTable table = GetTable();
+    TypeIndex::const_iterator it = table->types.find(type);
+    return it != table->types.end() ? it->second : NO_DEVICES;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -268,17 +548,65 @@ std::set<CDevice::Pointer> CDeviceManager::GetDevicesOfType(std::string type)
 std::multiset<SignalValue> CDeviceManager::GetValues(std::string type,
         std::string signal)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     std::multiset<SignalValue> result;
+    GetValues(type, signal, std::inserter(result, result.end()));
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Computes the sum, minimum, maximum and count of a contiguous array, such
+/// as the buffer filled by Snapshot or by GetValues. The array is consumed
+/// four values at a time into independent partial results so the loop does
+/// not serialize on a single accumulator.
+///
+/// @pre values points to at least count values.
+/// @post None.
+/// @param values The first value of the array.
+/// @param count The number of values in the array.
+/// @return The aggregate, with zero extremes if count is zero.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::SignalAggregate CDeviceManager::Reduce(
+        const SignalValue * values, std::size_t count)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    std::set<CDevice::Pointer> devices = GetDevicesOfType(type);
+    SignalAggregate result;
+    result.sum = result.min = result.max = 0;
+    result.count = count;
 
-    BOOST_FOREACH (CDevice::Pointer device, devices)
+    if( count == 0 )
     {
-        result.insert(device->GetState(signal));
+        return result;
     }
 
+    SignalValue sum[4] = { 0, 0, 0, 0 };
+    SignalValue min[4] = { values[0], values[0], values[0], values[0] };
+    SignalValue max[4] = { values[0], values[0], values[0], values[0] };
+    std::size_t i = 0;
+
+    for( ; i + 4 <= count; i += 4 )
+    {
+        for( std::size_t j = 0; j < 4; j++ )
+        {
+            sum[j] += values[i + j];
+            min[j] = std::min(min[j], values[i + j]);
+            max[j] = std::max(max[j], values[i + j]);
+        }
+    }
+    for( ; i < count; i++ )
+    {
+        sum[0] += values[i];
+        min[0] = std::min(min[0], values[i]);
+        max[0] = std::max(max[0], values[i]);
+    }
+
+    result.sum = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    result.min = std::min(std::min(min[0], min[1]), std::min(min[2], min[3]));
+    result.max = std::max(std::max(max[0], max[1]), std::max(max[2], max[3]));
     return result;
 }
 
@@ -286,7 +614,7 @@ std::multiset<SignalValue> CDeviceManager::GetValues(std::string type,
 /// Aggregates a set of device signals using the given binary operation.
 ///
 /// @pre The devices of the specified type must recognize the given signal.
-/// @post Performs a binary mathematical operation on a subset of m_devices.
+/// @post Reads the sum from the aggregate cache.
 /// @param type The device type that should perform the operation.
 /// @param signal The signal of the device to aggregate.
 /// @return The aggregate value obtained by applying the binary operation.
@@ -295,21 +623,527 @@ std::multiset<SignalValue> CDeviceManager::GetValues(std::string type,
 ///////////////////////////////////////////////////////////////////////////////
 SignalValue CDeviceManager::GetNetValue(std::string type, std::string signal)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    SignalValue result = 0;
+    return GetAggregate(type, signal).sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Computes the sum, minimum, maximum and count of a signal over the devices
+/// of a type. The result is cached until an adapter publishes new states or
+/// the devices change, so repeated reads within a round do not visit the
+/// devices again.
+///
+/// @pre The devices of the specified type must recognize the given signal.
+/// @post Stores the aggregate in m_aggregates if it had to be computed.  The
+///     states it was computed from count toward the open control loop scope
+///     whether or not the aggregate was cached.
+/// @param type The device type to aggregate over.
+/// @param signal The signal of the device to aggregate.
+/// @return The aggregate, with zero extremes if no device has the type.
+///
+/// @limitations The cache is invalidated by any state change of any adapter.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::SignalAggregate CDeviceManager::GetAggregate(
+        const std::string & type, const std::string & signal)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    std::set<CDevice::Pointer> devices = GetDevicesOfType(type);
-    std::set<CDevice::Pointer>::iterator it, end;
+    std::pair<std::string, std::string> key(type, signal);
+    unsigned long generation;
 
-    for( it = devices.begin(), end = devices.end(); it != end; it++ )
     {
-        result = result + (*it)->GetState(signal);
+        boost::lock_guard<boost::mutex> lock(m_aggregateMutex);
+        AggregateCache::const_iterator it = m_aggregates.find(key);
+        generation = m_generation;
+
+        if( it != m_aggregates.end() && it->second.generation == generation )
+        {
+            CControlLoop::Observe(it->second.stamp);
+            return it->second.value;
+        }
     }
 
+    // the devices are read without the lock since adapters invalidate it
+    SignalAggregate result;
+    result.sum = result.min = result.max = 0;
+    result.count = 0;
+    SControlStamp stamp;
+
+    DeviceSetView devices = GetDeviceView(type);
+    DeviceSet::const_iterator it, end;
+
+    {
+        // collect the stamps of these reads apart so the cache can keep them
+        CControlLoop::CScope scope(CControlLoop::Path());
+        for( it = devices->begin(), end = devices->end(); it != end; it++ )
+        {
+            SignalValue value = (*it)->GetState(signal);
+
+            result.sum = result.sum + value;
+            result.min = result.count == 0 ? value : std::min(result.min, value);
+            result.max = result.count == 0 ? value : std::max(result.max, value);
+            result.count++;
+        }
+        stamp = CControlLoop::Current();
+    }
+
+    // a state published during the loop leaves the entry out of date
+    boost::lock_guard<boost::mutex> lock(m_aggregateMutex);
+    SCachedAggregate & cached = m_aggregates[key];
+    cached.generation = generation;
+    cached.value = result;
+    cached.stamp = stamp;
+
     return result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Marks the cached aggregates as out of date. Adapters call this after new
+/// states become visible to GetState.
+///
+/// @pre None.
+/// @post Increments m_generation so the next GetAggregate recomputes.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::InvalidateAggregates()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(m_aggregateMutex);
+    m_generation++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Resolves a batch of device signals and groups them by the adapter that
+/// stores them. The query stays valid for as long as its devices exist and
+/// can be passed to Snapshot any number of times.
+///
+/// @ErrorHandling Throws a std::runtime_error if a device does not exist or
+/// does not recognize its signal.
+/// @pre Each device must be visible in the device manager.
+/// @post Looks each device up in the device table and resolves its signal.
+/// @param signals The (device, signal) pairs to read, in snapshot order.
+/// @return The query to pass to Snapshot.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::SnapshotQuery CDeviceManager::ResolveSnapshot(
+        const std::vector<SignalName> & signals)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SnapshotQuery query;
+    query.size = signals.size();
+    std::map<IAdapter *, std::size_t> groups;
+
+    for( std::size_t i = 0; i < signals.size(); i++ )
+    {
+        CDevice::Pointer device = GetDevice(signals[i].first);
+
+        if( !device )
+        {
+            throw std::runtime_error("No such device: " + signals[i].first);
+        }
+
+        SignalHandle handle = device->GetStateHandle(signals[i].second);
+        IAdapter * adapter = device->m_adapter.get();
+
+        if( groups.count(adapter) == 0 )
+        {
+            groups[adapter] = query.groups.size();
+            query.groups.push_back(SnapshotQuery::SGroup());
+            query.groups.back().adapter = device->m_adapter;
+            query.groups.back().buffer = device->m_buffer;
+        }
+
+        SnapshotQuery::SGroup & group = query.groups[groups[adapter]];
+
+        if( group.buffer )
+        {
+            group.handles.push_back(handle);
+        }
+        else
+        {
+            group.devices.push_back(signals[i].first);
+            group.signals.push_back(signals[i].second);
+        }
+        group.slots.push_back(i);
+    }
+
+    return query;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reads every signal of a query into a flat buffer. The signals of a buffer
+/// adapter are copied in one critical section, so they come from the same
+/// adapter cycle.
+///
+/// @ErrorHandling Throws a std::runtime_error if an adapter rejects a signal.
+/// @pre The query must come from ResolveSnapshot.
+/// @post values[i] holds the state of the i-th signal of the query.
+/// @param query The resolved signals to read.
+/// @param values The buffer that receives the values, resized to the query.
+///
+/// @limitations Adapters without buffers are read one signal at a time, and
+/// the signals of different adapters can come from different cycles.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::Snapshot(const SnapshotQuery & query,
+        std::vector<SignalValue> & values) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    values.resize(query.size);
+
+    BOOST_FOREACH(const SnapshotQuery::SGroup & group, query.groups)
+    {
+        if( group.buffer )
+        {
+            group.buffer->GetStates(group.handles, group.slots, values);
+            continue;
+        }
+
+        for( std::size_t i = 0; i < group.slots.size(); i++ )
+        {
+            values[group.slots[i]] =
+                    group.adapter->GetState(group.devices[i], group.signals[i]);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Adds a command to a batch. The command is checked against the device and
+/// resolved to its buffer index now, so CommitCommands only has to copy it.
+///
+/// @ErrorHandling Throws a std::runtime_error if the device does not have
+/// the command signal.
+/// @pre None.
+/// @post The command is in the group of the device's adapter in the batch.
+/// @param batch The batch to add the command to.
+/// @param device The device to command.
+/// @param signal The string identifier of the command signal.
+/// @param value The desired new value for the command signal.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::StageCommand(CommandBatch & batch,
+        const CDevice::Pointer & device, const std::string & signal,
+        SignalValue value) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    StageCommand(batch, device, device->GetCommandHandle(signal), value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Adds a command resolved by CDevice::GetCommandHandle to a batch. A later
+/// command for the same signal in the batch overwrites the earlier one when
+/// the batch is committed.
+///
+/// @pre The handle must come from GetCommandHandle on the device.
+/// @post The command is in the group of the device's adapter in the batch.
+/// @param batch The batch to add the command to.
+/// @param device The device to command.
+/// @param handle The handle of the command signal.
+/// @param value The desired new value for the command signal.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::StageCommand(CommandBatch & batch,
+        const CDevice::Pointer & device, SignalHandle handle,
+        SignalValue value) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::size_t i = 0;
+
+    // A batch spans few adapters, so a scan finds the group
+    while( i < batch.groups.size() && batch.groups[i].adapter != device->m_adapter )
+    {
+        i++;
+    }
+
+    if( i == batch.groups.size() )
+    {
+        batch.groups.push_back(CommandBatch::SGroup());
+        batch.groups.back().adapter = device->m_adapter;
+        batch.groups.back().buffer = device->m_buffer;
+    }
+
+    CommandBatch::SGroup & group = batch.groups[i];
+
+    if( group.buffer )
+    {
+        group.handles.push_back(handle);
+    }
+    else
+    {
+        group.devices.push_back(device->m_devid);
+        group.signals.push_back(device->m_type->GetCommandName(handle));
+    }
+    group.values.push_back(value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Writes every command of a batch and empties it. The commands of a buffer
+/// adapter are written in one critical section, and the adapter copies its
+/// command table under the same lock, so they go out in the same frame.
+///
+/// @ErrorHandling Throws a std::runtime_error if an adapter rejects a command.
+/// The commands of a buffer adapter are all written or none are.
+/// @pre The commands must have been staged by StageCommand.
+/// @post The commands are in their adapters and the batch is empty.
+/// @param batch The batch to write.
+///
+/// @limitations Adapters without buffers are written one command at a time.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::CommitCommands(CommandBatch & batch) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    CommandBatch staged;
+    staged.groups.swap(batch.groups);
+
+    BOOST_FOREACH(const CommandBatch::SGroup & group, staged.groups)
+    {
+        if( group.buffer )
+        {
+            group.buffer->SetCommands(group.handles, group.values);
+            continue;
+        }
+
+        for( std::size_t i = 0; i < group.values.size(); i++ )
+        {
+            group.adapter->SetCommand(group.devices[i], group.signals[i],
+                    group.values[i]);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Subscribes a module to the net value of a signal over the devices of a
+/// type. When an adapter publishes states that move the value by more than
+/// the threshold since the last event, the handler is scheduled in the phase
+/// of the module. Changes that occur before the handler runs are coalesced
+/// into that one event, which reads the value when it runs.
+///
+/// @pre The module must be registered with the broker.
+/// @post Inserts the subscription into m_subscriptions.
+/// @param module The module whose phase runs the handler.
+/// @param type The device type to aggregate over.
+/// @param signal The signal of the devices to aggregate.
+/// @param threshold The change in the net value that raises an event.
+/// @param handler The function to call with the new net value.
+/// @return The identifier to pass to Unsubscribe.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::SubscriptionId CDeviceManager::Subscribe(
+        const std::string & module, const std::string & type,
+        const std::string & signal, SignalValue threshold,
+        ChangeHandler handler)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SSubscription subscription;
+    subscription.module = module;
+    subscription.type = type;
+    subscription.signal = signal;
+    subscription.threshold = threshold;
+    subscription.last = GetAggregate(type, signal).sum;
+    subscription.pending = false;
+    subscription.each = false;
+    subscription.handler = handler;
+
+    boost::lock_guard<boost::mutex> lock(m_subscriptionMutex);
+    SubscriptionId id = m_nextSubscription++;
+    m_subscriptions[id] = subscription;
+
+    LOG_INFO(Logger) << module << " subscribed to " << type << " " << signal
+            << " changes above " << threshold << std::endl;
+    return id;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Subscribes a module to the signal of each device of a type. An event is
+/// raised when the signal of any one device changes, or a device of the type
+/// joins or leaves, even if the net value stays the same, as when one device
+/// opens while another closes. This suits a few devices with discrete
+/// states; the signal of every device is compared on each change.
+///
+/// @pre The module must be registered with the broker.
+/// @post Inserts the subscription into m_subscriptions.
+/// @param module The module whose phase runs the handler.
+/// @param type The device type to watch.
+/// @param signal The signal of the devices to watch.
+/// @param handler The function to call with the new net value.
+/// @return The identifier to pass to Unsubscribe.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CDeviceManager::SubscriptionId CDeviceManager::SubscribeEach(
+        const std::string & module, const std::string & type,
+        const std::string & signal, ChangeHandler handler)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SSubscription subscription;
+    subscription.module = module;
+    subscription.type = type;
+    subscription.signal = signal;
+    subscription.threshold = 0;
+    subscription.last = 0;
+    subscription.pending = false;
+    subscription.each = true;
+    subscription.values = ReadEach(type, signal);
+    subscription.handler = handler;
+
+    boost::lock_guard<boost::mutex> lock(m_subscriptionMutex);
+    SubscriptionId id = m_nextSubscription++;
+    m_subscriptions[id] = subscription;
+
+    LOG_INFO(Logger) << module << " subscribed to each " << type << " "
+            << signal << std::endl;
+    return id;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Removes a subscription. An event that is already scheduled does nothing
+/// when it runs.
+///
+/// @pre None.
+/// @post Erases the subscription from m_subscriptions.
+/// @param id The identifier returned by Subscribe.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::Unsubscribe(SubscriptionId id)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(m_subscriptionMutex);
+    m_subscriptions.erase(id);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Compares the net value of each subscription with its last event and
+/// schedules an event for those that moved past their threshold, or for
+/// SubscribeEach the signal of each device with the last event. The event
+/// waits for the phase of the module rather than running on the adapter.
+///
+/// @pre The new states or devices are visible to GetState.
+/// @post Each changed subscription has an event pending.
+///
+/// @limitations Only IAdapter::StatesChanged and PublishTable should call
+///     this function.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::NotifySubscribers()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::lock_guard<boost::mutex> lock(m_subscriptionMutex);
+
+    BOOST_FOREACH(SubscriptionMap::value_type & entry, m_subscriptions)
+    {
+        SSubscription & subscription = entry.second;
+
+        if( subscription.pending )
+        {
+            continue;
+        }
+
+        bool changed;
+
+        if( subscription.each )
+        {
+            changed = ReadEach(subscription.type, subscription.signal)
+                    != subscription.values;
+        }
+        else
+        {
+            SignalValue value =
+                    GetAggregate(subscription.type, subscription.signal).sum;
+            changed = std::fabs(value - subscription.last)
+                    > subscription.threshold;
+        }
+
+        if( changed )
+        {
+            // the module runs the event in its own phase, not on this thread
+            subscription.pending = CBroker::Instance().Schedule(
+                    subscription.module, boost::bind(&CDeviceManager::DeliverChange,
+                    this, entry.first), false) == 0;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Runs the handler of a subscription with the net value at the time the
+/// event runs, so every change coalesced into the event is seen.
+///
+/// @pre The event was scheduled by NotifySubscribers.
+/// @post The value is recorded as the last event of the subscription.
+/// @param id The identifier of the subscription.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CDeviceManager::DeliverChange(SubscriptionId id)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    ChangeHandler handler;
+    SignalValue value;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_subscriptionMutex);
+        SubscriptionMap::iterator it = m_subscriptions.find(id);
+
+        if( it == m_subscriptions.end() )
+        {
+            return;
+        }
+
+        if( it->second.each )
+        {
+            it->second.values = ReadEach(it->second.type, it->second.signal);
+        }
+        value = GetAggregate(it->second.type, it->second.signal).sum;
+        it->second.last = value;
+        it->second.pending = false;
+        handler = it->second.handler;
+    }
+
+    handler(value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reads the signal of each visible device of a type, keyed by the device
+/// identifier so that a device that joins or leaves is also a change.
+///
+/// @pre The signal must be recognized by the devices of the type.
+/// @post None.
+/// @param type The device type to read.
+/// @param signal The signal of the devices to read.
+/// @return The signal of each device of the type.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+std::map<std::string, SignalValue> CDeviceManager::ReadEach(
+        const std::string & type, const std::string & signal) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<std::string, SignalValue> values;
+    DeviceSetView devices = GetDeviceView(type);
+
+    BOOST_FOREACH(const CDevice::Pointer & device, *devices)
+    {
+        values[device->GetID()] = device->GetState(signal);
+    }
+    return values;
+}
+
 } // namespace device
 } // namespace broker
 } // namespace freedm
@@ -25,13 +25,19 @@
 #ifndef C_DEVICE_MANAGER_HPP
 #define C_DEVICE_MANAGER_HPP
 
+#include "CControlLoop.hpp"
 #include "CDevice.hpp"
 
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 namespace freedm {
@@ -53,6 +59,91 @@ class CDeviceManager
     : private boost::noncopyable
 {
 public:
+    /// A set of devices.
+    typedef std::set<CDevice::Pointer> DeviceSet;
+
+    /// A shared set of devices that is never modified once published.
+    typedef boost::shared_ptr<const DeviceSet> DeviceSetView;
+
+    /// The sum, extremes and count of a signal over the devices of a type.
+    struct SignalAggregate
+    {
+        SignalValue sum;
+        SignalValue min;
+        SignalValue max;
+        std::size_t count;
+    };
+
+    /// Called in the phase of a subscribed module with the new net value.
+    typedef boost::function<void (SignalValue)> ChangeHandler;
+
+    /// Identifies a subscription returned by Subscribe.
+    typedef unsigned int SubscriptionId;
+
+    /// A device signal to read, as the device identifier and the signal.
+    typedef std::pair<std::string, std::string> SignalName;
+
+    /// A batch of device signals resolved once by ResolveSnapshot.
+    struct SnapshotQuery
+    {
+        /// The signals of a query that are stored by one adapter.
+        struct SGroup
+        {
+            /// The adapter that stores the signals.
+            IAdapter::Pointer adapter;
+
+            /// The adapter if it stores its signals in buffers, otherwise null.
+            boost::shared_ptr<IBufferAdapter> buffer;
+
+            /// The device of each signal, for adapters without buffers.
+            std::vector<std::string> devices;
+
+            /// Each signal, for adapters without buffers.
+            std::vector<std::string> signals;
+
+            /// The buffer index of each signal, for buffer adapters.
+            std::vector<SignalHandle> handles;
+
+            /// The position of each signal in the snapshot.
+            std::vector<std::size_t> slots;
+        };
+
+        /// The signals of the query grouped by adapter.
+        std::vector<SGroup> groups;
+
+        /// The number of signals in the query.
+        std::size_t size;
+    };
+
+    /// Commands staged by StageCommand and written by CommitCommands.
+    struct CommandBatch
+    {
+        /// The commands of a batch that are stored by one adapter.
+        struct SGroup
+        {
+            /// The adapter that stores the commands.
+            IAdapter::Pointer adapter;
+
+            /// The adapter if it stores its signals in buffers, otherwise null.
+            boost::shared_ptr<IBufferAdapter> buffer;
+
+            /// The device of each command, for adapters without buffers.
+            std::vector<std::string> devices;
+
+            /// Each command, for adapters without buffers.
+            std::vector<std::string> signals;
+
+            /// The buffer index of each command, for buffer adapters.
+            std::vector<SignalHandle> handles;
+
+            /// The value of each command.
+            std::vector<SignalValue> values;
+        };
+
+        /// The staged commands grouped by adapter.
+        std::vector<SGroup> groups;
+    };
+
     /// Gets the instance of the device manager.
     static CDeviceManager & Instance();
 
@@ -68,13 +159,60 @@ public:
     /// Retrieves all the stored devices of a specified type.
     std::set<CDevice::Pointer> GetDevicesOfType(std::string type);
 
+    /// Retrieves a view of the stored devices of a specified type.
+    DeviceSetView GetDeviceView(const std::string & type) const;
+
     /// Retrieves a multiset of stored values for the given device signal.
     std::multiset<SignalValue> GetValues(std::string type,
             std::string signal);
 
+    /// Writes the stored values for the given device signal to an iterator.
+    template <typename OutputIterator>
+    OutputIterator GetValues(const std::string & type,
+            const std::string & signal, OutputIterator out) const;
+
+    /// Computes the sum, extremes and count of a contiguous array of values.
+    static SignalAggregate Reduce(const SignalValue * values,
+            std::size_t count);
+
     /// Returns the result of a binary operation on a set of device signals.
     SignalValue GetNetValue(std::string type, std::string signal);
 
+    /// Returns the sum, extremes and count of a set of device signals.
+    SignalAggregate GetAggregate(const std::string & type,
+            const std::string & signal);
+
+    /// Resolves a batch of device signals for repeated snapshots.
+    SnapshotQuery ResolveSnapshot(const std::vector<SignalName> & signals);
+
+    /// Reads the signals of a query with one lock per adapter.
+    void Snapshot(const SnapshotQuery & query,
+            std::vector<SignalValue> & values) const;
+
+    /// Adds a command to a batch without writing it to the adapter.
+    void StageCommand(CommandBatch & batch, const CDevice::Pointer & device,
+            const std::string & signal, SignalValue value) const;
+
+    /// Adds a command resolved by GetCommandHandle to a batch.
+    void StageCommand(CommandBatch & batch, const CDevice::Pointer & device,
+            SignalHandle handle, SignalValue value) const;
+
+    /// Writes the commands of a batch with one lock per adapter.
+    void CommitCommands(CommandBatch & batch) const;
+
+    /// Schedules a handler when the net value of a signal changes.
+    SubscriptionId Subscribe(const std::string & module,
+            const std::string & type, const std::string & signal,
+            SignalValue threshold, ChangeHandler handler);
+
+    /// Schedules a handler when the signal of any device of a type changes.
+    SubscriptionId SubscribeEach(const std::string & module,
+            const std::string & type, const std::string & signal,
+            ChangeHandler handler);
+
+    /// Stops the change events of a subscription.
+    void Unsubscribe(SubscriptionId id);
+
 private:
     /// A typedef for the mapping of identifier to device pointers.
     typedef std::map<std::string, CDevice::Pointer> PhysicalDeviceSet;
@@ -85,6 +223,69 @@ private:
     /// A typedef providing an iterator for this object.
     typedef PhysicalDeviceSet::iterator iterator;
 
+    /// A typedef for the mapping of types to the devices of that type.
+    typedef std::map<std::string, DeviceSetView> TypeIndex;
+
+    /// The visible devices, published as a whole and never modified after.
+    struct SDeviceTable
+    {
+        /// Mapping from identifiers to device pointers.
+        PhysicalDeviceSet devices;
+
+        /// Visible devices by type.
+        TypeIndex types;
+    };
+
+    /// A shared device table that is never modified once published.
+    typedef boost::shared_ptr<const SDeviceTable> DeviceTable;
+
+    /// An aggregate with the state generation it was computed for.
+    struct SCachedAggregate
+    {
+        unsigned long generation;
+        SignalAggregate value;
+        /// The oldest state table the value was computed from.
+        SControlStamp stamp;
+    };
+
+    /// A module waiting for the net value of a signal to change.
+    struct SSubscription
+    {
+        /// The module whose phase runs the handler.
+        std::string module;
+
+        /// The device type to aggregate over.
+        std::string type;
+
+        /// The signal to aggregate.
+        std::string signal;
+
+        /// The change that must be exceeded to raise an event.
+        SignalValue threshold;
+
+        /// The net value of the last event.
+        SignalValue last;
+
+        /// Set while an event is scheduled but has not run.
+        bool pending;
+
+        /// Set to raise an event when the signal of any one device changes.
+        bool each;
+
+        /// The signal of each device at the last event, if each is set.
+        std::map<std::string, SignalValue> values;
+
+        /// The handler of the events.
+        ChangeHandler handler;
+    };
+
+    /// A typedef for the mapping of identifiers to subscriptions.
+    typedef std::map<SubscriptionId, SSubscription> SubscriptionMap;
+
+    /// A typedef for the mapping of (type, signal) to its cached aggregate.
+    typedef std::map<std::pair<std::string, std::string>, SCachedAggregate>
+            AggregateCache;
+
     /// CAdapterFactory can add/remove devices.
     friend class CAdapterFactory;
 
@@ -100,22 +301,105 @@ private:
     /// Add a pointer to the hidden device set.
     void AddDevice(CDevice::Pointer device);
 
+    /// Add several pointers at once, to the visible set if reveal is set.
+    void AddDevices(const std::vector<CDevice::Pointer> & devices,
+            bool reveal = false);
+
     /// Move a pointer to the visible device set.
     void RevealDevice(std::string devid);
 
+    /// Move several pointers to the visible device set at once.
+    void RevealDevices(const std::set<std::string> & devids);
+
     /// Remove a device by its identifier.
     bool RemoveDevice(std::string devid);
 
-    /// Mapping from identifiers to device pointers.
-    PhysicalDeviceSet m_devices;
+    /// Remove several devices at once.
+    std::size_t RemoveDevices(const std::set<std::string> & devids);
+
+    /// Adds or removes visible devices in the type index.
+    void IndexDevices(SDeviceTable & table,
+            const std::vector<CDevice::Pointer> & devices, bool insert);
+
+    /// Gets the device table published last.
+    DeviceTable GetTable() const;
+
+    /// Publishes a new device table and notifies the subscribers once.
+    void PublishTable(DeviceTable table);
+
+    /// Marks every cached aggregate as out of date.
+    void InvalidateAggregates();
+
+    /// Schedules the events of the subscriptions whose value changed.
+    void NotifySubscribers();
+
+    /// Reads the signal of each device of a type by device identifier.
+    std::map<std::string, SignalValue> ReadEach(const std::string & type,
+            const std::string & signal) const;
+
+    /// Runs the handler of a subscription with its current value.
+    void DeliverChange(SubscriptionId id);
+
+    /// The visible devices, replaced rather than modified on change.
+    DeviceTable m_table;
 
     /// Set of uninitialized device objects.
     PhysicalDeviceSet m_hidden_devices;
 
-    /// Mutex for the device map.
+    /// Serializes the changes to the devices and guards m_hidden_devices.
+    boost::mutex m_writeMutex;
+
+    /// Mutex for the m_table pointer, held only to copy or replace it.
     mutable boost::shared_mutex m_mutex;
+
+    /// Aggregates of the device signals read since the states last changed.
+    AggregateCache m_aggregates;
+
+    /// Incremented each time a device joins, leaves or publishes new states.
+    unsigned long m_generation;
+
+    /// Mutex for the aggregate cache and its generation.
+    boost::mutex m_aggregateMutex;
+
+    /// Modules waiting for device signals to change.
+    SubscriptionMap m_subscriptions;
+
+    /// The identifier of the next subscription.
+    SubscriptionId m_nextSubscription;
+
+    /// Mutex for the subscriptions.
+    boost::mutex m_subscriptionMutex;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// Writes the value of a signal for each device of a type to an output
+/// iterator, in no particular order. Unlike the multiset overload nothing is
+/// allocated, so the caller can reuse its buffer or reduce on the fly.
+///
+/// @pre The signal must be recognized by the specified device.
+/// @post Writes one value per device of the type to out.
+/// @param type The type of the device to collect signals from.
+/// @param signal The signal of the device to collect.
+/// @param out The iterator that receives the values.
+/// @return The iterator past the last value written.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <typename OutputIterator>
+OutputIterator CDeviceManager::GetValues(const std::string & type,
+        const std::string & signal, OutputIterator out) const
+{
+    DeviceSetView devices = GetDeviceView(type);
+    DeviceSet::const_iterator it, end;
+
+    for( it = devices->begin(), end = devices->end(); it != end; it++ )
+    {
+        *out++ = (*it)->GetState(signal);
+    }
+
+    return out;
+}
+
 } // namespace device
 } // namespace broker
 } // namespace freedm
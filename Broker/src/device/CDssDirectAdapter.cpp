@@ -0,0 +1,417 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CDssDirectAdapter.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that runs an OpenDSS engine inside the DGI process.
+///
+/// @functions    CDssDirectAdapter::Create
+///               CDssDirectAdapter::CDssDirectAdapter
+///               CDssDirectAdapter::ReadProperties
+///               CDssDirectAdapter::Resolve
+///               CDssDirectAdapter::Command
+///               CDssDirectAdapter::Start
+///               CDssDirectAdapter::Solve
+///               CDssDirectAdapter::Stop
+///               CDssDirectAdapter::~CDssDirectAdapter
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CDssDirectAdapter.hpp"
+#include "CLogger.hpp"
+#include "CTimings.hpp"
+
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include <dlfcn.h>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The library loaded when the info tag does not name one.
+const char * DEFAULT_LIBRARY = "libdss_capi.so";
+
+} // unnamed namespace
+
+///////////////////////////////////////////////////////////////////////////////
+/// Creates an in-process OpenDSS adapter on the given io_service.
+///
+/// @Shared_Memory Uses the passed io_service
+///
+/// @pre None.
+/// @post CDssDirectAdapter object is returned for use.
+///
+/// @param service The io_service that runs the solutions.
+/// @param ptree The info tag of the adapter.
+///
+/// @return Shared pointer to the new CDssDirectAdapter object.
+///
+/// @limitations None
+///////////////////////////////////////////////////////////////////////////////
+IAdapter::Pointer CDssDirectAdapter::Create(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return CDssDirectAdapter::Pointer(new CDssDirectAdapter(service, ptree));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructs an in-process OpenDSS adapter.  The info tag holds the script
+/// of the circuit, the element property of each state and command, and the
+/// optional library and period, which default to libdss_capi.so and
+/// DEV_RTDS_DELAY.  The library is loaded and the engine context of the
+/// adapter is created here, so a missing library fails the configuration.
+///
+/// @Shared_Memory Uses the passed io_service.
+///
+/// @ErrorHandling Throws a std::runtime_error if the period is zero, or if the
+///     library cannot be loaded or lacks a function of the DSS C-API.
+/// @pre None.
+/// @post The adapter has an engine context of its own.
+///
+/// @param service The io_service that runs the solutions.
+/// @param ptree The info tag of the adapter.
+///
+/// @limitations None
+////////////////////////////////////////////////////////////////////////////////
+CDssDirectAdapter::CDssDirectAdapter(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+    : m_library(0)
+    , m_context(0)
+    , m_script(ptree.get<std::string>("script"))
+    , m_period(ptree.get<unsigned int>("period", CTimings::Get(CTimings::DEV_RTDS_DELAY)))
+    , m_solveTimer(service)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string library = ptree.get<std::string>("library", DEFAULT_LIBRARY);
+
+    if( m_period == 0 )
+    {
+        throw std::runtime_error("The DSS adapter period must be positive.");
+    }
+
+    ReadProperties(ptree, "state", m_states);
+    ReadProperties(ptree, "command", m_commands);
+
+    m_library = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if( !m_library )
+    {
+        throw std::runtime_error("Could not load the DSS library " + library
+                + ": " + dlerror());
+    }
+
+    try
+    {
+        m_new = reinterpret_cast<NewFunction>(Resolve("ctx_New"));
+        m_dispose = reinterpret_cast<DisposeFunction>(Resolve("ctx_Dispose"));
+        m_setCommand = reinterpret_cast<SetCommandFunction>(Resolve("ctx_Text_Set_Command"));
+        m_getResult = reinterpret_cast<GetResultFunction>(Resolve("ctx_Text_Get_Result"));
+        m_solve = reinterpret_cast<SolveFunction>(Resolve("ctx_Solution_Solve"));
+        m_errorNumber = reinterpret_cast<ErrorNumberFunction>(Resolve("ctx_Error_Get_Number"));
+        m_errorDescription = reinterpret_cast<ErrorDescriptionFunction>(
+                Resolve("ctx_Error_Get_Description"));
+
+        m_context = m_new();
+        if( !m_context )
+        {
+            throw std::runtime_error("The DSS library could not create an engine.");
+        }
+    }
+    catch( ... )
+    {
+        dlclose(m_library);
+        m_library = 0;
+        throw;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reads the element properties of one kind of signal from the info tag.
+/// Each tag of the kind holds a property such as Load.L1.kW and the index of
+/// the buffer entry it fills or drains.
+///
+/// @ErrorHandling Throws a std::runtime_error if an index is not positive or
+///     is given twice.
+/// @pre None.
+/// @post out maps the buffer position of each index to its property.
+///
+/// @param ptree The info tag of the adapter.
+/// @param tag The kind of signal, state or command.
+/// @param out The map to fill.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CDssDirectAdapter::ReadProperties(const boost::property_tree::ptree & ptree,
+        const std::string & tag, std::map<std::size_t, std::string> & out)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    BOOST_FOREACH(const boost::property_tree::ptree::value_type & child, ptree)
+    {
+        if( child.first != tag )
+        {
+            continue;
+        }
+
+        std::size_t index = child.second.get<std::size_t>("<xmlattr>.index");
+        std::string property = child.second.get_value<std::string>();
+
+        if( index == 0 || property.empty() )
+        {
+            throw std::runtime_error("Each DSS " + tag
+                    + " needs a positive index and a property.");
+        }
+        if( !out.insert(std::make_pair(index - 1, property)).second )
+        {
+            throw std::runtime_error("The DSS " + tag + " index "
+                    + boost::lexical_cast<std::string>(index) + " is given twice.");
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Finds a function of the loaded library.
+///
+/// @ErrorHandling Throws a std::runtime_error if the library lacks it.
+/// @pre The library is loaded.
+/// @post None.
+///
+/// @param symbol The name of the function.
+///
+/// @return The address of the function.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void * CDssDirectAdapter::Resolve(const char * symbol)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    void * address = dlsym(m_library, symbol);
+    if( !address )
+    {
+        throw std::runtime_error(std::string("The DSS library has no ") + symbol);
+    }
+    return address;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Runs an OpenDSS command on the engine of this adapter.
+///
+/// @ErrorHandling Throws a std::runtime_error if the engine reports an error.
+/// @pre The engine context exists.
+/// @post The command has run.
+///
+/// @param command The text of the command.
+///
+/// @return The result text of the command.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+std::string CDssDirectAdapter::Command(const std::string & command)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_setCommand(m_context, command.c_str());
+    if( m_errorNumber(m_context) != 0 )
+    {
+        throw std::runtime_error("OpenDSS rejected '" + command + "': "
+                + m_errorDescription(m_context));
+    }
+
+    const char * result = m_getResult(m_context);
+    return result ? result : "";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sizes the buffers, builds the circuit and starts the solutions.
+///
+/// @ErrorHandling Throws a std::runtime_error if a state or command has no
+///     property or a property has no buffer entry, or if the script fails.
+/// @pre The devices of the adapter have been registered.
+/// @post CDssDirectAdapter::Solve is scheduled.
+///
+/// @limitations All devices must be added to the adapter before this call.
+////////////////////////////////////////////////////////////////////////////////
+void CDssDirectAdapter::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    IBufferAdapter::Start();
+
+    if( m_states.size() != m_rxBuffer.size()
+        || (!m_states.empty() && m_states.rbegin()->first >= m_rxBuffer.size())
+        || m_commands.size() != m_txBuffer.size()
+        || (!m_commands.empty() && m_commands.rbegin()->first >= m_txBuffer.size()) )
+    {
+        throw std::runtime_error("The DSS adapter needs one property for each"
+                " of its states and commands.");
+    }
+
+    Command("redirect \"" + m_script + "\"");
+    LOG_NOTICE(Logger) << "Loaded the DSS circuit " << m_script << std::endl;
+
+    m_solveTimer.expires_from_now(boost::posix_time::milliseconds(0));
+    m_solveTimer.async_wait(boost::bind(&CDssDirectAdapter::Solve,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Writes the commands to the circuit, solves it and reads the states, then
+/// schedules the next solution one period after this one.  A command that was
+/// never set leaves its property alone.  The devices are revealed after the
+/// first solution.
+///
+/// @ErrorHandling Logs and stops the solutions if the engine reports an error
+///     or returns a property that is not a number.
+/// @pre The circuit is loaded.
+/// @post m_rxBuffer holds the states of the solved circuit.
+///
+/// @param e The error code of the solve timer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CDssDirectAdapter::Solve(const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( e )
+    {
+        if( e != boost::asio::error::operation_aborted )
+        {
+            LOG_ERROR(Logger) << "Solve timer failed: " << e.message() << std::endl;
+        }
+        return;
+    }
+
+    try
+    {
+        std::map<std::size_t, std::string>::const_iterator it;
+
+        SnapshotCommands();
+        for( it = m_commands.begin(); it != m_commands.end(); it++ )
+        {
+            if( m_txStaging[it->first] != NULL_COMMAND )
+            {
+                std::ostringstream command;
+                command << it->second << "=" << m_txStaging[it->first];
+                Command(command.str());
+            }
+        }
+
+        m_solve(m_context);
+        if( m_errorNumber(m_context) != 0 )
+        {
+            throw std::runtime_error(std::string("OpenDSS could not solve: ")
+                    + m_errorDescription(m_context));
+        }
+
+        for( it = m_states.begin(); it != m_states.end(); it++ )
+        {
+            // vector properties come back as [ a b c ], keep the first value
+            std::string result = Command("? " + it->second);
+            std::string::size_type begin = result.find_first_not_of("[ ");
+            const char * text = result.c_str() + (begin == std::string::npos ? 0 : begin);
+            char * end;
+            double value = std::strtod(text, &end);
+            if( end == text )
+            {
+                throw std::runtime_error("OpenDSS returned '" + result
+                        + "' for " + it->second);
+            }
+            m_rxStaging[it->first] = static_cast<SignalValue>(value);
+        }
+    }
+    catch( std::exception & ex )
+    {
+        LOG_ERROR(Logger) << "Stopped the DSS circuit " << m_script << ": "
+                << ex.what() << std::endl;
+        return;
+    }
+
+    PublishStates();
+
+    if( m_buffer_initialized == false )
+    {
+        m_buffer_initialized = true;
+        RevealDevices();
+    }
+
+    m_solveTimer.expires_at(m_solveTimer.expires_at()
+            + boost::posix_time::milliseconds(m_period));
+    m_solveTimer.async_wait(boost::bind(&CDssDirectAdapter::Solve,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Stops the adapter. Thread-safe.
+///
+/// @pre None.
+/// @post The solve timer is cancelled.
+///
+/// @limitations None
+////////////////////////////////////////////////////////////////////////////
+void CDssDirectAdapter::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    try
+    {
+        m_solveTimer.cancel();
+    }
+    catch( boost::system::system_error & e )
+    {
+        LOG_ERROR(Logger) << "Error cancelling timer: " << e.what() << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Destructor.
+///
+/// @pre None.
+/// @post The engine context is disposed and the library is released.
+///
+/// @limitations None
+////////////////////////////////////////////////////////////////////////////
+CDssDirectAdapter::~CDssDirectAdapter()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_context )
+    {
+        m_dispose(m_context);
+    }
+    if( m_library )
+    {
+        dlclose(m_library);
+    }
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
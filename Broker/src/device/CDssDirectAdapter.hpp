@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CDssDirectAdapter.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that runs an OpenDSS engine inside the DGI process.
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_DSS_DIRECT_ADAPTER_HPP
+#define C_DSS_DIRECT_ADAPTER_HPP
+
+#include "IBufferAdapter.hpp"
+
+#include <map>
+#include <string>
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// Solves an OpenDSS circuit in process through the DSS C-API.
+////////////////////////////////////////////////////////////////////////////////
+/// Unlike the OpenDSS adapter, which hands its buffers to an external engine
+/// through static state and a socket, each of these adapters opens its own
+/// engine context of the DSS C-API library.  Several adapters can therefore
+/// simulate different feeders in one DGI without sharing any state.
+///
+/// Once per period the adapter writes the commands of its buffer as property
+/// assignments, solves the circuit, and reads its states back as property
+/// queries.  The library is loaded when the adapter is constructed, so the
+/// DGI does not depend on it unless such an adapter is configured.
+///
+/// @limitations Every state and command index must name one property of an
+///     element of the circuit.  Engine errors stop the adapter.
+////////////////////////////////////////////////////////////////////////////////
+class CDssDirectAdapter
+    : public IBufferAdapter
+    , public boost::enable_shared_from_this<CDssDirectAdapter>
+{
+public:
+    /// Pointer to a CDssDirectAdapter object.
+    typedef boost::shared_ptr<CDssDirectAdapter> Pointer;
+
+    /// Create a CDssDirectAdapter object and returns a pointer to it.
+    static IAdapter::Pointer Create(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Starts the adapter.
+    void Start();
+
+    /// Stops the solutions.
+    void Stop();
+
+    /// Destructor.
+    ~CDssDirectAdapter();
+
+private:
+    /// Functions of the DSS C-API that take an engine context.
+    //@{
+    typedef void * (*NewFunction)();
+    typedef void (*DisposeFunction)(void *);
+    typedef void (*SetCommandFunction)(void *, const char *);
+    typedef const char * (*GetResultFunction)(void *);
+    typedef void (*SolveFunction)(void *);
+    typedef int (*ErrorNumberFunction)(void *);
+    typedef const char * (*ErrorDescriptionFunction)(void *);
+    //@}
+
+    /// Constructor.
+    CDssDirectAdapter(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Reads the element properties of the states or commands.
+    static void ReadProperties(const boost::property_tree::ptree & ptree,
+            const std::string & tag, std::map<std::size_t, std::string> & out);
+
+    /// Finds a function of the loaded library.
+    void * Resolve(const char * symbol);
+
+    /// Runs an OpenDSS command and returns its result.
+    std::string Command(const std::string & command);
+
+    /// Solves the circuit and schedules the next solution.
+    void Solve(const boost::system::error_code & e);
+
+    /// Handle of the loaded library.
+    void * m_library;
+
+    /// Engine context of this adapter.
+    void * m_context;
+
+    /// The functions of the library.
+    //@{
+    NewFunction m_new;
+    DisposeFunction m_dispose;
+    SetCommandFunction m_setCommand;
+    GetResultFunction m_getResult;
+    SolveFunction m_solve;
+    ErrorNumberFunction m_errorNumber;
+    ErrorDescriptionFunction m_errorDescription;
+    //@}
+
+    /// Script that builds the circuit.
+    std::string m_script;
+
+    /// Element property of each state index.
+    std::map<std::size_t, std::string> m_states;
+
+    /// Element property of each command index.
+    std::map<std::size_t, std::string> m_commands;
+
+    /// Milliseconds between two solutions.
+    unsigned int m_period;
+
+    /// Timer for the solutions.
+    boost::asio::deadline_timer m_solveTimer;
+};
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // C_DSS_DIRECT_ADAPTER_HPP
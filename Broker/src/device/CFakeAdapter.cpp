@@ -49,7 +49,7 @@ CFakeAdapter::CFakeAdapter()
 ////////////////////////////////////////////////////////////////////////////////
 CFakeAdapter::Pointer CFakeAdapter::Create()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return Pointer(new CFakeAdapter());
 }
 
@@ -62,7 +62,7 @@ CFakeAdapter::Pointer CFakeAdapter::Create()
 ////////////////////////////////////////////////////////////////////////////////
 void CFakeAdapter::Start()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     RevealDevices();
 }
 
@@ -74,7 +74,7 @@ void CFakeAdapter::Start()
 ////////////////////////////////////////////////////////////////////////////////
 void CFakeAdapter::Stop()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     m_stopMutex.lock();
     m_stopped = true;
@@ -94,7 +94,7 @@ void CFakeAdapter::Stop()
 SignalValue CFakeAdapter::GetState(const std::string device,
                               const std::string key) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     // Get a map of keys/values from the map of devices/maps.
     // Then look up the value in that map.
@@ -127,13 +127,16 @@ SignalValue CFakeAdapter::GetState(const std::string device,
 void CFakeAdapter::SetCommand(const std::string device, const std::string key,
                        const SignalValue value)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    boost::lock_guard<boost::mutex> lock(m_stopMutex);
-    if (!m_stopped)
     {
-        m_registry[device][key] = value;
+        boost::lock_guard<boost::mutex> lock(m_stopMutex);
+        if (!m_stopped)
+        {
+            m_registry[device][key] = value;
+        }
     }
+    StatesChanged();
 }
 
 } // namespace device
@@ -35,10 +35,17 @@
 #include "CDeviceManager.hpp"
 #include "CGlobalConfiguration.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CThreadPolicy.hpp"
 
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/pointer_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <cstdlib>
+#include <cstring>
+
 #define ADDRESS   "tcp://localhost:1883"
 #define CLIENTID  "ExampleClientPub"
 #define TOPIC     "MQTT Example"
@@ -56,13 +63,52 @@ namespace freedm {
             namespace {
                 /// This file's logger.
                 CLocalLogger Logger(__FILE__);
+
+                /// Longest payload that is parsed as a device state.
+                const std::size_t MAX_NUMBER_LENGTH = 63;
+
+                /// Default quality of service of the state topics.
+                const int TELEMETRY_QOS = 0;
+
+                /// Default quality of service of the command topics.
+                const int COMMAND_QOS = 1;
+
+                /// States replaced by a newer one before their worker read them.
+                CCounter& CoalescedMetric = CMetrics::Instance().GetCounter(
+                    "dgi_mqtt_coalesced_states_total",
+                    "MQTT state messages replaced by a newer state of the same topic before they were handled");
+
+                /// Checks if a topic carries the state of a device signal.
+                bool IsStateTopic(const std::string & topic)
+                {
+                    return topic.find("/AOUT/") != std::string::npos
+                        || topic.find("/DOUT/") != std::string::npos;
+                }
+
+                /// Parses a payload that holds nothing but a number without
+                /// building a string from it.
+                bool ParseNumber(const char * payload, std::size_t length, SignalValue & value)
+                {
+                    char number[MAX_NUMBER_LENGTH + 1];
+                    char * end;
+
+                    if(length == 0 || length > MAX_NUMBER_LENGTH)
+                    {
+                        return false;
+                    }
+                    std::memcpy(number, payload, length);
+                    number[length] = '\0';
+                    value = static_cast<SignalValue>(std::strtod(number, &end));
+                    return end == number + length;
+                }
             } // unnamed namespace
 
 
 
             CMqttAdapter::CMqttAdapter(std::string id, std::string address)
+                : m_FlushScheduled(false)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
 
                 if(id.size() > 23)
@@ -76,33 +122,50 @@ namespace freedm {
 
                 if(MQTTClient_setCallbacks(m_Client, &m_ID, ConnectionLost, HandleMessage, DeliveryComplete) != MQTTCLIENT_SUCCESS)
                     throw std::runtime_error("Failed to set the MQTT client callback functions");
+
+                for(unsigned int i = 0; i < CGlobalConfiguration::Instance().GetMQTTWorkers(); i++)
+                {
+                    m_Workers.push_back(boost::shared_ptr<boost::asio::io_service>(
+                        new boost::asio::io_service()));
+                }
             }
 
             CMqttAdapter::~CMqttAdapter()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                m_WorkerLoad.clear();
+                m_WorkerThreads.join_all();
                 MQTTClient_destroy(&m_Client);
             }
 
 
             IAdapter::Pointer CMqttAdapter::Create(std::string id, std::string address) {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 return CMqttAdapter::Pointer(new CMqttAdapter(id, address));
             }
 
             void CMqttAdapter::Start()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 MQTTClient_connectOptions connectOptions = MQTTClient_connectOptions_initializer;
                 connectOptions.keepAliveInterval = 20;
                 connectOptions.cleansession = 1;
 
+                // the workers must run before a subscription can deliver
+                for(std::size_t i = 0; i < m_Workers.size(); i++)
+                {
+                    m_WorkerLoad.push_back(boost::shared_ptr<boost::asio::io_service::work>(
+                        new boost::asio::io_service::work(*m_Workers[i])));
+                    m_WorkerThreads.create_thread(boost::bind(&CMqttAdapter::RunWorker,
+                        this, boost::ref(*m_Workers[i])));
+                }
+
                 int returnCode = MQTTClient_connect(m_Client, &connectOptions);
 
                 if(returnCode != MQTTCLIENT_SUCCESS)
                 {
 
-                    Logger.Error << "MQTT Client Connection Failed with Return Code = " << returnCode << std::endl;
+                    LOG_ERROR(Logger) << "MQTT Client Connection Failed with Return Code = " << returnCode << std::endl;
 
                     throw std::runtime_error("Failed to connect to the MQTT Broker");
 
@@ -120,16 +183,16 @@ namespace freedm {
                                 std::string topic;
                                 topic = subscription + "/1/JSON";
                                 MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
                                 topic = subscription + "/1/AOUT/#";
-                                MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                                MQTTClient_subscribe(m_Client, topic.c_str(), TELEMETRY_QOS);
+                                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
                                 topic = subscription + "/1/DOUT/#";
-                                MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                                MQTTClient_subscribe(m_Client, topic.c_str(), TELEMETRY_QOS);
+                                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
                                 topic = subscription+"/1/ACK";
                                 MQTTClient_subscribe(m_Client, topic.c_str(), 0);
-                                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
 
                                 // Publish(subscription+"/1/ACK", "ACK");
 
@@ -144,76 +207,214 @@ namespace freedm {
 
             void CMqttAdapter::Stop()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 Publish("leave/DGIClient/1", "disconnect");
                 MQTTClient_disconnect(m_Client, 2000);
+
+                // the workers finish the messages they were given
+                m_WorkerLoad.clear();
+                m_WorkerThreads.join_all();
+            }
+
+            /// Runs one worker until the adapter stops.
+            void CMqttAdapter::RunWorker(boost::asio::io_service & ios)
+            {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                CThreadPolicy::Instance().Apply("mqtt");
+
+                try
+                {
+                    ios.run();
+                }
+                catch(std::exception & e)
+                {
+                    LOG_ERROR(Logger) << "MQTT worker stopped: " << e.what() << std::endl;
+                }
+            }
+
+            /// The join and leave topics name their device second, and every
+            /// other topic names it first.
+            std::size_t CMqttAdapter::GetWorker(const std::string & topic) const
+            {
+                std::size_t begin = 0, end;
+
+                if(topic.compare(0, 5, "join/") == 0 || topic.compare(0, 6, "leave/") == 0)
+                {
+                    begin = topic.find('/') + 1;
+                }
+                end = topic.find('/', begin);
+                if(end == std::string::npos)
+                {
+                    end = topic.size();
+                }
+                return boost::hash_range(topic.begin() + begin, topic.begin() + end)
+                    % m_Workers.size();
+            }
+
+            void CMqttAdapter::HandleCopy(const std::string & topic, const std::string & payload)
+            {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                try
+                {
+                    HandleMessage(topic, payload.data(), payload.size());
+                }
+                catch(std::exception & e)
+                {
+                    LOG_WARN(Logger) << "Dropped MQTT message " << topic << ": " << e.what() << std::endl;
+                }
+            }
+
+            /// Takes the latest payload of a state topic, so the states that
+            /// arrived for it since it was posted are handled as one.
+            void CMqttAdapter::HandleState(const std::string & topic)
+            {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                std::string payload;
+                {
+                    boost::lock_guard<boost::mutex> lock(m_PendingStatesLock);
+                    std::map<std::string, std::string>::iterator it = m_PendingStates.find(topic);
+                    if(it == m_PendingStates.end())
+                    {
+                        return;
+                    }
+                    payload.swap(it->second);
+                    m_PendingStates.erase(it);
+                }
+                HandleCopy(topic, payload);
             }
 
             SignalValue CMqttAdapter::GetState(const std::string device, const std::string key) const
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
                 if(m_DeviceData.count(device) != 1)
                 {
-                    Logger.Error << "Device " << device << " does not exist as an MQTT device" << std::endl;
+                    LOG_ERROR(Logger) << "Device " << device << " does not exist as an MQTT device" << std::endl;
                     throw std::runtime_error("Invalid Device Name");
                 }
                 if(m_DeviceData.at(device).s_SignalToValue.count(key) != 1)
                 {
-                    Logger.Error << "Device " << device << " does not have the signal " << key << std::endl;
+                    LOG_ERROR(Logger) << "Device " << device << " does not have the signal " << key << std::endl;
                     throw std::runtime_error("Invalid Device Signal");
                 }
                 SignalValue value = m_DeviceData.at(device).s_SignalToValue.at(key);
-                Logger.Debug << device << " " << key << ": " << value << std::endl;
+                LOG_DEBUG(Logger) << device << " " << key << ": " << value << std::endl;
                 return value;
             }
 
             void CMqttAdapter::SetCommand(const std::string device, const std::string key, const SignalValue value)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
                 if(m_DeviceData.count(device) != 1)
                 {
-                    Logger.Error << "Device " << device << " does not exist as an MQTT device" << std::endl;
+                    LOG_ERROR(Logger) << "Device " << device << " does not exist as an MQTT device" << std::endl;
                     throw std::runtime_error("Invalid Device Name");
                 }
                 if(m_DeviceData[device].s_SignalToValue.count(key) != 1)
                 {
-                    Logger.Error << "Device " << device << " does not have the signal " << key << std::endl;
+                    LOG_ERROR(Logger) << "Device " << device << " does not have the signal " << key << std::endl;
                     throw std::runtime_error("Invalid Device Signal");
                 }
                 m_DeviceData[device].s_SignalToValue[key] = value;
                 std::string strIndex = m_DeviceData[device].s_IndexReference.at(key);
-                Publish(device + "/1/" + strIndex, boost::lexical_cast<std::string>(value));
-                Logger.Info << "Sent Command " << device << "/1/" << strIndex << " = " << value << std::endl;
+                SPendingCommand command;
+                command.s_Value = value;
+                command.s_Delivery = SDelivery(COMMAND_QOS);
+                std::map<std::string, SDelivery>::const_iterator delivery =
+                    m_DeviceData[device].s_Delivery.find(key);
+                if(delivery != m_DeviceData[device].s_Delivery.end())
+                {
+                    command.s_Delivery = delivery->second;
+                }
+
+                // commands of one burst go out together on the devices thread
+                boost::lock_guard<boost::mutex> pending(m_PendingLock);
+                m_PendingCommands[device + "/1/" + strIndex] = command;
+                if(!m_FlushScheduled)
+                {
+                    m_FlushScheduled = true;
+                    CAdapterFactory::Instance().m_ios.post(
+                        boost::bind(&CMqttAdapter::FlushCommands, shared_from_this()));
+                }
+                LOG_INFO(Logger) << "Queued Command " << device << "/1/" << strIndex << " = " << value << std::endl;
+            }
+
+            /// Publishes the latest value of every command topic set since the last
+            /// flush, one message per topic however often it was set.
+            void CMqttAdapter::FlushCommands()
+            {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                std::map<std::string, SPendingCommand> commands;
+                {
+                    boost::lock_guard<boost::mutex> pending(m_PendingLock);
+                    commands.swap(m_PendingCommands);
+                    m_FlushScheduled = false;
+                }
+
+                std::map<std::string, SPendingCommand>::iterator it;
+                for(it = commands.begin(); it != commands.end(); it++)
+                {
+                    Publish(it->first, boost::lexical_cast<std::string>(it->second.s_Value),
+                        it->second.s_Delivery);
+                    LOG_INFO(Logger) << "Sent Command " << it->first << " = " << it->second.s_Value
+                        << " at QoS " << it->second.s_Delivery.s_Qos << std::endl;
+                }
             }
 
             void CMqttAdapter::ConnectionLost(void * id, char * reason)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-                Logger.Error << "MQTT Client " << (char *)id << " lost connection to broker: " << reason << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                LOG_ERROR(Logger) << "MQTT Client " << (char *)id << " lost connection to broker: " << reason << std::endl;
                 throw std::runtime_error("Lost Connection to the MQTT Broker");
             }
 
             int CMqttAdapter::HandleMessage(void * id, char * topic, int topicLen, MQTTClient_message * msg)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                // the client library calls back on a thread of its own
+                CThreadPolicy::Instance().ApplyOnce("mqtt");
                 std::string strId((char *)id);
-                std::string strTopic(topic);
-                std::string message((char *)msg->payload, msg->payloadlen);
-                Logger.Status << "MQTT message received" <<topic<<":"<< message << std::endl;
+                std::map<std::string, IAdapter::Pointer>::iterator it;
+                it = CAdapterFactory::Instance().m_adapters.find(strId);
                 if(topicLen != 0)
                 {
-                    Logger.Warn << "Dropped byte array topic for MQTT adapter with identifier " << strId << std::endl;
+                    LOG_WARN(Logger) << "Dropped byte array topic for MQTT adapter with identifier " << strId << std::endl;
                 }
-                else if(CAdapterFactory::Instance().m_adapters.count(strId) > 0)
+                else if(it != CAdapterFactory::Instance().m_adapters.end())
                 {
-                    Pointer client = boost::dynamic_pointer_cast<CMqttAdapter>(CAdapterFactory::Instance().m_adapters[strId]);
-                    client->HandleMessage(strTopic, message);
+                    Pointer client = boost::dynamic_pointer_cast<CMqttAdapter>(it->second);
+                    std::string name(topic);
+                    if(IsStateTopic(name))
+                    {
+                        // a state still waiting for its worker takes the newer value
+                        boost::lock_guard<boost::mutex> lock(client->m_PendingStatesLock);
+                        std::map<std::string, std::string>::iterator state =
+                            client->m_PendingStates.find(name);
+                        if(state != client->m_PendingStates.end())
+                        {
+                            state->second.assign((const char *)msg->payload, msg->payloadlen);
+                            CoalescedMetric.Increment();
+                        }
+                        else
+                        {
+                            client->m_PendingStates[name].assign((const char *)msg->payload, msg->payloadlen);
+                            client->m_Workers[client->GetWorker(name)]->post(
+                                boost::bind(&CMqttAdapter::HandleState, client.get(), name));
+                        }
+                    }
+                    else
+                    {
+                        std::string payload((const char *)msg->payload, msg->payloadlen);
+                        // the destructor joins the workers, so they need no reference
+                        client->m_Workers[client->GetWorker(name)]->post(
+                            boost::bind(&CMqttAdapter::HandleCopy, client.get(), name, payload));
+                    }
                 }
                 else
                 {
-                    Logger.Warn << "Dropped message for missing MQTT adapter with identifier " << strId << std::endl;
+                    LOG_WARN(Logger) << "Dropped message for missing MQTT adapter with identifier " << strId << std::endl;
                 }
                 MQTTClient_freeMessage(&msg);
                 MQTTClient_free(topic);
@@ -222,20 +423,20 @@ namespace freedm {
 
             void CMqttAdapter::DeliveryComplete(void * id, MQTTClient_deliveryToken token)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                CThreadPolicy::Instance().ApplyOnce("mqtt");
                 std::string strId((char *)id);
-                std::list<CMqttMessage::Pointer>::iterator it;
                 Pointer client = boost::dynamic_pointer_cast<CMqttAdapter>(CAdapterFactory::Instance().m_adapters.at(strId));
-                for(it = client->m_MessageQueue.begin(); it != client->m_MessageQueue.end() && (*it)->GetToken() != token; it++);
-                if(it == client->m_MessageQueue.end())
+                boost::lock_guard<boost::mutex> lock(client->m_InFlightLock);
+                if(client->m_InFlight.erase(token) == 0)
                 {
-                    Logger.Error << "MQTT client " << strId << " does not recognize the token " << token << std::endl;
-                    throw std::runtime_error("Unrecognized Delivery Token");
+                    // Publish has not stored the message of this token yet
+                    LOG_DEBUG(Logger) << "MQTT client " << strId << " delivered " << token << " before it was stored" << std::endl;
+                    client->m_EarlyTokens.insert(token);
                 }
                 else
                 {
-                    Logger.Info << "MQTT client " << strId << " has delivered message " << token << std::endl;
-                    client->m_MessageQueue.erase(it);
+                    LOG_INFO(Logger) << "MQTT client " << strId << " has delivered message " << token << std::endl;
                 }
             }
 
@@ -251,17 +452,41 @@ namespace freedm {
                 return internal;
             }
 
-            void CMqttAdapter::HandleMessage(std::string topic, std::string message)
+            /// State updates are looked up in the routing table and written under
+            /// the lock; every other topic is parsed as before.
+            void CMqttAdapter::HandleMessage(const std::string & topic, const char * payload, std::size_t length)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                LOG_STATUS(Logger) << "MQTT message received" << topic << ":" << std::string(payload, length) << std::endl;
+
+                SignalValue value;
+                if(ParseNumber(payload, length, value))
+                {
+                    bool routed;
+                    {
+                        boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
+                        TTopicToValue::iterator route = m_Routes.find(topic);
+                        routed = (route != m_Routes.end());
+                        if(routed)
+                        {
+                            *route->second = value;
+                        }
+                    }
+                    if(routed)
+                    {
+                        // subscribers read the new state through GetState
+                        StatesChanged();
+                        LOG_STATUS(Logger) << "Received " << topic << " = " << value << std::endl;
+                        return;
+                    }
+                }
 
-                std::size_t index;
-                Logger.Status << "MQTT message received" <<topic<<":"<< message << std::endl;
+                std::string message(payload, length);
                 if(topic.compare(0,4,"join") == 0)
                 {
 
                     std::string deviceName = split(topic,dem[0]).at(1);
-                    Logger.Status << "Received a join message for device: " << deviceName << std::endl;
+                    LOG_STATUS(Logger) << "Received a join message for device: " << deviceName << std::endl;
                     boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
                     if(m_DeviceData.count(deviceName) == 0)
                     {
@@ -270,7 +495,7 @@ namespace freedm {
 
                         /* if(MQTTClient_subscribe(m_Client, subscription.c_str(), 2) != MQTTCLIENT_SUCCESS)
             {
-                Logger.Error << "Failed to subscribe to the topic " << subscription << std::endl;
+                LOG_ERROR(Logger) << "Failed to subscribe to the topic " << subscription << std::endl;
                 throw std::runtime_error("MQTT Subscription Failure");
             }
                          */
@@ -279,7 +504,7 @@ namespace freedm {
                     }
                     else
                     {
-                        Logger.Status << "Dropped duplicate join message for device " << deviceName << std::endl;
+                        LOG_STATUS(Logger) << "Dropped duplicate join message for device " << deviceName << std::endl;
                     }
                 }
                 else if(topic.compare(0,5,"leave") == 0)
@@ -287,7 +512,7 @@ namespace freedm {
 
                     std::string deviceName =  split(topic,dem[0]).at(1);
 
-                    Logger.Status << "Received a leave message for device: " << deviceName << std::endl;
+                    LOG_STATUS(Logger) << "Received a leave message for device: " << deviceName << std::endl;
                     boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
                     if(m_DeviceData.count(deviceName) > 0 )//remove block comments
                     {
@@ -296,16 +521,22 @@ namespace freedm {
                         // UnsubscribeAll(deviceName);
                         /*if(MQTTClient_unsubscribe(m_Client, subscription.c_str()) != MQTTCLIENT_SUCCESS)
             {
-                Logger.Error << "Failed to unsubscribe to the topic " << subscription << std::endl;
+                LOG_ERROR(Logger) << "Failed to unsubscribe to the topic " << subscription << std::endl;
                 throw std::runtime_error("MQTT Subscription Failure");
             }
                          */
                         CDeviceManager::Instance().RemoveDevice(deviceName);
+                        std::string prefix = deviceName + "/";
+                        TTopicToValue::iterator it = m_Routes.lower_bound(prefix);
+                        while(it != m_Routes.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+                        {
+                            m_Routes.erase(it++);
+                        }
                         m_DeviceData.erase(deviceName);
                     }
                     else
                     {
-                        Logger.Status << "Dropped leave message for unknown device " << deviceName << std::endl;
+                        LOG_STATUS(Logger) << "Dropped leave message for unknown device " << deviceName << std::endl;
                     }
                 }
                 else if(topic.find("JSON") != std::string::npos)
@@ -313,47 +544,41 @@ namespace freedm {
                     std::string deviceName = split(topic,dem[0]).at(0);
                     if(CDeviceManager::Instance().DeviceExists(deviceName))
                     {
-                        Logger.Status << "Dropped JSON for duplicate device " << deviceName << std::endl;
+                        LOG_STATUS(Logger) << "Dropped JSON for duplicate device " << deviceName << std::endl;
                     }
                     else
                     {
-                        Logger.Status << "Received JSON for device " << deviceName << ":\n" << message << std::endl;
+                        LOG_STATUS(Logger) << "Received JSON for device " << deviceName << ":\n" << message << std::endl;
                         CreateDevice(deviceName, message);
                     }
                 }
-                else if((index = topic.find("/AOUT/")) != std::string::npos || (index = topic.find("/DOUT/")) != std::string::npos)
+                else if(topic.find("/AOUT/") != std::string::npos || topic.find("/DOUT/") != std::string::npos)
                 {
-
-                    vector<string> mparts = split(topic, dem[0]);
-                    std::string device = mparts.at(0);
-                    std::string signal = mparts.at(2);
-                    signal = signal + "/" + mparts.at(3);
-                    float value = boost::lexical_cast<float>(message);
-
-                    try
-                    {
-                        boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
-                        signal = m_DeviceData.at(device).s_IndexReference.at(signal);
-                        m_DeviceData.at(device).s_SignalToValue.at(signal) = value;
-                        Logger.Status << "Received AOUT for device " <<value<<std::endl;
-                    }
-                    catch(std::exception & e)
-                    {
-                        Logger.Warn << "Device Signal (" << device << "," << signal << ") does not exist" << std::endl;
-                    }
+                    LOG_WARN(Logger) << "Dropped state " << topic << " = " << message << " of unknown signal or non-numeric value" << std::endl;
                 }
                 else
                 {
-                    Logger.Warn << "Dropped MQTT Message:\n" << topic << "\n" << message << std::endl;
+                    LOG_WARN(Logger) << "Dropped MQTT Message:\n" << topic << "\n" << message << std::endl;
                 }
             }
 
-            void CMqttAdapter::Publish(std::string topic, std::string content)
+            void CMqttAdapter::Publish(std::string topic, std::string content, SDelivery delivery)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-                CMqttMessage::Pointer msg = CMqttMessage::Create(topic, content);
-                m_MessageQueue.push_back(msg);
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+                CMqttMessage::Pointer msg = CMqttMessage::Create(topic, content,
+                    delivery.s_Qos, delivery.s_Retain);
                 msg->Publish(m_Client);
+                if(delivery.s_Qos == 0)
+                {
+                    // nothing confirms the delivery of a QoS 0 message
+                    return;
+                }
+
+                boost::lock_guard<boost::mutex> lock(m_InFlightLock);
+                if(m_EarlyTokens.erase(msg->GetToken()) == 0)
+                {
+                    m_InFlight[msg->GetToken()] = msg;
+                }
             }
 
             void CMqttAdapter::SubscribeAll(std::string deviceName) {
@@ -362,16 +587,16 @@ namespace freedm {
                 std::string topic;
                 topic = deviceName+ "/1/JSON";
                 MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
                 topic = deviceName + "/1/AOUT/#";
-                MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                MQTTClient_subscribe(m_Client, topic.c_str(), TELEMETRY_QOS);
+                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
                 topic = deviceName + "/1/DOUT/#";
-                MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                MQTTClient_subscribe(m_Client, topic.c_str(), TELEMETRY_QOS);
+                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
                 topic = deviceName+"/1/ACK";
                 MQTTClient_subscribe(m_Client, topic.c_str(), 0);
-                Logger.Notice << "Subscribed to MQTT topic " << topic << std::endl;
+                LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << topic << std::endl;
 
 
             }
@@ -383,13 +608,13 @@ namespace freedm {
                 std::string topic;
                 topic = deviceName+ "/1/JSON";
                 MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                Logger.Notice << "UnSubscribed to MQTT topic " << topic << std::endl;
+                LOG_NOTICE(Logger) << "UnSubscribed to MQTT topic " << topic << std::endl;
                 topic = deviceName + "/1/AOUT/#";
                 MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                Logger.Notice << "UnSubscribed to MQTT topic " << topic << std::endl;
+                LOG_NOTICE(Logger) << "UnSubscribed to MQTT topic " << topic << std::endl;
                 topic = deviceName + "/1/DOUT/#";
                 MQTTClient_subscribe(m_Client, topic.c_str(), 2);
-                Logger.Notice << "UnSubscribed to MQTT topic " << topic << std::endl;
+                LOG_NOTICE(Logger) << "UnSubscribed to MQTT topic " << topic << std::endl;
                 // topic = deviceName+"/1/ACK";
                 // MQTTClient_subscribe(m_Client, topic.c_str(), 0);
                 //  }
@@ -397,41 +622,94 @@ namespace freedm {
 
             void CMqttAdapter::CreateDevice(std::string deviceName, std::string json)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 boost::property_tree::ptree propertyTree;
                 std::istringstream inputStream(json);
                 read_json(inputStream, propertyTree);
 
+                // the delivery of each signal class, unless the JSON changes it
+                std::map<std::string, SDelivery> defaults;
+                defaults["DEV_CHAR"] = defaults["AOUT"] = defaults["DOUT"] = SDelivery(TELEMETRY_QOS);
+                defaults["AIN"] = defaults["DIN"] = SDelivery(COMMAND_QOS);
+                boost::optional<boost::property_tree::ptree &> classes =
+                    propertyTree.get_child_optional("DELIVERY");
+                if(classes)
+                {
+                    BOOST_FOREACH(boost::property_tree::ptree::value_type & signalClass, classes.get())
+                                {
+                                    defaults[signalClass.first] = ReadDelivery(signalClass.second, defaults[signalClass.first]);
+                                }
+                }
+
                 DeviceInfo devinfo;
+                std::map<std::string, int> subscriptions;
                 BOOST_FOREACH(boost::property_tree::ptree::value_type & property, propertyTree)
                             {
                                 if(property.first == "DEV_CHAR" || property.first == "AOUT" || property.first == "DOUT")
                                 {
-                                    Logger.Status<< "State property ssss  " << deviceName << std::endl;
-                                    AddSignals(deviceName, property, devinfo.s_state, devinfo.s_type);
-                                    Logger.Status<< "State property " << deviceName << std::endl;
+                                    LOG_STATUS(Logger)<< "State property ssss  " << deviceName << std::endl;
+                                    AddSignals(deviceName, property, devinfo.s_state, devinfo.s_type,
+                                        defaults[property.first], subscriptions);
+                                    LOG_STATUS(Logger)<< "State property " << deviceName << std::endl;
                                 }
                                 else if(property.first == "AIN" || property.first == "DIN")
                                 {
-                                    AddSignals(deviceName, property, devinfo.s_command, devinfo.s_type);
+                                    AddSignals(deviceName, property, devinfo.s_command, devinfo.s_type,
+                                        defaults[property.first], subscriptions);
+                                }
+                                else if(property.first == "DELIVERY")
+                                {
+                                    continue;
                                 }
                                 else
                                 {
-                                    Logger.Info << "Skipped property " << property.first << std::endl;
+                                    LOG_INFO(Logger) << "Skipped property " << property.first << std::endl;
                                 }
                             }
+
+                // the state topics above the QoS of the class subscription
+                std::map<std::string, int>::iterator it;
+                for(it = subscriptions.begin(); it != subscriptions.end(); it++)
+                {
+                    if(MQTTClient_subscribe(m_Client, it->first.c_str(), it->second) != MQTTCLIENT_SUCCESS)
+                    {
+                        LOG_WARN(Logger) << "Failed to subscribe to " << it->first << " at QoS " << it->second << std::endl;
+                    }
+                    else
+                    {
+                        LOG_NOTICE(Logger) << "Subscribed to MQTT topic " << it->first << " at QoS " << it->second << std::endl;
+                    }
+                }
                 CDevice::Pointer device = CDevice::Pointer(new CDevice(deviceName, devinfo, shared_from_this()));
-                CDeviceManager::Instance().AddDevice(device);
-                CDeviceManager::Instance().RevealDevice(deviceName);
+                CDeviceManager::Instance().AddDevices(
+                        std::vector<CDevice::Pointer>(1, device), true);
+            }
+
+            /// Reads the "qos" and "retain" fields of a signal class or signal, each
+            /// of which keeps its default when it is left out.
+            CMqttAdapter::SDelivery CMqttAdapter::ReadDelivery(const boost::property_tree::ptree & ptree, const SDelivery & defaults)
+            {
+                SDelivery delivery;
+                delivery.s_Qos = ptree.get<int>("qos", defaults.s_Qos);
+                delivery.s_Retain = ptree.get<bool>("retain", defaults.s_Retain);
+                if(delivery.s_Qos < 0 || delivery.s_Qos > 2)
+                {
+                    LOG_ERROR(Logger) << "Invalid MQTT QoS " << delivery.s_Qos << std::endl;
+                    throw std::runtime_error("Bad Device JSON");
+                }
+                return delivery;
             }
 
-            void CMqttAdapter::AddSignals(std::string device, boost::property_tree::ptree::value_type & ptree, std::set<std::string> & sigset, std::set<std::string> & type)
+            /// Stores the signals of one class. A command keeps its delivery
+            /// settings, and a state above QoS 0 is added to the subscriptions.
+            void CMqttAdapter::AddSignals(std::string device, boost::property_tree::ptree::value_type & ptree, std::set<std::string> & sigset, std::set<std::string> & type,
+                const SDelivery & defaults, std::map<std::string, int> & subscriptions)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 boost::lock_guard<boost::mutex> lock(m_DeviceDataLock);
-                Logger.Info << "Parsing the " << ptree.first << " field of the JSON for device " << device << std::endl;
+                LOG_INFO(Logger) << "Parsing the " << ptree.first << " field of the JSON for device " << device << std::endl;
                 BOOST_FOREACH(boost::property_tree::ptree::value_type & signal, ptree.second)
                             {
                                 std::string name, index;
@@ -445,7 +723,7 @@ namespace freedm {
                                     {
                                         std::string strval = signal.second.get<std::string>("value");
                                         type.insert(strval);
-                                        Logger.Info << "Classified device " << device << " as type " << strval << std::endl;
+                                        LOG_INFO(Logger) << "Classified device " << device << " as type " << strval << std::endl;
                                         continue;
                                     }
                                     name = ptree.first + "/" + name;
@@ -458,28 +736,41 @@ namespace freedm {
                                     m_DeviceData[device].s_SignalToValue[name] = value;
                                     m_DeviceData[device].s_IndexReference[name] = index;
                                     m_DeviceData[device].s_IndexReference[index] = name;
-                                    Logger.Info << "Stored (" << index << "," << name << ") = " << value << std::endl;
+                                    SDelivery delivery = ReadDelivery(signal.second, defaults);
+                                    if(ptree.first == "AOUT" || ptree.first == "DOUT")
+                                    {
+                                        m_Routes[device + "/1/" + index] = &m_DeviceData[device].s_SignalToValue[name];
+                                        if(delivery.s_Qos > TELEMETRY_QOS)
+                                        {
+                                            subscriptions[device + "/1/" + index] = delivery.s_Qos;
+                                        }
+                                    }
+                                    else if(ptree.first == "AIN" || ptree.first == "DIN")
+                                    {
+                                        m_DeviceData[device].s_Delivery[name] = delivery;
+                                    }
+                                    LOG_INFO(Logger) << "Stored (" << index << "," << name << ") = " << value << std::endl;
                                     if(min)
                                     {
                                         sigset.insert(name + "_minimum");
                                         m_DeviceData[device].s_SignalToValue[name + "_minimum"] = min.get();
-                                        Logger.Status << "Set its minimum value to " << min.get() << std::endl;
+                                        LOG_STATUS(Logger) << "Set its minimum value to " << min.get() << std::endl;
                                     }
                                     if(max)
                                     {
                                         sigset.insert(name + "_maximum");
                                         m_DeviceData[device].s_SignalToValue[name + "_maximum"] = max.get();
-                                        Logger.Status << "Set its maximum value to " << max.get() << std::endl;
+                                        LOG_STATUS(Logger) << "Set its maximum value to " << max.get() << std::endl;
                                     }
                                 }
                                 catch(boost::property_tree::ptree_bad_data & e)
                                 {
                                     // this happens when value cannot be set as the float conversion fails
-                                    Logger.Warn << "Dropped field " << name << " due to non-numeric type" << std::endl;
+                                    LOG_WARN(Logger) << "Dropped field " << name << " due to non-numeric type" << std::endl;
                                 }
                                 catch(std::exception & e)
                                 {
-                                    Logger.Error << "Unexpected format for field " << ptree.first << std::endl;
+                                    LOG_ERROR(Logger) << "Unexpected format for field " << ptree.first << std::endl;
                                     throw std::runtime_error("Bad Device JSON");
                                 }
                             }
@@ -27,10 +27,12 @@
 #include "CMqttMessage.hpp"
 
 #include <map>
-#include <list>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <MQTTClient.h>
+#include <boost/asio/io_service.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -47,6 +49,29 @@ namespace device {
 /// listen for the appearance of new plug-and-play devices. When a new device
 /// joins, the adapter subscribes to that device to receive its state changes.
 ///
+/// Commands are not published from SetCommand. They are queued per command
+/// topic, where a newer command replaces an older one, and published together
+/// by FlushCommands on the devices thread. Messages in flight are indexed by
+/// their delivery token.
+///
+/// State topics are routed through a table built when the device JSON is
+/// parsed, which maps each AOUT and DOUT topic straight to its stored value.
+///
+/// The client library thread only copies each received message and posts it
+/// to one of mqtt-workers worker threads, chosen by the device name of its
+/// topic. The messages of one device are therefore handled in order, while a
+/// device that is being created only holds up the devices of its worker.
+///
+/// Each signal class is delivered with a quality of service of its own. The
+/// state topics, which carry the high rate telemetry, are subscribed at QoS 0
+/// and coalesced on the way to the workers, so a state that changes faster
+/// than its worker keeps up costs one update with the latest value. Commands
+/// are published at QoS 1. A device JSON can change the class defaults with
+/// a DELIVERY object that maps a class, such as AIN, to its "qos" and
+/// "retain" settings, and a signal can name its own "qos" and "retain". A
+/// state signal above QoS 0 is subscribed on its own topic at that QoS, and a
+/// retained command is kept by the broker for a device that connects later.
+///
 /// @peers The MQTT client will communicate with the MQTT broker specified in
 ///     the adapter configuration file. Through the broker, the client will
 ///     send and receive data with physical devices.
@@ -80,10 +105,33 @@ public:
     ~CMqttAdapter();
 
 private:
+    /// The MQTT delivery settings of a signal.
+    struct SDelivery
+    {
+        /// Creates the settings of a signal class.
+        SDelivery(int qos = 0, bool retain = false)
+            : s_Qos(qos), s_Retain(retain) { }
+        /// Quality of service the signal is published or subscribed with.
+        int s_Qos;
+        /// True if the broker keeps the last value of a command topic.
+        bool s_Retain;
+    };
+
     struct DeviceData
     {
         std::map<std::string, SignalValue> s_SignalToValue;
         std::map<std::string, std::string> s_IndexReference;
+        /// Delivery settings of each command signal.
+        std::map<std::string, SDelivery> s_Delivery;
+    };
+
+    /// A command waiting for FlushCommands.
+    struct SPendingCommand
+    {
+        /// The latest value set.
+        SignalValue s_Value;
+        /// The delivery settings of its signal.
+        SDelivery s_Delivery;
     };
 
     /// Constructor.
@@ -98,11 +146,26 @@ private:
     /// Callback function when a message has been delivered to the broker.
     static void DeliveryComplete(void * id, MQTTClient_deliveryToken token);
 
+    /// Finds the worker of the device named by a topic.
+    std::size_t GetWorker(const std::string & topic) const;
+
+    /// Runs the i/o service of a worker.
+    void RunWorker(boost::asio::io_service & ios);
+
+    /// Handles a message copied from the client library on a worker.
+    void HandleCopy(const std::string & topic, const std::string & payload);
+
+    /// Handles the latest payload of a coalesced state topic on a worker.
+    void HandleState(const std::string & topic);
+
     /// Handles messages received from subscribed topics.
-    void HandleMessage(std::string topic, std::string message);
+    void HandleMessage(const std::string & topic, const char * payload, std::size_t length);
     
     /// Publish a message on a topic to the MQTT broker.
-    void Publish(std::string topic, std::string content);
+    void Publish(std::string topic, std::string content, SDelivery delivery = SDelivery(1));
+
+    /// Publish the commands queued since the last flush.
+    void FlushCommands();
 
     /// does a full Subscribe
     void SubscribeAll(std::string deviceName);
@@ -113,7 +176,11 @@ private:
     /// Create a CDevice object from a JSON specification.
     void CreateDevice(std::string deviceName, std::string json);
 
-    void AddSignals(std::string device, boost::property_tree::ptree::value_type & ptree, std::set<std::string> & sigset, std::set<std::string> & type);
+    void AddSignals(std::string device, boost::property_tree::ptree::value_type & ptree, std::set<std::string> & sigset, std::set<std::string> & type,
+        const SDelivery & defaults, std::map<std::string, int> & subscriptions);
+
+    /// Reads the delivery settings of a signal class or signal.
+    static SDelivery ReadDelivery(const boost::property_tree::ptree & ptree, const SDelivery & defaults);
 
     /// Map from a device name to its stored signal values.
     typedef std::map<std::string, DeviceData> TDeviceToData;
@@ -121,10 +188,46 @@ private:
     /// Map of device data expected over MQTT.
     TDeviceToData m_DeviceData;
 
-    /// Storage for MQTT messages
-    std::list<CMqttMessage::Pointer> m_MessageQueue;
+    /// Map from a state topic to its value in m_DeviceData.
+    typedef std::map<std::string, SignalValue *> TTopicToValue;
+
+    /// Routes of the state topics of every known device.
+    TTopicToValue m_Routes;
+
+    /// MQTT messages in flight by delivery token.
+    std::map<MQTTClient_deliveryToken, CMqttMessage::Pointer> m_InFlight;
+
+    /// Tokens delivered before Publish stored their message.
+    std::set<MQTTClient_deliveryToken> m_EarlyTokens;
+
+    /// Protect the messages in flight.
+    boost::mutex m_InFlightLock;
+
+    /// Latest command by command topic, waiting for FlushCommands.
+    std::map<std::string, SPendingCommand> m_PendingCommands;
+
+    /// True while a call to FlushCommands is posted.
+    bool m_FlushScheduled;
+
+    /// Protect the pending commands.
+    boost::mutex m_PendingLock;
+
+    /// One i/o service for each worker thread.
+    std::vector<boost::shared_ptr<boost::asio::io_service> > m_Workers;
+
+    /// Keeps the workers running until the adapter stops.
+    std::vector<boost::shared_ptr<boost::asio::io_service::work> > m_WorkerLoad;
+
+    /// Threads that run the workers.
+    boost::thread_group m_WorkerThreads;
+
+    /// Latest payload by state topic, waiting for its worker.
+    std::map<std::string, std::string> m_PendingStates;
+
+    /// Protect the pending states.
+    boost::mutex m_PendingStatesLock;
 
-    /// Protect the device data map.
+    /// Protect the device data map and the routes into it.
     mutable boost::mutex m_DeviceDataLock;
 
     /// MQTT client object.
@@ -38,9 +38,9 @@ namespace {
 CLocalLogger Logger(__FILE__);
 } // unnamed namespace
 
-CMqttMessage::CMqttMessage(std::string topic, std::string content, int qos)
+CMqttMessage::CMqttMessage(std::string topic, std::string content, int qos, bool retained)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     m_Topic = topic;
 
@@ -56,13 +56,13 @@ CMqttMessage::CMqttMessage(std::string topic, std::string content, int qos)
     m_Message.payloadlen = size;
     m_Message.payload = m_Payload;
     m_Message.qos = qos;
-    m_Message.retained = 0;
+    m_Message.retained = retained ? 1 : 0;
     m_Message.dup = 0;
 }
 
 CMqttMessage::~CMqttMessage()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     
     if(m_Payload != NULL)
     {
@@ -70,28 +70,28 @@ CMqttMessage::~CMqttMessage()
     }
 }
 
-CMqttMessage::Pointer CMqttMessage::Create(std::string topic, std::string content, int qos)
+CMqttMessage::Pointer CMqttMessage::Create(std::string topic, std::string content, int qos, bool retained)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return Pointer(new CMqttMessage(topic, content, qos));
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return Pointer(new CMqttMessage(topic, content, qos, retained));
 }
 
 const MQTTClient_deliveryToken & CMqttMessage::GetToken() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return m_Token;
 }
 
 void CMqttMessage::Publish(MQTTClient client)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(MQTTClient_publishMessage(client, m_Topic.c_str(), &m_Message, &m_Token) != MQTTCLIENT_SUCCESS)
     {
-        Logger.Error << "Message on topic " << m_Topic << " with value " << m_Payload << " rejected." << std::endl;
+        LOG_ERROR(Logger) << "Message on topic " << m_Topic << " with value " << m_Payload << " rejected." << std::endl;
         throw std::runtime_error("Message Rejected for Publication");
     }
-    Logger.Info << m_Topic << " " << m_Payload << " sent for delivery with token " << m_Token << std::endl;
+    LOG_INFO(Logger) << m_Topic << " " << m_Payload << " sent for delivery with token " << m_Token << std::endl;
 
 }
 
@@ -37,7 +37,10 @@ class CMqttMessage
 public:
     typedef boost::shared_ptr<CMqttMessage> Pointer;
 
-    static Pointer Create(std::string topic, std::string content, int qos = 1);
+    static Pointer Create(std::string topic, std::string content, int qos = 1, bool retained = false);
+
+    /// Quality of service the message is published with.
+    int GetQos() const { return m_Message.qos; }
 
     const MQTTClient_deliveryToken & GetToken() const;
 
@@ -45,7 +48,7 @@ public:
 
     ~CMqttMessage();
 private:
-    CMqttMessage(std::string topic, std::string content, int qos);
+    CMqttMessage(std::string topic, std::string content, int qos, bool retained);
 
     char * m_Payload;
 
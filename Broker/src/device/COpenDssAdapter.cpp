@@ -11,15 +11,17 @@
 ///
 /// @description  Opendss simulation adapter.
 ///
-/// @functions    EndianSwap
-///               EndianSwapIfNeeded
-///               COpenDssAdapter::Create
+/// @functions    COpenDssAdapter::Create
 ///               COpenDssAdapter::Start
 ///               COpenDssAdapter::~COpenDssAdapter
 ///               COpenDssAdapter::Run
 ///               COpenDssAdapter::COpenDssAdapter
 ///               COpenDssAdapter::Quit
 ///               COpenDssAdapter::Connect
+///               COpenDssAdapter::HandleResolve
+///               COpenDssAdapter::HandleConnect
+///               COpenDssAdapter::NegotiateBinary
+///               COpenDssAdapter::ExchangeFrames
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -40,6 +42,7 @@
 #include "SynchronousTimeout.hpp"
 
 #include <sys/param.h>
+#include <arpa/inet.h>
 
 #include <cmath>
 #include <vector>
@@ -49,7 +52,9 @@
 #include <algorithm>
 
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
 #include <boost/static_assert.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -86,7 +91,7 @@ namespace freedm {
             IAdapter::Pointer COpenDssAdapter::Create(boost::asio::io_service & service,
                                                       const boost::property_tree::ptree & ptree)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
                 return COpenDssAdapter::Pointer(new COpenDssAdapter(service, ptree));
             }
 
@@ -105,30 +110,36 @@ namespace freedm {
                                              const boost::property_tree::ptree & ptree)
                     : m_runTimer(io_service)
                     , m_socket(io_service)
+                    , m_resolver(io_service)
                     , m_host(ptree.get<std::string>("host"))
                     , m_port(ptree.get<std::string>("port"))
+                    , m_binary(false)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                std::string framing = ptree.get<std::string>("framing", "text");
+                if( framing != "text" && framing != "binary" )
+                {
+                    throw std::runtime_error("Unknown OpenDSS framing: " + framing);
+                }
+                m_wantBinary = (framing == "binary");
             }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Starts sending and receiving data with the adapter.
 ///
 /// @pre The adapter has not yet been started.
-/// @post COpenDssAdapter::Run is called to start the adapter.
+/// @post The server is being connected in the background, and
+///     COpenDssAdapter::Run is called once it is.
 ///
 /// @limitations All devices must be added to the adapter before this call.
 ////////////////////////////////////////////////////////////////////////////////
             void COpenDssAdapter::Start()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 IBufferAdapter::Start();
                 Connect();
-                m_runTimer.expires_from_now(
-                        boost::posix_time::milliseconds(CTimings::Get("DEV_RTDS_DELAY")));
-                m_runTimer.async_wait(boost::bind(&COpenDssAdapter::Run, shared_from_this(),
-                                                  boost::asio::placeholders::error));
             }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -151,7 +162,7 @@ namespace freedm {
             char COpenDssAdapter::buffer[COpenDssAdapter::BUFFER_SIZE] = "";
             void COpenDssAdapter::Run(const boost::system::error_code & e)
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 if( e )
                 {
@@ -161,24 +172,45 @@ namespace freedm {
                     }
                     else
                     {
-                        Logger.Fatal << "Run called with error: " << e.message()
+                        LOG_FATAL(Logger) << "Run called with error: " << e.message()
                                      << std::endl;
                         throw boost::system::system_error(e);
                     }
                 }
+
+                if( m_binary )
+                {
+                    ExchangeFrames();
+
+                    // Start the timer; on timeout, this function is called again
+                    if( m_fixedRate )
+                    {
+                        m_runTimer.expires_at(NextDeadline(
+                                CTimings::GetDuration(CTimings::DEV_RTDS_DELAY)));
+                    }
+                    else
+                    {
+                        m_runTimer.expires_from_now(
+                                CTimings::GetDuration(CTimings::DEV_RTDS_DELAY));
+                    }
+                    m_runTimer.async_wait(boost::bind(&COpenDssAdapter::Run, shared_from_this(),
+                                                      boost::asio::placeholders::error));
+                    return;
+                }
+
                 bzero(buffer,BUFFER_SIZE-1);
                 sd = m_socket.native();
                 if(!(read(sd,buffer, BUFFER_SIZE-1))){
-                    Logger.Status<<"Error reading socket!?"<<std::endl;
+                    LOG_STATUS(Logger)<<"Error reading socket!?"<<std::endl;
                 }
 
                 openDss_data = buffer;
-                Logger.Status << "opendss data: " << buffer << std::endl;
+                LOG_STATUS(Logger) << "opendss data: " << buffer << std::endl;
 
                 //std::string command = "Bus : 1,Node1 : 2,Basekv : 88.88,Magnitude1 : 8088.8,Angle1 : 88.8, pu1 : 1.088"; // generic command should be changed
                 //sendCommand(command);    //test sendop
 
-                Logger.Status<<"command sent to openDss device"<<std::endl;
+                LOG_STATUS(Logger)<<"command sent to openDss device"<<std::endl;
             }
 ///////////////////////////////////////////////////////////////////////////////
 /// gets openDss data
@@ -198,15 +230,16 @@ namespace freedm {
 ////////////////////////////////////////////////////////////////////////////
             void COpenDssAdapter::Stop()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
                 try
                 {
                     m_runTimer.cancel();
+                    m_resolver.cancel();
                 }
                 catch( boost::system::system_error& e)
                 {
-                    Logger.Error << "Error cancelling timer: " << e.what() << std::endl;
+                    LOG_ERROR(Logger) << "Error cancelling timer: " << e.what() << std::endl;
                 }
 
                 if( m_socket.is_open() )
@@ -229,9 +262,9 @@ namespace freedm {
                 n = write(sd,buffer,command.size());
 
                 if(!n) {
-                    Logger.Error<<"Error writing to socket"<<std::endl;
+                    LOG_ERROR(Logger)<<"Error writing to socket"<<std::endl;
                 }
-                Logger.Status<<"command sent to openDss device: "<< buffer <<std::endl;
+                LOG_STATUS(Logger)<<"command sent to openDss device: "<< buffer <<std::endl;
             }
 ////////////////////////////////////////////////////////////////////////////
 /// Closes the socket before destroying an object instance.
@@ -243,101 +276,225 @@ namespace freedm {
 ////////////////////////////////////////////////////////////////////////////
             COpenDssAdapter::~COpenDssAdapter()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
             }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// A utility function for converting byte order from big endian to little
-/// endian and vice versa. This needs to be called on a SINGLE WORD of the data
-/// since it actually just reverses the bytes.
-///
-/// @pre None
-/// @post The bytes in the buffer are now reversed
-/// @param buffer the data to be reversed
-/// @param numBytes the number of bytes in the buffer
+/// Offers binary framing to the server with the handshake described in the
+/// class documentation.
+///
+/// @ErrorHandling A failed or rejected handshake is logged, not thrown.
+/// @pre m_socket is connected and the buffers have their final size.
+/// @post The handshake has been exchanged with the server.
+/// @return true if the server accepted binary framing.
+///
+/// @limitations A text-only server that answers the handshake with data
+///     leaves that data unread by the text loop.
 ////////////////////////////////////////////////////////////////////////////////
-            void COpenDssAdapter::ReverseBytes( char * buffer, const int numBytes )
+            bool COpenDssAdapter::NegotiateBinary()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                boost::uint32_t hello[3];
+                boost::uint32_t reply[2];
+                hello[0] = htonl(BINARY_MAGIC);
+                hello[1] = htonl(m_rxBuffer.size());
+                hello[2] = htonl(m_txBuffer.size());
+
+                try
+                {
+                    TimedWrite(m_socket, boost::asio::buffer(hello, sizeof(hello)),
+                               CTimings::Get(CTimings::DEV_SOCKET_TIMEOUT));
+                    TimedRead(m_socket, boost::asio::buffer(reply, sizeof(reply)),
+                              CTimings::Get(CTimings::DEV_SOCKET_TIMEOUT));
+                }
+                catch(std::exception & e)
+                {
+                    LOG_WARN(Logger) << "Binary framing not negotiated with " << m_host
+                                << ": " << e.what() << std::endl;
+                    return false;
+                }
 
-                for( std::size_t i = 0, j = numBytes-1; i < j; i++, j-- )
+                if( ntohl(reply[0]) != BINARY_MAGIC || ntohl(reply[1]) != 0 )
                 {
-                    char temp = buffer[i];
-                    buffer[i] = buffer[j];
-                    buffer[j] = temp;
+                    LOG_WARN(Logger) << "Binary framing rejected by " << m_host
+                                << ", using text mode." << std::endl;
+                    return false;
                 }
+
+                LOG_STATUS(Logger) << "Using binary framing with " << m_host << ":"
+                              << m_port << "." << std::endl;
+                return true;
             }
 
-///////////////////////////////////////////////////////////////////////////////
-/// Converts the SignalValues in the passed vector from big-endian to
-/// little-endian, or vice-versa, if the DGI is running on a little-endian
-/// system.
+////////////////////////////////////////////////////////////////////////////////
+/// Sends a snapshot of m_txBuffer to the server and publishes its reply as the
+/// new m_rxBuffer, both as length-prefixed big-endian float32 frames.
 ///
-/// @pre None.
-/// @post The elements of data are converted in endianness if the DGI is
-///  running on a little-endian system.  Otherwise, nothing happens.
-/// @param v The vector of SignalValues to be endian-swapped.
+/// @ErrorHandling Throws std::runtime_error if the socket operations time
+///     out or the server sends the wrong number of values.
+/// @pre Binary framing has been negotiated.
+/// @post m_rxBuffer holds the latest values from the server.
 ///
-/// @limitations Assumes the existence of UNIX byte order macros.
-///////////////////////////////////////////////////////////////////////////////
-            void COpenDssAdapter::EndianSwapIfNeeded(std::vector<SignalValue> & v)
+/// @limitations This function uses synchronous communication.
+////////////////////////////////////////////////////////////////////////////////
+            void COpenDssAdapter::ExchangeFrames()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-
-// check endianess at compile time.  Middle-Endian not allowed
-// The parameters __BYTE_ORDER, __LITTLE_ENDIAN, __BIG_ENDIAN should
-// automatically be defined and determined in sys/param.h, which exists
-// in most Unix systems.
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-                for( std::size_t i = 0; i < v.size(); i++ )
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                unsigned int timeout = CTimings::Get(CTimings::DEV_SOCKET_TIMEOUT);
+
+                SnapshotCommands();
+                EndianSwapIfNeeded(m_txStaging);
+
+                boost::uint32_t count = htonl(m_txStaging.size());
+                std::vector<boost::asio::const_buffer> frame;
+                frame.push_back(boost::asio::buffer(&count, sizeof(count)));
+                if( !m_txStaging.empty() )
+                {
+                    frame.push_back(boost::asio::buffer(m_txStaging));
+                }
+                TimedWrite(m_socket, frame, timeout);
+
+                TimedRead(m_socket, boost::asio::buffer(&count, sizeof(count)), timeout);
+                count = ntohl(count);
+
+                if( count != m_rxStaging.size() )
                 {
-                    ReverseBytes((char*)&v[i], sizeof(SignalValue));
+                    throw std::runtime_error("OpenDSS frame holds "
+                            + boost::lexical_cast<std::string>(count) + " values, expected "
+                            + boost::lexical_cast<std::string>(m_rxStaging.size()));
                 }
+                if( count > 0 )
+                {
+                    TimedRead(m_socket, boost::asio::buffer(m_rxStaging), timeout);
+                    EndianSwapIfNeeded(m_rxStaging);
+                }
+
+                bool reveal = false;
 
-#elif __BYTE_ORDER == __BIG_ENDIAN
-                Logger.Debug << "Endian swap skipped: host is big-endian." << std::endl;
-#else
-#error "unsupported endianness or __BYTE_ORDER not defined"
-#endif
+                if( m_buffer_initialized == false )
+                {
+                    m_buffer_initialized = true;
+
+                    for( unsigned int i = 0; i < m_rxStaging.size(); i++ )
+                    {
+                        if( m_rxStaging[i] == NULL_COMMAND )
+                        {
+                            m_buffer_initialized = false;
+                        }
+                    }
+                    reveal = m_buffer_initialized;
+                }
+
+                PublishStates();
+
+                if( reveal )
+                {
+                    RevealDevices();
+                }
             }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Creates a TCP socket connection to the adapter's target host and port.
+/// Starts a TCP socket connection to the adapter's target host and port.  The
+/// connection is made on the adapter's i/o service, so the caller does not
+/// wait for the server to answer.
 ///
-/// @ErrorHandling Throws a std::runtime_error for connection errors.
 /// @pre hostname and service specify a valid endpoint.
-/// @post m_socket is connected to the passed service.
+/// @post The host is being resolved.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
             void COpenDssAdapter::Connect()
             {
-                Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-                boost::asio::ip::tcp::resolver resolver(m_socket.get_io_service());
                 boost::asio::ip::tcp::resolver::query query(m_host, m_port);
-                boost::asio::ip::tcp::resolver::iterator it = resolver.resolve(query);
-                boost::asio::ip::tcp::resolver::iterator end;
+                m_resolver.async_resolve(query, boost::bind(
+                        &COpenDssAdapter::HandleResolve, shared_from_this(),
+                        boost::asio::placeholders::error,
+                        boost::asio::placeholders::iterator));
+            }
 
-                // attempt to connect to one of the resolved endpoints
-                boost::system::error_code error = boost::asio::error::host_not_found;
+////////////////////////////////////////////////////////////////////////////////
+/// Starts the connection to the first address of the host.
+///
+/// @ErrorHandling Throws a std::runtime_error if the host cannot be resolved.
+/// @pre Called once the host has been resolved.
+/// @post m_socket is connecting.
+/// @param e The error code of the resolve.
+/// @param it The addresses of the host.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            void COpenDssAdapter::HandleResolve(const boost::system::error_code & e,
+                                                boost::asio::ip::tcp::resolver::iterator it)
+            {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-                while( error && it != end )
+                if( e == boost::asio::error::operation_aborted )
                 {
-                    m_socket.close();
-                    m_socket.connect(*it, error);
-                    ++it;
+                    return;
+                }
+                if( e || it == boost::asio::ip::tcp::resolver::iterator() )
+                {
+                    throw std::runtime_error("Failed to resolve " + m_host + ":"
+                                             + m_port + " because: "
+                                             + std::string(boost::system::system_error(e).what()));
                 }
 
-                if( error )
+                m_candidate = it;
+                m_socket.async_connect(*m_candidate, boost::bind(
+                        &COpenDssAdapter::HandleConnect, shared_from_this(),
+                        boost::asio::placeholders::error));
+            }
+
+////////////////////////////////////////////////////////////////////////////////
+/// Moves on to the next address of the host if the connection failed.  Once
+/// connected, the framing is negotiated and the first cycle is scheduled.
+///
+/// @ErrorHandling Throws a std::runtime_error if no address of the host
+/// accepted the connection.
+/// @pre A connection attempt has finished.
+/// @post m_socket is connected to the passed service or tries its next address.
+/// @param e The error code of the connection attempt.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+            void COpenDssAdapter::HandleConnect(const boost::system::error_code & e)
+            {
+                LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+                if( e == boost::asio::error::operation_aborted )
+                {
+                    return;
+                }
+                if( e )
                 {
+                    if( ++m_candidate != boost::asio::ip::tcp::resolver::iterator() )
+                    {
+                        m_socket.close();
+                        m_socket.async_connect(*m_candidate, boost::bind(
+                                &COpenDssAdapter::HandleConnect, shared_from_this(),
+                                boost::asio::placeholders::error));
+                        return;
+                    }
                     throw std::runtime_error("Failed to connect to " + m_host + ":"
                                              + m_port + " because: "
-                                             + std::string(boost::system::system_error(error).what()));
+                                             + std::string(boost::system::system_error(e).what()));
                 }
 
-                Logger.Status << "Opened a TCP socket connection to host " << m_host
+                LOG_STATUS(Logger) << "Opened a TCP socket connection to host " << m_host
                               << ":" << m_port << "." << std::endl;
+
+                if( m_wantBinary )
+                {
+                    m_binary = NegotiateBinary();
+                }
+                m_runTimer.expires_from_now(
+                        CTimings::GetDuration(CTimings::DEV_RTDS_DELAY));
+                m_runTimer.async_wait(boost::bind(&COpenDssAdapter::Run, shared_from_this(),
+                                                  boost::asio::placeholders::error));
             }
 
         }//namespace broker
@@ -45,6 +45,16 @@ namespace freedm {
 /// a device server. It serves as client to the server, retrieving values
 /// from and transmitting commands to the opendss application.
 ///
+/// By default the server exchanges csv text. With <framing>binary</framing>
+/// in the adapter configuration, the adapter offers binary framing when it
+/// connects: it sends the magic number, the number of state values and
+/// the number of command values, each as a big-endian uint32. The server
+/// accepts by echoing the magic number followed by a zero status. After
+/// that, every cycle exchanges frames made of a big-endian uint32 value
+/// count followed by that many big-endian float32 values. Outgoing frames
+/// carry m_txBuffer and incoming frames fill m_rxBuffer, in the same order
+/// as the buffer indices. If the server does not accept, the adapter stays
+/// in text mode.
 ///
 /// @limitations
 ///    Subject to improvement.
@@ -81,14 +91,21 @@ namespace freedm {
                 /// Continuous loop for sending and receiving to/from opendss.
                 void Run(const boost::system::error_code & e);
 
-                /// Reverses all of the bytes in a buffer.
-                void ReverseBytes( char * buffer, const int numBytes );
+                /// Starts a socket connection to the given hostname and port number.
+                void Connect();
 
-                /// Swaps the endianness of all SignalValues in a vector.
-                void EndianSwapIfNeeded(std::vector<SignalValue> & v);
+                /// Connects to the first address of the resolved host.
+                void HandleResolve(const boost::system::error_code & e,
+                                   boost::asio::ip::tcp::resolver::iterator it);
 
-                /// Creates a socket connection to the given hostname and port number.
-                void Connect();
+                /// Tries the next address of the host, or starts the adapter.
+                void HandleConnect(const boost::system::error_code & e);
+
+                /// Offers binary framing to the server.
+                bool NegotiateBinary();
+
+                /// Exchanges one pair of binary frames with the server.
+                void ExchangeFrames();
 
                 /// Timer object to set communication cycle pace.
                 boost::asio::deadline_timer m_runTimer;
@@ -96,11 +113,26 @@ namespace freedm {
                 /// Socket to use for the TCP connection.
                 mutable boost::asio::ip::tcp::socket m_socket;
 
+                /// Resolves the host while the connection is established.
+                boost::asio::ip::tcp::resolver m_resolver;
+
+                /// The resolved address m_socket is connecting to.
+                boost::asio::ip::tcp::resolver::iterator m_candidate;
+
                 /// The hostname of the remote host.
                 std::string m_host;
 
                 /// The port number of the remote host.
                 std::string m_port;
+
+                /// True if binary framing was requested in the configuration.
+                bool m_wantBinary;
+
+                /// True once the server has accepted binary framing.
+                bool m_binary;
+
+                /// Magic number that opens the binary framing handshake.
+                static const unsigned int BINARY_MAGIC = 0x44535342;
                 
                 /// buffer size in bytes of the simulation packet
                 static const unsigned int BUFFER_SIZE = 1024;
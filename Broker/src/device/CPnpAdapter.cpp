@@ -16,6 +16,10 @@
 ///     CPnpAdapter::GetPortNumber
 ///     CPnpAdapter::Timeout
 ///     CPnpAdapter::HandleRead
+///     CPnpAdapter::HandleFrameHeader
+///     CPnpAdapter::HandleFrame
+///     CPnpAdapter::WriteCommandFrame
+///     CPnpAdapter::EndSession
 ///     CPnpAdapter::AfterWrite
 ///     CPnpAdapter::Stop
 ///     CPnpAdapter::ReadStatePacket
@@ -42,7 +46,11 @@
 #include "CTimings.hpp"
 #include "SynchronousTimeout.hpp"
 
+#include <arpa/inet.h>
+
+#include <cmath>
 #include <map>
+#include <ostream>
 #include <sstream>
 #include <stdexcept>
 
@@ -75,7 +83,7 @@ CLocalLogger Logger(__FILE__);
 IAdapter::Pointer CPnpAdapter::Create(boost::asio::io_service & service,
         boost::property_tree::ptree & p, CTcpServer::Connection client)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return CPnpAdapter::Pointer(new CPnpAdapter(service, p, client));
 }
 
@@ -85,6 +93,8 @@ IAdapter::Pointer CPnpAdapter::Create(boost::asio::io_service & service,
 /// @pre The ptree must have the 'identifier' and 'stateport' properties.
 /// @post Creates a new TCP server on the specified 'stateport'.
 /// @post Registers CPnpAdapter::HandleMessage with m_server.
+/// @post Uses binary framing if the ptree has a true 'binary' property.
+/// @post Uses delta packets if the ptree has a true 'delta' property.
 /// @param service The i/o service for the TCP server.
 /// @param p The property tree that configures the adapter.
 /// @param client The TCP connection to use for this adapter.
@@ -93,14 +103,20 @@ IAdapter::Pointer CPnpAdapter::Create(boost::asio::io_service & service,
 ////////////////////////////////////////////////////////////////////////////////
 CPnpAdapter::CPnpAdapter(boost::asio::io_service & service,
         boost::property_tree::ptree & p, CTcpServer::Connection client)
-    : m_countdown(new boost::asio::deadline_timer(service))
+    : m_deadline(0)
     , m_ios(service)
     , m_client(client)
+    , m_binary(false)
+    , m_frameCount(0)
+    , m_delta(false)
+    , m_sinceRefresh(0)
     , m_stopping(false)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     m_identifier = p.get<std::string>("identifier");
+    m_binary = p.get<bool>("binary", false);
+    m_delta = p.get<bool>("delta", false);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -113,54 +129,43 @@ CPnpAdapter::CPnpAdapter(boost::asio::io_service & service,
 ////////////////////////////////////////////////////////////////////////////////
 CPnpAdapter::~CPnpAdapter()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Starts the internal countdown timer to destroy this object.
+/// Registers this object with the heartbeat wheel that destroys it on timeout.
 ///
-/// @pre None.
-/// @post m_heartbeat set to call CPnpAdapter::Timeout on expiration.
+/// @pre The session protocol of CAdapterFactory must be started.
+/// @post CAdapterFactory calls CPnpAdapter::Timeout if the deadline passes.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::Start()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     IBufferAdapter::Start();
 
-    m_countdown->expires_from_now(boost::posix_time::milliseconds(
-            CTimings::Get("DEV_PNP_HEARTBEAT")));
-    m_countdown->async_wait(boost::bind(&CPnpAdapter::Timeout,
-            shared_from_this(), boost::asio::placeholders::error));
+    m_deadline = CAdapterFactory::Instance().GetHeartbeatDeadline();
+    CAdapterFactory::Instance().WatchHeartbeat(shared_from_this());
 
     StartRead();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Refreshes the heartbeat countdown timer.
+/// Refreshes the heartbeat deadline.  The heartbeat wheel notices the new
+/// deadline the next time it visits this adapter, so no timer is touched.
 ///
-/// @pre m_heartbeat must not have expired.
-/// @post Resets the countdown of the m_heartbeat timer.
+/// @pre None.
+/// @post Moves m_deadline one heartbeat period past the current wheel tick.
 ///
-/// @limitations This call will do nothing if the timer has already expired.
+/// @limitations Must be called from the thread of the session protocol.
 ////////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::Heartbeat()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    if( m_countdown->expires_from_now(boost::posix_time::milliseconds(
-            CTimings::Get("DEV_PNP_HEARTBEAT"))) != 0 )
-    {
-        Logger.Debug << "Reset an adapter heartbeat timer." << std::endl;
-        m_countdown->async_wait(boost::bind(&CPnpAdapter::Timeout,
-                shared_from_this(), boost::asio::placeholders::error));
-    }
-    else
-    {
-        Logger.Warn << "The heartbeat timer has already expired." << std::endl;
-    }
+    m_deadline = CAdapterFactory::Instance().GetHeartbeatDeadline();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -178,46 +183,44 @@ void CPnpAdapter::Heartbeat()
 ///////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::Stop()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-
-    // The timer is not thread safe; it must be stopped from the device thread.
-    // Note that this io_service may have already been stopped if the devices
-    // thread threw an exception.  In this case, the cancel will never be
-    // executed, but this is harmless.
-    m_ios.post(boost::bind(&boost::asio::deadline_timer::cancel, m_countdown,
-            boost::system::error_code()));
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    {
-        boost::lock_guard<boost::mutex> stoppingLock(m_stoppingMutex);
-        m_stopping = true;
-    }
+    // The heartbeat wheel only holds a weak pointer and drops this adapter
+    // once the handlers in flight release it.
+    boost::lock_guard<boost::mutex> stoppingLock(m_stoppingMutex);
+    m_stopping = true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Stops the adapter due to timeout.
 ///
 /// @pre None.
-/// @post Calls CAdapterFactory::RemoveAdapter if the timer was not reset.
-/// @param e The error code that signals if the timeout has been canceled.
+/// @post Calls CAdapterFactory::RemoveAdapter unless the adapter has stopped.
 ////////////////////////////////////////////////////////////////////////////////
-void CPnpAdapter::Timeout(const boost::system::error_code & e)
+void CPnpAdapter::Timeout()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    if( !e )
+    bool stopping;
     {
-        Logger.Status << "Removing an adapter due to timeout." << std::endl;
+        boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
+        stopping = m_stopping;
+    }
+
+    if( !stopping )
+    {
+        LOG_STATUS(Logger) << "Removing an adapter due to timeout." << std::endl;
 
         try
         {
             std::string msg;
             msg = "Error\r\nConnection closed due to timeout.\r\n\r\n";
             TimedWrite(*m_client, boost::asio::buffer(msg),
-                    CTimings::Get("DEV_SOCKET_TIMEOUT"));
+                    CTimings::Get(CTimings::DEV_SOCKET_TIMEOUT));
         }
         catch(std::exception & e)
         {
-            Logger.Info << "Failed to tell client about timeout." << std::endl;
+            LOG_INFO(Logger) << "Failed to tell client about timeout." << std::endl;
         }
 
         CAdapterFactory::Instance().RemoveAdapter(m_identifier);
@@ -231,17 +234,29 @@ void CPnpAdapter::Timeout(const boost::system::error_code & e)
 /// @post Clears the content of m_buffer prior to the read.
 /// @post Calls CPnpAdapter::Heartbeat to refresh the connection.
 /// @post Schedules the next socket connection on m_client.
+/// @post With binary framing, reads only the value count of the next frame.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::StartRead()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     Heartbeat();
     m_buffer.consume(m_buffer.size());
-    boost::asio::async_read_until(*m_client, m_buffer, "\r\n\r\n",
-            boost::bind(&CPnpAdapter::HandleRead, shared_from_this(),
-            boost::asio::placeholders::error));
+
+    if( m_binary )
+    {
+        boost::asio::async_read(*m_client,
+                boost::asio::buffer(&m_frameCount, sizeof(m_frameCount)),
+                boost::bind(&CPnpAdapter::HandleFrameHeader, shared_from_this(),
+                boost::asio::placeholders::error));
+    }
+    else
+    {
+        boost::asio::async_read_until(*m_client, m_buffer, "\r\n\r\n",
+                boost::bind(&CPnpAdapter::HandleRead, shared_from_this(),
+                boost::asio::placeholders::error));
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -256,7 +271,7 @@ void CPnpAdapter::StartRead()
 ////////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::StartWrite()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     Heartbeat();
 
     boost::asio::async_write(*m_client, m_buffer,
@@ -277,13 +292,13 @@ void CPnpAdapter::StartWrite()
 ////////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::HandleRead(const boost::system::error_code & e)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     {
         boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
         if( m_stopping || e )
         {
-            Logger.Debug << "HandleRead giving up : "
+            LOG_DEBUG(Logger) << "HandleRead giving up : "
                 << (m_stopping ? "received stop" : e.message()) << std::endl;
             return;
         }
@@ -299,14 +314,14 @@ void CPnpAdapter::HandleRead(const boost::system::error_code & e)
 
         packet >> header;
         data = std::string(std::istreambuf_iterator<char>(packet), end);
-        Logger.Debug << "Received " << header << " packet." << std::endl;
+        LOG_DEBUG(Logger) << "Received " << header << " packet." << std::endl;
 
         m_buffer.consume(m_buffer.size());
-        if( header == "DeviceStates" )
+        if( header == "DeviceStates" || (m_delta && header == "DeviceStatesDelta") )
         {
             try
             {
-                ReadStatePacket(data);
+                ReadStatePacket(data, header == "DeviceStatesDelta");
                 if( m_buffer_initialized == false )
                 {
                     RevealDevices();
@@ -317,42 +332,203 @@ void CPnpAdapter::HandleRead(const boost::system::error_code & e)
             catch(boost::bad_lexical_cast &)
             {
                 std::string str = "received non-numeric value";
-                Logger.Warn << "Corrupt state: " << str << std::endl;
+                LOG_WARN_LIMITED(Logger, 1) << "Corrupt state: " << str << std::endl;
                 packet << "BadRequest\r\n" << str << "\r\n\r\n";
             }
             catch(EBadRequest & e)
             {
-                Logger.Warn << "Corrupt state: " << e.what() << std::endl;
+                LOG_WARN_LIMITED(Logger, 1) << "Corrupt state: " << e.what() << std::endl;
                 packet << "BadRequest\r\n" << e.what() << "\r\n\r\n";
             }
         }
         else if( header == "PoliteDisconnect" )
         {
-            Logger.Info << "Polite Disconnect Accepted" << std::endl;
+            LOG_INFO(Logger) << "Polite Disconnect Accepted" << std::endl;
             packet << "PoliteDisconnect\r\nAccepted\r\n\r\n";
-            m_countdown->cancel();
-            {
-                boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
-                m_stopping = true;
-            }
-            CAdapterFactory::Instance().RemoveAdapter(m_identifier);
+            EndSession();
         }
         else
         {
             std::string msg = "Unknown header: " + header;
             packet << "BadRequest\r\n" << msg << "\r\n\r\n";
-            Logger.Warn << msg << std::endl;
+            LOG_WARN(Logger) << msg << std::endl;
         }
         StartWrite();
     }
     catch(std::exception & e)
     {
-        Logger.Info << m_identifier << " communication failed."
+        LOG_INFO(Logger) << m_identifier << " communication failed."
                 << std::endl;
-        Logger.Debug << "Reason: " << e.what() << std::endl;
+        LOG_DEBUG(Logger) << "Reason: " << e.what() << std::endl;
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Handles the value count that opens a binary state frame.
+///
+/// @ErrorHandling If the count does not match the number of states, the
+/// client is sent a bad request and the session ends, as the rest of the
+/// stream cannot be framed.
+/// @pre m_frameCount must hold the count read from the client.
+/// @post Schedules the read of the frame values, or accepts a disconnect.
+/// @param e The error code associated with the last read operation.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CPnpAdapter::HandleFrameHeader(const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
+        if( m_stopping || e )
+        {
+            LOG_DEBUG(Logger) << "HandleFrameHeader giving up : "
+                << (m_stopping ? "received stop" : e.message()) << std::endl;
+            return;
+        }
+    }
+
+    std::ostream packet(&m_buffer);
+    boost::uint32_t count = ntohl(m_frameCount);
+
+    try
+    {
+        Heartbeat();
+
+        if( count == DISCONNECT_FRAME )
+        {
+            LOG_INFO(Logger) << "Polite Disconnect Accepted" << std::endl;
+            packet.write(reinterpret_cast<const char *>(&m_frameCount),
+                    sizeof(m_frameCount));
+            EndSession();
+            StartWrite();
+        }
+        else if( count != m_rxStaging.size() )
+        {
+            std::string str = "frame holds "
+                    + boost::lexical_cast<std::string>(count) + " values, expected "
+                    + boost::lexical_cast<std::string>(m_rxStaging.size());
+            LOG_WARN_LIMITED(Logger, 1) << "Corrupt state: " << str << std::endl;
+            packet << "BadRequest\r\n" << str << "\r\n\r\n";
+            EndSession();
+            StartWrite();
+        }
+        else if( count == 0 )
+        {
+            HandleFrame(boost::system::error_code());
+        }
+        else
+        {
+            boost::asio::async_read(*m_client, boost::asio::buffer(m_rxStaging),
+                    boost::bind(&CPnpAdapter::HandleFrame, shared_from_this(),
+                    boost::asio::placeholders::error));
+        }
+    }
+    catch(std::exception & e)
+    {
+        LOG_INFO(Logger) << m_identifier << " communication failed."
+                << std::endl;
+        LOG_DEBUG(Logger) << "Reason: " << e.what() << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Publishes the values of a binary state frame and answers with a binary
+/// command frame.
+///
+/// @pre m_rxStaging must hold the frame values in network order.
+/// @post Updates m_rxBuffer with the new state information.
+/// @post Sends the current commands to the client.
+/// @param e The error code associated with the last read operation.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CPnpAdapter::HandleFrame(const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
+        if( m_stopping || e )
+        {
+            LOG_DEBUG(Logger) << "HandleFrame giving up : "
+                << (m_stopping ? "received stop" : e.message()) << std::endl;
+            return;
+        }
+    }
+
+    try
+    {
+        Heartbeat();
+
+        EndianSwapIfNeeded(m_rxStaging);
+        PublishStates();
+        if( m_buffer_initialized == false )
+        {
+            RevealDevices();
+            m_buffer_initialized = true;
+        }
+
+        WriteCommandFrame();
+        StartWrite();
+    }
+    catch(std::exception & e)
+    {
+        LOG_INFO(Logger) << m_identifier << " communication failed."
+                << std::endl;
+        LOG_DEBUG(Logger) << "Reason: " << e.what() << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Writes the current DGI commands to m_buffer as a binary command frame.
+///
+/// @pre None.
+/// @post m_buffer holds the big-endian value count and the commands in index
+/// order as big-endian float32 values.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CPnpAdapter::WriteCommandFrame()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::ostream packet(&m_buffer);
+
+    SnapshotCommands();
+    EndianSwapIfNeeded(m_txStaging);
+
+    boost::uint32_t count = htonl(m_txStaging.size());
+    packet.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+    if( !m_txStaging.empty() )
+    {
+        packet.write(reinterpret_cast<const char *>(&m_txStaging[0]),
+                m_txStaging.size() * sizeof(SignalValue));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Ends the session once the pending response has been written.
+///
+/// @pre None.
+/// @post Raises the m_stopping flag.
+/// @post Calls CAdapterFactory::RemoveAdapter for this adapter.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CPnpAdapter::EndSession()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    {
+        boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
+        m_stopping = true;
+    }
+    CAdapterFactory::Instance().RemoveAdapter(m_identifier);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Prepares the next read operation after a successful write.
 ///
@@ -365,7 +541,7 @@ void CPnpAdapter::HandleRead(const boost::system::error_code & e)
 ////////////////////////////////////////////////////////////////////////////////
 void CPnpAdapter::AfterWrite(const boost::system::error_code & e)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     boost::lock_guard<boost::mutex> lock(m_stoppingMutex);
     if( !m_stopping && !e )
@@ -375,25 +551,33 @@ void CPnpAdapter::AfterWrite(const boost::system::error_code & e)
     }
     else
     {
-        Logger.Debug << "AfterWrite giving up: "
+        LOG_DEBUG(Logger) << "AfterWrite giving up: "
                 << (m_stopping ? "stop received" : e.message()) << std::endl;
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Processes the content of a state packet received from the device.
+/// Processes the content of a state packet received from the device.  A
+/// partial packet only updates the states it lists.
 ///
-/// @ErrorHandling Throws a EBadRequest if the packet is malformed.
+/// @ErrorHandling Throws a EBadRequest if the packet is malformed, or if it is
+/// partial and no full packet has been received yet.
 /// @pre The packet format must adhere to the session protocol specifications.
 /// @post Extracts the device state information from packet.
 /// @post Updates m_rxBuffer with the new state information.
 /// @param packet The device packet that contains updated state information.
+/// @param partial True if the packet is a delta that may omit states.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-void CPnpAdapter::ReadStatePacket(const std::string packet)
+void CPnpAdapter::ReadStatePacket(const std::string packet, bool partial)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( partial && m_buffer_initialized == false )
+    {
+        throw EBadRequest("Delta states before the first full device states.");
+    }
 
     std::map<std::size_t, SignalValue> temp;
     std::map<std::size_t, SignalValue>::iterator it, end;
@@ -404,7 +588,7 @@ void CPnpAdapter::ReadStatePacket(const std::string packet)
     std::size_t index;
     SignalValue value;
 
-    Logger.Debug << "Processing packet: " << packet;
+    LOG_DEBUG(Logger) << "Processing packet: " << packet;
 
     out << packet;
 
@@ -413,7 +597,7 @@ void CPnpAdapter::ReadStatePacket(const std::string packet)
         name = m_identifier + ":" + name;
         boost::replace_all(name, ".", ":");
 
-        Logger.Debug << "Parsing: " << name << " " << signal << std::endl;
+        LOG_DEBUG(Logger) << "Parsing: " << name << " " << signal << std::endl;
 
         DeviceSignal devsig(name, signal);
         std::string devsigstr = name + " " + signal;
@@ -432,7 +616,7 @@ void CPnpAdapter::ReadStatePacket(const std::string packet)
         }
     }
 
-    if( temp.size() != m_rxBuffer.size() )
+    if( !partial && temp.size() != m_rxBuffer.size() )
     {
         throw EBadRequest("Incomplete device state specification.");
     }
@@ -446,31 +630,44 @@ void CPnpAdapter::ReadStatePacket(const std::string packet)
             m_rxBuffer[it->first] = it->second;
         }
     }
+    StatesChanged();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Generates the next command packet from the current DGI commands.
+/// Generates the next command packet from the current DGI commands.  With
+/// delta packets, a command is only listed if it moved past the deadband
+/// since it was last sent, and every command is listed in the first packet
+/// and once the refresh count of delta packets has passed.
 ///
 /// @pre None.
 /// @post Creates a command packet from the content of m_txBuffer.
+/// @post m_sentCommands holds the last value sent of each command.
 /// @return A string that contains the next command packet.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 std::string CPnpAdapter::GetCommandPacket()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     std::map<const DeviceSignal, const std::size_t>::iterator it, end;
     std::stringstream packet;
     std::string devname, signal;
     SignalValue value;
     std::size_t index;
-
-    packet << "DeviceCommands\r\n";
+    bool full = true;
 
     boost::unique_lock<boost::shared_mutex> lock(m_txMutex);
 
+    if( m_delta )
+    {
+        full = m_sentCommands.size() != m_txBuffer.size()
+            || m_sinceRefresh >= CGlobalConfiguration::Instance().GetPnpDeltaRefresh();
+        m_sentCommands.resize(m_txBuffer.size(), NULL_COMMAND);
+        m_sinceRefresh = full ? 0 : m_sinceRefresh + 1;
+    }
+    packet << (full ? "DeviceCommands\r\n" : "DeviceCommandsDelta\r\n");
+
     end = m_commandInfo.end();
     for( it = m_commandInfo.begin(); it != end; it++ )
     {
@@ -483,9 +680,20 @@ std::string CPnpAdapter::GetCommandPacket()
 
         value = m_txBuffer[it->second];
 
+        if( m_delta )
+        {
+            SignalValue & sent = m_sentCommands[it->second];
+            if( !full && std::abs(value - sent)
+                    <= CGlobalConfiguration::Instance().GetPnpDeltaDeadband() )
+            {
+                continue;
+            }
+            sent = value;
+        }
+
         packet << devname << " " << signal << " " << value << "\r\n";
     }
-    Logger.Debug << "Sending packet:\n" << packet.str() << std::endl;
+    LOG_DEBUG(Logger) << "Sending packet:\n" << packet.str() << std::endl;
     packet << "\r\n";
     return packet.str();
 }
@@ -27,6 +27,7 @@
 #include "CTcpServer.hpp"
 
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/property_tree/ptree_fwd.hpp>
@@ -38,10 +39,24 @@ namespace device {
 /// PNP adapter that maintains a TCP server for a set of plug-and-play devices.
 ////////////////////////////////////////////////////////////////////////////////
 /// The PNP adapter implements the plug-and-play session protocol. An object of
-/// this class will delete itself on expiration of an internal countdown timer
-/// unless the CPnpAdapter::Heartbeat function is called to refresh the timer.
-/// The adapter calls this function itself whenever it sends or receives data
-/// on its TCP server without incident.
+/// this class will delete itself when the heartbeat wheel of CAdapterFactory
+/// passes its deadline unless the CPnpAdapter::Heartbeat function is called
+/// to move the deadline. The adapter calls this function itself whenever it
+/// sends or receives data on its TCP server without incident.
+///
+/// A client that opens the session with HelloBinary uses binary framing once
+/// the start packet has been sent. Each DeviceStates packet is then a
+/// big-endian uint32 value count followed by that many big-endian float32
+/// states in index order, and the adapter answers with a frame of the same
+/// format that carries the commands. A count of DISCONNECT_FRAME in place of
+/// the states is a polite disconnect, and the adapter echoes it back.
+///
+/// A client that opens the session with HelloDelta may send DeviceStatesDelta
+/// packets that hold only the states it changed, once it has sent one full
+/// DeviceStates packet. The adapter then answers with DeviceCommandsDelta
+/// packets that hold only the commands that moved past the delta deadband
+/// since they were last sent, and with a full DeviceCommands packet every
+/// time the delta refresh count of packets has passed.
 ///
 /// @limitations A shared pointer to this class must never be stored except in
 /// the CAdapterFactory class. If a shared pointer is stored, then the session
@@ -59,13 +74,13 @@ public:
     static IAdapter::Pointer Create(boost::asio::io_service & service,
             boost::property_tree::ptree & p, CTcpServer::Connection client);
 
-    /// Starts the internal countdown timer.
+    /// Registers the adapter with the heartbeat wheel.
     void Start();
 
     /// Stops the adapter.
     void Stop();
 
-    /// Refreshes the internal countdown timer.
+    /// Refreshes the heartbeat deadline.
     void Heartbeat();
 
     /// Destructs the object.
@@ -76,7 +91,7 @@ private:
             boost::property_tree::ptree & p, CTcpServer::Connection client);
 
     /// Tells the adapter factory to remove its reference to this object.
-    void Timeout(const boost::system::error_code & e);
+    void Timeout();
 
     /// Schedules the next read operation.
     void StartRead();
@@ -87,17 +102,29 @@ private:
     /// Handles a packet received from the device.
     void HandleRead(const boost::system::error_code & e);
 
+    /// Handles the value count of a binary state frame.
+    void HandleFrameHeader(const boost::system::error_code & e);
+
+    /// Handles the values of a binary state frame.
+    void HandleFrame(const boost::system::error_code & e);
+
+    /// Writes the current commands to m_buffer as a binary frame.
+    void WriteCommandFrame();
+
+    /// Accepts a polite disconnect from the client.
+    void EndSession();
+
     /// Handles when a packet has been sent to the device.
     void AfterWrite(const boost::system::error_code & e);
 
-    /// Parses a state packet received from the client.
-    void ReadStatePacket(const std::string packet);
+    /// Parses a full or delta state packet received from the client.
+    void ReadStatePacket(const std::string packet, bool partial);
 
     /// Sends device commands to the current client.
     std::string GetCommandPacket();
 
-    /// Countdown until the object destroys itself.
-    boost::shared_ptr<boost::asio::deadline_timer> m_countdown;
+    /// Wheel tick after which the object destroys itself.
+    boost::uint64_t m_deadline;
 
     /// The ioservice running this adapter
     boost::asio::io_service& m_ios;
@@ -111,11 +138,31 @@ private:
     /// Stream used to send and receive data.
     boost::asio::streambuf m_buffer;
 
+    /// True if the client negotiated binary framing.
+    bool m_binary;
+
+    /// Value count of the binary frame being read, in network order.
+    boost::uint32_t m_frameCount;
+
+    /// True if the client negotiated delta packets.
+    bool m_delta;
+
+    /// Command values the client was last sent, by index.
+    std::vector<SignalValue> m_sentCommands;
+
+    /// Delta command packets sent since the last full command packet.
+    unsigned int m_sinceRefresh;
+
+    /// Value count that marks a polite disconnect in binary framing.
+    static const boost::uint32_t DISCONNECT_FRAME = 0xFFFFFFFF;
+
     /// Signifies that the adapter is to stop.
     bool m_stopping;
 
     /// Protects access to m_stopping
     boost::mutex m_stoppingMutex;
+
+    friend class CAdapterFactory;
 };
 
 } // namespace device
@@ -0,0 +1,358 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CReplayAdapter.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that replays the states of a telemetry file.
+///
+/// @functions    CReplayAdapter::Create
+///               CReplayAdapter::CReplayAdapter
+///               CReplayAdapter::Start
+///               CReplayAdapter::Rewind
+///               CReplayAdapter::ReadChunk
+///               CReplayAdapter::Update
+///               CReplayAdapter::Stop
+///               CReplayAdapter::~CReplayAdapter
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CReplayAdapter.hpp"
+#include "TelemetryFormat.hpp"
+#include "CLogger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+} // unnamed namespace
+
+///////////////////////////////////////////////////////////////////////////////
+/// Creates a replay adapter on the given io_service.
+///
+/// @Shared_Memory Uses the passed io_service
+///
+/// @pre None.
+/// @post CReplayAdapter object is returned for use.
+///
+/// @param service The io_service that runs the replay.
+/// @param ptree The info tag of the adapter.
+///
+/// @return Shared pointer to the new CReplayAdapter object.
+///
+/// @limitations None
+///////////////////////////////////////////////////////////////////////////////
+IAdapter::Pointer CReplayAdapter::Create(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return CReplayAdapter::Pointer(new CReplayAdapter(service, ptree));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructs a replay adapter.  The info tag holds the telemetry file, the
+/// name of the recorded adapter, the speed of the replay and whether to
+/// start over at the end of the file.
+///
+/// @Shared_Memory Uses the passed io_service.
+///
+/// @ErrorHandling Throws a std::runtime_error if the file is missing or the
+/// speed is not positive.
+/// @pre None.
+/// @post The adapter is ready to be started.
+///
+/// @param service The io_service that runs the replay.
+/// @param ptree The info tag of the adapter.
+///
+/// @limitations None
+////////////////////////////////////////////////////////////////////////////////
+CReplayAdapter::CReplayAdapter(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+    : m_path(ptree.get<std::string>("file"))
+    , m_stream(ptree.get<std::string>("stream", ""))
+    , m_speed(ptree.get<double>("speed", 1.0))
+    , m_loop(ptree.get<bool>("loop", false))
+    , m_streamId(0)
+    , m_found(false)
+    , m_width(0)
+    , m_next(0)
+    , m_first(0)
+    , m_updateTimer(service)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_speed <= 0 )
+    {
+        throw std::runtime_error("The replay adapter speed must be positive.");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sizes the buffers, reads the first chunk of the recorded adapter and
+/// replays its first row at once.
+///
+/// @ErrorHandling Throws a std::runtime_error if the file is not a telemetry
+/// file, or if it has no rows of the recorded adapter.
+/// @pre The devices of the adapter have been registered.
+/// @post CReplayAdapter::Update is called to publish the first row.
+///
+/// @limitations All devices must be added to the adapter before this call.
+////////////////////////////////////////////////////////////////////////////////
+void CReplayAdapter::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    IBufferAdapter::Start();
+    Rewind();
+
+    if( !ReadChunk() )
+    {
+        throw std::runtime_error("The telemetry file " + m_path
+                + " has no rows of the adapter " + m_stream);
+    }
+
+    LOG_INFO(Logger) << "Replaying " << m_rxBuffer.size() << " states from "
+            << m_path << " at " << m_speed << " times the recorded speed."
+            << std::endl;
+
+    m_first = m_times[0];
+    m_origin = CVirtualClock::Now();
+    m_updateTimer.expires_at(m_origin);
+    m_updateTimer.async_wait(boost::bind(&CReplayAdapter::Update,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Opens the telemetry file at its first block.
+///
+/// @ErrorHandling Throws a std::runtime_error if the file cannot be opened or
+/// is not a telemetry file of this version.
+/// @pre None.
+/// @post The next ReadChunk reads the first chunk of the recorded adapter.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CReplayAdapter::Rewind()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    STelemetryHeader header;
+
+    m_file.close();
+    m_file.clear();
+    m_file.open(m_path.c_str(), std::ios::in | std::ios::binary);
+
+    if( !m_file.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || std::memcmp(header.magic, TELEMETRY_MAGIC, sizeof(header.magic)) != 0
+        || header.version != TELEMETRY_VERSION
+        || header.value_size != sizeof(SignalValue) )
+    {
+        throw std::runtime_error(m_path + " is not a telemetry file.");
+    }
+
+    m_found = false;
+    m_times.clear();
+    m_rows.clear();
+    m_next = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reads blocks until the next chunk of the recorded adapter, skipping the
+/// blocks of every other adapter.  The recorded adapter is the one named by
+/// the stream tag, or the first one in the file.
+///
+/// @ErrorHandling Throws a std::runtime_error if the recorded adapter has
+/// fewer states than this adapter, or if its chunk is malformed.
+/// @pre The file is open.
+/// @post m_times and m_rows hold the chunk, and m_next is its first row.
+///
+/// @return False at the end of the file.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+bool CReplayAdapter::ReadChunk()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    STelemetryBlock block;
+    std::vector<char> payload;
+
+    while( m_file.read(reinterpret_cast<char *>(&block), sizeof(block)) )
+    {
+        payload.resize(block.length + 1);
+        // a block cut short when the recording stopped ends the file
+        if( !m_file.read(&payload[0], block.length) )
+        {
+            return false;
+        }
+
+        const char * pos = &payload[0];
+        const char * end = pos + block.length;
+
+        if( block.kind == TELEMETRY_STREAM && !m_found
+            && block.length >= sizeof(STelemetryStream) )
+        {
+            STelemetryStream info;
+            std::memcpy(&info, pos, sizeof(info));
+            std::string name(pos + sizeof(info), end);
+
+            if( m_stream.empty() || name == m_stream )
+            {
+                if( info.states < m_rxBuffer.size() )
+                {
+                    throw std::runtime_error("The recorded adapter " + name
+                            + " has only " + boost::lexical_cast<std::string>(info.states)
+                            + " states.");
+                }
+                m_found = true;
+                m_streamId = block.stream;
+                m_width = info.states + info.commands;
+            }
+        }
+        else if( block.kind == TELEMETRY_CHUNK && m_found
+            && block.stream == m_streamId )
+        {
+            STelemetryChunk header;
+
+            if( !DecodeChunk(pos, end, m_width, header, m_times, m_rows) )
+            {
+                throw std::runtime_error("The telemetry file " + m_path
+                        + " has a malformed chunk.");
+            }
+            if( header.dropped > 0 )
+            {
+                LOG_WARN(Logger) << "The recording dropped " << header.dropped
+                        << " rows here." << std::endl;
+            }
+            if( !m_times.empty() )
+            {
+                m_next = 0;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Publishes the states of the next row and schedules the row after it at
+/// its recorded distance from the first row, divided by the speed.  The
+/// devices are revealed after the first row.
+///
+/// @pre The adapter has been started.
+/// @post m_rxBuffer holds the states of the row.
+///
+/// @param e The error code of the update timer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CReplayAdapter::Update(const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( e )
+    {
+        if( e != boost::asio::error::operation_aborted )
+        {
+            LOG_ERROR(Logger) << "Update timer failed: " << e.message() << std::endl;
+        }
+        return;
+    }
+
+    const float * row = &m_rows[m_next * m_width];
+    std::copy(row, row + m_rxStaging.size(), m_rxStaging.begin());
+    PublishStates();
+
+    if( m_buffer_initialized == false )
+    {
+        m_buffer_initialized = true;
+        RevealDevices();
+    }
+
+    m_next++;
+    if( m_next == m_times.size() && !ReadChunk() )
+    {
+        if( !m_loop )
+        {
+            LOG_NOTICE(Logger) << "Finished replaying " << m_path << std::endl;
+            return;
+        }
+        Rewind();
+        if( !ReadChunk() )
+        {
+            return;
+        }
+        // the next pass starts right after the last row of this one
+        m_origin = m_updateTimer.expires_at();
+        m_first = m_times[0];
+    }
+
+    boost::uint64_t offset = m_times[m_next] > m_first ? m_times[m_next] - m_first : 0;
+    m_updateTimer.expires_at(m_origin
+            + boost::posix_time::microseconds(static_cast<boost::int64_t>(offset / m_speed)));
+    m_updateTimer.async_wait(boost::bind(&CReplayAdapter::Update,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Stops the adapter. Thread-safe.
+///
+/// @pre None.
+/// @post The update timer is cancelled and the states no longer change.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+void CReplayAdapter::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    try
+    {
+        m_updateTimer.cancel();
+    }
+    catch( boost::system::system_error & e )
+    {
+        LOG_ERROR(Logger) << "Error cancelling timer: " << e.what() << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Destructor.
+///
+/// @pre None.
+/// @post None.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+CReplayAdapter::~CReplayAdapter()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
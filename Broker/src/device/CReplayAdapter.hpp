@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CReplayAdapter.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that replays the states of a telemetry file.
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_REPLAY_ADAPTER_HPP
+#define C_REPLAY_ADAPTER_HPP
+
+#include "IBufferAdapter.hpp"
+#include "CVirtualClock.hpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// Replays the states an adapter recorded to a telemetry file.
+////////////////////////////////////////////////////////////////////////////////
+/// Feeds the state tables of one adapter of a telemetry file back to the DGI
+/// at the pace they were recorded, or faster, so that two builds can be
+/// compared on the same inputs.  The devices of the replay adapter are given
+/// the state indices of the recorded adapter, which is usually done by
+/// copying its state tags.  The rows are read from the file a chunk at a
+/// time, and the recorded commands are ignored.
+///
+/// @limitations The commands of the DGI do not change the replayed states.
+////////////////////////////////////////////////////////////////////////////////
+class CReplayAdapter
+    : public IBufferAdapter
+    , public boost::enable_shared_from_this<CReplayAdapter>
+{
+public:
+    /// Pointer to a CReplayAdapter object.
+    typedef boost::shared_ptr<CReplayAdapter> Pointer;
+
+    /// Create a CReplayAdapter object and returns a pointer to it.
+    static IAdapter::Pointer Create(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Starts the adapter.
+    void Start();
+
+    /// Stops replaying states.
+    void Stop();
+
+    /// Destructor.
+    ~CReplayAdapter();
+
+private:
+    /// Constructor.
+    CReplayAdapter(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Opens the file and finds the recorded adapter.
+    void Rewind();
+
+    /// Reads the next chunk of the recorded adapter.
+    bool ReadChunk();
+
+    /// Publishes the next row and schedules the one after.
+    void Update(const boost::system::error_code & e);
+
+    /// The telemetry file.
+    std::string m_path;
+
+    /// The name of the recorded adapter, empty for the first one.
+    std::string m_stream;
+
+    /// How many times faster than recorded the rows are replayed.
+    double m_speed;
+
+    /// True to start over at the end of the file.
+    bool m_loop;
+
+    /// The open telemetry file.
+    std::ifstream m_file;
+
+    /// The number of the recorded adapter in the file.
+    boost::uint32_t m_streamId;
+
+    /// True once the recorded adapter was found.
+    bool m_found;
+
+    /// The number of columns of the recorded adapter.
+    std::size_t m_width;
+
+    /// The time of each row of the current chunk.
+    std::vector<boost::uint64_t> m_times;
+
+    /// The rows of the current chunk.
+    std::vector<float> m_rows;
+
+    /// The next row of the current chunk.
+    std::size_t m_next;
+
+    /// The recorded time of the first replayed row.
+    boost::uint64_t m_first;
+
+    /// The time the first row was replayed.
+    boost::posix_time::ptime m_origin;
+
+    /// Timer for the rows.
+    CVirtualTimer m_updateTimer;
+};
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // C_REPLAY_ADAPTER_HPP
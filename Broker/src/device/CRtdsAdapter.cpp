@@ -10,15 +10,22 @@
 ///
 /// @description  DGI implementation of the FPGA communication protocol.
 ///
-/// @functions    EndianSwap
-///               EndianSwapIfNeeded
-///               CRtdsAdapter::Create
+/// @functions    CRtdsAdapter::Create
 ///               CRtdsAdapter::Start
 ///               CRtdsAdapter::~CRtdsAdapter
+///               CRtdsAdapter::AssignSlices
 ///               CRtdsAdapter::Run
+///               CRtdsAdapter::HandleWrite
+///               CRtdsAdapter::HandleRead
+///               CRtdsAdapter::HandleTimeout
+///               CRtdsAdapter::ArmTimeout
+///               CRtdsAdapter::EndCycle
+///               CRtdsAdapter::ScheduleRun
 ///               CRtdsAdapter::CRtdsAdapter
 ///               CRtdsAdapter::Quit
 ///               CRtdsAdapter::Connect
+///               CRtdsAdapter::HandleResolve
+///               CRtdsAdapter::HandleConnect
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -36,7 +43,6 @@
 #include "CRtdsAdapter.hpp"
 #include "CLogger.hpp"
 #include "CTimings.hpp"
-#include "SynchronousTimeout.hpp"
 
 #include <sys/param.h>
 
@@ -50,6 +56,7 @@
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/static_assert.hpp>
 #include <boost/property_tree/ptree.hpp>
 
@@ -85,12 +92,15 @@ CLocalLogger Logger(__FILE__);
 IAdapter::Pointer CRtdsAdapter::Create(boost::asio::io_service & service,
         const boost::property_tree::ptree & ptree)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return CRtdsAdapter::Pointer(new CRtdsAdapter(service, ptree));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Constructs an RTDS client.
+/// Constructs an RTDS client.  The info tag either holds the host and port of
+/// a single FPGA, or one endpoint tag per FPGA with its host and port and the
+/// number of states and commands it exchanges.  The counts can be left out
+/// on the last endpoint, which then exchanges the rest of the buffers.
 ///
 /// @Shared_Memory Uses the passed io_service.
 ///
@@ -105,59 +115,147 @@ IAdapter::Pointer CRtdsAdapter::Create(boost::asio::io_service & service,
 CRtdsAdapter::CRtdsAdapter(boost::asio::io_service & io_service,
         const boost::property_tree::ptree & ptree)
     : m_runTimer(io_service)
-    , m_socket(io_service)
-    , m_host(ptree.get<std::string>("host"))
-    , m_port(ptree.get<std::string>("port"))
+    , m_outstanding(0)
+    , m_connecting(0)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::vector<const boost::property_tree::ptree *> specs;
+
+    BOOST_FOREACH(const boost::property_tree::ptree::value_type & child, ptree)
+    {
+        if( child.first == "endpoint" )
+        {
+            specs.push_back(&child.second);
+        }
+    }
+    if( specs.empty() )
+    {
+        specs.push_back(&ptree);
+    }
+
+    BOOST_FOREACH(const boost::property_tree::ptree * spec, specs)
+    {
+        SEndpoint endpoint;
+        endpoint.host = spec->get<std::string>("host");
+        endpoint.port = spec->get<std::string>("port");
+        endpoint.socket.reset(new boost::asio::ip::tcp::socket(io_service));
+        endpoint.resolver.reset(new boost::asio::ip::tcp::resolver(io_service));
+        endpoint.timeout.reset(new boost::asio::deadline_timer(io_service));
+        endpoint.timedOut = false;
+        endpoint.stateOffset = 0;
+        endpoint.stateCount = spec->get<int>("states", -1);
+        endpoint.commandOffset = 0;
+        endpoint.commandCount = spec->get<int>("commands", -1);
+        m_endpoints.push_back(endpoint);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Starts sending and receiving data with the adapter.
 ///
 /// @pre The adapter has not yet been started.
-/// @post CRtdsAdapter::Run is called to start the adapter.
+/// @post The endpoints are being connected in the background, and
+///     CRtdsAdapter::Run is called once all of them are.
 ///
 /// @limitations All devices must be added to the adapter before this call.
 ////////////////////////////////////////////////////////////////////////////////
 void CRtdsAdapter::Start()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     IBufferAdapter::Start();
+    AssignSlices();
     Connect();
-    m_runTimer.expires_from_now(
-            boost::posix_time::milliseconds(CTimings::Get("DEV_RTDS_DELAY")));
-    m_runTimer.async_wait(boost::bind(&CRtdsAdapter::Run, shared_from_this(),
-            boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Gives each endpoint the next part of the state and command buffers.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the counts of the endpoints do not add
+///     up to the size of the buffers.
+///
+/// @pre The buffers have their final size.
+///
+/// @post The offset and count of each endpoint are set.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::AssignSlices()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::size_t state = 0, command = 0;
+
+    for( std::size_t i = 0; i < m_endpoints.size(); i++ )
+    {
+        SEndpoint & endpoint = m_endpoints[i];
+        bool last = (i + 1 == m_endpoints.size());
+
+        if( !last && (endpoint.stateCount < 0 || endpoint.commandCount < 0) )
+        {
+            throw std::runtime_error("RTDS endpoint " + endpoint.host + ":"
+                    + endpoint.port + " must list its states and commands.");
+        }
+        if( endpoint.stateCount < 0 )
+        {
+            endpoint.stateCount = state < m_rxStaging.size()
+                    ? m_rxStaging.size() - state : 0;
+        }
+        if( endpoint.commandCount < 0 )
+        {
+            endpoint.commandCount = command < m_txStaging.size()
+                    ? m_txStaging.size() - command : 0;
+        }
+
+        endpoint.stateOffset = state;
+        endpoint.commandOffset = command;
+        state += endpoint.stateCount;
+        command += endpoint.commandCount;
+
+        LOG_INFO(Logger) << "RTDS endpoint " << endpoint.host << ":"
+                << endpoint.port << " exchanges " << endpoint.stateCount
+                << " states and " << endpoint.commandCount << " commands."
+                << std::endl;
+    }
+
+    if( state != m_rxStaging.size() || command != m_txStaging.size() )
+    {
+        throw std::runtime_error("The RTDS endpoints exchange "
+                + boost::lexical_cast<std::string>(state) + " states and "
+                + boost::lexical_cast<std::string>(command) + " commands, expected "
+                + boost::lexical_cast<std::string>(m_rxStaging.size()) + " and "
+                + boost::lexical_cast<std::string>(m_txStaging.size()) + ".");
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// This is the main communication engine.
 ///
 /// @IO
-///     At every timestep, a message is sent to the FPGA via TCP socket
-///     connection, then a message is retrieved from FPGA via the same
+///     At every timestep, a message is sent to each FPGA via its TCP socket
+///     connection, then a message is retrieved from the FPGA via the same
 ///     connection.  On the FPGA side, it's the reverse order -- receive and
-///     then send.  Both DGI and FPGA receive functions will block until a
-///     message arrives, creating a synchronous, lock-step communication between
-///     DGI and the FPGA. We keep the timestep (a static member of CRtdsAdapter)
-///     very small so that how frequently send and receive get executed is
-///     dependent on how fast the FPGA runs.
+///     then send.  The writes and the reads are asynchronous and all of the
+///     endpoints run at once: this function starts the writes, HandleWrite
+///     starts the read of its endpoint, and the last HandleRead of the cycle
+///     publishes the state table.  The buffers on the wire are the staging
+///     buffers, so module reads only wait for the swap in PublishStates and
+///     never for the network.
 ///
 /// @Error_Handling
 ///     Throws std::runtime_error if reading from or writing to socket fails.
 ///
-/// @pre Connection with FPGA is established.
+/// @pre Connection with each FPGA is established.
 ///
-/// @post All values in the receive buffer are sent to the FPGA.  All values in
-/// the send buffer are updated with data from the FPGA.
+/// @post The commands are being sent to the FPGAs.
 ///
-/// @limitations This function uses synchronous communication.
+/// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 void CRtdsAdapter::Run(const boost::system::error_code & e)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if( e )
     {
@@ -167,83 +265,278 @@ void CRtdsAdapter::Run(const boost::system::error_code & e)
         }
         else
         {
-            Logger.Fatal << "Run called with error: " << e.message()
+            LOG_FATAL(Logger) << "Run called with error: " << e.message()
                     << std::endl;
             throw boost::system::system_error(e);
         }
     }
 
+    m_cycleStart = boost::asio::deadline_timer::traits_type::now();
+    m_outstanding = m_endpoints.size();
+
     // Always send data to FPGA first
-    if( !m_txBuffer.empty() )
+    if( !m_txStaging.empty() )
+    {
+        SnapshotCommands();
+        EndianSwapIfNeeded(m_txStaging);
+    }
+
+    for( std::size_t i = 0; i < m_endpoints.size(); i++ )
     {
-        boost::unique_lock<boost::shared_mutex> writeLock(m_txMutex);
-        Logger.Debug << "Obtained the txBuffer mutex." << std::endl;
+        SEndpoint & endpoint = m_endpoints[i];
 
-        EndianSwapIfNeeded(m_txBuffer);
-        try
+        if( endpoint.commandCount == 0 )
         {
-            Logger.Debug << "Blocking for a socket write call." << std::endl;
-            TimedWrite(m_socket, boost::asio::buffer(m_txBuffer,
-                    m_txBuffer.size() * sizeof(SignalValue)),
-                    CTimings::Get("DEV_SOCKET_TIMEOUT"));
+            HandleWrite(i, boost::system::error_code());
+            continue;
+        }
+
+        LOG_DEBUG(Logger) << "Starting a socket write to " << endpoint.host
+                << "." << std::endl;
+        ArmTimeout(i);
+        boost::asio::async_write(*endpoint.socket, boost::asio::buffer(
+                &m_txStaging[endpoint.commandOffset],
+                endpoint.commandCount * sizeof(SignalValue)),
+                boost::bind(&CRtdsAdapter::HandleWrite, shared_from_this(), i,
+                boost::asio::placeholders::error));
+    }
+}
 
+////////////////////////////////////////////////////////////////////////////////
+/// Starts reading the states of an endpoint once its commands are sent.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the write timed out and a
+///     boost::system::system_error if it failed.
+///
+/// @pre The write started by Run has completed.
+///
+/// @post The states of the endpoint are being read into m_rxStaging.
+///
+/// @param i The index of the endpoint in m_endpoints.
+/// @param e The result of the write.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::HandleWrite(std::size_t i, const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SEndpoint & endpoint = m_endpoints[i];
+
+    if( e )
+    {
+        if( endpoint.timedOut )
+        {
+            LOG_FATAL(Logger) << "Send to FPGA " << endpoint.host
+                    << " timed out." << std::endl;
+            throw std::runtime_error("RTDS Write Timeout");
         }
-        catch(boost::system::system_error & e)
+        if( e == boost::asio::error::operation_aborted )
         {
-            Logger.Fatal << "Send to FPGA failed: " << e.what();
-            throw;
+            return;
         }
-        EndianSwapIfNeeded(m_txBuffer);
-
-        Logger.Debug << "Releasing the txBuffer mutex." << std::endl;
+        LOG_FATAL(Logger) << "Send to FPGA " << endpoint.host << " failed: "
+                << e.message() << std::endl;
+        throw boost::system::system_error(e);
     }
 
     // Receive data from FPGA next
-    if( !m_rxBuffer.empty() )
+    if( endpoint.stateCount == 0 )
     {
-        // must be a unique_lock for endian swaps
-        boost::unique_lock<boost::shared_mutex> writeLock(m_rxMutex);
-        Logger.Debug << "Obtained the rxBuffer mutex." << std::endl;
+        HandleRead(i, boost::system::error_code());
+        return;
+    }
 
-        try
+    // the staging buffer is private to this adapter, so the modules can
+    // keep reading the previous state table during the socket read
+    LOG_DEBUG(Logger) << "Starting a socket read from " << endpoint.host
+            << "." << std::endl;
+    ArmTimeout(i);
+    boost::asio::async_read(*endpoint.socket, boost::asio::buffer(
+            &m_rxStaging[endpoint.stateOffset],
+            endpoint.stateCount * sizeof(SignalValue)),
+            boost::bind(&CRtdsAdapter::HandleRead, shared_from_this(), i,
+            boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Counts the states of an endpoint as read, and ends the cycle once the
+/// last endpoint has replied.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the read timed out and a
+///     boost::system::system_error if it failed.
+///
+/// @pre The read started by HandleWrite has completed.
+///
+/// @post The cycle ends if no other endpoint is outstanding.
+///
+/// @param i The index of the endpoint in m_endpoints.
+/// @param e The result of the read.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::HandleRead(std::size_t i, const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SEndpoint & endpoint = m_endpoints[i];
+
+    if( e )
+    {
+        if( endpoint.timedOut )
         {
-            Logger.Debug << "Blocking for a socket read call." << std::endl;
-            TimedRead(m_socket, boost::asio::buffer(m_rxBuffer,
-                    m_rxBuffer.size() * sizeof(SignalValue)),
-                    CTimings::Get("DEV_SOCKET_TIMEOUT"));
+            LOG_FATAL(Logger) << "Receive from FPGA " << endpoint.host
+                    << " timed out." << std::endl;
+            throw std::runtime_error("RTDS Read Timeout");
         }
-        catch (boost::system::system_error & e)
+        if( e == boost::asio::error::operation_aborted )
         {
-            Logger.Fatal << "Receive from FPGA failed: " << e.what();
-            throw;
+            return;
         }
-        EndianSwapIfNeeded(m_rxBuffer);
+        LOG_FATAL(Logger) << "Receive from FPGA " << endpoint.host
+                << " failed: " << e.message() << std::endl;
+        throw boost::system::system_error(e);
+    }
+
+    endpoint.timeout->cancel();
+
+    if( --m_outstanding == 0 )
+    {
+        EndCycle();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Cancels the socket operation of an endpoint when its timeout expires. The
+/// handler of the operation then sees the cancellation and reports it.
+///
+/// @pre None.
+/// @post The endpoint is marked as timed out and its socket operations are
+///     cancelled if the timeout expired.
+///
+/// @param i The index of the endpoint in m_endpoints.
+/// @param e The result of the wait.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::HandleTimeout(std::size_t i, const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SEndpoint & endpoint = m_endpoints[i];
+
+    // a wait that finished as it was re-armed must not cancel the next one
+    if( e || endpoint.timeout->expires_at() >
+            boost::asio::deadline_timer::traits_type::now() )
+    {
+        return;
+    }
+
+    endpoint.timedOut = true;
+    boost::system::error_code ignored;
+    endpoint.socket->cancel(ignored);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Bounds the next socket operation of an endpoint by DEV_SOCKET_TIMEOUT.
+///
+/// @pre None.
+/// @post The timer of the endpoint expires after DEV_SOCKET_TIMEOUT.
+///
+/// @param i The index of the endpoint in m_endpoints.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::ArmTimeout(std::size_t i)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SEndpoint & endpoint = m_endpoints[i];
+
+    endpoint.timedOut = false;
+    endpoint.timeout->expires_from_now(
+            CTimings::GetDuration(CTimings::DEV_SOCKET_TIMEOUT));
+    endpoint.timeout->async_wait(boost::bind(&CRtdsAdapter::HandleTimeout,
+            shared_from_this(), i, boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Publishes the states read from every endpoint as one state table.
+///
+/// @pre The states of every endpoint have been read this cycle.
+///
+/// @post m_rxBuffer holds the values from the FPGAs and the next cycle is
+///     scheduled.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::EndCycle()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( !m_rxStaging.empty() )
+    {
+        EndianSwapIfNeeded(m_rxStaging);
+
+        bool reveal = false;
 
         if( m_buffer_initialized == false )
         {
             m_buffer_initialized = true;
 
-            for( unsigned int i = 0; i < m_rxBuffer.size(); i++ )
+            for( unsigned int i = 0; i < m_rxStaging.size(); i++ )
             {
-                if( m_rxBuffer[i] == NULL_COMMAND )
+                if( m_rxStaging[i] == NULL_COMMAND )
                 {
                     m_buffer_initialized = false;
                 }
             }
             if( m_buffer_initialized )
             {
-                Logger.Status << "Clientdata : " <<m_rxBuffer[0]<< std::endl;
-
-                RevealDevices();
+                LOG_STATUS(Logger) << "Clientdata : " <<m_rxStaging[0]<< std::endl;
+                reveal = true;
             }
         }
 
-        Logger.Debug << "Releasing the rxBuffer mutex." << std::endl;
+        PublishStates();
+
+        if( reveal )
+        {
+            RevealDevices();
+        }
     }
 
-    // Start the timer; on timeout, this function is called again
-    m_runTimer.expires_from_now(
-    boost::posix_time::milliseconds(CTimings::Get("DEV_RTDS_DELAY")));
+    ScheduleRun();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Schedules the next cycle DEV_RTDS_DELAY after the start of the last one,
+/// so the time spent on the socket counts toward the delay. A cycle that
+/// took longer than the delay is followed at once by the next. At a fixed
+/// rate the cycle is instead scheduled on the next free deadline.
+///
+/// @pre m_cycleStart holds the start of the cycle that just completed.
+/// @post CRtdsAdapter::Run is scheduled.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::ScheduleRun()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // Start the timer; on timeout, Run is called again
+    if( m_fixedRate )
+    {
+        m_runTimer.expires_at(NextDeadline(
+                CTimings::GetDuration(CTimings::DEV_RTDS_DELAY)));
+    }
+    else
+    {
+        m_runTimer.expires_at(m_cycleStart
+                + CTimings::GetDuration(CTimings::DEV_RTDS_DELAY));
+    }
     m_runTimer.async_wait(boost::bind(&CRtdsAdapter::Run, shared_from_this(),
             boost::asio::placeholders::error));
 }
@@ -258,20 +551,29 @@ void CRtdsAdapter::Run(const boost::system::error_code & e)
 ////////////////////////////////////////////////////////////////////////////
 void CRtdsAdapter::Stop()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     try
     {
         m_runTimer.cancel();
+
+        BOOST_FOREACH(SEndpoint & endpoint, m_endpoints)
+        {
+            endpoint.timeout->cancel();
+            endpoint.resolver->cancel();
+        }
     }
     catch( boost::system::system_error& e)
     {
-        Logger.Error << "Error cancelling timer: " << e.what() << std::endl;
+        LOG_ERROR(Logger) << "Error cancelling timer: " << e.what() << std::endl;
     }
 
-    if( m_socket.is_open() )
+    BOOST_FOREACH(SEndpoint & endpoint, m_endpoints)
     {
-        m_socket.close();
+        if( endpoint.socket->is_open() )
+        {
+            endpoint.socket->close();
+        }
     }
 }
 
@@ -285,101 +587,121 @@ void CRtdsAdapter::Stop()
 ////////////////////////////////////////////////////////////////////////////
 CRtdsAdapter::~CRtdsAdapter()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// A utility function for converting byte order from big endian to little
-/// endian and vice versa. This needs to be called on a SINGLE WORD of the data
-/// since it actually just reverses the bytes.
-///
-/// @pre None
-/// @post The bytes in the buffer are now reversed
-/// @param buffer the data to be reversed
-/// @param numBytes the number of bytes in the buffer
+/// Starts a TCP socket connection to the target host and port of each
+/// endpoint.  The connections are made on the adapter's i/o service, so the
+/// caller does not wait for the FPGAs to answer, and the endpoints of every
+/// adapter are connected at once.
+///
+/// @pre hostname and service specify a valid endpoint.
+/// @post The host of each endpoint is being resolved.
+///
+/// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-void CRtdsAdapter::ReverseBytes( char * buffer, const int numBytes )
+void CRtdsAdapter::Connect()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_connecting = m_endpoints.size();
 
-    for( std::size_t i = 0, j = numBytes-1; i < j; i++, j-- )
+    for( std::size_t i = 0; i < m_endpoints.size(); i++ )
     {
-        char temp = buffer[i];
-        buffer[i] = buffer[j];
-        buffer[j] = temp;
+        SEndpoint & endpoint = m_endpoints[i];
+        boost::asio::ip::tcp::resolver::query query(endpoint.host, endpoint.port);
+        endpoint.resolver->async_resolve(query, boost::bind(
+                &CRtdsAdapter::HandleResolve, shared_from_this(), i,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::iterator));
     }
 }
 
-///////////////////////////////////////////////////////////////////////////////
-/// Converts the SignalValues in the passed vector from big-endian to
-/// little-endian, or vice-versa, if the DGI is running on a little-endian
-/// system.
+////////////////////////////////////////////////////////////////////////////////
+/// Starts the connection of an endpoint to the first address of its host.
 ///
-/// @pre None.
-/// @post The elements of data are converted in endianness if the DGI is
-///  running on a little-endian system.  Otherwise, nothing happens.
-/// @param v The vector of SignalValues to be endian-swapped.
+/// @ErrorHandling Throws a std::runtime_error if the host cannot be resolved.
+/// @pre Called once the host of the endpoint has been resolved.
+/// @post The socket of the endpoint is connecting.
+/// @param i The index of the endpoint.
+/// @param e The error code of the resolve.
+/// @param it The addresses of the host.
 ///
-/// @limitations Assumes the existence of UNIX byte order macros.
-///////////////////////////////////////////////////////////////////////////////
-void CRtdsAdapter::EndianSwapIfNeeded(std::vector<SignalValue> & v)
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::HandleResolve(std::size_t i, const boost::system::error_code & e,
+        boost::asio::ip::tcp::resolver::iterator it)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-
-// check endianess at compile time.  Middle-Endian not allowed
-// The parameters __BYTE_ORDER, __LITTLE_ENDIAN, __BIG_ENDIAN should
-// automatically be defined and determined in sys/param.h, which exists
-// in most Unix systems.
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-    for( std::size_t i = 0; i < v.size(); i++ )
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SEndpoint & endpoint = m_endpoints[i];
+
+    if( e == boost::asio::error::operation_aborted )
     {
-        ReverseBytes((char*)&v[i], sizeof(SignalValue));
+        return;
+    }
+    if( e || it == boost::asio::ip::tcp::resolver::iterator() )
+    {
+        throw std::runtime_error("Failed to resolve " + endpoint.host + ":"
+                + endpoint.port + " because: "
+                + std::string(boost::system::system_error(e).what()));
     }
 
-#elif __BYTE_ORDER == __BIG_ENDIAN
-    Logger.Debug << "Endian swap skipped: host is big-endian." << std::endl;
-#else
-#error "unsupported endianness or __BYTE_ORDER not defined"
-#endif
+    endpoint.candidate = it;
+    endpoint.socket->async_connect(*endpoint.candidate, boost::bind(
+            &CRtdsAdapter::HandleConnect, shared_from_this(), i,
+            boost::asio::placeholders::error));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Creates a TCP socket connection to the adapter's target host and port.
+/// Moves on to the next address of the host if the connection failed.  Once
+/// every endpoint is connected the first cycle is scheduled.
 ///
-/// @ErrorHandling Throws a std::runtime_error for connection errors.
-/// @pre hostname and service specify a valid endpoint.
-/// @post m_socket is connected to the passed service.
+/// @ErrorHandling Throws a std::runtime_error if no address of the host
+/// accepted the connection.
+/// @pre A connection attempt of the endpoint has finished.
+/// @post The endpoint is connected or tries its next address.
+/// @param i The index of the endpoint.
+/// @param e The error code of the connection attempt.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-void CRtdsAdapter::Connect()
+void CRtdsAdapter::HandleConnect(std::size_t i, const boost::system::error_code & e)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-
-    boost::asio::ip::tcp::resolver resolver(m_socket.get_io_service());
-    boost::asio::ip::tcp::resolver::query query(m_host, m_port);
-    boost::asio::ip::tcp::resolver::iterator it = resolver.resolve(query);
-    boost::asio::ip::tcp::resolver::iterator end;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    // attempt to connect to one of the resolved endpoints
-    boost::system::error_code error = boost::asio::error::host_not_found;
+    SEndpoint & endpoint = m_endpoints[i];
 
-    while( error && it != end )
+    if( e == boost::asio::error::operation_aborted )
     {
-        m_socket.close();
-        m_socket.connect(*it, error);
-        ++it;
+        return;
     }
-
-    if( error )
+    if( e )
     {
-        throw std::runtime_error("Failed to connect to " + m_host + ":"
-                + m_port + " because: "
-                + std::string(boost::system::system_error(error).what()));
+        if( ++endpoint.candidate != boost::asio::ip::tcp::resolver::iterator() )
+        {
+            endpoint.socket->close();
+            endpoint.socket->async_connect(*endpoint.candidate, boost::bind(
+                    &CRtdsAdapter::HandleConnect, shared_from_this(), i,
+                    boost::asio::placeholders::error));
+            return;
+        }
+        throw std::runtime_error("Failed to connect to " + endpoint.host + ":"
+                + endpoint.port + " because: "
+                + std::string(boost::system::system_error(e).what()));
     }
 
-    Logger.Status << "Opened a TCP socket connection to host " << m_host
-            << ":" << m_port << "." << std::endl;
+    LOG_STATUS(Logger) << "Opened a TCP socket connection to host "
+            << endpoint.host << ":" << endpoint.port << "." << std::endl;
+
+    if( --m_connecting == 0 )
+    {
+        m_runTimer.expires_from_now(
+                CTimings::GetDuration(CTimings::DEV_RTDS_DELAY));
+        m_runTimer.async_wait(boost::bind(&CRtdsAdapter::Run, shared_from_this(),
+                boost::asio::placeholders::error));
+    }
 }
 
 }//namespace broker
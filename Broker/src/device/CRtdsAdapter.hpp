@@ -42,16 +42,21 @@ namespace device {
 /// Provides an interface for communicating with a RTDS simulation model
 ////////////////////////////////////////////////////////////////////////////////
 /// This class handles communications to and from the RTDS simulation model via
-/// an FPGA device. It serves as client to the FPGA's server, retrieving values
-/// from and transmitting commands to the RTDS.
+/// one or more FPGA devices. It serves as client to the FPGA's server,
+/// retrieving values from and transmitting commands to the RTDS.
+///
+/// A model split across several FPGAs lists one endpoint tag per FPGA in the
+/// info tag of the adapter.  Each endpoint exchanges the next states and
+/// commands of the buffers, in the order the endpoints are listed, and all of
+/// them are driven at once.  A cycle ends when every endpoint has replied.
 ///
 /// @peers The FPGA device used by FREEDM research at Florida State University
 ///     directly communicates with CRtdsAdapter. For more details about the code
 ///     on the FPGA, please contact Dr. Mischa Steurer <steurer@caps.fsu.edu>
 ///
 /// @limitations
-///     We assume any multiplexing/demultiplexing (if needed) of readings from
-///     multiple microgrids simulated by the RTDS model is done FPGA-side.
+///     The signals of one endpoint must be contiguous in the state and command
+///     buffers.
 ////////////////////////////////////////////////////////////////////////////////
 class CRtdsAdapter
      : public IBufferAdapter
@@ -75,33 +80,95 @@ public:
     ~CRtdsAdapter();
 
 private:
+    /// The connection to one FPGA and the part of the buffers it exchanges.
+    struct SEndpoint
+    {
+        /// The hostname of the remote host.
+        std::string host;
+
+        /// The port number of the remote host.
+        std::string port;
+
+        /// Socket to use for the TCP connection.
+        boost::shared_ptr<boost::asio::ip::tcp::socket> socket;
+
+        /// Resolves the host while the connection is established.
+        boost::shared_ptr<boost::asio::ip::tcp::resolver> resolver;
+
+        /// The resolved address the socket is connecting to.
+        boost::asio::ip::tcp::resolver::iterator candidate;
+
+        /// Timer that bounds the socket operation in progress.
+        boost::shared_ptr<boost::asio::deadline_timer> timeout;
+
+        /// Set when the socket operation in progress was cancelled on timeout.
+        bool timedOut;
+
+        /// The first state of the endpoint in the state buffer.
+        std::size_t stateOffset;
+
+        /// The number of states the endpoint sends, or -1 for the rest.
+        int stateCount;
+
+        /// The first command of the endpoint in the command buffer.
+        std::size_t commandOffset;
+
+        /// The number of commands the endpoint receives, or -1 for the rest.
+        int commandCount;
+    };
+
     /// Constructor.
     CRtdsAdapter(boost::asio::io_service & service,
             const boost::property_tree::ptree & ptree);
 
+    /// Assigns each endpoint its part of the buffers.
+    void AssignSlices();
+
     /// Continuous loop for sending and receiving to/from RTDS.
     void Run(const boost::system::error_code & e);
 
-    /// Reverses all of the bytes in a buffer.
-    void ReverseBytes( char * buffer, const int numBytes );
+    /// Starts the read of an endpoint's states once its commands are sent.
+    void HandleWrite(std::size_t i, const boost::system::error_code & e);
+
+    /// Ends the cycle once the states of every endpoint have been read.
+    void HandleRead(std::size_t i, const boost::system::error_code & e);
+
+    /// Cancels the socket operation of an endpoint if it took too long.
+    void HandleTimeout(std::size_t i, const boost::system::error_code & e);
 
-    /// Swaps the endianness of all SignalValues in a vector.
-    void EndianSwapIfNeeded(std::vector<SignalValue> & v);
+    /// Arms the timeout of the next socket operation of an endpoint.
+    void ArmTimeout(std::size_t i);
 
-    /// Creates a socket connection to the given hostname and port number.
+    /// Publishes the state table and schedules the next cycle.
+    void EndCycle();
+
+    /// Schedules the next cycle relative to the start of the last one.
+    void ScheduleRun();
+
+    /// Starts a socket connection to each endpoint.
     void Connect();
 
+    /// Connects to the first address of a resolved endpoint.
+    void HandleResolve(std::size_t i, const boost::system::error_code & e,
+            boost::asio::ip::tcp::resolver::iterator it);
+
+    /// Tries the next address of an endpoint, or counts it as connected.
+    void HandleConnect(std::size_t i, const boost::system::error_code & e);
+
     /// Timer object to set communication cycle pace.
     boost::asio::deadline_timer m_runTimer;
 
-    /// Socket to use for the TCP connection.
-    mutable boost::asio::ip::tcp::socket m_socket;
+    /// The FPGAs that exchange the buffers, in buffer order.
+    std::vector<SEndpoint> m_endpoints;
+
+    /// The number of endpoints whose states have not arrived this cycle.
+    std::size_t m_outstanding;
 
-    /// The hostname of the remote host.
-    std::string m_host;
+    /// The number of endpoints that are not connected yet.
+    std::size_t m_connecting;
 
-    /// The port number of the remote host.
-    std::string m_port;
+    /// The time the current cycle started.
+    boost::posix_time::ptime m_cycleStart;
 };
 
 } //namespace device
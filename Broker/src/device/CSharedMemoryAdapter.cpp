@@ -0,0 +1,354 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSharedMemoryAdapter.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that maps the tables of a co-located pscad-interface.
+///
+/// @functions    CSharedMemoryAdapter::Create
+///               CSharedMemoryAdapter::CSharedMemoryAdapter
+///               CSharedMemoryAdapter::Start
+///               CSharedMemoryAdapter::Stop
+///               CSharedMemoryAdapter::Map
+///               CSharedMemoryAdapter::Exchange
+///               CSharedMemoryAdapter::ReadStates
+///               CSharedMemoryAdapter::WriteCommands
+///               CSharedMemoryAdapter::~CSharedMemoryAdapter
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CSharedMemoryAdapter.hpp"
+#include "CLogger.hpp"
+#include "CTimings.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+} // unnamed namespace
+
+///////////////////////////////////////////////////////////////////////////////
+/// Creates a shared memory adapter on the given io_service.
+///
+/// @Shared_Memory Uses the passed io_service
+///
+/// @pre None.
+/// @post CSharedMemoryAdapter object is returned for use.
+///
+/// @param service The io_service that runs the exchanges.
+/// @param ptree The info tag of the adapter.
+///
+/// @return Shared pointer to the new CSharedMemoryAdapter object.
+///
+/// @limitations None
+///////////////////////////////////////////////////////////////////////////////
+IAdapter::Pointer CSharedMemoryAdapter::Create(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return CSharedMemoryAdapter::Pointer(new CSharedMemoryAdapter(service, ptree));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructs a shared memory adapter.  The info tag holds the name of the
+/// segment and the period of the exchanges in milliseconds, which defaults to
+/// DEV_RTDS_DELAY.
+///
+/// @Shared_Memory Uses the passed io_service.
+///
+/// @ErrorHandling Throws a std::runtime_error if the period is zero.
+/// @pre None.
+/// @post The segment is not mapped until the adapter is started.
+///
+/// @param service The io_service that runs the exchanges.
+/// @param ptree The info tag of the adapter.
+///
+/// @limitations None
+////////////////////////////////////////////////////////////////////////////////
+CSharedMemoryAdapter::CSharedMemoryAdapter(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+    : m_segment(ptree.get<std::string>("segment"))
+    , m_period(ptree.get<unsigned int>("period", CTimings::Get(CTimings::DEV_RTDS_DELAY)))
+    , m_size(0)
+    , m_header(0)
+    , m_stateSequence(0)
+    , m_exchangeTimer(service)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_period == 0 )
+    {
+        throw std::runtime_error("The shared memory adapter period must be positive.");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sizes the buffers and starts the exchanges.  The segment is mapped by the
+/// first exchange that finds it.
+///
+/// @pre The devices of the adapter have been registered.
+/// @post CSharedMemoryAdapter::Exchange is scheduled.
+///
+/// @limitations All devices must be added to the adapter before this call.
+////////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    IBufferAdapter::Start();
+
+    m_exchangeTimer.expires_from_now(boost::posix_time::milliseconds(0));
+    m_exchangeTimer.async_wait(boost::bind(&CSharedMemoryAdapter::Exchange,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Maps the segment created by the pscad-interface.
+///
+/// @ErrorHandling Throws a std::runtime_error if the segment does not match
+///     the buffers of the adapter.
+/// @pre The segment is not mapped.
+/// @post m_header points to the segment if it exists.
+///
+/// @return True if the segment is mapped.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+bool CSharedMemoryAdapter::Map()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::size_t size = sizeof(SSharedHeader)
+            + (m_rxBuffer.size() + m_txBuffer.size()) * sizeof(SharedValue);
+    struct stat info;
+
+    int fd = shm_open(m_segment.c_str(), O_RDWR, 0);
+    if( fd == -1 )
+    {
+        return false;
+    }
+    if( fstat(fd, &info) == -1 || static_cast<std::size_t>(info.st_size) < size )
+    {
+        // the pscad-interface has not sized the segment yet
+        close(fd);
+        return false;
+    }
+
+    void * memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if( memory == MAP_FAILED )
+    {
+        return false;
+    }
+
+    SSharedHeader * header = static_cast<SSharedHeader *>(memory);
+    if( header->magic != SEGMENT_MAGIC )
+    {
+        munmap(memory, size);
+        return false;
+    }
+    if( header->stateCount != m_rxBuffer.size() || header->commandCount != m_txBuffer.size() )
+    {
+        munmap(memory, size);
+        throw std::runtime_error("The shared memory segment " + m_segment
+                + " does not have the states and commands of the adapter.");
+    }
+
+    m_header = header;
+    m_size = size;
+    LOG_NOTICE(Logger) << "Mapped the shared memory segment " << m_segment << std::endl;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Exchanges the buffers with the segment, mapping it first if needed, and
+/// schedules the next exchange one period after this one.  The devices are
+/// revealed once every state has been written by the pscad-interface.
+///
+/// @pre The adapter has been started.
+/// @post m_rxBuffer holds the new states of the segment.
+/// @post The segment holds the commands of m_txBuffer.
+///
+/// @param e The error code of the exchange timer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::Exchange(const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( e )
+    {
+        if( e != boost::asio::error::operation_aborted )
+        {
+            LOG_ERROR(Logger) << "Exchange timer failed: " << e.message() << std::endl;
+        }
+        return;
+    }
+
+    if( m_header || Map() )
+    {
+        WriteCommands();
+        ReadStates();
+    }
+    else
+    {
+        LOG_DEBUG(Logger) << "Waiting for the segment " << m_segment << std::endl;
+    }
+
+    m_exchangeTimer.expires_at(m_exchangeTimer.expires_at()
+            + boost::posix_time::milliseconds(m_period));
+    m_exchangeTimer.async_wait(boost::bind(&CSharedMemoryAdapter::Exchange,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Copies the states of the segment into the state buffer if they changed
+/// since the last exchange.  States caught in the middle of a write are left
+/// for the next exchange.
+///
+/// @pre The segment is mapped.
+/// @post m_rxBuffer holds the states of the segment.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::ReadStates()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::uint32_t sequence = m_header->stateSequence;
+    const SharedValue * states = reinterpret_cast<const SharedValue *>(m_header + 1);
+
+    if( sequence % 2 != 0 || sequence == m_stateSequence || m_rxStaging.empty() )
+    {
+        return;
+    }
+
+    __sync_synchronize();
+    std::copy(states, states + m_rxStaging.size(), m_rxStaging.begin());
+    __sync_synchronize();
+
+    if( m_header->stateSequence != sequence )
+    {
+        LOG_DEBUG(Logger) << "States changed while read, retry later." << std::endl;
+        return;
+    }
+    m_stateSequence = sequence;
+
+    bool reveal = false;
+
+    if( m_buffer_initialized == false
+        && std::find(m_rxStaging.begin(), m_rxStaging.end(), NULL_COMMAND) == m_rxStaging.end() )
+    {
+        m_buffer_initialized = true;
+        reveal = true;
+    }
+
+    PublishStates();
+
+    if( reveal )
+    {
+        RevealDevices();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Copies the command buffer into the segment.
+///
+/// @pre The segment is mapped.
+/// @post The commands of the segment are the commands of m_txBuffer.
+/// @post The command sequence of the segment is advanced by two.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::WriteCommands()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_txBuffer.empty() )
+    {
+        return;
+    }
+
+    SharedValue * commands = reinterpret_cast<SharedValue *>(m_header + 1)
+            + m_rxBuffer.size();
+
+    SnapshotCommands();
+    m_header->commandSequence = m_header->commandSequence + 1;
+    __sync_synchronize();
+    std::copy(m_txStaging.begin(), m_txStaging.end(), commands);
+    __sync_synchronize();
+    m_header->commandSequence = m_header->commandSequence + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Stops the adapter. Thread-safe.
+///
+/// @pre None.
+/// @post The exchange timer is cancelled.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    try
+    {
+        m_exchangeTimer.cancel();
+    }
+    catch( boost::system::system_error & e )
+    {
+        LOG_ERROR(Logger) << "Error cancelling timer: " << e.what() << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Destructor.
+///
+/// @pre None.
+/// @post The segment is unmapped.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+CSharedMemoryAdapter::~CSharedMemoryAdapter()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_header )
+    {
+        munmap(m_header, m_size);
+    }
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSharedMemoryAdapter.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that maps the tables of a co-located pscad-interface.
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_SHARED_MEMORY_ADAPTER_HPP
+#define C_SHARED_MEMORY_ADAPTER_HPP
+
+#include "IBufferAdapter.hpp"
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// Exchanges the buffers with a pscad-interface through shared memory.
+////////////////////////////////////////////////////////////////////////////////
+/// The pscad-interface creates a POSIX shared memory segment for each of its
+/// shared memory adapters.  This adapter maps that segment and, once per
+/// period, copies the states of the segment into the state buffer and the
+/// command buffer into the segment, as host order floats.  It replaces the
+/// socket of the RTDS adapter when both programs run on the same host.
+///
+/// Each array of the segment is guarded by a sequence counter that its writer
+/// makes odd before it writes and even after.  A reader keeps its copy only if
+/// the counter was even and did not change during the copy, and otherwise
+/// tries again on the next period.
+///
+/// @limitations The segment layout must match SSharedHeader of the
+///     pscad-interface, and its counts must match the buffers of the adapter.
+////////////////////////////////////////////////////////////////////////////////
+class CSharedMemoryAdapter
+    : public IBufferAdapter
+    , public boost::enable_shared_from_this<CSharedMemoryAdapter>
+{
+public:
+    /// Pointer to a CSharedMemoryAdapter object.
+    typedef boost::shared_ptr<CSharedMemoryAdapter> Pointer;
+
+    /// Create a CSharedMemoryAdapter object and returns a pointer to it.
+    static IAdapter::Pointer Create(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Starts the adapter.
+    void Start();
+
+    /// Stops the exchanges.
+    void Stop();
+
+    /// Destructor.
+    ~CSharedMemoryAdapter();
+
+private:
+    /// Type of a value in the segment.
+    typedef float SharedValue;
+
+    /// Layout of the front of the segment, followed by the value arrays.
+    struct SSharedHeader
+    {
+        /// Identifies a segment of this layout.
+        boost::uint32_t magic;
+
+        /// Number of states in the segment.
+        boost::uint32_t stateCount;
+
+        /// Number of commands in the segment.
+        boost::uint32_t commandCount;
+
+        /// Odd while the states are being written.
+        volatile boost::uint32_t stateSequence;
+
+        /// Odd while the commands are being written.
+        volatile boost::uint32_t commandSequence;
+    };
+
+    /// Constructor.
+    CSharedMemoryAdapter(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Maps the segment if it exists.
+    bool Map();
+
+    /// Exchanges the buffers with the segment and schedules the next exchange.
+    void Exchange(const boost::system::error_code & e);
+
+    /// Copies new states from the segment into the state buffer.
+    void ReadStates();
+
+    /// Copies the command buffer into the segment.
+    void WriteCommands();
+
+    /// Magic number of the segment layout, FRDM in ASCII.
+    static const boost::uint32_t SEGMENT_MAGIC = 0x4644524D;
+
+    /// Name of the shared memory segment.
+    std::string m_segment;
+
+    /// Milliseconds between two exchanges.
+    unsigned int m_period;
+
+    /// Size of the mapped segment in bytes, or 0 if it is not mapped.
+    std::size_t m_size;
+
+    /// Header of the mapped segment.
+    SSharedHeader * m_header;
+
+    /// State sequence of the last states read.
+    boost::uint32_t m_stateSequence;
+
+    /// Timer for the exchanges.
+    boost::asio::deadline_timer m_exchangeTimer;
+};
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // C_SHARED_MEMORY_ADAPTER_HPP
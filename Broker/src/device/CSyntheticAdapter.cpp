@@ -0,0 +1,377 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSyntheticAdapter.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that generates device states from waveforms.
+///
+/// @functions    CSyntheticAdapter::Create
+///               CSyntheticAdapter::CSyntheticAdapter
+///               CSyntheticAdapter::Start
+///               CSyntheticAdapter::Stop
+///               CSyntheticAdapter::ClassifyDevice
+///               CSyntheticAdapter::Update
+///               CSyntheticAdapter::Sample
+///               CSyntheticAdapter::~CSyntheticAdapter
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CSyntheticAdapter.hpp"
+#include "CLogger.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/foreach.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Ratio of the circumference of a circle to its diameter.
+const double PI = 3.14159265358979323846;
+
+} // unnamed namespace
+
+///////////////////////////////////////////////////////////////////////////////
+/// Creates a synthetic adapter on the given io_service.
+///
+/// @Shared_Memory Uses the passed io_service
+///
+/// @pre None.
+/// @post CSyntheticAdapter object is returned for use.
+///
+/// @param service The io_service that runs the updates.
+/// @param ptree The info tag of the adapter.
+///
+/// @return Shared pointer to the new CSyntheticAdapter object.
+///
+/// @limitations None
+///////////////////////////////////////////////////////////////////////////////
+IAdapter::Pointer CSyntheticAdapter::Create(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return CSyntheticAdapter::Pointer(new CSyntheticAdapter(service, ptree));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructs a synthetic adapter.  The info tag holds the update period in
+/// milliseconds, an optional seed for the noise shape, and one waveform tag
+/// for each device type and signal that should not hold a constant zero.
+///
+/// @Shared_Memory Uses the passed io_service.
+///
+/// @ErrorHandling Throws a std::runtime_error if a waveform has an unknown
+/// shape or a cycle that is not positive, or if the period is zero.
+/// @pre None.
+/// @post m_shapes holds the configured waveforms.
+///
+/// @param service The io_service that runs the updates.
+/// @param ptree The info tag of the adapter.
+///
+/// @limitations None
+////////////////////////////////////////////////////////////////////////////////
+CSyntheticAdapter::CSyntheticAdapter(boost::asio::io_service & service,
+        const boost::property_tree::ptree & ptree)
+    : m_commands(false)
+    , m_period(ptree.get<unsigned int>("period", 1000))
+    , m_random(ptree.get<boost::uint32_t>("seed", 5489u))
+    , m_updateTimer(service)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_period == 0 )
+    {
+        throw std::runtime_error("The synthetic adapter period must be positive.");
+    }
+
+    BOOST_FOREACH(const boost::property_tree::ptree::value_type & child, ptree)
+    {
+        if( child.first != "waveform" )
+        {
+            continue;
+        }
+
+        std::string type = child.second.get<std::string>("type");
+        std::string signal = child.second.get<std::string>("signal");
+        std::string shape = child.second.get<std::string>("shape");
+        SWaveform waveform;
+
+        if( shape == "constant" )       waveform.shape = CONSTANT;
+        else if( shape == "sine" )      waveform.shape = SINE;
+        else if( shape == "square" )    waveform.shape = SQUARE;
+        else if( shape == "ramp" )      waveform.shape = RAMP;
+        else if( shape == "noise" )     waveform.shape = NOISE;
+        else if( shape == "command" )   waveform.shape = COMMAND;
+        else
+        {
+            throw std::runtime_error("Unknown waveform shape: " + shape);
+        }
+
+        waveform.offset = child.second.get<double>("offset", 0.0);
+        waveform.amplitude = child.second.get<double>("amplitude", 0.0);
+        waveform.cycle = child.second.get<double>("cycle", 60000.0);
+        waveform.phase = 0.0;
+        waveform.command = 0;
+
+        if( waveform.cycle <= 0.0 )
+        {
+            throw std::runtime_error("The cycle of a waveform must be positive.");
+        }
+
+        m_shapes[std::make_pair(type, signal)] = waveform;
+        LOG_DEBUG(Logger) << "The " << signal << " of " << type
+                << " devices follows a " << shape << " waveform." << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Records the type of a device, which selects the waveforms of its states,
+/// and the fraction of a cycle its waveforms are shifted by.
+///
+/// @pre The adapter has not been started.
+/// @post m_classes holds the type and phase of the device.
+///
+/// @param device The name of a device registered with the adapter.
+/// @param type The type of the device.
+/// @param phase The shift of the waveforms, as a fraction of a cycle.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CSyntheticAdapter::ClassifyDevice(const std::string & device,
+        const std::string & type, double phase)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_classes[device] = std::make_pair(type, phase);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sizes the buffers and gives each state its waveform.  A state without a
+/// configured waveform copies the command of the same signal if there is
+/// one, and holds a constant zero otherwise.
+///
+/// @pre The devices of the adapter have been registered and classified.
+/// @post CSyntheticAdapter::Update is called to generate the first states.
+///
+/// @limitations All devices must be added to the adapter before this call.
+////////////////////////////////////////////////////////////////////////////////
+void CSyntheticAdapter::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<const DeviceSignal, const std::size_t>::const_iterator it;
+
+    IBufferAdapter::Start();
+    m_waveforms.resize(m_rxBuffer.size());
+
+    for( it = m_stateInfo.begin(); it != m_stateInfo.end(); it++ )
+    {
+        SWaveform & waveform = m_waveforms[it->second];
+        std::map<std::string, std::pair<std::string, double> >::const_iterator type;
+        std::map<std::pair<std::string, std::string>, SWaveform>::const_iterator shape;
+        std::map<const DeviceSignal, const std::size_t>::const_iterator command;
+
+        type = m_classes.find(it->first.first);
+        command = m_commandInfo.find(it->first);
+
+        waveform.shape = CONSTANT;
+        waveform.offset = 0.0;
+        waveform.amplitude = 0.0;
+        waveform.cycle = 1.0;
+        waveform.phase = 0.0;
+        waveform.command = 0;
+
+        if( type != m_classes.end() )
+        {
+            shape = m_shapes.find(std::make_pair(type->second.first, it->first.second));
+            if( shape != m_shapes.end() )
+            {
+                waveform = shape->second;
+            }
+            else if( command != m_commandInfo.end() )
+            {
+                waveform.shape = COMMAND;
+            }
+            waveform.phase = type->second.second;
+        }
+
+        if( waveform.shape == COMMAND )
+        {
+            if( command == m_commandInfo.end() )
+            {
+                throw std::runtime_error("The state (" + it->first.first + ","
+                        + it->first.second + ") has no command to copy.");
+            }
+            waveform.command = command->second;
+            m_commands = true;
+        }
+    }
+
+    LOG_INFO(Logger) << "Generating " << m_waveforms.size() << " states every "
+            << m_period << " ms." << std::endl;
+
+    m_origin = CVirtualClock::Now();
+    m_updateTimer.expires_at(m_origin);
+    m_updateTimer.async_wait(boost::bind(&CSyntheticAdapter::Update,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Computes every state from its waveform at the current time, publishes the
+/// states, and schedules the next update one period after this one.  The
+/// devices are revealed after the first update.
+///
+/// @pre The adapter has been started.
+/// @post m_rxBuffer holds the new states.
+///
+/// @param e The error code of the update timer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CSyntheticAdapter::Update(const boost::system::error_code & e)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( e )
+    {
+        if( e != boost::asio::error::operation_aborted )
+        {
+            LOG_ERROR(Logger) << "Update timer failed: " << e.message() << std::endl;
+        }
+        return;
+    }
+
+    boost::posix_time::ptime now = m_updateTimer.expires_at();
+    double time = (now - m_origin).total_microseconds() / 1000.0;
+
+    if( m_commands )
+    {
+        SnapshotCommands();
+    }
+
+    for( std::size_t i = 0; i < m_waveforms.size(); i++ )
+    {
+        m_rxStaging[i] = Sample(m_waveforms[i], time);
+    }
+    PublishStates();
+
+    if( m_buffer_initialized == false )
+    {
+        m_buffer_initialized = true;
+        RevealDevices();
+    }
+
+    m_updateTimer.expires_at(now + boost::posix_time::milliseconds(m_period));
+    m_updateTimer.async_wait(boost::bind(&CSyntheticAdapter::Update,
+            shared_from_this(), boost::asio::placeholders::error));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Computes the value of a waveform some time after the first update.  The
+/// command shape copies its command, or its offset while the command is
+/// still unset.
+///
+/// @pre The command of a command shape is in m_txStaging.
+/// @post The noise shape advances m_random.
+///
+/// @param waveform The waveform to sample.
+/// @param time Milliseconds since the first update.
+///
+/// @return The value of the waveform.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+SignalValue CSyntheticAdapter::Sample(const SWaveform & waveform, double time)
+{
+    double position = time / waveform.cycle + waveform.phase;
+    double fraction = position - std::floor(position);
+    double value;
+
+    switch( waveform.shape )
+    {
+    case SINE:
+        value = waveform.offset + waveform.amplitude * std::sin(2 * PI * position);
+        break;
+    case SQUARE:
+        value = waveform.offset + (fraction < 0.5 ? waveform.amplitude : -waveform.amplitude);
+        break;
+    case RAMP:
+        value = waveform.offset + waveform.amplitude * (2 * fraction - 1);
+        break;
+    case NOISE:
+        value = waveform.offset + waveform.amplitude
+                * (2.0 * (m_random() - m_random.min()) / (m_random.max() - m_random.min()) - 1);
+        break;
+    case COMMAND:
+        value = m_txStaging[waveform.command];
+        if( value == NULL_COMMAND )
+        {
+            value = waveform.offset;
+        }
+        break;
+    default:
+        value = waveform.offset;
+        break;
+    }
+    return static_cast<SignalValue>(value);
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Stops the adapter. Thread-safe.
+///
+/// @pre None.
+/// @post The update timer is cancelled and the states no longer change.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+void CSyntheticAdapter::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    try
+    {
+        m_updateTimer.cancel();
+    }
+    catch( boost::system::system_error & e )
+    {
+        LOG_ERROR(Logger) << "Error cancelling timer: " << e.what() << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Destructor.
+///
+/// @pre None.
+/// @post None.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+CSyntheticAdapter::~CSyntheticAdapter()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
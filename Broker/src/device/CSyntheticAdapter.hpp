@@ -0,0 +1,147 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSyntheticAdapter.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that generates device states from waveforms.
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_SYNTHETIC_ADAPTER_HPP
+#define C_SYNTHETIC_ADAPTER_HPP
+
+#include "IBufferAdapter.hpp"
+#include "CVirtualClock.hpp"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// Generates the states of many devices without a device server.
+////////////////////////////////////////////////////////////////////////////////
+/// Synthetic load generator for benchmarks. The adapter factory creates the
+/// requested number of devices of each type, and this adapter computes every
+/// state from a waveform once per period. The waveforms are configured per
+/// device type and signal, and each device of a type is shifted in phase so
+/// that the devices do not move in lockstep.
+///
+/// The states and commands live in the flat buffers of IBufferAdapter, and
+/// m_waveforms holds the waveform of each state in the same order, so an
+/// update is a single pass over two arrays.
+///
+/// @limitations The waveforms ignore the commands, except for the command
+///              shape which copies the command of the same signal.
+////////////////////////////////////////////////////////////////////////////////
+class CSyntheticAdapter
+    : public IBufferAdapter
+    , public boost::enable_shared_from_this<CSyntheticAdapter>
+{
+public:
+    /// Pointer to a CSyntheticAdapter object.
+    typedef boost::shared_ptr<CSyntheticAdapter> Pointer;
+
+    /// Create a CSyntheticAdapter object and returns a pointer to it.
+    static IAdapter::Pointer Create(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Starts the adapter.
+    void Start();
+
+    /// Stops generating states.
+    void Stop();
+
+    /// Gives a device the waveforms of its type.
+    void ClassifyDevice(const std::string & device, const std::string & type,
+            double phase);
+
+    /// Destructor.
+    ~CSyntheticAdapter();
+
+private:
+    /// Shapes a state can follow.
+    enum EShape { CONSTANT, SINE, SQUARE, RAMP, NOISE, COMMAND };
+
+    /// Parameters of the waveform of one state.
+    struct SWaveform
+    {
+        /// Shape of the waveform.
+        EShape shape;
+
+        /// Value around which the waveform moves.
+        double offset;
+
+        /// Largest distance of the waveform from its offset.
+        double amplitude;
+
+        /// Length of one cycle in milliseconds.
+        double cycle;
+
+        /// Fraction of a cycle the waveform is shifted by.
+        double phase;
+
+        /// Index in m_txStaging of the command copied by the command shape.
+        std::size_t command;
+    };
+
+    /// Constructor.
+    CSyntheticAdapter(boost::asio::io_service & service,
+            const boost::property_tree::ptree & ptree);
+
+    /// Computes the states and schedules the next update.
+    void Update(const boost::system::error_code & e);
+
+    /// Computes the value of a waveform at some time.
+    SignalValue Sample(const SWaveform & waveform, double time);
+
+    /// Waveforms by device type and signal.
+    std::map<std::pair<std::string, std::string>, SWaveform> m_shapes;
+
+    /// Device type and phase by device name.
+    std::map<std::string, std::pair<std::string, double> > m_classes;
+
+    /// Waveform of each state, in the order of m_rxBuffer.
+    std::vector<SWaveform> m_waveforms;
+
+    /// True if some waveform copies a command.
+    bool m_commands;
+
+    /// Milliseconds between two updates.
+    unsigned int m_period;
+
+    /// Time of the first update.
+    boost::posix_time::ptime m_origin;
+
+    /// Random numbers of the noise shape.
+    boost::mt19937 m_random;
+
+    /// Timer for the updates.
+    CVirtualTimer m_updateTimer;
+};
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // C_SYNTHETIC_ADAPTER_HPP
@@ -5,7 +5,7 @@
 ///
 /// @project        FREEDM DGI
 ///
-/// @description    TCP server that accepts a single client connection.
+/// @description    TCP server that hands accepted clients to a handler.
 ///
 /// @functions
 ///     CTcpServer::CTcpServer
@@ -38,9 +38,12 @@
 #include "CLogger.hpp"
 
 #include <string>
+#include <algorithm>
 #include <stdexcept>
 
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 
 namespace freedm {
 namespace broker {
@@ -49,6 +52,12 @@ namespace device {
 namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
+
+#ifdef SO_REUSEPORT
+/// Socket option that lets several acceptors bind the listening port.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>
+    ReusePort;
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -56,18 +65,21 @@ CLocalLogger Logger(__FILE__);
 ///
 /// @pre The specified port number must be valid.
 /// @post Constructs a TCP server that accepts connections on the given port.
+/// @post Falls back to one acceptor if SO_REUSEPORT is not supported.
 /// @param ios The I/O service used by the server.
 /// @param port The listen port of the server.
 /// @param address The address of the interface used for listening.
+/// @param backlog The length of each accept queue, or 0 for the system limit.
+/// @param acceptors The number of acceptors that share the port.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 CTcpServer::CTcpServer(boost::asio::io_service & ios, unsigned short port,
-    const std::string address)
-    : m_acceptor(ios)
+    const std::string address, unsigned int backlog, unsigned int acceptors)
+    : m_ios(ios)
     , m_port(port)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     using boost::asio::ip::tcp;
 
@@ -78,14 +90,45 @@ CTcpServer::CTcpServer(boost::asio::io_service & ios, unsigned short port,
         endpoint.address( boost::asio::ip::address::from_string(address) );
     }
 
-    m_acceptor.open(endpoint.protocol());
-    m_acceptor.set_option(tcp::acceptor::reuse_address(true));
-    m_acceptor.bind(endpoint);
-    m_acceptor.listen();
+    if( backlog == 0 )
+    {
+        backlog = tcp::acceptor::max_connections;
+    }
 
-    Logger.Status << "Opened TCP server: " << endpoint << "." << std::endl;
+#ifndef SO_REUSEPORT
+    if( acceptors > 1 )
+    {
+        LOG_WARN(Logger) << hdr() << "SO_REUSEPORT is not supported, using"
+                << " one acceptor" << std::endl;
+        acceptors = 1;
+    }
+#endif
 
-    StartAccept();
+    for( unsigned int i = 0; i < std::max(1u, acceptors); i++ )
+    {
+        Acceptor acceptor(new tcp::acceptor(ios));
+
+        acceptor->open(endpoint.protocol());
+        acceptor->set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if( acceptors > 1 )
+        {
+            acceptor->set_option(ReusePort(true));
+        }
+#endif
+        acceptor->bind(endpoint);
+        acceptor->listen(backlog);
+
+        m_acceptors.push_back(acceptor);
+    }
+
+    LOG_STATUS(Logger) << "Opened TCP server: " << endpoint << " with "
+            << m_acceptors.size() << " acceptors." << std::endl;
+
+    BOOST_FOREACH(Acceptor acceptor, m_acceptors)
+    {
+        StartAccept(acceptor);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -98,7 +141,7 @@ CTcpServer::CTcpServer(boost::asio::io_service & ios, unsigned short port,
 ////////////////////////////////////////////////////////////////////////////////
 CTcpServer::~CTcpServer()
 {
-    Logger.Trace << hdr() << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << hdr() << __PRETTY_FUNCTION__ << std::endl;
     Stop();
 }
 
@@ -110,37 +153,43 @@ CTcpServer::~CTcpServer()
 /// @param ios The I/O service used by the server.
 /// @param port The listen port of the server.
 /// @param address The address of the interface used for listening.
+/// @param backlog The length of each accept queue, or 0 for the system limit.
+/// @param acceptors The number of acceptors that share the port.
 /// @return Shared pointer to the server.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 CTcpServer::Pointer CTcpServer::Create(boost::asio::io_service & ios,
-        unsigned short port, const std::string address)
+        unsigned short port, const std::string address, unsigned int backlog,
+        unsigned int acceptors)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return Pointer(new CTcpServer(ios, port, address));
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    return Pointer(new CTcpServer(ios, port, address, backlog, acceptors));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Stops the TCP server from accepting new clients.
 ///
 /// @pre None.
-/// @post m_acceptor and m_socket are closed.
+/// @post Every acceptor is closed. Clients owned by the handler stay open.
 /// @ErrorHandling throws boost::system::system_error if it fails
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
 void CTcpServer::Stop()
 {
-    Logger.Trace << hdr() << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << hdr() << __PRETTY_FUNCTION__ << std::endl;
 
-    if( m_acceptor.is_open() )
+    BOOST_FOREACH(Acceptor acceptor, m_acceptors)
     {
-        Logger.Info << hdr() << "Closed TCP server acceptor." << std::endl;
-        m_acceptor.close();
+        if( acceptor->is_open() )
+        {
+            LOG_INFO(Logger) << hdr() << "Closed TCP server acceptor." << std::endl;
+            acceptor->close();
+        }
     }
 
-    Logger.Status << "Closed TCP server on port " << m_port << "." << std::endl;
+    LOG_STATUS(Logger) << "Closed TCP server on port " << m_port << "." << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -156,7 +205,7 @@ void CTcpServer::Stop()
 ////////////////////////////////////////////////////////////////////////////////
 void CTcpServer::RegisterHandler(ConnectionHandler h)
 {
-    Logger.Trace << hdr() << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << hdr() << __PRETTY_FUNCTION__ << std::endl;
 
     if( !m_handler.empty() )
     {
@@ -170,28 +219,29 @@ void CTcpServer::RegisterHandler(ConnectionHandler h)
 
     m_handler = h;
 
-    Logger.Notice << hdr() << "Set client connection handler." << std::endl;
+    LOG_NOTICE(Logger) << hdr() << "Set client connection handler." << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// Prepares to accept the next client connection.
+/// Prepares an acceptor to accept the next client connection.
 ///
 /// @pre None.
-/// @post Closes the current client connection on m_socket.
+/// @post Schedules an accept into a new client socket.
+/// @param acceptor The acceptor to accept the next client on.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
-void CTcpServer::StartAccept()
+void CTcpServer::StartAccept(Acceptor acceptor)
 {
-    Logger.Trace << hdr() << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << hdr() << __PRETTY_FUNCTION__ << std::endl;
 
-    if( m_acceptor.is_open() )
+    if( acceptor->is_open() )
     {
-        m_client.reset(new boost::asio::ip::tcp::socket(m_acceptor.get_io_service()));
-        m_acceptor.async_accept(*m_client, boost::bind(&CTcpServer::HandleAccept,
-                this, boost::asio::placeholders::error));
+        Connection client(new boost::asio::ip::tcp::socket(m_ios));
+        acceptor->async_accept(*client, boost::bind(&CTcpServer::HandleAccept,
+                this, acceptor, client, boost::asio::placeholders::error));
 
-        Logger.Info << hdr() << "Waiting for next connection." << std::endl;
+        LOG_INFO(Logger) << hdr() << "Waiting for next connection." << std::endl;
     }
 }
 
@@ -202,30 +252,34 @@ void CTcpServer::StartAccept()
 /// not been defined with CTcpServer::RegisterHandler.
 /// @pre CTcpServer::RegisterHandler must be called prior to this function.
 /// @post Calls m_handler to handle the client connection.
+/// @post Schedules the next accept on the same acceptor.
+/// @param acceptor The acceptor that accepted the client.
+/// @param client The socket of the accepted client.
 /// @param error The error code if the connection failed.
 ///
-/// @limitations This function will not schedule the next accept. The owner of
-/// the handler must call CTcpServer::StartAccept when done with the client.
-/// This limitation is because the server handles at most one connection, and
-/// that connection must be closed before the next accept can be scheduled.
+/// @limitations The handler owns the client once it is called and must keep
+/// the connection alive for as long as it needs it.
 ////////////////////////////////////////////////////////////////////////////////
-void CTcpServer::HandleAccept(const boost::system::error_code & error)
+void CTcpServer::HandleAccept(Acceptor acceptor, Connection client,
+        const boost::system::error_code & error)
 {
-    Logger.Trace << hdr() << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << hdr() << __PRETTY_FUNCTION__ << std::endl;
 
     if( !error )
     {
-        Logger.Info << hdr() << "Accepted new client connection." << std::endl;
+        LOG_INFO(Logger) << hdr() << "Accepted new client connection." << std::endl;
 
         if( m_handler.empty() )
         {
             throw std::runtime_error(hdr() + "Null connection handler.");
         }
-        m_handler();
+        StartAccept(acceptor);
+        m_handler(client);
     }
     else if( error != boost::asio::error::operation_aborted )
     {
-        Logger.Warn << hdr() << "Failed to accept a client." << std::endl;
+        LOG_WARN(Logger) << hdr() << "Failed to accept a client." << std::endl;
+        StartAccept(acceptor);
     }
 }
 
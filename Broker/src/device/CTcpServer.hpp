@@ -5,7 +5,7 @@
 ///
 /// @project        FREEDM DGI
 ///
-/// @description    TCP server that accepts a single client connection.
+/// @description    TCP server that hands accepted clients to a handler.
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -23,6 +23,8 @@
 #ifndef C_TCP_SERVER_HPP
 #define C_TCP_SERVER_HPP
 
+#include <vector>
+
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
@@ -32,9 +34,13 @@ namespace freedm {
 namespace broker {
 namespace device {
 
-/// TCP server that handles a single client connection.
+/// TCP server that hands each accepted client to a connection handler.
 ////////////////////////////////////////////////////////////////////////////////
 /// A TCP server that redirects clients to the registered connection handler.
+/// The server schedules the next accept as soon as a client is handed over,
+/// so the handler can keep several clients at once. With more than one
+/// acceptor, every acceptor binds the port with SO_REUSEPORT and the kernel
+/// spreads the incoming connections over their accept queues.
 ///
 /// @limitations None.
 ////////////////////////////////////////////////////////////////////////////////
@@ -49,48 +55,50 @@ public:
     typedef boost::shared_ptr<boost::asio::ip::tcp::socket> Connection;
 
     /// Type of the callback function for client connections.
-    typedef boost::function<void ()> ConnectionHandler;
+    typedef boost::function<void (Connection)> ConnectionHandler;
 
     /// Virtual destructor for derived classes.
     virtual ~CTcpServer();
 
     /// Creates a new TCP server on the specified port number.
     static Pointer Create(boost::asio::io_service & ios, unsigned short port,
-        const std::string address="");
+        const std::string address="", unsigned int backlog=0,
+        unsigned int acceptors=1);
 
     /// Registers a callback function for client connections.
     void RegisterHandler(ConnectionHandler h);
 
     /// Stops the TCP server.
     void Stop();
-
-    /// Prepares to accept the next client.
-    void StartAccept();
-
-    /// Gets the current client.
-    Connection GetClient() { return m_client; }
 private:
+    /// Convenient type for a listening socket.
+    typedef boost::shared_ptr<boost::asio::ip::tcp::acceptor> Acceptor;
+
     /// Constructs the TCP server on the specified port number.
     CTcpServer(boost::asio::io_service & ios, unsigned short port,
-        const std::string address="");
+        const std::string address, unsigned int backlog, unsigned int acceptors);
+
+    /// Prepares an acceptor to accept the next client.
+    void StartAccept(Acceptor acceptor);
 
     /// Handles an accepted client connection.
-    void HandleAccept(const boost::system::error_code & error);
+    void HandleAccept(Acceptor acceptor, Connection client,
+        const boost::system::error_code & error);
 
     /// Gets a log header.
     std::string hdr() const;
 
-    /// Acceptor for new client connections.
-    boost::asio::ip::tcp::acceptor m_acceptor;
+    /// I/O service of the acceptors and the client sockets.
+    boost::asio::io_service & m_ios;
+
+    /// Acceptors for new client connections.
+    std::vector<Acceptor> m_acceptors;
 
     /// Port number of the server.
     unsigned short m_port;
 
     /// Callback function to handle clients.
     ConnectionHandler m_handler;
-protected:
-    /// Socket for the current client.
-    Connection m_client;
 };
 
 } // namespace device
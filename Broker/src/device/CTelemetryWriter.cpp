@@ -0,0 +1,457 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CTelemetryWriter.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Writes the device tables to a columnar file in the background.
+///
+/// @functions
+///     CTelemetryWriter::Instance
+///     CTelemetryWriter::CTelemetryWriter
+///     CTelemetryWriter::~CTelemetryWriter
+///     CTelemetryWriter::Start
+///     CTelemetryWriter::Stop
+///     CTelemetryWriter::RegisterStream
+///     CTelemetryWriter::Submit
+///     CTelemetryWriter::RunWriter
+///     CTelemetryWriter::Append
+///     CTelemetryWriter::Flush
+///     CTelemetryWriter::WriteBlock
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CTelemetryWriter.hpp"
+#include "TelemetryFormat.hpp"
+#include "CGlobalConfiguration.hpp"
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CVirtualClock.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+namespace {
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// The universal time the telemetry time stamps count from.
+const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+
+/// The rows gathered before a chunk is written.
+const std::size_t CHUNK_ROWS = 256;
+
+/// The longest a row waits in its chunk before the chunk is written.
+const boost::uint64_t CHUNK_AGE = 5000000;
+
+/// Rows of the device tables written to the telemetry file
+CCounter & RowsMetric = CMetrics::Instance().GetCounter(
+        "dgi_telemetry_rows_total", "Device table rows written to the telemetry file");
+
+/// Rows of the device tables dropped because the queue was full
+CCounter & DroppedMetric = CMetrics::Instance().GetCounter(
+        "dgi_telemetry_dropped_total",
+        "Device table rows dropped because the telemetry queue was full");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Access the singleton instance of the telemetry writer.
+///
+/// @pre None.
+/// @post None.
+/// @return A reference to the telemetry writer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+CTelemetryWriter & CTelemetryWriter::Instance()
+{
+    static CTelemetryWriter writer;
+    return writer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Creates a telemetry writer that records nothing until Start.
+///
+/// @pre None.
+/// @post The telemetry writer is disabled.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+CTelemetryWriter::CTelemetryWriter()
+    : m_enabled(false)
+    , m_stopping(false)
+    , m_queueLimit(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Stops the writer thread if Stop was not called.  The queued rows are lost.
+///
+/// @pre None.
+/// @post The writer thread has exited.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+CTelemetryWriter::~CTelemetryWriter()
+{
+    if( m_thread.joinable() )
+    {
+        m_thread.interrupt();
+        m_thread.join();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Creates the configured telemetry file and starts the thread that writes
+/// it.  Adapters that registered before Start are recorded from now on.
+///
+/// @ErrorHandling Throws std::runtime_error if the file cannot be created.
+/// @pre None.
+/// @post Device tables are recorded if a telemetry file is configured.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::Start()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::string path = CGlobalConfiguration::Instance().GetTelemetryFile();
+
+    if( path.empty() || m_thread.joinable() )
+    {
+        return;
+    }
+
+    m_file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if( !m_file.is_open() )
+    {
+        throw std::runtime_error("Could not create telemetry file " + path);
+    }
+
+    STelemetryHeader header;
+    std::memcpy(header.magic, TELEMETRY_MAGIC, sizeof(header.magic));
+    header.version = TELEMETRY_VERSION;
+    header.value_size = sizeof(SignalValue);
+    m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    m_queueLimit = CGlobalConfiguration::Instance().GetTelemetryQueue();
+    m_thread = boost::thread(boost::bind(&CTelemetryWriter::RunWriter, this));
+    m_enabled = true;
+    LOG_NOTICE(Logger) << "Recording the device tables to " << path << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Stops accepting frames, then waits for the writer thread to write the
+/// queued frames and every partial chunk.
+///
+/// @pre None.
+/// @post The writer thread has exited and the file holds every queued row.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::Stop()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( !m_thread.joinable() )
+    {
+        return;
+    }
+
+    m_enabled = false;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stopping = true;
+    }
+    m_ready.notify_one();
+    m_thread.join();
+    m_file.close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Numbers an adapter so its frames can be told apart in the file.
+///
+/// @pre None.
+/// @post The adapter is described in the file before its first chunk.
+/// @param name The name of the adapter in the adapter configuration.
+/// @param states The size of the state table of the adapter.
+/// @param commands The size of the command table of the adapter.
+/// @return The number to pass to Submit.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+unsigned int CTelemetryWriter::RegisterStream(const std::string & name,
+        std::size_t states, std::size_t commands)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SStream stream;
+    stream.name = name;
+    stream.states = states;
+    stream.commands = commands;
+    stream.dropped = 0;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_streams.push_back(stream);
+    return m_streams.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Queues a copy of the tables an adapter just published.  When the queue is
+/// full the copy is dropped and counted, since the adapter must never wait
+/// for the disk.
+///
+/// @pre stream must come from RegisterStream with the sizes of the tables.
+/// @post The frame is queued or counted as dropped.
+/// @param stream The number returned by RegisterStream.
+/// @param states The state table of the adapter.
+/// @param commands The command table of the adapter.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::Submit(unsigned int stream,
+        const std::vector<SignalValue> & states,
+        const std::vector<SignalValue> & commands)
+{
+    if( !m_enabled )
+    {
+        return;
+    }
+
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    now += CGlobalConfiguration::Instance().GetClockSkew();
+
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        if( stream >= m_streams.size() )
+        {
+            return;
+        }
+        if( m_queue.size() >= m_queueLimit )
+        {
+            m_streams[stream].dropped++;
+            DroppedMetric.Increment();
+            return;
+        }
+
+        m_queue.push_back(SFrame());
+        SFrame & frame = m_queue.back();
+        frame.stream = stream;
+        frame.time = (now - EPOCH).total_microseconds();
+        frame.values.reserve(states.size() + commands.size());
+        frame.values.insert(frame.values.end(), states.begin(), states.end());
+        frame.values.insert(frame.values.end(), commands.begin(), commands.end());
+    }
+    m_ready.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Body of the writer thread.  The queue is taken as a whole each time the
+/// thread wakes, so the adapters can keep queuing while it writes.  A chunk
+/// is written once it is full or its oldest row is a few seconds old.
+///
+/// @pre The file is open.
+/// @post Returns once Stop is called, after writing every row.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::RunWriter()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    try
+    {
+        while( true )
+        {
+            std::deque<SFrame> frames;
+            bool stopping;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                if( m_queue.empty() && !m_stopping )
+                {
+                    m_ready.timed_wait(lock, boost::posix_time::seconds(1));
+                }
+                frames.swap(m_queue);
+                stopping = m_stopping;
+            }
+
+            BOOST_FOREACH(const SFrame & frame, frames)
+            {
+                Append(frame);
+            }
+
+            boost::uint64_t now = (boost::posix_time::microsec_clock::universal_time()
+                    + CGlobalConfiguration::Instance().GetClockSkew()
+                    - EPOCH).total_microseconds();
+            for( std::size_t i = 0; i < m_chunks.size(); i++ )
+            {
+                if( !m_chunks[i].times.empty()
+                    && (stopping || m_chunks[i].times.front() + CHUNK_AGE < now) )
+                {
+                    Flush(i);
+                }
+            }
+            m_file.flush();
+
+            if( stopping )
+            {
+                return;
+            }
+        }
+    }
+    catch(boost::thread_interrupted &)
+    {
+        LOG_DEBUG(Logger) << "Telemetry writer interrupted." << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Adds a frame as the next row of its adapter's chunk, and writes the chunk
+/// once it is full.
+///
+/// @pre Only the writer thread may call this function.
+/// @post The frame is in its chunk, or written with it.
+/// @param frame The frame to add.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::Append(const SFrame & frame)
+{
+    if( m_chunks.size() <= frame.stream )
+    {
+        SChunk empty;
+        empty.described = false;
+        m_chunks.resize(frame.stream + 1, empty);
+    }
+
+    SChunk & chunk = m_chunks[frame.stream];
+    chunk.times.push_back(frame.time);
+    chunk.rows.insert(chunk.rows.end(), frame.values.begin(), frame.values.end());
+
+    if( chunk.times.size() >= CHUNK_ROWS )
+    {
+        Flush(frame.stream);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Writes the gathered rows of an adapter as one chunk, turning the rows into
+/// columns.  The adapter is described first if this is its first chunk.
+///
+/// @pre Only the writer thread may call this function.
+/// @pre The chunk of the stream has at least one row.
+/// @post The chunk is written and emptied.
+/// @param stream The adapter whose chunk is written.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::Flush(unsigned int stream)
+{
+    SChunk & chunk = m_chunks[stream];
+    SStream copy;
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        copy = m_streams[stream];
+        m_streams[stream].dropped = 0;
+    }
+
+    if( !chunk.described )
+    {
+        STelemetryStream info;
+        info.states = copy.states;
+        info.commands = copy.commands;
+        std::string payload(reinterpret_cast<const char *>(&info), sizeof(info));
+        payload += copy.name;
+        WriteBlock(TELEMETRY_STREAM, stream, payload);
+        chunk.described = true;
+    }
+
+    std::size_t rows = chunk.times.size();
+    std::size_t width = copy.states + copy.commands;
+    STelemetryChunk header;
+    header.rows = rows;
+    header.dropped = copy.dropped;
+    header.first_time = chunk.times[0];
+
+    std::string payload(reinterpret_cast<const char *>(&header), sizeof(header));
+    for( std::size_t r = 1; r < rows; r++ )
+    {
+        AppendVarint(payload, chunk.times[r] - chunk.times[r-1]);
+    }
+
+    std::string bitmap, values;
+    for( std::size_t c = 0; c < width; c++ )
+    {
+        bitmap.assign((rows + 7) / 8, 0);
+        values.clear();
+        for( std::size_t r = 0; r < rows; r++ )
+        {
+            const SignalValue & value = chunk.rows[r * width + c];
+            if( r == 0 || std::memcmp(&value, &chunk.rows[(r-1) * width + c],
+                    sizeof(value)) != 0 )
+            {
+                bitmap[r / 8] |= static_cast<char>(1 << (r % 8));
+                values.append(reinterpret_cast<const char *>(&value), sizeof(value));
+            }
+        }
+        payload += bitmap;
+        payload += values;
+    }
+
+    WriteBlock(TELEMETRY_CHUNK, stream, payload);
+    RowsMetric.Increment(rows);
+    chunk.times.clear();
+    chunk.rows.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Writes one block to the telemetry file.  A failed write is logged and the
+/// writer keeps going, so a full disk loses rows without stopping the DGI.
+///
+/// @pre Only the writer thread may call this function.
+/// @post The block is at the end of the file.
+/// @param kind The ETelemetryBlock.
+/// @param stream The adapter the block belongs to.
+/// @param payload The bytes of the block.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+void CTelemetryWriter::WriteBlock(boost::uint32_t kind, unsigned int stream,
+        const std::string & payload)
+{
+    STelemetryBlock block;
+    block.kind = kind;
+    block.stream = stream;
+    block.length = payload.size();
+
+    m_file.write(reinterpret_cast<const char *>(&block), sizeof(block));
+    m_file.write(payload.data(), payload.size());
+    if( !m_file )
+    {
+        LOG_ERROR(Logger) << "Failed to write the telemetry file." << std::endl;
+        m_file.clear();
+    }
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
@@ -0,0 +1,168 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CTelemetryWriter.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Writes the device tables to a columnar file in the background.
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_TELEMETRY_WRITER_HPP
+#define C_TELEMETRY_WRITER_HPP
+
+#include "IAdapter.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// Records the state and command tables of the buffer adapters.
+////////////////////////////////////////////////////////////////////////////////
+/// When a telemetry file is configured, each buffer adapter hands a copy of
+/// its tables to the writer every time it publishes its states.  The copy is
+/// queued under a lock without formatting anything, and a full queue drops
+/// the copy and counts it rather than slowing the adapter down.  A thread of
+/// its own gathers the rows of each adapter into chunks and writes each chunk
+/// column by column in the layout of TelemetryFormat.hpp.  The file is in the
+/// byte order of the DGI that wrote it.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+class CTelemetryWriter
+    : private boost::noncopyable
+{
+public:
+    /// Access the singleton instance of the CTelemetryWriter.
+    static CTelemetryWriter & Instance();
+
+    /// Creates the telemetry file and starts the writer, if configured.
+    void Start();
+
+    /// Writes the queued rows and stops the writer.
+    void Stop();
+
+    /// True if the tables are being recorded.
+    bool IsEnabled() const { return m_enabled; }
+
+    /// Numbers an adapter and the width of its tables.
+    unsigned int RegisterStream(const std::string & name, std::size_t states,
+            std::size_t commands);
+
+    /// Queues a copy of the tables of an adapter.
+    void Submit(unsigned int stream, const std::vector<SignalValue> & states,
+            const std::vector<SignalValue> & commands);
+
+private:
+    /// A copy of the tables of one adapter.
+    struct SFrame
+    {
+        /// The adapter the tables belong to.
+        unsigned int stream;
+        /// Synchronized microseconds since the epoch.
+        boost::uint64_t time;
+        /// The states followed by the commands.
+        std::vector<SignalValue> values;
+    };
+
+    /// An adapter known to the writer.
+    struct SStream
+    {
+        /// The name of the adapter.
+        std::string name;
+        /// The number of state columns.
+        std::size_t states;
+        /// The number of command columns.
+        std::size_t commands;
+        /// The rows dropped since the last chunk was written.
+        unsigned int dropped;
+    };
+
+    /// The rows of an adapter not written yet, owned by the writer thread.
+    struct SChunk
+    {
+        /// True once the stream block was written.
+        bool described;
+        /// The time of each row.
+        std::vector<boost::uint64_t> times;
+        /// The rows one after another.
+        std::vector<SignalValue> rows;
+    };
+
+    /// Private constructor for the singleton instance.
+    CTelemetryWriter();
+
+    /// Stops the writer thread if Stop was not called.
+    ~CTelemetryWriter();
+
+    /// Writes the queued frames until stopped.
+    void RunWriter();
+
+    /// Adds a frame to the chunk of its adapter.
+    void Append(const SFrame & frame);
+
+    /// Writes the chunk of an adapter to the file.
+    void Flush(unsigned int stream);
+
+    /// Writes one block to the file.
+    void WriteBlock(boost::uint32_t kind, unsigned int stream,
+            const std::string & payload);
+
+    /// True once the file is open and frames are accepted.
+    volatile bool m_enabled;
+
+    /// True once the writer thread should drain the queue and exit.
+    bool m_stopping;
+
+    /// The most frames the queue holds.
+    std::size_t m_queueLimit;
+
+    /// Frames waiting for the writer thread.
+    std::deque<SFrame> m_queue;
+
+    /// The registered adapters.
+    std::vector<SStream> m_streams;
+
+    /// Guards m_queue, m_streams and m_stopping.
+    boost::mutex m_mutex;
+
+    /// Wakes the writer thread when frames are queued.
+    boost::condition_variable m_ready;
+
+    /// The rows of each adapter, owned by the writer thread.
+    std::vector<SChunk> m_chunks;
+
+    /// The telemetry file, owned by the writer thread once started.
+    std::ofstream m_file;
+
+    /// Writes the file off the adapter threads.
+    boost::thread m_thread;
+};
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // C_TELEMETRY_WRITER_HPP
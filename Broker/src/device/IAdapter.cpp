@@ -12,6 +12,7 @@
 ///     IAdapter::RegisterDevice
 ///     IAdapter::GetDevices
 ///     IAdapter::RevealDevices
+///     IAdapter::StatesChanged
 ///
 /// These source code files were created at Missouri University of Science and
 /// Technology, and are intended for use in teaching or research. They may be
@@ -46,7 +47,7 @@ CLocalLogger Logger(__FILE__);
 ////////////////////////////////////////////////////////////////////////////////
 IAdapter::IAdapter()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,7 +60,7 @@ IAdapter::IAdapter()
 ////////////////////////////////////////////////////////////////////////////////
 IAdapter::~IAdapter()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -73,7 +74,7 @@ IAdapter::~IAdapter()
 ////////////////////////////////////////////////////////////////////////////////
 void IAdapter::RegisterDevice(const std::string devid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     m_devices.insert(devid);
 }
 
@@ -88,7 +89,7 @@ void IAdapter::RegisterDevice(const std::string devid)
 ////////////////////////////////////////////////////////////////////////////////
 std::set<std::string> IAdapter::GetDevices() const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return m_devices;
 }
 
@@ -102,12 +103,27 @@ std::set<std::string> IAdapter::GetDevices() const
 ////////////////////////////////////////////////////////////////////////////////
 void IAdapter::RevealDevices()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    BOOST_FOREACH(std::string devid, m_devices)
-    {
-        CDeviceManager::Instance().RevealDevice(devid);
-    }
+    CDeviceManager::Instance().RevealDevices(m_devices);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Invalidates the signal aggregates cached by the device manager and raises
+/// the change events of the modules subscribed to the new states.
+///
+/// @pre None.
+/// @post Calls CDeviceManager::InvalidateAggregates and
+///     CDeviceManager::NotifySubscribers.
+///
+/// @limitations Call after the new states are visible to GetState, without
+/// holding a lock that GetState takes.
+////////////////////////////////////////////////////////////////////////////////
+void IAdapter::StatesChanged()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    CDeviceManager::Instance().InvalidateAggregates();
+    CDeviceManager::Instance().NotifySubscribers();
 }
 
 } // namespace freedm
@@ -30,6 +30,7 @@
 #include <utility>
 
 #include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/ptime.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
@@ -47,6 +48,28 @@ const SignalValue NULL_COMMAND = std::pow(10, 8);
 /// Type of the unique identifier for device values.
 typedef std::pair<const std::string, const std::string> DeviceSignal;
 
+/// Type of a device signal resolved ahead of time for repeated access.
+typedef std::size_t SignalHandle;
+
+/// A state value and the time its state table was published.
+struct SignalSample
+{
+    /// The time the value was published.
+    boost::posix_time::ptime time;
+
+    /// The value of the signal.
+    SignalValue value;
+};
+
+/// The mean and extremes of a state signal over a window of its history.
+struct SignalTrend
+{
+    SignalValue mean;
+    SignalValue min;
+    SignalValue max;
+    std::size_t count;
+};
+
 /// Physical adapter device interface.
 ////////////////////////////////////////////////////////////////////////////////
 /// Defines the interface each device uses to perform its operations.  The
@@ -101,6 +124,9 @@ protected:
     /// Reveals devices in the device manager.
     void RevealDevices();
 
+    /// Tells the device manager that new states are visible.
+    void StatesChanged();
+
 private:
     /// Set of registered device names.
     std::set<std::string> m_devices;
@@ -11,6 +11,17 @@
 /// @functions      IBufferAdapter::Start
 ///                 IBufferAdapter::Set
 ///                 IBufferAdapter::Get
+///                 IBufferAdapter::GetStateHandle
+///                 IBufferAdapter::GetCommandHandle
+///                 IBufferAdapter::GetStates
+///                 IBufferAdapter::SetCommands
+///                 IBufferAdapter::PublishStates
+///                 IBufferAdapter::RecordHistory
+///                 IBufferAdapter::GetHistory
+///                 IBufferAdapter::GetTrend
+///                 IBufferAdapter::SnapshotCommands
+///                 IBufferAdapter::NoteCommand
+///                 IBufferAdapter::EndianSwapIfNeeded
 ///                 IBufferAdapter::RegisterStateInfo
 ///                 IBufferAdapter::RegisterCommandInfo
 ///                 IBufferAdapter::~IBufferAdapter
@@ -29,8 +40,16 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "IBufferAdapter.hpp"
+#include "CControlLoop.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CTelemetryWriter.hpp"
+#include "CVirtualClock.hpp"
 
+#include <sys/param.h>
+
+#include <algorithm>
+#include <cstring>
 #include <set>
 #include <stdexcept>
 
@@ -38,6 +57,9 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/range/adaptor/map.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/static_assert.hpp>
 
 namespace freedm {
 namespace broker {
@@ -46,12 +68,25 @@ namespace device {
 namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
+
+/// The time the history timestamps count from.
+const boost::posix_time::ptime HISTORY_EPOCH(boost::gregorian::date(1970, 1, 1));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Constructor
 ///////////////////////////////////////////////////////////////////////////////
-IBufferAdapter::IBufferAdapter() { }
+IBufferAdapter::IBufferAdapter()
+    : m_fixedRate(false)
+    , m_telemetryStream(0)
+    , m_historySlots(0)
+    , m_historyCount(0)
+    , m_updateMetric(0)
+    , m_cycleMetric(0)
+    , m_overrunMetric(0)
+    , m_skippedMetric(0)
+{
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Called when "starting" the adapter, after all devices have been added.
@@ -69,7 +104,7 @@ IBufferAdapter::IBufferAdapter() { }
 ///////////////////////////////////////////////////////////////////////////////
 void IBufferAdapter::Start()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     std::size_t stateSize;
     std::size_t commandSize;
@@ -93,8 +128,16 @@ void IBufferAdapter::Start()
         m_txBuffer.push_back(NULL_COMMAND);
     }
 
+    m_rxStaging = m_rxBuffer;
+    m_txStaging = m_txBuffer;
     m_buffer_initialized = false;
 
+    // the history is never resized once readers may see it
+    m_historyTimes.assign(m_historySlots, 0);
+    m_historyValues.assign(m_historySlots * m_rxBuffer.size(), NULL_COMMAND);
+    m_telemetryStream = CTelemetryWriter::Instance().RegisterStream(m_name,
+            m_rxBuffer.size(), m_txBuffer.size());
+
     stateSize = stateIndices.size();
     commandSize = commandIndices.size();
 
@@ -148,7 +191,7 @@ void IBufferAdapter::Start()
 void IBufferAdapter::SetCommand(const std::string device, const std::string signal,
         const SignalValue value)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     const DeviceSignal devsig(device, signal);
     boost::unique_lock<boost::shared_mutex> writeLock(m_txMutex);
@@ -160,6 +203,7 @@ void IBufferAdapter::SetCommand(const std::string device, const std::string sign
     }
 
     m_txBuffer.at(m_commandInfo[devsig]) = value;
+    NoteCommand();
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -181,7 +225,7 @@ void IBufferAdapter::SetCommand(const std::string device, const std::string sign
 SignalValue IBufferAdapter::GetState(const std::string device,
         const std::string signal) const
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     const DeviceSignal devsig(device, signal);
     boost::shared_lock<boost::shared_mutex> readLock(m_rxMutex);
@@ -193,12 +237,686 @@ SignalValue IBufferAdapter::GetState(const std::string device,
     }
 
     SignalValue value = m_rxBuffer.at(m_stateInfo.find(devsig)->second);
+    SControlStamp stamp = m_published;
+    readLock.unlock();
+    CControlLoop::Observe(stamp);
+
+    LOG_DEBUG(Logger) << device << " " << signal << ": " << value << std::endl;
+
+    return value;
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Resolves a state signal to the index of its value in the rxBuffer.  The
+/// returned handle can be passed to GetState to skip the signal lookup.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the signal has not been registered.
+///
+/// @pre The passed signal must be recognized by the adapter.
+/// @post Returns the rxBuffer index registered for the signal.
+///
+/// @param device The unique identifier of a physical device.
+/// @param signal A power electronic reading related to the device.
+///
+/// @return SignalHandle for use with GetState.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+SignalHandle IBufferAdapter::GetStateHandle(const std::string & device,
+        const std::string & signal) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<const DeviceSignal, const std::size_t>::const_iterator it;
+    it = m_stateInfo.find(DeviceSignal(device, signal));
+
+    if( it == m_stateInfo.end() )
+    {
+        throw std::runtime_error("Attempted to resolve a device signal ("
+                + device + "," + signal + ") that does not exist.");
+    }
+
+    return it->second;
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Resolves a command signal to the index of its value in the txBuffer.  The
+/// returned handle can be passed to SetCommand to skip the signal lookup.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the signal has not been registered.
+///
+/// @pre The passed signal must be recognized by the adapter.
+/// @post Returns the txBuffer index registered for the signal.
+///
+/// @param device The unique identifier of a physical device.
+/// @param signal A power electronic command related to the device.
+///
+/// @return SignalHandle for use with SetCommand.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+SignalHandle IBufferAdapter::GetCommandHandle(const std::string & device,
+        const std::string & signal) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<const DeviceSignal, const std::size_t>::const_iterator it;
+    it = m_commandInfo.find(DeviceSignal(device, signal));
+
+    if( it == m_commandInfo.end() )
+    {
+        throw std::runtime_error("Attempted to resolve a device signal ("
+                + device + "," + signal + ") that does not exist.");
+    }
+
+    return it->second;
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Read the value stored at a resolved index of the rxBuffer.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the handle is outside the rxBuffer.
+///
+/// @pre The handle must come from GetStateHandle on this adapter.
+/// @post Returns the value stored in m_rxBuffer at the handle.
+///
+/// @param handle The index returned by GetStateHandle.
+///
+/// @return SignalValue from the rxBuffer.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+SignalValue IBufferAdapter::GetState(const SignalHandle handle) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::shared_lock<boost::shared_mutex> readLock(m_rxMutex);
 
-    Logger.Debug << device << " " << signal << ": " << value << std::endl;
+    if( handle >= m_rxBuffer.size() )
+    {
+        throw std::runtime_error("Attempted to get a state with the invalid"
+                " handle " + boost::lexical_cast<std::string>(handle) + ".");
+    }
 
+    SignalValue value = m_rxBuffer[handle];
+    SControlStamp stamp = m_published;
+    readLock.unlock();
+    CControlLoop::Observe(stamp);
     return value;
 }
 
+////////////////////////////////////////////////////////////////////////////
+/// Read the values stored at several resolved indices of the rxBuffer. All
+/// of the values are copied while holding the lock once, so they come from
+/// the same published state table.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if a handle is outside the rxBuffer.
+///
+/// @pre Each handle must come from GetStateHandle on this adapter.
+/// @pre values must be large enough to hold every slot.
+/// @post values[slots[i]] holds the value stored at handles[i].
+///
+/// @param handles The indices returned by GetStateHandle.
+/// @param slots The position in values of each handle.
+/// @param values The buffer that receives the values.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::GetStates(const std::vector<SignalHandle> & handles,
+        const std::vector<std::size_t> & slots,
+        std::vector<SignalValue> & values) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::shared_lock<boost::shared_mutex> readLock(m_rxMutex);
+
+    for( std::size_t i = 0; i < handles.size(); i++ )
+    {
+        if( handles[i] >= m_rxBuffer.size() )
+        {
+            throw std::runtime_error("Attempted to get a state with the invalid"
+                    " handle " + boost::lexical_cast<std::string>(handles[i]) + ".");
+        }
+        values[slots[i]] = m_rxBuffer[handles[i]];
+    }
+    SControlStamp stamp = m_published;
+    readLock.unlock();
+    CControlLoop::Observe(stamp);
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Update the value stored at a resolved index of the txBuffer.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the handle is outside the txBuffer.
+///
+/// @pre The handle must come from GetCommandHandle on this adapter.
+/// @post Updates the value stored in m_txBuffer at the handle.
+///
+/// @param handle The index returned by GetCommandHandle.
+/// @param value The desired new value for the device signal.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::SetCommand(const SignalHandle handle,
+        const SignalValue value)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::unique_lock<boost::shared_mutex> writeLock(m_txMutex);
+
+    if( handle >= m_txBuffer.size() )
+    {
+        throw std::runtime_error("Attempted to set a command with the invalid"
+                " handle " + boost::lexical_cast<std::string>(handle) + ".");
+    }
+
+    m_txBuffer[handle] = value;
+    NoteCommand();
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Update the values stored at several resolved indices of the txBuffer.
+/// Every handle is checked before any value is written, and the values are
+/// written while holding the lock once, so SnapshotCommands copies either
+/// all of them or none.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if a handle is outside the txBuffer.
+///
+/// @pre Each handle must come from GetCommandHandle on this adapter.
+/// @pre values must have one value for each handle.
+/// @post Updates the value stored in m_txBuffer at each handle.
+///
+/// @param handles The indices returned by GetCommandHandle.
+/// @param values The desired new value for each handle.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::SetCommands(const std::vector<SignalHandle> & handles,
+        const std::vector<SignalValue> & values)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::unique_lock<boost::shared_mutex> writeLock(m_txMutex);
+
+    for( std::size_t i = 0; i < handles.size(); i++ )
+    {
+        if( handles[i] >= m_txBuffer.size() )
+        {
+            throw std::runtime_error("Attempted to set a command with the invalid"
+                    " handle " + boost::lexical_cast<std::string>(handles[i]) + ".");
+        }
+    }
+
+    for( std::size_t i = 0; i < handles.size(); i++ )
+    {
+        m_txBuffer[handles[i]] = values[i];
+    }
+    NoteCommand();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Registers the metrics of the adapter, labeled with its name in the adapter
+/// configuration.  An adapter without a name records no metrics.
+///
+/// @pre The adapter has not been started.
+/// @post PublishStates counts the state tables and times the cycles, and
+///     the telemetry file names the adapter.
+/// @param name The name of the adapter.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::SetMetricsName(const std::string & name)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_name = name;
+    std::string label = CMetrics::Label("adapter", name);
+    m_updateMetric = &CMetrics::Instance().GetCounter(
+            "dgi_adapter_updates_total",
+            "State tables published, by device adapter", label);
+    m_cycleMetric = &CMetrics::Instance().GetHistogram(
+            "dgi_adapter_cycle_seconds",
+            "Times from a command snapshot to the next state table, by device adapter",
+            label);
+    m_overrunMetric = &CMetrics::Instance().GetCounter(
+            "dgi_adapter_overruns_total",
+            "Fixed-rate cycles that ended after their deadline, by device adapter",
+            label);
+    m_skippedMetric = &CMetrics::Instance().GetCounter(
+            "dgi_adapter_skipped_cycles_total",
+            "Fixed-rate cycles skipped after an overrun, by device adapter",
+            label);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Selects how the adapter paces its cycles.  By default the next cycle
+/// waits a delay after the last one, so the period grows with the time spent
+/// on the socket.  At a fixed rate each cycle starts one period after the
+/// deadline of the last, whatever the exchange took.
+///
+/// @pre The adapter has not been started.
+/// @post The adapter schedules its cycles through NextDeadline if fixed.
+/// @param fixed True to schedule the cycles against fixed deadlines.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::SetFixedRate(const bool fixed)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_fixedRate = fixed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Computes the deadline of the next fixed-rate cycle.  The deadlines stay on
+/// a grid of one period from the first, so the rate does not drift.  A cycle
+/// that ended after the next deadline is an overrun, and the deadlines it
+/// missed are skipped rather than run back to back.
+///
+/// @pre None.
+/// @post m_deadline holds the returned deadline.  Overruns and skipped
+///     cycles are recorded in the metrics.
+/// @param period The time between the starts of two cycles.
+/// @return The time the next cycle should start.
+///
+/// @limitations Only the adapter thread may call this function.
+///////////////////////////////////////////////////////////////////////////////
+boost::posix_time::ptime IBufferAdapter::NextDeadline(
+        const boost::posix_time::time_duration period)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::posix_time::ptime now =
+            boost::posix_time::microsec_clock::universal_time();
+
+    if( m_deadline.is_not_a_date_time() || period.ticks() <= 0 )
+    {
+        m_deadline = now;
+    }
+    m_deadline += period;
+
+    if( m_deadline <= now )
+    {
+        boost::int64_t missed = (now - m_deadline).ticks() / period.ticks();
+        m_deadline += period * static_cast<int>(missed + 1);
+        LOG_DEBUG(Logger) << "Cycle overran its deadline, skipping "
+                << missed + 1 << " cycles." << std::endl;
+        if( m_overrunMetric )
+        {
+            m_overrunMetric->Increment();
+            m_skippedMetric->Increment(missed + 1);
+        }
+    }
+    return m_deadline;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Makes the values in m_rxStaging visible to GetState.  The adapter fills
+/// m_rxStaging without holding any lock, so readers only wait for the swap of
+/// the two buffers rather than for the socket operation that produced them.
+///
+/// @pre m_rxStaging holds a complete state table of the size of m_rxBuffer.
+/// @post m_rxBuffer holds the new state table and m_rxStaging the previous.
+///     The new table is stamped with its number and the time for the control
+///     loop metrics.  The tables are added to the history and queued for the
+///     telemetry file.  The aggregates cached by the device manager are
+///     invalidated.  The cycle since the last SnapshotCommands is recorded in
+///     the metrics.
+///
+/// @limitations Only the adapter thread may call this function.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::PublishStates()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    {
+        boost::unique_lock<boost::shared_mutex> writeLock(m_rxMutex);
+        m_rxBuffer.swap(m_rxStaging);
+        m_published.sequence++;
+        m_published.published = boost::posix_time::microsec_clock::universal_time();
+    }
+    RecordHistory();
+    // the telemetry copy is queued, never written, on the adapter thread
+    if( CTelemetryWriter::Instance().IsEnabled() )
+    {
+        CTelemetryWriter::Instance().Submit(m_telemetryStream, m_rxBuffer,
+                m_txStaging);
+    }
+    StatesChanged();
+
+    if( m_updateMetric )
+    {
+        m_updateMetric->Increment();
+        if( !m_cycleStart.is_not_a_date_time() )
+        {
+            boost::posix_time::time_duration cycle =
+                    boost::posix_time::microsec_clock::universal_time() - m_cycleStart;
+            m_cycleMetric->Observe(cycle.total_microseconds() / 1e6);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Sets the number of values kept for each state signal.  The history of a
+/// signal is a ring of its last values next to each other, and the rows of
+/// all the signals share one ring of timestamps.
+///
+/// @pre The adapter has not been started.
+/// @post Start allocates the history and PublishStates fills it.
+/// @param capacity The number of values to keep, 0 to keep no history.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::SetHistoryCapacity(const std::size_t capacity)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // the extra row is the one being written while readers copy the others
+    m_historySlots = capacity > 0 ? capacity + 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Gets the number of values kept for each state signal.
+///
+/// @pre None.
+/// @post None.
+/// @return The capacity given to SetHistoryCapacity.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t IBufferAdapter::GetHistoryCapacity() const
+{
+    return m_historySlots > 0 ? m_historySlots - 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Writes the state table in m_rxBuffer to the next row of the history.  The
+/// count is only advanced after the row is written, so a reader that sees
+/// the count also sees the row.
+///
+/// @pre m_rxBuffer holds the state table that was just published.
+/// @post The oldest row is replaced by the state table.
+///
+/// @limitations Only the adapter thread may call this function.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::RecordHistory()
+{
+    if( m_historySlots == 0 )
+    {
+        return;
+    }
+
+    std::size_t row = m_historyCount % m_historySlots;
+
+    m_historyTimes[row] = (CVirtualClock::Now()
+            - HISTORY_EPOCH).total_microseconds();
+    for( std::size_t i = 0; i < m_rxBuffer.size(); i++ )
+    {
+        m_historyValues[i * m_historySlots + row] = m_rxBuffer[i];
+    }
+    __sync_synchronize();
+    m_historyCount = m_historyCount + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the last values of a state signal without taking a lock.  The rows
+/// are copied between two reads of the count, and copied again if the
+/// adapter started to overwrite one of them in between.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the handle is outside the rxBuffer.
+///
+/// @pre The handle must come from GetStateHandle on this adapter.
+/// @post samples holds up to count of the newest values, oldest first.  It
+///     has fewer if the history is shorter, and is empty with no history.
+///
+/// @param handle The index returned by GetStateHandle.
+/// @param count The number of values wanted.
+/// @param samples The buffer that receives the values.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::GetHistory(const SignalHandle handle,
+        const std::size_t count, std::vector<SignalSample> & samples) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    samples.clear();
+
+    if( m_historySlots == 0 )
+    {
+        return;
+    }
+    if( handle >= m_rxBuffer.size() )
+    {
+        throw std::runtime_error("Attempted to get the history of the invalid"
+                " handle " + boost::lexical_cast<std::string>(handle) + ".");
+    }
+
+    const SignalValue * values = &m_historyValues[handle * m_historySlots];
+
+    while( true )
+    {
+        std::size_t newest = m_historyCount;
+        __sync_synchronize();
+
+        std::size_t n = std::min(count, std::min<std::size_t>(newest,
+                GetHistoryCapacity()));
+        samples.resize(n);
+
+        for( std::size_t k = 0; k < n; k++ )
+        {
+            std::size_t row = (newest - n + k) % m_historySlots;
+            samples[k].time = HISTORY_EPOCH
+                    + boost::posix_time::microseconds(m_historyTimes[row]);
+            samples[k].value = values[row];
+        }
+        __sync_synchronize();
+
+        // the adapter overwrites the row of the oldest value it is past
+        if( m_historyCount < newest - n + m_historySlots )
+        {
+            return;
+        }
+        LOG_DEBUG(Logger) << "History changed while read, retry." << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Computes the mean and extremes of the values of a state signal published
+/// within a window that ends now, without taking a lock.  Values the adapter
+/// has not received yet (NULL_COMMAND) are left out.
+///
+/// @Error_Handling
+///     Throws std::runtime_error if the handle is outside the rxBuffer.
+///
+/// @pre The handle must come from GetStateHandle on this adapter.
+/// @post None.
+///
+/// @param handle The index returned by GetStateHandle.
+/// @param window How far back from now to look.
+///
+/// @return The trend of the signal, with a count of 0 if no value is in the
+///     window.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+SignalTrend IBufferAdapter::GetTrend(const SignalHandle handle,
+        const boost::posix_time::time_duration window) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SignalTrend trend;
+    trend.mean = trend.min = trend.max = 0;
+    trend.count = 0;
+
+    if( m_historySlots == 0 )
+    {
+        return trend;
+    }
+    if( handle >= m_rxBuffer.size() )
+    {
+        throw std::runtime_error("Attempted to get the trend of the invalid"
+                " handle " + boost::lexical_cast<std::string>(handle) + ".");
+    }
+
+    const SignalValue * values = &m_historyValues[handle * m_historySlots];
+    boost::int64_t start = (CVirtualClock::Now()
+            - window - HISTORY_EPOCH).total_microseconds();
+
+    while( true )
+    {
+        std::size_t newest = m_historyCount;
+        __sync_synchronize();
+
+        std::size_t limit = std::min<std::size_t>(newest, GetHistoryCapacity());
+        std::size_t n = 0;
+        double sum = 0;
+        trend.count = 0;
+
+        // the rows are in time order, so stop at the first one too old
+        for( ; n < limit; n++ )
+        {
+            std::size_t row = (newest - 1 - n) % m_historySlots;
+            SignalValue value = values[row];
+
+            if( m_historyTimes[row] < start )
+            {
+                break;
+            }
+            if( value == NULL_COMMAND )
+            {
+                continue;
+            }
+            if( trend.count == 0 || value < trend.min )
+            {
+                trend.min = value;
+            }
+            if( trend.count == 0 || value > trend.max )
+            {
+                trend.max = value;
+            }
+            sum += value;
+            trend.count++;
+        }
+        __sync_synchronize();
+
+        // the row that ended the window was read as well
+        std::size_t read = n < limit ? n + 1 : n;
+
+        if( m_historyCount < newest - read + m_historySlots )
+        {
+            trend.mean = trend.count > 0 ? sum / trend.count : 0;
+            return trend;
+        }
+        LOG_DEBUG(Logger) << "History changed while read, retry." << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Converts the SignalValues in the passed vector from big-endian to
+/// little-endian, or vice-versa, if the DGI is running on a little-endian
+/// system. Each value is swapped as a whole word with the byte swap builtin,
+/// which the compiler can vectorize, instead of one byte at a time.
+///
+/// @pre None.
+/// @post The elements of data are converted in endianness if the DGI is
+///  running on a little-endian system.  Otherwise, nothing happens.
+/// @param v The vector of SignalValues to be endian-swapped.
+///
+/// @limitations Assumes the existence of UNIX byte order macros.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::EndianSwapIfNeeded(std::vector<SignalValue> & v)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    BOOST_STATIC_ASSERT(sizeof(SignalValue) == sizeof(boost::uint32_t));
+
+// check endianess at compile time.  Middle-Endian not allowed
+// The parameters __BYTE_ORDER, __LITTLE_ENDIAN, __BIG_ENDIAN should
+// automatically be defined and determined in sys/param.h, which exists
+// in most Unix systems.
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    boost::uint32_t word;
+
+    for( std::size_t i = 0; i < v.size(); i++ )
+    {
+        // memcpy keeps the float and the integer from aliasing
+        std::memcpy(&word, &v[i], sizeof(word));
+        word = __builtin_bswap32(word);
+        std::memcpy(&v[i], &word, sizeof(word));
+    }
+#elif __BYTE_ORDER == __BIG_ENDIAN
+    LOG_DEBUG(Logger) << "Endian swap skipped: host is big-endian." << std::endl;
+#else
+#error "unsupported endianness or __BYTE_ORDER not defined"
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the command table into m_txStaging so the adapter can convert and
+/// send it without blocking SetCommand for the duration of the write.  The
+/// copy is sent right after, so the control paths whose commands it holds
+/// are timed here.
+///
+/// @pre Start has sized m_txStaging to match m_txBuffer.
+/// @post m_txStaging holds a consistent copy of m_txBuffer.  The latency of
+///     each control path with a command in the copy is recorded.
+///
+/// @limitations Only the adapter thread may call this function.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::SnapshotCommands()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( m_cycleMetric )
+    {
+        m_cycleStart = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    std::map<std::string, SControlStamp> loops;
+    {
+        boost::shared_lock<boost::shared_mutex> readLock(m_txMutex);
+        std::copy(m_txBuffer.begin(), m_txBuffer.end(), m_txStaging.begin());
+        boost::lock_guard<boost::mutex> lock(m_loopMutex);
+        loops.swap(m_pendingLoops);
+    }
+
+    std::map<std::string, SControlStamp>::const_iterator it;
+    for( it = loops.begin(); it != loops.end(); it++ )
+    {
+        CControlLoop::Deliver(it->first, it->second);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Attaches the oldest state read in the open control loop scope to the
+/// commands just written, so SnapshotCommands can time them when they leave.
+///
+/// @pre The caller holds m_txMutex for writing.
+/// @post m_pendingLoops holds the stamp of the scope under its path, unless
+///     no scope is open or it read no stamped state.
+///
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void IBufferAdapter::NoteCommand()
+{
+    SControlStamp stamp = CControlLoop::Current();
+    if( !stamp.IsSet() )
+    {
+        return;
+    }
+    std::string path = CControlLoop::Path();
+    if( path.empty() )
+    {
+        return;
+    }
+    boost::lock_guard<boost::mutex> lock(m_loopMutex);
+    m_pendingLoops[path].Merge(stamp);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Registers a new device signal as state information with the adapter.
 ///
@@ -217,7 +935,7 @@ SignalValue IBufferAdapter::GetState(const std::string device,
 void IBufferAdapter::RegisterStateInfo(const std::string device,
         const std::string signal, const std::size_t index )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     DeviceSignal devsig(device, signal);
 
     if( device.empty() || signal.empty() )
@@ -247,7 +965,7 @@ void IBufferAdapter::RegisterStateInfo(const std::string device,
 
     // Buffer indices start at zero, but XML indices start at one...
     m_stateInfo.insert(std::pair<DeviceSignal, std::size_t>(devsig, index-1));
-    Logger.Info << "Registered the device signal (" << device << "," << signal
+    LOG_INFO(Logger) << "Registered the device signal (" << device << "," << signal
             << ") as adapter state information." << std::endl;
 }
 
@@ -269,7 +987,7 @@ void IBufferAdapter::RegisterStateInfo(const std::string device,
 void IBufferAdapter::RegisterCommandInfo(const std::string device,
         const std::string signal, const std::size_t index )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     DeviceSignal devsig(device, signal);
 
     if( device.empty() || signal.empty() )
@@ -299,7 +1017,7 @@ void IBufferAdapter::RegisterCommandInfo(const std::string device,
 
     // Buffer indices start at zero, but XML indices start at one...
     m_commandInfo.insert(std::pair<DeviceSignal, std::size_t>(devsig, index-1));
-    Logger.Info << "Registered the device (" << device << "," << signal
+    LOG_INFO(Logger) << "Registered the device (" << device << "," << signal
             << ") as adapter command information." << std::endl;
 }
 
@@ -313,7 +1031,7 @@ void IBufferAdapter::RegisterCommandInfo(const std::string device,
 ////////////////////////////////////////////////////////////////////////////////
 IBufferAdapter::~IBufferAdapter()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 }
 
 } // namespace device
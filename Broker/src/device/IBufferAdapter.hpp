@@ -25,16 +25,24 @@
 #define	I_BUFFER_ADAPTER_HPP
 
 #include "IAdapter.hpp"
+#include "CControlLoop.hpp"
 
 #include <map>
 #include <string>
 #include <vector>
 
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/ptime.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 namespace freedm {
 namespace broker {
+
+class CCounter;
+class CHistogram;
+
 namespace device {
 
 /// Buffer adapter device interface.
@@ -58,6 +66,29 @@ public:
     /// Retrieve data from rxBuffer.
     SignalValue GetState(const std::string device, const std::string signal) const;
 
+    /// Resolves a state signal to its rxBuffer index.
+    SignalHandle GetStateHandle(const std::string & device,
+            const std::string & signal) const;
+
+    /// Resolves a command signal to its txBuffer index.
+    SignalHandle GetCommandHandle(const std::string & device,
+            const std::string & signal) const;
+
+    /// Retrieve data from rxBuffer through a resolved handle.
+    SignalValue GetState(const SignalHandle handle) const;
+
+    /// Retrieve several values from rxBuffer under a single lock.
+    void GetStates(const std::vector<SignalHandle> & handles,
+            const std::vector<std::size_t> & slots,
+            std::vector<SignalValue> & values) const;
+
+    /// Set data in txBuffer through a resolved handle.
+    void SetCommand(const SignalHandle handle, const SignalValue value);
+
+    /// Set several values in txBuffer under a single lock.
+    void SetCommands(const std::vector<SignalHandle> & handles,
+            const std::vector<SignalValue> & values);
+
     /// Registers a new device signal with the physical adapter.
     void RegisterStateInfo(const std::string device, const std::string signal,
             const std::size_t index);
@@ -69,6 +100,26 @@ public:
     /// Starts the adapter
     void Start();
 
+    /// Registers the cycle metrics of the adapter under its configured name.
+    void SetMetricsName(const std::string & name);
+
+    /// Keeps the last values of every state signal, 0 to keep none.
+    void SetHistoryCapacity(const std::size_t capacity);
+
+    /// Gets the number of values kept for each state signal.
+    std::size_t GetHistoryCapacity() const;
+
+    /// Schedules the cycles against fixed deadlines instead of a delay.
+    void SetFixedRate(const bool fixed);
+
+    /// Retrieve the last values of a state signal, oldest first.
+    void GetHistory(const SignalHandle handle, const std::size_t count,
+            std::vector<SignalSample> & samples) const;
+
+    /// Summarize the values of a state signal published within a window.
+    SignalTrend GetTrend(const SignalHandle handle,
+            const boost::posix_time::time_duration window) const;
+
     /// Virtual destructor for derived classes.
     virtual ~IBufferAdapter();
 protected:
@@ -87,6 +138,28 @@ protected:
     /// The "command table" buffer sent to the external host.
     std::vector<SignalValue> m_txBuffer;
 
+    /// Adapter-side copy of m_rxBuffer filled without holding m_rxMutex.
+    std::vector<SignalValue> m_rxStaging;
+
+    /// Adapter-side copy of m_txBuffer sent without holding m_txMutex.
+    std::vector<SignalValue> m_txStaging;
+
+    /// Publishes m_rxStaging as the new m_rxBuffer.
+    void PublishStates();
+
+    /// Converts the SignalValues in a vector between network and host order.
+    static void EndianSwapIfNeeded(std::vector<SignalValue> & v);
+
+    /// Copies the current m_txBuffer into m_txStaging.
+    void SnapshotCommands();
+
+    /// Advances the fixed-rate deadline past the current time.
+    boost::posix_time::ptime NextDeadline(
+            const boost::posix_time::time_duration period);
+
+    /// True if the cycles are scheduled against fixed deadlines.
+    bool m_fixedRate;
+
     /// Provides synchronization for m_rxBuffer.
     mutable boost::shared_mutex m_rxMutex;
 
@@ -95,6 +168,58 @@ protected:
 
     /// Flag that indicates whether the buffer is NaN.
     bool m_buffer_initialized;
+
+private:
+    /// Time of the last SnapshotCommands, where a cycle starts.
+    boost::posix_time::ptime m_cycleStart;
+
+    /// The name of the adapter in the adapter configuration.
+    std::string m_name;
+
+    /// The number of the adapter in the telemetry file.
+    unsigned int m_telemetryStream;
+
+    /// Appends the published state table to the history.
+    void RecordHistory();
+
+    /// Rows of the history, one more than its capacity, or 0 if it is off.
+    std::size_t m_historySlots;
+
+    /// Publish time of each row of the history, in microseconds.
+    std::vector<boost::int64_t> m_historyTimes;
+
+    /// The rows of each state signal one after another, by rxBuffer index.
+    std::vector<SignalValue> m_historyValues;
+
+    /// The number of state tables recorded, advanced after a row is written.
+    volatile std::size_t m_historyCount;
+
+    /// Counts the state tables published, null until SetMetricsName.
+    CCounter * m_updateMetric;
+
+    /// Times from a command snapshot to the next publish of the states.
+    CHistogram * m_cycleMetric;
+
+    /// The deadline of the last fixed-rate cycle.
+    boost::posix_time::ptime m_deadline;
+
+    /// Counts the fixed-rate cycles that ended after their deadline.
+    CCounter * m_overrunMetric;
+
+    /// Counts the fixed-rate cycles skipped to catch up with the clock.
+    CCounter * m_skippedMetric;
+
+    /// Notes the control path that wrote a command in the open scope.
+    void NoteCommand();
+
+    /// The stamp of the state table in m_rxBuffer, guarded by m_rxMutex.
+    SControlStamp m_published;
+
+    /// The oldest state behind the commands not yet sent, by control path.
+    std::map<std::string, SControlStamp> m_pendingLoops;
+
+    /// Provides synchronization for m_pendingLoops.
+    boost::mutex m_loopMutex;
 };
 
 } // namespace device
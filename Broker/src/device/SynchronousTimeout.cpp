@@ -53,7 +53,7 @@ CLocalLogger Logger(__FILE__);
 void SetResult(boost::shared_ptr<OptionalError> status,
         const boost::system::error_code & error)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     *status = error;
 }
 
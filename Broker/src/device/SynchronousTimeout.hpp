@@ -71,14 +71,14 @@ template <typename ReadStream, typename BufferSequence>
 void TimedRead(ReadStream & stream, const BufferSequence & buffer,
         unsigned int duration)
 {
-    SyncTimeoutLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(SyncTimeoutLogger) << __PRETTY_FUNCTION__ << std::endl;
 
     boost::asio::io_service & ios = stream.get_io_service();
     boost::shared_ptr<OptionalError> result(new OptionalError);
     boost::shared_ptr<OptionalError> timeout(new OptionalError);
     boost::asio::deadline_timer timer(ios);
 
-    SyncTimeoutLogger.Info << "Blocking for synchronous read." << std::endl;
+    LOG_INFO(SyncTimeoutLogger) << "Blocking for synchronous read." << std::endl;
 
     boost::asio::async_read(stream, buffer,
             boost::bind(SetResult, result, boost::asio::placeholders::error));
@@ -93,7 +93,7 @@ void TimedRead(ReadStream & stream, const BufferSequence & buffer,
 
     if( *result && (*result)->value() == boost::system::errc::success )
     {
-        SyncTimeoutLogger.Info << "Synchronous read complete." << std::endl;
+        LOG_INFO(SyncTimeoutLogger) << "Synchronous read complete." << std::endl;
     }
     else if( *timeout && (*timeout)->value() == boost::system::errc::success )
     {
@@ -126,14 +126,14 @@ void TimedReadUntil(ReadStream & stream,
         const std::string & delim,
         unsigned int duration)
 {
-    SyncTimeoutLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(SyncTimeoutLogger) << __PRETTY_FUNCTION__ << std::endl;
 
     boost::asio::io_service & ios = stream.get_io_service();
     boost::shared_ptr<OptionalError> result(new OptionalError);
     boost::shared_ptr<OptionalError> timeout(new OptionalError);
     boost::asio::deadline_timer timer(ios);
 
-    SyncTimeoutLogger.Info << "Blocking for synchronous read." << std::endl;
+    LOG_INFO(SyncTimeoutLogger) << "Blocking for synchronous read." << std::endl;
 
     boost::asio::async_read_until(stream, buffer, delim,
             boost::bind(SetResult, result, boost::asio::placeholders::error));
@@ -148,7 +148,7 @@ void TimedReadUntil(ReadStream & stream,
 
     if( *result && (*result)->value() == boost::system::errc::success )
     {
-        SyncTimeoutLogger.Info << "Synchronous read complete." << std::endl;
+        LOG_INFO(SyncTimeoutLogger) << "Synchronous read complete." << std::endl;
     }
     else if( *timeout && (*timeout)->value() == boost::system::errc::success )
     {
@@ -177,14 +177,14 @@ template <typename WriteStream, typename BufferSequence>
 void TimedWrite(WriteStream & stream, const BufferSequence & buffer,
         unsigned int duration)
 {
-    SyncTimeoutLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(SyncTimeoutLogger) << __PRETTY_FUNCTION__ << std::endl;
 
     boost::asio::io_service & ios = stream.get_io_service();
     boost::shared_ptr<OptionalError> result(new OptionalError);
     boost::shared_ptr<OptionalError> timeout(new OptionalError);
     boost::asio::deadline_timer timer(ios);
 
-    SyncTimeoutLogger.Info << "Blocking for synchronous write." << std::endl;
+    LOG_INFO(SyncTimeoutLogger) << "Blocking for synchronous write." << std::endl;
 
     boost::asio::async_write(stream, buffer,
             boost::bind(SetResult, result, boost::asio::placeholders::error));
@@ -199,7 +199,7 @@ void TimedWrite(WriteStream & stream, const BufferSequence & buffer,
 
     if( *result && (*result)->value() == boost::system::errc::success )
     {
-        SyncTimeoutLogger.Info << "Synchronous write complete." << std::endl;
+        LOG_INFO(SyncTimeoutLogger) << "Synchronous write complete." << std::endl;
     }
     else if( *timeout && (*timeout)->value() == boost::system::errc::success )
     {
@@ -229,14 +229,14 @@ void TimedWrite(WriteStream & stream,
         boost::asio::basic_streambuf<Allocator> & buffer,
         unsigned int duration)
 {
-    SyncTimeoutLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(SyncTimeoutLogger) << __PRETTY_FUNCTION__ << std::endl;
 
     boost::asio::io_service & ios = stream.get_io_service();
     boost::shared_ptr<OptionalError> result(new OptionalError);
     boost::shared_ptr<OptionalError> timeout(new OptionalError);
     boost::asio::deadline_timer timer(ios);
 
-    SyncTimeoutLogger.Info << "Blocking for synchronous write." << std::endl;
+    LOG_INFO(SyncTimeoutLogger) << "Blocking for synchronous write." << std::endl;
 
     boost::asio::async_write(stream, buffer,
             boost::bind(SetResult, result, boost::asio::placeholders::error));
@@ -251,7 +251,7 @@ void TimedWrite(WriteStream & stream,
 
     if( *result && (*result)->value() == boost::system::errc::success )
     {
-        SyncTimeoutLogger.Info << "Synchronous write complete." << std::endl;
+        LOG_INFO(SyncTimeoutLogger) << "Synchronous write complete." << std::endl;
     }
     else if( *timeout && (*timeout)->value() == boost::system::errc::success )
     {
@@ -0,0 +1,229 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         TelemetryFormat.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Layout of the device telemetry file.
+///
+/// @functions
+///     AppendVarint
+///     ReadVarint
+///     DecodeChunk
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TELEMETRY_FORMAT_HPP
+#define TELEMETRY_FORMAT_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+namespace freedm {
+namespace broker {
+namespace device {
+
+/// Identifies a telemetry file.
+const char TELEMETRY_MAGIC[8] = { 'F', 'R', 'E', 'E', 'D', 'M', 'T', 'M' };
+
+/// The layout version of the telemetry file.
+const boost::uint32_t TELEMETRY_VERSION = 1;
+
+/// The kinds of blocks in a telemetry file.
+enum ETelemetryBlock
+{
+    /// Names an adapter and its number of state and command columns.
+    TELEMETRY_STREAM = 1,
+    /// Holds the rows of one adapter column by column.
+    TELEMETRY_CHUNK = 2
+};
+
+/// The header at the start of a telemetry file.
+struct STelemetryHeader
+{
+    /// TELEMETRY_MAGIC
+    char magic[8];
+    /// TELEMETRY_VERSION
+    boost::uint32_t version;
+    /// The size of a signal value in bytes.
+    boost::uint32_t value_size;
+};
+
+/// The start of every block, followed by length bytes of the block.
+struct STelemetryBlock
+{
+    /// The ETelemetryBlock
+    boost::uint32_t kind;
+    /// The adapter the block belongs to.
+    boost::uint32_t stream;
+    /// The number of bytes that follow.
+    boost::uint32_t length;
+};
+
+/// A TELEMETRY_STREAM block, followed by the name of the adapter.
+struct STelemetryStream
+{
+    /// The number of state columns.
+    boost::uint32_t states;
+    /// The number of command columns, after the state columns.
+    boost::uint32_t commands;
+};
+
+/// A TELEMETRY_CHUNK block.
+////////////////////////////////////////////////////////////////////////////////
+/// The header is followed by rows - 1 varints, each the microseconds from the
+/// row before, and then by each column in turn.  A column is a bitmap of the
+/// rows whose value differs from the row before, the first row always set,
+/// followed by the value of each set row.  Device tables are mostly constant
+/// from one cycle to the next, so a column usually costs its bitmap alone.
+////////////////////////////////////////////////////////////////////////////////
+struct STelemetryChunk
+{
+    /// The number of rows.
+    boost::uint32_t rows;
+    /// The rows of the stream dropped since the chunk before.
+    boost::uint32_t dropped;
+    /// The time of the first row in synchronized microseconds since the epoch.
+    boost::uint64_t first_time;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Appends an unsigned integer seven bits at a time, low bits first, with the
+/// top bit of each byte set while more bytes follow.
+///
+/// @pre None.
+/// @post The encoded value is at the end of the buffer.
+/// @param buffer The buffer to append to.
+/// @param value The value to encode.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+inline void AppendVarint(std::string & buffer, boost::uint64_t value)
+{
+    while( value >= 0x80 )
+    {
+        buffer += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buffer += static_cast<char>(value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reads an unsigned integer written by AppendVarint.
+///
+/// @pre None.
+/// @post pos is past the encoded value.
+/// @param pos The start of the encoded value.
+/// @param end The end of the buffer.
+/// @param value Set to the decoded value.
+/// @return False if the buffer ends inside the value.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+inline bool ReadVarint(const char *& pos, const char * end,
+        boost::uint64_t & value)
+{
+    value = 0;
+    for( unsigned int shift = 0; pos < end && shift < 64; shift += 7 )
+    {
+        unsigned char byte = static_cast<unsigned char>(*pos++);
+        value |= static_cast<boost::uint64_t>(byte & 0x7F) << shift;
+        if( (byte & 0x80) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Turns the columns of a chunk back into rows.
+///
+/// @pre The values of the file are floats.
+/// @post None.
+/// @param pos The start of the chunk, after its block.
+/// @param end The end of the chunk.
+/// @param width The number of columns of the stream of the chunk.
+/// @param header Set to the header of the chunk.
+/// @param times Set to the time of each row.
+/// @param values Set to the rows one after another.
+/// @return False if the chunk is malformed.
+///
+/// @limitations None.
+////////////////////////////////////////////////////////////////////////////////
+inline bool DecodeChunk(const char * pos, const char * end, std::size_t width,
+        STelemetryChunk & header, std::vector<boost::uint64_t> & times,
+        std::vector<float> & values)
+{
+    if( end - pos < static_cast<std::ptrdiff_t>(sizeof(header)) )
+    {
+        return false;
+    }
+    std::memcpy(&header, pos, sizeof(header));
+    pos += sizeof(header);
+
+    std::size_t rows = header.rows;
+    times.assign(rows, header.first_time);
+    for( std::size_t r = 1; r < rows; r++ )
+    {
+        boost::uint64_t delta;
+        if( !ReadVarint(pos, end, delta) )
+        {
+            return false;
+        }
+        times[r] = times[r-1] + delta;
+    }
+
+    std::size_t bitmap = (rows + 7) / 8;
+    values.resize(rows * width);
+    for( std::size_t c = 0; c < width; c++ )
+    {
+        if( end - pos < static_cast<std::ptrdiff_t>(bitmap) )
+        {
+            return false;
+        }
+        const char * changed = pos;
+        pos += bitmap;
+        for( std::size_t r = 0; r < rows; r++ )
+        {
+            if( changed[r / 8] & (1 << (r % 8)) )
+            {
+                if( end - pos < static_cast<std::ptrdiff_t>(sizeof(float)) )
+                {
+                    return false;
+                }
+                std::memcpy(&values[r * width + c], pos, sizeof(float));
+                pos += sizeof(float);
+            }
+            else if( r > 0 )
+            {
+                values[r * width + c] = values[(r-1) * width + c];
+            }
+            else
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace device
+} // namespace broker
+} // namespace freedm
+
+#endif // TELEMETRY_FORMAT_HPP
@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CGroupHierarchy.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Feeder segments and coordinator reports of hierarchical groups
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CGroupHierarchy.hpp"
+
+#include "CLogger.hpp"
+
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+
+namespace freedm {
+
+namespace broker {
+
+namespace gm {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Check periods a report is kept without being refreshed
+const unsigned int REPORT_LIFETIME = 3;
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::CGroupHierarchy
+/// @description Creates a hierarchy that knows no segments.
+/// @pre None
+/// @post Load must be called before the segments are used.
+/// @param self The UUID of this node.
+///////////////////////////////////////////////////////////////////////////////
+CGroupHierarchy::CGroupHierarchy(const std::string& self)
+    : m_self(self)
+    , m_own(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::Load
+/// @description Splits the physical topology into its feeder segments.
+/// @pre The physical topology is available.
+/// @post The segments and the segment of this node are known.
+/// @return False if this node is not in the physical topology.
+///////////////////////////////////////////////////////////////////////////////
+bool CGroupHierarchy::Load()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_segments = CPhysicalTopology::Instance().Segments();
+    m_segmentof.clear();
+    m_reports.clear();
+    for(std::size_t i = 0; i < m_segments.size(); i++)
+    {
+        BOOST_FOREACH(const std::string& uuid, m_segments[i])
+        {
+            m_segmentof[uuid] = i;
+        }
+    }
+    std::map<std::string, std::size_t>::const_iterator it = m_segmentof.find(m_self);
+    if(it == m_segmentof.end())
+    {
+        return false;
+    }
+    m_own = it->second;
+    LOG_NOTICE(Logger) << "Segment " << m_own << " of " << m_segments.size()
+            << " has " << m_segments[m_own].size() << " nodes" << std::endl;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::InSegment
+/// @description Tells whether a node takes part in the segment group of this
+///     node.
+/// @pre Load succeeded.
+/// @post None
+/// @param uuid The node to look up.
+/// @return True if the node is in the segment of this node.
+///////////////////////////////////////////////////////////////////////////////
+bool CGroupHierarchy::InSegment(const std::string& uuid) const
+{
+    return m_segments.size() > m_own && m_segments[m_own].count(uuid) > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::Contacts
+/// @description Picks one node per other segment to report to: the segment
+///     coordinator if it has reported, else the node of the segment with the
+///     highest priority, which is the most likely to coordinate it. A node that
+///     is not a coordinator forwards the report to its own.
+/// @pre Load succeeded.
+/// @post None
+/// @return The UUIDs of the nodes to report to.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<std::string> CGroupHierarchy::Contacts() const
+{
+    std::vector<std::string> contacts;
+    for(std::size_t i = 0; i < m_segments.size(); i++)
+    {
+        if(i == m_own || m_segments[i].empty())
+        {
+            continue;
+        }
+        ReportMap::const_iterator it = m_reports.find(i);
+        if(it != m_reports.end())
+        {
+            contacts.push_back(it->second.coordinator);
+            continue;
+        }
+        std::string best = *m_segments[i].begin();
+        BOOST_FOREACH(const std::string& uuid, m_segments[i])
+        {
+            if(Outranks(uuid, best))
+            {
+                best = uuid;
+            }
+        }
+        contacts.push_back(best);
+    }
+    return contacts;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::Record
+/// @description Replaces the report of the segment of the coordinator.
+/// @pre Load succeeded.
+/// @post The report is kept unless it comes from this segment or a node
+///     outside the topology.
+/// @param report The report that was received.
+///////////////////////////////////////////////////////////////////////////////
+void CGroupHierarchy::Record(const SReport& report)
+{
+    std::map<std::string, std::size_t>::const_iterator it =
+        m_segmentof.find(report.coordinator);
+    if(it == m_segmentof.end() || it->second == m_own)
+    {
+        LOG_DEBUG(Logger) << "Ignored segment report from " << report.coordinator
+                << std::endl;
+        return;
+    }
+    SReport& kept = m_reports[it->second];
+    kept = report;
+    kept.age = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::Tick
+/// @description Ages the reports, dropping those of segments whose
+///     coordinator has not reported for REPORT_LIFETIME check periods.
+/// @pre None
+/// @post The stale reports are removed.
+///////////////////////////////////////////////////////////////////////////////
+void CGroupHierarchy::Tick()
+{
+    ReportMap::iterator it = m_reports.begin();
+    while(it != m_reports.end())
+    {
+        if(++it->second.age > REPORT_LIFETIME)
+        {
+            LOG_NOTICE(Logger) << "Segment coordinator " << it->second.coordinator
+                    << " stopped reporting" << std::endl;
+            m_reports.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::ChooseTop
+/// @description Every segment coordinator makes the same choice from the same
+///     reports, so they agree on the top coordinator without an election.
+/// @pre None
+/// @post None
+/// @param reachable The nodes physically reachable from this node.
+/// @return The UUID of the reachable coordinator with the highest priority,
+///     which may be this node.
+///////////////////////////////////////////////////////////////////////////////
+std::string CGroupHierarchy::ChooseTop(
+    const CPhysicalTopology::VertexSet& reachable) const
+{
+    std::string top = m_self;
+    BOOST_FOREACH(const ReportMap::value_type& entry, m_reports)
+    {
+        const std::string& uuid = entry.second.coordinator;
+        if(reachable.count(uuid) > 0 && Outranks(uuid, top))
+        {
+            top = uuid;
+        }
+    }
+    return top;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::Priority
+/// @description Hashes a UUID the same way the Premerge wait does.
+/// @pre None
+/// @post None
+/// @param uuid The node to rank.
+/// @return The priority of the node.
+///////////////////////////////////////////////////////////////////////////////
+std::size_t CGroupHierarchy::Priority(const std::string& uuid)
+{
+    boost::hash<std::string> string_hash;
+    return string_hash(uuid);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CGroupHierarchy::Outranks
+/// @description Orders nodes by priority, breaking ties by UUID.
+/// @pre None
+/// @post None
+/// @return True if a has a higher priority than b.
+///////////////////////////////////////////////////////////////////////////////
+bool CGroupHierarchy::Outranks(const std::string& a, const std::string& b)
+{
+    std::size_t pa = Priority(a);
+    std::size_t pb = Priority(b);
+    return pa > pb || (pa == pb && a > b);
+}
+
+} // namespace gm
+
+} // namespace broker
+
+} // namespace freedm
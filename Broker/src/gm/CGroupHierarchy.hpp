@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CGroupHierarchy.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Feeder segments and coordinator reports of hierarchical groups
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CGROUPHIERARCHY_HPP
+#define CGROUPHIERARCHY_HPP
+
+#include "CPhysicalTopology.hpp"
+#include "PeerSets.hpp"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace freedm {
+
+namespace broker {
+
+namespace gm {
+
+/// Tracks the feeder segments for hierarchical group management.
+///
+/// Each segment elects its own coordinator with the invitation algorithm.
+/// The segment coordinators then report their groups to one another, and the
+/// one with the highest priority among those physically reachable becomes the
+/// top coordinator and publishes the combined group. The class only keeps
+/// state; GMAgent sends and receives the reports.
+class CGroupHierarchy
+{
+public:
+    /// What a segment coordinator last reported about its group
+    struct SReport
+    {
+        /// The coordinator of the segment group
+        std::string coordinator;
+        /// The group identifier of the segment group
+        unsigned int group;
+        /// Every node of the segment group, the coordinator included
+        PeerSet members;
+        /// The FID states known in the segment
+        CPhysicalTopology::FIDState fids;
+        /// Check periods since the report was received
+        unsigned int age;
+    };
+
+    /// Reports keyed by the index of the segment they came from
+    typedef std::map<std::size_t, SReport> ReportMap;
+
+    /// Creates an empty hierarchy for this node
+    explicit CGroupHierarchy(const std::string& self);
+
+    /// Reads the segments from the physical topology
+    bool Load();
+
+    /// True if the node is in the same segment as this node
+    bool InSegment(const std::string& uuid) const;
+
+    /// Chooses the node each other segment is reported to
+    std::vector<std::string> Contacts() const;
+
+    /// Keeps a report from the coordinator of another segment
+    void Record(const SReport& report);
+
+    /// Ends a check period and forgets the reports that stopped coming
+    void Tick();
+
+    /// Gets the reports of the other segments
+    const ReportMap& GetReports() const { return m_reports; }
+
+    /// Chooses the top coordinator among the reachable segment coordinators
+    std::string ChooseTop(const CPhysicalTopology::VertexSet& reachable) const;
+
+    /// Gets the election priority of a node
+    static std::size_t Priority(const std::string& uuid);
+
+private:
+    /// True if a has a higher priority than b
+    static bool Outranks(const std::string& a, const std::string& b);
+
+    /// The UUID of this node
+    std::string m_self;
+    /// The nodes of each segment
+    std::vector<CPhysicalTopology::VertexSet> m_segments;
+    /// The segment of each node
+    std::map<std::string, std::size_t> m_segmentof;
+    /// The segment of this node
+    std::size_t m_own;
+    /// The latest report of each other segment
+    ReportMap m_reports;
+};
+
+} // namespace gm
+
+} // namespace broker
+
+} // namespace freedm
+
+#endif // CGROUPHIERARCHY_HPP
@@ -0,0 +1,407 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSwimMembership.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Membership state of the SWIM failure detector
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CSwimMembership.hpp"
+
+#include "CLogger.hpp"
+
+#include <algorithm>
+
+namespace freedm {
+
+namespace broker {
+
+namespace gm {
+
+namespace {
+
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Probe periods per Scale() a node stays suspected before it is dead
+const unsigned int SUSPECT_PERIODS = 3;
+
+/// Messages per Scale() that carry each update
+const unsigned int RETRANSMIT_MULTIPLIER = 3;
+
+/// Largest number of updates piggybacked on one message
+const std::size_t MAX_PIGGYBACK = 6;
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::CSwimMembership
+/// @description Creates the membership with no other nodes.
+/// @pre None
+/// @post This node is alive at the given incarnation.
+/// @param self The UUID of this node.
+/// @param incarnation The starting incarnation. It should be larger than the
+///     incarnation of any earlier run of this node.
+///////////////////////////////////////////////////////////////////////////////
+CSwimMembership::CSwimMembership(const std::string& self, unsigned int incarnation)
+    : m_self(self)
+    , m_incarnation(incarnation)
+    , m_next(0)
+    , m_period(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Add
+/// @description Adds a node at incarnation 0. A node that is already known
+///     keeps its state.
+/// @pre None
+/// @post The node is known. It is probed from the next round.
+/// @param uuid The node to add.
+///////////////////////////////////////////////////////////////////////////////
+void CSwimMembership::Add(const std::string& uuid)
+{
+    if(uuid == m_self || m_members.count(uuid) > 0)
+    {
+        return;
+    }
+    SMember member;
+    member.state = ALIVE;
+    member.incarnation = 0;
+    member.suspected = m_period;
+    m_members.insert(std::make_pair(uuid, member));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::NextTarget
+/// @description Picks the next node of the current round. When the round is
+///     over the nodes that are not dead are shuffled into a new round.
+/// @pre None
+/// @post The target is taken from the round.
+/// @param target Set to the node to probe.
+/// @return False if there is no node to probe.
+///////////////////////////////////////////////////////////////////////////////
+bool CSwimMembership::NextTarget(std::string& target)
+{
+    for(int pass = 0; pass < 2; pass++)
+    {
+        while(m_next < m_order.size())
+        {
+            target = m_order[m_next++];
+            if(!IsDead(target))
+            {
+                return true;
+            }
+        }
+        m_order.clear();
+        m_next = 0;
+        std::map<std::string, SMember>::const_iterator it;
+        for(it = m_members.begin(); it != m_members.end(); it++)
+        {
+            if(it->second.state != DEAD)
+            {
+                m_order.push_back(it->first);
+            }
+        }
+        std::random_shuffle(m_order.begin(), m_order.end());
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::PickHelpers
+/// @description Picks random nodes, other than the target, that are not dead.
+/// @pre None
+/// @post None
+/// @param target The node that did not answer its probe.
+/// @param count The number of helpers wanted.
+/// @return Up to count nodes.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<std::string> CSwimMembership::PickHelpers(const std::string& target,
+    std::size_t count) const
+{
+    std::vector<std::string> helpers;
+    std::map<std::string, SMember>::const_iterator it;
+    for(it = m_members.begin(); it != m_members.end(); it++)
+    {
+        if(it->first != target && it->second.state != DEAD)
+        {
+            helpers.push_back(it->first);
+        }
+    }
+    std::random_shuffle(helpers.begin(), helpers.end());
+    if(helpers.size() > count)
+    {
+        helpers.resize(count);
+    }
+    return helpers;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Suspect
+/// @description Marks an alive node as suspected and spreads the suspicion.
+///     The node can refute it with a higher incarnation.
+/// @pre None
+/// @post The node is suspected unless it is unknown or dead.
+/// @param uuid The node that did not answer.
+///////////////////////////////////////////////////////////////////////////////
+void CSwimMembership::Suspect(const std::string& uuid)
+{
+    std::map<std::string, SMember>::iterator it = m_members.find(uuid);
+    if(it == m_members.end() || it->second.state != ALIVE)
+    {
+        return;
+    }
+    LOG_NOTICE(Logger) << "Suspecting " << uuid << std::endl;
+    SUpdate update;
+    update.uuid = uuid;
+    update.incarnation = it->second.incarnation;
+    update.state = SUSPECT;
+    Apply(update);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Tick
+/// @description Moves to the next probe period. Nodes suspected for
+///     SUSPECT_PERIODS times Scale() periods are declared dead.
+/// @pre Called once per probe period.
+/// @post The nodes that timed out are dead and reported by TakeDeaths.
+///////////////////////////////////////////////////////////////////////////////
+void CSwimMembership::Tick()
+{
+    m_period++;
+    unsigned int timeout = SUSPECT_PERIODS * Scale();
+    std::map<std::string, SMember>::iterator it;
+    for(it = m_members.begin(); it != m_members.end(); it++)
+    {
+        if(it->second.state == SUSPECT && m_period - it->second.suspected >= timeout)
+        {
+            SUpdate update;
+            update.uuid = it->first;
+            update.incarnation = it->second.incarnation;
+            update.state = DEAD;
+            Apply(update);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Apply
+/// @description Merges an update. A higher incarnation overrides what is
+///     known; at the same incarnation a suspicion overrides alive and a
+///     death overrides both. An update that suspects this node is refuted by
+///     raising the incarnation of this node above it.
+/// @pre None
+/// @post A change is spread to other nodes with the next messages.
+/// @param update The update to merge.
+/// @return True if the update changed what this node believes.
+///////////////////////////////////////////////////////////////////////////////
+bool CSwimMembership::Apply(const SUpdate& update)
+{
+    if(update.uuid == m_self)
+    {
+        if(update.state != ALIVE && update.incarnation >= m_incarnation)
+        {
+            m_incarnation = update.incarnation + 1;
+            LOG_NOTICE(Logger) << "Refuting suspicion, incarnation "
+                << m_incarnation << std::endl;
+            SUpdate alive;
+            alive.uuid = m_self;
+            alive.incarnation = m_incarnation;
+            alive.state = ALIVE;
+            Queue(alive);
+            return true;
+        }
+        return false;
+    }
+
+    std::map<std::string, SMember>::iterator it = m_members.find(update.uuid);
+    if(it == m_members.end())
+    {
+        SMember member;
+        member.state = ALIVE;
+        member.incarnation = 0;
+        member.suspected = m_period;
+        it = m_members.insert(std::make_pair(update.uuid, member)).first;
+        if(update.state == ALIVE && update.incarnation == 0)
+        {
+            return false;
+        }
+    }
+
+    SMember& member = it->second;
+    bool changed = false;
+    switch(update.state)
+    {
+        case ALIVE:
+            changed = update.incarnation > member.incarnation;
+            break;
+        case SUSPECT:
+            changed = update.incarnation > member.incarnation ||
+                (update.incarnation == member.incarnation && member.state == ALIVE);
+            break;
+        case DEAD:
+            changed = member.state != DEAD && update.incarnation >= member.incarnation;
+            break;
+    }
+    if(!changed)
+    {
+        return false;
+    }
+
+    if(update.state == DEAD)
+    {
+        LOG_NOTICE(Logger) << update.uuid << " has failed" << std::endl;
+        m_deaths.push_back(update.uuid);
+    }
+    else if(member.state == DEAD)
+    {
+        LOG_NOTICE(Logger) << update.uuid << " has recovered" << std::endl;
+    }
+    if(update.state == SUSPECT && member.state != SUSPECT)
+    {
+        member.suspected = m_period;
+    }
+    member.state = update.state;
+    member.incarnation = update.incarnation;
+    Queue(update);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Piggyback
+/// @description Picks the least spread updates for the next message. An
+///     update is dropped once RETRANSMIT_MULTIPLIER times Scale() messages
+///     have carried it, which is enough for it to reach every node with high
+///     probability.
+/// @pre None
+/// @post The picked updates count as sent once more.
+/// @return Up to MAX_PIGGYBACK updates.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<CSwimMembership::SUpdate> CSwimMembership::Piggyback()
+{
+    std::vector<SUpdate> updates;
+    unsigned int limit = RETRANSMIT_MULTIPLIER * Scale();
+    m_gossip.sort(&CSwimMembership::LessSent);
+    std::list<SGossip>::iterator it = m_gossip.begin();
+    while(it != m_gossip.end() && updates.size() < MAX_PIGGYBACK)
+    {
+        updates.push_back(it->update);
+        it->sent++;
+        if(it->sent >= limit)
+        {
+            m_gossip.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+    return updates;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::TakeDeaths
+/// @description Gets the nodes that were declared dead, so the group can
+///     react to them.
+/// @pre None
+/// @post The list of new deaths is empty.
+/// @return The nodes declared dead since the last call.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<std::string> CSwimMembership::TakeDeaths()
+{
+    std::vector<std::string> deaths;
+    deaths.swap(m_deaths);
+    return deaths;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::IsDead
+/// @description Checks if a node is believed to have failed. A suspected
+///     node still counts as alive.
+/// @pre None
+/// @post None
+/// @param uuid The node to check.
+/// @return True if the node is known and dead.
+///////////////////////////////////////////////////////////////////////////////
+bool CSwimMembership::IsDead(const std::string& uuid) const
+{
+    std::map<std::string, SMember>::const_iterator it = m_members.find(uuid);
+    return it != m_members.end() && it->second.state == DEAD;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Queue
+/// @description Starts spreading an update. An older update about the same
+///     node is no longer spread.
+/// @pre None
+/// @post The update is sent with the next messages.
+/// @param update The update to spread.
+///////////////////////////////////////////////////////////////////////////////
+void CSwimMembership::Queue(const SUpdate& update)
+{
+    std::list<SGossip>::iterator it = m_gossip.begin();
+    while(it != m_gossip.end())
+    {
+        if(it->update.uuid == update.uuid)
+        {
+            m_gossip.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+    SGossip gossip;
+    gossip.update = update;
+    gossip.sent = 0;
+    m_gossip.push_front(gossip);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::Scale
+/// @description Computes the base 2 logarithm of the number of nodes, rounded
+///     up, which sets how long suspicions and updates last.
+/// @pre None
+/// @post None
+/// @return At least 1.
+///////////////////////////////////////////////////////////////////////////////
+unsigned int CSwimMembership::Scale() const
+{
+    unsigned int scale = 1;
+    for(std::size_t n = m_members.size() + 1; n > 2; n = (n + 1) / 2)
+    {
+        scale++;
+    }
+    return scale;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CSwimMembership::LessSent
+/// @description Compares two updates by how many messages carried them.
+/// @pre None
+/// @post None
+/// @return True if a was sent fewer times than b.
+///////////////////////////////////////////////////////////////////////////////
+bool CSwimMembership::LessSent(const SGossip& a, const SGossip& b)
+{
+    return a.sent < b.sent;
+}
+
+} // namespace gm
+
+} // namespace broker
+
+} // namespace freedm
@@ -0,0 +1,150 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CSwimMembership.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Membership state of the SWIM failure detector
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSWIMMEMBERSHIP_HPP
+#define CSWIMMEMBERSHIP_HPP
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace freedm {
+
+namespace broker {
+
+namespace gm {
+
+/// Tracks which nodes are alive for the SWIM failure detector.
+///
+/// The class only keeps state. GMAgent sends the probes and passes the
+/// outcomes and the piggybacked updates in. Each node is probed in a random
+/// order, once per round, so a failure is noticed within a bounded number of
+/// probe periods whatever the size of the system.
+class CSwimMembership
+{
+public:
+    /// What a node is believed to be
+    enum EState { ALIVE = 0, SUSPECT = 1, DEAD = 2 };
+
+    /// A membership change passed between nodes
+    struct SUpdate
+    {
+        /// The node the update is about
+        std::string uuid;
+        /// The incarnation of the node the update is about
+        unsigned int incarnation;
+        /// The state of the node
+        EState state;
+    };
+
+    /// Creates the membership of this node
+    CSwimMembership(const std::string& self, unsigned int incarnation);
+
+    /// Adds a node that is believed alive, if it is new
+    void Add(const std::string& uuid);
+
+    /// Gets the number of other known nodes, dead or alive
+    std::size_t Size() const { return m_members.size(); }
+
+    /// Chooses the node to probe in the next probe period
+    bool NextTarget(std::string& target);
+
+    /// Chooses the nodes asked to probe a target that did not answer
+    std::vector<std::string> PickHelpers(const std::string& target,
+        std::size_t count) const;
+
+    /// Suspects a node this node could not reach
+    void Suspect(const std::string& uuid);
+
+    /// Ends a probe period and declares dead the nodes suspected too long
+    void Tick();
+
+    /// Merges an update received from another node
+    bool Apply(const SUpdate& update);
+
+    /// Gets the updates to piggyback on the next message
+    std::vector<SUpdate> Piggyback();
+
+    /// Gets the nodes declared dead since the last call
+    std::vector<std::string> TakeDeaths();
+
+    /// True if the node is believed to have failed
+    bool IsDead(const std::string& uuid) const;
+
+    /// Gets the incarnation of this node
+    unsigned int GetIncarnation() const { return m_incarnation; }
+
+private:
+    /// What this node knows about another node
+    struct SMember
+    {
+        /// The believed state
+        EState state;
+        /// The highest known incarnation
+        unsigned int incarnation;
+        /// The probe period the suspicion started in
+        unsigned int suspected;
+    };
+
+    /// An update waiting to be piggybacked
+    struct SGossip
+    {
+        /// The update
+        SUpdate update;
+        /// How many messages carried it
+        unsigned int sent;
+    };
+
+    /// Starts spreading an update, replacing older ones about the same node
+    void Queue(const SUpdate& update);
+
+    /// Grows with the logarithm of the number of nodes
+    unsigned int Scale() const;
+
+    /// Orders the gossip so the least sent updates come first
+    static bool LessSent(const SGossip& a, const SGossip& b);
+
+    /// The UUID of this node
+    std::string m_self;
+    /// The incarnation of this node, raised to refute a suspicion
+    unsigned int m_incarnation;
+    /// Every other known node
+    std::map<std::string, SMember> m_members;
+    /// The probe order of the current round
+    std::vector<std::string> m_order;
+    /// The position of the next probe in m_order
+    std::size_t m_next;
+    /// The current probe period
+    unsigned int m_period;
+    /// The updates being spread
+    std::list<SGossip> m_gossip;
+    /// The nodes declared dead since the last TakeDeaths
+    std::vector<std::string> m_deaths;
+};
+
+} // namespace gm
+
+} // namespace broker
+
+} // namespace freedm
+
+#endif // CSWIMMEMBERSHIP_HPP
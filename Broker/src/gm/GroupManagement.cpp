@@ -28,18 +28,25 @@
 #include "CConnectionManager.hpp"
 #include "CGlobalPeerList.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CPeerBitSet.hpp"
 #include "SRemoteHost.hpp"
 #include "CDeviceManager.hpp"
+#include "CDispatcher.hpp"
 #include "CTimings.hpp"
+#include "CVirtualClock.hpp"
 #include "CDevice.hpp"
 #include "Messages.hpp"
 #include "CPhysicalTopology.hpp"
 #include "FreedmExceptions.hpp"
+#include "CWarmState.hpp"
 
 #include <algorithm>
+#include <ctime>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <list>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -53,6 +60,7 @@
 #include <boost/foreach.hpp>
 #include <boost/function.hpp>
 #include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/range/adaptor/map.hpp>
 
 namespace freedm {
@@ -66,6 +74,44 @@ namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Elections this node has started
+CCounter& ElectionsMetric = CMetrics::Instance().GetCounter(
+    "dgi_gm_elections_total", "Elections started by group management");
+
+/// Groups this node has joined or formed
+CCounter& GroupChangesMetric = CMetrics::Instance().GetCounter(
+    "dgi_gm_group_changes_total", "Groups joined or formed by this node");
+
+/// Members of the group of this node
+CGauge& GroupSizeMetric = CMetrics::Instance().GetGauge(
+    "dgi_gm_group_members", "Members of the group of this node, itself included");
+
+/// Groups this node formed as the standby of a failed coordinator
+CCounter& TakeoversMetric = CMetrics::Instance().GetCounter(
+    "dgi_gm_standby_takeovers_total",
+    "Groups formed by this node as the standby of a failed coordinator");
+
+/// Milliseconds a planned phase must differ by before the phases are resized
+const unsigned int PHASE_CHANGE_THRESHOLD = 20;
+
+/// Full rounds the group is given to receive a phase schedule
+const unsigned int PHASE_SCHEDULE_LEAD = 2;
+
+/// Nodes asked to probe a target that did not acknowledge a probe
+const std::size_t SWIM_INDIRECT_PROBES = 3;
+
+/// Length of a SWIM probe period, as a multiple of the acknowledgement timeout
+const int SWIM_PERIOD_FACTOR = 3;
+
+/// Membership versions kept so each module of a node can reuse them
+const std::size_t MEMBERSHIP_CACHE_SIZE = 8;
+
+/// The latest membership snapshots built on this node, newest first
+std::list<MembershipSnapshot> RecentMemberships;
+
+/// Guards RecentMemberships for modules running on other threads
+boost::mutex MembershipMutex;
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -79,11 +125,16 @@ GMAgent::GMAgent()
     : CHECK_TIMEOUT(boost::posix_time::not_a_date_time),
       TIMEOUT_TIMEOUT(boost::posix_time::not_a_date_time),
       FID_TIMEOUT(boost::posix_time::not_a_date_time),
-      AYC_RESPONSE_TIMEOUT(boost::posix_time::milliseconds(CTimings::Get("GM_AYC_RESPONSE_TIMEOUT"))),
-      AYT_RESPONSE_TIMEOUT(boost::posix_time::milliseconds(CTimings::Get("GM_AYT_RESPONSE_TIMEOUT"))),
-      INVITE_RESPONSE_TIMEOUT(boost::posix_time::milliseconds(CTimings::Get("GM_INVITE_RESPONSE_TIMEOUT")))
+      AYC_RESPONSE_TIMEOUT(CTimings::GetDuration(CTimings::GM_AYC_RESPONSE_TIMEOUT)),
+      AYT_RESPONSE_TIMEOUT(CTimings::GetDuration(CTimings::GM_AYT_RESPONSE_TIMEOUT)),
+      INVITE_RESPONSE_TIMEOUT(CTimings::GetDuration(CTimings::GM_INVITE_RESPONSE_TIMEOUT)),
+      SWIM_ACK_TIMEOUT(AYT_RESPONSE_TIMEOUT),
+      SWIM_PROBE_PERIOD(AYT_RESPONSE_TIMEOUT * SWIM_PERIOD_FACTOR),
+      // A restarted node starts at a higher incarnation than its last run
+      m_swim(GetUUID(), static_cast<unsigned int>(std::time(0))),
+      m_hierarchy(GetUUID())
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     AddPeer(GetMe());
     m_groupsformed = 0;
     m_groupsbroken = 0;
@@ -91,9 +142,31 @@ GMAgent::GMAgent()
     m_groupsjoined = 0;
     m_membership = 0;
     m_membershipchecks = 0;
+    m_phaseeffective = 0;
+    m_phaseversion = 0;
+    m_timingsversion = CTimings::GetVersion();
+    m_swimknown = 0;
+    m_pushedgroup = 0;
+    m_peerepoch = 0;
+    m_probeseq = 0;
+    m_probing = false;
+    m_probeacked = false;
+    m_hierarchical = false;
+    m_standbywait = false;
+    m_top = GetUUID();
     m_timer = CBroker::Instance().AllocateTimer("gm");
     m_fidtimer = CBroker::Instance().AllocateTimer("gm");
+    m_swimtimer = CBroker::Instance().AllocateTimer("gm");
     m_GrpCounter = rand();
+    // a peer waiting on these should not wait for the group management phase
+    CDispatcher::Instance().RegisterImmediateHandler("gm.AreYouThereMessage");
+    CDispatcher::Instance().RegisterImmediateHandler("gm.AreYouCoordinatorMessage");
+    // the leader of an election ends it once every invited node accepted
+    CDispatcher::Instance().RegisterImmediateHandler("gm.AcceptMessage");
+    // the FID states are read when one changes, not on every check
+    m_localfids = ReadLocalFids();
+    device::CDeviceManager::Instance().SubscribeEach("gm", "Fid", "state",
+        boost::bind(&GMAgent::HandleFidChange, this, _1));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -104,7 +177,7 @@ GMAgent::GMAgent()
 ///////////////////////////////////////////////////////////////////////////////
 GMAgent::~GMAgent()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     m_UpNodes.clear();
     m_Coordinators.clear();
     m_AYCResponse.clear();
@@ -120,11 +193,11 @@ GMAgent::~GMAgent()
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(msg->has_group_management_message())
     {
-        GroupManagementMessage gmm = msg->group_management_message();
+        const GroupManagementMessage& gmm = msg->group_management_message();
         if(gmm.has_invite_message())
         {
             HandleInvite(gmm.invite_message(),peer);
@@ -157,14 +230,30 @@ void GMAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg,
         {
             HandlePeerList(gmm.peer_list_message(),peer);
         }
+        else if(gmm.has_ping_message())
+        {
+            HandlePing(gmm.ping_message(),peer);
+        }
+        else if(gmm.has_ping_request_message())
+        {
+            HandlePingRequest(gmm.ping_request_message(),peer);
+        }
+        else if(gmm.has_ping_ack_message())
+        {
+            HandlePingAck(gmm.ping_ack_message(),peer);
+        }
+        else if(gmm.has_segment_report_message())
+        {
+            HandleSegmentReport(gmm.segment_report_message(),peer);
+        }
         else
         {
-            Logger.Warn << "Dropped gm message of unexpected type:\n" << msg->DebugString();
+            LOG_WARN(Logger) << "Dropped gm message of unexpected type:\n" << msg->DebugString();
         }
     }
     else
     {
-        Logger.Warn << "Dropped message of unexpected type:\n" << msg->DebugString();
+        LOG_WARN(Logger) << "Dropped message of unexpected type:\n" << msg->DebugString();
     }
 }
 
@@ -176,15 +265,26 @@ void GMAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg,
 /// @return A GroupManagementMessage with the contents of an Are You Coordinator Message.
 /// @limitations: Can only author messages from this node.
 ///////////////////////////////////////////////////////////////////////////////
-ModuleMessage GMAgent::AreYouCoordinator()
+CSerializedMessage::Pointer GMAgent::AreYouCoordinator()
 {
     static google::protobuf::uint32 id = 0;
-    GroupManagementMessage gmm;
-    AreYouCoordinatorMessage* aycm = gmm.mutable_are_you_coordinator_message();
-    aycm->set_sequence_no(id);
-    Logger.Debug<<"Generated AYC : "<<id<<std::endl;
-    id++;
-    return PrepareForSending(gmm);
+    std::string key = boost::lexical_cast<std::string>(CBroker::Instance().GetDigestEpoch());
+    if(!m_ayctemplate.message || m_ayctemplate.key != key)
+    {
+        // Only the sequence number and the load balance digest change
+        GroupManagementMessage gmm;
+        gmm.mutable_are_you_coordinator_message()->set_sequence_no(0);
+        ModuleMessage mm = PrepareForSending(gmm);
+        m_ayctemplate.key = boost::lexical_cast<std::string>(
+            CBroker::Instance().AttachStateDigest(mm));
+        m_ayctemplate.message.reset(new CMessageTemplate(mm,
+            boost::assign::list_of<int>
+                (ModuleMessage::kGroupManagementMessageFieldNumber)
+                (GroupManagementMessage::kAreYouCoordinatorMessageFieldNumber)
+                (AreYouCoordinatorMessage::kSequenceNoFieldNumber)));
+    }
+    LOG_DEBUG(Logger)<<"Generated AYC : "<<id<<std::endl;
+    return m_ayctemplate.message->Instantiate(id++);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -216,8 +316,16 @@ ModuleMessage GMAgent::Invitation()
 /// @param seq sequence number? (?)
 /// @return A GroupManagementMessage with the contents of a Response message
 ///////////////////////////////////////////////////////////////////////////////
-ModuleMessage GMAgent::AreYouCoordinatorResponse(std::string payload,int seq)
+CSerializedMessage::Pointer GMAgent::AreYouCoordinatorResponse(std::string payload,int seq)
 {
+    SMessageTemplate& cached = m_aycresponse[payload == "yes" ? 0 : 1];
+    std::string key = payload + "\n" + Coordinator() + "\n"
+        + boost::lexical_cast<std::string>(CBroker::Instance().GetDigestEpoch());
+    if(m_localfids.empty() && cached.message && cached.key == key)
+    {
+        return cached.message->Instantiate(static_cast<google::protobuf::uint32>(seq));
+    }
+
     GroupManagementMessage gmm;
     AreYouCoordinatorResponseMessage* aycrm = gmm.mutable_are_you_coordinator_response_message();
     aycrm->set_payload(payload);
@@ -225,14 +333,26 @@ ModuleMessage GMAgent::AreYouCoordinatorResponse(std::string payload,int seq)
     aycrm->set_leader_host(GetPeer(Coordinator()).GetHostname());
     aycrm->set_leader_port(GetPeer(Coordinator()).GetPort());
     aycrm->set_sequence_no(seq);
-    std::set<device::CDevice::Pointer> attachedFIDs = device::CDeviceManager::Instance().GetDevicesOfType("Fid");
-    BOOST_FOREACH(device::CDevice::Pointer ptr, attachedFIDs)
+    BOOST_FOREACH(const CPhysicalTopology::FIDState::value_type& fid, m_localfids)
     {
         FidStateMessage *fsm = aycrm->add_fid_state();
-        fsm->set_deviceid(ptr->GetID());
-        fsm->set_state((bool) ptr->GetState("state"));
+        fsm->set_deviceid(fid.first);
+        fsm->set_state(fid.second);
     }
-    return PrepareForSending(gmm);
+    ModuleMessage mm = PrepareForSending(gmm);
+    google::protobuf::uint64 epoch = CBroker::Instance().AttachStateDigest(mm);
+    if(!m_localfids.empty())
+    {
+        // The FID states can change between responses
+        return CSerializedMessage::Pointer(new CSerializedMessage(mm));
+    }
+    cached.key = payload + "\n" + Coordinator() + "\n" + boost::lexical_cast<std::string>(epoch);
+    cached.message.reset(new CMessageTemplate(mm,
+        boost::assign::list_of<int>
+            (ModuleMessage::kGroupManagementMessageFieldNumber)
+            (GroupManagementMessage::kAreYouCoordinatorResponseMessageFieldNumber)
+            (AreYouCoordinatorResponseMessage::kSequenceNoFieldNumber)));
+    return cached.message->Instantiate(static_cast<google::protobuf::uint32>(seq));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -244,8 +364,17 @@ ModuleMessage GMAgent::AreYouCoordinatorResponse(std::string payload,int seq)
 /// @param seq sequence number? (?)
 /// @return A GroupManagementMessage with the contents of a Response message
 ///////////////////////////////////////////////////////////////////////////////
-ModuleMessage GMAgent::AreYouThereResponse(std::string payload,int seq)
+CSerializedMessage::Pointer GMAgent::AreYouThereResponse(std::string payload,int seq)
 {
+    bool schedule = payload == "yes" && IsCoordinator() && !m_phaselengths.empty();
+    SMessageTemplate& cached = m_aytresponse[payload == "yes" ? 0 : 1];
+    std::string key = payload + "\n" + Coordinator() + "\n"
+        + boost::lexical_cast<std::string>(CBroker::Instance().GetDigestEpoch());
+    if(!schedule && cached.message && cached.key == key)
+    {
+        return cached.message->Instantiate(static_cast<google::protobuf::uint32>(seq));
+    }
+
     GroupManagementMessage gmm;
     AreYouThereResponseMessage* aytrm = gmm.mutable_are_you_there_response_message();
     aytrm->set_payload(payload);
@@ -253,7 +382,30 @@ ModuleMessage GMAgent::AreYouThereResponse(std::string payload,int seq)
     aytrm->set_leader_host(GetPeer(Coordinator()).GetHostname());
     aytrm->set_leader_port(GetPeer(Coordinator()).GetPort());
     aytrm->set_sequence_no(seq);
-    return PrepareForSending(gmm);
+    if(schedule)
+    {
+        PhaseScheduleMessage* psm = aytrm->mutable_phase_schedule();
+        BOOST_FOREACH(unsigned int length, m_phaselengths)
+        {
+            psm->add_phase_length(length);
+        }
+        psm->set_effective(m_phaseeffective);
+        psm->set_version(m_phaseversion);
+    }
+    ModuleMessage mm = PrepareForSending(gmm);
+    google::protobuf::uint64 epoch = CBroker::Instance().AttachStateDigest(mm);
+    if(schedule)
+    {
+        // The schedule can change between responses
+        return CSerializedMessage::Pointer(new CSerializedMessage(mm));
+    }
+    cached.key = payload + "\n" + Coordinator() + "\n" + boost::lexical_cast<std::string>(epoch);
+    cached.message.reset(new CMessageTemplate(mm,
+        boost::assign::list_of<int>
+            (ModuleMessage::kGroupManagementMessageFieldNumber)
+            (GroupManagementMessage::kAreYouThereResponseMessageFieldNumber)
+            (AreYouThereResponseMessage::kSequenceNoFieldNumber)));
+    return cached.message->Instantiate(static_cast<google::protobuf::uint32>(seq));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -278,16 +430,43 @@ ModuleMessage GMAgent::Accept()
 /// @post No Change.
 /// @return A GroupManagementMessage with the contents of an AreYouThere message
 ///////////////////////////////////////////////////////////////////////////////
-ModuleMessage GMAgent::AreYouThere()
+CSerializedMessage::Pointer GMAgent::AreYouThere()
 {
     static int id = 100000;
-    GroupManagementMessage gmm;
-    AreYouThereMessage* aytm = gmm.mutable_are_you_there_message();
-    aytm->set_group_id(m_GroupID);
-    aytm->set_sequence_no(id);
-    Logger.Debug<<"Generated AYT : "<<id<<std::endl;
-    id++;
-    return PrepareForSending(gmm);
+    LOG_DEBUG(Logger)<<"Generated AYT : "<<id<<std::endl;
+    if(CGlobalConfiguration::Instance().GetAdaptivePhases())
+    {
+        // The phase demand is taken fresh for every AYT
+        GroupManagementMessage gmm;
+        AreYouThereMessage* aytm = gmm.mutable_are_you_there_message();
+        aytm->set_group_id(m_GroupID);
+        aytm->set_sequence_no(id++);
+        BOOST_FOREACH(unsigned int busy, CBroker::Instance().TakePhaseDemand())
+        {
+            aytm->add_phase_demand(busy);
+        }
+        ModuleMessage mm = PrepareForSending(gmm);
+        CBroker::Instance().AttachStateDigest(mm);
+        return CSerializedMessage::Pointer(new CSerializedMessage(mm));
+    }
+    std::string key = boost::lexical_cast<std::string>(m_GroupID) + "\n"
+        + boost::lexical_cast<std::string>(CBroker::Instance().GetDigestEpoch());
+    if(!m_ayttemplate.message || m_ayttemplate.key != key)
+    {
+        GroupManagementMessage gmm;
+        AreYouThereMessage* aytm = gmm.mutable_are_you_there_message();
+        aytm->set_group_id(m_GroupID);
+        aytm->set_sequence_no(0);
+        ModuleMessage mm = PrepareForSending(gmm);
+        m_ayttemplate.key = boost::lexical_cast<std::string>(m_GroupID) + "\n"
+            + boost::lexical_cast<std::string>(CBroker::Instance().AttachStateDigest(mm));
+        m_ayttemplate.message.reset(new CMessageTemplate(mm,
+            boost::assign::list_of<int>
+                (ModuleMessage::kGroupManagementMessageFieldNumber)
+                (GroupManagementMessage::kAreYouThereMessageFieldNumber)
+                (AreYouThereMessage::kSequenceNoFieldNumber)));
+    }
+    return m_ayttemplate.message->Instantiate(id++);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -299,8 +478,57 @@ ModuleMessage GMAgent::AreYouThere()
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage GMAgent::PeerList(std::string requester)
 {
-    GroupManagementMessage gmm;
-    PeerListMessage* plm = gmm.mutable_peer_list_message();
+    // Packed in place, the list can be large
+    ModuleMessage mm;
+    mm.set_recipient_module(requester);
+    PeerListMessage* plm =
+        mm.mutable_group_management_message()->mutable_peer_list_message();
+    const PeerSet* members = &m_UpNodes;
+    // The leader answers with the version it pushed, so a module can apply
+    // the changes that follow it.
+    if(IsPublisher() && m_peerepoch != 0 && m_pushedgroup == m_GroupID)
+    {
+        plm->set_group_id(m_GroupID);
+        plm->set_epoch(m_peerepoch);
+        members = &m_pushedpeers;
+    }
+    BOOST_FOREACH(CPeerNode peer, *members | boost::adaptors::map_values)
+    {
+        ConnectedPeerMessage* cpm = plm->add_connected_peer_message();
+        cpm->set_uuid(peer.GetUUID());
+        cpm->set_host(peer.GetHostname());
+        cpm->set_port(peer.GetPort());
+    }
+    ConnectedPeerMessage* cpm = plm->add_connected_peer_message();
+    cpm->set_uuid(GetUUID());
+    cpm->set_host(GetMe().GetHostname());
+    cpm->set_port(GetMe().GetPort());
+    if(IsCoordinator())
+    {
+        std::string standby = ChooseStandby(*members);
+        if(!standby.empty())
+        {
+            plm->set_standby_uuid(standby);
+        }
+    }
+    return mm;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::SegmentList
+/// @description Packs the segment group in a peer list that only group
+///     management reads, since the modules use the combined group.
+/// @pre This node is the coordinator of a segment group.
+/// @post No Change.
+/// @return A GroupManagementMessage with the members of the segment group
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GMAgent::SegmentList()
+{
+    ModuleMessage mm;
+    mm.set_recipient_module("gm");
+    PeerListMessage* plm =
+        mm.mutable_group_management_message()->mutable_peer_list_message();
+    plm->set_segment_only(true);
     BOOST_FOREACH(CPeerNode peer, m_UpNodes | boost::adaptors::map_values)
     {
         ConnectedPeerMessage* cpm = plm->add_connected_peer_message();
@@ -312,7 +540,82 @@ ModuleMessage GMAgent::PeerList(std::string requester)
     cpm->set_uuid(GetUUID());
     cpm->set_host(GetMe().GetHostname());
     cpm->set_port(GetMe().GetPort());
-    return PrepareForSending(gmm, requester);
+    return mm;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::SegmentReport
+/// @description Describes the segment group and the FID states collected in
+///     it to the coordinators of the other segments.
+/// @pre This node is the coordinator of a segment group.
+/// @post No Change.
+/// @return A GroupManagementMessage with the contents of a SegmentReport
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GMAgent::SegmentReport()
+{
+    GroupManagementMessage gmm;
+    SegmentReportMessage* srm = gmm.mutable_segment_report_message();
+    srm->set_coordinator_uuid(GetUUID());
+    srm->set_group_id(m_GroupID);
+    BOOST_FOREACH(CPeerNode peer, m_UpNodes | boost::adaptors::map_values)
+    {
+        ConnectedPeerMessage* cpm = srm->add_member();
+        cpm->set_uuid(peer.GetUUID());
+        cpm->set_host(peer.GetHostname());
+        cpm->set_port(peer.GetPort());
+    }
+    ConnectedPeerMessage* cpm = srm->add_member();
+    cpm->set_uuid(GetUUID());
+    cpm->set_host(GetMe().GetHostname());
+    cpm->set_port(GetMe().GetPort());
+    typedef std::pair< std::string, bool > FIDPair;
+    BOOST_FOREACH(const FIDPair& fid, m_fidstate)
+    {
+        FidStateMessage* fsm = srm->add_fid_state();
+        fsm->set_deviceid(fid.first);
+        fsm->set_state(fid.second);
+    }
+    return PrepareForSending(gmm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PeerListDelta
+/// @description Packs the nodes added to and removed from the group since
+///     the peer list with the base version.
+/// @pre This node is a leader and has pushed a peer list for this group.
+/// @post No Change.
+/// @param base The version the changes apply to.
+/// @param added The nodes that joined the group.
+/// @param removed The nodes that left the group.
+/// @return A GroupManagementMessage with the changes to the group membership
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GMAgent::PeerListDelta(google::protobuf::uint64 base,
+    const PeerSet& added, const PeerSet& removed)
+{
+    ModuleMessage mm;
+    mm.set_recipient_module("all");
+    PeerListMessage* plm =
+        mm.mutable_group_management_message()->mutable_peer_list_message();
+    plm->set_group_id(m_GroupID);
+    plm->set_epoch(m_peerepoch);
+    plm->set_base_epoch(base);
+    BOOST_FOREACH(CPeerNode peer, added | boost::adaptors::map_values)
+    {
+        ConnectedPeerMessage* cpm = plm->add_connected_peer_message();
+        cpm->set_uuid(peer.GetUUID());
+        cpm->set_host(peer.GetHostname());
+        cpm->set_port(peer.GetPort());
+    }
+    BOOST_FOREACH(CPeerNode peer, removed | boost::adaptors::map_values)
+    {
+        plm->add_removed_uuid(peer.GetUUID());
+    }
+    std::string standby = ChooseStandby(m_pushedpeers);
+    if(!standby.empty())
+    {
+        plm->set_standby_uuid(standby);
+    }
+    return mm;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -332,6 +635,108 @@ ModuleMessage GMAgent::PeerListQuery(std::string requester)
     return PrepareForSending(gmm);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::Ping
+/// @description Creates a SWIM probe with the membership updates to spread.
+/// @pre None
+/// @post The updates count as sent once more.
+/// @param seq The sequence number of the probe.
+/// @param origin The node probing through this one, or empty.
+/// @return A GroupManagementMessage with the contents of a Ping message
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GMAgent::Ping(unsigned int seq, const std::string& origin)
+{
+    GroupManagementMessage gmm;
+    PingMessage* pm = gmm.mutable_ping_message();
+    pm->set_sequence_no(seq);
+    pm->set_incarnation(m_swim.GetIncarnation());
+    if(!origin.empty())
+    {
+        pm->set_origin(origin);
+    }
+    FillUpdates(pm->mutable_update());
+    return PrepareForSending(gmm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PingRequest
+/// @description Creates a request for another node to probe a target.
+/// @pre None
+/// @post The updates count as sent once more.
+/// @param seq The sequence number of the probe.
+/// @param target The node that did not acknowledge the probe.
+/// @return A GroupManagementMessage with the contents of a PingRequest message
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GMAgent::PingRequest(unsigned int seq, const std::string& target)
+{
+    GroupManagementMessage gmm;
+    PingRequestMessage* prm = gmm.mutable_ping_request_message();
+    prm->set_sequence_no(seq);
+    prm->set_target(target);
+    prm->set_incarnation(m_swim.GetIncarnation());
+    FillUpdates(prm->mutable_update());
+    return PrepareForSending(gmm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PingAck
+/// @description Creates the acknowledgement of a SWIM probe.
+/// @pre None
+/// @post The updates count as sent once more.
+/// @param seq The sequence number of the probe.
+/// @param target The node that was probed.
+/// @param incarnation The incarnation of the probed node.
+/// @param origin The node the acknowledgement is relayed to, or empty.
+/// @return A GroupManagementMessage with the contents of a PingAck message
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GMAgent::PingAck(unsigned int seq, const std::string& target,
+    unsigned int incarnation, const std::string& origin)
+{
+    GroupManagementMessage gmm;
+    PingAckMessage* pam = gmm.mutable_ping_ack_message();
+    pam->set_sequence_no(seq);
+    pam->set_target(target);
+    pam->set_incarnation(incarnation);
+    if(!origin.empty())
+    {
+        pam->set_origin(origin);
+    }
+    FillUpdates(pam->mutable_update());
+    return PrepareForSending(gmm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::FillUpdates
+/// @description Adds the membership updates the failure detector is
+///     spreading, with the address of each node so a receiver that does not
+///     know the node can probe it.
+/// @pre None
+/// @post The updates count as sent once more.
+/// @param updates The field of the message to fill.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::FillUpdates(
+    google::protobuf::RepeatedPtrField<MembershipUpdateMessage>* updates)
+{
+    BOOST_FOREACH(const CSwimMembership::SUpdate& update, m_swim.Piggyback())
+    {
+        CPeerNode node;
+        try
+        {
+            node = GetPeer(update.uuid);
+        }
+        catch(EDgiNoSuchPeerError &e)
+        {
+            continue;
+        }
+        MembershipUpdateMessage* mum = updates->Add();
+        mum->set_uuid(update.uuid);
+        mum->set_host(node.GetHostname());
+        mum->set_port(node.GetPort());
+        mum->set_incarnation(update.incarnation);
+        mum->set_state(update.state);
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// GMAgent::SystemState
 /// @description Puts the system state to the logger.
@@ -347,11 +752,13 @@ void GMAgent::SystemState()
               <<"SYSTEM NODES"<<std::endl;
     unsigned int bit = 2;
     unsigned int groupfield = 0;
+    unsigned int members = 0;
     if(IsCoordinator())
     {
         groupfield = 1;
     }
-    BOOST_FOREACH(CPeerNode& peer, CGlobalPeerList::instance().PeerList() | boost::adaptors::map_values)
+    CGlobalPeerList::Snapshot known = CGlobalPeerList::instance().PeerList();
+    BOOST_FOREACH(const CPeerNode& peer, *known | boost::adaptors::map_values)
     {
         nodestatus<<"Node: "<<peer.GetUUID()<<" State: ";
         if(peer.GetUUID() == GetUUID())
@@ -361,68 +768,706 @@ void GMAgent::SystemState()
             else
                 nodestatus<<"Up (Me, Coordinator)"<<std::endl;
             groupfield |= bit;
+            members++;
         }
         else if(peer.GetUUID() == Coordinator())
         {
-            nodestatus<<"Up (Coordinator)"<<std::endl;
-            groupfield |= bit;
+            nodestatus<<"Up (Coordinator)"<<std::endl;
+            groupfield |= bit;
+            members++;
+        }
+        else if(CountInPeerSet(m_UpNodes,peer) > 0)
+        {
+            nodestatus<<"Up (In Group)"<<std::endl;
+            groupfield |= bit;
+            members++;
+        }
+        else
+        {
+            nodestatus<<"Unknown"<<std::endl;
+        }
+        bit = bit << 1;
+    }
+
+    GroupSizeMetric.Set(members);
+    float* groupfloat = (float *) &groupfield;
+
+    LOG_STATUS(Logger)<<"Group Bitfield : ";
+    bit = 1;
+    for(int i=0; i < 32; i++)
+    {
+        LOG_STATUS(Logger)<< ((groupfield & bit)?1:0);
+        bit = bit << 1;
+    }
+    LOG_STATUS(Logger)<<std::endl;
+    LOG_STATUS(Logger)<<"Group Float : "<< *groupfloat << std::endl;
+
+    std::set<device::CDevice::Pointer> devset;
+    devset = device::CDeviceManager::Instance().GetDevicesOfType("Logger");
+    if( !devset.empty() )
+    {
+        (*devset.begin())->SetCommand("groupStatus", *groupfloat);
+    }
+
+    nodestatus<<"FID state: "<<device::CDeviceManager::Instance().
+            GetNetValue("Fid", "state");
+    nodestatus<<std::endl<<"Current Skew: "<<CGlobalConfiguration::Instance().GetClockSkew();
+    nodestatus<<std::endl<<"Time left in phase: "<<CBroker::Instance().TimeRemaining()<<std::endl;
+    LOG_STATUS(Logger)<<nodestatus.str()<<std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PushPeerList
+/// @description Sends the membership list to other modules of this node and
+///     other nodes. With hierarchical groups the segment members only get the
+///     segment group for group management, and the modules get the combined
+///     group from the top coordinator.
+/// @pre This node is new group leader
+/// @post A peer list is pushed to the group members
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::PushPeerList()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(m_hierarchical)
+    {
+        ModuleMessage list = SegmentList();
+        CSerializedMessage::Pointer m_(new CSerializedMessage(ShareMessage(list)));
+        BroadcastToPeers(m_UpNodes, m_);
+        GetMe().Send(m_);
+        PublishIsland();
+    }
+    else
+    {
+        PublishMembers(m_UpNodes);
+    }
+    SaveWarmGroup();
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << "FINISH" <<    std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::ChooseStandby
+/// @description Picks the member that takes over the group if this node
+///     fails. Every member can tell the same node apart, since the member
+///     with the lowest UUID is chosen.
+/// @pre This node is the coordinator of a flat group.
+/// @post No Change.
+/// @param members The other nodes of the group.
+/// @return The UUID of the standby, or empty if no standby is named.
+///////////////////////////////////////////////////////////////////////////////
+std::string GMAgent::ChooseStandby(const PeerSet& members) const
+{
+    if(!CGlobalConfiguration::Instance().GetGroupStandby() || m_hierarchical
+        || members.empty())
+    {
+        return "";
+    }
+    return members.begin()->first;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::SaveWarmGroup
+/// @description Hands the group, its coordinator and its members to the warm
+///     state, so a restart of this node can rejoin the same coordinator.
+/// @pre None
+/// @post The warm state holds the current group if it is enabled.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::SaveWarmGroup()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!CWarmState::Instance().IsEnabled())
+    {
+        return;
+    }
+    WarmGroup group;
+    group.set_group_id(m_GroupID);
+    group.set_coordinator(Coordinator());
+    BOOST_FOREACH(const std::string& uuid, m_UpNodes | boost::adaptors::map_keys)
+    {
+        group.add_member(uuid);
+    }
+    CWarmState::Instance().SaveGroup(group);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PublishMembers
+/// @description Sends the peer list the modules use. Each push is a new
+///     version of the membership. The members that had the previous version
+///     of this group only receive the nodes added and removed since; a new
+///     group and new members get the full list.
+/// @pre This node is the group leader, or the top coordinator.
+/// @post A peer list is pushed to the members and to this node
+/// @param members The other nodes of the group.
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::PublishMembers(const PeerSet& members)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    bool regrouped = (m_peerepoch == 0 || m_pushedgroup != m_GroupID);
+    CPeerBitSet current(members);
+    CPeerBitSet pushed(m_pushedpeers);
+    PeerSet added;
+    PeerSet removed;
+    PeerSet kept;
+    if(!regrouped)
+    {
+        added = (current - pushed).ToPeerSet();
+        removed = (pushed - current).ToPeerSet();
+        kept = (current & pushed).ToPeerSet();
+    }
+
+    google::protobuf::uint64 base = m_peerepoch;
+    if(m_peerepoch == 0)
+    {
+        // A restarted leader does not reuse the versions of its last run
+        m_peerepoch = static_cast<google::protobuf::uint64>(std::time(0)) << 16;
+    }
+    m_peerepoch++;
+    m_pushedgroup = m_GroupID;
+    m_pushedpeers = members;
+
+    // Each list is serialized once and shared with the copy for this node
+    ModuleMessage list = PeerList();
+    CSerializedMessage::Pointer m_(new CSerializedMessage(ShareMessage(list)));
+    if(regrouped)
+    {
+        BroadcastToPeers(members, m_);
+        GetMe().Send(m_);
+    }
+    else
+    {
+        ModuleMessage changes = PeerListDelta(base, added, removed);
+        CSerializedMessage::Pointer delta(
+            new CSerializedMessage(ShareMessage(changes)));
+        BroadcastToPeers(kept, delta);
+        BroadcastToPeers(added, m_);
+        GetMe().Send(delta);
+        LOG_DEBUG(Logger) << "Pushed peer list version " << m_peerepoch << ": "
+                << added.size() << " added, " << removed.size() << " removed"
+                << std::endl;
+    }
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << "FINISH" <<    std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::Federate
+/// @description Runs the upper level of hierarchical group management. The
+///     segment group and its FID states are reported to every other segment,
+///     and the top coordinator is chosen among the segment coordinators that
+///     the known FID states make physically reachable.
+/// @pre This node coordinates its segment and has collected its FID states.
+/// @post Reports are sent, and the combined group is published if this node
+///     is the top coordinator.
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::Federate()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_hierarchy.Tick();
+
+    // The FID states seen in this segment are the most recent
+    CPhysicalTopology::FIDState fids = m_fidstate;
+    BOOST_FOREACH(const CGroupHierarchy::ReportMap::value_type& entry,
+        m_hierarchy.GetReports())
+    {
+        fids.insert(entry.second.fids.begin(), entry.second.fids.end());
+    }
+    m_reachable = CPhysicalTopology::Instance().ReachablePeers(GetUUID(), fids);
+
+    std::string top = m_hierarchy.ChooseTop(m_reachable);
+    if(top != m_top)
+    {
+        LOG_NOTICE(Logger) << "Top coordinator is now " << top << std::endl;
+        m_top = top;
+    }
+
+    ModuleMessage m_ = SegmentReport();
+    BOOST_FOREACH(const std::string& uuid, m_hierarchy.Contacts())
+    {
+        if(CGlobalPeerList::instance().Count(uuid) > 0)
+        {
+            GetPeer(uuid).Send(m_);
+        }
+    }
+    PublishIsland();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::ReadLocalFids
+/// @description Reads the state of each FID attached to this node.
+/// @pre None
+/// @post None
+/// @return The FID states, true if closed.
+///////////////////////////////////////////////////////////////////////////////
+CPhysicalTopology::FIDState GMAgent::ReadLocalFids()
+{
+    CPhysicalTopology::FIDState fids;
+    std::set<device::CDevice::Pointer> attachedFIDs =
+        device::CDeviceManager::Instance().GetDevicesOfType("Fid");
+    BOOST_FOREACH(device::CDevice::Pointer ptr, attachedFIDs)
+    {
+        fids[ptr->GetID()] = ptr->GetState("state");
+    }
+    return fids;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::HandleFidChange
+/// @description Runs in the group management phase when an attached FID
+///     opens, closes, joins or leaves. The coordinator of a group prunes the
+///     members that the new states cut off at once, rather than at the end of
+///     the next check, and a segment coordinator reports to the other
+///     segments. Nothing is read while the FIDs keep their states.
+/// @pre The subscription of the constructor raised the event.
+/// @post m_localfids holds the attached FID states.
+/// @param net The number of closed FIDs, which is not used.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::HandleFidChange(float)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    CPhysicalTopology::FIDState fids = ReadLocalFids();
+    if(fids == m_localfids)
+    {
+        return;
+    }
+    m_localfids.swap(fids);
+    LOG_NOTICE(Logger) << "The states of the " << m_localfids.size()
+        << " attached FIDs changed" << std::endl;
+
+    if(!CPhysicalTopology::Instance().IsAvailable() || m_checkedfids.empty() ||
+        GetStatus() != GMAgent::NORMAL || !IsCoordinator())
+    {
+        // The members report their states in the next AYC response, and a
+        // coordinator without a check has no states of the other FIDs yet
+        return;
+    }
+    // The other FIDs keep the states of the last check
+    BOOST_FOREACH(const CPhysicalTopology::FIDState::value_type& fid, m_localfids)
+    {
+        m_checkedfids[fid.first] = fid.second;
+    }
+    if(PruneUnreachable(m_checkedfids))
+    {
+        PushPeerList();
+    }
+    if(m_hierarchical)
+    {
+        // Federate reports the states collected so far in this check
+        BOOST_FOREACH(const CPhysicalTopology::FIDState::value_type& fid, m_localfids)
+        {
+            m_fidstate[fid.first] = fid.second;
+        }
+        m_fidstate.insert(m_checkedfids.begin(), m_checkedfids.end());
+        Federate();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PruneUnreachable
+/// @description Removes the group members and the known coordinators that
+///     the FID states make physically unreachable from this node.
+/// @pre The physical topology is available.
+/// @post The unreachable nodes are erased from m_UpNodes and m_Coordinators.
+/// @param fids The FID states to search the topology with.
+/// @return True if a group member was removed.
+///////////////////////////////////////////////////////////////////////////////
+bool GMAgent::PruneUnreachable(const CPhysicalTopology::FIDState& fids)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    std::set<std::string> reachables = CPhysicalTopology::Instance().ReachablePeers(GetUUID(), fids);
+    LOG_WARN(Logger)<<"There are "<<reachables.size()<<" reachable peers"<<std::endl;
+
+    std::set<std::string> unreachables;
+    // Of the nodes in the m_UpNodes set, which are not in the physically reachable set?
+    // This will select nodes that we need to remove from our active group.
+    BOOST_FOREACH( std::string uuid, m_UpNodes | boost::adaptors::map_keys)
+    {
+        if(reachables.count(uuid) == 0)
+            unreachables.insert(uuid);
+    }
+    // Of the nodes in the m_Coordinators set, which are not in the physically reachable set?
+    // These are coordinators that we can see, but we don't want to participate in an election with.
+    BOOST_FOREACH( std::string uuid, m_Coordinators | boost::adaptors::map_keys)
+    {
+        if(reachables.count(uuid) == 0)
+            unreachables.insert(uuid);
+    }
+    // For each unreachable node, remove them from the coordinators set, and the active group.
+    bool removed = false;
+    BOOST_FOREACH( std::string uuid, unreachables)
+    {
+        removed = removed || m_UpNodes.count(uuid) > 0;
+        m_UpNodes.erase(uuid);
+        m_Coordinators.erase(uuid);
+        LOG_INFO(Logger) << "FID state indicates "<<uuid<<" is unreachable"<<std::endl;
+    }
+    return removed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PublishIsland
+/// @description Combines this segment group with the reported groups of the
+///     reachable segments and publishes the result to their nodes, unless it
+///     has not changed since the last push.
+/// @pre Hierarchical groups are enabled.
+/// @post The modules of every node in the combined group have its peer list
+///     if this node is the top coordinator.
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::PublishIsland()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!IsPublisher())
+    {
+        return;
+    }
+    PeerSet island = m_UpNodes;
+    BOOST_FOREACH(const CGroupHierarchy::ReportMap::value_type& entry,
+        m_hierarchy.GetReports())
+    {
+        if(m_reachable.count(entry.second.coordinator) == 0)
+        {
+            continue;
+        }
+        BOOST_FOREACH(CPeerNode peer, entry.second.members | boost::adaptors::map_values)
+        {
+            if(peer.GetUUID() != GetUUID())
+            {
+                InsertInPeerSet(island, peer);
+            }
+        }
+    }
+
+    bool changed = (m_peerepoch == 0 || m_pushedgroup != m_GroupID
+        || island.size() != m_pushedpeers.size());
+    BOOST_FOREACH(const std::string& uuid, island | boost::adaptors::map_keys)
+    {
+        if(changed)
+            break;
+        changed = (m_pushedpeers.count(uuid) == 0);
+    }
+    if(changed)
+    {
+        LOG_NOTICE(Logger) << "Publishing a group of " << island.size() + 1
+                << " nodes from " << m_hierarchy.GetReports().size() + 1
+                << " segments" << std::endl;
+        PublishMembers(island);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::IsPublisher
+/// @description Tells whether the modules take their peer list from this
+///     node: the group leader, or with hierarchical groups the top coordinator.
+/// @pre None
+/// @post None
+/// @return True if this node publishes the peer list.
+///////////////////////////////////////////////////////////////////////////////
+bool GMAgent::IsPublisher() const
+{
+    return IsCoordinator() && (!m_hierarchical || m_top == GetUUID());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PlanPhases
+/// @description Sizes the phases for the busiest node of the group, using the
+///     phase demand measured here and reported in the AYT messages of the
+///     members. A new schedule is published only if a phase would change by
+///     more than PHASE_CHANGE_THRESHOLD, and it starts PHASE_SCHEDULE_LEAD
+///     rounds from now so the members receive it before it takes effect.
+/// @pre This node is the group leader and the adaptive phases are enabled.
+/// @post The schedule is applied here and sent with the next AYT responses.
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::PlanPhases()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    typedef std::map< std::string, std::vector<unsigned int> > DemandMap;
+    std::vector<unsigned int> demand = CBroker::Instance().TakePhaseDemand();
+    DemandMap::iterator it = m_phasedemand.begin();
+    while(it != m_phasedemand.end())
+    {
+        if(m_UpNodes.count(it->first) == 0)
+        {
+            m_phasedemand.erase(it++);
+            continue;
+        }
+        for(unsigned int i=0; i < it->second.size() && i < demand.size(); i++)
+        {
+            demand[i] = std::max(demand[i], it->second[i]);
+        }
+        it++;
+    }
+
+    std::vector<unsigned int> lengths = CBroker::Instance().PlanPhaseLengths(demand);
+    std::vector<unsigned int> current = m_phaselengths;
+    if(current.size() != lengths.size())
+    {
+        current = CBroker::Instance().GetPhaseLengths();
+    }
+    bool changed = false;
+    for(unsigned int i=0; i < lengths.size() && i < current.size(); i++)
+    {
+        unsigned int diff = lengths[i] > current[i] ?
+            lengths[i] - current[i] : current[i] - lengths[i];
+        if(diff > PHASE_CHANGE_THRESHOLD)
+        {
+            changed = true;
+        }
+    }
+    if(!changed)
+    {
+        return;
+    }
+    PublishPhases(lengths);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::PublishPhases
+/// @description Starts a new phase schedule PHASE_SCHEDULE_LEAD rounds from
+///     now so the members receive it before it takes effect.
+/// @pre This node is the group leader.
+/// @post The schedule is applied here and sent with the next AYT responses.
+/// @param lengths The phase length of each module in milliseconds.
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::PublishPhases(const std::vector<unsigned int>& lengths)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_phaselengths = lengths;
+    m_phaseeffective = CBroker::Instance().GetRoundBoundary(PHASE_SCHEDULE_LEAD);
+    m_phaseversion++;
+    m_phaseleader = GetUUID();
+    LOG_NOTICE(Logger) << "Publishing phase schedule " << m_phaseversion
+        << " effective at " << m_phaseeffective << std::endl;
+    CBroker::Instance().SetPhaseLengths(m_phaselengths, m_phaseeffective);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::ReloadTimings
+/// @description Takes the group management timeouts from the timings file
+///     once it has been reloaded. A group leader also publishes the reloaded
+///     phase lengths, so the group changes them at the same round boundary;
+///     a member keeps following its leader's schedule.
+/// @pre None
+/// @post The timeouts are those of the last reload.
+/// @return Nothing
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::ReloadTimings()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(m_timingsversion == CTimings::GetVersion())
+    {
+        return;
+    }
+    m_timingsversion = CTimings::GetVersion();
+    AYC_RESPONSE_TIMEOUT = CTimings::GetDuration(CTimings::GM_AYC_RESPONSE_TIMEOUT);
+    AYT_RESPONSE_TIMEOUT = CTimings::GetDuration(CTimings::GM_AYT_RESPONSE_TIMEOUT);
+    INVITE_RESPONSE_TIMEOUT = CTimings::GetDuration(CTimings::GM_INVITE_RESPONSE_TIMEOUT);
+    SWIM_ACK_TIMEOUT = AYT_RESPONSE_TIMEOUT;
+    SWIM_PROBE_PERIOD = AYT_RESPONSE_TIMEOUT * SWIM_PERIOD_FACTOR;
+    if(IsCoordinator())
+    {
+        PublishPhases(CBroker::Instance().GetConfiguredLengths());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::Probe
+/// @description Ends the last SWIM probe period and starts the next one. A
+///     target that acknowledged neither the direct nor the indirect probes
+///     is suspected. The next target is probed directly, and ProbeIndirect
+///     runs if it has not answered within SWIM_ACK_TIMEOUT. Each node sends
+///     one probe per period, however many nodes there are.
+/// @pre The SWIM failure detector is enabled.
+/// @post A probe is sent and the timer for ProbeIndirect is set.
+/// @param err The error code associated with the calling timer.
+/// @citation SWIM: Scalable Weakly-consistent Infection-style Process Group
+///     Membership Protocol (Das, Gupta, Motivala)
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::Probe( const boost::system::error_code& err )
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(err == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+    else if(err)
+    {
+        LOG_ERROR(Logger) << err << std::endl;
+        throw boost::system::system_error(err);
+    }
+
+    if(m_probing && !m_probeacked)
+    {
+        m_swim.Suspect(m_probetarget);
+    }
+    m_probing = false;
+    m_swim.Tick();
+
+    // Peers are only added to the global list, so a changed size means new
+    // peers to probe
+    CGlobalPeerList::Snapshot peers = CGlobalPeerList::instance().PeerList();
+    if(peers->size() != m_swimknown)
+    {
+        BOOST_FOREACH(const std::string& uuid, *peers | boost::adaptors::map_keys)
+        {
+            m_swim.Add(uuid);
+        }
+        m_swimknown = peers->size();
+    }
+    HandleFailures();
+
+    std::string target;
+    if(!m_swim.NextTarget(target))
+    {
+        CBroker::Instance().Schedule(m_swimtimer, SWIM_PROBE_PERIOD,
+            boost::bind(&GMAgent::Probe, this, boost::asio::placeholders::error));
+        return;
+    }
+    m_probeseq++;
+    m_probetarget = target;
+    m_probing = true;
+    m_probeacked = false;
+    LOG_DEBUG(Logger) << "SEND: Probing " << target << std::endl;
+    GetPeer(target).Send(Ping(m_probeseq, ""));
+    CBroker::Instance().Schedule(m_swimtimer, SWIM_ACK_TIMEOUT,
+        boost::bind(&GMAgent::ProbeIndirect, this, boost::asio::placeholders::error));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::ProbeIndirect
+/// @description If the target of the current probe has not acknowledged it,
+///     asks SWIM_INDIRECT_PROBES random nodes to probe the target. This keeps
+///     a bad link between two nodes from looking like a failed node.
+/// @pre A probe was sent SWIM_ACK_TIMEOUT ago.
+/// @post The timer for the next Probe is set.
+/// @param err The error code associated with the calling timer.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::ProbeIndirect( const boost::system::error_code& err )
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(err == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+    else if(err)
+    {
+        LOG_ERROR(Logger) << err << std::endl;
+        throw boost::system::system_error(err);
+    }
+
+    if(m_probing && !m_probeacked)
+    {
+        LOG_DEBUG(Logger) << "No ack from " << m_probetarget
+            << ", probing indirectly" << std::endl;
+        ModuleMessage m_ = PingRequest(m_probeseq, m_probetarget);
+        BOOST_FOREACH(const std::string& uuid,
+            m_swim.PickHelpers(m_probetarget, SWIM_INDIRECT_PROBES))
+        {
+            GetPeer(uuid).Send(m_);
         }
-        else if(CountInPeerSet(m_UpNodes,peer) > 0)
+    }
+    CBroker::Instance().Schedule(m_swimtimer, SWIM_PROBE_PERIOD - SWIM_ACK_TIMEOUT,
+        boost::bind(&GMAgent::Probe, this, boost::asio::placeholders::error));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::HandleFailures
+/// @description Feeds the failures found by the SWIM detector to the group.
+///     A leader drops dead members and pushes the new peer list. A member
+///     whose leader died goes into recovery.
+/// @pre None
+/// @post The group state no longer counts on the dead nodes.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::HandleFailures()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    bool list_change = false;
+    bool leader_failed = false;
+    BOOST_FOREACH(const std::string& uuid, m_swim.TakeDeaths())
+    {
+        if(IsCoordinator() && m_UpNodes.count(uuid) > 0)
         {
-            nodestatus<<"Up (In Group)"<<std::endl;
-            groupfield |= bit;
+            LOG_INFO(Logger) << "Failure detected for peer: " << uuid << std::endl;
+            m_UpNodes.erase(uuid);
+            list_change = true;
         }
-        else
+        else if(!IsCoordinator() && uuid == Coordinator())
         {
-            nodestatus<<"Unknown"<<std::endl;
+            LOG_INFO(Logger) << "Failure detected for leader: " << uuid << std::endl;
+            leader_failed = true;
         }
-        bit = bit << 1;
     }
-
-    float* groupfloat = (float *) &groupfield;
-
-    Logger.Status<<"Group Bitfield : ";
-    bit = 1;
-    for(int i=0; i < 32; i++)
+    if(list_change && GetStatus() == GMAgent::NORMAL)
     {
-        Logger.Status<< ((groupfield & bit)?1:0);
-        bit = bit << 1;
+        PushPeerList();
+        m_membership += m_UpNodes.size()+1;
+        m_membershipchecks++;
     }
-    Logger.Status<<std::endl;
-    Logger.Status<<"Group Float : "<< *groupfloat << std::endl;
-
-    std::set<device::CDevice::Pointer> devset;
-    devset = device::CDeviceManager::Instance().GetDevicesOfType("Logger");
-    if( !devset.empty() )
+    if(leader_failed && GetStatus() == GMAgent::NORMAL)
     {
-        (*devset.begin())->SetCommand("groupStatus", *groupfloat);
+        m_groupsbroken++;
+        Recovery();
     }
-
-    nodestatus<<"FID state: "<<device::CDeviceManager::Instance().
-            GetNetValue("Fid", "state");
-    nodestatus<<std::endl<<"Current Skew: "<<CGlobalConfiguration::Instance().GetClockSkew();
-    nodestatus<<std::endl<<"Time left in phase: "<<CBroker::Instance().TimeRemaining()<<std::endl;
-    Logger.Status<<nodestatus.str()<<std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// GMAgent::PushPeerList
-/// @description Sends the membership list to other modules of this node and
-///     other nodes
-/// @pre This node is new group leader
-/// @post A peer list is pushed to the group members
-/// @return Nothing
+/// GMAgent::ApplyUpdates
+/// @description Merges piggybacked membership updates into the failure
+///     detector. Nodes this DGI did not know about are registered with the
+///     connection manager so they can be probed.
+/// @pre None
+/// @post The updates are merged and any failures fed to the group.
+/// @param updates The updates of a SWIM message.
 ///////////////////////////////////////////////////////////////////////////////
-void GMAgent::PushPeerList()
+void GMAgent::ApplyUpdates(
+    const google::protobuf::RepeatedPtrField<MembershipUpdateMessage>& updates)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    ModuleMessage m_ = PeerList();
-    BOOST_FOREACH( CPeerNode peer, m_UpNodes | boost::adaptors::map_values)
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    BOOST_FOREACH(const MembershipUpdateMessage& mum, updates)
     {
-        peer.Send(m_);
+        if(mum.state() > CSwimMembership::DEAD)
+        {
+            continue;
+        }
+        if(mum.uuid() != GetUUID() &&
+            CGlobalPeerList::instance().Count(mum.uuid()) == 0)
+        {
+            if(!IsValidPort(mum.port()))
+            {
+                LOG_WARN(Logger) << "Dropped update with invalid port: "
+                    << mum.DebugString() << std::endl;
+                continue;
+            }
+            LOG_WARN(Logger) << "Adding previously unknown peer: " << mum.uuid() << std::endl;
+            CConnectionManager::Instance().PutHost(mum.uuid(), mum.host(), mum.port());
+            AddPeer(mum.uuid());
+        }
+        CSwimMembership::SUpdate update;
+        update.uuid = mum.uuid();
+        update.incarnation = mum.incarnation();
+        update.state = static_cast<CSwimMembership::EState>(mum.state());
+        m_swim.Apply(update);
     }
-    GetMe().Send(m_);
-    Logger.Trace << __PRETTY_FUNCTION__ << "FINISH" <<    std::endl;
+    HandleFailures();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::ApplyAlive
+/// @description Merges the news that a node answered at an incarnation.
+/// @pre None
+/// @post A node thought dead at a lower incarnation is alive again.
+/// @param uuid The node that answered.
+/// @param incarnation Its incarnation.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::ApplyAlive(const std::string& uuid, unsigned int incarnation)
+{
+    CSwimMembership::SUpdate update;
+    update.uuid = uuid;
+    update.incarnation = incarnation;
+    update.state = CSwimMembership::ALIVE;
+    m_swim.Apply(update);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -436,28 +1481,33 @@ void GMAgent::PushPeerList()
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Recovery()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     SetStatus(GMAgent::ELECTION);
-    Logger.Notice << "+ State Change ELECTION : "<<__LINE__<<std::endl;
+    LOG_NOTICE(Logger) << "+ State Change ELECTION : "<<__LINE__<<std::endl;
     m_GrpCounter++;
     m_GroupID = m_GrpCounter;
     m_GroupLeader = GetUUID();
-    BOOST_FOREACH(CPeerNode& peer, CGlobalPeerList::instance().PeerList() | boost::adaptors::map_values)
+    m_standby.clear();
+    // Alone, this node publishes its own group until the segments report
+    m_top = GetUUID();
+    CGlobalPeerList::Snapshot known = CGlobalPeerList::instance().PeerList();
+    BOOST_FOREACH(const CPeerNode& peer, *known | boost::adaptors::map_values)
     {
         if( peer.GetUUID() == GetUUID())
             continue;
     }
-    Logger.Notice << "Changed group: "<< m_GroupID<<" ("<< m_GroupLeader <<")"<<std::endl;
+    LOG_NOTICE(Logger) << "Changed group: "<< m_GroupID<<" ("<< m_GroupLeader <<")"<<std::endl;
+    GroupChangesMetric.Increment();
     // Empties the UpList
     m_UpNodes.clear();
     SetStatus(GMAgent::REORGANIZATION);
-    Logger.Notice << "+ State Change REORGANIZATION : "<<__LINE__<<std::endl;
+    LOG_NOTICE(Logger) << "+ State Change REORGANIZATION : "<<__LINE__<<std::endl;
     // Perform work assignments, etc here.
     SetStatus(GMAgent::NORMAL);
-    Logger.Notice << "+ State Change NORMAL : "<<__LINE__<<std::endl;
+    LOG_NOTICE(Logger) << "+ State Change NORMAL : "<<__LINE__<<std::endl;
     PushPeerList();
     // Go to work
-    Logger.Info << "TIMER: Setting CheckTimer (Check): " << __LINE__ << std::endl;
+    LOG_INFO(Logger) << "TIMER: Setting CheckTimer (Check): " << __LINE__ << std::endl;
     CBroker::Instance().Schedule(m_timer, CHECK_TIMEOUT,
         boost::bind(&GMAgent::Check, this, boost::asio::placeholders::error));
     // On recovery, we will reset the clock skew to 0 and start trying to synch again
@@ -475,9 +1525,35 @@ void GMAgent::Recovery()
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Recovery( const boost::system::error_code& err )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Info << "RECOVERY CALL" << std::endl;
-    if(!err)
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_INFO(Logger) << "RECOVERY CALL" << std::endl;
+    if(!err && CGlobalConfiguration::Instance().GetSwimMembership() &&
+        GetStatus() == GMAgent::NORMAL && !m_swim.IsDead(Coordinator()))
+    {
+        // The failure detector, not a missed AYT response, decides that the
+        // leader is gone
+        LOG_INFO(Logger) << "No AYT response, but the leader is not dead" << std::endl;
+        CBroker::Instance().Schedule(m_timer, TIMEOUT_TIMEOUT,
+            boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error),
+            boost::posix_time::milliseconds(0));
+    }
+    else if(!err && GetStatus() == GMAgent::NORMAL && !IsCoordinator()
+        && m_standby == GetUUID())
+    {
+        m_groupsbroken++;
+        TakeOver();
+    }
+    else if(!err && GetStatus() == GMAgent::NORMAL && !m_standbywait
+        && !m_standby.empty() && m_standby != Coordinator())
+    {
+        // The standby missed the same response and is inviting the group
+        LOG_INFO(Logger) << "Waiting for " << m_standby << " to take over"
+                << std::endl;
+        m_standbywait = true;
+        CBroker::Instance().Schedule(m_timer, AYT_RESPONSE_TIMEOUT,
+            boost::bind(&GMAgent::Recovery, this, boost::asio::placeholders::error));
+    }
+    else if(!err)
     {
         m_groupsbroken++;
         Recovery();
@@ -486,20 +1562,42 @@ void GMAgent::Recovery( const boost::system::error_code& err )
     {
         if(!IsCoordinator())
         {
-            Logger.Info << "TIMER: Setting TimeoutTimer (Timeout):" << __LINE__ << std::endl;
+            LOG_INFO(Logger) << "TIMER: Setting TimeoutTimer (Timeout):" << __LINE__ << std::endl;
             // We are not the Coordinator, we must run Timeout()
             CBroker::Instance().Schedule(m_timer, TIMEOUT_TIMEOUT,
-                boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error));
+                boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error),
+                boost::posix_time::milliseconds(0));
         }
     }
     else
     {
         /* An error occurred or timer was canceled */
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::TakeOver
+/// @description Forms a new group from the members the failed coordinator
+///     last pushed. The members are invited at once, without the AYC round
+///     and premerge delay that the recovery of each member would need.
+/// @pre This node is the standby of its group and missed the AYT response.
+/// @post This node leads an election and has invited the old members.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::TakeOver()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_NOTICE(Logger) << "Taking over the group of " << Coordinator() << std::endl;
+    TakeoversMetric.Increment();
+    m_UpNodes.erase(Coordinator());
+    m_GroupLeader = GetUUID();
+    m_standby.clear();
+    m_standbywait = false;
+    m_Coordinators.clear();
+    Merge(boost::system::error_code());
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// GMAgent::Check
 /// @description This method queries all nodes to Check and see if any of them
@@ -512,31 +1610,73 @@ void GMAgent::Recovery( const boost::system::error_code& err )
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Check( const boost::system::error_code& err )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if( !err )
     {
         SystemState();
+        ReloadTimings();
         // Only run if this is the group leader and in normal state
         if((GMAgent::NORMAL == GetStatus()) && (IsCoordinator()))
         {
             // Reset and find all group leaders
             m_Coordinators.clear();
             m_AYCResponse.clear();
-            ModuleMessage m_ = AreYouCoordinator();
-            Logger.Info <<"SEND: Sending out AYC"<<std::endl;
-            BOOST_FOREACH(CPeerNode& peer, CGlobalPeerList::instance().PeerList() | boost::adaptors::map_values)
+            CSerializedMessage::Pointer m_ = AreYouCoordinator();
+            LOG_INFO(Logger) <<"SEND: Sending out AYC"<<std::endl;
+            PeerSet others = *CGlobalPeerList::instance().PeerList();
+            others.erase(GetUUID());
+            if(CGlobalConfiguration::Instance().GetSwimMembership())
             {
-                if( peer.GetUUID() == GetUUID())
-                    continue;
-                peer.Send(m_);
-                InsertInTimedPeerSet(m_AYCResponse, peer, boost::posix_time::microsec_clock::universal_time());
+                // The failure detector watches the group, so only the nodes
+                // that could be other coordinators are asked. The members
+                // are still asked for their FID states if they are needed.
+                bool fids = CPhysicalTopology::Instance().IsAvailable();
+                PeerSetIterator it = others.begin();
+                while(it != others.end())
+                {
+                    if(m_swim.IsDead(it->first) ||
+                        (!fids && CountInPeerSet(m_UpNodes, it->second)))
+                    {
+                        others.erase(it++);
+                    }
+                    else
+                    {
+                        it++;
+                    }
+                }
+            }
+            if(m_hierarchical)
+            {
+                // Elections stay within the feeder segment; the other
+                // segments are reached through their coordinators.
+                PeerSetIterator it = others.begin();
+                while(it != others.end())
+                {
+                    if(!m_hierarchy.InSegment(it->first))
+                    {
+                        others.erase(it++);
+                    }
+                    else
+                    {
+                        it++;
+                    }
+                }
+            }
+            SendToPeers(others, m_);
+            BOOST_FOREACH(CPeerNode& peer, others | boost::adaptors::map_values)
+            {
+                InsertInTimedPeerSet(m_AYCResponse, peer, CVirtualClock::Now());
             }
             // The AlivePeers set is no longer good, we should clear it and make them
             // Send us new messages
             // Wait for responses
-            Logger.Info << "TIMER: Setting GlobalTimer (Premerge): " << __LINE__ << std::endl;
+            LOG_INFO(Logger) << "TIMER: Setting GlobalTimer (Premerge): " << __LINE__ << std::endl;
             CBroker::Instance().Schedule(m_timer, AYC_RESPONSE_TIMEOUT,
                 boost::bind(&GMAgent::Premerge, this, boost::asio::placeholders::error));
+            if(CGlobalConfiguration::Instance().GetAdaptivePhases())
+            {
+                PlanPhases();
+            }
         } // End if
     }
     else if(boost::asio::error::operation_aborted == err )
@@ -546,7 +1686,7 @@ void GMAgent::Check( const boost::system::error_code& err )
     else
     {
         /* An error occurred or timer was canceled */
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
 }
@@ -562,7 +1702,7 @@ void GMAgent::Check( const boost::system::error_code& err )
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Premerge( const boost::system::error_code &err )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(!IsCoordinator())
         return;
     if( !err || (boost::asio::error::operation_aborted == err ))
@@ -577,66 +1717,47 @@ void GMAgent::Premerge( const boost::system::error_code &err )
              it++)
         {
             CPeerNode& peer = it->second.first;
-            if(CountInPeerSet(m_UpNodes,peer)) 
+            if(CountInPeerSet(m_UpNodes,peer) &&
+                !CGlobalConfiguration::Instance().GetSwimMembership())
             {
                 list_change = true;
                 EraseInPeerSet(m_UpNodes,peer);
-                Logger.Info << "No response from peer: "<<peer.GetUUID()<<std::endl;
+                LOG_INFO(Logger) << "No response from peer: "<<peer.GetUUID()<<std::endl;
             }
         }
         if(CPhysicalTopology::Instance().IsAvailable())
         {
-            // Add my state of m_fidstate:
-            std::set<device::CDevice::Pointer> attachedFIDs = 
-                device::CDeviceManager::Instance().GetDevicesOfType("Fid");
-            Logger.Notice<<"There are "<<attachedFIDs.size()<<" Attached Fids"<<std::endl;
-            BOOST_FOREACH(device::CDevice::Pointer ptr, attachedFIDs)
+            // Add my state of m_fidstate, as of the last change:
+            LOG_NOTICE(Logger)<<"There are "<<m_localfids.size()<<" Attached Fids"<<std::endl;
+            BOOST_FOREACH(const CPhysicalTopology::FIDState::value_type& fid, m_localfids)
             {
-                m_fidstate[ptr->GetID()] = ptr->GetState("state");
+                m_fidstate[fid.first] = fid.second;
             }
             // Print out a table to debug
-            Logger.Info<<"FID Table:"<<std::endl;
+            LOG_INFO(Logger)<<"FID Table:"<<std::endl;
             typedef std::pair< std::string , bool > FIDPair;
             BOOST_FOREACH( const FIDPair& fid, m_fidstate )
             {
-                Logger.Info<<"(FID) "<<fid.first<<" : ";
+                LOG_INFO(Logger)<<"(FID) "<<fid.first<<" : ";
                 if(fid.second)
-                    Logger.Info<<"Closed"<<std::endl;
+                    LOG_INFO(Logger)<<"Closed"<<std::endl;
                 else
-                    Logger.Info<<"Open"<<std::endl;
+                    LOG_INFO(Logger)<<"Open"<<std::endl;
             }
             // Run BFS on the collected Data to make sure your group is still reachable.
-            std::set<std::string> reachables = CPhysicalTopology::Instance().ReachablePeers(GetUUID(),  m_fidstate);
-            std::stringstream table2;
-            Logger.Warn<<"There are "<<reachables.size()<<" reachable peers"<<std::endl;
-            
-            std::set<std::string> unreachables;
-            // Of the nodes in the m_UpNodes set, which are not in the physically reachable set?
-            // This will select nodes that we need to remove from our active group.
-            BOOST_FOREACH( std::string uuid, m_UpNodes | boost::adaptors::map_keys)
-            {
-                if(reachables.count(uuid) == 0)
-                    unreachables.insert(uuid);
-            }
-            // Of the nodes in the m_Coordinators set, which are not in the physically reachable set?
-            // These are coordinators that we can see, but we don't want to participate in an election with.
-            BOOST_FOREACH( std::string uuid, m_Coordinators | boost::adaptors::map_keys)
-            {
-                if(reachables.count(uuid) == 0)
-                    unreachables.insert(uuid);
-            }
-            // For each unreachable node, remove them from the coordinators set, and the active group.
-            BOOST_FOREACH( std::string uuid, unreachables)
+            if(PruneUnreachable(m_fidstate))
             {
                 list_change = true;
-                m_UpNodes.erase(uuid);
-                m_Coordinators.erase(uuid);
-                Logger.Info << "FID state indicates "<<uuid<<" is unreachable"<<std::endl;
             }
+            m_checkedfids = m_fidstate;
         }
         else
         {
-            Logger.Warn<<"Physical Topology not available. Groups will form using cyber topology only."<<std::endl;
+            LOG_WARN(Logger)<<"Physical Topology not available. Groups will form using cyber topology only."<<std::endl;
+        }
+        if(m_hierarchical)
+        {
+            Federate();
         }
         if(list_change)
         {
@@ -664,23 +1785,35 @@ void GMAgent::Premerge( const boost::system::error_code &err )
                 }
             }
             float wait_val_;
-            int maxWait = CTimings::Get("GM_PREMERGE_MAX_TIMEOUT"); /* The longest a node would have to wait to Merge */
-            int minWait = CTimings::Get("GM_PREMERGE_MIN_TIMEOUT");
-            int granularity = CTimings::Get("GM_PREMERGE_GRANULARITY"); /* How finely it can slip in */
+            int maxWait = CTimings::Get(CTimings::GM_PREMERGE_MAX_TIMEOUT); /* The longest a node would have to wait to Merge */
+            int minWait = CTimings::Get(CTimings::GM_PREMERGE_MIN_TIMEOUT);
+            int granularity = CTimings::Get(CTimings::GM_PREMERGE_GRANULARITY); /* How finely it can slip in */
             int delta = ((maxWait-minWait)*1.0)/(granularity*1.0);
             if( myPriority < maxPeer_ )
                 wait_val_ = (((maxPeer_ - myPriority)%(granularity+1))*1.0)*delta+minWait;
             else
                 wait_val_ = 0;
+            if(!m_warmleader.empty())
+            {
+                // After a restart the coordinator of the last run gets to
+                // invite this node back before this node invites anyone
+                if(m_Coordinators.count(m_warmleader) > 0)
+                {
+                    LOG_NOTICE(Logger) << "Waiting for the last coordinator "
+                            << m_warmleader << std::endl;
+                    wait_val_ = maxWait + delta;
+                }
+                m_warmleader.clear();
+            }
             boost::posix_time::milliseconds proportional_Timeout( wait_val_ );
             /* Set deadline timer to call Merge() */
-            Logger.Notice << "TIMER: Waiting for Merge(): " << wait_val_ << " ms." << std::endl;
+            LOG_NOTICE(Logger) << "TIMER: Waiting for Merge(): " << wait_val_ << " ms." << std::endl;
             CBroker::Instance().Schedule(m_timer, proportional_Timeout,
                 boost::bind(&GMAgent::Merge, this, boost::asio::placeholders::error));
         }
         else
         {    // We didn't find any other Coordinators, go back to work
-            Logger.Info << "TIMER: Setting CheckTimer (Check): " << __LINE__ << std::endl;
+            LOG_INFO(Logger) << "TIMER: Setting CheckTimer (Check): " << __LINE__ << std::endl;
             CBroker::Instance().Schedule(m_timer, CHECK_TIMEOUT,
                 boost::bind(&GMAgent::Check, this, boost::asio::placeholders::error));
         }
@@ -688,7 +1821,7 @@ void GMAgent::Premerge( const boost::system::error_code &err )
     else
     {
         // Unexpected error
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
 }
@@ -709,38 +1842,35 @@ void GMAgent::Premerge( const boost::system::error_code &err )
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Merge( const boost::system::error_code& err )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(!IsCoordinator())
     {
         // Premerge made me wait. If in the waiting period I accepted someone
         // else's invitation, I am no longer a Coordinator and don't need to worry
         // about performing this anymore.
-        Logger.Notice << "Skipping Merge(): No longer a Coordinator." << std::endl;
+        LOG_NOTICE(Logger) << "Skipping Merge(): No longer a Coordinator." << std::endl;
         return;
     }
     if( !err )
     {
         // This proc forms a new group by inviting Coordinators in CoordinatorSet
         SetStatus(GMAgent::ELECTION);
-        Logger.Notice << "+ State Change ELECTION : "<<__LINE__<<std::endl;
+        LOG_NOTICE(Logger) << "+ State Change ELECTION : "<<__LINE__<<std::endl;
         // Update GroupID
         m_GrpCounter++;
         m_GroupID = m_GrpCounter;
         m_GroupLeader = GetUUID();
         // Clear the FID state, this gives us a more accurate BFS
         m_fidstate.clear();
-        Logger.Notice << "Changed group: " << m_GroupID << " (" << m_GroupLeader << ")" << std::endl;
-        // m_UpNodes are the members of my group.
+        LOG_NOTICE(Logger) << "Changed group: " << m_GroupID << " (" << m_GroupLeader << ")" << std::endl;
+        GroupChangesMetric.Increment();
+        // m_UpNodes are the members of my group. The Coordinators and the
+        // members are invited together, in one pass over the peers.
         PeerSet tempSet_ = m_UpNodes;
         m_UpNodes.clear();
-        // Create new invitation and send it to all Coordinators
-        ModuleMessage m_ = Invitation();
-        Logger.Info <<"SEND: Sending out Invites (Invite Coordinators)"<<std::endl;
-        BOOST_FOREACH( CPeerNode& peer, m_Coordinators | boost::adaptors::map_values)
+        BOOST_FOREACH(CPeerNode peer, m_Coordinators | boost::adaptors::map_values)
         {
-            if( peer.GetUUID() == GetUUID())
-                continue;
-            peer.Send(m_);
+            InsertInPeerSet(tempSet_, peer);
         }
         // Previously, this set the global timer and waited for GLOBAL_TIMEOUT
         // Before inviting group nodes. However, looking at the original text of the
@@ -754,7 +1884,7 @@ void GMAgent::Merge( const boost::system::error_code& err )
     }
     else
     {
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
     //m_CheckTimer.expires_from_now( boost::posix_time::seconds(CHECK_TIMEOUT) );
@@ -774,30 +1904,34 @@ void GMAgent::Merge( const boost::system::error_code& err )
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::InviteGroupNodes( const boost::system::error_code& err, PeerSet p_tempSet )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if( !err || err == boost::asio::error::operation_aborted )
     {
         /* If the timer expired, err should be false, if canceled,
          * second condition is true.    Timer should only be canceled if
          * we are no longer waiting on more replies  */
-        ModuleMessage m_ = Invitation();
-        Logger.Info <<"SEND: Sending out Invites (Invite Group Nodes):"<<std::endl;
-        BOOST_FOREACH( CPeerNode& peer, p_tempSet | boost::adaptors::map_values)
-        {
-            if( peer.GetUUID() == GetUUID())
-                continue;
-            peer.Send(m_);
-        }
+        ModuleMessage invite = Invitation();
+        CSerializedMessage::Pointer m_(new CSerializedMessage(ShareMessage(invite)));
+        LOG_INFO(Logger) <<"SEND: Sending out Invites (Invite Group Nodes):"<<std::endl;
+        PeerSet others = p_tempSet;
+        others.erase(GetUUID());
+        SendToPeers(others, m_);
         if(IsCoordinator())
         {     // We only call Reorganize if we are the new leader
-            Logger.Info << "TIMER: Setting GlobalTimer (Reorganize) : " << __LINE__ << std::endl;
-            CBroker::Instance().Schedule(m_timer, INVITE_RESPONSE_TIMEOUT,
+            std::set<std::string> expected;
+            BOOST_FOREACH(const std::string& uuid, others | boost::adaptors::map_keys)
+            {
+                expected.insert(uuid);
+            }
+            // Without anyone to wait on, the group is organized at once
+            LOG_INFO(Logger) << "TIMER: Setting GlobalTimer (Reorganize) : " << __LINE__ << std::endl;
+            m_invites.Start(m_timer, INVITE_RESPONSE_TIMEOUT, expected,
                 boost::bind(&GMAgent::Reorganize, this, boost::asio::placeholders::error));
         }
     }
     else
     {
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
     return;
@@ -814,11 +1948,11 @@ void GMAgent::InviteGroupNodes( const boost::system::error_code& err, PeerSet p_
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Reorganize( const boost::system::error_code& err )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if( !err )
     {
         SetStatus(GMAgent::REORGANIZATION);
-        Logger.Notice << "+ State change: REORGANIZATION: " << __LINE__    << std::endl;
+        LOG_NOTICE(Logger) << "+ State change: REORGANIZATION: " << __LINE__    << std::endl;
         // Send new membership list to group members
         // PeerList is the new READY
         PushPeerList();
@@ -826,16 +1960,20 @@ void GMAgent::Reorganize( const boost::system::error_code& err )
         m_membershipchecks++;
         // sufficiently_long_Timeout; maybe Reorganize if something blows up
         SetStatus(GMAgent::NORMAL);
-        Logger.Notice << "+ State change: NORMAL: " << __LINE__ << std::endl;
+        LOG_NOTICE(Logger) << "+ State change: NORMAL: " << __LINE__ << std::endl;
         m_groupsformed++;
         // Back to work
-        Logger.Info << "TIMER: Setting CheckTimer (Check): " << __LINE__ << std::endl;
+        LOG_INFO(Logger) << "TIMER: Setting CheckTimer (Check): " << __LINE__ << std::endl;
         CBroker::Instance().Schedule(m_timer, CHECK_TIMEOUT,
             boost::bind(&GMAgent::Check, this, boost::asio::placeholders::error));
     }
+    else if(boost::asio::error::operation_aborted == err)
+    {
+        // The timer was set again before the invited nodes accepted
+    }
     else
     {
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
 }
@@ -850,25 +1988,26 @@ void GMAgent::Reorganize( const boost::system::error_code& err )
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::Timeout( const boost::system::error_code& err )
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     CPeerNode peer;
     if( !err )
     {
         SystemState();
+        ReloadTimings();
         /* If we are the group leader, we don't need to run this */
-        ModuleMessage m_ = AreYouThere();
+        CSerializedMessage::Pointer m_ = AreYouThere();
         peer = GetPeer(Coordinator());
         m_AYTResponse.clear();
         if(!IsCoordinator())
         {
-            Logger.Info << "SEND: Sending AreYouThere messages." << std::endl;
+            LOG_INFO(Logger) << "SEND: Sending AreYouThere messages." << std::endl;
             if(peer.GetUUID() != GetUUID())
             {
                 peer.Send(m_);
-                Logger.Info << "Expecting response from "<<peer.GetUUID()<<std::endl;
-                InsertInTimedPeerSet(m_AYTResponse, peer, boost::posix_time::microsec_clock::universal_time());
+                LOG_INFO(Logger) << "Expecting response from "<<peer.GetUUID()<<std::endl;
+                InsertInTimedPeerSet(m_AYTResponse, peer, CVirtualClock::Now());
             }
-            Logger.Info << "TIMER: Setting TimeoutTimer (Recovery):" << __LINE__ << std::endl;
+            LOG_INFO(Logger) << "TIMER: Setting TimeoutTimer (Recovery):" << __LINE__ << std::endl;
             CBroker::Instance().Schedule(m_timer, AYT_RESPONSE_TIMEOUT,
                 boost::bind(&GMAgent::Recovery, this, boost::asio::placeholders::error));
         }
@@ -880,7 +2019,7 @@ void GMAgent::Timeout( const boost::system::error_code& err )
     else
     {
         /* An error occurred */
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
 }
@@ -895,20 +2034,34 @@ void GMAgent::Timeout( const boost::system::error_code& err )
 PeerSet GMAgent::ProcessPeerList(const PeerListMessage& msg)
 {
     // Note: The group leader inserts himself into the peer list.
+    return ProcessConnectedPeers(msg.connected_peer_message());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::ProcessConnectedPeers
+/// @description Finds the peers listed in a message, adding the previously
+///     unknown ones to the connection manager.
+/// @param peers The peers to parse
+/// @return A PeerSet with the listed nodes.
+/// @ErrorHandling Throws std::runtime_error if a port is invalid.
+///////////////////////////////////////////////////////////////////////////////
+PeerSet GMAgent::ProcessConnectedPeers(
+    const google::protobuf::RepeatedPtrField<ConnectedPeerMessage>& peers)
+{
     PeerSet tmp;
-    //Logger.Debug<<"Looping Peer List"<<std::endl;
-    BOOST_FOREACH(const ConnectedPeerMessage &cpm, msg.connected_peer_message())
+    //LOG_DEBUG(Logger)<<"Looping Peer List"<<std::endl;
+    BOOST_FOREACH(const ConnectedPeerMessage &cpm, peers)
     {
-        //Logger.Debug<<"Peer Item"<<std::endl;
+        //LOG_DEBUG(Logger)<<"Peer Item"<<std::endl;
         std::string nuuid = cpm.uuid();
         std::string nhost = cpm.host();
         std::string nport = cpm.port();
         if(!IsValidPort(nport))
         {
             throw std::runtime_error(
-                "GMAgent::ProcessPeerList: invalid port: " + msg.DebugString());
+                "GMAgent::ProcessConnectedPeers: invalid port: " + cpm.DebugString());
         }
-        //Logger.Debug<<"Got Peer ("<<nuuid<<","<<nhost<<","<<nport<<")"<<std::endl;
+        //LOG_DEBUG(Logger)<<"Got Peer ("<<nuuid<<","<<nhost<<","<<nport<<")"<<std::endl;
         CPeerNode p;
         try
         {
@@ -916,7 +2069,7 @@ PeerSet GMAgent::ProcessPeerList(const PeerListMessage& msg)
         }
         catch(EDgiNoSuchPeerError &e)
         {    
-            Logger.Warn<<"Adding previously unknown peer: "<<nuuid<<std::endl;
+            LOG_WARN(Logger)<<"Adding previously unknown peer: "<<nuuid<<std::endl;
             //If you don't already know about the peer, make sure it is in the connection manager
             CConnectionManager::Instance().PutHost(nuuid, nhost, nport);
             p = CGlobalPeerList::instance().Create(nuuid);
@@ -926,6 +2079,96 @@ PeerSet GMAgent::ProcessPeerList(const PeerListMessage& msg)
     return tmp;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::UpdateMembership
+/// @description Builds the membership described by a peer list. A full list
+///     replaces the membership; a delta is applied to the current one. The
+///     snapshots are shared, so the modules of a node receiving the same
+///     version of the membership reuse the snapshot built by the first one.
+/// @pre None
+/// @post The new snapshot is cached if the peer list has a version.
+/// @param current The membership the caller holds, or null.
+/// @param msg The peer list that was received.
+/// @param leader The UUID of the node that sent the peer list.
+/// @return The new membership, or null if msg is a delta that does not apply
+///     to current, in which case the caller should ask the leader for the
+///     full list with PeerListQuery.
+///////////////////////////////////////////////////////////////////////////////
+MembershipSnapshot GMAgent::UpdateMembership(MembershipSnapshot current,
+    const PeerListMessage& msg, const std::string& leader)
+{
+    if(msg.has_epoch())
+    {
+        boost::mutex::scoped_lock lock(MembershipMutex);
+        BOOST_FOREACH(MembershipSnapshot snapshot, RecentMemberships)
+        {
+            if(snapshot->leader == leader && snapshot->group == msg.group_id()
+                && snapshot->epoch == msg.epoch())
+            {
+                return snapshot;
+            }
+        }
+    }
+
+    if(msg.has_base_epoch() && (!current || current->leader != leader
+        || current->group != msg.group_id() || current->epoch != msg.base_epoch()))
+    {
+        LOG_NOTICE(Logger) << "Peer list version " << msg.epoch() << " from "
+                << leader << " does not follow the known version" << std::endl;
+        return MembershipSnapshot();
+    }
+
+    boost::shared_ptr<SMembershipSnapshot> next(new SMembershipSnapshot);
+    next->leader = leader;
+    next->group = msg.group_id();
+    next->epoch = msg.epoch();
+    next->added = ProcessPeerList(msg);
+    next->full = !msg.has_base_epoch();
+    next->base = msg.base_epoch();
+    if(next->full)
+    {
+        next->peers = next->added;
+    }
+    else
+    {
+        next->peers = current->peers;
+        BOOST_FOREACH(const std::string& uuid, msg.removed_uuid())
+        {
+            next->peers.erase(uuid);
+            next->removed.push_back(uuid);
+        }
+        BOOST_FOREACH(CPeerNode peer, next->added | boost::adaptors::map_values)
+        {
+            InsertInPeerSet(next->peers, peer);
+        }
+    }
+
+    if(msg.has_epoch())
+    {
+        boost::mutex::scoped_lock lock(MembershipMutex);
+        RecentMemberships.push_front(next);
+        if(RecentMemberships.size() > MEMBERSHIP_CACHE_SIZE)
+        {
+            RecentMemberships.pop_back();
+        }
+    }
+    return next;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::IsDeltaOf
+/// @description Tells a module whether it can update its own state from the
+///     changes recorded in a snapshot rather than rebuilding it.
+/// @param next The snapshot just received.
+/// @param current The snapshot the module held before.
+/// @return True if next lists the changes made to current.
+///////////////////////////////////////////////////////////////////////////////
+bool GMAgent::IsDeltaOf(MembershipSnapshot next, MembershipSnapshot current)
+{
+    return next && current && !next->full && next->leader == current->leader
+        && next->group == current->group && next->base == current->epoch;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// GMAgent::HandlePeerList
 /// @description Handles receiveing the peerlist.
@@ -937,35 +2180,70 @@ PeerSet GMAgent::ProcessPeerList(const PeerListMessage& msg)
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandlePeerList(const PeerListMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    if(peer.GetUUID() == m_GroupLeader && GetStatus() == GMAgent::REORGANIZATION)
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    // With hierarchical groups the combined group is only for the modules
+    if(m_hierarchical && !msg.segment_only())
+    {
+        return;
+    }
+    if(peer.GetUUID() != m_GroupLeader || (GetStatus() != GMAgent::REORGANIZATION
+        && GetStatus() != GMAgent::NORMAL))
+    {
+        return;
+    }
+    MembershipSnapshot previous = m_snapshot;
+    MembershipSnapshot next = UpdateMembership(previous, msg, peer.GetUUID());
+    if(!next)
+    {
+        peer.Send(PeerListQuery("gm"));
+        return;
+    }
+    m_snapshot = next;
+    m_standby = msg.standby_uuid();
+    m_standbywait = false;
+
+    if(GetStatus() == GMAgent::REORGANIZATION)
     {
         SetStatus(GMAgent::NORMAL);
-        Logger.Notice << "+ State change: NORMAL: " << __LINE__ << std::endl;
+        LOG_NOTICE(Logger) << "+ State change: NORMAL: " << __LINE__ << std::endl;
         m_groupsjoined++;
         // We are no longer the Coordinator, we must run Timeout()
-        Logger.Info << "TIMER: Canceling TimeoutTimer : " << __LINE__ << std::endl;
+        LOG_INFO(Logger) << "TIMER: Canceling TimeoutTimer : " << __LINE__ << std::endl;
         // We used to set a timeout timer here but cancelling the
         // timer should accomplish the same thing.
         CBroker::Instance().Schedule(m_timer, TIMEOUT_TIMEOUT,
-            boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error));
-        Logger.Info << "RECV: PeerList (Ready) message from " <<peer.GetUUID() << std::endl;
-        m_UpNodes.clear();
-        m_UpNodes = ProcessPeerList(msg);
+            boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error),
+            boost::posix_time::milliseconds(0));
+        LOG_INFO(Logger) << "RECV: PeerList (Ready) message from " <<peer.GetUUID() << std::endl;
+        m_UpNodes = next->peers;
         m_membership += m_UpNodes.size();
         m_membershipchecks++;
         m_UpNodes.erase(GetUUID());
-        Logger.Notice<<"Updated Peer Set."<<std::endl;
+        LOG_NOTICE(Logger)<<"Updated Peer Set."<<std::endl;
     }
-    else if(peer.GetUUID() == m_GroupLeader && GetStatus() == GMAgent::NORMAL)
+    else
     {
-        m_UpNodes.clear();
-        m_UpNodes = ProcessPeerList(msg);
+        if(IsDeltaOf(next, previous))
+        {
+            BOOST_FOREACH(const std::string& uuid, next->removed)
+            {
+                m_UpNodes.erase(uuid);
+            }
+            BOOST_FOREACH(CPeerNode p, next->added | boost::adaptors::map_values)
+            {
+                InsertInPeerSet(m_UpNodes, p);
+            }
+        }
+        else
+        {
+            m_UpNodes = next->peers;
+        }
         m_membership = m_UpNodes.size()+1;
         m_membershipchecks++;
         m_UpNodes.erase(GetUUID());
-        Logger.Notice<<"Updated peer set (UPDATE)"<<std::endl;
+        LOG_NOTICE(Logger)<<"Updated peer set (UPDATE)"<<std::endl;
     }
+    SaveWarmGroup();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -974,16 +2252,18 @@ void GMAgent::HandlePeerList(const PeerListMessage& msg, CPeerNode peer)
 /// @key gm.Accept
 /// @pre In an election, and invites have been sent out.
 /// @post The sender is added to the tenative list of accepted peers for the group,
-///     if the accept messag is for the correct group identifier.
+///     if the accept messag is for the correct group identifier. Once every
+///     invited node and every node they forwarded the invite to has accepted,
+///     the group is organized without waiting out the invite timeout.
 /// @peers Any node which has received an invite. (This can be any selection of
 ///     the global peerlist, not just the ones this specific node sent the message
 ///     to.)
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleAccept(const AcceptMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     unsigned int msg_group = msg.group_id();
-    Logger.Info << "RECV: Accept Message from " << peer.GetUUID() << std::endl;
+    LOG_INFO(Logger) << "RECV: Accept Message from " << peer.GetUUID() << std::endl;
     if(GetStatus() == GMAgent::ELECTION && msg_group == m_GroupID && IsCoordinator())
     {
         // We are holding an election, the remote peer wants to join
@@ -991,10 +2271,24 @@ void GMAgent::HandleAccept(const AcceptMessage& msg, CPeerNode peer)
         InsertInPeerSet(m_UpNodes,peer);
         // XXX I am not sure if the client should get some sort of ACK
         // or perhaps this comes in the means of the Ready msg
+        // A coordinator that joins also brings the members it invited
+        BOOST_FOREACH(const std::string& uuid, msg.forwarded_uuid())
+        {
+            if(uuid != GetUUID() && m_UpNodes.count(uuid) == 0)
+            {
+                m_invites.Expect(uuid);
+            }
+        }
+        if(m_invites.Respond(peer.GetUUID()))
+        {
+            // The group is organized in the phase of group management,
+            // without waiting out the invite response timeout
+            LOG_INFO(Logger) << "All invited nodes accepted" << std::endl;
+        }
     }
     else
     {
-        Logger.Warn << "Unexpected Accept message" << std::endl;
+        LOG_WARN_LIMITED(Logger, 1) << "Unexpected Accept message" << std::endl;
     }
 }
 
@@ -1008,21 +2302,21 @@ void GMAgent::HandleAccept(const AcceptMessage& msg, CPeerNode peer)
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleAreYouCoordinator(const AreYouCoordinatorMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     int seq = msg.sequence_no();
-    Logger.Info << "RECV: AreYouCoordinator message from "<< peer.GetUUID() <<" seq: "<<seq<<std::endl;
+    LOG_INFO(Logger) << "RECV: AreYouCoordinator message from "<< peer.GetUUID() <<" seq: "<<seq<<std::endl;
     if(GetStatus() == GMAgent::NORMAL && IsCoordinator())
     {
         // We are the group Coordinator AND we are at normal operation
-        Logger.Info << "SEND: AYC Response (YES) to "<<peer.GetUUID()<<std::endl;
-        ModuleMessage m_ = AreYouCoordinatorResponse("yes",seq);
+        LOG_INFO(Logger) << "SEND: AYC Response (YES) to "<<peer.GetUUID()<<std::endl;
+        CSerializedMessage::Pointer m_ = AreYouCoordinatorResponse("yes",seq);
         peer.Send(m_);
     }
     else
     {
         // We are not the Coordinator OR we are not at normal operation
-        Logger.Info << "SEND: AYC Response (NO) to "<<peer.GetUUID()<<std::endl;
-        ModuleMessage m_ = AreYouCoordinatorResponse("no",seq);
+        LOG_INFO(Logger) << "SEND: AYC Response (NO) to "<<peer.GetUUID()<<std::endl;
+        CSerializedMessage::Pointer m_ = AreYouCoordinatorResponse("no",seq);
         peer.Send(m_);
     }
 }
@@ -1037,23 +2331,25 @@ void GMAgent::HandleAreYouCoordinator(const AreYouCoordinatorMessage& msg, CPeer
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleAreYouThere(const AreYouThereMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     int seq = msg.sequence_no();
-    Logger.Info << "RECV: AreYouThere message from " << peer.GetUUID()  <<" seq: "<<seq<< std::endl;
+    LOG_INFO(Logger) << "RECV: AreYouThere message from " << peer.GetUUID()  <<" seq: "<<seq<< std::endl;
     unsigned int msg_group = msg.group_id();
     bool ingroup = CountInPeerSet(m_UpNodes,peer);
     if(IsCoordinator() && msg_group == m_GroupID && ingroup)
     {
-        Logger.Info << "SEND: AYT Response (YES) to "<<peer.GetUUID()<<std::endl;
+        LOG_INFO(Logger) << "SEND: AYT Response (YES) to "<<peer.GetUUID()<<std::endl;
         // We are Coordinator, peer is in our group, and peer is up
-        ModuleMessage m_ = AreYouThereResponse("yes",seq);
+        m_phasedemand[peer.GetUUID()].assign(msg.phase_demand().begin(),
+            msg.phase_demand().end());
+        CSerializedMessage::Pointer m_ = AreYouThereResponse("yes",seq);
         peer.Send(m_);
     }
     else
     {
-        Logger.Info << "SEND: AYT Response (NO) to "<<peer.GetUUID()<<std::endl;
+        LOG_INFO(Logger) << "SEND: AYT Response (NO) to "<<peer.GetUUID()<<std::endl;
         // We are not Coordinator OR peer is not in our groups OR peer is down
-        ModuleMessage m_ = AreYouThereResponse("no",seq);
+        CSerializedMessage::Pointer m_ = AreYouThereResponse("no",seq);
         peer.Send(m_);
     }
 }
@@ -1071,35 +2367,46 @@ void GMAgent::HandleAreYouThere(const AreYouThereMessage& msg, CPeerNode peer)
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleInvite(const InviteMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     PeerSet tempSet_;
     std::string coord_;
-    Logger.Info << "RECV: Invite message from " <<peer.GetUUID() << std::endl;
+    LOG_INFO(Logger) << "RECV: Invite message from " <<peer.GetUUID() << std::endl;
+    if(m_hierarchical && !m_hierarchy.InSegment(msg.group_leader_uuid()))
+    {
+        LOG_INFO(Logger) << "Declined invite from outside the segment" << std::endl;
+        return;
+    }
     if(GetStatus() == GMAgent::NORMAL)
     {
         // STOP ALL JOBS.
         coord_ = Coordinator();
         tempSet_ = m_UpNodes;
         SetStatus(GMAgent::ELECTION);
-        Logger.Notice << "+ State Change ELECTION : "<<__LINE__<<std::endl;
+        LOG_NOTICE(Logger) << "+ State Change ELECTION : "<<__LINE__<<std::endl;
 
         m_GroupID = msg.group_id();
         m_GroupLeader = msg.group_leader_uuid();
-        Logger.Notice << "Changed group: " << m_GroupID << " (" << m_GroupLeader << ") " << std::endl;
+        LOG_NOTICE(Logger) << "Changed group: " << m_GroupID << " (" << m_GroupLeader << ") " << std::endl;
+        GroupChangesMetric.Increment();
         if(coord_ == GetUUID())
         {
-            Logger.Info << "SEND: Sending invitations to former group members" << std::endl;
+            LOG_INFO(Logger) << "SEND: Sending invitations to former group members" << std::endl;
             // Forward invitation to all members of my group
-            ModuleMessage m_ = Invitation();
-            BOOST_FOREACH(CPeerNode peer, tempSet_ | boost::adaptors::map_values)
-            {
-                if( peer.GetUUID() == GetUUID())
-                    continue;
-                peer.Send(m_);
-            }
+            tempSet_.erase(GetUUID());
+            SendToPeers(tempSet_, Invitation());
+        }
+        else
+        {
+            tempSet_.clear();
         }
         ModuleMessage m_ = Accept();
-        Logger.Info << "SEND: Invitation accept to "<<peer.GetUUID()<< std::endl;
+        // The new leader waits for the accepts of the forwarded invites too
+        BOOST_FOREACH(const std::string& uuid, tempSet_ | boost::adaptors::map_keys)
+        {
+            m_.mutable_group_management_message()->mutable_accept_message()
+                ->add_forwarded_uuid(uuid);
+        }
+        LOG_INFO(Logger) << "SEND: Invitation accept to "<<peer.GetUUID()<< std::endl;
         //Send Accept
         //If this is a forwarded invite, the source may not be where I want
         //send my accept to. Instead, we will generate it based on the groupleader
@@ -1117,15 +2424,15 @@ void GMAgent::HandleInvite(const InviteMessage& msg, CPeerNode peer)
                 throw std::runtime_error(
                     "GMAgent::HandleInvite: invalid port: " + msg.DebugString());
             }
-            Logger.Warn<<"Got invite from unknonwn peer: "<<m_GroupLeader<<". Added."<<std::endl;
+            LOG_WARN(Logger)<<"Got invite from unknonwn peer: "<<m_GroupLeader<<". Added."<<std::endl;
             //If you don't already know about the peer, make sure it is in the connection manager
             CConnectionManager::Instance().PutHost(m_GroupLeader, nhost, nport);
             p = CGlobalPeerList::instance().Create(m_GroupLeader);
         }
         p.Send(m_);
         SetStatus(GMAgent::REORGANIZATION);
-        Logger.Notice << "+ State Change REORGANIZATION : "<<__LINE__<<std::endl;
-        Logger.Info << "TIMER: Setting TimeoutTimer (Recovery) : " << __LINE__ << std::endl;
+        LOG_NOTICE(Logger) << "+ State Change REORGANIZATION : "<<__LINE__<<std::endl;
+        LOG_INFO(Logger) << "TIMER: Setting TimeoutTimer (Recovery) : " << __LINE__ << std::endl;
         CBroker::Instance().Schedule(m_timer, TIMEOUT_TIMEOUT,
             boost::bind(&GMAgent::Recovery, this, boost::asio::placeholders::error));
     }
@@ -1148,15 +2455,15 @@ void GMAgent::HandleInvite(const InviteMessage& msg, CPeerNode peer)
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleResponseAYC(const AreYouCoordinatorResponseMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     std::string answer = msg.payload();
     int seq = msg.sequence_no();
-    Logger.Info << "RECV: Response (AYC) ("<<answer<<") from " <<peer.GetUUID() << " seq "<<seq<< std::endl;
+    LOG_INFO(Logger) << "RECV: Response (AYC) ("<<answer<<") from " <<peer.GetUUID() << " seq "<<seq<< std::endl;
     bool expected = CountInTimedPeerSet(m_AYCResponse,peer);
     if(expected)
     {
-        boost::posix_time::time_duration interval = boost::posix_time::microsec_clock::universal_time() - GetTimeFromPeerSet(m_AYCResponse, peer);
-        Logger.Info << "AYC response received " << interval << " after query sent" << std::endl;
+        boost::posix_time::time_duration interval = CVirtualClock::Now() - GetTimeFromPeerSet(m_AYCResponse, peer);
+        LOG_INFO(Logger) << "AYC response received " << interval << " after query sent" << std::endl;
         //Update the states of the available FIDs
         BOOST_FOREACH(const FidStateMessage &fsm, msg.fid_state())
         {
@@ -1171,7 +2478,7 @@ void GMAgent::HandleResponseAYC(const AreYouCoordinatorResponseMessage& msg, CPe
         InsertInPeerSet(m_Coordinators,peer);
         if(m_AYCResponse.size() == 0)
         {
-            Logger.Info << "TIMER: Canceling GlobalTimer : " << __LINE__ << std::endl;
+            LOG_INFO(Logger) << "TIMER: Canceling GlobalTimer : " << __LINE__ << std::endl;
             //Before, we just cleared this timer. Now I'm going to set it to start another check cycle
             CBroker::Instance().Schedule(m_timer, TIMEOUT_TIMEOUT,
                 boost::bind(&GMAgent::Check, this, boost::asio::placeholders::error));
@@ -1193,7 +2500,7 @@ void GMAgent::HandleResponseAYC(const AreYouCoordinatorResponseMessage& msg, CPe
     }
     else
     {
-        Logger.Warn<< "Unsolicited AreYouCoordinator response from "<<peer.GetUUID()<< std::endl;
+        LOG_WARN_LIMITED(Logger, 1)<< "Unsolicited AreYouCoordinator response from "<<peer.GetUUID()<< std::endl;
     }
 }
 
@@ -1209,23 +2516,38 @@ void GMAgent::HandleResponseAYC(const AreYouCoordinatorResponseMessage& msg, CPe
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandleResponseAYT(const AreYouThereResponseMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     std::string answer = msg.payload();
     int seq = msg.sequence_no();
-    Logger.Info << "RECV: Response (AYT) ("<<answer<<") from " <<peer.GetUUID() << " seq " <<seq<<std::endl;
+    LOG_INFO(Logger) << "RECV: Response (AYT) ("<<answer<<") from " <<peer.GetUUID() << " seq " <<seq<<std::endl;
     bool expected = CountInTimedPeerSet(m_AYTResponse,peer);
     if(expected)
     {
-        boost::posix_time::time_duration interval = boost::posix_time::microsec_clock::universal_time() - GetTimeFromPeerSet(m_AYTResponse, peer);
-        Logger.Info << "AYT response received " << interval << " after query sent" << std::endl;
+        boost::posix_time::time_duration interval = CVirtualClock::Now() - GetTimeFromPeerSet(m_AYTResponse, peer);
+        LOG_INFO(Logger) << "AYT response received " << interval << " after query sent" << std::endl;
     }
 
     EraseInTimedPeerSet(m_AYTResponse,peer);
     if(expected == true && answer == "yes")
     {
-        Logger.Info << "TIMER: Setting TimeoutTimer (Timeout): " << __LINE__ << std::endl;
+        if(msg.has_phase_schedule() && peer.GetUUID() == Coordinator())
+        {
+            const PhaseScheduleMessage& psm = msg.phase_schedule();
+            if(m_phaseleader != peer.GetUUID() || m_phaseversion != psm.version())
+            {
+                LOG_NOTICE(Logger) << "Following phase schedule " << psm.version()
+                    << " of " << peer.GetUUID() << std::endl;
+                m_phaselengths.assign(psm.phase_length().begin(), psm.phase_length().end());
+                m_phaseeffective = psm.effective();
+                m_phaseversion = psm.version();
+                m_phaseleader = peer.GetUUID();
+                CBroker::Instance().SetPhaseLengths(m_phaselengths, m_phaseeffective);
+            }
+        }
+        LOG_INFO(Logger) << "TIMER: Setting TimeoutTimer (Timeout): " << __LINE__ << std::endl;
         CBroker::Instance().Schedule(m_timer, TIMEOUT_TIMEOUT,
-            boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error));
+            boost::bind(&GMAgent::Timeout, this, boost::asio::placeholders::error),
+            boost::posix_time::milliseconds(0));
     }
     else if(answer == "no")
     {
@@ -1236,7 +2558,7 @@ void GMAgent::HandleResponseAYT(const AreYouThereResponseMessage& msg, CPeerNode
     }
     else
     {
-        Logger.Warn<< "Unsolicited AreYouThere response from "<<peer.GetUUID()<<std::endl;
+        LOG_WARN_LIMITED(Logger, 1)<< "Unsolicited AreYouThere response from "<<peer.GetUUID()<<std::endl;
     }
 }
 
@@ -1251,7 +2573,130 @@ void GMAgent::HandleResponseAYT(const AreYouThereResponseMessage& msg, CPeerNode
 ///////////////////////////////////////////////////////////////////////////////
 void GMAgent::HandlePeerListQuery(const PeerListQueryMessage& msg, CPeerNode peer)
 {
-    peer.Send(PeerList(msg.requester()));
+    ModuleMessage list = PeerList(msg.requester());
+    peer.Send(ShareMessage(list));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::HandlePing
+/// @description Acknowledges a SWIM probe, relaying it to the origin if the
+///     probe was sent on another node's behalf.
+/// @key gm.Ping
+/// @pre None
+/// @post The piggybacked updates are merged and the probe acknowledged.
+/// @peers Any node running the SWIM failure detector.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::HandlePing(const PingMessage& msg, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    ApplyAlive(peer.GetUUID(), msg.incarnation());
+    ApplyUpdates(msg.update());
+    peer.Send(PingAck(msg.sequence_no(), GetUUID(), m_swim.GetIncarnation(),
+        msg.has_origin() ? msg.origin() : ""));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::HandlePingRequest
+/// @description Probes a node on behalf of the sender.
+/// @key gm.PingRequest
+/// @pre None
+/// @post The target is probed and will acknowledge through this node.
+/// @peers Any node running the SWIM failure detector.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::HandlePingRequest(const PingRequestMessage& msg, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    ApplyAlive(peer.GetUUID(), msg.incarnation());
+    ApplyUpdates(msg.update());
+    try
+    {
+        GetPeer(msg.target()).Send(Ping(msg.sequence_no(), peer.GetUUID()));
+    }
+    catch(EDgiNoSuchPeerError &e)
+    {
+        LOG_WARN(Logger) << "Asked to probe unknown peer " << msg.target() << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::HandlePingAck
+/// @description Handles an acknowledgement of a SWIM probe. One that answers
+///     a probe sent for another node is relayed to that node.
+/// @key gm.PingAck
+/// @pre None
+/// @post The target is known to be alive. The current probe is acknowledged
+///     if the acknowledgement is for it.
+/// @peers The probed node, or a node that probed it for this one.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::HandlePingAck(const PingAckMessage& msg, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    ApplyAlive(msg.target(), msg.incarnation());
+    ApplyUpdates(msg.update());
+    if(msg.has_origin() && msg.origin() != GetUUID())
+    {
+        try
+        {
+            GetPeer(msg.origin()).Send(PingAck(msg.sequence_no(), msg.target(),
+                msg.incarnation(), ""));
+        }
+        catch(EDgiNoSuchPeerError &e)
+        {
+            LOG_WARN(Logger) << "Cannot relay ack to unknown peer " << msg.origin() << std::endl;
+        }
+    }
+    else if(m_probing && msg.sequence_no() == m_probeseq &&
+        msg.target() == m_probetarget)
+    {
+        LOG_DEBUG(Logger) << "RECV: Ack for probe of " << msg.target()
+            << " from " << peer.GetUUID() << std::endl;
+        m_probeacked = true;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GMAgent::HandleSegmentReport
+/// @description Handles the report of another segment coordinator. A node
+///     that does not coordinate its segment passes the report on to its
+///     coordinator, so a report reaches a segment through any of its nodes.
+/// @key gm.SegmentReport
+/// @pre Hierarchical groups are enabled.
+/// @post The report is kept for choosing and building the combined group.
+/// @peers The coordinators of the other segments, or the members of this
+///     segment forwarding their reports.
+///////////////////////////////////////////////////////////////////////////////
+void GMAgent::HandleSegmentReport(const SegmentReportMessage& msg, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(!m_hierarchical || m_hierarchy.InSegment(msg.coordinator_uuid()))
+    {
+        return;
+    }
+    if(!IsCoordinator())
+    {
+        if(GetStatus() == GMAgent::NORMAL)
+        {
+            LOG_DEBUG(Logger) << "Forwarding segment report of "
+                    << msg.coordinator_uuid() << std::endl;
+            GroupManagementMessage gmm;
+            *gmm.mutable_segment_report_message() = msg;
+            GetPeer(Coordinator()).Send(PrepareForSending(gmm));
+        }
+        return;
+    }
+
+    LOG_DEBUG(Logger) << "RECV: Segment report of " << msg.coordinator_uuid()
+            << " via " << peer.GetUUID() << std::endl;
+    CGroupHierarchy::SReport report;
+    report.coordinator = msg.coordinator_uuid();
+    report.group = msg.group_id();
+    report.members = ProcessConnectedPeers(msg.member());
+    BOOST_FOREACH(const FidStateMessage& fsm, msg.fid_state())
+    {
+        report.fids[fsm.deviceid()] = fsm.state();
+    }
+    report.age = 0;
+    m_hierarchy.Record(report);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1264,7 +2709,7 @@ void GMAgent::HandlePeerListQuery(const PeerListQueryMessage& msg, CPeerNode pee
 ///////////////////////////////////////////////////////////////////////////////
 CPeerNode GMAgent::AddPeer(std::string uuid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     return CGlobalPeerList::instance().Create(uuid);
 }
 
@@ -1303,7 +2748,7 @@ CPeerNode GMAgent::GetPeer(const std::string& uuid)
 /////////////////////////////////////////////////////////
 int GMAgent::Run()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     std::map<std::string, SRemoteHost>::iterator mapIt_;
 
@@ -1311,15 +2756,43 @@ int GMAgent::Run()
         mapIt_ != CConnectionManager::Instance().GetHostsEnd(); ++mapIt_ )
     {
         std::string host_ = mapIt_->first;
-        Logger.Notice<<"Registering peer "<<mapIt_->first<<std::endl;
+        LOG_NOTICE(Logger)<<"Registering peer "<<mapIt_->first<<std::endl;
         AddPeer(const_cast<std::string&>(mapIt_->first));
     }
-    Logger.Notice<<"All peers added "<<CGlobalPeerList::instance().PeerList().size()<<std::endl;
-    BOOST_FOREACH(CPeerNode p_, CGlobalPeerList::instance().PeerList() | boost::adaptors::map_values)
+    CGlobalPeerList::Snapshot known = CGlobalPeerList::instance().PeerList();
+    LOG_NOTICE(Logger)<<"All peers added "<<known->size()<<std::endl;
+    BOOST_FOREACH(const CPeerNode& p_, *known | boost::adaptors::map_values)
+    {
+        LOG_NOTICE(Logger) << "! " <<p_.GetUUID() << " added to peer set" <<std::endl;
+    }
+    if(CGlobalConfiguration::Instance().GetHierarchicalGroups())
+    {
+        if(CPhysicalTopology::Instance().IsAvailable() && m_hierarchy.Load())
+        {
+            LOG_NOTICE(Logger) << "Forming groups per feeder segment" << std::endl;
+            m_hierarchical = true;
+        }
+        else
+        {
+            LOG_WARN(Logger) << "Hierarchical groups need this node in the"
+                    << " physical topology. Forming flat groups." << std::endl;
+        }
+    }
+    const WarmGroup* hint = CWarmState::Instance().GetGroupHint();
+    if(hint != 0 && hint->coordinator() != GetUUID() &&
+        CGlobalPeerList::instance().Count(hint->coordinator()) > 0)
     {
-        Logger.Notice << "! " <<p_.GetUUID() << " added to peer set" <<std::endl;
+        LOG_NOTICE(Logger) << "Last run was in the group of "
+                << hint->coordinator() << std::endl;
+        m_warmleader = hint->coordinator();
     }
     Recovery();
+    if(CGlobalConfiguration::Instance().GetSwimMembership())
+    {
+        LOG_NOTICE(Logger) << "Using the SWIM failure detector" << std::endl;
+        CBroker::Instance().Schedule(m_swimtimer, SWIM_PROBE_PERIOD,
+            boost::bind(&GMAgent::Probe, this, boost::asio::placeholders::error));
+    }
     return 0;
 }
 
@@ -1346,7 +2819,11 @@ int GMAgent::GetStatus() const
 ////////////////////////////////////////////////////////////
 void GMAgent::SetStatus(int status)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if(status == GMAgent::ELECTION)
+    {
+        ElectionsMetric.Increment();
+    }
     m_status = status;
 }
 
@@ -1363,7 +2840,7 @@ void GMAgent::SetStatus(int status)
 ModuleMessage GMAgent::PrepareForSending(
     const GroupManagementMessage& message, std::string recipient)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     ModuleMessage mm;
     mm.mutable_group_management_message()->CopyFrom(message);
     mm.set_recipient_module(recipient);
@@ -26,7 +26,12 @@
 
 #include "CBroker.hpp"
 #include "IDGIModule.hpp"
+#include "CGroupHierarchy.hpp"
 #include "CPeerNode.hpp"
+#include "CResponseRound.hpp"
+#include "CPhysicalTopology.hpp"
+#include "CSwimMembership.hpp"
+#include "Messages.hpp"
 #include "PeerSets.hpp"
 
 #include "messages/ModuleMessage.pb.h"
@@ -35,12 +40,43 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 
+#include <set>
+#include <string>
+#include <vector>
+
 namespace freedm {
 
 namespace broker {
 
 namespace gm {
 
+/// A version of the group membership, shared by the modules that read it.
+///
+/// Snapshots are never changed once built, so every module of a node can
+/// hold the same one instead of copying the peer list.
+struct SMembershipSnapshot
+{
+    /// The UUID of the group leader that sent the membership
+    std::string leader;
+    /// The group the membership belongs to
+    google::protobuf::uint32 group;
+    /// The version of the membership, or 0 if the sender did not give one
+    google::protobuf::uint64 epoch;
+    /// Every node of the group, the leader included
+    PeerSet peers;
+    /// True if the snapshot was built from a full peer list
+    bool full;
+    /// The version the changes below apply to, if not full
+    google::protobuf::uint64 base;
+    /// The nodes added since the base version
+    PeerSet added;
+    /// The UUIDs of the nodes removed since the base version
+    std::vector<std::string> removed;
+};
+
+/// A shared, read only group membership
+typedef boost::shared_ptr<const SMembershipSnapshot> MembershipSnapshot;
+
 /// Declaration of Garcia-Molina Invitation Leader Election algorithm.
 class GMAgent
   : public IDGIModule
@@ -56,12 +92,24 @@ class GMAgent
     int	Run();
     /// Handles Processing a PeerList
     static PeerSet ProcessPeerList(const PeerListMessage& msg);
+    /// Applies a received peer list to the membership a module holds
+    static MembershipSnapshot UpdateMembership(MembershipSnapshot current,
+        const PeerListMessage& msg, const std::string& leader);
+    /// True if the snapshot only lists the changes made to the current one
+    static bool IsDeltaOf(MembershipSnapshot next, MembershipSnapshot current);
+    /// Generates a CMessage that can be used to query for the group
+    static ModuleMessage PeerListQuery(std::string requester);
 
   private:
     /// Resets the algorithm to the default startup state.
     void Recovery();
     /// Returns true if this node considers itself a coordinator
     bool IsCoordinator() const { return (Coordinator() == GetUUID()); };
+    /// Returns true if this node sends the peer list the modules use
+    bool IsPublisher() const;
+    /// Parses the peers of a message, registering the unknown ones
+    static PeerSet ProcessConnectedPeers(
+        const google::protobuf::RepeatedPtrField<ConnectedPeerMessage>& peers);
 
     // Handlers
     /// Handles received messages
@@ -82,6 +130,14 @@ class GMAgent
     void HandleResponseAYT(const AreYouThereResponseMessage& msg,CPeerNode peere);
     /// Handles recieving peerlist requests
     void HandlePeerListQuery(const PeerListQueryMessage& msg, CPeerNode peer);
+    /// Handles recieving SWIM probes
+    void HandlePing(const PingMessage& msg, CPeerNode peer);
+    /// Handles recieving requests to probe a node for another node
+    void HandlePingRequest(const PingRequestMessage& msg, CPeerNode peer);
+    /// Handles recieving SWIM probe acknowledgements
+    void HandlePingAck(const PingAckMessage& msg, CPeerNode peer);
+    /// Handles the report of another segment coordinator
+    void HandleSegmentReport(const SegmentReportMessage& msg, CPeerNode peer);
 
     //Routines
     /// Checks for other up leaders
@@ -96,24 +152,74 @@ class GMAgent
     void Merge( const boost::system::error_code& err );
     /// Sends the peer list to all group members.
     void PushPeerList();
+    /// Picks the member that takes over if this coordinator fails
+    std::string ChooseStandby(const PeerSet& members) const;
+    /// Forms a new group from the members of the failed coordinator
+    void TakeOver();
+    /// Records the group of this node in the warm state
+    void SaveWarmGroup();
+    /// Sends a new version of the module peer list to the given nodes
+    void PublishMembers(const PeerSet& members);
+    /// Exchanges reports with the other segments and picks the top coordinator
+    void Federate();
+    /// Publishes the combined group if this node is the top coordinator
+    void PublishIsland();
+    /// Reads the states of the FIDs attached to this node
+    static CPhysicalTopology::FIDState ReadLocalFids();
+    /// Updates the group when an attached FID opens or closes
+    void HandleFidChange(float net);
+    /// Removes the members and coordinators the FID states make unreachable
+    bool PruneUnreachable(const CPhysicalTopology::FIDState& fids);
+    /// Resizes the phases of the group for the measured workload.
+    void PlanPhases();
+    /// Starts a phase schedule for the group a few rounds from now.
+    void PublishPhases(const std::vector<unsigned int>& lengths);
+    /// Takes the timings of the last reload of the timings file.
+    void ReloadTimings();
+    /// Starts a SWIM probe period
+    void Probe( const boost::system::error_code& err );
+    /// Asks other nodes to probe a target that did not answer
+    void ProbeIndirect( const boost::system::error_code& err );
+    /// Removes the nodes the failure detector declared dead from the group
+    void HandleFailures();
+    /// Merges the membership updates piggybacked on a SWIM message
+    void ApplyUpdates(
+        const google::protobuf::RepeatedPtrField<MembershipUpdateMessage>& updates);
+    /// Merges the news that a node is alive at an incarnation
+    void ApplyAlive(const std::string& uuid, unsigned int incarnation);
 
     // Messages
     /// Creates AYC Message.
-    ModuleMessage AreYouCoordinator();
+    CSerializedMessage::Pointer AreYouCoordinator();
     /// Creates Group Invitation Message
     ModuleMessage Invitation();
     /// Creates A Response message
-    ModuleMessage AreYouCoordinatorResponse(std::string payload, int seq);
+    CSerializedMessage::Pointer AreYouCoordinatorResponse(std::string payload, int seq);
     /// Creates A Response message
-    ModuleMessage AreYouThereResponse(std::string payload,int seq);
+    CSerializedMessage::Pointer AreYouThereResponse(std::string payload,int seq);
     /// Creates an Accept Message
     ModuleMessage Accept();
     /// Creates a AYT, used for Timeout
-    ModuleMessage AreYouThere();
+    CSerializedMessage::Pointer AreYouThere();
     /// Generates a peer list
     ModuleMessage PeerList(std::string requester="all");
-    /// Generates a CMessage that can be used to query for the group
-    static ModuleMessage PeerListQuery(std::string requester);
+    /// Generates the peer list of the segment group
+    ModuleMessage SegmentList();
+    /// Creates a report of the segment group for other segment coordinators
+    ModuleMessage SegmentReport();
+    /// Generates the changes to the group since the last pushed peer list
+    ModuleMessage PeerListDelta(google::protobuf::uint64 base,
+        const PeerSet& added, const PeerSet& removed);
+    /// Creates a SWIM probe
+    ModuleMessage Ping(unsigned int seq, const std::string& origin);
+    /// Creates a request to probe a node on this node's behalf
+    ModuleMessage PingRequest(unsigned int seq, const std::string& target);
+    /// Creates a SWIM probe acknowledgement
+    ModuleMessage PingAck(unsigned int seq, const std::string& target,
+        unsigned int incarnation, const std::string& origin);
+    /// Adds the membership updates to piggyback on a SWIM message
+    void FillUpdates(
+        google::protobuf::RepeatedPtrField<MembershipUpdateMessage>* updates);
 
     //Peer Set Manipulation
     /// Adds a peer to the peer set from UUID
@@ -145,6 +251,14 @@ class GMAgent
 
     /// Nodes In My Group
     PeerSet m_UpNodes;
+    /// The group members in the last peer list this node pushed
+    PeerSet m_pushedpeers;
+    /// The group of the last peer list this node pushed
+    google::protobuf::uint32 m_pushedgroup;
+    /// The version of the last peer list this node pushed
+    google::protobuf::uint64 m_peerepoch;
+    /// The membership last received from the group leader
+    MembershipSnapshot m_snapshot;
     /// Known Coordinators
     PeerSet m_Coordinators;
     /// Nodes expecting AYC response from
@@ -166,6 +280,8 @@ class GMAgent
     CBroker::TimerHandle m_timer;
     /// Timer for checking FIDs.
     CBroker::TimerHandle m_fidtimer;
+    /// Timer for the SWIM probe periods.
+    CBroker::TimerHandle m_swimtimer;
 
     // Timeouts
     /// How long between AYC checks
@@ -180,6 +296,10 @@ class GMAgent
     boost::posix_time::time_duration AYT_RESPONSE_TIMEOUT;
     /// How long to wait for responses from other nodes.
     boost::posix_time::time_duration INVITE_RESPONSE_TIMEOUT;
+    /// How long to wait for a SWIM probe to be acknowledged directly.
+    boost::posix_time::time_duration SWIM_ACK_TIMEOUT;
+    /// How long a SWIM probe period lasts.
+    boost::posix_time::time_duration SWIM_PROBE_PERIOD;
 
     /// Number of groups formed
     int m_groupsformed ;
@@ -197,6 +317,67 @@ class GMAgent
     int m_status;
     /// A store for the state of attached FIDs.
     std::map< std::string , bool > m_fidstate;
+    /// The states of the FIDs attached to this node, kept by HandleFidChange
+    CPhysicalTopology::FIDState m_localfids;
+    /// The FID states collected by the last check of this coordinator
+    CPhysicalTopology::FIDState m_checkedfids;
+    /// The last phase demand reported by each group member
+    std::map< std::string, std::vector<unsigned int> > m_phasedemand;
+    /// The phase lengths of the last schedule published or followed
+    std::vector<unsigned int> m_phaselengths;
+
+    /// An encoded periodic message and the fields it was encoded with
+    struct SMessageTemplate
+    {
+        /// The fields other than the sequence number, joined
+        std::string key;
+        /// The encoded message, null until the first send
+        boost::shared_ptr<CMessageTemplate> message;
+    };
+    /// The AYT of this node's group
+    SMessageTemplate m_ayttemplate;
+    /// The AYC of this node
+    SMessageTemplate m_ayctemplate;
+    /// The last yes and no AYT responses
+    SMessageTemplate m_aytresponse[2];
+    /// The last yes and no AYC responses without FID states
+    SMessageTemplate m_aycresponse[2];
+    /// When the last phase schedule took effect
+    google::protobuf::uint64 m_phaseeffective;
+    /// The version of the last phase schedule
+    google::protobuf::uint32 m_phaseversion;
+    /// The leader that published the last phase schedule
+    std::string m_phaseleader;
+    /// The reload of the timings file the timeouts were taken from
+    unsigned int m_timingsversion;
+    /// The SWIM failure detector state
+    CSwimMembership m_swim;
+    /// The number of peers in the global peer list known to m_swim
+    std::size_t m_swimknown;
+    /// The node probed in the current probe period
+    std::string m_probetarget;
+    /// The sequence number of the current probe
+    unsigned int m_probeseq;
+    /// True while a probe period is running
+    bool m_probing;
+    /// True once the current probe was acknowledged
+    bool m_probeacked;
+    /// The feeder segments and the reports of their coordinators
+    CGroupHierarchy m_hierarchy;
+    /// True if groups form per feeder segment
+    bool m_hierarchical;
+    /// The segment coordinator that publishes the combined group
+    std::string m_top;
+    /// The nodes physically reachable when the top coordinator was chosen
+    CPhysicalTopology::VertexSet m_reachable;
+    /// The coordinator of the last run, deferred to at the first merge
+    std::string m_warmleader;
+    /// The invites of this election waiting for the nodes to accept
+    CResponseRound m_invites;
+    /// The member named to take over the group if the coordinator fails
+    std::string m_standby;
+    /// True once this node waited for the standby to take over
+    bool m_standbywait;
 };
 
 } // namespace gm
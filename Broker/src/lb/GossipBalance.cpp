@@ -0,0 +1,459 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file           GossipBalance.cpp
+///
+/// @project        FREEDM DGI
+///
+/// @description    Load balance by push-sum averaging of the gateway imbalance
+///
+/// @citations      Kempe, David, Alin Dobra, and Johannes Gehrke.
+///                 Gossip-based computation of aggregate information.
+///                 Foundations of Computer Science, IEEE Symposium on (2003)
+///
+/// @functions      GossipAgent::GossipAgent
+///                 GossipAgent::Run
+///                 GossipAgent::HandleIncomingMessage
+///                 GossipAgent::HandlePeerList
+///                 GossipAgent::HandleGossip
+///                 GossipAgent::StartPhase
+///                 GossipAgent::GossipRound
+///                 GossipAgent::Push
+///                 GossipAgent::Apply
+///                 GossipAgent::ReadDevices
+///                 GossipAgent::SetPStar
+///                 GossipAgent::MessageGossip
+///                 GossipAgent::PrepareForSending
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "GossipBalance.hpp"
+
+#include "CLogger.hpp"
+#include "CMetrics.hpp"
+#include "CTimings.hpp"
+#include "CControlLoop.hpp"
+#include "CDeviceManager.hpp"
+#include "CGlobalConfiguration.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iterator>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/range/adaptor/map.hpp>
+
+namespace freedm {
+namespace broker {
+namespace lb {
+
+namespace {
+CLocalLogger Logger(__FILE__);
+
+/// Shares of push-sum gossip this node sent
+CCounter& GossipSentMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_gossip_messages_total", "Push-sum gossip messages sent by this node");
+
+/// Shares of push-sum gossip dropped because they were from another phase
+CCounter& GossipStaleMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_gossip_stale_total",
+    "Push-sum gossip messages dropped because they were from another phase");
+
+/// Gateway changes made from the mean imbalance
+CCounter& GossipMigrationsMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_gossip_migrations_total",
+    "Gateway changes this node made toward the mean imbalance of its group");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GossipAgent
+/// @description Constructor for the gossip load balancing module. A round of
+///     gossip takes the time a draft request would wait for its replies.
+/// @pre None
+/// @post Object is initialized and ready to run
+///////////////////////////////////////////////////////////////////////////////
+GossipAgent::GossipAgent()
+    : ROUND_TIME(CTimings::GetDuration(CTimings::LB_REQUEST_TIMEOUT))
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_RoundTimer = CBroker::Instance().AllocateTimer("lb");
+
+    m_Epoch = 0;
+    m_Sum = 0;
+    m_Weight = 0;
+    m_Rounds = 0;
+    m_Gateway = 0;
+    m_Imbalance = 0;
+    m_MigrationStep = CGlobalConfiguration::Instance().GetMigrationStep();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Run
+/// @description Main function which initiates the algorithm
+/// @pre Posix Main should invoke this function
+/// @post The gossip is scheduled for the start of the next phase
+///////////////////////////////////////////////////////////////////////////////
+int GossipAgent::Run()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    CBroker::Instance().Schedule(m_RoundTimer, boost::posix_time::not_a_date_time,
+        boost::bind(&GossipAgent::StartPhase, this, boost::asio::placeholders::error));
+    LOG_INFO(Logger) << "Gossip scheduled for the next phase." << std::endl;
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandleIncomingMessage
+/// "Downcasts" incoming messages into a specific message type, and passes the
+/// message to an appropriate handler.
+/// @pre None
+/// @post The message is handled by the target handler or a warning is
+///     produced.
+/// @param m the incoming message
+/// @param peer the node that sent this message (could be this DGI)
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m->has_group_management_message() &&
+        m->group_management_message().has_peer_list_message())
+    {
+        HandlePeerList(m->group_management_message().peer_list_message(), peer);
+    }
+    else if(m->has_load_balancing_message() &&
+        m->load_balancing_message().has_gossip_message())
+    {
+        HandleGossip(m->load_balancing_message().gossip_message(), peer);
+    }
+    else if(m->has_state_collection_message() ||
+        m->has_load_balancing_message())
+    {
+        // the drafting messages of nodes that do not gossip
+        LOG_DEBUG(Logger) << "Ignored a message for the drafting algorithm" << std::endl;
+    }
+    else
+    {
+        LOG_WARN(Logger) << "Dropped message of unexpected type:\n" << m->DebugString();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandlePeerList
+/// @description Updates the list of peers this node gossips with.
+/// @pre There is a valid message pointer and peer passed into the module.
+/// @post m_AllPeers holds the members of the group other than this node.
+/// @param m The message body that was recieved by this process.
+/// @param peer The process that the message orginated from.
+/// @peers Group leader.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::HandlePeerList(const gm::PeerListMessage & m, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_NOTICE(Logger) << "Updated peer list received from: " << peer.GetUUID() << std::endl;
+
+    gm::MembershipSnapshot next =
+        gm::GMAgent::UpdateMembership(m_membership, m, peer.GetUUID());
+    if(!next)
+    {
+        peer.Send(gm::GMAgent::PeerListQuery("lb"));
+        return;
+    }
+    m_membership = next;
+
+    m_AllPeers.clear();
+    BOOST_FOREACH(CPeerNode p, next->peers | boost::adaptors::map_values)
+    {
+        if(p.GetUUID() != GetUUID())
+        {
+            InsertInPeerSet(m_AllPeers, p);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandleGossip
+/// @description Adds the share of the sum and weight a peer pushed to this
+///     node, which is how the mass of the push-sum moves through the group.
+/// @pre None
+/// @post The share is added if it was sent for the phase this node is in.
+/// @param m The message body that was recieved by this process.
+/// @param peer The process that the message orginated from.
+/// @peers A group member.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::HandleGossip(const GossipMessage & m, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m.epoch() != m_Epoch)
+    {
+        GossipStaleMetric.Increment();
+        LOG_INFO(Logger) << "Dropped gossip of another phase from "
+            << peer.GetUUID() << std::endl;
+        return;
+    }
+
+    m_Sum += m.sum();
+    m_Weight += m.weight();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// StartPhase
+/// @description Starts the push-sum of the phase with the imbalance of this
+///     node, counted in migration steps, and a weight of one.
+/// @pre None
+/// @post If the timer wasn't cancelled the first gossip round runs.
+/// @param error The reason this function was called.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::StartPhase(const boost::system::error_code & error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!error)
+    {
+        // the same instant on every node of the group names the phase
+        m_Epoch = CBroker::Instance().GetRoundBoundary(0);
+        ReadDevices();
+        m_Sum = m_Imbalance / m_MigrationStep;
+        m_Weight = 1;
+        m_Rounds = 0;
+        GossipRound(boost::system::error_code());
+    }
+    else if(error == boost::asio::error::operation_aborted)
+    {
+        LOG_NOTICE(Logger) << "Gossip Aborted" << std::endl;
+    }
+    else
+    {
+        LOG_ERROR(Logger) << error << std::endl;
+        throw boost::system::system_error(error);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// GossipRound
+/// @description Pushes a share to a group member while another round fits
+///     in the phase, and applies the mean once it does not.
+/// @pre StartPhase has run this phase.
+/// @post The next round, or the start of the next phase, is scheduled.
+/// @param error The reason this function was called.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::GossipRound(const boost::system::error_code & error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!error)
+    {
+        // the timings file may have been reloaded since the last round
+        ROUND_TIME = CTimings::GetDuration(CTimings::LB_REQUEST_TIMEOUT);
+        if(CBroker::Instance().TimeRemaining() > ROUND_TIME + ROUND_TIME)
+        {
+            Push();
+            m_Rounds++;
+            CBroker::Instance().Schedule(m_RoundTimer, ROUND_TIME,
+                boost::bind(&GossipAgent::GossipRound, this, boost::asio::placeholders::error));
+        }
+        else
+        {
+            Apply();
+            CBroker::Instance().Schedule(m_RoundTimer, boost::posix_time::not_a_date_time,
+                boost::bind(&GossipAgent::StartPhase, this, boost::asio::placeholders::error));
+            LOG_INFO(Logger) << "Gossip scheduled for the next phase." << std::endl;
+        }
+    }
+    else if(error == boost::asio::error::operation_aborted)
+    {
+        LOG_NOTICE(Logger) << "Gossip Aborted" << std::endl;
+    }
+    else
+    {
+        LOG_ERROR(Logger) << error << std::endl;
+        throw boost::system::system_error(error);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Push
+/// @description Sends half of the sum and weight of this node to a group
+///     member chosen at random and keeps the other half.
+/// @pre None
+/// @post The share is kept if there is no peer or it could not be sent.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::Push()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_AllPeers.empty())
+    {
+        return;
+    }
+
+    PeerSet::iterator it = m_AllPeers.begin();
+    std::advance(it, std::rand() % m_AllPeers.size());
+
+    float sum = m_Sum / 2;
+    float weight = m_Weight / 2;
+
+    try
+    {
+        it->second.Send(MessageGossip(sum, weight));
+        m_Sum -= sum;
+        m_Weight -= weight;
+        GossipSentMetric.Increment();
+    }
+    catch(boost::system::system_error & e)
+    {
+        LOG_WARN(Logger) << "Couldn't connect to peer" << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Apply
+/// @description Moves the gateway of this node by the whole migration steps
+///     its imbalance is away from the estimated mean of the group.
+/// @pre The gossip of the phase has run.
+/// @post The gateway is changed if it is a step or more off the mean.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::Apply()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_Weight <= 0)
+    {
+        LOG_NOTICE(Logger) << "Gossip Cancelled: no weight left" << std::endl;
+        return;
+    }
+
+    std::set<device::CDevice::Pointer> logger;
+    logger = device::CDeviceManager::Instance().GetDevicesOfType("Logger");
+    if(!logger.empty() && (*logger.begin())->GetState("dgiEnable") != 1)
+    {
+        return;
+    }
+
+    float mean = m_Sum / m_Weight;
+    float excess = m_Imbalance / m_MigrationStep - mean;
+    // toward zero, so the changes of the group never add up to more power
+    float steps = excess < 0 ? std::ceil(excess) : std::floor(excess);
+
+    LOG_STATUS(Logger) << "Gossip mean after " << m_Rounds << " rounds: "
+        << mean * m_MigrationStep << ", this node " << m_Imbalance << std::endl;
+
+    if(steps != 0)
+    {
+        SetPStar(m_Gateway + steps * m_MigrationStep);
+        GossipMigrationsMetric.Increment();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ReadDevices
+/// @description Reads the device state that LBAgent reads, from the same
+///     placeholder signals.
+/// @pre None
+/// @post m_Gateway and m_Imbalance are updated.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::ReadDevices()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    device::CDeviceManager & manager = device::CDeviceManager::Instance();
+    float generation = manager.GetNetValue("DRER", "AOUT/Grid_Freq");
+    float storage = manager.GetNetValue("DESD", "AOUT/Grid_Freq");
+    float load = manager.GetNetValue("Load", "drain");
+
+    m_Gateway = manager.GetNetValue("SST", "AOUT/Reactive_Pwr");
+    m_Imbalance = generation + storage - load - m_Gateway;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SetPStar
+/// @description Migrates power the way LBAgent does, through the first
+///     setpoint of the attached DESD.
+/// @pre None
+/// @post The DESD setpoint is changed if there is one.
+/// @param pstar the new pstar setting to use.
+///////////////////////////////////////////////////////////////////////////////
+void GossipAgent::SetPStar(float pstar)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // the DESD command is timed from the oldest state read for it
+    device::CControlLoop::CScope scope("lb");
+
+    float generation = device::CDeviceManager::Instance().GetNetValue("DRER", "generation");
+    float load = device::CDeviceManager::Instance().GetNetValue("Load", "drain");
+
+    std::set<device::CDevice::Pointer> desd;
+    desd = device::CDeviceManager::Instance().GetDevicesOfType("DESD");
+
+    if(desd.empty())
+    {
+        LOG_WARN(Logger) << "Failed to set Desd: no attached Desd device" << std::endl;
+        return;
+    }
+
+    device::CDevice::Pointer dev = *desd.begin();
+    BOOST_FOREACH(std::string command, dev->GetCommandSet())
+    {
+        if(command.find("_minimum") == command.find("_maximum"))
+        {
+            dev->SetCommand(command, pstar - generation + load);
+            LOG_NOTICE(Logger) << "P* = " << pstar << std::endl;
+            return;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MessageGossip
+/// @description Generates a share of the push-sum of this phase.
+/// @pre None
+/// @post Returns the new message.
+/// @param sum the share of the sum
+/// @param weight the share of the weight
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GossipAgent::MessageGossip(float sum, float weight)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LoadBalancingMessage msg;
+    GossipMessage * submsg = msg.mutable_gossip_message();
+    submsg->set_epoch(m_Epoch);
+    submsg->set_sum(sum);
+    submsg->set_weight(weight);
+    return PrepareForSending(msg);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Wraps a LoadBalancingMessage in a ModuleMessage.
+///
+/// @param m the message to prepare. If any required field is unset,
+///                the DGI will abort.
+/// @param recipient the module (sc/lb/gm/clk etc.) the message should be
+///                delivered to
+///
+/// @return a ModuleMessage containing a copy of the LoadBalancingMessage
+///////////////////////////////////////////////////////////////////////////////
+ModuleMessage GossipAgent::PrepareForSending(const LoadBalancingMessage & m, std::string recipient)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    ModuleMessage mm;
+    mm.mutable_load_balancing_message()->CopyFrom(m);
+    mm.set_recipient_module(recipient);
+    return mm;
+}
+
+} // namespace lb
+} // namespace broker
+} // namespace freedm
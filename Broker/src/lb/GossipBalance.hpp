@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file           GossipBalance.hpp
+///
+/// @project        FREEDM DGI
+///
+/// @description    Load balance by push-sum averaging of the gateway imbalance
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef GOSSIP_BALANCE_HPP
+#define GOSSIP_BALANCE_HPP
+
+#include "CBroker.hpp"
+#include "CPeerNode.hpp"
+#include "PeerSets.hpp"
+#include "IDGIModule.hpp"
+#include "gm/GroupManagement.hpp"
+#include "messages/ModuleMessage.pb.h"
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace freedm {
+namespace broker {
+namespace lb {
+
+/// Balances the group by averaging the gateway imbalance of its members
+////////////////////////////////////////////////////////////////////////////////
+/// An alternative to the drafting of LBAgent that registers as the same "lb"
+/// module. At the start of each phase a node measures its imbalance, the net
+/// generation less the gateway, in migration steps. It then runs push-sum
+/// gossip over the group: each gossip round it keeps half of its sum and
+/// weight and sends the other half to one random group member. The ratio of
+/// sum to weight at every node converges to the mean imbalance of the group
+/// in O(log N) rounds, with one message per round and no replies to wait for.
+/// Near the end of the phase each node moves its gateway by the whole steps
+/// its imbalance is off the mean, so the changes of the group add up to about
+/// nothing. Gossip from another phase is dropped; a lost message only costs
+/// the accuracy of that phase's mean.
+////////////////////////////////////////////////////////////////////////////////
+class GossipAgent
+    : public IDGIModule
+{
+public:
+    /// Creates the module and reads its configuration
+    GossipAgent();
+    /// Schedules the first phase of gossip
+    int Run();
+private:
+    /// First handler for an incoming message.
+    void HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CPeerNode peer);
+    /// Handles the peerlist coming from the group leader.
+    void HandlePeerList(const gm::PeerListMessage & m, CPeerNode peer);
+    /// Adds the share of a peer to the sum and weight of this node.
+    void HandleGossip(const GossipMessage & m, CPeerNode peer);
+
+    /// Starts the gossip of the phase from the imbalance of this node.
+    void StartPhase(const boost::system::error_code & error);
+    /// Runs a round of gossip, or applies the mean when the phase ends.
+    void GossipRound(const boost::system::error_code & error);
+    /// Sends half of the sum and weight to a random group member.
+    void Push();
+    /// Moves the gateway of this node toward the mean imbalance.
+    void Apply();
+    /// Reads the gateway and the imbalance from the devices.
+    void ReadDevices();
+    /// Sets PStar to the specified level
+    void SetPStar(float pstar);
+
+    /// Generates a message carrying a share of the sum and weight.
+    ModuleMessage MessageGossip(float sum, float weight);
+    /// Boilerplate for preparing a message.
+    ModuleMessage PrepareForSending(const LoadBalancingMessage & m, std::string recipient = "lb");
+
+    /// The time between two rounds of gossip
+    boost::posix_time::time_duration ROUND_TIME;
+
+    /// Timer handle for the round timer
+    CBroker::TimerHandle m_RoundTimer;
+
+    /// The group membership last received
+    gm::MembershipSnapshot m_membership;
+    /// All peers in group.
+    PeerSet m_AllPeers;
+
+    /// The synchronized start of the round that ends this phase
+    boost::uint64_t m_Epoch;
+    /// The push-sum of the imbalance, in migration steps
+    float m_Sum;
+    /// The push-sum weight
+    float m_Weight;
+    /// Rounds of gossip run this phase
+    unsigned int m_Rounds;
+
+    /// The gateway of this node.
+    float m_Gateway;
+    /// The net generation less the gateway of this node.
+    float m_Imbalance;
+    /// The amount to migrate.
+    float m_MigrationStep;
+};
+
+} // namespace lb
+} // namespace broker
+} // namespace freedm
+
+#endif // GOSSIP_BALANCE_HPP
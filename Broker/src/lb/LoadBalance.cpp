@@ -20,10 +20,15 @@
 ///                 LBAgent::LoadManage
 ///                 LBAgent::ScheduleNextRound
 ///                 LBAgent::ReadDevices
+///                 LBAgent::UpdateForecast
 ///                 LBAgent::UpdateState
+///                 LBAgent::HandleLoadChange
+///                 LBAgent::HandleImbalanceChange
 ///                 LBAgent::LoadTable
 ///                 LBAgent::SendStateChange
 ///                 LBAgent::HandleStateChange
+///                 LBAgent::PublishDigest
+///                 LBAgent::HandleStateDigest
 ///                 LBAgent::SendDraftRequest
 ///                 LBAgent::HandleDraftRequest
 ///                 LBAgent::SendDraftAge
@@ -59,22 +64,60 @@
 #include "LoadBalance.hpp"
 
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
 #include "CTimings.hpp"
+#include "CControlLoop.hpp"
 #include "CDeviceManager.hpp"
 #include "CGlobalPeerList.hpp"
 #include "gm/GroupManagement.hpp"
 #include "CGlobalConfiguration.hpp"
+#include "CWarmState.hpp"
+#include "Messages.hpp"
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/range/adaptor/map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <armadillo>
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 namespace freedm {
 namespace broker {
 namespace lb {
 
 namespace {
 CLocalLogger Logger(__FILE__);
+
+/// Load balance rounds run by this node
+CCounter& RoundsMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_rounds_total", "Load balance rounds run by this node");
+
+/// Migrations this node accepted as a supply node
+CCounter& MigrationsMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_migrations_total", "Migrations accepted by this node in supply");
+
+/// Migrations this node refused because it was no longer in supply
+CCounter& LateMigrationsMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_late_migrations_total",
+    "Migrations this node refused because its supply was gone");
+
+/// Load balance rounds started early by a change of the devices
+CCounter& EventRoundsMetric = CMetrics::Instance().GetCounter(
+    "dgi_lb_event_rounds_total",
+    "Load balance rounds started early because the devices left the deadband");
+
+/// A demand node that replied to a draft request, with its draft age
+typedef std::pair<float, CPeerNode> DraftCandidate;
+
+/// Orders the draft candidates from the greatest draft age to the least
+bool GreaterDraftAge(const DraftCandidate & a, const DraftCandidate & b)
+{
+    return a.first > b.first;
+}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -85,10 +128,10 @@ CLocalLogger Logger(__FILE__);
 /// @limitations: None
 ///////////////////////////////////////////////////////////////////////////////
 LBAgent::LBAgent()
-    : ROUND_TIME(boost::posix_time::milliseconds(CTimings::Get("LB_ROUND_TIME")))
-    , REQUEST_TIMEOUT(boost::posix_time::milliseconds(CTimings::Get("LB_REQUEST_TIMEOUT")))
+    : ROUND_TIME(CTimings::GetDuration(CTimings::LB_ROUND_TIME))
+    , REQUEST_TIMEOUT(CTimings::GetDuration(CTimings::LB_REQUEST_TIMEOUT))
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     m_RoundTimer = CBroker::Instance().AllocateTimer("lb");
     m_WaitTimer = CBroker::Instance().AllocateTimer("lb");
@@ -98,6 +141,41 @@ LBAgent::LBAgent()
 
     m_PowerDifferential = 0;
     m_MigrationStep = CGlobalConfiguration::Instance().GetMigrationStep();
+    m_Deadband = CGlobalConfiguration::Instance().GetLoadBalanceDeadband();
+    m_DraftPartners = CGlobalConfiguration::Instance().GetDraftPartners();
+    m_RoundGateway = 0;
+    m_RoundNetGeneration = 0;
+    m_MeasuredNetGeneration = 0;
+    m_Forecast = CGlobalConfiguration::Instance().GetLoadBalanceForecast();
+    m_ForecastLevel = 0;
+    m_ForecastTrend = 0;
+    m_NextPhase = true;
+    m_Drafting = false;
+    m_WarmResumed = false;
+    m_Digests = CGlobalConfiguration::Instance().GetLoadBalanceDigests();
+    // a restarted node advertises epochs above those it used before
+    m_DigestEpoch = (boost::posix_time::microsec_clock::universal_time()
+        - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_microseconds();
+    m_DigestState = m_State;
+    m_DigestGateway = 0;
+
+    // a load change of a migration step can change the state of the node
+    device::CDeviceManager::Instance().Subscribe("lb", "Load", "drain",
+        m_MigrationStep, boost::bind(&LBAgent::HandleLoadChange, this, _1));
+
+    if(m_Deadband > 0)
+    {
+        // the signals read by ReadDevices, the periodic round is still the floor
+        device::CDeviceManager & manager = device::CDeviceManager::Instance();
+        manager.Subscribe("lb", "SST", "AOUT/Reactive_Pwr", m_Deadband,
+            boost::bind(&LBAgent::HandleImbalanceChange, this, _1));
+        manager.Subscribe("lb", "DRER", "AOUT/Grid_Freq", m_Deadband,
+            boost::bind(&LBAgent::HandleImbalanceChange, this, _1));
+        manager.Subscribe("lb", "DESD", "AOUT/Grid_Freq", m_Deadband,
+            boost::bind(&LBAgent::HandleImbalanceChange, this, _1));
+        manager.Subscribe("lb", "Load", "drain", m_Deadband,
+            boost::bind(&LBAgent::HandleImbalanceChange, this, _1));
+    }
 
 	/* ARMADILLO TEST */
 	using namespace arma;
@@ -117,10 +195,11 @@ LBAgent::LBAgent()
 /////////////////////////////////////////////////////////
 int LBAgent::Run()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_NextPhase = true;
     CBroker::Instance().Schedule(m_RoundTimer, boost::posix_time::not_a_date_time,
         boost::bind(&LBAgent::FirstRound, this, boost::asio::placeholders::error));
-    Logger.Info << "LoadManage scheduled for the next phase." << std::endl;
+    LOG_INFO(Logger) << "LoadManage scheduled for the next phase." << std::endl;
     return 0;
 }
 
@@ -136,11 +215,21 @@ int LBAgent::Run()
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m->has_lb_digest())
+    {
+        HandleStateDigest(m->lb_digest(), peer);
+        if(m->recipient_module() != "lb" && m->recipient_module() != "all")
+        {
+            // delivered only for the digest
+            return;
+        }
+    }
 
     if(m->has_group_management_message())
     {
-        gm::GroupManagementMessage gmm = m->group_management_message();
+        const gm::GroupManagementMessage& gmm = m->group_management_message();
 
         if(gmm.has_peer_list_message())
         {
@@ -148,26 +237,26 @@ void LBAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CP
         }
         else
         {
-            Logger.Warn << "Dropped unexpected group management message:\n" << m->DebugString();
+            LOG_WARN(Logger) << "Dropped unexpected group management message:\n" << m->DebugString();
         }
     }
     else if(m->has_state_collection_message())
     {
-        sc::StateCollectionMessage scm = m->state_collection_message();
+        const sc::StateCollectionMessage& scm = m->state_collection_message();
     
         if(scm.has_collected_state_message())
         {
-            Logger.Debug << "Collected State: " << m->DebugString();
+            LOG_DEBUG(Logger) << "Collected State: " << m->DebugString();
             HandleCollectedState(scm.collected_state_message());
         }
         else
         {
-            Logger.Warn << "Dropped unexpected group management message:\n" << m->DebugString();
+            LOG_WARN(Logger) << "Dropped unexpected group management message:\n" << m->DebugString();
         }
     }
     else if(m->has_load_balancing_message())
     {
-        LoadBalancingMessage lbm = m->load_balancing_message();
+        const LoadBalancingMessage& lbm = m->load_balancing_message();
         
         if(lbm.has_state_change_message())
         {
@@ -199,12 +288,12 @@ void LBAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CP
         }
         else
         {
-            Logger.Warn << "Dropped unexpected load balance message:\n" << m->DebugString();
+            LOG_WARN(Logger) << "Dropped unexpected load balance message:\n" << m->DebugString();
         }
     }
     else
     {
-        Logger.Warn << "Dropped message of unexpected type:\n" << m->DebugString();
+        LOG_WARN(Logger) << "Dropped message of unexpected type:\n" << m->DebugString();
     }
 }
 
@@ -217,18 +306,20 @@ void LBAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CP
 /// @param ps The peerset to move the peer to.
 /// @param peer the peer to move.
 ///////////////////////////////////////////////////////////////////////////////
-void LBAgent::MoveToPeerSet(PeerSet & ps, CPeerNode peer)
+void LBAgent::MoveToPeerSet(CPeerBitSet & ps, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    EraseInPeerSet(m_InSupply, peer);
-    EraseInPeerSet(m_InDemand, peer);
-    EraseInPeerSet(m_InNormal, peer);
-    InsertInPeerSet(ps, peer);
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_InSupply.Erase(peer);
+    m_InDemand.Erase(peer);
+    m_InNormal.Erase(peer);
+    ps.Insert(peer);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// SendToPeerSet
-/// @description Given a message m, send it to every process in peerSet
+/// @description Given a message m, send it to every process in peerSet. The
+///     peers share one multicast datagram when the multicast channel is on,
+///     or a relay tree when the relay fanout is set.
 /// @pre None
 /// @post m is sent to all processes in peerSet
 /// @peers peerSet
@@ -237,19 +328,16 @@ void LBAgent::MoveToPeerSet(PeerSet & ps, CPeerNode peer)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::SendToPeerSet(const PeerSet & ps, const ModuleMessage & m)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Info << "Sending " << m.DebugString() << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_INFO(Logger) << "Sending " << m.DebugString() << std::endl;
 
-    BOOST_FOREACH(CPeerNode peer, ps | boost::adaptors::map_values)
+    try
     {
-        try
-        {
-            peer.Send(m);
-        }
-        catch(boost::system::system_error & error)
-        {
-            Logger.Warn << "Couldn't send message to peer";
-        }
+        BroadcastToPeers(ps, m);
+    }
+    catch(boost::system::system_error & error)
+    {
+        LOG_WARN(Logger) << "Couldn't send message to peer";
     }
 }
 
@@ -264,22 +352,23 @@ void LBAgent::SendToPeerSet(const PeerSet & ps, const ModuleMessage & m)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::FirstRound(const boost::system::error_code & error)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(!error)
     {
         m_Synchronized = false;
+        ResumeWarmState();
         ScheduleStateCollection();
         CBroker::Instance().Schedule("lb",
             boost::bind(&LBAgent::LoadManage, this, boost::system::error_code()));
     }
     else if(error == boost::asio::error::operation_aborted)
     {
-        Logger.Notice << "Load Manage Aborted" << std::endl;
+        LOG_NOTICE(Logger) << "Load Manage Aborted" << std::endl;
     }
     else
     {
-        Logger.Error << error << std::endl;
+        LOG_ERROR(Logger) << error << std::endl;
         throw boost::system::system_error(error);
     }
 }
@@ -298,12 +387,16 @@ void LBAgent::FirstRound(const boost::system::error_code & error)
 /////////////////////////////////////////////////////////
 void LBAgent::LoadManage(const boost::system::error_code & error)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(!error)
     {
+        RoundsMetric.Increment();
         ScheduleNextRound();
         ReadDevices();
+        UpdateForecast();
+        m_RoundGateway = m_Gateway;
+        m_RoundNetGeneration = m_NetGeneration;
         UpdateState();
         LoadTable();
 
@@ -313,10 +406,10 @@ void LBAgent::LoadManage(const boost::system::error_code & error)
 
         if(logger.empty() || (*logger.begin())->GetState("dgiEnable") == 1)
         {
-            if(m_State == LBAgent::DEMAND)
+            if(m_State == LBAgent::DEMAND && !m_Digests)
             {
                 SendToPeerSet(m_AllPeers, MessageStateChange("demand"));
-                Logger.Notice << "Sending state change, DEMAND" << std::endl;
+                LOG_NOTICE(Logger) << "Sending state change, DEMAND" << std::endl;
             }
 
             if(m_Synchronized)
@@ -325,7 +418,7 @@ void LBAgent::LoadManage(const boost::system::error_code & error)
             }
             else
             {
-                Logger.Notice << "Draft Request Cancelled: state too old" << std::endl;
+                LOG_NOTICE(Logger) << "Draft Request Cancelled: state too old" << std::endl;
             }
         }
         else
@@ -338,11 +431,11 @@ void LBAgent::LoadManage(const boost::system::error_code & error)
     }
     else if(error == boost::asio::error::operation_aborted)
     {
-        Logger.Notice << "Load Manage Aborted" << std::endl;
+        LOG_NOTICE(Logger) << "Load Manage Aborted" << std::endl;
     }
     else
     {
-        Logger.Error << error << std::endl;
+        LOG_ERROR(Logger) << error << std::endl;
         throw boost::system::system_error(error);
     }
 }
@@ -357,19 +450,25 @@ void LBAgent::LoadManage(const boost::system::error_code & error)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::ScheduleNextRound()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // the timings file may have been reloaded since the last round
+    ROUND_TIME = CTimings::GetDuration(CTimings::LB_ROUND_TIME);
+    REQUEST_TIMEOUT = CTimings::GetDuration(CTimings::LB_REQUEST_TIMEOUT);
+
+    m_NextPhase = CBroker::Instance().TimeRemaining() <= ROUND_TIME + ROUND_TIME;
 
-    if(CBroker::Instance().TimeRemaining() > ROUND_TIME + ROUND_TIME)
+    if(!m_NextPhase)
     {
         CBroker::Instance().Schedule(m_RoundTimer, ROUND_TIME,
             boost::bind(&LBAgent::LoadManage, this, boost::asio::placeholders::error));
-        Logger.Info << "LoadManage scheduled in " << ROUND_TIME << " ms." << std::endl;
+        LOG_INFO(Logger) << "LoadManage scheduled in " << ROUND_TIME << " ms." << std::endl;
     }
     else
     {
         CBroker::Instance().Schedule(m_RoundTimer, boost::posix_time::not_a_date_time,
             boost::bind(&LBAgent::FirstRound, this, boost::asio::placeholders::error));
-        Logger.Info << "LoadManage scheduled for the next phase." << std::endl;
+        LOG_INFO(Logger) << "LoadManage scheduled for the next phase." << std::endl;
     }
 }
 
@@ -377,20 +476,23 @@ void LBAgent::ScheduleNextRound()
 /// ReadDevices
 /// @description Reads the device state and updates the appropriate member vars.
 /// @pre None
-/// @post m_gateway and m_netgeneration are updated.
+/// @post m_gateway and m_netgeneration are updated. With a forecast, the net
+///     generation is the reading moved by the trend over one round.
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::ReadDevices()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     float generation = device::CDeviceManager::Instance().GetNetValue("DRER", "AOUT/Grid_Freq");//these are placeholders, it should be generation
     float storage = device::CDeviceManager::Instance().GetNetValue("DESD", "AOUT/Grid_Freq");   //these are placeholders, it should be storage
     float load = device::CDeviceManager::Instance().GetNetValue("Load", "drain");
 
     m_Gateway = device::CDeviceManager::Instance().GetNetValue("SST", "AOUT/Reactive_Pwr");     //these are placeholders, it should be gateway
-    m_NetGeneration = generation + storage - load;
+    m_MeasuredNetGeneration = generation + storage - load;
+    m_NetGeneration = m_MeasuredNetGeneration + m_ForecastTrend *
+        (ROUND_TIME.total_microseconds() / 1e6);
 
-   // Logger.Status << "NET dedsd VALUES: " << storage << " SST values" <<m_Gateway<< std::endl;
+   // LOG_STATUS(Logger) << "NET dedsd VALUES: " << storage << " SST values" <<m_Gateway<< std::endl;
 
     // Keeping the above changes in merge and disabling below
     // float generation = device::CDeviceManager::Instance().GetNetValue("Drer", "generation");
@@ -401,6 +503,55 @@ void LBAgent::ReadDevices()
     // m_NetGeneration = generation + storage - load;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// UpdateForecast
+/// @description Smooths the net generation read each round with Holt's
+///     linear method, which follows both the level and the trend of the
+///     readings. The trend, per second, moves the net generation a round
+///     ahead, so that a node in a load ramp enters supply or demand and drafts
+///     for the imbalance the next round will see instead of the one it reads.
+/// @pre ReadDevices has read the devices for this round.
+/// @post If a forecast is configured, the trend is updated and the net
+///     generation is the reading plus the trend over one round.
+/// @limitations The first round of a node only sets the level, so the
+///     forecast starts with its second round.
+///////////////////////////////////////////////////////////////////////////////
+void LBAgent::UpdateForecast()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m_Forecast == 0)
+    {
+        return;
+    }
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if(m_ForecastTime.is_not_a_date_time())
+    {
+        m_ForecastLevel = m_MeasuredNetGeneration;
+        m_ForecastTrend = 0;
+    }
+    else
+    {
+        float elapsed = (now - m_ForecastTime).total_microseconds() / 1e6;
+        if(elapsed <= 0)
+        {
+            return;
+        }
+        float level = m_Forecast * m_MeasuredNetGeneration +
+            (1 - m_Forecast) * (m_ForecastLevel + m_ForecastTrend * elapsed);
+        m_ForecastTrend = m_Forecast * (level - m_ForecastLevel) / elapsed +
+            (1 - m_Forecast) * m_ForecastTrend;
+        m_ForecastLevel = level;
+    }
+    m_ForecastTime = now;
+
+    m_NetGeneration = m_MeasuredNetGeneration + m_ForecastTrend *
+        (ROUND_TIME.total_microseconds() / 1e6);
+    LOG_INFO(Logger) << "Net generation " << m_MeasuredNetGeneration
+        << " forecast at " << m_NetGeneration << " a round ahead" << std::endl;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// UpdateState
 /// @description Determines the state of this node with respect to Supply,
@@ -411,17 +562,17 @@ void LBAgent::ReadDevices()
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::UpdateState()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    int sstCount = device::CDeviceManager::Instance().GetDevicesOfType("SST").size();
-    Logger.Status << "Recognize " << sstCount << " attached SST devices." << std::endl;
+    int sstCount = device::CDeviceManager::Instance().GetDeviceView("SST")->size();
+    LOG_STATUS(Logger) << "Recognize " << sstCount << " attached SST devices." << std::endl;
 
     if(sstCount > 0 && m_NetGeneration >= m_Gateway + m_MigrationStep)
     {
         if(m_State != LBAgent::SUPPLY)
         {
             m_State = LBAgent::SUPPLY;
-            Logger.Info << "Changed to SUPPLY state." << std::endl;
+            LOG_INFO(Logger) << "Changed to SUPPLY state." << std::endl;
         }
     }
     else if(sstCount > 0 && m_NetGeneration <= m_Gateway - m_MigrationStep)
@@ -429,7 +580,7 @@ void LBAgent::UpdateState()
         if(m_State != LBAgent::DEMAND)
         {
             m_State = LBAgent::DEMAND;
-            Logger.Info << "Changed to DEMAND state." << std::endl;
+            LOG_INFO(Logger) << "Changed to DEMAND state." << std::endl;
         }
     }
     else
@@ -437,9 +588,113 @@ void LBAgent::UpdateState()
         if(m_State != LBAgent::NORMAL)
         {
             m_State = LBAgent::NORMAL;
-            Logger.Info << "Changed to NORMAL state." << std::endl;
+            LOG_INFO(Logger) << "Changed to NORMAL state." << std::endl;
         }
     }
+
+    PublishDigest();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PublishDigest
+/// @description Hands the state and gateway of this node to the broker, which
+///     attaches them to the group management and clock messages sent to the
+///     peers, if they changed since they were last handed over.
+/// @pre The state and gateway are up to date.
+/// @post A digest with a greater epoch is advertised if anything changed.
+///////////////////////////////////////////////////////////////////////////////
+void LBAgent::PublishDigest()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_Digests || (m_State == m_DigestState && m_Gateway == m_DigestGateway
+        && CBroker::Instance().GetDigestEpoch() != 0))
+    {
+        return;
+    }
+    m_DigestState = m_State;
+    m_DigestGateway = m_Gateway;
+    m_DigestEpoch++;
+
+    StateDigestMessage digest;
+    digest.set_state(m_State);
+    digest.set_gateway(m_Gateway);
+    digest.set_epoch(m_DigestEpoch);
+    CBroker::Instance().SetStateDigest(digest);
+    LOG_DEBUG(Logger) << "Advertising state " << m_State << " at epoch "
+        << m_DigestEpoch << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandleLoadChange
+/// @description Called in the phase of load balancing when the net load has
+///     moved by more than a migration step since the last change, so that a
+///     new demand is advertised without waiting for the next round.
+/// @pre The subscription was made by the constructor.
+/// @post The state of the node is updated from the devices.
+/// @param load the new net load
+///////////////////////////////////////////////////////////////////////////////
+void LBAgent::HandleLoadChange(float load)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_INFO(Logger) << "Net load changed to " << load << std::endl;
+
+    State previous = m_State;
+    ReadDevices();
+    UpdateState();
+
+    if(m_State == LBAgent::DEMAND && previous != LBAgent::DEMAND)
+    {
+        SendToPeerSet(m_AllPeers, MessageStateChange("demand"));
+        LOG_NOTICE(Logger) << "Sending state change, DEMAND" << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandleImbalanceChange
+/// @description Called in the phase of load balancing when a signal read by
+///     ReadDevices has moved by more than the deadband. If the gateway or the
+///     net generation is now a deadband away from the values of the last
+///     round, the round timer is moved up so that the round runs at once; it
+///     then schedules the periodic round that follows as usual.
+/// @pre The deadband is positive and the subscriptions were made by the
+///     constructor.
+/// @post A round may be scheduled to run at once. No round is started while
+///     draft ages are awaited or once the rounds of this phase are over.
+/// @param value the new net value of the signal that changed
+///////////////////////////////////////////////////////////////////////////////
+void LBAgent::HandleImbalanceChange(float value)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_DEBUG(Logger) << "Device signal changed to " << value << std::endl;
+
+    ReadDevices();
+
+    if(std::fabs(m_Gateway - m_RoundGateway) < m_Deadband &&
+        std::fabs(m_NetGeneration - m_RoundNetGeneration) < m_Deadband)
+    {
+        LOG_DEBUG(Logger) << "Early round skipped: within the deadband" << std::endl;
+    }
+    else if(m_NextPhase)
+    {
+        LOG_INFO(Logger) << "Early round skipped: no rounds left this phase" << std::endl;
+    }
+    else if(m_Drafting)
+    {
+        LOG_INFO(Logger) << "Early round skipped: draft in progress" << std::endl;
+    }
+    else if(CBroker::Instance().TimeRemaining() <= ROUND_TIME)
+    {
+        LOG_INFO(Logger) << "Early round skipped: phase ending" << std::endl;
+    }
+    else
+    {
+        EventRoundsMetric.Increment();
+        CBroker::Instance().Schedule(m_RoundTimer, boost::posix_time::milliseconds(0),
+            boost::bind(&LBAgent::LoadManage, this, boost::asio::placeholders::error));
+        LOG_NOTICE(Logger) << "LoadManage scheduled early: gateway "
+            << m_Gateway << ", net generation " << m_NetGeneration << std::endl;
+    }
 }
 
 ////////////////////////////////////////////////////////////
@@ -453,11 +708,11 @@ void LBAgent::UpdateState()
 /////////////////////////////////////////////////////////
 void LBAgent::LoadTable()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    int drer_count = device::CDeviceManager::Instance().GetDevicesOfType("DRER").size();
-    int desd_count = device::CDeviceManager::Instance().GetDevicesOfType("DESD").size();
-    int load_count = device::CDeviceManager::Instance().GetDevicesOfType("Load").size();
+    int drer_count = device::CDeviceManager::Instance().GetDeviceView("DRER")->size();
+    int desd_count = device::CDeviceManager::Instance().GetDeviceView("DESD")->size();
+    int load_count = device::CDeviceManager::Instance().GetDeviceView("Load")->size();
     float generation = device::CDeviceManager::Instance().GetNetValue("DRER", "AOUT/Grid_Freq");////these are placeholders, it should be generation
     float storage = device::CDeviceManager::Instance().GetNetValue("DESD", "AOUT/Grid_Freq");////these are placeholders, it should be storage
 
@@ -472,7 +727,7 @@ void LBAgent::LoadTable()
     if (desd_count > 0) { //pub
         device::CDevice::Pointer dev1 = device::CDeviceManager::Instance().GetDevice("DESD");
         dev1->SetCommand("AIN/Active_Pwr", 8888);
-        Logger.Status << "Set command on " << dev1->GetID() << std::endl;
+        LOG_STATUS(Logger) << "Set command on " << dev1->GetID() << std::endl;
     }
     std::stringstream loadtable;
     loadtable << std::setprecision(2) << std::fixed;
@@ -486,9 +741,13 @@ void LBAgent::LoadTable()
     loadtable << "\t---------------------------------------------" << std::endl;
     loadtable << "\tSST Gateway:    " << m_Gateway << std::endl;
     loadtable << "\tNet Generation: " << m_NetGeneration << std::endl;
+    if(m_Forecast != 0)
+    {
+        loadtable << "\tMeasured Net Generation: " << m_MeasuredNetGeneration << std::endl;
+    }
     loadtable << "\tPredicted K:    " << m_PowerDifferential << std::endl;
     loadtable << "\t---------------------------------------------" << std::endl;
-    Logger.Status << "NET dedsd VALUES: " << storage << " SST values" <<m_Gateway<< std::endl;
+    LOG_STATUS(Logger) << "NET dedsd VALUES: " << storage << " SST values" <<m_Gateway<< std::endl;
 
     if(m_State == LBAgent::DEMAND)
     {
@@ -504,15 +763,15 @@ void LBAgent::LoadTable()
     }
     BOOST_FOREACH(CPeerNode peer, m_AllPeers | boost::adaptors::map_values)
     {
-        if(CountInPeerSet(m_InDemand, peer) > 0)
+        if(m_InDemand.Contains(peer))
         {
             loadtable << "\t(DEMAND) " << peer.GetUUID() << std::endl;
         }
-        else if(CountInPeerSet(m_InNormal, peer) > 0)
+        else if(m_InNormal.Contains(peer))
         {
             loadtable << "\t(NORMAL) " << peer.GetUUID() << std::endl;
         }
-        else if(CountInPeerSet(m_InSupply, peer) > 0)
+        else if(m_InSupply.Contains(peer))
         {
             loadtable << "\t(SUPPLY) " << peer.GetUUID() << std::endl;
         }
@@ -523,7 +782,7 @@ void LBAgent::LoadTable()
     }
 
     loadtable << "\t---------------------------------------------";
-    Logger.Status << loadtable.str() << std::endl;
+    LOG_STATUS(Logger) << loadtable.str() << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -535,7 +794,7 @@ void LBAgent::LoadTable()
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageStateChange(std::string state)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     StateChangeMessage * submsg = msg.mutable_state_change_message();
     submsg->set_state(state);
@@ -556,16 +815,16 @@ ModuleMessage LBAgent::MessageStateChange(std::string state)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleStateChange(const StateChangeMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(CountInPeerSet(m_AllPeers, peer) == 0)
     {
-        Logger.Warn << "State from unknown peer: " << peer.GetUUID() << std::endl;
+        LOG_WARN(Logger) << "State from unknown peer: " << peer.GetUUID() << std::endl;
     }
     else
     {
         std::string state = m.state();
-        Logger.Info << "Received " << state << " state from " << peer.GetUUID() << std::endl;
+        LOG_INFO(Logger) << "Received " << state << " state from " << peer.GetUUID() << std::endl;
 
         if(state == "supply")
         {
@@ -581,11 +840,59 @@ void LBAgent::HandleStateChange(const StateChangeMessage & m, CPeerNode peer)
         }
         else
         {
-            Logger.Warn << "Bad state from peer: " << peer.GetUUID() << std::endl;
+            LOG_WARN(Logger) << "Bad state from peer: " << peer.GetUUID() << std::endl;
         }
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// HandleStateDigest
+/// @description Handles the state a peer advertised on a group management or
+///     clock message. A digest no newer than the last one of the peer is
+///     dropped, since the messages that carry it are not ordered.
+/// @pre None
+/// @post A group member is placed in the set of its advertised state.
+/// @param m The digest that was received by this process.
+/// @param peer The process that the digest originated from.
+/// @peers A Group member, or any process the messages come from.
+/// @limitations Does not validate the source, integrity or contents of the
+///     message.
+///////////////////////////////////////////////////////////////////////////////
+void LBAgent::HandleStateDigest(const StateDigestMessage & m, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(CountInPeerSet(m_AllPeers, peer) == 0)
+    {
+        return;
+    }
+
+    std::map<std::string, google::protobuf::uint64>::iterator it =
+        m_PeerEpochs.find(peer.GetUUID());
+    if(it != m_PeerEpochs.end() && it->second >= m.epoch())
+    {
+        return;
+    }
+    m_PeerEpochs[peer.GetUUID()] = m.epoch();
+    LOG_DEBUG(Logger) << "Digest from " << peer.GetUUID() << ": state "
+        << m.state() << ", gateway " << m.gateway() << std::endl;
+
+    switch(m.state())
+    {
+    case LBAgent::SUPPLY:
+        MoveToPeerSet(m_InSupply, peer);
+        break;
+    case LBAgent::DEMAND:
+        MoveToPeerSet(m_InDemand, peer);
+        break;
+    case LBAgent::NORMAL:
+        MoveToPeerSet(m_InNormal, peer);
+        break;
+    default:
+        LOG_WARN(Logger) << "Bad state from peer: " << peer.GetUUID() << std::endl;
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// MessageDraftRequest
 /// @pre None
@@ -594,7 +901,7 @@ void LBAgent::HandleStateChange(const StateChangeMessage & m, CPeerNode peer)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageDraftRequest()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     msg.mutable_draft_request_message();
     return PrepareForSending(msg);
@@ -608,27 +915,35 @@ ModuleMessage LBAgent::MessageDraftRequest()
 /////////////////////////////////////////////////////////
 void LBAgent::SendDraftRequest()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(m_State != LBAgent::SUPPLY)
     {
-        Logger.Notice << "Draft Request Cancelled: not in SUPPLY" << std::endl;
+        LOG_NOTICE(Logger) << "Draft Request Cancelled: not in SUPPLY" << std::endl;
     }
-    else if(m_InDemand.empty())
+    else if(m_InDemand.Empty())
     {
-        Logger.Notice << "Draft Request Cancelled: no DEMAND" << std::endl;
+        LOG_NOTICE(Logger) << "Draft Request Cancelled: no DEMAND" << std::endl;
     }
-    else if(!InvariantCheck())
+    else if(!InvariantCheck(m_MigrationStep))
     {
-        Logger.Notice << "Draft Request Cancelled: invariant false" << std::endl;
+        LOG_NOTICE(Logger) << "Draft Request Cancelled: invariant false" << std::endl;
     }
     else
     {
-        SendToPeerSet(m_InDemand, MessageDraftRequest());
-        CBroker::Instance().Schedule(m_WaitTimer, REQUEST_TIMEOUT,
-            boost::bind(&LBAgent::DraftStandard, this, boost::asio::placeholders::error));
+        PeerSet demand = m_InDemand.ToPeerSet();
+        std::set<std::string> expected;
+        BOOST_FOREACH(const std::string & uuid, demand | boost::adaptors::map_keys)
+        {
+            expected.insert(uuid);
+        }
+        SendToPeerSet(demand, MessageDraftRequest());
         m_DraftAge.clear();
-        Logger.Info << "Sent Draft Request" << std::endl;
+        m_Drafting = true;
+        // the draft is decided once every demand node answered
+        m_DraftRound.Start(m_WaitTimer, REQUEST_TIMEOUT,
+            expected, boost::bind(&LBAgent::DraftStandard, this, boost::asio::placeholders::error));
+        LOG_INFO(Logger) << "Sent Draft Request" << std::endl;
     }
 }
 
@@ -648,12 +963,12 @@ void LBAgent::SendDraftRequest()
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleDraftRequest(const DraftRequestMessage & /*m*/, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Info << "Draft Request from " << peer.GetUUID() << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_INFO(Logger) << "Draft Request from " << peer.GetUUID() << std::endl;
 
     if(CountInPeerSet(m_AllPeers, peer) == 0)
     {
-        Logger.Notice << "Rejected Draft Request: unknown peer" << std::endl;
+        LOG_NOTICE(Logger) << "Rejected Draft Request: unknown peer" << std::endl;
     }
     else
     {
@@ -670,7 +985,7 @@ void LBAgent::HandleDraftRequest(const DraftRequestMessage & /*m*/, CPeerNode pe
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageDraftAge(float age)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     DraftAgeMessage * submsg = msg.mutable_draft_age_message();
     submsg->set_draft_age(age);
@@ -687,23 +1002,23 @@ ModuleMessage LBAgent::MessageDraftAge(float age)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::SendDraftAge(CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     float age = 0;
     if(m_State == LBAgent::DEMAND)
     {
         age = m_Gateway - m_NetGeneration;
     }
-    Logger.Info << "Calculated Draft Age: " << age << std::endl;
+    LOG_INFO(Logger) << "Calculated Draft Age: " << age << std::endl;
 
     try
     {
         peer.Send(MessageDraftAge(age));
-        Logger.Notice << "Sent Draft Age to " << peer.GetUUID() << std::endl;
+        LOG_NOTICE(Logger) << "Sent Draft Age to " << peer.GetUUID() << std::endl;
     }
     catch(boost::system::system_error & e)
     {
-        Logger.Warn << "Couldn't connect to peer" << std::endl;
+        LOG_WARN(Logger) << "Couldn't connect to peer" << std::endl;
     }
 }
 
@@ -715,8 +1030,8 @@ void LBAgent::SendDraftAge(CPeerNode peer)
 ///     instruct the demand node to commit a power change.
 /// @pre The message and peer are valid. This node should have sent a draft
 ///     request message to peer previously.
-/// @post If in supply and the demand node is selected, a drafting message
-///     will be sent to the demand node.
+/// @post The age is kept for DraftStandard, which runs early once every
+///     demand node asked has answered.
 /// @param m The message body that was recieved by this process.
 /// @param peer The process that the message orginated from.
 /// @peers A demand node in the group.
@@ -725,16 +1040,17 @@ void LBAgent::SendDraftAge(CPeerNode peer)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleDraftAge(const DraftAgeMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(CountInPeerSet(m_AllPeers, peer) == 0)
     {
-        Logger.Notice << "Rejected Draft Age: unknown peer" << std::endl;
+        LOG_NOTICE(Logger) << "Rejected Draft Age: unknown peer" << std::endl;
     }
     else
     {
         m_DraftAge[peer.GetUUID()] = m.draft_age();
-        Logger.Info << "Received draft age from " << peer.GetUUID() << std::endl;
+        LOG_INFO(Logger) << "Received draft age from " << peer.GetUUID() << std::endl;
+        m_DraftRound.Respond(peer.GetUUID());
     }
 }
 
@@ -742,19 +1058,24 @@ void LBAgent::HandleDraftAge(const DraftAgeMessage & m, CPeerNode peer)
 /// DraftStandard
 /// @description This function is used to select the process(es) that the
 ///     migration will happen with. The demand nodes send DraftAge messages
-///     indicating the amount of demand to fill.
+///     indicating the amount of demand to fill. With one draft partner the
+///     greatest age is sent a single migration step. With more, the surplus
+///     of this node is split across up to that many demand nodes from the
+///     greatest age down, each sent the whole steps of its age that the
+///     remaining surplus covers, and the invariant is checked before each.
 /// @pre DraftRequests were sent to the nodes whose replies will be processed
 /// @post DraftSelect messages are sent to the selected demand nodes.
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::DraftStandard(const boost::system::error_code & error)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_Drafting = false;
 
     if(!error)
     {
         std::map<std::string, float>::iterator it;
-        CPeerNode selected_peer;
-        float selected_age = 0;
+        std::vector<DraftCandidate> candidates;
 
         for(it = m_DraftAge.begin(); it != m_DraftAge.end(); it++)
         {
@@ -762,7 +1083,7 @@ void LBAgent::DraftStandard(const boost::system::error_code & error)
 
             if(psit == m_AllPeers.end())
             {
-                Logger.Info << "Skipped unknown peer: " << it->first << std::endl;
+                LOG_INFO(Logger) << "Skipped unknown peer: " << it->first << std::endl;
                 continue;
             }
 
@@ -773,25 +1094,49 @@ void LBAgent::DraftStandard(const boost::system::error_code & error)
             {
                 MoveToPeerSet(m_InNormal, peer);
             }
-            else if(age > selected_age)
+            else if(age > 0.0)
             {
-                selected_age = age;
-                selected_peer = peer;
+                candidates.push_back(DraftCandidate(age, peer));
             }
         }
 
-        if(selected_age >= m_MigrationStep && m_State == LBAgent::SUPPLY)
+        // stable, so equal ages keep the order of the table as before
+        std::stable_sort(candidates.begin(), candidates.end(), GreaterDraftAge);
+
+        float surplus = m_NetGeneration - m_Gateway;
+        std::size_t limit = std::min<std::size_t>(m_DraftPartners, candidates.size());
+
+        for(std::size_t i = 0; i < limit && m_State == LBAgent::SUPPLY; i++)
         {
-            SendDraftSelect(selected_peer, m_MigrationStep);
+            float amount = m_MigrationStep;
+
+            if(m_DraftPartners > 1)
+            {
+                float need = std::min(candidates[i].first, surplus);
+                amount = m_MigrationStep * std::floor(need / m_MigrationStep);
+            }
+
+            if(candidates[i].first < m_MigrationStep || amount < m_MigrationStep)
+            {
+                break;
+            }
+            if(m_DraftPartners > 1 && !InvariantCheck(amount))
+            {
+                LOG_NOTICE(Logger) << "Draft Select Cancelled: invariant false" << std::endl;
+                break;
+            }
+
+            SendDraftSelect(candidates[i].second, amount);
+            surplus -= amount;
         }
     }
     else if(error == boost::asio::error::operation_aborted)
     {
-        Logger.Notice << "Draft Standard Aborted" << std::endl;
+        LOG_NOTICE(Logger) << "Draft Standard Aborted" << std::endl;
     }
     else
     {
-        Logger.Error << error << std::endl;
+        LOG_ERROR(Logger) << error << std::endl;
         throw boost::system::system_error(error);
     }
 }
@@ -804,7 +1149,7 @@ void LBAgent::DraftStandard(const boost::system::error_code & error)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageDraftSelect(float amount)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     DraftSelectMessage * submsg = msg.mutable_draft_select_message();
     submsg->set_migrate_step(amount);
@@ -819,7 +1164,7 @@ ModuleMessage LBAgent::MessageDraftSelect(float amount)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::SendDraftSelect(CPeerNode peer, float step)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     try
     {
@@ -829,7 +1174,7 @@ void LBAgent::SendDraftSelect(CPeerNode peer, float step)
     }
     catch(boost::system::system_error & e)
     {
-        Logger.Warn << "Couldn't connect to peer" << std::endl;
+        LOG_WARN(Logger) << "Couldn't connect to peer" << std::endl;
     }
 }
 
@@ -853,15 +1198,15 @@ void LBAgent::SendDraftSelect(CPeerNode peer, float step)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleDraftSelect(const DraftSelectMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(CountInPeerSet(m_AllPeers, peer) == 0)
     {
-        Logger.Notice << "Rejected Draft Select: peer node in group" << std::endl;
+        LOG_NOTICE(Logger) << "Rejected Draft Select: peer node in group" << std::endl;
     }
     else if(CGlobalConfiguration::Instance().GetMaliciousFlag())
     {
-        Logger.Notice << "(MALICIOUS) Dropped draft select message." << std::endl;
+        LOG_NOTICE(Logger) << "(MALICIOUS) Dropped draft select message." << std::endl;
     }
     else
     {
@@ -873,15 +1218,17 @@ void LBAgent::HandleDraftSelect(const DraftSelectMessage & m, CPeerNode peer)
             {
                 peer.Send(MessageDraftAccept(amount));
                 SetPStar(m_PredictedGateway - amount);
+                MigrationsMetric.Increment();
             }
             else
             {
                 peer.Send(MessageTooLate(amount));
+                LateMigrationsMetric.Increment();
             }
         }
         catch(boost::system::system_error & error)
         {
-            Logger.Warn << "Couldn't connect to peer" << std::endl;
+            LOG_WARN(Logger) << "Couldn't connect to peer" << std::endl;
         }
     }
 }
@@ -894,7 +1241,7 @@ void LBAgent::HandleDraftSelect(const DraftSelectMessage & m, CPeerNode peer)
 /////////////////////////////////////////////////////////////////////////////// 
 ModuleMessage LBAgent::MessageDraftAccept(float amount)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     DraftAcceptMessage * submsg = msg.mutable_draft_accept_message();
     submsg->set_migrate_step(amount);
@@ -909,7 +1256,7 @@ ModuleMessage LBAgent::MessageDraftAccept(float amount)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageTooLate(float amount)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     TooLateMessage * submsg = msg.mutable_too_late_message();
     submsg->set_migrate_step(amount);
@@ -931,7 +1278,7 @@ ModuleMessage LBAgent::MessageTooLate(float amount)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleDraftAccept(const DraftAcceptMessage & m, CPeerNode /* peer */)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     m_PowerDifferential -= m.migrate_step();
 }
 
@@ -950,7 +1297,7 @@ void LBAgent::HandleDraftAccept(const DraftAcceptMessage & m, CPeerNode /* peer
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleTooLate(const TooLateMessage & m)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     SetPStar(m_PredictedGateway - m.migrate_step());
     m_PowerDifferential -= m.migrate_step();
 }
@@ -959,7 +1306,9 @@ void LBAgent::HandleTooLate(const TooLateMessage & m)
 /// HandlePeerList
 /// @description Updates the list of peers this node is aware of.
 /// @pre There is a valid message pointer and peer passed into the module.
-/// @post The AllPeers, Normal, Supply, and Demand peersets are reset.
+/// @post The AllPeers, Normal, Supply, and Demand peersets are reset, or only
+///     updated with the nodes that joined and left if the message lists the
+///     changes to the membership held.
 /// @param m The message body that was recieved by this process.
 /// @param peer The process that the message orginated from.
 /// @peers Group leader.
@@ -968,22 +1317,49 @@ void LBAgent::HandleTooLate(const TooLateMessage & m)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandlePeerList(const gm::PeerListMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Notice << "Updated peer list received from: " << peer.GetUUID() << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_NOTICE(Logger) << "Updated peer list received from: " << peer.GetUUID() << std::endl;
 
-    m_AllPeers.clear();
-    m_InSupply.clear();
-    m_InDemand.clear();
-    m_InNormal.clear();
+    gm::MembershipSnapshot next =
+        gm::GMAgent::UpdateMembership(m_membership, m, peer.GetUUID());
+    if(!next)
+    {
+        peer.Send(gm::GMAgent::PeerListQuery("lb"));
+        return;
+    }
+
+    PeerSet temp;
+    if(gm::GMAgent::IsDeltaOf(next, m_membership))
+    {
+        BOOST_FOREACH(const std::string& uuid, next->removed)
+        {
+            m_AllPeers.erase(uuid);
+            m_PeerEpochs.erase(uuid);
+            m_InSupply.Erase(uuid);
+            m_InDemand.Erase(uuid);
+            m_InNormal.Erase(uuid);
+        }
+        temp = next->added;
+    }
+    else
+    {
+        m_AllPeers.clear();
+        m_InSupply.Clear();
+        m_InDemand.Clear();
+        m_InNormal.Clear();
+        temp = next->peers;
+    }
+    m_membership = next;
 
-    PeerSet temp = gm::GMAgent::ProcessPeerList(m);
     BOOST_FOREACH(CPeerNode p, temp | boost::adaptors::map_values)
     {
         if(CountInPeerSet(m_AllPeers, p) == 0 && p.GetUUID() != GetUUID())
         {
-            Logger.Debug << "Recognize new peer: " << p.GetUUID() << std::endl;
+            LOG_DEBUG(Logger) << "Recognize new peer: " << p.GetUUID() << std::endl;
             InsertInPeerSet(m_AllPeers, p);
-            InsertInPeerSet(m_InNormal, p);
+            m_InNormal.Insert(p);
+            // the next digest of the peer sets its state again
+            m_PeerEpochs.erase(p.GetUUID());
         }
     }
     m_Leader = peer.GetUUID();
@@ -999,7 +1375,10 @@ void LBAgent::HandlePeerList(const gm::PeerListMessage & m, CPeerNode peer)
 /////////////////////////////////////////////////////////
 void LBAgent::SetPStar(float pstar)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // the DESD command is timed from the oldest state read for it
+    device::CControlLoop::CScope scope("lb");
 
     //std::set<device::CDevice::Pointer> sstContainer;
     //sstContainer = device::CDeviceManager::Instance().GetDevicesOfType("Sst");
@@ -1014,16 +1393,16 @@ void LBAgent::SetPStar(float pstar)
     {
         if(sstContainer.size() > 1)
         {
-            Logger.Warn << "Multiple attached SST devices" << std::endl;
+            LOG_WARN(Logger) << "Multiple attached SST devices" << std::endl;
         }
 
         (*sstContainer.begin())->SetCommand("gateway", pstar);
         m_PredictedGateway = pstar;
-        Logger.Notice << "P* = " << pstar << std::endl;
+        LOG_NOTICE(Logger) << "P* = " << pstar << std::endl;
     }
     else
     {
-        Logger.Warn << "Failed to set P*: no attached SST device" << std::endl;
+        LOG_WARN(Logger) << "Failed to set P*: no attached SST device" << std::endl;
     }*/
 }
 
@@ -1037,7 +1416,7 @@ void LBAgent::SetPStar(float pstar)
 /////////////////////////////////////////////////////////
 void LBAgent::SetDESD(float desdv)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     std::set<device::CDevice::Pointer> desd;
     desd = device::CDeviceManager::Instance().GetDevicesOfType("DESD");
@@ -1061,19 +1440,19 @@ void LBAgent::SetDESD(float desdv)
             }
             output += "\t" + command + "\n";
         }
-        Logger.Status << output << std::endl;
+        LOG_STATUS(Logger) << output << std::endl;
 
         //HARD CODED BIT
 
         if(!cmd.empty())
         {
             dev->SetCommand(cmd, desdv);
-            Logger.Notice << "Desd* = " << desdv << std::endl;
+            LOG_NOTICE(Logger) << "Desd* = " << desdv << std::endl;
         }
     }
     else
     {
-        Logger.Warn << "Failed to set Desd: no attached Desd device" << std::endl;
+        LOG_WARN(Logger) << "Failed to set Desd: no attached Desd device" << std::endl;
     }
 }
 
@@ -1089,7 +1468,7 @@ void LBAgent::SetDESD(float desdv)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::PrepareForSending(const LoadBalancingMessage & m, std::string recipient)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     ModuleMessage mm;
     mm.mutable_load_balancing_message()->CopyFrom(m);
     mm.set_recipient_module(recipient);
@@ -1105,12 +1484,14 @@ ModuleMessage LBAgent::PrepareForSending(const LoadBalancingMessage & m, std::st
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageStateCollection()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     sc::StateCollectionMessage msg;
     sc::RequestMessage * submsg = msg.mutable_request_message();
     sc::DeviceSignalRequestMessage * subsubmsg = submsg->add_device_signal_request_message();
     submsg->set_module("lb");
+    // a result older than a round would be stale
+    submsg->set_deadline_ms(ROUND_TIME.total_milliseconds());
     subsubmsg->set_type("SST");
     subsubmsg->set_signal("gateway");
 
@@ -1129,7 +1510,7 @@ ModuleMessage LBAgent::MessageStateCollection()
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::ScheduleStateCollection()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(m_Leader == GetUUID())
     {
@@ -1140,7 +1521,7 @@ void LBAgent::ScheduleStateCollection()
         }
         catch(boost::system::system_error & error)
         {
-            Logger.Info << "Couldn't send message to peer" << std::endl;
+            LOG_INFO(Logger) << "Couldn't send message to peer" << std::endl;
         }
     }
 }
@@ -1151,7 +1532,9 @@ void LBAgent::ScheduleStateCollection()
 ///     this function handles that message and stores it into this node.
 /// @pre The message is valid 
 /// @post The aggregate gateway, normal and demand member variables are set.
-///     Sends the normal to the members of the group.
+///     Sends the normal to the members of the group. A result that misses
+///     members because its deadline passed is ignored and the last normal
+///     is kept.
 /// @param m The message body that was recieved by this process.
 /// @peers My state collection module, Members of my group.
 /// @limitations Does not validate the source, integrity or contents of the
@@ -1159,7 +1542,18 @@ void LBAgent::ScheduleStateCollection()
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleCollectedState(const sc::CollectedStateMessage & m)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(m.has_complete() && !m.complete())
+    {
+        return;
+    }
+    if(m.has_reported() && m.reported() < m.expected())
+    {
+        LOG_NOTICE(Logger) << "Ignored a collected state of " << m.reported()
+            << " of " << m.expected() << " nodes" << std::endl;
+        return;
+    }
 
     float net_power = 0;
     BOOST_FOREACH(float v, m.gateway())
@@ -1181,7 +1575,7 @@ void LBAgent::HandleCollectedState(const sc::CollectedStateMessage & m)
 ///////////////////////////////////////////////////////////////////////////////
 ModuleMessage LBAgent::MessageCollectedState(float state)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     LoadBalancingMessage msg;
     CollectedStateMessage * submsg = msg.mutable_collected_state_message();
     submsg->set_gross_power_flow(state);
@@ -1202,7 +1596,7 @@ ModuleMessage LBAgent::MessageCollectedState(float state)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::HandleCollectedState(const CollectedStateMessage & m)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     Synchronize(m.gross_power_flow());
 }
 
@@ -1216,27 +1610,71 @@ void LBAgent::HandleCollectedState(const CollectedStateMessage & m)
 ///////////////////////////////////////////////////////////////////////////////
 void LBAgent::Synchronize(float k)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     
     ReadDevices();
     m_PowerDifferential = k;
     m_PredictedGateway = m_Gateway;
     m_Synchronized = true;
 
-    Logger.Info << "Reset Gross Power Flow: " << k << std::endl;
-    Logger.Info << "Reset Predicted Gateway: " << m_Gateway << std::endl;
+    if(CWarmState::Instance().IsEnabled())
+    {
+        WarmLoadBalance state;
+        state.set_gateway(m_Gateway);
+        state.set_power_differential(k);
+        CWarmState::Instance().SaveLoadBalance(state);
+    }
+
+    LOG_INFO(Logger) << "Reset Gross Power Flow: " << k << std::endl;
+    LOG_INFO(Logger) << "Reset Predicted Gateway: " << m_Gateway << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ResumeWarmState
+/// @description Takes the gross power flow of the last run as the state of
+///     the first round, so drafting can resume before the first state
+///     collection returns. The hint is only used once, and only if the
+///     gateway is still within a migration step of the saved one; otherwise
+///     the node waits for state collection as usual.
+/// @pre None
+/// @post m_Synchronized is true if the hint was used.
+///////////////////////////////////////////////////////////////////////////////
+void LBAgent::ResumeWarmState()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const WarmLoadBalance* hint = CWarmState::Instance().GetLoadBalanceHint();
+    if(hint == 0 || m_WarmResumed)
+    {
+        return;
+    }
+    m_WarmResumed = true;
+
+    ReadDevices();
+    if(std::fabs(m_Gateway - hint->gateway()) >= m_MigrationStep)
+    {
+        LOG_NOTICE(Logger) << "Gateway moved since the warm state was saved" << std::endl;
+        return;
+    }
+    m_PowerDifferential = hint->power_differential();
+    m_PredictedGateway = m_Gateway;
+    m_Synchronized = true;
+    LOG_NOTICE(Logger) << "Resumed Gross Power Flow: " << m_PowerDifferential << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// InvariantCheck
-/// @description Evaluates the current truth of the physical invariant
+/// @description Evaluates the current truth of the physical invariant for a
+///     new migration of the given size. The migrations selected earlier in the
+///     round are already part of the power differential.
 /// @pre none
 /// @post calculate the physical invariant using the Omega device
+/// @param step the size of the migration that would be started
 /// @return the truth value of the physical invariant 
 ///////////////////////////////////////////////////////////////////////////////
-bool LBAgent::InvariantCheck()
+bool LBAgent::InvariantCheck(float step)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     const float OMEGA_STEADY_STATE = 376.8;
     const int SCALING_FACTOR = 1000;
@@ -1249,14 +1687,14 @@ bool LBAgent::InvariantCheck()
     {
         if(container.size() > 1)
         {
-            Logger.Warn << "Multiple attached frequency devices." << std::endl;
+            LOG_WARN(Logger) << "Multiple attached frequency devices." << std::endl;
         }
         float w  = (*container.begin())->GetState("frequency");
         float P  = SCALING_FACTOR * m_PowerDifferential;
-        float dK = SCALING_FACTOR * (m_PowerDifferential + m_MigrationStep);
+        float dK = SCALING_FACTOR * (m_PowerDifferential + step);
         float freq_diff = w - OMEGA_STEADY_STATE;
 
-        Logger.Info << "Invariant Variables:"
+        LOG_INFO(Logger) << "Invariant Variables:"
             << "\n\tw  = " << w
             << "\n\tP  = " << P
             << "\n\tdK = " << dK << std::endl;
@@ -1265,7 +1703,7 @@ bool LBAgent::InvariantCheck()
 
         if(!result)
         {
-            Logger.Info << "The physical invariant is false." << std::endl;
+            LOG_INFO(Logger) << "The physical invariant is false." << std::endl;
         }
     }
 
@@ -26,9 +26,12 @@
 
 #include "CBroker.hpp"
 #include "CDevice.hpp"
+#include "CPeerBitSet.hpp"
 #include "CPeerNode.hpp"
+#include "CResponseRound.hpp"
 #include "PeerSets.hpp"
 #include "IDGIModule.hpp"
+#include "gm/GroupManagement.hpp"
 #include "messages/ModuleMessage.pb.h"
 
 #include <map>
@@ -76,6 +79,8 @@ private:
     void HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, CPeerNode peer);
     /// Handles a node announcing its state change.
     void HandleStateChange(const StateChangeMessage & m, CPeerNode peer);
+    /// Handles the state a peer advertised on a message of another module.
+    void HandleStateDigest(const StateDigestMessage & m, CPeerNode peer);
     /// Handles the draft request originating from the supply node.
     void HandleDraftRequest(const DraftRequestMessage & m, CPeerNode peer);
     /// Handles the draft age message coming from the demand node.
@@ -94,7 +99,7 @@ private:
     void HandleCollectedState(const CollectedStateMessage & m);
     
     /// Moves a peer to the specified peerset.
-    void MoveToPeerSet(PeerSet & ps, CPeerNode peer);
+    void MoveToPeerSet(CPeerBitSet & ps, CPeerNode peer);
     
     /// The code that the supply nodes use to start doing migrations
     void LoadManage(const boost::system::error_code & error);
@@ -107,8 +112,16 @@ private:
     void ScheduleNextRound();
     /// Updates the state from the devices.
     void ReadDevices();
+    /// Moves the net generation along its trend by one round
+    void UpdateForecast();
     /// Updates the node's state.
     void UpdateState();
+    /// Advertises the state on the messages of other modules if it changed.
+    void PublishDigest();
+    /// Reacts to a change of the load between rounds.
+    void HandleLoadChange(float load);
+    /// Starts a round early when the devices have left the deadband.
+    void HandleImbalanceChange(float value);
     /// Displays the load table to show DGI state.
     void LoadTable();
     /// Sends Draft request to all the demand peers.
@@ -129,27 +142,32 @@ private:
     void ScheduleStateCollection();
     /// Synchronizes the Fast-Style Loadbalance with the physical system.
     void Synchronize(float k);
-    /// Check the invariant prior to starting a new migration.
-    bool InvariantCheck();
+    void ResumeWarmState();
+    /// Check the invariant prior to starting a new migration of step.
+    bool InvariantCheck(float step);
 
     /// The amount of time it takes to do an LB round
-    const boost::posix_time::time_duration ROUND_TIME;
+    boost::posix_time::time_duration ROUND_TIME;
     /// The time it takes to get a draftrequest response
-    const boost::posix_time::time_duration REQUEST_TIMEOUT;
+    boost::posix_time::time_duration REQUEST_TIMEOUT;
 
     /// Timer handle for the round timer
     CBroker::TimerHandle m_RoundTimer;
     /// Timer handle for the request timer
     CBroker::TimerHandle m_WaitTimer;
+    /// The draft request waiting on the demand nodes' ages
+    CResponseRound m_DraftRound;
 
+    /// The group membership last received
+    gm::MembershipSnapshot m_membership;
     /// All peers in group.
     PeerSet m_AllPeers;
     /// Peers in the supply state
-    PeerSet m_InSupply;
+    CPeerBitSet m_InSupply;
     /// Peers in the demand state
-    PeerSet m_InDemand;
+    CPeerBitSet m_InDemand;
     /// Peers in the normal state
-    PeerSet m_InNormal;
+    CPeerBitSet m_InNormal;
 
     /// The current state of this peer.
     State m_State;
@@ -162,11 +180,44 @@ private:
     float m_PredictedGateway;
     /// The amount to migrate.
     float m_MigrationStep;
+    /// The most demand nodes drafted in one round.
+    unsigned int m_DraftPartners;
     /// The powerflow used by the physical invariant.
     float m_PowerDifferential;
+    /// The change from the last round that starts a round early, 0 for none.
+    float m_Deadband;
+    /// The gateway read by the last round.
+    float m_RoundGateway;
+    /// The net generation read by the last round.
+    float m_RoundNetGeneration;
+    /// The net generation read from the devices, before the forecast.
+    float m_MeasuredNetGeneration;
+    /// The smoothing factor of the forecast, 0 for none.
+    float m_Forecast;
+    /// The smoothed net generation.
+    float m_ForecastLevel;
+    /// The smoothed change of the net generation per second.
+    float m_ForecastTrend;
+    /// The time of the last reading smoothed.
+    boost::posix_time::ptime m_ForecastTime;
 
     /// If the system is synchronized with the physical system.
     bool m_Synchronized;
+    /// If the next round waits for the next phase.
+    bool m_NextPhase;
+    /// If draft ages are awaited from the demand nodes.
+    bool m_Drafting;
+    /// If the state is advertised on the messages of other modules.
+    bool m_Digests;
+    /// The epoch of the last state advertised.
+    google::protobuf::uint64 m_DigestEpoch;
+    /// The state last advertised.
+    State m_DigestState;
+    /// The gateway last advertised.
+    float m_DigestGateway;
+    /// The epoch of the newest digest of each peer.
+    std::map<std::string, google::protobuf::uint64> m_PeerEpochs;
+    bool m_WarmResumed;
 
     /// The coordinator of  the group.
     std::string m_Leader;
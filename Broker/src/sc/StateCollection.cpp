@@ -13,8 +13,18 @@
 ///               HandleRead()
 ///               TakeSnapshot()
 ///               StateResponse()
+///               ContinueResponse()
 ///               SendStateBack()
 ///               SaveForward()
+///               StartSnapshot()
+///               EndSnapshot()
+///               Record()
+///               RecordChannel()
+///               Release()
+///               ReleaseAll()
+///               PatchState()
+///               StartAggregate()
+///               ForwardAggregate()
 ///               GetPeer()
 ///               AddPeer()
 ///
@@ -41,14 +51,18 @@
 #include "CConnection.hpp"
 #include "CConnectionManager.hpp"
 #include "CDeviceManager.hpp"
+#include "CGlobalConfiguration.hpp"
 #include "CGlobalPeerList.hpp"
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
 #include "CPeerNode.hpp"
+#include "CVirtualClock.hpp"
 #include "Messages.hpp"
 #include "gm/GroupManagement.hpp"
 #include "FreedmExceptions.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <exception>
 #include <fstream>
@@ -67,6 +81,7 @@
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/foreach.hpp>
 #include <boost/function.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/range/adaptor/map.hpp>
 
 using boost::property_tree::ptree;
@@ -95,6 +110,151 @@ namespace
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
 
+/// Snapshots this node completed as the initiator
+CCounter& CollectionsMetric = CMetrics::Instance().GetCounter(
+    "dgi_sc_collections_total", "State collections completed, by outcome",
+    CMetrics::Label("outcome", "complete"));
+
+/// Snapshots this node answered at their deadline with the states so far
+CCounter& ExpiredMetric = CMetrics::Instance().GetCounter(
+    "dgi_sc_collections_total", "State collections completed, by outcome",
+    CMetrics::Label("outcome", "expired"));
+
+/// Requests answered with the last collected state
+CCounter& CachedMetric = CMetrics::Instance().GetCounter(
+    "dgi_sc_requests_without_snapshot_total",
+    "State collection requests answered without a new snapshot, by source",
+    CMetrics::Label("source", "cache"));
+
+/// Requests answered with a snapshot that was already in flight
+CCounter& SharedMetric = CMetrics::Instance().GetCounter(
+    "dgi_sc_requests_without_snapshot_total",
+    "State collection requests answered without a new snapshot, by source",
+    CMetrics::Label("source", "shared"));
+
+/// Snapshots dropped to make room for newer ones
+CCounter& AbandonedMetric = CMetrics::Instance().GetCounter(
+    "dgi_sc_abandoned_snapshots_total",
+    "Snapshots dropped to make room for a newer snapshot");
+
+/// States left out of a snapshot at the recording memory cap
+CCounter& OverflowMetric = CMetrics::Instance().GetCounter(
+    "dgi_sc_record_overflow_total",
+    "States left out of a snapshot because the recordings reached their memory cap");
+
+/// Released recordings kept for the states of later snapshots
+const std::size_t RECORDING_POOL = 4;
+
+/// Times from the start of a snapshot to the collected state
+CHistogram& LatencyMetric = CMetrics::Instance().GetHistogram(
+    "dgi_sc_collection_seconds",
+    "Times from the start of a state collection to its result");
+
+/// Children of each node in the aggregation tree
+const unsigned int AGGREGATE_FANOUT = 4;
+
+/// Finds the aggregate of a signal, creating an empty one if needed
+SignalAggregateMessage& FindAggregate(AggregateStateMessage& total,
+    const std::string& type, const std::string& signal)
+{
+    for (int i = 0; i < total.aggregate_size(); i++)
+    {
+        if (total.aggregate(i).type() == type && total.aggregate(i).signal() == signal)
+        {
+            return *total.mutable_aggregate(i);
+        }
+    }
+
+    SignalAggregateMessage* sam = total.add_aggregate();
+    sam->set_type(type);
+    sam->set_signal(signal);
+    sam->set_sum(0);
+    sam->set_min(0);
+    sam->set_max(0);
+    sam->set_count(0);
+    sam->set_nodes(0);
+    return *sam;
+}
+
+/// Folds the aggregate of one subtree into another
+void MergeAggregate(AggregateStateMessage& total, const SignalAggregateMessage& part)
+{
+    SignalAggregateMessage& sam = FindAggregate(total, part.type(), part.signal());
+
+    if (part.nodes() > 0)
+    {
+        sam.set_min(sam.nodes() > 0 ? std::min(sam.min(), part.min()) : part.min());
+        sam.set_max(sam.nodes() > 0 ? std::max(sam.max(), part.max()) : part.max());
+    }
+    sam.set_sum(sam.sum() + part.sum());
+    sam.set_count(sam.count() + part.count());
+    sam.set_nodes(sam.nodes() + part.nodes());
+}
+
+/// Adds the state of one signal of a node to a collected state
+void AddToCollected(CollectedStateMessage& csm, const DeviceSignalStateMessage& dssm)
+{
+    if (dssm.type() == "SST")
+    {
+        if(dssm.count()>0)
+        {
+            csm.add_gateway(dssm.value());
+        }
+        else
+        {
+            csm.clear_gateway();
+        }
+    }
+    else if (dssm.type() == "Drer")
+    {
+        if(dssm.count()>0)
+        {
+            csm.add_generation(dssm.value());
+        }
+        else
+        {
+            csm.clear_generation();
+        }
+    }
+    else if (dssm.type() == "DESD")
+    {
+        if(dssm.count()>0)
+        {
+            csm.add_storage(dssm.value());
+        }
+        else
+        {
+            csm.clear_storage();
+        }
+    }
+    else if (dssm.type() == "Load")
+    {
+        if(dssm.count()>0)
+        {
+            csm.add_drain(dssm.value());
+        }
+        else
+        {
+            csm.clear_drain();
+        }
+    }
+    else if (dssm.type() == "Fid")
+    {
+        if(dssm.count()>0)
+        {
+            csm.add_state(dssm.value());
+        }
+        else
+        {
+            csm.clear_state();
+        }
+    }
+    else if (dssm.type() == "Message")
+    {
+        csm.set_num_intransit_accepts(csm.num_intransit_accepts() + dssm.value());
+    }
+}
+
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -106,12 +266,16 @@ CLocalLogger Logger(__FILE__);
 ///////////////////////////////////////////////////////////////////////////////
 
 SCAgent::SCAgent():
-        m_countstate(0),
-        m_NotifyToSave(false),
-        m_curversion("default", 0)
+        m_recordedbytes(0),
+        m_recordedstates(0),
+        m_nextid(0),
+        m_started(0),
+        m_reportedversion("default", 0),
+        m_collectmemory("sc", "collectstate")
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     AddPeer(GetMe());
+    m_deadlinetimer = CBroker::Instance().AllocateTimer("sc");
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -123,11 +287,11 @@ SCAgent::SCAgent():
 ///////////////////////////////////////////////////////////////////////////////
 void SCAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if (msg->has_group_management_message())
     {
-        gm::GroupManagementMessage gmm = msg->group_management_message();
+        const gm::GroupManagementMessage& gmm = msg->group_management_message();
 
         if (gmm.has_peer_list_message())
         {
@@ -135,13 +299,13 @@ void SCAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg,
         }
         else
         {
-            Logger.Warn << "Dropped group management message of unexpected type:\n"
+            LOG_WARN(Logger) << "Dropped group management message of unexpected type:\n"
                         << msg->DebugString();
         }
     }
     else if (msg->has_load_balancing_message())
     {
-        lb::LoadBalancingMessage lbm = msg->load_balancing_message();
+        const lb::LoadBalancingMessage& lbm = msg->load_balancing_message();
 
         if (lbm.has_draft_accept_message())
         {
@@ -150,11 +314,11 @@ void SCAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg,
     }
     else if (msg->has_volt_var_message())
     {
-        vvc::VoltVarMessage vvm = msg->volt_var_message();
+        // the volt var messages carry nothing for state collection
     }
     else if (msg->has_state_collection_message())
     {
-        StateCollectionMessage scm = msg->state_collection_message();
+        const StateCollectionMessage& scm = msg->state_collection_message();
 
         if (scm.has_marker_message())
         {
@@ -168,210 +332,549 @@ void SCAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg,
         {
             HandleRequest(scm.request_message(), peer);
         }
+        else if (scm.has_aggregate_state_message())
+        {
+            HandleAggregate(scm.aggregate_state_message(), peer);
+        }
         else
         {
-            Logger.Warn << "Dropped sc message of unexpected type:\n" << msg->DebugString();
+            LOG_WARN(Logger) << "Dropped sc message of unexpected type:\n" << msg->DebugString();
         }
     }
     else
     {
-        Logger.Warn << "Dropped message of unexpected type:\n" << msg->DebugString();
+        LOG_WARN(Logger) << "Dropped message of unexpected type:\n" << msg->DebugString();
     }
 }
 
 ///////////////////////////////////////////////////////////////////
 /// Initiate
 /// @description Initiator redcords its local state and broadcasts marker.
+///     Each call starts a new snapshot version, so a snapshot can start
+///     while the previous ones are still in flight.
 /// @pre Receiving state collection request from other module.
 /// @post The node (initiator) starts collecting state by saving its own states and
 ///        broadcasting a marker out.
 /// @IO TakeSnapshot()
+/// @param module the module that requested the state
+/// @param devices the signals to collect, as type:signal
+/// @param stream true to deliver the state of each node as it arrives
+/// @param deadline milliseconds before the result is delivered regardless,
+///     or 0 to wait for every node
+/// @param maxage milliseconds old a collected state may be to answer the
+///     request instead, or 0 to always start a snapshot
 /// @return Send a marker out to all known peers
 /// @citation Distributed Snapshots: Determining Global States of Distributed Systems,
 ///            ACM Transactions on Computer Systems, Vol. 3, No. 1, 1985, pp. 63-75
 //////////////////////////////////////////////////////////////////
-void SCAgent::Initiate()
-{
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    //clear map of the collected states previously
-    collectstate.clear();
-    //count the number of states recorded
-    m_countstate = 0;
-    //count the number of peers that have finished the local state collection
-    m_countdone = 0;
-    //initiate current version of the marker
-    m_curversion.first = GetUUID();
-    m_curversion.second++;
-    //count marker
-    m_countmarker = 1;
+void SCAgent::Initiate(std::string module, std::vector<std::string> devices,
+    bool stream, int deadline, int maxage)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    if (maxage > 0 && !stream && AnswerFromCache(module, devices, maxage))
+    {
+        return;
+    }
+    //initiate the version of the marker, never reused by this node
+    m_nextid++;
+    StateVersion version(GetUUID(), m_nextid);
+    SSnapshot& snapshot = StartSnapshot(version, devices);
+    snapshot.module = module;
+    snapshot.stream = stream;
+    if (deadline > 0)
+    {
+        snapshot.deadline = CVirtualClock::Now()
+            + boost::posix_time::milliseconds(deadline);
+        ArmDeadline();
+    }
     //current peers in a group
-    Logger.Debug << " ------------ INITIAL, current peerList : -------------- "<<std::endl;
+    LOG_DEBUG(Logger) << " ------------ INITIAL, current peerList : -------------- "<<std::endl;
     BOOST_FOREACH(CPeerNode peer, m_AllPeers | boost::adaptors::map_values)
     {
-        Logger.Trace << peer.GetUUID() <<std::endl;
+        LOG_TRACE(Logger) << peer.GetUUID() <<std::endl;
     }
-    Logger.Debug << " --------------------------------------------- "<<std::endl;
+    LOG_DEBUG(Logger) << " --------------------------------------------- "<<std::endl;
     //collect states of local devices
-    Logger.Info << "TakeSnapshot: collect states of " << GetUUID() << std::endl;
-    //TakeSnapshot(m_deviceType, m_valueType);
-    TakeSnapshot(m_device);
-    //save state into the multimap "collectstate"
-    collectstate.insert(std::make_pair(m_curversion, m_curstate));
-    m_countstate++;
+    LOG_INFO(Logger) << "TakeSnapshot: collect states of " << GetUUID() << std::endl;
+    TakeSnapshot(devices);
+    //save state into the recording of the snapshot
+    Record(version, m_curstate);
+    if (stream)
+    {
+        SendPartial(snapshot, m_curstate);
+    }
 
     //set flag to start to record messages in channel
     if (m_AllPeers.size() > 1)
     {
-        m_NotifyToSave = true;
+        snapshot.recording = true;
+    }
+
+    if (CGlobalConfiguration::Instance().GetStateAggregate())
+    {
+        StartAggregate(snapshot, version);
     }
 
     //prepare marker tagged with UUID + Int
-    Logger.Info << "Marker is ready from " << GetUUID() << std::endl;
+    LOG_INFO(Logger) << "Marker " << version.second << " is ready from " << GetUUID()
+                     << ", " << m_snapshots.size() << " snapshots in flight" << std::endl;
 
     StateCollectionMessage scm;
     MarkerMessage* mm = scm.mutable_marker_message();
     mm->set_source(GetUUID());
-    mm->set_id(m_curversion.second);
+    mm->set_id(version.second);
+    if (CGlobalConfiguration::Instance().GetStatePacked())
+    {
+        mm->set_packed(true);
+    }
 
-    //add each device from m_device to marker message
-    BOOST_FOREACH(std::string device, m_device)
+    //add each device to marker message
+    BOOST_FOREACH(std::string device, devices)
     {
         mm->add_device(device);
     }
+
+    //tell the peers whose state is cached that they can send changes only
+    std::map<std::string, int>::iterator ack = m_cacheversion.begin();
+    while (ack != m_cacheversion.end())
+    {
+        if (m_AllPeers.count(ack->first) == 0)
+        {
+            m_cache.erase(ack->first);
+            m_cacheversion.erase(ack++);
+            continue;
+        }
+        if (CGlobalConfiguration::Instance().GetStateDelta())
+        {
+            StateAckMessage* sam = mm->add_acknowledged();
+            sam->set_source(ack->first);
+            sam->set_version(ack->second);
+        }
+        ack++;
+    }
+
     //send tagged marker to all other peers
+    CSerializedMessage::Pointer marker(new CSerializedMessage(ShareForSending(scm)));
     BOOST_FOREACH(CPeerNode peer, m_AllPeers | boost::adaptors::map_values)
     {
         if (peer.GetUUID()!= GetUUID())
         {
-            Logger.Info << "Sending marker to " << peer.GetUUID() << std::endl;
-            peer.Send(PrepareForSending(scm));
+            LOG_INFO(Logger) << "Sending marker to " << peer.GetUUID() << std::endl;
+            peer.Send(marker);
         }
     }//end foreach
 }
 
 
+///////////////////////////////////////////////////////////////////
+/// StartSnapshot
+/// @description Starts the bookkeeping of a snapshot. When the configured
+///     number of snapshots is already in flight, the oldest one is abandoned
+///     to make room.
+/// @pre version is not in flight.
+/// @post The snapshot is in m_snapshots with its own marker counted.
+/// @param version the marker of the snapshot
+/// @param devices the signals the snapshot collects
+/// @return the bookkeeping of the snapshot
+//////////////////////////////////////////////////////////////////
+SCAgent::SSnapshot& SCAgent::StartSnapshot(StateVersion version,
+    const std::vector<std::string>& devices)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    unsigned int capacity = CGlobalConfiguration::Instance().GetStateSnapshots();
+
+    while (!m_snapshots.empty() && m_snapshots.size() >= capacity)
+    {
+        SnapshotMap::iterator oldest = m_snapshots.begin();
+        for (SnapshotMap::iterator i = m_snapshots.begin(); i != m_snapshots.end(); i++)
+        {
+            if (i->second.started < oldest->second.started)
+            {
+                oldest = i;
+            }
+        }
+        StateVersion abandoned = oldest->first;
+        LOG_NOTICE(Logger) << "Abandoned snapshot " << abandoned.first << " + "
+                           << abandoned.second << std::endl;
+        AbandonedMetric.Increment();
+        EndSnapshot(abandoned);
+    }
+
+    std::map<std::string, int>::iterator latest = m_latest.find(version.first);
+    if (latest == m_latest.end() || latest->second < version.second)
+    {
+        m_latest[version.first] = version.second;
+    }
+
+    SSnapshot& snapshot = m_snapshots[version];
+    snapshot.markers = 1;
+    snapshot.states = 0;
+    snapshot.recording = false;
+    snapshot.started = m_started++;
+    snapshot.devices = devices;
+    snapshot.module.clear();
+    snapshot.shared.clear();
+    snapshot.stream = false;
+    snapshot.deadline = boost::posix_time::not_a_date_time;
+    snapshot.base = -1;
+    snapshot.packed = false;
+    snapshot.aggregate.Clear();
+    snapshot.parent.clear();
+    snapshot.pending = 0;
+    snapshot.local = false;
+    snapshot.begun = boost::posix_time::microsec_clock::universal_time();
+    return snapshot;
+}
+
+
+///////////////////////////////////////////////////////////////////
+/// EndSnapshot
+/// @description Forgets a snapshot and the states recorded for it.
+/// @pre None
+/// @post version is no longer in flight.
+/// @param version the marker of the snapshot
+//////////////////////////////////////////////////////////////////
+void SCAgent::EndSnapshot(StateVersion version)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    m_snapshots.erase(version);
+    Release(version);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 /// StateResponse
 /// @description This function deals with the collectstate and prepare states sending back.
 /// @pre The initiator has collected all states.
+/// @param version the marker of the snapshot
+/// @param expired true to send what has arrived when the deadline passed
 /// @post Collected states are sent back to the request module.
 /// @peers other SC processes
 /// @return Send message which contains gateway values and channel transit messages
 /// @limitation Currently, only gateway values and channel transit messages are collected and sent back.
 ///////////////////////////////////////////////////////////////////////////////
 
-void SCAgent::StateResponse()
+void SCAgent::StateResponse(StateVersion version, bool expired)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-    if (m_countmarker == m_AllPeers.size() && m_NotifyToSave == false)
+    SnapshotMap::iterator snap = m_snapshots.find(version);
+    if (snap == m_snapshots.end())
     {
-        Logger.Status << "****************CollectedStates***************************" << std::endl;
-        //prepare collect states
-        Logger.Info << "Sending requested state back to " << m_module << " module" << std::endl;
+        return;
+    }
+    SSnapshot& snapshot = snap->second;
 
-        StateCollectionMessage scm;
-        CollectedStateMessage* csm = scm.mutable_collected_state_message();
+    if (expired || (snapshot.markers == m_AllPeers.size() && snapshot.recording == false))
+    {
+        LOG_STATUS(Logger) << "****************CollectedStates***************************" << std::endl;
+        (expired ? ExpiredMetric : CollectionsMetric).Increment();
+        LatencyMetric.Observe((boost::posix_time::microsec_clock::universal_time()
+            - snapshot.begun).total_microseconds() / 1e6);
+        //prepare collect states
+        LOG_INFO(Logger) << "Sending requested state back to " << snapshot.module << " module" << std::endl;
+
+        boost::shared_ptr<SResponse> response = boost::make_shared<SResponse>();
+        response->version = version;
+        response->expired = expired;
+        response->module = snapshot.module;
+        response->shared = snapshot.shared;
+        response->devices = snapshot.devices;
+        response->next = 0;
+        CollectedStateMessage* csm = response->scm.mutable_collected_state_message();
         csm->set_num_intransit_accepts(0);
+        csm->set_complete(true);
+        csm->set_reported(snapshot.states + 1);
+        csm->set_expected(m_AllPeers.size());
 
-        for (it = collectstate.begin(); it != collectstate.end(); it++)
+        if (CGlobalConfiguration::Instance().GetStateAggregate())
         {
-            if ((*it).first == m_curversion)
+            //the tree has already combined the states of the members
+            AggregateLocal(snapshot, version);
+            LOG_INFO(Logger) << "Aggregated the states of " << snapshot.aggregate.members()
+                             << " nodes" << std::endl;
+            csm->set_reported(snapshot.aggregate.members());
+            csm->set_num_intransit_accepts(snapshot.aggregate.num_intransit_accepts());
+            BOOST_FOREACH(const SignalAggregateMessage& sam, snapshot.aggregate.aggregate())
             {
-                BOOST_FOREACH(
-                    const DeviceSignalStateMessage& dssm, it->second.device_signal_state_message())
+                csm->add_aggregate()->CopyFrom(sam);
+                if (sam.count() == 0)
+                {
+                    continue;
+                }
+                if (sam.type() == "SST")
+                {
+                    csm->add_gateway(sam.sum());
+                }
+                else if (sam.type() == "Drer")
+                {
+                    csm->add_generation(sam.sum());
+                }
+                else if (sam.type() == "DESD")
+                {
+                    csm->add_storage(sam.sum());
+                }
+                else if (sam.type() == "Load")
+                {
+                    csm->add_drain(sam.sum());
+                }
+                else if (sam.type() == "Fid")
                 {
-                    Logger.Status << (*it).first.first << "+++" << (*it).first.second << "    "
-                                  << dssm.type() << " : "
-                                  << dssm.signal() << " : "
-                                  << dssm.value() << std::endl;
-                    if (dssm.type() == "SST")
-                    {
-                        if(dssm.count()>0)
-                        {
-                            csm->add_gateway(dssm.value());
-                        }
-                        else
-                        {
-                            csm->clear_gateway();
-                        }
-                    }
-                    else if (dssm.type() == "Drer")
-                    {
-                        if(dssm.count()>0)
-                        {
-                            csm->add_generation(dssm.value());
-                        }
-                        else
-                        {
-                            csm->clear_generation();
-                        }
-                    }
-                    else if (dssm.type() == "DESD")
-                    {
-                        if(dssm.count()>0)
-                        {
-                            csm->add_storage(dssm.value());
-                        }
-                        else
-                        {
-                            csm->clear_storage();
-                        }
-                    }
-                    else if (dssm.type() == "Load")
-                    {
-                        if(dssm.count()>0)
-                        {
-                            csm->add_drain(dssm.value());
-                        }
-                        else
-                        {
-                            csm->clear_drain();
-                        }
-                    }
-                    else if (dssm.type() == "Fid")
-                    {
-                        if(dssm.count()>0)
-                        {
-                            csm->add_state(dssm.value());
-                        }
-                        else
-                        {
-                            csm->clear_state();
-                        }
-                    }
-                    else if (dssm.type() == "Message")
-                    {
-                        csm->set_num_intransit_accepts(csm->num_intransit_accepts() + dssm.value());
-                    }
+                    csm->add_state(sam.sum());
                 }
             }
-        }//end for
+            Release(version);
+        }
 
-        //send collected states to the request module
-        GetMe().Send(PrepareForSending(scm, m_module));
+        //the states leave the bookkeeping, which ends with this call
+        RecordingMap::iterator recorded = collectstate.find(version);
+        for (std::size_t i = 0; recorded != collectstate.end()
+             && i < recorded->second.used; i++)
+        {
+            response->states.push_back(StateMessage());
+            response->states.back().Swap(&recorded->second.states[i]);
+        }
 
-        //clear collectstate
-        collectstate.clear();
-        m_countmarker = 0;
-        m_countstate = 0;
+        //a large group is put together over several runs of the phase
+        if (!ContinueResponse(response))
+        {
+            CBroker::Instance().ScheduleResumable("sc",
+                boost::bind(&SCAgent::ContinueResponse, this, response));
+        }
     }
     else
     {
-        Logger.Notice << "(Initiator) Not receiving all states back. PeerList size is " << m_AllPeers.size()<< std::endl;
+        LOG_NOTICE(Logger) << "(Initiator) Not receiving all states back. PeerList size is " << m_AllPeers.size()<< std::endl;
 
-        if (m_NotifyToSave == true)
+        if (snapshot.recording == true)
         {
-            Logger.Status << m_countmarker << " + " << "TRUE" << std::endl;
+            LOG_STATUS(Logger) << snapshot.markers << " + " << "TRUE" << std::endl;
         }
         else
         {
-            Logger.Status << m_countmarker << " + " << "FALSE" << std::endl;
+            LOG_STATUS(Logger) << snapshot.markers << " + " << "FALSE" << std::endl;
+        }
+    }
+
+    //the snapshot is answered or abandoned
+    EndSnapshot(version);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// ContinueResponse
+/// @description Adds the states of the nodes to a collected state until the
+///     scheduler asks the task to yield, then sends the collected state back
+///     once every state is in.
+/// @pre The response holds the states of an answered snapshot.
+/// @post The states added so far are removed from the response, and it is
+///     sent to the request module if none remain.
+/// @param response the collected state being put together
+/// @return True once the collected state has been sent.
+///////////////////////////////////////////////////////////////////////////////
+bool SCAgent::ContinueResponse(boost::shared_ptr<SResponse> response)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    CollectedStateMessage* csm = response->scm.mutable_collected_state_message();
+    while (response->next < response->states.size())
+    {
+        if (response->next > 0 && CBroker::Instance().ShouldYield())
+        {
+            LOG_DEBUG(Logger) << "Yielded with " << response->states.size() - response->next
+                              << " states left to collect" << std::endl;
+            return false;
+        }
+        StateMessage& state = response->states[response->next++];
+        BOOST_FOREACH(
+            const DeviceSignalStateMessage& dssm, state.device_signal_state_message())
+        {
+            LOG_STATUS(Logger) << response->version.first << "+++" << response->version.second << "    "
+                          << dssm.type() << " : "
+                          << dssm.signal() << " : "
+                          << dssm.value() << std::endl;
+            AddToCollected(*csm, dssm);
+        }
+        state.Clear();
+    }
+
+    //send collected states to the request module
+    if (response->expired)
+    {
+        LOG_NOTICE(Logger) << "Deadline passed with the states of " << csm->reported()
+                           << " of " << csm->expected() << " nodes" << std::endl;
+    }
+    else
+    {
+        SCachedState& cached = m_results[response->devices];
+        cached.state.CopyFrom(*csm);
+        cached.completed = CVirtualClock::Now();
+    }
+    BOOST_FOREACH(const std::string& module, response->shared)
+    {
+        StateCollectionMessage copy(response->scm);
+        GetMe().Send(ShareForSending(copy, module));
+    }
+    GetMe().Send(ShareForSending(response->scm, response->module));
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SendPartial
+/// @description Sends the state of one node to the request module as soon as
+///     it arrives, so the module can start before the snapshot completes.
+///     The final result still follows with complete set.
+/// @pre The snapshot was requested with stream set.
+/// @post A partial collected state is sent to the request module.
+/// @param snapshot the bookkeeping of the snapshot
+/// @param state the state of the node
+///////////////////////////////////////////////////////////////////////////////
+void SCAgent::SendPartial(const SSnapshot& snapshot, const StateMessage& state)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    StateCollectionMessage scm;
+    CollectedStateMessage* csm = scm.mutable_collected_state_message();
+    csm->set_num_intransit_accepts(0);
+    csm->set_source(state.source());
+    csm->set_complete(false);
+
+    BOOST_FOREACH(const DeviceSignalStateMessage& dssm, state.device_signal_state_message())
+    {
+        AddToCollected(*csm, dssm);
+    }
+    GetMe().Send(ShareForSending(scm, snapshot.module));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// ArmDeadline
+/// @description Sets the deadline timer for the earliest deadline of the
+///     snapshots in flight. Setting the timer again cancels the earlier wait.
+/// @pre None
+/// @post The timer is armed if a snapshot has a deadline.
+///////////////////////////////////////////////////////////////////////////////
+void SCAgent::ArmDeadline()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::posix_time::ptime earliest;
+
+    BOOST_FOREACH(const SnapshotMap::value_type& snapshot, m_snapshots)
+    {
+        const boost::posix_time::ptime& deadline = snapshot.second.deadline;
+        if (!deadline.is_not_a_date_time() && (earliest.is_not_a_date_time() || deadline < earliest))
+        {
+            earliest = deadline;
+        }
+    }
+
+    if (earliest.is_not_a_date_time())
+    {
+        return;
+    }
+
+    boost::posix_time::time_duration wait =
+        earliest - CVirtualClock::Now();
+    if (wait.is_negative())
+    {
+        wait = boost::posix_time::milliseconds(0);
+    }
+    CBroker::Instance().Schedule(m_deadlinetimer, wait,
+        boost::bind(&SCAgent::HandleDeadline, this, boost::asio::placeholders::error));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandleDeadline
+/// @description Delivers the snapshots whose deadline has passed with the
+///     states that have arrived, then waits for the next deadline.
+/// @pre The deadline timer expired.
+/// @post The expired snapshots are answered and ended.
+/// @param error the reason the timer expired
+/// @ErrorHandling Throws boost::system::system_error if the timer failed.
+///////////////////////////////////////////////////////////////////////////////
+void SCAgent::HandleDeadline(const boost::system::error_code& error)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if (error == boost::asio::error::operation_aborted)
+    {
+        return;
+    }
+    else if (error)
+    {
+        LOG_ERROR(Logger) << error << std::endl;
+        throw boost::system::system_error(error);
+    }
+
+    boost::posix_time::ptime now = CVirtualClock::Now();
+    std::vector<StateVersion> expired;
+
+    BOOST_FOREACH(const SnapshotMap::value_type& snapshot, m_snapshots)
+    {
+        if (!snapshot.second.deadline.is_not_a_date_time() && snapshot.second.deadline <= now)
+        {
+            expired.push_back(snapshot.first);
         }
+    }
+
+    BOOST_FOREACH(const StateVersion& version, expired)
+    {
+        StateResponse(version, true);
+    }
+    ArmDeadline();
+}
+
+
+///////////////////////////////////////////////////////////////////
+/// AnswerFromCache
+/// @description AnswerFromCache sends a module the last complete state of the
+///     signals it asks for if that state is recent enough. Otherwise, if a
+///     snapshot of the same signals is in flight, the module gets its result
+///     as well, so concurrent requests flood the group with one marker.
+/// @pre The request does not stream the states of the nodes.
+/// @post The module has its answer or shares a snapshot if true is returned.
+/// @param module the module that requested the state
+/// @param devices the signals to collect, as type:signal
+/// @param maxage milliseconds old the collected state may be
+/// @return true if no new snapshot is needed
+//////////////////////////////////////////////////////////////////
+bool SCAgent::AnswerFromCache(const std::string& module,
+    const std::vector<std::string>& devices, int maxage)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<std::vector<std::string>, SCachedState>::iterator cached
+        = m_results.find(devices);
+    if (cached != m_results.end() && CVirtualClock::Now() - cached->second.completed
+        <= boost::posix_time::milliseconds(maxage))
+    {
+        LOG_INFO(Logger) << "Answered " << module << " with a state collected "
+                         << CVirtualClock::Now() - cached->second.completed
+                         << " ago" << std::endl;
+        CachedMetric.Increment();
+        StateCollectionMessage scm;
+        scm.mutable_collected_state_message()->CopyFrom(cached->second.state);
+        GetMe().Send(ShareForSending(scm, module));
+        return true;
+    }
 
-        m_countmarker = 0;
-        m_NotifyToSave = false;
+    BOOST_FOREACH(SnapshotMap::value_type& snapshot, m_snapshots)
+    {
+        if (snapshot.first.first == GetUUID() && !snapshot.second.stream
+            && snapshot.second.devices == devices)
+        {
+            LOG_INFO(Logger) << "Answering " << module << " with the snapshot "
+                             << snapshot.first.second << " in flight" << std::endl;
+            SharedMetric.Increment();
+            snapshot.second.shared.push_back(module);
+            return true;
+        }
     }
+    return false;
 }
 
 
@@ -388,7 +891,7 @@ void SCAgent::TakeSnapshot(const std::vector<std::string>& devicelist)
 {
     //For multidevices state collection
 
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     device::SignalValue PowerValue;
 
     m_curstate.Clear();
@@ -408,8 +911,8 @@ void SCAgent::TakeSnapshot(const std::vector<std::string>& devicelist)
         std::string signal(device.begin() + colon + 1, device.end());
 
         PowerValue = device::CDeviceManager::Instance().GetNetValue(type, signal);
-        Logger.Status << "Device:   "<< type << "  Signal:  "<< signal << " Value:  " << PowerValue << std::endl;
-        count = device::CDeviceManager::Instance().GetDevicesOfType(type).size();
+        LOG_STATUS(Logger) << "Device:   "<< type << "  Signal:  "<< signal << " Value:  " << PowerValue << std::endl;
+        count = device::CDeviceManager::Instance().GetDeviceView(type)->size();
 
 	//save device state
         DeviceSignalStateMessage* dssm = m_curstate.add_device_signal_state_message();
@@ -426,47 +929,105 @@ void SCAgent::TakeSnapshot(const std::vector<std::string>& devicelist)
 /// @description SendStateBack is used by the peer to send collect states back to initiator.
 /// @pre Peer has completed its collecting states in local side.
 /// @post Peer sends its states back to the initiator.
+/// @param version the marker of the snapshot
 /// @limitation Currently, only sending back gateway value and channel transit messages.
 //////////////////////////////////////////////////////////////////
-void SCAgent::SendStateBack()
+void SCAgent::SendStateBack(StateVersion version)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SnapshotMap::iterator snap = m_snapshots.find(version);
+    if (snap == m_snapshots.end())
+    {
+        return;
+    }
+    SSnapshot& snapshot = snap->second;
+
     //Peer send collected states to initiator
     //for each in collectstate, extract ptree as a message then send to initiator
-    Logger.Status << "(Peer)The number of collected states is " << int(collectstate.size()) << std::endl;
+    RecordingMap::const_iterator recorded = collectstate.find(version);
+    std::size_t count = (recorded == collectstate.end() ? 0 : recorded->second.used);
+    LOG_STATUS(Logger) << "(Peer)The number of collected states is "
+                       << count << std::endl;
+
+    if (CGlobalConfiguration::Instance().GetStateAggregate())
+    {
+        AggregateLocal(snapshot, version);
+        ForwardAggregate(version);
+        return;
+    }
 
     StateCollectionMessage scm;
     StateMessage* sm = scm.mutable_state_message();
     sm->set_source(GetUUID());
-    sm->set_marker_uuid(m_curversion.first);
-    sm->set_marker_int(m_curversion.second);
+    sm->set_marker_uuid(version.first);
+    sm->set_marker_int(version.second);
+
+    if (snapshot.base >= 0)
+    {
+        sm->set_base_version(snapshot.base);
+    }
+    else
+    {
+        m_reported.clear();
+    }
+
+    //the position of each signal in the marker, for a packed report
+    std::map<std::string, unsigned int> index;
+    for (unsigned int i = 0; snapshot.packed && i < snapshot.devices.size(); i++)
+    {
+        index.insert(std::make_pair(snapshot.devices[i], i));
+    }
 
     //send collected states to initiator
-    for (it = collectstate.begin(); it != collectstate.end(); it++)
+    for (std::size_t i = 0; i < count; i++)
     {
-        if ((*it).first == m_curversion)
+        BOOST_FOREACH(
+            const DeviceSignalStateMessage& stored, recorded->second.states[i].device_signal_state_message())
         {
-            BOOST_FOREACH(
-                const DeviceSignalStateMessage& stored, it->second.device_signal_state_message())
+            //in-transit messages are not state and are always sent
+            if (stored.type() != "Message")
             {
-                Logger.Status << "item:     " << stored.type() << "   "
-                              << stored.signal() << "    "
-                              <<  stored.value() << std::endl;
+                std::string key = stored.type() + ":" + stored.signal();
+                SignalMap::iterator last = m_reported.find(key);
+
+                if (snapshot.base >= 0 && last != m_reported.end()
+                    && !Changed(last->second, stored))
+                {
+                    continue;
+                }
+                m_reported[key].CopyFrom(stored);
+            }
+
+            LOG_STATUS(Logger) << "item:     " << stored.type() << "   "
+                          << stored.signal() << "    "
+                          <<  stored.value() << std::endl;
 
-                DeviceSignalStateMessage* copy = sm->add_device_signal_state_message();
-                copy->CopyFrom(stored);
+            std::map<std::string, unsigned int>::const_iterator position
+                = index.find(stored.type() + ":" + stored.signal());
+            if (position != index.end())
+            {
+                sm->add_signal_index(position->second);
+                sm->add_signal_value(stored.value());
+                sm->add_signal_count(stored.count());
+                continue;
             }
+
+            DeviceSignalStateMessage* copy = sm->add_device_signal_state_message();
+            copy->CopyFrom(stored);
         }
     }//end for
+    m_reportedversion = version;
 
     try
     {
-        GetPeer(m_curversion.first).Send(PrepareForSending(scm));
+        GetPeer(version.first).Send(ShareForSending(scm));
     }
     catch(EDgiNoSuchPeerError)
     {
-        Logger.Info << "Peer '"<<m_curversion.first<<"' doesn't exist" << std::endl;
+        LOG_INFO(Logger) << "Peer '"<<version.first<<"' doesn't exist" << std::endl;
     }
+    EndSnapshot(version);
 }
 
 
@@ -480,21 +1041,44 @@ void SCAgent::SendStateBack()
 //////////////////////////////////////////////////////////////////
 void SCAgent::SaveForward(StateVersion latest, const MarkerMessage& msg)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    collectstate.clear();
-    //assign latest marker version to current version
-    m_curversion = latest;
-    //count unique marker
-    m_countmarker = 1;
-    Logger.Info << "Marker is " << m_curversion.first << " " << m_curversion.second << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    //parse the device information from msg to a vector
+    std::vector<std::string> devices;
+    BOOST_FOREACH(std::string device, msg.device())
+    {
+        devices.push_back(device);
+        LOG_NOTICE(Logger) << "Needed device: " << device << std::endl;
+    }
+
+    SSnapshot& snapshot = StartSnapshot(latest, devices);
+    snapshot.packed = msg.packed();
+    LOG_INFO(Logger) << "Marker is " << latest.first << " " << latest.second << std::endl;
     //physical device information
-    Logger.Debug << "SC module identified "<< device::CDeviceManager::Instance().DeviceCount()
+    LOG_DEBUG(Logger) << "SC module identified "<< device::CDeviceManager::Instance().DeviceCount()
     << " physical devices on this node" << std::endl;
     //collect local state
-    TakeSnapshot(m_device);
-    //save state into the multimap "collectstate"
-    collectstate.insert(std::make_pair(m_curversion, m_curstate));
-    m_countstate++;
+    TakeSnapshot(devices);
+    //save state into the recording of the snapshot
+    Record(latest, m_curstate);
+
+    if (CGlobalConfiguration::Instance().GetStateAggregate())
+    {
+        StartAggregate(snapshot, latest);
+    }
+
+    //send changes only if the initiator holds the last state this node sent
+    if (CGlobalConfiguration::Instance().GetStateDelta()
+        && m_reportedversion.first == latest.first)
+    {
+        BOOST_FOREACH(const StateAckMessage& sam, msg.acknowledged())
+        {
+            if (sam.source() == GetUUID() && sam.version() == m_reportedversion.second)
+            {
+                snapshot.base = sam.version();
+            }
+        }
+    }
 
     StateCollectionMessage scm;
     MarkerMessage* mm = scm.mutable_marker_message();
@@ -503,57 +1087,381 @@ void SCAgent::SaveForward(StateVersion latest, const MarkerMessage& msg)
     if (m_AllPeers.size()==2)
     //only two nodes, peer finish collecting states: send marker then state back
     {
-        GetPeer(m_curversion.first).Send(PrepareForSending(scm));
+        GetPeer(latest.first).Send(PrepareForSending(scm));
         //send collected states to initiator
-        SendStateBack();
-        m_curversion.first = "default";
-        m_curversion.second = 0;
-        m_countmarker = 0;
-        collectstate.clear();
+        SendStateBack(latest);
     }
     else
     //more than two nodes
     {
         //broadcast marker to all other peers
+        CSerializedMessage::Pointer marker(new CSerializedMessage(ShareForSending(scm)));
         BOOST_FOREACH(CPeerNode peer, m_AllPeers | boost::adaptors::map_values)
         {
             if (peer.GetUUID()!= GetUUID())
             {
-                Logger.Info << "Forward marker to " << peer.GetUUID() << std::endl;
-                peer.Send(PrepareForSending(scm));
+                LOG_INFO(Logger) << "Forward marker to " << peer.GetUUID() << std::endl;
+                peer.Send(marker);
             }
         }//end foreach
         //set flag to start to record messages in channel
-        m_NotifyToSave = true;
+        snapshot.recording = true;
     }
 }
 
-///////////////////////////////////////////////////////////////////////////////
-/// This function will be called to handle Accept messages from LoadBalancing.
-/// Normally, state collection can safely ignore these messages, but if they
-/// arrive during state collection's own phase, then there is a problem and
-/// they need to be added to the collected state.
-///
-/// @param peer the DGI that sent the message
-///////////////////////////////////////////////////////////////////////////////
-void SCAgent::HandleAccept(CPeerNode peer)
+///////////////////////////////////////////////////////////////////
+/// PatchState
+/// @description PatchState keeps the last state of each peer at the initiator.
+///     A full state replaces the cached one. A delta state updates the cached
+///     signals it carries, and m_curstate is rebuilt from the cache so the
+///     collected state always holds every requested signal of the peer.
+/// @pre m_curstate holds the received state message.
+/// @post The cache of the sender is updated.
+/// @param msg the received state message
+/// @param devices the signals the snapshot collects
+/// @return false if msg is a delta of a state the initiator does not hold
+//////////////////////////////////////////////////////////////////
+bool SCAgent::PatchState(const StateMessage& msg,
+    const std::vector<std::string>& devices)
 {
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if (!CGlobalConfiguration::Instance().GetStateDelta() && !msg.has_base_version())
+    {
+        return true;
+    }
+
+    std::map<std::string, int>::iterator version = m_cacheversion.find(msg.source());
+
+    if (msg.has_base_version())
+    {
+        if (version == m_cacheversion.end() || version->second != msg.base_version())
+        {
+            LOG_WARN(Logger) << "Dropped a state of " << msg.source()
+                             << " based on an unknown version " << msg.base_version() << std::endl;
+            m_cache.erase(msg.source());
+            m_cacheversion.erase(msg.source());
+            return false;
+        }
+    }
+    else
+    {
+        m_cache.erase(msg.source());
+    }
+
+    SignalMap& cached = m_cache[msg.source()];
+    m_cacheversion[msg.source()] = msg.marker_int();
+
+    if (!msg.has_base_version())
+    {
+        BOOST_FOREACH(const DeviceSignalStateMessage& dssm, msg.device_signal_state_message())
+        {
+            if (dssm.type() != "Message")
+            {
+                cached[dssm.type() + ":" + dssm.signal()].CopyFrom(dssm);
+            }
+        }
+        return true;
+    }
+
+    m_curstate.clear_device_signal_state_message();
+    BOOST_FOREACH(const DeviceSignalStateMessage& dssm, msg.device_signal_state_message())
+    {
+        if (dssm.type() == "Message")
+        {
+            m_curstate.add_device_signal_state_message()->CopyFrom(dssm);
+        }
+        else
+        {
+            cached[dssm.type() + ":" + dssm.signal()].CopyFrom(dssm);
+        }
+    }
+    LOG_DEBUG(Logger) << "Patched " << msg.device_signal_state_message_size()
+                      << " signals of " << msg.source() << std::endl;
+
+    BOOST_FOREACH(const std::string& device, devices)
+    {
+        SignalMap::const_iterator signal = cached.find(device);
+
+        if (signal != cached.end())
+        {
+            m_curstate.add_device_signal_state_message()->CopyFrom(signal->second);
+        }
+    }
+    return true;
+}
+
+
+///////////////////////////////////////////////////////////////////
+/// UnpackState
+/// @description UnpackState turns the signals a peer reported by their index
+///     in the device list of the marker back into named signals.
+/// @pre msg answers a packed marker of the initiator with these devices.
+/// @post state holds msg with every packed signal as a named one.
+/// @param msg the received state message
+/// @param devices the signals the snapshot collects, as type:signal
+/// @param state set to the unpacked state message
+//////////////////////////////////////////////////////////////////
+void SCAgent::UnpackState(const StateMessage& msg,
+    const std::vector<std::string>& devices, StateMessage& state)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    state.CopyFrom(msg);
+    state.clear_signal_index();
+    state.clear_signal_value();
+    state.clear_signal_count();
+
+    int signals = std::min(msg.signal_index_size(),
+        std::min(msg.signal_value_size(), msg.signal_count_size()));
+    for (int i = 0; i < signals; i++)
+    {
+        unsigned int position = msg.signal_index(i);
+        size_t colon = position < devices.size()
+            ? devices[position].find(':') : std::string::npos;
+
+        if (colon == std::string::npos)
+        {
+            LOG_WARN(Logger) << "Dropped signal " << position << " of "
+                             << msg.source() << ", it is not in the marker" << std::endl;
+            continue;
+        }
+
+        DeviceSignalStateMessage* dssm = state.add_device_signal_state_message();
+        dssm->set_type(devices[position].substr(0, colon));
+        dssm->set_signal(devices[position].substr(colon + 1));
+        dssm->set_value(msg.signal_value(i));
+        dssm->set_count(msg.signal_count(i));
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////
+/// Changed
+/// @description Compares a signal with the value last reported for it.
+/// @param reported the signal as it was last sent to the initiator
+/// @param current the signal as it is now
+/// @return true if the device count changed or the value moved by more than
+///     the configured deadband
+//////////////////////////////////////////////////////////////////
+bool SCAgent::Changed(const DeviceSignalStateMessage& reported,
+    const DeviceSignalStateMessage& current)
+{
+    float deadband = CGlobalConfiguration::Instance().GetStateDeadband();
+
+    return reported.count() != current.count()
+        || std::fabs(reported.value() - current.value()) > deadband;
+}
+
+///////////////////////////////////////////////////////////////////
+/// AggregateTree
+/// @description Orders the members for the aggregation tree. The root comes
+///     first and the others follow by UUID, so every member that has the
+///     same peer list builds the same tree. The parent of the member at
+///     position i is the member at position (i-1)/AGGREGATE_FANOUT.
+/// @param root the node the aggregate is sent to
+/// @return the UUIDs of m_AllPeers in tree order
+//////////////////////////////////////////////////////////////////
+std::vector<std::string> SCAgent::AggregateTree(const std::string& root) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::vector<std::string> order;
+    order.push_back(root);
+    BOOST_FOREACH(const std::string& uuid, m_AllPeers | boost::adaptors::map_keys)
+    {
+        if (uuid != root)
+        {
+            order.push_back(uuid);
+        }
+    }
+    return order;
+}
+
+///////////////////////////////////////////////////////////////////
+/// StartAggregate
+/// @description Finds the place of this node in the aggregation tree of a
+///     marker and clears the aggregate.
+/// @pre m_AllPeers holds the current group.
+/// @post The parent and pending children of the snapshot are set.
+/// @param snapshot the bookkeeping of the snapshot
+/// @param version the marker the states are collected for
+//////////////////////////////////////////////////////////////////
+void SCAgent::StartAggregate(SSnapshot& snapshot, StateVersion version)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::vector<std::string> order = AggregateTree(version.first);
+    std::size_t self = std::find(order.begin(), order.end(), GetUUID()) - order.begin();
+    std::size_t first = self * AGGREGATE_FANOUT + 1;
+
+    snapshot.parent = self > 0 ? order[(self - 1) / AGGREGATE_FANOUT] : "";
+    snapshot.pending = first < order.size()
+        ? std::min<std::size_t>(AGGREGATE_FANOUT, order.size() - first) : 0;
+    snapshot.local = false;
+
+    snapshot.aggregate.Clear();
+    snapshot.aggregate.set_marker_uuid(version.first);
+    snapshot.aggregate.set_marker_int(version.second);
+    snapshot.aggregate.set_num_intransit_accepts(0);
+    snapshot.aggregate.set_members(0);
+
+    LOG_DEBUG(Logger) << "Aggregating to '" << snapshot.parent << "' from "
+                      << snapshot.pending << " children" << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////
+/// AggregateLocal
+/// @description Adds the local state and the in-transit messages recorded
+///     for a marker to its aggregate.
+/// @pre The node has received the markers from all its peers.
+/// @post The local state is counted in the aggregate once.
+/// @param snapshot the bookkeeping of the snapshot
+/// @param version the marker the states are collected for
+//////////////////////////////////////////////////////////////////
+void SCAgent::AggregateLocal(SSnapshot& snapshot, StateVersion version)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if (snapshot.local)
+    {
+        return;
+    }
+
+    RecordingMap::const_iterator recorded = collectstate.find(version);
+    for (std::size_t i = 0; recorded != collectstate.end()
+         && i < recorded->second.used; i++)
+    {
+        BOOST_FOREACH(
+            const DeviceSignalStateMessage& dssm, recorded->second.states[i].device_signal_state_message())
+        {
+            if (dssm.type() == "Message")
+            {
+                snapshot.aggregate.set_num_intransit_accepts(
+                    snapshot.aggregate.num_intransit_accepts() + dssm.value());
+                continue;
+            }
+
+            SignalAggregateMessage part;
+            part.set_type(dssm.type());
+            part.set_signal(dssm.signal());
+            part.set_sum(dssm.value());
+            part.set_min(dssm.value());
+            part.set_max(dssm.value());
+            part.set_count(dssm.count());
+            part.set_nodes(dssm.count() > 0 ? 1 : 0);
+            MergeAggregate(snapshot.aggregate, part);
+        }
+    }
+    snapshot.aggregate.set_members(snapshot.aggregate.members() + 1);
+    snapshot.local = true;
+}
+
+///////////////////////////////////////////////////////////////////
+/// ForwardAggregate
+/// @description Sends the aggregate to the parent once the local state and
+///     every child are in. The root answers the request instead.
+/// @pre None
+/// @post The aggregate is sent and the snapshot ends, or nothing happens.
+/// @param version the marker the states are collected for
+//////////////////////////////////////////////////////////////////
+void SCAgent::ForwardAggregate(StateVersion version)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    SnapshotMap::iterator snap = m_snapshots.find(version);
+    if (snap == m_snapshots.end() || snap->second.pending > 0)
+    {
+        return;
+    }
+
+    if (snap->second.parent.empty())
+    {
+        StateResponse(version);
+        return;
+    }
+
+    if (!snap->second.local)
+    {
+        return;
+    }
+
+    StateCollectionMessage scm;
+    scm.mutable_aggregate_state_message()->CopyFrom(snap->second.aggregate);
+
+    try
+    {
+        GetPeer(snap->second.parent).Send(ShareForSending(scm));
+    }
+    catch(EDgiNoSuchPeerError)
+    {
+        LOG_INFO(Logger) << "Peer '" << snap->second.parent << "' doesn't exist" << std::endl;
+    }
+    EndSnapshot(version);
+}
+
+///////////////////////////////////////////////////////////////////
+/// SCAgent::HandleAggregate
+/// @description This function will be called to handle the aggregate of a
+///     subtree sent by a child in the aggregation tree.
+/// @key sc.aggregate
+/// @pre Messages are obtained.
+/// @post The aggregate is combined and forwarded once the subtree is in.
+/// @peers Invoked by dispatcher, other SC
+/// @param msg the received message
+/// @param peer the node
+//////////////////////////////////////////////////////////////////
+void SCAgent::HandleAggregate(const AggregateStateMessage& msg, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(CountInPeerSet(m_AllPeers,peer) == 0)
         return;
-    if (m_NotifyToSave == true)
+
+    StateVersion version(msg.marker_uuid(), msg.marker_int());
+    SnapshotMap::iterator snap = m_snapshots.find(version);
+
+    if (snap == m_snapshots.end() || snap->second.pending == 0)
     {
-        Logger.Warn << "Received intransit accept message" << std::endl;
+        LOG_INFO(Logger) << "Dropped an aggregate of " << msg.marker_uuid() << " + "
+                         << msg.marker_int() << " from " << peer.GetUUID() << std::endl;
+        return;
+    }
 
-        // FIXME yes, the accept message is a device! you bet!
-        m_curstate.Clear();
-        DeviceSignalStateMessage* dssm = m_curstate.add_device_signal_state_message();
-        dssm->set_type("Message");
-        dssm->set_signal("inchannel");
-        dssm->set_value(1);
-        dssm->set_count(1);
+    LOG_NOTICE(Logger) << "Receive aggregate of " << msg.members() << " nodes from "
+                       << peer.GetUUID() << std::endl;
+    AggregateStateMessage& total = snap->second.aggregate;
+    BOOST_FOREACH(const SignalAggregateMessage& sam, msg.aggregate())
+    {
+        MergeAggregate(total, sam);
+    }
+    total.set_num_intransit_accepts(total.num_intransit_accepts() + msg.num_intransit_accepts());
+    total.set_members(total.members() + msg.members());
+    snap->second.pending--;
+
+    ForwardAggregate(version);
+}
 
-        collectstate.insert(std::make_pair(m_curversion, m_curstate));
-        m_countstate++;
+///////////////////////////////////////////////////////////////////////////////
+/// This function will be called to handle Accept messages from LoadBalancing.
+/// Normally, state collection can safely ignore these messages, but if they
+/// arrive during state collection's own phase, then there is a problem and
+/// they need to be added to the collected state. The message is counted in
+/// every snapshot that is still recording its channels.
+///
+/// @param peer the DGI that sent the message
+///////////////////////////////////////////////////////////////////////////////
+void SCAgent::HandleAccept(CPeerNode peer)
+{
+    if(CountInPeerSet(m_AllPeers,peer) == 0)
+        return;
+
+    BOOST_FOREACH(SnapshotMap::value_type& snapshot, m_snapshots)
+    {
+        if (snapshot.second.recording == true)
+        {
+            LOG_WARN(Logger) << "Received intransit accept message" << std::endl;
+            RecordChannel(snapshot.first);
+        }
     }
 }
 
@@ -562,50 +1470,69 @@ void SCAgent::HandleAccept(CPeerNode peer)
 /// @description This function will be called to handle PeerList message.
 /// @key any.PeerList
 /// @pre Messages are obtained.
-/// @post parsing messages, reset to default state if receiving PeerList from different leader.
+/// @post parsing messages, abandon the snapshots in flight if the leader or
+///     the members changed.
 /// @peers Invoked by dispatcher, other SC
 /// @param msg the received message
 /// @param peer the node
 //////////////////////////////////////////////////////////////////
 void SCAgent::HandlePeerList(const gm::PeerListMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    std::string line_ = peer.GetUUID();
-    m_scleader = peer.GetUUID();
-    Logger.Info << "Peer List received from Group Leader: " << peer.GetUUID() <<std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_INFO(Logger) << "Peer List received from Group Leader: " << peer.GetUUID() <<std::endl;
     // Process the peer list.
-    m_AllPeers = gm::GMAgent::ProcessPeerList(msg);
-
-    //if only one node left
-    if (m_AllPeers.size()==1)
+    gm::MembershipSnapshot next =
+        gm::GMAgent::UpdateMembership(m_membership, msg, peer.GetUUID());
+    if(!next)
     {
-        m_NotifyToSave = false;
+        peer.Send(gm::GMAgent::PeerListQuery("sc"));
+        return;
     }
+    bool newleader = (m_scleader != peer.GetUUID());
+    m_scleader = peer.GetUUID();
+    PeerSet before = m_AllPeers;
+    if(gm::GMAgent::IsDeltaOf(next, m_membership))
+    {
+        BOOST_FOREACH(const std::string& uuid, next->removed)
+        {
+            m_AllPeers.erase(uuid);
+        }
+        BOOST_FOREACH(CPeerNode p, next->added | boost::adaptors::map_values)
+        {
+            InsertInPeerSet(m_AllPeers, p);
+        }
+    }
+    else
+    {
+        m_AllPeers = next->peers;
+    }
+    m_membership = next;
 
-    if (line_ == GetUUID() && line_  == m_curversion.first)
-        //initiator doesn't change
+    //the marker counts of a snapshot only hold for the members it started with
+    bool changed = (before.size() != m_AllPeers.size());
+    PeerSet::const_iterator old = before.begin();
+    PeerSet::const_iterator now = m_AllPeers.begin();
+    for (; !changed && old != before.end(); old++, now++)
     {
-        Logger.Info << "Keep going!" << std::endl;
+        changed = (old->first != now->first);
     }
-    else if (line_ == GetUUID() && line_ != m_curversion.first)
-        //group leader is changed to a new one
+
+    if (newleader || changed)
     {
-        m_curversion.first = "default";
-        m_curversion.second = 0;
-        collectstate.clear();
-        m_NotifyToSave = false;
-        m_countstate = 0;
-        m_countmarker = 0;
-        m_countdone = 0;
+        if (!m_snapshots.empty())
+        {
+            LOG_NOTICE(Logger) << "Group changed, abandoned " << m_snapshots.size()
+                               << " snapshots" << std::endl;
+        }
+        m_snapshots.clear();
+        ReleaseAll();
+        m_results.clear();
     }
-    else
+    if (newleader)
     {
-        m_curversion.first = "default";
-        m_curversion.second = 0;
-        collectstate.clear();
-        m_NotifyToSave = false;
-        m_countstate = 0;
-        m_countmarker = 0;
+        m_latest.clear();
+        m_cache.clear();
+        m_cacheversion.clear();
     }
     return;
 }
@@ -621,43 +1548,42 @@ void SCAgent::HandlePeerList(const gm::PeerListMessage& msg, CPeerNode peer)
 //////////////////////////////////////////////////////////////////
 void SCAgent::HandleRequest(const RequestMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     //For multidevices state collection
-    //clear m_device
-    m_device.clear();
+    std::vector<std::string> devices;
 
     if(CountInPeerSet(m_AllPeers,peer) == 0)
         return;
 
     //extract module that made request
-    m_module = msg.module();
+    std::string module = msg.module();
 
     //extract type and value of devices and insert into lists
-    //m_deviceType.insert
-    //m_valueType.insert
     BOOST_FOREACH(const DeviceSignalRequestMessage& dsrm, msg.device_signal_request_message())
     {
         std::string deviceType = dsrm.type();
         std::string valueType = dsrm.signal();
         std::string combine = deviceType + ":" + valueType;
-        m_device.push_back(combine);
-        Logger.Status<<"Device Item:  .." << combine << std::endl;
+        devices.push_back(combine);
+        LOG_STATUS(Logger)<<"Device Item:  .." << combine << std::endl;
     }
 
     //call initiate to start state collection
-    Logger.Notice << "Receiving state collect request from " << m_module << " ( "
+    LOG_NOTICE(Logger) << "Receiving state collect request from " << module << " ( "
                   << peer.GetUUID() << " )" << std::endl;
 
     //Put the initiate call into the back of queue
-    CBroker::Instance().Schedule("sc",boost::bind(&SCAgent::Initiate, this),true);
-    //Initiate();
+    CBroker::Instance().Schedule("sc", boost::bind(&SCAgent::Initiate, this,
+        module, devices, msg.stream(), msg.deadline_ms(), msg.max_age_ms()), true);
 }
 
 
 ///////////////////////////////////////////////////////////////////
 /// SCAgent::HandleMarker
 /// @description This function will be called to handle marker message.
+///     Each marker version is tracked on its own, so markers of several
+///     snapshots can be handled at once.
 /// @key sc.marker
 /// @pre Messages are obtained.
 /// @post parsing marker messages based on different conditions.
@@ -667,94 +1593,68 @@ void SCAgent::HandleRequest(const RequestMessage& msg, CPeerNode peer)
 //////////////////////////////////////////////////////////////////
 void SCAgent::HandleMarker(const MarkerMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(CountInPeerSet(m_AllPeers,peer) == 0)
         return;
-    StateVersion incomingVer_;
     // marker value is present
-    Logger.Info << "Received message is a marker!" << std::endl;
+    LOG_INFO(Logger) << "Received message is a marker!" << std::endl;
     // read the incoming version from marker
-    incomingVer_.first = msg.source();
-    incomingVer_.second = msg.id();
-    m_device.clear();
+    StateVersion incomingVer_(msg.source(), msg.id());
+    SnapshotMap::iterator snap = m_snapshots.find(incomingVer_);
 
-    //parse the device information from msg to a vector
-    BOOST_FOREACH(std::string device, msg.device())
-	{
-        //save power level for each node into a vector
-        m_device.push_back(device);
-	    Logger.Notice << "Needed device: " << device << std::endl;
-	}
-
-    if (m_curversion.first == "default")
-        //peer receives first marker
-    {
-        Logger.Status << "------------------------first maker with default state ----------------" << std::endl;
-        SaveForward(incomingVer_, msg);
-    }//first receive marker
-    else if (m_curversion == incomingVer_ && m_curversion.first == GetUUID())
-        //initiator receives his marker before
+    if (snap == m_snapshots.end())
+        //first marker of a snapshot
     {
-        Logger.Status << "------------------------Initiator receives his marker------------------" << std::endl;
-        //number of marker is increased by 1
-        m_countmarker++;
+        std::map<std::string, int>::iterator latest = m_latest.find(incomingVer_.first);
+        unsigned int capacity = CGlobalConfiguration::Instance().GetStateSnapshots();
 
-        if (m_countmarker == m_AllPeers.size())
-            //Initiator done! set flag to false not record channel message
+        if (latest != m_latest.end() && incomingVer_.second <= latest->second)
         {
-            m_NotifyToSave=false;
+            LOG_STATUS(Logger) << "Incoming marker " << incomingVer_.first << " + "
+                               << incomingVer_.second << " is finished or abandoned, ignore" << std::endl;
         }
+        else if (m_snapshots.size() >= capacity && incomingVer_.first != m_scleader)
+        {
+            LOG_STATUS(Logger) << "Incoming marker is from another peer and no snapshot can be started, ignore" << std::endl;
+        }
+        else
+        {
+            LOG_STATUS(Logger) << "------------------------first marker of " << incomingVer_.first
+                               << " + " << incomingVer_.second << "----------------" << std::endl;
+            SaveForward(incomingVer_, msg);
+        }
+        return;
     }
-    else if (m_curversion == incomingVer_ && m_curversion.first != GetUUID())
-        //peer receives this marker before
+
+    SSnapshot& snapshot = snap->second;
+    //number of marker is increased by 1
+    snapshot.markers++;
+
+    if (incomingVer_.first == GetUUID())
+        //initiator receives his marker before
     {
-        Logger.Status << "------------------------Peer receives marker before--------------------" << std::endl;
-        //number of marker is increased by 1
-        m_countmarker++;
+        LOG_STATUS(Logger) << "------------------------Initiator receives his marker------------------" << std::endl;
 
-        if (m_countmarker == m_AllPeers.size()-1)
+        if (snapshot.markers == m_AllPeers.size())
+            //Initiator done! set flag to false not record channel message
         {
-            //peer done! set flag to false not record channel message
-            m_NotifyToSave=false;
-            //send collected states to initiator
-            SendStateBack();
-            m_curversion.first = "default";
-            m_curversion.second = 0;
-            m_countmarker = 0;
-            collectstate.clear();
+            snapshot.recording = false;
         }
     }
-    else if (incomingVer_ != m_curversion && m_curversion.first != "default")
-        //receive a new marker from other peer
+    else
+        //peer receives this marker before
     {
-        //Logger.Status << "===================================================" << std::endl;
-        Logger.Status << "-----Receive a new marker different from current one.-------" << std::endl;
-        Logger.Status << "Current version is " << m_curversion.first << " + " << m_curversion.second << std::endl;
-        Logger.Status << "Incoming version is " << incomingVer_.first << " + " << incomingVer_.second << std::endl;
+        LOG_STATUS(Logger) << "------------------------Peer receives marker before--------------------" << std::endl;
 
-        //assign incoming version to current version if the incoming is newer
-        if (m_curversion.first == incomingVer_.first && incomingVer_.second > m_curversion.second)
+        if (snapshot.markers == m_AllPeers.size()-1)
         {
-            Logger.Status << "Incoming marker is newer from same node, follow the newer" << std::endl;
-            SaveForward(incomingVer_, msg);
-        }
-        //assign incoming version to current version if the incoming is from leader
-        else if (GetUUID() != m_scleader && incomingVer_.first == m_scleader && incomingVer_.second >  m_curversion.second)
-        {
-            Logger.Status << "Incoming marker is from leader and newer, follow the newer" << std::endl;
-            SaveForward(incomingVer_, msg);
-        }
-        else if (incomingVer_.first == m_scleader && m_curversion.first != incomingVer_.first)
-        {
-            Logger.Status << "Incoming marker is from leader, follow the leader" << std::endl;
-            SaveForward(incomingVer_, msg);
-        }
-        else
-        {
-            Logger.Status << "Incoming marker is from another peer, or index is smaller, ignore" << std::endl;
+            //peer done! set flag to false not record channel message
+            snapshot.recording = false;
+            //send collected states to initiator
+            SendStateBack(incomingVer_);
         }
     }
- }
+}
 
 
 ///////////////////////////////////////////////////////////////////
@@ -769,26 +1669,47 @@ void SCAgent::HandleMarker(const MarkerMessage& msg, CPeerNode peer)
 //////////////////////////////////////////////////////////////////
 void SCAgent::HandleState(const StateMessage& msg, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     if(CountInPeerSet(m_AllPeers,peer) == 0)
         return;
 
-    if (m_curversion.first==msg.marker_uuid() && m_curversion.second==msg.marker_int())
+    StateVersion version(msg.marker_uuid(), msg.marker_int());
+    SnapshotMap::iterator snap = m_snapshots.find(version);
+
+    if (snap == m_snapshots.end() || version.first != GetUUID())
+    {
+        LOG_INFO(Logger) << "Dropped a state of " << msg.source() << " for snapshot "
+                         << version.first << " + " << version.second << std::endl;
+        return;
+    }
+
+    snap->second.states++;
+    LOG_NOTICE(Logger) << "Receive collected state from peer " << msg.source() << std::endl;
+
+    //the rest of the module only reads signals by name
+    StateMessage unpacked;
+    const StateMessage* state = &msg;
+    if (msg.signal_index_size() > 0)
     {
-        m_countdone++;
-        Logger.Notice << "Receive collected state from peer " << msg.source() << std::endl;
-        m_curstate.CopyFrom(msg);
+        UnpackState(msg, snap->second.devices, unpacked);
+        state = &unpacked;
+    }
+    m_curstate.CopyFrom(*state);
 
-        //save state into the map "collectstate"
-        collectstate.insert(std::make_pair( m_curversion, m_curstate));
-        m_countstate++;
+    //save state into the recording of the snapshot
+    if (PatchState(*state, snap->second.devices))
+    {
+        Record(version, m_curstate);
+        if (snap->second.stream)
+        {
+            SendPartial(snap->second, m_curstate);
+        }
     }
 
     //if "done" is received from all peers
-    if (m_countdone == m_AllPeers.size()-1)
+    if (snap->second.states == m_AllPeers.size()-1)
     {
-        StateResponse();
-        m_countdone = 0;
+        StateResponse(version);
     }
 }
 
@@ -805,7 +1726,7 @@ void SCAgent::HandleState(const StateMessage& msg, CPeerNode peer)
 /////////////////////////////////////////////////////////
 CPeerNode SCAgent::AddPeer(CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     InsertInPeerSet(m_AllPeers,peer);
     return peer;
 }
@@ -821,7 +1742,7 @@ CPeerNode SCAgent::AddPeer(CPeerNode peer)
 /////////////////////////////////////////////////////////
 CPeerNode SCAgent::GetPeer(std::string uuid)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     PeerSet::iterator it = m_AllPeers.find(uuid);
 
     if (it != m_AllPeers.end())
@@ -834,6 +1755,156 @@ CPeerNode SCAgent::GetPeer(std::string uuid)
     }
 }
 
+////////////////////////////////////////////////////////////
+/// Record
+/// @description Copies a state into the recording of a snapshot. The
+///               recording reuses the cleared states of a released one, so
+///               the memory of a state is allocated once for many snapshots.
+/// @pre None
+/// @post The state is recorded, unless every recording together would hold
+///       more than the sc-record-limit, in which case it is counted as an
+///       overflow and left out of the snapshot.
+/// @param version the marker of the snapshot
+/// @param state the state to record
+/// @return true if the state was recorded
+/////////////////////////////////////////////////////////
+bool SCAgent::Record(StateVersion version, const StateMessage& state)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::size_t space = state.SpaceUsed();
+    std::size_t limit = CGlobalConfiguration::Instance().GetStateRecordLimit() * 1024;
+    if (limit > 0 && m_recordedbytes + space > limit)
+    {
+        LOG_WARN(Logger) << "Left a state out of snapshot " << version.first << " + "
+                         << version.second << ": recordings hold "
+                         << m_recordedbytes << " bytes" << std::endl;
+        OverflowMetric.Increment();
+        return false;
+    }
+
+    RecordingMap::iterator recorded = collectstate.find(version);
+    if (recorded == collectstate.end())
+    {
+        recorded = collectstate.insert(std::make_pair(version, SRecording())).first;
+        if (!m_pool.empty())
+        {
+            recorded->second.states.swap(m_pool.back());
+            m_pool.pop_back();
+        }
+    }
+    SRecording& recording = recorded->second;
+    if (recording.used == recording.states.size())
+    {
+        recording.states.push_back(StateMessage());
+    }
+    recording.states[recording.used++].CopyFrom(state);
+    recording.bytes += space;
+    m_recordedbytes += space;
+    m_recordedstates++;
+    NoteCollectedStates();
+    return true;
+}
+
+////////////////////////////////////////////////////////////
+/// RecordChannel
+/// @description Counts a message that was in a channel when a snapshot
+///               recorded it. The messages of a snapshot are counted in one
+///               state, so a slow marker does not grow the recording.
+/// @pre The snapshot is recording its channels.
+/// @post The channel state of the snapshot counts one more message.
+/// @param version the marker of the snapshot
+/////////////////////////////////////////////////////////
+void SCAgent::RecordChannel(StateVersion version)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    RecordingMap::iterator recorded = collectstate.find(version);
+    if (recorded != collectstate.end() && recorded->second.channel >= 0)
+    {
+        DeviceSignalStateMessage* dssm = recorded->second.states[
+            recorded->second.channel].mutable_device_signal_state_message(0);
+        dssm->set_value(dssm->value() + 1);
+        dssm->set_count(dssm->count() + 1);
+        return;
+    }
+
+    // FIXME yes, the accept message is a device! you bet!
+    m_curstate.Clear();
+    DeviceSignalStateMessage* dssm = m_curstate.add_device_signal_state_message();
+    dssm->set_type("Message");
+    dssm->set_signal("inchannel");
+    dssm->set_value(1);
+    dssm->set_count(1);
+
+    if (Record(version, m_curstate))
+    {
+        SRecording& recording = collectstate[version];
+        recording.channel = recording.used - 1;
+    }
+}
+
+////////////////////////////////////////////////////////////
+/// Release
+/// @description Frees the states recorded for a snapshot all at once. The
+///               cleared states go back to the pool for a later snapshot.
+/// @pre None
+/// @post The snapshot has no recording.
+/// @param version the marker of the snapshot
+/////////////////////////////////////////////////////////
+void SCAgent::Release(StateVersion version)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    RecordingMap::iterator recorded = collectstate.find(version);
+    if (recorded == collectstate.end())
+    {
+        return;
+    }
+    SRecording& recording = recorded->second;
+    m_recordedbytes -= recording.bytes;
+    m_recordedstates -= recording.used;
+    if (m_pool.size() < RECORDING_POOL)
+    {
+        for (std::size_t i = 0; i < recording.used; i++)
+        {
+            recording.states[i].Clear();
+        }
+        m_pool.push_back(std::vector<StateMessage>());
+        m_pool.back().swap(recording.states);
+    }
+    collectstate.erase(recorded);
+    NoteCollectedStates();
+}
+
+////////////////////////////////////////////////////////////
+/// ReleaseAll
+/// @description Frees the states recorded for every snapshot.
+/// @pre None
+/// @post No snapshot has a recording.
+/////////////////////////////////////////////////////////
+void SCAgent::ReleaseAll()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    while (!collectstate.empty())
+    {
+        Release(collectstate.begin()->first);
+    }
+}
+
+////////////////////////////////////////////////////////////
+/// NoteCollectedStates
+/// @description Reports the number of collected states and the memory they
+///               use to the metrics.
+/// @pre collectstate has just changed
+/// @post The sc collectstate container metrics match collectstate
+/////////////////////////////////////////////////////////
+void SCAgent::NoteCollectedStates()
+{
+    m_collectmemory.Update(m_recordedstates, m_recordedbytes);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Wraps a StateCollectionMessage in a ModuleMessage.
 ///
@@ -847,13 +1918,35 @@ CPeerNode SCAgent::GetPeer(std::string uuid)
 ModuleMessage SCAgent::PrepareForSending(
     const StateCollectionMessage& message, std::string recipient)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     ModuleMessage mm;
     mm.mutable_state_collection_message()->CopyFrom(message);
     mm.set_recipient_module(recipient);
     return mm;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Moves a StateCollectionMessage into a shared ModuleMessage. Unlike
+/// PrepareForSending the message is not copied, which matters for collected
+/// states, and the shared message is delivered to this node as it is.
+///
+/// @param message the message to prepare, which is left empty. If any
+///                required field is unset, the DGI will abort.
+/// @param recipient the module (sc/lb/gm/clk etc.) the message should be
+///                  delivered to
+///
+/// @return a shared ModuleMessage holding the contents of message
+///////////////////////////////////////////////////////////////////////////////
+boost::shared_ptr<const ModuleMessage> SCAgent::ShareForSending(
+    StateCollectionMessage& message, std::string recipient)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    ModuleMessage mm;
+    mm.mutable_state_collection_message()->Swap(&message);
+    mm.set_recipient_module(recipient);
+    return ShareMessage(mm);
+}
+
 } // namespace sc
 
 } // namespace broker
@@ -24,8 +24,11 @@
 #ifndef CSTATECOLLECTION_HPP_
 #define CSTATECOLLECTION_HPP_
 
+#include "CBroker.hpp"
+#include "CMetrics.hpp"
 #include "PeerSets.hpp"
 #include "IDGIModule.hpp"
+#include "gm/GroupManagement.hpp"
 #include "CPeerNode.hpp"
 #include "messages/ModuleMessage.pb.h"
 
@@ -34,6 +37,7 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 namespace freedm
@@ -67,6 +71,82 @@ class SCAgent
     private:
         //Marker structure
         typedef std::pair< std::string, int >  StateVersion;
+        //Signal states keyed by type:signal
+        typedef std::map< std::string, DeviceSignalStateMessage > SignalMap;
+
+        ///Bookkeeping of one snapshot in flight
+        struct SSnapshot
+        {
+            ///number of markers received, the own one included
+            unsigned int markers;
+            ///(Initiator) number of states received back
+            unsigned int states;
+            ///flag to indicate save channel message
+            bool recording;
+            ///order in which the snapshots were started
+            unsigned int started;
+            ///signals the snapshot collects, as type:signal
+            std::vector<std::string> devices;
+            ///(Initiator) module that requested the snapshot
+            std::string module;
+            ///(Initiator) modules that asked for the same signals since
+            std::vector<std::string> shared;
+            ///(Initiator) deliver the state of each peer as it arrives
+            bool stream;
+            ///(Initiator) time the result is delivered regardless
+            boost::posix_time::ptime deadline;
+            ///(Peer) version the report is a delta of, -1 for a full one
+            int base;
+            ///(Peer) report the signals by their index in devices
+            bool packed;
+            ///combined state of this node and the children that reported
+            AggregateStateMessage aggregate;
+            ///parent in the aggregation tree, empty at the root
+            std::string parent;
+            ///children that have not reported yet
+            unsigned int pending;
+            ///true once the local state is in the aggregate
+            bool local;
+            ///time the snapshot was started on this node
+            boost::posix_time::ptime begun;
+        };
+        typedef std::map< StateVersion, SSnapshot > SnapshotMap;
+
+        ///States recorded for one snapshot, released together
+        struct SRecording
+        {
+            SRecording() : used(0), channel(-1), bytes(0) { }
+            ///recorded states in [0, used), the cleared ones after for reuse
+            std::vector<StateMessage> states;
+            ///number of states recorded
+            std::size_t used;
+            ///position of the state counting the channel messages, -1 for none
+            int channel;
+            ///memory the recorded states hold
+            std::size_t bytes;
+        };
+        typedef std::map< StateVersion, SRecording > RecordingMap;
+
+        ///(Initiator) a collected state being put together in slices
+        struct SResponse
+        {
+            ///marker of the answered snapshot
+            StateVersion version;
+            ///true if the deadline passed before every state arrived
+            bool expired;
+            ///module that requested the snapshot
+            std::string module;
+            ///modules that asked for the same signals
+            std::vector<std::string> shared;
+            ///signals the snapshot collected
+            std::vector<std::string> devices;
+            ///states of the nodes that are still to be added
+            std::vector<StateMessage> states;
+            ///position of the next state to add
+            std::size_t next;
+            ///the message sent back
+            StateCollectionMessage scm;
+        };
 
         //Handler
         ///Handle receiving messages
@@ -75,20 +155,55 @@ class SCAgent
         void HandleRequest(const RequestMessage& msg, CPeerNode peer);
         void HandleMarker(const MarkerMessage& msg, CPeerNode peer);
         void HandleState(const StateMessage& msg, CPeerNode peer);
+        void HandleAggregate(const AggregateStateMessage& msg, CPeerNode peer);
         /// Handles received messages
         void HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer);
 
         //Internal
         ///Initiator starts state collection
-        void    Initiate();
+        void    Initiate(std::string module, std::vector<std::string> devices,
+            bool stream, int deadline, int maxage);
+        ///Initiator answers a request without a new snapshot if it can
+        bool    AnswerFromCache(const std::string& module,
+            const std::vector<std::string>& devices, int maxage);
         ///Save local state
         void    TakeSnapshot(const std::vector<std::string>& devicelist);
         ///Peer sends collected states back to the initiator
-        void    SendStateBack();
+        void    SendStateBack(StateVersion version);
         ///Initiator sends collected states back to the request module
-        void    StateResponse();
+        void    StateResponse(StateVersion version, bool expired = false);
+        ///Initiator adds the states of the nodes until it should yield
+        bool    ContinueResponse(boost::shared_ptr<SResponse> response);
+        ///Initiator sends the state of one node to the request module
+        void    SendPartial(const SSnapshot& snapshot, const StateMessage& state);
+        ///Arms the timer for the earliest deadline in flight
+        void    ArmDeadline();
+        ///Delivers the snapshots whose deadline has passed
+        void    HandleDeadline(const boost::system::error_code& error);
         ///Peer save local state and forward maker
         void    SaveForward(StateVersion latest, const MarkerMessage& msg);
+        ///Makes room for a new snapshot and starts its bookkeeping
+        SSnapshot& StartSnapshot(StateVersion version,
+            const std::vector<std::string>& devices);
+        ///Forgets a finished or abandoned snapshot
+        void    EndSnapshot(StateVersion version);
+        ///Initiator patches its cached state of a peer with a received state
+        bool    PatchState(const StateMessage& msg,
+            const std::vector<std::string>& devices);
+        ///Initiator expands the signals a peer reported by their index
+        static void UnpackState(const StateMessage& msg,
+            const std::vector<std::string>& devices, StateMessage& state);
+        ///True if a signal moved beyond the deadband since it was reported
+        static bool Changed(const DeviceSignalStateMessage& reported,
+            const DeviceSignalStateMessage& current);
+        ///Starts combining the states of a marker along the aggregation tree
+        void    StartAggregate(SSnapshot& snapshot, StateVersion version);
+        ///Adds the local states of a marker to its aggregate
+        void    AggregateLocal(SSnapshot& snapshot, StateVersion version);
+        ///Sends the aggregate up the tree once the whole subtree is in
+        void    ForwardAggregate(StateVersion version);
+        ///Gets the members in aggregation tree order, the root first
+        std::vector<std::string> AggregateTree(const std::string& root) const;
 
         //Peer set operations
         ///Add a peer to peer set from a pointer to a peer node object
@@ -96,40 +211,77 @@ class SCAgent
         ///Get a pointer to a peer from UUID
         CPeerNode GetPeer(std::string uuid);
 
+        ///Records a state for a snapshot unless the memory cap is reached
+        bool    Record(StateVersion version, const StateMessage& state);
+        ///Counts a message in the channels recorded for a snapshot
+        void    RecordChannel(StateVersion version);
+        ///Frees the states recorded for a snapshot at once
+        void    Release(StateVersion version);
+        ///Frees the states recorded for every snapshot
+        void    ReleaseAll();
+        ///Reports the size of collectstate to the metrics
+        void NoteCollectedStates();
+
         /// Wraps a StateCollectionMessage in a ModuleMessage
         static ModuleMessage PrepareForSending(
             const StateCollectionMessage& message, std::string recipient = "sc");
 
-        ///collect states container and its iterator
-        std::multimap<StateVersion, StateMessage> collectstate;
-        std::multimap<StateVersion, StateMessage>::iterator it;
+        /// Moves a StateCollectionMessage into a shared ModuleMessage
+        static boost::shared_ptr<const ModuleMessage> ShareForSending(
+            StateCollectionMessage& message, std::string recipient = "sc");
+
+        ///collect states container, one recording per snapshot
+        RecordingMap collectstate;
+        ///released recordings whose states are cleared for the next snapshot
+        std::vector< std::vector<StateMessage> > m_pool;
+        ///memory held by the states of every recording
+        std::size_t m_recordedbytes;
+        ///number of states in every recording
+        std::size_t m_recordedstates;
 
-        ///count number of states
-        unsigned int m_countstate;
-        ///count number of marker
-        unsigned int m_countmarker;
-        ///count number of "Done" messages
-        unsigned int m_countdone;
+        ///snapshots in flight
+        SnapshotMap m_snapshots;
+        ///highest marker id seen from each initiator
+        std::map<std::string, int> m_latest;
+        ///id of the last snapshot this node initiated
+        int m_nextid;
+        ///number of snapshots started, orders the snapshots in flight
+        unsigned int m_started;
+        ///timer for the deadlines of the snapshots
+        CBroker::TimerHandle m_deadlinetimer;
 
         ///save leader
         std::string m_scleader;
 
-        ///flag to indicate save channel message
-        bool m_NotifyToSave;
-
-        ///module that request state collection
-        std::string m_module;
-
-        //For multidevices state collection the following variables have to be changed
-        std::vector<std::string> m_device;
-
-        ///current version of marker
-        StateVersion        m_curversion;
         ///current state
         StateMessage m_curstate;
 
         ///all known peers
         PeerSet m_AllPeers;
+
+        ///(Initiator) last state received from each peer
+        std::map<std::string, SignalMap> m_cache;
+        ///(Initiator) marker id of the last state received from each peer
+        std::map<std::string, int> m_cacheversion;
+        ///(Peer) signal values as last sent to m_reportedversion's initiator
+        SignalMap m_reported;
+        ///(Peer) marker of the last state sent back
+        StateVersion m_reportedversion;
+
+        ///(Initiator) a collected state and the time it completed
+        struct SCachedState
+        {
+            CollectedStateMessage state;
+            boost::posix_time::ptime completed;
+        };
+        ///(Initiator) last complete state of each list of signals
+        std::map<std::vector<std::string>, SCachedState> m_results;
+
+        ///the group membership last received
+        gm::MembershipSnapshot m_membership;
+
+        ///size of collectstate
+        CSizeTracker m_collectmemory;
 };
 
 } // namespace sc
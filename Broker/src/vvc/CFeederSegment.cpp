@@ -0,0 +1,418 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CFeederSegment.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  The part of the feeder model a DGI solves in distributed VVC
+///
+/// @functions
+///     CFeederSegment::CFeederSegment
+///     CFeederSegment::NoteNeighbor
+///     CFeederSegment::SetSource
+///     CFeederSegment::Extract
+///     CFeederSegment::Restore
+///     CFeederSegment::NoteFlow
+///     CFeederSegment::GetFeed
+///     CFeederSegment::IsBelow
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "CFeederSegment.hpp"
+#include "CLogger.hpp"
+
+#include <deque>
+#include <set>
+#include <stdexcept>
+
+#include <boost/lexical_cast.hpp>
+
+namespace freedm {
+namespace broker {
+namespace vvc {
+
+namespace {
+/// This file's logger.
+CLocalLogger Logger(__FILE__);
+
+/// Rounds a downstream segment may stay silent before it is solved here again
+const unsigned int STALE_ROUNDS = 3;
+
+/// Columns of the feeder model
+enum
+{
+    COL_LINE = 0, COL_FROM = 1, COL_TO = 2, COL_CODE = 3, COL_LENGTH = 4,
+    COL_TYPE = 5, COL_LOAD = 6, COL_WIDTH = 13
+};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::CFeederSegment
+/// @description Indexes the branches of the feeder below the boundary bus.
+/// @pre Dl is a radial feeder model in the layout DPF_plan reads.
+/// @post m_branches and m_parent describe the tree of the feeder.
+/// @param root The boundary bus of the segment of this DGI.
+/// @param Dl The feeder model; only its first six columns are read.
+/// @except std::runtime_error if no branch leaves the boundary bus.
+///////////////////////////////////////////////////////////////////////////////
+CFeederSegment::CFeederSegment(unsigned int root, const arma::mat& Dl)
+    : m_root(root)
+    , m_power(6, 0.0)
+    , m_round(0)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for( unsigned int i = 0; i < Dl.n_rows; i++ )
+    {
+        if( Dl(i, COL_LINE) == 0 )
+        {
+            continue;
+        }
+        unsigned int from = static_cast<unsigned int>(Dl(i, COL_FROM));
+        unsigned int to = static_cast<unsigned int>(Dl(i, COL_TO));
+        m_branches[from].push_back(i);
+        m_parent[to] = from;
+    }
+
+    if( m_branches.count(m_root) == 0 )
+    {
+        throw std::runtime_error("No branch of the feeder model leaves bus "
+            + boost::lexical_cast<std::string>(m_root));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::NoteNeighbor
+/// @description Records a neighbor as downstream if its boundary bus is
+///     below ours, and forgets it otherwise.
+/// @pre None.
+/// @post A downstream neighbor is lumped into the next Extract.
+/// @param uuid The UUID of the neighbor.
+/// @param bus The boundary bus the neighbor reported.
+/// @param power The power the neighbor draws at that bus, Pa Qa Pb Qb Pc Qc.
+///////////////////////////////////////////////////////////////////////////////
+void CFeederSegment::NoteNeighbor(const std::string& uuid, unsigned int bus,
+    const PhaseValues& power)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( !IsBelow(bus) || power.size() != 6 )
+    {
+        m_children.erase(uuid);
+        return;
+    }
+
+    std::map<std::string, SChild>::iterator it = m_children.find(uuid);
+    if( it != m_children.end() && it->second.bus != bus )
+    {
+        m_children.erase(it);
+        it = m_children.end();
+    }
+    if( it == m_children.end() )
+    {
+        it = m_children.insert(std::make_pair(uuid, SChild())).first;
+        it->second.bus = bus;
+    }
+    SChild& child = it->second;
+    child.power = power;
+    child.heard = m_round;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::SetSource
+/// @description Sets the voltage the segment is fed from.
+/// @pre None.
+/// @post The next power flow of the segment starts from this voltage.
+/// @param voltage The real and imaginary parts of phases a, b and c in p.u.
+///////////////////////////////////////////////////////////////////////////////
+void CFeederSegment::SetSource(const PhaseValues& voltage)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( voltage.size() != 6 )
+    {
+        LOG_WARN(Logger) << "Dropped a boundary voltage with "
+                         << voltage.size() << " values." << std::endl;
+        return;
+    }
+
+    m_source.set_size(1, 3);
+    for( unsigned int p = 0; p < 3; p++ )
+    {
+        m_source(0, p) = std::complex<double>(voltage[2*p], voltage[2*p+1]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::Extract
+/// @description Copies the branches of this segment out of the feeder model.
+///     The boundary bus becomes bus 0 and the others are numbered in the
+///     order they are visited. Each lateral is a chain of branches after a
+///     row of zeros, and a lateral follows the chain it leaves, as DPF_plan
+///     expects. When several branches leave the boundary bus, a branch of no
+///     length from bus 0 to bus 1 is put first so that each of them starts a
+///     lateral. The branch into the boundary bus of a downstream segment
+///     carries the power that segment reported, and the walk stops there.
+/// @pre Dl has the branches of the model passed to the constructor.
+/// @post m_origin, m_lumped and m_number describe the returned model.
+/// @param Dl The feeder model with the current loads.
+/// @return The feeder model of the segment.
+///////////////////////////////////////////////////////////////////////////////
+arma::mat CFeederSegment::Extract(const arma::mat& Dl)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_round++;
+
+    std::map<unsigned int, const SChild *> boundary;
+    std::map<std::string, SChild>::iterator it = m_children.begin();
+    while( it != m_children.end() )
+    {
+        if( m_round - it->second.heard > STALE_ROUNDS )
+        {
+            LOG_NOTICE(Logger) << "Solving the segment of " << it->first
+                               << " again after it went silent." << std::endl;
+            m_children.erase(it++);
+            continue;
+        }
+        boundary[it->second.bus] = &it->second;
+        ++it;
+    }
+
+    std::vector<arma::rowvec> rows;
+    m_origin.clear();
+    m_lumped.clear();
+    m_number.clear();
+
+    const std::vector<unsigned int>& first = m_branches[m_root];
+    unsigned int next = 1;
+    bool split = first.size() > 1;
+
+    if( split )
+    {
+        arma::rowvec tie(COL_WIDTH, arma::fill::zeros);
+        tie(COL_FROM) = 0;
+        tie(COL_TO) = 1;
+        tie(COL_CODE) = Dl(first[0], COL_CODE);
+        tie(COL_TYPE) = Dl(first[0], COL_TYPE);
+        rows.push_back(tie);
+        m_origin.push_back(-1);
+        m_lumped.push_back(PhaseValues(6, 0.0));
+        m_number[m_root] = next++;
+    }
+    else
+    {
+        m_number[m_root] = 0;
+    }
+
+    std::deque<unsigned int> pending(first.begin(), first.end());
+    bool lateral = false;
+
+    while( !pending.empty() )
+    {
+        unsigned int row = pending.front();
+        pending.pop_front();
+
+        // the first chain continues from the source, the others are laterals
+        if( lateral )
+        {
+            rows.push_back(arma::rowvec(COL_WIDTH, arma::fill::zeros));
+            m_origin.push_back(-1);
+            m_lumped.push_back(PhaseValues(6, 0.0));
+        }
+        lateral = true;
+
+        while( true )
+        {
+            unsigned int from = static_cast<unsigned int>(Dl(row, COL_FROM));
+            unsigned int to = static_cast<unsigned int>(Dl(row, COL_TO));
+
+            arma::rowvec branch = Dl.row(row).cols(0, COL_WIDTH-1);
+            branch(COL_FROM) = m_number[from];
+            branch(COL_TO) = m_number[to] = next++;
+
+            PhaseValues lumped(6, 0.0);
+            std::map<unsigned int, const SChild *>::iterator bit;
+            bit = boundary.find(to);
+            if( bit != boundary.end() )
+            {
+                lumped = bit->second->power;
+                for( unsigned int k = 0; k < 6; k++ )
+                {
+                    branch(COL_LOAD+k) += lumped[k];
+                }
+            }
+
+            rows.push_back(branch);
+            m_origin.push_back(row);
+            m_lumped.push_back(lumped);
+
+            if( bit != boundary.end() || m_branches.count(to) == 0 )
+            {
+                break;
+            }
+
+            const std::vector<unsigned int>& out = m_branches[to];
+            pending.insert(pending.end(), out.begin() + 1, out.end());
+            row = out[0];
+        }
+    }
+
+    arma::mat segment(rows.size(), COL_WIDTH);
+    for( unsigned int i = 0; i < rows.size(); i++ )
+    {
+        segment.row(i) = rows[i];
+        if( m_origin[i] >= 0 )
+        {
+            // the 1-based line numbers are all DPF_plan uses from column 0
+            segment(i, COL_LINE) = i + 1;
+        }
+    }
+    if( split )
+    {
+        segment(0, COL_LINE) = 1;
+    }
+
+    LOG_DEBUG(Logger) << "Segment below bus " << m_root << " has "
+                      << rows.size() << " rows and " << boundary.size()
+                      << " lumped downstream segments." << std::endl;
+    return segment;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::Restore
+/// @description Writes the reactive set points the optimizer chose for the
+///     owned branches back into the feeder model, without the lumped power.
+/// @pre segment was returned by the last Extract, possibly with new set
+///     points in columns 7, 9 and 11.
+/// @post The owned rows of Dl carry the new set points.
+/// @param Dl The feeder model to update.
+/// @param segment The solved model of the segment.
+///////////////////////////////////////////////////////////////////////////////
+void CFeederSegment::Restore(arma::mat& Dl, const arma::mat& segment) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    for( unsigned int i = 0; i < segment.n_rows && i < m_origin.size(); i++ )
+    {
+        if( m_origin[i] < 0 )
+        {
+            continue;
+        }
+        for( unsigned int k = 1; k < 6; k += 2 )
+        {
+            Dl(m_origin[i], COL_LOAD+k) =
+                segment(i, COL_LOAD+k) - m_lumped[i][k];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::NoteFlow
+/// @description Keeps the power drawn at the boundary bus and the voltages
+///     at the boundary buses of the downstream segments.
+/// @pre flow is a power flow of the model returned by the last Extract.
+/// @post GetPower and GetFeed report the values of this flow.
+/// @param flow The power flow of the segment.
+///////////////////////////////////////////////////////////////////////////////
+void CFeederSegment::NoteFlow(const VPQ& flow)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if( flow.PQb.n_rows > 0 && flow.PQb.n_cols >= 6 )
+    {
+        for( unsigned int k = 0; k < 6; k++ )
+        {
+            m_power[k] = flow.PQb(0, k);
+        }
+    }
+
+    std::map<std::string, SChild>::iterator it;
+    for( it = m_children.begin(); it != m_children.end(); it++ )
+    {
+        std::map<unsigned int, unsigned int>::const_iterator num;
+        num = m_number.find(it->second.bus);
+        if( num == m_number.end() || num->second >= flow.V.n_rows
+            || flow.V.n_cols < 3 )
+        {
+            continue;
+        }
+        it->second.voltage.resize(6);
+        for( unsigned int p = 0; p < 3; p++ )
+        {
+            std::complex<double> v = flow.V(num->second, p);
+            it->second.voltage[2*p] = v.real();
+            it->second.voltage[2*p+1] = v.imag();
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::GetFeed
+/// @description Gets the voltage to send to a downstream neighbor.
+/// @pre None.
+/// @post None.
+/// @param uuid The UUID of the neighbor.
+/// @param bus Set to the boundary bus of the neighbor.
+/// @param voltage Set to the voltage solved for the bus.
+/// @return True if the neighbor is downstream and its voltage is known.
+///////////////////////////////////////////////////////////////////////////////
+bool CFeederSegment::GetFeed(const std::string& uuid, unsigned int& bus,
+    PhaseValues& voltage) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::map<std::string, SChild>::const_iterator it = m_children.find(uuid);
+    if( it == m_children.end() || it->second.voltage.empty() )
+    {
+        return false;
+    }
+    bus = it->second.bus;
+    voltage = it->second.voltage;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CFeederSegment::IsBelow
+/// @description Walks up the feeder from a bus to see if it passes the
+///     boundary bus of this segment.
+/// @pre None.
+/// @post None.
+/// @param bus The bus to look for.
+/// @return True if the bus is downstream of the boundary bus.
+///////////////////////////////////////////////////////////////////////////////
+bool CFeederSegment::IsBelow(unsigned int bus) const
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    std::set<unsigned int> seen;
+    std::map<unsigned int, unsigned int>::const_iterator it;
+
+    while( (it = m_parent.find(bus)) != m_parent.end() )
+    {
+        if( !seen.insert(bus).second )
+        {
+            break;
+        }
+        bus = it->second;
+        if( bus == m_root )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace vvc
+} // namespace broker
+} // namespace freedm
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file         CFeederSegment.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  The part of the feeder model a DGI solves in distributed VVC
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CFEEDERSEGMENT_HPP
+#define CFEEDERSEGMENT_HPP
+
+#include "fun_return.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace freedm {
+namespace broker {
+namespace vvc {
+
+/// Cuts the feeder model down to the branches one DGI solves
+////////////////////////////////////////////////////////////////////////////////
+/// In distributed VVC each DGI owns the branches of the radial feeder that
+/// leave the buses below its boundary bus, down to the boundary buses of the
+/// DGIs beneath it. A downstream segment is replaced with a lumped load of the
+/// power it reported drawing at its boundary bus, and the segment itself is
+/// fed from the voltage its upstream neighbor solved for the boundary bus.
+/// Extract renumbers the owned branches into a feeder model of their own, in
+/// the layout DPF_plan expects, so VVCAgent::vvc_compute runs unchanged on a
+/// model whose size does not grow with the rest of the feeder.
+///
+/// The class only keeps state. VVCAgent exchanges the boundary values with
+/// the neighbors and passes them in. A downstream segment that has not been
+/// heard from for a few rounds is solved as part of this one again.
+////////////////////////////////////////////////////////////////////////////////
+class CFeederSegment
+{
+public:
+    /// The values of the three phases at a boundary, as six numbers
+    typedef std::vector<double> PhaseValues;
+
+    /// Creates the segment below a bus of the feeder model
+    CFeederSegment(unsigned int root, const arma::mat& Dl);
+
+    /// Gets the boundary bus of the segment
+    unsigned int GetRoot() const { return m_root; }
+
+    /// Records the boundary bus and power a neighbor reported
+    void NoteNeighbor(const std::string& uuid, unsigned int bus,
+        const PhaseValues& power);
+
+    /// Sets the voltage the upstream neighbor solved for the boundary bus
+    void SetSource(const PhaseValues& voltage);
+
+    /// Gets the source voltage for the power flow, empty if unknown
+    const arma::cx_mat& GetSource() const { return m_source; }
+
+    /// Builds the feeder model of the segment from a full feeder model
+    arma::mat Extract(const arma::mat& Dl);
+
+    /// Copies the reactive set points of a solved segment into the full model
+    void Restore(arma::mat& Dl, const arma::mat& segment) const;
+
+    /// Takes the boundary values out of a power flow of the segment
+    void NoteFlow(const VPQ& flow);
+
+    /// Gets the power the segment draws at its boundary bus
+    const PhaseValues& GetPower() const { return m_power; }
+
+    /// Gets the voltage solved for the boundary bus of a downstream neighbor
+    bool GetFeed(const std::string& uuid, unsigned int& bus,
+        PhaseValues& voltage) const;
+
+private:
+    /// A downstream segment
+    struct SChild
+    {
+        /// The boundary bus of the segment
+        unsigned int bus;
+        /// The power it draws at the boundary bus
+        PhaseValues power;
+        /// The voltage solved for the boundary bus
+        PhaseValues voltage;
+        /// The round it was last heard from
+        unsigned int heard;
+    };
+
+    /// True if the bus is below the boundary bus of this segment
+    bool IsBelow(unsigned int bus) const;
+
+    /// The boundary bus of this segment
+    unsigned int m_root;
+    /// The branches, as rows of the full model, that leave each bus
+    std::map<unsigned int, std::vector<unsigned int> > m_branches;
+    /// The bus each bus is fed from
+    std::map<unsigned int, unsigned int> m_parent;
+    /// The downstream segments by UUID of their DGI
+    std::map<std::string, SChild> m_children;
+    /// The row of the full model of each segment row, -1 if it has none
+    std::vector<int> m_origin;
+    /// The lumped power added to each segment row
+    std::vector<PhaseValues> m_lumped;
+    /// The segment bus number of each bus of the full model
+    std::map<unsigned int, unsigned int> m_number;
+    /// The voltage the segment is fed from
+    arma::cx_mat m_source;
+    /// The power the segment draws at its boundary bus
+    PhaseValues m_power;
+    /// Rounds extracted so far
+    unsigned int m_round;
+};
+
+} // namespace vvc
+} // namespace broker
+} // namespace freedm
+
+#endif // CFEEDERSEGMENT_HPP
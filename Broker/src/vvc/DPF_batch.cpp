@@ -0,0 +1,130 @@
+# include <armadillo>
+# include <algorithm>
+# include <limits>
+# include <stdexcept>
+# include <string>
+# include <boost/bind.hpp>
+# include <boost/lexical_cast.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/thread.hpp>
+# include "fun_return.h"
+
+// What-if power flows of several candidate feeder models. The candidates
+// only share the read-only plan and impedance table, so each one can be
+// solved on its own thread.
+
+namespace {
+
+struct dpf_queue
+{
+	const std::vector<arma::mat>* models;
+	const arma::cx_mat* Z;
+	const dpf_plan* plan;
+	const dpf_warm* warm;
+	std::vector<dpf_candidate>* out;
+	std::vector<std::string>* error;
+	boost::mutex lock;
+	unsigned int next;
+};
+
+dpf_candidate evaluate(const arma::mat& Dl, const arma::cx_mat& Z, const dpf_plan& plan, const dpf_warm* warm)
+{
+	// every solve starts from its own copy of the warm start
+	dpf_warm seed;
+	if (warm != NULL)
+	{
+		seed = *warm;
+	}
+	VPQ flow = DPF_return7(Dl, Z, plan, warm != NULL ? &seed : NULL);
+
+	dpf_candidate result;
+	result.converged = flow.converged;
+	result.loss = flow.PQb(0, 0) + flow.PQb(0, 2) + flow.PQb(0, 4)
+		- arma::accu(flow.PQL.col(0)) - arma::accu(flow.PQL.col(2)) - arma::accu(flow.PQL.col(4));
+	result.vmin = std::numeric_limits<double>::infinity();
+	result.vmax = -result.vmin;
+	// a zero magnitude marks a phase the bus does not have, as in V_abc_list
+	for (unsigned int i = 0; i < flow.Vpolar.n_rows; ++i)
+	{
+		for (unsigned int p = 0; p < 6; p += 2)
+		{
+			double v = flow.Vpolar(i, p);
+			if (v != 0)
+			{
+				result.vmin = std::min(result.vmin, v);
+				result.vmax = std::max(result.vmax, v);
+			}
+		}
+	}
+	return result;
+}
+
+void dpf_worker(dpf_queue* queue)
+{
+	while (true)
+	{
+		unsigned int k;
+		{
+			boost::mutex::scoped_lock guard(queue->lock);
+			if (queue->next >= queue->models->size())
+			{
+				return;
+			}
+			k = queue->next++;
+		}
+		try
+		{
+			(*queue->out)[k] = evaluate((*queue->models)[k], *queue->Z, *queue->plan, queue->warm);
+		}
+		catch (std::exception& e)
+		{
+			(*queue->error)[k] = e.what();
+		}
+	}
+}
+
+}
+
+std::vector<dpf_candidate> DPF_batch(const std::vector<arma::mat>& models, const arma::cx_mat& Z,
+	const dpf_plan& plan, const dpf_warm* warm, unsigned int threads)
+{
+	std::vector<dpf_candidate> out(models.size());
+	std::vector<std::string> error(models.size());
+
+	dpf_queue queue;
+	unsigned int workers = std::min<unsigned int>(threads, models.size());
+	// the candidates already keep the threads busy, so each one is swept in order
+	dpf_plan serial = plan;
+	serial.threads = 1;
+
+	queue.models = &models;
+	queue.Z = &Z;
+	queue.plan = workers > 1 ? &serial : &plan;
+	queue.warm = warm;
+	queue.out = &out;
+	queue.error = &error;
+	queue.next = 0;
+
+	if (workers > 1)
+	{
+		boost::thread_group pool;
+		for (unsigned int t = 0; t < workers; t++)
+		{
+			pool.create_thread(boost::bind(&dpf_worker, &queue));
+		}
+		pool.join_all();
+	}
+	else
+	{
+		dpf_worker(&queue);
+	}
+
+	for (unsigned int k = 0; k < models.size(); k++)
+	{
+		if (!error[k].empty())
+		{
+			throw std::runtime_error("VVC what-if power flow " + boost::lexical_cast<std::string>(k) + ": " + error[k]);
+		}
+	}
+	return out;
+}
@@ -6,6 +6,11 @@ using namespace std;
 using namespace arma;
 
 VPQ DPF_return7(mat Dl, cx_mat Z)
+{
+	return DPF_return7(Dl, Z, DPF_plan(Dl, Z, 1000, 12.47));
+}
+
+VPQ DPF_return7(mat Dl, cx_mat Z, const dpf_plan& plan, dpf_warm* warm)
 {
   VPQ dpf_return7;
   double bkva = 1000;
@@ -51,183 +56,48 @@ VPQ DPF_return7(mat Dl, cx_mat Z)
 	
 
 	
-	int rz = Z.n_rows/3;
-	int cz = Z.n_cols;
-	field<cx_mat> Zz(1, rz);
-	for (int i = 0; i < rz; i++)
+	//Put all Vi's=V0 for the first iteration
+	vo = vo / bkv;
+	// one voltage per phase, kept in a fixed size row without allocating
+	cx_rowvec::fixed<3> V0;
+	V0(0) = cx_double(vo, 0);
+	V0(1) = cx_double((-0.5)*vo, (-0.5*sqrt(3))*vo);
+	V0(2) = cx_double((-0.5)*vo, (0.5*sqrt(3))*vo);
+	//V0.print("Initial Voltage is");
+	if (plan.V0.n_elem == 3)
 	{
-		Zz(0, i) = Z(span(i * 3, i * 3 + 2), span(0, 2));
+	  V0 = plan.V0; // a feeder segment fed from a neighbor's boundary bus
 	}
 
-	//Zz.print("Zz:");
-	// set uo Zbase and Z in p.u.
-	double Zb = 1000 * pow(bkv,2) /bkva;
-	//cout << "Zb= " << Zb << endl;
-	int Wz = rz;
-	cx_mat Ztemp(zeros(3, 3),zeros(3,3));
-	cx_mat Zl(zeros(3, 3), zeros(3, 3));
-	for (int i = 0; i < Wz; i++)
+	// backward/forward sweep on the precomputed plan
+	cx_mat V, Iinj, Ild;
+	bool converged;
+	int itr = DPF_sweep(plan, Sld, V0, eps, mxitr, warm, V, Iinj, Ild, converged);
+	if (warm != NULL)
 	{
-		Ztemp = Zz(0, i) / Zb;
-		if (i == 0)
-		{
-			Zl = Ztemp;
-		}
-		else
-		{
-			Zl = join_rows(Zl, Ztemp);
-		}
+	  warm->iterations = itr;
+	  if (converged)
+	  {
+	    warm->valid = true;
+	    warm->V = V;
+	    warm->Ib0 = Iinj.row(0);
+	  }
 	}
-	//cout << " No of Cols in Zl: " << Zl.n_cols << endl;
-	
-	//Put all Vi's=V0 for the first iteration
-	vo = vo / bkv;
-	mat V0real = zeros(1, 3);
-	mat V0imag = zeros(1, 3);
-	V0real << vo << (-0.5)*vo << (-0.5)*vo << endr;
-	V0imag << 0 << (-0.5*sqrt(3))*vo << (0.5*sqrt(3))*vo << endr;
-	cx_mat V0(V0real, V0imag);
-	//V0.print("Initial Voltage is");
-
-	field<cx_mat> V(Nl, 1);
-	for (int i = 0; i < Nl; i++)
+	if (converged)
 	{
-		V(i, 0) = V0;
+	  cout << " DPF converged! (" << itr << " iterations)" << endl;
 	}
-	//V.row(0).print("Node Voltage in complex number is: \n");
-	
-	cx_mat Ibo(zeros(1, 3), zeros(1, 3));
-	cx_mat Iinj(zeros(cnt_nodes - 2, 3), zeros(cnt_nodes - 2, 3));
-	cx_mat Ild(zeros(cnt_nodes - 1, 3), zeros(cnt_nodes - 1, 3));
-	for (int i = 0; i < mxitr; i++)
+	else
 	{
-		// Calculate the load currents
-		//field<cx_mat> IL(cnt_nodes-1, 3);
-		cx_mat IL(zeros(cnt_nodes, 3), zeros(cnt_nodes, 3));
-		for (int j = 0; j < Nl; j++)
-		{
-			if (ln(j) > 0)
-			{
-				for (int a = 0; a < 3; a++)
-				{
-					int ndr = int(rbus(j,0));
-					//cout << "ndr at" << j + 1 << " th iteration is" << ndr << endl;
-					cx_mat v_temp = V(ndr, 0);
-					
-					if (abs(v_temp(0, a)) == 0)
-					{
-						IL(ndr - 1, a) = cx_double(0, 0);
-					}
-					else
-					{
-						cx_mat v_temp1 = V(ndr, 0);
-						IL(ndr - 1, a) = conj(Sld(j, a) / v_temp1(0, a));
-					}
-					
-					
-				}// end of for "a" loop
-			}//end of "if (ln(j) > 0)"
-		}//end of j Nl for IL
-		//IL.print("Load current: \n");// the last row should be empty
-		
-		//Find the branch currents in per unit
-		cx_mat Ib(zeros(cnt_nodes - 1, 3), zeros(cnt_nodes - 1, 3));
-		cx_mat Ibl(zeros(1, 3), zeros(1, 3));//let Ibl be the last branch current calculated
-		for (int m = Nl-1 ; m >= 0; m--)
-		{
-			if (ln(m) == 0)
-			{	
-				int node = int(sbus(m + 1, 0));
-				for (int a = 0; a < 3; a++)
-				{
-					Ib(node - 1, a) = Ib(node - 1, a) + Ibl(0, a);
-				}
-				Ibl = cx_mat(zeros(1, 3), zeros(1, 3));
-			}
-			else
-			{
-				//update a branch in a lateral or main
-				int ndr = int(rbus(m, 0));
-				for (int a = 0; a < 3; a++)
-				{
-					Ib(ndr - 1, a) = Ib(ndr - 1, a) + Ibl(0, a) +IL(ndr - 1, a);
-					//cout << "Ibl = " << Ibl(0, a) << "	IL = "<<IL(ndr - 1, a)<<endl;
-					//cout << "ndr:   " << ndr << "	" << "Ib (ndr -1,0)=" << Ib(ndr - 1, 0) << endl;
-				}
-				Ibl = Ib.row(ndr - 1);
-			}
-			
-		}//end of Ib loop
-		//Ib.print("Ib: \n");
-
-		int lcd1 = int(Dl(0, 3));
-		int lpt1 = 3 * (lcd1 - 1);
-		Ztemp = Zl.cols(lpt1, lpt1 + 2);
-		//Ztemp.print("Ztemp: \n");
-		
-		V(1,0) = V0 - lng(0, 0)*Ib.row(0)*Ztemp;
-		for (int m = 1 ; m < Nl ; m++ )
-		{
-		  if (ln(m) != 0)
-		  {
-		    int lcd = int(Dl(m, 3));
-		    int lpt = 3 * (lcd - 1);
-		    Ztemp = Zl.cols(lpt, lpt + 2);
-		    cx_mat rv, sv;
-		    sv = V(sbus(m), 0);
-		    rv = sv - lng(m) * Ib.row( rbus(m) - 1 )*Ztemp;
-		    //cout << m << "z=" << Ztemp <<"\n" << " receiving end voltage: " << rv << endl;
-		    if (abs(Ztemp(0, 0)) == 0 )
-		    {
-		      rv(0, 0) = cx_double(0,0);
-		      //cout<<V(rbus(m), 0)<<endl;
-		    }
-		    if (abs(Ztemp(1, 1)) == 0 )
-		    {
-		      rv(0, 1) = cx_double(0,0);
-		    }
-		    if (abs(Ztemp(2, 2)) == 0 )
-		    {
-		      rv(0, 2) = cx_double(0,0);
-		    }
-		    V( rbus(m), 0) = rv;
-		  }// end of if ln(m) 
-		}//end of for m loop
-		//V.print("V: \n");
-		
-		//check for convergence
-		cx_mat Idiff = Ib.row(0) - Ibo;
-		mat diff = abs(Idiff);
-		double errmx = max(max(diff));
-		//cout << "At " << i+1 <<"th iteration,  max error = " << errmx << "\n";
-		Ibo = Ib.row(0);
-		if (errmx < eps)
-		{
-		  cout << " DPF converged!" << endl;
-		  Iinj = Ib;
-		  Ild = IL;
-		  break;
-		}
-		if (i >= mxitr )
-		{
-		  cout << " Exit DPF! (DPF reaches maximum iterations)" << endl;
-		  Iinj = Ib;
-		  Ild = IL;
-		  break;
-		}
-	}// end of DPF iteration
+	  cout << " Exit DPF! (DPF reaches maximum iterations)" << endl;
+	}
 	
 	// Format DPF results
 	// This will put the voltage in polar form
 	cx_mat V_nodes = cx_mat(zeros(cnt_nodes,3), zeros(cnt_nodes,3)); // Substation at the last row
 	//cx_mat V_nodes1 = cx_mat(zeros(cnt_nodes,3), zeros(cnt_nodes,3));//Substation at the first row
-	V_nodes.row(cnt_nodes - 1) = V(0,0);//to put substation para at the last row
-	//V_nodes1.row(cnt_nodes - 1) = V(cnt_nodes - 1,0);//to put substation para at the first row
-	for (int j = 0; j < cnt_nodes - 1; j++)
-	{
-	  V_nodes.row(j) = V(j + 1, 0);
-	  //V_nodes1.row(j) = V(j, 0);
-	}
+	V_nodes.row(cnt_nodes - 1) = V.row(0);//to put substation para at the last row
+	V_nodes.rows(0, cnt_nodes - 2) = V.rows(1, cnt_nodes - 1);
 	mat Vabs = abs(V_nodes);
 	mat Vang = (180/datum::pi)*atan(imag(V_nodes)/real(V_nodes));
 	Vang.elem( find_nonfinite(Vang) ).zeros();
@@ -253,11 +123,14 @@ VPQ DPF_return7(mat Dl, cx_mat Z)
 	//cout << "PQL = \n" << PQL << endl;
 	//cout << "size of PQL: " << size(PQL) << endl;
 	
+	dpf_return7.V = V;
 	dpf_return7.Vpolar = Vpolar;
 	dpf_return7.PQb = PQb;
 	dpf_return7.PQL = PQL;
 	dpf_return7.Qset_a = Dl.col(7);
 	dpf_return7.Qset_b = Dl.col(9);
 	dpf_return7.Qset_c = Dl.col(11);
+	dpf_return7.iterations = itr;
+	dpf_return7.converged = converged;
 	return dpf_return7;
 }
\ No newline at end of file
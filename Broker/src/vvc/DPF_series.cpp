@@ -0,0 +1,204 @@
+# include <armadillo>
+# include <algorithm>
+# include <cmath>
+# include <limits>
+# include <stdexcept>
+# include <string>
+# include <boost/bind.hpp>
+# include <boost/lexical_cast.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/thread.hpp>
+# include "fun_return.h"
+
+// Power flows of one feeder over a series of load profiles. The topology and
+// its sweep plan are fixed, so each time point only scales the loads and
+// sweeps again. The series is cut into blocks of consecutive time points;
+// each block is solved on one thread, and every point of a block starts from
+// the solution of the point before it.
+
+namespace {
+
+// the base values DPF_return7 solves in
+const double BKVA = 1000;
+const double BKV = 12.47;
+const double EPS = 0.0001;
+const int MXITR = 20;
+
+struct dpf_series_queue
+{
+	const arma::cx_mat* Sld;
+	const arma::mat* profiles;
+	const dpf_plan* plan;
+	const dpf_warm* warm;
+	arma::cx_mat V0;
+	unsigned int block;
+	dpf_series_sink* sink;
+	boost::mutex lock;	// serializes the sink and the queue
+	unsigned int next;
+	std::string error;
+};
+
+// loss and voltage range of a solution, computed as DPF_return7 formats it
+void summarize(const dpf_plan& plan, const arma::cx_mat& V, const arma::cx_mat& Ib,
+	const arma::cx_mat& IL, dpf_point& point)
+{
+	const int nc = plan.cnt_nodes;
+	double sub = 0, load = 0;
+	point.vmin = std::numeric_limits<double>::infinity();
+	point.vmax = -point.vmin;
+	for (int a = 0; a < 3; a++)
+	{
+		sub += std::real(V(0, a) * std::conj(Ib(0, a)));
+		// the load currents put the substation last, the voltages first
+		load += std::real(V(0, a) * std::conj(IL(nc - 1, a)));
+		for (int k = 0; k < nc - 1; k++)
+		{
+			load += std::real(V(k + 1, a) * std::conj(IL(k, a)));
+		}
+		for (int k = 0; k < nc; k++)
+		{
+			double v = std::abs(V(k, a));
+			if (v != 0)
+			{
+				point.vmin = std::min(point.vmin, v);
+				point.vmax = std::max(point.vmax, v);
+			}
+		}
+	}
+	point.p_sub = (BKVA / 3) * sub;
+	point.loss = (BKVA / 3) * (sub - load);
+}
+
+void dpf_series_worker(dpf_series_queue* queue)
+{
+	const arma::cx_mat& base = *queue->Sld;
+	const arma::mat& profiles = *queue->profiles;
+	const bool feeder = profiles.n_rows == 1;
+	// one set of buffers per thread, reused by every point it solves
+	arma::cx_mat Sld(base.n_rows, 3);
+	arma::cx_mat V, Ib, IL;
+	dpf_warm seed;
+	dpf_point point;
+
+	while (true)
+	{
+		unsigned int begin;
+		{
+			boost::mutex::scoped_lock guard(queue->lock);
+			if (queue->next >= profiles.n_cols || !queue->error.empty())
+			{
+				return;
+			}
+			begin = queue->next;
+			queue->next += queue->block;
+		}
+		unsigned int end = std::min<unsigned int>(begin + queue->block, profiles.n_cols);
+
+		// the first point of a block starts from the caller's solution
+		seed = dpf_warm();
+		if (queue->warm != NULL)
+		{
+			seed = *queue->warm;
+		}
+		try
+		{
+			for (unsigned int t = begin; t < end; t++)
+			{
+				for (unsigned int i = 0; i < base.n_rows; i++)
+				{
+					double scale = profiles(feeder ? 0 : i, t);
+					Sld(i, 0) = scale * base(i, 0);
+					Sld(i, 1) = scale * base(i, 1);
+					Sld(i, 2) = scale * base(i, 2);
+				}
+				bool converged;
+				point.iterations = DPF_sweep(*queue->plan, Sld, queue->V0, EPS, MXITR,
+					seed.valid ? &seed : NULL, V, Ib, IL, converged);
+				point.converged = converged;
+				summarize(*queue->plan, V, Ib, IL, point);
+				if (converged)
+				{
+					seed.valid = true;
+					seed.V = V;
+					seed.Ib0 = Ib.row(0);
+				}
+				boost::mutex::scoped_lock guard(queue->lock);
+				queue->sink->point(t, point, V);
+			}
+		}
+		catch (std::exception& e)
+		{
+			boost::mutex::scoped_lock guard(queue->lock);
+			if (queue->error.empty())
+			{
+				queue->error = "VVC time series power flow at point "
+					+ boost::lexical_cast<std::string>(begin) + ": " + e.what();
+			}
+			return;
+		}
+	}
+}
+
+}
+
+void DPF_series(const arma::mat& Dl, const arma::mat& profiles, const dpf_plan& plan,
+	const dpf_warm* warm, unsigned int threads, unsigned int block, dpf_series_sink& sink)
+{
+	if (profiles.n_rows != 1 && profiles.n_rows != Dl.n_rows)
+	{
+		throw std::runtime_error("VVC time series needs one profile row per Dl row or one for the feeder, got "
+			+ boost::lexical_cast<std::string>(profiles.n_rows));
+	}
+
+	// the loads of the base case in p.u., scaled by each time point
+	arma::cx_mat Sld(Dl.n_rows, 3);
+	for (unsigned int i = 0; i < Dl.n_rows; i++)
+	{
+		Sld(i, 0) = arma::cx_double(Dl(i, 6), Dl(i, 7)) / (BKVA / 3);
+		Sld(i, 1) = arma::cx_double(Dl(i, 8), Dl(i, 9)) / (BKVA / 3);
+		Sld(i, 2) = arma::cx_double(Dl(i, 10), Dl(i, 11)) / (BKVA / 3);
+	}
+
+	dpf_series_queue queue;
+	queue.block = std::max(block, 1u);
+	unsigned int blocks = (profiles.n_cols + queue.block - 1) / queue.block;
+	unsigned int workers = std::min(threads, blocks);
+	// the blocks already keep the threads busy, so each one is swept in order
+	dpf_plan serial = plan;
+	serial.threads = 1;
+
+	double vo = 12.47 * 1.015 / BKV;
+	queue.V0 = arma::cx_mat(1, 3);
+	queue.V0(0, 0) = arma::cx_double(vo, 0);
+	queue.V0(0, 1) = arma::cx_double((-0.5) * vo, (-0.5 * sqrt(3.0)) * vo);
+	queue.V0(0, 2) = arma::cx_double((-0.5) * vo, (0.5 * sqrt(3.0)) * vo);
+	if (plan.V0.n_elem == 3)
+	{
+		queue.V0 = plan.V0;
+	}
+	queue.Sld = &Sld;
+	queue.profiles = &profiles;
+	queue.plan = workers > 1 ? &serial : &plan;
+	queue.warm = warm != NULL && warm->valid ? warm : NULL;
+	queue.sink = &sink;
+	queue.next = 0;
+
+	if (workers > 1)
+	{
+		boost::thread_group pool;
+		for (unsigned int t = 0; t < workers; t++)
+		{
+			pool.create_thread(boost::bind(&dpf_series_worker, &queue));
+		}
+		pool.join_all();
+	}
+	else
+	{
+		dpf_series_worker(&queue);
+	}
+
+	if (!queue.error.empty())
+	{
+		throw std::runtime_error(queue.error);
+	}
+}
@@ -0,0 +1,525 @@
+# include <armadillo>
+# include <algorithm>
+# include <cmath>
+# include <map>
+# include <vector>
+# include <boost/bind.hpp>
+# include <boost/thread/barrier.hpp>
+# include <boost/thread/thread.hpp>
+# include "fun_return.h"
+
+// Structure-of-arrays backward/forward sweep used by DPF_return7.
+// DPF_plan flattens the topology of Dl and the line impedances of Z into
+// index and coefficient arrays once; DPF_sweep then iterates on plain
+// double arrays (one contiguous real and one imaginary array per phase)
+// without allocating any per-node temporaries.
+//
+// The rows of Dl between two empty rows form a lateral, which only meets the
+// rest of the feeder at the bus it hangs from. With plan.threads above one,
+// the laterals at the same depth are swept on different threads: the
+// backward sweep goes from the deepest laterals up, each one adding the
+// currents of the laterals below it, and the forward sweep goes down, a
+// lateral starting from the voltage of its junction. The threads meet at a
+// barrier after each depth.
+
+namespace {
+
+// feeders with fewer branches are swept in order, the barriers cost more
+const int PARALLEL_SWEEP_MIN_BRANCHES = 256;
+
+// finds the laterals of the feeder and orders them by depth; leaves them
+// empty when a branch is fed from a bus the laterals cannot order
+void dpf_laterals(const arma::mat& Dl, const std::vector<int>& fwd_row, dpf_plan& plan)
+{
+	const int nf = fwd_row.size();
+	if (nf == 0 || Dl(fwd_row[0], 0) == 0)
+		return;
+
+	std::vector<int> begin, junction, level;
+	std::vector<int> node(nf), lateral(nf);
+	std::map<int, int> owner;	// bus -> forward step that feeds it
+	for (int f = 0; f < nf; f++)
+	{
+		int m = fwd_row[f];
+		if (f == 0 || m != fwd_row[f - 1] + 1)
+		{
+			// an empty row before the branch starts a new lateral
+			int parent = 0;
+			if (f > 0)
+			{
+				std::map<int, int>::const_iterator it = owner.find((int)Dl(m, 1));
+				if (it == owner.end())
+					return;
+				parent = lateral[it->second];
+			}
+			begin.push_back(f);
+			junction.push_back(f == 0 ? 0 : (int)Dl(m, 1));
+			level.push_back(f == 0 ? 0 : level[parent] + 1);
+		}
+		int r = begin.size() - 1;
+		// within a lateral a branch is fed from the lateral or from above it
+		if (f > 0 && plan.fwd_src[f] != junction[r])
+		{
+			std::map<int, int>::const_iterator it = owner.find(plan.fwd_src[f]);
+			if (it == owner.end() || (lateral[it->second] != r && level[lateral[it->second]] >= level[r]))
+				return;
+		}
+		node[f] = (int)Dl(m, 2);
+		lateral[f] = r;
+		owner[node[f]] = f;
+	}
+	const int nr = begin.size();
+	if (nr < 2)
+		return;
+
+	int depth = *std::max_element(level.begin(), level.end()) + 1;
+	std::vector<int> child_begin(nr + 1, 0), level_begin(depth + 1, 0);
+	for (int r = 1; r < nr; r++)
+		child_begin[lateral[owner[junction[r]]] + 1]++;
+	for (int r = 0; r < nr; r++)
+	{
+		child_begin[r + 1] += child_begin[r];
+		level_begin[level[r] + 1]++;
+	}
+	for (int d = 0; d < depth; d++)
+		level_begin[d + 1] += level_begin[d];
+
+	std::vector<int> child(nr - 1), order(nr);
+	std::vector<int> next_child(child_begin.begin(), child_begin.end() - 1);
+	std::vector<int> next_order(level_begin.begin(), level_begin.end() - 1);
+	for (int r = 0; r < nr; r++)
+	{
+		if (r > 0)
+			child[next_child[lateral[owner[junction[r]]]]++] = r;
+		order[next_order[level[r]]++] = r;
+	}
+
+	begin.push_back(nf);
+	plan.lat_begin = begin;
+	plan.lat_node = node;
+	plan.lat_junction = junction;
+	plan.lat_child_begin = child_begin;
+	plan.lat_child = child;
+	plan.level_begin = level_begin;
+	plan.lat_order = order;
+}
+
+// one backward/forward sweep shared by the threads that run its laterals
+struct dpf_lateral_sweep
+{
+	const dpf_plan* plan;
+	int nb, mxitr;
+	double eps;
+	unsigned int threads;
+	boost::barrier* barrier;
+	double *vr, *vi, *ibr, *ibi, *ilr, *ili;
+	const double *sr, *si;
+	double ibo_r[3], ibo_i[3];
+	int itr;
+	bool converged;
+
+	// branch currents of a lateral, after the laterals below it are done
+	void backward(int r)
+	{
+		const dpf_plan& p = *plan;
+		for (int a = 0; a < 3; a++)
+		{
+			double* pibr = ibr + a * nb;
+			double* pibi = ibi + a * nb;
+			const double* pilr = ilr + a * nb;
+			const double* pili = ili + a * nb;
+			for (int s = p.lat_begin[r]; s < p.lat_begin[r + 1]; s++)
+			{
+				pibr[p.lat_node[s] - 1] = 0;
+				pibi[p.lat_node[s] - 1] = 0;
+			}
+			for (int c = p.lat_child_begin[r]; c < p.lat_child_begin[r + 1]; c++)
+			{
+				int l = p.lat_child[c];
+				int top = p.lat_node[p.lat_begin[l]] - 1;
+				pibr[p.lat_junction[l] - 1] += pibr[top];
+				pibi[p.lat_junction[l] - 1] += pibi[top];
+			}
+			double cr = 0, ci = 0;
+			for (int s = p.lat_begin[r + 1] - 1; s >= p.lat_begin[r]; s--)
+			{
+				int n = p.lat_node[s] - 1;
+				pibr[n] += cr + pilr[n];
+				pibi[n] += ci + pili[n];
+				cr = pibr[n];
+				ci = pibi[n];
+			}
+		}
+	}
+
+	// bus voltages of a lateral, after the lateral above it is done
+	void forward(int r)
+	{
+		const dpf_plan& p = *plan;
+		for (int f = p.lat_begin[r]; f < p.lat_begin[r + 1]; f++)
+		{
+			int src = p.fwd_src[f];
+			int rcv = p.fwd_rcv[f];
+			int k = rcv - 1;
+			const double* zr = &p.fwd_zr[9 * f];
+			const double* zi = &p.fwd_zi[9 * f];
+			double rvr[3], rvi[3];
+			for (int b = 0; b < 3; b++)
+			{
+				double accr = 0, acci = 0;
+				for (int a = 0; a < 3; a++)
+				{
+					double br = ibr[a * nb + k];
+					double bi = ibi[a * nb + k];
+					accr += br * zr[3 * a + b] - bi * zi[3 * a + b];
+					acci += br * zi[3 * a + b] + bi * zr[3 * a + b];
+				}
+				rvr[b] = vr[b * nb + src] - accr;
+				rvi[b] = vi[b * nb + src] - acci;
+			}
+			for (int b = 0; b < 3; b++)
+			{
+				bool on = p.fwd_mask[3 * f + b] != 0;
+				vr[b * nb + rcv] = on ? rvr[b] : 0.0;
+				vi[b * nb + rcv] = on ? rvi[b] : 0.0;
+			}
+		}
+	}
+
+	// the share of the sweep of thread t
+	void run(unsigned int t)
+	{
+		const dpf_plan& p = *plan;
+		const int nl = p.load_row.size();
+		const int depth = p.level_begin.size() - 1;
+		for (int i = 0; i < mxitr; i++)
+		{
+			for (int l = t; l < nl; l += threads)
+			{
+				int n = p.load_node[l];
+				for (int a = 0; a < 3; a++)
+				{
+					double pvr = vr[a * nb + n], pvi = vi[a * nb + n];
+					double d = pvr * pvr + pvi * pvi;
+					double inv = (d == 0) ? 0.0 : 1.0 / d;
+					ilr[a * nb + n - 1] = (sr[a * nl + l] * pvr + si[a * nl + l] * pvi) * inv;
+					ili[a * nb + n - 1] = (sr[a * nl + l] * pvi - si[a * nl + l] * pvr) * inv;
+				}
+			}
+			barrier->wait();
+			for (int d = depth - 1; d >= 0; d--)
+			{
+				for (int k = p.level_begin[d] + t; k < p.level_begin[d + 1]; k += threads)
+					backward(p.lat_order[k]);
+				barrier->wait();
+			}
+			for (int d = 0; d < depth; d++)
+			{
+				for (int k = p.level_begin[d] + t; k < p.level_begin[d + 1]; k += threads)
+					forward(p.lat_order[k]);
+				barrier->wait();
+			}
+			if (t == 0)
+			{
+				//check for convergence on the substation branch current
+				double errmx = 0;
+				for (int a = 0; a < 3; a++)
+				{
+					double dr = ibr[a * nb] - ibo_r[a];
+					double di = ibi[a * nb] - ibo_i[a];
+					errmx = std::max(errmx, sqrt(dr * dr + di * di));
+					ibo_r[a] = ibr[a * nb];
+					ibo_i[a] = ibi[a * nb];
+				}
+				itr = i + 1;
+				converged = errmx < eps;
+			}
+			barrier->wait();
+			if (converged)
+				break;
+		}
+	}
+};
+
+// number of threads worth starting for the sweep of a plan
+unsigned int dpf_sweep_threads(const dpf_plan& plan)
+{
+	if (plan.threads < 2 || plan.lat_order.empty() || (int)plan.fwd_src.size() < PARALLEL_SWEEP_MIN_BRANCHES)
+		return 1;
+	int widest = 0;
+	for (unsigned int d = 0; d + 1 < plan.level_begin.size(); d++)
+		widest = std::max(widest, plan.level_begin[d + 1] - plan.level_begin[d]);
+	return std::min<unsigned int>(plan.threads, widest);
+}
+
+}
+
+dpf_plan DPF_plan(const arma::mat& Dl, const arma::cx_mat& Z, double bkva, double bkv)
+{
+	dpf_plan plan;
+	double Zb = 1000 * pow(bkv, 2) / bkva;
+	int Nl = Dl.n_rows;
+
+	int cnt_nodes = 0;
+	int max_node = 0;
+	for (int i = 0; i < Nl; ++i)
+	{
+		if ((int)Dl(i, 0) != 0)
+			cnt_nodes = cnt_nodes + 1;
+		max_node = std::max(max_node, (int)Dl(i, 1));
+		max_node = std::max(max_node, (int)Dl(i, 2));
+	}
+	plan.cnt_nodes = cnt_nodes + 1;//No of nodes= No of branches +1
+	plan.n_bus = std::max(std::max(Nl, plan.cnt_nodes), max_node + 1);
+
+	// loads are attached to the receiving bus of their branch
+	for (int j = 0; j < Nl; j++)
+	{
+		if (Dl(j, 0) > 0)
+		{
+			plan.load_row.push_back(j);
+			plan.load_node.push_back((int)Dl(j, 2));
+		}
+	}
+
+	// backward sweep in reverse branch order; an empty row closes a lateral
+	// and hands the accumulated current to the lateral's source bus
+	for (int m = Nl - 1; m >= 0; m--)
+	{
+		if (Dl(m, 0) == 0)
+		{
+			if (m + 1 < Nl)
+			{
+				plan.bwd_node.push_back((int)Dl(m + 1, 1));
+				plan.bwd_flush.push_back(1);
+			}
+		}
+		else
+		{
+			plan.bwd_node.push_back((int)Dl(m, 2));
+			plan.bwd_flush.push_back(0);
+		}
+	}
+
+	// forward sweep in branch order; the first branch always feeds bus 1
+	// from the substation
+	std::vector<int> fwd_row;
+	for (int m = 0; m < Nl; m++)
+	{
+		if (m > 0 && Dl(m, 0) == 0)
+			continue;
+		fwd_row.push_back(m);
+		int lpt = 3 * ((int)Dl(m, 3) - 1);
+		// a line is always 3x3, so its block lives on the stack
+		arma::cx_mat::fixed<3, 3> Zl = Z(arma::span(lpt, lpt + 2), arma::span(0, 2)) / Zb;
+		double lng = Dl(m, 4);
+		int rcv = (m == 0) ? 1 : (int)Dl(m, 2);
+		plan.fwd_src.push_back((m == 0) ? 0 : (int)Dl(m, 1));
+		plan.fwd_rcv.push_back(rcv);
+		for (int a = 0; a < 3; a++)
+		{
+			for (int b = 0; b < 3; b++)
+			{
+				plan.fwd_zr.push_back(lng * std::real(Zl(a, b)));
+				plan.fwd_zi.push_back(lng * std::imag(Zl(a, b)));
+			}
+			plan.fwd_mask.push_back((m == 0 || std::abs(Zl(a, a)) != 0) ? 1 : 0);
+		}
+	}
+	dpf_laterals(Dl, fwd_row, plan);
+	return plan;
+}
+
+int DPF_sweep(const dpf_plan& plan, const arma::cx_mat& Sld, const arma::cx_mat& V0, double eps, int mxitr,
+	const dpf_warm* warm, arma::cx_mat& V, arma::cx_mat& Ib, arma::cx_mat& IL, bool& converged)
+{
+	const int nb = plan.n_bus;
+	const int nl = plan.load_row.size();
+	const int ns = plan.bwd_node.size();
+	const int nf = plan.fwd_src.size();
+
+	// phase a of bus k lives at [a * nb + k]
+	std::vector<double> vr(3 * nb), vi(3 * nb);
+	std::vector<double> ibr(3 * nb), ibi(3 * nb);
+	std::vector<double> ilr(3 * nb), ili(3 * nb);
+	std::vector<double> sr(3 * nl), si(3 * nl);
+	for (int a = 0; a < 3; a++)
+	{
+		std::fill(vr.begin() + a * nb, vr.begin() + (a + 1) * nb, std::real(V0(0, a)));
+		std::fill(vi.begin() + a * nb, vi.begin() + (a + 1) * nb, std::imag(V0(0, a)));
+		for (int l = 0; l < nl; l++)
+		{
+			sr[a * nl + l] = std::real(Sld(plan.load_row[l], a));
+			si[a * nl + l] = std::imag(Sld(plan.load_row[l], a));
+		}
+	}
+
+	double ibo_r[3] = { 0, 0, 0 };
+	double ibo_i[3] = { 0, 0, 0 };
+
+	// start from the previous solution when one exists for this plan, so a
+	// small load change converges in a sweep or two
+	if (warm != NULL && warm->valid && (int)warm->V.n_rows == nb && warm->Ib0.n_cols == 3)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			for (int k = 0; k < nb; k++)
+			{
+				vr[a * nb + k] = std::real(warm->V(k, a));
+				vi[a * nb + k] = std::imag(warm->V(k, a));
+			}
+			ibo_r[a] = std::real(warm->Ib0(0, a));
+			ibo_i[a] = std::imag(warm->Ib0(0, a));
+		}
+	}
+	int itr = 0;
+	converged = false;
+	unsigned int threads = dpf_sweep_threads(plan);
+	if (threads > 1)
+	{
+		boost::barrier barrier(threads);
+		dpf_lateral_sweep sweep;
+		sweep.plan = &plan;
+		sweep.nb = nb;
+		sweep.mxitr = mxitr;
+		sweep.eps = eps;
+		sweep.threads = threads;
+		sweep.barrier = &barrier;
+		sweep.vr = &vr[0];
+		sweep.vi = &vi[0];
+		sweep.ibr = &ibr[0];
+		sweep.ibi = &ibi[0];
+		sweep.ilr = &ilr[0];
+		sweep.ili = &ili[0];
+		sweep.sr = sr.empty() ? NULL : &sr[0];
+		sweep.si = si.empty() ? NULL : &si[0];
+		std::copy(ibo_r, ibo_r + 3, sweep.ibo_r);
+		std::copy(ibo_i, ibo_i + 3, sweep.ibo_i);
+		sweep.itr = 0;
+		sweep.converged = false;
+		boost::thread_group pool;
+		for (unsigned int t = 1; t < threads; t++)
+		{
+			pool.create_thread(boost::bind(&dpf_lateral_sweep::run, &sweep, t));
+		}
+		sweep.run(0);
+		pool.join_all();
+		itr = sweep.itr;
+		converged = sweep.converged;
+	}
+	for (int i = 0; threads == 1 && i < mxitr && !converged; i++)
+	{
+		itr = i + 1;
+		for (int a = 0; a < 3; a++)
+		{
+			const double* pvr = &vr[a * nb];
+			const double* pvi = &vi[a * nb];
+			double* pilr = &ilr[a * nb];
+			double* pili = &ili[a * nb];
+			double* pibr = &ibr[a * nb];
+			double* pibi = &ibi[a * nb];
+			const double* psr = &sr[a * nl];
+			const double* psi = &si[a * nl];
+
+			// load currents conj(S / V), independent for every load
+			std::fill(pilr, pilr + nb, 0.0);
+			std::fill(pili, pili + nb, 0.0);
+			for (int l = 0; l < nl; l++)
+			{
+				int n = plan.load_node[l];
+				double d = pvr[n] * pvr[n] + pvi[n] * pvi[n];
+				double inv = (d == 0) ? 0.0 : 1.0 / d;
+				pilr[n - 1] = (psr[l] * pvr[n] + psi[l] * pvi[n]) * inv;
+				pili[n - 1] = (psr[l] * pvi[n] - psi[l] * pvr[n]) * inv;
+			}
+
+			// branch currents, accumulated from the feeder ends
+			std::fill(pibr, pibr + nb, 0.0);
+			std::fill(pibi, pibi + nb, 0.0);
+			double cr = 0, ci = 0;
+			for (int s = 0; s < ns; s++)
+			{
+				int n = plan.bwd_node[s] - 1;
+				if (plan.bwd_flush[s])
+				{
+					pibr[n] += cr;
+					pibi[n] += ci;
+					cr = 0;
+					ci = 0;
+				}
+				else
+				{
+					pibr[n] += cr + pilr[n];
+					pibi[n] += ci + pili[n];
+					cr = pibr[n];
+					ci = pibi[n];
+				}
+			}
+		}
+
+		// bus voltages from the substation outwards; the phases are
+		// coupled through the mutual impedances
+		for (int f = 0; f < nf; f++)
+		{
+			int src = plan.fwd_src[f];
+			int rcv = plan.fwd_rcv[f];
+			int k = rcv - 1;
+			const double* zr = &plan.fwd_zr[9 * f];
+			const double* zi = &plan.fwd_zi[9 * f];
+			double rvr[3], rvi[3];
+			for (int b = 0; b < 3; b++)
+			{
+				double accr = 0, acci = 0;
+				for (int a = 0; a < 3; a++)
+				{
+					double br = ibr[a * nb + k];
+					double bi = ibi[a * nb + k];
+					accr += br * zr[3 * a + b] - bi * zi[3 * a + b];
+					acci += br * zi[3 * a + b] + bi * zr[3 * a + b];
+				}
+				rvr[b] = vr[b * nb + src] - accr;
+				rvi[b] = vi[b * nb + src] - acci;
+			}
+			for (int b = 0; b < 3; b++)
+			{
+				bool on = plan.fwd_mask[3 * f + b] != 0;
+				vr[b * nb + rcv] = on ? rvr[b] : 0.0;
+				vi[b * nb + rcv] = on ? rvi[b] : 0.0;
+			}
+		}
+
+		//check for convergence on the substation branch current
+		double errmx = 0;
+		for (int a = 0; a < 3; a++)
+		{
+			double dr = ibr[a * nb] - ibo_r[a];
+			double di = ibi[a * nb] - ibo_i[a];
+			errmx = std::max(errmx, sqrt(dr * dr + di * di));
+			ibo_r[a] = ibr[a * nb];
+			ibo_i[a] = ibi[a * nb];
+		}
+		converged = errmx < eps;
+	}
+
+	// hand the results back in the layout DPF_return7 formats
+	const int nc = plan.cnt_nodes;
+	V = arma::cx_mat(arma::zeros(nb, 3), arma::zeros(nb, 3));
+	Ib = arma::cx_mat(arma::zeros(nc - 1, 3), arma::zeros(nc - 1, 3));
+	IL = arma::cx_mat(arma::zeros(nc, 3), arma::zeros(nc, 3));
+	for (int a = 0; a < 3; a++)
+	{
+		for (int k = 0; k < nb; k++)
+		{
+			V(k, a) = arma::cx_double(vr[a * nb + k], vi[a * nb + k]);
+		}
+		for (int k = 0; k < nc - 1 && k < nb; k++)
+		{
+			Ib(k, a) = arma::cx_double(ibr[a * nb + k], ibi[a * nb + k]);
+		}
+		for (int k = 0; k < nc && k < nb; k++)
+		{
+			IL(k, a) = arma::cx_double(ilr[a * nb + k], ili[a * nb + k]);
+		}
+	}
+	return itr;
+}
@@ -4,17 +4,26 @@
 #include <iostream>
 #include <fstream>
 #include "CLogger.hpp"
+#include "CMetrics.hpp"
 #include "Messages.hpp"
 #include "CTimings.hpp"
 #include "CDeviceManager.hpp"
 #include "CGlobalPeerList.hpp"
+#include "FreedmExceptions.hpp"
 #include "gm/GroupManagement.hpp"
 #include "CGlobalConfiguration.hpp"
+#include "CWarmState.hpp"
 #include "device/COpenDssAdapter.hpp"
 #include <sstream>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <vector>
 
 #include <boost/foreach.hpp>
 #include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/asio/error.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/range/adaptor/map.hpp>
@@ -32,6 +41,170 @@ namespace vvc {
 namespace {
 /// This file's logger.
 CLocalLogger Logger(__FILE__);
+
+/// Rounds of the volt-var optimization
+CCounter& RoundsMetric = CMetrics::Instance().GetCounter(
+    "dgi_vvc_rounds_total", "Rounds of the volt-var optimization");
+
+/// Times spent in the volt-var optimization of a round
+CHistogram& RoundMetric = CMetrics::Instance().GetHistogram(
+    "dgi_vvc_round_seconds", "Times spent in the volt-var optimization of a round");
+
+/// Rounds skipped because the feeder was quiet
+CCounter& SkippedMetric = CMetrics::Instance().GetCounter(
+    "dgi_vvc_rounds_skipped_total",
+    "Rounds of the volt-var optimization skipped on a quiet feeder");
+
+/// Distance in p.u. a quiet feeder keeps from its voltage bounds
+const double QUIET_VOLTAGE_MARGIN = 0.005;
+
+/// Relative error of a single precision lambda that is reported as a warning
+const double SINGLE_PRECISION_TOLERANCE = 1e-3;
+
+/// First and last load column of the feeder model
+const unsigned int FIRST_LOAD_COLUMN = 6;
+const unsigned int LAST_LOAD_COLUMN = 11;
+
+/// Reactive set point column of the feeder model for phases a, b and c
+const unsigned int REACTIVE_COLUMNS[3] = { 7, 9, 11 };
+
+/// Device types of the SSTs of phases a, b and c
+const char* const SST_TYPES[3] = { "Sst_a", "Sst_b", "Sst_c" };
+
+/// Rows of the built-in feeder model SST1 to SST7 set, as vvc_main reads them
+const unsigned int SST_ROWS[] = { 1, 2, 3, 4, 8, 7, 6 };
+
+/// Rounds a float to the nearest IEEE 754 half precision float
+boost::uint16_t ToHalf(float value)
+{
+    boost::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    boost::uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    boost::uint32_t mantissa = bits & 0x7fffff;
+
+    if(((bits >> 23) & 0xff) == 0xff)
+    {
+        // infinity stays infinity and NaN stays NaN
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    if(exponent >= 31)
+    {
+        return sign | 0x7c00;
+    }
+    if(exponent <= 0)
+    {
+        if(exponent < -10)
+        {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        boost::uint16_t half = mantissa >> shift;
+        if((mantissa >> (shift - 1)) & 1)
+        {
+            half++;
+        }
+        return sign | half;
+    }
+    // a carry out of the mantissa correctly bumps the exponent
+    boost::uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if(mantissa & 0x1000)
+    {
+        half++;
+    }
+    return half;
+}
+
+/// Widens an IEEE 754 half precision float
+float FromHalf(boost::uint16_t half)
+{
+    boost::uint32_t sign = static_cast<boost::uint32_t>(half & 0x8000) << 16;
+    boost::uint32_t exponent = (half >> 10) & 0x1f;
+    boost::uint32_t mantissa = half & 0x3ff;
+    boost::uint32_t bits;
+
+    if(exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if(exponent == 0)
+    {
+        float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/// Reads the gradient of a message in either of its encodings
+std::vector<double> GradientValues(const GradientMessage & m)
+{
+    if(!m.has_gradient_half())
+    {
+        return std::vector<double>(m.gradient_value().begin(), m.gradient_value().end());
+    }
+    const std::string& blob = m.gradient_half();
+    std::vector<double> values(blob.size() / 2);
+    for(unsigned int i = 0; i < values.size(); i++)
+    {
+        boost::uint16_t half = static_cast<unsigned char>(blob[2*i])
+            | (static_cast<unsigned char>(blob[2*i+1]) << 8);
+        values[i] = FromHalf(half);
+    }
+    return values;
+}
+
+/// Copies a converged power flow solution into a warm state message
+WarmVoltVar SaveSolution(const dpf_warm& warm)
+{
+    WarmVoltVar vvc;
+    vvc.set_rows(warm.V.n_rows);
+    vvc.set_cols(warm.V.n_cols);
+    for(unsigned int i = 0; i < warm.V.n_elem; i++)
+    {
+        vvc.add_voltage_real(std::real(warm.V(i)));
+        vvc.add_voltage_imag(std::imag(warm.V(i)));
+    }
+    for(unsigned int i = 0; i < warm.Ib0.n_elem; i++)
+    {
+        vvc.add_current_real(std::real(warm.Ib0(i)));
+        vvc.add_current_imag(std::imag(warm.Ib0(i)));
+    }
+    return vvc;
+}
+
+/// Fills a power flow starting point from a warm state message, if complete
+bool ResumeSolution(const WarmVoltVar& vvc, dpf_warm& warm)
+{
+    unsigned int n = vvc.rows() * vvc.cols();
+    if(n == 0 || vvc.voltage_real_size() != static_cast<int>(n) ||
+        vvc.voltage_imag_size() != static_cast<int>(n) ||
+        vvc.current_real_size() != static_cast<int>(vvc.cols()) ||
+        vvc.current_imag_size() != static_cast<int>(vvc.cols()))
+    {
+        return false;
+    }
+    warm.V.set_size(vvc.rows(), vvc.cols());
+    for(unsigned int i = 0; i < n; i++)
+    {
+        warm.V(i) = arma::cx_double(vvc.voltage_real(i), vvc.voltage_imag(i));
+    }
+    warm.Ib0.set_size(1, vvc.cols());
+    for(unsigned int i = 0; i < vvc.cols(); i++)
+    {
+        warm.Ib0(i) = arma::cx_double(vvc.current_real(i), vvc.current_imag(i));
+    }
+    // DPF_sweep still checks the size against the feeder it solves
+    warm.valid = true;
+    return true;
+}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -44,18 +217,63 @@ CLocalLogger Logger(__FILE__);
 /// @limitations: None
 ///////////////////////////////////////////////////////////////////////////////
 VVCAgent::VVCAgent()
-    : ROUND_TIME(boost::posix_time::milliseconds(CTimings::Get("LB_ROUND_TIME")))
-    , REQUEST_TIMEOUT(boost::posix_time::milliseconds(CTimings::Get("LB_REQUEST_TIMEOUT")))
+    : ROUND_TIME(CTimings::GetDuration(CTimings::LB_ROUND_TIME))
+    , REQUEST_TIMEOUT(CTimings::GetDuration(CTimings::LB_REQUEST_TIMEOUT))
 {
 
-  Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+  LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
   m_RoundTimer = CBroker::Instance().AllocateTimer("vvc");
   m_WaitTimer = CBroker::Instance().AllocateTimer("vvc");
+  m_computing = false;
+  m_warmResumed = false;
+  m_quiet = false;
+  m_capabilityVersion = 1;
+
+  std::string model = CGlobalConfiguration::Instance().GetFeederModelPath();
+  if(model.empty())
+  {
+    m_sysinfo = load_system_data();
+  }
+  else
+  {
+    m_sysinfo = load_system_data(model, CGlobalConfiguration::Instance().GetFeederImpedancePath());
+    LOG_STATUS(Logger) << "Loaded feeder model " << model << " with "
+        << m_sysinfo.Dl.n_rows << " branches" << std::endl;
+  }
+
+  int bus = CGlobalConfiguration::Instance().GetVVCSegmentBus();
+  if(bus >= 0)
+  {
+    m_segment.reset(new CFeederSegment(bus, m_sysinfo.Dl));
+    LOG_STATUS(Logger) << "VVC solves the feeder segment below bus " << bus << std::endl;
+  }
+
+  if(CGlobalConfiguration::Instance().GetVVCOffload())
+  {
+    m_computeThread = boost::thread(boost::bind(&VVCAgent::RunCompute, this));
+    LOG_STATUS(Logger) << "VVC solves run on a separate compute thread" << std::endl;
+  }
 
+  m_dumpPath = CGlobalConfiguration::Instance().GetVVCDumpPath();
+  if(!m_dumpPath.empty())
+  {
+    m_dumpThread = boost::thread(boost::bind(&VVCAgent::RunDump, this));
+    LOG_STATUS(Logger) << "VVC feeder models are dumped to " << m_dumpPath << std::endl;
+  }
 }
 VVCAgent::~VVCAgent()
 {
+  if(m_computeThread.joinable())
+  {
+    m_computeService.stop();
+    m_computeThread.join();
+  }
+  if(m_dumpThread.joinable())
+  {
+    m_dumpService.stop();
+    m_dumpThread.join();
+  }
 }
 			
 ////////////////////////////////////////////////////////////
@@ -70,7 +288,7 @@ int VVCAgent::Run()
   std::cout<< " --------------------VVC ---------------------------------" << std::endl; 
   CBroker::Instance().Schedule("vvc",
       boost::bind(&VVCAgent::FirstRound, this, boost::system::error_code()));
-  Logger.Info << "VVC is scheduled for the next phase." << std::endl;
+  LOG_INFO(Logger) << "VVC is scheduled for the next phase." << std::endl;
   return 0;
 }
 
@@ -89,7 +307,7 @@ void VVCAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, C
 {
     if(m->has_volt_var_message())
     {
-        VoltVarMessage vvm = m->volt_var_message();
+        const VoltVarMessage& vvm = m->volt_var_message();
         if(vvm.has_voltage_delta_message())
         {
             HandleVoltageDelta(vvm.voltage_delta_message(), peer);
@@ -102,61 +320,104 @@ void VVCAgent::HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> m, C
         {
             HandleGradient(vvm.gradient_message(), peer);
         }
+        else if(vvm.has_segment_boundary_message())
+        {
+            HandleSegmentBoundary(vvm.segment_boundary_message(), peer);
+        }
         else
         {
-            Logger.Warn << "Dropped unexpected volt var message: \n" << m->DebugString();
+            LOG_WARN(Logger) << "Dropped unexpected volt var message: \n" << m->DebugString();
         }
     }
     else if(m->has_group_management_message())
     {
-        gm::GroupManagementMessage gmm = m->group_management_message();
+        const gm::GroupManagementMessage& gmm = m->group_management_message();
         if(gmm.has_peer_list_message())
         {
             HandlePeerList(gmm.peer_list_message(), peer);
         }
         else
         {
-            Logger.Warn << "Dropped unexpected group management message:\n" << m->DebugString();
+            LOG_WARN(Logger) << "Dropped unexpected group management message:\n" << m->DebugString();
         }
     }
     else
     {
-        Logger.Warn<<"Dropped message of unexpected type:\n" << m->DebugString();
+        LOG_WARN(Logger)<<"Dropped message of unexpected type:\n" << m->DebugString();
     }
 }
 
 void VVCAgent::HandleVoltageDelta(const VoltageDeltaMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Notice << "Got VoltageDelta from: " << peer.GetUUID() << std::endl;
-    Logger.Notice << "CF "<<m.control_factor()<<" Phase "<<m.phase_measurement()<<std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_NOTICE(Logger) << "Got VoltageDelta from: " << peer.GetUUID() << std::endl;
+    LOG_NOTICE(Logger) << "CF "<<m.control_factor()<<" Phase "<<m.phase_measurement()<<std::endl;
 }
 
 void VVCAgent::HandleLineReadings(const LineReadingsMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Notice << "Got Line Readings from "<< peer.GetUUID() << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_NOTICE(Logger) << "Got Line Readings from "<< peer.GetUUID() << std::endl;
 }
 
 void VVCAgent::HandleGradient(const GradientMessage & m, CPeerNode peer)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Notice << "Got Gradients from "<< peer.GetUUID() << std::endl;
-    Logger.Notice << "size of vector "<< m.gradient_value_size() << std::endl;
-    Logger.Notice << "the 1st element = " << m.gradient_value(0) <<std::endl;
-    
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+    LOG_NOTICE(Logger) << "Got Gradients from "<< peer.GetUUID() << std::endl;
+    std::vector<double> gradient = GradientValues(m);
+    LOG_NOTICE(Logger) << "size of vector "<< gradient.size() << std::endl;
+    if(!gradient.empty())
+    {
+        LOG_NOTICE(Logger) << "the 1st element = " << gradient[0] <<std::endl;
+    }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// HandleSegmentBoundary
+/// @description Records the boundary bus and power of a neighboring feeder
+///     segment, and the voltage of our boundary bus when the neighbor is the
+///     segment we are fed from.
+/// @pre None
+/// @post The next round of this segment uses the neighbor's values.
+/// @param m the boundary values of the neighbor
+/// @param peer the DGI that solves the neighboring segment
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::HandleSegmentBoundary(const SegmentBoundaryMessage & m, CPeerNode peer)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_segment)
+    {
+        LOG_NOTICE(Logger) << "Dropped segment boundary from " << peer.GetUUID()
+            << " while solving the whole feeder" << std::endl;
+        return;
+    }
+
+    CFeederSegment::PhaseValues power(m.root_power().begin(), m.root_power().end());
+    m_segment->NoteNeighbor(peer.GetUUID(), m.root_bus(), power);
+
+    if(m.has_feed_bus() && m.feed_bus() == m_segment->GetRoot())
+    {
+        CFeederSegment::PhaseValues voltage(m.feed_voltage().begin(), m.feed_voltage().end());
+        m_segment->SetSource(voltage);
+    }
+}
 
 // HandlePeerlist Implementation
 void VVCAgent::HandlePeerList(const gm::PeerListMessage & m, CPeerNode peer)
 {
-	Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-	Logger.Notice << "Updated Peer List Received from: " << peer.GetUUID() << std::endl;
-	
-	m_peers.clear();
+	LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+	LOG_NOTICE(Logger) << "Updated Peer List Received from: " << peer.GetUUID() << std::endl;
 	
-	m_peers = gm::GMAgent::ProcessPeerList(m);
+	gm::MembershipSnapshot next =
+	    gm::GMAgent::UpdateMembership(m_peers, m, peer.GetUUID());
+	if(!next)
+	{
+	    peer.Send(gm::GMAgent::PeerListQuery("vvc"));
+	    return;
+	}
+	// Refers to the shared membership instead of copying it
+	m_peers = next;
 	m_leader = peer.GetUUID();
 }
 
@@ -174,8 +435,9 @@ ModuleMessage VVCAgent::VoltageDelta(unsigned int cf, float pm, std::string loc)
 ModuleMessage VVCAgent::LineReadings(std::vector<float> vals)
 {
 	VoltVarMessage vvm;
-	std::vector<float>::iterator it;
 	LineReadingsMessage *lrm = vvm.mutable_line_readings_message();
+	lrm->mutable_measurement()->Reserve(vals.size());
+	std::vector<float>::iterator it;
 	for (it = vals.begin(); it != vals.end(); it++)
 	{
 		lrm -> add_measurement(*it);
@@ -188,19 +450,56 @@ ModuleMessage VVCAgent::Gradient(arma::mat grad)
 {
 	VoltVarMessage vvm;
 	unsigned int idx;
-        GradientMessage *grdm = vvm.mutable_gradient_message();
-	for (idx = 0; idx < grad.n_rows; idx++)
+	GradientMessage *grdm = vvm.mutable_gradient_message();
+	if (CGlobalConfiguration::Instance().GetVVCHalfGradients())
+	{
+		// two bytes per node instead of the eight of a packed double
+		std::string blob(2 * grad.n_rows, '\0');
+		for (idx = 0; idx < grad.n_rows; idx++)
+		{
+			boost::uint16_t half = ToHalf(static_cast<float>(grad(idx)));
+			blob[2*idx] = static_cast<char>(half & 0xff);
+			blob[2*idx+1] = static_cast<char>(half >> 8);
+		}
+		grdm->set_gradient_half(blob);
+	}
+	else
 	{
-		grdm -> add_gradient_value(grad(idx));
+		grdm->mutable_gradient_value()->Reserve(grad.n_rows);
+		for (idx = 0; idx < grad.n_rows; idx++)
+		{
+			grdm -> add_gradient_value(grad(idx));
+		}
 	}
 	grdm->set_gradient_capture_time(boost::posix_time::to_simple_string(boost::posix_time::microsec_clock::universal_time()));
 	return PrepareForSending(vvm,"vvc");
 }
 
+ModuleMessage VVCAgent::SegmentBoundary(const std::string& uuid)
+{
+	VoltVarMessage vvm;
+	SegmentBoundaryMessage *sbm = vvm.mutable_segment_boundary_message();
+	sbm->set_root_bus(m_segment->GetRoot());
+	BOOST_FOREACH(double p, m_segment->GetPower())
+	{
+		sbm->add_root_power(p);
+	}
+	unsigned int bus;
+	CFeederSegment::PhaseValues voltage;
+	if(m_segment->GetFeed(uuid, bus, voltage))
+	{
+		sbm->set_feed_bus(bus);
+		BOOST_FOREACH(double v, voltage)
+		{
+			sbm->add_feed_voltage(v);
+		}
+	}
+	return PrepareForSending(vvm,"vvc");
+}
 
 ModuleMessage VVCAgent::PrepareForSending(const VoltVarMessage& message, std::string recipient)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
     ModuleMessage mm;
     mm.mutable_volt_var_message()->CopyFrom(message);
     mm.set_recipient_module(recipient);
@@ -218,7 +517,7 @@ ModuleMessage VVCAgent::PrepareForSending(const VoltVarMessage& message, std::st
 ///////////////////////////////////////////////////////////////////////////////
 void VVCAgent::FirstRound(const boost::system::error_code& err)
 {
-  Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+  LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
   
   if(!err)
   {
@@ -227,11 +526,11 @@ void VVCAgent::FirstRound(const boost::system::error_code& err)
   }
   else if(err == boost::asio::error::operation_aborted)
   {
-    Logger.Notice << "VVCManage Aborted" << std::endl;
+    LOG_NOTICE(Logger) << "VVCManage Aborted" << std::endl;
   }
   else
   {
-    Logger.Error << err << std::endl;
+    LOG_ERROR(Logger) << err << std::endl;
     throw boost::system::system_error(err);
   }
 			
@@ -248,24 +547,28 @@ void VVCAgent::FirstRound(const boost::system::error_code& err)
 /////////////////////////////////////////////////////////
 void VVCAgent::VVCManage(const boost::system::error_code& err)
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     if(!err)
     {
       ScheduleNextRound();
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      // the set points are timed from the oldest reading behind them
+      device::CControlLoop::CScope scope("vvc");
       ReadDevices();
       vvc_main();
-     
-      
+      RoundsMetric.Increment();
+      RoundMetric.Observe((boost::posix_time::microsec_clock::universal_time()
+          - start).total_microseconds() / 1e6);
     }
         
     else if(err == boost::asio::error::operation_aborted)
     {
-        Logger.Notice << "VVCManage Aborted" << std::endl;
+        LOG_NOTICE(Logger) << "VVCManage Aborted" << std::endl;
     }
     else
     {
-        Logger.Error << err << std::endl;
+        LOG_ERROR(Logger) << err << std::endl;
         throw boost::system::system_error(err);
     }
 }
@@ -280,19 +583,23 @@ void VVCAgent::VVCManage(const boost::system::error_code& err)
 ///////////////////////////////////////////////////////////////////////////////
 void VVCAgent::ScheduleNextRound()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // the timings file may have been reloaded since the last round
+    ROUND_TIME = CTimings::GetDuration(CTimings::LB_ROUND_TIME);
+    REQUEST_TIMEOUT = CTimings::GetDuration(CTimings::LB_REQUEST_TIMEOUT);
 
     if(CBroker::Instance().TimeRemaining() > ROUND_TIME + ROUND_TIME)
     {
         CBroker::Instance().Schedule(m_RoundTimer, ROUND_TIME,
             boost::bind(&VVCAgent::VVCManage, this, boost::asio::placeholders::error));
-        Logger.Info << "VVCManage scheduled in " << ROUND_TIME << " ms." << std::endl;
+        LOG_INFO(Logger) << "VVCManage scheduled in " << ROUND_TIME << " ms." << std::endl;
     }
     else
     {
         CBroker::Instance().Schedule(m_RoundTimer, boost::posix_time::not_a_date_time,
             boost::bind(&VVCAgent::FirstRound, this, boost::asio::placeholders::error));
-        Logger.Info << "VVCManage scheduled for the next phase." << std::endl;
+        LOG_INFO(Logger) << "VVCManage scheduled for the next phase." << std::endl;
     }
 }
 
@@ -305,7 +612,7 @@ void VVCAgent::ScheduleNextRound()
 ///////////////////////////////////////////////////////////////////////////////
 void VVCAgent::ReadDevices()
 {
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
     float generation = device::CDeviceManager::Instance().GetNetValue("Drer", "generation");
     float storage = device::CDeviceManager::Instance().GetNetValue("Desd", "storage");
@@ -321,31 +628,243 @@ void VVCAgent::ReadDevices()
 
 
 
-void VVCAgent::vvc_main()
+///////////////////////////////////////////////////////////////////////////////
+/// ReadFidState
+/// @description Reads the state of every attached FID device.
+/// @pre None
+/// @post None
+/// @return A map from FID device identifier to its current state.
+///////////////////////////////////////////////////////////////////////////////
+CPhysicalTopology::FIDState VVCAgent::ReadFidState()
+{
+    CPhysicalTopology::FIDState fidstate;
+    std::set<device::CDevice::Pointer> attachedFIDs =
+        device::CDeviceManager::Instance().GetDevicesOfType("Fid");
+    BOOST_FOREACH(device::CDevice::Pointer ptr, attachedFIDs)
+    {
+        fidstate[ptr->GetID()] = ptr->GetState("state");
+    }
+    return fidstate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ReadCapabilities
+/// @description Reads the reactive limits of the SSTs that report them in
+///     their optional qmin and qmax states. The limits are kept by the node
+///     of the SST, so they hold for any feeder model that has the node.
+/// @pre None
+/// @post m_capability holds the reported limits. If one changed,
+///     m_capabilityVersion is bumped so the next solve fills them again.
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::ReadCapabilities()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const unsigned int count = sizeof(SST_ROWS) / sizeof(SST_ROWS[0]);
+    bool changed = false;
+
+    boost::mutex::scoped_lock lock(m_capabilityMutex);
+    for(int p = 0; p < 3; p++)
+    {
+        std::set<device::CDevice::Pointer> ssts =
+            device::CDeviceManager::Instance().GetDevicesOfType(SST_TYPES[p]);
+        BOOST_FOREACH(device::CDevice::Pointer sst, ssts)
+        {
+            if(!sst->HasState("qmin") && !sst->HasState("qmax"))
+            {
+                continue;
+            }
+            // the devices are named SST<n>_<phase>, like vvc_main reads them
+            unsigned int n = 0;
+            std::istringstream id(sst->GetID().substr(std::min<std::size_t>(3,
+                sst->GetID().size())));
+            if(!(id >> n) || n < 1 || n > count || SST_ROWS[n - 1] >= m_sysinfo.Dl.n_rows)
+            {
+                LOG_WARN(Logger) << "No feeder node for the limits of "
+                    << sst->GetID() << std::endl;
+                continue;
+            }
+            int node = static_cast<int>(m_sysinfo.Dl(SST_ROWS[n - 1], 2));
+            ReactiveLimit & limit = m_capability[std::make_pair(p, node)];
+            ReactiveLimit read = limit;
+            if(sst->HasState("qmin"))
+            {
+                read.qmin = sst->GetState("qmin");
+            }
+            if(sst->HasState("qmax"))
+            {
+                read.qmax = sst->GetState("qmax");
+            }
+            if(read.qmin != limit.qmin || read.qmax != limit.qmax)
+            {
+                LOG_DEBUG(Logger) << "Reactive limits of " << sst->GetID()
+                    << " are " << read.qmin << " to " << read.qmax << " kVar" << std::endl;
+                limit = read;
+                changed = true;
+            }
+        }
+    }
+    if(changed)
+    {
+        m_capabilityVersion++;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IsQuiet
+/// @description Checks whether the feeder is where the last solved round left
+///     it: that round found the voltages comfortably within their bounds, the
+///     FIDs and the source of the feeder are the same, and no load or set
+///     point has moved by more than the configured deadband.
+/// @pre None
+/// @post None
+/// @param Dl the feeder model with this round's device readings
+/// @param fids the FID states read with the devices
+/// @param source the voltage the feeder is fed from, empty for the substation
+/// @return true if the round can be skipped.
+///////////////////////////////////////////////////////////////////////////////
+bool VVCAgent::IsQuiet(const arma::mat& Dl, const CPhysicalTopology::FIDState& fids,
+    const arma::cx_mat& source) const
+{
+    const double deadband = CGlobalConfiguration::Instance().GetVVCSkipDeadband();
+    if(deadband <= 0 || !m_quiet || fids != m_quietFids
+        || Dl.n_rows != m_quietDl.n_rows || Dl.n_cols != m_quietDl.n_cols
+        || Dl.n_cols <= LAST_LOAD_COLUMN
+        || source.n_elem != m_quietSource.n_elem)
+    {
+        return false;
+    }
+    for(unsigned int i = 0; i < source.n_elem; i++)
+    {
+        if(source(i) != m_quietSource(i))
+        {
+            return false;
+        }
+    }
+    for(unsigned int c = FIRST_LOAD_COLUMN; c <= LAST_LOAD_COLUMN; c++)
+    {
+        for(unsigned int r = 0; r < Dl.n_rows; r++)
+        {
+            if(std::fabs(Dl(r, c) - m_quietDl(r, c)) > deadband)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// WithinBounds
+/// @description Checks the bus voltages of a power flow against the bounds
+///     of the feeder, leaving a small margin. A zero magnitude marks a phase
+///     the bus does not have.
+/// @pre None
+/// @post None
+/// @param flow the power flow of a solved round
+/// @return true if every voltage is comfortably within the bounds.
+///////////////////////////////////////////////////////////////////////////////
+bool VVCAgent::WithinBounds(const VPQ& flow) const
+{
+    if(flow.Vpolar.n_rows == 0 || flow.Vpolar.n_cols < 6)
+    {
+        return false;
+    }
+    for(unsigned int i = 0; i < flow.Vpolar.n_rows; i++)
+    {
+        for(unsigned int p = 0; p < 6; p += 2)
+        {
+            double v = flow.Vpolar(i, p);
+            if(v != 0 && (v < m_sysinfo.lb_v + QUIET_VOLTAGE_MARGIN
+                || v > m_sysinfo.ub_v - QUIET_VOLTAGE_MARGIN))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// SameNodes
+/// @description Compares two node lists element by element.
+/// @return true if both lists have the same size and contents.
+///////////////////////////////////////////////////////////////////////////////
+bool VVCAgent::SameNodes(const arma::mat& a, const arma::mat& b)
+{
+    return a.n_rows == b.n_rows && a.n_cols == b.n_cols &&
+        arma::accu(a != b) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TopologyChanged
+/// @description Checks whether the cached topology data is still valid for
+///     the given feeder model. The cache is keyed on the topology columns of
+///     Dl (branch, buses, line code, length, type), which load columns hold a
+///     load, the impedance table Z, and the state of the attached FIDs. The
+///     physical topology itself is only loaded once at startup, so the FIDs
+///     are the part of it that can change between rounds.
+/// @pre None
+/// @post None
+/// @param Dl the feeder model for this round
+/// @param Z the line impedance table for this round
+/// @param fids the FID states read with this round's devices
+/// @return true if BuildTopology must be called before the cache is used.
+///////////////////////////////////////////////////////////////////////////////
+bool VVCAgent::TopologyChanged(const arma::mat& Dl, const arma::cx_mat& Z,
+    const CPhysicalTopology::FIDState& fids)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!m_topo.valid)
+    {
+        return true;
+    }
+    arma::mat key = Dl.cols(0, 5);
+    arma::umat loads = join_rows(join_rows(Dl.col(6) != 0, Dl.col(8) != 0), Dl.col(10) != 0);
+    if(!SameNodes(key, m_topo.key) || loads.n_rows != m_topo.loads.n_rows ||
+        arma::accu(loads != m_topo.loads) != 0)
+    {
+        LOG_INFO(Logger) << "Feeder model changed, rebuilding VVC topology" << std::endl;
+        return true;
+    }
+    if(Z.n_rows != m_topo.Z.n_rows || Z.n_cols != m_topo.Z.n_cols ||
+        arma::accu(Z != m_topo.Z) != 0)
+    {
+        LOG_INFO(Logger) << "Impedance table changed, rebuilding VVC topology" << std::endl;
+        return true;
+    }
+    if(fids != m_topo.fids)
+    {
+        LOG_INFO(Logger) << "FID state changed, rebuilding VVC topology" << std::endl;
+        return true;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// BuildTopology
+/// @description Computes everything in vvc_compute that depends only on the
+///     feeder topology: the node and load index vectors, the admittance
+///     matrices, the per-phase branch tables and the DPF sweep plan.
+/// @pre None
+/// @post m_topo holds the topology data for Dl and is marked valid.
+/// @param Dl the feeder model for this round
+/// @param sysinfo the system data the feeder model was loaded from
+/// @param fids the FID states read with this round's devices
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::BuildTopology(const arma::mat& Dl, const sysdata& sysinfo,
+    const CPhysicalTopology::FIDState& fids)
 {
 using namespace arma;
 using namespace std;
-	
-//Prepare para for DPF
-sysdata sysinfo = load_system_data();
-int Ldl = sysinfo.Dl.n_rows;
-int Wdl = sysinfo.Dl.n_cols;
-cout << "Dl dimension:"<< Ldl <<"*"<< Wdl << endl;//Matrix Dl in Matlab
-cout << "OpenDSS data: "<< device::COpenDssAdapter::GetData() << endl;
-std::string command = "Bus : 1,Node1 : 2,Basekv : 88.88,Magnitude1 : 8088.8,Angle1 : 88.8, pu1 : 1.088"; // generic command should be changed
-device::COpenDssAdapter::sendCommand(command);    //test sendop
 
-mat Dl = sysinfo.Dl;
-cx_mat Z = sysinfo.Z;
+LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
 
-mat du, step_size; // delta control
-double Ploss_aftter_ctrl;
-bool flag = true;
-double Vmax, Vmin;
+int Ldl = Dl.n_rows;
+int j, ja, jb, jc;
 
 //document the original node number in sequence
-int j, ja, jb, jc, ia, ib, ic;
-
 j = 1;
 ja = 0;
 jb = 0;
@@ -402,7 +921,6 @@ cout << "Phase A B C NoBranches:" << Y_return.Lnum << endl;
 cout << "No. of Nodes:" << Y_return.Nnum << endl;
 	
 int Lbr = Y_return.brnches.n_rows;
-int Wbr = Y_return.brnches.n_cols;
 
 //save three phase branch data separately
 cx_mat brn_a = cx_mat(zeros(Y_return.Lnum_a, Y_return.brnches.n_cols), zeros(Y_return.Lnum_a, Y_return.brnches.n_cols));
@@ -432,6 +950,67 @@ for (int i = 0; i < Lbr && ja<Y_return.Lnum_a && jb<Y_return.Lnum_b && jc<Y_retu
   }
 }
 
+m_topo.key = Dl.cols(0, 5);
+m_topo.loads = join_rows(join_rows(Dl.col(6) != 0, Dl.col(8) != 0), Dl.col(10) != 0);
+m_topo.Z = sysinfo.Z;
+m_topo.fids = fids;
+m_topo.Y = Y_return;
+m_topo.brn_a = brn_a;
+m_topo.brn_b = brn_b;
+m_topo.brn_c = brn_c;
+m_topo.Node_f = Node_f;
+m_topo.Load_a = Load_a;
+m_topo.Load_b = Load_b;
+m_topo.Load_c = Load_c;
+m_topo.Lla = Lla;
+m_topo.Llb = Llb;
+m_topo.Llc = Llc;
+
+// the elements of Dl each load moves and the gradient it moves by, so a step
+// is one indexed expression per phase instead of a search of Dl per load
+const mat* loads[3] = { &Load_a, &Load_b, &Load_c };
+const int counts[3] = { Lla, Llb, Llc };
+for (int p = 0; p < 3; ++p)
+{
+  std::vector<uword> index, slots;
+  for (int l = 0; l < counts[p]; ++l)
+  {
+    for (int i = 0; i < Ldl; ++i)
+    {
+      if (Dl(i, 2) == (*loads[p])(0, l))
+      {
+        index.push_back(REACTIVE_COLUMNS[p] * Ldl + i);
+        slots.push_back(l);
+      }
+    }
+  }
+  m_topo.index[p] = conv_to<uvec>::from(index);
+  m_topo.slots[p] = conv_to<uvec>::from(slots);
+}
+m_topo.capability = 0;
+m_topo.plan = DPF_plan(Dl, sysinfo.Z, sysinfo.bkva, sysinfo.bkv);
+m_topo.plan.threads = CGlobalConfiguration::Instance().GetVVCSweepThreads();
+m_topo.warm = dpf_warm();
+m_topo.renamed = false;
+m_topo.valid = true;
+}
+
+void VVCAgent::vvc_main()
+{
+using namespace arma;
+using namespace std;
+	
+//Prepare para for DPF
+const sysdata& sysinfo = m_sysinfo;
+int Ldl = sysinfo.Dl.n_rows;
+int Wdl = sysinfo.Dl.n_cols;
+cout << "Dl dimension:"<< Ldl <<"*"<< Wdl << endl;//Matrix Dl in Matlab
+cout << "OpenDSS data: "<< device::COpenDssAdapter::GetData() << endl;
+
+// refilled in place each round; sysinfo.Dl has the same size every time
+m_work.Dl = sysinfo.Dl;
+mat& Dl = m_work.Dl;
+
 
 /////*********read from RSCAD output***********/////
 
@@ -1134,13 +1713,138 @@ catch(std::exception & e)
 
 // end of SST reading
 
+ReadCapabilities();
+
 // end of reading from RSCAD
 
+// the FID states are read here with the devices; vvc_compute only does math
+CPhysicalTopology::FIDState fids = ReadFidState();
+if (m_computeThread.joinable() && m_computing)
+{
+  LOG_WARN(Logger) << "Previous VVC solve still running, skipping this round" << std::endl;
+  return;
+}
+
+// a feeder segment is solved in place of the whole feeder model
+const mat* model = &Dl;
+mat segment;
+cx_mat source;
+if (m_segment)
+{
+  m_roundDl = Dl;
+  segment = m_segment->Extract(m_roundDl);
+  source = m_segment->GetSource();
+  model = &segment;
+}
+
+// the last solve still holds when nothing it read has moved
+if (IsQuiet(*model, fids, source))
+{
+  LOG_INFO(Logger) << "Feeder within bounds and loads unchanged, skipping this round" << std::endl;
+  SkippedMetric.Increment();
+  return;
+}
+m_quiet = false;
+m_quietDl = *model;
+m_quietFids = fids;
+m_quietSource = source;
+
+device::SControlStamp stamp = device::CControlLoop::Current();
+if (m_computeThread.joinable())
+{
+  m_computing = true;
+  m_computeService.post(boost::bind(&VVCAgent::ComputeRound, this, *model, fids, source, stamp));
+}
+else
+{
+  VVCResult result = vvc_compute(*model, fids, source);
+  result.stamp = stamp;
+  vvc_apply(result);
+}
+}// end of vvc_main()
+
+///////////////////////////////////////////////////////////////////////////////
+/// vvc_compute
+/// @description Runs the power flow, the gradient calculation and the
+///     step-size search for one VVC round. Only the cached topology and
+///     the system data are touched, so this may run off the broker thread.
+/// @pre Only one vvc_compute runs at a time.
+/// @post m_topo is updated for the feeder model of this round.
+/// @param Dl the feeder model with this round's device readings
+/// @param fids the FID states read with the devices
+/// @param source the voltage the feeder is fed from, empty for the substation
+/// @return the set points to send to the slaves, if any
+///////////////////////////////////////////////////////////////////////////////
+VVCAgent::VVCResult VVCAgent::vvc_compute(arma::mat Dl, const CPhysicalTopology::FIDState& fids,
+    const arma::cx_mat& source)
+{
+using namespace arma;
+using namespace std;
+
+LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+const sysdata& sysinfo = m_sysinfo;
+int Ldl = Dl.n_rows;
+const cx_mat& Z = sysinfo.Z;
+VVCResult result;
+
+mat du, step_size; // delta control
+double Ploss_aftter_ctrl;
+bool flag = true;
+double Vmax, Vmin;
 
+// topology-dependent data (Y, branch tables, node/load index vectors) is only
+// rebuilt when the feeder model or the FID states change
+if (TopologyChanged(Dl, Z, fids))
+{
+  BuildTopology(Dl, sysinfo, fids);
+}
+else
+{
+  cout << "Reusing cached feeder topology" << endl;
+}
+m_topo.plan.V0 = source;
+FillLimits(Dl);
 
-VPQ dpf_re = DPF_return7(Dl, Z);
+// seed each power flow with the last converged solution when enabled
+dpf_warm* warm = NULL;
+if (CGlobalConfiguration::Instance().GetVVCWarmStart())
+{
+  warm = &m_topo.warm;
+  // the first power flow after a restart starts from the last run's solution
+  const WarmVoltVar* hint = CWarmState::Instance().GetVoltVarHint();
+  if (!m_warmResumed && !warm->valid && hint != NULL && ResumeSolution(*hint, *warm))
+  {
+    LOG_NOTICE(Logger) << "Power flow starts from the warm state" << std::endl;
+  }
+  m_warmResumed = true;
+}
+const y_re& Y_return = m_topo.Y;
+const mat& Node_f = m_topo.Node_f;
+const mat& Load_a = m_topo.Load_a;
+const mat& Load_b = m_topo.Load_b;
+const mat& Load_c = m_topo.Load_c;
+const cx_mat& brn_a = m_topo.brn_a;
+const cx_mat& brn_b = m_topo.brn_b;
+const cx_mat& brn_c = m_topo.brn_c;
+int Lla = m_topo.Lla;
+int Llb = m_topo.Llb;
+int Llc = m_topo.Llc;
+
+
+
+
+
+VPQ dpf_re = DPF_return7(Dl, Z, m_topo.plan, warm);
+LOG_INFO(Logger) << "DPF " << (dpf_re.converged ? "converged" : "stopped") << " after "
+    << dpf_re.iterations << " iterations" << std::endl;
+if (warm != NULL && warm->valid && CWarmState::Instance().IsEnabled())
+{
+  CWarmState::Instance().SaveVoltVar(SaveSolution(*warm));
+}
 //cout << "Vpolar = \n" << dpf_re.Vpolar << endl;
 //cout << "PQb = \n" << dpf_re.Vpolar << endl;
+result.flow = dpf_re;
 mat Vpolar = dpf_re.Vpolar;
 mat PQb = dpf_re.PQb;
 mat PQL = dpf_re.PQL;
@@ -1188,12 +1892,30 @@ mat theta_c = V_abc.theta_c;
 mat Qset_a = dpf_re.Qset_a;
 mat Qset_b = dpf_re.Qset_b;
 mat Qset_c = dpf_re.Qset_c;
-mat Dl_new = Dl;
+// the feeder-sized matrices of the search live in m_work, so rounds of the
+// same feeder overwrite them in place instead of allocating them again
+mat& Dl_new = m_work.Dl_new;
+Dl_new = Dl;
 Dl_new.col(7) = Qset_a;
 Dl_new.col(9) = Qset_b;
 Dl_new.col(11) = Qset_c;
 
-newbrn Newbrn_return = rename_brn(Node_a, Node_b, Node_c, brn_a, brn_b, brn_c, Y_return.Lnum_a, Y_return.Lnum_b, Y_return.Lnum_c, Lna, Lnb, Lnc);
+// the per-phase node lists only change with the topology, so the renamed
+// branch tables are cached next to Y
+if (!m_topo.renamed || !SameNodes(m_topo.Node_a, Node_a) ||
+    !SameNodes(m_topo.Node_b, Node_b) || !SameNodes(m_topo.Node_c, Node_c))
+{
+  m_topo.brn = rename_brn(Node_a, Node_b, Node_c, brn_a, brn_b, brn_c, Y_return.Lnum_a, Y_return.Lnum_b, Y_return.Lnum_c, Lna, Lnb, Lnc);
+  m_topo.Node_a = Node_a;
+  m_topo.Node_b = Node_b;
+  m_topo.Node_c = Node_c;
+  m_topo.renamed = true;
+  for (int p = 0; p < 3; p++)
+  {
+    m_work.sensitivity[p].valid = false;
+  }
+}
+const newbrn& Newbrn_return = m_topo.brn;
 
 //cout << "Phase A Vmin:" << min(V_a) << endl;
 //cout << "Phase B Vmin:" << min(V_b) << endl;
@@ -1218,95 +1940,58 @@ cout << "Vmin (p.u.) = " << Vmin_orig << endl;
 double beta0 = 0.1;// min dQsst for SST is 0.1 kVar
 double alpha = 1.1;
 int m_max = 100; // max iterations to search for the best step-size
-//deltaF/deltaTheta
-arma::mat Ftheta_a = form_Ftheta(Y_return.Y_a, V_a, theta_a, Newbrn_return.newbrn_a, Lna, Lnum_a);
-arma::mat Ftheta_b = form_Ftheta(Y_return.Y_b, V_b, theta_b, Newbrn_return.newbrn_b, Lnb, Lnum_b);
-arma::mat Ftheta_c = form_Ftheta(Y_return.Y_c, V_c, theta_c, Newbrn_return.newbrn_c, Lnc, Lnum_c);
-
-//detltaF/deltaV
-arma::mat Fv_a = form_Fv(Y_return.Y_a, V_a, theta_a, Newbrn_return.newbrn_a, Lna, Lnum_a);
-arma::mat Fv_b = form_Fv(Y_return.Y_b, V_b, theta_b, Newbrn_return.newbrn_b, Lnb, Lnum_b);
-arma::mat Fv_c = form_Fv(Y_return.Y_c, V_c, theta_c, Newbrn_return.newbrn_c, Lnc, Lnum_c);
-//detltaF/deltaX
-arma::mat Fx_a = join_cols(Ftheta_a, Fv_a);
-arma::mat Fx_b = join_cols(Ftheta_b, Fv_b);
-arma::mat Fx_c = join_cols(Ftheta_c, Fv_c);
-					
-
-//form Jacobian Matrices for each phase
-arma::mat J_a, J_b, J_c;
-J_a = form_J(Y_return.Y_a, V_a, theta_a, Lna);
-J_b = form_J(Y_return.Y_b, V_b, theta_b, Lnb);
-J_c = form_J(Y_return.Y_c, V_c, theta_c, Lnc);
-
-// get lambda for each phase
-arma::mat lambda_a = -inv(J_a.st())*Fx_a;//need LAPAC etc
-arma::mat lambda_b = -inv(J_b.st())*Fx_b;
-arma::mat lambda_c = -inv(J_c.st())*Fx_c;
-
-//std::cout << lambda_a << std::endl;
-					
-//deltaG/delta_Qnj from sst
-//deltaP/delta_Qinj
-arma::mat Gpq_a = arma::zeros(Lnum_a, Lla);
-arma::mat Gpq_b = arma::zeros(Lnum_b, Llb);
-arma::mat Gpq_c = arma::zeros(Lnum_c, Llc);
-//deltaQ/delta_Qinj
-arma::mat Gqq_a = arma::zeros(Lnum_a, Lla);
-arma::mat Gqq_b = arma::zeros(Lnum_b, Llb);
-arma::mat Gqq_c = arma::zeros(Lnum_c, Llc);
-					
-					
-					//Phase A
-					for (ia = 0; ia < Lnum_a; ++ia)
-					{
-						for ( ja = 0; ja < Lla; ++ja)
-						{
-							if (Node_a(0, ia + 1) == Load_a(0, ja))
-							{
-								Gqq_a(ia, ja) = -1;
-							}
-
-						}
-					}
-					
-					//Phase B
-					for (ib = 0; ib < Lnum_b; ++ib)
-					{
-						for (jb = 0; jb < Llb; ++jb)
-						{
-							if (Node_b(0, ib + 1) == Load_b(0, jb))
-							{
-								Gqq_b(ib, jb) = -1;
-							}
-
-						}
-					}
-					
-					//Phase C
-					for (ic = 0; ic < Lnum_c; ++ic)
-					{
-						for (jc = 0; jc < Llc; ++jc)
-						{
-							if (Node_c(0, ic + 1) == Load_c(0, jc))
-							{
-								Gqq_c(ic, jc) = -1;
-							}
-
-						}
-					}
-					
-//form deltaG/deltaQinj
-arma::mat gu_a, gu_b, gu_c;
-gu_a = join_cols(Gpq_a, Gqq_a);
-gu_b = join_cols(Gpq_b, Gqq_b);
-gu_c = join_cols(Gpq_c, Gqq_c);
-
-					
-
-arma::mat g_vq_a = -gu_a.st()*lambda_a;//Gradient in p.u.  aka df/du , u is Qinj
-arma::mat g_vq_b = -gu_b.st()*lambda_b;
-arma::mat g_vq_c = -gu_c.st()*lambda_c;
+// the three phases are independent: Ftheta, Fv, J and lambda of each
+// phase only read the shared Y and branch tables
+phase_input ph[3];
+ph[0].Y = &Y_return.Y_a;
+ph[1].Y = &Y_return.Y_b;
+ph[2].Y = &Y_return.Y_c;
+ph[0].Ysp = &Y_return.Ysp_a;
+ph[1].Ysp = &Y_return.Ysp_b;
+ph[2].Ysp = &Y_return.Ysp_c;
+ph[0].brn = &Newbrn_return.newbrn_a;
+ph[1].brn = &Newbrn_return.newbrn_b;
+ph[2].brn = &Newbrn_return.newbrn_c;
+ph[0].Node = &Node_a;
+ph[1].Node = &Node_b;
+ph[2].Node = &Node_c;
+ph[0].Load = &Load_a;
+ph[1].Load = &Load_b;
+ph[2].Load = &Load_c;
+ph[0].V = V_a; ph[0].theta = theta_a; ph[0].Ln = Lna; ph[0].Lnum = Lnum_a; ph[0].Ll = Lla;
+ph[1].V = V_b; ph[1].theta = theta_b; ph[1].Ln = Lnb; ph[1].Lnum = Lnum_b; ph[1].Ll = Llb;
+ph[2].V = V_c; ph[2].theta = theta_c; ph[2].Ln = Lnc; ph[2].Lnum = Lnum_c; ph[2].Ll = Llc;
+// Ftheta, Fv and J are only formed again for the nodes that moved
+const std::string precision = CGlobalConfiguration::Instance().GetVVCPrecision();
+double deviation[3] = { 0, 0, 0 };
+for (int p = 0; p < 3; p++)
+{
+  ph[p].sparse = Y_return.sparse;
+  ph[p].cache = &m_work.sensitivity[p];
+  ph[p].tolerance = CGlobalConfiguration::Instance().GetVVCSensitivityTolerance();
+  ph[p].single = precision == "single" || precision == "check";
+  ph[p].deviation = precision == "check" ? &deviation[p] : NULL;
+}
+
+arma::mat g_vq[3];
+phase_gradients(ph, g_vq, CGlobalConfiguration::Instance().GetVVCParallelPhases());
+if (precision == "check")
+{
+  double worst = std::max(deviation[0], std::max(deviation[1], deviation[2]));
+  if (worst > SINGLE_PRECISION_TOLERANCE)
+  {
+    LOG_WARN(Logger) << "Single precision VVC sensitivities deviate by " << worst
+        << " from the double solve" << std::endl;
+  }
+  else
+  {
+    LOG_INFO(Logger) << "Single precision VVC sensitivities deviate by " << worst
+        << " from the double solve" << std::endl;
+  }
+}
+arma::mat g_vq_a = g_vq[0];//Gradient in p.u.  aka df/du , u is Qinj
+arma::mat g_vq_b = g_vq[1];
+arma::mat g_vq_c = g_vq[2];
 //std::cout<< g_vq_a << std::endl;
 
 arma::mat g_min;
@@ -1324,59 +2009,39 @@ double cvq_a = beta0/(sysinfo.bkva/3)/gabs_min;
 double cvq_b = beta0/(sysinfo.bkva/3)/gabs_min;
 double cvq_c = beta0/(sysinfo.bkva/3)/gabs_min;
 
-mat ctrl_o =  Dl;// save the previous control
+if (CGlobalConfiguration::Instance().GetVVCOptimizer() == "newton")
+{
+  arma::mat g[3] = { g_vq_a, g_vq_b, g_vq_c };
+  if (LineSearch(Dl, g, cvq_a, Ploss_orig, Vmin_orig, Vmax_orig, warm, m_work.Dl_new))
+  {
+    result.send = true;
+    result.location = "Line search";
+    result.Dl = m_work.Dl_new;
+  }
+  return result;
+}
+
+mat& ctrl_o = m_work.ctrl_o;
+ctrl_o = Dl;// save the previous control
 
 
 for ( int m = 0; m < m_max; m++ )
 {
-  // update Qinj for three phase separately
-  double Gupdate;
-  //Phase A
-  for (ia = 0; ia < Lla; ++ia)
-  {
-    for (ja = 0; ja < Ldl; ++ja)
-    {
-      if (Dl(ja, 2) == Load_a(0, ia))
-      {
-	Gupdate = g_vq_a(ia, 0)*(sysinfo.bkva/3)*cvq_a;
-	Dl_new(ja, 7) = ctrl_o(ja, 7) - Gupdate;
-      }
-     }
-  }//end of Phase A
-  
-  //Phase B
-  for (ib = 0; ib < Llb; ++ib)
-  {
-    for (jb = 0; jb < Ldl; ++jb)
-    {
-      if (Dl(jb, 2) == Load_b(0, ib))
-      {
-	Gupdate = g_vq_b(ib, 0)*(sysinfo.bkva / 3)*cvq_b;
-	Dl_new(jb, 9) = ctrl_o(jb, 9) - Gupdate;
-      }
-    }
-   }//end of Phase B
-   
-   //Phase C
-  for (ic = 0; ic < Llc; ++ic)
+  // update Qinj for three phase separately, within the reactive limits
   {
-    for (jc = 0; jc < Ldl; ++jc)
-    {
-      if (Dl(jc, 2) == Load_c(0, ic))
-      {
-	Gupdate = g_vq_c(ic, 0)*(sysinfo.bkva / 3)*cvq_c;
-	Dl_new(jc, 11) = ctrl_o(jc, 11) - Gupdate;
-      }
-     }
-  }// end of Phase C
-mat Dl_osize = Dl_new;  
-mat du_temp=Dl_osize-ctrl_o;
+    const double steps[3] = { cvq_a, cvq_b, cvq_c };
+    StepLoads(ctrl_o, g_vq, steps, Dl_new);
+  }
+mat& Dl_osize = m_work.Dl_osize;
+Dl_osize = Dl_new;
+mat& du_temp = m_work.du;
+du_temp = Dl_osize - ctrl_o;
 du = du_temp.cols(6,11);
 
 // cout << "Dl_new = \n" << Dl_new << endl;
 // DPF based on Dl_new
 
-VPQ dpf_re = DPF_return7(Dl_osize, Z);
+VPQ dpf_re = DPF_return7(Dl_osize, Z, m_topo.plan, warm);
 //cout << "Vpolar = \n" << dpf_re.Vpolar << endl;
 mat Vpolar = dpf_re.Vpolar;
 mat PQb = dpf_re.PQb;
@@ -1421,49 +2086,16 @@ cvq_a=alpha*cvq_a;
 cvq_b=alpha*cvq_b;
 cvq_c=alpha*cvq_c; 
 
-//update Dl_new based on the new step-size
-//Phase A
-  for (ia = 0; ia < Lla; ++ia)
-  {
-    for (ja = 0; ja < Ldl; ++ja)
-    {
-      if (Dl(ja, 2) == Load_a(0, ia))
-      {
-	Gupdate = g_vq_a(ia, 0)*(sysinfo.bkva/3)*cvq_a;
-	Dl_new(ja, 7) = ctrl_o(ja, 7) - Gupdate;
-      }
-     }
-  }//end of Phase A
-  
-  //Phase B
-  for (ib = 0; ib < Llb; ++ib)
-  {
-    for (jb = 0; jb < Ldl; ++jb)
-    {
-      if (Dl(jb, 2) == Load_b(0, ib))
-      {
-	Gupdate = g_vq_b(ib, 0)*(sysinfo.bkva / 3)*cvq_b;
-	Dl_new(jb, 9) = ctrl_o(jb, 9) - Gupdate;
-      }
-    }
-   }//end of Phase B
-   
-   //Phase C
-  for (ic = 0; ic < Llc; ++ic)
+//update Dl_new based on the new step-size, within the reactive limits
   {
-    for (jc = 0; jc < Ldl; ++jc)
-    {
-      if (Dl(jc, 2) == Load_c(0, ic))
-      {
-	Gupdate = g_vq_c(ic, 0)*(sysinfo.bkva / 3)*cvq_c;
-	Dl_new(jc, 11) = ctrl_o(jc, 11) - Gupdate;
-      }
-     }
-  }// end of Phase C
+    const double steps[3] = { cvq_a, cvq_b, cvq_c };
+    StepLoads(ctrl_o, g_vq, steps, Dl_new);
+  }
   
-mat Dl_nsize = Dl_new;  
+mat& Dl_nsize = m_work.Dl_nsize;
+Dl_nsize = Dl_new;
 
-dpf_re = DPF_return7(Dl_nsize, Z);// run DPF based on new step-size
+dpf_re = DPF_return7(Dl_nsize, Z, m_topo.plan, warm);// run DPF based on new step-size
 Vpolar = dpf_re.Vpolar;
 PQb = dpf_re.PQb;
 PQL = dpf_re.PQL;
@@ -1494,20 +2126,10 @@ if (Ploss_nsize>Ploss_osize)
   // send messages to slaves
 	if (Ploss_osize < Ploss_orig)// grad message will NOT be sent to slaves if loss is not reduced
 	{
-		BOOST_FOREACH(CPeerNode peer, m_peers | boost::adaptors::map_values)
-        	{
-      	    
-	    	ModuleMessage mm = VoltageDelta(2, 3.0, "NCSU");
-            	peer.Send(mm);
-	    
-	   
-	    	mat S2;
-	    	S2 << Dl(1,7) << Dl(2,7) << Dl(3,7) << Dl(4,7) << Dl(6,7) << Dl(7,7) << Dl(8,7) << Dl(1,9) << Dl(2,9) << Dl(3,9) << Dl(4,9) << Dl(6,9) << Dl(7,9) << Dl(8,9) << Dl(1,11)<< Dl(2,11)<< Dl(3,11)<< Dl(4,11)<< Dl(6,11)<< Dl(7,11)<< Dl(8,11)<< endr;
-	    	S2 = S2.t();
-	    	ModuleMessage mg = Gradient(S2);
-	    	peer.Send(mg);
-	    
-		}
+		// the set points go out to the slaves from vvc_apply
+		result.send = true;
+		result.location = "NCSU";
+		result.Dl = Dl;
 	}
 	else
 	{
@@ -1550,54 +2172,21 @@ if (flag == false)
   
 for ( int m = 0; m < m_max; m++ )
 {
-  // update Qinj for three phase separately
-  double Gupdate;
-  //Phase A
-  for (ia = 0; ia < Lla; ++ia)
-  {
-    for (ja = 0; ja < Ldl; ++ja)
-    {
-      if (Dl(ja, 2) == Load_a(0, ia))
-      {
-	Gupdate = g_vq_a(ia, 0)*(sysinfo.bkva/3)*cvq_a;
-	Dl_new(ja, 7) = ctrl_o(ja, 7) - Gupdate;
-      }
-     }
-  }//end of Phase A
-  
-  //Phase B
-  for (ib = 0; ib < Llb; ++ib)
-  {
-    for (jb = 0; jb < Ldl; ++jb)
-    {
-      if (Dl(jb, 2) == Load_b(0, ib))
-      {
-	Gupdate = g_vq_b(ib, 0)*(sysinfo.bkva / 3)*cvq_b;
-	Dl_new(jb, 9) = ctrl_o(jb, 9) - Gupdate;
-      }
-    }
-   }//end of Phase B
-   
-   //Phase C
-  for (ic = 0; ic < Llc; ++ic)
+  // update Qinj for three phase separately, within the reactive limits
   {
-    for (jc = 0; jc < Ldl; ++jc)
-    {
-      if (Dl(jc, 2) == Load_c(0, ic))
-      {
-	Gupdate = g_vq_c(ic, 0)*(sysinfo.bkva / 3)*cvq_c;
-	Dl_new(jc, 11) = ctrl_o(jc, 11) - Gupdate;
-      }
-     }
-  }// end of Phase C
-mat Dl_osize = Dl_new;  
-mat du_temp=Dl_osize-ctrl_o;
+    const double steps[3] = { cvq_a, cvq_b, cvq_c };
+    StepLoads(ctrl_o, g_vq, steps, Dl_new);
+  }
+mat& Dl_osize = m_work.Dl_osize;
+Dl_osize = Dl_new;
+mat& du_temp = m_work.du;
+du_temp = Dl_osize - ctrl_o;
 du = du_temp.cols(6,11);
 
 //cout << "Dl_new = \n" << Dl_new << endl;
 // DPF based on Dl_new
 
-VPQ dpf_re = DPF_return7(Dl_osize, Z);
+VPQ dpf_re = DPF_return7(Dl_osize, Z, m_topo.plan, warm);
 //cout << "Vpolar = \n" << dpf_re.Vpolar << endl;
 mat Vpolar = dpf_re.Vpolar;
 mat PQb = dpf_re.PQb;
@@ -1642,49 +2231,16 @@ cvq_a=alpha*cvq_a;
 cvq_b=alpha*cvq_b;
 cvq_c=alpha*cvq_c; 
 
-//update Dl_new based on the new step-size
-//Phase A
-  for (ia = 0; ia < Lla; ++ia)
-  {
-    for (ja = 0; ja < Ldl; ++ja)
-    {
-      if (Dl(ja, 2) == Load_a(0, ia))
-      {
-	Gupdate = g_vq_a(ia, 0)*(sysinfo.bkva/3)*cvq_a;
-	Dl_new(ja, 7) = ctrl_o(ja, 7) - Gupdate;
-      }
-     }
-  }//end of Phase A
-  
-  //Phase B
-  for (ib = 0; ib < Llb; ++ib)
-  {
-    for (jb = 0; jb < Ldl; ++jb)
-    {
-      if (Dl(jb, 2) == Load_b(0, ib))
-      {
-	Gupdate = g_vq_b(ib, 0)*(sysinfo.bkva / 3)*cvq_b;
-	Dl_new(jb, 9) = ctrl_o(jb, 9) - Gupdate;
-      }
-    }
-   }//end of Phase B
-   
-   //Phase C
-  for (ic = 0; ic < Llc; ++ic)
+//update Dl_new based on the new step-size, within the reactive limits
   {
-    for (jc = 0; jc < Ldl; ++jc)
-    {
-      if (Dl(jc, 2) == Load_c(0, ic))
-      {
-	Gupdate = g_vq_c(ic, 0)*(sysinfo.bkva / 3)*cvq_c;
-	Dl_new(jc, 11) = ctrl_o(jc, 11) - Gupdate;
-      }
-     }
-  }// end of Phase C
+    const double steps[3] = { cvq_a, cvq_b, cvq_c };
+    StepLoads(ctrl_o, g_vq, steps, Dl_new);
+  }
   
-mat Dl_nsize = Dl_new;  
+mat& Dl_nsize = m_work.Dl_nsize;
+Dl_nsize = Dl_new;
 
-dpf_re = DPF_return7(Dl_nsize, Z);// run DPF based on new step-size
+dpf_re = DPF_return7(Dl_nsize, Z, m_topo.plan, warm);// run DPF based on new step-size
 Vpolar = dpf_re.Vpolar;
 PQb = dpf_re.PQb;
 PQL = dpf_re.PQL;
@@ -1715,19 +2271,10 @@ if (Ploss_nsize>Ploss_osize)
   // send messages to slaves
 	if (Ploss_osize < Ploss_orig)
 	{
-  	BOOST_FOREACH(CPeerNode peer, m_peers | boost::adaptors::map_values)
-        	{
-      	    
-	    	ModuleMessage mm = VoltageDelta(2, 3.0, "Gradients reversed!");
-            	peer.Send(mm);
-	    
-	   
-	    	mat S2;
-	    	S2 << Dl(1,7) << Dl(2,7) << Dl(3,7) << Dl(4,7) << Dl(6,7) << Dl(7,7) << Dl(8,7) << Dl(1,9) << Dl(2,9) << Dl(3,9) << Dl(4,9) << Dl(6,9) << Dl(7,9) << Dl(8,9) << Dl(1,11)<< Dl(2,11)<< Dl(3,11)<< Dl(4,11)<< Dl(6,11)<< Dl(7,11)<< Dl(8,11)<< endr;
-	    	S2 = S2.t();
-	    	ModuleMessage mg = Gradient(S2);
-	    	peer.Send(mg);
-		}
+  	// the set points go out to the slaves from vvc_apply
+		result.send = true;
+		result.location = "Gradients reversed!";
+		result.Dl = Dl;
 	}
 	else
 	{
@@ -1763,7 +2310,503 @@ else
 
 
 
-}// end of vvc_main()
+return result;
+}// end of vvc_compute()
+
+///////////////////////////////////////////////////////////////////////////////
+/// StepModel
+/// @description Moves the reactive set point of each load against its
+///     gradient, the same update the step-size search of vvc_compute makes,
+///     within the reactive limits of the loads.
+/// @pre m_topo holds the load lists of Dl.
+/// @post out is Dl with the moved set points.
+/// @param Dl the feeder model the step starts from
+/// @param g the gradients of phases a, b and c in p.u., one row per load
+/// @param step the step size, negative to move along the gradient
+/// @param out set to the moved feeder model
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::StepModel(const arma::mat& Dl, const arma::mat g[3], double step,
+    arma::mat& out)
+{
+    const double steps[3] = { step, step, step };
+
+    out = Dl;
+    StepLoads(Dl, g, steps, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// StepLoads
+/// @description Moves the reactive set point of each load against its
+///     gradient and clamps it to the limits of its SST. The elements of the
+///     loads were found once with the topology, so each phase is one gather,
+///     one scaled subtraction and one clamp.
+/// @pre m_topo holds the topology of from and out, and its limits are filled.
+/// @post The reactive set points of the loads in out are moved; the other
+///     elements of out are not changed.
+/// @param from the feeder model the step starts from
+/// @param g the gradients of phases a, b and c in p.u., one row per load
+/// @param step the step size of each phase, negative to move along the gradient
+/// @param out the feeder model to write the moved set points to
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::StepLoads(const arma::mat& from, const arma::mat g[3],
+    const double step[3], arma::mat& out) const
+{
+    for(int p = 0; p < 3; p++)
+    {
+        const arma::uvec& index = m_topo.index[p];
+        if(index.is_empty())
+        {
+            continue;
+        }
+        arma::vec q = from.elem(index)
+            - g[p].elem(m_topo.slots[p]) * ((m_sysinfo.bkva / 3) * step[p]);
+        out.elem(index) = arma::min(arma::max(q, m_topo.qmin[p]), m_topo.qmax[p]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// FillLimits
+/// @description Fills the reactive limits of each load of the cached
+///     topology from the limits the SSTs reported. A load without a reported
+///     limit is not bounded. The limits are only filled again when the
+///     topology was rebuilt or a reported limit changed.
+/// @pre m_topo holds the topology of Dl.
+/// @post The limits of m_topo match m_capability.
+/// @param Dl the feeder model of the topology
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::FillLimits(const arma::mat& Dl)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::mutex::scoped_lock lock(m_capabilityMutex);
+    if(m_topo.capability == m_capabilityVersion)
+    {
+        return;
+    }
+    for(int p = 0; p < 3; p++)
+    {
+        const arma::uvec& index = m_topo.index[p];
+        m_topo.qmin[p].set_size(index.n_elem);
+        m_topo.qmax[p].set_size(index.n_elem);
+        for(arma::uword i = 0; i < index.n_elem; i++)
+        {
+            unsigned int row = index(i) % Dl.n_rows;
+            CapabilityMap::const_iterator it =
+                m_capability.find(std::make_pair(p, static_cast<int>(Dl(row, 2))));
+            ReactiveLimit limit = it != m_capability.end() ? it->second : ReactiveLimit();
+            m_topo.qmin[p](i) = limit.qmin;
+            m_topo.qmax[p](i) = limit.qmax;
+        }
+    }
+    m_topo.capability = m_capabilityVersion;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// TrySteps
+/// @description Runs the power flows of the feeder model moved by several
+///     step sizes, in parallel on vvc-batch-threads threads, and reports
+///     their losses. A step that takes the voltages further out of the limits
+///     of the feeder model than they already are is given an infinite loss,
+///     so the line search never picks it.
+/// @pre m_topo holds the topology of Dl.
+/// @post None
+/// @param Dl the feeder model the steps start from
+/// @param g the gradients of phases a, b and c
+/// @param steps the step sizes to try
+/// @param vmin the lowest voltage of Dl in p.u.
+/// @param vmax the highest voltage of Dl in p.u.
+/// @param warm the warm start of the power flows, or NULL
+/// @return the step sizes and their losses, in the order of steps
+///////////////////////////////////////////////////////////////////////////////
+std::vector<VVCAgent::StepTrial> VVCAgent::TrySteps(const arma::mat& Dl,
+    const arma::mat g[3], const std::vector<double>& steps, double vmin,
+    double vmax, const dpf_warm* warm)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_work.candidates.resize(steps.size());
+    for(unsigned int k = 0; k < steps.size(); k++)
+    {
+        StepModel(Dl, g, steps[k], m_work.candidates[k]);
+    }
+    std::vector<dpf_candidate> flows = DPF_batch(m_work.candidates, m_sysinfo.Z,
+        m_topo.plan, warm, CGlobalConfiguration::Instance().GetVVCBatchThreads());
+
+    std::vector<StepTrial> trials(steps.size());
+    for(unsigned int k = 0; k < steps.size(); k++)
+    {
+        trials[k].step = steps[k];
+        trials[k].loss = flows[k].loss;
+        if(flows[k].vmin < std::min(m_sysinfo.lb_v, vmin) ||
+            flows[k].vmax > std::max(m_sysinfo.ub_v, vmax))
+        {
+            trials[k].loss = std::numeric_limits<double>::infinity();
+        }
+        LOG_DEBUG(Logger) << "Step " << trials[k].step << " has a loss of "
+            << trials[k].loss << " kW" << std::endl;
+    }
+    return trials;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// LineSearch
+/// @description Searches the step size along the gradient that minimizes the
+///     feeder loss. The search tries one step each way from the current set
+///     points and doubles the step while the loss keeps falling, which
+///     brackets the minimum between three step sizes. It then tries the
+///     minimum of the parabola through them, a Newton step on the loss along
+///     the gradient. Both directions are covered by the first two power
+///     flows, so the gradient never has to be reversed. With several batch
+///     threads the next doublings are tried together, as many as there are
+///     threads.
+/// @pre m_topo holds the topology of Dl and g was computed for Dl.
+/// @post best holds the feeder model of the best step when one was found.
+/// @param Dl the feeder model with the current set points
+/// @param g the gradients of phases a, b and c
+/// @param step the first step size to try
+/// @param loss the loss of Dl in kW
+/// @param vmin the lowest voltage of Dl in p.u.
+/// @param vmax the highest voltage of Dl in p.u.
+/// @param warm the warm start of the power flow, or NULL
+/// @param best set to the feeder model with the least loss
+/// @return true if a step reduces the loss
+///////////////////////////////////////////////////////////////////////////////
+bool VVCAgent::LineSearch(const arma::mat& Dl, const arma::mat g[3], double step,
+    double loss, double vmin, double vmax, dpf_warm* warm, arma::mat& best)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    const unsigned int MAX_TRIALS = 12;
+    const unsigned int batch = CGlobalConfiguration::Instance().GetVVCBatchThreads();
+
+    std::vector<double> steps;
+    steps.push_back(-step);
+    steps.push_back(step);
+    std::vector<StepTrial> first = TrySteps(Dl, g, steps, vmin, vmax, warm);
+    StepTrial a = first[0];
+    StepTrial b = { 0, loss };
+    StepTrial c = first[1];
+    unsigned int trials = 2;
+    int direction = 0;
+    bool bracketed = true;
+
+    if(c.loss < b.loss && c.loss <= a.loss)
+    {
+        a = b;
+        b = c;
+        direction = 1;
+    }
+    else if(a.loss < b.loss)
+    {
+        c = b;
+        b = a;
+        direction = -1;
+    }
+
+    // walk downhill with doubling steps until the loss rises again
+    if(direction != 0)
+    {
+        bracketed = false;
+        while(!bracketed && trials < MAX_TRIALS)
+        {
+            steps.clear();
+            double next = b.step;
+            for(unsigned int k = 0; k < batch && trials + k < MAX_TRIALS; k++)
+            {
+                next *= 2;
+                steps.push_back(next);
+            }
+            std::vector<StepTrial> walk = TrySteps(Dl, g, steps, vmin, vmax, warm);
+            trials += walk.size();
+            for(unsigned int k = 0; k < walk.size() && !bracketed; k++)
+            {
+                if(walk[k].loss < b.loss)
+                {
+                    (direction > 0 ? a : c) = b;
+                    b = walk[k];
+                }
+                else
+                {
+                    (direction > 0 ? c : a) = walk[k];
+                    bracketed = true;
+                }
+            }
+        }
+    }
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    if(bracketed && a.loss < infinity && c.loss < infinity)
+    {
+        double p = (b.step - a.step) * (b.loss - c.loss);
+        double q = (b.step - c.step) * (b.loss - a.loss);
+        if(p != q)
+        {
+            double x = b.step - 0.5 * ((b.step - a.step) * p - (b.step - c.step) * q) / (p - q);
+            if(x > a.step && x < c.step && x != b.step)
+            {
+                StepTrial vertex = TrySteps(Dl, g, std::vector<double>(1, x),
+                    vmin, vmax, warm)[0];
+                trials++;
+                if(vertex.loss < b.loss)
+                {
+                    b = vertex;
+                }
+            }
+        }
+    }
+
+    LOG_INFO(Logger) << "Line search took " << trials << " power flows, step "
+        << b.step << " and loss " << b.loss << " kW (was " << loss << ")" << std::endl;
+
+    if(b.step == 0)
+    {
+        return false;
+    }
+    StepModel(Dl, g, b.step, best);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// vvc_apply
+/// @description Sends the set points found by vvc_compute to the slaves.
+/// @pre Called on the broker thread during the VVC phase.
+/// @post A VoltageDelta and a Gradient message are sent to every peer when
+///     the round reduced the power loss.
+/// @param result the outcome of vvc_compute
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::vvc_apply(const VVCResult& result)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_quiet = WithinBounds(result.flow);
+    if(m_segment)
+    {
+        ApplySegment(result);
+        return;
+    }
+    if(!result.send)
+    {
+        return;
+    }
+    const arma::mat& Dl = result.Dl;
+    HandOff(Dl, result.stamp);
+    if(!m_peers)
+    {
+        return;
+    }
+    BOOST_FOREACH(CPeerNode peer, m_peers->peers | boost::adaptors::map_values)
+    {
+        ModuleMessage mm = VoltageDelta(2, 3.0, result.location);
+        peer.Send(mm);
+
+        arma::mat S2;
+        S2 << Dl(1,7) << Dl(2,7) << Dl(3,7) << Dl(4,7) << Dl(6,7) << Dl(7,7) << Dl(8,7) << Dl(1,9) << Dl(2,9) << Dl(3,9) << Dl(4,9) << Dl(6,9) << Dl(7,9) << Dl(8,9) << Dl(1,11)<< Dl(2,11)<< Dl(3,11)<< Dl(4,11)<< Dl(6,11)<< Dl(7,11)<< Dl(8,11)<< arma::endr;
+        S2 = S2.t();
+        ModuleMessage mg = Gradient(S2);
+        peer.Send(mg);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ApplySegment
+/// @description Keeps the set points found for the owned branches and sends
+///     each neighbor in the physical topology the power drawn at our boundary
+///     bus, and a downstream neighbor the voltage solved for its own. Without
+///     a physical topology the boundary values go to the group instead.
+/// @pre Called on the broker thread with the result for m_roundDl.
+/// @post m_roundDl holds the new set points of the owned branches.
+/// @param result the outcome of vvc_compute on the feeder segment
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::ApplySegment(const VVCResult& result)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_segment->NoteFlow(result.flow);
+    if(result.send)
+    {
+        m_segment->Restore(m_roundDl, result.Dl);
+        HandOff(m_roundDl, result.stamp);
+        LOG_NOTICE(Logger) << "New reactive set points (kVar) of the segment below bus "
+            << m_segment->GetRoot() << ":\n"
+            << arma::join_rows(arma::join_rows(m_roundDl.col(7), m_roundDl.col(9)),
+                m_roundDl.col(11)) << std::endl;
+    }
+
+    std::set<std::string> neighbors;
+    if(CPhysicalTopology::Instance().IsAvailable())
+    {
+        neighbors = CPhysicalTopology::Instance().AdjacentPeers(
+            CGlobalConfiguration::Instance().GetUUID(), ReadFidState());
+    }
+    else if(m_peers)
+    {
+        BOOST_FOREACH(const std::string& uuid, m_peers->peers | boost::adaptors::map_keys)
+        {
+            neighbors.insert(uuid);
+        }
+    }
+
+    BOOST_FOREACH(const std::string& uuid, neighbors)
+    {
+        if(uuid == CGlobalConfiguration::Instance().GetUUID())
+        {
+            continue;
+        }
+        try
+        {
+            CGlobalPeerList::instance().GetPeer(uuid).Send(SegmentBoundary(uuid));
+        }
+        catch(EDgiNoSuchPeerError & e)
+        {
+            LOG_DEBUG(Logger) << "No connection to neighbor " << uuid << std::endl;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// HandOff
+/// @description Sends the reactive set points of each loaded bus to OpenDSS
+///     straight from the feeder model in memory, and queues the model for the
+///     dump file when one is configured.
+/// @pre Called on the broker thread.
+/// @post One command per loaded bus is sent to the OpenDSS adapter, and
+///     the control loop latency of the round is recorded.
+/// @param Dl the feeder model holding the new set points
+/// @param stamp the oldest device state the round read
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::HandOff(const arma::mat& Dl, const device::SControlStamp& stamp)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    // one command per bus keeps each within the adapter's buffer
+    for(unsigned int i = 0; i < Dl.n_rows; i++)
+    {
+        if(Dl(i, 6) == 0 && Dl(i, 8) == 0 && Dl(i, 10) == 0)
+        {
+            continue;
+        }
+        std::ostringstream command;
+        command << "Bus : " << Dl(i, 2) << ",Qa : " << Dl(i, 7)
+                << ",Qb : " << Dl(i, 9) << ",Qc : " << Dl(i, 11);
+        device::COpenDssAdapter::sendCommand(command.str());
+    }
+    device::CControlLoop::Deliver("vvc", stamp);
+
+    if(m_dumpThread.joinable())
+    {
+        m_dumpService.post(boost::bind(&VVCAgent::DumpModel, this, Dl));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// DumpModel
+/// @description Saves a feeder model to the dump file in raw ASCII.
+/// @pre Called on the dump thread.
+/// @post The dump file holds Dl, or an error is logged.
+/// @param Dl the feeder model to save
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::DumpModel(arma::mat Dl)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(!Dl.save(m_dumpPath, arma::raw_ascii))
+    {
+        LOG_WARN(Logger) << "Unable to dump the VVC feeder model to " << m_dumpPath << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// RunDump
+/// @description Runs the dump service with an infinite workload.
+/// @pre Called on the dump thread.
+/// @post Blocks until m_dumpService is stopped.
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::RunDump()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::asio::io_service::work workload(m_dumpService);
+    m_dumpService.run();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// RunCompute
+/// @description Runs the compute service with an infinite workload.
+/// @pre Called on the compute thread.
+/// @post Blocks until m_computeService is stopped.
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::RunCompute()
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    boost::asio::io_service::work workload(m_computeService);
+    m_computeService.run();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ComputeRound
+/// @description Runs vvc_compute on the compute thread and hands the result
+///     back to the broker thread.
+/// @pre Called on the compute thread.
+/// @post QueueResult is posted to the broker's io_service.
+/// @param Dl the feeder model with this round's device readings
+/// @param fids the FID states read with the devices
+/// @param source the voltage the feeder is fed from, empty for the substation
+/// @param stamp the oldest device state read for the round
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::ComputeRound(arma::mat Dl, CPhysicalTopology::FIDState fids,
+    arma::cx_mat source, device::SControlStamp stamp)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    VVCResult result;
+    try
+    {
+        result = vvc_compute(Dl, fids, source);
+    }
+    catch(std::exception & e)
+    {
+        LOG_ERROR(Logger) << "VVC solve failed: " << e.what() << std::endl;
+    }
+    result.stamp = stamp;
+    // CBroker::Schedule runs the worker inline, so it is called from the
+    // broker thread rather than from here
+    CBroker::Instance().GetStrand().post(
+        boost::bind(&VVCAgent::QueueResult, this, result));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// QueueResult
+/// @description Queues the result of an offloaded solve for the VVC phase.
+/// @pre Called on the broker thread.
+/// @post ApplyResult is scheduled for the VVC module.
+/// @param result the outcome of vvc_compute
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::QueueResult(VVCResult result)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    if(CBroker::Instance().Schedule("vvc",
+        boost::bind(&VVCAgent::ApplyResult, this, result)) != 0)
+    {
+        m_computing = false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ApplyResult
+/// @description Applies the result of an offloaded solve.
+/// @pre Called by the scheduler during the VVC phase.
+/// @post The next round may start a new solve.
+/// @param result the outcome of vvc_compute
+///////////////////////////////////////////////////////////////////////////////
+void VVCAgent::ApplyResult(VVCResult result)
+{
+    LOG_TRACE(Logger) << __PRETTY_FUNCTION__ << std::endl;
+
+    m_computing = false;
+    vvc_apply(result);
+}
 
 
 }//namespace vvc
@@ -12,21 +12,30 @@
 #define VoltVarCtrl_HPP_
 
 #include "CBroker.hpp"
+#include "CControlLoop.hpp"
 #include "CDevice.hpp"
 #include "CPeerNode.hpp"
+#include "CPhysicalTopology.hpp"
 #include "PeerSets.hpp"
 #include "IDGIModule.hpp"
+#include "gm/GroupManagement.hpp"
 #include "messages/ModuleMessage.pb.h"
 
 // To include vvc headers
 #include "load_system_data.h"
 #include "fun_return.h"
+#include "CFeederSegment.hpp"
 
 
+#include <limits>
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <boost/asio/io_service.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace freedm {
@@ -54,16 +63,19 @@ private:
     /// First handler for an incoming message.
     void HandleIncomingMessage(boost::shared_ptr<const ModuleMessage> msg, CPeerNode peer);
     void HandlePeerList(const gm::PeerListMessage & m, CPeerNode peer);
-    PeerSet m_peers;
+    gm::MembershipSnapshot m_peers;
     std::string m_leader;
     
     ModuleMessage VoltageDelta(unsigned int cf, float pm, std::string loc);
     ModuleMessage LineReadings(std::vector<float> vals);
     ModuleMessage Gradient(arma::mat grad);	
+    ModuleMessage SegmentBoundary(const std::string& uuid);
     ModuleMessage PrepareForSending(const VoltVarMessage& message, std::string recipient);
     void HandleVoltageDelta(const VoltageDeltaMessage & m, CPeerNode peer);
     void HandleLineReadings(const LineReadingsMessage & m, CPeerNode peer);
     void HandleGradient(const GradientMessage & m, CPeerNode peer);
+    /// Records the boundary values a neighboring feeder segment sent
+    void HandleSegmentBoundary(const SegmentBoundaryMessage & m, CPeerNode peer);
 
 
 
@@ -80,12 +92,206 @@ private:
     /// Updates the node's state.
     //int vvc_main1();
     void vvc_main();
+
+    /// Outcome of one VVC solve
+    struct VVCResult
+    {
+        VVCResult() : send(false) { }
+        /// Set when the new set points should be sent to the slaves
+        bool send;
+        /// Reading location reported in the VoltageDelta message
+        std::string location;
+        /// Feeder model holding the new set points
+        arma::mat Dl;
+        /// Power flow of the feeder model before the new set points
+        VPQ flow;
+        /// Oldest device state the round read
+        device::SControlStamp stamp;
+    };
+    /// Runs the power flow and the gradient step for one round
+    VVCResult vvc_compute(arma::mat Dl, const CPhysicalTopology::FIDState& fids,
+        const arma::cx_mat& source);
+    /// Sends the result of vvc_compute to the slaves
+    void vvc_apply(const VVCResult& result);
+
+    /// A step size tried by the line search
+    struct StepTrial
+    {
+        /// Step size along the gradient
+        double step;
+        /// Power loss of the feeder in kW, infinite when out of bounds
+        double loss;
+    };
+    /// Moves the set points of a feeder model along the gradient
+    void StepModel(const arma::mat& Dl, const arma::mat g[3], double step,
+        arma::mat& out);
+    /// Moves the reactive set point of each load, within its capability
+    void StepLoads(const arma::mat& from, const arma::mat g[3],
+        const double step[3], arma::mat& out) const;
+    /// Runs the power flows of several step sizes at once
+    std::vector<StepTrial> TrySteps(const arma::mat& Dl, const arma::mat g[3],
+        const std::vector<double>& steps, double vmin, double vmax,
+        const dpf_warm* warm);
+    /// Finds the step size with the least loss by a parabolic line search
+    bool LineSearch(const arma::mat& Dl, const arma::mat g[3], double step,
+        double loss, double vmin, double vmax, dpf_warm* warm, arma::mat& best);
+    /// Applies the result of a feeder segment and updates the neighbors
+    void ApplySegment(const VVCResult& result);
+    /// Passes new set points to OpenDSS and the debug dump
+    void HandOff(const arma::mat& Dl, const device::SControlStamp& stamp);
+    /// Saves a feeder model to the dump file
+    void DumpModel(arma::mat Dl);
+    /// Runs the dump service
+    void RunDump();
+    /// Runs the compute service
+    void RunCompute();
+    /// Runs vvc_compute on the compute thread
+    void ComputeRound(arma::mat Dl, CPhysicalTopology::FIDState fids,
+        arma::cx_mat source, device::SControlStamp stamp);
+    /// Queues an offloaded result for the VVC phase
+    void QueueResult(VVCResult result);
+    /// Applies an offloaded result
+    void ApplyResult(VVCResult result);
+
+    /// Topology-dependent VVC data that is reused across rounds
+    struct TopologyCache
+    {
+        TopologyCache() : valid(false), renamed(false), capability(0) { }
+        /// Set once the cache holds data for the current key
+        bool valid;
+        /// Topology columns of Dl the cache was built from
+        arma::mat key;
+        /// Which load columns of Dl were populated
+        arma::umat loads;
+        /// Impedance table the cache was built from
+        arma::cx_mat Z;
+        /// FID states the cache was built from
+        CPhysicalTopology::FIDState fids;
+        /// Admittance matrices and branch table
+        y_re Y;
+        /// Per-phase branch tables
+        arma::cx_mat brn_a, brn_b, brn_c;
+        /// Node and load index vectors
+        arma::mat Node_f, Load_a, Load_b, Load_c;
+        /// Number of loads on each phase
+        int Lla, Llb, Llc;
+        /// Elements of Dl holding the reactive set point each load of
+        /// phases a, b and c moves, as linear indices
+        arma::uvec index[3];
+        /// Position in Load_a, Load_b or Load_c of the load of each element
+        arma::uvec slots[3];
+        /// Reactive limits in kVar of each element, infinite when unknown
+        arma::vec qmin[3], qmax[3];
+        /// Version of m_capability the limits were filled from, 0 for none
+        unsigned long capability;
+        /// Set once brn holds the renamed branch tables for Node_a/b/c
+        bool renamed;
+        /// Per-phase node lists the renamed branches refer to
+        arma::mat Node_a, Node_b, Node_c;
+        /// Renamed per-phase branch tables
+        newbrn brn;
+        /// Sweep order and line data for DPF_return7
+        dpf_plan plan;
+        /// Last converged DPF solution for warm starts
+        dpf_warm warm;
+    };
+
+    /// Reads the state of the attached FIDs
+    CPhysicalTopology::FIDState ReadFidState();
+    /// Checks whether a round may be skipped for the last one's result
+    bool IsQuiet(const arma::mat& Dl, const CPhysicalTopology::FIDState& fids,
+        const arma::cx_mat& source) const;
+    /// Checks whether a power flow is comfortably within the voltage bounds
+    bool WithinBounds(const VPQ& flow) const;
+    /// Compares two node lists
+    static bool SameNodes(const arma::mat& a, const arma::mat& b);
+    /// Checks whether the cached topology matches the feeder model
+    bool TopologyChanged(const arma::mat& Dl, const arma::cx_mat& Z,
+        const CPhysicalTopology::FIDState& fids);
+    /// Rebuilds the cached topology from the feeder model
+    void BuildTopology(const arma::mat& Dl, const sysdata& sysinfo,
+        const CPhysicalTopology::FIDState& fids);
+    /// Reads the reactive limits the SSTs report
+    void ReadCapabilities();
+    /// Fills the limits of the cached topology from the SST capabilities
+    void FillLimits(const arma::mat& Dl);
+
+    /// Reactive limits of the SST of a node and phase, in kVar
+    struct ReactiveLimit
+    {
+        ReactiveLimit() : qmin(-std::numeric_limits<double>::infinity()),
+            qmax(std::numeric_limits<double>::infinity()) { }
+        /// Lowest reactive set point
+        double qmin;
+        /// Highest reactive set point
+        double qmax;
+    };
+    /// Reactive limits by phase and node
+    typedef std::map<std::pair<int, int>, ReactiveLimit> CapabilityMap;
+
+    /// Matrices the size of the feeder model that are reused across rounds
+    struct Workspace
+    {
+        /// Feeder model with this round's device readings, read by vvc_main
+        arma::mat Dl;
+        /// Candidate set points of the step-size search
+        arma::mat Dl_new;
+        /// Set points the search started from
+        arma::mat ctrl_o;
+        /// Set points at the last and the next step size
+        arma::mat Dl_osize, Dl_nsize;
+        /// Change of the set points at the last step size
+        arma::mat du;
+        /// Feeder models of the steps tried together by the line search
+        std::vector<arma::mat> candidates;
+        /// Ftheta, Fv and J of each phase at the last round's voltages
+        sensitivity_cache sensitivity[3];
+    };
+
+    /// Cached topology data
+    TopologyCache m_topo;
+    /// Reactive limits the SSTs reported, by phase and node
+    CapabilityMap m_capability;
+    /// Bumped each time a reported limit changes
+    unsigned long m_capabilityVersion;
+    /// Lock for m_capability, which the compute thread reads
+    boost::mutex m_capabilityMutex;
+    /// Reused matrices of vvc_main and vvc_compute
+    Workspace m_work;
+    /// Feeder model and VVC parameters, loaded once at startup
+    sysdata m_sysinfo;
+    /// The feeder segment this DGI solves, null to solve the whole feeder
+    boost::shared_ptr<CFeederSegment> m_segment;
+    /// The full feeder model of the round whose segment is being solved
+    arma::mat m_roundDl;
+
+    /// Queue of solves for the compute thread
+    boost::asio::io_service m_computeService;
+    /// Thread running vvc_compute when the solve is offloaded
+    boost::thread m_computeThread;
+    /// Set while an offloaded solve has not been applied yet
+    bool m_computing;
+    /// Set once the warm state of the last run was offered to the power flow
+    bool m_warmResumed;
+    /// Set while the last solved round left the feeder within its bounds
+    bool m_quiet;
+    /// Feeder model, FID states and source of the last solved round
+    arma::mat m_quietDl;
+    CPhysicalTopology::FIDState m_quietFids;
+    arma::cx_mat m_quietSource;
+
+    /// Queue of feeder models for the dump thread
+    boost::asio::io_service m_dumpService;
+    /// Thread that writes the feeder models to the dump file
+    boost::thread m_dumpThread;
+    /// The dump file, empty when nothing is dumped
+    std::string m_dumpPath;
     
     ////////////////////////////////////////////////////
     /// The amount of time it takes to do an VVC round
-    const boost::posix_time::time_duration ROUND_TIME;
+    boost::posix_time::time_duration ROUND_TIME;
     /// The time it takes to get a draftrequest response
-    const boost::posix_time::time_duration REQUEST_TIMEOUT;
+    boost::posix_time::time_duration REQUEST_TIMEOUT;
 
     /// Timer handle for the round timer
     CBroker::TimerHandle m_RoundTimer;
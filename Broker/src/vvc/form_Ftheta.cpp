@@ -39,4 +39,28 @@ arma::mat form_Ftheta(arma::cx_mat Y, arma::mat V, arma::mat theta, arma::cx_mat
 		//cout << "Ftheta(" << i << ")=" << Ftheta(i, 0) << endl;
 	}
 	return Ftheta;
-}
\ No newline at end of file
+}
+
+// sparse Y: every branch contributes to at most two entries of Ftheta, so
+// visit each branch once instead of scanning all branches for every node
+arma::mat form_Ftheta(const arma::sp_cx_mat& Y, const arma::mat& V, const arma::mat& theta, const arma::cx_mat& brn, int Ln, int Lnm)
+{
+	arma::mat Ftheta = arma::zeros(Ln - 1,1);
+	const double pi = 3.14159265358979323846;
+	for (int j = 0; j < Lnm; ++j)
+	{
+		int s = (int)real(brn(j, 0));
+		int r = (int)real(brn(j, 1));
+		double G = real(Y(s, r));
+		double dsin = sin((theta(0,s) - theta(0,r))*pi / 180);
+		if (s >= 1 && s < Ln)
+		{
+			Ftheta(s - 1, 0) -= 2 * (-G)*V(s,0)*V(r,0)*(-dsin);
+		}
+		if (r >= 1 && r < Ln)
+		{
+			Ftheta(r - 1, 0) -= 2 * (-G)*V(s,0)*V(r,0)*dsin;
+		}
+	}
+	return Ftheta;
+}
@@ -30,4 +30,27 @@ arma::mat form_Fv(arma::cx_mat Y, arma::mat V, arma::mat theta, arma::cx_mat brn
 		Fv(i, 0) = R;
 	}
 	return Fv;
-}
\ No newline at end of file
+}
+
+// sparse Y: single pass over the branch list, see form_Ftheta
+arma::mat form_Fv(const arma::sp_cx_mat& Y, const arma::mat& V, const arma::mat& theta, const arma::cx_mat& brn, int Ln, int Lnm)
+{
+	arma::mat Fv = arma::zeros(Ln - 1, 1);
+	const double pi = 3.14159265358979323846;
+	for (int j = 0; j < Lnm; ++j)
+	{
+		int s = (int)real(brn(j, 0));
+		int r = (int)real(brn(j, 1));
+		double G = real(Y(s, r));
+		double dcos = cos((theta(0,s) - theta(0,r))*pi / 180);
+		if (s >= 1 && s < Ln)
+		{
+			Fv(s - 1, 0) += 2 * (-G)*(V(s,0) - V(r,0)*dcos);
+		}
+		if (r >= 1 && r < Ln)
+		{
+			Fv(r - 1, 0) += 2 * (-G)*(V(r,0) - V(s,0)*dcos);
+		}
+	}
+	return Fv;
+}
@@ -125,4 +125,110 @@ arma::mat form_J(arma::cx_mat Y, arma::mat V, arma::mat theta, int Lnm)
 	//cout << "L=" << L.cols(0, 4) << endl;
 	
 	return J;
-}
\ No newline at end of file
+}
+
+// sparse Y: H, N, K and L share the sparsity pattern of Y, so only the
+// nonzeros of Y are visited and J is assembled in one batch insertion
+arma::sp_mat form_J(const arma::sp_cx_mat& Y, const arma::mat& V, const arma::mat& theta, int Lnm)
+{
+	const double pi = 3.14159265358979323846;
+	const int n = Lnm - 1;
+	arma::vec Rsin = arma::zeros(Lnm);	// sum of V(m)*(G*sin - B*cos) over m != i
+	arma::vec Rcos = arma::zeros(Lnm);	// sum of V(m)*(G*cos + B*sin) over m != i
+	arma::vec Gd = arma::zeros(Lnm);
+	arma::vec Bd = arma::zeros(Lnm);
+
+	arma::umat loc(2, 4 * Y.n_nonzero + 4 * n);
+	arma::vec val(4 * Y.n_nonzero + 4 * n);
+	int k = 0;
+	for (arma::sp_cx_mat::const_iterator it = Y.begin(); it != Y.end(); ++it)
+	{
+		int i = it.row();
+		int m = it.col();
+		if (i >= Lnm || m >= Lnm)
+			continue;
+		double G = real((arma::cx_double)(*it));
+		double B = imag((arma::cx_double)(*it));
+		if (i == m)
+		{
+			Gd(i) = G;
+			Bd(i) = B;
+			continue;
+		}
+		double dsin = sin((theta(0,i) - theta(0,m))*pi / 180);
+		double dcos = cos((theta(0,i) - theta(0,m))*pi / 180);
+		double a = G*dsin - B*dcos;
+		double b = G*dcos + B*dsin;
+		Rsin(i) += V(m,0)*a;
+		Rcos(i) += V(m,0)*b;
+		if (i >= 1 && m >= 1)
+		{
+			loc(0, k) = i - 1;     loc(1, k) = m - 1;     val(k) = V(i,0)*V(m,0)*a;  ++k; // H
+			loc(0, k) = i - 1;     loc(1, k) = n + m - 1; val(k) = V(i,0)*b;         ++k; // N
+			loc(0, k) = n + i - 1; loc(1, k) = m - 1;     val(k) = -V(i,0)*V(m,0)*b; ++k; // K
+			loc(0, k) = n + i - 1; loc(1, k) = n + m - 1; val(k) = V(i,0)*a;         ++k; // L
+		}
+	}
+	for (int i = 1; i < Lnm; ++i)
+	{
+		loc(0, k) = i - 1;     loc(1, k) = i - 1;     val(k) = -V(i,0)*Rsin(i);                ++k;
+		loc(0, k) = i - 1;     loc(1, k) = n + i - 1; val(k) = Rcos(i) + 2*V(i,0)*Gd(i);       ++k;
+		loc(0, k) = n + i - 1; loc(1, k) = i - 1;     val(k) = V(i,0)*Rcos(i);                 ++k;
+		loc(0, k) = n + i - 1; loc(1, k) = n + i - 1; val(k) = -2*V(i,0)*Bd(i) + Rsin(i);      ++k;
+	}
+	if (k == 0)
+	{
+		return arma::sp_mat(2 * n, 2 * n);
+	}
+	return arma::sp_mat(true, loc.cols(0, k - 1), val.rows(0, k - 1), 2 * n, 2 * n);
+}
+
+arma::mat form_lambda(const arma::mat& J, const arma::mat& Fx)
+{
+	return -inv(J.st())*Fx;//need LAPAC etc
+}
+
+arma::mat form_lambda(const arma::sp_mat& J, const arma::mat& Fx)
+{
+#ifdef ARMA_USE_SUPERLU
+	arma::sp_mat Jt = J.st();
+	return -arma::spsolve(Jt, Fx);
+#else
+	// armadillo was built without SuperLU; fall back to a dense solve
+	arma::mat Jt(J.st());
+	return -arma::solve(Jt, Fx);
+#endif
+}
+
+arma::mat form_lambda_single(const arma::mat& J, const arma::mat& Fx)
+{
+	arma::fmat Jt = arma::conv_to<arma::fmat>::from(J);
+	arma::inplace_trans(Jt);
+	arma::fmat lambda = arma::solve(Jt, arma::conv_to<arma::fmat>::from(Fx));
+	return -arma::conv_to<arma::mat>::from(lambda);
+}
+
+arma::mat form_lambda_single(const arma::sp_mat& J, const arma::mat& Fx)
+{
+	arma::fmat F = arma::conv_to<arma::fmat>::from(Fx);
+	arma::fmat lambda;
+#ifdef ARMA_USE_SUPERLU
+	// transpose while narrowing, by swapping the row and column of each value
+	arma::umat loc(2, J.n_nonzero);
+	arma::fvec val(J.n_nonzero);
+	arma::uword k = 0;
+	for (arma::sp_mat::const_iterator it = J.begin(); it != J.end(); ++it, ++k)
+	{
+		loc(0, k) = it.col();
+		loc(1, k) = it.row();
+		val(k) = static_cast<float>(*it);
+	}
+	arma::sp_fmat Jt(loc, val, J.n_cols, J.n_rows);
+	lambda = arma::spsolve(Jt, F);
+#else
+	arma::fmat Jt = arma::conv_to<arma::fmat>::from(arma::mat(J));
+	arma::inplace_trans(Jt);
+	lambda = arma::solve(Jt, F);
+#endif
+	return -arma::conv_to<arma::mat>::from(lambda);
+}
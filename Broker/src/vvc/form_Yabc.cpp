@@ -2,9 +2,45 @@
 #include "fun_return.h"
 #include "cmath"
 #include <iostream>
+#include <map>
 
 //using namespace arma;
 
+// assemble the admittance matrix of one phase straight from its branch list:
+// every branch adds its admittance to both diagonal entries and subtracts it
+// from the two mutual entries, so Y is built in O(Lnum) instead of O(Lnum^3)
+static arma::sp_cx_mat form_Y_sparse(const arma::cx_mat& brnches_p, const arma::cx_mat& YY_p, int Lnum_p)
+{
+	// node number -> row/col of Y, same ordering as ka/kb/kc below
+	std::map<int, arma::uword> idx;
+	for (int i = Lnum_p - 1; i >= 0; --i)
+	{
+		idx[(int)real(brnches_p(i, 1))] = i + 1;
+	}
+	idx[(int)real(brnches_p(0, 0))] = 0;
+
+	arma::umat loc(2, 4 * Lnum_p);
+	arma::cx_vec val(4 * Lnum_p);
+	int k = 0;
+	for (int x = 0; x < Lnum_p; ++x)
+	{
+		std::map<int, arma::uword>::const_iterator s = idx.find((int)real(brnches_p(x, 0)));
+		std::map<int, arma::uword>::const_iterator r = idx.find((int)real(brnches_p(x, 1)));
+		if (s == idx.end() || r == idx.end())
+			continue;
+		loc(0, k) = s->second; loc(1, k) = s->second; val(k) = YY_p(x); ++k;
+		loc(0, k) = r->second; loc(1, k) = r->second; val(k) = YY_p(x); ++k;
+		loc(0, k) = s->second; loc(1, k) = r->second; val(k) = -YY_p(x); ++k;
+		loc(0, k) = r->second; loc(1, k) = s->second; val(k) = -YY_p(x); ++k;
+	}
+	if (k == 0)
+	{
+		return arma::sp_cx_mat(Lnum_p + 1, Lnum_p + 1);
+	}
+	// add_values=true sums the duplicate diagonal entries
+	return arma::sp_cx_mat(true, loc.cols(0, k - 1), val.rows(0, k - 1), Lnum_p + 1, Lnum_p + 1);
+}
+
 y_re form_Y_abc(arma::mat Dl, arma::cx_mat Z, double bkva, double bkv)
 {
 	y_re y_results;
@@ -97,143 +133,155 @@ y_re form_Y_abc(arma::mat Dl, arma::cx_mat Z, double bkva, double bkv)
 	arma::cx_mat YY_b = arma::cx_mat(arma::zeros(1, Lnum_b), arma::zeros(1, Lnum_b));
 	arma::cx_mat YY_c = arma::cx_mat(arma::zeros(1, Lnum_c), arma::zeros(1, Lnum_c));
 
-	arma::cx_mat cx_unity = arma::cx_mat(arma::ones(1, 1), arma::zeros(1, 1));
+	const arma::cx_double cx_unity(1, 0);
 
 	for (int i = 0; i < Lnum_a; ++i)
 	{
-		YY_a(0, i) = cx_unity(0, 0) / brnches_a(i, 2);
+		YY_a(0, i) = cx_unity / brnches_a(i, 2);
 
 	}
 	//cout << YY_a<< endl;
 	for (int i = 0; i < Lnum_b; ++i)
 	{
-		YY_b(0, i) = cx_unity(0, 0) / brnches_b(i, 2);
+		YY_b(0, i) = cx_unity / brnches_b(i, 2);
 
 	}
 	//cout << YY_b<< endl;
 	for (int i = 0; i < Lnum_c; ++i)
 	{
-		YY_c(0, i) = cx_unity(0, 0) / brnches_c(i, 2);
+		YY_c(0, i) = cx_unity / brnches_c(i, 2);
 
 	}
 	//cout << YY_c<< endl;
 
-	//element in Y of three phase are different, then treat separately 
-	//phase A
-
-	arma::cx_mat AA;
-	AA << brnches_a(0, 0) << arma::endr;
-	arma::cx_mat BB = brnches_a.col(1);
-	arma::cx_mat ka = join_cols(AA, BB);
-	//cout << ka << endl;
-	arma::cx_mat Y_a = arma::cx_mat(arma::zeros(Lnum_a + 1, Lnum_a + 1), arma::zeros(Lnum_a + 1, Lnum_a + 1));
-	//int n = 0;
-	for (int m = 0; m < (Lnum_a + 1); ++m)
+	y_results.sparse = (Lbr + 1) >= SPARSE_NODE_THRESHOLD;
+	if (y_results.sparse)
+	{
+		y_results.Ysp_a = form_Y_sparse(brnches_a, YY_a, Lnum_a);
+		y_results.Ysp_b = form_Y_sparse(brnches_b, YY_b, Lnum_b);
+		y_results.Ysp_c = form_Y_sparse(brnches_c, YY_c, Lnum_c);
+	}
+	else
 	{
-		for (int n = 0; n < (Lnum_a + 1); ++n)
+		//element in Y of three phase are different, then treat separately 
+		//phase A
+
+		arma::cx_mat AA;
+		AA << brnches_a(0, 0) << arma::endr;
+		arma::cx_mat BB = brnches_a.col(1);
+		arma::cx_mat ka = join_cols(AA, BB);
+		//cout << ka << endl;
+		arma::cx_mat Y_a = arma::cx_mat(arma::zeros(Lnum_a + 1, Lnum_a + 1), arma::zeros(Lnum_a + 1, Lnum_a + 1));
+		//int n = 0;
+		for (int m = 0; m < (Lnum_a + 1); ++m)
 		{
-			//cout << "m=" << m << "n=" << n << endl;
-			if (m == n)
+			for (int n = 0; n < (Lnum_a + 1); ++n)
 			{
-				for (int x = 0; x < Lnum_a; ++x)
+				//cout << "m=" << m << "n=" << n << endl;
+				if (m == n)
 				{
-					if ((int)(real(brnches_a(x, 0))) == (int)real(ka(m)) || (int)(real(brnches_a(x, 1))) == (int)real(ka(m)))
-						Y_a(m, n) = Y_a(m, n) + YY_a(x);
+					for (int x = 0; x < Lnum_a; ++x)
+					{
+						if ((int)(real(brnches_a(x, 0))) == (int)real(ka(m)) || (int)(real(brnches_a(x, 1))) == (int)real(ka(m)))
+							Y_a(m, n) = Y_a(m, n) + YY_a(x);
+					}
 				}
-			}
-			else
-			{
-				for (int x = 0; x < Lnum_a; ++x)
+				else
 				{
-					if ((int)(real(brnches_a(x, 0))) == (int)real(ka(m)) && (int)(real(brnches_a(x, 1))) == (int)real(ka(n)))
-						Y_a(m, n) = Y_a(m, n) - YY_a(x);
-				}
-				for (int x = 0; x < Lnum_a; ++x)
-				{
-					if ((int)(real(brnches_a(x, 1))) == (int)real(ka(m)) && (int)(real(brnches_a(x, 0))) == (int)real(ka(n)))
-						Y_a(m, n) = Y_a(m, n) - YY_a(x);
+					for (int x = 0; x < Lnum_a; ++x)
+					{
+						if ((int)(real(brnches_a(x, 0))) == (int)real(ka(m)) && (int)(real(brnches_a(x, 1))) == (int)real(ka(n)))
+							Y_a(m, n) = Y_a(m, n) - YY_a(x);
+					}
+					for (int x = 0; x < Lnum_a; ++x)
+					{
+						if ((int)(real(brnches_a(x, 1))) == (int)real(ka(m)) && (int)(real(brnches_a(x, 0))) == (int)real(ka(n)))
+							Y_a(m, n) = Y_a(m, n) - YY_a(x);
+					}
 				}
 			}
 		}
-	}
-	//cout <<real(Y_a.col(15))<< endl;
+		//cout <<real(Y_a.col(15))<< endl;
 
-	//phase B
-	arma::cx_mat AB;
-	AB << brnches_b(0, 0) << arma::endr;
-	arma::cx_mat BBB = brnches_b.col(1);
-	arma::cx_mat kb = join_cols(AB, BBB);
-	arma::cx_mat Y_b = arma::cx_mat(arma::zeros(Lnum_b + 1, Lnum_b + 1), arma::zeros(Lnum_b + 1, Lnum_b + 1));
-	//int n = 0;
-	for (int m = 0; m < (Lnum_b + 1); ++m)
-	{
-		for (int n = 0; n < (Lnum_b + 1); ++n)
+		//phase B
+		arma::cx_mat AB;
+		AB << brnches_b(0, 0) << arma::endr;
+		arma::cx_mat BBB = brnches_b.col(1);
+		arma::cx_mat kb = join_cols(AB, BBB);
+		arma::cx_mat Y_b = arma::cx_mat(arma::zeros(Lnum_b + 1, Lnum_b + 1), arma::zeros(Lnum_b + 1, Lnum_b + 1));
+		//int n = 0;
+		for (int m = 0; m < (Lnum_b + 1); ++m)
 		{
-			//cout << "m=" << m << "n=" << n << endl;
-			if (m == n)
-			{
-				for (int x = 0; x < Lnum_b; ++x)
-				{
-					if ((int)(real(brnches_b(x, 0))) == (int)real(kb(m)) || (int)(real(brnches_b(x, 1))) == (int)real(kb(m)))
-						Y_b(m, n) = Y_b(m, n) + YY_b(x);
-				}
-			}
-			else
+			for (int n = 0; n < (Lnum_b + 1); ++n)
 			{
-				for (int x = 0; x < Lnum_b; ++x)
+				//cout << "m=" << m << "n=" << n << endl;
+				if (m == n)
 				{
-					if ((int)(real(brnches_b(x, 0))) == (int)real(kb(m)) && (int)(real(brnches_b(x, 1))) == (int)real(kb(n)))
-						Y_b(m, n) = Y_b(m, n) - YY_b(x);
+					for (int x = 0; x < Lnum_b; ++x)
+					{
+						if ((int)(real(brnches_b(x, 0))) == (int)real(kb(m)) || (int)(real(brnches_b(x, 1))) == (int)real(kb(m)))
+							Y_b(m, n) = Y_b(m, n) + YY_b(x);
+					}
 				}
-				for (int x = 0; x < Lnum_b; ++x)
+				else
 				{
-					if ((int)(real(brnches_b(x, 1))) == (int)real(kb(m)) && (int)(real(brnches_b(x, 0))) == (int)real(kb(n)))
-						Y_b(m, n) = Y_b(m, n) - YY_b(x);
+					for (int x = 0; x < Lnum_b; ++x)
+					{
+						if ((int)(real(brnches_b(x, 0))) == (int)real(kb(m)) && (int)(real(brnches_b(x, 1))) == (int)real(kb(n)))
+							Y_b(m, n) = Y_b(m, n) - YY_b(x);
+					}
+					for (int x = 0; x < Lnum_b; ++x)
+					{
+						if ((int)(real(brnches_b(x, 1))) == (int)real(kb(m)) && (int)(real(brnches_b(x, 0))) == (int)real(kb(n)))
+							Y_b(m, n) = Y_b(m, n) - YY_b(x);
+					}
 				}
 			}
 		}
-	}
-	//cout <<real(Y_b.col(3))<< endl;
+		//cout <<real(Y_b.col(3))<< endl;
 
-	//phase C
-	arma::cx_mat AC;
-	AC << brnches_c(0, 0) << arma::endr;
-	arma::cx_mat BC = brnches_c.col(1);
-	arma::cx_mat kc = join_cols(AC, BC);
-	arma::cx_mat Y_c = arma::cx_mat(arma::zeros(Lnum_c + 1, Lnum_c + 1), arma::zeros(Lnum_c + 1, Lnum_c + 1));
-	//int n = 0;
-	for (int m = 0; m < (Lnum_c + 1); ++m)
-	{
-		for (int n = 0; n < (Lnum_c + 1); ++n)
+		//phase C
+		arma::cx_mat AC;
+		AC << brnches_c(0, 0) << arma::endr;
+		arma::cx_mat BC = brnches_c.col(1);
+		arma::cx_mat kc = join_cols(AC, BC);
+		arma::cx_mat Y_c = arma::cx_mat(arma::zeros(Lnum_c + 1, Lnum_c + 1), arma::zeros(Lnum_c + 1, Lnum_c + 1));
+		//int n = 0;
+		for (int m = 0; m < (Lnum_c + 1); ++m)
 		{
-			//cout << "m=" << m << "n=" << n << endl;
-			if (m == n)
-			{
-				for (int x = 0; x < Lnum_c; ++x)
-				{
-					if ((int)(real(brnches_c(x, 0))) == (int)real(kc(m)) || (int)(real(brnches_c(x, 1))) == (int)real(kc(m)))
-						Y_c(m, n) = Y_c(m, n) + YY_c(x);
-				}
-			}
-			else
+			for (int n = 0; n < (Lnum_c + 1); ++n)
 			{
-				for (int x = 0; x < Lnum_c; ++x)
+				//cout << "m=" << m << "n=" << n << endl;
+				if (m == n)
 				{
-					if ((int)(real(brnches_c(x, 0))) == (int)real(kc(m)) && (int)(real(brnches_c(x, 1))) == (int)real(kc(n)))
-						Y_c(m, n) = Y_c(m, n) - YY_c(x);
+					for (int x = 0; x < Lnum_c; ++x)
+					{
+						if ((int)(real(brnches_c(x, 0))) == (int)real(kc(m)) || (int)(real(brnches_c(x, 1))) == (int)real(kc(m)))
+							Y_c(m, n) = Y_c(m, n) + YY_c(x);
+					}
 				}
-				for (int x = 0; x < Lnum_c; ++x)
+				else
 				{
-					if ((int)(real(brnches_c(x, 1))) == (int)real(kc(m)) && (int)(real(brnches_c(x, 0))) == (int)real(kc(n)))
-						Y_c(m, n) = Y_c(m, n) - YY_c(x);
+					for (int x = 0; x < Lnum_c; ++x)
+					{
+						if ((int)(real(brnches_c(x, 0))) == (int)real(kc(m)) && (int)(real(brnches_c(x, 1))) == (int)real(kc(n)))
+							Y_c(m, n) = Y_c(m, n) - YY_c(x);
+					}
+					for (int x = 0; x < Lnum_c; ++x)
+					{
+						if ((int)(real(brnches_c(x, 1))) == (int)real(kc(m)) && (int)(real(brnches_c(x, 0))) == (int)real(kc(n)))
+							Y_c(m, n) = Y_c(m, n) - YY_c(x);
+					}
 				}
 			}
 		}
+		//cout <<real(Y_c.col(13))<< endl;
+		y_results.Y_a = Y_a;
+		y_results.Y_b = Y_b;
+		y_results.Y_c = Y_c;
 	}
-	//cout <<real(Y_c.col(13))<< endl;
 
-	arma::cx_mat Nnum1 = arma::cx_mat(arma::zeros(1, 1), arma::zeros(1, 1));
-	Nnum1 = max(join_cols(brnches.col(1), brnches.col(0)), 0);
+	arma::cx_mat Nnum1 = max(join_cols(brnches.col(1), brnches.col(0)), 0);
 
 	int Nnum = (int)real(Nnum1(0, 0)) + 1;// NodeNo starts form 0, count of nodes should +1
 	//cout << Nnum << endl;
@@ -245,9 +293,6 @@ y_re form_Y_abc(arma::mat Dl, arma::cx_mat Z, double bkva, double bkv)
 	y_results.Lnum_b = Lnum_b;
 	y_results.Lnum_c = Lnum_c;
 	y_results.Nnum = Nnum;
-	y_results.Y_a = Y_a;
-	y_results.Y_b = Y_b;
-	y_results.Y_c = Y_c;
 
 	//mat rY_a = real(Y_a);
 	//rY_a.save("Ya.mat", raw_ascii);
@@ -2,12 +2,21 @@
 #define FUN_RETURN_HPP_
 
 #include <armadillo>
+#include <vector>
 //using namespace arma;
+
+// feeders with at least this many nodes use the sparse Y/J path
+const int SPARSE_NODE_THRESHOLD = 64;
+
 struct y_re   //output of form_Yabc_34(*)
 {
 	arma::cx_mat Y_a;
 	arma::cx_mat Y_b;
 	arma::cx_mat Y_c;
+	bool sparse; // true when only Ysp_a/b/c are filled in
+	arma::sp_cx_mat Ysp_a;
+	arma::sp_cx_mat Ysp_b;
+	arma::sp_cx_mat Ysp_c;
 	arma::cx_mat brnches;
 	int Nnum;
 	arma::mat Lnum;
@@ -47,14 +56,146 @@ struct VPQ //output of DPF ( Voltage PQb and PQL)
 	arma::mat PQL;
 	arma::mat Ib;
 	arma::mat IL;
+	arma::cx_mat V; // bus voltages in p.u. by bus number, the source first
 	arma::mat Qset_a,Qset_b,Qset_c;
+	int iterations; // sweeps used by the solve
+	bool converged;
+};
+
+struct dpf_plan //sweep order and per-unit line data derived from Dl and Z
+{
+	dpf_plan() : cnt_nodes(0), n_bus(0), threads(1) { }
+	int cnt_nodes;
+	int n_bus;
+	std::vector<int> load_row, load_node;
+	std::vector<int> bwd_node;	// bus of each backward sweep step
+	std::vector<char> bwd_flush;	// 1 when the step closes a lateral
+	std::vector<int> fwd_src, fwd_rcv;
+	std::vector<double> fwd_zr, fwd_zi;	// lng*Z/Zb, 9 entries per branch
+	std::vector<char> fwd_mask;	// 0 for phases a branch does not carry
+	arma::cx_mat V0;	// source voltage in p.u., empty for the substation's
+	// the laterals of a radial feeder, empty when the sweep must run in order
+	std::vector<int> lat_begin;	// first forward step of each lateral, then the step count
+	std::vector<int> lat_node;	// bus each forward step feeds, as the backward sweep sees it
+	std::vector<int> lat_junction;	// bus each lateral hangs from
+	std::vector<int> lat_child_begin, lat_child;	// laterals hanging from each lateral
+	std::vector<int> level_begin, lat_order;	// laterals by depth below the main feeder
+	unsigned int threads;	// threads one sweep runs on, 1 to sweep in order
+};
+
+struct dpf_warm //last converged DPF solution, used as the next starting point
+{
+	dpf_warm() : valid(false), iterations(0) { }
+	bool valid;
+	arma::cx_mat V;		// bus voltages in the sweep's bus numbering
+	arma::cx_mat Ib0;	// substation branch current
+	int iterations;		// sweeps used by the most recent solve
 };
 
+dpf_plan DPF_plan(const arma::mat& Dl, const arma::cx_mat& Z, double bkva, double bkv);
+int DPF_sweep(const dpf_plan& plan, const arma::cx_mat& Sld, const arma::cx_mat& V0, double eps, int mxitr,
+	const dpf_warm* warm, arma::cx_mat& V, arma::cx_mat& Ib, arma::cx_mat& IL, bool& converged);
+
 VPQ DPF_return7(arma::mat Dl, arma::cx_mat Z);
+VPQ DPF_return7(arma::mat Dl, arma::cx_mat Z, const dpf_plan& plan, dpf_warm* warm = NULL);
+
+struct dpf_candidate // outcome of one what-if DPF
+{
+	double loss;       // total line loss in kW
+	double vmin, vmax; // lowest and highest bus voltage in p.u.
+	bool converged;
+};
+
+// one DPF per candidate feeder model, on up to threads threads at once;
+// each solve starts from its own copy of warm, which is left unchanged
+std::vector<dpf_candidate> DPF_batch(const std::vector<arma::mat>& models, const arma::cx_mat& Z,
+	const dpf_plan& plan, const dpf_warm* warm, unsigned int threads);
+
+struct dpf_point // outcome of the DPF of one time point of a series
+{
+	double loss;       // total line loss in kW
+	double p_sub;      // real power drawn from the substation in kW
+	double vmin, vmax; // lowest and highest bus voltage in p.u.
+	int iterations;
+	bool converged;
+};
+
+class dpf_series_sink // receives each time point of DPF_series as it is solved
+{
+public:
+	virtual ~dpf_series_sink() { }
+	// called under a lock, in time order within a block but not across
+	// blocks; V is the solution in the sweep's bus numbering
+	virtual void point(unsigned int t, const dpf_point& result, const arma::cx_mat& V) = 0;
+};
+
+// one DPF per column of profiles on the fixed feeder of Dl and plan; a column
+// scales the loads of each Dl row, or of the whole feeder if profiles has one
+// row. Blocks of consecutive points run on up to threads threads, each point
+// warm started from the one before it, and the first from warm if given.
+void DPF_series(const arma::mat& Dl, const arma::mat& profiles, const dpf_plan& plan,
+	const dpf_warm* warm, unsigned int threads, unsigned int block, dpf_series_sink& sink);
 
 
 arma::mat form_Ftheta(arma::cx_mat Y, arma::mat V, arma::mat theta, arma::cx_mat brn, int Ln, int Lnm);//output of form_Ftheta(*)
 arma::mat form_Fv(arma::cx_mat Y, arma::mat V, arma::mat theta, arma::cx_mat brn, int Ln, int Lnm);//output of form_Fv(*)
 arma::mat form_J(arma::cx_mat Y, arma::mat V, arma::mat theta, int Lnm);//out put of form_J(*)
 
+// sparse counterparts, linear in the number of branches
+arma::mat form_Ftheta(const arma::sp_cx_mat& Y, const arma::mat& V, const arma::mat& theta, const arma::cx_mat& brn, int Ln, int Lnm);
+arma::mat form_Fv(const arma::sp_cx_mat& Y, const arma::mat& V, const arma::mat& theta, const arma::cx_mat& brn, int Ln, int Lnm);
+arma::sp_mat form_J(const arma::sp_cx_mat& Y, const arma::mat& V, const arma::mat& theta, int Lnm);
+
+// lambda = -inv(J')*Fx for either Jacobian representation
+arma::mat form_lambda(const arma::mat& J, const arma::mat& Fx);
+arma::mat form_lambda(const arma::sp_mat& J, const arma::mat& Fx);
+// the same solve in single precision; J and Fx are formed in double, and
+// only the factorization and the triangular solves run on floats
+arma::mat form_lambda_single(const arma::mat& J, const arma::mat& Fx);
+arma::mat form_lambda_single(const arma::sp_mat& J, const arma::mat& Fx);
+
+struct sensitivity_cache //Ftheta, Fv and J of a phase, kept across rounds
+{
+	sensitivity_cache() : valid(false), sparse(false), Ln(0), Lnum(0), diag(0) { }
+	bool valid, sparse;
+	int Ln, Lnum;
+	arma::mat V, theta;	// voltages the cached rows were formed at
+	arma::mat Ftheta, Fv;
+	arma::mat J;		// dense Y
+	arma::sp_mat Jsp;	// sparse Y
+	arma::umat Jloc;	// entries of J, 4 per off-diagonal slot then 4 per node
+	arma::vec Jval;
+	int diag;		// first diagonal entry of Jloc
+	std::vector<int> yi, ym, slot;	// off-diagonal nonzeros of Y and their J slot, -1 if none
+	std::vector<double> yG, yB;
+	arma::vec Gd, Bd, Rsin, Rcos;
+	std::vector<int> bs, br;	// branch ends and conductances
+	std::vector<double> bG;
+};
+
+struct phase_input //everything one phase of the gradient calculation reads
+{
+	bool sparse;
+	const arma::cx_mat* Y;
+	const arma::sp_cx_mat* Ysp;
+	const arma::cx_mat* brn;
+	const arma::mat* Node;
+	const arma::mat* Load;
+	arma::mat V, theta;
+	int Ln, Lnum, Ll;
+	sensitivity_cache* cache;	// NULL to form Ftheta, Fv and J in full
+	double tolerance;	// p.u. and rad a node moves before its rows are formed again
+	bool single;	// solve for lambda in single precision
+	double* deviation;	// if single and not NULL, also solve in double and store the largest relative difference
+};
+
+// brings the cached Ftheta, Fv and J up to date with the voltages of in,
+// returns the number of nodes that moved
+int phase_sensitivity(const phase_input& in, sensitivity_cache& cache);
+
+// df/dQinj of a single phase
+arma::mat phase_gradient(const phase_input& in);
+// all three phases, on one thread each when parallel is set
+void phase_gradients(const phase_input in[3], arma::mat out[3], bool parallel);
+
 #endif
\ No newline at end of file
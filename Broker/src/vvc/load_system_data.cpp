@@ -1,4 +1,5 @@
 #include <armadillo>
+#include <stdexcept>
 #include "load_system_data.h"
 //using namespace arma;
 
@@ -57,4 +58,33 @@ sysdata load_system_data()
 
 
 	return data1;
-};
\ No newline at end of file
+};
+
+sysdata load_system_data(const std::string& dl_file, const std::string& z_file)
+{
+	sysdata data1 = load_system_data();
+
+	arma::mat Dl;
+	if (!Dl.load(dl_file) || Dl.n_rows == 0 || Dl.n_cols != data1.Dl.n_cols)
+	{
+		throw std::runtime_error("Unable to load feeder model: " + dl_file);
+	}
+	data1.Dl = Dl;
+
+	if (!z_file.empty())
+	{
+		arma::mat RX;
+		if (!RX.load(z_file) || RX.n_rows == 0 || RX.n_rows % 3 != 0 || RX.n_cols != 6)
+		{
+			throw std::runtime_error("Unable to load line impedances: " + z_file);
+		}
+		data1.Z = arma::cx_mat(RX.cols(0, 2), RX.cols(3, 5));
+	}
+
+	// every line code used by the feeder needs a 3x3 block in Z
+	if (Dl.col(3).max() * 3 > data1.Z.n_rows || Dl.col(3).min() < 0)
+	{
+		throw std::runtime_error("Feeder model uses an undefined line code: " + dl_file);
+	}
+	return data1;
+}
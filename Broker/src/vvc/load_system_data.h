@@ -2,6 +2,7 @@
 #define LOAD_SYSTEM_DATA_HPP_
 
 #include "armadillo"
+#include <string>
 //using namespace arma;
 struct sysdata{
 	double Rpv;
@@ -23,5 +24,9 @@ struct sysdata{
 	arma::cx_mat Z;
 };
 sysdata load_system_data();
+// same parameters, with Dl and the impedances read from files written by
+// arma::mat::save (arma_binary, raw_ascii or csv). The impedance file holds
+// [R X] with three rows per line code; if omitted the built-in Z is kept.
+sysdata load_system_data(const std::string& dl_file, const std::string& z_file);
 
 #endif
\ No newline at end of file
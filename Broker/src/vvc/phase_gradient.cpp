@@ -0,0 +1,128 @@
+# include <armadillo>
+# include <stdexcept>
+# include <string>
+# include <boost/bind.hpp>
+# include <boost/thread/thread.hpp>
+# include "fun_return.h"
+
+// Loss gradient with respect to the reactive injections of one phase.
+// The three phases only share read-only inputs, so they can be computed
+// on separate threads.
+
+namespace {
+
+// lambda in the precision the phase asks for; a single precision solve can
+// be checked against the double one, relative to the largest double value
+template <typename Jacobian>
+arma::mat solve_lambda(const phase_input& in, const Jacobian& J, const arma::mat& Fx)
+{
+	if (!in.single)
+	{
+		return form_lambda(J, Fx);
+	}
+	arma::mat lambda = form_lambda_single(J, Fx);
+	if (in.deviation != NULL)
+	{
+		arma::mat exact = form_lambda(J, Fx);
+		double scale = exact.n_elem > 0 ? arma::abs(exact).max() : 0;
+		*in.deviation = scale > 0 ? arma::abs(lambda - exact).max() / scale : 0;
+	}
+	return lambda;
+}
+
+}
+
+arma::mat phase_gradient(const phase_input& in)
+{
+	arma::mat Ftheta, Fv, lambda;
+	if (in.cache != NULL)
+	{
+		phase_sensitivity(in, *in.cache);
+		Ftheta = in.cache->Ftheta;
+		Fv = in.cache->Fv;
+		if (in.sparse)
+		{
+			lambda = solve_lambda(in, in.cache->Jsp, join_cols(Ftheta, Fv));
+		}
+		else
+		{
+			lambda = solve_lambda(in, in.cache->J, join_cols(Ftheta, Fv));
+		}
+	}
+	else if (in.sparse)
+	{
+		Ftheta = form_Ftheta(*in.Ysp, in.V, in.theta, *in.brn, in.Ln, in.Lnum);
+		Fv = form_Fv(*in.Ysp, in.V, in.theta, *in.brn, in.Ln, in.Lnum);
+		arma::sp_mat J = form_J(*in.Ysp, in.V, in.theta, in.Ln);
+		lambda = solve_lambda(in, J, join_cols(Ftheta, Fv));
+	}
+	else
+	{
+		//deltaF/deltaTheta and deltaF/deltaV
+		Ftheta = form_Ftheta(*in.Y, in.V, in.theta, *in.brn, in.Ln, in.Lnum);
+		Fv = form_Fv(*in.Y, in.V, in.theta, *in.brn, in.Ln, in.Lnum);
+		arma::mat J = form_J(*in.Y, in.V, in.theta, in.Ln);
+		lambda = solve_lambda(in, J, join_cols(Ftheta, Fv));
+	}
+
+	//deltaP/delta_Qinj
+	arma::mat Gpq = arma::zeros(in.Lnum, in.Ll);
+	//deltaQ/delta_Qinj
+	arma::mat Gqq = arma::zeros(in.Lnum, in.Ll);
+	for (int i = 0; i < in.Lnum; ++i)
+	{
+		for (int j = 0; j < in.Ll; ++j)
+		{
+			if ((*in.Node)(0, i + 1) == (*in.Load)(0, j))
+			{
+				Gqq(i, j) = -1;
+			}
+		}
+	}
+	arma::mat gu = join_cols(Gpq, Gqq);
+	return -gu.st()*lambda;//Gradient in p.u.  aka df/du , u is Qinj
+}
+
+namespace {
+
+void phase_worker(const phase_input* in, arma::mat* out, std::string* error)
+{
+	try
+	{
+		*out = phase_gradient(*in);
+	}
+	catch (std::exception& e)
+	{
+		*error = e.what();
+	}
+}
+
+}
+
+void phase_gradients(const phase_input in[3], arma::mat out[3], bool parallel)
+{
+	std::string error[3];
+	if (parallel)
+	{
+		boost::thread_group workers;
+		for (int p = 0; p < 3; p++)
+		{
+			workers.create_thread(boost::bind(&phase_worker, &in[p], &out[p], &error[p]));
+		}
+		workers.join_all();
+	}
+	else
+	{
+		for (int p = 0; p < 3; p++)
+		{
+			phase_worker(&in[p], &out[p], &error[p]);
+		}
+	}
+	for (int p = 0; p < 3; p++)
+	{
+		if (!error[p].empty())
+		{
+			throw std::runtime_error("VVC gradient of phase " + std::string(1, char('A' + p)) + ": " + error[p]);
+		}
+	}
+}
@@ -0,0 +1,272 @@
+# include <armadillo>
+# include <cmath>
+# include "fun_return.h"
+
+// Ftheta, Fv and J of one phase, kept from round to round. A row of these
+// only reads the voltages of its node and of the nodes next to it, so after
+// a power flow that moved a few nodes only their rows and their neighbors'
+// are formed again. Every other row still holds what form_Ftheta, form_Fv
+// and form_J would compute.
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+void add_entry(sensitivity_cache& cache, int i, int m, const arma::cx_double& y, int Ln, int& slots)
+{
+	if (i >= Ln || m >= Ln)
+	{
+		return;
+	}
+	if (i == m)
+	{
+		cache.Gd(i) = real(y);
+		cache.Bd(i) = imag(y);
+		return;
+	}
+	cache.yi.push_back(i);
+	cache.ym.push_back(m);
+	cache.yG.push_back(real(y));
+	cache.yB.push_back(imag(y));
+	cache.slot.push_back(i >= 1 && m >= 1 ? slots++ : -1);
+}
+
+// everything taken from Y and the branch list, which only change with the topology
+void sensitivity_topology(const phase_input& in, sensitivity_cache& cache)
+{
+	const int n = in.Ln - 1;
+	cache.yi.clear();
+	cache.ym.clear();
+	cache.yG.clear();
+	cache.yB.clear();
+	cache.slot.clear();
+	cache.Gd = arma::zeros(in.Ln);
+	cache.Bd = arma::zeros(in.Ln);
+	int slots = 0;
+	if (in.sparse)
+	{
+		for (arma::sp_cx_mat::const_iterator it = in.Ysp->begin(); it != in.Ysp->end(); ++it)
+		{
+			add_entry(cache, it.row(), it.col(), (arma::cx_double)(*it), in.Ln, slots);
+		}
+	}
+	else
+	{
+		// an off-diagonal zero of Y adds nothing to J, so only the nonzeros are kept
+		for (int i = 0; i < in.Ln; ++i)
+		{
+			for (int m = 0; m < in.Ln; ++m)
+			{
+				if ((*in.Y)(i, m) != arma::cx_double(0, 0))
+				{
+					add_entry(cache, i, m, (*in.Y)(i, m), in.Ln, slots);
+				}
+			}
+		}
+	}
+
+	// H, N, K and L entries of each off-diagonal slot, then the diagonals
+	cache.Jloc.set_size(2, 4 * slots + 4 * n);
+	cache.Jval = arma::zeros(4 * slots + 4 * n);
+	for (unsigned int k = 0; k < cache.yi.size(); ++k)
+	{
+		int q = cache.slot[k];
+		if (q < 0)
+		{
+			continue;
+		}
+		unsigned int r = cache.yi[k] - 1;
+		unsigned int c = cache.ym[k] - 1;
+		cache.Jloc(0, 4*q)     = r;     cache.Jloc(1, 4*q)     = c;
+		cache.Jloc(0, 4*q + 1) = r;     cache.Jloc(1, 4*q + 1) = n + c;
+		cache.Jloc(0, 4*q + 2) = n + r; cache.Jloc(1, 4*q + 2) = c;
+		cache.Jloc(0, 4*q + 3) = n + r; cache.Jloc(1, 4*q + 3) = n + c;
+	}
+	for (int i = 0; i < n; ++i)
+	{
+		int q = 4 * slots + 4 * i;
+		cache.Jloc(0, q)     = i;     cache.Jloc(1, q)     = i;
+		cache.Jloc(0, q + 1) = i;     cache.Jloc(1, q + 1) = n + i;
+		cache.Jloc(0, q + 2) = n + i; cache.Jloc(1, q + 2) = i;
+		cache.Jloc(0, q + 3) = n + i; cache.Jloc(1, q + 3) = n + i;
+	}
+	cache.diag = 4 * slots;
+
+	cache.bs.resize(in.Lnum);
+	cache.br.resize(in.Lnum);
+	cache.bG.resize(in.Lnum);
+	for (int j = 0; j < in.Lnum; ++j)
+	{
+		int s = (int)real((*in.brn)(j, 0));
+		int r = (int)real((*in.brn)(j, 1));
+		cache.bs[j] = s;
+		cache.br[j] = r;
+		cache.bG[j] = in.sparse ? real((arma::cx_double)(*in.Ysp)(s, r)) : real((*in.Y)(s, r));
+	}
+
+	cache.Ftheta = arma::zeros(n, 1);
+	cache.Fv = arma::zeros(n, 1);
+	cache.Rsin = arma::zeros(in.Ln);
+	cache.Rcos = arma::zeros(in.Ln);
+	if (!in.sparse)
+	{
+		cache.J = arma::zeros(2 * n, 2 * n);
+	}
+	cache.sparse = in.sparse;
+	cache.Ln = in.Ln;
+	cache.Lnum = in.Lnum;
+}
+
+}
+
+int phase_sensitivity(const phase_input& in, sensitivity_cache& cache)
+{
+	const double tolerance = in.tolerance;
+	const int n = in.Ln - 1;
+	std::vector<char> changed(in.Ln, 0);
+	int moved = 0;
+	if (!cache.valid || cache.sparse != in.sparse || cache.Ln != in.Ln || cache.Lnum != in.Lnum)
+	{
+		sensitivity_topology(in, cache);
+		cache.V = in.V;
+		cache.theta = in.theta;
+		changed.assign(in.Ln, 1);
+		moved = in.Ln;
+		cache.valid = true;
+	}
+	else
+	{
+		// the rows are formed at cache.V, which only follows in.V once a node
+		// moves beyond the tolerance, so slow drift is caught up with too
+		for (int i = 0; i < in.Ln; ++i)
+		{
+			if (std::fabs(in.V(i, 0) - cache.V(i, 0)) > tolerance ||
+				std::fabs((in.theta(0, i) - cache.theta(0, i))*pi / 180) > tolerance)
+			{
+				cache.V(i, 0) = in.V(i, 0);
+				cache.theta(0, i) = in.theta(0, i);
+				changed[i] = 1;
+				moved++;
+			}
+		}
+		if (moved == 0)
+		{
+			return 0;
+		}
+	}
+	const arma::mat& V = cache.V;
+	const arma::mat& theta = cache.theta;
+
+	// a row is formed again if its node or a node next to it moved
+	std::vector<char> affected(changed);
+	for (unsigned int k = 0; k < cache.yi.size(); ++k)
+	{
+		if (changed[cache.ym[k]])
+		{
+			affected[cache.yi[k]] = 1;
+		}
+	}
+	for (int j = 0; j < in.Lnum; ++j)
+	{
+		int s = cache.bs[j];
+		int r = cache.br[j];
+		if (s < in.Ln && r < in.Ln && (changed[s] || changed[r]))
+		{
+			affected[s] = 1;
+			affected[r] = 1;
+		}
+	}
+
+	// Ftheta and Fv, as in the sparse form_Ftheta and form_Fv
+	for (int i = 1; i < in.Ln; ++i)
+	{
+		if (affected[i])
+		{
+			cache.Ftheta(i - 1, 0) = 0;
+			cache.Fv(i - 1, 0) = 0;
+		}
+	}
+	for (int j = 0; j < in.Lnum; ++j)
+	{
+		int s = cache.bs[j];
+		int r = cache.br[j];
+		bool fs = s >= 1 && s < in.Ln && affected[s];
+		bool fr = r >= 1 && r < in.Ln && affected[r];
+		if (!fs && !fr)
+		{
+			continue;
+		}
+		double G = cache.bG[j];
+		double dsin = sin((theta(0,s) - theta(0,r))*pi / 180);
+		double dcos = cos((theta(0,s) - theta(0,r))*pi / 180);
+		if (fs)
+		{
+			cache.Ftheta(s - 1, 0) -= 2 * (-G)*V(s,0)*V(r,0)*(-dsin);
+			cache.Fv(s - 1, 0) += 2 * (-G)*(V(s,0) - V(r,0)*dcos);
+		}
+		if (fr)
+		{
+			cache.Ftheta(r - 1, 0) -= 2 * (-G)*V(s,0)*V(r,0)*dsin;
+			cache.Fv(r - 1, 0) += 2 * (-G)*(V(r,0) - V(s,0)*dcos);
+		}
+	}
+
+	// J = [H,N;K,L], as in the sparse form_J
+	for (int i = 0; i < in.Ln; ++i)
+	{
+		if (affected[i])
+		{
+			cache.Rsin(i) = 0;
+			cache.Rcos(i) = 0;
+		}
+	}
+	for (unsigned int k = 0; k < cache.yi.size(); ++k)
+	{
+		int i = cache.yi[k];
+		if (!affected[i])
+		{
+			continue;
+		}
+		int m = cache.ym[k];
+		double dsin = sin((theta(0,i) - theta(0,m))*pi / 180);
+		double dcos = cos((theta(0,i) - theta(0,m))*pi / 180);
+		double a = cache.yG[k]*dsin - cache.yB[k]*dcos;
+		double b = cache.yG[k]*dcos + cache.yB[k]*dsin;
+		cache.Rsin(i) += V(m,0)*a;
+		cache.Rcos(i) += V(m,0)*b;
+		int q = cache.slot[k];
+		if (q >= 0)
+		{
+			cache.Jval(4*q)     = V(i,0)*V(m,0)*a;  // H
+			cache.Jval(4*q + 1) = V(i,0)*b;         // N
+			cache.Jval(4*q + 2) = -V(i,0)*V(m,0)*b; // K
+			cache.Jval(4*q + 3) = V(i,0)*a;         // L
+		}
+	}
+	for (int i = 1; i < in.Ln; ++i)
+	{
+		if (!affected[i])
+		{
+			continue;
+		}
+		int q = cache.diag + 4 * (i - 1);
+		cache.Jval(q)     = -V(i,0)*cache.Rsin(i);
+		cache.Jval(q + 1) = cache.Rcos(i) + 2*V(i,0)*cache.Gd(i);
+		cache.Jval(q + 2) = V(i,0)*cache.Rcos(i);
+		cache.Jval(q + 3) = -2*V(i,0)*cache.Bd(i) + cache.Rsin(i);
+	}
+
+	if (in.sparse)
+	{
+		cache.Jsp = cache.Jval.n_elem == 0 ? arma::sp_mat(2 * n, 2 * n)
+			: arma::sp_mat(true, cache.Jloc, cache.Jval, 2 * n, 2 * n);
+	}
+	else
+	{
+		for (unsigned int q = 0; q < cache.Jval.n_elem; ++q)
+		{
+			cache.J(cache.Jloc(0, q), cache.Jloc(1, q)) = cache.Jval(q);
+		}
+	}
+	return moved;
+}
@@ -0,0 +1,406 @@
+#!/usr/bin/env python
+# -*- mode: python; indent-tabs-mode: nil; tab-width: 4 -*-
+###############################################################################
+# @file           scenario_runner.py
+#
+# @project        FREEDM DGI
+#
+# @description    Run a group of DGI through a scenario and time how they
+#                 recover from each event.
+#
+# These source code files were created at Missouri University of Science and
+# Technology, and are intended for use in teaching or research. They may be
+# freely copied, modified, and redistributed as long as modified versions are
+# clearly marked as such and this notice is not removed. Neither the authors
+# nor Missouri S&T make any warranty, express or implied, nor assume any legal
+# responsibility for the accuracy, completeness, or usefulness of these files
+# or any information distributed with these files.
+#
+# Suggested modifications or questions about these files can be directed to
+# Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+# Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+###############################################################################
+
+# Every DGI is started from the same executable on this computer, each in its
+# own directory under --workdir with a generated freedm.cfg, logger.cfg and
+# network.xml. A scenario is a JSON list of events:
+#
+#   [ { "time": 20, "action": "leave", "nodes": [3] },
+#     { "time": 40, "action": "join", "nodes": [3] },
+#     { "time": 60, "action": "partition", "groups": [[0, 1], [2, 3]] },
+#     { "time": 80, "action": "heal" } ]
+#
+# Times are seconds since the DGI were started and nodes are numbered from 0.
+# A node leaves when it is sent SIGTERM and joins when it is started again. A
+# partition sets the reliability of every channel between two groups to 0 in
+# network.xml, which the DGI only honor when built with -DCUSTOMNETWORK=ON.
+#
+# When the run ends the logs of every DGI are merged, and the report gives for
+# each event how long it took for group management to settle on the expected
+# groups, how many load balance rounds passed before the last migration, and
+# how long the state collections took. The report is printed as JSON, and is
+# also written to the file given with --report.
+
+import json
+import optparse
+import os
+import re
+import signal
+import socket
+import subprocess
+import sys
+import time
+from datetime import datetime, timedelta
+
+HEADER = re.compile(r'^(\d{4}-\w{3}-\d{2} \d{2}:\d{2}:\d{2}(?:\.\d+)?) : '
+                    r'(\S+)\((\d)\):$')
+SYSTEM_STATE = re.compile(r'Me: (\S+), Group: (\S+) Leader:(\S+)')
+NODE_STATE = re.compile(r'^Node: (\S+) State: (\S+)')
+SC_REQUEST = 'Receiving state collect request from'
+SC_DONE = '*****CollectedStates*****'
+LB_ROUND = '------- LOAD TABLE'
+LB_MIGRATION = ('Sending state change, DEMAND', 'Sent Draft Age to')
+
+LOGGER_CONFIG = '''GroupManagement.cpp=5
+StateCollection.cpp=5
+LoadBalance.cpp=5
+'''
+
+
+def parse_stamp(stamp):
+    """Converts the local time printed by CLog into a datetime."""
+    if '.' not in stamp:
+        stamp += '.0'
+    return datetime.strptime(stamp, '%Y-%b-%d %H:%M:%S.%f')
+
+
+def seconds(delta):
+    return delta.days * 86400 + delta.seconds + delta.microseconds / 1e6
+
+
+class Node(object):
+    """One DGI process and the directory it runs in."""
+
+    def __init__(self, index, host, port, options):
+        self.index = index
+        self.port = port
+        self.uuid = host + ':' + str(port)
+        self.path = os.path.join(options.workdir, 'node%d' % index)
+        self.executable = options.executable
+        self.extra = options.extra
+        self.process = None
+
+    def configure(self, peers, timings):
+        if not os.path.isdir(self.path):
+            os.makedirs(self.path)
+        config = open(os.path.join(self.path, 'freedm.cfg'), 'w')
+        config.write('address=0.0.0.0\n')
+        config.write('port=%d\n' % self.port)
+        config.write('verbose=3\n')
+        config.write('logger-config=%s\n' %
+                     os.path.join(self.path, 'logger.cfg'))
+        config.write('timings-config=%s\n' % timings)
+        for peer in peers:
+            if peer is not self:
+                config.write('add-host=%s\n' % peer.uuid)
+        config.close()
+        open(os.path.join(self.path, 'logger.cfg'), 'w').write(LOGGER_CONFIG)
+        log = os.path.join(self.path, 'dgi.log')
+        if os.path.exists(log):
+            os.remove(log)
+
+    def write_network(self, peers, reachable):
+        # write to a temporary file so the DGI never reads a partial file
+        temp = os.path.join(self.path, 'network.xml.tmp')
+        xml = ['<?xml version="1.0" ?><network><incoming>'
+               '<reliability>100</reliability></incoming><outgoing>']
+        for peer in peers:
+            if peer is not self:
+                xml.append('<channel uuid="%s"><reliability>%d</reliability>'
+                           '</channel>' % (peer.uuid,
+                                           100 if peer in reachable else 0))
+        xml.append('</outgoing></network>\n')
+        open(temp, 'w').write(''.join(xml))
+        os.rename(temp, os.path.join(self.path, 'network.xml'))
+
+    def start(self):
+        if self.running():
+            return
+        log = open(os.path.join(self.path, 'dgi.log'), 'a')
+        self.process = subprocess.Popen([self.executable, '--config',
+                                         'freedm.cfg'] + self.extra,
+                                        cwd=self.path, stdout=log,
+                                        stderr=subprocess.STDOUT)
+        log.close()
+
+    def stop(self):
+        if not self.running():
+            return
+        self.process.send_signal(signal.SIGTERM)
+        for _ in range(50):
+            if self.process.poll() is not None:
+                return
+            time.sleep(0.1)
+        self.process.kill()
+        self.process.wait()
+
+    def running(self):
+        return self.process is not None and self.process.poll() is None
+
+
+def default_scenario(count, duration):
+    """Leave and rejoin with the last node, then split the group in half."""
+    half = count // 2
+    return [
+        {'time': duration / 3.0, 'action': 'leave', 'nodes': [count - 1]},
+        {'time': duration / 2.0, 'action': 'join', 'nodes': [count - 1]},
+        {'time': duration * 2 / 3.0, 'action': 'partition',
+         'groups': [list(range(half)), list(range(half, count))]},
+        {'time': duration * 5 / 6.0, 'action': 'heal'}]
+
+
+def read_log(node):
+    """Returns the (time, logger, lines) records of the log of a node."""
+    records = []
+    current = None
+    try:
+        log = open(os.path.join(node.path, 'dgi.log'))
+    except IOError:
+        return records
+    for line in log:
+        line = line.rstrip('\n')
+        match = HEADER.match(line)
+        if match:
+            current = (parse_stamp(match.group(1)), match.group(2), [])
+            records.append(current)
+        elif current is not None:
+            current[2].append(line.strip())
+    log.close()
+    return records
+
+
+class Analysis(object):
+    """Walks the merged logs and times the recovery from each event."""
+
+    def __init__(self, nodes, events):
+        self.nodes = nodes
+        self.events = events
+
+    def expected_groups(self, event):
+        # the groups group management should form once the event has passed
+        live = set(event['live'])
+        groups = []
+        for group in event['groups']:
+            members = set(group) & live
+            if members:
+                groups.append(members)
+        return groups
+
+    def settled(self, groups, leaders, members):
+        for group in groups:
+            uuids = set(self.nodes[i].uuid for i in group)
+            leader = set(leaders.get(i) for i in group)
+            if len(leader) != 1:
+                return False
+            leader = leader.pop()
+            if leader not in uuids:
+                return False
+            owner = [n.index for n in self.nodes if n.uuid == leader][0]
+            if members.get(owner) != uuids:
+                return False
+        return True
+
+    def run(self):
+        merged = []
+        for node in self.nodes:
+            for stamp, logger, lines in read_log(node):
+                merged.append((stamp, node.index, logger, lines))
+        merged.sort(key=lambda record: record[0])
+        results = []
+        for number, event in enumerate(self.events):
+            start = event['wall']
+            if number + 1 < len(self.events):
+                end = self.events[number + 1]['wall']
+            else:
+                end = None
+            window = [r for r in merged
+                      if r[0] >= start and (end is None or r[0] < end)]
+            results.append(self.measure(event, window, merged, start))
+        return results
+
+    def measure(self, event, window, merged, start):
+        groups = self.expected_groups(event)
+        leaders = {}
+        members = {}
+        # carry over what each live node believed before the event
+        for stamp, index, logger, lines in merged:
+            if stamp >= start:
+                break
+            self.track(index, logger, lines, leaders, members)
+        for index in list(leaders.keys()):
+            if index not in event['live']:
+                del leaders[index]
+                members.pop(index, None)
+
+        formation = None
+        rounds = 0
+        migration_round = None
+        requests = {}
+        latencies = []
+        for stamp, index, logger, lines in window:
+            self.track(index, logger, lines, leaders, members)
+            if formation is None and self.settled(groups, leaders, members):
+                formation = seconds(stamp - start)
+            if not lines:
+                continue
+            if logger.startswith('LoadBalance') and lines[0].startswith(
+                    LB_ROUND):
+                rounds += 1
+            elif logger.startswith('LoadBalance') and lines[0].startswith(
+                    LB_MIGRATION):
+                migration_round = rounds
+            elif logger.startswith('StateCollection'):
+                if lines[0].startswith(SC_REQUEST):
+                    requests.setdefault(index, []).append(stamp)
+                elif SC_DONE in lines[0] and requests.get(index):
+                    sent = requests[index].pop(0)
+                    latencies.append(seconds(stamp - sent))
+        latencies.sort()
+
+        result = {
+            'time': event['time'],
+            'action': event['action'],
+            'live': sorted(event['live']),
+            'expected_groups': [sorted(g) for g in groups],
+            'group_formation_s': formation,
+            'lb_rounds': rounds,
+            'lb_rounds_to_converge': migration_round,
+            'sc_snapshots': len(latencies),
+            'sc_latency_p50_s': None,
+            'sc_latency_max_s': None,
+            'sc_unanswered': sum(len(r) for r in requests.values())
+        }
+        if latencies:
+            result['sc_latency_p50_s'] = latencies[len(latencies) // 2]
+            result['sc_latency_max_s'] = latencies[-1]
+        return result
+
+    def track(self, index, logger, lines, leaders, members):
+        if not logger.startswith('GroupManagement') or not lines:
+            return
+        for number, line in enumerate(lines):
+            match = SYSTEM_STATE.search(line)
+            if match:
+                leaders[index] = match.group(3)
+                up = set()
+                for other in lines[number + 1:]:
+                    node = NODE_STATE.match(other)
+                    if node and node.group(2) == 'Up':
+                        up.add(node.group(1))
+                members[index] = up
+                return
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] [-- dgi options]')
+    parser.add_option('-e', '--executable', default='../PosixBroker',
+                      help='DGI executable to run')
+    parser.add_option('-n', '--nodes', type='int', default=4,
+                      help='number of DGI to run')
+    parser.add_option('-p', '--base-port', type='int', default=51870,
+                      help='port of the first DGI')
+    parser.add_option('-s', '--scenario',
+                      help='JSON file with the events to inject')
+    parser.add_option('-d', '--duration', type='float', default=120,
+                      help='seconds to run the DGI for')
+    parser.add_option('-t', '--timings', default='../config/timings.cfg',
+                      help='timings config given to every DGI')
+    parser.add_option('-w', '--workdir', default='scenario',
+                      help='directory for the configs and logs of the DGI')
+    parser.add_option('-r', '--report', help='file to write the report to')
+    options, extra = parser.parse_args()
+    options.extra = extra
+    options.executable = os.path.abspath(options.executable)
+    options.workdir = os.path.abspath(options.workdir)
+    timings = os.path.abspath(options.timings)
+
+    if options.nodes < 2:
+        parser.error('a scenario needs at least two nodes')
+    if options.scenario:
+        events = json.load(open(options.scenario))
+    else:
+        events = default_scenario(options.nodes, options.duration)
+    events.sort(key=lambda event: event['time'])
+
+    host = socket.gethostname()
+    nodes = [Node(i, host, options.base_port + i, options)
+             for i in range(options.nodes)]
+    for node in nodes:
+        node.configure(nodes, timings)
+        node.write_network(nodes, nodes)
+
+    # the state of the system after each event, starting from all nodes up
+    live = set(range(options.nodes))
+    groups = [list(range(options.nodes))]
+    history = [{'time': 0, 'action': 'start', 'live': set(live),
+                'groups': groups}]
+
+    origin = datetime.now()
+    for node in nodes:
+        node.start()
+    history[0]['wall'] = origin
+
+    try:
+        for event in events:
+            delay = event['time'] - seconds(datetime.now() - origin)
+            if delay > 0:
+                time.sleep(delay)
+            action = event['action']
+            if action == 'leave':
+                for i in event['nodes']:
+                    nodes[i].stop()
+                    live.discard(i)
+            elif action == 'join':
+                for i in event['nodes']:
+                    nodes[i].start()
+                    live.add(i)
+            elif action in ('partition', 'heal'):
+                if action == 'heal':
+                    groups = [list(range(options.nodes))]
+                else:
+                    groups = event['groups']
+                for group in groups:
+                    reachable = [nodes[i] for i in group]
+                    for i in group:
+                        nodes[i].write_network(nodes, reachable)
+            else:
+                raise RuntimeError('unknown action ' + action)
+            history.append({'time': event['time'], 'action': action,
+                            'live': set(live), 'groups': groups,
+                            'wall': datetime.now()})
+        delay = options.duration - seconds(datetime.now() - origin)
+        if delay > 0:
+            time.sleep(delay)
+    finally:
+        for node in nodes:
+            node.stop()
+
+    crashed = [n.index for n in nodes
+               if n.process is not None and n.process.returncode not in
+               (0, -signal.SIGTERM)]
+    report = {
+        'nodes': options.nodes,
+        'duration_s': options.duration,
+        'executable': options.executable,
+        'partitions_need': '-DCUSTOMNETWORK=ON',
+        'crashed': crashed,
+        'events': Analysis(nodes, history).run()
+    }
+    text = json.dumps(report, indent=2, sort_keys=True)
+    print(text)
+    if options.report:
+        open(options.report, 'w').write(text + '\n')
+    return 1 if crashed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
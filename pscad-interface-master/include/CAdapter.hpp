@@ -24,6 +24,7 @@
 #define C_ADAPTER_HPP
 
 #include "CDeviceSignal.hpp"
+#include "DeviceTable.hpp"
 
 #include <vector>
 
@@ -38,7 +39,8 @@ namespace adapter {
 /// The CAdapter class reads an XML specification, creates a set of devices
 /// based on the specification, and encapsulates the specification details in
 /// its member variables.  Derived classes can convert a buffer index into a
-/// device signal through use of the member vectors of this class.
+/// device signal through use of the member vectors of this class, and into
+/// the index of that device signal in its device table.
 /// 
 /// @limitations This class cannot be constructed as a base adapter cannot be
 /// used on its own.  The adapter instances should derive from this class and
@@ -54,10 +56,15 @@ protected:
     std::vector<CDeviceSignal> m_StateDetails;
     /// associates external commands with their specification index
     std::vector<CDeviceSignal> m_CommandDetails;
+    /// state table index of each state variable by specification index
+    std::vector<TSignalIndex> m_StateIndex;
+    /// command table index of each external command by specification index
+    std::vector<TSignalIndex> m_CommandIndex;
 private:
     /// initializes the state or command details based on the property tree
     void ReadDetails( const boost::property_tree::ptree & tree,
-            const char name[], std::vector<CDeviceSignal> & details );
+            const char name[], std::vector<CDeviceSignal> & details,
+            std::vector<TSignalIndex> & indices );
 };
 
 } // namespace adapter
@@ -26,6 +26,9 @@
 #include "IServer.hpp"
 #include "CAdapter.hpp"
 
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
 #include <boost/property_tree/ptree_fwd.hpp>
 
 namespace freedm {
@@ -40,11 +43,12 @@ typedef float TSignalValue;
 /// The RTDS adapter waits for a byte stream of data from its client.  It uses
 /// that data to update the command table, and then responds to that data with
 /// the current values of the state table.  The endian of both the sent and the
-/// received data is swapped to emulate Big Endian.
+/// received data is swapped to emulate Big Endian.  The exchanges of many
+/// clients are handled at once, each until its client disconnects.
 /// 
 /// @limitations If the adapter does not receive the expected amount of bytes
-/// from the client, it will be blocked until more data is sent or the client
-/// closes the connection.
+/// from the client, the connection will wait until more data is sent or the
+/// client closes the connection.
 ///////////////////////////////////////////////////////////////////////////////
 class CRtdsAdapter
     : public IServer
@@ -52,11 +56,32 @@ class CRtdsAdapter
 {
 public:
     /// constructs a DGI-RTDS adapter instance
-    CRtdsAdapter( unsigned short port,
+    CRtdsAdapter( boost::asio::io_service & service, unsigned short port,
             const boost::property_tree::ptree & tree );
 private:
-    /// handles the accepted socket connection
-    virtual void HandleConnection();
+    /// buffers of the exchanges on a client connection
+    struct SSession
+    {
+        /// client connection
+        TSocket s_socket;
+        /// commands received from the client
+        std::vector<TSignalValue> s_command;
+        /// states sent to the client
+        std::vector<TSignalValue> s_state;
+    };
+    /// type of a pointer to the buffers of a client connection
+    typedef boost::shared_ptr<SSession> TSession;
+    
+    /// starts the exchanges on the accepted socket connection
+    virtual void HandleConnection( TSocket socket );
+    /// waits for the next commands from the client
+    void StartRead( TSession session );
+    /// updates the command table and responds with the state table
+    void HandleRead( TSession session,
+            const boost::system::error_code & error );
+    /// waits for the next commands once the response is written
+    void HandleWrite( TSession session,
+            const boost::system::error_code & error );
     /// reverses the bytes in a buffer
     void ReverseBytes( char * buffer, const int numBytes );
     /// swap byte order of floats in a buffer if system is little-endian
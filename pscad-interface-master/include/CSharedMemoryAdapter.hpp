@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file         CSharedMemoryAdapter.hpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that shares device tables with a co-located DGI
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_ADAPTER_SHARED_MEMORY_HPP
+#define C_ADAPTER_SHARED_MEMORY_HPP
+
+#include "CAdapter.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
+
+namespace freedm {
+namespace simulation {
+namespace adapter {
+
+/// dgi adapter that exchanges the tables through a POSIX shared memory segment
+///////////////////////////////////////////////////////////////////////////////
+/// The shared memory adapter creates a POSIX shared memory segment that holds
+/// the states and commands of its XML specification as host order floats.
+/// Once per period, it reads the commands a DGI on the same host wrote to the
+/// segment into the command table, and writes the state table to the segment.
+/// The DGI maps the segment with its own shared memory adapter, so no socket
+/// or byte swap is involved in the exchange.
+/// 
+/// Each array of the segment is guarded by a sequence counter that its writer
+/// makes odd before it writes and even after.  A reader copies the array and
+/// keeps the copy only if the counter was even and did not change meanwhile.
+/// 
+/// @limitations The segment layout must match SSharedHeader of the DGI.  The
+/// adapter polls the segment, so a command takes up to one period to arrive.
+///////////////////////////////////////////////////////////////////////////////
+class CSharedMemoryAdapter
+    : public CAdapter
+    , private boost::noncopyable
+{
+public:
+    /// creates the segment and starts the exchanges
+    CSharedMemoryAdapter( boost::asio::io_service & service,
+            const std::string & segment, unsigned int period,
+            const boost::property_tree::ptree & tree );
+    
+    /// removes the segment
+    ~CSharedMemoryAdapter();
+private:
+    /// type of a value in the segment
+    typedef float TSharedValue;
+    
+    /// layout of the front of the segment, followed by the value arrays
+    struct SSharedHeader
+    {
+        /// identifies a segment of this layout
+        boost::uint32_t s_magic;
+        /// number of states in the segment
+        boost::uint32_t s_stateCount;
+        /// number of commands in the segment
+        boost::uint32_t s_commandCount;
+        /// odd while the states are being written
+        volatile boost::uint32_t s_stateSequence;
+        /// odd while the commands are being written
+        volatile boost::uint32_t s_commandSequence;
+    };
+    
+    /// exchanges the tables with the segment and schedules the next exchange
+    void Exchange( const boost::system::error_code & error );
+    /// copies new commands from the segment into the command table
+    void ReadCommands();
+    /// copies the state table into the segment
+    void WriteStates();
+    
+    /// magic number of the segment layout, FRDM in ASCII
+    static const boost::uint32_t SEGMENT_MAGIC = 0x4644524D;
+    
+    /// name of the shared memory segment
+    std::string m_segment;
+    /// milliseconds between two exchanges
+    unsigned int m_period;
+    /// size of the mapped segment in bytes
+    std::size_t m_size;
+    /// header of the mapped segment
+    SSharedHeader * m_header;
+    /// states of the mapped segment
+    TSharedValue * m_states;
+    /// commands of the mapped segment
+    TSharedValue * m_commands;
+    /// command sequence of the last commands read
+    boost::uint32_t m_commandSequence;
+    /// values copied between a table and the segment
+    std::vector<TSharedValue> m_buffer;
+    /// timer for the exchanges
+    boost::asio::deadline_timer m_timer;
+};
+
+} // namespace adapter
+} // namespace simulation
+} // namespace freedm
+
+#endif // C_ADAPTER_SHARED_MEMORY_HPP
@@ -26,6 +26,9 @@
 #include "IServer.hpp"
 #include "CAdapter.hpp"
 
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
 #include <boost/property_tree/ptree_fwd.hpp>
 
 namespace freedm {
@@ -39,10 +42,21 @@ namespace adapter {
 /// state table using the packet payload.  A GET header will be responded to
 /// with the content of the command table.  A RST header will update both the
 /// state table and the command table using the packet payload.  If a header
-/// is not recognized, the payload will be discarded.
+/// is not recognized, the payload will be discarded.  Each connection carries
+/// a single packet, and the packets of many clients are handled at once.
+/// 
+/// A XCH header combines SET and GET: the payload updates the state table, and
+/// the content of the command table is the response.  A STR header starts a
+/// stream in which the connection stays open, and every payload that follows
+/// is handled as a XCH packet without a header until the client disconnects.
+/// A simulation step then costs one exchange on an open connection.
+/// 
+/// The payload and the response are arrays of doubles unless the adapter is
+/// configured with the float32 encoding, in which case every value is sent as
+/// a 4-byte float and the packets are half the size.
 /// 
 /// @limitations If the payload does not contain the expected amount of bytes,
-/// the adapter will be blocked until the client sends more data or closes the
+/// the connection will wait until the client sends more data or closes the
 /// connection.  The bytes expected is derived from the XML specification.
 ///////////////////////////////////////////////////////////////////////////////
 class CSimulationAdapter
@@ -51,18 +65,55 @@ class CSimulationAdapter
 {
 public:
     /// constructs a simulation adapter instance
-    CSimulationAdapter( unsigned short port,
-            const boost::property_tree::ptree & tree );
+    CSimulationAdapter( boost::asio::io_service & service, unsigned short port,
+            const boost::property_tree::ptree & tree, bool float32 = false );
 private:
-    /// handles the accepted socket connection
-    virtual void HandleConnection();
-    /// updates the state table with data read from the socket
-    void SetSimulationState();
-    /// writes the command table data to the socket
-    void GetExternalCommand();
-    
     /// header size in bytes of the simulation packet
     static const unsigned int HEADER_SIZE = 5;
+    
+    /// buffers of the packet on a client connection
+    struct SSession
+    {
+        /// client connection
+        TSocket s_socket;
+        /// packet header
+        char s_header[HEADER_SIZE];
+        /// packet payload
+        std::vector<simulation::TSignalValue> s_payload;
+        /// response to the packet
+        std::vector<simulation::TSignalValue> s_response;
+        /// packet payload in the float32 encoding
+        std::vector<float> s_payload32;
+        /// response to the packet in the float32 encoding
+        std::vector<float> s_response32;
+    };
+    /// type of a pointer to the buffers of a client connection
+    typedef boost::shared_ptr<SSession> TSession;
+    
+    /// starts to read a packet from the accepted socket connection
+    virtual void HandleConnection( TSocket socket );
+    /// calls an appropriate message handler for the packet header
+    void HandleHeader( TSession session,
+            const boost::system::error_code & error );
+    /// starts to read the payload of a packet
+    void StartPayload( TSession session );
+    /// handles the payload of a SET, RST, XCH or STR packet
+    void HandlePayload( TSession session,
+            const boost::system::error_code & error );
+    /// writes the command table to the client
+    void StartResponse( TSession session );
+    /// ends the packet once the response is written
+    void HandleResponse( TSession session,
+            const boost::system::error_code & error );
+    /// updates the state table with the payload of a packet
+    template <typename TValue>
+    void SetSimulationState( const std::vector<TValue> & state );
+    /// reads the command table into the response of a packet
+    template <typename TValue>
+    void GetExternalCommand( std::vector<TValue> & command );
+    
+    /// set if the values are sent as 4-byte floats
+    bool m_float32;
 };
 
 } // namespace adapter
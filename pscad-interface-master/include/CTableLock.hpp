@@ -26,8 +26,10 @@
 #include "CLogger.hpp"
 #include "DeviceTable.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
@@ -56,6 +58,10 @@ namespace simulation {
 /// use const member functions.  This is due to some TLock instances using a
 /// const TLock::GetTable() function.  A solution to this problem is not yet
 /// known, but it's something that should be fixed.
+///
+/// A device signal can be resolved to its index with GetIndex once, after
+/// which the index overloads skip the search of the table layout.  GetValues
+/// and SetValues move the values of many indices in a single pass.
 ///////////////////////////////////////////////////////////////////////////////
 template <class TLock>
 class CTableLock
@@ -68,14 +74,29 @@ public:
     CTableLock( const SDeviceTable & table );
     
     /// inserts a new device signal into the device table
-    void InsertDeviceSignal( const CDeviceSignal & devsig );
+    TSignalIndex InsertDeviceSignal( const CDeviceSignal & devsig );
     /// checks if a device signal is in the device table
     bool DeviceSignalExists( const CDeviceSignal & devsig );
+    /// gets the index of a device signal in the device table
+    TSignalIndex GetIndex( const CDeviceSignal & devsig );
     
     /// gets the value of a device signal from the table
     TSignalValue GetValue( const CDeviceSignal & devsig );
     /// sets the value of a device signal in the table
     void SetValue( const CDeviceSignal & devsig, TSignalValue value );
+    
+    /// gets the value stored at an index of the table
+    TSignalValue GetValue( TSignalIndex index );
+    /// sets the value stored at an index of the table
+    void SetValue( TSignalIndex index, TSignalValue value );
+    
+    /// copies the values stored at a set of indices out of the table
+    template <class TValue>
+    void GetValues( const std::vector<TSignalIndex> & indices, TValue * values );
+    /// copies a set of values into the table at the given indices
+    template <class TValue>
+    void SetValues( const std::vector<TSignalIndex> & indices,
+            const TValue * values );
 private:
     /// engine instance
     TLock m_lock;
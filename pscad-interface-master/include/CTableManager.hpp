@@ -27,13 +27,17 @@
 
 #include "CTableLock.hpp"
 #include "CTableReadLock.hpp"
+#include "CTableSnapshot.hpp"
 #include "CTableWriteLock.hpp"
 
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
 namespace freedm {
@@ -47,6 +51,9 @@ namespace simulation {
 /// store a new table under that identifier.  This class follows the multiton
 /// design pattern, also known as a registry of singletons.
 /// 
+/// Readers that only need values by index should use a TSnapshot on the stack,
+/// which reads the values published by the last writer without the mutex.
+/// 
 /// @limitations This class cannot be constructed.  It follows the multiton
 /// design pattern and must be accessed through one of its static members.
 ///////////////////////////////////////////////////////////////////////////////
@@ -64,23 +71,67 @@ private:
     /// type for a write lock over a device table
     typedef CTableLock<CTableWriteLock> TWriteLock;
     
+    /// entries stored at consecutive indices of both a source and a target
+    struct SSyncRun
+    {
+        /// first index of the run in the source table
+        TSignalIndex s_source;
+        /// first index of the run in the target table
+        TSignalIndex s_target;
+        /// number of entries in the run
+        std::size_t s_count;
+    };
+    
+    /// state of the updates from one source table to one target table
+    struct SSyncState
+    {
+        /// constructs the state of a pair of tables that were never updated
+        SSyncState() : s_shared(0), s_sourceSize(0), s_targetSize(0),
+                s_version(0), s_full(true) {}
+        
+        /// entries shared by the two tables, ordered by source index
+        std::vector<SSyncRun> s_runs;
+        /// number of entries shared by the two tables
+        std::size_t s_shared;
+        /// size of the source table when s_runs was computed
+        std::size_t s_sourceSize;
+        /// size of the target table when s_runs was computed
+        std::size_t s_targetSize;
+        /// version of the source table at the last update
+        TTableVersion s_version;
+        /// true if the next update must copy every shared entry
+        bool s_full;
+    };
+    
     /// retrieves a device table instance from the registry
     static SDeviceTable & GetInstance( std::string identifier );
     
+    /// computes the entries shared by a source and a target table
+    static void CompileSync( SSyncState & sync, const SDeviceTable & target,
+            const SDeviceTable & source );
+    
     /// set of device table instances registered by identifier
     static std::map<std::string,SDeviceTable> m_instance;
     /// mutex lock over the instance set
     static boost::shared_mutex m_mutex;
+    /// update state of each pair of target and source identifiers
+    static std::map<std::pair<std::string,std::string>,SSyncState> m_sync;
+    /// mutex lock over the update states
+    static boost::mutex m_syncMutex;
 public:
     /// type for a reader interface to a device table
     typedef boost::shared_ptr<TReadLock> TReader;
     /// type for a writer interface to a device table
     typedef boost::shared_ptr<TWriteLock> TWriter;
+    /// type for a wait-free reader of the values published to a device table
+    typedef CTableLock<CTableSnapshot> TSnapshot;
     
     /// accesses a device table instance as a reader
     static TReader AsReader( std::string identifier );
     /// accesses a device table instance as a writer
     static TWriter AsWriter( std::string identifier );
+    /// accesses a device table instance to construct a TSnapshot
+    static const SDeviceTable & AsSnapshot( std::string identifier );
     
     /// updates target to be consistent with the current values of source
     static int UpdateTable( std::string target, std::string source );
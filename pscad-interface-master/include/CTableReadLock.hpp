@@ -49,9 +49,18 @@ public:
     /// constructor that acquires shared ownership of a device table
     CTableReadLock( const SDeviceTable & table );
     
+    /// accessor for the index of each device signal
+    const TTableLayout & GetLayout() const;
+    
     /// accessor for the device table
     const TDeviceTable & GetTable() const;
     
+    /// accessor for the version of the last write to each entry
+    const std::vector<TTableVersion> & GetVersions() const;
+    
+    /// accessor for the version of the last write lock on the table
+    TTableVersion GetVersion() const;
+    
     /// destructor that releases shared ownership of the device table
     ~CTableReadLock();
 private:
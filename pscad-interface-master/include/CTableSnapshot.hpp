@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file         CTableSnapshot.hpp
+///
+/// @author       Thomas Roth <tprfh7@mst.edu>
+///
+/// @project      FREEDM DGI
+///
+/// @description  Wait-free reader of the published values of device tables
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef C_TABLE_SNAPSHOT_HPP
+#define C_TABLE_SNAPSHOT_HPP
+
+#include "DeviceTable.hpp"
+
+#include <boost/noncopyable.hpp>
+
+namespace freedm {
+namespace simulation {
+
+/// provides a reader interface to the last published values of a device table
+///////////////////////////////////////////////////////////////////////////////
+/// The CTableSnapshot class reads a device table without its mutex.  Each
+/// write lock publishes the table into one of two buffers when it is released,
+/// and a snapshot pins the buffer published last for its lifetime.  A writer
+/// never fills a buffer that is pinned, so a snapshot cannot be blocked by a
+/// writer and always sees the values of one complete write.  This class is
+/// intended to be used on the stack, as the engine of a CTableLock.
+/// 
+/// @limitations The snapshot does not see the layout of the table, so values
+/// can only be accessed by index.  A snapshot should be held briefly, since a
+/// writer that wants to reuse the pinned buffer waits for its release.
+///////////////////////////////////////////////////////////////////////////////
+class CTableSnapshot
+    : private boost::noncopyable
+{
+public:
+    /// constructor that pins the last published values of a device table
+    CTableSnapshot( const SDeviceTable & table );
+    
+    /// accessor for the published values
+    const TDeviceTable & GetTable() const;
+    
+    /// destructor that unpins the published values
+    ~CTableSnapshot();
+private:
+    /// device table read by the snapshot
+    const SDeviceTable & m_table;
+    /// index of the pinned buffer in m_table.s_published
+    int m_buffer;
+};
+
+} // namespace simulation
+} // namespace freedm
+
+#endif // C_TABLE_SNAPSHOT_HPP
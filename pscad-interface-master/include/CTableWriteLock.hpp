@@ -49,12 +49,24 @@ public:
     /// constructor that acquires unique ownership of a device table
     CTableWriteLock( SDeviceTable & table );
     
+    /// accessor for the index of each device signal
+    TTableLayout & GetLayout();
+    
     /// accessor for the device table
     TDeviceTable & GetTable();
     
+    /// accessor for the version of the last write to each entry
+    std::vector<TTableVersion> & GetVersions();
+    
+    /// accessor for the version this lock stamps its writes with
+    TTableVersion GetVersion() const;
+    
     /// destructor that releases unique ownership of the device table
     ~CTableWriteLock();
 private:
+    /// copies the device table into the buffer snapshots do not read
+    void Publish();
+    
     /// device table managed by the write lock
     SDeviceTable & m_table;
 };
@@ -28,6 +28,7 @@
 #include <cmath>
 #include <map>
 #include <string>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/shared_mutex.hpp>
@@ -40,8 +41,14 @@ const double NULL_COMMAND = std::pow(10, 8);
 
 /// type for simulation state variables
 typedef double TSignalValue;
-/// type for containers that store a set of signal values
-typedef std::map<CDeviceSignal,TSignalValue> TDeviceTable;
+/// type for the position of a device signal in its device table
+typedef std::size_t TSignalIndex;
+/// type for containers that store a set of signal values by index
+typedef std::vector<TSignalValue> TDeviceTable;
+/// type for the map from each device signal to its index in a device table
+typedef std::map<CDeviceSignal,TSignalIndex> TTableLayout;
+/// type for the count of write locks taken on a device table
+typedef unsigned long TTableVersion;
 
 /// simple container for the device table and its associated mutex
 ///////////////////////////////////////////////////////////////////////////////
@@ -49,6 +56,21 @@ typedef std::map<CDeviceSignal,TSignalValue> TDeviceTable;
 /// unique identifier.  It is meant to be used in the different lock types and
 /// should not be made available to classes that do not manipulate the mutex.
 /// These classes should instead receive direct access to the table instance.
+///
+/// The values are stored in a contiguous array.  Each device signal is given
+/// the next index of the array when it is first inserted, which happens while
+/// the XML specification is read, and the layout maps the device signal to
+/// that index.  Adapters resolve their device signals once and then access the
+/// table by index.
+///
+/// Each write lock advances the version of the table, and every value written
+/// under the lock is stamped with that version in s_versions.  A reader that
+/// remembers the version it last saw can find the values changed since then.
+///
+/// When a write lock is released, s_instance is copied into the buffer of
+/// s_published that is not read from, and s_front is switched to it.  The
+/// snapshots read s_published without the mutex and count themselves in
+/// s_readers, so a writer knows when the other buffer is free again.
 /// 
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
@@ -57,10 +79,28 @@ struct SDeviceTable
     /// type for the table mutex to allow for storage in STL containers
     typedef boost::shared_ptr<boost::shared_mutex> TSharedMutex;
     
+    /// constructs an empty table at version 0
+    SDeviceTable() : s_version(0), s_front(0)
+    {
+        s_readers[0] = s_readers[1] = 0;
+    }
+    
     /// mutex lock associated with the table
     mutable TSharedMutex s_mutex;
+    /// index of each device signal in s_instance
+    TTableLayout s_layout;
     /// device table instance
     TDeviceTable s_instance;
+    /// version of the last write to each entry of s_instance
+    std::vector<TTableVersion> s_versions;
+    /// version of the last write lock on the table
+    TTableVersion s_version;
+    /// values published by the last two write locks
+    TDeviceTable s_published[2];
+    /// index of the buffer in s_published published last
+    volatile int s_front;
+    /// number of snapshots that pin each buffer in s_published
+    mutable volatile long s_readers[2];
     /// name of the table
     std::string s_name;
 };
@@ -25,54 +25,57 @@
 
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace freedm {
 namespace simulation {
 
-/// single-thread TCP server that handles one client at a time
+/// asynchronous TCP server that handles many clients on a shared io_service
 ///////////////////////////////////////////////////////////////////////////////
 /// The IServer class handles initialization and teardown of client connections
 /// to a TCP server.  Each client is redirected to the pure virtual function
 /// IServer::HandleConnection() which must be implemented by derived classes.
-/// A derived class can use the member variable m_socket to access the client
-/// connection inside of the connection handler.
+/// The connection handler must start an asynchronous session on the socket and
+/// return without blocking, so that the io_service can be shared by several
+/// servers and run by a pool of threads.  The socket is closed once the
+/// session releases its last copy of the socket pointer.
 /// 
-/// @limitations The server operates on a single thread and can only handle one
-/// client connection at a time.  Additional clients are blocked in a queue
-/// until the active connection is fully handled.
+/// @limitations The io_service may run the handlers of a session on any of its
+/// threads.  A session must chain its handlers so that only one is pending at
+/// a time, and must protect any state it shares with other sessions.
 ///////////////////////////////////////////////////////////////////////////////
 class IServer
     : private boost::noncopyable
 {
 public:
     /// constructs a TCP server on the given port
-    IServer( unsigned short port );
+    IServer( boost::asio::io_service & service, unsigned short port );
     
-    /// blocking call to start the server
-    void Run();
-    /// interrupts and stops the server
+    /// stops accepting client connections
     void Stop();
     
-    /// closes any active connection
+    /// closes the acceptor
     virtual ~IServer();
+protected:
+    /// type of a pointer to an accepted client connection
+    typedef boost::shared_ptr<boost::asio::ip::tcp::socket> TSocket;
+    
+    /// starts a session on the accepted socket connection
+    virtual void HandleConnection( TSocket socket ) = 0;
+    
+    /// unique identifier for this server
+    unsigned short m_id;
 private:
     /// prepares to accept the next client
     void StartAccept();
     /// invokes the client connection handler
-    void HandleAccept( const boost::system::error_code & error );
+    void HandleAccept( TSocket socket,
+            const boost::system::error_code & error );
     
-    /// service for the socket and acceptor
-    boost::asio::io_service m_service;
+    /// service shared by the acceptor and the client connections
+    boost::asio::io_service & m_service;
     /// acceptor to receive client connections
     boost::asio::ip::tcp::acceptor m_acceptor;
-protected:
-    /// handles the accepted socket connection
-    virtual void HandleConnection() = 0;
-    
-    /// socket for accepted client connections
-    boost::asio::ip::tcp::socket m_socket;
-    /// unique identifier for this server
-    unsigned short m_id;
 };
 
 } // namespace simulation
@@ -22,6 +22,9 @@
 ///     pscad_recv_init( int *, int *, int *, int *, int * )
 ///     pscad_recv( int *, int *, int *, int *, int *, double *, int * )
 ///     pscad_recv_close( )
+///     pscad_exchange_init( int *, int *, int *, int *, int * )
+///     pscad_exchange( double *, int *, double *, int * )
+///     pscad_exchange_close( )
 ///
 /// These source code files were created at the Missouri University of Science
 /// and Technology, and are intended for use in teaching or research. They may
@@ -42,6 +45,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -52,6 +56,10 @@
 
 #define SENDLOG         "pscad_send.txt"
 #define RECVLOG         "pscad_recv.txt"
+#define XCHGLOG         "pscad_exchange.txt"
+
+// open stream of the pscad_exchange component
+static int xchg_socket = -1;
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @function print_header
@@ -486,3 +494,119 @@ void pscad_recv_close__( )
 {
     print_footer( RECVLOG );
 }
+
+///////////////////////////////////////////////////////////////////////////////
+/// @function pscad_exchange_init
+/// @description initialization step for the pscad_exchange component
+/// @pre ip1.ip2.ip3.ip4:port must specify a valid IPv4 address
+/// @post creates the file XCHGLOG with a simple header
+/// @post opens a stream to the given IP address with a STR message
+/// @param ip1 first octet of the IP address
+/// @param ip2 second octet of the IP address
+/// @param ip3 third octet of the IP address
+/// @param ip4 fourth octet of the IP address
+/// @param port port number of the IP address
+/// @limitations the number of trailing underscores for this function depends
+/// on both the version of PSCAD and the Fortran compiler. if this code does
+/// not compile, rename the function pscad_exchange_init_ with a single
+/// underscore
+///////////////////////////////////////////////////////////////////////////////
+void pscad_exchange_init__( int * ip1, int * ip2, int * ip3, int * ip4,
+        int * port )
+{
+    char request[] = "STR";
+    char address[16];
+    char err[128];
+    
+    // get printable ip address
+    itodd( *ip1, *ip2, *ip3, *ip4, address );
+    print_header( XCHGLOG, address, *port );
+    
+    // connect to remote simulation server
+    if( (xchg_socket = connect_to_server( address, *port, err )) == -1 )
+    {
+        print_error( XCHGLOG, err );
+        return;
+    }
+    
+    // send the STR request that keeps the connection open
+    if( send_packet( xchg_socket, request, 0, 0, err ) == -1 )
+    {
+        print_error( XCHGLOG, err );
+        close( xchg_socket );
+        xchg_socket = -1;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @function pscad_exchange
+/// @description exchange step for the pscad_exchange component, which sends
+/// the states and receives the commands of one time step on the open stream
+/// @pre pscad_exchange_init must have opened the stream
+/// @pre nstate and ncommand must specify the number of elements of the arrays
+/// @post appends to the file XCHGLOG a status message
+/// @post stores in command the payload received from the stream
+/// @param state payload to send on the stream
+/// @param nstate number of elements in the payload
+/// @param command array to store the received information
+/// @param ncommand number of elements of the command array
+/// @limitations the number of trailing underscores for this function depends
+/// on both the version of PSCAD and the Fortran compiler. if this code does
+/// not compile, rename the function pscad_exchange_ with a single underscore
+///////////////////////////////////////////////////////////////////////////////
+void pscad_exchange__( double * state, int * nstate, double * command,
+        int * ncommand )
+{
+    char err[128];
+    int bytes = (*ncommand)*sizeof(double);
+    int received = 0;
+    int dat_size;
+    
+    if( xchg_socket == -1 )
+    {
+        print_error( XCHGLOG, "the stream is not open" );
+        return;
+    }
+    
+    // send the states of this time step
+    if( send( xchg_socket, state, (*nstate)*sizeof(double), 0 ) == -1 )
+    {
+        print_error( XCHGLOG, strerror(errno) );
+        return;
+    }
+    
+    // receive the complete command response
+    while( received < bytes )
+    {
+        dat_size = receive_packet( xchg_socket, (char *)command + received,
+                bytes - received, err );
+        if( dat_size <= 0 )
+        {
+            print_error( XCHGLOG, dat_size == 0 ? "stream closed" : err );
+            return;
+        }
+        received += dat_size;
+    }
+    
+    print_data( XCHGLOG, "XCH", command, *ncommand );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @function pscad_exchange_close
+/// @description final step for the pscad_exchange component
+/// @pre none
+/// @post closes the stream and appends to the file XCHGLOG a simple footer
+/// @limitations the number of trailing underscores for this function depends
+/// on both the version of PSCAD and the Fortran compiler. if this code does
+/// not compile, rename the function pscad_exchange_close_ with a single
+/// underscore
+///////////////////////////////////////////////////////////////////////////////
+void pscad_exchange_close__( )
+{
+    if( xchg_socket != -1 )
+    {
+        close( xchg_socket );
+        xchg_socket = -1;
+    }
+    print_footer( XCHGLOG );
+}
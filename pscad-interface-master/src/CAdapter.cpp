@@ -53,8 +53,8 @@ CAdapter::CAdapter( const boost::property_tree::ptree & tree )
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
     
-    ReadDetails(tree,STATE_TABLE,m_StateDetails);
-    ReadDetails(tree,COMMAND_TABLE,m_CommandDetails);
+    ReadDetails(tree,STATE_TABLE,m_StateDetails,m_StateIndex);
+    ReadDetails(tree,COMMAND_TABLE,m_CommandDetails,m_CommandIndex);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -71,9 +71,11 @@ CAdapter::CAdapter( const boost::property_tree::ptree & tree )
 /// @post Obtains a write lock on the device table with the passed identifier.
 /// @post Inserts elements into the device table based on the specification.
 /// @post Modifies the passed vector to contain the specification details.
+/// @post Modifies the passed indices to contain the table index of each entry.
 /// @param tree The property tree that contains the adapter specification.
 /// @param name The name of the subtree to parse and the table identifier.
 /// @param details The vector to store the specifications details.
+/// @param indices The vector to store the device table indices.
 /// @limitations The name argument is used both for the XML tag that stores the
 /// specification as well as the name of the device table associated with this
 /// adapter.  An alternative would be to read the table name from an attribute
@@ -81,7 +83,8 @@ CAdapter::CAdapter( const boost::property_tree::ptree & tree )
 /// there is no present reason to support that flexibility.
 ///////////////////////////////////////////////////////////////////////////////
 void CAdapter::ReadDetails( const boost::property_tree::ptree & tree,
-        const char name[], std::vector<CDeviceSignal> & details )
+        const char name[], std::vector<CDeviceSignal> & details,
+        std::vector<TSignalIndex> & indices )
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
     typedef std::vector<CDeviceSignal>::size_type TIndex;
@@ -100,6 +103,7 @@ void CAdapter::ReadDetails( const boost::property_tree::ptree & tree,
         Logger.Info << "Reading the " << name << " subtree." << std::endl;
         subtree = tree.get_child(name);
         details.resize(subtree.size());
+        indices.resize(subtree.size());
     }
     catch( std::exception & e )
     {
@@ -159,8 +163,8 @@ void CAdapter::ReadDetails( const boost::property_tree::ptree & tree,
         }
         
         details[index-1] = devsig;
-        lock->InsertDeviceSignal(devsig);
-        currentValue = lock->GetValue(devsig);
+        indices[index-1] = lock->InsertDeviceSignal(devsig);
+        currentValue = lock->GetValue(indices[index-1]);
         Logger.Info << "Added " << devsig << " to " << name
                     << " table." << std::endl;
         
@@ -173,9 +177,9 @@ void CAdapter::ReadDetails( const boost::property_tree::ptree & tree,
                             << " specification file." << std::endl;
                 throw std::logic_error("Duplicate Initial Value");
             }
-            lock->SetValue(devsig,value.get());
+            lock->SetValue(indices[index-1],value.get());
             Logger.Info << "Set the initial value " << devsig << "="
-                        << lock->GetValue(devsig) << std::endl;
+                        << lock->GetValue(indices[index-1]) << std::endl;
         }
     }
 }
@@ -30,7 +30,7 @@
 #include <sys/param.h>
 
 #include <boost/asio.hpp>
-#include <boost/system/system_error.hpp>
+#include <boost/bind.hpp>
 
 namespace freedm {
 namespace simulation {
@@ -48,13 +48,14 @@ BOOST_STATIC_ASSERT( sizeof( TSignalValue ) == 4 );
 /// Calls its base class constructors on the given arguments.
 /// @pre See IServer::IServer() and CAdapter::CAdapter().
 /// @post Initializes the IServer and CAdapter base classes.
+/// @param service The io_service that runs the server.
 /// @param port The port number to use for the server.
 /// @param tree The property tree specification of the adapter.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-CRtdsAdapter::CRtdsAdapter( unsigned short port,
-        const boost::property_tree::ptree & tree )
-    : IServer(port)
+CRtdsAdapter::CRtdsAdapter( boost::asio::io_service & service,
+        unsigned short port, const boost::property_tree::ptree & tree )
+    : IServer(service, port)
     , CAdapter(tree)
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
@@ -62,60 +63,116 @@ CRtdsAdapter::CRtdsAdapter( unsigned short port,
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Handles byte stream requests until the client disconnects.
+/// @pre None.
+/// @post Allocates the send and receive buffers of the connection.
+/// @param socket The accepted client connection.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::HandleConnection( TSocket socket )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    TSession session( new SSession );
+    
+    session->s_socket = socket;
+    session->s_command.resize(m_CommandDetails.size());
+    session->s_state.resize(m_StateDetails.size());
+    StartRead(session);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Waits for the next byte stream of commands from the client.
+/// @pre None.
+/// @post An asynchronous read of the commands is pending on the connection.
+/// @param session The buffers of the client connection.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::StartRead( TSession session )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    Logger.Info << "Waiting for client data." << std::endl;
+    boost::asio::async_read( *session->s_socket,
+            boost::asio::buffer(session->s_command),
+            boost::bind(&CRtdsAdapter::HandleRead, this, session,
+                    boost::asio::placeholders::error) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Updates the command table with the received commands, and responds with
+/// the current values of the state table.
+/// @Peers Acquires a unique write lock on the command table.
+/// @Peers Reads a snapshot of the state table without its mutex.
 /// @pre The machine running this code should be little endian.
-/// @post Allocates dynamic memory for a send and receive buffer.
+/// @post An asynchronous write of the states is pending on the connection.
+/// @param session The buffers of the client connection.
+/// @param error The io_service error code if the read failed.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-void CRtdsAdapter::HandleConnection()
+void CRtdsAdapter::HandleRead( TSession session,
+        const boost::system::error_code & error )
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    TSignalValue * recvBuffer = new TSignalValue[m_CommandDetails.size()];
-    TSignalValue * sendBuffer = new TSignalValue[m_StateDetails.size()];
-    std::size_t recvBytes = sizeof(TSignalValue) * m_CommandDetails.size();
-    std::size_t sendBytes = sizeof(TSignalValue) * m_StateDetails.size();
-    std::size_t recvSize = m_CommandDetails.size();
-    std::size_t sendSize = m_StateDetails.size();
-    CTableManager::TWriter writeLock;
-    CTableManager::TReader readLock;
+    std::vector<TSignalValue> & command = session->s_command;
+    std::vector<TSignalValue> & state = session->s_state;
     
-    try
+    if( error )
     {
-        while(true) // rtds lacks a proper exit condition
+        Logger.Info << "Client disconnected." << std::endl;
+        return;
+    }
+    
+    if( !command.empty() )
+    {
+        EndianSwapIfNeeded( (char *)&command[0],
+                sizeof(TSignalValue) * command.size() );
+        
+        Logger.Info << "Updating the command table." << std::endl;
+        CTableManager::TWriter writeLock =
+                CTableManager::AsWriter(COMMAND_TABLE);
+        for( std::size_t i = 0; i < command.size(); i++ )
         {
-            Logger.Info << "Waiting for client data." << std::endl;
-            boost::asio::read( m_socket,
-                    boost::asio::buffer(recvBuffer,recvBytes) );
-            EndianSwapIfNeeded( (char *)recvBuffer, recvBytes );
-            
-            Logger.Info << "Updating the command table." << std::endl;
-            writeLock = CTableManager::AsWriter(COMMAND_TABLE);
-            for( std::size_t i = 0; i < recvSize; i++ )
-            {
-                if( recvBuffer[i] != NULL_COMMAND )
-                    writeLock->SetValue(m_CommandDetails[i],recvBuffer[i]);
-            }
-            writeLock.reset();
-            
-            Logger.Info << "Reading the state table." << std::endl;
-            readLock = CTableManager::AsReader(STATE_TABLE);
-            for( std::size_t i = 0; i < sendSize; i++ )
-            {
-                sendBuffer[i] = readLock->GetValue(m_StateDetails[i]);
-            }
-            readLock.reset();
-            
-            Logger.Info << "Writing a response." << std::endl;
-            EndianSwapIfNeeded( (char *)sendBuffer, sendBytes );
-            boost::asio::write( m_socket,
-                    boost::asio::buffer(sendBuffer,sendBytes) );
+            if( command[i] != NULL_COMMAND )
+                writeLock->SetValue(m_CommandIndex[i],command[i]);
         }
     }
-    catch( boost::system::system_error & e )
+    
+    if( !state.empty() )
+    {
+        Logger.Info << "Reading the state table." << std::endl;
+        {
+            CTableManager::TSnapshot snapshot(
+                    CTableManager::AsSnapshot(STATE_TABLE));
+            snapshot.GetValues(m_StateIndex, &state[0]);
+        }
+        EndianSwapIfNeeded( (char *)&state[0],
+                sizeof(TSignalValue) * state.size() );
+    }
+    
+    Logger.Info << "Writing a response." << std::endl;
+    boost::asio::async_write( *session->s_socket, boost::asio::buffer(state),
+            boost::bind(&CRtdsAdapter::HandleWrite, this, session,
+                    boost::asio::placeholders::error) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Waits for the next commands once the states are written to the client.
+/// @pre None.
+/// @post Calls StartRead unless the client disconnected.
+/// @param session The buffers of the client connection.
+/// @param error The io_service error code if the write failed.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CRtdsAdapter::HandleWrite( TSession session,
+        const boost::system::error_code & error )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    if( error )
     {
         Logger.Info << "Client disconnected." << std::endl;
-        delete [] recvBuffer;
-        delete [] sendBuffer;
+        return;
     }
+    StartRead(session);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
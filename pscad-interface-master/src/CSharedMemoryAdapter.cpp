@@ -0,0 +1,236 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file         CSharedMemoryAdapter.cpp
+///
+/// @project      FREEDM DGI
+///
+/// @description  Adapter that shares device tables with a co-located DGI
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CSharedMemoryAdapter.hpp"
+#include "CTableManager.hpp"
+#include "DeviceTable.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+
+namespace freedm {
+namespace simulation {
+namespace adapter {
+
+namespace // unnamed
+{
+    /// local logger for this file
+    CLocalLogger Logger(__FILE__);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Creates the shared memory segment and schedules the first exchange.  The
+/// commands of the segment start as NULL_COMMAND so that the command table is
+/// not changed before the DGI writes its first commands.
+/// @ErrorHandling Throws a std::runtime_error if the segment cannot be created
+/// or mapped.
+/// @pre The segment name must start with a slash.
+/// @post The segment is created, initialized and mapped.
+/// @param service The io_service that runs the exchanges.
+/// @param segment The name of the shared memory segment.
+/// @param period The milliseconds between two exchanges.
+/// @param tree The property tree specification of the adapter.
+/// @limitations An existing segment with the same name is replaced.
+///////////////////////////////////////////////////////////////////////////////
+CSharedMemoryAdapter::CSharedMemoryAdapter( boost::asio::io_service & service,
+        const std::string & segment, unsigned int period,
+        const boost::property_tree::ptree & tree )
+    : CAdapter(tree)
+    , m_segment(segment)
+    , m_period(period)
+    , m_commandSequence(0)
+    , m_timer(service)
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    std::size_t states = m_StateDetails.size();
+    std::size_t commands = m_CommandDetails.size();
+    m_size = sizeof(SSharedHeader) + (states + commands) * sizeof(TSharedValue);
+    
+    int fd = shm_open(m_segment.c_str(), O_CREAT | O_RDWR, 0600);
+    if( fd == -1 || ftruncate(fd, m_size) == -1 )
+    {
+        std::string error = std::strerror(errno);
+        if( fd != -1 )
+        {
+            close(fd);
+        }
+        throw std::runtime_error("Failed to create " + m_segment + ": " + error);
+    }
+    
+    void * memory = mmap(0, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if( memory == MAP_FAILED )
+    {
+        throw std::runtime_error("Failed to map " + m_segment + ": "
+                + std::strerror(errno));
+    }
+    
+    m_header = static_cast<SSharedHeader *>(memory);
+    m_states = reinterpret_cast<TSharedValue *>(m_header + 1);
+    m_commands = m_states + states;
+    
+    m_header->s_magic = 0;
+    m_header->s_stateCount = states;
+    m_header->s_commandCount = commands;
+    m_header->s_stateSequence = 0;
+    m_header->s_commandSequence = 0;
+    std::fill(m_states, m_states + states, TSharedValue(NULL_COMMAND));
+    std::fill(m_commands, m_commands + commands, TSharedValue(NULL_COMMAND));
+    __sync_synchronize();
+    m_header->s_magic = SEGMENT_MAGIC;
+    
+    Logger.Status << "Opened shared memory segment " << m_segment << " with "
+                  << states << " states and " << commands << " commands."
+                  << std::endl;
+    
+    m_timer.expires_from_now(boost::posix_time::milliseconds(0));
+    m_timer.async_wait(boost::bind(&CSharedMemoryAdapter::Exchange, this,
+            boost::asio::placeholders::error));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Unmaps and removes the shared memory segment.
+/// @pre None.
+/// @post The segment no longer exists.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CSharedMemoryAdapter::~CSharedMemoryAdapter()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    m_timer.cancel();
+    munmap(m_header, m_size);
+    shm_unlink(m_segment.c_str());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Exchanges the tables with the segment, then schedules the next exchange
+/// one period after this one.
+/// @pre None.
+/// @post The command table holds the new commands of the segment.
+/// @post The segment holds the current states.
+/// @param error The io_service error code of the timer.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::Exchange( const boost::system::error_code & error )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    if( error )
+    {
+        return;
+    }
+    
+    ReadCommands();
+    WriteStates();
+    
+    m_timer.expires_at(m_timer.expires_at()
+            + boost::posix_time::milliseconds(m_period));
+    m_timer.async_wait(boost::bind(&CSharedMemoryAdapter::Exchange, this,
+            boost::asio::placeholders::error));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the commands of the segment into the command table if the DGI wrote
+/// them since the last exchange.  Commands caught in the middle of a write
+/// are left for the next exchange.
+/// @Peers Acquires a unique write lock on the command table.
+/// @pre None.
+/// @post The commands that are not NULL_COMMAND are in the command table.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::ReadCommands()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    boost::uint32_t sequence = m_header->s_commandSequence;
+    
+    if( sequence % 2 != 0 || sequence == m_commandSequence
+            || m_CommandDetails.empty() )
+    {
+        return;
+    }
+    
+    __sync_synchronize();
+    m_buffer.assign(m_commands, m_commands + m_CommandDetails.size());
+    __sync_synchronize();
+    
+    if( m_header->s_commandSequence != sequence )
+    {
+        Logger.Debug << "Commands changed while read, retry later." << std::endl;
+        return;
+    }
+    m_commandSequence = sequence;
+    
+    CTableManager::TWriter lock = CTableManager::AsWriter(COMMAND_TABLE);
+    for( std::size_t i = 0; i < m_buffer.size(); i++ )
+    {
+        if( m_buffer[i] != TSharedValue(NULL_COMMAND) )
+        {
+            lock->SetValue(m_CommandIndex[i], m_buffer[i]);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the state table into the segment.
+/// @Peers Reads a snapshot of the state table without its mutex.
+/// @pre None.
+/// @post The states of the segment are the published states of the table.
+/// @post The state sequence of the segment is advanced by two.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CSharedMemoryAdapter::WriteStates()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    if( m_StateDetails.empty() )
+    {
+        return;
+    }
+    
+    m_buffer.resize(m_StateDetails.size());
+    {
+        CTableManager::TSnapshot snapshot(
+                CTableManager::AsSnapshot(STATE_TABLE));
+        snapshot.GetValues(m_StateIndex, &m_buffer[0]);
+    }
+    
+    m_header->s_stateSequence = m_header->s_stateSequence + 1;
+    __sync_synchronize();
+    std::copy(m_buffer.begin(), m_buffer.end(), m_states);
+    __sync_synchronize();
+    m_header->s_stateSequence = m_header->s_stateSequence + 1;
+}
+
+} // namespace adapter
+} // namespace simulation
+} // namespace freedm
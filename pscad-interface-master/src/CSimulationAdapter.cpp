@@ -29,6 +29,8 @@
 #include <cstddef>
 
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
 
 namespace freedm {
 namespace simulation {
@@ -40,109 +42,277 @@ namespace // unnamed
     CLocalLogger Logger(__FILE__);
 }
 
+BOOST_STATIC_ASSERT( sizeof( float ) == 4 );
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Calls its base class constructors on the given arguments.
 /// @pre See IServer::IServer() and CAdapter::CAdapter().
 /// @post Initializes the IServer and CAdapter base classes.
+/// @param service The io_service that runs the server.
 /// @param port The port number to use for the server.
 /// @param tree The property tree specification of the adapter.
+/// @param float32 True to send the values as 4-byte floats.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-CSimulationAdapter::CSimulationAdapter( unsigned short port,
-        const boost::property_tree::ptree & tree )
-    : IServer(port)
+CSimulationAdapter::CSimulationAdapter( boost::asio::io_service & service,
+        unsigned short port, const boost::property_tree::ptree & tree,
+        bool float32 )
+    : IServer(service, port)
     , CAdapter(tree)
+    , m_float32(float32)
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Starts to read the packet header from an accepted client connection.
+/// @Peers Communicates through socket connection to the IServer client.
+/// @pre None.
+/// @post An asynchronous read of HEADER_SIZE bytes is pending on socket.
+/// @param socket The accepted client connection.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CSimulationAdapter::HandleConnection( TSocket socket )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    TSession session( new SSession );
+    session->s_socket = socket;
+    
+    Logger.Info << "Waiting for header from client." << std::endl;
+    boost::asio::async_read( *socket, boost::asio::buffer(session->s_header),
+            boost::bind(&CSimulationAdapter::HandleHeader, this, session,
+                    boost::asio::placeholders::error) );
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Reads the packet header and calls an appropriate message handler.
 /// @Peers Communicates through socket connection to the IServer client.
 /// @ErrorHandling If the header does not have a recognized callback, then the
 /// packet will be dropped with a warning message.  No exception is thrown.
 /// @pre The client must sent HEADER_SIZE bytes of data as a header.
-/// @pre The received header must be RST, SET, or GET.
-/// @post A private message handler is called based on the header.
+/// @pre The received header must be RST, SET, GET, XCH or STR.
+/// @post The payload is read, or the response written for GET.
+/// @param session The buffers of the client connection.
+/// @param error The io_service error code if the read failed.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-void CSimulationAdapter::HandleConnection()
+void CSimulationAdapter::HandleHeader( TSession session,
+        const boost::system::error_code & error )
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    char header[HEADER_SIZE];
-    
-    Logger.Info << "Waiting for header from client." << std::endl;
-    boost::asio::read( m_socket, boost::asio::buffer(header) );
-    Logger.Info << "Received the '" << header << "' header." << std::endl;
     
-    if( strcmp(header,"RST") == 0 )
+    if( error )
     {
-        SetSimulationState();
-        CTableManager::UpdateTable(COMMAND_TABLE,STATE_TABLE);
+        Logger.Warn << "Failed to read a header: " << error.message()
+                    << std::endl;
+        return;
     }
-    else if( strcmp(header,"SET") == 0 )
+    Logger.Info << "Received the '" << session->s_header << "' header."
+                << std::endl;
+    
+    if( strcmp(session->s_header,"RST") == 0
+            || strcmp(session->s_header,"SET") == 0
+            || strcmp(session->s_header,"XCH") == 0
+            || strcmp(session->s_header,"STR") == 0 )
     {
-        SetSimulationState();
+        StartPayload(session);
     }
-    else if( strcmp(header,"GET") == 0 )
+    else if( strcmp(session->s_header,"GET") == 0 )
     {
-        GetExternalCommand();
+        StartResponse(session);
     }
     else
     {
-        Logger.Warn << header << " is not a recognized header." << std::endl;
+        Logger.Warn << session->s_header << " is not a recognized header."
+                    << std::endl;
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Reads the packet payload and uses it to update the state table.
+/// Starts to read the payload of a packet, or the next payload of a stream.
 /// @Peers Communicates through socket connection to the IServer client.
-/// @Peers Acquires a unique write lock on the state table.
-/// @pre The client must send the amount of data specified in the XML file.
-/// @post A write lock is acquired on the state table.
-/// @post The state table is updated according to the XML specification.
+/// @pre None.
+/// @post An asynchronous read of the state payload is pending on the socket.
+/// @param session The buffers of the client connection.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-void CSimulationAdapter::SetSimulationState()
+void CSimulationAdapter::StartPayload( TSession session )
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    std::vector<TSignalValue> state(m_StateDetails.size());
     
     Logger.Info << "Waiting for payload from client." << std::endl;
-    boost::asio::read( m_socket, boost::asio::buffer(state) );
+    if( m_float32 )
+    {
+        session->s_payload32.resize(m_StateDetails.size());
+        boost::asio::async_read( *session->s_socket,
+                boost::asio::buffer(session->s_payload32),
+                boost::bind(&CSimulationAdapter::HandlePayload, this, session,
+                        boost::asio::placeholders::error) );
+        return;
+    }
+    session->s_payload.resize(m_StateDetails.size());
+    boost::asio::async_read( *session->s_socket,
+            boost::asio::buffer(session->s_payload),
+            boost::bind(&CSimulationAdapter::HandlePayload, this, session,
+                    boost::asio::placeholders::error) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Updates the tables with the payload of a packet, and responds with the
+/// command table if the packet is an exchange.
+/// @pre The header of session is RST, SET, XCH or STR.
+/// @post The state table is updated, and for RST the command table as well.
+/// @post For XCH and STR the command table is written to the client.
+/// @param session The buffers of the client connection.
+/// @param error The io_service error code if the read failed.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CSimulationAdapter::HandlePayload( TSession session,
+        const boost::system::error_code & error )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    if( error == boost::asio::error::eof
+            && strcmp(session->s_header,"STR") == 0 )
+    {
+        Logger.Info << "Client closed the stream." << std::endl;
+        return;
+    }
+    if( error )
+    {
+        Logger.Warn << "Failed to read a payload: " << error.message()
+                    << std::endl;
+        return;
+    }
     Logger.Info << "Received client payload." << std::endl;
     
-    CTableManager::TWriter lock = CTableManager::AsWriter(STATE_TABLE);
-    for( std::size_t i = 0, n = m_StateDetails.size(); i < n; i++ )
+    if( m_float32 )
+    {
+        SetSimulationState(session->s_payload32);
+    }
+    else
+    {
+        SetSimulationState(session->s_payload);
+    }
+    if( strcmp(session->s_header,"RST") == 0 )
+    {
+        CTableManager::UpdateTable(COMMAND_TABLE,STATE_TABLE);
+    }
+    else if( strcmp(session->s_header,"XCH") == 0
+            || strcmp(session->s_header,"STR") == 0 )
     {
-        lock->SetValue(m_StateDetails[i],state[i]);
-        Logger.Debug << m_StateDetails[i] << "=" << state[i] << std::endl;
+        StartResponse(session);
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Reads the command table and writes the content back to the client.
+/// Writes the content of the command table to the client.
 /// @Peers Communicates through socket connection to the IServer client.
-/// @Peers Acquires a shared read lock on the command table.
 /// @pre None.
-/// @post A read lock is acquired on the command table.
-/// @post Writes to the socket the information specified in the XML file.
+/// @post An asynchronous write of the commands is pending on the socket.
+/// @param session The buffers of the client connection.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-void CSimulationAdapter::GetExternalCommand()
+void CSimulationAdapter::StartResponse( TSession session )
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    std::vector<TSignalValue> command(m_CommandDetails.size());
     
-    CTableManager::TReader lock = CTableManager::AsReader(COMMAND_TABLE);
+    if( m_float32 )
+    {
+        GetExternalCommand(session->s_response32);
+        boost::asio::async_write( *session->s_socket,
+                boost::asio::buffer(session->s_response32),
+                boost::bind(&CSimulationAdapter::HandleResponse, this, session,
+                        boost::asio::placeholders::error) );
+        return;
+    }
+    GetExternalCommand(session->s_response);
+    boost::asio::async_write( *session->s_socket,
+            boost::asio::buffer(session->s_response),
+            boost::bind(&CSimulationAdapter::HandleResponse, this, session,
+                    boost::asio::placeholders::error) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Ends the packet once its response is written.  A stream waits for its next
+/// payload, while any other connection is closed.
+/// @pre None.
+/// @post The next payload of a stream is read, or the connection shut down.
+/// @param session The buffers of the client connection.
+/// @param error The io_service error code if the write failed.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CSimulationAdapter::HandleResponse( TSession session,
+        const boost::system::error_code & error )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
     
-    for( std::size_t i = 0, n = m_CommandDetails.size(); i < n; i++ )
+    if( error )
     {
-        command[i] = lock->GetValue(m_CommandDetails[i]);
-        Logger.Debug << "Retrieved " << m_CommandDetails[i] << std::endl;
+        Logger.Warn << "Failed to write a response: " << error.message()
+                    << std::endl;
+        return;
     }
-    boost::asio::write( m_socket, boost::asio::buffer(command) );
     Logger.Info << "Wrote response to client." << std::endl;
+    
+    if( strcmp(session->s_header,"STR") == 0 )
+    {
+        StartPayload(session);
+        return;
+    }
+    
+    boost::system::error_code ignored;
+    session->s_socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both,
+            ignored);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Uses the packet payload to update the state table.  The values are stored
+/// as they are copied, so a float32 payload needs no buffer of its own.
+/// @Peers Acquires a unique write lock on the state table.
+/// @pre state must hold one value per state in the XML specification.
+/// @post A write lock is acquired on the state table.
+/// @post The state table is updated according to the XML specification.
+/// @param state The payload of the packet.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <typename TValue>
+void CSimulationAdapter::SetSimulationState(
+        const std::vector<TValue> & state )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    if( state.empty() )
+    {
+        return;
+    }
+    CTableManager::TWriter lock = CTableManager::AsWriter(STATE_TABLE);
+    lock->SetValues(m_StateIndex, &state[0]);
+    Logger.Debug << "Updated " << state.size() << " states." << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reads the command table into the response for the client.
+/// @Peers Reads a snapshot of the command table without its mutex.
+/// @pre None.
+/// @post Reads the commands published by the last writer of the table.
+/// @post command holds the commands specified in the XML file.
+/// @param command The response of the packet.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <typename TValue>
+void CSimulationAdapter::GetExternalCommand( std::vector<TValue> & command )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    command.resize(m_CommandDetails.size());
+    
+    if( !command.empty() )
+    {
+        CTableManager::TSnapshot snapshot(
+                CTableManager::AsSnapshot(COMMAND_TABLE));
+        snapshot.GetValues(m_CommandIndex, &command[0]);
+    }
+    Logger.Debug << "Retrieved " << command.size() << " commands." << std::endl;
 }
 
 } // namespace adapter
@@ -61,20 +61,26 @@ CTableLock<TLock>::CTableLock( const SDeviceTable & table )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Inserts the passed device signal into the device table.
-/// @pre The non-const member function TLock::GetTable() must be defined.
-/// @post devsig is added to m_lock's device table with a default value of 0.
-/// If the device signal is already stored by the table, the call does nothing.
+/// @pre The non-const member function TLock::GetLayout() must be defined.
+/// @post devsig is given the next index of m_lock's device table, with a
+/// default value of NULL_COMMAND stamped with the version of m_lock.  If the
+/// device signal is already stored by the table, the call does nothing.
 /// @param devsig The device signal to add to the device table.
+/// @return The index of devsig in the device table.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 template <class TLock>
-void CTableLock<TLock>::InsertDeviceSignal( const CDeviceSignal & devsig )
+TSignalIndex CTableLock<TLock>::InsertDeviceSignal( const CDeviceSignal & devsig )
 {
     CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
     
-    if( m_lock.GetTable().insert(
-        TDeviceTable::value_type(devsig, NULL_COMMAND)).second )
+    std::pair<TTableLayout::iterator, bool> result = m_lock.GetLayout().insert(
+        TTableLayout::value_type(devsig, m_lock.GetTable().size()));
+    
+    if( result.second )
     {
+        m_lock.GetTable().push_back(NULL_COMMAND);
+        m_lock.GetVersions().push_back(m_lock.GetVersion());
         CTLLogger.Info << devsig << " inserted into the " << m_name
                        << " table." << std::endl;
     }
@@ -83,11 +89,12 @@ void CTableLock<TLock>::InsertDeviceSignal( const CDeviceSignal & devsig )
         CTLLogger.Info << devsig << " already exists in the " << m_name
                        << " table." << std::endl;
     }
+    return result.first->second;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Checks if a device signal exists in the device table.
-/// @pre The member function TLock::GetTable() must be defined.
+/// @pre The member function TLock::GetLayout() must be defined.
 /// @post Determines if devsig is stored in m_lock's device table.
 /// @param devsig The device signal to locate in the device table.
 /// @return True if devsig is stored by the device table, false otherwise.
@@ -97,26 +104,26 @@ template <class TLock>
 bool CTableLock<TLock>::DeviceSignalExists( const CDeviceSignal & devsig )
 {
     CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    return m_lock.GetTable().count(devsig) > 0;
+    return m_lock.GetLayout().count(devsig) > 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Gets the value of a device signal from the device table.
+/// Gets the index of a device signal in the device table.
 /// @ErrorHandling This call will throw a std::runtime_error if the device
 /// signal cannot be found in the device table.
-/// @pre The member function TLock::GetTable() must be defined.
-/// @post Retrieves the value associated with devsig from m_lock's table.
-/// @param devsig The device signal to retrieve from the device table.
-/// @return The value stored in the table for the device signal.
+/// @pre The member function TLock::GetLayout() must be defined.
+/// @post Finds devsig in the layout of m_lock's device table.
+/// @param devsig The device signal to locate in the device table.
+/// @return The index of the device signal in the device table.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 template <class TLock>
-TSignalValue CTableLock<TLock>::GetValue( const CDeviceSignal & devsig )
+TSignalIndex CTableLock<TLock>::GetIndex( const CDeviceSignal & devsig )
 {
     CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    TDeviceTable::const_iterator it = m_lock.GetTable().find(devsig);
+    TTableLayout::const_iterator it = m_lock.GetLayout().find(devsig);
     
-    if( it == m_lock.GetTable().end() )
+    if( it == m_lock.GetLayout().end() )
     {
         CTLLogger.Alert << "The " << m_name << " table does not store an entry"
                         << " for " << devsig << "." << std::endl;
@@ -125,6 +132,24 @@ TSignalValue CTableLock<TLock>::GetValue( const CDeviceSignal & devsig )
     return it->second;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Gets the value of a device signal from the device table.
+/// @ErrorHandling This call will throw a std::runtime_error if the device
+/// signal cannot be found in the device table.
+/// @pre The member functions TLock::GetLayout() and TLock::GetTable() must be
+/// defined.
+/// @post Retrieves the value associated with devsig from m_lock's table.
+/// @param devsig The device signal to retrieve from the device table.
+/// @return The value stored in the table for the device signal.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <class TLock>
+TSignalValue CTableLock<TLock>::GetValue( const CDeviceSignal & devsig )
+{
+    CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_lock.GetTable()[GetIndex(devsig)];
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Sets the value of a device signal in the device table.
 /// @ErrorHandling This call will throw a std::runtime_error if the device
@@ -140,15 +165,108 @@ void CTableLock<TLock>::SetValue( const CDeviceSignal & devsig,
         TSignalValue value )
 {
     CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    TDeviceTable::iterator it = m_lock.GetTable().find(devsig);
+    SetValue(GetIndex(devsig), value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Gets the value stored at an index of the device table.
+/// @ErrorHandling This call will throw a std::out_of_range if the index is not
+/// in the device table.
+/// @pre The member function TLock::GetTable() must be defined.
+/// @post Retrieves the value at index from m_lock's table.
+/// @param index The index of a device signal, as returned by GetIndex.
+/// @return The value stored in the table at the index.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <class TLock>
+TSignalValue CTableLock<TLock>::GetValue( TSignalIndex index )
+{
+    CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_lock.GetTable().at(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Sets the value stored at an index of the device table.
+/// @ErrorHandling This call will throw a std::out_of_range if the index is not
+/// in the device table.
+/// @pre The member TLock::GetTable() must return a non-const reference.
+/// @post Sets the value at index in m_lock's table.
+/// @post Stamps the entry with the version of m_lock.
+/// @param index The index of a device signal, as returned by GetIndex.
+/// @param value The value to set for the device signal.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <class TLock>
+void CTableLock<TLock>::SetValue( TSignalIndex index, TSignalValue value )
+{
+    CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    m_lock.GetTable().at(index) = value;
+    m_lock.GetVersions()[index] = m_lock.GetVersion();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the values stored at a set of indices into an array, converting
+/// each value to the type of the array.
+/// @ErrorHandling This call will throw a std::out_of_range if an index is not
+/// in the device table.
+/// @pre The member function TLock::GetTable() must be defined.
+/// @pre values must have room for one value per index.
+/// @post values[i] holds the value stored at indices[i].
+/// @param indices The indices of the device signals, as returned by GetIndex.
+/// @param values The array to store the values in.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <class TLock>
+template <class TValue>
+void CTableLock<TLock>::GetValues( const std::vector<TSignalIndex> & indices,
+        TValue * values )
+{
+    CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    const TDeviceTable & table = m_lock.GetTable();
     
-    if( it == m_lock.GetTable().end() )
+    if( !indices.empty() && *std::max_element(indices.begin(), indices.end())
+            >= table.size() )
     {
-        CTLLogger.Alert << "The " << m_name << " table does not store an entry"
-                        << " for " << devsig << "." << std::endl;
-        throw std::runtime_error("Device Signal Not Found");
+        throw std::out_of_range("Device Table Index");
+    }
+    for( std::size_t i = 0, n = indices.size(); i < n; i++ )
+    {
+        values[i] = static_cast<TValue>(table[indices[i]]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the values of an array into the device table at a set of indices.
+/// @ErrorHandling This call will throw a std::out_of_range if an index is not
+/// in the device table.
+/// @pre The member TLock::GetTable() must return a non-const reference.
+/// @pre values must hold one value per index.
+/// @post The value stored at indices[i] is values[i].
+/// @post Stamps the entries with the version of m_lock.
+/// @param indices The indices of the device signals, as returned by GetIndex.
+/// @param values The array of values to store.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+template <class TLock>
+template <class TValue>
+void CTableLock<TLock>::SetValues( const std::vector<TSignalIndex> & indices,
+        const TValue * values )
+{
+    CTLLogger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    TDeviceTable & table = m_lock.GetTable();
+    std::vector<TTableVersion> & versions = m_lock.GetVersions();
+    TTableVersion version = m_lock.GetVersion();
+    
+    if( !indices.empty() && *std::max_element(indices.begin(), indices.end())
+            >= table.size() )
+    {
+        throw std::out_of_range("Device Table Index");
+    }
+    for( std::size_t i = 0, n = indices.size(); i < n; i++ )
+    {
+        table[indices[i]] = values[i];
+        versions[indices[i]] = version;
     }
-    it->second = value;
 }
 
 } // namespace simulation
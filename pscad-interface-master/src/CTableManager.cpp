@@ -23,6 +23,8 @@
 #include "CTableManager.hpp"
 #include "CLogger.hpp"
 
+#include <algorithm>
+
 #include <boost/thread/locks.hpp>
 
 namespace freedm {
@@ -37,6 +39,9 @@ namespace // unnamed
 // define the static member variable of the table manager
 std::map<std::string,SDeviceTable> CTableManager::m_instance;
 boost::shared_mutex CTableManager::m_mutex;
+std::map<std::pair<std::string,std::string>,CTableManager::SSyncState>
+        CTableManager::m_sync;
+boost::mutex CTableManager::m_syncMutex;
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Provides a unique write lock to the table with the given identifier.
@@ -66,16 +71,36 @@ CTableManager::TReader CTableManager::AsReader( std::string identifier )
     return TReader( new TReadLock(GetInstance(identifier)) );
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Provides the table with the given identifier for the construction of a
+/// TSnapshot, which reads the table without its mutex.
+/// @pre None.
+/// @post Return a reference to the stored device table.
+/// @param identifier The name of the device table to read.
+/// @return Constant reference to the specified table.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+const SDeviceTable & CTableManager::AsSnapshot( std::string identifier )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return GetInstance(identifier);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// The update table function will make a source table consistent with a target
 /// table.  If an entry of the source table is also stored in the target table,
 /// then it will be set to its value in the target table.  If an entry is not
 /// in both tables, then its current value will be unmodified.
+/// 
+/// Only the entries written since the previous update of the same pair of
+/// tables are copied.  The shared entries are grouped into runs of consecutive
+/// indices, and each changed span of a run is copied as one block.
 /// @Peers This call will attempt to obtain a read lock on the target table,
 /// followed by a write lock on the source table.  It is impossible for this
-/// call to possess both locks at the same time.
+/// call to possess both locks at the same time.  Concurrent updates are
+/// serialized on m_syncMutex.
 /// @pre None.
-/// @post A read lock will be obtained on target to copy its device table.
+/// @post A read lock will be obtained on target to copy its changed entries.
 /// @post A write lock will be obtained on source as its values are updated.
 /// @param target The device table to update.
 /// @param source The device table to read from.
@@ -88,39 +113,180 @@ int CTableManager::UpdateTable( std::string target, std::string source )
     
     SDeviceTable & tar = GetInstance(target);
     SDeviceTable & src = GetInstance(source);
-    int sharedEntries = 0;
     
-    // copy the target table
-    TDeviceTable targetTable;
+    boost::lock_guard<boost::mutex> guard(m_syncMutex);
+    SSyncState & sync = m_sync[std::make_pair(target, source)];
+    CompileSync(sync, tar, src);
+    
+    // copy the spans of entries changed since the last update
+    std::vector<SSyncRun> spans;
+    TDeviceTable values;
     {
         CTableReadLock lock(src);
-        targetTable = lock.GetTable();
+        const TDeviceTable & table = lock.GetTable();
+        const std::vector<TTableVersion> & versions = lock.GetVersions();
+        std::vector<SSyncRun>::const_iterator it, end;
+        
+        for( it = sync.s_runs.begin(), end = sync.s_runs.end(); it != end; it++ )
+        {
+            std::size_t i = 0;
+            
+            while( i < it->s_count )
+            {
+                while( i < it->s_count && !sync.s_full
+                        && versions[it->s_source + i] <= sync.s_version )
+                {
+                    i++;
+                }
+                
+                SSyncRun span = { it->s_source + i, it->s_target + i, 0 };
+                while( i < it->s_count && ( sync.s_full
+                        || versions[it->s_source + i] > sync.s_version ) )
+                {
+                    span.s_count++;
+                    i++;
+                }
+                
+                if( span.s_count > 0 )
+                {
+                    values.insert(values.end(), table.begin() + span.s_source,
+                            table.begin() + span.s_source + span.s_count);
+                    spans.push_back(span);
+                }
+            }
+        }
+        sync.s_version = lock.GetVersion();
+        sync.s_full = false;
     }
     
-    // iterate over elements of the copy
-    TDeviceTable::const_iterator it, end;
-    TDeviceTable::iterator element;
-    CTableWriteLock lock(tar);
-    for( it = targetTable.begin(), end = targetTable.end(); it != end; it++ )
+    // write the changed spans into the target
+    if( !spans.empty() )
     {
-        element = lock.GetTable().find(it->first);
+        CTableWriteLock lock(tar);
+        TDeviceTable & table = lock.GetTable();
+        std::vector<TTableVersion> & versions = lock.GetVersions();
+        TDeviceTable::const_iterator value = values.begin();
+        std::vector<SSyncRun>::const_iterator it, end;
         
-        // update shared elements in source
-        if( element != lock.GetTable().end() )
+        for( it = spans.begin(), end = spans.end(); it != end; it++ )
         {
-            Logger.Info << it->first << " in " << target << " table has been"
-                        << " updated to " << it->second << "." << std::endl;
-            element->second = it->second;
-            sharedEntries++;
+            std::copy(value, value + it->s_count, table.begin() + it->s_target);
+            std::fill(versions.begin() + it->s_target,
+                    versions.begin() + it->s_target + it->s_count,
+                    lock.GetVersion());
+            value += it->s_count;
         }
     }
-    return sharedEntries;
+    
+    Logger.Info << "Updated " << values.size() << " of the " << sync.s_shared
+                << " entries the " << target << " table shares with the "
+                << source << " table." << std::endl;
+    return values.size();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Retrieves the instance with a given identifier from the instance map.
-/// @Peers This call can be blocked by other instances of the same call made in
-/// a concurrent thread.
+/// Computes the runs of entries shared by a source and a target table.  The
+/// runs are only computed again when one of the tables has grown since the
+/// last call, since the index of an entry never changes once assigned.
+/// @Peers This call obtains read locks on target and source, one at a time.
+/// @pre m_syncMutex must be held by the caller.
+/// @post sync.s_runs holds the entries shared by the current tables.
+/// @post sync.s_full is set if the runs were computed again.
+/// @param sync The update state of the pair of tables.
+/// @param target The device table that will be updated.
+/// @param source The device table that will be read from.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CTableManager::CompileSync( SSyncState & sync, const SDeviceTable & target,
+        const SDeviceTable & source )
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    TTableLayout targetLayout, sourceLayout;
+    std::size_t targetSize, sourceSize;
+    
+    {
+        CTableReadLock lock(target);
+        targetSize = lock.GetTable().size();
+        if( targetSize != sync.s_targetSize )
+        {
+            targetLayout = lock.GetLayout();
+        }
+    }
+    {
+        CTableReadLock lock(source);
+        sourceSize = lock.GetTable().size();
+        if( sourceSize != sync.s_sourceSize || targetSize != sync.s_targetSize )
+        {
+            sourceLayout = lock.GetLayout();
+        }
+    }
+    
+    if( sourceSize == sync.s_sourceSize && targetSize == sync.s_targetSize )
+    {
+        return;
+    }
+    if( targetLayout.empty() && targetSize > 0 )
+    {
+        CTableReadLock lock(target);
+        targetLayout = lock.GetLayout();
+        targetSize = lock.GetTable().size();
+    }
+    
+    // both layouts are sorted by device signal, so walk them side by side
+    std::vector<std::pair<TSignalIndex,TSignalIndex> > shared;
+    TTableLayout::const_iterator sit = sourceLayout.begin();
+    TTableLayout::const_iterator tit = targetLayout.begin();
+    
+    while( sit != sourceLayout.end() && tit != targetLayout.end() )
+    {
+        if( sit->first < tit->first )
+        {
+            sit++;
+        }
+        else if( tit->first < sit->first )
+        {
+            tit++;
+        }
+        else
+        {
+            shared.push_back(std::make_pair(sit->second, tit->second));
+            sit++;
+            tit++;
+        }
+    }
+    std::sort(shared.begin(), shared.end());
+    
+    sync.s_runs.clear();
+    for( std::size_t i = 0; i < shared.size(); i++ )
+    {
+        if( sync.s_runs.empty()
+                || sync.s_runs.back().s_source + sync.s_runs.back().s_count
+                        != shared[i].first
+                || sync.s_runs.back().s_target + sync.s_runs.back().s_count
+                        != shared[i].second )
+        {
+            SSyncRun run = { shared[i].first, shared[i].second, 0 };
+            sync.s_runs.push_back(run);
+        }
+        sync.s_runs.back().s_count++;
+    }
+    
+    Logger.Notice << "The " << target.s_name << " and " << source.s_name
+                  << " tables share " << shared.size() << " entries in "
+                  << sync.s_runs.size() << " runs." << std::endl;
+    
+    sync.s_shared = shared.size();
+    sync.s_sourceSize = sourceSize;
+    sync.s_targetSize = targetSize;
+    sync.s_full = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Retrieves the instance with a given identifier from the instance map.  The
+/// instance map is searched under a shared lock, and a unique lock is only
+/// taken to insert a table that does not exist yet.
+/// @Peers This call can be blocked by a concurrent call that inserts a table.
 /// @pre None.
 /// @post Inserts a new table instance if the identifier cannot be found.
 /// @param identifier The name of the table to retrieve from the instance map.
@@ -131,6 +297,16 @@ SDeviceTable & CTableManager::GetInstance( std::string identifier )
 {
     std::map<std::string,SDeviceTable>::iterator it;
     
+    {
+        boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+        it = m_instance.find(identifier);
+        
+        if( it != m_instance.end() )
+        {
+            return it->second;
+        }
+    }
+    
     boost::unique_lock<boost::shared_mutex> lock(m_mutex);
     it = m_instance.find(identifier);
     
@@ -141,6 +317,7 @@ SDeviceTable & CTableManager::GetInstance( std::string identifier )
         std::pair<std::string,SDeviceTable> value(identifier,SDeviceTable());
         SDeviceTable::TSharedMutex mutex( new boost::shared_mutex );
         value.second.s_mutex = mutex;
+        value.second.s_name = identifier;
         
         it = m_instance.insert(value).first;
     }
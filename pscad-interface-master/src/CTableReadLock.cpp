@@ -55,6 +55,19 @@ CTableReadLock::CTableReadLock( const SDeviceTable & table )
                 << " table." << std::endl;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the layout of the device table.
+/// @pre None.
+/// @post Returns a reference to m_table.s_layout.
+/// @return A constant reference to the index of each device signal.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+const TTableLayout & CTableReadLock::GetLayout() const
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_layout;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Accessor for the device table.
 /// @pre None.
@@ -68,6 +81,32 @@ const TDeviceTable & CTableReadLock::GetTable() const
     return m_table.s_instance;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the versions of the device table entries.
+/// @pre None.
+/// @post Returns a reference to m_table.s_versions.
+/// @return A constant reference to the version of the last write to each entry.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+const std::vector<TTableVersion> & CTableReadLock::GetVersions() const
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_versions;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the version of the device table.
+/// @pre None.
+/// @post Returns m_table.s_version.
+/// @return The version of the last write lock on the device table.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+TTableVersion CTableReadLock::GetVersion() const
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_version;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Releases the read lock acquired during construction.
 /// @Peers This call will allow a blocked thread to progress towards ownership
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file         CTableSnapshot.cpp
+///
+/// @author       Thomas Roth <tprfh7@mst.edu>
+///
+/// @project      FREEDM DGI
+///
+/// @description  Wait-free reader of the published values of device tables
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CTableSnapshot.hpp"
+#include "CLogger.hpp"
+
+#include <iostream>
+
+namespace freedm {
+namespace simulation {
+
+namespace // unnamed
+{
+    /// local logger for this file
+    CLocalLogger Logger(__FILE__);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Pins the buffer of the device table published last.  The reader count of
+/// the buffer is raised before the buffer is used, and the pin is retried if a
+/// writer published the other buffer in the meantime.
+/// @Peers A concurrent write lock can force a retry, but never blocks the call.
+/// @pre None.
+/// @post The reader count of the front buffer of table is incremented.
+/// @param table The device table to read.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CTableSnapshot::CTableSnapshot( const SDeviceTable & table )
+    : m_table(table)
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    while( true )
+    {
+        m_buffer = m_table.s_front;
+        __sync_fetch_and_add(&m_table.s_readers[m_buffer], 1);
+        
+        if( m_buffer == m_table.s_front )
+        {
+            break;
+        }
+        __sync_fetch_and_sub(&m_table.s_readers[m_buffer], 1);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the published values of the device table.
+/// @pre None.
+/// @post Returns a reference to the pinned buffer.
+/// @return A constant reference to the values of the last write lock.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+const TDeviceTable & CTableSnapshot::GetTable() const
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_published[m_buffer];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Unpins the buffer pinned during construction.
+/// @Peers This call will allow a waiting writer to reuse the buffer.
+/// @pre None.
+/// @post The reader count of the pinned buffer is decremented.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+CTableSnapshot::~CTableSnapshot()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    __sync_fetch_and_sub(&m_table.s_readers[m_buffer], 1);
+}
+
+} // namespace simulation
+} // namespace freedm
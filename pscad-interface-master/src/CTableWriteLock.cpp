@@ -25,6 +25,8 @@
 
 #include <iostream>
 
+#include <boost/thread/thread.hpp>
+
 namespace freedm {
 namespace simulation {
 
@@ -40,6 +42,7 @@ namespace // unnamed
 /// shared ownership of the device table.
 /// @pre None.
 /// @post A unique lock is acquired on the device table..
+/// @post The version of the device table is advanced.
 /// @param table The device table to be locked.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
@@ -51,10 +54,24 @@ CTableWriteLock::CTableWriteLock( SDeviceTable & table )
     Logger.Info << "Trying to acquire a unique lock on the "
                 << m_table.s_name << " table." << std::endl;
     m_table.s_mutex->lock();
+    m_table.s_version++;
     Logger.Info << "Acquired shared lock on the " << m_table.s_name
                 << " table." << std::endl;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the layout of the device table.
+/// @pre None.
+/// @post Returns a reference to m_table.s_layout.
+/// @return A reference to the index of each device signal.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+TTableLayout & CTableWriteLock::GetLayout()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_layout;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Accessor for the device table.
 /// @pre None.
@@ -68,11 +85,39 @@ TDeviceTable & CTableWriteLock::GetTable()
     return m_table.s_instance;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the versions of the device table entries.
+/// @pre None.
+/// @post Returns a reference to m_table.s_versions.
+/// @return A reference to the version of the last write to each entry.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<TTableVersion> & CTableWriteLock::GetVersions()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_versions;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Accessor for the version of the device table, which this lock advanced
+/// when it was acquired.
+/// @pre None.
+/// @post Returns m_table.s_version.
+/// @return The version to stamp the writes made under this lock with.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+TTableVersion CTableWriteLock::GetVersion() const
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    return m_table.s_version;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Releases the write lock acquired during construction.
 /// @Peers This call will allow a blocked thread to progress towards shared or
 /// unique ownership of the device table.
 /// @pre None.
+/// @post The device table is published to the snapshots.
 /// @post The unique lock on m_mutex is released.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
@@ -80,10 +125,36 @@ CTableWriteLock::~CTableWriteLock()
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
     
+    Publish();
     m_table.s_mutex->unlock();
     Logger.Info << "Released unique lock on the " << m_table.s_name
                 << " table." << std::endl;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Publishes the device table to the snapshots.  The table is copied into the
+/// buffer that was published before the current one, once the snapshots that
+/// still pin that buffer have released it, and then becomes the front buffer.
+/// @Peers This call waits for the snapshots of the back buffer to finish.
+/// @pre The unique lock on m_mutex must be held.
+/// @post m_table.s_published[m_table.s_front] is a copy of m_table.s_instance.
+/// @limitations None.
+///////////////////////////////////////////////////////////////////////////////
+void CTableWriteLock::Publish()
+{
+    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
+    
+    int back = 1 - m_table.s_front;
+    
+    while( m_table.s_readers[back] != 0 )
+    {
+        boost::this_thread::yield();
+    }
+    __sync_synchronize();
+    m_table.s_published[back] = m_table.s_instance;
+    __sync_synchronize();
+    m_table.s_front = back;
+}
+
 } // namespace simulation
 } // namespace freedm
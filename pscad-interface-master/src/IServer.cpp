@@ -23,6 +23,8 @@
 #include "IServer.hpp"
 #include "CLogger.hpp"
 
+#include <exception>
+
 #include <boost/bind.hpp>
 #include <boost/system/error_code.hpp>
 
@@ -39,13 +41,15 @@ namespace // unnamed
 /// Creates a new TCPv4 server that listens on a given port number.
 /// @pre The specified port number must be available to use.
 /// @post Initiates a TCPv4 server on the specified port number.
+/// @post Schedules the first client connection on the io_service.
+/// @param service The io_service that runs the server and its connections.
 /// @param port The port number to use for the TCP server.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-IServer::IServer( unsigned short port )
-    : m_acceptor(m_service)
-    , m_socket(m_service)
-    , m_id(port)
+IServer::IServer( boost::asio::io_service & service, unsigned short port )
+    : m_id(port)
+    , m_service(service)
+    , m_acceptor(service)
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
     
@@ -63,35 +67,27 @@ IServer::IServer( unsigned short port )
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Runs the io_service and blocks the current thread.
+/// Stops accepting new client connections.
 /// @pre None.
-/// @post Blocks the current thread until IServer::Stop() is called.
-/// @limitations None.
-///////////////////////////////////////////////////////////////////////////////
-void IServer::Run()
-{
-    Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    Logger.Status << "Blocking thread with io_service::run()." << std::endl;
-    m_service.run();
-}
-
-///////////////////////////////////////////////////////////////////////////////
-/// Stops the io_service and unblocks the current thread.
-/// @pre None.
-/// @post Interrupts the TCP server and unblocks the current thread.
-/// @limitations None.
+/// @post m_acceptor is closed and the pending accept is cancelled.
+/// @limitations The sessions of accepted clients continue until they end.
 ///////////////////////////////////////////////////////////////////////////////
 void IServer::Stop()
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
-    m_service.stop();
-    Logger.Status << "Thread unblocked with io_service::stop()." << std::endl;
+    
+    if( m_acceptor.is_open() )
+    {
+        m_acceptor.close();
+        Logger.Status << "Stopped the TCP server on port " << m_id << "."
+                      << std::endl;
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Closes both the acceptor and the socket prior to destruction.
+/// Closes the acceptor prior to destruction.
 /// @pre None.
-/// @post m_acceptor and m_socket are closed in that order.
+/// @post m_acceptor is closed.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 IServer::~IServer()
@@ -103,51 +99,63 @@ IServer::~IServer()
         Logger.Warn << "Closed the acceptor." << std::endl;
         m_acceptor.close();
     }
-    if( m_socket.is_open() )
-    {
-        Logger.Warn << "Closed an open client connection." << std::endl;
-        m_socket.close();
-    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Schedules the next client connection.
 /// @pre None.
-/// @post Closes the current client connection on m_socket.
+/// @post An asynchronous accept is pending on a new socket.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
 void IServer::StartAccept()
 {
     Logger.Trace << __PRETTY_FUNCTION__ << std::endl;
     
-    if( m_socket.is_open() )
-    {
-        Logger.Info << "Closed an open client connection." << std::endl;
-        m_socket.close();
-    }
-    m_acceptor.async_accept( m_socket, boost::bind( &IServer::HandleAccept,
-            this, boost::asio::placeholders::error) );
+    TSocket socket( new boost::asio::ip::tcp::socket(m_service) );
+    m_acceptor.async_accept( *socket, boost::bind( &IServer::HandleAccept,
+            this, socket, boost::asio::placeholders::error) );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Redirects an accepted client to the connection handler.
+/// @ErrorHandling Exceptions thrown while a session is started are logged and
+/// close the connection without stopping the server.
 /// @pre None.
-/// @post Schedules the next connection with IServer::StartAccept()
+/// @post Schedules the next connection with IServer::StartAccept() unless the
+/// acceptor was closed.
+/// @param socket The socket of the accepted client.
 /// @param error The io_service error code if the connection failed.
 /// @limitations None.
 ///////////////////////////////////////////////////////////////////////////////
-void IServer::HandleAccept( const boost::system::error_code & error )
+void IServer::HandleAccept( TSocket socket,
+        const boost::system::error_code & error )
 {
+    if( error == boost::asio::error::operation_aborted )
+    {
+        Logger.Info << "Stopped accepting client connections." << std::endl;
+        return;
+    }
+    
+    // accept the next client before this one is handled
+    StartAccept();
+    
     if( !error )
     {
         Logger.Info << "Accepted a new client connection." << std::endl;
-        HandleConnection();
+        try
+        {
+            HandleConnection(socket);
+        }
+        catch( std::exception & e )
+        {
+            Logger.Warn << "Dropped a client connection: " << e.what()
+                        << std::endl;
+        }
     }
     else
     {
         Logger.Warn << "Failed to accept a client connection" << std::endl;
     }
-    StartAccept();
 }
 
 } // namespace simulation
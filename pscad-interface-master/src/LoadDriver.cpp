@@ -0,0 +1,403 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file         LoadDriver.cpp
+///
+/// @project      FREEDM Simulation Server
+///
+/// @description  Emulates PSCAD and RTDS clients to load the simulation server
+///
+/// These source code files were created at Missouri University of Science and
+/// Technology, and are intended for use in teaching or research. They may be
+/// freely copied, modified, and redistributed as long as modified versions are
+/// clearly marked as such and this notice is not removed. Neither the authors
+/// nor Missouri S&T make any warranty, express or implied, nor assume any legal
+/// responsibility for the accuracy, completeness, or usefulness of these files
+/// or any information distributed with these files.
+///
+/// Suggested modifications or questions about these files can be directed to
+/// Dr. Bruce McMillin, Department of Computer Science, Missouri University of
+/// Science and Technology, Rolla, MO 65409 <ff@mst.edu>.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+using boost::asio::ip::tcp;
+
+namespace // unnamed
+{
+    /// header size in bytes of the simulation packet
+    const std::size_t HEADER_SIZE = 5;
+
+    /// the settings shared by every emulated client
+    struct SOptions
+    {
+        /// host of the simulation server
+        std::string host;
+        /// port of the simulation adapter
+        unsigned short simPort;
+        /// port of the rtds adapter
+        unsigned short rtdsPort;
+        /// states sent by the simulation and read by the rtds clients
+        unsigned int states;
+        /// commands sent by the rtds and read by the simulation clients
+        unsigned int commands;
+        /// steps per second of each client, or 0 for as fast as possible
+        double rate;
+        /// seconds each client runs for
+        double duration;
+        /// setget, exchange or stream
+        std::string mode;
+        /// set if the simulation adapter uses the float32 encoding
+        bool float32;
+        /// the time every client starts at
+        pt::ptime start;
+    };
+
+    /// the steps completed by one client
+    struct SResult
+    {
+        /// the latency of each step in microseconds
+        std::vector<double> latency;
+        /// the steps that failed
+        unsigned long failures;
+    };
+
+    /// writes a packet header padded with null bytes
+    void WriteHeader( tcp::socket & socket, const char * header )
+    {
+        char buffer[HEADER_SIZE];
+        std::memset(buffer, 0, HEADER_SIZE);
+        std::strncpy(buffer, header, HEADER_SIZE - 1);
+        boost::asio::write(socket, boost::asio::buffer(buffer));
+    }
+
+    /// waits for the server to close a connection
+    void WaitForClose( tcp::socket & socket )
+    {
+        char buffer[64];
+        boost::system::error_code error;
+        while( !error )
+        {
+            socket.read_some(boost::asio::buffer(buffer), error);
+        }
+        if( error != boost::asio::error::eof )
+        {
+            throw boost::system::system_error(error);
+        }
+    }
+
+    /// one step of a simulation client in the encoding TValue
+    template <typename TValue>
+    void SimulationStep( boost::asio::io_service & service,
+            const tcp::endpoint & endpoint, const SOptions & options,
+            boost::shared_ptr<tcp::socket> & stream, unsigned long step )
+    {
+        std::vector<TValue> payload(options.states, TValue(step));
+        std::vector<TValue> response(options.commands);
+
+        if( options.mode == "stream" )
+        {
+            if( !stream )
+            {
+                stream.reset(new tcp::socket(service));
+                stream->connect(endpoint);
+                stream->set_option(tcp::no_delay(true));
+                WriteHeader(*stream, "STR");
+            }
+            boost::asio::write(*stream, boost::asio::buffer(payload));
+            boost::asio::read(*stream, boost::asio::buffer(response));
+        }
+        else if( options.mode == "exchange" )
+        {
+            tcp::socket socket(service);
+            socket.connect(endpoint);
+            WriteHeader(socket, "XCH");
+            boost::asio::write(socket, boost::asio::buffer(payload));
+            boost::asio::read(socket, boost::asio::buffer(response));
+        }
+        else
+        {
+            // the pscad_send and pscad_recv components connect separately
+            tcp::socket set(service);
+            set.connect(endpoint);
+            WriteHeader(set, "SET");
+            boost::asio::write(set, boost::asio::buffer(payload));
+            WaitForClose(set);
+
+            tcp::socket get(service);
+            get.connect(endpoint);
+            WriteHeader(get, "GET");
+            boost::asio::read(get, boost::asio::buffer(response));
+        }
+    }
+
+    /// one step of an rtds client, in big-endian floats
+    void RtdsStep( boost::asio::io_service & service,
+            const tcp::endpoint & endpoint, const SOptions & options,
+            boost::shared_ptr<tcp::socket> & stream, unsigned long step )
+    {
+        std::vector<boost::uint32_t> command(options.commands);
+        std::vector<boost::uint32_t> state(options.states);
+        float value = float(step);
+        boost::uint32_t word;
+
+        std::memcpy(&word, &value, sizeof(word));
+        std::fill(command.begin(), command.end(), htonl(word));
+
+        if( !stream )
+        {
+            stream.reset(new tcp::socket(service));
+            stream->connect(endpoint);
+            stream->set_option(tcp::no_delay(true));
+        }
+        boost::asio::write(*stream, boost::asio::buffer(command));
+        boost::asio::read(*stream, boost::asio::buffer(state));
+    }
+
+    /// runs the steps of one client until its duration ends
+    void RunClient( const SOptions & options, bool rtds, SResult & result )
+    {
+        boost::asio::io_service service;
+        tcp::resolver resolver(service);
+        tcp::resolver::query query(options.host, boost::lexical_cast<
+                std::string>(rtds ? options.rtdsPort : options.simPort));
+        tcp::endpoint endpoint = *resolver.resolve(query);
+        boost::shared_ptr<tcp::socket> stream;
+
+        pt::ptime end = options.start
+                + pt::microseconds(long(options.duration * 1e6));
+        pt::time_duration period = options.rate > 0
+                ? pt::microseconds(long(1e6 / options.rate))
+                : pt::microseconds(0);
+
+        result.failures = 0;
+        for( unsigned long step = 1; ; step++ )
+        {
+            pt::ptime slot = options.start + period * int(step - 1);
+            pt::ptime now = pt::microsec_clock::universal_time();
+
+            if( slot > now )
+            {
+                boost::this_thread::sleep(slot - now);
+            }
+            pt::ptime before = pt::microsec_clock::universal_time();
+            if( before >= end )
+            {
+                break;
+            }
+
+            try
+            {
+                if( rtds )
+                {
+                    RtdsStep(service, endpoint, options, stream, step);
+                }
+                else if( options.float32 )
+                {
+                    SimulationStep<float>(service, endpoint, options, stream,
+                            step);
+                }
+                else
+                {
+                    SimulationStep<double>(service, endpoint, options, stream,
+                            step);
+                }
+                result.latency.push_back((pt::microsec_clock::universal_time()
+                        - before).total_microseconds());
+            }
+            catch( std::exception & e )
+            {
+                if( result.failures++ == 0 )
+                {
+                    std::cerr << "Step failed: " << e.what() << std::endl;
+                }
+                stream.reset();
+                boost::this_thread::sleep(pt::milliseconds(10));
+            }
+        }
+    }
+
+    /// gets a percentile of sorted latencies
+    double Percentile( const std::vector<double> & sorted, double p )
+    {
+        if( sorted.empty() )
+        {
+            return 0;
+        }
+        std::size_t i = std::size_t(p * (sorted.size() - 1) + 0.5);
+        return sorted[i];
+    }
+
+    /// prints the combined results of a kind of client
+    void Report( const std::string & name, const std::vector<SResult> & results,
+            double seconds )
+    {
+        std::vector<double> latency;
+        unsigned long failures = 0;
+
+        for( std::size_t i = 0; i < results.size(); i++ )
+        {
+            latency.insert(latency.end(), results[i].latency.begin(),
+                    results[i].latency.end());
+            failures += results[i].failures;
+        }
+        if( results.empty() )
+        {
+            return;
+        }
+        std::sort(latency.begin(), latency.end());
+
+        std::cout << std::left << std::setw(12) << name << std::right
+                  << std::setw(8) << results.size()
+                  << std::setw(10) << latency.size()
+                  << std::setw(10) << failures
+                  << std::setw(12) << std::fixed << std::setprecision(1)
+                  << latency.size() / seconds
+                  << std::setw(10) << Percentile(latency, 0.5)
+                  << std::setw(10) << Percentile(latency, 0.99)
+                  << std::setw(10) << (latency.empty() ? 0 : latency.back())
+                  << std::endl;
+    }
+
+    /// writes the entries of one table of an adapter
+    void WriteEntries( std::ostream & out, const std::string & tag,
+            unsigned int count )
+    {
+        out << "        <" << tag << ">\n";
+        for( unsigned int i = 0; i < count; i++ )
+        {
+            out << "            <entry index=\"" << i + 1 << "\">\n"
+                << "                <device>LOAD" << i + 1 << "</device>\n"
+                << "                <signal>" << tag << "</signal>\n"
+                << "                <value>0</value>\n"
+                << "            </entry>\n";
+        }
+        out << "        </" << tag << ">\n";
+    }
+
+    /// writes a server specification that matches the options
+    void WriteXml( const std::string & filename, const SOptions & options )
+    {
+        std::ofstream out(filename.c_str());
+        if( !out )
+        {
+            throw std::runtime_error("Failed to open " + filename);
+        }
+
+        out << "<?xml version=\"1.0\" encoding=\"us-ascii\" ?>\n<root>\n"
+            << "    <adapter type=\"simulation\" port=\"" << options.simPort
+            << "\" encoding=\"" << (options.float32 ? "float32" : "float64")
+            << "\">\n";
+        WriteEntries(out, "state", options.states);
+        WriteEntries(out, "command", options.commands);
+        out << "    </adapter>\n"
+            << "    <adapter type=\"rtds\" port=\"" << options.rtdsPort
+            << "\">\n";
+        WriteEntries(out, "state", options.states);
+        WriteEntries(out, "command", options.commands);
+        out << "    </adapter>\n</root>\n";
+    }
+}
+
+int main( int argc, char * argv[] )
+{
+    po::options_description options("Load Driver Options");
+    po::variables_map vmap;
+    SOptions settings;
+    unsigned int simClients, rtdsClients;
+    std::string xmlFilename;
+
+    options.add_options()
+        ( "help,h", "print usage help (this screen)" )
+        ( "host", po::value<std::string>(&settings.host)->
+                default_value("localhost"), "host of the simulation server" )
+        ( "sim-port", po::value<unsigned short>(&settings.simPort)->
+                default_value(5000), "port of the simulation adapter" )
+        ( "rtds-port", po::value<unsigned short>(&settings.rtdsPort)->
+                default_value(5001), "port of the rtds adapter" )
+        ( "states", po::value<unsigned int>(&settings.states)->
+                default_value(60), "states of each adapter" )
+        ( "commands", po::value<unsigned int>(&settings.commands)->
+                default_value(60), "commands of each adapter" )
+        ( "sim-clients", po::value<unsigned int>(&simClients)->
+                default_value(1), "emulated PSCAD simulations" )
+        ( "rtds-clients", po::value<unsigned int>(&rtdsClients)->
+                default_value(4), "emulated DGI rtds adapters" )
+        ( "rate", po::value<double>(&settings.rate)->default_value(0),
+                "steps per second of each client, 0 for as fast as possible" )
+        ( "duration", po::value<double>(&settings.duration)->
+                default_value(10), "seconds to run the clients for" )
+        ( "mode", po::value<std::string>(&settings.mode)->
+                default_value("setget"),
+                "simulation packets: setget, exchange or stream" )
+        ( "float32", po::bool_switch(&settings.float32),
+                "the simulation adapter uses the float32 encoding" )
+        ( "generate", po::value<std::string>(&xmlFilename),
+                "write a server XML for these options and exit" )
+        ;
+
+    po::store( po::parse_command_line(argc, argv, options), vmap );
+    po::notify(vmap);
+
+    if( vmap.count("help") > 0 )
+    {
+        std::cout << options << std::endl;
+        return 0;
+    }
+    if( settings.mode != "setget" && settings.mode != "exchange"
+            && settings.mode != "stream" )
+    {
+        std::cerr << "Unknown mode " << settings.mode << std::endl;
+        return -1;
+    }
+    if( vmap.count("generate") > 0 )
+    {
+        WriteXml(xmlFilename, settings);
+        return 0;
+    }
+
+    std::vector<SResult> simResults(simClients), rtdsResults(rtdsClients);
+    boost::thread_group threads;
+
+    settings.start = pt::microsec_clock::universal_time()
+            + pt::milliseconds(100);
+    for( unsigned int i = 0; i < simClients; i++ )
+    {
+        threads.create_thread(boost::bind(&RunClient, boost::cref(settings),
+                false, boost::ref(simResults[i])));
+    }
+    for( unsigned int i = 0; i < rtdsClients; i++ )
+    {
+        threads.create_thread(boost::bind(&RunClient, boost::cref(settings),
+                true, boost::ref(rtdsResults[i])));
+    }
+    threads.join_all();
+
+    std::cout << std::left << std::setw(12) << "client" << std::right
+              << std::setw(8) << "count" << std::setw(10) << "steps"
+              << std::setw(10) << "failed" << std::setw(12) << "steps/s"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+              << std::setw(10) << "max us" << std::endl;
+    Report(settings.mode, simResults, settings.duration);
+    Report("rtds", rtdsResults, settings.duration);
+    return 0;
+}
@@ -24,18 +24,22 @@
 #include "IServer.hpp"
 #include "CRtdsAdapter.hpp"
 #include "CSimulationAdapter.hpp"
+#include "CSharedMemoryAdapter.hpp"
 
 #include <set>
 #include <list>
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <exception>
 #include <stdexcept>
 
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
-#include <boost/make_shared.hpp>
 #include <boost/program_options.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -43,10 +47,18 @@
 using namespace freedm::simulation;
 namespace po = boost::program_options;
 
-void ReadXML( std::string xml, std::list< boost::shared_ptr<IServer> > & list )
+namespace // unnamed
+{
+    /// local logger for this file
+    freedm::CLocalLogger Logger(__FILE__);
+}
+
+void ReadXML( std::string xml, boost::asio::io_service & service,
+        std::list< boost::shared_ptr<adapter::CAdapter> > & list )
 {
     using boost::property_tree::ptree;
     std::set<unsigned short> portset;
+    std::set<std::string> segmentset;
     unsigned short port;
     std::string type;
     ptree tree;
@@ -56,21 +68,49 @@ void ReadXML( std::string xml, std::list< boost::shared_ptr<IServer> > & list )
     BOOST_FOREACH( ptree::value_type & child, tree.get_child("root") )
     {    
         type = child.second.get<std::string>("<xmlattr>.type");
+        boost::shared_ptr<adapter::CAdapter> adapter;
+        
+        if( type == "shm" )
+        {
+            std::string segment =
+                    child.second.get<std::string>("<xmlattr>.segment");
+            unsigned int period =
+                    child.second.get<unsigned int>("<xmlattr>.period", 1);
+            
+            if( segmentset.insert(segment).second == false )
+            {
+                throw std::logic_error("Duplicate Segment Name");
+            }
+            adapter.reset( new adapter::CSharedMemoryAdapter(service,segment,
+                    period,child.second) );
+            list.push_back(adapter);
+            continue;
+        }
+        
         port = child.second.get<unsigned short>("<xmlattr>.port");
         
         if( portset.insert(port).second == false )
         {
             throw std::logic_error("Duplicate Port Number");
         }
-        boost::shared_ptr<IServer> adapter;
         
         if( type == "rtds" )
         {
-            adapter.reset( new adapter::CRtdsAdapter(port,child.second) );
+            adapter.reset( new adapter::CRtdsAdapter(service,port,
+                    child.second) );
         }
         else if( type == "simulation" )
         {
-            adapter.reset( new adapter::CSimulationAdapter(port,child.second) );
+            std::string encoding =
+                    child.second.get<std::string>("<xmlattr>.encoding",
+                            "float64");
+            
+            if( encoding != "float64" && encoding != "float32" )
+            {
+                throw std::logic_error("Unknown Adapter Encoding");
+            }
+            adapter.reset( new adapter::CSimulationAdapter(service,port,
+                    child.second,encoding == "float32") );
         }
         else
         {
@@ -81,6 +121,23 @@ void ReadXML( std::string xml, std::list< boost::shared_ptr<IServer> > & list )
     }
 }
 
+void RunService( boost::asio::io_service & service )
+{
+    while(true)
+    {
+        try
+        {
+            service.run();
+            break;
+        }
+        catch( std::exception & e )
+        {
+            Logger.Error << "Dropped a client connection: " << e.what()
+                         << std::endl;
+        }
+    }
+}
+
 int main( int argc, char * argv[] )
 {
     po::options_description cmdlineOptions("Command Line Options");
@@ -88,13 +145,13 @@ int main( int argc, char * argv[] )
     po::options_description visibleOptions;
     po::variables_map vmap;
     
-    std::list< boost::shared_ptr<IServer> > adapterList;
-    std::list< boost::shared_ptr<boost::thread> > threadList;
-    std::list< boost::shared_ptr<IServer> >::iterator it, end;
+    std::list< boost::shared_ptr<adapter::CAdapter> > adapterList;
+    boost::asio::io_service service;
+    boost::thread_group threadPool;
     
     std::ifstream configFile;
     std::string configFilename, xmlFilename, loggerFilename;
-    unsigned int outputLevel;
+    unsigned int outputLevel, threadCount;
     
     cmdlineOptions.add_options()
         ( "help,h", "print usage help (this screen)" )
@@ -112,6 +169,8 @@ int main( int argc, char * argv[] )
                 "filename for the logger configuration file" )
         ( "verbose,v", po::value<unsigned int>(&outputLevel)->default_value(3),
                 "default level of logger output, 0 (Fatal) to 8 (Trace)" )
+        ( "threads,t", po::value<unsigned int>(&threadCount)->default_value(4),
+                "number of threads that serve the client connections" )
         ;
     
     visibleOptions.add(cmdlineOptions).add(generalOptions);
@@ -142,12 +201,12 @@ int main( int argc, char * argv[] )
     
     freedm::CGlobalLogger::instance().SetGlobalLevel(outputLevel);
     freedm::CGlobalLogger::instance().SetInitialLoggerLevels(loggerFilename);
-    ReadXML( xmlFilename, adapterList );
+    ReadXML( xmlFilename, service, adapterList );
     
-    for( it = adapterList.begin(), end = adapterList.end(); it != end; it++ )
+    for( unsigned int i = 0; i < std::max(threadCount, 1u); i++ )
     {
-        threadList.push_back(boost::make_shared<boost::thread>(
-                &IServer::Run, *it));
+        threadPool.create_thread(boost::bind(&RunService,
+                boost::ref(service)));
     }
-    while(true);
+    threadPool.join_all();
 }